@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define NOMINMAX
+#include <Windows.h>
+
+#include "common/mutation.hpp"
+#include "common/sl2_rng.hpp"
+
+// mutation_bench times the mutation engine on its own, outside of DR: every strategy
+// only draws from an sl2_rng, so it links common/mutation.cpp as-is. Each case mutates the same
+// buffer over and over, so that what's measured is the strategy's own cost (and not the cost of
+// refilling the buffer).
+
+/*! The name of each entry in SL2_STRATEGY_TABLE, in order. */
+static const char *SL2_BENCH_STRATEGIES[] = {
+    "strategyFlipBit",          "strategyRandValues",
+    "strategyRepeatBytes",      "strategyRepeatBytesBackwards",
+    "strategyKnownValues",      "strategyAddSubKnownValues",
+    "strategyEndianSwap",       "strategyDeleteBytes",
+    "strategyDeleteBytesAscii", "strategyDictionary",
+    "strategyInputToState",     "strategyTokenNumber",
+    "strategyTokenLength",
+};
+
+static_assert(sizeof(SL2_BENCH_STRATEGIES) / sizeof(SL2_BENCH_STRATEGIES[0]) == SL2_NUM_STRATEGIES,
+              "SL2_BENCH_STRATEGIES must name every entry in SL2_STRATEGY_TABLE");
+
+/*! The name of each entry in SL2_RESIZE_STRATEGY_TABLE, in order. */
+static const char *SL2_BENCH_RESIZE_STRATEGIES[] = {
+    "strategyInsertBytes", "strategyDeleteShiftBytes", "strategySpliceBytes",
+    "strategyTruncate",    "strategyInsertToken",      "strategyTokenDuplicate",
+    "strategyTokenDelete", "strategyTokenResize",
+};
+
+static_assert(sizeof(SL2_BENCH_RESIZE_STRATEGIES) / sizeof(SL2_BENCH_RESIZE_STRATEGIES[0]) ==
+                  SL2_NUM_RESIZE_STRATEGIES,
+              "SL2_BENCH_RESIZE_STRATEGIES must name every entry in SL2_RESIZE_STRATEGY_TABLE");
+
+/*! The smallest and largest buffers that are benchmarked by default, in bytes. */
+#define SL2_BENCH_MIN_SIZE 1
+#define SL2_BENCH_MAX_SIZE (16 * 1024 * 1024)
+
+/*! The benchmark's options. */
+struct sl2_bench_opts {
+  /*! The smallest and largest buffer sizes, in bytes; each size is `step` times the last */
+  size_t min_size;
+  size_t max_size;
+  size_t step;
+  /*! How long each case runs for, at least, in milliseconds */
+  int min_time_ms;
+  /*! Only cases whose names contain this are run (NULL for all) */
+  const char *filter;
+  /*! Whether to print JSON instead of a table */
+  bool json;
+};
+
+static sl2_bench_opts opts = {SL2_BENCH_MIN_SIZE, SL2_BENCH_MAX_SIZE, 16, 200, NULL, false};
+
+/*! A single case's timing. */
+struct sl2_bench_result {
+  std::string name;
+  size_t size;
+  uint64_t iterations;
+  double ns_per_mutation;
+  double bytes_per_second;
+};
+
+static LARGE_INTEGER frequency;
+
+/*! Folds in a byte of every mutated buffer, so that the compiler can't drop the mutations. */
+static volatile uint8_t sink;
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-s <min size>] [-S <max size>] [-x <step>] [-t <min time ms>]\n",
+          argv0);
+  fprintf(stderr, "       [-f <filter>] [-j]\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Times every mutation strategy, and do_mutation and do_mutation_havoc, on\n");
+  fprintf(stderr, "buffers from <min size> (default 1) to <max size> (default 16MB) bytes, each\n");
+  fprintf(stderr, "<step> (default 16) times the last. Each case runs for at least <min time ms>\n");
+  fprintf(stderr, "(default 200) milliseconds. Only cases whose names contain <filter> are run.\n");
+  fprintf(stderr, "Reports ns/mutation and bytes/sec, as a table or (with -j) as JSON in Google\n");
+  fprintf(stderr, "Benchmark's format, so that builds can be compared with its tools.\n");
+}
+
+/**
+ * Times a single case, doubling the number of mutations until they take at least
+ * `opts.min_time_ms`.
+ * @param name the case's name
+ * @param size the buffer's size
+ * @param mutate mutates the buffer once
+ * @return the case's timing
+ */
+template <typename Mutate>
+static sl2_bench_result run_case(const std::string &name, size_t size, Mutate mutate) {
+  LARGE_INTEGER start, end;
+  uint64_t iterations = 1;
+  double elapsed = 0;
+
+  for (;;) {
+    QueryPerformanceCounter(&start);
+
+    for (uint64_t i = 0; i < iterations; ++i) {
+      mutate();
+    }
+
+    QueryPerformanceCounter(&end);
+    elapsed = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+    if (elapsed * 1000 >= opts.min_time_ms || iterations >= (1ULL << 40)) {
+      break;
+    }
+
+    // Aim a little past the target, rather than doubling blindly into a case that's almost done.
+    double scale = elapsed > 0 ? (opts.min_time_ms / 1000.0) * 1.2 / elapsed : 10;
+    iterations = (uint64_t)(iterations * std::min(std::max(scale, 2.0), 10.0));
+  }
+
+  return {name, size, iterations, elapsed * 1e9 / iterations, size * iterations / elapsed};
+}
+
+/**
+ * @param name a case's name
+ * @return whether the case should be run
+ */
+static bool selected(const std::string &name) {
+  return opts.filter == NULL || name.find(opts.filter) != std::string::npos;
+}
+
+/**
+ * Runs every case on a buffer of the given size.
+ * @param size the buffer's size
+ * @param results receives each case's timing
+ */
+static void run_size(size_t size, std::vector<sl2_bench_result> &results) {
+  // Resize strategies can grow the buffer up to its capacity, so it gets twice the room.
+  std::vector<uint8_t> buffer(size * 2);
+  sl2_rng rng;
+  std::string suffix = "/" + std::to_string(size);
+
+  sl2_rng_seed(&rng, 0x5EED);
+  for (uint8_t &byte : buffer) {
+    byte = (uint8_t)sl2_rng_next(&rng);
+  }
+
+  for (int i = 0; i < SL2_NUM_STRATEGIES; ++i) {
+    std::string name = SL2_BENCH_STRATEGIES[i] + suffix;
+
+    if (selected(name)) {
+      results.push_back(run_case(name, size, [&] {
+        SL2_STRATEGY_TABLE[i](&rng, buffer.data(), size);
+        sink ^= buffer[0];
+      }));
+    }
+  }
+
+  for (int i = 0; i < SL2_NUM_RESIZE_STRATEGIES; ++i) {
+    std::string name = SL2_BENCH_RESIZE_STRATEGIES[i] + suffix;
+
+    if (selected(name)) {
+      results.push_back(run_case(name, size, [&] {
+        sink ^= (uint8_t)SL2_RESIZE_STRATEGY_TABLE[i](&rng, buffer.data(), size, buffer.size());
+      }));
+    }
+  }
+
+  sl2_mutation mutation = {0};
+  mutation.buffer = buffer.data();
+
+  // These pick among the resize strategies too, since the buffer has room to grow.
+  if (selected("do_mutation" + suffix)) {
+    results.push_back(run_case("do_mutation" + suffix, size, [&] {
+      mutation.bufsize = size;
+      mutation.capacity = buffer.size();
+      do_mutation(&rng, &mutation);
+      sink ^= buffer[0];
+    }));
+  }
+
+  if (selected("do_mutation_havoc" + suffix)) {
+    results.push_back(run_case("do_mutation_havoc" + suffix, size, [&] {
+      mutation.bufsize = size;
+      mutation.capacity = buffer.size();
+      do_mutation_havoc(&rng, &mutation, 0, -1);
+      sink ^= buffer[0];
+    }));
+  }
+}
+
+/**
+ * Prints the results as JSON, in the same shape as Google Benchmark's --benchmark_format=json.
+ * @param results every case's timing
+ */
+static void print_json(const std::vector<sl2_bench_result> &results) {
+  printf("{\n  \"context\": {\n");
+  printf("    \"executable\": \"mutation_bench\",\n");
+  printf("    \"num_strategies\": %d,\n", SL2_NUM_STRATEGIES);
+  printf("    \"num_resize_strategies\": %d,\n", SL2_NUM_RESIZE_STRATEGIES);
+  printf("    \"min_time_ms\": %d\n", opts.min_time_ms);
+  printf("  },\n  \"benchmarks\": [\n");
+
+  for (size_t i = 0; i < results.size(); ++i) {
+    const sl2_bench_result &result = results[i];
+
+    printf("    {\n");
+    printf("      \"name\": \"%s\",\n", result.name.c_str());
+    printf("      \"run_name\": \"%s\",\n", result.name.c_str());
+    printf("      \"run_type\": \"iteration\",\n");
+    printf("      \"iterations\": %llu,\n", result.iterations);
+    printf("      \"real_time\": %.3f,\n", result.ns_per_mutation);
+    printf("      \"cpu_time\": %.3f,\n", result.ns_per_mutation);
+    printf("      \"time_unit\": \"ns\",\n");
+    printf("      \"bytes_per_second\": %.1f,\n", result.bytes_per_second);
+    printf("      \"size\": %zu\n", result.size);
+    printf("    }%s\n", i + 1 < results.size() ? "," : "");
+  }
+
+  printf("  ]\n}\n");
+}
+
+/**
+ * Prints the results as a table.
+ * @param results every case's timing
+ */
+static void print_table(const std::vector<sl2_bench_result> &results) {
+  printf("%-40s %14s %14s %16s\n", "case", "iterations", "ns/mutation", "MB/sec");
+
+  for (const sl2_bench_result &result : results) {
+    printf("%-40s %14llu %14.1f %16.1f\n", result.name.c_str(), result.iterations,
+           result.ns_per_mutation, result.bytes_per_second / (1024 * 1024));
+  }
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      opts.min_size = std::max(strtoull(argv[++i], NULL, 0), 1ULL);
+    } else if (!strcmp(argv[i], "-S") && i + 1 < argc) {
+      opts.max_size = std::max(strtoull(argv[++i], NULL, 0), 1ULL);
+    } else if (!strcmp(argv[i], "-x") && i + 1 < argc) {
+      opts.step = std::max(strtoull(argv[++i], NULL, 0), 2ULL);
+    } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      opts.min_time_ms = std::max(atoi(argv[++i]), 1);
+    } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+      opts.filter = argv[++i];
+    } else if (!strcmp(argv[i], "-j")) {
+      opts.json = true;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  QueryPerformanceFrequency(&frequency);
+
+  std::vector<sl2_bench_result> results;
+
+  for (size_t size = opts.min_size; size <= opts.max_size; size *= opts.step) {
+    run_size(size, results);
+
+    if (size > opts.max_size / opts.step) {
+      break;
+    }
+  }
+
+  if (opts.json) {
+    print_json(results);
+  } else {
+    print_table(results);
+  }
+
+  return 0;
+}
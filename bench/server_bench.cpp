@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+#include <ShlObj.h>
+#include <PathCch.h>
+#include <strsafe.h>
+
+#include "common/sl2_server_api.hpp"
+
+// server_bench drives a running fuzz_server the same way that fuzzers under DR do,
+// minus the target, so that the server's own overhead can be measured (and compared across
+// changes) without DR's noise. Every latency below is what a client saw, from the start of the
+// sl2_conn_* call to its return.
+
+/*! The operations that server_bench times, one per sl2_conn_* call in a synthetic run. */
+enum sl2_bench_op {
+  SL2_BENCH_SESSION_BEGIN,
+  SL2_BENCH_REGISTER_PID,
+  SL2_BENCH_GET_ARENA,
+  SL2_BENCH_ADVISE_MUTATION,
+  SL2_BENCH_REGISTER_MUTATION,
+  SL2_BENCH_SET_ARENA,
+  SL2_BENCH_COVERAGE_INFO,
+  SL2_BENCH_FINALIZE_RUN,
+  SL2_BENCH_CRASH_PATHS,
+  SL2_BENCH_NUM_OPS,
+};
+
+/*! The name of each operation, and the server event that it sends. */
+static const struct {
+  const char *name;
+  uint8_t event;
+} SL2_BENCH_OPS[SL2_BENCH_NUM_OPS] = {
+    {"session_begin", EVT_SESSION_BEGIN},
+    {"register_pid", EVT_REGISTER_PID},
+    {"get_arena", EVT_GET_ARENA},
+    {"advise_mutation", EVT_ADVISE_MUTATION},
+    {"register_mutation", EVT_REGISTER_MUTATION},
+    {"set_arena", EVT_SET_ARENA},
+    {"coverage_info", EVT_COVERAGE_INFO},
+    {"finalize_run", EVT_FINALIZE_RUN},
+    {"crash_paths", EVT_CRASH_PATHS},
+};
+
+/*! The size of each synthetic mutation's buffer, in bytes. */
+#define SL2_BENCH_BUFSIZE 256
+
+/*! How many arena cells each synthetic run hits. */
+#define SL2_BENCH_CELLS 512
+
+/*! The benchmark's options. */
+struct sl2_bench_opts {
+  /*! How many clients run concurrently, each on its own connection */
+  int clients;
+  /*! How many runs each client makes */
+  int runs;
+  /*! How many mutations each run registers */
+  int mutations;
+  /*! How many distinct arenas (i.e., targets) the clients' runs are spread across */
+  int arenas;
+  /*! Every this many runs crashes, and requests its crash paths `crash_burst` times (0 for none) */
+  int crash_every;
+  int crash_burst;
+  /*! Whether runs finish with EVT_FINALIZE_RUN, instead of EVT_SET_ARENA and EVT_COVERAGE_INFO */
+  bool finalize;
+  /*! Whether mutations are registered asynchronously (see `sl2_conn_set_async`) */
+  bool async;
+};
+
+static sl2_bench_opts opts = {8, 100, 8, 1, 10, 4, false, false};
+
+/*! Each client's latencies (in QueryPerformanceCounter ticks), and failures, by operation. */
+struct sl2_bench_client {
+  int index;
+  std::vector<uint64_t> ticks[SL2_BENCH_NUM_OPS];
+  uint64_t failures[SL2_BENCH_NUM_OPS];
+};
+
+static wchar_t FUZZ_WORKING_PATH[MAX_PATH] = L"";
+static LARGE_INTEGER frequency;
+
+/*! Set once a client fails to connect, so that the others stop early. */
+static std::atomic<bool> bench_failed(false);
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-c <clients>] [-r <runs>] [-m <mutations>] [-a <arenas>]\n", argv0);
+  fprintf(stderr, "       [-k <crash every>] [-b <crash burst>] [-f] [-A]\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Runs <clients> (default 8) synthetic fuzzers against the running server,\n");
+  fprintf(stderr, "each making <runs> (default 100) runs of: get-arena, advise, <mutations>\n");
+  fprintf(stderr, "(default 8) mutation registrations, set-arena, and coverage-info (or\n");
+  fprintf(stderr, "finalize-run, with -f). Runs are spread across <arenas> (default 1) arenas.\n");
+  fprintf(stderr, "Every <crash every>th run (default 10, 0 for none) requests its crash paths\n");
+  fprintf(stderr, "<crash burst> (default 4) times. -A registers mutations asynchronously.\n");
+  fprintf(stderr, "Reports events per second, and each event's latency as seen by the clients\n");
+  fprintf(stderr, "and by the server.\n");
+}
+
+/**
+ * Initializes the path to the server's runs directory, which each synthetic run's directory is
+ * created under.
+ * This should be kept up-to-date with init_working_paths in server.cpp.
+ */
+static void init_working_paths() {
+  wchar_t *roaming_path;
+  SHGetKnownFolderPath(FOLDERID_RoamingAppData, NULL, NULL, &roaming_path);
+
+  PathCchCombine(FUZZ_WORKING_PATH, MAX_PATH, roaming_path, L"Trail of Bits\\sl2\\runs");
+
+  CoTaskMemFree(roaming_path);
+}
+
+/**
+ * Creates a new run and its directory, the way the harness does for each fuzzing run.
+ * @param run_id receives the run's ID
+ * @param run_dir receives the run's directory
+ * @return whether the run's directory was created
+ */
+static bool create_run(UUID *run_id, wchar_t run_dir[MAX_PATH + 1]) {
+  wchar_t *run_id_s;
+
+  if (UuidCreate(run_id) != RPC_S_OK ||
+      UuidToString(run_id, (RPC_WSTR *)&run_id_s) != RPC_S_OK) {
+    return false;
+  }
+
+  PathCchCombine(run_dir, MAX_PATH, FUZZ_WORKING_PATH, run_id_s);
+  RpcStringFree((RPC_WSTR *)&run_id_s);
+
+  return CreateDirectory(run_dir, NULL) != 0;
+}
+
+/**
+ * Removes a run's directory, and the files that the server wrote to it.
+ * @param run_dir the run's directory
+ */
+static void remove_run(const wchar_t *run_dir) {
+  wchar_t pattern[MAX_PATH + 1] = {0};
+  wchar_t path[MAX_PATH + 1] = {0};
+  WIN32_FIND_DATA found;
+
+  PathCchCombine(pattern, MAX_PATH, run_dir, L"*");
+  HANDLE find = FindFirstFile(pattern, &found);
+
+  if (find != INVALID_HANDLE_VALUE) {
+    do {
+      if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        PathCchCombine(path, MAX_PATH, run_dir, found.cFileName);
+        DeleteFile(path);
+      }
+    } while (FindNextFile(find, &found));
+
+    FindClose(find);
+  }
+
+  RemoveDirectory(run_dir);
+}
+
+/**
+ * Times a single sl2_conn_* call.
+ * @param client the client making the call
+ * @param op the call's operation
+ * @param call the call
+ */
+template <typename Call> static void timed(sl2_bench_client *client, sl2_bench_op op, Call call) {
+  LARGE_INTEGER start, end;
+
+  QueryPerformanceCounter(&start);
+  SL2Response response = call();
+  QueryPerformanceCounter(&end);
+
+  if (response == SL2Response::OK) {
+    client->ticks[op].push_back(end.QuadPart - start.QuadPart);
+  } else {
+    client->failures[op]++;
+  }
+}
+
+/**
+ * Makes a single client's runs, one connection per run, like a fuzzer does.
+ * @param client the client
+ */
+static void client_thread(sl2_bench_client *client) {
+  std::mt19937_64 rng(GetCurrentThreadId() ^ GetTickCount64());
+  uint64_t pid = GetCurrentProcessId();
+
+  // sl2_conn and arena maps are too big for a thread's stack.
+  sl2_conn *conn = new sl2_conn();
+  sl2_arena *arena = new sl2_arena();
+  std::vector<uint8_t> map;
+  uint8_t buffer[SL2_BENCH_BUFSIZE];
+  wchar_t resource[] = L"C:\\server_bench\\input.bin";
+
+  for (int run = 0; run < opts.runs && !bench_failed; ++run) {
+    UUID run_id;
+    wchar_t run_dir[MAX_PATH + 1] = {0};
+    sl2_mutation_advice advice = {0};
+    sl2_coverage_info cov;
+
+    if (!create_run(&run_id, run_dir)) {
+      fprintf(stderr, "client %d: couldn't create a run directory\n", client->index);
+      bench_failed = true;
+      break;
+    }
+
+    if (sl2_conn_open(conn) != SL2Response::OK) {
+      fprintf(stderr, "client %d: couldn't connect; is the server running?\n", client->index);
+      remove_run(run_dir);
+      bench_failed = true;
+      break;
+    }
+
+    memset(arena, 0, sizeof(*arena));
+    StringCchPrintfW(arena->id, SL2_HASH_LEN + 1, L"%064llx",
+                     (unsigned long long)((client->index + run) % opts.arenas));
+    arena->size = FUZZ_ARENA_SIZE;
+
+    timed(client, SL2_BENCH_SESSION_BEGIN, [&] { return sl2_conn_assign_run_id(conn, run_id); });
+    sl2_conn_set_async(conn, opts.async);
+    timed(client, SL2_BENCH_REGISTER_PID, [&] { return sl2_conn_register_pid(conn, pid, false); });
+    timed(client, SL2_BENCH_GET_ARENA, [&] { return sl2_conn_request_arena(conn, arena); });
+
+    // Each run hits a random handful of cells, so that some of them find new paths.
+    // The server may have made the arena with another size.
+    map.assign(SL2_ARENA_SIZE_VALID(arena->size) ? arena->size : FUZZ_ARENA_SIZE, 0);
+    arena->size = (uint32_t)map.size();
+    arena->map = map.data();
+    for (int cell = 0; cell < SL2_BENCH_CELLS; ++cell) {
+      arena->map[rng() % arena->size] = (uint8_t)(1 + rng() % 8);
+    }
+
+    timed(client, SL2_BENCH_ADVISE_MUTATION,
+          [&] { return sl2_conn_advise_mutation(conn, arena, NULL, &advice); });
+
+    for (int count = 0; count < opts.mutations; ++count) {
+      sl2_mutation mutation = {0};
+
+      for (size_t i = 0; i < sizeof(buffer); ++i) {
+        buffer[i] = (uint8_t)rng();
+      }
+
+      mutation.mut_count = count;
+      mutation.mut_type = advice.table_idx;
+      mutation.resource = resource;
+      mutation.bufsize = sizeof(buffer);
+      mutation.buffer = buffer;
+
+      timed(client, SL2_BENCH_REGISTER_MUTATION,
+            [&] { return sl2_conn_register_mutation(conn, &mutation); });
+    }
+
+    bool crashed = opts.crash_every > 0 && run % opts.crash_every == opts.crash_every - 1;
+
+    if (crashed) {
+      for (int i = 0; i < opts.crash_burst; ++i) {
+        sl2_crash_paths paths;
+        timed(client, SL2_BENCH_CRASH_PATHS,
+              [&] { return sl2_conn_request_crash_paths(conn, pid, &paths); });
+      }
+    }
+
+    if (opts.finalize) {
+      timed(client, SL2_BENCH_FINALIZE_RUN, [&] {
+        return sl2_conn_finalize_run(conn, arena, pid, crashed, SL2_DISTANCE_NONE, &cov);
+      });
+    } else {
+      timed(client, SL2_BENCH_SET_ARENA, [&] { return sl2_conn_register_arena(conn, arena); });
+      timed(client, SL2_BENCH_COVERAGE_INFO,
+            [&] { return sl2_conn_get_coverage(conn, arena, &cov); });
+    }
+
+    sl2_conn_close(conn);
+    remove_run(run_dir);
+  }
+
+  delete arena;
+  delete conn;
+}
+
+/**
+ * @param ordered sorted latencies, in ticks
+ * @param fraction the percentile, as a fraction
+ * @return the percentile, in microseconds
+ */
+static double percentile_us(const std::vector<uint64_t> &ordered, double fraction) {
+  size_t index = std::min(ordered.size() - 1, (size_t)(ordered.size() * fraction));
+  return ordered[index] * 1000000.0 / frequency.QuadPart;
+}
+
+/**
+ * Prints the server's own view of each event's latency, for comparison with the clients'.
+ */
+static void print_server_stats() {
+  sl2_conn *conn = new sl2_conn();
+  sl2_server_stats stats;
+
+  if (sl2_conn_open(conn) != SL2Response::OK ||
+      sl2_conn_request_stats(conn, &stats) != SL2Response::OK) {
+    fprintf(stderr, "couldn't request the server's statistics\n");
+    delete conn;
+    return;
+  }
+
+  sl2_conn_close(conn);
+  delete conn;
+
+  printf("\nserver (since it started, percentiles rounded up to powers of two):\n");
+  printf("%-20s %10s %10s %10s %10s %14s\n", "event", "count", "p50_us", "p99_us", "max_us",
+         "lock_wait_us");
+
+  for (int op = 0; op < SL2_BENCH_NUM_OPS; ++op) {
+    sl2_event_stats *event = &(stats.events[SL2_BENCH_OPS[op].event]);
+
+    if (event->count == 0) {
+      continue;
+    }
+
+    printf("%-20s %10llu %10llu %10llu %10llu %14llu\n", SL2_BENCH_OPS[op].name, event->count,
+           event->p50_us, event->p99_us, event->max_us, event->lock_wait_us);
+  }
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+      opts.clients = std::max(atoi(argv[++i]), 1);
+    } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      opts.runs = std::max(atoi(argv[++i]), 1);
+    } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+      opts.mutations = std::max(atoi(argv[++i]), 0);
+    } else if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+      opts.arenas = std::max(atoi(argv[++i]), 1);
+    } else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+      opts.crash_every = std::max(atoi(argv[++i]), 0);
+    } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      opts.crash_burst = std::max(atoi(argv[++i]), 0);
+    } else if (!strcmp(argv[i], "-f")) {
+      opts.finalize = true;
+    } else if (!strcmp(argv[i], "-A")) {
+      opts.async = true;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  init_working_paths();
+  QueryPerformanceFrequency(&frequency);
+
+  std::vector<sl2_bench_client> clients(opts.clients);
+  std::vector<std::thread> threads;
+  LARGE_INTEGER start, end;
+
+  QueryPerformanceCounter(&start);
+
+  for (int i = 0; i < opts.clients; ++i) {
+    clients[i].index = i;
+    memset(clients[i].failures, 0, sizeof(clients[i].failures));
+    threads.emplace_back(client_thread, &clients[i]);
+  }
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  QueryPerformanceCounter(&end);
+
+  if (bench_failed) {
+    return 1;
+  }
+
+  double elapsed = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+  uint64_t total = 0;
+
+  printf("%-20s %10s %10s %10s %10s %10s %10s\n", "event", "count", "failed", "p50_us", "p99_us",
+         "p999_us", "max_us");
+
+  for (int op = 0; op < SL2_BENCH_NUM_OPS; ++op) {
+    std::vector<uint64_t> ordered;
+    uint64_t failures = 0;
+
+    for (sl2_bench_client &client : clients) {
+      ordered.insert(ordered.end(), client.ticks[op].begin(), client.ticks[op].end());
+      failures += client.failures[op];
+    }
+
+    if (ordered.empty() && failures == 0) {
+      continue;
+    }
+
+    total += ordered.size() + failures;
+
+    if (ordered.empty()) {
+      printf("%-20s %10d %10llu\n", SL2_BENCH_OPS[op].name, 0, failures);
+      continue;
+    }
+
+    std::sort(ordered.begin(), ordered.end());
+
+    printf("%-20s %10zu %10llu %10.1f %10.1f %10.1f %10.1f\n", SL2_BENCH_OPS[op].name,
+           ordered.size(), failures, percentile_us(ordered, 0.5), percentile_us(ordered, 0.99),
+           percentile_us(ordered, 0.999), percentile_us(ordered, 1.0));
+  }
+
+  printf("\n%d clients, %d runs, %llu events in %.2fs: %.0f events/sec, %.0f runs/sec\n",
+         opts.clients, opts.clients * opts.runs, total, elapsed, total / elapsed,
+         opts.clients * opts.runs / elapsed);
+
+  print_server_stats();
+
+  return 0;
+}
@@ -0,0 +1,196 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define NOMINMAX
+#include <Windows.h>
+
+#include "server.hpp"
+#include "arena_kernels.hpp"
+#include "common/sl2_rng.hpp"
+
+// simd_test checks that every vectorized arena kernel gives bit-for-bit the same results as its
+// scalar reference: the same return values, and the same maps afterwards. Every map size is
+// checked at every instruction set that this host supports, on random maps and on the maps
+// that the vector kernels are most likely to get wrong (saturation, and each bucket's bounds).
+
+/*! The hit counts on either side of every bucket bound (see bucket_value and bucket_bit). */
+static const uint8_t SL2_TEST_BOUNDS[] = {0, 1, 2, 3, 4, 7, 8, 15, 16, 31, 32, 127, 128, 254, 255};
+
+/*! The kinds of maps that every kernel is run on. */
+enum sl2_test_map {
+  SL2_TEST_MAP_ZERO,
+  SL2_TEST_MAP_FULL,
+  SL2_TEST_MAP_RANDOM,
+  SL2_TEST_MAP_SPARSE,
+  SL2_TEST_MAP_BOUNDS,
+  SL2_TEST_MAP_KINDS,
+};
+
+static const char *SL2_TEST_MAP_NAMES[] = {"zero", "full", "random", "sparse", "bounds"};
+
+static_assert(sizeof(SL2_TEST_MAP_NAMES) / sizeof(SL2_TEST_MAP_NAMES[0]) == SL2_TEST_MAP_KINDS,
+              "SL2_TEST_MAP_NAMES must name every kind of map");
+
+/*! How many kernel runs didn't match their reference. */
+static uint32_t failures;
+
+/**
+ * Fills a map with one of the kinds that the kernels are tested on.
+ * @param rng the generator for random maps
+ * @param map the map to fill
+ * @param kind the kind of map
+ * @param offset where to start in SL2_TEST_BOUNDS, so that two maps' bounds don't line up
+ */
+static void fill_map(sl2_rng *rng, std::vector<uint8_t> &map, sl2_test_map kind, size_t offset) {
+  switch (kind) {
+  case SL2_TEST_MAP_ZERO:
+    memset(map.data(), 0, map.size());
+    break;
+  case SL2_TEST_MAP_FULL:
+    memset(map.data(), UINT8_MAX, map.size());
+    break;
+  case SL2_TEST_MAP_RANDOM:
+    sl2_rng_fill(rng, map.data(), map.size());
+    break;
+  case SL2_TEST_MAP_SPARSE:
+    // Like a real run's map: mostly empty, with a few cells hit a few times.
+    for (uint8_t &cell : map) {
+      cell = sl2_rng_below(rng, 64) ? 0 : (uint8_t)(1 + sl2_rng_below(rng, 16));
+    }
+    break;
+  default:
+    for (size_t i = 0; i < map.size(); ++i) {
+      map[i] = SL2_TEST_BOUNDS[(i + offset) % sizeof(SL2_TEST_BOUNDS)];
+    }
+    break;
+  }
+}
+
+/**
+ * @param expected the reference map
+ * @param actual the map to check
+ * @return the index of the first cell at which the maps differ, or -1 if they don't
+ */
+static int64_t first_difference(const std::vector<uint8_t> &expected,
+                                const std::vector<uint8_t> &actual) {
+  for (size_t i = 0; i < expected.size(); ++i) {
+    if (expected[i] != actual[i]) {
+      return (int64_t)i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Checks a merge/score kernel against the scalar one, on every pair of map kinds (and on
+ * scoring alone), with and without bucketing.
+ * @param level the kernel's instruction set
+ * @param size_class the kernel's map size (see arena_size_class)
+ * @param rng the generator for random maps
+ */
+static void test_merge_score(sl2_simd_level level, uint32_t size_class, sl2_rng *rng) {
+  sl2_merge_score_fn reference = merge_score_kernels(SL2_SIMD_SCALAR)[size_class];
+  sl2_merge_score_fn kernel = merge_score_kernels(level)[size_class];
+  size_t size = (size_t)FUZZ_ARENA_SIZE << size_class;
+  std::vector<uint8_t> map(size), other(size), expected(size), actual(size);
+
+  for (int map_kind = 0; map_kind < SL2_TEST_MAP_KINDS; ++map_kind) {
+    fill_map(rng, map, (sl2_test_map)map_kind, 0);
+
+    // One more than the number of kinds: the last one is scoring without merging.
+    for (int other_kind = 0; other_kind <= SL2_TEST_MAP_KINDS; ++other_kind) {
+      bool merging = other_kind < SL2_TEST_MAP_KINDS;
+
+      if (merging) {
+        fill_map(rng, other, (sl2_test_map)other_kind, 5);
+      }
+
+      for (int bucketing = 0; bucketing < 2; ++bucketing) {
+        expected = map;
+        actual = map;
+
+        uint32_t want = reference(expected.data(), merging ? other.data() : NULL, !!bucketing);
+        uint32_t got = kernel(actual.data(), merging ? other.data() : NULL, !!bucketing);
+        int64_t diff = first_difference(expected, actual);
+
+        if (want != got || diff >= 0) {
+          printf("FAIL merge_score %s size=%zu map=%s other=%s bucketing=%d: score %u (want %u), "
+                 "first different cell %lld\n",
+                 sl2_simd_level_name(level), size, SL2_TEST_MAP_NAMES[map_kind],
+                 merging ? SL2_TEST_MAP_NAMES[other_kind] : "none", bucketing, got, want, diff);
+          failures++;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Checks a novelty kernel against the scalar one, on every pair of virgin and run map kinds,
+ * with and without bucketing.
+ * @param level the kernel's instruction set
+ * @param size_class the kernel's map size (see arena_size_class)
+ * @param rng the generator for random maps
+ */
+static void test_novelty(sl2_simd_level level, uint32_t size_class, sl2_rng *rng) {
+  sl2_novelty_fn reference = novelty_kernels(SL2_SIMD_SCALAR)[size_class];
+  sl2_novelty_fn kernel = novelty_kernels(level)[size_class];
+  size_t size = (size_t)FUZZ_ARENA_SIZE << size_class;
+  std::vector<uint8_t> virgin(size), run(size), expected(size), actual(size);
+
+  for (int virgin_kind = 0; virgin_kind < SL2_TEST_MAP_KINDS; ++virgin_kind) {
+    fill_map(rng, virgin, (sl2_test_map)virgin_kind, 0);
+
+    for (int run_kind = 0; run_kind < SL2_TEST_MAP_KINDS; ++run_kind) {
+      fill_map(rng, run, (sl2_test_map)run_kind, 5);
+
+      for (int bucketing = 0; bucketing < 2; ++bucketing) {
+        uint32_t want_buckets = 0, got_buckets = 0;
+        expected = virgin;
+        actual = virgin;
+
+        uint32_t want = reference(expected.data(), run.data(), !!bucketing, &want_buckets);
+        uint32_t got = kernel(actual.data(), run.data(), !!bucketing, &got_buckets);
+        int64_t diff = first_difference(expected, actual);
+
+        if (want != got || want_buckets != got_buckets || diff >= 0) {
+          printf("FAIL novelty %s size=%zu virgin=%s run=%s bucketing=%d: %u new cells (want %u), "
+                 "%u new buckets (want %u), first different cell %lld\n",
+                 sl2_simd_level_name(level), size, SL2_TEST_MAP_NAMES[virgin_kind],
+                 SL2_TEST_MAP_NAMES[run_kind], bucketing, got, want, got_buckets, want_buckets,
+                 diff);
+          failures++;
+        }
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 0) : 0x5EED;
+  sl2_rng rng;
+
+  sl2_rng_seed(&rng, seed);
+  printf("seed 0x%llx, host supports %s\n", (unsigned long long)seed,
+         sl2_simd_level_name(sl2_simd_current()));
+
+  // The scalar kernels are checked against themselves too, which catches a kernel that
+  // depends on something other than its arguments.
+  for (int level = SL2_SIMD_SCALAR; level <= sl2_simd_current(); ++level) {
+    uint32_t before = failures;
+
+    for (uint32_t size_class = 0; size_class < SL2_ARENA_SIZE_CLASSES; ++size_class) {
+      test_merge_score((sl2_simd_level)level, size_class, &rng);
+      test_novelty((sl2_simd_level)level, size_class, &rng);
+    }
+
+    printf("%s: %s\n", sl2_simd_level_name((sl2_simd_level)level),
+           failures == before ? "ok" : "FAILED");
+  }
+
+  return failures ? 1 : 0;
+}
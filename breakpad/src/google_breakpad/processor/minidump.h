@@ -1229,6 +1229,11 @@ class Minidump {
   // Returns the current position of the minidump file.
   off_t Tell();
 
+  // Returns a pointer to count bytes at offset directly in the minidump
+  // file's mapping, or NULL if the minidump isn't mapped or the range is out
+  // of bounds.  The view is valid for as long as the Minidump object is.
+  const uint8_t* GetView(off_t offset, size_t count) const;
+
   // Medium-level I/O routines.
 
   // ReadString returns a string which is owned by the caller!  offset
@@ -1292,6 +1297,15 @@ class Minidump {
   // Opens the minidump file, or if already open, seeks to the beginning.
   bool Open();
 
+  // Maps the minidump file at path_ for reading.  Returns false if it can't
+  // be mapped, in which case Open falls back to reading it through an
+  // ifstream.  A minidump that SL2's server compressed (server -z) is
+  // decompressed onto the heap instead, and the "mapping" is that copy.
+  bool Map();
+
+  // Unmaps the minidump file, if it's mapped.
+  void Unmap();
+
   // The largest number of top-level streams that will be read from a minidump.
   // Note that streams are only read (and only consume memory) as needed,
   // when directed by the caller.  The default is 128.
@@ -1319,6 +1333,17 @@ class Minidump {
   // Set based on the path in Open, or directly in the constructor.
   std::istream*             stream_;
 
+  // The minidump file's read-only mapping, if it was opened from a path and
+  // could be mapped.  When it's set, ReadBytes, SeekSet and Tell work on the
+  // mapping instead of stream_, and memory regions are views into it.
+  const uint8_t*            mapped_;
+  size_t                    mapped_size_;
+  size_t                    mapped_position_;
+
+  // Whether mapped_ is a decompressed copy on the heap, rather than a view of
+  // the file.
+  bool                      inflated_;
+
   // swap_ is true if the minidump file should be byte-swapped.  If the
   // minidump was produced by a CPU that is other-endian than the CPU
   // processing the minidump, this will be true.  If the two CPUs are
@@ -1,13 +1,16 @@
+#include <algorithm>
 #include <cstdint>
 #include <random>
 
-#include "common/sl2_dr_client.hpp"
+// The server links this file too (to pre-generate mutations), so it mustn't depend on
+// DynamoRIO.
+#include <Windows.h>
+
 #include "common/mutation.hpp"
+#include "common/sl2_rng.hpp"
 
 // TODO(ww): Additional strategies:
-// insert bytes
 // move bytes
-// add random bytes to space
 sl2_strategy_t SL2_STRATEGY_TABLE[] = {
     // NOTE(ww): We probably don't need to use this.
     // Some of the other strategies call it as a fallback.
@@ -16,36 +19,72 @@ sl2_strategy_t SL2_STRATEGY_TABLE[] = {
     strategyRepeatBytes,      strategyRepeatBytesBackwards,
     strategyKnownValues,      strategyAddSubKnownValues,
     strategyEndianSwap,       strategyDeleteBytes,
-    strategyDeleteBytesAscii,
+    strategyDeleteBytesAscii, strategyDictionary,
+    strategyInputToState,     strategyTokenNumber,
+    strategyTokenLength,
+};
+
+// These change the length of the buffer, so they're only used when the hooked
+// function can report the new length back to the target (see sl2_mutation.capacity).
+sl2_resize_strategy_t SL2_RESIZE_STRATEGY_TABLE[] = {
+    strategyInsertBytes,
+    strategyDeleteShiftBytes,
+    strategySpliceBytes,
+    strategyTruncate,
+    strategyInsertToken,
+    strategyTokenDuplicate,
+    strategyTokenDelete,
+    strategyTokenResize,
 };
 
+/*! The dictionary that strategyDictionary and strategyInsertToken draw from, if any */
+static const sl2_dictionary *dictionary = NULL;
+
+/*! The comparison log that strategyInputToState draws operands from, if any */
+static const sl2_cmplog *cmplog = NULL;
+
+/*! How many logged comparisons strategyInputToState looks for in the buffer before giving up. */
+#define SL2_INPUT_TO_STATE_TRIES 8
+
+/*! The most bytes that the structure-aware strategies scan for a token (or a length prefix) in. */
+#define SL2_TOKEN_WINDOW 4096
+
+/*! The most bytes that strategyTokenResize grows a length-prefixed value by at once. */
+#define SL2_TOKEN_MAX_GROWTH 256
+
 SL2_EXPORT
-void strategyAAAA(uint8_t *buf, size_t size) {
+void strategyAAAA(sl2_rng *rng, uint8_t *buf, size_t size) {
   memset(buf, 'A', size);
 }
 
 SL2_EXPORT
-void strategyFlipBit(uint8_t *buf, size_t size) {
-  size_t pos = dr_get_random_value((uint)size);
-  buf[pos] ^= (1 << dr_get_random_value(8));
+void strategyFlipBit(sl2_rng *rng, uint8_t *buf, size_t size) {
+  size_t pos = sl2_rng_below(rng, size);
+  buf[pos] ^= (1 << sl2_rng_below(rng, 8));
 }
 
 SL2_EXPORT
-void strategyRepeatBytes(uint8_t *buf, size_t size) {
+void strategyRepeatBytes(sl2_rng *rng, uint8_t *buf, size_t size) {
+  // There's nothing to repeat into; resize strategies can leave us here.
+  if (size < 2) {
+    strategyFlipBit(rng, buf, size);
+    return;
+  }
+
   // pos -> zero to second to last byte
-  size_t pos = dr_get_random_value((uint)(size - 1));
+  size_t pos = sl2_rng_below(rng, size - 1);
 
   // repeat_length -> 1 to (remaining_size - 1)
   size_t size_m2 = size - 2;
   size_t repeat_length = 0;
   if (size_m2 > pos) {
-    repeat_length = dr_get_random_value((uint)(size_m2 - pos));
+    repeat_length = sl2_rng_below(rng, size_m2 - pos);
   }
   repeat_length++;
 
   // set start and end
   size_t curr_pos = pos + repeat_length;
-  size_t end = dr_get_random_value((uint)(size - curr_pos));
+  size_t end = sl2_rng_below(rng, size - curr_pos);
   end += curr_pos + 1;
 
   while (curr_pos < end) {
@@ -56,213 +95,1223 @@ void strategyRepeatBytes(uint8_t *buf, size_t size) {
 }
 
 SL2_EXPORT
-void strategyRepeatBytesBackwards(uint8_t *buf, size_t size) {
-  size_t start = dr_get_random_value((uint)(size - 1));
-  size_t end = start + dr_get_random_value((uint)((size + 1) - start));
+void strategyRepeatBytesBackwards(sl2_rng *rng, uint8_t *buf, size_t size) {
+  size_t start = sl2_rng_below(rng, size - 1);
+  size_t end = start + sl2_rng_below(rng, (size + 1) - start);
 
   std::reverse(buf + start, buf + end);
 }
 
 SL2_EXPORT
-void strategyDeleteBytes(uint8_t *buf, size_t size) {
-  size_t start = dr_get_random_value((uint)(size - 1));
-  size_t count = dr_get_random_value((uint)((size + 1) - start));
+void strategyDeleteBytes(sl2_rng *rng, uint8_t *buf, size_t size) {
+  size_t start = sl2_rng_below(rng, size - 1);
+  size_t count = sl2_rng_below(rng, (size + 1) - start);
 
   memset(buf + start, 0, count);
 }
 
 SL2_EXPORT
-void strategyDeleteBytesAscii(uint8_t *buf, size_t size) {
-  size_t start = dr_get_random_value((uint)(size - 1));
-  size_t count = dr_get_random_value((uint)((size + 1) - start));
+void strategyDeleteBytesAscii(sl2_rng *rng, uint8_t *buf, size_t size) {
+  size_t start = sl2_rng_below(rng, size - 1);
+  size_t count = sl2_rng_below(rng, (size + 1) - start);
 
   memset(buf + start, '0', count);
 }
 
+// Each integer width takes the known values of every narrower width, plus its own.
+static constexpr int8_t KNOWN_VALUES_8[] = {KNOWN_VALUES1};
+static constexpr int16_t KNOWN_VALUES_16[] = {KNOWN_VALUES1, KNOWN_VALUES2};
+static constexpr int32_t KNOWN_VALUES_32[] = {KNOWN_VALUES1, KNOWN_VALUES2, KNOWN_VALUES4};
+static constexpr int64_t KNOWN_VALUES_64[] = {KNOWN_VALUES1, KNOWN_VALUES2, KNOWN_VALUES4,
+                                              KNOWN_VALUES8};
+
+/**
+ * The known values and byte swap for each integer width that the width strategies mutate.
+ */
+template <typename T> struct width_traits;
+
+template <> struct width_traits<uint8_t> {
+  static constexpr const int8_t *known = KNOWN_VALUES_8;
+  static constexpr size_t num_known = sizeof(KNOWN_VALUES_8) / sizeof(KNOWN_VALUES_8[0]);
+
+  // nibble endianness, because sim cards
+  static uint8_t swap(uint8_t value) {
+    return (uint8_t)(value >> 4 | value << 4);
+  }
+};
+
+template <> struct width_traits<uint16_t> {
+  static constexpr const int16_t *known = KNOWN_VALUES_16;
+  static constexpr size_t num_known = sizeof(KNOWN_VALUES_16) / sizeof(KNOWN_VALUES_16[0]);
+
+  static uint16_t swap(uint16_t value) {
+    return _byteswap_ushort(value);
+  }
+};
+
+template <> struct width_traits<uint32_t> {
+  static constexpr const int32_t *known = KNOWN_VALUES_32;
+  static constexpr size_t num_known = sizeof(KNOWN_VALUES_32) / sizeof(KNOWN_VALUES_32[0]);
+
+  static uint32_t swap(uint32_t value) {
+    return _byteswap_ulong(value);
+  }
+};
+
+template <> struct width_traits<uint64_t> {
+  static constexpr const int64_t *known = KNOWN_VALUES_64;
+  static constexpr size_t num_known = sizeof(KNOWN_VALUES_64) / sizeof(KNOWN_VALUES_64[0]);
+
+  static uint64_t swap(uint64_t value) {
+    return _byteswap_uint64(value);
+  }
+};
+
+/**
+ * Picks one of the integer widths (1, 2, 4 or 8 bytes) that fit in the buffer, uniformly.
+ * @param rng - the sl2_rng to draw from
+ * @param size - the size of the buffer (at least 1)
+ * @return log2 of the width, as an index into the per-width strategy tables below
+ */
+static inline uint32_t random_width(sl2_rng *rng, size_t size) {
+  uint32_t widest = size >= 8 ? 3 : size >= 4 ? 2 : size >= 2 ? 1 : 0;
+
+  return (uint32_t)sl2_rng_below(rng, widest + 1);
+}
+
+/**
+ * Picks a random position for an integer of type T within the buffer.
+ * @param rng - the sl2_rng to draw from
+ * @param size - the size of the buffer (at least sizeof(T))
+ * @return the position
+ */
+template <typename T> static inline size_t random_position(sl2_rng *rng, size_t size) {
+  // pos -> zero to ((size + 1) - sizeof(T))
+  // e.g. buf size is 16, sizeof(T) is 8
+  // max will be from 0 to 9 guaranteeing a
+  // pos that will fit into the buffer
+  return sl2_rng_below(rng, (size + 1) - sizeof(T));
+}
+
+template <typename T> static void rand_value(sl2_rng *rng, uint8_t *buf, size_t size) {
+  sl2_rng_fill(rng, buf + random_position<T>(rng, size), sizeof(T));
+}
+
+template <typename T> static void known_value(sl2_rng *rng, uint8_t *buf, size_t size) {
+  typedef width_traits<T> traits;
+
+  size_t pos = random_position<T>(rng, size);
+  bool endian = sl2_rng_below(rng, 2);
+  T value = (T)traits::known[sl2_rng_below(rng, traits::num_known)];
+
+  value = endian ? traits::swap(value) : value;
+  memcpy(buf + pos, &value, sizeof(value));
+}
+
+template <typename T> static void add_sub_known_value(sl2_rng *rng, uint8_t *buf, size_t size) {
+  typedef width_traits<T> traits;
+
+  size_t pos = random_position<T>(rng, size);
+  bool endian = sl2_rng_below(rng, 2);
+  bool sub = sl2_rng_below(rng, 2);
+  T value = (T)traits::known[sl2_rng_below(rng, traits::num_known)];
+  T current;
+
+  value = endian ? traits::swap(value) : value;
+  memcpy(&current, buf + pos, sizeof(current));
+  current = sub ? (T)(current - value) : (T)(current + value);
+  memcpy(buf + pos, &current, sizeof(current));
+}
+
+template <typename T> static void endian_swap(sl2_rng *rng, uint8_t *buf, size_t size) {
+  size_t pos = random_position<T>(rng, size);
+  T value;
+
+  memcpy(&value, buf + pos, sizeof(value));
+  value = width_traits<T>::swap(value);
+  memcpy(buf + pos, &value, sizeof(value));
+}
+
+static const sl2_strategy_t RAND_VALUE_WIDTHS[] = {
+    rand_value<uint8_t>,
+    rand_value<uint16_t>,
+    rand_value<uint32_t>,
+    rand_value<uint64_t>,
+};
+
+static const sl2_strategy_t KNOWN_VALUE_WIDTHS[] = {
+    known_value<uint8_t>,
+    known_value<uint16_t>,
+    known_value<uint32_t>,
+    known_value<uint64_t>,
+};
+
+static const sl2_strategy_t ADD_SUB_KNOWN_VALUE_WIDTHS[] = {
+    add_sub_known_value<uint8_t>,
+    add_sub_known_value<uint16_t>,
+    add_sub_known_value<uint32_t>,
+    add_sub_known_value<uint64_t>,
+};
+
+static const sl2_strategy_t ENDIAN_SWAP_WIDTHS[] = {
+    endian_swap<uint8_t>,
+    endian_swap<uint16_t>,
+    endian_swap<uint32_t>,
+    endian_swap<uint64_t>,
+};
+
+SL2_EXPORT
+void strategyRandValues(sl2_rng *rng, uint8_t *buf, size_t size) {
+  RAND_VALUE_WIDTHS[random_width(rng, size)](rng, buf, size);
+}
+
 SL2_EXPORT
-void strategyRandValues(uint8_t *buf, size_t size) {
-  size_t rand_size;
-  do {
-    rand_size = (size_t)1 << dr_get_random_value(4);
-  } while (size < rand_size);
-  size_t max = (size + 1) - rand_size;
-  size_t pos = dr_get_random_value((uint)max);
+void strategyKnownValues(sl2_rng *rng, uint8_t *buf, size_t size) {
+  KNOWN_VALUE_WIDTHS[random_width(rng, size)](rng, buf, size);
+}
+
+SL2_EXPORT
+void strategyAddSubKnownValues(sl2_rng *rng, uint8_t *buf, size_t size) {
+  ADD_SUB_KNOWN_VALUE_WIDTHS[random_width(rng, size)](rng, buf, size);
+}
+
+SL2_EXPORT
+void strategyEndianSwap(sl2_rng *rng, uint8_t *buf, size_t size) {
+  ENDIAN_SWAP_WIDTHS[random_width(rng, size)](rng, buf, size);
+}
 
-  for (size_t i = 0; i < rand_size; i++) {
-    uint8_t mut = dr_get_random_value(UINT8_MAX + 1);
-    buf[pos + i] = mut;
+/**
+ * Picks the length of a span to insert or delete: between 1 and `max` bytes, biased towards
+ * short spans.
+ * @param rng - the sl2_rng to draw from
+ * @param max - the longest allowable span (at least 1)
+ * @return the span's length
+ */
+static size_t random_span(sl2_rng *rng, size_t max) {
+  size_t limit = (size_t)1 << sl2_rng_below(rng, 16);
+
+  if (limit > max) {
+    limit = max;
   }
+
+  return 1 + sl2_rng_below(rng, limit);
 }
 
 SL2_EXPORT
-void strategyKnownValues(uint8_t *buf, size_t size) {
-  int8_t values1[] = {KNOWN_VALUES1};
-  int16_t values2[] = {KNOWN_VALUES1, KNOWN_VALUES2};
-  int32_t values4[] = {KNOWN_VALUES1, KNOWN_VALUES2, KNOWN_VALUES4};
-  int64_t values8[] = {KNOWN_VALUES1, KNOWN_VALUES2, KNOWN_VALUES4, KNOWN_VALUES8};
+size_t strategyInsertBytes(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity) {
+  if (capacity <= size) {
+    strategyRandValues(rng, buf, size);
+    return size;
+  }
 
-  size_t rand_size;
-  do {
-    rand_size = (size_t)1 << dr_get_random_value(4);
-  } while (size < rand_size);
-  size_t max = (size + 1) - rand_size;
-  size_t pos = dr_get_random_value((uint)max);
-  bool endian = dr_get_random_value(2);
-
-  // pos -> zero to ((size + 1) - rand_size)
-  // e.g. buf size is 16, rand_size is 8
-  // max will be from 0 to 9 guanteeing a
-  // pos that will fit into the buffer
+  size_t count = random_span(rng, capacity - size);
+  size_t pos = sl2_rng_below(rng, size + 1);
 
-  size_t selection = 0;
-  switch (rand_size) {
-  case 1:
-    selection = dr_get_random_value(sizeof(values1) / sizeof(values1[0]));
-    // nibble endianness, because sim cards
-    values1[selection] =
-        endian ? values1[selection] >> 4 | values1[selection] << 4 : values1[selection];
-    *(uint8_t *)(buf + pos) = values1[selection];
-    break;
-  case 2:
-    selection = dr_get_random_value(sizeof(values2) / sizeof(values2[0]));
-    values2[selection] = endian ? _byteswap_ushort(values2[selection]) : values2[selection];
-    *(uint16_t *)(buf + pos) = values2[selection];
-    break;
-  case 4:
-    selection = dr_get_random_value(sizeof(values4) / sizeof(values4[0]));
-    values4[selection] = endian ? _byteswap_ulong(values4[selection]) : values4[selection];
-    *(uint32_t *)(buf + pos) = values4[selection];
-    break;
-  case 8:
-    selection = dr_get_random_value(sizeof(values8) / sizeof(values8[0]));
-    values8[selection] = endian ? _byteswap_uint64(values8[selection]) : values8[selection];
-    *(uint64_t *)(buf + pos) = values8[selection];
-    break;
-  default:
-    strategyAAAA(buf, size);
-    break;
+  memmove(buf + pos + count, buf + pos, size - pos);
+  sl2_rng_fill(rng, buf + pos, count);
+
+  return size + count;
+}
+
+SL2_EXPORT
+size_t strategyDeleteShiftBytes(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity) {
+  if (size < 2) {
+    strategyFlipBit(rng, buf, size);
+    return size;
   }
+
+  size_t count = random_span(rng, size - 1);
+  size_t pos = sl2_rng_below(rng, size - count + 1);
+
+  memmove(buf + pos, buf + pos + count, size - pos - count);
+
+  return size - count;
 }
 
 SL2_EXPORT
-void strategyAddSubKnownValues(uint8_t *buf, size_t size) {
-  int8_t values1[] = {KNOWN_VALUES1};
-  int16_t values2[] = {KNOWN_VALUES1, KNOWN_VALUES2};
-  int32_t values4[] = {KNOWN_VALUES1, KNOWN_VALUES2, KNOWN_VALUES4};
-  int64_t values8[] = {KNOWN_VALUES1, KNOWN_VALUES2, KNOWN_VALUES4, KNOWN_VALUES8};
+size_t strategySpliceBytes(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity) {
+  if (capacity <= size) {
+    strategyRepeatBytes(rng, buf, size);
+    return size;
+  }
 
-  size_t rand_size;
-  do {
-    rand_size = (size_t)1 << dr_get_random_value(4);
-  } while (size < rand_size);
-  size_t max = (size + 1) - rand_size;
-  size_t pos = dr_get_random_value((uint)max);
-  bool endian = dr_get_random_value(2);
-  uint8_t sub = dr_get_random_value(2) ? -1 : 1;
-  size_t selection = 0;
-
-  switch (rand_size) {
-  case 1:
-    selection = dr_get_random_value(sizeof(values1) / sizeof(values1[0]));
-    // nibble endianness, because sim cards
-    values1[selection] =
-        endian ? values1[selection] >> 4 | values1[selection] << 4 : values1[selection];
-    *(uint8_t *)(buf + pos) += sub * values1[selection];
-    break;
-  case 2:
-    selection = dr_get_random_value(sizeof(values2) / sizeof(values2[0]));
-    values2[selection] = endian ? _byteswap_ushort(values2[selection]) : values2[selection];
-    *(uint16_t *)(buf + pos) += sub * values2[selection];
-    break;
-  case 4:
-    selection = dr_get_random_value(sizeof(values4) / sizeof(values4[0]));
-    values4[selection] = endian ? _byteswap_ulong(values4[selection]) : values4[selection];
-    *(uint32_t *)(buf + pos) += sub * values4[selection];
-    break;
-  case 8:
-    selection = dr_get_random_value(sizeof(values8) / sizeof(values8[0]));
-    values8[selection] = endian ? _byteswap_uint64(values8[selection]) : values8[selection];
-    *(uint64_t *)(buf + pos) += sub * values8[selection];
-    break;
-  default:
-    strategyAAAA(buf, size);
-    break;
+  size_t count = random_span(rng, min(capacity - size, size));
+  size_t src = sl2_rng_below(rng, size - count + 1);
+  size_t dst = sl2_rng_below(rng, size + 1);
+
+  // Open up a hole at dst, and then fill it from wherever the source span ended up.
+  memmove(buf + dst + count, buf + dst, size - dst);
+
+  if (src + count <= dst) {
+    memcpy(buf + dst, buf + src, count);
+  } else if (src >= dst) {
+    memcpy(buf + dst, buf + src + count, count);
+  } else {
+    // The hole split the source span, so its head stayed put and its tail moved past the hole.
+    size_t head = dst - src;
+    memcpy(buf + dst, buf + src, head);
+    memcpy(buf + dst + head, buf + dst + count, count - head);
+  }
+
+  return size + count;
+}
+
+SL2_EXPORT
+size_t strategyTruncate(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity) {
+  if (size < 2) {
+    strategyFlipBit(rng, buf, size);
+    return size;
+  }
+
+  return 1 + sl2_rng_below(rng, size - 1);
+}
+
+/**
+ * Picks a random token from the dictionary.
+ * @param rng - the sl2_rng to draw from
+ * @param len - receives the token's length
+ * @return the token, or NULL if there's no (non-empty) dictionary
+ */
+static const uint8_t *random_token(sl2_rng *rng, size_t *len) {
+  if (dictionary == NULL || dictionary->count == 0) {
+    return NULL;
+  }
+
+  uint32_t idx = (uint32_t)sl2_rng_below(rng, dictionary->count);
+  *len = dictionary->offsets[idx + 1] - dictionary->offsets[idx];
+
+  return dictionary->tokens + dictionary->offsets[idx];
+}
+
+SL2_EXPORT
+void strategyDictionary(sl2_rng *rng, uint8_t *buf, size_t size) {
+  size_t len = 0;
+  const uint8_t *token = random_token(rng, &len);
+
+  if (token == NULL) {
+    strategyKnownValues(rng, buf, size);
+    return;
+  }
+
+  len = min(len, size);
+  size_t pos = sl2_rng_below(rng, size - len + 1);
+
+  memcpy(buf + pos, token, len);
+}
+
+SL2_EXPORT
+size_t strategyInsertToken(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity) {
+  size_t len = 0;
+  const uint8_t *token = random_token(rng, &len);
+
+  if (token == NULL || capacity < size + len) {
+    return strategyInsertBytes(rng, buf, size, capacity);
+  }
+
+  size_t pos = sl2_rng_below(rng, size + 1);
+
+  memmove(buf + pos + len, buf + pos, size - pos);
+  memcpy(buf + pos, token, len);
+
+  return size + len;
+}
+
+/**
+ * Looks for `pattern` in the buffer, starting at a random position and wrapping around.
+ * @param rng - the sl2_rng to draw from
+ * @param buf - the buffer to search
+ * @param size - the size of the buffer
+ * @param pattern - the bytes to look for
+ * @param len - the number of bytes to look for, at most `size`
+ * @return the position of an occurrence, or `size` if there isn't one
+ */
+static size_t find_operand(sl2_rng *rng, const uint8_t *buf, size_t size, const uint8_t *pattern,
+                           size_t len) {
+  size_t positions = size - len + 1;
+  size_t start = sl2_rng_below(rng, positions);
+
+  for (size_t i = 0; i < positions; i++) {
+    size_t pos = (start + i) % positions;
+
+    if (buf[pos] == pattern[0] && !memcmp(buf + pos, pattern, len)) {
+      return pos;
+    }
+  }
+
+  return size;
+}
+
+SL2_EXPORT
+void strategyInputToState(sl2_rng *rng, uint8_t *buf, size_t size) {
+  if (cmplog == NULL || cmplog->count == 0) {
+    strategyDictionary(rng, buf, size);
+    return;
+  }
+
+  for (int tries = 0; tries < SL2_INPUT_TO_STATE_TRIES; tries++) {
+    const sl2_cmplog_entry *entry = &cmplog->entries[sl2_rng_below(rng, cmplog->count)];
+    size_t len = entry->size;
+
+    if (len == 0 || len > size) {
+      continue;
+    }
+
+    // Either operand may be the one that came from the input, so look for a random one of them.
+    uint8_t pattern[SL2_CMPLOG_MAX_OPERAND];
+    uint8_t replacement[SL2_CMPLOG_MAX_OPERAND];
+    bool swap_operands = sl2_rng_below(rng, 2);
+
+    memcpy(pattern, swap_operands ? entry->rhs : entry->lhs, len);
+    memcpy(replacement, swap_operands ? entry->lhs : entry->rhs, len);
+
+    // Integers are logged in the target's byte order, but file formats often store
+    // them big-endian and swap them on the way in.
+    if (entry->kind == SL2_CMPLOG_INT && sl2_rng_below(rng, 2)) {
+      std::reverse(pattern, pattern + len);
+      std::reverse(replacement, replacement + len);
+    }
+
+    size_t pos = find_operand(rng, buf, size, pattern, len);
+
+    if (pos < size) {
+      memcpy(buf + pos, replacement, len);
+      return;
+    }
+  }
+
+  strategyDictionary(rng, buf, size);
+}
+
+/**
+ * The kinds of token that the structure-aware strategies split text into.
+ */
+enum sl2_token_kind {
+  /*! A decimal (or 0x-prefixed hex) number, with an optional sign, fraction and exponent */
+  SL2_TOKEN_NUMBER,
+  /*! A single- or double-quoted string, quotes included */
+  SL2_TOKEN_STRING,
+  /*! A run of letters, digits and underscores that doesn't start with a digit */
+  SL2_TOKEN_WORD,
+  /*! Any other single byte: punctuation, whitespace, or binary data */
+  SL2_TOKEN_DELIM,
+};
+
+/**
+ * A token within a buffer.
+ */
+struct sl2_token {
+  size_t start;
+  size_t len;
+  sl2_token_kind kind;
+};
+
+static inline bool is_digit(uint8_t c) {
+  return c >= '0' && c <= '9';
+}
+
+static inline bool is_hex_digit(uint8_t c) {
+  return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static inline bool is_word_char(uint8_t c) {
+  return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+/**
+ * @param c a delimiter
+ * @return whether it separates the elements of a list or record (e.g. a JSON array, an INI
+ *         line, a query string), so that it goes along with a token that's duplicated or deleted
+ */
+static inline bool is_separator(uint8_t c) {
+  return c == ',' || c == ';' || c == ' ' || c == '\t' || c == '\n' || c == '&' || c == '|';
+}
+
+/**
+ * Scans the token that starts at `pos`.
+ * @param buf - the buffer
+ * @param size - the size of the buffer
+ * @param pos - where the token starts (less than `size`)
+ * @return the token
+ */
+static sl2_token scan_token(const uint8_t *buf, size_t size, size_t pos) {
+  sl2_token token = {pos, 1, SL2_TOKEN_DELIM};
+  size_t end = pos;
+  uint8_t c = buf[pos];
+
+  if (c == '"' || c == '\'') {
+    for (end = pos + 1; end < size && buf[end] != c && buf[end] != '\n'; end++) {
+      if (buf[end] == '\\' && end + 1 < size) {
+        end++;
+      }
+    }
+
+    // An unterminated string is just a quote, so that it doesn't swallow the rest of
+    // the line.
+    if (end < size && buf[end] == c) {
+      token.len = end + 1 - pos;
+      token.kind = SL2_TOKEN_STRING;
+    }
+  } else if (is_digit(c) || ((c == '-' || c == '+') && pos + 1 < size && is_digit(buf[pos + 1]))) {
+    end = pos + 1;
+
+    if (c == '0' && end + 1 < size && (buf[end] == 'x' || buf[end] == 'X') &&
+        is_hex_digit(buf[end + 1])) {
+      for (end += 1; end < size && is_hex_digit(buf[end]); end++) {
+      }
+    } else {
+      while (end < size && is_digit(buf[end])) {
+        end++;
+      }
+
+      if (end + 1 < size && buf[end] == '.' && is_digit(buf[end + 1])) {
+        for (end += 1; end < size && is_digit(buf[end]); end++) {
+        }
+      }
+
+      if (end + 1 < size && (buf[end] == 'e' || buf[end] == 'E')) {
+        size_t exp = end + 1;
+
+        if (exp + 1 < size && (buf[exp] == '-' || buf[exp] == '+')) {
+          exp++;
+        }
+
+        if (exp < size && is_digit(buf[exp])) {
+          for (end = exp; end < size && is_digit(buf[end]); end++) {
+          }
+        }
+      }
+    }
+
+    token.len = end - pos;
+    token.kind = SL2_TOKEN_NUMBER;
+  } else if (is_word_char(c)) {
+    for (end = pos + 1; end < size && is_word_char(buf[end]); end++) {
+    }
+
+    token.len = end - pos;
+    token.kind = SL2_TOKEN_WORD;
+  }
+
+  return token;
+}
+
+/**
+ * Picks a random token of the given kinds from a window of the buffer. The window starts at a
+ * random line (so that it starts on a token boundary), and is at most SL2_TOKEN_WINDOW bytes
+ * long, so that the strategies cost the same on large buffers as on small ones.
+ * @param rng - the sl2_rng to draw from
+ * @param buf - the buffer
+ * @param size - the size of the buffer (at least 1)
+ * @param kinds - a mask of the kinds to pick from (1 << sl2_token_kind)
+ * @param token - receives the token
+ * @return whether the window had a token of any of the kinds
+ */
+static bool random_token_of(sl2_rng *rng, const uint8_t *buf, size_t size, uint32_t kinds,
+                            sl2_token *token) {
+  size_t pos = sl2_rng_below(rng, size);
+  size_t floor = pos > SL2_TOKEN_WINDOW ? pos - SL2_TOKEN_WINDOW : 0;
+  uint64_t seen = 0;
+
+  while (pos > floor && buf[pos - 1] != '\n') {
+    pos--;
+  }
+
+  for (size_t end = min(size, pos + SL2_TOKEN_WINDOW); pos < end;) {
+    sl2_token candidate = scan_token(buf, size, pos);
+
+    // Reservoir sampling, so that every matching token in the window is as likely.
+    if ((kinds & (1 << candidate.kind)) && sl2_rng_below(rng, ++seen) == 0) {
+      *token = candidate;
+    }
+
+    pos += candidate.len;
+  }
+
+  return seen > 0;
+}
+
+/**
+ * Widens a token to take one of the separators next to it along: the one after it if there is
+ * one, otherwise the one before it.
+ * @param buf - the buffer
+ * @param size - the size of the buffer
+ * @param token - the token to widen
+ */
+static void take_separator(const uint8_t *buf, size_t size, sl2_token *token) {
+  if (token->start + token->len < size && is_separator(buf[token->start + token->len])) {
+    token->len++;
+  } else if (token->start > 0 && is_separator(buf[token->start - 1])) {
+    token->start--;
+    token->len++;
   }
 }
 
+/*! The token kinds that the duplicating and deleting strategies work on. */
+#define SL2_TOKEN_VALUES                                                                           \
+  ((1 << SL2_TOKEN_NUMBER) | (1 << SL2_TOKEN_STRING) | (1 << SL2_TOKEN_WORD))
+
 SL2_EXPORT
-void strategyEndianSwap(uint8_t *buf, size_t size) {
-  size_t rand_size;
+void strategyTokenNumber(sl2_rng *rng, uint8_t *buf, size_t size) {
+  sl2_token token;
+
+  if (!random_token_of(rng, buf, size, 1 << SL2_TOKEN_NUMBER, &token)) {
+    strategyKnownValues(rng, buf, size);
+    return;
+  }
+
+  int64_t value = KNOWN_VALUES_64[sl2_rng_below(rng, width_traits<uint64_t>::num_known)];
+  bool negative = value < 0;
+  uint64_t magnitude = negative ? 0 - (uint64_t)value : (uint64_t)value;
+  uint8_t digits[20];
+  size_t len = 0;
+
   do {
-    rand_size = (size_t)1 << dr_get_random_value(4);
-  } while (size < rand_size);
-  size_t max = (size + 1) - rand_size;
-  size_t pos = dr_get_random_value((uint)max);
-
-  switch (rand_size) {
-  case 1:
-    // nibble endianness, because sim cards
-    *(uint8_t *)(buf + pos) = *(uint8_t *)(buf + pos) >> 4 | *(uint8_t *)(buf + pos) << 4;
-    break;
-  case 2:
-    *(uint16_t *)(buf + pos) = _byteswap_ushort(*(uint16_t *)(buf + pos));
-    break;
-  case 4:
-    *(uint32_t *)(buf + pos) = _byteswap_ulong(*(uint32_t *)(buf + pos));
-    break;
-  case 8:
-    *(uint64_t *)(buf + pos) = _byteswap_uint64(*(uint64_t *)(buf + pos));
-    break;
-  default:
-    strategyAAAA(buf, size);
-    break;
+    digits[sizeof(digits) - ++len] = (uint8_t)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude);
+
+  size_t room = token.len - ((negative && token.len > 1) ? 1 : 0);
+  uint8_t *out = buf + token.start;
+
+  if (negative && token.len > 1) {
+    *out++ = '-';
+  }
+
+  // The number keeps its width: shorter values are zero-padded, and longer ones become the
+  // largest value that fits.
+  if (len > room) {
+    memset(out, '9', room);
+  } else {
+    memset(out, '0', room - len);
+    memcpy(out + room - len, digits + sizeof(digits) - len, len);
   }
 }
 
 /**
- * Applies the mutation strategy given by the index
- * @param buf - pointer to the buffer to be mutated
- * @param size - number of bytes to mutate
+ * A plausible length prefix: an unsigned integer that counts the bytes right after it.
+ */
+struct sl2_length_field {
+  size_t pos;
+  /*! The field's width, in bytes (1, 2 or 4) */
+  size_t width;
+  bool big_endian;
+  uint64_t value;
+};
+
+static uint64_t read_length_field(const uint8_t *buf, size_t width, bool big_endian) {
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < width; i++) {
+    value |= (uint64_t)buf[big_endian ? width - 1 - i : i] << (8 * i);
+  }
+
+  return value;
+}
+
+static void write_length_field(uint8_t *buf, const sl2_length_field &field, uint64_t value) {
+  for (size_t i = 0; i < field.width; i++) {
+    buf[field.pos + (field.big_endian ? field.width - 1 - i : i)] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+static inline bool is_printable(uint8_t c) {
+  return (c >= 0x20 && c < 0x7F) || c == '\t' || c == '\n' || c == '\r';
+}
+
+/**
+ * @param buf - the buffer
+ * @param size - the size of the buffer
+ * @param pos - a position in the buffer
+ * @return whether the byte at `pos`, and the bytes on either side of it, are all text. Lone bytes
+ *         like that are nearly always characters rather than lengths.
+ */
+static bool in_text(const uint8_t *buf, size_t size, size_t pos) {
+  return pos > 0 && pos + 1 < size && is_printable(buf[pos - 1]) && is_printable(buf[pos]) &&
+         is_printable(buf[pos + 1]);
+}
+
+/**
+ * Looks for a plausible length prefix (in a TLV record, say), starting at a random position and
+ * trying at most SL2_TOKEN_WINDOW positions. Wider fields are preferred, since a single byte is
+ * a plausible length far more often by chance (and single bytes within text are skipped).
+ * @param rng - the sl2_rng to draw from
+ * @param buf - the buffer
+ * @param size - the size of the buffer
+ * @param field - receives the length prefix
+ * @return whether one was found
+ */
+static bool find_length_field(sl2_rng *rng, const uint8_t *buf, size_t size,
+                              sl2_length_field *field) {
+  static const size_t widths[] = {4, 2, 1};
+  size_t start = sl2_rng_below(rng, size);
+  size_t tries = min(size, (size_t)SL2_TOKEN_WINDOW);
+
+  for (size_t i = 0; i < tries; i++) {
+    size_t pos = (start + i) % size;
+
+    for (size_t width : widths) {
+      for (int big_endian = 0; big_endian < 2; big_endian++) {
+        if (width == 1 && (big_endian || in_text(buf, size, pos))) {
+          continue;
+        }
+
+        uint64_t value = pos + width <= size ? read_length_field(buf + pos, width, big_endian) : 0;
+
+        // A zero length is plausible, but there's nothing in it to resize.
+        if (value >= (width == 1 ? 2 : 1) && value <= size - pos - width) {
+          *field = {pos, width, big_endian != 0, value};
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+SL2_EXPORT
+void strategyTokenLength(sl2_rng *rng, uint8_t *buf, size_t size) {
+  sl2_length_field field;
+
+  if (!find_length_field(rng, buf, size, &field)) {
+    strategyKnownValues(rng, buf, size);
+    return;
+  }
+
+  uint64_t remaining = size - field.pos - field.width;
+  uint64_t field_max = field.width == 4 ? 0xFFFFFFFF : (1ULL << (8 * field.width)) - 1;
+  uint64_t lengths[] = {0, field.value - 1, field.value + 1, remaining, remaining + 1, field_max};
+
+  write_length_field(buf, field, lengths[sl2_rng_below(rng, sizeof(lengths) / sizeof(lengths[0]))]);
+}
+
+SL2_EXPORT
+size_t strategyTokenDuplicate(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity) {
+  sl2_token token;
+
+  if (!random_token_of(rng, buf, size, SL2_TOKEN_VALUES, &token)) {
+    return strategySpliceBytes(rng, buf, size, capacity);
+  }
+
+  take_separator(buf, size, &token);
+
+  if (capacity < size + token.len) {
+    return strategySpliceBytes(rng, buf, size, capacity);
+  }
+
+  size_t end = token.start + token.len;
+
+  memmove(buf + end + token.len, buf + end, size - end);
+  memcpy(buf + end, buf + token.start, token.len);
+
+  return size + token.len;
+}
+
+SL2_EXPORT
+size_t strategyTokenDelete(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity) {
+  sl2_token token;
+
+  if (!random_token_of(rng, buf, size, SL2_TOKEN_VALUES, &token)) {
+    return strategyDeleteShiftBytes(rng, buf, size, capacity);
+  }
+
+  take_separator(buf, size, &token);
+
+  if (token.len >= size) {
+    return strategyDeleteShiftBytes(rng, buf, size, capacity);
+  }
+
+  size_t end = token.start + token.len;
+  memmove(buf + token.start, buf + end, size - end);
+
+  return size - token.len;
+}
+
+SL2_EXPORT
+size_t strategyTokenResize(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity) {
+  sl2_length_field field;
+
+  if (!find_length_field(rng, buf, size, &field)) {
+    return strategyInsertBytes(rng, buf, size, capacity);
+  }
+
+  uint64_t field_max = field.width == 4 ? 0xFFFFFFFF : (1ULL << (8 * field.width)) - 1;
+  size_t value_start = field.pos + field.width;
+  size_t grow = (size_t)min((uint64_t)(capacity > size ? capacity - size : 0),
+                            field_max - field.value);
+  bool shrink = !grow || sl2_rng_below(rng, 2);
+
+  if (shrink) {
+    size_t count = random_span(rng, (size_t)field.value);
+    size_t pos = value_start + sl2_rng_below(rng, (size_t)field.value - count + 1);
+
+    memmove(buf + pos, buf + pos + count, size - pos - count);
+    write_length_field(buf, field, field.value - count);
+
+    return size - count;
+  }
+
+  // Grow the value with a copy of part of itself, so that it stays made up of the same stuff.
+  size_t count = random_span(rng, min(grow, (size_t)field.value));
+  size_t src = value_start + sl2_rng_below(rng, (size_t)field.value - count + 1);
+  size_t dst = value_start + sl2_rng_below(rng, (size_t)field.value + 1);
+  uint8_t copy[SL2_TOKEN_MAX_GROWTH];
+
+  count = min(count, sizeof(copy));
+  memcpy(copy, buf + src, count);
+  memmove(buf + dst + count, buf + dst, size - dst);
+  memcpy(buf + dst, copy, count);
+  write_length_field(buf, field, field.value + count);
+
+  return size + count;
+}
+
+/**
+ * The number of strategies that are applicable to the given mutation.
+ * @param mutation - the mutation
+ * @return the number of strategies; indices past SL2_NUM_STRATEGIES are resize strategies
+ */
+static uint32_t num_strategies(sl2_mutation *mutation) {
+  if (mutation->capacity < mutation->bufsize || mutation->capacity == 0) {
+    return SL2_NUM_STRATEGIES;
+  }
+
+  return SL2_NUM_STRATEGIES + SL2_NUM_RESIZE_STRATEGIES;
+}
+
+/**
+ * Applies the mutation strategy given by the index. Resize strategies (indices starting at
+ * SL2_NUM_STRATEGIES) update `mutation->bufsize`.
+ * @param rng - the sl2_rng to draw random decisions from
+ * @param mutation - the mutation whose buffer should be mutated
  * @param choice - index of the strategy to use
  * @return bool indicating success
  */
-static bool mutate_buffer_choice(uint8_t *buf, size_t size, uint32_t choice) {
-  if (size == 0 || choice > SL2_NUM_STRATEGIES - 1) {
+static bool mutate_buffer_choice(sl2_rng *rng, sl2_mutation *mutation, uint32_t choice) {
+  if (mutation->bufsize == 0 || choice >= num_strategies(mutation)) {
     return false;
   }
 
-  SL2_STRATEGY_TABLE[choice](buf, size);
+  if (choice < SL2_NUM_STRATEGIES) {
+    SL2_STRATEGY_TABLE[choice](rng, mutation->buffer, mutation->bufsize);
+  } else {
+    mutation->bufsize = SL2_RESIZE_STRATEGY_TABLE[choice - SL2_NUM_STRATEGIES](
+        rng, mutation->buffer, mutation->bufsize, mutation->capacity);
+  }
 
   return true;
 }
 
 /**
  * Allows directly passing in a specific strategy to be applied
+ * @param rng - the sl2_rng to draw random decisions from
  * @param buf - pointer to the buffer to be mutated
  * @param size - number of bytes to mutate
  * @param strategy - function pointer to the strategy
  * @return bool indicating success
  */
-static bool mutate_buffer_custom(uint8_t *buf, size_t size, sl2_strategy_t strategy) {
+static bool mutate_buffer_custom(sl2_rng *rng, uint8_t *buf, size_t size,
+                                 sl2_strategy_t strategy) {
   if (size == 0) {
     return false;
   }
 
-  strategy(buf, size);
+  strategy(rng, buf, size);
 
   return true;
 }
 
 SL2_EXPORT
-bool do_mutation(sl2_mutation *mutation) {
-  mutation->mut_type = dr_get_random_value(SL2_NUM_STRATEGIES);
+bool do_mutation(sl2_rng *rng, sl2_mutation *mutation) {
+  mutation->mut_type = (uint32_t)sl2_rng_below(rng, num_strategies(mutation));
 
-  return mutate_buffer_choice(mutation->buffer, mutation->bufsize, mutation->mut_type);
+  return mutate_buffer_choice(rng, mutation, mutation->mut_type);
 }
 
 SL2_EXPORT
-bool do_mutation_custom(sl2_mutation *mutation, sl2_strategy_t strategy) {
+bool do_mutation_custom(sl2_rng *rng, sl2_mutation *mutation, sl2_strategy_t strategy) {
   mutation->mut_type = SL2_CUSTOM_STRATEGY;
 
-  return mutate_buffer_custom(mutation->buffer, mutation->bufsize, strategy);
+  return mutate_buffer_custom(rng, mutation->buffer, mutation->bufsize, strategy);
+}
+
+SL2_EXPORT
+bool do_mutation_havoc(sl2_rng *rng, sl2_mutation *mutation, uint32_t max_stack,
+                       int first_strategy) {
+  if (max_stack == 0 || max_stack > SL2_MAX_MUTATION_CHAIN) {
+    max_stack = SL2_MAX_MUTATION_CHAIN;
+  }
+
+  mutation->mut_type = SL2_HAVOC_STRATEGY;
+  mutation->chain_seed = sl2_rng_next(rng);
+  mutation->chain_len = 1 + (uint32_t)sl2_rng_below(rng, max_stack);
+
+  // The stack itself comes from `rng`, but the strategies only ever draw from a PRNG
+  // seeded with chain_seed. That way, the recorded chain and seed are all it takes to replay it.
+  for (uint32_t i = 0; i < mutation->chain_len; i++) {
+    mutation->chain[i] = (uint32_t)sl2_rng_below(rng, num_strategies(mutation));
+  }
+
+  if (first_strategy >= 0) {
+    mutation->chain[0] = (uint32_t)first_strategy;
+  }
+
+  return do_mutation_chain(mutation);
+}
+
+SL2_EXPORT
+bool do_mutation_chain(sl2_mutation *mutation) {
+  sl2_rng chain_rng;
+
+  if (mutation->chain_len == 0 || mutation->chain_len > SL2_MAX_MUTATION_CHAIN) {
+    return false;
+  }
+
+  sl2_rng_seed(&chain_rng, mutation->chain_seed);
+
+  for (uint32_t i = 0; i < mutation->chain_len; i++) {
+    if (!mutate_buffer_choice(&chain_rng, mutation, mutation->chain[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// The interesting-value stages walk the same values that strategyKnownValues picks from.
+#define DET_NUM_VALUES1 (width_traits<uint8_t>::num_known)
+#define DET_NUM_VALUES2 (width_traits<uint16_t>::num_known)
+#define DET_NUM_VALUES4 (width_traits<uint32_t>::num_known)
+
+SL2_EXPORT
+bool do_mutation_splice(sl2_rng *rng, sl2_mutation *mutation, const uint8_t *donor,
+                        size_t donor_size) {
+  size_t common = min(mutation->bufsize, donor_size);
+  size_t first = 0;
+  size_t last = 0;
+
+  // Like AFL, we only split where the two inputs differ; splitting anywhere else just
+  // hands back one of them.
+  while (first < common && mutation->buffer[first] == donor[first]) {
+    first++;
+  }
+
+  for (size_t i = first; i < common; i++) {
+    if (mutation->buffer[i] != donor[i]) {
+      last = i;
+    }
+  }
+
+  if (first >= common || last <= first) {
+    return false;
+  }
+
+  size_t split = first + 1 + sl2_rng_below(rng, last - first);
+  size_t size = mutation->bufsize;
+
+  if (mutation->capacity >= mutation->bufsize && mutation->capacity != 0) {
+    size = min(donor_size, mutation->capacity);
+  }
+
+  memcpy(mutation->buffer + split, donor + split, min(size, donor_size) - split);
+
+  mutation->bufsize = size;
+  mutation->mut_type = SL2_SPLICE_STRATEGY;
+
+  return true;
+}
+
+SL2_EXPORT
+uint64_t sl2_det_stage_len(uint32_t stage, size_t size) {
+  switch (stage) {
+  case SL2_DET_FLIP1:
+    return (uint64_t)size * 8;
+  case SL2_DET_FLIP8:
+    return size;
+  case SL2_DET_ARITH8:
+    return (uint64_t)size * 2 * SL2_DET_ARITH_MAX;
+  case SL2_DET_INTEREST8:
+    return (uint64_t)size * DET_NUM_VALUES1;
+  case SL2_DET_INTEREST16:
+    return size < sizeof(uint16_t) ? 0 : (uint64_t)(size - 1) * 2 * DET_NUM_VALUES2;
+  case SL2_DET_INTEREST32:
+    return size < sizeof(uint32_t) ? 0 : (uint64_t)(size - 3) * 2 * DET_NUM_VALUES4;
+  default:
+    return 0;
+  }
+}
+
+SL2_EXPORT
+bool do_mutation_deterministic(sl2_mutation *mutation, const sl2_det_cursor *cursor) {
+  uint8_t *buf = mutation->buffer;
+  uint64_t offset = cursor->offset;
+
+  if (offset >= sl2_det_stage_len(cursor->stage, mutation->bufsize)) {
+    return false;
+  }
+
+  mutation->mut_type = SL2_DETERMINISTIC_STRATEGY;
+
+  switch (cursor->stage) {
+  case SL2_DET_FLIP1:
+    buf[offset / 8] ^= 0x80 >> (offset % 8);
+    break;
+  case SL2_DET_FLIP8:
+    buf[offset] ^= 0xFF;
+    break;
+  case SL2_DET_ARITH8: {
+    size_t pos = (size_t)(offset / (2 * SL2_DET_ARITH_MAX));
+    uint32_t step = (uint32_t)(offset % (2 * SL2_DET_ARITH_MAX));
+    uint8_t delta = (uint8_t)(1 + (step / 2));
+
+    if (step % 2) {
+      buf[pos] -= delta;
+    } else {
+      buf[pos] += delta;
+    }
+    break;
+  }
+  case SL2_DET_INTEREST8:
+    buf[offset / DET_NUM_VALUES1] = (uint8_t)KNOWN_VALUES_8[offset % DET_NUM_VALUES1];
+    break;
+  case SL2_DET_INTEREST16: {
+    size_t pos = (size_t)(offset / (2 * DET_NUM_VALUES2));
+    uint32_t step = (uint32_t)(offset % (2 * DET_NUM_VALUES2));
+    uint16_t value = (uint16_t)KNOWN_VALUES_16[step / 2];
+
+    if (step % 2) {
+      value = _byteswap_ushort(value);
+    }
+
+    memcpy(buf + pos, &value, sizeof(value));
+    break;
+  }
+  case SL2_DET_INTEREST32: {
+    size_t pos = (size_t)(offset / (2 * DET_NUM_VALUES4));
+    uint32_t step = (uint32_t)(offset % (2 * DET_NUM_VALUES4));
+    uint32_t value = (uint32_t)KNOWN_VALUES_32[step / 2];
+
+    if (step % 2) {
+      value = _byteswap_ulong(value);
+    }
+
+    memcpy(buf + pos, &value, sizeof(value));
+    break;
+  }
+  }
+
+  return true;
+}
+
+SL2_EXPORT
+bool sl2_dictionary_parse(sl2_dictionary *dict, const uint8_t *data, size_t size) {
+  const sl2_dictionary_header *header = (const sl2_dictionary_header *)data;
+
+  if (size < sizeof(*header) || memcmp(header->magic, SL2_DICTIONARY_MAGIC, 4) ||
+      header->version != SL2_DICTIONARY_VERSION) {
+    return false;
+  }
+
+  size_t index_size = ((size_t)header->count + 1) * sizeof(uint32_t);
+
+  if (size - sizeof(*header) < index_size) {
+    return false;
+  }
+
+  dict->count = header->count;
+  dict->offsets = (const uint32_t *)(data + sizeof(*header));
+  dict->tokens = data + sizeof(*header) + index_size;
+
+  // Make sure that every token is in bounds, so that the strategies don't have to check.
+  size_t tokens_size = size - sizeof(*header) - index_size;
+
+  for (uint32_t i = 0; i < dict->count; i++) {
+    if (dict->offsets[i] > dict->offsets[i + 1] || dict->offsets[i + 1] > tokens_size ||
+        dict->offsets[i + 1] - dict->offsets[i] > SL2_MAX_TOKEN_LEN) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+SL2_EXPORT
+void set_mutation_dictionary(const sl2_dictionary *dict) {
+  dictionary = dict;
+}
+
+SL2_EXPORT
+bool sl2_cmplog_parse(sl2_cmplog *log, const uint8_t *data, size_t size) {
+  const sl2_cmplog_header *header = (const sl2_cmplog_header *)data;
+
+  if (size < sizeof(*header) || memcmp(header->magic, SL2_CMPLOG_MAGIC, 4) ||
+      header->version != SL2_CMPLOG_VERSION || header->count > SL2_CMPLOG_MAX_ENTRIES ||
+      size - sizeof(*header) < (size_t)header->count * sizeof(sl2_cmplog_entry)) {
+    return false;
+  }
+
+  log->count = header->count;
+  log->entries = (const sl2_cmplog_entry *)(data + sizeof(*header));
+
+  // Make sure that every operand is in bounds, so that strategyInputToState doesn't have to check.
+  for (uint32_t i = 0; i < log->count; i++) {
+    if (log->entries[i].size > SL2_CMPLOG_MAX_OPERAND) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+SL2_EXPORT
+void set_mutation_cmplog(const sl2_cmplog *log) {
+  cmplog = log;
+}
+
+SL2_EXPORT
+bool sl2_fixups_parse(sl2_fixups *fixups, const uint8_t *data, size_t size) {
+  const sl2_fixups_header *header = (const sl2_fixups_header *)data;
+
+  if (size < sizeof(*header) || memcmp(header->magic, SL2_FIXUPS_MAGIC, 4) ||
+      header->version != SL2_FIXUPS_VERSION || header->count > SL2_MAX_FIXUPS ||
+      size - sizeof(*header) < (size_t)header->count * sizeof(sl2_fixup)) {
+    return false;
+  }
+
+  fixups->count = header->count;
+  fixups->fixups = (const sl2_fixup *)(data + sizeof(*header));
+
+  // Make sure that every fixup can be computed, so that sl2_apply_fixups only checks its bounds.
+  for (uint32_t i = 0; i < fixups->count; i++) {
+    const sl2_fixup *fixup = &(fixups->fixups[i]);
+
+    if (fixup->algorithm >= SL2_FIXUP_ALGORITHMS ||
+        (fixup->width != 1 && fixup->width != 2 && fixup->width != 4)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @param offset a fixup offset, which counts back from the end of the buffer if it's below 0
+ * @param size the size of the buffer
+ * @param end whether the offset is a range's end, for which 0 is the end of the buffer
+ * @return the offset from the start of the buffer, or -1 if it's out of bounds
+ */
+static int64_t fixup_offset(int32_t offset, size_t size, bool end) {
+  int64_t resolved = (offset < 0 || (end && offset == 0)) ? (int64_t)size + offset : offset;
+
+  return (resolved < 0 || resolved > (int64_t)size) ? -1 : resolved;
+}
+
+/**
+ * @param buf the bytes to checksum
+ * @param size the number of bytes
+ * @return the bytes' CRC-32
+ */
+static uint32_t fixup_crc32(const uint8_t *buf, size_t size) {
+  static uint32_t table[256];
+  static bool table_built = false;
+
+  // Every thread builds the same table, so racing to build it is harmless.
+  if (!table_built) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+      }
+
+      table[i] = crc;
+    }
+
+    table_built = true;
+  }
+
+  uint32_t crc = 0xffffffff;
+
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+  }
+
+  return ~crc;
+}
+
+/**
+ * @param buf the bytes to checksum
+ * @param size the number of bytes
+ * @return the bytes' Adler-32
+ */
+static uint32_t fixup_adler32(const uint8_t *buf, size_t size) {
+  uint32_t a = 1;
+  uint32_t b = 0;
+
+  for (size_t i = 0; i < size; i++) {
+    a = (a + buf[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+
+  return (b << 16) | a;
+}
+
+SL2_EXPORT
+bool sl2_apply_fixups(const sl2_fixups *fixups, uint32_t mut_count, uint8_t *buf, size_t size) {
+  bool changed = false;
+
+  for (uint32_t i = 0; i < fixups->count; i++) {
+    const sl2_fixup *fixup = &(fixups->fixups[i]);
+
+    if (fixup->mut_count != SL2_FIXUP_ANY_READ && fixup->mut_count != mut_count) {
+      continue;
+    }
+
+    int64_t field = fixup_offset(fixup->field, size, false);
+    int64_t start = fixup_offset(fixup->start, size, false);
+    int64_t end = fixup_offset(fixup->end, size, true);
+
+    if (field < 0 || field + fixup->width > (int64_t)size || start < 0 || end < start) {
+      continue;
+    }
+
+    uint8_t before[4];
+    memcpy(before, buf + field, fixup->width);
+
+    if (field < end && field + fixup->width > start) {
+      memset(buf + field, 0, fixup->width);
+    }
+
+    const uint8_t *covered = buf + start;
+    size_t covered_size = (size_t)(end - start);
+    uint32_t value = 0;
+
+    switch (fixup->algorithm) {
+    case SL2_FIXUP_LENGTH:
+      value = (uint32_t)covered_size;
+      break;
+    case SL2_FIXUP_CRC32:
+      value = fixup_crc32(covered, covered_size);
+      break;
+    case SL2_FIXUP_ADLER32:
+      value = fixup_adler32(covered, covered_size);
+      break;
+    case SL2_FIXUP_SUM:
+      for (size_t j = 0; j < covered_size; j++) {
+        value += covered[j];
+      }
+      break;
+    }
+
+    value += (uint32_t)fixup->adjust;
+
+    for (uint8_t j = 0; j < fixup->width; j++) {
+      uint8_t shift = 8 * (fixup->big_endian ? fixup->width - 1 - j : j);
+      buf[field + j] = (uint8_t)(value >> shift);
+    }
+
+    changed |= memcmp(before, buf + field, fixup->width) != 0;
+  }
+
+  return changed;
 }
@@ -2,6 +2,8 @@
 
 #include "common/sl2_dr_client.hpp"
 
+SL2_ETW_DEFINE_PROVIDER();
+
 using namespace std;
 
 // NOTE(ww): As of Windows 10, both KERNEL32.dll and ADVAPI32.dll
@@ -40,14 +42,40 @@ sl2_funcmod SL2_FUNCMOD_TABLE[] = {
  * Common functionality for DynamoRIO clients
  */
 SL2Client::SL2Client() {
+  memset(&call_counts, 0, sizeof(call_counts));
+  target_count = 0;
+  handle_paths_lock = NULL;
+  hook_module_count = 0;
+  module_hook_count = 0;
 }
 
 /**
- * Creates a SHA256 hash of the arguments to a function
- * @param argHash pointer to the char buffer to write the hex-encoded hash into
+ * Hashes the arguments to a function
+ * @param argHash pointer to the char buffer to write the hex-encoded hash into (at least
+ *                SL2_HASH_LEN + 1 bytes)
  * @param hash_ctx pointer to the context containing the information to hash
+ * @param version which hash to use: SHA256 (SL2_ARG_HASH_SHA256), or the much cheaper 64-bit
+ *                FNV-1a (SL2_ARG_HASH_FNV1A64)
  */
-void SL2Client::hash_args(char *argHash, hash_context *hash_ctx) {
+void SL2Client::hash_args(char *argHash, hash_context *hash_ctx, uint32_t version) {
+  SL2_PROFILE(SL2_PROBE_HASH_ARGS);
+  if (version == SL2_ARG_HASH_FNV1A64) {
+    static const char hex[] = "0123456789abcdef";
+    const uint8_t *bytes = (const uint8_t *)hash_ctx;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for (size_t i = 0; i < sizeof(hash_context); i++) {
+      hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+
+    for (int i = 15; i >= 0; i--, hash >>= 4) {
+      argHash[i] = hex[hash & 0xf];
+    }
+
+    argHash[16] = 0;
+    return;
+  }
+
   std::vector<unsigned char> blob_vec((unsigned char *)hash_ctx,
                                       ((unsigned char *)hash_ctx) + sizeof(hash_context));
   std::string hash_str;
@@ -56,128 +84,197 @@ void SL2Client::hash_args(char *argHash, hash_context *hash_ctx) {
   memcpy((void *)argHash, hash_str.c_str(), SL2_HASH_LEN);
 }
 
+/**
+ * Stashes the arguments to a function in its read info, to be hashed by `arg_hash` if (and only if)
+ * a target needs them. Most hooked calls are matched without a hash, or don't match at all.
+ * @param info - the hooked function call
+ * @param hash_ctx - the information to hash
+ */
+void SL2Client::defer_hash_args(client_read_info *info, hash_context *hash_ctx) {
+  info->hashCtx = *hash_ctx;
+  info->argHashVersion = 0;
+}
+
+/**
+ * Hashes the arguments to a function call on first use, and caches the result in its read info.
+ * @param info - the hooked function call; its arguments must have been passed to `defer_hash_args`
+ * @param version - the hash format to return (SL2_ARG_HASH_*)
+ * @return the hex-encoded hash, or NULL if the call has nowhere to store one
+ */
+const char *SL2Client::arg_hash(client_read_info *info, uint32_t version) {
+  if (!info->argHash) {
+    return NULL;
+  }
+
+  if (info->argHashVersion != version) {
+    hash_args(info->argHash, &info->hashCtx, version);
+    info->argHashVersion = version;
+  }
+
+  return info->argHash;
+}
+
 /**
  * Implements targeting strategies to determine whether we should fuzz a given function call.
+ * This runs on every hooked call, so it only walks the compiled targets for the hooked
+ * function (see `compile_targets`) and never allocates.
  * @param info - struct containing information about the last function call hooked via pre callback
+ * @param target_index - if not NULL, receives the index (in the target file) of the matching target
  * @return true if the current function should be targeted.
  */
-bool SL2Client::is_function_targeted(client_read_info *info) {
+bool SL2Client::is_function_targeted(client_read_info *info, size_t *target_index) {
+  SL2_PROFILE(SL2_PROBE_IS_FUNCTION_TARGETED);
   Function function = info->function;
-  const char *func_name = function_to_string(function);
 
-  for (targetFunction t : parsedJson) {
-    if (t.selected && STREQ(t.functionName.c_str(), func_name)) {
-      if (t.mode & MATCH_INDEX && compare_indices(t, function)) {
-        return true;
-      }
-      if (t.mode & MATCH_RETN_ADDRESS && compare_return_addresses(t, info)) {
-        return true;
-      }
-      if (t.mode & MATCH_ARG_HASH && compare_arg_hashes(t, info)) {
-        return true;
-      }
-      if (t.mode & MATCH_ARG_COMPARE && compare_arg_buffers(t, info)) {
-        return true;
-      }
-      if (t.mode & MATCH_FILENAMES && compare_filenames(t, info)) {
-        return true;
-      }
-      if (t.mode & MATCH_RETN_COUNT && compare_index_at_retaddr(t, info)) {
-        return true;
-      }
-      if (t.mode & LOW_PRECISION) {
-        // if filename is available
-        if (info->source && compare_filenames(t, info)) {
-          if (compare_filenames(t, info)) {
-            return true;
-          }
-        }
-        if (compare_return_addresses(t, info) && compare_arg_buffers(t, info)) {
-          return true;
-        }
-      }
-      if (t.mode & MEDIUM_PRECISION) {
-        if (compare_arg_hashes(t, info) && compare_return_addresses(t, info)) {
-          return true;
-        }
+  if ((size_t)function >= SL2_NUM_FUNCTIONS) {
+    return false;
+  }
+
+  sl2_function_targets &table = compiledTargets[(size_t)function];
+
+  // If every target needs its own return address, most calls can be ruled out with one lookup.
+  if (!table.retAddrs.empty() &&
+      !std::binary_search(table.retAddrs.begin(), table.retAddrs.end(),
+                          (uint64_t)info->retAddrOffset & SUB_ASLR_BITS)) {
+    return false;
+  }
+
+  for (const sl2_target &t : table.targets) {
+    bool matched = false;
+
+    if (t.mode & MATCH_INDEX && compare_indices(t, function)) {
+      matched = true;
+    } else if (t.mode & MATCH_RETN_ADDRESS && compare_return_addresses(t, info)) {
+      matched = true;
+    } else if (t.mode & MATCH_ARG_HASH && compare_arg_hashes(t, info)) {
+      matched = true;
+    } else if (t.mode & MATCH_ARG_COMPARE && compare_arg_buffers(t, info)) {
+      matched = true;
+    } else if (t.mode & MATCH_FILENAMES && compare_filenames(t, info)) {
+      matched = true;
+    } else if (t.mode & MATCH_RETN_COUNT && compare_index_at_retaddr(t, info)) {
+      matched = true;
+    } else if (t.mode & LOW_PRECISION) {
+      // if filename is available
+      if (info->source && compare_filenames(t, info)) {
+        matched = true;
+      } else if (compare_return_addresses(t, info) && compare_arg_buffers(t, info)) {
+        matched = true;
       }
-      if (t.mode & HIGH_PRECISION) {
-        if (compare_arg_hashes(t, info) && compare_index_at_retaddr(t, info)) {
-          return true;
-        }
+    }
+
+    if (!matched && t.mode & MEDIUM_PRECISION) {
+      matched = compare_arg_hashes(t, info) && compare_return_addresses(t, info);
+    }
+
+    if (!matched && t.mode & HIGH_PRECISION) {
+      matched = compare_arg_hashes(t, info) && compare_index_at_retaddr(t, info);
+    }
+
+    if (matched) {
+      if (target_index) {
+        *target_index = t.json_index;
       }
+
+      sl2_etw_targeted_call(function_to_string(function), (uint64_t)info->retAddrOffset,
+                            info->nNumberOfBytesToRead);
+      return true;
     }
   }
   return false;
 }
 
+/**
+ * Checks whether any target could still match a later call to the given function. Call counts
+ * only go up, so once a function has been called past the index of every target that matches on
+ * MATCH_INDEX alone, none of them ever will.
+ * @param function - the hooked function, whose call count includes the current call
+ * @return false if no later call can be targeted, true if one might be
+ */
+bool SL2Client::can_still_match(Function function) {
+  if ((size_t)function >= SL2_NUM_FUNCTIONS) {
+    return true;
+  }
+
+  sl2_function_targets &table = compiledTargets[(size_t)function];
+
+  if (table.targets.empty()) {
+    return false;
+  }
+
+  if (!table.indexOnly) {
+    return true;
+  }
+
+  return thread_call_counts().counts[(size_t)function] < table.maxIndex;
+}
+
 /**
  * compares the name of the file argument to this function with the name of the file argument
  * recorded by the wizard
- * @param t - struct describing the desired function to target, loaded from disk
+ * @param t - the compiled target to compare against
  * @param info - information about the last hooked function call
  * @return true if they match, false if they don't
  */
-bool SL2Client::compare_filenames(targetFunction &t, client_read_info *info) {
+bool SL2Client::compare_filenames(const sl2_target &t, client_read_info *info) {
   return !wcscmp(t.source.c_str(), info->source);
 }
 
 /**
  * compares the number of times we've seen the given function
- * @param t - struct describing the desired function to target, loaded from disk
+ * @param t - the compiled target to compare against
  * @param function - the function currently hooked
  * @return true if they match, false if they don't
  */
-bool SL2Client::compare_indices(targetFunction &t, Function &function) {
-  return call_counts[function] == t.index;
+bool SL2Client::compare_indices(const sl2_target &t, Function &function) {
+  return (size_t)function < SL2_NUM_FUNCTIONS &&
+         thread_call_counts().counts[(size_t)function] == t.index;
 }
 
 /**
  * compares the number of times we've encountered the given return address with the count from the
  * wizard
- * @param t - struct describing the desired function to target, loaded from disk
+ * @param t - the compiled target to compare against
  * @param info - information about the last hooked function call
  * @return true if they match, false if they don't
  */
-bool SL2Client::compare_index_at_retaddr(targetFunction &t, client_read_info *info) {
-  return ret_addr_counts[info->retAddrOffset] == t.retAddrCount;
+bool SL2Client::compare_index_at_retaddr(const sl2_target &t, client_read_info *info) {
+  return thread_ret_addr_counts().get(info->retAddrOffset) == t.retAddrCount;
 }
 
 /**
  * compares the return address of the function with the one recorded by the wizard
- * @param t - struct describing the desired function to target, loaded from disk
+ * @param t - the compiled target to compare against
  * @param info - information about the last hooked function call
  * @return true if they match, false if they don't
  */
-bool SL2Client::compare_return_addresses(targetFunction &t, client_read_info *info) {
+bool SL2Client::compare_return_addresses(const sl2_target &t, client_read_info *info) {
   // Get around ASLR by only examining the bottom bits. This is something of a cheap hack and we
   // should ideally store a copy of the memory map in every run
-  uint64_t left = t.retAddrOffset & SUB_ASLR_BITS;
-  uint64_t right = info->retAddrOffset & SUB_ASLR_BITS;
-  // SL2_DR_DEBUG("Comparing 0x%llx to 0x%llx (%s)\n", left, right, left == right ? "True" :
-  // "False");
-  return left == right;
+  // The target's side was already masked by compile_targets.
+  return t.retAddrOffset == (info->retAddrOffset & SUB_ASLR_BITS);
 }
 
 /**
  * compares the hash of the arguments for the function
- * @param t - struct describing the desired function to target, loaded from disk
+ * @param t - the compiled target to compare against
  * @param info - information about the last hooked function call
  * @return true if they match, false if they don't
  */
-bool SL2Client::compare_arg_hashes(targetFunction &t, client_read_info *info) {
-  return STREQ(t.argHash.c_str(), info->argHash);
+bool SL2Client::compare_arg_hashes(const sl2_target &t, client_read_info *info) {
+  const char *hash = arg_hash(info, t.argHashVersion);
+  return hash && STREQ(t.argHash, hash);
 }
 
 /**
  * compares the first 16 bytes of the argument buffer for a function vs the one recorded by the
  * wizard
- * @param t - struct describing the desired function to target, loaded from disk
+ * @param t - the compiled target to compare against
  * @param info - information about the last hooked function call
  * @return true if they match, false if they don't
  */
-bool SL2Client::compare_arg_buffers(targetFunction &t, client_read_info *info) { // Not working
-  size_t minimum = min(16, t.buffer.size());
+bool SL2Client::compare_arg_buffers(const sl2_target &t, client_read_info *info) { // Not working
+  size_t minimum = t.bufferSize;
   if (info->lpNumberOfBytesRead) {
     minimum = min(minimum, *info->lpNumberOfBytesRead);
   } else {
@@ -185,7 +282,7 @@ bool SL2Client::compare_arg_buffers(targetFunction &t, client_read_info *info) {
                  "a segfault\n");
   }
 
-  return !memcmp(t.buffer.data(), info->lpBuffer, minimum);
+  return !memcmp(t.buffer, info->lpBuffer, minimum);
 }
 
 /**
@@ -194,7 +291,11 @@ bool SL2Client::compare_arg_buffers(targetFunction &t, client_read_info *info) {
  * @return the incremented value
  */
 uint64_t SL2Client::increment_call_count(Function function) {
-  return call_counts[function]++;
+  if ((size_t)function >= SL2_NUM_FUNCTIONS) {
+    return 0;
+  }
+
+  return thread_call_counts().counts[(size_t)function]++;
 }
 
 /**
@@ -203,21 +304,102 @@ uint64_t SL2Client::increment_call_count(Function function) {
  * @return the incremented value
  */
 uint64_t SL2Client::increment_retaddr_count(uint64_t retAddr) {
-  return ret_addr_counts[retAddr]++;
+  return thread_ret_addr_counts().increment(retAddr);
 }
 
+/*! The drmgr TLS field holding the sl2_thread_counts of each thread that has its own */
+static int thread_counts_tls_idx = -1;
+
 /**
- * Loads the msgpack blob containing target information into the client.
+ * Lets threads keep call counts of their own (see `set_thread_counts`). Until this is called,
+ * every thread shares `call_counts` and `ret_addr_counts`.
+ */
+void SL2Client::init_thread_counts() {
+  thread_counts_tls_idx = drmgr_register_tls_field();
+
+  if (thread_counts_tls_idx == -1) {
+    DR_ASSERT(false);
+  }
+}
+
+/**
+ * Tears down whatever `init_thread_counts` set up. The counts themselves belong to their owners.
+ */
+void SL2Client::exit_thread_counts() {
+  if (thread_counts_tls_idx == -1) {
+    return;
+  }
+
+  drmgr_unregister_tls_field(thread_counts_tls_idx);
+  thread_counts_tls_idx = -1;
+}
+
+/**
+ * Gives a thread call counts of its own, which its reads are targeted by instead of the shared
+ * ones. `init_thread_counts` must have been called first.
+ * @param drcontext - the thread's DR context
+ * @param counts - the thread's counts, which must outlive the thread (or NULL, to share again)
+ */
+void SL2Client::set_thread_counts(void *drcontext, sl2_thread_counts *counts) {
+  drmgr_set_tls_field(drcontext, thread_counts_tls_idx, counts);
+}
+
+/**
+ * @return the current thread's own call counts, if it has any, or the shared ones
+ */
+sl2_call_counts &SL2Client::thread_call_counts() {
+  if (thread_counts_tls_idx != -1) {
+    sl2_thread_counts *counts = (sl2_thread_counts *)drmgr_get_tls_field(
+        dr_get_current_drcontext(), thread_counts_tls_idx);
+
+    if (counts) {
+      return counts->call_counts;
+    }
+  }
+
+  return call_counts;
+}
+
+/**
+ * @return the current thread's own return address counts, if it has any, or the shared ones
+ */
+sl2_retaddr_counts &SL2Client::thread_ret_addr_counts() {
+  if (thread_counts_tls_idx != -1) {
+    sl2_thread_counts *counts = (sl2_thread_counts *)drmgr_get_tls_field(
+        dr_get_current_drcontext(), thread_counts_tls_idx);
+
+    if (counts) {
+      return counts->ret_addr_counts;
+    }
+  }
+
+  return ret_addr_counts;
+}
+
+/**
+ * Loads the targets into the client. The target file's index (see sl2_target_index.hpp) is
+ * preferred when the harness has written one, since it's mapped and compiled in place; otherwise,
+ * the msgpack blob itself is parsed.
  * @param path - location of the target file to read from
  * @return succes
  */
 bool SL2Client::loadTargets(string path) {
+  size_t ext = path.rfind(".msg");
+
+  if (ext != string::npos && ext + strlen(".msg") == path.size()) {
+    string index_path = path.substr(0, ext) + SL2_TARGET_INDEX_EXT;
+
+    if (load_target_index(index_path)) {
+      return true;
+    }
+  }
+
   file_t targets = dr_open_file(path.c_str(), DR_FILE_READ);
   size_t targets_size;
   size_t txsize;
 
   dr_file_size(targets, &targets_size);
-  uint8_t *buffer = (uint8_t *)dr_global_alloc(targets_size);
+  uint8_t *buffer = (uint8_t *)sl2_global_alloc(targets_size);
 
   txsize = dr_read_file(targets, buffer, targets_size);
   dr_close_file(targets);
@@ -229,11 +411,844 @@ bool SL2Client::loadTargets(string path) {
 
   std::vector<std::uint8_t> msg(buffer, buffer + targets_size);
 
-  parsedJson = json::from_msgpack(msg);
+  json parsed = json::from_msgpack(msg);
 
   dr_global_free(buffer, targets_size);
 
-  return parsedJson.is_array();
+  if (!parsed.is_array()) {
+    return false;
+  }
+
+  compile_targets(parsed);
+
+  return true;
+}
+
+/**
+ * Maps a target index and compiles its selected targets.
+ * Every record is checked against the bounds of the mapping before anything is
+ * compiled, so a truncated or stale index is rejected as a whole (and the caller can fall back to
+ * the msgpack blob) rather than half-loaded.
+ * @param path - location of the target index
+ * @return whether the index was loaded
+ */
+bool SL2Client::load_target_index(string path) {
+  file_t file = dr_open_file(path.c_str(), DR_FILE_READ);
+  uint64 file_size = 0;
+  size_t view_size = 0;
+  uint8_t *view = NULL;
+  bool loaded = false;
+
+  if (file == INVALID_FILE) {
+    return false;
+  }
+
+  if (dr_file_size(file, &file_size) && file_size >= sizeof(sl2_target_index_header)) {
+    view_size = (size_t)file_size;
+    view = (uint8_t *)dr_map_file(file, &view_size, 0, NULL, DR_MEMPROT_READ, DR_MAP_PRIVATE);
+  }
+
+  // The mapping outlives the handle.
+  dr_close_file(file);
+
+  if (view == NULL) {
+    return false;
+  }
+
+  const sl2_target_index_header *header = (const sl2_target_index_header *)view;
+  const uint8_t *records = view + sizeof(*header);
+  const wchar_t *strings;
+  size_t strings_len;
+
+  if (header->magic != SL2_TARGET_INDEX_MAGIC || header->version != SL2_TARGET_INDEX_VERSION ||
+      header->record_size != sizeof(sl2_target_index_record) ||
+      header->count > (file_size - sizeof(*header)) / sizeof(sl2_target_index_record)) {
+    SL2_DR_DEBUG("load_target_index: %s is malformed or stale, ignoring it\n", path.c_str());
+    goto cleanup;
+  }
+
+  strings = (const wchar_t *)(records + (header->count * sizeof(sl2_target_index_record)));
+  strings_len = (size_t)(view + file_size - (const uint8_t *)strings) / sizeof(wchar_t);
+
+  for (uint32_t i = 0; i < header->count; i++) {
+    const sl2_target_index_record *record =
+        (const sl2_target_index_record *)(records + (i * sizeof(sl2_target_index_record)));
+
+    if (record->source_offset > strings_len ||
+        record->source_length > strings_len - record->source_offset ||
+        record->buffer_size > SL2_TARGET_INDEX_BUFFER_LEN) {
+      SL2_DR_DEBUG("load_target_index: record %u of %s is malformed, ignoring the index\n", i,
+                   path.c_str());
+      goto cleanup;
+    }
+  }
+
+  reset_targets();
+  target_count = header->count;
+
+  for (uint32_t i = 0; i < header->count; i++) {
+    const sl2_target_index_record *record =
+        (const sl2_target_index_record *)(records + (i * sizeof(sl2_target_index_record)));
+    char func_name[SL2_TARGET_INDEX_NAME_LEN];
+    Function function;
+
+    if (!record->selected) {
+      continue;
+    }
+
+    strncpy(func_name, record->func_name, SL2_TARGET_INDEX_NAME_LEN - 1);
+    func_name[SL2_TARGET_INDEX_NAME_LEN - 1] = 0;
+
+    if (!string_to_function(func_name, &function)) {
+      SL2_DR_DEBUG("load_target_index: skipping target for unknown function %s\n", func_name);
+      continue;
+    }
+
+    sl2_target compiled = {0};
+    compiled.json_index = i;
+    compiled.mode = record->mode;
+    compiled.index = record->index;
+    compiled.retAddrOffset = record->retAddrOffset & SUB_ASLR_BITS;
+    compiled.retAddrCount = record->retAddrCount;
+    compiled.argHashVersion = record->argHashVersion;
+    compiled.source.assign(strings + record->source_offset, record->source_length);
+
+    strncpy(compiled.argHash, record->argHash, SL2_HASH_LEN);
+    compiled.argHash[SL2_HASH_LEN] = 0;
+
+    compiled.bufferSize = min(SL2_TARGET_BUFFER_LEN, record->buffer_size);
+    memcpy(compiled.buffer, record->buffer, compiled.bufferSize);
+
+    add_target(function, compiled);
+  }
+
+  finish_targets();
+  loaded = true;
+
+  SL2_DR_DEBUG("load_target_index: loaded %u targets from %s\n", header->count, path.c_str());
+
+cleanup:
+  dr_unmap_file(view, view_size);
+
+  return loaded;
+}
+
+/**
+ * Compiles the selected targets in a parsed target file into per-function tables, so that
+ * matching a hooked call doesn't have to convert (or even look at) targets for other functions.
+ * @param targets - the parsed target file
+ */
+void SL2Client::compile_targets(const json &targets) {
+  reset_targets();
+  target_count = targets.size();
+
+  for (size_t i = 0; i < targets.size(); ++i) {
+    targetFunction t = targets[i];
+    Function function;
+
+    if (!t.selected) {
+      continue;
+    }
+
+    if (!string_to_function(t.functionName.c_str(), &function)) {
+      SL2_DR_DEBUG("compile_targets: skipping target for unknown function %s\n",
+                   t.functionName.c_str());
+      continue;
+    }
+
+    sl2_target compiled = {0};
+    compiled.json_index = i;
+    compiled.mode = t.mode;
+    compiled.index = t.index;
+    compiled.retAddrOffset = t.retAddrOffset & SUB_ASLR_BITS;
+    compiled.retAddrCount = t.retAddrCount;
+    compiled.argHashVersion = t.argHashVersion;
+    compiled.source = t.source;
+
+    strncpy(compiled.argHash, t.argHash.c_str(), SL2_HASH_LEN);
+    compiled.argHash[SL2_HASH_LEN] = 0;
+
+    compiled.bufferSize = min(SL2_TARGET_BUFFER_LEN, t.buffer.size());
+    memcpy(compiled.buffer, t.buffer.data(), compiled.bufferSize);
+
+    add_target(function, compiled);
+  }
+
+  finish_targets();
+}
+
+/**
+ * Empties the per-function target tables.
+ */
+void SL2Client::reset_targets() {
+  target_count = 0;
+
+  for (size_t f = 0; f < SL2_NUM_FUNCTIONS; f++) {
+    compiledTargets[f].targets.clear();
+    compiledTargets[f].retAddrs.clear();
+    compiledTargets[f].indexOnly = true;
+    compiledTargets[f].maxIndex = 0;
+  }
+}
+
+/**
+ * Adds a compiled target to its function's table.
+ * @param function - the function that the target is for
+ * @param target - the compiled target
+ */
+void SL2Client::add_target(Function function, const sl2_target &target) {
+  sl2_function_targets &table = compiledTargets[(size_t)function];
+
+  table.targets.push_back(target);
+
+  if (target.mode != MATCH_INDEX) {
+    table.indexOnly = false;
+  }
+
+  table.maxIndex = max(table.maxIndex, target.index);
+}
+
+/**
+ * Builds the return address filters, once every target has been added.
+ */
+void SL2Client::finish_targets() {
+  // A target can only match at its own return address when all of its strategies check it.
+  for (size_t f = 0; f < SL2_NUM_FUNCTIONS; f++) {
+    sl2_function_targets &table = compiledTargets[f];
+    bool all_need_retaddr = !table.targets.empty();
+
+    for (const sl2_target &t : table.targets) {
+      if (!t.mode || t.mode & ~(uint64_t)(MATCH_RETN_ADDRESS | MEDIUM_PRECISION)) {
+        all_need_retaddr = false;
+        break;
+      }
+    }
+
+    if (!all_need_retaddr) {
+      continue;
+    }
+
+    for (const sl2_target &t : table.targets) {
+      table.retAddrs.push_back(t.retAddrOffset);
+    }
+
+    std::sort(table.retAddrs.begin(), table.retAddrs.end());
+    table.retAddrs.erase(std::unique(table.retAddrs.begin(), table.retAddrs.end()),
+                         table.retAddrs.end());
+  }
+}
+
+/**
+ * Checks whether any selected target is for the function behind an export, so that clients only
+ * wrap the exports they need to.
+ * Targets name functions the way the wizard does, without the A/W suffix that some
+ * exports carry (e.g. "RegQueryValueEx" for both RegQueryValueExA and RegQueryValueExW).
+ * @param export_name - the name of the export (e.g. "ReadEventLogW")
+ * @return whether the export should be wrapped
+ */
+bool SL2Client::function_has_targets(const char *export_name) {
+  Function function;
+  char name[SL2_TARGET_INDEX_NAME_LEN];
+  size_t len = strlen(export_name);
+
+  if (string_to_function(export_name, &function)) {
+    return !compiledTargets[(size_t)function].targets.empty();
+  }
+
+  if (len < 2 || len >= sizeof(name) ||
+      (export_name[len - 1] != 'A' && export_name[len - 1] != 'W')) {
+    return false;
+  }
+
+  memcpy(name, export_name, len - 1);
+  name[len - 1] = 0;
+
+  return string_to_function(name, &function) &&
+         !compiledTargets[(size_t)function].targets.empty();
+}
+
+/*! The size of the buffer that events are batched in before they're written out */
+#define SL2_EVENT_BUFFER_SIZE (64 * 1024)
+
+/**
+ * The client's stream of events to the harness. Events are batched in a buffer, and written out
+ * to the event file when it fills up, when an event asks for it, and on exit.
+ */
+struct sl2_event_stream {
+  file_t file;
+  uint8_t *buffer;
+  size_t used;
+  /*! Guards buffer and used */
+  void *lock;
+};
+
+static sl2_event_stream event_stream = {INVALID_FILE, NULL, 0, NULL};
+
+/**
+ * Writes out the events in the buffer. The caller must hold the stream's lock.
+ */
+static void flush_event_stream() {
+  if (event_stream.used && dr_write_file(event_stream.file, event_stream.buffer,
+                                         event_stream.used) != event_stream.used) {
+    SL2_DR_DEBUG("flush_event_stream: short write, events were lost!\n");
+  }
+
+  event_stream.used = 0;
+}
+
+/**
+ * Opens the event file. Until this is called (or if it fails), events are logged to stderr
+ * as lines of JSON instead.
+ * @param path - the event file, or an empty string for none
+ */
+void SL2Client::init_events(const char *path) {
+  if (!path || !*path) {
+    return;
+  }
+
+  event_stream.file = dr_open_file(path, DR_FILE_WRITE_OVERWRITE);
+
+  if (event_stream.file == INVALID_FILE) {
+    SL2_DR_DEBUG("init_events: couldn't open %s, logging events to stderr\n", path);
+    return;
+  }
+
+  event_stream.buffer = (uint8_t *)sl2_global_alloc(SL2_EVENT_BUFFER_SIZE);
+  event_stream.used = 0;
+  event_stream.lock = dr_mutex_create();
+}
+
+/**
+ * Writes out any buffered events, and closes the event file.
+ */
+void SL2Client::exit_events() {
+  if (event_stream.file == INVALID_FILE) {
+    return;
+  }
+
+  flush_event_stream();
+  dr_close_file(event_stream.file);
+  dr_global_free(event_stream.buffer, SL2_EVENT_BUFFER_SIZE);
+  dr_mutex_destroy(event_stream.lock);
+
+  event_stream.file = INVALID_FILE;
+  event_stream.buffer = NULL;
+  event_stream.lock = NULL;
+}
+
+/**
+ * Finishes an event and sends it to the harness.
+ * @param ev - the event
+ * @param flush - whether to write the event out right away, e.g. because the process is about to
+ *                go down
+ */
+void SL2Client::emit_event(sl2_event *ev, bool flush) {
+  uint32_t size = sl2_event_finish(ev);
+
+  if (!size) {
+    SL2_DR_DEBUG("emit_event: dropping an event that's over %u bytes\n", SL2_EVENT_MAX_SIZE);
+    return;
+  }
+
+  if (event_stream.file == INVALID_FILE) {
+    json j = json::from_msgpack(std::vector<uint8_t>(ev->data + sizeof(uint32_t), ev->data + size));
+    SL2_LOG_JSONL(j);
+    return;
+  }
+
+  dr_mutex_lock(event_stream.lock);
+
+  if (size > SL2_EVENT_BUFFER_SIZE - event_stream.used) {
+    flush_event_stream();
+  }
+
+  memcpy(event_stream.buffer + event_stream.used, ev->data, size);
+  event_stream.used += size;
+
+  if (flush) {
+    flush_event_stream();
+  }
+
+  dr_mutex_unlock(event_stream.lock);
+}
+
+/**
+ * Writes out any buffered events.
+ */
+void SL2Client::flush_events() {
+  if (event_stream.file == INVALID_FILE) {
+    return;
+  }
+
+  dr_mutex_lock(event_stream.lock);
+  flush_event_stream();
+  dr_mutex_unlock(event_stream.lock);
+}
+
+/**
+ * A thread's preallocated client_read_info records. Hooked calls on a thread can nest (e.g. fread
+ * calling ReadFile), so records are handed out from a small stack of free ones.
+ */
+struct sl2_read_info_pool {
+  client_read_info records[SL2_READ_INFO_POOL_SIZE];
+  client_read_info *free[SL2_READ_INFO_POOL_SIZE];
+  size_t nfree;
+};
+
+/*! The drmgr TLS field holding each thread's sl2_read_info_pool */
+static int read_info_tls_idx = -1;
+
+/**
+ * Frees an exiting thread's read info pool.
+ * @param drcontext - the exiting thread's DR context
+ */
+static void on_thread_exit_read_info_pool(void *drcontext) {
+  sl2_read_info_pool *pool =
+      (sl2_read_info_pool *)drmgr_get_tls_field(drcontext, read_info_tls_idx);
+
+  if (pool) {
+    dr_thread_free(drcontext, pool, sizeof(sl2_read_info_pool));
+    drmgr_set_tls_field(drcontext, read_info_tls_idx, NULL);
+  }
+}
+
+/**
+ * Sets up the per-thread read info pools. Until this is called (and after `exit_read_info_pool`),
+ * every record comes straight from the thread's heap.
+ */
+void SL2Client::init_read_info_pool() {
+  read_info_tls_idx = drmgr_register_tls_field();
+
+  if (read_info_tls_idx == -1 || !drmgr_register_thread_exit_event(on_thread_exit_read_info_pool)) {
+    DR_ASSERT(false);
+  }
+}
+
+/**
+ * Tears down the per-thread read info pools.
+ */
+void SL2Client::exit_read_info_pool() {
+  if (read_info_tls_idx == -1) {
+    return;
+  }
+
+  drmgr_unregister_thread_exit_event(on_thread_exit_read_info_pool);
+  drmgr_unregister_tls_field(read_info_tls_idx);
+  read_info_tls_idx = -1;
+}
+
+/**
+ * Gets a record for a hooked call from the current thread's pool, since pre-hooks run on every
+ * read the target performs.
+ * @param drcontext - the current thread's DR context
+ * @return the record, with `argHash` pointing at its own storage and no source
+ */
+client_read_info *SL2Client::alloc_read_info(void *drcontext) {
+  sl2_read_info_pool *pool = NULL;
+  client_read_info *info;
+
+  if (read_info_tls_idx != -1) {
+    pool = (sl2_read_info_pool *)drmgr_get_tls_field(drcontext, read_info_tls_idx);
+
+    if (!pool) {
+      pool = (sl2_read_info_pool *)sl2_thread_alloc(drcontext, sizeof(sl2_read_info_pool));
+
+      for (size_t i = 0; i < SL2_READ_INFO_POOL_SIZE; i++) {
+        pool->free[i] = &pool->records[SL2_READ_INFO_POOL_SIZE - 1 - i];
+      }
+
+      pool->nfree = SL2_READ_INFO_POOL_SIZE;
+      drmgr_set_tls_field(drcontext, read_info_tls_idx, pool);
+    }
+  }
+
+  if (pool && pool->nfree) {
+    info = pool->free[--pool->nfree];
+  } else {
+    // Calls nested deeper than the pool (or missed post-hooks) fall back to the heap.
+    info = (client_read_info *)sl2_thread_alloc(drcontext, sizeof(client_read_info));
+  }
+
+  info->source = NULL;
+  info->argHash = info->argHashBuf;
+  info->argHashVersion = 0;
+
+  return info;
+}
+
+/**
+ * Returns a record from `alloc_read_info`. Everything it points to is stored inline (or borrowed),
+ * so there's nothing else to free.
+ * @param drcontext - the current thread's DR context
+ * @param info - the record
+ */
+void SL2Client::free_read_info(void *drcontext, client_read_info *info) {
+  sl2_read_info_pool *pool = NULL;
+
+  if (read_info_tls_idx != -1) {
+    pool = (sl2_read_info_pool *)drmgr_get_tls_field(drcontext, read_info_tls_idx);
+  }
+
+  if (pool && info >= pool->records && info < pool->records + SL2_READ_INFO_POOL_SIZE) {
+    pool->free[pool->nfree++] = info;
+  } else {
+    dr_thread_free(drcontext, info, sizeof(client_read_info));
+  }
+}
+
+static_assert(SL2_PROFILE_READ_HOOKS == SL2_NUM_FUNCTIONS,
+              "SL2_PROFILE_READ_HOOKS must match SL2_NUM_FUNCTIONS");
+
+/*! The drmgr TLS field holding each thread's sl2_profile_counters, or -1 if the profiler is off */
+static int profile_tls_idx = -1;
+
+/*! Every thread's counts, including those of threads that have exited */
+static sl2_profile_counters *profile_threads = NULL;
+
+/*! Guards profile_threads */
+static void *profile_lock = NULL;
+
+/*! When the profiler was started, in cycles and in microseconds */
+static uint64_t profile_start_cycles;
+static uint64_t profile_start_us;
+
+/*! How many times a probe runs on a thread before it mustn't allocate any more, or 0 (see
+ * sl2_alloc.hpp) */
+static uint64_t profile_alloc_steady = 0;
+
+sl2_profile_counters *sl2_profile_thread() {
+  if (profile_tls_idx == -1) {
+    return NULL;
+  }
+
+  void *drcontext = dr_get_current_drcontext();
+  if (!drcontext) {
+    return NULL;
+  }
+
+  sl2_profile_counters *counters =
+      (sl2_profile_counters *)drmgr_get_tls_field(drcontext, profile_tls_idx);
+
+  // Counts outlive their threads, so that exit_profile can total them.
+  if (!counters) {
+    counters = (sl2_profile_counters *)dr_global_alloc(sizeof(sl2_profile_counters));
+    memset(counters, 0, sizeof(sl2_profile_counters));
+
+    dr_mutex_lock(profile_lock);
+    counters->next = profile_threads;
+    profile_threads = counters;
+    dr_mutex_unlock(profile_lock);
+
+    drmgr_set_tls_field(drcontext, profile_tls_idx, counters);
+  }
+
+  return counters;
+}
+
+#ifdef SL2_ALLOC_STATS
+void sl2_alloc_count(size_t bytes) {
+  sl2_profile_counters *counters = sl2_profile_thread();
+
+  if (!counters) {
+    return;
+  }
+
+  uint32_t probe = counters->scope ? counters->scope->probe : SL2_PROBE_OTHER;
+  counters->allocs[probe]++;
+  counters->alloc_bytes[probe] += bytes;
+
+  if (profile_alloc_steady && probe != SL2_PROBE_OTHER &&
+      counters->calls[probe] >= profile_alloc_steady) {
+    SL2_DR_DEBUG("sl2_alloc_count: probe %u allocated %llu bytes after %llu calls\n", probe,
+                 (uint64_t)bytes, counters->calls[probe]);
+    DR_ASSERT_MSG(false, "allocation in a steady-state probe");
+  }
+}
+#endif
+
+void sl2_profile_request(uint8_t event, uint64_t cycles) {
+  sl2_profile_counters *counters = sl2_profile_thread();
+
+  if (counters && event < SL2_PROFILE_CONN_EVENTS) {
+    counters->calls[SL2_PROBE_CONN + event]++;
+    counters->cycles[SL2_PROBE_CONN + event] += cycles;
+  }
+}
+
+/**
+ * Starts the profiler (-profile). Until this is called, every probe is a no-op.
+ * @param alloc_steady how many times a probe may run on a thread before it mustn't allocate any
+ *                     more, or 0 to allow any allocation (-alloc_steady, see sl2_alloc.hpp)
+ */
+void SL2Client::init_profile(uint64_t alloc_steady) {
+#ifndef SL2_ALLOC_STATS
+  if (alloc_steady) {
+    SL2_DR_DEBUG("init_profile: -alloc_steady needs a build with SL2_ALLOC_STATS, ignoring it\n");
+  }
+#endif
+
+  profile_alloc_steady = alloc_steady;
+  profile_lock = dr_mutex_create();
+  profile_tls_idx = drmgr_register_tls_field();
+
+  if (profile_tls_idx == -1) {
+    DR_ASSERT(false);
+  }
+
+  profile_start_cycles = __rdtsc();
+  profile_start_us = dr_get_microseconds();
+}
+
+/**
+ * Stops the profiler, and reports every probe that was hit as a "profile" event, along with a
+ * "run" probe for how long the profiler ran (in cycles, and in microseconds, so that the harness
+ * can convert cycles to time).
+ */
+void SL2Client::exit_profile() {
+  if (profile_tls_idx == -1) {
+    return;
+  }
+
+  uint64_t calls[SL2_NUM_PROBES] = {0};
+  uint64_t cycles[SL2_NUM_PROBES] = {0};
+  uint64_t allocs[SL2_NUM_PROBES + 1] = {0};
+  uint64_t alloc_bytes[SL2_NUM_PROBES + 1] = {0};
+
+  dr_mutex_lock(profile_lock);
+
+  // Threads that are still running may bump their counts while we total them; those
+  // last few calls can go either way.
+  for (sl2_profile_counters *counters = profile_threads; counters; counters = counters->next) {
+    for (uint32_t probe = 0; probe < SL2_NUM_PROBES; probe++) {
+      calls[probe] += counters->calls[probe];
+      cycles[probe] += counters->cycles[probe];
+    }
+
+    for (uint32_t probe = 0; probe <= SL2_PROBE_OTHER; probe++) {
+      allocs[probe] += counters->allocs[probe];
+      alloc_bytes[probe] += counters->alloc_bytes[probe];
+    }
+  }
+
+  dr_mutex_unlock(profile_lock);
+
+  sl2_event ev;
+  char name[64];
+  uint64_t total_allocs = 0;
+  uint64_t total_alloc_bytes = 0;
+
+  for (uint32_t probe = 0; probe <= SL2_PROBE_OTHER; probe++) {
+    total_allocs += allocs[probe];
+    total_alloc_bytes += alloc_bytes[probe];
+
+    if ((probe == SL2_PROBE_OTHER || !calls[probe]) && !allocs[probe]) {
+      continue;
+    }
+
+    sl2_event_begin(&ev, "profile");
+    sl2_event_str(&ev, "probe", probe_to_string(probe, name, sizeof(name)));
+    sl2_event_uint(&ev, "calls", probe == SL2_PROBE_OTHER ? 0 : calls[probe]);
+    sl2_event_uint(&ev, "cycles", probe == SL2_PROBE_OTHER ? 0 : cycles[probe]);
+
+    if (allocs[probe]) {
+      sl2_event_uint(&ev, "allocs", allocs[probe]);
+      sl2_event_uint(&ev, "alloc_bytes", alloc_bytes[probe]);
+    }
+
+    emit_event(&ev);
+  }
+
+  sl2_event_begin(&ev, "profile");
+  sl2_event_str(&ev, "probe", "run");
+  sl2_event_uint(&ev, "calls", 1);
+  sl2_event_uint(&ev, "cycles", __rdtsc() - profile_start_cycles);
+  sl2_event_uint(&ev, "us", dr_get_microseconds() - profile_start_us);
+#ifdef SL2_ALLOC_STATS
+  sl2_event_uint(&ev, "allocs", total_allocs);
+  sl2_event_uint(&ev, "alloc_bytes", total_alloc_bytes);
+#endif
+  emit_event(&ev, true);
+
+  // Threads that are still running see the profiler as off from here on. Their counts
+  // aren't freed, since one of them may still be inside a probe; the process is going down anyway.
+  int tls_idx = profile_tls_idx;
+  profile_tls_idx = -1;
+  drmgr_unregister_tls_field(tls_idx);
+}
+
+/**
+ * Names a probe.
+ * @param probe the probe (see `sl2_probe`)
+ * @param buf storage for names that have to be built
+ * @param len the size of `buf`
+ * @return the probe's name
+ */
+const char *SL2Client::probe_to_string(uint32_t probe, char *buf, size_t len) {
+  if (probe < SL2_PROBE_POST_GENERIC) {
+    dr_snprintf(buf, len, "wrap_pre_%s",
+                function_to_string((Function)(probe - SL2_PROBE_PRE_HOOK)));
+    buf[len - 1] = '\0';
+    return buf;
+  }
+
+  if (probe == SL2_PROBE_OTHER) {
+    return "other";
+  }
+
+  if (probe >= SL2_PROBE_CONN) {
+    dr_snprintf(buf, len, "conn:%u", probe - SL2_PROBE_CONN);
+    buf[len - 1] = '\0';
+    return buf;
+  }
+
+  switch (probe) {
+  case SL2_PROBE_POST_GENERIC:
+    return "wrap_post_Generic";
+  case SL2_PROBE_POST_MAPVIEWOFFILE:
+    return "wrap_post_MapViewOfFile";
+  case SL2_PROBE_PRE_CLOSEHANDLE:
+    return "wrap_pre_CloseHandle";
+  case SL2_PROBE_PRE_DUPLICATEHANDLE:
+    return "wrap_pre_DuplicateHandle";
+  case SL2_PROBE_POST_DUPLICATEHANDLE:
+    return "wrap_post_DuplicateHandle";
+  case SL2_PROBE_PRE_ISPROCESSORFEATUREPRESENT:
+    return "wrap_pre_IsProcessorFeaturePresent";
+  case SL2_PROBE_POST_ISPROCESSORFEATUREPRESENT:
+    return "wrap_post_IsProcessorFeaturePresent";
+  case SL2_PROBE_PRE_UNHANDLEDEXCEPTIONFILTER:
+    return "wrap_pre_UnhandledExceptionFilter";
+  case SL2_PROBE_PRE_VERIFIERSTOPMESSAGE:
+    return "wrap_pre_VerifierStopMessage";
+  case SL2_PROBE_IS_FUNCTION_TARGETED:
+    return "is_function_targeted";
+  case SL2_PROBE_HASH_ARGS:
+    return "hash_args";
+  case SL2_PROBE_MUTATE:
+    return "mutate";
+  case SL2_PROBE_BB_INSTRUMENT:
+    return "on_bb_instrument";
+  }
+
+  return "unknown";
+}
+
+/**
+ * Sets up the handle path cache. Until this is called, `get_handle_path` doesn't cache anything.
+ */
+void SL2Client::init_handle_cache() {
+  handle_paths_lock = dr_mutex_create();
+}
+
+/**
+ * Tears down the handle path cache.
+ */
+void SL2Client::exit_handle_cache() {
+  if (handle_paths_lock) {
+    dr_mutex_destroy(handle_paths_lock);
+    handle_paths_lock = NULL;
+  }
+
+  handle_paths.clear();
+}
+
+/**
+ * Gets the normalized path behind a file handle.
+ * GetFinalPathNameByHandle is a kernel round-trip (plus path normalization), and targets
+ * that stream a file in small chunks read from the same handle thousands of times. So we ask once
+ * per handle, and forget the answer when the target closes the handle (see wrap_pre_CloseHandle).
+ * @param handle - the handle
+ * @param path - receives the path (at least MAX_PATH + 1 wide characters), or an empty string if
+ *               the handle doesn't have one
+ */
+void SL2Client::get_handle_path(HANDLE handle, wchar_t *path) {
+  if (!handle_paths_lock) {
+    path[0] = 0;
+    GetFinalPathNameByHandle(handle, path, MAX_PATH, FILE_NAME_NORMALIZED);
+    return;
+  }
+
+  dr_mutex_lock(handle_paths_lock);
+
+  auto it = handle_paths.find(handle);
+  if (it != handle_paths.end()) {
+    memcpy(path, it->second.path, sizeof(it->second.path));
+    dr_mutex_unlock(handle_paths_lock);
+    return;
+  }
+
+  dr_mutex_unlock(handle_paths_lock);
+
+  sl2_handle_path entry = {0};
+  GetFinalPathNameByHandle(handle, entry.path, MAX_PATH, FILE_NAME_NORMALIZED);
+  memcpy(path, entry.path, sizeof(entry.path));
+
+  dr_mutex_lock(handle_paths_lock);
+  handle_paths[handle] = entry;
+  dr_mutex_unlock(handle_paths_lock);
+}
+
+/**
+ * Drops a handle from the handle path cache, since its value may be reused once it's closed.
+ * @param handle - the handle
+ */
+void SL2Client::forget_handle(HANDLE handle) {
+  if (!handle_paths_lock) {
+    return;
+  }
+
+  dr_mutex_lock(handle_paths_lock);
+  handle_paths.erase(handle);
+  dr_mutex_unlock(handle_paths_lock);
+}
+
+/**
+ * Pre-function wrapper for CloseHandle; invalidates the handle's cached path.
+ * @param wrapcxt - dynamorio wrap context
+ * @param user_data - unused
+ */
+void SL2Client::wrap_pre_CloseHandle(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_CLOSEHANDLE);
+  forget_handle(drwrap_get_arg(wrapcxt, 0));
+  *user_data = NULL;
+}
+
+/**
+ * Pre-function wrapper for DuplicateHandle. DUPLICATE_CLOSE_SOURCE closes the source handle, so
+ * we forget it here; the new handle is forgotten in the post-hook.
+ * @param wrapcxt - dynamorio wrap context
+ * @param user_data - receives the address of the new handle, if it's for this process
+ */
+void SL2Client::wrap_pre_DuplicateHandle(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_DUPLICATEHANDLE);
+  HANDLE hSourceProcessHandle = drwrap_get_arg(wrapcxt, 0);
+  HANDLE hSourceHandle = drwrap_get_arg(wrapcxt, 1);
+  HANDLE hTargetProcessHandle = drwrap_get_arg(wrapcxt, 2);
+  LPHANDLE lpTargetHandle = (LPHANDLE)drwrap_get_arg(wrapcxt, 3);
+#pragma warning(suppress : 4311 4302)
+  DWORD dwOptions = (DWORD)drwrap_get_arg(wrapcxt, 6);
+  DWORD pid = GetCurrentProcessId();
+
+  if (dwOptions & DUPLICATE_CLOSE_SOURCE && GetProcessId(hSourceProcessHandle) == pid) {
+    forget_handle(hSourceHandle);
+  }
+
+  *user_data = GetProcessId(hTargetProcessHandle) == pid ? lpTargetHandle : NULL;
+}
+
+/**
+ * Post-function wrapper for DuplicateHandle. Forgets the new handle, in case we missed the close of
+ * an older handle with the same value.
+ * @param wrapcxt - dynamorio wrap context
+ * @param user_data - the address of the new handle, or NULL
+ */
+void SL2Client::wrap_post_DuplicateHandle(void *wrapcxt, void *user_data) {
+  SL2_PROFILE(SL2_PROBE_POST_DUPLICATEHANDLE);
+  LPHANDLE lpTargetHandle = (LPHANDLE)user_data;
+
+  if (lpTargetHandle && drwrap_get_retval(wrapcxt)) {
+    forget_handle(*lpTargetHandle);
+  }
 }
 
 /*
@@ -257,6 +1272,7 @@ bool SL2Client::loadTargets(string path) {
  * Hack to tell the target process that __fastfail isn't available
  */
 void SL2Client::wrap_pre_IsProcessorFeaturePresent(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_ISPROCESSORFEATUREPRESENT);
 #pragma warning(suppress : 4311 4302)
   DWORD feature = (DWORD)drwrap_get_arg(wrapcxt, 0);
 
@@ -268,6 +1284,7 @@ void SL2Client::wrap_pre_IsProcessorFeaturePresent(void *wrapcxt, OUT void **use
  * Hack to tell the target process that __fastfail isn't available
  */
 void SL2Client::wrap_post_IsProcessorFeaturePresent(void *wrapcxt, void *user_data) {
+  SL2_PROFILE(SL2_PROBE_POST_ISPROCESSORFEATUREPRESENT);
 #pragma warning(suppress : 4311 4302)
   DWORD feature = (DWORD)user_data;
 
@@ -283,6 +1300,7 @@ void SL2Client::wrap_post_IsProcessorFeaturePresent(void *wrapcxt, void *user_da
  */
 void SL2Client::wrap_pre_UnhandledExceptionFilter(void *wrapcxt, OUT void **user_data,
                                                   bool (*on_exception)(void *, dr_exception_t *)) {
+  SL2_PROFILE(SL2_PROBE_PRE_UNHANDLEDEXCEPTIONFILTER);
   SL2_DR_DEBUG("wrap_pre_UnhandledExceptionFilter: stealing unhandled exception\n");
 
   EXCEPTION_POINTERS *exception = (EXCEPTION_POINTERS *)drwrap_get_arg(wrapcxt, 0);
@@ -300,6 +1318,7 @@ void SL2Client::wrap_pre_UnhandledExceptionFilter(void *wrapcxt, OUT void **user
  */
 void SL2Client::wrap_pre_VerifierStopMessage(void *wrapcxt, OUT void **user_data,
                                              bool (*on_exception)(void *, dr_exception_t *)) {
+  SL2_PROFILE(SL2_PROBE_PRE_VERIFIERSTOPMESSAGE);
   SL2_DR_DEBUG("wrap_pre_VerifierStopMessage: stealing unhandled exception\n");
 
   EXCEPTION_RECORD record = {0};
@@ -334,6 +1353,7 @@ void SL2Client::wrap_pre_VerifierStopMessage(void *wrapcxt, OUT void **user_data
    this call
 */
 void SL2Client::wrap_pre_ReadEventLog(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_HOOK + (uint32_t)Function::ReadEventLog);
   SL2_DR_DEBUG("<in wrap_pre_ReadEventLog>\n");
   HANDLE hEventLog = (HANDLE)drwrap_get_arg(wrapcxt, 0);
 #pragma warning(suppress : 4311 4302)
@@ -346,7 +1366,7 @@ void SL2Client::wrap_pre_ReadEventLog(void *wrapcxt, OUT void **user_data) {
   DWORD *pnBytesRead = (DWORD *)drwrap_get_arg(wrapcxt, 5);
   DWORD *pnMinNumberOfBytesNeeded = (DWORD *)drwrap_get_arg(wrapcxt, 6);
 
-  *user_data = dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(client_read_info));
+  *user_data = alloc_read_info(drwrap_get_drcontext(wrapcxt));
   client_read_info *info = (client_read_info *)*user_data;
 
   info->function = Function::ReadEventLog;
@@ -354,6 +1374,7 @@ void SL2Client::wrap_pre_ReadEventLog(void *wrapcxt, OUT void **user_data) {
   info->lpBuffer = lpBuffer;
   info->nNumberOfBytesToRead = nNumberOfBytesToRead;
   info->lpNumberOfBytesRead = pnBytesRead;
+  info->capacity = pnBytesRead ? info->nNumberOfBytesToRead : 0;
   info->position = 0;
   info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - baseAddr;
   info->source = NULL;
@@ -364,8 +1385,7 @@ void SL2Client::wrap_pre_ReadEventLog(void *wrapcxt, OUT void **user_data) {
   hash_ctx.position = dwRecordOffset;
   hash_ctx.readSize = nNumberOfBytesToRead;
 
-  info->argHash = (char *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), SL2_HASH_LEN + 1);
-  hash_args(info->argHash, &hash_ctx);
+  defer_hash_args(info, &hash_ctx);
 }
 
 /** Pre-function wrapper for RegQueryValu
@@ -385,6 +1405,7 @@ void SL2Client::wrap_pre_ReadEventLog(void *wrapcxt, OUT void **user_data) {
    this call
 */
 void SL2Client::wrap_pre_RegQueryValueEx(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_HOOK + (uint32_t)Function::RegQueryValueEx);
   SL2_DR_DEBUG("<in wrap_pre_RegQueryValueEx>\n");
   HKEY hKey = (HKEY)drwrap_get_arg(wrapcxt, 0);
   LPCTSTR lpValueName = (LPCTSTR)drwrap_get_arg(wrapcxt, 1);
@@ -394,7 +1415,7 @@ void SL2Client::wrap_pre_RegQueryValueEx(void *wrapcxt, OUT void **user_data) {
   LPDWORD lpcbData = (LPDWORD)drwrap_get_arg(wrapcxt, 5);
 
   if (lpData != NULL && lpcbData != NULL) {
-    *user_data = dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(client_read_info));
+    *user_data = alloc_read_info(drwrap_get_drcontext(wrapcxt));
     client_read_info *info = (client_read_info *)*user_data;
 
     info->function = Function::RegQueryValueEx;
@@ -402,6 +1423,7 @@ void SL2Client::wrap_pre_RegQueryValueEx(void *wrapcxt, OUT void **user_data) {
     info->lpBuffer = lpData;
     info->nNumberOfBytesToRead = *lpcbData;
     info->lpNumberOfBytesRead = lpcbData;
+    info->capacity = *lpcbData;
     info->position = 0;
     info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - baseAddr;
     info->source = NULL;
@@ -411,8 +1433,7 @@ void SL2Client::wrap_pre_RegQueryValueEx(void *wrapcxt, OUT void **user_data) {
     //        mbstowcs_s(hash_ctx.fileName, , lpValueName, MAX_PATH);
     hash_ctx.readSize = *lpcbData;
 
-    info->argHash = (char *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), SL2_HASH_LEN + 1);
-    hash_args(info->argHash, &hash_ctx);
+    defer_hash_args(info, &hash_ctx);
   } else {
     *user_data = NULL;
   }
@@ -434,6 +1455,7 @@ void SL2Client::wrap_pre_RegQueryValueEx(void *wrapcxt, OUT void **user_data) {
    this call
 */
 void SL2Client::wrap_pre_WinHttpWebSocketReceive(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_HOOK + (uint32_t)Function::WinHttpWebSocketReceive);
   SL2_DR_DEBUG("<in wrap_pre_WinHttpWebSocketReceive>\n");
   HINTERNET hRequest = (HINTERNET)drwrap_get_arg(wrapcxt, 0);
   PVOID pvBuffer = drwrap_get_arg(wrapcxt, 1);
@@ -449,7 +1471,7 @@ void SL2Client::wrap_pre_WinHttpWebSocketReceive(void *wrapcxt, OUT void **user_
   // DWORD positionLow = InternetSetFilePointer(hRequest, 0, &positionHigh, FILE_CURRENT);
   // uint64_t position = positionHigh;
 
-  *user_data = dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(client_read_info));
+  *user_data = alloc_read_info(drwrap_get_drcontext(wrapcxt));
   client_read_info *info = (client_read_info *)*user_data;
 
   info->function = Function::WinHttpWebSocketReceive;
@@ -457,6 +1479,7 @@ void SL2Client::wrap_pre_WinHttpWebSocketReceive(void *wrapcxt, OUT void **user_
   info->lpBuffer = pvBuffer;
   info->nNumberOfBytesToRead = dwBufferLength;
   info->lpNumberOfBytesRead = pdwBytesRead;
+  info->capacity = pdwBytesRead ? info->nNumberOfBytesToRead : 0;
   info->position = 0;
   info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - baseAddr;
   info->source = NULL;
@@ -466,8 +1489,7 @@ void SL2Client::wrap_pre_WinHttpWebSocketReceive(void *wrapcxt, OUT void **user_
   //    hash_ctx.fileName[0] = (wchar_t) s;
   hash_ctx.readSize = dwBufferLength;
 
-  info->argHash = (char *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), SL2_HASH_LEN + 1);
-  hash_args(info->argHash, &hash_ctx);
+  defer_hash_args(info, &hash_ctx);
 }
 
 /** Pre-function wrapper for InternetReadFile
@@ -485,6 +1507,7 @@ void SL2Client::wrap_pre_WinHttpWebSocketReceive(void *wrapcxt, OUT void **user_
    this call
 */
 void SL2Client::wrap_pre_InternetReadFile(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_HOOK + (uint32_t)Function::InternetReadFile);
   SL2_DR_DEBUG("<in wrap_pre_InternetReadFile>\n");
   HINTERNET hFile = (HINTERNET)drwrap_get_arg(wrapcxt, 0);
   void *lpBuffer = drwrap_get_arg(wrapcxt, 1);
@@ -496,7 +1519,7 @@ void SL2Client::wrap_pre_InternetReadFile(void *wrapcxt, OUT void **user_data) {
   // DWORD positionLow = InternetSetFilePointer(hFile, 0, &positionHigh, FILE_CURRENT);
   // uint64_t position = positionHigh;
 
-  *user_data = dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(client_read_info));
+  *user_data = alloc_read_info(drwrap_get_drcontext(wrapcxt));
   client_read_info *info = (client_read_info *)*user_data;
 
   info->function = Function::InternetReadFile;
@@ -504,6 +1527,7 @@ void SL2Client::wrap_pre_InternetReadFile(void *wrapcxt, OUT void **user_data) {
   info->lpBuffer = lpBuffer;
   info->nNumberOfBytesToRead = nNumberOfBytesToRead;
   info->lpNumberOfBytesRead = lpNumberOfBytesRead;
+  info->capacity = lpNumberOfBytesRead ? info->nNumberOfBytesToRead : 0;
   info->position = 0;
   info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - baseAddr;
   info->source = NULL;
@@ -513,8 +1537,7 @@ void SL2Client::wrap_pre_InternetReadFile(void *wrapcxt, OUT void **user_data) {
   //    hash_ctx.fileName[0] = (wchar_t) s;
   hash_ctx.readSize = nNumberOfBytesToRead;
 
-  info->argHash = (char *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), SL2_HASH_LEN + 1);
-  hash_args(info->argHash, &hash_ctx);
+  defer_hash_args(info, &hash_ctx);
 }
 
 /** Pre-function wrapper for WinHttpReadD
@@ -532,6 +1555,7 @@ void SL2Client::wrap_pre_InternetReadFile(void *wrapcxt, OUT void **user_data) {
    this call
 */
 void SL2Client::wrap_pre_WinHttpReadData(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_HOOK + (uint32_t)Function::WinHttpReadData);
   SL2_DR_DEBUG("<in wrap_pre_WinHttpReadData>\n");
   HINTERNET hRequest = (HINTERNET)drwrap_get_arg(wrapcxt, 0);
   void *lpBuffer = drwrap_get_arg(wrapcxt, 1);
@@ -543,7 +1567,7 @@ void SL2Client::wrap_pre_WinHttpReadData(void *wrapcxt, OUT void **user_data) {
   // DWORD positionLow = InternetSetFilePointer(hRequest, 0, &positionHigh, FILE_CURRENT);
   // uint64_t position = positionHigh;
 
-  *user_data = dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(client_read_info));
+  *user_data = alloc_read_info(drwrap_get_drcontext(wrapcxt));
   client_read_info *info = (client_read_info *)*user_data;
 
   info->function = Function::WinHttpReadData;
@@ -551,6 +1575,7 @@ void SL2Client::wrap_pre_WinHttpReadData(void *wrapcxt, OUT void **user_data) {
   info->lpBuffer = lpBuffer;
   info->nNumberOfBytesToRead = nNumberOfBytesToRead;
   info->lpNumberOfBytesRead = lpNumberOfBytesRead;
+  info->capacity = lpNumberOfBytesRead ? info->nNumberOfBytesToRead : 0;
   info->position = 0;
   info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - baseAddr;
   info->source = NULL;
@@ -560,8 +1585,7 @@ void SL2Client::wrap_pre_WinHttpReadData(void *wrapcxt, OUT void **user_data) {
   //    hash_ctx.fileName[0] = (wchar_t) s;
   hash_ctx.readSize = nNumberOfBytesToRead;
 
-  info->argHash = (char *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), SL2_HASH_LEN + 1);
-  hash_args(info->argHash, &hash_ctx);
+  defer_hash_args(info, &hash_ctx);
 }
 
 /** Pre-function wrapper for recv
@@ -579,6 +1603,7 @@ void SL2Client::wrap_pre_WinHttpReadData(void *wrapcxt, OUT void **user_data) {
    this call
 */
 void SL2Client::wrap_pre_recv(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_HOOK + (uint32_t)Function::recv);
   SL2_DR_DEBUG("<in wrap_pre_recv>\n");
   SOCKET s = (SOCKET)drwrap_get_arg(wrapcxt, 0);
   char *buf = (char *)drwrap_get_arg(wrapcxt, 1);
@@ -587,7 +1612,7 @@ void SL2Client::wrap_pre_recv(void *wrapcxt, OUT void **user_data) {
 #pragma warning(suppress : 4311 4302)
   int flags = (int)drwrap_get_arg(wrapcxt, 3);
 
-  *user_data = dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(client_read_info));
+  *user_data = alloc_read_info(drwrap_get_drcontext(wrapcxt));
   client_read_info *info = (client_read_info *)*user_data;
 
   info->function = Function::recv;
@@ -595,6 +1620,7 @@ void SL2Client::wrap_pre_recv(void *wrapcxt, OUT void **user_data) {
   info->lpBuffer = buf;
   info->nNumberOfBytesToRead = len;
   info->lpNumberOfBytesRead = NULL;
+  info->capacity = len;
   info->position = 0;
   info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - baseAddr;
   info->source = NULL;
@@ -604,8 +1630,7 @@ void SL2Client::wrap_pre_recv(void *wrapcxt, OUT void **user_data) {
   hash_ctx.fileName[0] = (wchar_t)s;
   hash_ctx.readSize = len;
 
-  info->argHash = (char *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), SL2_HASH_LEN + 1);
-  hash_args(info->argHash, &hash_ctx);
+  defer_hash_args(info, &hash_ctx);
 }
 
 /** Pre-function wrapper for ReadFile
@@ -625,6 +1650,7 @@ void SL2Client::wrap_pre_recv(void *wrapcxt, OUT void **user_data) {
  call
 */
 void SL2Client::wrap_pre_ReadFile(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_HOOK + (uint32_t)Function::ReadFile);
   SL2_DR_DEBUG("<in wrap_pre_ReadFile>\n");
   HANDLE hFile = drwrap_get_arg(wrapcxt, 0);
   void *lpBuffer = drwrap_get_arg(wrapcxt, 1);
@@ -638,11 +1664,11 @@ void SL2Client::wrap_pre_ReadFile(void *wrapcxt, OUT void **user_data) {
   LARGE_INTEGER position = {0};
   SetFilePointerEx(hFile, offset, &position, FILE_CURRENT);
 
-  GetFinalPathNameByHandle(hFile, hash_ctx.fileName, MAX_PATH, FILE_NAME_NORMALIZED);
+  get_handle_path(hFile, hash_ctx.fileName);
   hash_ctx.position = position.QuadPart;
   hash_ctx.readSize = nNumberOfBytesToRead;
 
-  *user_data = dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(client_read_info));
+  *user_data = alloc_read_info(drwrap_get_drcontext(wrapcxt));
   client_read_info *info = (client_read_info *)*user_data;
 
   info->function = Function::ReadFile;
@@ -650,15 +1676,14 @@ void SL2Client::wrap_pre_ReadFile(void *wrapcxt, OUT void **user_data) {
   info->lpBuffer = lpBuffer;
   info->nNumberOfBytesToRead = nNumberOfBytesToRead;
   info->lpNumberOfBytesRead = lpNumberOfBytesRead;
+  info->capacity = lpNumberOfBytesRead ? info->nNumberOfBytesToRead : 0;
   info->position = hash_ctx.position;
   info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - baseAddr;
 
-  info->source =
-      (wchar_t *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(hash_ctx.fileName));
-  memcpy(info->source, hash_ctx.fileName, sizeof(hash_ctx.fileName));
+  defer_hash_args(info, &hash_ctx);
 
-  info->argHash = (char *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), SL2_HASH_LEN + 1);
-  hash_args(info->argHash, &hash_ctx);
+  // The stashed hash_context outlives the call, so the source can just point into it.
+  info->source = info->hashCtx.fileName;
 }
 
 /**
@@ -668,6 +1693,7 @@ void SL2Client::wrap_pre_ReadFile(void *wrapcxt, OUT void **user_data) {
  * function call
  */
 void SL2Client::wrap_pre_fread_s(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_HOOK + (uint32_t)Function::fread_s);
   SL2_DR_DEBUG("<in wrap_pre_fread_s>\n");
   void *buffer = (void *)drwrap_get_arg(wrapcxt, 0);
   size_t bufsize = (size_t)drwrap_get_arg(wrapcxt, 1);
@@ -677,7 +1703,7 @@ void SL2Client::wrap_pre_fread_s(void *wrapcxt, OUT void **user_data) {
   size_t count = (size_t)drwrap_get_arg(wrapcxt, 3);
   FILE *file = (FILE *)drwrap_get_arg(wrapcxt, 4);
 
-  *user_data = dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(client_read_info));
+  *user_data = alloc_read_info(drwrap_get_drcontext(wrapcxt));
   client_read_info *info = (client_read_info *)*user_data;
 
   info->function = Function::fread_s;
@@ -687,6 +1713,7 @@ void SL2Client::wrap_pre_fread_s(void *wrapcxt, OUT void **user_data) {
   info->lpBuffer = buffer;
   info->nNumberOfBytesToRead = size * count;
   info->lpNumberOfBytesRead = NULL;
+  info->capacity = 0;
   info->position = 0;
   info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - baseAddr;
   info->source = NULL;
@@ -699,8 +1726,7 @@ void SL2Client::wrap_pre_fread_s(void *wrapcxt, OUT void **user_data) {
   hash_ctx.readSize = size;
   hash_ctx.count = count;
 
-  info->argHash = (char *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), SL2_HASH_LEN + 1);
-  hash_args(info->argHash, &hash_ctx);
+  defer_hash_args(info, &hash_ctx);
 }
 
 /**
@@ -710,6 +1736,7 @@ void SL2Client::wrap_pre_fread_s(void *wrapcxt, OUT void **user_data) {
  * function call
  */
 void SL2Client::wrap_pre_fread(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_HOOK + (uint32_t)Function::fread);
   SL2_DR_DEBUG("<in wrap_pre_fread>\n");
 
   void *buffer = (void *)drwrap_get_arg(wrapcxt, 0);
@@ -719,7 +1746,7 @@ void SL2Client::wrap_pre_fread(void *wrapcxt, OUT void **user_data) {
   size_t count = (size_t)drwrap_get_arg(wrapcxt, 2);
   FILE *file = (FILE *)drwrap_get_arg(wrapcxt, 3);
 
-  *user_data = dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(client_read_info));
+  *user_data = alloc_read_info(drwrap_get_drcontext(wrapcxt));
   client_read_info *info = (client_read_info *)*user_data;
 
   info->function = Function::fread;
@@ -729,6 +1756,7 @@ void SL2Client::wrap_pre_fread(void *wrapcxt, OUT void **user_data) {
   info->lpBuffer = buffer;
   info->nNumberOfBytesToRead = size * count;
   info->lpNumberOfBytesRead = NULL;
+  info->capacity = 0;
   info->position = 0;
   info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - baseAddr;
   info->source = NULL;
@@ -741,8 +1769,7 @@ void SL2Client::wrap_pre_fread(void *wrapcxt, OUT void **user_data) {
   hash_ctx.readSize = size;
   hash_ctx.count = count;
 
-  info->argHash = (char *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), SL2_HASH_LEN + 1);
-  hash_args(info->argHash, &hash_ctx);
+  defer_hash_args(info, &hash_ctx);
 }
 
 /**
@@ -752,6 +1779,7 @@ void SL2Client::wrap_pre_fread(void *wrapcxt, OUT void **user_data) {
  * function call
  */
 void SL2Client::wrap_pre__read(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_HOOK + (uint32_t)Function::_read);
   SL2_DR_DEBUG("<in wrap_pre__read>\n");
 
 #pragma warning(suppress : 4311 4302)
@@ -760,7 +1788,7 @@ void SL2Client::wrap_pre__read(void *wrapcxt, OUT void **user_data) {
 #pragma warning(suppress : 4311 4302)
   unsigned int count = (unsigned int)drwrap_get_arg(wrapcxt, 2);
 
-  *user_data = dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(client_read_info));
+  *user_data = alloc_read_info(drwrap_get_drcontext(wrapcxt));
   client_read_info *info = (client_read_info *)*user_data;
 
   info->function = Function::_read;
@@ -770,6 +1798,7 @@ void SL2Client::wrap_pre__read(void *wrapcxt, OUT void **user_data) {
   info->lpBuffer = buffer;
   info->nNumberOfBytesToRead = count;
   info->lpNumberOfBytesRead = NULL;
+  info->capacity = 0;
   info->position = 0;
   info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - baseAddr;
   info->source = NULL;
@@ -779,8 +1808,7 @@ void SL2Client::wrap_pre__read(void *wrapcxt, OUT void **user_data) {
   hash_ctx.fileName[0] = (wchar_t)fd;
   hash_ctx.count = count;
 
-  info->argHash = (char *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), SL2_HASH_LEN + 1);
-  hash_args(info->argHash, &hash_ctx);
+  defer_hash_args(info, &hash_ctx);
 }
 
 /**
@@ -790,6 +1818,7 @@ void SL2Client::wrap_pre__read(void *wrapcxt, OUT void **user_data) {
  * function call
  */
 void SL2Client::wrap_pre_MapViewOfFile(void *wrapcxt, OUT void **user_data) {
+  SL2_PROFILE(SL2_PROBE_PRE_HOOK + (uint32_t)Function::MapViewOfFile);
   SL2_DR_DEBUG("<in wrap_pre_MapViewOfFile>\n");
 
   HANDLE hFileMappingObject = drwrap_get_arg(wrapcxt, 0);
@@ -801,7 +1830,7 @@ void SL2Client::wrap_pre_MapViewOfFile(void *wrapcxt, OUT void **user_data) {
   DWORD dwFileOffsetLow = (DWORD)drwrap_get_arg(wrapcxt, 3);
   size_t dwNumberOfBytesToMap = (size_t)drwrap_get_arg(wrapcxt, 4);
 
-  *user_data = dr_thread_alloc(drwrap_get_drcontext(wrapcxt), sizeof(client_read_info));
+  *user_data = alloc_read_info(drwrap_get_drcontext(wrapcxt));
   client_read_info *info = (client_read_info *)*user_data;
 
   info->function = Function::MapViewOfFile;
@@ -810,13 +1839,13 @@ void SL2Client::wrap_pre_MapViewOfFile(void *wrapcxt, OUT void **user_data) {
   // entire file is being mapped into memory. We handle this case in the post-hook
   // with a VirtualQuery call.
   info->nNumberOfBytesToRead = dwNumberOfBytesToMap;
+  info->capacity = 0;
   info->position = 0;
   info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - baseAddr;
   info->source = NULL;
 
   // NOTE(ww): We populate these in the post-hook, when necessary.
   info->lpBuffer = NULL;
-  info->argHash = (char *)dr_thread_alloc(drwrap_get_drcontext(wrapcxt), SL2_HASH_LEN + 1);
 
   // Change write-access requests to copy-on-write requests, since we don't want to clobber
   // our original input file with mutated data.
@@ -890,6 +1919,23 @@ const char *SL2Client::function_to_string(Function function) {
   return "unknown";
 }
 
+/**
+ * The inverse of `function_to_string`.
+ * @param name the stringified name of a function
+ * @param function receives the function, if the name is known
+ * @return whether the name is known
+ */
+bool SL2Client::string_to_function(const char *name, Function *function) {
+  for (size_t f = 0; f < SL2_NUM_FUNCTIONS; f++) {
+    if (STREQ(name, function_to_string((Function)f))) {
+      *function = (Function)f;
+      return true;
+    }
+  }
+
+  return false;
+}
+
 /**
  * maps exception codes to strings
  * @param exception_code
@@ -986,6 +2032,92 @@ bool SL2Client::function_is_in_expected_module(const char *func, const char *mod
   return false;
 }
 
+/**
+ * Indexes the read hooks by the modules that SL2_FUNCMOD_TABLE expects them in, so that each
+ * module load only has to look up its own hooks rather than scanning the whole table for each
+ * one. Call this once, after the targets are loaded and before any module load events.
+ * @param pre_hooks the pre-hook of each function to wrap
+ * @param post_hooks the post-hook of each function in pre_hooks
+ * @param targeted_only whether to leave out the functions that no target matches
+ */
+void SL2Client::init_module_hooks(sl2_pre_proto_map &pre_hooks, sl2_post_proto_map &post_hooks,
+                                  bool targeted_only) {
+  hook_module_count = 0;
+  module_hook_count = 0;
+
+  // The maps are keyed on pointers, so they're searched by name instead.
+  for (int i = 0; i < SL2_FUNCMOD_TABLE_SIZE; i++) {
+    const sl2_funcmod &funcmod = SL2_FUNCMOD_TABLE[i];
+    size_t module;
+
+    if (targeted_only && !function_has_targets(funcmod.func)) {
+      continue;
+    }
+
+    sl2_pre_proto_map::iterator pre = pre_hooks.begin();
+    while (pre != pre_hooks.end() && !STREQ(pre->first, funcmod.func)) {
+      pre++;
+    }
+
+    if (pre == pre_hooks.end()) {
+      continue;
+    }
+
+    for (module = 0; module < hook_module_count; module++) {
+      if (STREQI(hook_modules[module], funcmod.mod)) {
+        break;
+      }
+    }
+
+    if (module == hook_module_count) {
+      hook_modules[hook_module_count++] = funcmod.mod;
+    }
+
+    DR_ASSERT_MSG(module_hook_count < SL2_MAX_MODULE_HOOKS, "too many read hooks");
+
+    // Keep each module's hooks together, so that hooks_for_module can hand them out as a range.
+    size_t j = module_hook_count++;
+    for (; j > 0 && module_hooks[j - 1].module > module; j--) {
+      module_hooks[j] = module_hooks[j - 1];
+    }
+
+    module_hooks[j] = {funcmod.func, module, pre->second, post_hooks[pre->first]};
+  }
+}
+
+/**
+ * Looks up the read hooks to wrap in a module (see `init_module_hooks`).
+ * @param mod the module's preferred name
+ * @param hooks set to the module's first hook, if it has any
+ * @return how many hooks the module has
+ */
+size_t SL2Client::hooks_for_module(const char *mod, const sl2_module_hook **hooks) {
+  size_t module;
+  size_t first = 0;
+  size_t count = 0;
+
+  for (module = 0; module < hook_module_count; module++) {
+    if (STREQI(hook_modules[module], mod)) {
+      break;
+    }
+  }
+
+  if (module == hook_module_count) {
+    return 0;
+  }
+
+  while (first < module_hook_count && module_hooks[first].module < module) {
+    first++;
+  }
+
+  while (first + count < module_hook_count && module_hooks[first + count].module == module) {
+    count++;
+  }
+
+  *hooks = &module_hooks[first];
+  return count;
+}
+
 // TODO(ww): Document the fallback values here.
 /**
  * Converts a msgpack-encoded target object on the disk into a target function struct
@@ -1005,6 +2137,8 @@ bool SL2Client::function_is_in_expected_module(const char *func, const char *mod
     func_name --  ""
 
     argHash --  ""
+
+    argHashVersion --  SL2_ARG_HASH_SHA256
  * @param j - values loaded from target file on disk
  * @param t - struct to fill out
  */
@@ -1017,6 +2151,7 @@ void from_json(const json &j, targetFunction &t) {
   t.retAddrOffset = j.value("retAddrOffset", -1);
   t.functionName = j.value("func_name", "");
   t.argHash = j.value("argHash", "");
+  t.argHashVersion = j.value("argHashVersion", SL2_ARG_HASH_SHA256);
   t.buffer = j["buffer"].get<vector<uint8_t>>();
 
   string source = j.value("source", "");
@@ -1,20 +1,144 @@
 #include <cstdint>
+#include <cstdio>
+#include <cwctype>
 
 #include <Windows.h>
+#include <intrin.h>
 
 #include "common/sl2_server_api.hpp"
 
+/**
+ * Sends the request that's being built (if any) to the server, in a single write.
+ * @param conn
+ * @param flags the frame's flags: SL2_FRAME_MORE if the request continues in another frame
+ * @return success
+ */
+static BOOL sl2_conn_flush(sl2_conn *conn, uint8_t flags = 0) {
+  DWORD txsize;
+
+  if (!conn->framing) {
+    return true;
+  }
+
+  sl2_frame_header *header = (sl2_frame_header *)conn->frame;
+  header->flags = flags | conn->frame_flags;
+  header->length = conn->frame_len;
+
+  DWORD size = (DWORD)(sizeof(*header) + conn->frame_len);
+  BOOL ok = WriteFile(conn->pipe, conn->frame, size, &txsize, NULL) && txsize == size;
+
+  // A continued request keeps building into the (now empty) buffer.
+  conn->frame_len = 0;
+  conn->framing = (flags & SL2_FRAME_MORE) != 0;
+
+  return ok;
+}
+
+/**
+ * Starts building a new request for the server.
+ * @param conn
+ * @param event the request's event
+ * @param flags the flags for every frame of the request: SL2_FRAME_NO_REPLY, or 0
+ */
+static void sl2_conn_begin(sl2_conn *conn, uint8_t event, uint8_t flags = 0) {
+  sl2_frame_header *header = (sl2_frame_header *)conn->frame;
+  header->magic = SL2_FRAME_MAGIC;
+  header->version = SL2_FRAME_VERSION;
+  header->event = event;
+
+  conn->profile_event = event;
+  conn->frame_flags = flags;
+  conn->frame_len = 0;
+  conn->framing = true;
+}
+
+/**
+ * Adds bytes to the request that's being built, or writes them straight to the server if the
+ * request has already been sent.
+ * @param conn
+ * @param thing the bytes
+ * @param size how many bytes
+ * @param txsize receives how many bytes were taken
+ * @return success
+ */
+static BOOL sl2_conn_write(sl2_conn *conn, const void *thing, size_t size, DWORD *txsize) {
+  if (!conn->framing) {
+    return WriteFile(conn->pipe, thing, (DWORD)size, txsize, NULL);
+  }
+
+  const uint8_t *bytes = (const uint8_t *)thing;
+  size_t left = size;
+
+  while (left > 0) {
+    size_t room = SL2_CONN_FRAME_SIZE - sizeof(sl2_frame_header) - conn->frame_len;
+
+    if (room == 0) {
+      if (!sl2_conn_flush(conn, SL2_FRAME_MORE)) {
+        return false;
+      }
+      continue;
+    }
+
+    size_t chunk = min(left, room);
+    memcpy(conn->frame + sizeof(sl2_frame_header) + conn->frame_len, bytes, chunk);
+    conn->frame_len += (uint32_t)chunk;
+    bytes += chunk;
+    left -= chunk;
+  }
+
+  *txsize = (DWORD)size;
+  return true;
+}
+
 // NOTE(ww): The macros below assume the following state:
 // conn: an `sl2_conn *`
 // txsize: a `DWORD
-#define SL2_CONN_WRITE(thing, size) (WriteFile(conn->pipe, thing, (DWORD)size, &txsize, NULL))
-#define SL2_CONN_READ(thing, size) (ReadFile(conn->pipe, thing, (DWORD)size, &txsize, NULL))
+// Each request is built up by SL2_CONN_EVT and SL2_CONN_WRITE, and sent by its first
+// SL2_CONN_READ (or by an explicit sl2_conn_flush, for requests without a response).
+#define SL2_CONN_WRITE(thing, size) (sl2_conn_write(conn, thing, size, &txsize))
+#define SL2_CONN_READ(thing, size)                                                                 \
+  (sl2_conn_flush(conn) && ReadFile(conn->pipe, thing, (DWORD)size, &txsize, NULL))
+
+#define SL2_CONN_EVT(event) sl2_conn_begin(conn, event)
+
+/**
+ * Times a request for the connection's profile hook (if it has one), from its construction until
+ * it goes out of scope. The request's event is whichever one it sent.
+ */
+struct sl2_conn_timer {
+  sl2_conn *conn;
+  uint64_t start;
+
+  sl2_conn_timer(sl2_conn *conn) : conn(conn), start(0) {
+    if (conn->profile_hook) {
+      conn->profile_event = EVT_INVALID;
+      start = __rdtsc();
+    }
+  }
 
-#define SL2_CONN_EVT(event)                                                                        \
-  do {                                                                                             \
-    uint8_t evt = event;                                                                           \
-    SL2_CONN_WRITE(&evt, sizeof(evt));                                                             \
-  } while (0)
+  ~sl2_conn_timer() {
+    if (conn->profile_hook && conn->profile_event != EVT_INVALID) {
+      conn->profile_hook(conn->profile_event, __rdtsc() - start);
+    }
+  }
+};
+
+// Requests that call other requests (e.g. sl2_conn_close) aren't timed themselves, so
+// that nothing is counted twice.
+#define SL2_CONN_PROFILE() sl2_conn_timer conn_timer(conn)
+
+/**
+ * Tells the server which run a request is for, unless our session is already bound to it
+ * (see `sl2_conn_assign_run_id`).
+ * @param conn
+ */
+static void sl2_conn_write_run_id(sl2_conn *conn) {
+  DWORD txsize;
+
+  if (!conn->session_bound) {
+    SL2_CONN_WRITE(&(conn->run_id), sizeof(conn->run_id));
+  }
+}
 
 /**
  * Writes a length-prefixed wide string to the server.
@@ -58,11 +182,109 @@ static SL2Response sl2_conn_read_prefixed_string(sl2_conn *conn, wchar_t *messag
   return SL2Response::OK;
 }
 
+/**
+ * Writes an unshared arena's map to the server: its size, and then the map itself, sparse if few
+ * enough of its cells are nonzero and dense otherwise.
+ * @param conn
+ * @param arena the arena
+ */
+static void sl2_conn_write_arena_map(sl2_conn *conn, sl2_arena *arena) {
+  DWORD txsize;
+  uint32_t cells = 0;
+  const uint32_t max_cells = SL2_ARENA_SPARSE_MAX_CELLS(arena->size);
+  const uint64_t *words = (const uint64_t *)arena->map;
+
+  SL2_CONN_WRITE(&(arena->size), sizeof(arena->size));
+
+  // Most runs only touch a few words of the map, so we count the nonzero cells in
+  // those alone, and give up as soon as the arena is too dense to be worth sending sparse.
+  for (size_t i = 0; i < arena->size / sizeof(*words) && cells < max_cells; i++) {
+    if (!words[i]) {
+      continue;
+    }
+
+    for (size_t j = 0; j < sizeof(*words); j++) {
+      cells += arena->map[i * sizeof(*words) + j] != 0;
+    }
+  }
+
+  uint8_t encoding = cells < max_cells ? SL2_ARENA_SPARSE : SL2_ARENA_DENSE;
+  SL2_CONN_WRITE(&encoding, sizeof(encoding));
+
+  if (encoding == SL2_ARENA_DENSE) {
+    SL2_CONN_WRITE(arena->map, arena->size);
+    return;
+  }
+
+  SL2_CONN_WRITE(&cells, sizeof(cells));
+
+  uint32_t packed[256];
+  size_t count = 0;
+
+  for (size_t i = 0; i < arena->size / sizeof(*words); i++) {
+    if (!words[i]) {
+      continue;
+    }
+
+    for (size_t j = i * sizeof(*words); j < (i + 1) * sizeof(*words); j++) {
+      if (!arena->map[j]) {
+        continue;
+      }
+
+      packed[count++] = SL2_ARENA_CELL(j, arena->map[j]);
+
+      if (count == sizeof(packed) / sizeof(packed[0])) {
+        SL2_CONN_WRITE(packed, sizeof(packed));
+        count = 0;
+      }
+    }
+  }
+
+  if (count) {
+    SL2_CONN_WRITE(packed, count * sizeof(packed[0]));
+  }
+}
+
+/**
+ * Works out which pipe to connect to: the default server instance's, or the one named by
+ * FUZZ_SERVER_INSTANCE_ENV.
+ * The instance comes from the environment so that every client that the harness starts
+ * (and everything that they start) talks to the same instance, without a flag of its own.
+ * @param pipe_path receives the pipe's path
+ * @return whether the instance's name (if any) is valid
+ */
+static bool sl2_conn_server_path(wchar_t pipe_path[MAX_PATH]) {
+  wchar_t instance[FUZZ_SERVER_INSTANCE_MAX + 1];
+  DWORD len =
+      GetEnvironmentVariable(FUZZ_SERVER_INSTANCE_ENV, instance, FUZZ_SERVER_INSTANCE_MAX + 1);
+
+  if (!len) {
+    wcscpy_s(pipe_path, MAX_PATH, FUZZ_SERVER_PATH);
+    return true;
+  }
+
+  if (len > FUZZ_SERVER_INSTANCE_MAX) {
+    return false;
+  }
+
+  for (DWORD i = 0; i < len; ++i) {
+    if (!iswalnum(instance[i]) && instance[i] != L'-' && instance[i] != L'_') {
+      return false;
+    }
+  }
+
+  return swprintf_s(pipe_path, MAX_PATH, FUZZ_SERVER_INSTANCE_PATH_FMT, instance) > 0;
+}
+
 SL2_EXPORT SL2Response sl2_conn_open(sl2_conn *conn) {
   HANDLE pipe;
+  wchar_t pipe_path[MAX_PATH];
 
-  pipe =
-      CreateFile(FUZZ_SERVER_PATH, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+  if (!sl2_conn_server_path(pipe_path)) {
+    return SL2Response::BadPipe;
+  }
+
+  pipe = CreateFile(pipe_path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
 
   if (pipe == INVALID_HANDLE_VALUE) {
     return SL2Response::BadPipe;
@@ -74,71 +296,203 @@ SL2_EXPORT SL2Response sl2_conn_open(sl2_conn *conn) {
   // without requesting a run ID first will be a huge giveaway.
   conn->run_id = {0};
   conn->has_run_id = false;
+  conn->mapped_arena = NULL;
+  conn->finalized = false;
+  conn->has_advice = false;
+  conn->target_advice_count = 0;
+  memset(conn->mapped_rings, 0, sizeof(conn->mapped_rings));
+  conn->upload = NULL;
+  conn->upload_size = 0;
+  conn->upload_refused = false;
+  conn->framing = false;
+  conn->frame_len = 0;
+  conn->frame_flags = 0;
+  conn->async = false;
+  conn->session_bound = false;
+  conn->profile_hook = NULL;
+  conn->profile_event = EVT_INVALID;
 
   return SL2Response::OK;
 }
 
 SL2_EXPORT
 SL2Response sl2_conn_end_session(sl2_conn *conn) {
-  DWORD txsize;
-
+  SL2_CONN_PROFILE();
   // Tell the server that we want to end our session.
   SL2_CONN_EVT(EVT_SESSION_TEARDOWN);
+  sl2_conn_flush(conn);
 
   conn->has_run_id = false;
+  conn->session_bound = false;
 
   return SL2Response::OK;
 }
 
 SL2_EXPORT
 SL2Response sl2_conn_close(sl2_conn *conn) {
-  sl2_conn_end_session(conn);
+  // The server has already hung up on us if we've finalized the run.
+  if (!conn->finalized) {
+    sl2_conn_end_session(conn);
+  }
 
   FlushFileBuffers(conn->pipe);
   CloseHandle(conn->pipe);
 
+  if (conn->mapped_arena) {
+    UnmapViewOfFile(conn->mapped_arena->map);
+    conn->mapped_arena = NULL;
+  }
+
+  for (int i = 0; i < SL2_CONN_MAX_RINGS; i++) {
+    if (conn->mapped_rings[i]) {
+      UnmapViewOfFile(conn->mapped_rings[i]);
+      conn->mapped_rings[i] = NULL;
+    }
+  }
+
+  if (conn->upload) {
+    UnmapViewOfFile(conn->upload);
+    conn->upload = NULL;
+    conn->upload_size = 0;
+  }
+
   // TODO(ww): error returns
   return SL2Response::OK;
 }
 
+SL2_EXPORT
+SL2Response sl2_conn_set_async(sl2_conn *conn, bool async) {
+  conn->async = async;
+
+  return SL2Response::OK;
+}
+
+SL2_EXPORT
+SL2Response sl2_conn_set_profile_hook(sl2_conn *conn, sl2_conn_profile_hook hook) {
+  conn->profile_hook = hook;
+
+  return SL2Response::OK;
+}
+
 SL2_EXPORT
 SL2Response sl2_conn_assign_run_id(sl2_conn *conn, UUID run_id) {
+  SL2_CONN_PROFILE();
   if (conn->has_run_id) {
     return SL2Response::AlreadyHasRunID;
   }
 
+  DWORD txsize;
+
   conn->run_id = run_id;
   conn->has_run_id = true;
 
+  // Bind our session to the run, so that we don't have to send its ID with every event.
+  SL2_CONN_EVT(EVT_SESSION_BEGIN);
+  SL2_CONN_WRITE(&(conn->run_id), sizeof(conn->run_id));
+
+  if (!sl2_conn_flush(conn)) {
+    return SL2Response::ShortWrite;
+  }
+
+  conn->session_bound = true;
+
   return SL2Response::OK;
 }
 
+/**
+ * Makes sure that the connection's upload section can hold a mutated buffer, replacing it with a
+ * bigger one if it can't.
+ * @param conn
+ * @param bufsize the size of the mutated buffer
+ * @return whether the buffer can be uploaded through the section
+ */
+static bool sl2_conn_reserve_upload(sl2_conn *conn, size_t bufsize) {
+  if (conn->upload && bufsize <= conn->upload_size) {
+    return true;
+  }
+
+  size_t size =
+      (bufsize + SL2_UPLOAD_SECTION_SIZE - 1) / SL2_UPLOAD_SECTION_SIZE * SL2_UPLOAD_SECTION_SIZE;
+
+  if (conn->upload_refused || size > SL2_UPLOAD_MAX_SIZE) {
+    return false;
+  }
+
+  if (sl2_conn_map_upload(conn, size) != SL2Response::OK) {
+    conn->upload_refused = true;
+    return false;
+  }
+
+  return true;
+}
+
 SL2_EXPORT
-SL2Response sl2_conn_register_mutation(sl2_conn *conn, sl2_mutation *mutation) {
+SL2Response sl2_conn_register_mutation(sl2_conn *conn, sl2_mutation *mutation,
+                                       const uint8_t *delta, size_t delta_size) {
+  SL2_CONN_PROFILE();
   uint8_t status;
+  uint8_t encoding = delta ? SL2_FKT_DELTA : SL2_FKT_FULL;
   DWORD txsize;
 
   if (!conn->has_run_id) {
     return SL2Response::MissingRunID;
   }
 
-  // First, tell the server that we're registering a mutation.
-  SL2_CONN_EVT(EVT_REGISTER_MUTATION);
+  // Asynchronous registrations can't go through the upload section, since the next one
+  // would overwrite it before the server has read it.
+  bool shared = !delta && !conn->async && mutation->bufsize >= SL2_UPLOAD_MIN_BUFSIZE &&
+                sl2_conn_reserve_upload(conn, mutation->bufsize);
+
+  if (shared) {
+    encoding |= SL2_MUTATION_SHARED;
+  }
+
+  // First, tell the server that we're registering a mutation (and whether we want its status).
+  sl2_conn_begin(conn, EVT_REGISTER_MUTATION, conn->async ? SL2_FRAME_NO_REPLY : 0);
 
   // Then, tell the server which run the mutation is associated with.
-  SL2_CONN_WRITE(&(conn->run_id), sizeof(conn->run_id));
+  sl2_conn_write_run_id(conn);
 
   // Then, send our mutation state over.
   // TODO(ww): Check for truncated writes.
   SL2_CONN_WRITE(&(mutation->function), sizeof(mutation->function));
   SL2_CONN_WRITE(&(mutation->mut_count), sizeof(mutation->mut_count));
   SL2_CONN_WRITE(&(mutation->mut_type), sizeof(mutation->mut_type));
+  SL2_CONN_WRITE(&(mutation->chain_seed), sizeof(mutation->chain_seed));
+  SL2_CONN_WRITE(&(mutation->chain_len), sizeof(mutation->chain_len));
+
+  // The server needs a chain's capacity to re-apply it (see SL2_FKT_CHAIN).
+  if (mutation->chain_len > 0) {
+    SL2_CONN_WRITE(mutation->chain, mutation->chain_len * sizeof(mutation->chain[0]));
+    SL2_CONN_WRITE(&(mutation->capacity), sizeof(mutation->capacity));
+  }
+
   sl2_conn_write_prefixed_string(conn, mutation->resource);
   SL2_CONN_WRITE(&(mutation->position), sizeof(mutation->position));
-  SL2_CONN_WRITE(&(mutation->bufsize), sizeof(mutation->bufsize));
+  SL2_CONN_WRITE(&encoding, sizeof(encoding));
+
+  // A delta replaces the mutated buffer on the wire; the server stores it as is.
+  if (delta) {
+    SL2_CONN_WRITE(&delta_size, sizeof(delta_size));
+    SL2_CONN_WRITE(delta, delta_size);
+  } else if (shared) {
+    size_t offset = 0;
+
+    memcpy(conn->upload + offset, mutation->buffer, mutation->bufsize);
+    SL2_CONN_WRITE(&(mutation->bufsize), sizeof(mutation->bufsize));
+    SL2_CONN_WRITE(&offset, sizeof(offset));
+  } else {
+    SL2_CONN_WRITE(&(mutation->bufsize), sizeof(mutation->bufsize));
 
-  if (mutation->bufsize > 0) {
-    SL2_CONN_WRITE(mutation->buffer, mutation->bufsize);
+    if (mutation->bufsize > 0) {
+      SL2_CONN_WRITE(mutation->buffer, mutation->bufsize);
+    }
+  }
+
+  // Asynchronous registrations are done once they're in the pipe. The server won't
+  // send a status for them.
+  if (conn->async) {
+    return sl2_conn_flush(conn) ? SL2Response::OK : SL2Response::ShortWrite;
   }
 
   SL2_CONN_READ(&status, sizeof(status));
@@ -150,10 +504,78 @@ SL2Response sl2_conn_register_mutation(sl2_conn *conn, sl2_mutation *mutation) {
   }
 }
 
+/**
+ * Reads a delta-encoded mutation from the server, applying it to a buffer that holds the
+ * original bytes as it goes. Changed bytes that don't fit in the buffer are read and dropped.
+ * @param conn
+ * @param buffer the buffer holding the original bytes
+ * @param bufsize the size of the buffer
+ * @param replayed receives the length of the mutated buffer (at most `bufsize`)
+ * @return SL2Response code
+ */
+static SL2Response sl2_conn_read_delta(sl2_conn *conn, uint8_t *buffer, size_t bufsize,
+                                       size_t *replayed) {
+  DWORD txsize;
+  size_t delta_size = 0;
+  size_t consumed = 0;
+  sl2_delta delta;
+  uint8_t scratch[256];
+
+  if (!SL2_CONN_READ(&delta_size, sizeof(delta_size)) || delta_size < sizeof(delta) ||
+      !SL2_CONN_READ(&delta, sizeof(delta)) || txsize != sizeof(delta)) {
+    return SL2Response::ShortRead;
+  }
+
+  consumed = sizeof(delta);
+
+  for (uint32_t i = 0; i < delta.count; i++) {
+    sl2_delta_range range;
+
+    if (delta_size - consumed < sizeof(range) || !SL2_CONN_READ(&range, sizeof(range)) ||
+        txsize != sizeof(range)) {
+      return SL2Response::ShortRead;
+    }
+
+    consumed += sizeof(range);
+
+    if (delta_size - consumed < range.length ||
+        (uint64_t)range.offset + range.length > delta.mutated_size) {
+      return SL2Response::BadValue;
+    }
+
+    consumed += range.length;
+
+    size_t inside = 0;
+    if (range.offset < bufsize) {
+      inside = min(range.length, bufsize - range.offset);
+    }
+
+    if (inside > 0 && (!SL2_CONN_READ(buffer + range.offset, inside) || txsize != inside)) {
+      return SL2Response::ShortRead;
+    }
+
+    for (size_t left = range.length - inside; left > 0; left -= txsize) {
+      if (!SL2_CONN_READ(scratch, min(left, sizeof(scratch))) || txsize == 0) {
+        return SL2Response::ShortRead;
+      }
+    }
+  }
+
+  if (consumed != delta_size) {
+    return SL2Response::BadValue;
+  }
+
+  *replayed = min((size_t)delta.mutated_size, bufsize);
+
+  return SL2Response::OK;
+}
+
 SL2_EXPORT
 SL2Response sl2_conn_request_replay(sl2_conn *conn, uint32_t mut_count, size_t bufsize,
-                                    void *buffer) {
+                                    void *buffer, size_t *replayed) {
+  SL2_CONN_PROFILE();
   DWORD txsize;
+  size_t replay_size = 0;
 
   // If the connection doesn't have a run ID, then we don't know which
   // replay to request.
@@ -165,21 +587,42 @@ SL2Response sl2_conn_request_replay(sl2_conn *conn, uint32_t mut_count, size_t b
   SL2_CONN_EVT(EVT_REPLAY);
 
   // Then, tell the server which run we're requesting the replay for.
-  SL2_CONN_WRITE(&(conn->run_id), sizeof(conn->run_id));
+  sl2_conn_write_run_id(conn);
 
   // Then, tell the server which mutation we're expecting from that run.
   SL2_CONN_WRITE(&mut_count, sizeof(mut_count));
 
-  // Finally, tell the server how many bytes we expect to receive and
-  // receive those bytes into the buffer.
+  // Then, tell the server how many bytes we expect to receive.
   SL2_CONN_WRITE(&bufsize, sizeof(bufsize));
-  SL2_CONN_READ(buffer, bufsize);
+
+  // The server tells us whether it's sending the whole mutated buffer or just a delta.
+  uint8_t encoding = SL2_FKT_FULL;
+  SL2_CONN_READ(&encoding, sizeof(encoding));
+
+  if (encoding == SL2_FKT_DELTA) {
+    SL2Response res = sl2_conn_read_delta(conn, (uint8_t *)buffer, bufsize, &replay_size);
+
+    if (res != SL2Response::OK) {
+      return res;
+    }
+  } else {
+    // Receive the bytes into the buffer.
+    SL2_CONN_READ(buffer, bufsize);
+
+    // The server tells us how many of those bytes were actually mutated ones.
+    SL2_CONN_READ(&replay_size, sizeof(replay_size));
+  }
+
+  if (replayed) {
+    *replayed = replay_size;
+  }
 
   return SL2Response::OK;
 }
 
 SL2_EXPORT
 SL2Response sl2_conn_request_crash_paths(sl2_conn *conn, uint64_t pid, sl2_crash_paths *paths) {
+  SL2_CONN_PROFILE();
   DWORD txsize;
 
   // If the connection doesn't a run ID, then we don't have a run to finalize.
@@ -191,7 +634,7 @@ SL2Response sl2_conn_request_crash_paths(sl2_conn *conn, uint64_t pid, sl2_crash
   SL2_CONN_EVT(EVT_CRASH_PATHS);
 
   // Then, tell the server which run we're requesting crash paths for.
-  SL2_CONN_WRITE(&(conn->run_id), sizeof(conn->run_id));
+  sl2_conn_write_run_id(conn);
 
   // Then, tell the server which process is crashing (so that we get unique crash paths).
   SL2_CONN_WRITE(&pid, sizeof(pid));
@@ -204,8 +647,80 @@ SL2Response sl2_conn_request_crash_paths(sl2_conn *conn, uint64_t pid, sl2_crash
   return SL2Response::OK;
 }
 
+SL2_EXPORT
+SL2Response sl2_conn_request_crash_dump(sl2_conn *conn, uint64_t pid, uint32_t thread_id,
+                                        EXCEPTION_POINTERS *exception_pointers) {
+  SL2_CONN_PROFILE();
+  DWORD txsize;
+  uint8_t status;
+  uint64_t exception_pointers_addr = (uint64_t)exception_pointers;
+
+  if (!conn->has_run_id) {
+    return SL2Response::MissingRunID;
+  }
+
+  // First, tell the server that we'd like it to dump us.
+  SL2_CONN_EVT(EVT_CRASH_DUMP);
+
+  // Then, tell the server which run the dump belongs to.
+  sl2_conn_write_run_id(conn);
+
+  // Then, tell the server which process and thread crashed.
+  SL2_CONN_WRITE(&pid, sizeof(pid));
+  SL2_CONN_WRITE(&thread_id, sizeof(thread_id));
+
+  // Then, tell the server where to find the crash in our address space.
+  SL2_CONN_WRITE(&exception_pointers_addr, sizeof(exception_pointers_addr));
+
+  // Finally, wait for the server to tell us that it has a snapshot of us.
+  SL2_CONN_READ(&status, sizeof(status));
+
+  if (status) {
+    return SL2Response::ServerError;
+  }
+
+  return SL2Response::OK;
+}
+
+/**
+ * Reads the server's mutation advice into the connection's advice cache: the arena's, followed
+ * by that of each targeted call that the server keeps a schedule for.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @return SL2Response code
+ */
+static SL2Response sl2_conn_read_advice(sl2_conn *conn) {
+  DWORD txsize;
+  uint32_t count = 0;
+
+  SL2_CONN_READ(&(conn->advice.table_idx), sizeof(conn->advice.table_idx));
+
+  // The server doesn't actually know how many strategies we have;
+  // it just knows whether or not it wants to move on to a new one.
+  conn->advice.table_idx %= SL2_NUM_STRATEGIES;
+  conn->advice.strategy = SL2_STRATEGY_TABLE[conn->advice.table_idx];
+
+  if (!SL2_CONN_READ(&count, sizeof(count)) || txsize != sizeof(count)) {
+    return SL2Response::ShortRead;
+  }
+
+  if (count > SL2_MAX_TARGETS) {
+    return SL2Response::BadValue;
+  }
+
+  size_t size = count * sizeof(conn->target_advice[0]);
+  if (size && (!SL2_CONN_READ(conn->target_advice, size) || txsize != size)) {
+    return SL2Response::ShortRead;
+  }
+
+  conn->target_advice_count = count;
+  conn->has_advice = true;
+
+  return SL2Response::OK;
+}
+
 SL2_EXPORT
 SL2Response sl2_conn_request_arena(sl2_conn *conn, sl2_arena *arena) {
+  SL2_CONN_PROFILE();
   DWORD txsize;
 
   if (!arena->id) {
@@ -221,11 +736,261 @@ SL2Response sl2_conn_request_arena(sl2_conn *conn, sl2_arena *arena) {
   // and function(s) should produce the same identifier.
   sl2_conn_write_prefixed_string(conn, arena->id);
 
+  // Then, tell the server how big a map we'd like, and read back how big the arena's map is.
+  // An arena that already exists keeps its size.
+  SL2_CONN_WRITE(&(arena->size), sizeof(arena->size));
+  SL2_CONN_READ(&(arena->size), sizeof(arena->size));
+
+  if (!SL2_ARENA_SIZE_VALID(arena->size)) {
+    return SL2Response::BadValue;
+  }
+
+  // Finally, read the arena's current mutation advice.
+  return sl2_conn_read_advice(conn);
+}
+
+SL2_EXPORT
+SL2Response sl2_conn_map_arena(sl2_conn *conn, wchar_t *arena_id, uint64_t pid, uint32_t size,
+                               sl2_arena **arena) {
+  SL2_CONN_PROFILE();
+  DWORD txsize;
+  uint8_t status;
+  wchar_t section_name[MAX_PATH + 1] = {0};
+
+  if (!arena_id) {
+    return SL2Response::MissingArenaID;
+  }
+
+  // First, tell the server that we'd like a shared coverage arena.
+  SL2_CONN_EVT(EVT_MAP_ARENA);
+
+  // Then, tell the server which coverage arena we'd like.
+  sl2_conn_write_prefixed_string(conn, arena_id);
+
+  // Then, tell the server who we are (so that we get a unique section), and how big a map we'd
+  // like.
+  SL2_CONN_WRITE(&pid, sizeof(pid));
+  SL2_CONN_WRITE(&size, sizeof(size));
+
+  SL2_CONN_READ(&status, sizeof(status));
+
+  if (status) {
+    return SL2Response::ServerError;
+  }
+
+  // Then, read the name of the section, and the size of the arena's map.
+  if (sl2_conn_read_prefixed_string(conn, section_name, MAX_PATH) != SL2Response::OK) {
+    return SL2Response::MaxPath;
+  }
+
+  SL2_CONN_READ(&size, sizeof(size));
+
+  if (!SL2_ARENA_SIZE_VALID(size)) {
+    return SL2Response::BadValue;
+  }
+
+  // Then, read the arena's current mutation advice.
+  if (sl2_conn_read_advice(conn) != SL2Response::OK) {
+    return SL2Response::ShortRead;
+  }
+
+  // Finally, map the section.
+
+  HANDLE section = OpenFileMapping(FILE_MAP_ALL_ACCESS, false, section_name);
+
+  if (!section) {
+    return SL2Response::BadValue;
+  }
+
+  // The view keeps the section alive, so we don't need to hold onto its handle.
+  uint8_t *map = (uint8_t *)MapViewOfFile(section, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  CloseHandle(section);
+
+  if (!map) {
+    return SL2Response::BadValue;
+  }
+
+  wcscpy_s(conn->shared_arena.id, arena_id);
+  conn->shared_arena.size = size;
+  conn->shared_arena.map = map;
+  conn->mapped_arena = &(conn->shared_arena);
+
+  *arena = conn->mapped_arena;
+
+  return SL2Response::OK;
+}
+
+SL2_EXPORT
+SL2Response sl2_conn_map_ring(sl2_conn *conn, wchar_t *arena_id, sl2_mutation *mutation,
+                              sl2_mutation_ring **ring) {
+  SL2_CONN_PROFILE();
+  DWORD txsize;
+  uint8_t status;
+  uint64_t hash;
+  wchar_t section_name[MAX_PATH + 1] = {0};
+
+  if (!arena_id) {
+    return SL2Response::MissingArenaID;
+  }
+
+  if (mutation->mut_count >= SL2_CONN_MAX_RINGS || mutation->bufsize == 0) {
+    return SL2Response::BadValue;
+  }
+
+  hash = sl2_ring_hash(mutation->buffer, mutation->bufsize);
+
+  if (conn->mapped_rings[mutation->mut_count]) {
+    if (conn->mapped_ring_sizes[mutation->mut_count] == mutation->bufsize &&
+        conn->mapped_ring_hashes[mutation->mut_count] == hash) {
+      *ring = conn->mapped_rings[mutation->mut_count];
+      return SL2Response::OK;
+    }
+
+    UnmapViewOfFile(conn->mapped_rings[mutation->mut_count]);
+    conn->mapped_rings[mutation->mut_count] = NULL;
+  }
+
+  // First, tell the server that we'd like a ring of mutations.
+  SL2_CONN_EVT(EVT_MAP_RING);
+
+  // Then, tell the server which targeted read we'd like mutations of.
+  sl2_conn_write_prefixed_string(conn, arena_id);
+  SL2_CONN_WRITE(&(mutation->mut_count), sizeof(mutation->mut_count));
+  SL2_CONN_WRITE(&(mutation->bufsize), sizeof(mutation->bufsize));
+  SL2_CONN_WRITE(&hash, sizeof(hash));
+
+  SL2_CONN_READ(&status, sizeof(status));
+
+  // If the server hasn't seen the read before, it asks us for the read itself.
+  if (status == 2) {
+    SL2_CONN_WRITE(mutation->buffer, mutation->bufsize);
+    SL2_CONN_READ(&status, sizeof(status));
+  }
+
+  if (status) {
+    return SL2Response::ServerError;
+  }
+
+  // Then, read the name of the section.
+  if (sl2_conn_read_prefixed_string(conn, section_name, MAX_PATH) != SL2Response::OK) {
+    return SL2Response::MaxPath;
+  }
+
+  // Finally, map the section.
+  HANDLE section = OpenFileMapping(FILE_MAP_ALL_ACCESS, false, section_name);
+
+  if (!section) {
+    return SL2Response::BadValue;
+  }
+
+  sl2_mutation_ring *view = (sl2_mutation_ring *)MapViewOfFile(
+      section, FILE_MAP_ALL_ACCESS, 0, 0, sl2_ring_size(mutation->bufsize));
+  CloseHandle(section);
+
+  if (!view) {
+    return SL2Response::BadValue;
+  }
+
+  if (view->bufsize != mutation->bufsize) {
+    UnmapViewOfFile(view);
+    return SL2Response::BadValue;
+  }
+
+  conn->mapped_rings[mutation->mut_count] = view;
+  conn->mapped_ring_sizes[mutation->mut_count] = mutation->bufsize;
+  conn->mapped_ring_hashes[mutation->mut_count] = hash;
+  *ring = view;
+
+  return SL2Response::OK;
+}
+
+SL2_EXPORT
+SL2Response sl2_conn_register_ring_mutation(sl2_conn *conn, sl2_mutation *mutation,
+                                            sl2_mutation_ring *ring, uint64_t seq) {
+  SL2_CONN_PROFILE();
+  uint8_t status;
+  DWORD txsize;
+
+  if (!conn->has_run_id) {
+    return SL2Response::MissingRunID;
+  }
+
+  // First, tell the server that we're registering a mutation from a ring.
+  SL2_CONN_EVT(EVT_REGISTER_RING_MUTATION);
+
+  // Then, tell the server which run the mutation is associated with.
+  sl2_conn_write_run_id(conn);
+
+  // Then, tell the server where to find the mutation, and what it was applied to.
+  SL2_CONN_WRITE(&(mutation->function), sizeof(mutation->function));
+  SL2_CONN_WRITE(&(mutation->mut_count), sizeof(mutation->mut_count));
+  SL2_CONN_WRITE(&(ring->id), sizeof(ring->id));
+  SL2_CONN_WRITE(&seq, sizeof(seq));
+  sl2_conn_write_prefixed_string(conn, mutation->resource);
+  SL2_CONN_WRITE(&(mutation->position), sizeof(mutation->position));
+
+  SL2_CONN_READ(&status, sizeof(status));
+
+  if (!status) {
+    return SL2Response::OK;
+  } else {
+    return SL2Response::ServerError;
+  }
+}
+
+SL2_EXPORT
+SL2Response sl2_conn_map_upload(sl2_conn *conn, size_t size) {
+  SL2_CONN_PROFILE();
+  DWORD txsize;
+  uint8_t status;
+  wchar_t section_name[MAX_PATH + 1] = {0};
+
+  // First, tell the server that we'd like a section to upload mutations through, and how big.
+  SL2_CONN_EVT(EVT_MAP_UPLOAD);
+  SL2_CONN_WRITE(&size, sizeof(size));
+
+  SL2_CONN_READ(&status, sizeof(status));
+
+  if (status) {
+    return SL2Response::ServerError;
+  }
+
+  if (conn->upload) {
+    UnmapViewOfFile(conn->upload);
+    conn->upload = NULL;
+    conn->upload_size = 0;
+  }
+
+  // Then, read the name of the section, and its size.
+  if (sl2_conn_read_prefixed_string(conn, section_name, MAX_PATH) != SL2Response::OK) {
+    return SL2Response::MaxPath;
+  }
+
+  SL2_CONN_READ(&size, sizeof(size));
+
+  // Finally, map the section.
+  HANDLE section = OpenFileMapping(FILE_MAP_ALL_ACCESS, false, section_name);
+
+  if (!section) {
+    return SL2Response::BadValue;
+  }
+
+  uint8_t *view = (uint8_t *)MapViewOfFile(section, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  CloseHandle(section);
+
+  if (!view) {
+    return SL2Response::BadValue;
+  }
+
+  conn->upload = view;
+  conn->upload_size = size;
+
   return SL2Response::OK;
 }
 
 SL2_EXPORT
 SL2Response sl2_conn_register_arena(sl2_conn *conn, sl2_arena *arena) {
+  SL2_CONN_PROFILE();
   DWORD txsize;
 
   if (!arena->id) {
@@ -235,17 +1000,107 @@ SL2Response sl2_conn_register_arena(sl2_conn *conn, sl2_arena *arena) {
   // First, tell the server that we're sending it a coverage arena.
   SL2_CONN_EVT(EVT_SET_ARENA);
 
+  // The server may pick a new strategy based on this arena.
+  conn->has_advice = false;
+
   // Then, tell the server which ID the arena is associated with.
   sl2_conn_write_prefixed_string(conn, arena->id);
 
-  // Finally, write the arena data to the server.
-  SL2_CONN_WRITE(arena->map, FUZZ_ARENA_SIZE);
+  // Then, tell the server whether the arena is shared with it.
+  bool mapped = arena == conn->mapped_arena;
+  SL2_CONN_WRITE(&mapped, sizeof(mapped));
+
+  // Finally, write the arena data to the server (sparse, for sparse arenas). If the arena is
+  // shared, the server reads the data straight out of the section instead.
+  if (!mapped) {
+    sl2_conn_write_arena_map(conn, arena);
+  }
+
+  if (!sl2_conn_flush(conn)) {
+    return SL2Response::ShortWrite;
+  }
+
+  return SL2Response::OK;
+}
+
+/**
+ * Fingerprints a raw arena, so that the server can tell whether it's already seen the run's path
+ * without being sent the whole map. Like the server's sparse path hash, only the map's nonzero
+ * words (and their positions) are mixed in, since most runs only touch a few of them.
+ * @param arena the arena
+ * @return the fingerprint, which is never 0
+ */
+static uint64_t sl2_arena_fingerprint(const sl2_arena *arena) {
+  const uint64_t *words = (const uint64_t *)arena->map;
+  uint64_t hash = 0x9E3779B185EBCA87ULL ^ arena->size;
+
+  for (size_t i = 0; i < arena->size / sizeof(*words); i++) {
+    if (words[i]) {
+      hash ^= (words[i] ^ (i * 0x85EBCA77C2B2AE63ULL)) * 0xC2B2AE3D27D4EB4FULL;
+      hash = _rotl64(hash, 27) * 0x9E3779B185EBCA87ULL;
+    }
+  }
+
+  hash ^= hash >> 33;
+  hash *= 0xC2B2AE3D27D4EB4FULL;
+  hash ^= hash >> 29;
+
+  return hash ? hash : 1;
+}
+
+SL2_EXPORT
+SL2Response sl2_conn_finalize_run(sl2_conn *conn, sl2_arena *arena, uint64_t pid, bool crashed,
+                                  uint32_t distance, sl2_coverage_info *cov) {
+  SL2_CONN_PROFILE();
+  DWORD txsize;
+
+  if (!arena->id) {
+    return SL2Response::MissingArenaID;
+  }
+
+  // First, tell the server that we're finalizing our run.
+  SL2_CONN_EVT(EVT_FINALIZE_PATH);
+
+  // Then, tell it which arena the run is for, and which path the run took.
+  sl2_conn_write_prefixed_string(conn, arena->id);
+
+  uint64_t fingerprint = sl2_arena_fingerprint(arena);
+  SL2_CONN_WRITE(&fingerprint, sizeof(fingerprint));
+
+  // Then, tell the server about the process, whether it crashed, and how close it got to its
+  // directed targets.
+  SL2_CONN_WRITE(&pid, sizeof(pid));
+  SL2_CONN_WRITE(&crashed, sizeof(crashed));
+  SL2_CONN_WRITE(&distance, sizeof(distance));
+
+  // If the server hasn't seen the path yet, send the arena exactly as EVT_SET_ARENA does.
+  bool known = false;
+  if (!SL2_CONN_READ(&known, sizeof(known))) {
+    return SL2Response::ShortRead;
+  }
+
+  if (!known) {
+    bool mapped = arena == conn->mapped_arena;
+    SL2_CONN_WRITE(&mapped, sizeof(mapped));
+
+    if (!mapped) {
+      sl2_conn_write_arena_map(conn, arena);
+    }
+  }
+
+  // Finally, read the coverage info for the run's path back.
+  SL2_CONN_READ(cov, sizeof(sl2_coverage_info));
+
+  conn->has_run_id = false;
+  conn->session_bound = false;
+  conn->finalized = true;
 
   return SL2Response::OK;
 }
 
 SL2_EXPORT
 SL2Response sl2_conn_ping(sl2_conn *conn, uint8_t *ok) {
+  SL2_CONN_PROFILE();
   DWORD txsize;
 
   SL2_CONN_EVT(EVT_PING);
@@ -257,6 +1112,7 @@ SL2Response sl2_conn_ping(sl2_conn *conn, uint8_t *ok) {
 
 SL2_EXPORT
 SL2Response sl2_conn_register_pid(sl2_conn *conn, uint64_t pid, bool tracing) {
+  SL2_CONN_PROFILE();
   DWORD txsize;
 
   if (!conn->has_run_id) {
@@ -267,7 +1123,7 @@ SL2Response sl2_conn_register_pid(sl2_conn *conn, uint64_t pid, bool tracing) {
   SL2_CONN_EVT(EVT_REGISTER_PID);
 
   // Then, tell the server which run the pid is associated with.
-  SL2_CONN_WRITE(&(conn->run_id), sizeof(conn->run_id));
+  sl2_conn_write_run_id(conn);
 
   // Then, tell the server whether we're registering a tracer pid or not.
   SL2_CONN_WRITE(&tracing, sizeof(tracing));
@@ -275,39 +1131,158 @@ SL2Response sl2_conn_register_pid(sl2_conn *conn, uint64_t pid, bool tracing) {
   // Finally, write the pid to the server.
   SL2_CONN_WRITE(&pid, sizeof(pid));
 
+  if (!sl2_conn_flush(conn)) {
+    return SL2Response::ShortWrite;
+  }
+
   return SL2Response::OK;
 }
 
 SL2_EXPORT
 SL2Response sl2_conn_advise_mutation(sl2_conn *conn, sl2_arena *arena,
-                                     sl2_mutation_advice *advice) {
+                                     const sl2_mutation *mutation, sl2_mutation_advice *advice) {
+  SL2_CONN_PROFILE();
+  DWORD txsize;
+
+  if (!arena->id) {
+    return SL2Response::MissingArenaID;
+  }
+
+  if (!conn->has_advice) {
+    // First, tell the server that we want mutation advice.
+    SL2_CONN_EVT(EVT_ADVISE_MUTATION);
+
+    // Then, tell the server which arena we want it to base advice on.
+    sl2_conn_write_prefixed_string(conn, arena->id);
+
+    // Then, tell the server that we only want strategy advice.
+    size_t bufsize = 0;
+    SL2_CONN_WRITE(&bufsize, sizeof(bufsize));
+
+    // Then, read the index of the next strategy from the server.
+    SL2Response res = sl2_conn_read_advice(conn);
+
+    if (res != SL2Response::OK) {
+      return res;
+    }
+  }
+
+  *advice = conn->advice;
+
+  for (uint32_t i = 0; mutation && i < conn->target_advice_count; ++i) {
+    const sl2_target_advice &target = conn->target_advice[i];
+
+    if (target.function == mutation->function && target.mut_count == mutation->mut_count) {
+      advice->table_idx = target.table_idx % SL2_NUM_STRATEGIES;
+      advice->strategy = SL2_STRATEGY_TABLE[advice->table_idx];
+      break;
+    }
+  }
+
+  return SL2Response::OK;
+}
+
+SL2_EXPORT
+SL2Response sl2_conn_advise_deterministic(sl2_conn *conn, sl2_arena *arena, size_t bufsize,
+                                          sl2_det_cursor *cursor) {
+  SL2_CONN_PROFILE();
   DWORD txsize;
 
   if (!arena->id) {
     return SL2Response::MissingArenaID;
   }
 
+  if (bufsize == 0) {
+    return SL2Response::BadValue;
+  }
+
   // First, tell the server that we want mutation advice.
   SL2_CONN_EVT(EVT_ADVISE_MUTATION);
 
   // Then, tell the server which arena we want it to base advice on.
   sl2_conn_write_prefixed_string(conn, arena->id);
 
-  // Then, read the index of the next strategy from the server.
-  SL2_CONN_READ(&(advice->table_idx), sizeof(advice->table_idx));
+  // Then, tell the server how big the buffer we're walking is.
+  SL2_CONN_WRITE(&bufsize, sizeof(bufsize));
 
-  // The server doesn't actually know how many strategies we have;
-  // it just knows whether or not it wants to move on to a new one.
-  advice->table_idx %= SL2_NUM_STRATEGIES;
+  // Then, read the index of the next strategy from the server. It's always current.
+  SL2Response res = sl2_conn_read_advice(conn);
 
-  advice->strategy = SL2_STRATEGY_TABLE[advice->table_idx];
+  if (res != SL2Response::OK) {
+    return res;
+  }
+
+  // Finally, read the deterministic mutation that the server handed us.
+  if (!SL2_CONN_READ(cursor, sizeof(*cursor)) || txsize != sizeof(*cursor)) {
+    return SL2Response::ShortRead;
+  }
 
   return SL2Response::OK;
 }
 
+/**
+ * Requests an input from the arena's corpus, either as a splice donor or as a seed.
+ * @param conn
+ * @param event EVT_CORPUS_DONOR or EVT_SEED
+ * @param arena
+ * @param mut_count the targeted read that the input should come from
+ * @param buf receives the input
+ * @param capacity the size of `buf`
+ * @param size receives the input's size, or 0 if there isn't one
+ * @return SL2Response code
+ */
+static SL2Response sl2_conn_request_corpus_input(sl2_conn *conn, uint8_t event, sl2_arena *arena,
+                                                 uint32_t mut_count, uint8_t *buf,
+                                                 size_t capacity, size_t *size) {
+  DWORD txsize;
+
+  if (!arena->id) {
+    return SL2Response::MissingArenaID;
+  }
+
+  // First, tell the server what we'd like the input for.
+  SL2_CONN_EVT(event);
+
+  // Then, tell the server which targeted read of which arena it should come from, and how much
+  // of it we have room for.
+  sl2_conn_write_prefixed_string(conn, arena->id);
+  SL2_CONN_WRITE(&mut_count, sizeof(mut_count));
+  SL2_CONN_WRITE(&capacity, sizeof(capacity));
+
+  // Then, read the input's size. The server never sends more than we have room for.
+  if (!SL2_CONN_READ(size, sizeof(*size)) || txsize != sizeof(*size) || *size > capacity) {
+    return SL2Response::ShortRead;
+  }
+
+  // Finally, read the input itself (if there is one).
+  if (*size > 0 && (!SL2_CONN_READ(buf, (DWORD)*size) || txsize != *size)) {
+    return SL2Response::ShortRead;
+  }
+
+  return SL2Response::OK;
+}
+
+// Requests a splice donor from the arena's corpus
+SL2_EXPORT
+SL2Response sl2_conn_request_donor(sl2_conn *conn, sl2_arena *arena, uint32_t mut_count,
+                                   uint8_t *buf, size_t capacity, size_t *size) {
+  SL2_CONN_PROFILE();
+  return sl2_conn_request_corpus_input(conn, EVT_CORPUS_DONOR, arena, mut_count, buf, capacity,
+                                       size);
+}
+
+// Requests a seed to mutate from the arena's corpus
+SL2_EXPORT
+SL2Response sl2_conn_request_seed(sl2_conn *conn, sl2_arena *arena, uint32_t mut_count,
+                                  uint8_t *buf, size_t capacity, size_t *size) {
+  SL2_CONN_PROFILE();
+  return sl2_conn_request_corpus_input(conn, EVT_SEED, arena, mut_count, buf, capacity, size);
+}
+
 // Requests information about code coverage so far
 SL2_EXPORT
 SL2Response sl2_conn_get_coverage(sl2_conn *conn, sl2_arena *arena, sl2_coverage_info *cov) {
+  SL2_CONN_PROFILE();
 
   DWORD txsize;
 
@@ -325,3 +1300,17 @@ SL2Response sl2_conn_get_coverage(sl2_conn *conn, sl2_arena *arena, sl2_coverage
 
   return SL2Response::OK;
 }
+
+SL2_EXPORT
+SL2Response sl2_conn_request_stats(sl2_conn *conn, sl2_server_stats *stats) {
+  SL2_CONN_PROFILE();
+  DWORD txsize;
+
+  // First, tell the server that we want its statistics.
+  SL2_CONN_EVT(EVT_STATS);
+
+  // Then, read them back.
+  SL2_CONN_READ(stats, sizeof(sl2_server_stats));
+
+  return SL2Response::OK;
+}
@@ -0,0 +1,74 @@
+#include "bench_common.h"
+
+// A byte-at-a-time parser: tokenizes its input into numbers, words, and punctuation, the way a
+// hand-written text format parser would. Every byte passes through a branch on its own value,
+// which is the worst case for per-instruction taint propagation.
+//
+// Usage: bench_byte_parser <input> [passes]
+
+/*! What the tokenizer is in the middle of. */
+enum bench_token {
+  BENCH_NONE,
+  BENCH_NUMBER,
+  BENCH_WORD,
+};
+
+int main(int argc, char **argv) {
+  std::vector<uint8_t> input;
+
+  if (argc < 2 || !bench_read_input(argv[1], 0, input)) {
+    fprintf(stderr, "Usage: %s <input> [passes]\n", argv[0]);
+    return 1;
+  }
+
+  uint32_t passes = bench_arg(argc, argv, 2, SL2_BENCH_DEFAULT_WORK);
+  uint64_t numbers = 0, words = 0, lines = 0, punctuation = 0, sum = 0;
+
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    bench_token token = BENCH_NONE;
+    uint64_t number = 0;
+
+    for (size_t i = 0; i < input.size(); i++) {
+      uint8_t c = input[i];
+
+      if (c >= '0' && c <= '9') {
+        if (token != BENCH_NUMBER) {
+          token = BENCH_NUMBER;
+          number = 0;
+          numbers++;
+        }
+        number = number * 10 + (c - '0');
+        continue;
+      }
+
+      if (token == BENCH_NUMBER) {
+        sum += number;
+      }
+
+      if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') {
+        if (token != BENCH_WORD) {
+          words++;
+        }
+        token = BENCH_WORD;
+        continue;
+      }
+
+      token = BENCH_NONE;
+
+      if (c == '\n') {
+        lines++;
+      } else if (c != ' ' && c != '\t' && c != '\r') {
+        punctuation++;
+      }
+    }
+
+    if (token == BENCH_NUMBER) {
+      sum += number;
+    }
+  }
+
+  printf("%zu bytes, %u passes: %llu numbers (sum %llu), %llu words, %llu lines, %llu other\n",
+         input.size(), passes, numbers, sum, words, lines, punctuation);
+
+  return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef SL2_BENCH_COMMON_H
+#define SL2_BENCH_COMMON_H
+
+// These targets exist to measure the fuzzer's and tracer's overhead, not to be fuzzed
+// into crashing: every one of them reads its whole input with ReadFile (which the wizard and
+// fuzzer target), does a tunable amount of work on it, and prints a checksum of the result. The
+// same input and arguments always do the same work, so runs can be compared across builds.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+/*! How many passes over the input the targets make by default. */
+#define SL2_BENCH_DEFAULT_WORK 1
+
+/**
+ * Reads the whole of a file, in reads of at most `chunk` bytes.
+ * @param path the file's path
+ * @param chunk the most bytes to read at once (0 for the whole file in one read)
+ * @param buf receives the file's contents
+ * @return whether the file could be read
+ */
+static bool bench_read_input(const char *path, DWORD chunk, std::vector<uint8_t> &buf) {
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+  LARGE_INTEGER size;
+
+  if (file == INVALID_HANDLE_VALUE) {
+    fprintf(stderr, "couldn't open %s\n", path);
+    return false;
+  }
+
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    return false;
+  }
+
+  buf.resize((size_t)size.QuadPart);
+
+  size_t offset = 0;
+  while (offset < buf.size()) {
+    DWORD want = (DWORD)std::min(buf.size() - offset, (size_t)(chunk ? chunk : MAXDWORD));
+    DWORD got = 0;
+
+    if (!ReadFile(file, buf.data() + offset, want, &got, NULL) || got == 0) {
+      break;
+    }
+
+    offset += got;
+  }
+
+  CloseHandle(file);
+  buf.resize(offset);
+
+  return true;
+}
+
+/**
+ * @param argc the number of arguments
+ * @param argv the arguments
+ * @param index the argument to parse
+ * @param fallback the value to use if it wasn't given
+ * @return the given argument as a positive integer, or `fallback`
+ */
+static uint32_t bench_arg(int argc, char **argv, int index, uint32_t fallback) {
+  if (index >= argc) {
+    return fallback;
+  }
+
+  uint32_t value = (uint32_t)strtoul(argv[index], NULL, 0);
+  return value ? value : fallback;
+}
+
+/**
+ * Folds a buffer into an FNV-1a hash.
+ * @param hash the hash so far
+ * @param buf the buffer
+ * @param size the size of the buffer
+ * @return the new hash
+ */
+static uint64_t bench_hash(uint64_t hash, const uint8_t *buf, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ buf[i]) * 0x100000001B3;
+  }
+
+  return hash;
+}
+
+#define SL2_BENCH_HASH_INIT 0xCBF29CE484222325
+
+#endif
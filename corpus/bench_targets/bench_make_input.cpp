@@ -0,0 +1,65 @@
+#include "bench_common.h"
+
+// Writes a reproducible input for the other benchmark targets: lines of words, numbers, and
+// punctuation, with a sprinkling of arbitrary bytes. The same size and seed always give the same
+// file, on every machine.
+//
+// Usage: bench_make_input <output> <size> [seed]
+
+/*! The pieces that the input is made of. */
+static const char *BENCH_WORDS[] = {"alpha", "beta", "gamma", "delta", "key", "value", "x", "_id"};
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <output> <size> [seed]\n", argv[0]);
+    return 1;
+  }
+
+  size_t size = (size_t)strtoull(argv[2], NULL, 0);
+  uint64_t x = bench_arg(argc, argv, 3, 1);
+  FILE *out = fopen(argv[1], "wb");
+  std::vector<uint8_t> buf;
+
+  if (!out) {
+    fprintf(stderr, "couldn't open %s\n", argv[1]);
+    return 1;
+  }
+
+  buf.reserve(size);
+
+  while (buf.size() < size) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint32_t pick = (uint32_t)(x >> 33);
+    char piece[32];
+    int len;
+
+    switch (pick % 8) {
+    case 0:
+    case 1:
+    case 2:
+      len = snprintf(piece, sizeof(piece), "%s ", BENCH_WORDS[(pick >> 3) % 8]);
+      break;
+    case 3:
+    case 4:
+      len = snprintf(piece, sizeof(piece), "%u ", (pick >> 3) % 100000);
+      break;
+    case 5:
+      len = snprintf(piece, sizeof(piece), "%c", "=,;:{}[]"[(pick >> 3) % 8]);
+      break;
+    case 6:
+      len = snprintf(piece, sizeof(piece), "\n");
+      break;
+    default:
+      piece[0] = (char)(pick >> 3);
+      len = 1;
+      break;
+    }
+
+    buf.insert(buf.end(), piece, piece + std::min((size_t)len, size - buf.size()));
+  }
+
+  fwrite(buf.data(), 1, buf.size(), out);
+  fclose(out);
+
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include <string.h>
+
+#include "bench_common.h"
+
+// A memcpy-heavy decoder: treats its input as a stream of LZ77-style records, each either a
+// literal run (copied from the input) or a back-reference (copied from the output so far). Most
+// of the time goes into bulk copies, which is the best case for range-based taint propagation.
+//
+// Each record starts with a control byte: its high bit picks a back-reference, and the rest
+// (plus one) is the run's length. Back-references are followed by a 16-bit distance. Records
+// that don't fit are clamped, so any input decodes.
+//
+// Usage: bench_memcpy_decoder <input> [passes]
+
+/*! The most bytes that a single pass decodes, so that a pass's output stays bounded no matter
+ * what the input is. */
+#define BENCH_MAX_OUTPUT (64 * 1024 * 1024)
+
+/**
+ * Decodes the input once.
+ * @param input the input
+ * @param out receives the decoded bytes
+ * @return the number of records decoded
+ */
+static uint64_t decode(const std::vector<uint8_t> &input, std::vector<uint8_t> &out) {
+  uint64_t records = 0;
+  size_t i = 0;
+
+  out.clear();
+
+  while (i < input.size() && out.size() < BENCH_MAX_OUTPUT) {
+    uint8_t control = input[i++];
+    size_t length = (size_t)(control & 0x7F) + 1;
+    size_t start = out.size();
+
+    records++;
+
+    if (control & 0x80 && i + 2 <= input.size() && !out.empty()) {
+      size_t distance = ((size_t)input[i] | ((size_t)input[i + 1] << 8)) % out.size() + 1;
+      i += 2;
+
+      // Overlapping back-references repeat their source, so they're copied in pieces
+      // no longer than the distance.
+      out.resize(start + length);
+      for (size_t copied = 0; copied < length;) {
+        size_t piece = std::min(length - copied, distance);
+        memcpy(out.data() + start + copied, out.data() + start + copied - distance, piece);
+        copied += piece;
+      }
+    } else {
+      length = std::min(length, input.size() - i);
+      out.resize(start + length);
+      memcpy(out.data() + start, input.data() + i, length);
+      i += length;
+    }
+  }
+
+  return records;
+}
+
+int main(int argc, char **argv) {
+  std::vector<uint8_t> input;
+
+  if (argc < 2 || !bench_read_input(argv[1], 0, input)) {
+    fprintf(stderr, "Usage: %s <input> [passes]\n", argv[0]);
+    return 1;
+  }
+
+  uint32_t passes = bench_arg(argc, argv, 2, SL2_BENCH_DEFAULT_WORK);
+  std::vector<uint8_t> out;
+  uint64_t records = 0, hash = SL2_BENCH_HASH_INIT;
+
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    records += decode(input, out);
+  }
+
+  hash = bench_hash(hash, out.data(), out.size());
+
+  printf("%zu bytes, %u passes: %llu records, %zu bytes out, hash %016llx\n", input.size(),
+         passes, records, out.size(), hash);
+
+  return 0;
+}
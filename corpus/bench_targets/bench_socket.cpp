@@ -0,0 +1,278 @@
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+#include "bench_common.h"
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+// A socket throughput benchmark, after corpus/test_application's socket_server and winsock_recv:
+// it listens on loopback, and each of several sender threads connects and streams a fixed number
+// of fixed-size messages to a receiver thread of its own, which reads them with recv and hashes
+// them. Every recv is timed, so that it reports the per-call latency as well as the throughput.
+//
+// Unlike the other targets, it doesn't read a file: its traffic is generated from its arguments.
+// To bound the tax that the recv hooks put on non-targeted traffic, make a targets file that
+// selects a single recv with the wizard, and time the benchmark natively and under the fuzzer
+// (e.g. with sl2-cli --overhead): every other recv goes through wrap_pre_recv and
+// wrap_post_Generic without being mutated.
+//
+// Usage: bench_socket [messages] [size] [connections] [chunk]
+
+/*! The default number of messages per connection, their size, the number of connections, and the
+ * most bytes that each recv asks for (0 for a message's size). */
+#define BENCH_DEFAULT_MESSAGES 10000
+#define BENCH_DEFAULT_SIZE 4096
+#define BENCH_DEFAULT_CONNECTIONS 1
+#define BENCH_DEFAULT_CHUNK 0
+
+/*! The most connections the benchmark makes. */
+#define BENCH_MAX_CONNECTIONS 64
+
+/*! The number of power-of-two buckets in each receiver's latency histogram, in microseconds. */
+#define BENCH_LATENCY_BUCKETS 32
+
+/** What each receiver measured. */
+struct bench_receiver {
+  uint64_t hash;
+  uint64_t bytes;
+  uint64_t calls;
+  uint64_t ticks;
+  uint64_t max_ticks;
+  uint64_t histogram[BENCH_LATENCY_BUCKETS];
+  bool failed;
+};
+
+/*! QueryPerformanceCounter's ticks per second. */
+static LARGE_INTEGER frequency;
+
+/** @return the microseconds that a number of performance counter ticks last for. */
+static double bench_ticks_to_us(uint64_t ticks) {
+  return ticks * 1000000.0 / frequency.QuadPart;
+}
+
+/**
+ * Sends a connection's messages. Each message is filled from its own index, so that the receivers
+ * see the same bytes on every run.
+ * @param port the listening socket's port (in network order)
+ * @param messages the number of messages to send
+ * @param size the size of each message
+ * @return whether every message was sent
+ */
+static bool bench_send(u_short port, uint32_t messages, uint32_t size) {
+  SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  sockaddr_in addr = {0};
+  std::vector<uint8_t> message(size);
+  bool ok = true;
+
+  addr.sin_family = AF_INET;
+  addr.sin_port = port;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (sock == INVALID_SOCKET || connect(sock, (sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR) {
+    fprintf(stderr, "connect failed with error: %d\n", WSAGetLastError());
+    return false;
+  }
+
+  for (uint32_t i = 0; ok && i < messages; i++) {
+    for (uint32_t j = 0; j < size; j++) {
+      message[j] = (uint8_t)(i * 31 + j);
+    }
+
+    for (uint32_t sent = 0; sent < size;) {
+      int got = send(sock, (const char *)message.data() + sent, size - sent, 0);
+
+      if (got == SOCKET_ERROR) {
+        fprintf(stderr, "send failed with error: %d\n", WSAGetLastError());
+        ok = false;
+        break;
+      }
+
+      sent += got;
+    }
+  }
+
+  shutdown(sock, SD_SEND);
+  closesocket(sock);
+
+  return ok;
+}
+
+/**
+ * Receives a connection's messages until its sender shuts it down, timing every recv.
+ * @param sock the connection
+ * @param chunk the most bytes to ask each recv for
+ * @param receiver receives the measurements
+ */
+static void bench_receive(SOCKET sock, uint32_t chunk, bench_receiver *receiver) {
+  std::vector<uint8_t> buf(chunk);
+
+  for (;;) {
+    LARGE_INTEGER before, after;
+
+    QueryPerformanceCounter(&before);
+    int got = recv(sock, (char *)buf.data(), chunk, 0);
+    QueryPerformanceCounter(&after);
+
+    uint64_t ticks = after.QuadPart - before.QuadPart;
+    uint64_t us = (uint64_t)bench_ticks_to_us(ticks);
+    uint32_t bucket = 0;
+
+    while (bucket < BENCH_LATENCY_BUCKETS - 1 && (1ULL << bucket) <= us) {
+      bucket++;
+    }
+
+    receiver->calls++;
+    receiver->ticks += ticks;
+    receiver->max_ticks = std::max(receiver->max_ticks, ticks);
+    receiver->histogram[bucket]++;
+
+    if (got <= 0) {
+      receiver->failed = got < 0;
+      break;
+    }
+
+    receiver->hash = bench_hash(receiver->hash, buf.data(), got);
+    receiver->bytes += got;
+  }
+
+  closesocket(sock);
+}
+
+/**
+ * @param receivers every receiver's measurements
+ * @param fraction the percentile, as a fraction
+ * @return an upper bound on the percentile's recv latency, in microseconds
+ */
+static uint64_t bench_latency_percentile(const std::vector<bench_receiver> &receivers,
+                                         double fraction) {
+  uint64_t calls = 0, seen = 0;
+
+  for (const bench_receiver &receiver : receivers) {
+    calls += receiver.calls;
+  }
+
+  for (uint32_t bucket = 0; bucket < BENCH_LATENCY_BUCKETS; bucket++) {
+    for (const bench_receiver &receiver : receivers) {
+      seen += receiver.histogram[bucket];
+    }
+
+    if (seen >= calls * fraction) {
+      return 1ULL << bucket;
+    }
+  }
+
+  return 1ULL << (BENCH_LATENCY_BUCKETS - 1);
+}
+
+int main(int argc, char **argv) {
+  uint32_t messages = bench_arg(argc, argv, 1, BENCH_DEFAULT_MESSAGES);
+  uint32_t size = bench_arg(argc, argv, 2, BENCH_DEFAULT_SIZE);
+  uint32_t connections = std::min<uint32_t>(bench_arg(argc, argv, 3, BENCH_DEFAULT_CONNECTIONS),
+                                            BENCH_MAX_CONNECTIONS);
+  uint32_t chunk = bench_arg(argc, argv, 4, BENCH_DEFAULT_CHUNK);
+  WSADATA wsa_data;
+
+  if (!chunk) {
+    chunk = size;
+  }
+
+  if (WSAStartup(MAKEWORD(2, 2), &wsa_data)) {
+    fprintf(stderr, "WSAStartup failed\n");
+    return 1;
+  }
+
+  QueryPerformanceFrequency(&frequency);
+
+  // Listen on an ephemeral loopback port, so that simultaneous runs don't collide.
+  SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  sockaddr_in addr = {0};
+  int addr_len = sizeof(addr);
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (listener == INVALID_SOCKET || bind(listener, (sockaddr *)&addr, sizeof(addr)) ||
+      listen(listener, SOMAXCONN) || getsockname(listener, (sockaddr *)&addr, &addr_len)) {
+    fprintf(stderr, "couldn't listen, error: %d\n", WSAGetLastError());
+    WSACleanup();
+    return 1;
+  }
+
+  std::vector<bench_receiver> receivers(connections);
+  std::vector<std::thread> senders, threads;
+  std::atomic<bool> sent(true);
+  LARGE_INTEGER started, finished;
+
+  for (bench_receiver &receiver : receivers) {
+    memset(&receiver, 0, sizeof(receiver));
+    receiver.hash = SL2_BENCH_HASH_INIT;
+  }
+
+  QueryPerformanceCounter(&started);
+
+  for (uint32_t c = 0; c < connections; c++) {
+    senders.emplace_back([&] {
+      if (!bench_send(addr.sin_port, messages, size)) {
+        sent = false;
+      }
+    });
+  }
+
+  for (uint32_t c = 0; c < connections; c++) {
+    SOCKET sock = accept(listener, NULL, NULL);
+
+    if (sock == INVALID_SOCKET) {
+      fprintf(stderr, "accept failed with error: %d\n", WSAGetLastError());
+      receivers[c].failed = true;
+      continue;
+    }
+
+    threads.emplace_back(bench_receive, sock, chunk, &receivers[c]);
+  }
+
+  for (std::thread &thread : senders) {
+    thread.join();
+  }
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  QueryPerformanceCounter(&finished);
+  closesocket(listener);
+  WSACleanup();
+
+  uint64_t hash = SL2_BENCH_HASH_INIT, bytes = 0, calls = 0, ticks = 0, max_ticks = 0;
+  bool failed = !sent;
+
+  // The connections are accepted in whatever order they arrive in, so their hashes are
+  // summed, which doesn't depend on it.
+  for (const bench_receiver &receiver : receivers) {
+    hash += receiver.hash;
+    bytes += receiver.bytes;
+    calls += receiver.calls;
+    ticks += receiver.ticks;
+    max_ticks = std::max(max_ticks, receiver.max_ticks);
+    failed = failed || receiver.failed;
+  }
+
+  double seconds = bench_ticks_to_us(finished.QuadPart - started.QuadPart) / 1000000;
+
+  printf("%llu bytes in %u-byte messages over %u connections, %u-byte reads: hash %016llx\n",
+         bytes, size, connections, chunk, hash);
+  printf("%.3f s, %.1f MB/s, %llu recv calls: mean %.2f us, p50 <= %llu us, p99 <= %llu us, "
+         "max %.1f us\n",
+         seconds, seconds > 0 ? bytes / seconds / (1024 * 1024) : 0, calls,
+         calls ? bench_ticks_to_us(ticks) / calls : 0, bench_latency_percentile(receivers, 0.5),
+         bench_latency_percentile(receivers, 0.99), bench_ticks_to_us(max_ticks));
+
+  if (failed || bytes != (uint64_t)messages * size * connections) {
+    fprintf(stderr, "expected %llu bytes\n", (uint64_t)messages * size * connections);
+    return 1;
+  }
+
+  return 0;
+}
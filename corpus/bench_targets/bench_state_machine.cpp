@@ -0,0 +1,63 @@
+#include "bench_common.h"
+
+// A table-driven state machine: runs its input through a DFA whose transition table is indexed
+// by the current state and input byte, the way generated lexers and protocol decoders do. Every
+// step is a load whose address depends on the input, which is what pointer taint has to track.
+//
+// Usage: bench_state_machine <input> [passes] [states]
+
+/*! The most states the DFA can have. */
+#define BENCH_MAX_STATES 4096
+
+/*! The DFA's default number of states. */
+#define BENCH_DEFAULT_STATES 64
+
+/**
+ * Builds a pseudo-random (but fixed) transition table.
+ * @param states the number of states
+ * @param table receives `states` rows of 256 transitions
+ */
+static void build_table(uint32_t states, std::vector<uint16_t> &table) {
+  uint64_t x = 0x5EED;
+
+  table.resize((size_t)states * 256);
+
+  for (uint16_t &next : table) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    next = (uint16_t)((x >> 33) % states);
+  }
+}
+
+int main(int argc, char **argv) {
+  std::vector<uint8_t> input;
+
+  if (argc < 2 || !bench_read_input(argv[1], 0, input)) {
+    fprintf(stderr, "Usage: %s <input> [passes] [states]\n", argv[0]);
+    return 1;
+  }
+
+  uint32_t passes = bench_arg(argc, argv, 2, SL2_BENCH_DEFAULT_WORK);
+  uint32_t states =
+      std::min<uint32_t>(bench_arg(argc, argv, 3, BENCH_DEFAULT_STATES), BENCH_MAX_STATES);
+  std::vector<uint16_t> table;
+  uint64_t accepted = 0;
+  uint16_t state = 0;
+
+  build_table(states, table);
+
+  // A quarter of the states accept, so that the branch on them isn't predictable.
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    for (size_t i = 0; i < input.size(); i++) {
+      state = table[(size_t)state * 256 + input[i]];
+
+      if (state % 4 == 0) {
+        accepted++;
+      }
+    }
+  }
+
+  printf("%zu bytes, %u passes, %u states: %llu accepting steps, final state %u\n", input.size(),
+         passes, states, accepted, state);
+
+  return 0;
+}
@@ -0,0 +1,66 @@
+#include <thread>
+
+#include "bench_common.h"
+
+// A multithreaded reader: several threads each read the whole input for themselves, in small
+// chunks, and hash it. That exercises the instrumentation's per-thread state and the targeted
+// call bookkeeping that the fuzzer and tracer share between threads.
+//
+// Usage: bench_threaded_reader <input> [passes] [threads] [chunk]
+
+/*! The reader's default number of threads and chunk size (in bytes). */
+#define BENCH_DEFAULT_THREADS 4
+#define BENCH_DEFAULT_CHUNK 4096
+
+/*! The most threads the reader starts. */
+#define BENCH_MAX_THREADS 64
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <input> [passes] [threads] [chunk]\n", argv[0]);
+    return 1;
+  }
+
+  uint32_t passes = bench_arg(argc, argv, 2, SL2_BENCH_DEFAULT_WORK);
+  uint32_t nthreads =
+      std::min<uint32_t>(bench_arg(argc, argv, 3, BENCH_DEFAULT_THREADS), BENCH_MAX_THREADS);
+  uint32_t chunk = bench_arg(argc, argv, 4, BENCH_DEFAULT_CHUNK);
+  std::vector<uint64_t> hashes(nthreads, SL2_BENCH_HASH_INIT);
+  std::vector<size_t> sizes(nthreads, 0);
+  std::vector<std::thread> threads;
+
+  for (uint32_t t = 0; t < nthreads; t++) {
+    threads.emplace_back([&, t] {
+      std::vector<uint8_t> input;
+
+      if (!bench_read_input(argv[1], chunk, input)) {
+        return;
+      }
+
+      for (uint32_t pass = 0; pass < passes; pass++) {
+        hashes[t] = bench_hash(hashes[t], input.data(), input.size());
+      }
+
+      sizes[t] = input.size();
+    });
+  }
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  uint64_t hash = SL2_BENCH_HASH_INIT;
+  for (uint32_t t = 0; t < nthreads; t++) {
+    if (sizes[t] != sizes[0]) {
+      fprintf(stderr, "thread %u read %zu bytes, not %zu\n", t, sizes[t], sizes[0]);
+      return 1;
+    }
+
+    hash ^= hashes[t];
+  }
+
+  printf("%zu bytes, %u passes, %u threads, %u-byte reads: hash %016llx\n", sizes[0], passes,
+         nthreads, chunk, hash);
+
+  return 0;
+}
@@ -1,17 +1,115 @@
 #include <map>
+#include <new>
 #include <array>
+#include <algorithm>
+#include <set>
+#include <vector>
 
 #include "common/sl2_dr_client.hpp"
 #include "common/sl2_dr_client_options.hpp"
 #include "vendor/picosha2.h"
 #include "common/mutation.hpp"
 #include "common/sl2_server_api.hpp"
+#include "common/sl2_mutator.hpp"
 
 // NOTE(ww): 1024 seems like a reasonable default here -- most programs won't have
 // more than 1024 modules, and those that do will probably have loaded the ones
 // we want to do coverage for anyways.
 #define SL2_MAX_MODULES 1024
 
+/*! The most arguments we'll snapshot and restore for a persistent target function */
+#define SL2_PERSIST_MAX_ARGS 8
+
+/*! The most threads that can loop a persistent target at once (see -persist_threads) */
+#define SL2_PERSIST_MAX_THREADS 64
+
+/*! The most arguments that the target of -persist_threads can take. A worker thread's target is
+ * its thread's start routine, so only its register arguments (or on 32-bit, its one stack
+ * argument) have room to be restored */
+#ifdef X64
+#define SL2_PERSIST_THREAD_MAX_ARGS 4
+#else
+#define SL2_PERSIST_THREAD_MAX_ARGS 1
+#endif
+
+/*! The most targeted reads per iteration that a looping thread keeps copies of, so that a
+ * crashing iteration can be registered again (see reregister_crash) */
+#define SL2_PERSIST_LOG_READS 8
+
+/*! The most candidates we ask a mutator plugin for at once */
+#define SL2_MUTATOR_BATCH 16
+
+/*! The most targeted reads per run that we keep a mutator plugin's candidates for */
+#define SL2_MUTATOR_MAX_READS 8
+
+/*! The exit status for runs that we end early because every selected target has been consumed.
+ * Keep this up-to-date with sl2/harness/instrument.py! */
+#define SL2_EXIT_TARGETS_CONSUMED 0x512
+
+/*! The exit status for runs that the watchdog ends because they hung (see -hang_ms).
+ * Keep this up-to-date with sl2/harness/instrument.py! */
+#define SL2_EXIT_HUNG 0x513
+
+/*! How often the watchdog checks whether the target has stopped making progress */
+#define SL2_WATCHDOG_POLL_MS 10
+
+/*! How many return addresses a crash's stack hash covers, and how many stack slots we scan for
+ * them */
+#define SL2_CRASH_STACK_FRAMES 4
+#define SL2_CRASH_STACK_SLOTS 512
+
+/*! The size of the pages that -guard_heap lays its allocations out in */
+#define SL2_GUARD_PAGE_SIZE 0x1000
+
+/*! The alignment of -guard_heap allocations: the same as the Windows heap's on x64 */
+#define SL2_GUARD_ALIGN 16
+
+/*! RtlReAllocateHeap's HEAP_REALLOC_IN_PLACE_ONLY flag */
+#define SL2_HEAP_REALLOC_IN_PLACE_ONLY 0x10
+
+/*! How often the early exit thread checks whether its time budget has run out */
+#define SL2_EARLY_EXIT_POLL_MS 10
+
+/*! The basic block countdown's value while we're not armed to exit early */
+#define SL2_EARLY_EXIT_IDLE_BBS 0x7FFFFFFF
+
+/*! How many drcov basic block records we buffer before writing them to the spool file */
+#define SL2_DRCOV_BUFFER_ENTRIES 4096
+
+/*! The longest string that -cmplog reads out of a strcmp()-like call's arguments */
+#define SL2_CMPLOG_MAX_STRING SL2_CMPLOG_MAX_OPERAND
+
+/*! How many handles to the -virtual_file can be open at once */
+#define SL2_VIRTUAL_FILE_MAX_HANDLES 64
+
+/*! The magic and version of -peer_script response scripts: "SL2P" */
+#define SL2_PEER_MAGIC "SL2P"
+#define SL2_PEER_VERSION 1
+
+/*! The most responses that a -peer_script can hold */
+#define SL2_PEER_MAX_RESPONSES 256
+
+/*! How many connections to the -emulate_peer can be open at once */
+#define SL2_PEER_MAX_CONNS 64
+
+/*! A -peer_script response's flag for responses that the peer sends without waiting for a send
+ * (e.g. a banner) */
+#define SL2_PEER_UNPROMPTED 0x1
+
+/*! The magic and version of -directed target tables: "SL2D" */
+#define SL2_DIRECTED_MAGIC "SL2D"
+#define SL2_DIRECTED_VERSION 1
+
+/*! The most targets that a -directed table can hold, and the most modules that they can be in */
+#define SL2_DIRECTED_MAX_TARGETS 4096
+#define SL2_DIRECTED_MAX_MODULES 16
+
+/*! The length of a -directed target's module name, including its NUL padding */
+#define SL2_DIRECTED_MODULE_LEN 64
+
+/*! The biggest -park_args file that we'll read a run's client arguments from */
+#define SL2_PARK_MAX_ARGS_SIZE 0x10000
+
 static droption_t<bool> op_no_coverage(DROPTION_SCOPE_CLIENT, "n", false, "nocoverage",
                                        "disable coverage, even when possible");
 
@@ -21,8 +119,313 @@ static droption_t<std::string> op_run_id(DROPTION_SCOPE_CLIENT, "r", "", "run_id
 static droption_t<std::string> op_arena_id(DROPTION_SCOPE_CLIENT, "a", "", "arena_id",
                                            "specify the arena ID for coverage guidance");
 
-// TODO(ww): Add options here for edge/bb coverage,
-// if we decided to support edge as well.
+static droption_t<std::string> op_persist_module(
+    DROPTION_SCOPE_CLIENT, "persist_module", "", "module containing the persistent target",
+    "run the function at -persist_offset in this module in a loop, instead of once per process");
+
+static droption_t<std::string> op_persist_offset(DROPTION_SCOPE_CLIENT, "persist_offset", "0",
+                                                 "offset of the persistent target",
+                                                 "offset (from the module base) of the function "
+                                                 "to loop in persistent mode");
+
+static droption_t<unsigned int> op_persist_iterations(DROPTION_SCOPE_CLIENT, "persist_iterations",
+                                                      100, "persistent iterations",
+                                                      "how many times to run the persistent "
+                                                      "target per process");
+
+static droption_t<unsigned int> op_persist_nargs(DROPTION_SCOPE_CLIENT, "persist_nargs", 4,
+                                                 "persistent target arguments",
+                                                 "how many arguments the persistent target takes");
+
+static droption_t<unsigned int> op_persist_threads(
+    DROPTION_SCOPE_CLIENT, "persist_threads", 1, "persistent threads",
+    "how many threads loop the persistent target at once, each with its own mutations, coverage "
+    "and connection to the server. The target must be thread-safe, and the arguments that it was "
+    "first called with must be safe to share between threads");
+
+static droption_t<bool> op_edge_coverage(DROPTION_SCOPE_CLIENT, "edge", false, "edge coverage",
+                                          "record AFL-style edge coverage instead of block "
+                                          "coverage. Don't mix modes on the same arena");
+
+static droption_t<unsigned int> op_map_size(DROPTION_SCOPE_CLIENT, "map_size", FUZZ_ARENA_SIZE,
+                                            "coverage map size",
+                                            "the size in bytes of the target's coverage map: a "
+                                            "power of two from 64KB to 8MB. Bigger maps have "
+                                            "fewer collisions on big targets. Only used when the "
+                                            "server creates the target's arena; an existing arena "
+                                            "keeps its size");
+
+static droption_t<bool> op_never_zero(DROPTION_SCOPE_CLIENT, "never_zero", false,
+                                      "never-zero counters",
+                                      "skip 0 when a coverage counter wraps, so that hot blocks "
+                                      "never look unvisited");
+
+static droption_t<bool> op_hit_once(DROPTION_SCOPE_CLIENT, "hit_once", false,
+                                    "hit-once block coverage",
+                                    "record whether each block ran rather than how often: "
+                                    "blocks are recorded when DR builds them, so they run with "
+                                    "no coverage instrumentation at all. Can't be used with "
+                                    "-edge. In persistent and snapshot modes, the code cache is "
+                                    "flushed between iterations so that each one's blocks get "
+                                    "recorded again");
+
+static droption_t<bool> op_raw_counts(DROPTION_SCOPE_CLIENT, "raw_counts", true,
+                                      "send raw hit counts",
+                                      "send the server the coverage map's raw hit counts. With "
+                                      "-no_raw_counts, each count is classified into its bucket "
+                                      "first (see SL2_BUCKET_FLOOR), so that more runs retrace "
+                                      "known paths, but the server's merged map then sums bucket "
+                                      "floors instead of hits, which changes its scores. Every "
+                                      "fuzzer of an arena should agree on this");
+
+static droption_t<bool> op_defer_coverage(DROPTION_SCOPE_CLIENT, "defer_coverage", false,
+                                          "defer coverage until the first mutation",
+                                          "don't instrument blocks for coverage until the first "
+                                          "mutation, and then flush the code cache, so that "
+                                          "startup runs uninstrumented and doesn't show up in "
+                                          "the coverage map");
+
+static droption_t<std::string> op_coverage_allow(DROPTION_SCOPE_CLIENT, "coverage_allow", "",
+                                                 "modules to measure coverage for",
+                                                 "semicolon-separated list of module names. "
+                                                 "When given, only these modules are instrumented");
+
+static droption_t<std::string> op_coverage_deny(DROPTION_SCOPE_CLIENT, "coverage_deny", "",
+                                                "modules to skip coverage for",
+                                                "semicolon-separated list of module names that "
+                                                "are never instrumented");
+
+static droption_t<bool> op_snapshot(DROPTION_SCOPE_CLIENT, "snapshot", false, "snapshot mode",
+                                    "snapshot the process at the first targeted read, and "
+                                    "restore it (with a new mutation) instead of exiting");
+
+static droption_t<unsigned int> op_snapshot_iterations(DROPTION_SCOPE_CLIENT,
+                                                       "snapshot_iterations", 100,
+                                                       "snapshot iterations",
+                                                       "how many times to resume from the "
+                                                       "snapshot per process");
+
+static droption_t<unsigned int> op_exit_after_bbs(DROPTION_SCOPE_CLIENT, "exit_after_bbs", 0,
+                                                  "blocks to run after the last target",
+                                                  "once every selected target has been mutated, "
+                                                  "exit after this many more basic blocks "
+                                                  "(0 disables)");
+
+static droption_t<unsigned int> op_exit_after_ms(DROPTION_SCOPE_CLIENT, "exit_after_ms", 0,
+                                                 "time to run after the last target",
+                                                 "once every selected target has been mutated, "
+                                                 "exit after this many more milliseconds "
+                                                 "(0 disables)");
+
+static droption_t<unsigned int> op_hang_ms(DROPTION_SCOPE_CLIENT, "hang_ms", 0,
+                                           "no-progress time before a hang",
+                                           "once the first mutation is made, treat the run as "
+                                           "hung (EXCEPTION_SL2_TIMEOUT) and exit, keeping its "
+                                           "coverage, if it goes this many milliseconds without "
+                                           "reaching new code or calling a hooked function "
+                                           "(0 disables)");
+
+static droption_t<std::string> op_drcov(DROPTION_SCOPE_CLIENT, "drcov", "", "drcov output file",
+                                        "write the exact basic block coverage of this run to "
+                                        "the given file, in drcov format");
+
+static droption_t<std::string> op_seed(DROPTION_SCOPE_CLIENT, "seed", "", "mutation seed",
+                                       "seed the mutation engine with this string, so that a run "
+                                       "can be reproduced exactly (default: random)");
+
+static droption_t<std::string> op_dictionary(DROPTION_SCOPE_CLIENT, "dictionary", "",
+                                             "token dictionary",
+                                             "map this token dictionary (as built by the harness) "
+                                             "for the dictionary mutation strategies");
+
+static droption_t<std::string> op_fixups(DROPTION_SCOPE_CLIENT, "fixups", "", "fixup table",
+                                         "map this fixup table (as built by the harness) and "
+                                         "recompute its checksum and length fields after every "
+                                         "mutation");
+
+static droption_t<std::string> op_cmplog(DROPTION_SCOPE_CLIENT, "cmplog", "", "cmplog output file",
+                                         "log the operands of the comparisons (cmp/test/sub and "
+                                         "memcmp()/strcmp() calls) in the selected modules, and "
+                                         "write them to the given file at exit");
+
+static droption_t<std::string> op_cmplog_table(DROPTION_SCOPE_CLIENT, "cmplog_table", "",
+                                               "comparison log",
+                                               "map this comparison log (as merged by the "
+                                               "harness) for input-to-state substitution");
+
+static droption_t<bool> op_guard_heap(DROPTION_SCOPE_CLIENT, "guard_heap", false,
+                                      "guard-page heap",
+                                      "place sampled heap allocations right before an "
+                                      "inaccessible page, and make them inaccessible once freed, "
+                                      "so that overflows and uses after free fault right away. "
+                                      "The tracer doesn't, so its replays of the crashes that "
+                                      "this finds may not crash");
+
+static droption_t<unsigned int> op_guard_heap_min(DROPTION_SCOPE_CLIENT, "guard_heap_min", 1,
+                                                  "smallest guarded allocation",
+                                                  "the smallest allocation that -guard_heap "
+                                                  "guards, in bytes");
+
+static droption_t<unsigned int> op_guard_heap_max(DROPTION_SCOPE_CLIENT, "guard_heap_max",
+                                                  0x10000, "largest guarded allocation",
+                                                  "the largest allocation that -guard_heap "
+                                                  "guards, in bytes");
+
+static droption_t<unsigned int> op_guard_heap_sample(DROPTION_SCOPE_CLIENT, "guard_heap_sample",
+                                                     1, "guarded allocation sampling",
+                                                     "guard every Nth allocation in the size "
+                                                     "range, rather than all of them");
+
+static droption_t<unsigned int> op_guard_heap_mb(DROPTION_SCOPE_CLIENT, "guard_heap_mb", 65536,
+                                                 "guarded address space",
+                                                 "the address space (in MiB) that -guard_heap "
+                                                 "reserves for its allocations. Freed allocations "
+                                                 "keep theirs, so once it's used up, allocations "
+                                                 "come from the real heap again");
+
+static droption_t<unsigned int> op_mutation_window(DROPTION_SCOPE_CLIENT, "mutation_window", 0,
+                                                   "mutation window",
+                                                   "only mutate (and register) this many bytes of "
+                                                   "targeted reads that are bigger than it, e.g. "
+                                                   "whole mapped files (0 disables)");
+
+static droption_t<int> op_mutation_window_at(DROPTION_SCOPE_CLIENT, "mutation_window_at", -1,
+                                             "mutation window offset",
+                                             "where -mutation_window's window starts in each "
+                                             "read (e.g. an interesting region that the wizard "
+                                             "or the tracer's labels found), or -1 to pick it at "
+                                             "random for each read");
+
+static droption_t<bool> op_havoc(DROPTION_SCOPE_CLIENT, "havoc", false, "stacked mutations",
+                                 "apply a random-length stack of strategies to each targeted "
+                                 "call, instead of a single strategy");
+
+static droption_t<unsigned int> op_havoc_stack(DROPTION_SCOPE_CLIENT, "havoc_stack", 8,
+                                               "maximum havoc stack",
+                                               "the maximum number of strategies that -havoc "
+                                               "stacks onto a single targeted call");
+
+static droption_t<bool> op_ring(DROPTION_SCOPE_CLIENT, "ring", false, "server-side mutations",
+                                "take mutations from the rings that the server pre-generates for "
+                                "each targeted read, instead of mutating in-process (requires "
+                                "coverage; ignored with -havoc)");
+
+static droption_t<bool> op_async(DROPTION_SCOPE_CLIENT, "async", false,
+                                 "asynchronous registration",
+                                 "register mutations with the server without waiting for its "
+                                 "response (the server only logs registration errors)");
+
+static droption_t<bool> op_deterministic(DROPTION_SCOPE_CLIENT, "deterministic", false,
+                                         "deterministic stages",
+                                         "walk the server's deterministic stages (bit flips, "
+                                         "arithmetic, interesting values) over the first "
+                                         "targeted read before mutating it randomly (requires "
+                                         "coverage)");
+
+static droption_t<unsigned int> op_splice(DROPTION_SCOPE_CLIENT, "splice", 0, "splice rate",
+                                          "splice an input from the server's corpus into 1 in "
+                                          "every N targeted reads (0 disables; requires "
+                                          "coverage)");
+
+static droption_t<unsigned int> op_seeds(DROPTION_SCOPE_CLIENT, "seeds", 0, "seed rate",
+                                         "replace 1 in every N targeted reads with a seed from "
+                                         "the server's corpus before mutating it (0 disables; "
+                                         "requires coverage)");
+
+static droption_t<std::string> op_replay_inputs(DROPTION_SCOPE_CLIENT, "replay_inputs", "",
+                                                "replay inputs directory",
+                                                "replay mode: give each targeted read N the input "
+                                                "in N.bin under this directory, if there is one, "
+                                                "instead of mutating it");
+
+static droption_t<std::string> op_replay_run(DROPTION_SCOPE_CLIENT, "replay_run", "",
+                                             "run to replay",
+                                             "replay mode: give the targeted reads that aren't in "
+                                             "-replay_inputs the mutations that this run made to "
+                                             "them (requires -replay_count)");
+
+static droption_t<unsigned int> op_replay_count(DROPTION_SCOPE_CLIENT, "replay_count", 0,
+                                                "number of mutations to replay",
+                                                "the number of mutations that -replay_run made; "
+                                                "later targeted reads are left as-is");
+
+static droption_t<std::string> op_replay_outputs(DROPTION_SCOPE_CLIENT, "replay_outputs", "",
+                                                 "replay outputs directory",
+                                                 "replay mode: write the bytes that each targeted "
+                                                 "read N ended up with to N.bin under this "
+                                                 "directory");
+
+static droption_t<bool> op_replay_register(DROPTION_SCOPE_CLIENT, "replay_register", false,
+                                           "register replayed reads",
+                                           "replay mode: register each targeted read with the "
+                                           "server, and dump crashes, as a fuzzing run would. "
+                                           "Otherwise, replays leave the server out of it");
+
+static droption_t<std::string> op_focus_run(DROPTION_SCOPE_CLIENT, "focus_run", "",
+                                             "crashing run to focus on",
+                                             "crash focus: start each targeted read from the "
+                                             "mutation that this (crashing) run made to it, and "
+                                             "only nudge it with a single small strategy "
+                                             "(requires -focus_count)");
+
+static droption_t<unsigned int> op_focus_count(DROPTION_SCOPE_CLIENT, "focus_count", 0,
+                                               "number of mutations to focus on",
+                                               "the number of mutations that -focus_run made; "
+                                               "later targeted reads are mutated as usual");
+
+static droption_t<std::string> op_arena_out(DROPTION_SCOPE_CLIENT, "arena_out", "",
+                                            "arena output file",
+                                            "write the run's coverage map to the given file "
+                                            "instead of returning it to the server (requires "
+                                            "coverage)");
+
+static droption_t<std::string> op_mutator(DROPTION_SCOPE_CLIENT, "mutator", "",
+                                          "custom mutator plugin",
+                                          "load this mutator plugin (a DLL exporting "
+                                          "sl2_mutator_init, sl2_mutator_mutate and "
+                                          "sl2_mutator_teardown) and let it mutate targeted reads");
+
+static droption_t<std::string> op_mutator_options(DROPTION_SCOPE_CLIENT, "mutator_options", "",
+                                                  "mutator plugin options",
+                                                  "an option string to pass to the -mutator "
+                                                  "plugin's sl2_mutator_init");
+
+static droption_t<std::string> op_virtual_file(DROPTION_SCOPE_CLIENT, "virtual_file", "",
+                                               "input file to serve from memory",
+                                               "read this file into memory once, and serve the "
+                                               "target's reads of it from there instead of "
+                                               "opening it on every run (can't be used with "
+                                               "-snapshot)");
+
+static droption_t<std::string> op_emulate_peer(DROPTION_SCOPE_CLIENT, "emulate_peer", "",
+                                               "endpoint to emulate",
+                                               "answer the target's connections to this endpoint "
+                                               "(IPv4-address:port for sockets, host:port for "
+                                               "WinHTTP) from the -peer_script, without touching "
+                                               "the network");
+
+static droption_t<std::string> op_peer_script(DROPTION_SCOPE_CLIENT, "peer_script", "",
+                                              "scripted peer responses",
+                                              "map this response script (as built by the "
+                                              "harness) for -emulate_peer");
+
+static droption_t<std::string> op_directed(DROPTION_SCOPE_CLIENT, "directed", "",
+                                           "directed target table",
+                                           "map this table of module offsets (as built by the "
+                                           "harness), and report how close each run's blocks "
+                                           "came to them, so that the server favors the seeds "
+                                           "and strategies that get closer");
+
+static droption_t<std::string> op_park(DROPTION_SCOPE_CLIENT, "park", "", "park until activated",
+                                       "wait for this named event before doing anything else, "
+                                       "then take the run's client arguments from -park_args, "
+                                       "so that the harness can start the target ahead of the "
+                                       "run that it's for");
+
+static droption_t<std::string> op_park_args(DROPTION_SCOPE_CLIENT, "park_args", "",
+                                            "parked run's client arguments",
+                                            "read the client arguments of the run that -park "
+                                            "activates from this file, one per line");
 
 // TODO(ww): These should all go in one class/struct, probably a "Fuzzer" subclass
 // of SL2Client.
@@ -32,208 +435,5168 @@ static sl2_exception_ctx fuzz_exception_ctx;
 static bool crashed = false;
 static bool exiting = false;
 static uint32_t mut_count = 0;
-/*! Blank arena that tracks our path for this single run. Gets sent to the server and merged with
- * old arenas*/
-static sl2_arena arena = {0};
+/*! Blank arena that tracks our path for this single run, used when the server can't share one with
+ * us. Gets sent to the server and merged with old arenas. Its map is allocated once the server
+ * tells us how big it is */
+static sl2_arena local_arena = {0};
+/*! The arena we record coverage into: either a section shared with the server, or local_arena */
+static sl2_arena *arena = &local_arena;
 static bool coverage_guided = false;
-/*! Map of the modules we've ssen so far (so we can find the base addresses) */
-static std::array<module_data_t *, SL2_MAX_MODULES> seen_modules;
+/*! Whether blocks get coverage instrumentation yet (see -defer_coverage and arm_coverage) */
+static volatile bool coverage_armed = true;
+/*! The address range covered by a module we're measuring coverage for */
+struct sl2_module_range {
+  app_pc start;
+  app_pc end;
+  /*! The module's index in drcov_modules */
+  uint16_t id;
+};
+
+/*! The modules we're measuring coverage for, sorted by start address (so we can find the base
+ * addresses with a binary search) */
+static std::array<sl2_module_range, SL2_MAX_MODULES> seen_modules;
 static uint32_t nmodules = 0;
+/*! Guards seen_modules, since modules can (un)load while other threads are building blocks */
+static void *modules_lock = NULL;
+/*! A module, as it appears in drcov's module table */
+struct sl2_drcov_module {
+  app_pc start;
+  app_pc end;
+  std::string path;
+};
+
+/*! A basic block, as it appears in drcov's (binary) basic block table */
+struct sl2_drcov_bb {
+  /*! The block's offset from the start of its module */
+  uint32_t start;
+  uint16_t size;
+  uint16_t mod_id;
+};
+
+/*! Every module we've ever measured coverage for, in load order. Guarded by modules_lock */
+static std::vector<sl2_drcov_module> drcov_modules;
+/*! Basic block records that haven't been written to the spool file yet */
+static sl2_drcov_bb drcov_buffer[SL2_DRCOV_BUFFER_ENTRIES];
+static uint32_t drcov_buffered = 0;
+static uint64_t drcov_count = 0;
+/*! Holds the basic block table until we know how many blocks (and modules) there are */
+static file_t drcov_spool = INVALID_FILE;
+static std::string drcov_spool_path;
+/*! Guards the drcov buffer and spool */
+static void *drcov_lock = NULL;
+/*! Module names from -coverage_allow and -coverage_deny */
+static std::vector<std::string> coverage_allow;
+static std::vector<std::string> coverage_deny;
+/*! The raw TLS slot holding each thread's previous block location, for edge coverage */
+static reg_id_t prev_loc_seg;
+static uint prev_loc_offs;
+/*! Maps each counter value to its next value, for updating counters without touching flags */
+static uint8_t next_count[256];
+/*! Maps each counter value to its bucket's smallest value (see SL2_BUCKET_FLOOR) */
+static uint8_t bucket_floor[256];
+#ifndef X64
+/*! Registers with 8-bit forms, which flags-free counter updates need */
+static drvector_t byte_regs;
+#endif
+/*! The drmgr TLS field holding each thread's private coverage map */
+static int thread_map_idx = -1;
+/*! Every live thread's coverage map, so that on_dr_exit can merge the ones that never exited */
+static std::vector<uint8_t *> thread_maps;
+/*! The size of each thread's coverage map: the arena's, plus room for edge indices to run past it
+ * (see on_bb_instrument) */
+static size_t thread_map_size = 0;
+/*! Guards thread_maps and merges into the global arena */
+static void *thread_maps_lock = NULL;
+
+/*! The drmgr TLS field holding each thread's mutation engine PRNG */
+static int thread_rng_idx = -1;
+/*! The seed that every thread's PRNG is derived from */
+static char rng_seed[64];
+/*! The number of PRNGs handed out so far, so that each thread gets its own stream */
+static int rng_streams = 0;
+
+/*! The token dictionary that the dictionary strategies draw from, if one was given */
+static sl2_dictionary dictionary;
+/*! The dictionary file's mapped view */
+static void *dictionary_view = NULL;
+static size_t dictionary_view_size = 0;
+
+/*! The checksum and length fields that are recomputed after every mutation, if -fixups was given */
+static sl2_fixups fixups;
+/*! The fixup file's mapped view */
+static void *fixups_view = NULL;
+static size_t fixups_view_size = 0;
+
+/*! The comparisons that -cmplog has logged so far, in the order that they were first seen */
+static std::vector<sl2_cmplog_entry> cmplog_entries;
+/*! Hashes of the logged comparisons, so that each is only logged once */
+static std::set<uint64_t> cmplog_seen;
+/*! Guards cmplog_entries and cmplog_seen. NULL unless -cmplog was given */
+static void *cmplog_lock = NULL;
+
+typedef std::map<app_pc, size_t, std::less<app_pc>,
+                 sl2_region_allocator<std::pair<const app_pc, size_t>>>
+    sl2_guard_allocs_map;
+
+/*! The address space that -guard_heap carves its allocations out of, and the next unused part */
+static app_pc guard_pool = NULL;
+static app_pc guard_pool_next = NULL;
+static app_pc guard_pool_end = NULL;
+/*! Every live guarded allocation's size, by the pointer that the target got */
+static sl2_guard_allocs_map guard_allocs;
+/*! How many allocations in -guard_heap's size range we've seen, for sampling */
+static volatile LONG64 guard_candidates = 0;
+/*! Guards guard_pool_next and guard_allocs. NULL unless -guard_heap was given */
+static void *guard_heap_lock = NULL;
+
+/*! An open handle to the -virtual_file. The handle that the target gets is its address */
+struct sl2_virtual_handle {
+  bool open;
+  /*! The file pointer */
+  uint64_t position;
+};
+
+/*! The -virtual_file's full path, as the target asks for it, and as targets see it */
+static wchar_t virtual_file_path[MAX_PATH + 1];
+static wchar_t virtual_file_final_path[MAX_PATH + 1];
+/*! The -virtual_file's contents */
+static uint8_t *virtual_file_data = NULL;
+static size_t virtual_file_size = 0;
+static sl2_virtual_handle virtual_handles[SL2_VIRTUAL_FILE_MAX_HANDLES];
+/*! Guards virtual_handles. NULL unless -virtual_file was given (and could be read) */
+static void *virtual_file_lock = NULL;
+
+/*! A -directed target in the table, as the harness writes it */
+struct sl2_directed_target {
+  /*! The module's name, NUL-padded */
+  char module[SL2_DIRECTED_MODULE_LEN];
+  /*! The target's offset in the module */
+  uint32_t offset;
+};
+
+/*! A module that holds -directed targets */
+struct sl2_directed_module {
+  const char *name;
+  /*! Where the module is loaded, or NULL while it isn't */
+  app_pc start;
+  app_pc end;
+  /*! The module's targets' offsets, sorted */
+  std::vector<uint32_t> offsets;
+};
+
+static void *directed_view = NULL;
+static size_t directed_view_size = 0;
+static sl2_directed_module directed_modules[SL2_DIRECTED_MAX_MODULES];
+static uint32_t directed_module_count = 0;
+/*! The total distance of the blocks that the run has hit in the directed modules, in log2 buckets,
+ * and how many of them there were (see note_directed_block) */
+static volatile LONG64 directed_distance_total = 0;
+static volatile LONG64 directed_blocks = 0;
+
+/*! A response in the -peer_script */
+struct sl2_peer_response {
+  uint32_t flags;
+  uint32_t length;
+  const uint8_t *data;
+};
+
+/*! The kinds of connections to the -emulate_peer */
+enum sl2_peer_kind {
+  SL2_PEER_SOCKET,
+  SL2_PEER_CONNECT,
+  SL2_PEER_REQUEST,
+};
+
+/*! A connection to the -emulate_peer: a connected socket, or a WinHTTP connection or request.
+ * The WinHTTP handles that the target gets are their addresses */
+struct sl2_peer_conn {
+  bool open;
+  sl2_peer_kind kind;
+  /*! The (real, but unconnected) socket, for sockets */
+  SOCKET socket;
+  /*! The response being read, or for WinHTTP connections, the response to their next request */
+  uint32_t response;
+  /*! How much of the response has been read */
+  uint32_t offset;
+  /*! Whether the peer has sent the response yet */
+  bool started;
+  /*! How many of the target's sends the peer hasn't answered yet */
+  uint32_t pending;
+  /*! The WinHTTP connection that a request was opened on */
+  sl2_peer_conn *connect;
+};
+
+/*! The -emulate_peer's host and port, and its address (in network byte order) if the host is an
+ * IPv4 address, or 0 */
+static wchar_t peer_host[MAX_PATH + 1];
+static uint16_t peer_port = 0;
+static uint32_t peer_addr = 0;
+/*! The -peer_script's responses, in order, and its mapped view */
+static sl2_peer_response peer_responses[SL2_PEER_MAX_RESPONSES];
+static uint32_t peer_response_count = 0;
+static void *peer_script_view = NULL;
+static size_t peer_script_view_size = 0;
+static sl2_peer_conn peer_conns[SL2_PEER_MAX_CONNS];
+/*! Guards peer_conns. NULL unless -emulate_peer was given (with a usable -peer_script) */
+static void *peer_lock = NULL;
+
+/*! The comparison log that strategyInputToState draws from, if -cmplog_table was given */
+static sl2_cmplog cmplog_table;
+/*! The comparison log file's mapped view */
+static void *cmplog_table_view = NULL;
+static size_t cmplog_table_view_size = 0;
+
+/*! Whether we're replaying inputs (see -replay_inputs and -replay_run) instead of fuzzing */
+static bool replaying = false;
+/*! A second connection to the server, bound to -replay_run, that its mutations are replayed over */
+static sl2_conn replay_conn;
+static bool replay_conn_open = false;
+
+/*! Which targeted reads (by mutation count) the server couldn't give us a mutation ring for */
+static bool ring_unavailable[SL2_CONN_MAX_RINGS];
+
+/*! Candidates that the mutator plugin prepared for a single targeted read */
+struct sl2_mutator_batch {
+  /*! The hash (see sl2_ring_hash) of the read that the candidates were prepared from */
+  uint64_t hash;
+  /*! The room that each candidate has */
+  size_t capacity;
+  /*! How many candidates were prepared, and which one is next */
+  uint32_t count;
+  uint32_t next;
+  /*! The candidates' buffers, back to back */
+  uint8_t *data;
+  size_t data_size;
+  sl2_mutator_candidate candidates[SL2_MUTATOR_BATCH];
+};
+
+/*! The mutator plugin given by -mutator, if any */
+struct sl2_mutator_plugin {
+  dr_auxlib_handle_t lib;
+  sl2_mutator_mutate_t mutate;
+  sl2_mutator_teardown_t teardown;
+  /*! The plugin's own state; NULL until the plugin has been initialized */
+  void *state;
+  /*! Serializes calls into the plugin, which may not be thread-safe */
+  void *lock;
+  sl2_mutator_batch batches[SL2_MUTATOR_MAX_READS];
+};
+
+static sl2_mutator_plugin mutator;
+
+/*! A targeted read that a looping thread mutated in its current iteration (see log_persist_read) */
+struct sl2_persist_read {
+  /*! The mutation, whose buffer and resource point at the copies below */
+  sl2_mutation mutation;
+  wchar_t resource[MAX_PATH + 1];
+  /*! A copy of the mutated buffer, and how much room it has */
+  uint8_t *buffer;
+  size_t capacity;
+};
+
+/*! State for looping a single target function in persistent mode */
+struct sl2_persist_state {
+  /*! The function being looped */
+  app_pc func_pc;
+  /*! The stack pointer on entry to the function, restored on each iteration */
+  reg_t xsp;
+  /*! The function's arguments on its first entry, restored on each iteration */
+  void *args[SL2_PERSIST_MAX_ARGS];
+  /*! The call counts at the function's first entry, so that targeting stays consistent */
+  sl2_call_counts call_counts;
+  sl2_retaddr_counts ret_addr_counts;
+  /*! How many iterations we've completed */
+  uint32_t iteration;
+  /*! The targeted reads mutated in the current iteration (-persist_threads only) */
+  sl2_persist_read reads[SL2_PERSIST_LOG_READS];
+  uint32_t read_count;
+};
+
+static sl2_persist_state persist;
+
+/*! A thread that loops the persistent target alongside the one that first entered it (see
+ * -persist_threads). Each worker has its own loop state, call counts and mutation count, and its
+ * own connection to the server, bound to the process's run. Its thread's coverage goes into an
+ * arena of its own (with the process's arena's ID), which it reports after every iteration */
+struct sl2_persist_worker {
+  sl2_persist_state loop;
+  sl2_thread_counts counts;
+  uint32_t mut_count;
+  sl2_conn conn;
+  bool conn_open;
+  sl2_arena arena;
+  /*! The thread's coverage map, which is kept out of thread_maps */
+  uint8_t *map;
+  /*! The worker's thread, and whether it has entered the target yet and finished looping it */
+  thread_id_t thread_id;
+  bool started;
+  bool finished;
+};
+
+/*! The workers that the first looping thread started */
+static sl2_persist_worker *persist_workers[SL2_PERSIST_MAX_THREADS - 1];
+static uint32_t persist_worker_count = 0;
+/*! How many workers haven't finished looping yet, and the event that the first looping thread
+ * waits on (once it's done) until none are left */
+static volatile LONG persist_workers_live = 0;
+static void *persist_workers_done = NULL;
+/*! The drmgr TLS field holding each worker thread's sl2_persist_worker */
+static int persist_worker_idx = -1;
+/*! Taken shared around each looping thread's registrations, and exclusively by a crashing one
+ * (see reregister_crash). NULL unless -persist_threads is over 1 */
+static void *persist_register_lock = NULL;
+
+/**
+ * @param drcontext the current thread's DR context
+ * @return the thread's -persist_threads worker, or NULL if it isn't one
+ */
+static sl2_persist_worker *current_worker(void *drcontext) {
+  if (persist_worker_idx == -1) {
+    return NULL;
+  }
+
+  return (sl2_persist_worker *)drmgr_get_tls_field(drcontext, persist_worker_idx);
+}
+
+/**
+ * @return the connection that the current thread talks to the server over: its worker's, or the
+ *         process's
+ */
+static sl2_conn *thread_conn() {
+  sl2_persist_worker *worker = current_worker(dr_get_current_drcontext());
+  return worker ? &(worker->conn) : &sl2_conn;
+}
+
+/*! A copy of one writable region of the application's memory */
+struct sl2_snapshot_region {
+  app_pc base;
+  size_t size;
+  uint8_t *data;
+};
+
+/*! State for resuming the process from a snapshot in snapshot mode */
+struct sl2_snapshot_state {
+  /*! Whether we've taken the snapshot yet */
+  bool taken;
+  /*! The thread that hit the first targeted read, which is the only one we can resume */
+  thread_id_t thread_id;
+  /*! The thread's context on return from the targeted read */
+  dr_mcontext_t mc;
+  /*! The targeted read, which gets re-mutated on each resume */
+  client_read_info info;
+  wchar_t source[MAX_PATH + 1];
+  /*! The mutation count before the targeted read was mutated */
+  uint32_t mut_count;
+  sl2_call_counts call_counts;
+  sl2_retaddr_counts ret_addr_counts;
+  /*! Every writable region of the application's memory at the time of the snapshot */
+  std::vector<sl2_snapshot_region> regions;
+  /*! How many times we've resumed from the snapshot */
+  uint32_t iteration;
+};
+
+static sl2_snapshot_state snapshot;
+
+/*! Which selected targets we've mutated at least once, indexed like the target file */
+static std::vector<bool> targets_consumed;
+static size_t targets_remaining = 0;
+/*! Guards targets_consumed and targets_remaining */
+static void *targets_lock = NULL;
+/*! Set once every selected target has been consumed, when we're exiting early */
+static volatile bool early_exit_armed = false;
+static uint64_t early_exit_armed_at = 0;
+/*! Counted down by every basic block; we exit when it hits 0 after being armed */
+static volatile ptr_int_t early_exit_bbs_left = SL2_EARLY_EXIT_IDLE_BBS;
+static volatile LONG early_exit_taken = 0;
+
+/*! When the target last made progress (see note_progress), in milliseconds, or 0 if the watchdog
+ * isn't armed yet */
+static volatile LONG64 watchdog_progress_at = 0;
+static volatile LONG watchdog_taken = 0;
+
+/*! When each stage of the run was reached, in microseconds since Jan 1, 1601 (see dr_get_microseconds).
+ * Reported to the harness in the "timing" event, which breaks each run's time down by stage. */
+struct sl2_run_timing {
+  /*! dr_client_main's startup phases: entering it, parsing the options, loading the targets,
+   * connecting to the server, and initializing the DR extensions */
+  volatile LONG64 start;
+  volatile LONG64 options;
+  volatile LONG64 targets;
+  volatile LONG64 connected;
+  volatile LONG64 extensions;
+  volatile LONG64 init;
+  volatile LONG64 first_hook;
+  volatile LONG64 first_mutation;
+  volatile LONG64 exit;
+  volatile LONG64 finalize;
+  volatile LONG64 finalized;
+  /*! How many modules have loaded, and the microseconds spent hooking them (in on_module_load) */
+  volatile LONG64 module_loads;
+  volatile LONG64 module_load_us;
+};
+
+static sl2_run_timing timing = {0};
+
+/**
+ * Finds the index of the last module in seen_modules starting at or before the given address.
+ * Callers must hold modules_lock.
+ * @param addr memory address to look up
+ * @return the module's index, or nmodules if every module starts after addr
+ */
+static uint32_t find_module_index(app_pc addr) {
+  uint32_t lo = 0;
+  uint32_t hi = nmodules;
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+
+    if (seen_modules[mid].start <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo ? lo - 1 : nmodules;
+}
 
 /**
  * Finds the base address of the module containing a given memory address
  * @param addr memory address of a basic block
+ * @param mod_id if not NULL, receives the module's drcov ID
  * @return base address of the module containing addr
  */
-static app_pc get_base_pc(app_pc addr) {
-  module_data_t *containing_module = NULL;
+static app_pc get_base_pc(app_pc addr, uint16_t *mod_id = NULL) {
+  app_pc base_pc = NULL;
 
-  for (uint32_t i = 0; i < nmodules; ++i) {
-    if (dr_module_contains_addr(seen_modules[i], addr)) {
-      containing_module = seen_modules[i];
-      break;
-    }
-  }
+  dr_rwlock_read_lock(modules_lock);
+
+  uint32_t i = find_module_index(addr);
 
   // NOTE(ww): This should only happen in two cases:
   // 1. When the address given is in a module we don't care about (e.g., system DLLs)
   // 2. When the address given is in a module we aren't tracking
   //  (i.e., when nmodules == SL2_MAX_MODULES)
-  if (!containing_module) {
-    return NULL;
+  if (i < nmodules && addr < seen_modules[i].end) {
+    base_pc = seen_modules[i].start;
+
+    if (mod_id) {
+      *mod_id = seen_modules[i].id;
+    }
   }
 
-  return containing_module->start;
+  dr_rwlock_read_unlock(modules_lock);
+
+  return base_pc;
 }
 
 /**
- * Instruments each basic block to insert instructions that update the arena in order to measure
- * code coverage
- * @return DynamoRIO flags indicating return code
+ * Adds a module to seen_modules, keeping it sorted.
+ * @param mod the module to add
+ * @return true if the module was added, false if we're already tracking too many
  */
-static dr_emit_flags_t on_bb_instrument(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
-                                        bool for_trace, bool translating, void *user_data) {
-  app_pc start_pc;
-  uint16_t offset;
+static bool add_module_range(const module_data_t *mod) {
+  bool added = false;
 
-  if (!drmgr_is_first_instr(drcontext, inst)) {
+  dr_rwlock_write_lock(modules_lock);
+
+  if (nmodules < SL2_MAX_MODULES) {
+    uint32_t i = find_module_index(mod->start);
+    i = (i == nmodules) ? 0 : i + 1;
+
+    memmove(&seen_modules[i + 1], &seen_modules[i], (nmodules - i) * sizeof(sl2_module_range));
+    seen_modules[i] = {mod->start, mod->end, (uint16_t)drcov_modules.size()};
+    nmodules++;
+    added = true;
+
+    if (drcov_lock) {
+      drcov_modules.push_back({mod->start, mod->end, mod->full_path});
+    }
+  }
+
+  dr_rwlock_write_unlock(modules_lock);
+
+  return added;
+}
+
+/**
+ * Removes a module from seen_modules, if we were tracking it.
+ * @param mod the module to remove
+ */
+static void remove_module_range(const module_data_t *mod) {
+  dr_rwlock_write_lock(modules_lock);
+
+  uint32_t i = find_module_index(mod->start);
+
+  if (i < nmodules && seen_modules[i].start == mod->start) {
+    memmove(&seen_modules[i], &seen_modules[i + 1],
+            (nmodules - i - 1) * sizeof(sl2_module_range));
+    nmodules--;
+  }
+
+  dr_rwlock_write_unlock(modules_lock);
+}
+
+/**
+ * Splits a semicolon-separated list of module names.
+ * @param list the list to split
+ * @param modules the vector to add each name to
+ */
+static void parse_module_list(const std::string &list, std::vector<std::string> &modules) {
+  size_t start = 0;
+
+  while (start < list.size()) {
+    size_t end = list.find(';', start);
+
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+
+    if (end > start) {
+      modules.push_back(list.substr(start, end - start));
+    }
+
+    start = end + 1;
+  }
+}
+
+/**
+ * Checks whether a module name appears in a list of module names, ignoring case.
+ */
+static bool module_in_list(const char *mod_name, const std::vector<std::string> &modules) {
+  for (const std::string &name : modules) {
+    if (STREQI(mod_name, name.c_str())) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Decides whether we should measure coverage for a module. An allow-list, when given, selects
+ * exactly the modules we care about; otherwise we skip system and DynamoRIO modules. The
+ * deny-list always wins.
+ * @param mod the module being loaded
+ * @return whether to add the module to seen_modules
+ */
+static bool module_is_selected(const module_data_t *mod) {
+  const char *mod_name = dr_module_preferred_name(mod);
+
+  if (!mod_name) {
+    return false;
+  }
+
+  if (module_in_list(mod_name, coverage_deny)) {
+    return false;
+  }
+
+  if (!coverage_allow.empty()) {
+    return module_in_list(mod_name, coverage_allow);
+  }
+
+  return _strnicmp("C:\\Windows\\", mod->full_path, 11) &&
+         !strstr(mod->full_path, "dynamorio.dll") && !strstr(mod->full_path, "drreg.dll") &&
+         !strstr(mod->full_path, "drwrap.dll") && !strstr(mod->full_path, "drmgr.dll") &&
+         !strstr(mod->full_path, "fuzzer.dll");
+}
+
+/**
+ * Writes the buffered drcov basic block records to the spool file.
+ * Callers must hold drcov_lock.
+ */
+static void flush_drcov_buffer() {
+  size_t size = drcov_buffered * sizeof(sl2_drcov_bb);
+
+  if (size && dr_write_file(drcov_spool, drcov_buffer, size) != (ssize_t)size) {
+    SL2_DR_DEBUG("flush_drcov_buffer: short write to the drcov spool!\n");
+  }
+
+  drcov_buffered = 0;
+}
+
+/**
+ * Records each newly built basic block, for the drcov coverage export. Like drcov, we record
+ * blocks when DynamoRIO builds them, which (barring flushes) is the first time they run.
+ * @return DynamoRIO flags indicating return code
+ */
+static dr_emit_flags_t on_bb_drcov(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                                   bool for_trace, bool translating, void *user_data) {
+  if (!drmgr_is_first_instr(drcontext, inst) || for_trace || translating) {
     return DR_EMIT_DEFAULT;
   }
 
-  start_pc = dr_fragment_app_pc(tag);
-  app_pc base_pc = get_base_pc(start_pc);
+  app_pc start_pc = dr_fragment_app_pc(tag);
+  uint16_t mod_id;
+  app_pc base_pc = get_base_pc(start_pc, &mod_id);
 
   if (!base_pc) {
     return DR_EMIT_DEFAULT;
   }
 
-  offset = (start_pc - base_pc) & (FUZZ_ARENA_SIZE - 1);
+  app_pc end_pc = start_pc;
 
-  drreg_reserve_aflags(drcontext, bb, inst);
-  // TODO(ww): Is it really necessary to inject an instruction here?
-  // This is how WinAFL does it, but we don't use shared memory like they do.
-  instrlist_meta_preinsert(
-      bb, inst, INSTR_CREATE_inc(drcontext, OPND_CREATE_ABSMEM(&(arena.map[offset]), OPSZ_1)));
-  drreg_unreserve_aflags(drcontext, bb, inst);
+  for (instr_t *instr = instrlist_first_app(bb); instr; instr = instr_get_next_app(instr)) {
+    app_pc pc = instr_get_app_pc(instr);
+
+    if (pc && pc + instr_length(drcontext, instr) > end_pc) {
+      end_pc = pc + instr_length(drcontext, instr);
+    }
+  }
+
+  sl2_drcov_bb record = {(uint32_t)(start_pc - base_pc),
+                         (uint16_t)min(end_pc - start_pc, 0xFFFF), mod_id};
+
+  dr_mutex_lock(drcov_lock);
+
+  drcov_buffer[drcov_buffered++] = record;
+  drcov_count++;
+
+  if (drcov_buffered == SL2_DRCOV_BUFFER_ENTRIES) {
+    flush_drcov_buffer();
+  }
+
+  dr_mutex_unlock(drcov_lock);
 
   return DR_EMIT_DEFAULT;
 }
 
-/*! Maps exception code to an exit status. Print it out, save the exception context, then exit. */
-static bool on_exception(void *drcontext, dr_exception_t *excpt) {
-  if (exiting) {
-    SL2_DR_DEBUG(
-        "fuzzer#on_exception: Exception while exiting! Probably an instrumentation failure.\n");
-    dr_abort();
-    return false;
+/**
+ * Starts spooling basic block records for the drcov coverage export, if the user asked for it.
+ */
+static void init_drcov() {
+  if (op_drcov.get_value() == "") {
+    return;
   }
 
-  crashed = true;
-  DWORD exception_code = excpt->record->ExceptionCode;
+  drcov_spool_path = op_drcov.get_value() + ".bbs";
+  drcov_spool = dr_open_file(drcov_spool_path.c_str(), DR_FILE_WRITE_OVERWRITE);
 
-  dr_switch_to_app_state(drcontext);
-  fuzz_exception_ctx.thread_id = GetCurrentThreadId();
-  dr_mcontext_to_context(&(fuzz_exception_ctx.thread_ctx), excpt->mcontext);
-  dr_switch_to_dr_state(drcontext);
+  if (drcov_spool == INVALID_FILE) {
+    SL2_DR_DEBUG("init_drcov: couldn't open %s, not exporting coverage\n",
+                 drcov_spool_path.c_str());
+    return;
+  }
 
-  // Make our own copy of the exception record.
-  memcpy(&(fuzz_exception_ctx.record), excpt->record, sizeof(EXCEPTION_RECORD));
+  drcov_lock = dr_mutex_create();
+
+  if (!drmgr_register_bb_instrumentation_event(NULL, on_bb_drcov, NULL)) {
+    DR_ASSERT(false);
+  }
+}
 
-  json j;
-  j["exception"] = client.exception_to_string(exception_code);
-  SL2_LOG_JSONL(j);
+/**
+ * Writes the drcov coverage export: a text header and module table, followed by the
+ * spooled basic block table.
+ */
+static void exit_drcov() {
+  if (!drcov_lock) {
+    return;
+  }
 
-  dr_exit_process(1);
-  return true;
+  dr_mutex_lock(drcov_lock);
+  flush_drcov_buffer();
+  dr_close_file(drcov_spool);
+
+  file_t out = dr_open_file(op_drcov.get_value().c_str(), DR_FILE_WRITE_OVERWRITE);
+  file_t spool = dr_open_file(drcov_spool_path.c_str(), DR_FILE_READ);
+  char line[MAX_PATH + 256];
+  int len;
+
+  if (out == INVALID_FILE || spool == INVALID_FILE) {
+    SL2_DR_DEBUG("exit_drcov: couldn't open the drcov output or spool!\n");
+    goto cleanup;
+  }
+
+  dr_rwlock_read_lock(modules_lock);
+
+  len = dr_snprintf(line, sizeof(line),
+                    "DRCOV VERSION: 2\nDRCOV FLAVOR: drcov\n"
+                    "Module Table: version 2, count %u\n"
+                    "Columns: id, base, end, entry, checksum, timestamp, path\n",
+                    (uint32_t)drcov_modules.size());
+  dr_write_file(out, line, len);
+
+  for (size_t i = 0; i < drcov_modules.size(); ++i) {
+    len = dr_snprintf(line, sizeof(line), "%3u, 0x%p, 0x%p, 0x%p, 0x%08x, 0x%08x, %s\n",
+                      (uint32_t)i, drcov_modules[i].start, drcov_modules[i].end, NULL, 0, 0,
+                      drcov_modules[i].path.c_str());
+    dr_write_file(out, line, len);
+  }
+
+  dr_rwlock_read_unlock(modules_lock);
+
+  len = dr_snprintf(line, sizeof(line), "BB Table: %llu bbs\n", drcov_count);
+  dr_write_file(out, line, len);
+
+  // The spool is already in drcov's binary format, so we copy it over wholesale,
+  // reusing the record buffer as scratch space.
+  ssize_t nread;
+  while ((nread = dr_read_file(spool, drcov_buffer, sizeof(drcov_buffer))) > 0) {
+    dr_write_file(out, drcov_buffer, nread);
+  }
+
+  SL2_DR_DEBUG("exit_drcov: wrote %llu blocks to %s\n", drcov_count,
+               op_drcov.get_value().c_str());
+
+cleanup:
+
+  if (out != INVALID_FILE) {
+    dr_close_file(out);
+  }
+
+  if (spool != INVALID_FILE) {
+    dr_close_file(spool);
+  }
+
+  dr_delete_file(drcov_spool_path.c_str());
+  dr_mutex_unlock(drcov_lock);
+  dr_mutex_destroy(drcov_lock);
+  drcov_lock = NULL;
 }
 
-/** Runs after the target application has exited. Reports crash state to the server and dumps
- * coverage info. */
-static void on_dr_exit(void) {
-  exiting = true;
-  SL2_DR_DEBUG("Dynamorio exiting (fuzzer)\n");
+/**
+ * Logs a comparison's operands, unless they're already equal (in which case there's nothing to
+ * substitute) or the comparison has been logged before.
+ * @param entry the comparison, with any bytes past `size` zeroed
+ */
+static void log_cmp(const sl2_cmplog_entry *entry) {
+  if (!entry->size || !memcmp(entry->lhs, entry->rhs, entry->size)) {
+    return;
+  }
 
-  if (crashed) {
-    char run_id_s[SL2_UUID_SIZE];
-    sl2_uuid_to_string(sl2_conn.run_id, run_id_s);
-    SL2_DR_DEBUG("<crash found for run id %s>\n", run_id_s);
+  // FNV-1a, over the whole entry.
+  uint64_t hash = 0xCBF29CE484222325;
+  for (size_t i = 0; i < sizeof(*entry); i++) {
+    hash = (hash ^ ((const uint8_t *)entry)[i]) * 0x100000001B3;
+  }
 
-    sl2_crash_paths crash_paths = {0};
-    sl2_conn_request_crash_paths(&sl2_conn, dr_get_process_id(), &crash_paths);
+  dr_mutex_lock(cmplog_lock);
 
-    // NOTE(ww): `dr_open_file` et al. don't work here, presumably because we explicitly
-    // switch to the target app state to perform the actual minidump write.
-    HANDLE dump_file = CreateFile(crash_paths.initial_dump_path, GENERIC_WRITE, NULL, NULL,
-                                  CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (cmplog_entries.size() < SL2_CMPLOG_MAX_ENTRIES && cmplog_seen.insert(hash).second) {
+    cmplog_entries.push_back(*entry);
+  }
 
-    if (dump_file == INVALID_HANDLE_VALUE) {
-      SL2_DR_DEBUG("fuzzer#on_dr_exit: could not open the initial dump file (GLE=%d)\n",
-                   GetLastError());
-    }
+  dr_mutex_unlock(cmplog_lock);
+}
 
-    EXCEPTION_POINTERS exception_pointers = {0};
-    MINIDUMP_EXCEPTION_INFORMATION mdump_info = {0};
+/**
+ * Reads an integer comparison operand's value at the time of the comparison.
+ * @param mc the thread's machine context
+ * @param opnd the operand
+ * @param size the size of the comparison, in bytes
+ * @param out receives the operand's value, little-endian
+ * @return whether the operand could be read
+ */
+static bool read_cmp_operand(dr_mcontext_t *mc, opnd_t opnd, size_t size, uint8_t *out) {
+  if (opnd_is_immed_int(opnd)) {
+    // Immediates can be narrower than the comparison; they're sign-extended.
+    int64 value = opnd_get_immed_int(opnd);
+    memcpy(out, &value, size);
+    return true;
+  }
 
-    exception_pointers.ExceptionRecord = &(fuzz_exception_ctx.record);
-    exception_pointers.ContextRecord = &(fuzz_exception_ctx.thread_ctx);
+  if (opnd_is_reg(opnd) && reg_is_gpr(opnd_get_reg(opnd))) {
+    // We only log 2, 4, and 8-byte comparisons, which only use low sub-registers.
+    reg_t value = reg_get_value(reg_to_pointer_sized(opnd_get_reg(opnd)), mc);
+    memcpy(out, &value, size);
+    return true;
+  }
 
-    mdump_info.ThreadId = fuzz_exception_ctx.thread_id;
-    mdump_info.ExceptionPointers = &exception_pointers;
-    mdump_info.ClientPointers = true;
+  if (opnd_is_memory_reference(opnd)) {
+    return dr_safe_read(opnd_compute_address(opnd, mc), size, out, NULL);
+  }
 
-    // NOTE(ww): Switching back to the application's state is necessary, as we don't want
-    // parts of the instrumentation showing up in our initial dump.
-    dr_switch_to_app_state(dr_get_current_drcontext());
+  return false;
+}
 
-    if (!MiniDumpWriteDump(GetCurrentProcess(), GetCurrentProcessId(), dump_file, MiniDumpNormal,
-                           &mdump_info, NULL, NULL)) {
-      SL2_DR_DEBUG("fuzzer#on_dr_exit: MiniDumpWriteDump failed (GLE=%d)\n", GetLastError());
+/**
+ * Clean call before each instrumented comparison instruction: decodes it again, and logs the
+ * values of its operands.
+ * @param pc the comparison's address
+ */
+static void on_cmp(app_pc pc) {
+  void *drcontext = dr_get_current_drcontext();
+  dr_mcontext_t mc = {sizeof(mc), DR_MC_INTEGER | DR_MC_CONTROL};
+  instr_t instr;
+
+  dr_get_mcontext(drcontext, &mc);
+  instr_init(drcontext, &instr);
+
+  if (decode(drcontext, pc, &instr) && instr_num_srcs(&instr) >= 2) {
+    sl2_cmplog_entry entry = {0};
+    entry.kind = SL2_CMPLOG_INT;
+    entry.size = opnd_size_in_bytes(opnd_get_size(instr_get_src(&instr, 0)));
+
+    if (read_cmp_operand(&mc, instr_get_src(&instr, 0), entry.size, entry.lhs) &&
+        read_cmp_operand(&mc, instr_get_src(&instr, 1), entry.size, entry.rhs)) {
+      log_cmp(&entry);
     }
+  }
 
-    dr_switch_to_dr_state(dr_get_current_drcontext());
+  instr_free(drcontext, &instr);
+}
+
+/**
+ * Instruments the 2, 4, and 8-byte cmp, test, and sub instructions in the selected modules
+ * with a clean call to on_cmp.
+ * @return DynamoRIO flags indicating return code
+ */
+static dr_emit_flags_t on_bb_cmplog(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                                    bool for_trace, bool translating, void *user_data) {
+  int opcode = instr_get_opcode(inst);
 
-    CloseHandle(dump_file);
+  if (!instr_is_app(inst) || (opcode != OP_cmp && opcode != OP_test && opcode != OP_sub)) {
+    return DR_EMIT_DEFAULT;
   }
 
-  if (coverage_guided) {
-    sl2_conn_register_arena(&sl2_conn, &arena);
+  app_pc pc = instr_get_app_pc(inst);
 
-    sl2_coverage_info cov = {0};
-    sl2_conn_get_coverage(&sl2_conn, &arena, &cov);
-    SL2_DR_DEBUG("#COVERAGE:{\"hash\": \"%s\", \"bkt\": %s, \"scr\": %u, \"rem\": %u}\n",
-                 cov.path_hash, cov.bucketing ? "true" : "false", cov.score, cov.tries_remaining);
+  if (!pc || !get_base_pc(pc) || instr_num_srcs(inst) < 2) {
+    return DR_EMIT_DEFAULT;
   }
 
-  sl2_conn_close(&sl2_conn);
+  // Single bytes are mostly flags and characters, which byte-level strategies
+  // already find without our help.
+  uint32_t size = opnd_size_in_bytes(opnd_get_size(instr_get_src(inst, 0)));
 
-  for (uint32_t i = 0; i < nmodules; ++i) {
-    dr_free_module_data(seen_modules[i]);
+  if (size != 2 && size != 4 && size != 8) {
+    return DR_EMIT_DEFAULT;
   }
 
-  dr_log(NULL, DR_LOG_ALL, ERROR, "fuzzer#on_dr_exit: Dynamorio Exiting\n");
-  drwrap_exit();
-  drmgr_exit();
-  drreg_exit();
+  dr_insert_clean_call(drcontext, bb, inst, (void *)on_cmp, false, 1, OPND_CREATE_INTPTR(pc));
+
+  return DR_EMIT_DEFAULT;
+}
+
+/**
+ * Reads up to `max` bytes of a NUL-terminated string from the target.
+ * @param str the string
+ * @param max the most bytes to read
+ * @param out receives the string's bytes
+ * @return the number of bytes read, not counting the NUL
+ */
+static size_t read_cmp_string(const char *str, size_t max, uint8_t *out) {
+  size_t len = 0;
+
+  while (len < max && dr_safe_read(str + len, 1, out + len, NULL) && out[len]) {
+    len++;
+  }
+
+  return len;
+}
+
+/**
+ * Logs the arguments of a memcmp()-like (`string` false) or strcmp()-like (`string` true) call,
+ * if the call came from one of the selected modules.
+ * @param wrapcxt - DynamoRIO Wrap Context
+ * @param string - whether the arguments are NUL-terminated strings
+ * @param limit - the most bytes that the call compares
+ */
+static void log_cmp_call(void *wrapcxt, bool string, size_t limit) {
+  if (!get_base_pc(drwrap_get_retaddr(wrapcxt))) {
+    return;
+  }
+
+  const char *lhs = (const char *)drwrap_get_arg(wrapcxt, 0);
+  const char *rhs = (const char *)drwrap_get_arg(wrapcxt, 1);
+  sl2_cmplog_entry entry = {0};
+  entry.kind = SL2_CMPLOG_MEM;
+  entry.size = (uint32_t)min(limit, SL2_CMPLOG_MAX_OPERAND);
+
+  if (string) {
+    entry.size = (uint32_t)max(read_cmp_string(lhs, entry.size, entry.lhs),
+                               read_cmp_string(rhs, entry.size, entry.rhs));
+  } else if (!dr_safe_read(lhs, entry.size, entry.lhs, NULL) ||
+             !dr_safe_read(rhs, entry.size, entry.rhs, NULL)) {
+    return;
+  }
+
+  log_cmp(&entry);
+}
+
+/**
+ * Logs the arguments of memcmp() (and friends) for -cmplog.
+ * @param wrapcxt - DynamoRIO Wrap Context
+ * @param user_data - unused
+ */
+static void wrap_pre_cmplog_memcmp(void *wrapcxt, OUT void **user_data) {
+  log_cmp_call(wrapcxt, false, (size_t)drwrap_get_arg(wrapcxt, 2));
+}
+
+/**
+ * Logs the arguments of strcmp() (and friends) for -cmplog.
+ * @param wrapcxt - DynamoRIO Wrap Context
+ * @param user_data - unused
+ */
+static void wrap_pre_cmplog_strcmp(void *wrapcxt, OUT void **user_data) {
+  log_cmp_call(wrapcxt, true, SL2_CMPLOG_MAX_STRING);
+}
+
+/**
+ * Logs the arguments of strncmp() (and friends) for -cmplog.
+ * @param wrapcxt - DynamoRIO Wrap Context
+ * @param user_data - unused
+ */
+static void wrap_pre_cmplog_strncmp(void *wrapcxt, OUT void **user_data) {
+  log_cmp_call(wrapcxt, true, (size_t)drwrap_get_arg(wrapcxt, 2));
+}
+
+/**
+ * Wraps whichever of the comparison functions that -cmplog logs a module exports.
+ * @param mod the module being loaded
+ */
+static void wrap_cmplog_functions(const module_data_t *mod) {
+  static const struct {
+    const char *name;
+    void (*pre_hook)(void *, void **);
+  } functions[] = {
+      {"memcmp", wrap_pre_cmplog_memcmp},    {"strcmp", wrap_pre_cmplog_strcmp},
+      {"_stricmp", wrap_pre_cmplog_strcmp},  {"strncmp", wrap_pre_cmplog_strncmp},
+      {"_strnicmp", wrap_pre_cmplog_strncmp},
+  };
+
+  for (const auto &function : functions) {
+    app_pc towrap = (app_pc)dr_get_proc_address(mod->handle, function.name);
+
+    if (towrap && !drwrap_wrap(towrap, function.pre_hook, NULL)) {
+      SL2_DR_DEBUG("<FAILED to wrap %s in %s for -cmplog\n", function.name, mod->full_path);
+    }
+  }
+}
+
+/**
+ * Starts logging comparisons, if the user asked for it.
+ */
+static void init_cmplog() {
+  if (op_cmplog.get_value() == "") {
+    return;
+  }
+
+  cmplog_lock = dr_mutex_create();
+
+  if (!drmgr_register_bb_instrumentation_event(NULL, on_bb_cmplog, NULL)) {
+    DR_ASSERT(false);
+  }
+}
+
+/**
+ * Writes the logged comparisons to the -cmplog file.
+ */
+static void exit_cmplog() {
+  if (!cmplog_lock) {
+    return;
+  }
+
+  dr_mutex_lock(cmplog_lock);
+
+  file_t out = dr_open_file(op_cmplog.get_value().c_str(), DR_FILE_WRITE_OVERWRITE);
+
+  if (out != INVALID_FILE) {
+    sl2_cmplog_header header = {{0}, SL2_CMPLOG_VERSION, (uint32_t)cmplog_entries.size()};
+    memcpy(header.magic, SL2_CMPLOG_MAGIC, sizeof(header.magic));
+
+    dr_write_file(out, &header, sizeof(header));
+    dr_write_file(out, cmplog_entries.data(), cmplog_entries.size() * sizeof(sl2_cmplog_entry));
+    dr_close_file(out);
+
+    SL2_DR_DEBUG("exit_cmplog: wrote %u comparisons to %s\n", header.count,
+                 op_cmplog.get_value().c_str());
+  } else {
+    SL2_DR_DEBUG("exit_cmplog: couldn't open %s!\n", op_cmplog.get_value().c_str());
+  }
+
+  dr_mutex_unlock(cmplog_lock);
+  dr_mutex_destroy(cmplog_lock);
+  cmplog_lock = NULL;
+}
+
+/**
+ * Makes a guarded allocation: its end is up against a page that's never committed, so that
+ * reading or writing past it faults.
+ * Allocations are aligned like the real heap's, so overflows of less than
+ * SL2_GUARD_ALIGN bytes can land in the padding instead of the guard page.
+ * @param size the allocation's size
+ * @return the allocation, or NULL if the pool is used up
+ */
+static void *guard_heap_alloc(size_t size) {
+  size_t aligned = ALIGN_FORWARD(std::max<size_t>(size, 1), SL2_GUARD_ALIGN);
+  size_t committed = ALIGN_FORWARD(aligned, SL2_GUARD_PAGE_SIZE);
+  app_pc slot = NULL;
+
+  dr_mutex_lock(guard_heap_lock);
+
+  if ((size_t)(guard_pool_end - guard_pool_next) >= committed + SL2_GUARD_PAGE_SIZE) {
+    slot = guard_pool_next;
+    guard_pool_next += committed + SL2_GUARD_PAGE_SIZE;
+  }
+
+  dr_mutex_unlock(guard_heap_lock);
+
+  if (!slot) {
+    return NULL;
+  }
+
+  if (!dr_custom_alloc(NULL,
+                       (dr_alloc_flags_t)(DR_ALLOC_NON_HEAP | DR_ALLOC_NON_DR |
+                                          DR_ALLOC_COMMIT_ONLY | DR_ALLOC_FIXED_LOCATION),
+                       committed, DR_MEMPROT_READ | DR_MEMPROT_WRITE, slot)) {
+    SL2_DR_DEBUG("guard_heap_alloc: couldn't commit %llu bytes at 0x%p\n", committed, slot);
+    return NULL;
+  }
+
+  app_pc ptr = slot + committed - aligned;
+
+  dr_mutex_lock(guard_heap_lock);
+  guard_allocs[ptr] = size;
+  dr_mutex_unlock(guard_heap_lock);
+
+  return ptr;
+}
+
+/**
+ * Frees a guarded allocation, by decommitting its pages, so that any later use of it faults.
+ * Its address space is never reused.
+ * @param ptr the allocation
+ * @param size receives its size, if it's not NULL
+ * @return whether the allocation was one of ours
+ */
+static bool guard_heap_free(app_pc ptr, size_t *size = NULL) {
+  dr_mutex_lock(guard_heap_lock);
+
+  sl2_guard_allocs_map::iterator it = guard_allocs.find(ptr);
+  bool ours = it != guard_allocs.end();
+
+  if (ours) {
+    if (size) {
+      *size = it->second;
+    }
+
+    guard_allocs.erase(it);
+  }
+
+  dr_mutex_unlock(guard_heap_lock);
+
+  if (ours) {
+    app_pc start = (app_pc)ALIGN_BACKWARD(ptr, SL2_GUARD_PAGE_SIZE);
+    app_pc guard = (app_pc)ALIGN_FORWARD(ptr + 1, SL2_GUARD_PAGE_SIZE);
+
+    dr_custom_free(NULL,
+                   (dr_alloc_flags_t)(DR_ALLOC_NON_HEAP | DR_ALLOC_NON_DR | DR_ALLOC_COMMIT_ONLY),
+                   start, guard - start);
+  }
+
+  return ours;
+}
+
+/**
+ * @param ptr an allocation
+ * @param size receives its size, if it's a guarded allocation
+ * @return whether the allocation was one of ours
+ */
+static bool guard_heap_size(app_pc ptr, size_t *size) {
+  dr_mutex_lock(guard_heap_lock);
+
+  sl2_guard_allocs_map::iterator it = guard_allocs.find(ptr);
+  bool ours = it != guard_allocs.end();
+
+  if (ours) {
+    *size = it->second;
+  }
+
+  dr_mutex_unlock(guard_heap_lock);
+
+  return ours;
+}
+
+/**
+ * Replaces sampled allocations in -guard_heap's size range with guarded ones.
+ * RtlAllocateHeap(HeapHandle, Flags, Size)
+ * Fresh commits are always zeroed, so HEAP_ZERO_MEMORY needs no handling.
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_RtlAllocateHeap(void *wrapcxt, OUT void **user_data) {
+  size_t size = (size_t)drwrap_get_arg(wrapcxt, 2);
+
+  if (size < op_guard_heap_min.get_value() || size > op_guard_heap_max.get_value() ||
+      (InterlockedIncrement64(&guard_candidates) - 1) % op_guard_heap_sample.get_value()) {
+    return;
+  }
+
+  void *ptr = guard_heap_alloc(size);
+
+  if (ptr) {
+    drwrap_skip_call(wrapcxt, ptr, 0);
+  }
+}
+
+/**
+ * Frees guarded allocations ourselves, and hands everything else to the real heap.
+ * RtlFreeHeap(HeapHandle, Flags, BaseAddress)
+ * A guarded allocation that's freed twice is handed to the real heap the second time,
+ * which reports it as heap corruption.
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_RtlFreeHeap(void *wrapcxt, OUT void **user_data) {
+  app_pc ptr = (app_pc)drwrap_get_arg(wrapcxt, 2);
+
+  if (ptr && guard_heap_free(ptr)) {
+    drwrap_skip_call(wrapcxt, (void *)TRUE, 0);
+  }
+}
+
+/**
+ * Reallocates guarded allocations as new guarded allocations, whatever their new size, since
+ * the real heap can't resize them.
+ * RtlReAllocateHeap(HeapHandle, Flags, BaseAddress, Size)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_RtlReAllocateHeap(void *wrapcxt, OUT void **user_data) {
+  app_pc ptr = (app_pc)drwrap_get_arg(wrapcxt, 2);
+  size_t size = (size_t)drwrap_get_arg(wrapcxt, 3);
+  size_t old_size;
+
+  if (!ptr || !guard_heap_size(ptr, &old_size)) {
+    return;
+  }
+
+  // Growing in place would move the allocation's end away from its guard page.
+  if ((size_t)drwrap_get_arg(wrapcxt, 1) & SL2_HEAP_REALLOC_IN_PLACE_ONLY) {
+    drwrap_skip_call(wrapcxt, NULL, 0);
+    return;
+  }
+
+  app_pc resized = (app_pc)guard_heap_alloc(size);
+
+  if (resized) {
+    memcpy(resized, ptr, std::min(size, old_size));
+    guard_heap_free(ptr);
+  }
+
+  drwrap_skip_call(wrapcxt, resized, 0);
+}
+
+/**
+ * Answers for the size of guarded allocations.
+ * RtlSizeHeap(HeapHandle, Flags, BaseAddress)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_RtlSizeHeap(void *wrapcxt, OUT void **user_data) {
+  size_t size;
+
+  if (guard_heap_size((app_pc)drwrap_get_arg(wrapcxt, 2), &size)) {
+    drwrap_skip_call(wrapcxt, (void *)size, 0);
+  }
+}
+
+/**
+ * Wraps ntdll's heap functions for -guard_heap.
+ * @param mod ntdll
+ */
+static void wrap_guard_heap_functions(const module_data_t *mod) {
+  static const struct {
+    const char *name;
+    void (*pre_hook)(void *, void **);
+  } functions[] = {
+      {"RtlAllocateHeap", wrap_pre_RtlAllocateHeap},
+      {"RtlFreeHeap", wrap_pre_RtlFreeHeap},
+      {"RtlReAllocateHeap", wrap_pre_RtlReAllocateHeap},
+      {"RtlSizeHeap", wrap_pre_RtlSizeHeap},
+  };
+
+  for (const auto &function : functions) {
+    app_pc towrap = (app_pc)dr_get_proc_address(mod->handle, function.name);
+
+    if (!towrap || !drwrap_wrap(towrap, function.pre_hook, NULL)) {
+      SL2_DR_DEBUG("<FAILED to wrap %s for -guard_heap\n", function.name);
+    }
+  }
+}
+
+/**
+ * Reserves -guard_heap's address space, if the user asked for it. Nothing in it is committed
+ * until it's allocated.
+ * The pool (and its lock) are never freed, since the target can still free guarded
+ * allocations while it exits.
+ */
+static void init_guard_heap() {
+  if (!op_guard_heap.get_value()) {
+    return;
+  }
+
+  if (!op_guard_heap_sample.get_value() ||
+      op_guard_heap_min.get_value() > op_guard_heap_max.get_value()) {
+    SL2_DR_DEBUG("ERROR: -guard_heap_sample must be nonzero, and -guard_heap_min at most "
+                 "-guard_heap_max\n");
+    dr_abort();
+  }
+
+  size_t size = (size_t)op_guard_heap_mb.get_value() * 1024 * 1024;
+
+  guard_pool = (app_pc)dr_custom_alloc(
+      NULL, (dr_alloc_flags_t)(DR_ALLOC_NON_HEAP | DR_ALLOC_NON_DR | DR_ALLOC_RESERVE_ONLY), size,
+      DR_MEMPROT_NONE, NULL);
+
+  if (!guard_pool) {
+    SL2_DR_DEBUG("init_guard_heap: couldn't reserve %u MiB, not guarding the heap\n",
+                 op_guard_heap_mb.get_value());
+    return;
+  }
+
+  guard_pool_next = guard_pool;
+  guard_pool_end = guard_pool + size;
+  guard_heap_lock = dr_mutex_create();
+}
+
+/**
+ * @param handle a handle that the target passed to a file function
+ * @return the open -virtual_file handle that it is, or NULL if it's a real handle
+ */
+static sl2_virtual_handle *virtual_handle(HANDLE handle) {
+  if (!virtual_file_lock || (sl2_virtual_handle *)handle < virtual_handles ||
+      (sl2_virtual_handle *)handle >= virtual_handles + SL2_VIRTUAL_FILE_MAX_HANDLES) {
+    return NULL;
+  }
+
+  sl2_virtual_handle *vhandle = (sl2_virtual_handle *)handle;
+
+  dr_mutex_lock(virtual_file_lock);
+  bool open = vhandle->open;
+  dr_mutex_unlock(virtual_file_lock);
+
+  return open ? vhandle : NULL;
+}
+
+/**
+ * Moves a -virtual_file handle's file pointer, like SetFilePointerEx does.
+ * @param vhandle the handle
+ * @param distance how far to move it
+ * @param method FILE_BEGIN, FILE_CURRENT or FILE_END
+ * @param position receives the new file pointer
+ * @return whether the file pointer was moved: it can't move before the start of the file
+ */
+static bool seek_virtual_file(sl2_virtual_handle *vhandle, int64_t distance, DWORD method,
+                              uint64_t *position) {
+  int64_t base;
+
+  dr_mutex_lock(virtual_file_lock);
+
+  switch (method) {
+  case FILE_BEGIN:
+    base = 0;
+    break;
+  case FILE_CURRENT:
+    base = (int64_t)vhandle->position;
+    break;
+  case FILE_END:
+    base = (int64_t)virtual_file_size;
+    break;
+  default:
+    dr_mutex_unlock(virtual_file_lock);
+    return false;
+  }
+
+  bool ok = base + distance >= 0;
+
+  if (ok) {
+    vhandle->position = (uint64_t)(base + distance);
+    *position = vhandle->position;
+  }
+
+  dr_mutex_unlock(virtual_file_lock);
+
+  return ok;
+}
+
+/**
+ * Opens the -virtual_file in memory, for reading only, instead of on disk. Anything else (writes,
+ * overlapped I/O, other files) goes to the real CreateFileW.
+ * CreateFileW(lpFileName, dwDesiredAccess, dwShareMode, lpSecurityAttributes,
+ *             dwCreationDisposition, dwFlagsAndAttributes, hTemplateFile)
+ * KERNELBASE's CreateFileA goes through CreateFileW, so this covers both.
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_CreateFileW(void *wrapcxt, OUT void **user_data) {
+  const wchar_t *name = (const wchar_t *)drwrap_get_arg(wrapcxt, 0);
+#pragma warning(suppress : 4311 4302)
+  DWORD access = (DWORD)drwrap_get_arg(wrapcxt, 1);
+#pragma warning(suppress : 4311 4302)
+  DWORD disposition = (DWORD)drwrap_get_arg(wrapcxt, 4);
+#pragma warning(suppress : 4311 4302)
+  DWORD flags = (DWORD)drwrap_get_arg(wrapcxt, 5);
+  wchar_t path[MAX_PATH + 1];
+
+  if (!name ||
+      (access & (GENERIC_WRITE | GENERIC_ALL | FILE_WRITE_DATA | FILE_APPEND_DATA | DELETE)) ||
+      (disposition != OPEN_EXISTING && disposition != OPEN_ALWAYS) ||
+      (flags & (FILE_FLAG_OVERLAPPED | FILE_FLAG_DELETE_ON_CLOSE))) {
+    return;
+  }
+
+  DWORD len = GetFullPathNameW(name, MAX_PATH + 1, path, NULL);
+
+  if (!len || len > MAX_PATH || _wcsicmp(path, virtual_file_path)) {
+    return;
+  }
+
+  sl2_virtual_handle *vhandle = NULL;
+
+  dr_mutex_lock(virtual_file_lock);
+
+  for (auto &candidate : virtual_handles) {
+    if (!candidate.open) {
+      candidate.open = true;
+      candidate.position = 0;
+      vhandle = &candidate;
+      break;
+    }
+  }
+
+  dr_mutex_unlock(virtual_file_lock);
+
+  // With every handle in use, the target just gets the real file.
+  if (vhandle) {
+    drwrap_skip_call(wrapcxt, vhandle, 0);
+  } else {
+    SL2_DR_DEBUG("<out of -virtual_file handles, opening the real file>\n");
+  }
+}
+
+/**
+ * Moves the file pointer of a -virtual_file handle.
+ * SetFilePointer(hFile, lDistanceToMove, lpDistanceToMoveHigh, dwMoveMethod)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_SetFilePointer(void *wrapcxt, OUT void **user_data) {
+  sl2_virtual_handle *vhandle = virtual_handle(drwrap_get_arg(wrapcxt, 0));
+
+  if (!vhandle) {
+    return;
+  }
+
+#pragma warning(suppress : 4311 4302)
+  LONG low = (LONG)drwrap_get_arg(wrapcxt, 1);
+  LONG *high = (LONG *)drwrap_get_arg(wrapcxt, 2);
+#pragma warning(suppress : 4311 4302)
+  DWORD method = (DWORD)drwrap_get_arg(wrapcxt, 3);
+
+  // Without a high part, the distance is a signed 32-bit one.
+  int64_t distance = high ? (int64_t)(((uint64_t)(DWORD)*high << 32) | (DWORD)low) : low;
+  uint64_t position;
+
+  if (!seek_virtual_file(vhandle, distance, method, &position)) {
+    drwrap_skip_call(wrapcxt, (void *)(size_t)INVALID_SET_FILE_POINTER, 0);
+    return;
+  }
+
+  if (high) {
+    *high = (LONG)(position >> 32);
+  }
+
+  drwrap_skip_call(wrapcxt, (void *)(size_t)(DWORD)position, 0);
+}
+
+/**
+ * Moves the file pointer of a -virtual_file handle.
+ * SetFilePointerEx(hFile, liDistanceToMove, lpNewFilePointer, dwMoveMethod)
+ * liDistanceToMove is passed by value, which takes a single argument on x64 only.
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_SetFilePointerEx(void *wrapcxt, OUT void **user_data) {
+  sl2_virtual_handle *vhandle = virtual_handle(drwrap_get_arg(wrapcxt, 0));
+
+  if (!vhandle) {
+    return;
+  }
+
+  int64_t distance = (int64_t)drwrap_get_arg(wrapcxt, 1);
+  LARGE_INTEGER *new_position = (LARGE_INTEGER *)drwrap_get_arg(wrapcxt, 2);
+#pragma warning(suppress : 4311 4302)
+  DWORD method = (DWORD)drwrap_get_arg(wrapcxt, 3);
+  uint64_t position;
+
+  if (!seek_virtual_file(vhandle, distance, method, &position)) {
+    drwrap_skip_call(wrapcxt, (void *)FALSE, 0);
+    return;
+  }
+
+  if (new_position) {
+    new_position->QuadPart = (LONGLONG)position;
+  }
+
+  drwrap_skip_call(wrapcxt, (void *)TRUE, 0);
+}
+
+/**
+ * Answers for the size of the -virtual_file.
+ * GetFileSize(hFile, lpFileSizeHigh)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_GetFileSize(void *wrapcxt, OUT void **user_data) {
+  if (!virtual_handle(drwrap_get_arg(wrapcxt, 0))) {
+    return;
+  }
+
+  DWORD *high = (DWORD *)drwrap_get_arg(wrapcxt, 1);
+
+  if (high) {
+    *high = (DWORD)((uint64_t)virtual_file_size >> 32);
+  }
+
+  drwrap_skip_call(wrapcxt, (void *)(size_t)(DWORD)virtual_file_size, 0);
+}
+
+/**
+ * Answers for the size of the -virtual_file.
+ * GetFileSizeEx(hFile, lpFileSize)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_GetFileSizeEx(void *wrapcxt, OUT void **user_data) {
+  if (!virtual_handle(drwrap_get_arg(wrapcxt, 0))) {
+    return;
+  }
+
+  LARGE_INTEGER *size = (LARGE_INTEGER *)drwrap_get_arg(wrapcxt, 1);
+
+  if (!size) {
+    drwrap_skip_call(wrapcxt, (void *)FALSE, 0);
+    return;
+  }
+
+  size->QuadPart = (LONGLONG)virtual_file_size;
+  drwrap_skip_call(wrapcxt, (void *)TRUE, 0);
+}
+
+/**
+ * Answers that -virtual_file handles are to disk files.
+ * GetFileType(hFile)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_GetFileType(void *wrapcxt, OUT void **user_data) {
+  if (virtual_handle(drwrap_get_arg(wrapcxt, 0))) {
+    drwrap_skip_call(wrapcxt, (void *)FILE_TYPE_DISK, 0);
+  }
+}
+
+static void wrap_pre_ReadFile(void *wrapcxt, OUT void **user_data);
+static void wrap_pre_recv(void *wrapcxt, OUT void **user_data);
+static void wrap_pre_WinHttpReadData(void *wrapcxt, OUT void **user_data);
+static void wrap_post_Generic(void *wrapcxt, void *user_data);
+
+/**
+ * Wraps a read function with its read hook, unless it has targets (and so was wrapped already).
+ * Emulated reads (see -virtual_file and -emulate_peer) are served by the read hooks, so they have
+ * to be wrapped either way.
+ * @param mod the read function's module
+ * @param name the read function
+ * @param pre_hook its read hook
+ */
+static void wrap_emulated_read(const module_data_t *mod, const char *name, sl2_pre_proto pre_hook) {
+  if (client.function_has_targets(name)) {
+    return;
+  }
+
+  app_pc towrap = (app_pc)dr_get_proc_address(mod->handle, name);
+
+  if (!towrap || !drwrap_wrap(towrap, pre_hook, wrap_post_Generic)) {
+    SL2_DR_DEBUG("<FAILED to wrap %s for emulated reads\n", name);
+  }
+}
+
+/**
+ * Wraps KERNELBASE's file functions for -virtual_file. ReadFile is served by its read hook (see
+ * wrap_pre_ReadFile), and CloseHandle by wrap_pre_CloseHandle.
+ * Other functions that take a handle (GetFileInformationByHandle, CreateFileMapping,
+ * DuplicateHandle...) aren't emulated, so they fail on -virtual_file handles.
+ * @param mod KERNELBASE
+ */
+static void wrap_virtual_file_functions(const module_data_t *mod) {
+  static const struct {
+    const char *name;
+    void (*pre_hook)(void *, void **);
+  } functions[] = {
+      {"CreateFileW", wrap_pre_CreateFileW},
+      {"SetFilePointer", wrap_pre_SetFilePointer},
+      {"SetFilePointerEx", wrap_pre_SetFilePointerEx},
+      {"GetFileSize", wrap_pre_GetFileSize},
+      {"GetFileSizeEx", wrap_pre_GetFileSizeEx},
+      {"GetFileType", wrap_pre_GetFileType},
+  };
+
+  for (const auto &function : functions) {
+    app_pc towrap = (app_pc)dr_get_proc_address(mod->handle, function.name);
+
+    if (!towrap || !drwrap_wrap(towrap, function.pre_hook, NULL)) {
+      SL2_DR_DEBUG("<FAILED to wrap %s for -virtual_file\n", function.name);
+    }
+  }
+
+  wrap_emulated_read(mod, "ReadFile", wrap_pre_ReadFile);
+}
+
+/**
+ * Reads the file given by -virtual_file (if any) into memory, so that the target's reads of it
+ * are served from there instead of the disk.
+ * The contents are the real file's, and they're mutated like any other read's, so the
+ * tracer and triage (which read the file from disk) see the same reads as the fuzzer does.
+ */
+static void init_virtual_file() {
+  if (op_virtual_file.get_value() == "") {
+    return;
+  }
+
+  wchar_t name[MAX_PATH + 1];
+  mbstowcs_s(NULL, name, MAX_PATH + 1, op_virtual_file.get_value().c_str(), _TRUNCATE);
+
+  DWORD len = GetFullPathNameW(name, MAX_PATH + 1, virtual_file_path, NULL);
+  HANDLE file = CreateFileW(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (!len || len > MAX_PATH || file == INVALID_HANDLE_VALUE) {
+    SL2_DR_DEBUG("init_virtual_file: couldn't open %s, reading it from disk\n",
+                 op_virtual_file.get_value().c_str());
+    if (file != INVALID_HANDLE_VALUE) {
+      CloseHandle(file);
+    }
+    return;
+  }
+
+  // Reads are targeted by the path that the client sees for them, which is the final
+  // one. See SL2Client::get_handle_path.
+  GetFinalPathNameByHandle(file, virtual_file_final_path, MAX_PATH, FILE_NAME_NORMALIZED);
+
+  LARGE_INTEGER size = {0};
+  DWORD nread = 0;
+
+  if (!GetFileSizeEx(file, &size) || size.QuadPart > MAXDWORD) {
+    SL2_DR_DEBUG("init_virtual_file: %s is too big, reading it from disk\n",
+                 op_virtual_file.get_value().c_str());
+    CloseHandle(file);
+    return;
+  }
+
+  virtual_file_size = (size_t)size.QuadPart;
+  virtual_file_data = (uint8_t *)dr_global_alloc(std::max(virtual_file_size, (size_t)1));
+
+  if (!ReadFile(file, virtual_file_data, (DWORD)virtual_file_size, &nread, NULL) ||
+      nread != virtual_file_size) {
+    SL2_DR_DEBUG("init_virtual_file: couldn't read %s, reading it from disk\n",
+                 op_virtual_file.get_value().c_str());
+    CloseHandle(file);
+    dr_global_free(virtual_file_data, std::max(virtual_file_size, (size_t)1));
+    virtual_file_data = NULL;
+    return;
+  }
+
+  CloseHandle(file);
+  virtual_file_lock = dr_mutex_create();
+
+  SL2_DR_DEBUG("init_virtual_file: serving %s (%llu bytes) from memory\n",
+               op_virtual_file.get_value().c_str(), (uint64_t)virtual_file_size);
+}
+
+/**
+ * Frees the -virtual_file's contents, if we read them.
+ */
+static void exit_virtual_file() {
+  if (!virtual_file_lock) {
+    return;
+  }
+
+  dr_mutex_destroy(virtual_file_lock);
+  virtual_file_lock = NULL;
+  dr_global_free(virtual_file_data, std::max(virtual_file_size, (size_t)1));
+  virtual_file_data = NULL;
+}
+
+/**
+ * @param s a socket that the target passed to a socket function
+ * @return the emulated connection that it is, or NULL if it's a real one
+ */
+static sl2_peer_conn *peer_socket(SOCKET s) {
+  sl2_peer_conn *conn = NULL;
+
+  if (!peer_lock) {
+    return NULL;
+  }
+
+  dr_mutex_lock(peer_lock);
+
+  for (auto &candidate : peer_conns) {
+    if (candidate.open && candidate.kind == SL2_PEER_SOCKET && candidate.socket == s) {
+      conn = &candidate;
+      break;
+    }
+  }
+
+  dr_mutex_unlock(peer_lock);
+
+  return conn;
+}
+
+/**
+ * @param handle a handle that the target passed to a WinHTTP function
+ * @param kind the kind of connection that the function takes
+ * @return the emulated connection that it is, or NULL if it's a real handle
+ */
+static sl2_peer_conn *peer_handle(HINTERNET handle, sl2_peer_kind kind) {
+  if (!peer_lock || (sl2_peer_conn *)handle < peer_conns ||
+      (sl2_peer_conn *)handle >= peer_conns + SL2_PEER_MAX_CONNS) {
+    return NULL;
+  }
+
+  sl2_peer_conn *conn = (sl2_peer_conn *)handle;
+
+  dr_mutex_lock(peer_lock);
+  bool ours = conn->open && conn->kind == kind;
+  dr_mutex_unlock(peer_lock);
+
+  return ours ? conn : NULL;
+}
+
+/**
+ * Opens an emulated connection.
+ * @param kind the kind of connection
+ * @param s the socket, for sockets
+ * @param connect the WinHTTP connection, for requests
+ * @return the connection, or NULL if every one is in use
+ */
+static sl2_peer_conn *open_peer_conn(sl2_peer_kind kind, SOCKET s, sl2_peer_conn *connect) {
+  sl2_peer_conn *conn = NULL;
+
+  dr_mutex_lock(peer_lock);
+
+  for (auto &candidate : peer_conns) {
+    if (!candidate.open) {
+      candidate = {true, kind, s, kind == SL2_PEER_REQUEST ? UINT32_MAX : 0, 0, false, 0, connect};
+      conn = &candidate;
+      break;
+    }
+  }
+
+  dr_mutex_unlock(peer_lock);
+
+  if (!conn) {
+    SL2_DR_DEBUG("<out of -emulate_peer connections>\n");
+  }
+
+  return conn;
+}
+
+/**
+ * @param conn an emulated connection
+ */
+static void close_peer_conn(sl2_peer_conn *conn) {
+  dr_mutex_lock(peer_lock);
+  conn->open = false;
+  dr_mutex_unlock(peer_lock);
+}
+
+/**
+ * Moves a connection on to the next response, once the peer would have sent it. A socket's
+ * responses each answer one of the target's sends (unless they're unprompted), and a WinHTTP
+ * request only gets the one response to it.
+ * Callers must hold peer_lock.
+ * @param conn the connection
+ * @return whether the connection has any bytes to read
+ */
+static bool peer_ready(sl2_peer_conn *conn) {
+  while (conn->response < peer_response_count) {
+    const sl2_peer_response &response = peer_responses[conn->response];
+
+    if (conn->started && conn->offset < response.length) {
+      return true;
+    }
+
+    if (conn->started) {
+      if (conn->kind == SL2_PEER_REQUEST) {
+        return false;
+      }
+
+      conn->response++;
+      conn->offset = 0;
+      conn->started = false;
+    } else if (response.flags & SL2_PEER_UNPROMPTED) {
+      conn->started = true;
+    } else if (conn->pending) {
+      conn->pending--;
+      conn->started = true;
+    } else {
+      return false;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Reads from the peer's responses on an emulated connection. Once the peer has nothing left to
+ * send, reads see it close the connection instead of blocking.
+ * @param conn the connection
+ * @param buf the target's buffer
+ * @param len the size of the target's buffer
+ * @param peek whether to leave the bytes to be read again
+ * @param count receives the number of bytes read
+ * @return whether the bytes could be written to the target's buffer
+ */
+static bool read_peer(sl2_peer_conn *conn, void *buf, size_t len, bool peek, size_t *count) {
+  const uint8_t *data = NULL;
+
+  *count = 0;
+
+  dr_mutex_lock(peer_lock);
+
+  if (peer_ready(conn)) {
+    const sl2_peer_response &response = peer_responses[conn->response];
+
+    data = response.data + conn->offset;
+    *count = std::min(len, (size_t)(response.length - conn->offset));
+
+    if (!peek) {
+      conn->offset += (uint32_t)*count;
+    }
+  }
+
+  dr_mutex_unlock(peer_lock);
+
+  return !*count || dr_safe_write(buf, *count, data, NULL);
+}
+
+/**
+ * @param conn a WinHTTP request
+ * @return the length of its response, or 0 if it has none
+ */
+static uint32_t peer_response_length(sl2_peer_conn *conn) {
+  uint32_t length = 0;
+
+  dr_mutex_lock(peer_lock);
+
+  if (conn->response < peer_response_count) {
+    length = peer_responses[conn->response].length;
+  }
+
+  dr_mutex_unlock(peer_lock);
+
+  return length;
+}
+
+/**
+ * Connects sockets to the -emulate_peer without touching the network. The socket itself is real,
+ * but stays unconnected.
+ * connect(s, name, namelen)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_connect(void *wrapcxt, OUT void **user_data) {
+  SOCKET s = (SOCKET)drwrap_get_arg(wrapcxt, 0);
+  const sockaddr_in *name = (const sockaddr_in *)drwrap_get_arg(wrapcxt, 1);
+#pragma warning(suppress : 4311 4302)
+  int namelen = (int)drwrap_get_arg(wrapcxt, 2);
+
+  if (!peer_addr || !name || namelen < (int)sizeof(sockaddr_in) || name->sin_family != AF_INET ||
+      name->sin_addr.S_un.S_addr != peer_addr || name->sin_port != _byteswap_ushort(peer_port)) {
+    return;
+  }
+
+  if (open_peer_conn(SL2_PEER_SOCKET, s, NULL)) {
+    drwrap_skip_call(wrapcxt, (void *)0, 0);
+  }
+}
+
+/**
+ * Sends to the -emulate_peer, which answers with its next response.
+ * send(s, buf, len, flags)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_send(void *wrapcxt, OUT void **user_data) {
+  sl2_peer_conn *conn = peer_socket((SOCKET)drwrap_get_arg(wrapcxt, 0));
+
+  if (!conn) {
+    return;
+  }
+
+  dr_mutex_lock(peer_lock);
+  conn->pending++;
+  dr_mutex_unlock(peer_lock);
+
+  drwrap_skip_call(wrapcxt, drwrap_get_arg(wrapcxt, 2), 0);
+}
+
+/**
+ * Shuts down emulated connections, which there's nothing to do for.
+ * shutdown(s, how)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_shutdown(void *wrapcxt, OUT void **user_data) {
+  if (peer_socket((SOCKET)drwrap_get_arg(wrapcxt, 0))) {
+    drwrap_skip_call(wrapcxt, (void *)0, 0);
+  }
+}
+
+/**
+ * Forgets emulated connections as their sockets are closed. The real closesocket still runs.
+ * closesocket(s)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_closesocket(void *wrapcxt, OUT void **user_data) {
+  sl2_peer_conn *conn = peer_socket((SOCKET)drwrap_get_arg(wrapcxt, 0));
+
+  if (conn) {
+    close_peer_conn(conn);
+  }
+}
+
+/**
+ * Connects to the -emulate_peer over WinHTTP without touching the network.
+ * WinHttpConnect(hSession, pswzServerName, nServerPort, dwReserved)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_WinHttpConnect(void *wrapcxt, OUT void **user_data) {
+  const wchar_t *name = (const wchar_t *)drwrap_get_arg(wrapcxt, 1);
+#pragma warning(suppress : 4311 4302)
+  INTERNET_PORT port = (INTERNET_PORT)drwrap_get_arg(wrapcxt, 2);
+
+  if (!peer_lock || !name || _wcsicmp(name, peer_host) ||
+      (port != peer_port && port != INTERNET_DEFAULT_PORT)) {
+    return;
+  }
+
+  sl2_peer_conn *conn = open_peer_conn(SL2_PEER_CONNECT, INVALID_SOCKET, NULL);
+
+  if (conn) {
+    drwrap_skip_call(wrapcxt, conn, 0);
+  }
+}
+
+/**
+ * Opens requests on emulated WinHTTP connections.
+ * WinHttpOpenRequest(hConnect, pwszVerb, pwszObjectName, pwszVersion, pwszReferrer,
+ *                    ppwszAcceptTypes, dwFlags)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_WinHttpOpenRequest(void *wrapcxt, OUT void **user_data) {
+  sl2_peer_conn *connect = peer_handle(drwrap_get_arg(wrapcxt, 0), SL2_PEER_CONNECT);
+
+  if (connect) {
+    drwrap_skip_call(wrapcxt, open_peer_conn(SL2_PEER_REQUEST, INVALID_SOCKET, connect), 0);
+  }
+}
+
+/**
+ * Sends emulated WinHTTP requests, each of which is answered by the connection's next response.
+ * WinHttpSendRequest(hRequest, lpszHeaders, dwHeadersLength, lpOptional, dwOptionalLength,
+ *                    dwTotalLength, dwContext)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_WinHttpSendRequest(void *wrapcxt, OUT void **user_data) {
+  sl2_peer_conn *conn = peer_handle(drwrap_get_arg(wrapcxt, 0), SL2_PEER_REQUEST);
+
+  if (!conn) {
+    return;
+  }
+
+  dr_mutex_lock(peer_lock);
+  conn->response = conn->connect->response++;
+  conn->offset = 0;
+  conn->started = true;
+  dr_mutex_unlock(peer_lock);
+
+  drwrap_skip_call(wrapcxt, (void *)TRUE, 0);
+}
+
+/**
+ * Sends request bodies on emulated WinHTTP requests.
+ * WinHttpWriteData(hRequest, lpBuffer, dwNumberOfBytesToWrite, lpdwNumberOfBytesWritten)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_WinHttpWriteData(void *wrapcxt, OUT void **user_data) {
+  if (!peer_handle(drwrap_get_arg(wrapcxt, 0), SL2_PEER_REQUEST)) {
+    return;
+  }
+
+  DWORD *written = (DWORD *)drwrap_get_arg(wrapcxt, 3);
+
+  if (written) {
+#pragma warning(suppress : 4311 4302)
+    *written = (DWORD)drwrap_get_arg(wrapcxt, 2);
+  }
+
+  drwrap_skip_call(wrapcxt, (void *)TRUE, 0);
+}
+
+/**
+ * Answers for how much of an emulated WinHTTP response is left to read.
+ * WinHttpQueryDataAvailable(hRequest, lpdwNumberOfBytesAvailable)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_WinHttpQueryDataAvailable(void *wrapcxt, OUT void **user_data) {
+  sl2_peer_conn *conn = peer_handle(drwrap_get_arg(wrapcxt, 0), SL2_PEER_REQUEST);
+
+  if (!conn) {
+    return;
+  }
+
+  DWORD *available = (DWORD *)drwrap_get_arg(wrapcxt, 1);
+
+  dr_mutex_lock(peer_lock);
+  DWORD left = peer_ready(conn) ? peer_responses[conn->response].length - conn->offset : 0;
+  dr_mutex_unlock(peer_lock);
+
+  if (available) {
+    *available = left;
+  }
+
+  drwrap_skip_call(wrapcxt, (void *)TRUE, 0);
+}
+
+/**
+ * Answers for the headers of emulated WinHTTP responses: a 200 status code and the response's
+ * length. Every other header is missing.
+ * WinHttpQueryHeaders(hRequest, dwInfoLevel, pwszName, lpBuffer, lpdwBufferLength, lpdwIndex)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_WinHttpQueryHeaders(void *wrapcxt, OUT void **user_data) {
+  sl2_peer_conn *conn = peer_handle(drwrap_get_arg(wrapcxt, 0), SL2_PEER_REQUEST);
+
+  if (!conn) {
+    return;
+  }
+
+#pragma warning(suppress : 4311 4302)
+  DWORD level = (DWORD)drwrap_get_arg(wrapcxt, 1);
+  void *buffer = drwrap_get_arg(wrapcxt, 3);
+  DWORD *buffer_len = (DWORD *)drwrap_get_arg(wrapcxt, 4);
+  DWORD value;
+
+  switch (level & WINHTTP_QUERY_HEADER_MASK) {
+  case WINHTTP_QUERY_STATUS_CODE:
+    value = HTTP_STATUS_OK;
+    break;
+  case WINHTTP_QUERY_CONTENT_LENGTH:
+    value = peer_response_length(conn);
+    break;
+  default:
+    drwrap_skip_call(wrapcxt, (void *)FALSE, 0);
+    return;
+  }
+
+  wchar_t text[16];
+  DWORD size = sizeof(value);
+
+  if (!(level & WINHTTP_QUERY_FLAG_NUMBER)) {
+    size = (DWORD)(_snwprintf_s(text, _TRUNCATE, L"%lu", value) * sizeof(wchar_t));
+  }
+
+  // Like WinHTTP, strings are measured without their NUL, but need room for it.
+  if (!buffer_len || !buffer ||
+      *buffer_len < size + ((level & WINHTTP_QUERY_FLAG_NUMBER) ? 0 : sizeof(wchar_t))) {
+    if (buffer_len) {
+      *buffer_len = size + ((level & WINHTTP_QUERY_FLAG_NUMBER) ? 0 : sizeof(wchar_t));
+    }
+    drwrap_skip_call(wrapcxt, (void *)FALSE, 0);
+    return;
+  }
+
+  if (level & WINHTTP_QUERY_FLAG_NUMBER) {
+    memcpy(buffer, &value, sizeof(value));
+  } else {
+    memcpy(buffer, text, size + sizeof(wchar_t));
+  }
+
+  *buffer_len = size;
+  drwrap_skip_call(wrapcxt, (void *)TRUE, 0);
+}
+
+/**
+ * Succeeds, without doing anything, for calls that only tune emulated WinHTTP requests or wait
+ * for their responses (WinHttpReceiveResponse, WinHttpAddRequestHeaders, WinHttpSetOption and
+ * WinHttpSetTimeouts).
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_WinHttpNothing(void *wrapcxt, OUT void **user_data) {
+  HINTERNET handle = drwrap_get_arg(wrapcxt, 0);
+
+  if (peer_handle(handle, SL2_PEER_REQUEST) || peer_handle(handle, SL2_PEER_CONNECT)) {
+    drwrap_skip_call(wrapcxt, (void *)TRUE, 0);
+  }
+}
+
+/**
+ * Closes emulated WinHTTP connections and requests.
+ * WinHttpCloseHandle(hInternet)
+ * @param wrapcxt - Wrapping context for drwrap
+ * @param user_data - unused
+ */
+static void wrap_pre_WinHttpCloseHandle(void *wrapcxt, OUT void **user_data) {
+  HINTERNET handle = drwrap_get_arg(wrapcxt, 0);
+  sl2_peer_conn *conn = peer_handle(handle, SL2_PEER_REQUEST);
+
+  if (!conn) {
+    conn = peer_handle(handle, SL2_PEER_CONNECT);
+  }
+
+  if (conn) {
+    close_peer_conn(conn);
+    drwrap_skip_call(wrapcxt, (void *)TRUE, 0);
+  }
+}
+
+/**
+ * Wraps the socket or WinHTTP functions that -emulate_peer emulates, in their module. Reads are
+ * served by their read hooks (see wrap_pre_recv and wrap_pre_WinHttpReadData).
+ * Only blocking calls are emulated: overlapped sockets (WSARecv, WSASend...),
+ * select() and asynchronous WinHTTP sessions still go to the real (unconnected) objects.
+ * @param mod WS2_32 or WINHTTP
+ */
+static void wrap_peer_functions(const module_data_t *mod) {
+  static const struct {
+    const char *module;
+    const char *name;
+    void (*pre_hook)(void *, void **);
+  } functions[] = {
+      {"WS2_32.DLL", "connect", wrap_pre_connect},
+      {"WS2_32.DLL", "send", wrap_pre_send},
+      {"WS2_32.DLL", "shutdown", wrap_pre_shutdown},
+      {"WS2_32.DLL", "closesocket", wrap_pre_closesocket},
+      {"WINHTTP.DLL", "WinHttpConnect", wrap_pre_WinHttpConnect},
+      {"WINHTTP.DLL", "WinHttpOpenRequest", wrap_pre_WinHttpOpenRequest},
+      {"WINHTTP.DLL", "WinHttpSendRequest", wrap_pre_WinHttpSendRequest},
+      {"WINHTTP.DLL", "WinHttpWriteData", wrap_pre_WinHttpWriteData},
+      {"WINHTTP.DLL", "WinHttpReceiveResponse", wrap_pre_WinHttpNothing},
+      {"WINHTTP.DLL", "WinHttpAddRequestHeaders", wrap_pre_WinHttpNothing},
+      {"WINHTTP.DLL", "WinHttpSetOption", wrap_pre_WinHttpNothing},
+      {"WINHTTP.DLL", "WinHttpSetTimeouts", wrap_pre_WinHttpNothing},
+      {"WINHTTP.DLL", "WinHttpQueryDataAvailable", wrap_pre_WinHttpQueryDataAvailable},
+      {"WINHTTP.DLL", "WinHttpQueryHeaders", wrap_pre_WinHttpQueryHeaders},
+      {"WINHTTP.DLL", "WinHttpCloseHandle", wrap_pre_WinHttpCloseHandle},
+  };
+
+  const char *mod_name = dr_module_preferred_name(mod);
+
+  for (const auto &function : functions) {
+    if (!STREQI(mod_name, function.module)) {
+      continue;
+    }
+
+    app_pc towrap = (app_pc)dr_get_proc_address(mod->handle, function.name);
+
+    if (!towrap || !drwrap_wrap(towrap, function.pre_hook, NULL)) {
+      SL2_DR_DEBUG("<FAILED to wrap %s for -emulate_peer\n", function.name);
+    }
+  }
+
+  if (STREQI(mod_name, "WS2_32.DLL")) {
+    wrap_emulated_read(mod, "recv", wrap_pre_recv);
+  } else {
+    wrap_emulated_read(mod, "WinHttpReadData", wrap_pre_WinHttpReadData);
+  }
+}
+
+/**
+ * @param buf an IPv4 address, in dotted-decimal form
+ * @param addr receives the address, in network byte order
+ * @return whether the address could be parsed
+ */
+static bool parse_ipv4(const char *buf, uint32_t *addr) {
+  unsigned int octets[4];
+  char tail;
+
+  if (sscanf_s(buf, "%u.%u.%u.%u%c", &octets[0], &octets[1], &octets[2], &octets[3], &tail, 1) !=
+      4) {
+    return false;
+  }
+
+  *addr = 0;
+
+  for (int i = 0; i < 4; i++) {
+    if (octets[i] > 0xFF) {
+      return false;
+    }
+
+    *addr |= octets[i] << (8 * i);
+  }
+
+  return true;
+}
+
+/**
+ * Reads the responses out of a -peer_script: its magic, version and response count (u32s), and
+ * its responses, each of which is its flags and length (u32s) and its bytes.
+ * @param buf the response script
+ * @param size the response script's size
+ * @return whether the response script is well-formed
+ */
+static bool parse_peer_script(const uint8_t *buf, size_t size) {
+  uint32_t version, count;
+
+  if (size < 12 || memcmp(buf, SL2_PEER_MAGIC, 4)) {
+    return false;
+  }
+
+  memcpy(&version, buf + 4, sizeof(version));
+  memcpy(&count, buf + 8, sizeof(count));
+
+  if (version != SL2_PEER_VERSION || count > SL2_PEER_MAX_RESPONSES) {
+    return false;
+  }
+
+  size_t offset = 12;
+
+  for (uint32_t i = 0; i < count; i++) {
+    sl2_peer_response &response = peer_responses[i];
+
+    if (size - offset < 8) {
+      return false;
+    }
+
+    memcpy(&response.flags, buf + offset, sizeof(response.flags));
+    memcpy(&response.length, buf + offset + 4, sizeof(response.length));
+    offset += 8;
+
+    if (size - offset < response.length) {
+      return false;
+    }
+
+    response.data = buf + offset;
+    offset += response.length;
+  }
+
+  peer_response_count = count;
+  return true;
+}
+
+/**
+ * Maps the -peer_script for -emulate_peer (if it was given).
+ */
+static void init_peer() {
+  if (op_emulate_peer.get_value() == "") {
+    return;
+  }
+
+  std::string endpoint = op_emulate_peer.get_value();
+  size_t colon = endpoint.rfind(':');
+  unsigned long port = colon == std::string::npos ? 0 : strtoul(&endpoint[colon + 1], NULL, 10);
+
+  if (!colon || colon == std::string::npos || !port || port > 0xFFFF ||
+      op_peer_script.get_value() == "") {
+    SL2_DR_DEBUG("ERROR: -emulate_peer takes host:port, and needs a -peer_script\n");
+    dr_abort();
+  }
+
+  std::string host = endpoint.substr(0, colon);
+  mbstowcs_s(NULL, peer_host, MAX_PATH + 1, host.c_str(), _TRUNCATE);
+  peer_port = (uint16_t)port;
+
+  if (!parse_ipv4(host.c_str(), &peer_addr)) {
+    SL2_DR_DEBUG("init_peer: %s isn't an IPv4 address, only emulating WinHTTP connections\n",
+                 host.c_str());
+  }
+
+  file_t file = dr_open_file(op_peer_script.get_value().c_str(), DR_FILE_READ);
+  uint64 file_size = 0;
+
+  if (file == INVALID_FILE) {
+    SL2_DR_DEBUG("init_peer: couldn't open %s, not emulating the peer\n",
+                 op_peer_script.get_value().c_str());
+    return;
+  }
+
+  if (dr_file_size(file, &file_size) && file_size > 0) {
+    peer_script_view_size = (size_t)file_size;
+    peer_script_view =
+        dr_map_file(file, &peer_script_view_size, 0, NULL, DR_MEMPROT_READ, DR_MAP_PRIVATE);
+  }
+
+  dr_close_file(file);
+
+  if (peer_script_view == NULL) {
+    SL2_DR_DEBUG("init_peer: couldn't map %s, not emulating the peer\n",
+                 op_peer_script.get_value().c_str());
+    return;
+  }
+
+  if (!parse_peer_script((uint8_t *)peer_script_view, (size_t)file_size)) {
+    SL2_DR_DEBUG("init_peer: malformed response script, not emulating the peer\n");
+    dr_unmap_file(peer_script_view, peer_script_view_size);
+    peer_script_view = NULL;
+    return;
+  }
+
+  peer_lock = dr_mutex_create();
+
+  SL2_DR_DEBUG("init_peer: emulating %s with %u responses\n", endpoint.c_str(),
+               peer_response_count);
+}
+
+/**
+ * Unmaps the -peer_script, if we mapped one.
+ */
+static void exit_peer() {
+  if (peer_script_view == NULL) {
+    return;
+  }
+
+  if (peer_lock) {
+    dr_mutex_destroy(peer_lock);
+    peer_lock = NULL;
+  }
+
+  dr_unmap_file(peer_script_view, peer_script_view_size);
+  peer_script_view = NULL;
+}
+
+/**
+ * Reads the targets out of a -directed table: its magic, version and target count (u32s), and its
+ * targets (see sl2_directed_target), which are grouped by module.
+ * @param buf the target table
+ * @param size the target table's size
+ * @return whether the target table is well-formed
+ */
+static bool parse_directed_table(const uint8_t *buf, size_t size) {
+  uint32_t version, count;
+
+  if (size < 12 || memcmp(buf, SL2_DIRECTED_MAGIC, 4)) {
+    return false;
+  }
+
+  memcpy(&version, buf + 4, sizeof(version));
+  memcpy(&count, buf + 8, sizeof(count));
+
+  if (version != SL2_DIRECTED_VERSION || count > SL2_DIRECTED_MAX_TARGETS ||
+      size - 12 < count * sizeof(sl2_directed_target)) {
+    return false;
+  }
+
+  const sl2_directed_target *targets = (const sl2_directed_target *)(buf + 12);
+
+  for (uint32_t i = 0; i < count; i++) {
+    const sl2_directed_target &target = targets[i];
+
+    if (!memchr(target.module, '\0', sizeof(target.module))) {
+      return false;
+    }
+
+    sl2_directed_module *module = NULL;
+    for (uint32_t j = 0; j < directed_module_count && !module; j++) {
+      if (STREQI(directed_modules[j].name, target.module)) {
+        module = &directed_modules[j];
+      }
+    }
+
+    if (!module) {
+      if (directed_module_count == SL2_DIRECTED_MAX_MODULES) {
+        return false;
+      }
+
+      module = &directed_modules[directed_module_count++];
+      module->name = target.module;
+    }
+
+    module->offsets.push_back(target.offset);
+  }
+
+  for (uint32_t i = 0; i < directed_module_count; i++) {
+    std::sort(directed_modules[i].offsets.begin(), directed_modules[i].offsets.end());
+  }
+
+  return true;
+}
+
+/**
+ * Maps the -directed target table (if it was given).
+ */
+static void init_directed() {
+  if (op_directed.get_value() == "") {
+    return;
+  }
+
+  file_t file = dr_open_file(op_directed.get_value().c_str(), DR_FILE_READ);
+  uint64 file_size = 0;
+
+  if (file == INVALID_FILE) {
+    SL2_DR_DEBUG("init_directed: couldn't open %s, not directing the run\n",
+                 op_directed.get_value().c_str());
+    return;
+  }
+
+  if (dr_file_size(file, &file_size) && file_size > 0) {
+    directed_view_size = (size_t)file_size;
+    directed_view =
+        dr_map_file(file, &directed_view_size, 0, NULL, DR_MEMPROT_READ, DR_MAP_PRIVATE);
+  }
+
+  dr_close_file(file);
+
+  if (directed_view == NULL) {
+    SL2_DR_DEBUG("init_directed: couldn't map %s, not directing the run\n",
+                 op_directed.get_value().c_str());
+    return;
+  }
+
+  if (!parse_directed_table((uint8_t *)directed_view, (size_t)file_size)) {
+    SL2_DR_DEBUG("init_directed: malformed target table, not directing the run\n");
+
+    for (uint32_t i = 0; i < directed_module_count; i++) {
+      directed_modules[i] = sl2_directed_module();
+    }
+
+    directed_module_count = 0;
+    dr_unmap_file(directed_view, directed_view_size);
+    directed_view = NULL;
+  }
+}
+
+/**
+ * Unmaps the -directed target table.
+ */
+static void exit_directed() {
+  if (directed_view == NULL) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < directed_module_count; i++) {
+    directed_modules[i] = sl2_directed_module();
+  }
+
+  directed_module_count = 0;
+  dr_unmap_file(directed_view, directed_view_size);
+  directed_view = NULL;
+}
+
+/**
+ * Keeps track of where the modules that hold -directed targets are loaded.
+ * A module is loaded before any of its blocks are built, so note_directed_block never
+ * sees it half-filled in.
+ * @param mod the module that was loaded or unloaded
+ * @param loaded whether it was loaded
+ */
+static void track_directed_module(const module_data_t *mod, bool loaded) {
+  const char *mod_name = dr_module_preferred_name(mod);
+
+  for (uint32_t i = 0; mod_name && i < directed_module_count; i++) {
+    sl2_directed_module &module = directed_modules[i];
+
+    if (STREQI(module.name, mod_name)) {
+      module.end = loaded ? mod->end : NULL;
+      module.start = loaded ? mod->start : NULL;
+    }
+  }
+}
+
+/**
+ * Adds a block that the run hit to its distance from the -directed targets: the distance, in
+ * bytes, from the block to the nearest target in its module, as a log2 bucket (0 for a block
+ * that holds a target). Blocks outside the directed modules don't count.
+ * Without a control flow graph (DR only sees blocks as they're first run), distance in
+ * the module's address space stands in for distance in its call graph: the blocks of a targeted
+ * function, and of the functions laid out around it, come closest. Like -hit_once, this relies on
+ * DR building a block just before it first runs it.
+ * @param bb the block
+ * @param start_pc the block's first address
+ */
+static void note_directed_block(instrlist_t *bb, app_pc start_pc) {
+  for (uint32_t i = 0; i < directed_module_count; i++) {
+    sl2_directed_module &module = directed_modules[i];
+
+    if (!module.start || start_pc < module.start || start_pc >= module.end) {
+      continue;
+    }
+
+    instr_t *last = instrlist_last_app(bb);
+    uint64_t first = (uint64_t)(start_pc - module.start);
+    uint64_t end = (last ? (uint64_t)(instr_get_app_pc(last) - module.start) : first) + 1;
+
+    // The nearest targets either side of the block
+    std::vector<uint32_t>::const_iterator after =
+        std::lower_bound(module.offsets.begin(), module.offsets.end(), first);
+    uint64_t bytes = UINT64_MAX;
+
+    if (after != module.offsets.end()) {
+      bytes = *after < end ? 0 : *after - end + 1;
+    }
+
+    if (after != module.offsets.begin()) {
+      bytes = std::min(bytes, first - *(after - 1));
+    }
+
+    uint32_t bucket = 0;
+    while (bucket < 64 && (bytes >> bucket)) {
+      bucket++;
+    }
+
+    InterlockedExchangeAdd64(&directed_distance_total, bucket);
+    InterlockedIncrement64(&directed_blocks);
+    return;
+  }
+}
+
+/**
+ * @return the run's distance from the -directed targets (see SL2_DISTANCE_NONE)
+ */
+static uint32_t directed_distance() {
+  if (!directed_blocks) {
+    return SL2_DISTANCE_NONE;
+  }
+
+  return (uint32_t)(directed_distance_total * SL2_DISTANCE_SCALE / directed_blocks);
+}
+
+/**
+ * Adds a thread's coverage map into the global arena, saturating each counter at 255
+ * so that a hit location can never wrap back to looking unhit. Counters past the end of the
+ * arena's map (see on_bb_instrument) wrap around to its start.
+ * Callers must hold thread_maps_lock.
+ * @param map the thread's coverage map
+ */
+static void merge_thread_map(sl2_arena *into, uint8_t *map) {
+  const uint32_t mask = into->size - 1;
+
+  for (uint32_t i = 0; i < thread_map_size; ++i) {
+    uint32_t sum = into->map[i & mask] + map[i];
+    into->map[i & mask] = (uint8_t)min(sum, 0xFF);
+  }
+}
+
+/**
+ * Classifies an arena's hit counts into their buckets before it's sent to the server (see
+ * SL2_BUCKET_FLOOR), under -no_raw_counts, so that the server's path hash and novelty check see
+ * buckets rather than exact counts. Only the map's nonzero words are looked at, since most runs
+ * touch few of them.
+ * @param classified the arena to classify
+ */
+static void classify_counts(sl2_arena *classified) {
+  if (op_raw_counts.get_value()) {
+    return;
+  }
+
+  uint64_t *words = (uint64_t *)classified->map;
+
+  for (size_t i = 0; i < classified->size / sizeof(*words); ++i) {
+    if (!words[i]) {
+      continue;
+    }
+
+    uint8_t *cells = (uint8_t *)&(words[i]);
+    for (size_t j = 0; j < sizeof(*words); ++j) {
+      cells[j] = bucket_floor[cells[j]];
+    }
+  }
+}
+
+/**
+ * Merges every live thread's coverage map into the global arena, then clears them.
+ * Threads that are still running can race with the clear and lose a few
+ * counts; that's fine, since we only call this between runs (or iterations).
+ */
+static void merge_thread_maps() {
+  dr_mutex_lock(thread_maps_lock);
+
+  for (uint8_t *map : thread_maps) {
+    merge_thread_map(arena, map);
+    memset(map, 0, thread_map_size);
+  }
+
+  dr_mutex_unlock(thread_maps_lock);
+}
+
+/**
+ * Gives each new thread a private coverage map, so that threads don't fight over (or drop
+ * increments to) the global arena's cache lines.
+ */
+static void on_thread_init(void *drcontext) {
+  uint8_t *map = (uint8_t *)sl2_global_alloc(thread_map_size);
+  memset(map, 0, thread_map_size);
+
+  dr_mutex_lock(thread_maps_lock);
+  thread_maps.push_back(map);
+  dr_mutex_unlock(thread_maps_lock);
+
+  drmgr_set_tls_field(drcontext, thread_map_idx, map);
+}
+
+/**
+ * Merges an exiting thread's coverage map into the global arena and frees it.
+ */
+static void on_thread_exit(void *drcontext) {
+  uint8_t *map = (uint8_t *)drmgr_get_tls_field(drcontext, thread_map_idx);
+
+  dr_mutex_lock(thread_maps_lock);
+
+  // on_dr_exit may have already merged and freed this thread's map.
+  auto it = std::find(thread_maps.begin(), thread_maps.end(), map);
+  if (it != thread_maps.end()) {
+    merge_thread_map(arena, map);
+    thread_maps.erase(it);
+    dr_global_free(map, thread_map_size);
+  }
+
+  dr_mutex_unlock(thread_maps_lock);
+
+  drmgr_set_tls_field(drcontext, thread_map_idx, NULL);
+}
+
+/**
+ * Fills in the next_count table, and sets up anything else that our instrumentation needs.
+ * The arena (and so its size) must be settled first.
+ * @param never_zero whether counters skip 0 when they wrap
+ */
+static void init_coverage_instrumentation(bool never_zero) {
+  // An edge index is at most offset + (offset >> 1), for an offset into the map.
+  thread_map_size = op_edge_coverage.get_value() ? arena->size + arena->size / 2 : arena->size;
+
+  for (uint32_t i = 0; i < 256; ++i) {
+    next_count[i] = (uint8_t)(i + 1);
+  }
+
+  if (never_zero) {
+    next_count[255] = 1;
+  }
+
+  for (uint32_t i = 0; i < 256; ++i) {
+    bucket_floor[i] = (uint8_t)SL2_BUCKET_FLOOR(i);
+  }
+
+  if (op_edge_coverage.get_value() && !dr_raw_tls_calloc(&prev_loc_seg, &prev_loc_offs, 1, 0)) {
+    DR_ASSERT(false);
+  }
+
+  thread_maps_lock = dr_mutex_create();
+  thread_map_idx = drmgr_register_tls_field();
+
+  if (thread_map_idx == -1 || !drmgr_register_thread_init_event(on_thread_init) ||
+      !drmgr_register_thread_exit_event(on_thread_exit)) {
+    DR_ASSERT(false);
+  }
+
+#ifndef X64
+  drreg_init_and_fill_vector(&byte_regs, false);
+  drreg_set_vector_entry(&byte_regs, DR_REG_XAX, true);
+  drreg_set_vector_entry(&byte_regs, DR_REG_XBX, true);
+  drreg_set_vector_entry(&byte_regs, DR_REG_XCX, true);
+  drreg_set_vector_entry(&byte_regs, DR_REG_XDX, true);
+#endif
+}
+
+/**
+ * Tears down whatever init_coverage_instrumentation set up.
+ */
+static void exit_coverage_instrumentation() {
+  if (op_edge_coverage.get_value()) {
+    dr_raw_tls_cfree(prev_loc_offs, 1);
+  }
+
+  drmgr_unregister_thread_init_event(on_thread_init);
+  drmgr_unregister_thread_exit_event(on_thread_exit);
+  drmgr_unregister_tls_field(thread_map_idx);
+
+  for (uint8_t *map : thread_maps) {
+    dr_global_free(map, thread_map_size);
+  }
+  thread_maps.clear();
+
+  if (local_arena.map) {
+    dr_global_free(local_arena.map, local_arena.size);
+    local_arena.map = NULL;
+  }
+
+  dr_mutex_destroy(thread_maps_lock);
+
+#ifndef X64
+  drvector_delete(&byte_regs);
+#endif
+}
+
+/**
+ * Inserts an increment of a single coverage counter before `inst`. When the arithmetic flags are
+ * dead we use a plain `inc` (or `add`/`adc` for never-zero counters); when they're live, we look
+ * the next value up in next_count with `mov`s instead of saving and restoring the flags.
+ * @param counter a memory operand for the counter
+ */
+static void insert_counter_update(void *drcontext, instrlist_t *bb, instr_t *inst,
+                                  opnd_t counter) {
+  bool flags_dead = false;
+
+  if (drreg_are_aflags_dead(drcontext, inst, &flags_dead) == DRREG_SUCCESS && flags_dead) {
+    drreg_reserve_aflags(drcontext, bb, inst);
+
+    if (op_never_zero.get_value()) {
+      instrlist_meta_preinsert(bb, inst,
+                               INSTR_CREATE_add(drcontext, counter, OPND_CREATE_INT8(1)));
+      instrlist_meta_preinsert(bb, inst,
+                               INSTR_CREATE_adc(drcontext, counter, OPND_CREATE_INT8(0)));
+    } else {
+      instrlist_meta_preinsert(bb, inst, INSTR_CREATE_inc(drcontext, counter));
+    }
+
+    drreg_unreserve_aflags(drcontext, bb, inst);
+    return;
+  }
+
+  reg_id_t table, count;
+  drvector_t *allowed = NULL;
+
+#ifndef X64
+  allowed = &byte_regs;
+#endif
+
+  if (drreg_reserve_register(drcontext, bb, inst, NULL, &table) != DRREG_SUCCESS ||
+      drreg_reserve_register(drcontext, bb, inst, allowed, &count) != DRREG_SUCCESS) {
+    DR_ASSERT(false);
+  }
+
+  reg_id_t count32 = reg_resize_to_opsz(count, OPSZ_4);
+
+  instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t)next_count, opnd_create_reg(table), bb,
+                                   inst, NULL, NULL);
+  instrlist_meta_preinsert(bb, inst,
+                           INSTR_CREATE_movzx(drcontext, opnd_create_reg(count32), counter));
+  instrlist_meta_preinsert(
+      bb, inst,
+      INSTR_CREATE_movzx(drcontext, opnd_create_reg(count32),
+                         opnd_create_base_disp(table, count, 1, 0, OPSZ_1)));
+  instrlist_meta_preinsert(
+      bb, inst,
+      INSTR_CREATE_mov_st(drcontext, counter,
+                          opnd_create_reg(reg_resize_to_opsz(count, OPSZ_1))));
+
+  drreg_unreserve_register(drcontext, bb, inst, count);
+  drreg_unreserve_register(drcontext, bb, inst, table);
+}
+
+/**
+ * Instruments each basic block to insert instructions that update the current thread's coverage
+ * map, which gets merged into the arena when the thread exits. In edge mode, the counter for the
+ * edge from the previous block is updated instead: like AFL, the previous location is kept
+ * shifted right by one in TLS, so that A->B and B->A hit different counters.
+ * Edges are combined with `lea` rather than XORed, so that the index can be computed
+ * without touching the flags. Instead of being masked, indices that run past the end of the map
+ * land in the extra room at the end of each thread's map, and wrap around when it's merged (see
+ * merge_thread_map), which works for every map size.
+ * @return DynamoRIO flags indicating return code
+ */
+static dr_emit_flags_t on_bb_instrument(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                                        bool for_trace, bool translating, void *user_data) {
+  app_pc start_pc;
+  uint32_t offset;
+
+  if (!coverage_armed || !drmgr_is_first_instr(drcontext, inst)) {
+    return DR_EMIT_DEFAULT;
+  }
+
+  SL2_PROFILE(SL2_PROBE_BB_INSTRUMENT);
+
+  start_pc = dr_fragment_app_pc(tag);
+  app_pc base_pc = get_base_pc(start_pc);
+
+  if (!base_pc) {
+    return DR_EMIT_DEFAULT;
+  }
+
+  offset = (uint32_t)((start_pc - base_pc) & (arena->size - 1));
+
+  if (directed_module_count && !for_trace && !translating) {
+    note_directed_block(bb, start_pc);
+  }
+
+  // DR builds a block just before it first runs it, so a block that's been built has
+  // been hit. It goes into the map of whichever thread built it, but the maps are all merged.
+  if (op_hit_once.get_value()) {
+    uint8_t *map = (uint8_t *)drmgr_get_tls_field(drcontext, thread_map_idx);
+
+    if (map && !translating) {
+      map[offset] = 1;
+    }
+
+    return DR_EMIT_DEFAULT;
+  }
+
+  if (!op_edge_coverage.get_value()) {
+    reg_id_t map;
+
+    if (drreg_reserve_register(drcontext, bb, inst, NULL, &map) != DRREG_SUCCESS) {
+      DR_ASSERT(false);
+    }
+
+    drmgr_insert_read_tls_field(drcontext, thread_map_idx, bb, inst, map);
+    insert_counter_update(drcontext, bb, inst, OPND_CREATE_MEM8(map, offset));
+
+    drreg_unreserve_register(drcontext, bb, inst, map);
+    return DR_EMIT_DEFAULT;
+  }
+
+  reg_id_t index, base;
+  opnd_t prev_loc = opnd_create_far_base_disp(prev_loc_seg, DR_REG_NULL, DR_REG_NULL, 0,
+                                              prev_loc_offs, OPSZ_PTR);
+
+  if (drreg_reserve_register(drcontext, bb, inst, NULL, &index) != DRREG_SUCCESS ||
+      drreg_reserve_register(drcontext, bb, inst, NULL, &base) != DRREG_SUCCESS) {
+    DR_ASSERT(false);
+  }
+
+  // index = prev_loc + offset
+  instrlist_meta_preinsert(bb, inst,
+                           INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(index), prev_loc));
+  instrlist_meta_preinsert(
+      bb, inst,
+      INSTR_CREATE_lea(drcontext, opnd_create_reg(index),
+                       OPND_CREATE_MEM_lea(index, DR_REG_NULL, 0, offset)));
+
+  // prev_loc = offset >> 1
+  instrlist_meta_preinsert(
+      bb, inst, INSTR_CREATE_mov_st(drcontext, prev_loc, OPND_CREATE_INT32(offset >> 1)));
+
+  // index = &map[index]
+  drmgr_insert_read_tls_field(drcontext, thread_map_idx, bb, inst, base);
+  instrlist_meta_preinsert(bb, inst,
+                           INSTR_CREATE_lea(drcontext, opnd_create_reg(index),
+                                            OPND_CREATE_MEM_lea(base, index, 1, 0)));
+
+  drreg_unreserve_register(drcontext, bb, inst, base);
+
+  insert_counter_update(drcontext, bb, inst, OPND_CREATE_MEM8(index, 0));
+
+  drreg_unreserve_register(drcontext, bb, inst, index);
+
+  return DR_EMIT_DEFAULT;
+}
+
+/**
+ * @param pc an address in a module
+ * @return whether the address follows a call instruction, i.e. whether it could be a return address
+ */
+static bool follows_call(app_pc pc) {
+  uint8_t before[7];
+
+  if (!dr_safe_read(pc - sizeof(before), sizeof(before), before, NULL)) {
+    return false;
+  }
+
+  // call rel32
+  if (before[2] == 0xE8) {
+    return true;
+  }
+
+  // call r/m (FF /2), by the length of its operand: a register, [reg+disp8] (with and without a
+  // SIB byte), and [reg+disp32] or [rip+disp32] (with and without a SIB byte)
+  uint8_t m2 = before[6], m3 = before[5], m4 = before[4], m6 = before[2], m7 = before[1];
+
+  return (before[5] == 0xFF && (m2 & 0x38) == 0x10 && (m2 >> 6) == 3) ||
+         (before[4] == 0xFF && (m3 & 0x38) == 0x10 && (m3 >> 6) == 1 && (m3 & 7) != 4) ||
+         (before[3] == 0xFF && (m4 & 0x38) == 0x10 && (m4 >> 6) == 1 && (m4 & 7) == 4) ||
+         (before[1] == 0xFF && (m6 & 0x38) == 0x10 && (m6 & 7) != 4 &&
+          ((m6 >> 6) == 2 || (m6 & 0xC7) == 0x05)) ||
+         (before[0] == 0xFF && (m7 & 0x38) == 0x10 && (m7 >> 6) == 2 && (m7 & 7) == 4);
+}
+
+/**
+ * Hashes the first few return addresses on a crashing thread's stack, as module names and
+ * offsets (so that ASLR doesn't matter), to tell apart crashes at the same spot in shared code
+ * (e.g. memcpy) that got there from different callers.
+ * Most x64 code doesn't keep frame pointers, so rather than walking frames, we scan the
+ * stack for values that point just past a call into a module. Stale return addresses can get
+ * picked up, so this is only meant to deduplicate crashes, not to symbolize them.
+ * @param mc the crashing thread's machine context
+ * @param frames receives how many return addresses were hashed
+ * @return the hash (FNV-1a)
+ */
+static uint64_t crash_stack_hash(dr_mcontext_t *mc, uint32_t *frames) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+
+  *frames = 0;
+
+  for (uint32_t slot = 0; slot < SL2_CRASH_STACK_SLOTS && *frames < SL2_CRASH_STACK_FRAMES;
+       slot++) {
+    app_pc ret;
+
+    if (!dr_safe_read((app_pc)mc->xsp + slot * sizeof(ret), sizeof(ret), &ret, NULL)) {
+      break;
+    }
+
+    module_data_t *mod = dr_lookup_module(ret);
+
+    if (!mod) {
+      continue;
+    }
+
+    const char *name = dr_module_preferred_name(mod);
+
+    if (name && follows_call(ret)) {
+      uint64_t offset = (uint64_t)(ret - mod->start);
+
+      // Module names are case-insensitive, so they're hashed in lowercase.
+      for (const char *c = name; *c; c++) {
+        uint8_t lower = (*c >= 'A' && *c <= 'Z') ? *c - 'A' + 'a' : *c;
+        hash = (hash ^ lower) * 0x100000001B3ULL;
+      }
+
+      for (size_t i = 0; i < sizeof(offset); i++) {
+        hash = (hash ^ (uint8_t)(offset >> (i * 8))) * 0x100000001B3ULL;
+      }
+
+      (*frames)++;
+    }
+
+    dr_free_module_data(mod);
+  }
+
+  return hash;
+}
+
+/**
+ * Registers the crashing thread's iteration with the server again, over the thread's own
+ * connection, so that the run's mutations are the ones that crashed rather than the ones that
+ * another looping thread happened to register last. No other looping thread registers anything
+ * after it. Does nothing unless -persist_threads is over 1.
+ * The lock is never released, since the process is on its way out.
+ * @param drcontext the crashing thread's DR context
+ */
+static void reregister_crash(void *drcontext) {
+  if (!persist_register_lock) {
+    return;
+  }
+
+  dr_rwlock_write_lock(persist_register_lock);
+
+  sl2_persist_worker *worker = current_worker(drcontext);
+  sl2_persist_state &loop = worker ? worker->loop : persist;
+  sl2_conn *conn = worker ? &(worker->conn) : &sl2_conn;
+
+  SL2_DR_DEBUG("reregister_crash: registering the crashing iteration's %d reads again\n",
+               loop.read_count);
+
+  for (uint32_t i = 0; i < loop.read_count; ++i) {
+    if (sl2_conn_register_mutation(conn, &(loop.reads[i].mutation)) != SL2Response::OK) {
+      SL2_DR_DEBUG("reregister_crash: couldn't register mutation %u\n",
+                   loop.reads[i].mutation.mut_count);
+    }
+  }
+}
+
+/*! Maps exception code to an exit status. Print it out, save the exception context, then exit. */
+static bool on_exception(void *drcontext, dr_exception_t *excpt) {
+  if (exiting) {
+    SL2_DR_DEBUG(
+        "fuzzer#on_exception: Exception while exiting! Probably an instrumentation failure.\n");
+    dr_abort();
+    return false;
+  }
+
+  crashed = true;
+  DWORD exception_code = excpt->record->ExceptionCode;
+
+  reregister_crash(drcontext);
+
+  dr_switch_to_app_state(drcontext);
+  fuzz_exception_ctx.thread_id = GetCurrentThreadId();
+  dr_mcontext_to_context(&(fuzz_exception_ctx.thread_ctx), excpt->mcontext);
+  dr_switch_to_dr_state(drcontext);
+
+  // Make our own copy of the exception record.
+  memcpy(&(fuzz_exception_ctx.record), excpt->record, sizeof(EXCEPTION_RECORD));
+
+  sl2_event ev;
+  sl2_event_begin(&ev, NULL);
+  sl2_event_str(&ev, "exception", client.exception_to_string(exception_code));
+
+  // Where the crash happened, as a module and an offset into it (so that ASLR doesn't matter).
+  // The harness uses this as a quick signature to skip triaging crashes that it's already seen.
+  app_pc crash_pc = (app_pc)excpt->record->ExceptionAddress;
+  module_data_t *crash_mod = dr_lookup_module(crash_pc);
+  const char *crash_mod_name = crash_mod ? dr_module_preferred_name(crash_mod) : NULL;
+
+  uint64_t crash_offset = (uint64_t)(crash_mod ? crash_pc - crash_mod->start : crash_pc);
+
+  sl2_event_str(&ev, "module", crash_mod_name ? crash_mod_name : "");
+  sl2_event_uint(&ev, "offset", crash_offset);
+
+  // What the faulting access was, so that the harness can triage the likeliest exploitable crashes
+  // first (see triage_queue.crash_severity).
+  if (exception_code == EXCEPTION_ACCESS_VIOLATION && excpt->record->NumberParameters >= 2) {
+    ULONG_PTR access = excpt->record->ExceptionInformation[0];
+    ULONG_PTR fault_address = excpt->record->ExceptionInformation[1];
+
+    sl2_event_str(&ev, "access", access == 1 ? "write" : (access == 8 ? "execute" : "read"));
+    sl2_event_uint(&ev, "fault_address", (uint64_t)fault_address);
+    sl2_event_bool(&ev, "fault_at_pc", fault_address == (ULONG_PTR)crash_pc);
+  }
+
+  uint32_t frames = 0;
+  uint64_t stack_hash = crash_stack_hash(excpt->mcontext, &frames);
+
+  if (frames) {
+    char stack_s[17];
+    dr_snprintf(stack_s, sizeof(stack_s), "%016llx", stack_hash);
+    sl2_event_str(&ev, "stack", stack_s);
+  }
+
+  client.emit_event(&ev, true);
+  sl2_etw_crash(client.exception_to_string(exception_code), crash_mod_name ? crash_mod_name : "",
+                crash_offset);
+
+  if (crash_mod) {
+    dr_free_module_data(crash_mod);
+  }
+
+  dr_exit_process(1);
+  return true;
+}
+
+/**
+ * Writes the initial minidump for a crash from inside the crashing process. This is the
+ * fallback for when the server can't write it for us.
+ * Callers should switch to the application's state first.
+ * @param exception_pointers the crash's exception record and (application) context
+ */
+static void write_initial_dump(EXCEPTION_POINTERS *exception_pointers) {
+  sl2_crash_paths crash_paths = {0};
+  sl2_conn_request_crash_paths(&sl2_conn, dr_get_process_id(), &crash_paths);
+
+  // NOTE(ww): `dr_open_file` et al. don't work here, presumably because we explicitly
+  // switch to the target app state to perform the actual minidump write.
+  HANDLE dump_file = CreateFile(crash_paths.initial_dump_path, GENERIC_WRITE, NULL, NULL,
+                                CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (dump_file == INVALID_HANDLE_VALUE) {
+    SL2_DR_DEBUG("fuzzer#write_initial_dump: could not open the initial dump file (GLE=%d)\n",
+                 GetLastError());
+  }
+
+  MINIDUMP_EXCEPTION_INFORMATION mdump_info = {0};
+
+  mdump_info.ThreadId = fuzz_exception_ctx.thread_id;
+  mdump_info.ExceptionPointers = exception_pointers;
+  mdump_info.ClientPointers = true;
+
+  if (!MiniDumpWriteDump(GetCurrentProcess(), GetCurrentProcessId(), dump_file, MiniDumpNormal,
+                         &mdump_info, NULL, NULL)) {
+    SL2_DR_DEBUG("fuzzer#write_initial_dump: MiniDumpWriteDump failed (GLE=%d)\n",
+                 GetLastError());
+  }
+
+  CloseHandle(dump_file);
+}
+
+/**
+ * Records the time that a stage of the run was first reached at. Only the first thread to reach
+ * it counts.
+ * @param stamp the stage's field in timing
+ */
+static void mark_stage(volatile LONG64 *stamp) {
+  if (!*stamp) {
+    InterlockedCompareExchange64(stamp, (LONG64)dr_get_microseconds(), 0);
+  }
+}
+
+/** Reports when each stage of the run was reached to the harness. */
+static void emit_timing() {
+  sl2_event ev;
+  sl2_event_begin(&ev, "timing");
+  sl2_event_uint(&ev, "start", timing.start);
+  sl2_event_uint(&ev, "opts", timing.options);
+  sl2_event_uint(&ev, "tgts", timing.targets);
+  sl2_event_uint(&ev, "conn", timing.connected);
+  sl2_event_uint(&ev, "ext", timing.extensions);
+  sl2_event_uint(&ev, "init", timing.init);
+  sl2_event_uint(&ev, "hook", timing.first_hook);
+  sl2_event_uint(&ev, "mut", timing.first_mutation);
+  sl2_event_uint(&ev, "exit", timing.exit);
+  sl2_event_uint(&ev, "fin0", timing.finalize);
+  sl2_event_uint(&ev, "fin", timing.finalized);
+  sl2_event_uint(&ev, "mods", timing.module_loads);
+  sl2_event_uint(&ev, "mods_us", timing.module_load_us);
+  client.emit_event(&ev, true);
+}
+
+/**
+ * Reports coverage info from the server to the harness.
+ * @param cov the coverage info
+ * @param distance the run's distance from its -directed targets, or SL2_DISTANCE_NONE
+ */
+static void emit_coverage(sl2_coverage_info *cov, uint32_t distance) {
+  sl2_event ev;
+  sl2_event_begin(&ev, "coverage");
+  sl2_event_str(&ev, "hash", (char *)cov->path_hash);
+  sl2_event_bool(&ev, "bkt", cov->bucketing);
+  sl2_event_uint(&ev, "scr", cov->score);
+  sl2_event_uint(&ev, "rem", cov->tries_remaining);
+  sl2_event_uint(&ev, "newc", cov->new_cells);
+  sl2_event_uint(&ev, "newb", cov->new_buckets);
+  sl2_event_uint(&ev, "runs", cov->runs);
+  sl2_event_uint(&ev, "paths", cov->paths);
+  sl2_event_uint(&ev, "f1", cov->singletons);
+  sl2_event_uint(&ev, "f2", cov->doubletons);
+  sl2_event_uint(&ev, "us", cov->exec_us);
+  sl2_event_bool(&ev, "slow", cov->slow);
+
+  if (distance != SL2_DISTANCE_NONE) {
+    sl2_event_uint(&ev, "dist", distance);
+  }
+
+  client.emit_event(&ev, true);
+}
+
+/** Runs after the target application has exited. Reports crash state to the server and dumps
+ * coverage info. */
+static void on_dr_exit(void) {
+  mark_stage(&timing.exit);
+  exiting = true;
+  SL2_DR_DEBUG("Dynamorio exiting (fuzzer)\n");
+
+  // Replays that aren't registered with the server (e.g. by crash minimization) don't
+  // need a dump, which would only slow them down.
+  if (crashed && (!replaying || op_replay_register.get_value())) {
+    char run_id_s[SL2_UUID_SIZE];
+    sl2_uuid_to_string(sl2_conn.run_id, run_id_s);
+    SL2_DR_DEBUG("<crash found for run id %s>\n", run_id_s);
+
+    EXCEPTION_POINTERS exception_pointers = {0};
+    exception_pointers.ExceptionRecord = &(fuzz_exception_ctx.record);
+    exception_pointers.ContextRecord = &(fuzz_exception_ctx.thread_ctx);
+
+    // NOTE(ww): Switching back to the application's state is necessary, as we don't want
+    // parts of the instrumentation showing up in our initial dump.
+    dr_switch_to_app_state(dr_get_current_drcontext());
+
+    // Ask the server to snapshot us and write the dump out-of-process, so that we don't hold
+    // up the harness while it's written. If it can't, write the dump ourselves.
+    if (sl2_conn_request_crash_dump(&sl2_conn, dr_get_process_id(), fuzz_exception_ctx.thread_id,
+                                    &exception_pointers) != SL2Response::OK) {
+      SL2_DR_DEBUG("fuzzer#on_dr_exit: server couldn't dump us, dumping in-process\n");
+      write_initial_dump(&exception_pointers);
+    }
+
+    dr_switch_to_dr_state(dr_get_current_drcontext());
+  }
+
+  if (coverage_guided) {
+    merge_thread_maps();
+
+    if (op_arena_out.get_value() != "") {
+      write_arena_out();
+    } else {
+      sl2_coverage_info cov = {0};
+      classify_counts(arena);
+      mark_stage(&timing.finalize);
+      uint32_t distance = directed_distance();
+      sl2_conn_finalize_run(&sl2_conn, arena, dr_get_process_id(), crashed, distance, &cov);
+      mark_stage(&timing.finalized);
+      sl2_etw_arena_upload("finalize", arena->size, timing.finalized - timing.finalize);
+      emit_coverage(&cov, distance);
+    }
+  }
+
+  emit_timing();
+  client.exit_profile();
+  sl2_etw_unregister();
+
+  sl2_conn_close(&sl2_conn);
+
+  exit_drcov();
+  exit_cmplog();
+  exit_dictionary();
+  exit_fixups();
+  exit_cmplog_table();
+  exit_replay();
+  exit_mutator();
+  exit_persist_threads();
+  exit_virtual_file();
+  exit_peer();
+  exit_directed();
+  client.exit_events();
+  client.exit_handle_cache();
+  client.exit_read_info_pool();
+  exit_unwrapping();
+  free_snapshot();
+  dr_rwlock_destroy(modules_lock);
+
+  if (targets_lock) {
+    dr_mutex_destroy(targets_lock);
+  }
+
+  if (coverage_guided) {
+    exit_coverage_instrumentation();
+  }
+
+  drmgr_unregister_thread_init_event(on_thread_init_rng);
+  drmgr_unregister_thread_exit_event(on_thread_exit_rng);
+  drmgr_unregister_tls_field(thread_rng_idx);
+
+  dr_log(NULL, DR_LOG_ALL, ERROR, "fuzzer#on_dr_exit: Dynamorio Exiting\n");
+  drwrap_exit();
+  drmgr_exit();
+  drreg_exit();
+
+  // The containers that are still alive keep their nodes until they're destroyed.
+  sl2_region_release(sl2_global_region());
+}
+
+/**
+ * Sends an iteration's arena to the server, reports the coverage info that the server sends back,
+ * and clears the arena for the next iteration.
+ * @param conn the connection to send the arena over
+ * @param iteration_arena the arena
+ */
+static void upload_iteration_coverage(sl2_conn *conn, sl2_arena *iteration_arena) {
+  classify_counts(iteration_arena);
+
+  uint64_t upload_start = dr_get_microseconds();
+  sl2_conn_register_arena(conn, iteration_arena);
+  sl2_etw_arena_upload("register", iteration_arena->size, dr_get_microseconds() - upload_start);
+
+  sl2_coverage_info cov = {0};
+  sl2_conn_get_coverage(conn, iteration_arena, &cov);
+  emit_coverage(&cov, SL2_DISTANCE_NONE);
+
+  memset(iteration_arena->map, 0, iteration_arena->size);
+}
+
+/**
+ * Reports the coverage for a single iteration (in persistent or snapshot mode) to the server, and
+ * clears the arena for the next one.
+ */
+static void report_iteration_coverage() {
+  merge_thread_maps();
+  upload_iteration_coverage(&sl2_conn, arena);
+
+  // Hit-once blocks are only recorded when they're built, so the next iteration has to
+  // build them all again.
+  if (op_hit_once.get_value() && !dr_delay_flush_region((app_pc)0, ~(size_t)0, 0, NULL)) {
+    SL2_DR_DEBUG("report_iteration_coverage: couldn't flush the code cache for -hit_once\n");
+  }
+}
+
+/**
+ * Keeps a copy of a targeted read that the current thread just mutated and registered, so that
+ * its iteration can be registered again if it crashes (see reregister_crash). Only with
+ * -persist_threads, since otherwise nothing else registers over the iteration's mutations.
+ * @param drcontext the current thread's DR context
+ * @param mutation the read's mutation
+ */
+static void log_persist_read(void *drcontext, const sl2_mutation *mutation) {
+  if (!persist_register_lock) {
+    return;
+  }
+
+  sl2_persist_worker *worker = current_worker(drcontext);
+  sl2_persist_state &loop = worker ? worker->loop : persist;
+
+  if (loop.read_count >= SL2_PERSIST_LOG_READS) {
+    return;
+  }
+
+  sl2_persist_read &read = loop.reads[loop.read_count++];
+
+  if (read.capacity < mutation->bufsize) {
+    if (read.buffer) {
+      dr_global_free(read.buffer, read.capacity);
+    }
+
+    read.capacity = mutation->bufsize;
+    read.buffer = (uint8_t *)sl2_global_alloc(read.capacity);
+  }
+
+  read.mutation = *mutation;
+  memcpy(read.buffer, mutation->buffer, mutation->bufsize);
+  read.mutation.buffer = read.buffer;
+  read.mutation.resource = NULL;
+
+  if (mutation->resource) {
+    wcsncpy_s(read.resource, MAX_PATH + 1, mutation->resource, _TRUNCATE);
+    read.mutation.resource = read.resource;
+  }
+}
+
+/**
+ * Takes persist_register_lock shared, if there is one, around one of the looping threads'
+ * registrations.
+ */
+static void lock_registration() {
+  if (persist_register_lock) {
+    dr_rwlock_read_lock(persist_register_lock);
+  }
+}
+
+/**
+ * Releases what lock_registration took.
+ */
+static void unlock_registration() {
+  if (persist_register_lock) {
+    dr_rwlock_read_unlock(persist_register_lock);
+  }
+}
+
+/**
+ * Starts the rest of -persist_threads' looping threads, once the first one has entered the
+ * target. Each is started at the target itself, with its first argument; the rest of the
+ * arguments are restored when it enters (see enter_worker_iteration).
+ * The threads are started with the application's own CreateThread, so that they start
+ * the way that the application's threads do, and DR takes them over as application threads. Ours
+ * would start them in our private copy of kernel32.
+ * @param drcontext the first looping thread's DR context
+ */
+static void spawn_persist_workers(void *drcontext) {
+  typedef HANDLE(WINAPI * create_thread_t)(LPSECURITY_ATTRIBUTES, SIZE_T, LPTHREAD_START_ROUTINE,
+                                           LPVOID, DWORD, LPDWORD);
+
+  uint32_t threads = min(op_persist_threads.get_value(), SL2_PERSIST_MAX_THREADS);
+  module_data_t *kernel32 = dr_lookup_module_by_name("kernel32.dll");
+  create_thread_t create_thread =
+      kernel32 ? (create_thread_t)dr_get_proc_address(kernel32->handle, "CreateThread") : NULL;
+
+  if (kernel32) {
+    dr_free_module_data(kernel32);
+  }
+
+  if (!create_thread) {
+    SL2_DR_DEBUG("spawn_persist_workers: no CreateThread, looping on a single thread\n");
+    return;
+  }
+
+  // Our allocations have to be made in DR's state, so they're all made up front.
+  sl2_persist_worker *workers[SL2_PERSIST_MAX_THREADS - 1];
+
+  for (uint32_t i = 0; i < threads - 1; ++i) {
+    workers[i] = new (sl2_global_alloc(sizeof(sl2_persist_worker))) sl2_persist_worker();
+  }
+
+  dr_switch_to_app_state(drcontext);
+
+  for (uint32_t i = 0; i < threads - 1; ++i) {
+    DWORD thread_id = 0;
+    HANDLE thread = create_thread(NULL, 0, (LPTHREAD_START_ROUTINE)persist.func_pc,
+                                  persist.args[0], CREATE_SUSPENDED, &thread_id);
+
+    if (!thread) {
+      break;
+    }
+
+    // The worker has to be findable by its thread before the thread runs.
+    workers[i]->thread_id = thread_id;
+    persist_workers[persist_worker_count++] = workers[i];
+    InterlockedIncrement(&persist_workers_live);
+
+    ResumeThread(thread);
+    CloseHandle(thread);
+  }
+
+  dr_switch_to_dr_state(drcontext);
+
+  for (uint32_t i = persist_worker_count; i < threads - 1; ++i) {
+    workers[i]->~sl2_persist_worker();
+    dr_global_free(workers[i], sizeof(sl2_persist_worker));
+  }
+
+  SL2_DR_DEBUG("spawn_persist_workers: started %d of %d worker threads\n", persist_worker_count,
+               threads - 1);
+}
+
+/**
+ * Sets up the worker that the current thread was started for, the first time that it enters the
+ * target: its call counts, its connection, and its coverage.
+ * @param drcontext the current thread's DR context
+ * @return the thread's worker, or NULL if the thread isn't one of spawn_persist_workers'
+ */
+static sl2_persist_worker *claim_persist_worker(void *drcontext) {
+  thread_id_t thread_id = dr_get_thread_id(drcontext);
+  sl2_persist_worker *worker = NULL;
+
+  for (uint32_t i = 0; i < persist_worker_count && !worker; ++i) {
+    if (persist_workers[i]->thread_id == thread_id && !persist_workers[i]->started) {
+      worker = persist_workers[i];
+    }
+  }
+
+  if (!worker) {
+    return NULL;
+  }
+
+  worker->started = true;
+  worker->loop.func_pc = persist.func_pc;
+  drmgr_set_tls_field(drcontext, persist_worker_idx, worker);
+  client.set_thread_counts(drcontext, &(worker->counts));
+
+  if (sl2_conn_open(&(worker->conn)) != SL2Response::OK) {
+    SL2_DR_DEBUG("ERROR: a persistent worker couldn't open a connection to the server!\n");
+    dr_abort();
+  }
+
+  worker->conn_open = true;
+  sl2_conn_assign_run_id(&(worker->conn), sl2_conn.run_id);
+
+  if (op_profile.get_value() || op_alloc_steady.get_value()) {
+    sl2_conn_set_profile_hook(&(worker->conn), sl2_profile_request);
+  }
+
+  if (coverage_guided) {
+    memcpy(worker->arena.id, arena->id, sizeof(worker->arena.id));
+    worker->arena.size = arena->size;
+
+    if (sl2_conn_request_arena(&(worker->conn), &(worker->arena)) != SL2Response::OK ||
+        worker->arena.size != arena->size) {
+      SL2_DR_DEBUG("ERROR: a persistent worker didn't get its arena from the server!\n");
+      dr_abort();
+    }
+
+    worker->arena.map = (uint8_t *)sl2_global_alloc(worker->arena.size);
+    memset(worker->arena.map, 0, worker->arena.size);
+
+    // Keep the thread's coverage out of the process's arena; the worker reports it on its own.
+    worker->map = (uint8_t *)drmgr_get_tls_field(drcontext, thread_map_idx);
+
+    dr_mutex_lock(thread_maps_lock);
+    thread_maps.erase(std::remove(thread_maps.begin(), thread_maps.end(), worker->map),
+                      thread_maps.end());
+    dr_mutex_unlock(thread_maps_lock);
+  }
+
+  SL2_DR_DEBUG("persistent worker started on thread %d\n", thread_id);
+
+  return worker;
+}
+
+/**
+ * Runs on every entry to the persistent target by a worker: gives the target the first looping
+ * thread's snapshotted arguments, and the worker the call counts that went with them.
+ * @param wrapcxt - DynamoRIO Wrap Context.
+ * @param worker the current thread's worker
+ */
+static void enter_worker_iteration(void *wrapcxt, sl2_persist_worker *worker) {
+  uint32_t nargs = min(op_persist_nargs.get_value(), SL2_PERSIST_THREAD_MAX_ARGS);
+
+  if (!worker->loop.xsp) {
+    worker->loop.xsp = drwrap_get_mcontext(wrapcxt)->xsp;
+  }
+
+  for (uint32_t i = 0; i < nargs; ++i) {
+    drwrap_set_arg(wrapcxt, i, persist.args[i]);
+  }
+
+  worker->counts.call_counts = persist.call_counts;
+  worker->counts.ret_addr_counts = persist.ret_addr_counts;
+  worker->loop.read_count = 0;
+}
+
+/**
+ * Marks a worker as done looping, and lets the first looping thread go on once every worker is.
+ * @param worker the worker
+ */
+static void finish_persist_worker(sl2_persist_worker *worker) {
+  if (worker->finished) {
+    return;
+  }
+
+  worker->finished = true;
+
+  if (!InterlockedDecrement(&persist_workers_live)) {
+    dr_event_signal(persist_workers_done);
+  }
+}
+
+/**
+ * Runs on every return from the persistent target by a worker. Reports the iteration's coverage
+ * over the worker's connection, and sends execution back to the top of the target until the
+ * worker has run out of iterations. After its last one, the worker's thread returns from the
+ * target, its start routine, and exits.
+ * @param wrapcxt - DynamoRIO Wrap Context.
+ * @param worker the current thread's worker
+ */
+static void next_worker_iteration(void *wrapcxt, sl2_persist_worker *worker) {
+  if (coverage_guided) {
+    merge_thread_map(&(worker->arena), worker->map);
+    memset(worker->map, 0, thread_map_size);
+    upload_iteration_coverage(&(worker->conn), &(worker->arena));
+  }
+
+  if (++worker->loop.iteration >= op_persist_iterations.get_value()) {
+    SL2_DR_DEBUG("persistent worker on thread %d finished after %d iterations\n",
+                 worker->thread_id, worker->loop.iteration);
+    finish_persist_worker(worker);
+    return;
+  }
+
+  worker->mut_count = 0;
+
+  dr_mcontext_t *mc = drwrap_get_mcontext(wrapcxt);
+  mc->xsp = worker->loop.xsp;
+  mc->pc = persist.func_pc;
+  drwrap_redirect_execution(wrapcxt);
+}
+
+/**
+ * Waits for every worker to finish looping, so that the first looping thread's last iteration
+ * doesn't take the process (and the workers' iterations) down with it when it returns.
+ */
+static void wait_for_persist_workers() {
+  if (!persist_workers_done || !persist_workers_live) {
+    return;
+  }
+
+  SL2_DR_DEBUG("waiting for %d persistent workers to finish\n", persist_workers_live);
+  dr_event_wait(persist_workers_done);
+}
+
+/**
+ * Frees whatever a worker holds onto, except for the worker itself. Safe to call more than once.
+ * @param worker the worker
+ */
+static void free_persist_worker(sl2_persist_worker *worker) {
+  if (worker->conn_open) {
+    sl2_conn_close(&(worker->conn));
+    worker->conn_open = false;
+  }
+
+  if (worker->map) {
+    dr_global_free(worker->map, thread_map_size);
+    worker->map = NULL;
+  }
+
+  if (worker->arena.map) {
+    dr_global_free(worker->arena.map, worker->arena.size);
+    worker->arena.map = NULL;
+  }
+
+  for (sl2_persist_read &read : worker->loop.reads) {
+    if (read.buffer) {
+      dr_global_free(read.buffer, read.capacity);
+      read.buffer = NULL;
+      read.capacity = 0;
+    }
+  }
+}
+
+/**
+ * Closes an exiting worker thread's connection, and frees its coverage.
+ * A worker whose thread exits before it's done looping (e.g. because the target
+ * exited it) is done all the same.
+ */
+static void on_thread_exit_persist_worker(void *drcontext) {
+  sl2_persist_worker *worker = current_worker(drcontext);
+
+  if (!worker) {
+    return;
+  }
+
+  finish_persist_worker(worker);
+  free_persist_worker(worker);
+  drmgr_set_tls_field(drcontext, persist_worker_idx, NULL);
+  client.set_thread_counts(drcontext, NULL);
+}
+
+/**
+ * Sets up -persist_threads, if it's over 1.
+ */
+static void init_persist_threads() {
+  if (op_persist_threads.get_value() <= 1) {
+    return;
+  }
+
+  persist_worker_idx = drmgr_register_tls_field();
+  persist_register_lock = dr_rwlock_create();
+  persist_workers_done = dr_event_create();
+  client.init_thread_counts();
+
+  if (persist_worker_idx == -1 ||
+      !drmgr_register_thread_exit_event(on_thread_exit_persist_worker)) {
+    DR_ASSERT(false);
+  }
+}
+
+/**
+ * Tears down whatever init_persist_threads (and the workers) set up.
+ */
+static void exit_persist_threads() {
+  if (persist_worker_idx == -1) {
+    return;
+  }
+
+  drmgr_unregister_thread_exit_event(on_thread_exit_persist_worker);
+
+  for (uint32_t i = 0; i < persist_worker_count; ++i) {
+    free_persist_worker(persist_workers[i]);
+    persist_workers[i]->~sl2_persist_worker();
+    dr_global_free(persist_workers[i], sizeof(sl2_persist_worker));
+  }
+
+  persist_worker_count = 0;
+
+  for (sl2_persist_read &read : persist.reads) {
+    if (read.buffer) {
+      dr_global_free(read.buffer, read.capacity);
+      read.buffer = NULL;
+    }
+  }
+
+  drmgr_unregister_tls_field(persist_worker_idx);
+  persist_worker_idx = -1;
+  client.exit_thread_counts();
+  dr_event_destroy(persist_workers_done);
+  persist_workers_done = NULL;
+
+  // A crashing thread never gives the lock back (see reregister_crash).
+  if (!crashed) {
+    dr_rwlock_destroy(persist_register_lock);
+  }
+
+  persist_register_lock = NULL;
+}
+
+/**
+ * Runs on every entry to the persistent target. The first entry is snapshotted; every later
+ * entry (which we redirected to) gets the snapshotted arguments back.
+ * @param wrapcxt - DynamoRIO Wrap Context.
+ * @param user_data - unused
+ */
+static void wrap_pre_persist_target(void *wrapcxt, OUT void **user_data) {
+  uint32_t nargs = min(op_persist_nargs.get_value(), SL2_PERSIST_MAX_ARGS);
+  void *drcontext = drwrap_get_drcontext(wrapcxt);
+  sl2_persist_worker *worker = persist_worker_idx != -1 ? current_worker(drcontext) : NULL;
+
+  if (persist_worker_idx != -1 && !worker) {
+    worker = claim_persist_worker(drcontext);
+  }
+
+  if (worker) {
+    enter_worker_iteration(wrapcxt, worker);
+    return;
+  }
+
+  persist.read_count = 0;
+
+  if (!persist.iteration) {
+    persist.func_pc = drwrap_get_func(wrapcxt);
+    persist.xsp = drwrap_get_mcontext(wrapcxt)->xsp;
+
+    for (uint32_t i = 0; i < nargs; ++i) {
+      persist.args[i] = drwrap_get_arg(wrapcxt, i);
+    }
+
+    persist.call_counts = client.call_counts;
+    persist.ret_addr_counts = client.ret_addr_counts;
+
+    SL2_DR_DEBUG("persistent target entered @ 0x%p, looping %d times\n", persist.func_pc,
+                 op_persist_iterations.get_value());
+
+    if (persist_worker_idx != -1 && !persist_worker_count) {
+      spawn_persist_workers(drcontext);
+    }
+  } else {
+    for (uint32_t i = 0; i < nargs; ++i) {
+      drwrap_set_arg(wrapcxt, i, persist.args[i]);
+    }
+
+    client.call_counts = persist.call_counts;
+    client.ret_addr_counts = persist.ret_addr_counts;
+  }
+}
+
+/**
+ * Runs on every return from the persistent target. Reports the iteration's coverage to the
+ * server, resets our per-iteration state, and sends execution back to the top of the target
+ * until we've run out of iterations.
+ * @param wrapcxt - DynamoRIO Wrap Context.
+ * @param user_data - unused
+ */
+static void wrap_post_persist_target(void *wrapcxt, void *user_data) {
+  void *drcontext = drwrap_get_drcontext(wrapcxt);
+  sl2_persist_worker *worker = current_worker(drcontext);
+
+  if (worker) {
+    next_worker_iteration(wrapcxt, worker);
+    return;
+  }
+
+  if (++persist.iteration >= op_persist_iterations.get_value()) {
+    // Let the last iteration return normally; on_dr_exit reports its coverage.
+    SL2_DR_DEBUG("persistent target finished after %d iterations\n", persist.iteration);
+    wait_for_persist_workers();
+    return;
+  }
+
+  if (coverage_guided) {
+    report_iteration_coverage();
+  }
+
+  // Restarting the mutation count means that a crash's FKTs always describe
+  // the iteration that actually crashed, so triage can replay it from the top.
+  mut_count = 0;
+
+  dr_mcontext_t *mc = drwrap_get_mcontext(wrapcxt);
+  mc->xsp = persist.xsp;
+  mc->pc = persist.func_pc;
+  drwrap_redirect_execution(wrapcxt);
+}
+
+/**
+ * Ends the run early, without a crash, once the target has had its chance to consume
+ * every mutation.
+ * @param reason why we're exiting, for debugging
+ */
+static void exit_early(const char *reason) {
+  if (InterlockedExchange(&early_exit_taken, 1)) {
+    return;
+  }
+
+  SL2_DR_DEBUG("every target consumed, exiting early (%s)\n", reason);
+  dr_exit_process(SL2_EXIT_TARGETS_CONSUMED);
+}
+
+/**
+ * Records that a selected target has been mutated, and arms the early exit once they all have.
+ * @param target_index the target's index in the target file
+ */
+static void consume_target(size_t target_index) {
+  if (!targets_lock) {
+    return;
+  }
+
+  dr_mutex_lock(targets_lock);
+
+  if (!early_exit_armed && target_index < targets_consumed.size() &&
+      !targets_consumed[target_index]) {
+    targets_consumed[target_index] = true;
+
+    if (!--targets_remaining) {
+      SL2_DR_DEBUG("consumed the last selected target, arming early exit\n");
+      early_exit_armed_at = dr_get_milliseconds();
+      early_exit_bbs_left = op_exit_after_bbs.get_value();
+      early_exit_armed = true;
+    }
+  }
+
+  dr_mutex_unlock(targets_lock);
+}
+
+/*! The hooks that a targetable function was wrapped with, so that it can be unwrapped */
+struct sl2_wrapped_read {
+  sl2_pre_proto pre;
+  sl2_post_proto post;
+};
+
+typedef std::map<app_pc, sl2_wrapped_read, std::less<app_pc>,
+                 sl2_region_allocator<std::pair<const app_pc, sl2_wrapped_read>>>
+    sl2_wrapped_reads_map;
+
+/*! Every targetable function we've wrapped, by address */
+static sl2_wrapped_reads_map wrapped_reads;
+/*! Guards wrapped_reads. NULL when we never unwrap */
+static void *wrapped_reads_lock = NULL;
+
+/**
+ * Sets up unwrapping of targetable functions that no target can match anymore.
+ * Persistent and snapshot modes rewind the call counts on each iteration, so a target
+ * that's been passed can match again. We never unwrap in those modes.
+ */
+static void init_unwrapping() {
+  if (op_snapshot.get_value() || op_persist_module.get_value() != "") {
+    return;
+  }
+
+  wrapped_reads_lock = dr_mutex_create();
+}
+
+/**
+ * Tears down unwrapping.
+ */
+static void exit_unwrapping() {
+  if (wrapped_reads_lock) {
+    dr_mutex_destroy(wrapped_reads_lock);
+    wrapped_reads_lock = NULL;
+  }
+}
+
+/**
+ * Unwraps the function behind a post-hook once no target can match a later call to it, so that
+ * the reads the target makes after its last targeted one don't pay for our hooks.
+ * @param wrapcxt - DynamoRIO Wrap Context, from the function's post-hook.
+ * @param function - the hooked function
+ */
+static void unwrap_if_exhausted(void *wrapcxt, Function function) {
+  if (!wrapcxt || !wrapped_reads_lock || client.can_still_match(function)) {
+    return;
+  }
+
+  // ReadFile's hook serves the -virtual_file, and recv's and WinHttpReadData's serve the
+  // -emulate_peer, so they have to stay.
+  if ((virtual_file_lock && function == Function::ReadFile) ||
+      (peer_lock && (function == Function::recv || function == Function::WinHttpReadData))) {
+    return;
+  }
+
+  app_pc func = drwrap_get_func(wrapcxt);
+
+  dr_mutex_lock(wrapped_reads_lock);
+
+  auto it = wrapped_reads.find(func);
+  if (it != wrapped_reads.end()) {
+    if (drwrap_unwrap(func, it->second.pre, it->second.post)) {
+      SL2_DR_DEBUG("<unwrapped %s @ 0x%p: no target can match it anymore>\n",
+                   client.function_to_string(function), func);
+    }
+
+    wrapped_reads.erase(it);
+  }
+
+  dr_mutex_unlock(wrapped_reads_lock);
+}
+
+/**
+ * Called when the basic block countdown hits 0. Before we're armed, this just means that the
+ * target ran a lot of blocks before its last target, so we restart the countdown.
+ */
+static void on_early_exit_bbs_exhausted() {
+  if (!early_exit_armed) {
+    early_exit_bbs_left = SL2_EARLY_EXIT_IDLE_BBS;
+    return;
+  }
+
+  exit_early("basic block budget");
+}
+
+/**
+ * Inserts the early exit's basic block countdown at the top of each block.
+ * @return DynamoRIO flags indicating return code
+ */
+static dr_emit_flags_t on_bb_countdown(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                                       bool for_trace, bool translating, void *user_data) {
+  if (!drmgr_is_first_instr(drcontext, inst)) {
+    return DR_EMIT_DEFAULT;
+  }
+
+  instr_t *skip = INSTR_CREATE_label(drcontext);
+
+  drreg_reserve_aflags(drcontext, bb, inst);
+
+  instrlist_meta_preinsert(
+      bb, inst,
+      INSTR_CREATE_sub(drcontext, OPND_CREATE_ABSMEM((void *)&early_exit_bbs_left, OPSZ_PTR),
+                       OPND_CREATE_INT8(1)));
+  instrlist_meta_preinsert(bb, inst, INSTR_CREATE_jcc(drcontext, OP_jnz, opnd_create_instr(skip)));
+  dr_insert_clean_call(drcontext, bb, inst, (void *)on_early_exit_bbs_exhausted, false, 0);
+  instrlist_meta_preinsert(bb, inst, skip);
+
+  drreg_unreserve_aflags(drcontext, bb, inst);
+
+  return DR_EMIT_DEFAULT;
+}
+
+/**
+ * Exits early once the early exit's time budget runs out.
+ */
+static void early_exit_thread(void *param) {
+  while (!exiting) {
+    if (early_exit_armed &&
+        dr_get_milliseconds() - early_exit_armed_at >= op_exit_after_ms.get_value()) {
+      exit_early("time budget");
+    }
+
+    dr_sleep(SL2_EARLY_EXIT_POLL_MS);
+  }
+}
+
+/**
+ * Sets up the "exit after the last target" policy, if the user asked for it.
+ */
+static void init_early_exit() {
+  if (!op_exit_after_bbs.get_value() && !op_exit_after_ms.get_value()) {
+    return;
+  }
+
+  // Persistent and snapshot modes consume every target on each iteration,
+  // so exiting after the first one would defeat the point.
+  if (op_snapshot.get_value() || op_persist_module.get_value() != "") {
+    SL2_DR_DEBUG("init_early_exit: ignoring early exit in persistent/snapshot mode\n");
+    return;
+  }
+
+  // Only selected targets can be consumed, so every other one starts out that way.
+  targets_consumed.assign(client.target_count, true);
+
+  for (size_t f = 0; f < SL2_NUM_FUNCTIONS; f++) {
+    for (const sl2_target &t : client.compiledTargets[f].targets) {
+      targets_consumed[t.json_index] = false;
+      targets_remaining++;
+    }
+  }
+
+  if (!targets_remaining) {
+    return;
+  }
+
+  targets_lock = dr_mutex_create();
+
+  if (op_exit_after_bbs.get_value() &&
+      !drmgr_register_bb_instrumentation_event(NULL, on_bb_countdown, NULL)) {
+    DR_ASSERT(false);
+  }
+
+  if (op_exit_after_ms.get_value() && !dr_create_client_thread(early_exit_thread, NULL)) {
+    SL2_DR_DEBUG("init_early_exit: couldn't start the early exit thread!\n");
+  }
+}
+
+/**
+ * Records that the target made progress, if the watchdog is armed.
+ */
+static void note_progress() {
+  if (watchdog_progress_at) {
+    watchdog_progress_at = (LONG64)dr_get_milliseconds();
+  }
+}
+
+/**
+ * Arms the watchdog, if the user asked for it. Until the first mutation, the target can't be
+ * hanging on one of our inputs, so we don't watch it.
+ */
+static void arm_watchdog() {
+  if (op_hang_ms.get_value()) {
+    watchdog_progress_at = (LONG64)dr_get_milliseconds();
+  }
+}
+
+/**
+ * Counts each newly built block as progress. DR only builds a block when the target reaches code
+ * that it hasn't run (since the last flush), so a target that's spinning or blocked builds none.
+ * @return DynamoRIO flags indicating return code
+ */
+static dr_emit_flags_t on_bb_progress(void *drcontext, void *tag, instrlist_t *bb, bool for_trace,
+                                      bool translating) {
+  if (!for_trace && !translating) {
+    note_progress();
+  }
+
+  return DR_EMIT_DEFAULT;
+}
+
+/**
+ * @return the CPU time that the process has used, in milliseconds
+ */
+static uint64_t process_cpu_ms() {
+  FILETIME creation, exit, kernel, user;
+
+  if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+    return 0;
+  }
+
+  ULARGE_INTEGER k = {kernel.dwLowDateTime, kernel.dwHighDateTime};
+  ULARGE_INTEGER u = {user.dwLowDateTime, user.dwHighDateTime};
+
+  return (k.QuadPart + u.QuadPart) / 10000;
+}
+
+/**
+ * Ends a run that's hung, as an EXCEPTION_SL2_TIMEOUT. Its coverage is still reported when we exit.
+ * @param idle_ms how long the target went without making progress
+ * @param cpu_ms how much CPU time it used meanwhile, which tells spinning apart from blocking
+ */
+static void exit_hung(uint64_t idle_ms, uint64_t cpu_ms) {
+  if (InterlockedExchange(&watchdog_taken, 1)) {
+    return;
+  }
+
+  SL2_DR_DEBUG("no progress in %llu ms (%llu ms of CPU), exiting as a hang\n", idle_ms, cpu_ms);
+
+  sl2_event ev;
+  sl2_event_begin(&ev, NULL);
+  sl2_event_str(&ev, "exception", "EXCEPTION_SL2_TIMEOUT");
+  sl2_event_uint(&ev, "idle_ms", idle_ms);
+  sl2_event_uint(&ev, "cpu_ms", cpu_ms);
+  client.emit_event(&ev, true);
+
+  dr_exit_process(SL2_EXIT_HUNG);
+}
+
+/**
+ * Watches for the target to stop making progress, and ends the run as a hang once it's gone
+ * -hang_ms without any. This catches a hang within SL2_WATCHDOG_POLL_MS of the threshold, where
+ * the harness's timeout only catches it after the whole run's, and loses its coverage.
+ */
+static void watchdog_thread(void *param) {
+  uint64_t last_seen = 0, cpu_at_progress = 0;
+
+  while (!exiting) {
+    uint64_t progress_at = (uint64_t)watchdog_progress_at;
+
+    if (progress_at) {
+      uint64_t cpu_ms = process_cpu_ms();
+
+      if (progress_at != last_seen) {
+        last_seen = progress_at;
+        cpu_at_progress = cpu_ms;
+      }
+
+      uint64_t now = dr_get_milliseconds();
+
+      if (now > progress_at && now - progress_at >= op_hang_ms.get_value()) {
+        exit_hung(now - progress_at, cpu_ms - cpu_at_progress);
+      }
+    }
+
+    dr_sleep(SL2_WATCHDOG_POLL_MS);
+  }
+}
+
+/**
+ * Sets up the hang watchdog, if the user asked for it.
+ */
+static void init_watchdog() {
+  if (!op_hang_ms.get_value()) {
+    return;
+  }
+
+  if (!drmgr_register_bb_app2app_event(on_bb_progress, NULL)) {
+    DR_ASSERT(false);
+  }
+
+  if (!dr_create_client_thread(watchdog_thread, NULL)) {
+    SL2_DR_DEBUG("init_watchdog: couldn't start the watchdog thread!\n");
+  }
+}
+
+/**
+ * Gives each new thread its own PRNG, derived from the run's seed and the order in which the
+ * thread was created.
+ */
+static void on_thread_init_rng(void *drcontext) {
+  sl2_rng *rng = (sl2_rng *)sl2_thread_alloc(drcontext, sizeof(sl2_rng));
+  int stream = dr_atomic_add32_return_sum(&rng_streams, 1) - 1;
+
+  sl2_rng_seed_string(rng, rng_seed, (uint64_t)stream);
+  drmgr_set_tls_field(drcontext, thread_rng_idx, rng);
+}
+
+static void on_thread_exit_rng(void *drcontext) {
+  sl2_rng *rng = (sl2_rng *)drmgr_get_tls_field(drcontext, thread_rng_idx);
+
+  dr_thread_free(drcontext, rng, sizeof(sl2_rng));
+  drmgr_set_tls_field(drcontext, thread_rng_idx, NULL);
+}
+
+/**
+ * Picks the run's seed (either the one the harness gave us or a random one) and sets up the
+ * per-thread PRNGs that the mutation engine draws from.
+ */
+static void init_rng() {
+  std::string seed = op_seed.get_value();
+
+  if (seed == "") {
+    // dr_get_random_value is itself seeded by drrun's -prng_seed.
+    dr_snprintf(rng_seed, sizeof(rng_seed), "%u%u", dr_get_random_value(UINT_MAX),
+                dr_get_random_value(UINT_MAX));
+  } else {
+    dr_snprintf(rng_seed, sizeof(rng_seed), "%s", seed.c_str());
+  }
+  rng_seed[sizeof(rng_seed) - 1] = '\0';
+
+  SL2_DR_DEBUG("init_rng: mutation seed: %s\n", rng_seed);
+
+  thread_rng_idx = drmgr_register_tls_field();
+
+  if (thread_rng_idx == -1 || !drmgr_register_thread_init_event(on_thread_init_rng) ||
+      !drmgr_register_thread_exit_event(on_thread_exit_rng)) {
+    DR_ASSERT(false);
+  }
+}
+
+/**
+ * Maps the token dictionary given by -dictionary (if any) and hands it to the mutation engine.
+ */
+static void init_dictionary() {
+  if (op_dictionary.get_value() == "") {
+    return;
+  }
+
+  file_t file = dr_open_file(op_dictionary.get_value().c_str(), DR_FILE_READ);
+  uint64 file_size = 0;
+
+  if (file == INVALID_FILE) {
+    SL2_DR_DEBUG("init_dictionary: couldn't open %s, not using a dictionary\n",
+                 op_dictionary.get_value().c_str());
+    return;
+  }
+
+  if (dr_file_size(file, &file_size) && file_size > 0) {
+    dictionary_view_size = (size_t)file_size;
+    dictionary_view =
+        dr_map_file(file, &dictionary_view_size, 0, NULL, DR_MEMPROT_READ, DR_MAP_PRIVATE);
+  }
+
+  dr_close_file(file);
+
+  if (dictionary_view == NULL) {
+    SL2_DR_DEBUG("init_dictionary: couldn't map %s, not using a dictionary\n",
+                 op_dictionary.get_value().c_str());
+    return;
+  }
+
+  if (!sl2_dictionary_parse(&dictionary, (uint8_t *)dictionary_view, (size_t)file_size)) {
+    SL2_DR_DEBUG("init_dictionary: malformed dictionary, not using it\n");
+    dr_unmap_file(dictionary_view, dictionary_view_size);
+    dictionary_view = NULL;
+    return;
+  }
+
+  SL2_DR_DEBUG("init_dictionary: loaded %u tokens\n", dictionary.count);
+  set_mutation_dictionary(&dictionary);
+}
+
+/**
+ * Unmaps the token dictionary, if we mapped one.
+ */
+static void exit_dictionary() {
+  if (dictionary_view == NULL) {
+    return;
+  }
+
+  set_mutation_dictionary(NULL);
+  dr_unmap_file(dictionary_view, dictionary_view_size);
+  dictionary_view = NULL;
+}
+
+/**
+ * Maps the fixup table given by -fixups (if any).
+ */
+static void init_fixups() {
+  if (op_fixups.get_value() == "") {
+    return;
+  }
+
+  file_t file = dr_open_file(op_fixups.get_value().c_str(), DR_FILE_READ);
+  uint64 file_size = 0;
+
+  if (file == INVALID_FILE) {
+    SL2_DR_DEBUG("init_fixups: couldn't open %s, not fixing up mutations\n",
+                 op_fixups.get_value().c_str());
+    return;
+  }
+
+  if (dr_file_size(file, &file_size) && file_size > 0) {
+    fixups_view_size = (size_t)file_size;
+    fixups_view = dr_map_file(file, &fixups_view_size, 0, NULL, DR_MEMPROT_READ, DR_MAP_PRIVATE);
+  }
+
+  dr_close_file(file);
+
+  if (fixups_view == NULL) {
+    SL2_DR_DEBUG("init_fixups: couldn't map %s, not fixing up mutations\n",
+                 op_fixups.get_value().c_str());
+    return;
+  }
+
+  if (!sl2_fixups_parse(&fixups, (uint8_t *)fixups_view, (size_t)file_size)) {
+    SL2_DR_DEBUG("init_fixups: malformed fixup table, not using it\n");
+    dr_unmap_file(fixups_view, fixups_view_size);
+    fixups_view = NULL;
+    return;
+  }
+
+  SL2_DR_DEBUG("init_fixups: loaded %u fixups\n", fixups.count);
+}
+
+/**
+ * Unmaps the fixup table, if we mapped one.
+ */
+static void exit_fixups() {
+  if (fixups_view == NULL) {
+    return;
+  }
+
+  dr_unmap_file(fixups_view, fixups_view_size);
+  fixups_view = NULL;
+}
+
+/**
+ * Maps the comparison log given by -cmplog_table (if any) and hands it to the mutation engine.
+ */
+static void init_cmplog_table() {
+  if (op_cmplog_table.get_value() == "") {
+    return;
+  }
+
+  file_t file = dr_open_file(op_cmplog_table.get_value().c_str(), DR_FILE_READ);
+  uint64 file_size = 0;
+
+  if (file == INVALID_FILE) {
+    SL2_DR_DEBUG("init_cmplog_table: couldn't open %s, not using a comparison log\n",
+                 op_cmplog_table.get_value().c_str());
+    return;
+  }
+
+  if (dr_file_size(file, &file_size) && file_size > 0) {
+    cmplog_table_view_size = (size_t)file_size;
+    cmplog_table_view =
+        dr_map_file(file, &cmplog_table_view_size, 0, NULL, DR_MEMPROT_READ, DR_MAP_PRIVATE);
+  }
+
+  dr_close_file(file);
+
+  if (cmplog_table_view == NULL) {
+    SL2_DR_DEBUG("init_cmplog_table: couldn't map %s, not using a comparison log\n",
+                 op_cmplog_table.get_value().c_str());
+    return;
+  }
+
+  if (!sl2_cmplog_parse(&cmplog_table, (uint8_t *)cmplog_table_view, (size_t)file_size)) {
+    SL2_DR_DEBUG("init_cmplog_table: malformed comparison log, not using it\n");
+    dr_unmap_file(cmplog_table_view, cmplog_table_view_size);
+    cmplog_table_view = NULL;
+    return;
+  }
+
+  SL2_DR_DEBUG("init_cmplog_table: loaded %u comparisons\n", cmplog_table.count);
+  set_mutation_cmplog(&cmplog_table);
+}
+
+/**
+ * Unmaps the comparison log, if we mapped one.
+ */
+static void exit_cmplog_table() {
+  if (cmplog_table_view == NULL) {
+    return;
+  }
+
+  set_mutation_cmplog(NULL);
+  dr_unmap_file(cmplog_table_view, cmplog_table_view_size);
+  cmplog_table_view = NULL;
+}
+
+/**
+ * Sets up replay mode, if we were asked to replay: connects to the server a second time, bound
+ * to the run whose mutations we're replaying (if any). Crash focus (-focus_run) replays its run's
+ * mutations through the same connection, without being in replay mode.
+ */
+static void init_replay() {
+  replaying = op_replay_inputs.get_value() != "" || op_replay_run.get_value() != "";
+
+  const std::string &source_run =
+      op_replay_run.get_value() != "" ? op_replay_run.get_value() : op_focus_run.get_value();
+
+  if (source_run == "") {
+    return;
+  }
+
+  if (sl2_conn_open(&replay_conn) != SL2Response::OK) {
+    SL2_DR_DEBUG("init_replay: couldn't open a replay connection to the server!\n");
+    dr_abort();
+  }
+
+  UUID run_id;
+  sl2_string_to_uuid(source_run.c_str(), &run_id);
+  sl2_conn_assign_run_id(&replay_conn, run_id);
+  replay_conn_open = true;
+
+  SL2_DR_DEBUG("init_replay: replaying %u mutations of %s\n",
+               replaying ? op_replay_count.get_value() : op_focus_count.get_value(),
+               source_run.c_str());
+}
+
+/**
+ * Closes the replay connection, if we opened one.
+ */
+static void exit_replay() {
+  if (replay_conn_open) {
+    sl2_conn_close(&replay_conn);
+    replay_conn_open = false;
+  }
+}
+
+/**
+ * Writes the run's coverage map to the file given by -arena_out.
+ */
+static void write_arena_out() {
+  file_t file = dr_open_file(op_arena_out.get_value().c_str(), DR_FILE_WRITE_OVERWRITE);
+
+  if (file == INVALID_FILE) {
+    SL2_DR_DEBUG("write_arena_out: couldn't open %s\n", op_arena_out.get_value().c_str());
+    return;
+  }
+
+  if (dr_write_file(file, arena->map, arena->size) != (ssize_t)arena->size) {
+    SL2_DR_DEBUG("write_arena_out: short write to %s\n", op_arena_out.get_value().c_str());
+  }
+
+  dr_close_file(file);
+}
+
+/**
+ * Loads the mutator plugin given by -mutator (if any) and initializes it.
+ */
+static void init_mutator() {
+  std::string path = op_mutator.get_value();
+
+  if (path == "") {
+    return;
+  }
+
+  mutator.lib = dr_load_aux_library(path.c_str(), NULL, NULL);
+
+  if (mutator.lib == NULL) {
+    SL2_DR_DEBUG("init_mutator: couldn't load %s\n", path.c_str());
+    dr_abort();
+  }
+
+  sl2_mutator_init_t init =
+      (sl2_mutator_init_t)dr_lookup_aux_library_routine(mutator.lib, SL2_MUTATOR_INIT_EXPORT);
+  mutator.mutate = (sl2_mutator_mutate_t)dr_lookup_aux_library_routine(
+      mutator.lib, SL2_MUTATOR_MUTATE_EXPORT);
+  mutator.teardown = (sl2_mutator_teardown_t)dr_lookup_aux_library_routine(
+      mutator.lib, SL2_MUTATOR_TEARDOWN_EXPORT);
+
+  if (init == NULL || mutator.mutate == NULL || mutator.teardown == NULL) {
+    SL2_DR_DEBUG("init_mutator: %s is missing one of the sl2_mutator_* exports\n", path.c_str());
+    dr_abort();
+  }
+
+  // The plugin gets its own stream of the run's seed, so that its runs reproduce too.
+  sl2_rng seed_rng;
+  sl2_rng_seed_string(&seed_rng, rng_seed, UINT64_MAX);
+
+  std::string options = op_mutator_options.get_value();
+  mutator.state = init(SL2_MUTATOR_ABI_VERSION, sl2_rng_next(&seed_rng), options.c_str());
+
+  if (mutator.state == NULL) {
+    SL2_DR_DEBUG("init_mutator: %s failed to initialize\n", path.c_str());
+    dr_abort();
+  }
+
+  mutator.lock = dr_mutex_create();
+
+  SL2_DR_DEBUG("init_mutator: loaded %s\n", path.c_str());
+}
+
+/**
+ * Tears down and unloads the mutator plugin, if we loaded one.
+ */
+static void exit_mutator() {
+  if (mutator.state == NULL) {
+    return;
+  }
+
+  mutator.teardown(mutator.state);
+  mutator.state = NULL;
+
+  for (sl2_mutator_batch &batch : mutator.batches) {
+    if (batch.data) {
+      dr_raw_mem_free(batch.data, batch.data_size);
+    }
+  }
+
+  dr_mutex_destroy(mutator.lock);
+  dr_unload_aux_library(mutator.lib);
+}
+
+/**
+ * Asks the mutator plugin for a new batch of candidates for a targeted read.
+ * Only persistent and snapshot runs see the same read more than once, so anything
+ * else only asks for a single candidate.
+ * @param batch the read's batch, which is replaced
+ * @param mutation the targeted read
+ * @param capacity the room that each candidate has
+ * @param hash the read's hash
+ */
+static void refill_mutator_batch(sl2_mutator_batch *batch, sl2_mutation *mutation,
+                                 size_t capacity, uint64_t hash) {
+  bool repeats = op_snapshot.get_value() || op_persist_module.get_value() != "";
+  uint32_t count = repeats ? SL2_MUTATOR_BATCH : 1;
+  size_t data_size = count * capacity;
+
+  batch->hash = hash;
+  batch->capacity = capacity;
+  batch->count = 0;
+  batch->next = 0;
+
+  if (batch->data_size < data_size) {
+    if (batch->data) {
+      dr_raw_mem_free(batch->data, batch->data_size);
+    }
+
+    batch->data =
+        (uint8_t *)sl2_raw_mem_alloc(data_size, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+    batch->data_size = batch->data ? data_size : 0;
+  }
+
+  if (batch->data == NULL) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    batch->candidates[i] = {batch->data + (i * capacity), 0};
+  }
+
+  sl2_mutator_input input = {
+      mutation->function, mutation->mut_count, mutation->resource, mutation->position,
+      mutation->buffer,   mutation->bufsize,   capacity,
+  };
+
+  uint32_t prepared = mutator.mutate(mutator.state, &input, batch->candidates, count);
+
+  if (prepared > count) {
+    SL2_DR_DEBUG("refill_mutator_batch: plugin prepared too many candidates, dropping them\n");
+    return;
+  }
+
+  for (uint32_t i = 0; i < prepared; i++) {
+    if (batch->candidates[i].bufsize == 0 || batch->candidates[i].bufsize > capacity) {
+      SL2_DR_DEBUG("refill_mutator_batch: candidate %u has a bad size, dropping the batch\n", i);
+      return;
+    }
+  }
+
+  batch->count = prepared;
+}
+
+/**
+ * Replaces a targeted read with the next candidate that the mutator plugin prepared for it,
+ * asking the plugin for more once they run out (or the read changes).
+ * @param mutation the targeted read
+ * @return whether the read was replaced; false if the plugin declined to mutate it
+ */
+static bool mutate_plugin(sl2_mutation *mutation) {
+  bool mutated = false;
+
+  if (mutation->mut_count >= SL2_MUTATOR_MAX_READS || mutation->bufsize == 0) {
+    return false;
+  }
+
+  sl2_mutator_batch *batch = &(mutator.batches[mutation->mut_count]);
+  size_t capacity = max(mutation->bufsize, mutation->capacity);
+  uint64_t hash = sl2_ring_hash(mutation->buffer, mutation->bufsize);
+
+  dr_mutex_lock(mutator.lock);
+
+  if (batch->next >= batch->count || batch->hash != hash || batch->capacity != capacity) {
+    refill_mutator_batch(batch, mutation, capacity, hash);
+  }
+
+  if (batch->next < batch->count) {
+    sl2_mutator_candidate *candidate = &(batch->candidates[batch->next++]);
+
+    memcpy(mutation->buffer, candidate->buffer, candidate->bufsize);
+    mutation->bufsize = candidate->bufsize;
+    mutation->mut_type = SL2_PLUGIN_STRATEGY;
+    mutated = true;
+  }
+
+  dr_mutex_unlock(mutator.lock);
+
+  return mutated;
+}
+
+/**
+ * Applies the next deterministic mutation that the server hands out for our arena.
+ * @param mutation the targeted read
+ * @return whether a deterministic mutation was applied; false once every stage has been walked
+ */
+static bool mutate_deterministic(sl2_mutation *mutation) {
+  sl2_det_cursor cursor;
+
+  if (sl2_conn_advise_deterministic(thread_conn(), arena, mutation->bufsize, &cursor) !=
+      SL2Response::OK) {
+    SL2_DR_DEBUG("mutate_deterministic: couldn't get a deterministic mutation\n");
+    return false;
+  }
+
+  if (!do_mutation_deterministic(mutation, &cursor)) {
+    return false;
+  }
+
+  SL2_DR_DEBUG("mutate_deterministic: stage=%u offset=%llu\n", cursor.stage, cursor.offset);
+
+  return true;
+}
+
+/**
+ * Splices an input from the server's corpus for the same targeted read into a targeted read.
+ * @param mutation the targeted read
+ * @return whether a donor was spliced in; false if the corpus had no (usable) donor
+ */
+static bool mutate_splice(sl2_mutation *mutation) {
+  void *drcontext = dr_get_current_drcontext();
+  size_t capacity = max(mutation->bufsize, mutation->capacity);
+  uint8_t *donor = (uint8_t *)sl2_thread_alloc(drcontext, capacity);
+  size_t donor_size = 0;
+  bool spliced = false;
+
+  if (sl2_conn_request_donor(thread_conn(), arena, mutation->mut_count, donor, capacity,
+                             &donor_size) != SL2Response::OK) {
+    SL2_DR_DEBUG("mutate_splice: couldn't get a donor for mutation %u\n", mutation->mut_count);
+  } else if (donor_size > 0) {
+    sl2_rng *rng = (sl2_rng *)drmgr_get_tls_field(drcontext, thread_rng_idx);
+    spliced = do_mutation_splice(rng, mutation, donor, donor_size);
+  }
+
+  dr_thread_free(drcontext, donor, capacity);
+
+  if (spliced) {
+    SL2_DR_DEBUG("mutate_splice: spliced a %lu byte donor into mutation %u\n", donor_size,
+                 mutation->mut_count);
+  }
+
+  return spliced;
+}
+
+/**
+ * Replaces a targeted read's bytes with a seed from the server's corpus for the same targeted
+ * read, to be mutated in their place. Seeds longer than the read only fit if the read's length
+ * can change, and are cut short otherwise.
+ * @param mutation the targeted read
+ * @return whether the read was seeded; false if the corpus had no seed for it
+ */
+static bool apply_seed(sl2_mutation *mutation) {
+  void *drcontext = dr_get_current_drcontext();
+  size_t capacity = max(mutation->bufsize, mutation->capacity);
+  uint8_t *seed = (uint8_t *)sl2_thread_alloc(drcontext, capacity);
+  size_t seed_size = 0;
+
+  if (sl2_conn_request_seed(thread_conn(), arena, mutation->mut_count, seed, capacity,
+                            &seed_size) != SL2Response::OK) {
+    SL2_DR_DEBUG("apply_seed: couldn't get a seed for mutation %u\n", mutation->mut_count);
+    seed_size = 0;
+  }
+
+  if (seed_size > 0) {
+    // A read whose length can't change keeps its own tail past a shorter seed.
+    if (mutation->capacity) {
+      mutation->bufsize = seed_size;
+    }
+
+    memcpy(mutation->buffer, seed, min(seed_size, mutation->bufsize));
+
+    SL2_DR_DEBUG("apply_seed: seeded mutation %u with %lu bytes\n", mutation->mut_count,
+                 seed_size);
+  }
+
+  dr_thread_free(drcontext, seed, capacity);
+
+  return seed_size > 0;
+}
+
+/**
+ * Replaces a targeted read with a mutation that the server pre-generated for it, mapping the
+ * read's mutation ring the first time we see it.
+ * @param mutation the targeted read, which is overwritten
+ * @param seq receives the mutation's position in the ring
+ * @return the ring that the mutation came from, or NULL if we should mutate in-process
+ */
+static sl2_mutation_ring *pop_ring_mutation(sl2_mutation *mutation, uint64_t *seq) {
+  sl2_mutation_ring *ring = NULL;
+
+  if (mutation->mut_count >= SL2_CONN_MAX_RINGS || ring_unavailable[mutation->mut_count]) {
+    return NULL;
+  }
+
+  if (sl2_conn_map_ring(thread_conn(), arena->id, mutation, &ring) != SL2Response::OK) {
+    SL2_DR_DEBUG("pop_ring_mutation: no ring for mutation %u, mutating in-process\n",
+                 mutation->mut_count);
+    ring_unavailable[mutation->mut_count] = true;
+    return NULL;
+  }
+
+  // An empty ring just means that the server is behind; try again next time.
+  if (!sl2_ring_pop(ring, mutation->buffer, mutation->bufsize, &(mutation->mut_type), seq)) {
+    SL2_DR_DEBUG("pop_ring_mutation: ring for mutation %u is empty\n", mutation->mut_count);
+    return NULL;
+  }
+
+  SL2_DR_DEBUG("pop_ring_mutation: took mutation %llu from ring %u\n", *seq, ring->id);
+
+  return ring;
+}
+
+/**
+ * Mutates a targeted read with the in-process mutation engine, following the server's strategy
+ * advice when we have coverage.
+ * @param mutation the targeted read
+ */
+static void mutate_in_process(sl2_mutation *mutation) {
+  sl2_rng *rng = (sl2_rng *)drmgr_get_tls_field(dr_get_current_drcontext(), thread_rng_idx);
+
+  if (op_havoc.get_value()) {
+    // With coverage, the server's advice still picks the bottom of the stack.
+    int first_strategy = -1;
+
+    if (coverage_guided) {
+      sl2_mutation_advice advice;
+      sl2_conn_advise_mutation(thread_conn(), arena, mutation, &advice);
+      first_strategy = (int)advice.table_idx;
+    }
+
+    do_mutation_havoc(rng, mutation, op_havoc_stack.get_value(), first_strategy);
+  } else if (coverage_guided) {
+    sl2_mutation_advice advice;
+    sl2_conn_advise_mutation(thread_conn(), arena, mutation, &advice);
+    do_mutation_custom(rng, mutation, advice.strategy);
+  } else {
+    do_mutation(rng, mutation);
+  }
+}
+
+/**
+ * Mutates (and registers) a window of a read that's bigger than -mutation_window, rather than the
+ * whole read. The window is registered as a delta of the whole read whenever the mutation leaves
+ * most of it alone, so that its FKT replays like any other's without either one touching the rest
+ * of the read.
+ * Windows keep their size, since resizing one would move the rest of the read. Neither
+ * the deterministic stages, seeds, splicing nor the server's rings apply to them, since those all
+ * work on whole reads.
+ * @param mutation the targeted read
+ * @return whether the server accepted the mutation
+ */
+static bool mutate_window(sl2_mutation *mutation) {
+  size_t len = op_mutation_window.get_value();
+  size_t offset;
+
+  if (op_mutation_window_at.get_value() >= 0) {
+    offset = std::min((size_t)op_mutation_window_at.get_value(), mutation->bufsize - len);
+  } else {
+    sl2_rng *rng = (sl2_rng *)drmgr_get_tls_field(dr_get_current_drcontext(), thread_rng_idx);
+    offset = (size_t)sl2_rng_below(rng, mutation->bufsize - len + 1);
+  }
+
+  sl2_mutation window = *mutation;
+  window.buffer += offset;
+  window.bufsize = len;
+  window.position += offset;
+  window.capacity = 0;
+
+  // A delta that's over half the size of the window isn't worth sending.
+  size_t delta_capacity = len / 2;
+  uint8_t *original = (uint8_t *)sl2_raw_mem_alloc(len, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+  uint8_t *delta = NULL;
+  size_t delta_size = 0;
+
+  if (original) {
+    memcpy(original, window.buffer, len);
+  }
+
+  if (!mutator.state || !mutate_plugin(&window)) {
+    mutate_in_process(&window);
+  }
+
+  mutation->mut_type = window.mut_type;
+  mutation->chain_seed = window.chain_seed;
+  mutation->chain_len = window.chain_len;
+  memcpy(mutation->chain, window.chain, sizeof(mutation->chain));
+
+  if (original && delta_capacity > sizeof(sl2_delta)) {
+    delta = (uint8_t *)sl2_raw_mem_alloc(delta_capacity, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+  }
+
+  if (delta) {
+    delta_size = sl2_delta_encode(original, len, window.buffer, len, delta, delta_capacity);
+  }
+
+  if (delta_size) {
+    sl2_delta_rebase(delta, delta_size, offset, mutation->bufsize);
+  }
+
+  SL2_DR_DEBUG("mutate_window: mutated %lu bytes at %lu (delta is %lu bytes)\n", len, offset,
+               delta_size);
+
+  lock_registration();
+  SL2Response res =
+      sl2_conn_register_mutation(thread_conn(), mutation, delta_size ? delta : NULL, delta_size);
+  unlock_registration();
+
+  if (delta) {
+    dr_raw_mem_free(delta, delta_capacity);
+  }
+
+  if (original) {
+    dr_raw_mem_free(original, len);
+  }
+
+  return res == SL2Response::OK;
+}
+
+/**
+ * Registers a mutation with the server. If we kept the read's original bytes and the mutation
+ * only changed a small part of them, only the changed ranges are sent.
+ * @param mutation the mutation
+ * @param original the read's original bytes, or NULL to send the whole mutated buffer
+ * @param original_size the size of the original bytes
+ * @return whether the server accepted the mutation
+ */
+static bool register_mutation(sl2_mutation *mutation, const uint8_t *original,
+                              size_t original_size) {
+  uint8_t *delta = NULL;
+  size_t delta_size = 0;
+  size_t delta_capacity = mutation->bufsize / 2;
+
+  if (original && delta_capacity > sizeof(sl2_delta)) {
+    delta = (uint8_t *)sl2_raw_mem_alloc(delta_capacity, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+  }
+
+  if (delta) {
+    delta_size = sl2_delta_encode(original, original_size, mutation->buffer, mutation->bufsize,
+                                  delta, delta_capacity);
+    SL2_DR_DEBUG("register_mutation: delta is %lu bytes (buffer is %lu)\n", delta_size,
+                 mutation->bufsize);
+  }
+
+  lock_registration();
+  SL2Response res =
+      sl2_conn_register_mutation(thread_conn(), mutation, delta_size ? delta : NULL, delta_size);
+  unlock_registration();
+
+  if (delta) {
+    dr_raw_mem_free(delta, delta_capacity);
+  }
+
+  return res == SL2Response::OK;
+}
+
+/**
+ * Tells the target about a targeted read's new length, if a mutation changed it.
+ * @param wrapcxt the hooked function's wrap context, or NULL if it has already returned
+ * @param info the targeted read
+ * @param mutation the read's mutation
+ */
+static void report_read_size(void *wrapcxt, client_read_info *info, sl2_mutation *mutation) {
+  if (mutation->bufsize == info->nNumberOfBytesToRead) {
+    return;
+  }
+
+  SL2_DR_DEBUG("mutate: resized buffer from %lu to %lu bytes\n", info->nNumberOfBytesToRead,
+               mutation->bufsize);
+
+  if (info->lpNumberOfBytesRead) {
+    *(info->lpNumberOfBytesRead) = (DWORD)mutation->bufsize;
+  } else {
+    drwrap_set_retval(wrapcxt, (void *)mutation->bufsize);
+  }
+}
+
+/**
+ * Replaces a targeted read's bytes with its input under -replay_inputs, the same way that
+ * apply_seed does with a seed.
+ * @param mutation the targeted read
+ * @return whether the read had an input to replay
+ */
+static bool apply_replay_input(sl2_mutation *mutation) {
+  char path[MAX_PATH + 1] = {0};
+  dr_snprintf(path, MAX_PATH, "%s\\%u.bin", op_replay_inputs.get_value().c_str(),
+              mutation->mut_count);
+
+  file_t file = dr_open_file(path, DR_FILE_READ);
+  uint64 file_size = 0;
+
+  if (file == INVALID_FILE) {
+    return false;
+  }
+
+  // An empty input is legitimate (e.g. a read that the target saw hit EOF).
+  if (dr_file_size(file, &file_size) && mutation->capacity) {
+    mutation->bufsize = min((size_t)file_size, mutation->capacity);
+  }
+
+  ssize_t size = dr_read_file(file, mutation->buffer, min((size_t)file_size, mutation->bufsize));
+  dr_close_file(file);
+
+  SL2_DR_DEBUG("apply_replay_input: replayed %ld bytes into mutation %u\n", size,
+               mutation->mut_count);
+
+  return true;
+}
+
+/**
+ * Replaces a targeted read's bytes with the mutation that -replay_run made to it, the same way
+ * that the tracer does.
+ * @param mutation the targeted read
+ */
+static void apply_replay_run(sl2_mutation *mutation) {
+  size_t replayed = 0;
+  size_t bufsize = mutation->capacity ? mutation->capacity : mutation->bufsize;
+
+  if (sl2_conn_request_replay(&replay_conn, mutation->mut_count, bufsize, mutation->buffer,
+                              &replayed) != SL2Response::OK) {
+    SL2_DR_DEBUG("apply_replay_run: couldn't replay mutation %u\n", mutation->mut_count);
+    return;
+  }
+
+  if (mutation->capacity) {
+    mutation->bufsize = replayed;
+  }
+}
+
+/*! The strategies that crash focus nudges a crashing input with: small, local changes that keep
+ * most of the input (and so, hopefully, the crash) intact */
+static sl2_strategy_t focus_strategies[] = {
+    strategyFlipBit,
+    strategyKnownValues,
+    strategyAddSubKnownValues,
+};
+
+/**
+ * Starts a targeted read from the mutation that -focus_run made to it, and applies a single small
+ * strategy to it, so that the run explores the inputs right around a crash.
+ * @param mutation the targeted read
+ * @return whether the read was focused (and mutated), or false if -focus_run didn't mutate it
+ */
+static bool mutate_focus(sl2_mutation *mutation) {
+  if (!replay_conn_open || mutation->mut_count >= op_focus_count.get_value()) {
+    return false;
+  }
+
+  apply_replay_run(mutation);
+
+  sl2_rng *rng = (sl2_rng *)drmgr_get_tls_field(dr_get_current_drcontext(), thread_rng_idx);
+  sl2_strategy_t strategy =
+      focus_strategies[sl2_rng_below(rng, sizeof(focus_strategies) / sizeof(focus_strategies[0]))];
+
+  return do_mutation_custom(rng, mutation, strategy);
+}
+
+/**
+ * Writes the bytes that a targeted read ended up with under -replay_outputs.
+ * @param mutation the targeted read
+ */
+static void write_replay_output(sl2_mutation *mutation) {
+  char path[MAX_PATH + 1] = {0};
+  dr_snprintf(path, MAX_PATH, "%s\\%u.bin", op_replay_outputs.get_value().c_str(),
+              mutation->mut_count);
+
+  file_t file = dr_open_file(path, DR_FILE_WRITE_OVERWRITE);
+
+  if (file == INVALID_FILE) {
+    SL2_DR_DEBUG("write_replay_output: couldn't open %s\n", path);
+    return;
+  }
+
+  dr_write_file(file, mutation->buffer, mutation->bufsize);
+  dr_close_file(file);
+}
+
+/**
+ * Replays a targeted read: from -replay_inputs if it has an input for the read, from -replay_run
+ * if that run mutated it, and as-is otherwise.
+ * @param wrapcxt the hooked function's wrap context, or NULL if it has already returned
+ * @param info the targeted read
+ * @param mutation the read's mutation
+ * @return success
+ */
+static bool replay_read(void *wrapcxt, client_read_info *info, sl2_mutation *mutation) {
+  bool replayed = op_replay_inputs.get_value() != "" && apply_replay_input(mutation);
+
+  if (!replayed && replay_conn_open && mutation->mut_count < op_replay_count.get_value()) {
+    apply_replay_run(mutation);
+  }
+
+  if (op_replay_outputs.get_value() != "") {
+    write_replay_output(mutation);
+  }
+
+  report_read_size(wrapcxt, info, mutation);
+
+  return !op_replay_register.get_value() || register_mutation(mutation, NULL, 0);
+}
+
+/**
+ * Turns deferred coverage on, the first time that it's called: every block built from now on is
+ * instrumented, and the code cache is flushed so that the blocks built before now get rebuilt
+ * with instrumentation the next time that they run.
+ * This runs in hooks, so the flush is delayed until every thread is out of the cache.
+ */
+static void arm_coverage() {
+  if (coverage_armed) {
+    return;
+  }
+
+  coverage_armed = true;
+
+  if (!dr_delay_flush_region((app_pc)0, ~(size_t)0, 0, NULL)) {
+    SL2_DR_DEBUG("arm_coverage: couldn't flush the code cache, startup blocks stay uncovered\n");
+  }
+}
+
+/**
+ * Mutates a function's input buffer, registers the mutation with the server,
+ * and writes the buffer into memory for fuzzing. If the mutation changed the buffer's length,
+ * the new length is reported back to the target.
+ * @param wrapcxt the hooked function's wrap context, or NULL if it has already returned
+ * @param info client_read_info with function metadata
+ * @return success
+ */
+static bool mutate(void *wrapcxt, client_read_info *info) {
+  SL2_PROFILE(SL2_PROBE_MUTATE);
+  uint64_t mutate_start = dr_get_microseconds();
+  void *drcontext = dr_get_current_drcontext();
+  sl2_persist_worker *worker = current_worker(drcontext);
+
+  arm_coverage();
+  arm_watchdog();
+
+  if (info->source) {
+    SL2_DR_DEBUG("mutate: info->source: %S\n", info->source);
+  }
+
+  sl2_mutation mutation = {
+      (uint32_t)info->function,
+      worker ? worker->mut_count++ : mut_count++,
+      0, // NOTE(ww): We don't know the mutation type yet.
+      info->source,
+      info->position,
+      info->nNumberOfBytesToRead,
+      (uint8_t *)info->lpBuffer,
+  };
+
+  // We can only change the buffer's length when we can tell the target about it:
+  // either through the function's bytes-read pointer, or (for recv) its return value.
+  if (info->lpNumberOfBytesRead || (info->function == Function::recv && wrapcxt)) {
+    mutation.capacity = info->capacity;
+  }
+
+  if (replaying) {
+    return replay_read(wrapcxt, info, &mutation);
+  }
+
+  // Windowed mutations are registered as deltas within their windows, so they don't get
+  // fixups, which could change bytes outside of them.
+  if (op_mutation_window.get_value() && mutation.bufsize > op_mutation_window.get_value()) {
+    bool windowed = mutate_window(&mutation);
+
+    if (windowed) {
+      log_persist_read(drcontext, &mutation);
+      sl2_etw_mutation(mutation.mut_count, mutation.mut_type, mutation.bufsize,
+                       dr_get_microseconds() - mutate_start);
+    }
+
+    return windowed;
+  }
+
+  sl2_mutation_ring *ring = NULL;
+  uint64_t ring_seq = 0;
+  bool mutated = false;
+  bool registered = false;
+
+  // Large reads (e.g. whole mapped files) are usually only changed in a few places,
+  // so we keep their original bytes around to register the mutation as a delta against.
+  uint8_t *original = NULL;
+  size_t original_size = mutation.bufsize;
+
+  if (original_size >= SL2_DELTA_MIN_BUFSIZE) {
+    original =
+        (uint8_t *)sl2_raw_mem_alloc(original_size, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+  }
+
+  if (original) {
+    memcpy(original, mutation.buffer, original_size);
+  }
+
+  // A focused read is already as close to its crash as we want it; nothing else gets
+  // to mutate it.
+  if (op_focus_run.get_value() != "") {
+    mutated = mutate_focus(&mutation);
+  }
+
+  // The deterministic stages walk a single buffer, so they only ever apply to
+  // the first targeted read of each run. Neither they nor the server's rings change the
+  // buffer's length.
+  if (!mutated && op_deterministic.get_value() && coverage_guided && mutation.mut_count == 0) {
+    mutated = mutate_deterministic(&mutation);
+  }
+
+  // A seed replaces the read's bytes, but still gets mutated below. The server's rings
+  // are generated from the read's own bytes, so they're skipped for seeded reads.
+  bool seeded = false;
+
+  if (!mutated && op_seeds.get_value() && coverage_guided) {
+    sl2_rng *rng = (sl2_rng *)drmgr_get_tls_field(drcontext, thread_rng_idx);
+
+    if (sl2_rng_below(rng, op_seeds.get_value()) == 0) {
+      seeded = apply_seed(&mutation);
+    }
+  }
+
+  if (!mutated && mutator.state) {
+    mutated = mutate_plugin(&mutation);
+  }
+
+  if (!mutated && op_splice.get_value() && coverage_guided) {
+    sl2_rng *rng = (sl2_rng *)drmgr_get_tls_field(drcontext, thread_rng_idx);
+
+    if (sl2_rng_below(rng, op_splice.get_value()) == 0) {
+      mutated = mutate_splice(&mutation);
+    }
+  }
+
+  if (!mutated && !seeded && op_ring.get_value() && coverage_guided && !op_havoc.get_value()) {
+    ring = pop_ring_mutation(&mutation, &ring_seq);
+    mutated = ring != NULL;
+  }
+
+  if (!mutated) {
+    mutate_in_process(&mutation);
+  }
+
+  // Recompute the read's checksums and lengths, so that the mutation gets past the target's
+  // integrity checks. The server's copy of a ring mutation is from before its fixups, so a ring
+  // mutation that they changed is registered in full instead.
+  if (fixups_view &&
+      sl2_apply_fixups(&fixups, mutation.mut_count, mutation.buffer, mutation.bufsize)) {
+    ring = NULL;
+  }
+
+  // SL2_DR_DEBUG("mutate: %.*s\n", mutation.bufsize, mutation.buffer);
+
+  report_read_size(wrapcxt, info, &mutation);
+
+  // If the mutation came from a ring, the server already has it. We still have the buffer,
+  // so we can fall back on uploading it if the server has forgotten the mutation.
+  if (ring) {
+    lock_registration();
+    registered = sl2_conn_register_ring_mutation(thread_conn(), &mutation, ring, ring_seq) ==
+                 SL2Response::OK;
+    unlock_registration();
+  }
+
+  // Tell the server about our mutation.
+  if (!registered) {
+    registered = register_mutation(&mutation, original, original_size);
+  }
+
+  if (original) {
+    dr_raw_mem_free(original, original_size);
+  }
+
+  if (!registered) {
+    SL2_DR_DEBUG("mutate: got an error response from the server!\n");
+    return false;
+  }
+
+  log_persist_read(drcontext, &mutation);
+  sl2_etw_mutation(mutation.mut_count, mutation.mut_type, mutation.bufsize,
+                   dr_get_microseconds() - mutate_start);
+  return true;
+}
+
+/**
+ * @param mem a region of the application's memory, from dr_query_memory_ex
+ * @return whether the region is one that snapshots copy: writable, committed, and neither
+ *         DynamoRIO's, ours, nor the coverage arena
+ */
+static bool snapshot_wanted(const dr_mem_info_t &mem) {
+  app_pc end = mem.base_pc + mem.size;
+
+  return mem.type != DR_MEMTYPE_FREE && mem.type != DR_MEMTYPE_RESERVED &&
+         (mem.prot & DR_MEMPROT_WRITE) && !(mem.prot & DR_MEMPROT_GUARD) &&
+         !dr_memory_is_dr_internal(mem.base_pc) && !dr_memory_is_in_client(mem.base_pc) &&
+         !((app_pc)arena->map >= mem.base_pc && (app_pc)arena->map < end);
+}
+
+/**
+ * Snapshots the application at its first targeted read: the reading thread's context, and a
+ * copy of every writable region of memory that doesn't belong to DynamoRIO or to us.
+ * Kernel state (file positions, sockets, other threads) isn't captured, so this
+ * works best for targets that do all of their post-read work on the reading thread.
+ * @param wrapcxt - DynamoRIO Wrap Context, from the targeted read's post-hook.
+ * @param info - the targeted read
+ */
+static void take_snapshot(void *wrapcxt, client_read_info *info) {
+  void *drcontext = drwrap_get_drcontext(wrapcxt);
+
+  snapshot.thread_id = dr_get_thread_id(drcontext);
+  snapshot.mc = *drwrap_get_mcontext_ex(wrapcxt, DR_MC_ALL);
+
+  snapshot.info = *info;
+  snapshot.info.argHash = NULL;
+  if (info->source) {
+    wcsncpy_s(snapshot.source, MAX_PATH + 1, info->source, _TRUNCATE);
+    snapshot.info.source = snapshot.source;
+  }
+
+  snapshot.mut_count = mut_count;
+  snapshot.call_counts = client.call_counts;
+  snapshot.ret_addr_counts = client.ret_addr_counts;
+
+  app_pc pc = NULL;
+  dr_mem_info_t mem;
+  size_t total = 0;
+
+  while (dr_query_memory_ex(pc, &mem)) {
+    app_pc next = mem.base_pc + mem.size;
+
+    if (snapshot_wanted(mem)) {
+      sl2_snapshot_region region = {mem.base_pc, mem.size, NULL};
+      region.data =
+          (uint8_t *)sl2_raw_mem_alloc(mem.size, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+
+      if (region.data && dr_safe_read(region.base, region.size, region.data, NULL)) {
+        snapshot.regions.push_back(region);
+        total += region.size;
+      } else if (region.data) {
+        dr_raw_mem_free(region.data, region.size);
+      }
+    }
+
+    if (next <= pc) {
+      break;
+    }
+
+    pc = next;
+  }
+
+  snapshot.taken = true;
+
+  SL2_DR_DEBUG("took a snapshot of %d regions (%llu bytes), resuming %d times\n",
+               snapshot.regions.size(), (uint64_t)total, op_snapshot_iterations.get_value());
+}
+
+/**
+ * Frees the memory copies taken by take_snapshot.
+ */
+static void free_snapshot() {
+  for (sl2_snapshot_region &region : snapshot.regions) {
+    dr_raw_mem_free(region.data, region.size);
+  }
+
+  snapshot.regions.clear();
+}
+
+/**
+ * Counts the writable regions that the application has allocated since the snapshot. They
+ * aren't restored (or freed) on resume, so they're only noted in the iteration's debug output.
+ * @param bytes receives the regions' total size
+ * @return the number of regions
+ */
+static uint32_t count_unsnapshotted_regions(uint64_t *bytes) {
+  app_pc pc = NULL;
+  dr_mem_info_t mem;
+  size_t covering = 0;
+  uint32_t count = 0;
+
+  *bytes = 0;
+
+  // The snapshot's regions are in address order, since they were found by walking memory too.
+  while (dr_query_memory_ex(pc, &mem)) {
+    app_pc next = mem.base_pc + mem.size;
+
+    while (covering < snapshot.regions.size() &&
+           snapshot.regions[covering].base + snapshot.regions[covering].size <= mem.base_pc) {
+      covering++;
+    }
+
+    if (snapshot_wanted(mem) &&
+        (covering == snapshot.regions.size() || snapshot.regions[covering].base > mem.base_pc)) {
+      count++;
+      *bytes += mem.size;
+    }
+
+    if (next <= pc) {
+      break;
+    }
+
+    pc = next;
+  }
+
+  return count;
+}
+
+/**
+ * Puts the application's memory back the way it was at the snapshot.
+ * @return whether every region was restored. Regions that the application has since freed or
+ *         made read-only can't be, and then the process can't be resumed.
+ */
+static bool restore_snapshot() {
+  bool restored = true;
+
+  for (sl2_snapshot_region &region : snapshot.regions) {
+    size_t written = 0;
+
+    if (dr_safe_write(region.base, region.size, region.data, &written) &&
+        written == region.size) {
+      continue;
+    }
+
+    dr_mem_info_t mem;
+
+    if (dr_query_memory_ex(region.base, &mem)) {
+      SL2_DR_DEBUG("snapshot: couldn't restore %p (%llu bytes, wrote %llu): it's now %p (%llu "
+                   "bytes), type %d, prot %d\n",
+                   region.base, (uint64_t)region.size, (uint64_t)written, mem.base_pc,
+                   (uint64_t)mem.size, mem.type, mem.prot);
+    } else {
+      SL2_DR_DEBUG("snapshot: couldn't restore %p (%llu bytes, wrote %llu), and can't query it\n",
+                   region.base, (uint64_t)region.size, (uint64_t)written);
+    }
+
+    restored = false;
+  }
+
+  uint64_t new_bytes;
+  uint32_t new_regions = count_unsnapshotted_regions(&new_bytes);
+
+  if (new_regions) {
+    SL2_DR_DEBUG("snapshot: iteration %d left %d regions (%llu bytes) that were allocated after "
+                 "the snapshot\n",
+                 snapshot.iteration, new_regions, new_bytes);
+  }
+
+  return restored;
 }
 
 /**
- * Mutates a function's input buffer, registers the mutation with the server,
- * and writes the buffer into memory for fuzzing.
- * @param info client_read_info with function metadata
- * @return success
+ * Intercepts process exit in snapshot mode. Reports the iteration's coverage, puts the
+ * application's memory back the way it was at the snapshot, re-mutates the targeted read,
+ * and resumes the reading thread from its return. If the memory can't be put back, the
+ * process exits as usual instead.
+ * @param wrapcxt - DynamoRIO Wrap Context.
+ * @param user_data - unused
  */
-static bool mutate(client_read_info *info) {
-  if (info->source) {
-    SL2_DR_DEBUG("mutate: info->source: %S\n", info->source);
+static void wrap_pre_RtlExitUserProcess(void *wrapcxt, OUT void **user_data) {
+  void *drcontext = drwrap_get_drcontext(wrapcxt);
+
+  if (!snapshot.taken || dr_get_thread_id(drcontext) != snapshot.thread_id) {
+    return;
   }
 
-  sl2_mutation mutation = {
-      (uint32_t)info->function,
-      mut_count++,
-      0, // NOTE(ww): We don't know the mutation type yet.
-      info->source,
-      info->position,
-      info->nNumberOfBytesToRead,
-      (uint8_t *)info->lpBuffer,
-  };
+  if (++snapshot.iteration >= op_snapshot_iterations.get_value()) {
+    SL2_DR_DEBUG("snapshot finished after %d iterations\n", snapshot.iteration);
+    return;
+  }
 
   if (coverage_guided) {
-    sl2_mutation_advice advice;
-    sl2_conn_advise_mutation(&sl2_conn, &arena, &advice);
-    do_mutation_custom(&mutation, advice.strategy);
-  } else {
-    do_mutation(&mutation);
+    report_iteration_coverage();
   }
 
-  // SL2_DR_DEBUG("mutate: %.*s\n", mutation.bufsize, mutation.buffer);
+  if (!restore_snapshot()) {
+    SL2_DR_DEBUG("snapshot: exiting after %d iterations, since the snapshot couldn't be "
+                 "restored\n",
+                 snapshot.iteration);
+    return;
+  }
 
-  // Tell the server about our mutation.
-  if (sl2_conn_register_mutation(&sl2_conn, &mutation) != SL2Response::OK) {
-    SL2_DR_DEBUG("mutate: got an error response from the server!\n");
-    return false;
+  client.call_counts = snapshot.call_counts;
+  client.ret_addr_counts = snapshot.ret_addr_counts;
+  mut_count = snapshot.mut_count;
+
+  if (!mutate(NULL, &snapshot.info)) {
+    crashed = false;
+    dr_exit_process(1);
   }
 
-  return true;
+  dr_mcontext_t *mc = drwrap_get_mcontext_ex(wrapcxt, DR_MC_ALL);
+  *mc = snapshot.mc;
+  drwrap_redirect_execution(wrapcxt);
 }
 
 /**
@@ -280,6 +5643,48 @@ static void wrap_pre_VerifierStopMessage(void *wrapcxt, OUT void **user_data) {
   client.wrap_pre_VerifierStopMessage(wrapcxt, user_data, on_exception);
 }
 
+/**
+  Transparent wrapper around SL2Client.wrap_pre_CloseHandle, except that -virtual_file handles are
+  closed here
+ * @param wrapcxt - DynamoRIO Wrap Context. Opaque pointer that can be passed to DR helper
+ functions.
+ * @param user_data - unused
+ */
+static void wrap_pre_CloseHandle(void *wrapcxt, OUT void **user_data) {
+  sl2_virtual_handle *vhandle = virtual_handle(drwrap_get_arg(wrapcxt, 0));
+
+  if (vhandle) {
+    dr_mutex_lock(virtual_file_lock);
+    vhandle->open = false;
+    dr_mutex_unlock(virtual_file_lock);
+
+    drwrap_skip_call(wrapcxt, (void *)TRUE, 0);
+    return;
+  }
+
+  client.wrap_pre_CloseHandle(wrapcxt, user_data);
+}
+
+/**
+  Transparent wrapper around SL2Client.wrap_pre_DuplicateHandle
+ * @param wrapcxt - DynamoRIO Wrap Context. Opaque pointer that can be passed to DR helper
+ functions.
+ * @param user_data - passed to wrap_post_DuplicateHandle
+ */
+static void wrap_pre_DuplicateHandle(void *wrapcxt, OUT void **user_data) {
+  client.wrap_pre_DuplicateHandle(wrapcxt, user_data);
+}
+
+/**
+  Transparent wrapper around SL2Client.wrap_post_DuplicateHandle
+ * @param wrapcxt - DynamoRIO Wrap Context. Opaque pointer that can be passed to DR helper
+ functions.
+ * @param user_data - from wrap_pre_DuplicateHandle
+ */
+static void wrap_post_DuplicateHandle(void *wrapcxt, void *user_data) {
+  client.wrap_post_DuplicateHandle(wrapcxt, user_data);
+}
+
 /**
  * Transparent wrapper around SL2Client.wrap_pre_ReadEventLog
  * @param wrapcxt - DynamoRIO Wrap Context. Opaque pointer that can be passed to DR helper
@@ -324,6 +5729,58 @@ static void wrap_pre_InternetReadFile(void *wrapcxt, OUT void **user_data) {
   client.wrap_pre_InternetReadFile(wrapcxt, user_data);
 }
 
+static void handle_read(void *wrapcxt, client_read_info *info);
+
+/**
+ * Serves a recv or WinHttpReadData on an emulated connection from the peer's responses, and
+ * mutates it right away if it's targeted, since the real function (and so its post-hook) is
+ * skipped.
+ * recv(s, buf, len, flags)
+ * WinHttpReadData(hRequest, lpBuffer, dwNumberOfBytesToRead, lpdwNumberOfBytesRead)
+ * @param wrapcxt - DynamoRIO Wrap Context, from the function's pre-hook.
+ * @param conn - the emulated connection being read
+ */
+static void read_emulated_peer(void *wrapcxt, sl2_peer_conn *conn) {
+  void *drcontext = drwrap_get_drcontext(wrapcxt);
+  bool socket = conn->kind == SL2_PEER_SOCKET;
+  void *buf = drwrap_get_arg(wrapcxt, 1);
+#pragma warning(suppress : 4311 4302)
+  int len = (int)drwrap_get_arg(wrapcxt, 2);
+#pragma warning(suppress : 4311 4302)
+  bool peek = socket && ((int)drwrap_get_arg(wrapcxt, 3) & MSG_PEEK);
+  size_t count;
+
+  if (len < 0 || !read_peer(conn, buf, (size_t)len, peek, &count)) {
+    drwrap_skip_call(wrapcxt, socket ? (void *)(ptrdiff_t)SOCKET_ERROR : (void *)FALSE, 0);
+    return;
+  }
+
+  client_read_info *info = NULL;
+  DWORD nread = (DWORD)count;
+
+  if (socket) {
+    client.wrap_pre_recv(wrapcxt, (void **)&info);
+  } else {
+    client.wrap_pre_WinHttpReadData(wrapcxt, (void **)&info);
+  }
+
+  // Unlike a real recv's post-hook, we know how many bytes were read, so the mutation
+  // can still change the length that the target sees.
+  if (socket || !info->lpNumberOfBytesRead) {
+    info->lpNumberOfBytesRead = &nread;
+    info->capacity = (size_t)len;
+  }
+
+  *info->lpNumberOfBytesRead = nread;
+
+  handle_read(NULL, info);
+
+  nread = *info->lpNumberOfBytesRead;
+  client.free_read_info(drcontext, info);
+
+  drwrap_skip_call(wrapcxt, socket ? (void *)(ptrdiff_t)nread : (void *)TRUE, 0);
+}
+
 /**
  * Transparent wrapper around SL2Client.wrap_pre_WinHttpReadData
  * @param wrapcxt - DynamoRIO Wrap Context. Opaque pointer that can be passed to DR helper
@@ -332,6 +5789,13 @@ static void wrap_pre_InternetReadFile(void *wrapcxt, OUT void **user_data) {
  * by wrap_pre
  */
 static void wrap_pre_WinHttpReadData(void *wrapcxt, OUT void **user_data) {
+  sl2_peer_conn *conn = peer_handle(drwrap_get_arg(wrapcxt, 0), SL2_PEER_REQUEST);
+
+  if (conn) {
+    read_emulated_peer(wrapcxt, conn);
+    return;
+  }
+
   client.wrap_pre_WinHttpReadData(wrapcxt, user_data);
 }
 
@@ -343,17 +5807,105 @@ static void wrap_pre_WinHttpReadData(void *wrapcxt, OUT void **user_data) {
  * by wrap_pre
  */
 static void wrap_pre_recv(void *wrapcxt, OUT void **user_data) {
+  sl2_peer_conn *conn = peer_socket((SOCKET)drwrap_get_arg(wrapcxt, 0));
+
+  if (conn) {
+    read_emulated_peer(wrapcxt, conn);
+    return;
+  }
+
   client.wrap_pre_recv(wrapcxt, user_data);
 }
 
 /**
- * Transparent wrapper around SL2Client.wrap_pre_ReadFile
+ * Serves a ReadFile of a -virtual_file handle from memory, and mutates it right away if it's
+ * targeted, since the real ReadFile (and so its post-hook) is skipped.
+ * ReadFile(hFile, lpBuffer, nNumberOfBytesToRead, lpNumberOfBytesRead, lpOverlapped)
+ * @param wrapcxt - DynamoRIO Wrap Context, from ReadFile's pre-hook.
+ * @param vhandle - the -virtual_file handle being read
+ */
+static void read_virtual_file(void *wrapcxt, sl2_virtual_handle *vhandle) {
+  void *drcontext = drwrap_get_drcontext(wrapcxt);
+  void *lpBuffer = drwrap_get_arg(wrapcxt, 1);
+#pragma warning(suppress : 4311 4302)
+  DWORD nNumberOfBytesToRead = (DWORD)drwrap_get_arg(wrapcxt, 2);
+  DWORD *lpNumberOfBytesRead = (DWORD *)drwrap_get_arg(wrapcxt, 3);
+  OVERLAPPED *lpOverlapped = (OVERLAPPED *)drwrap_get_arg(wrapcxt, 4);
+  uint64_t position;
+  size_t count = 0;
+
+  // Like a synchronous handle's, overlapped reads come from the given offset and don't
+  // move the file pointer.
+  dr_mutex_lock(virtual_file_lock);
+
+  position = lpOverlapped ? ((uint64_t)lpOverlapped->OffsetHigh << 32) | lpOverlapped->Offset
+                          : vhandle->position;
+
+  if (position < virtual_file_size) {
+    count = std::min((size_t)nNumberOfBytesToRead, virtual_file_size - (size_t)position);
+  }
+
+  if (!lpOverlapped) {
+    vhandle->position = position + count;
+  }
+
+  dr_mutex_unlock(virtual_file_lock);
+
+  if (count && !dr_safe_write(lpBuffer, count, virtual_file_data + position, NULL)) {
+    drwrap_skip_call(wrapcxt, (void *)FALSE, 0);
+    return;
+  }
+
+  if (lpNumberOfBytesRead) {
+    *lpNumberOfBytesRead = (DWORD)count;
+  }
+
+  if (lpOverlapped) {
+    lpOverlapped->Internal = 0;
+    lpOverlapped->InternalHigh = count;
+  }
+
+  hash_context hash_ctx = {0};
+  memcpy(hash_ctx.fileName, virtual_file_final_path, sizeof(hash_ctx.fileName));
+  hash_ctx.position = position;
+  hash_ctx.readSize = nNumberOfBytesToRead;
+
+  client_read_info *info = client.alloc_read_info(drcontext);
+
+  info->function = Function::ReadFile;
+  info->hFile = (HANDLE)vhandle;
+  info->lpBuffer = lpBuffer;
+  info->nNumberOfBytesToRead = nNumberOfBytesToRead;
+  info->lpNumberOfBytesRead = lpNumberOfBytesRead;
+  info->capacity = lpNumberOfBytesRead ? info->nNumberOfBytesToRead : 0;
+  info->position = hash_ctx.position;
+  info->retAddrOffset = (uint64_t)drwrap_get_retaddr(wrapcxt) - client.baseAddr;
+
+  client.defer_hash_args(info, &hash_ctx);
+  info->source = info->hashCtx.fileName;
+
+  handle_read(NULL, info);
+  client.free_read_info(drcontext, info);
+
+  drwrap_skip_call(wrapcxt, (void *)TRUE, 0);
+}
+
+/**
+ * Transparent wrapper around SL2Client.wrap_pre_ReadFile, except for reads of the -virtual_file
+ * (see read_virtual_file)
  * @param wrapcxt - DynamoRIO Wrap Context. Opaque pointer that can be passed to DR helper
  * functions.
  * @param user_data - client_read_info struct containing information about the function call hooked
  * by wrap_pre
  */
 static void wrap_pre_ReadFile(void *wrapcxt, OUT void **user_data) {
+  sl2_virtual_handle *vhandle = virtual_handle(drwrap_get_arg(wrapcxt, 0));
+
+  if (vhandle) {
+    read_virtual_file(wrapcxt, vhandle);
+    return;
+  }
+
   client.wrap_pre_ReadFile(wrapcxt, user_data);
 }
 
@@ -403,6 +5955,7 @@ static void wrap_pre_MapViewOfFile(void *wrapcxt, OUT void **user_data) {
 
 /*! Mutates whatever data the hooked function wrote (calls mutate) */
 static void wrap_post_Generic(void *wrapcxt, void *user_data) {
+  SL2_PROFILE(SL2_PROBE_POST_GENERIC);
   void *drcontext = NULL;
 
   if (!client.is_sane_post_hook(wrapcxt, user_data, &drcontext)) {
@@ -410,13 +5963,30 @@ static void wrap_post_Generic(void *wrapcxt, void *user_data) {
   }
 
   SL2_DR_DEBUG("<in wrap_post_Generic>\n");
+  handle_read(wrapcxt, (client_read_info *)user_data);
 
-  client_read_info *info = (client_read_info *)user_data;
+cleanup:
+
+  client.free_read_info(drcontext, (client_read_info *)user_data);
+}
+
+/**
+ * Mutates the data that a hooked function read, if the read is targeted.
+ * @param wrapcxt - DynamoRIO Wrap Context, from the function's post-hook, or NULL if the function
+ * was skipped (see read_virtual_file)
+ * @param info - the read
+ */
+static void handle_read(void *wrapcxt, client_read_info *info) {
+  mark_stage(&timing.first_hook);
 
   client.increment_call_count(info->function);
+  note_progress();
 
-  if (!client.is_function_targeted(info)) {
-    goto cleanup;
+  size_t target_index = 0;
+
+  if (!client.is_function_targeted(info, &target_index)) {
+    unwrap_if_exhausted(wrapcxt, info->function);
+    return;
   }
 
   // NOTE(ww): We should never read more bytes than we request, so this is more
@@ -425,24 +5995,19 @@ static void wrap_post_Generic(void *wrapcxt, void *user_data) {
     info->nNumberOfBytesToRead = *(info->lpNumberOfBytesRead);
   }
 
+  if (op_snapshot.get_value() && !snapshot.taken && wrapcxt) {
+    take_snapshot(wrapcxt, info);
+  }
+
   // If the mutation process fails in any way, consider this fuzzing run a loss.
-  if (!mutate(info)) {
+  if (!mutate(wrapcxt, info)) {
     crashed = false;
     dr_exit_process(1);
   }
 
-cleanup:
-
-  if (info->source) {
-    dr_thread_free(drcontext, info->source,
-                   wcsnlen_s(info->source, MAX_PATH + 1) * sizeof(wchar_t));
-  }
-
-  if (info->argHash) {
-    dr_thread_free(drcontext, info->argHash, SL2_HASH_LEN + 1);
-  }
-
-  dr_thread_free(drcontext, info, sizeof(client_read_info));
+  mark_stage(&timing.first_mutation);
+  consume_target(target_index);
+  unwrap_if_exhausted(wrapcxt, info->function);
 }
 
 /**
@@ -450,6 +6015,7 @@ cleanup:
  * address of the mapped view, we can't use the Generic post-hook.
  */
 static void wrap_post_MapViewOfFile(void *wrapcxt, void *user_data) {
+  SL2_PROFILE(SL2_PROBE_POST_MAPVIEWOFFILE);
   void *drcontext = NULL;
   bool interesting_call = true;
 
@@ -458,10 +6024,12 @@ static void wrap_post_MapViewOfFile(void *wrapcxt, void *user_data) {
   }
 
   SL2_DR_DEBUG("<in wrap_post_MapViewOfFile>\n");
+  mark_stage(&timing.first_hook);
 
   client_read_info *info = (client_read_info *)user_data;
 
   client.increment_call_count(info->function);
+  note_progress();
 
   info->lpBuffer = drwrap_get_retval(wrapcxt);
   MEMORY_BASIC_INFORMATION memory_info = {0};
@@ -486,44 +6054,36 @@ static void wrap_post_MapViewOfFile(void *wrapcxt, void *user_data) {
   // Toss the filename into info, so that `mutate` can send it to the server.
   info->source = hash_ctx.fileName;
 
-  // Create the argHash, now that we have the correct source and nNumberOfBytesToRead.
-  client.hash_args(info->argHash, &hash_ctx);
+  // Stash the arguments for the argHash, now that we have the correct source and
+  // nNumberOfBytesToRead. They're only hashed if a target needs them.
+  client.defer_hash_args(info, &hash_ctx);
 
-  if (interesting_call && client.is_function_targeted(info)) {
+  size_t target_index = 0;
+
+  if (interesting_call && client.is_function_targeted(info, &target_index)) {
     // If the mutation process fails in any way, consider this fuzzing run a loss.
-    if (!mutate(info)) {
+    if (!mutate(wrapcxt, info)) {
       crashed = false;
       dr_exit_process(1);
     }
+
+    mark_stage(&timing.first_mutation);
+    consume_target(target_index);
   }
 
+  unwrap_if_exhausted(wrapcxt, info->function);
+
 #pragma warning(suppress : 4533)
 cleanup:
 
-  dr_thread_free(drcontext, info->argHash, SL2_HASH_LEN + 1);
-  dr_thread_free(drcontext, info, sizeof(client_read_info));
+  client.free_read_info(drcontext, info);
 }
 
-/** Runs when a new module (typically an exe or dll) is loaded. Tells DynamoRIO to hook all the
- * interesting functions in that module. */
-static void on_module_load(void *drcontext, const module_data_t *mod, bool loaded) {
-  if (nmodules < SL2_MAX_MODULES - 1 && _strnicmp("C:\\Windows\\", mod->full_path, 11) &&
-      !strstr(mod->full_path, "dynamorio.dll") && !strstr(mod->full_path, "drreg.dll") &&
-      !strstr(mod->full_path, "drwrap.dll") && !strstr(mod->full_path, "drmgr.dll") &&
-      !strstr(mod->full_path, "fuzzer.dll")) {
-    // Add a copy of the module to our seen module map so that we can avoid
-    // doing basic block coverage of it later (if necessary).
-    seen_modules[nmodules++] = dr_copy_module_data(mod);
-    SL2_DR_DEBUG("Adding %s to seen_modules\n", mod->full_path);
-  }
-
-  if (!strcmp(dr_get_application_name(), dr_module_preferred_name(mod))) {
-    client.baseAddr = (uint64_t)mod->start;
-  }
-
-  const char *mod_name = dr_module_preferred_name(mod);
-  app_pc towrap;
-
+/**
+ * Indexes the read hooks by module, once, so that on_module_load only has to look up the loaded
+ * module's own. Only the functions that a target matches are hooked.
+ */
+static void init_read_hooks() {
   sl2_pre_proto_map pre_hooks;
   SL2_PRE_HOOK1(pre_hooks, ReadFile);
   SL2_PRE_HOOK1(pre_hooks, InternetReadFile);
@@ -562,6 +6122,58 @@ static void on_module_load(void *drcontext, const module_data_t *mod, bool loade
   SL2_POST_HOOK2(post_hooks, _read, Generic);
   SL2_POST_HOOK1(post_hooks, MapViewOfFile);
 
+  client.init_module_hooks(pre_hooks, post_hooks, true);
+}
+
+/** Runs when a new module (typically an exe or dll) is loaded. Tells DynamoRIO to hook all the
+ * interesting functions in that module. */
+static void on_module_load(void *drcontext, const module_data_t *mod, bool loaded) {
+  uint64_t load_start = dr_get_microseconds();
+
+  if (module_is_selected(mod)) {
+    // Add the module's range to our seen module table so that we can avoid
+    // doing basic block coverage of other modules later (if necessary).
+    if (add_module_range(mod)) {
+      SL2_DR_DEBUG("Adding %s to seen_modules\n", mod->full_path);
+    }
+  }
+
+  if (!strcmp(dr_get_application_name(), dr_module_preferred_name(mod))) {
+    client.baseAddr = (uint64_t)mod->start;
+  }
+
+  track_directed_module(mod, true);
+
+  if (cmplog_lock) {
+    wrap_cmplog_functions(mod);
+  }
+
+  if (guard_heap_lock && STREQI(dr_module_preferred_name(mod), "NTDLL.DLL")) {
+    wrap_guard_heap_functions(mod);
+  }
+
+  const char *mod_name = dr_module_preferred_name(mod);
+  app_pc towrap;
+
+  if (op_persist_module.get_value() != "" &&
+      STREQI(mod_name, op_persist_module.get_value().c_str())) {
+    towrap = mod->start + strtoull(op_persist_offset.get_value().c_str(), NULL, 0);
+
+    if (drwrap_wrap(towrap, wrap_pre_persist_target, wrap_post_persist_target)) {
+      SL2_DR_DEBUG("<wrapped persistent target @ 0x%p in %s\n", towrap, mod_name);
+    } else {
+      SL2_DR_DEBUG("<FAILED to wrap persistent target @ 0x%p in %s\n", towrap, mod_name);
+    }
+  }
+
+  if (op_snapshot.get_value() && STREQI(mod_name, "NTDLL.DLL")) {
+    towrap = (app_pc)dr_get_proc_address(mod->handle, "RtlExitUserProcess");
+
+    if (!towrap || !drwrap_wrap(towrap, wrap_pre_RtlExitUserProcess, NULL)) {
+      SL2_DR_DEBUG("<FAILED to wrap RtlExitUserProcess, snapshots won't be resumed\n");
+    }
+  }
+
   // Wrap IsProcessorFeaturePresent and UnhandledExceptionFilter to prevent
   // __fastfail from circumventing our exception tracking. See the comment
   // above wrap_pre_IsProcessorFeaturePresent for more information.
@@ -575,6 +6187,24 @@ static void on_module_load(void *drcontext, const module_data_t *mod, bool loade
     drwrap_wrap(towrap, wrap_pre_UnhandledExceptionFilter, NULL);
   }
 
+  // Wrap CloseHandle and DuplicateHandle, so that the client knows when to forget the path it
+  // cached for a handle. See SL2Client::get_handle_path.
+  if (STREQI(mod_name, "KERNELBASE.DLL")) {
+    towrap = (app_pc)dr_get_proc_address(mod->handle, "CloseHandle");
+    drwrap_wrap(towrap, wrap_pre_CloseHandle, NULL);
+
+    towrap = (app_pc)dr_get_proc_address(mod->handle, "DuplicateHandle");
+    drwrap_wrap(towrap, wrap_pre_DuplicateHandle, wrap_post_DuplicateHandle);
+  }
+
+  if (virtual_file_lock && STREQI(mod_name, "KERNELBASE.DLL")) {
+    wrap_virtual_file_functions(mod);
+  }
+
+  if (peer_lock && (STREQI(mod_name, "WS2_32.DLL") || STREQI(mod_name, "WINHTTP.DLL"))) {
+    wrap_peer_functions(mod);
+  }
+
   // Wrap VerifierStopMessage and VerifierStopMessageEx, which are apparently
   // used in AppVerifier to register heap corruptions.
   //
@@ -596,35 +6226,13 @@ static void on_module_load(void *drcontext, const module_data_t *mod, bool loade
     SL2_DR_DEBUG("OLE32.DLL loaded, but we don't have an DllDebugObjectRpcHook mitigation yet!\n");
   }
 
-  void(__cdecl * pre_hook)(void *, void **);
-  void(__cdecl * post_hook)(void *, void *);
-
-  sl2_pre_proto_map::iterator it;
-  for (it = pre_hooks.begin(); it != pre_hooks.end(); it++) {
-    char *function_name = it->first;
-    bool hook = false;
-
-    if (!client.function_is_in_expected_module(function_name, mod_name)) {
-      continue;
-    }
-
-    for (targetFunction t : client.parsedJson) {
-      if (t.selected && STREQ(t.functionName.c_str(), function_name)) {
-        hook = true;
-      } else if (t.selected && (STREQ(function_name, "RegQueryValueExW") ||
-                                STREQ(function_name, "RegQueryValueExA"))) {
-        if (!STREQ(t.functionName.c_str(), "RegQueryValueEx")) {
-          hook = false;
-        }
-      }
-    }
-
-    if (!hook) {
-      continue;
-    }
+  const sl2_module_hook *hooks;
+  size_t hook_count = client.hooks_for_module(mod_name, &hooks);
 
-    pre_hook = it->second;
-    post_hook = post_hooks[function_name];
+  for (size_t i = 0; i < hook_count; i++) {
+    const char *function_name = hooks[i].func;
+    sl2_pre_proto pre_hook = hooks[i].pre_hook;
+    sl2_post_proto post_hook = hooks[i].post_hook;
 
     towrap = (app_pc)dr_get_proc_address(mod->handle, function_name);
 
@@ -634,15 +6242,111 @@ static void on_module_load(void *drcontext, const module_data_t *mod, bool loade
       bool ok = drwrap_wrap(towrap, pre_hook, post_hook);
       if (ok) {
         SL2_DR_DEBUG("<wrapped %s @ 0x%p in %s\n", function_name, towrap, mod_name);
+
+        if (wrapped_reads_lock) {
+          dr_mutex_lock(wrapped_reads_lock);
+          wrapped_reads[towrap] = {pre_hook, post_hook};
+          dr_mutex_unlock(wrapped_reads_lock);
+        }
       } else {
         SL2_DR_DEBUG("<FAILED to wrap %s @ 0x%p: already wrapped?\n", function_name, towrap);
       }
     }
   }
+
+  InterlockedIncrement64(&timing.module_loads);
+  InterlockedExchangeAdd64(&timing.module_load_us, (LONG64)(dr_get_microseconds() - load_start));
+}
+
+/** Runs when a module is unloaded. Stops measuring coverage for it, so that a module loaded at
+ * the same address later doesn't inherit it. */
+static void on_module_unload(void *drcontext, const module_data_t *mod) {
+  remove_module_range(mod);
+  track_directed_module(mod, false);
+}
+
+/**
+ * Parks the client until the harness activates it for a run, by signaling the -park event, and
+ * then parses the run's client arguments (its run ID, arena, seed, and so on) from -park_args.
+ * The run's arguments are all of its client arguments, so they give every option that
+ * the parked process was started with again.
+ * @param client_name the client's argv[0]
+ * @return whether the run's arguments were parsed
+ */
+static bool unpark(const char *client_name) {
+  HANDLE event = OpenEventA(SYNCHRONIZE, FALSE, op_park.get_value().c_str());
+
+  if (event == NULL) {
+    SL2_DR_DEBUG("unpark: couldn't open %s\n", op_park.get_value().c_str());
+    return false;
+  }
+
+  // The harness keeps the parked process in a job that's killed along with it, so there's
+  // no need to give up on an activation that never comes.
+  DWORD waited = WaitForSingleObject(event, INFINITE);
+  CloseHandle(event);
+
+  if (waited != WAIT_OBJECT_0) {
+    SL2_DR_DEBUG("unpark: couldn't wait for %s\n", op_park.get_value().c_str());
+    return false;
+  }
+
+  file_t file = dr_open_file(op_park_args.get_value().c_str(), DR_FILE_READ);
+  uint64 file_size = 0;
+
+  if (file == INVALID_FILE) {
+    SL2_DR_DEBUG("unpark: couldn't open %s\n", op_park_args.get_value().c_str());
+    return false;
+  }
+
+  if (!dr_file_size(file, &file_size) || file_size > SL2_PARK_MAX_ARGS_SIZE) {
+    SL2_DR_DEBUG("unpark: %s is missing or too big\n", op_park_args.get_value().c_str());
+    dr_close_file(file);
+    return false;
+  }
+
+  std::string args((size_t)file_size, '\0');
+  ssize_t nread = dr_read_file(file, &args[0], (size_t)file_size);
+  dr_close_file(file);
+
+  if (nread != (ssize_t)file_size) {
+    SL2_DR_DEBUG("unpark: couldn't read %s\n", op_park_args.get_value().c_str());
+    return false;
+  }
+
+  std::vector<std::string> run_args;
+  size_t start = 0;
+
+  while (start < args.size()) {
+    size_t end = args.find('\n', start);
+
+    if (end == std::string::npos) {
+      end = args.size();
+    }
+
+    run_args.push_back(args.substr(start, end - start));
+    start = end + 1;
+  }
+
+  std::vector<const char *> run_argv = {client_name};
+  for (const std::string &arg : run_args) {
+    run_argv.push_back(arg.c_str());
+  }
+
+  std::string parse_err;
+  if (!droption_parser_t::parse_argv(DROPTION_SCOPE_CLIENT, (int)run_argv.size(), run_argv.data(),
+                                     &parse_err, NULL)) {
+    SL2_DR_DEBUG("unpark: usage error: %s", parse_err.c_str());
+    return false;
+  }
+
+  return true;
 }
 
 /** Runs after process initialization. Initializes DynamoRIO */
 DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]) {
+  mark_stage(&timing.start);
+
   dr_set_client_name("Sienna-Locomotive Fuzzer",
                      "https://github.com/trailofbits/sienna-locomotive/issues");
 
@@ -654,6 +6358,18 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]) {
     dr_abort();
   }
 
+  // A parked run starts once it's activated, rather than when its process did.
+  if (op_park.get_value() != "") {
+    if (!unpark(argv[0])) {
+      dr_abort();
+    }
+
+    timing.start = 0;
+    mark_stage(&timing.start);
+  }
+
+  mark_stage(&timing.options);
+
   std::string target = op_target.get_value();
 
   if (target == "") {
@@ -676,6 +6392,47 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]) {
     dr_abort();
   }
 
+  mark_stage(&timing.targets);
+
+  if (op_snapshot.get_value() && op_persist_module.get_value() != "") {
+    SL2_DR_DEBUG("ERROR: -snapshot and -persist_module can't be used together\n");
+    dr_abort();
+  }
+
+  if (op_persist_threads.get_value() > 1) {
+    if (op_persist_module.get_value() == "" || op_hit_once.get_value()) {
+      SL2_DR_DEBUG("ERROR: -persist_threads needs -persist_module, and can't be used with "
+                   "-hit_once\n");
+      dr_abort();
+    }
+
+    if (op_persist_threads.get_value() > SL2_PERSIST_MAX_THREADS ||
+        op_persist_nargs.get_value() > SL2_PERSIST_THREAD_MAX_ARGS) {
+      SL2_DR_DEBUG("ERROR: -persist_threads is at most %d, for targets of at most %d arguments\n",
+                   SL2_PERSIST_MAX_THREADS, SL2_PERSIST_THREAD_MAX_ARGS);
+      dr_abort();
+    }
+  }
+
+  if (op_snapshot.get_value() && op_virtual_file.get_value() != "") {
+    SL2_DR_DEBUG("ERROR: -snapshot and -virtual_file can't be used together\n");
+    dr_abort();
+  }
+
+  if (op_hit_once.get_value() && op_edge_coverage.get_value()) {
+    SL2_DR_DEBUG("ERROR: -hit_once and -edge can't be used together\n");
+    dr_abort();
+  }
+
+  if (!SL2_ARENA_SIZE_VALID(op_map_size.get_value())) {
+    SL2_DR_DEBUG("ERROR: -map_size must be a power of two from %u to %u\n", FUZZ_ARENA_SIZE,
+                 FUZZ_ARENA_MAX_SIZE);
+    dr_abort();
+  }
+
+  parse_module_list(op_coverage_allow.get_value(), coverage_allow);
+  parse_module_list(op_coverage_deny.get_value(), coverage_deny);
+
   dr_enable_console_printing();
   // Set up console printing
   dr_log(NULL, DR_LOG_ALL, 1, "DR client 'SL Fuzzer' initializing\n");
@@ -691,22 +6448,62 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]) {
   UUID run_id;
   sl2_string_to_uuid(run_id_s.c_str(), &run_id);
   sl2_conn_assign_run_id(&sl2_conn, run_id);
+  // Looping threads register synchronously, so that a crashing one's registrations are
+  // the last that the server handles (see reregister_crash).
+  sl2_conn_set_async(&sl2_conn, op_async.get_value() && op_persist_threads.get_value() <= 1);
 
   sl2_conn_register_pid(&sl2_conn, dr_get_process_id(), false);
 
-  drreg_options_t opts = {sizeof(opts), 3, false};
+  mark_stage(&timing.connected);
+
+  // Edge coverage needs up to four scratch registers per block, when the flags are live.
+  drreg_options_t opts = {sizeof(opts), 4, false};
+
+  modules_lock = dr_rwlock_create();
 
   if (!drmgr_init() || drreg_init(&opts) != DRREG_SUCCESS || !drwrap_init()) {
     DR_ASSERT(false);
   }
 
+  mark_stage(&timing.extensions);
+
+  // The profiler keeps its counts in drmgr TLS, so the requests made before drmgr is up
+  // (opening the connection and binding it to the run) aren't counted.
+  if (op_profile.get_value() || op_alloc_steady.get_value()) {
+    client.init_profile(op_alloc_steady.get_value());
+    sl2_conn_set_profile_hook(&sl2_conn, sl2_profile_request);
+  }
+
+  sl2_etw_register();
+
   // Check whether we can use coverage on this fuzzing run
   coverage_guided = (arena_id_s != "") && !no_coverage;
 
   if (coverage_guided) {
     SL2_DR_DEBUG("dr_client_main: arena given, instrumenting BBs!\n");
-    mbstowcs_s(NULL, arena.id, SL2_HASH_LEN + 1, arena_id_s.c_str(), SL2_HASH_LEN);
-    sl2_conn_request_arena(&sl2_conn, &arena);
+    mbstowcs_s(NULL, local_arena.id, SL2_HASH_LEN + 1, arena_id_s.c_str(), SL2_HASH_LEN);
+
+    // Our instrumentation only ever touches per-thread maps, but we still need
+    // to settle on an arena (and its size) before any threads exit and get merged into it.
+    if (sl2_conn_map_arena(&sl2_conn, local_arena.id, dr_get_process_id(),
+                           op_map_size.get_value(), &arena) != SL2Response::OK) {
+      SL2_DR_DEBUG("dr_client_main: couldn't map a shared arena, falling back to the pipe\n");
+      arena = &local_arena;
+      arena->size = op_map_size.get_value();
+
+      if (sl2_conn_request_arena(&sl2_conn, arena) != SL2Response::OK) {
+        SL2_DR_DEBUG("dr_client_main: server didn't give us an arena!\n");
+        dr_abort();
+      }
+
+      arena->map = (uint8_t *)sl2_global_alloc(arena->size);
+      memset(arena->map, 0, arena->size);
+    }
+
+    SL2_DR_DEBUG("dr_client_main: coverage map is %u bytes\n", arena->size);
+
+    init_coverage_instrumentation(op_never_zero.get_value());
+    coverage_armed = !op_defer_coverage.get_value();
 
     if (!drmgr_register_bb_instrumentation_event(NULL, on_bb_instrument, NULL)) {
       DR_ASSERT(false);
@@ -715,7 +6512,31 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]) {
     SL2_DR_DEBUG("dr_client_main: no arena given OR user requested dumb fuzzing!\n");
   }
 
+  init_rng();
+  init_dictionary();
+  init_fixups();
+  init_cmplog_table();
+  init_replay();
+  init_mutator();
+  client.init_read_info_pool();
+  client.init_events(op_events.get_value().c_str());
+  client.init_handle_cache();
+  init_unwrapping();
+  init_early_exit();
+  init_watchdog();
+  init_drcov();
+  init_cmplog();
+  init_guard_heap();
+  init_virtual_file();
+  init_peer();
+  init_directed();
+  init_persist_threads();
+  init_read_hooks();
+
   drmgr_register_exception_event(on_exception);
   dr_register_exit_event(on_dr_exit);
   drmgr_register_module_load_event(on_module_load);
+  drmgr_register_module_unload_event(on_module_unload);
+
+  mark_stage(&timing.init);
 }
@@ -0,0 +1,442 @@
+#ifndef SL2_ARENA_KERNELS_HPP
+#define SL2_ARENA_KERNELS_HPP
+
+#include <stdint.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#include "server.hpp"
+#include "common/sl2_simd.hpp"
+
+/**
+ * The server's coverage map kernels: merging and scoring arenas, and checking runs against their
+ * arenas' virgin maps. Each has a scalar reference and SSE2 and AVX2 versions, which must give
+ * bit-for-bit the same results (see bench/simd_test.cpp).
+ */
+
+/*! A kernel that merges one coverage map into another and scores the result in a single pass */
+typedef uint32_t (*sl2_merge_score_fn)(uint8_t *map, const uint8_t *other, bool bucketing);
+
+/*! How many map sizes the arena kernels are specialized for: every valid size, from
+ * FUZZ_ARENA_SIZE up to FUZZ_ARENA_MAX_SIZE */
+#define SL2_ARENA_SIZE_CLASSES 8
+
+static_assert((FUZZ_ARENA_SIZE << (SL2_ARENA_SIZE_CLASSES - 1)) == FUZZ_ARENA_MAX_SIZE,
+              "every valid map size needs its own kernels");
+
+/*! Instantiates a kernel template for every valid map size, indexed by arena_size_class */
+#define SL2_ARENA_KERNELS(kernel)                                                               \
+  {                                                                                             \
+    kernel<FUZZ_ARENA_SIZE << 0>, kernel<FUZZ_ARENA_SIZE << 1>, kernel<FUZZ_ARENA_SIZE << 2>,   \
+        kernel<FUZZ_ARENA_SIZE << 3>, kernel<FUZZ_ARENA_SIZE << 4>, kernel<FUZZ_ARENA_SIZE << 5>, \
+        kernel<FUZZ_ARENA_SIZE << 6>, kernel<FUZZ_ARENA_SIZE << 7>                              \
+  }
+
+/**
+ * @param size a valid map size (see SL2_ARENA_SIZE_VALID)
+ * @return the index of the kernels specialized for the size (see SL2_ARENA_KERNELS)
+ */
+static inline uint32_t arena_size_class(uint32_t size) {
+  unsigned long bit = 0;
+
+  _BitScanForward(&bit, size / FUZZ_ARENA_SIZE);
+  return (uint32_t)bit;
+}
+
+/**
+ * Scores a single arena cell by placing its hit count into a bucket: higher scores are
+ * given for relatively small counts, while large counts are given lower scores.
+ * @param hits the cell's hit count
+ * @return the cell's score
+ */
+static inline uint32_t bucket_value(uint8_t hits) {
+  if (!hits) {
+    return 0;
+  } else if (hits <= 3) {
+    return 32;
+  } else if (hits <= 7) {
+    return 16;
+  } else if (hits <= 15) {
+    return 8;
+  } else if (hits <= 31) {
+    return 4;
+  } else if (hits <= 127) {
+    return 2;
+  }
+
+  return 1;
+}
+
+/**
+ * Saturates `other` into `map` (when given) and scores the result, one cell at a time.
+ * This is the fallback for CPUs (and architectures) without the vector kernels below, and the
+ * reference that they're checked against (see sl2_simd.hpp).
+ * Like them, it's specialized for each map size, so that the compiler knows the trip count.
+ * @tparam size the size of both maps
+ * @param map the coverage map to merge into and score
+ * @param other the coverage map to merge, or NULL to only score `map`
+ * @param bucketing whether to use bucketed scoring or a dumb hit counter
+ * @return the score of the (merged) map
+ */
+template <size_t size>
+static uint32_t merge_score_scalar(uint8_t *map, const uint8_t *other, bool bucketing) {
+  uint32_t score = 0;
+
+  for (size_t i = 0; i < size; ++i) {
+    if (other) {
+      uint32_t hits = map[i] + other[i];
+      map[i] = (uint8_t)(hits > UINT8_MAX ? UINT8_MAX : hits);
+    }
+
+    score += bucketing ? bucket_value(map[i]) : !!map[i];
+  }
+
+  return score;
+}
+
+#if defined(_M_X64) || defined(_M_IX86)
+/**
+ * Scores 16 arena cells at once. The buckets in bucket_value nest, so a cell's score
+ * is the sum of a weight for each threshold it falls under.
+ * @param cells the cells to score
+ * @param bucketing whether to use bucketed scoring or a dumb hit counter
+ * @return the per-cell scores
+ */
+static inline __m128i score_cells_sse2(__m128i cells, bool bucketing) {
+  __m128i hit = _mm_andnot_si128(_mm_cmpeq_epi8(cells, _mm_setzero_si128()), _mm_set1_epi8(-1));
+
+  if (!bucketing) {
+    return _mm_and_si128(hit, _mm_set1_epi8(1));
+  }
+
+  // There's no unsigned byte comparison in SSE2, so x <= k becomes min(x, k) == x.
+  // x <= 127 is just a signed comparison against -1.
+  __m128i le127 = _mm_cmpgt_epi8(cells, _mm_set1_epi8(-1));
+  __m128i le31 = _mm_cmpeq_epi8(_mm_min_epu8(cells, _mm_set1_epi8(31)), cells);
+  __m128i le15 = _mm_cmpeq_epi8(_mm_min_epu8(cells, _mm_set1_epi8(15)), cells);
+  __m128i le7 = _mm_cmpeq_epi8(_mm_min_epu8(cells, _mm_set1_epi8(7)), cells);
+  __m128i le3 = _mm_cmpeq_epi8(_mm_min_epu8(cells, _mm_set1_epi8(3)), cells);
+
+  __m128i score = _mm_add_epi8(_mm_set1_epi8(1), _mm_and_si128(le127, _mm_set1_epi8(1)));
+  score = _mm_add_epi8(score, _mm_and_si128(le31, _mm_set1_epi8(2)));
+  score = _mm_add_epi8(score, _mm_and_si128(le15, _mm_set1_epi8(4)));
+  score = _mm_add_epi8(score, _mm_and_si128(le7, _mm_set1_epi8(8)));
+  score = _mm_add_epi8(score, _mm_and_si128(le3, _mm_set1_epi8(16)));
+
+  return _mm_and_si128(hit, score);
+}
+
+/**
+ * The SSE2 version of merge_score_scalar.
+ */
+template <size_t size>
+static uint32_t merge_score_sse2(uint8_t *map, const uint8_t *other, bool bucketing) {
+  __m128i total = _mm_setzero_si128();
+
+  for (size_t i = 0; i < size; i += sizeof(__m128i)) {
+    __m128i cells = _mm_loadu_si128((__m128i *)(map + i));
+
+    if (other) {
+      cells = _mm_adds_epu8(cells, _mm_loadu_si128((__m128i *)(other + i)));
+      _mm_storeu_si128((__m128i *)(map + i), cells);
+    }
+
+    // Horizontally sum the cell scores into two 64-bit lanes.
+    total = _mm_add_epi64(total, _mm_sad_epu8(score_cells_sse2(cells, bucketing),
+                                              _mm_setzero_si128()));
+  }
+
+  // The highest possible score is 32 * FUZZ_ARENA_MAX_SIZE, so the low halves suffice.
+  return _mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_srli_si128(total, 8));
+}
+
+/**
+ * The AVX2 version of score_cells_sse2.
+ */
+static inline __m256i score_cells_avx2(__m256i cells, bool bucketing) {
+  __m256i hit =
+      _mm256_andnot_si256(_mm256_cmpeq_epi8(cells, _mm256_setzero_si256()), _mm256_set1_epi8(-1));
+
+  if (!bucketing) {
+    return _mm256_and_si256(hit, _mm256_set1_epi8(1));
+  }
+
+  __m256i le127 = _mm256_cmpgt_epi8(cells, _mm256_set1_epi8(-1));
+  __m256i le31 = _mm256_cmpeq_epi8(_mm256_min_epu8(cells, _mm256_set1_epi8(31)), cells);
+  __m256i le15 = _mm256_cmpeq_epi8(_mm256_min_epu8(cells, _mm256_set1_epi8(15)), cells);
+  __m256i le7 = _mm256_cmpeq_epi8(_mm256_min_epu8(cells, _mm256_set1_epi8(7)), cells);
+  __m256i le3 = _mm256_cmpeq_epi8(_mm256_min_epu8(cells, _mm256_set1_epi8(3)), cells);
+
+  __m256i score =
+      _mm256_add_epi8(_mm256_set1_epi8(1), _mm256_and_si256(le127, _mm256_set1_epi8(1)));
+  score = _mm256_add_epi8(score, _mm256_and_si256(le31, _mm256_set1_epi8(2)));
+  score = _mm256_add_epi8(score, _mm256_and_si256(le15, _mm256_set1_epi8(4)));
+  score = _mm256_add_epi8(score, _mm256_and_si256(le7, _mm256_set1_epi8(8)));
+  score = _mm256_add_epi8(score, _mm256_and_si256(le3, _mm256_set1_epi8(16)));
+
+  return _mm256_and_si256(hit, score);
+}
+
+/**
+ * The AVX2 version of merge_score_scalar.
+ */
+template <size_t size>
+static uint32_t merge_score_avx2(uint8_t *map, const uint8_t *other, bool bucketing) {
+  __m256i total = _mm256_setzero_si256();
+
+  for (size_t i = 0; i < size; i += sizeof(__m256i)) {
+    __m256i cells = _mm256_loadu_si256((__m256i *)(map + i));
+
+    if (other) {
+      cells = _mm256_adds_epu8(cells, _mm256_loadu_si256((__m256i *)(other + i)));
+      _mm256_storeu_si256((__m256i *)(map + i), cells);
+    }
+
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(score_cells_avx2(cells, bucketing),
+                                                    _mm256_setzero_si256()));
+  }
+
+  __m128i half = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+
+  return _mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+}
+
+#endif
+
+/**
+ * Picks the fastest merge/score kernels for an instruction set.
+ * @param level the instruction set to pick for (see sl2_simd_current)
+ * @return the kernels, one per map size (see arena_size_class)
+ */
+static inline const sl2_merge_score_fn *merge_score_kernels(sl2_simd_level level) {
+  static const sl2_merge_score_fn scalar[] = SL2_ARENA_KERNELS(merge_score_scalar);
+#if defined(_M_X64) || defined(_M_IX86)
+  static const sl2_merge_score_fn avx2[] = SL2_ARENA_KERNELS(merge_score_avx2);
+  static const sl2_merge_score_fn sse2[] = SL2_ARENA_KERNELS(merge_score_sse2);
+#else
+  static const sl2_merge_score_fn *avx2 = NULL;
+  static const sl2_merge_score_fn *sse2 = NULL;
+#endif
+
+  return sl2_simd_pick<const sl2_merge_score_fn *>(level, scalar, sse2, avx2);
+}
+
+/*! A kernel that checks a run's map against a virgin map and updates it, in a single pass */
+typedef uint32_t (*sl2_novelty_fn)(uint8_t *virgin, const uint8_t *run, bool bucketing,
+                                   uint32_t *new_buckets);
+
+/**
+ * Places a cell's hit count into the same buckets as bucket_value, one bit per bucket.
+ * Without bucketing, every hit count falls into the same bucket.
+ * Keep the buckets in sync with SL2_BUCKET_FLOOR, which fuzzers classify their hit
+ * counts with.
+ * @param hits the cell's hit count
+ * @param bucketing whether bucketing is on
+ * @return the cell's bucket bit, or 0 if it wasn't hit
+ */
+static inline uint8_t bucket_bit(uint8_t hits, bool bucketing) {
+  if (!hits) {
+    return 0;
+  } else if (!bucketing || hits <= 3) {
+    return 1;
+  } else if (hits <= 7) {
+    return 2;
+  } else if (hits <= 15) {
+    return 4;
+  } else if (hits <= 31) {
+    return 8;
+  } else if (hits <= 127) {
+    return 16;
+  }
+
+  return 32;
+}
+
+/**
+ * Checks a run's map against an arena's virgin map, one cell at a time: a cell is new if it was
+ * never hit before, and is in a new bucket if it was, but never that many times. Both are added
+ * to the virgin map.
+ * @tparam size the size of both maps
+ * @param virgin the arena's virgin map
+ * @param run the run's coverage map
+ * @param bucketing whether bucketing is on
+ * @param new_buckets receives the number of cells in new buckets
+ * @return the number of new cells
+ */
+template <size_t size>
+static uint32_t novelty_scalar(uint8_t *virgin, const uint8_t *run, bool bucketing,
+                               uint32_t *new_buckets) {
+  uint32_t new_cells = 0;
+  *new_buckets = 0;
+
+  for (size_t i = 0; i < size; ++i) {
+    uint8_t bit = bucket_bit(run[i], bucketing);
+
+    if (bit & ~virgin[i]) {
+      if (virgin[i]) {
+        (*new_buckets)++;
+      } else {
+        new_cells++;
+      }
+
+      virgin[i] |= bit;
+    }
+  }
+
+  return new_cells;
+}
+
+#if defined(_M_X64) || defined(_M_IX86)
+/**
+ * The SSE2 version of bucket_bit, for 16 cells at once. Each threshold that a cell is over sets
+ * the next bit up, and the highest of those bits is the cell's bucket.
+ * @param cells the cells to place
+ * @param bucketing whether bucketing is on
+ * @return the cells' bucket bits
+ */
+static inline __m128i bucket_bits_sse2(__m128i cells, bool bucketing) {
+  __m128i hit = _mm_andnot_si128(_mm_cmpeq_epi8(cells, _mm_setzero_si128()), _mm_set1_epi8(1));
+
+  if (!bucketing) {
+    return hit;
+  }
+
+  __m128i le127 = _mm_cmpgt_epi8(cells, _mm_set1_epi8(-1));
+  __m128i le31 = _mm_cmpeq_epi8(_mm_min_epu8(cells, _mm_set1_epi8(31)), cells);
+  __m128i le15 = _mm_cmpeq_epi8(_mm_min_epu8(cells, _mm_set1_epi8(15)), cells);
+  __m128i le7 = _mm_cmpeq_epi8(_mm_min_epu8(cells, _mm_set1_epi8(7)), cells);
+  __m128i le3 = _mm_cmpeq_epi8(_mm_min_epu8(cells, _mm_set1_epi8(3)), cells);
+
+  __m128i over = _mm_or_si128(hit, _mm_andnot_si128(le3, _mm_set1_epi8(2)));
+  over = _mm_or_si128(over, _mm_andnot_si128(le7, _mm_set1_epi8(4)));
+  over = _mm_or_si128(over, _mm_andnot_si128(le15, _mm_set1_epi8(8)));
+  over = _mm_or_si128(over, _mm_andnot_si128(le31, _mm_set1_epi8(16)));
+  over = _mm_or_si128(over, _mm_andnot_si128(le127, _mm_set1_epi8(32)));
+
+  // There's no byte shift, but the bits shifted across bytes are masked off anyway.
+  return _mm_xor_si128(over, _mm_and_si128(_mm_srli_epi16(over, 1), _mm_set1_epi8(0x7f)));
+}
+
+/**
+ * The SSE2 version of novelty_scalar. Cells with nothing new (almost all of them, on most runs)
+ * leave the virgin map untouched.
+ */
+template <size_t size>
+static uint32_t novelty_sse2(uint8_t *virgin, const uint8_t *run, bool bucketing,
+                             uint32_t *new_buckets) {
+  __m128i cells_total = _mm_setzero_si128();
+  __m128i buckets_total = _mm_setzero_si128();
+
+  for (size_t i = 0; i < size; i += sizeof(__m128i)) {
+    __m128i bits = bucket_bits_sse2(_mm_loadu_si128((__m128i *)(run + i)), bucketing);
+    __m128i seen = _mm_loadu_si128((__m128i *)(virgin + i));
+    __m128i stale = _mm_cmpeq_epi8(_mm_andnot_si128(seen, bits), _mm_setzero_si128());
+
+    if (_mm_movemask_epi8(stale) == 0xffff) {
+      continue;
+    }
+
+    __m128i unseen = _mm_cmpeq_epi8(seen, _mm_setzero_si128());
+    __m128i novel = _mm_andnot_si128(stale, _mm_set1_epi8(1));
+
+    cells_total = _mm_add_epi64(
+        cells_total, _mm_sad_epu8(_mm_and_si128(unseen, novel), _mm_setzero_si128()));
+    buckets_total = _mm_add_epi64(
+        buckets_total, _mm_sad_epu8(_mm_andnot_si128(unseen, novel), _mm_setzero_si128()));
+    _mm_storeu_si128((__m128i *)(virgin + i), _mm_or_si128(seen, bits));
+  }
+
+  *new_buckets =
+      _mm_cvtsi128_si32(buckets_total) + _mm_cvtsi128_si32(_mm_srli_si128(buckets_total, 8));
+  return _mm_cvtsi128_si32(cells_total) + _mm_cvtsi128_si32(_mm_srli_si128(cells_total, 8));
+}
+
+/**
+ * The AVX2 version of bucket_bits_sse2.
+ */
+static inline __m256i bucket_bits_avx2(__m256i cells, bool bucketing) {
+  __m256i hit =
+      _mm256_andnot_si256(_mm256_cmpeq_epi8(cells, _mm256_setzero_si256()), _mm256_set1_epi8(1));
+
+  if (!bucketing) {
+    return hit;
+  }
+
+  __m256i le127 = _mm256_cmpgt_epi8(cells, _mm256_set1_epi8(-1));
+  __m256i le31 = _mm256_cmpeq_epi8(_mm256_min_epu8(cells, _mm256_set1_epi8(31)), cells);
+  __m256i le15 = _mm256_cmpeq_epi8(_mm256_min_epu8(cells, _mm256_set1_epi8(15)), cells);
+  __m256i le7 = _mm256_cmpeq_epi8(_mm256_min_epu8(cells, _mm256_set1_epi8(7)), cells);
+  __m256i le3 = _mm256_cmpeq_epi8(_mm256_min_epu8(cells, _mm256_set1_epi8(3)), cells);
+
+  __m256i over = _mm256_or_si256(hit, _mm256_andnot_si256(le3, _mm256_set1_epi8(2)));
+  over = _mm256_or_si256(over, _mm256_andnot_si256(le7, _mm256_set1_epi8(4)));
+  over = _mm256_or_si256(over, _mm256_andnot_si256(le15, _mm256_set1_epi8(8)));
+  over = _mm256_or_si256(over, _mm256_andnot_si256(le31, _mm256_set1_epi8(16)));
+  over = _mm256_or_si256(over, _mm256_andnot_si256(le127, _mm256_set1_epi8(32)));
+
+  return _mm256_xor_si256(
+      over, _mm256_and_si256(_mm256_srli_epi16(over, 1), _mm256_set1_epi8(0x7f)));
+}
+
+/**
+ * The AVX2 version of novelty_scalar.
+ */
+template <size_t size>
+static uint32_t novelty_avx2(uint8_t *virgin, const uint8_t *run, bool bucketing,
+                             uint32_t *new_buckets) {
+  __m256i cells_total = _mm256_setzero_si256();
+  __m256i buckets_total = _mm256_setzero_si256();
+
+  for (size_t i = 0; i < size; i += sizeof(__m256i)) {
+    __m256i bits = bucket_bits_avx2(_mm256_loadu_si256((__m256i *)(run + i)), bucketing);
+    __m256i seen = _mm256_loadu_si256((__m256i *)(virgin + i));
+    __m256i stale = _mm256_cmpeq_epi8(_mm256_andnot_si256(seen, bits), _mm256_setzero_si256());
+
+    if (_mm256_movemask_epi8(stale) == -1) {
+      continue;
+    }
+
+    __m256i unseen = _mm256_cmpeq_epi8(seen, _mm256_setzero_si256());
+    __m256i novel = _mm256_andnot_si256(stale, _mm256_set1_epi8(1));
+
+    cells_total = _mm256_add_epi64(
+        cells_total, _mm256_sad_epu8(_mm256_and_si256(unseen, novel), _mm256_setzero_si256()));
+    buckets_total = _mm256_add_epi64(
+        buckets_total,
+        _mm256_sad_epu8(_mm256_andnot_si256(unseen, novel), _mm256_setzero_si256()));
+    _mm256_storeu_si256((__m256i *)(virgin + i), _mm256_or_si256(seen, bits));
+  }
+
+  __m128i cells_half = _mm_add_epi64(_mm256_castsi256_si128(cells_total),
+                                     _mm256_extracti128_si256(cells_total, 1));
+  __m128i buckets_half = _mm_add_epi64(_mm256_castsi256_si128(buckets_total),
+                                       _mm256_extracti128_si256(buckets_total, 1));
+
+  *new_buckets =
+      _mm_cvtsi128_si32(buckets_half) + _mm_cvtsi128_si32(_mm_srli_si128(buckets_half, 8));
+  return _mm_cvtsi128_si32(cells_half) + _mm_cvtsi128_si32(_mm_srli_si128(cells_half, 8));
+}
+#endif
+
+/**
+ * Picks the fastest novelty kernels for an instruction set.
+ * @param level the instruction set to pick for (see sl2_simd_current)
+ * @return the kernels, one per map size (see arena_size_class)
+ */
+static inline const sl2_novelty_fn *novelty_kernels(sl2_simd_level level) {
+  static const sl2_novelty_fn scalar[] = SL2_ARENA_KERNELS(novelty_scalar);
+#if defined(_M_X64) || defined(_M_IX86)
+  static const sl2_novelty_fn avx2[] = SL2_ARENA_KERNELS(novelty_avx2);
+  static const sl2_novelty_fn sse2[] = SL2_ARENA_KERNELS(novelty_sse2);
+#else
+  static const sl2_novelty_fn *avx2 = NULL;
+  static const sl2_novelty_fn *sse2 = NULL;
+#endif
+
+  return sl2_simd_pick<const sl2_novelty_fn *>(level, scalar, sse2, avx2);
+}
+
+#endif
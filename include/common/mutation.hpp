@@ -1,6 +1,7 @@
 #ifndef SL2_MUTATION_HPP
 #define SL2_MUTATION_HPP
 
+#include "common/sl2_rng.hpp"
 #include "common/util.h"
 #include "server.hpp"
 
@@ -14,113 +15,565 @@
       18446744073709551615
 
 #define SL2_CUSTOM_STRATEGY (0xFFFFFFFF)
+#define SL2_HAVOC_STRATEGY (0xFFFFFFFE)
+#define SL2_DETERMINISTIC_STRATEGY (0xFFFFFFFD)
+#define SL2_SPLICE_STRATEGY (0xFFFFFFFC)
+#define SL2_PLUGIN_STRATEGY (0xFFFFFFFB)
+
+/*! The largest delta that the deterministic arithmetic stage adds to (or subtracts from) a byte. */
+#define SL2_DET_ARITH_MAX 35
+
+/**
+ * The deterministic mutation stages, in the order that they're walked. Each stage is a fixed
+ * sequence of single mutations over the whole buffer; see sl2_det_stage_len.
+ */
+enum sl2_det_stage {
+  /*! Flip each bit */
+  SL2_DET_FLIP1,
+  /*! Invert each byte */
+  SL2_DET_FLIP8,
+  /*! Add and subtract 1 through SL2_DET_ARITH_MAX to and from each byte */
+  SL2_DET_ARITH8,
+  /*! Overwrite each byte with each of KNOWN_VALUES1 */
+  SL2_DET_INTEREST8,
+  /*! Overwrite each 16-bit word with each 16-bit known value, in both byte orders */
+  SL2_DET_INTEREST16,
+  /*! Overwrite each 32-bit word with each 32-bit known value, in both byte orders */
+  SL2_DET_INTEREST32,
+  /*! Every stage has been walked */
+  SL2_DET_DONE,
+};
+
+/**
+ * A position in the deterministic stages: the `offset`th mutation of stage `stage`.
+ */
+struct sl2_det_cursor {
+  uint32_t stage;
+  uint32_t reserved;
+  uint64_t offset;
+};
+
+/*! The longest token in a dictionary. This must match MAX_TOKEN_LEN in dictionary.py. */
+#define SL2_MAX_TOKEN_LEN 32
+#define SL2_DICTIONARY_MAGIC "SL2D"
+#define SL2_DICTIONARY_VERSION 1
+
+/**
+ * The header of a token dictionary, as written by the harness. It's followed by `count + 1`
+ * token offsets (relative to the start of the token data), and then by the token data itself.
+ */
+struct sl2_dictionary_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+};
+
+/**
+ * A token dictionary, pointing into a mapped dictionary file.
+ */
+struct sl2_dictionary {
+  /*! The number of tokens */
+  uint32_t count;
+  /*! Token i spans [offsets[i], offsets[i + 1]) in `tokens` */
+  const uint32_t *offsets;
+  /*! The token data */
+  const uint8_t *tokens;
+};
+
+/*! The widest operand that a comparison log records. Longer memcmp()/strcmp() operands are cut
+ * short. This must match MAX_OPERAND_LEN in cmplog.py. */
+#define SL2_CMPLOG_MAX_OPERAND 32
+/*! The most comparisons that a comparison log holds. */
+#define SL2_CMPLOG_MAX_ENTRIES 4096
+#define SL2_CMPLOG_MAGIC "SL2K"
+#define SL2_CMPLOG_VERSION 1
+
+/*! The comparison's operands are integers, stored little-endian. */
+#define SL2_CMPLOG_INT 0
+/*! The comparison's operands are the leading bytes of a memcmp()/strcmp() call's arguments. */
+#define SL2_CMPLOG_MEM 1
+
+/**
+ * The header of a comparison log, as written by the fuzzer's -cmplog mode (and merged by the
+ * harness). It's followed by `count` sl2_cmplog_entry.
+ */
+struct sl2_cmplog_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+};
+
+/**
+ * A pair of operands that the target compared while it ran on an input.
+ */
+struct sl2_cmplog_entry {
+  /*! The size of each operand, in bytes */
+  uint32_t size;
+  /*! What kind of comparison it was (SL2_CMPLOG_INT or SL2_CMPLOG_MEM) */
+  uint32_t kind;
+  uint8_t lhs[SL2_CMPLOG_MAX_OPERAND];
+  uint8_t rhs[SL2_CMPLOG_MAX_OPERAND];
+};
+
+/**
+ * A comparison log, pointing into a mapped comparison log file.
+ */
+struct sl2_cmplog {
+  /*! The number of entries */
+  uint32_t count;
+  const sl2_cmplog_entry *entries;
+};
+
+/*! The most fixups that a fixup table holds. This must match MAX_FIXUPS in fixups.py. */
+#define SL2_MAX_FIXUPS 64
+#define SL2_FIXUPS_MAGIC "SL2X"
+#define SL2_FIXUPS_VERSION 1
+
+/*! The targeted read of a fixup that applies to every targeted read */
+#define SL2_FIXUP_ANY_READ UINT32_MAX
+
+/**
+ * How a fixup recomputes its field from the bytes that it covers.
+ * Keep these in sync with ALGORITHMS in fixups.py.
+ */
+enum sl2_fixup_algorithm {
+  /*! The number of covered bytes */
+  SL2_FIXUP_LENGTH,
+  /*! The CRC-32 (as in zlib, PNG, and Ethernet) of the covered bytes */
+  SL2_FIXUP_CRC32,
+  /*! The Adler-32 (as in zlib streams) of the covered bytes */
+  SL2_FIXUP_ADLER32,
+  /*! The sum of the covered bytes */
+  SL2_FIXUP_SUM,
+  SL2_FIXUP_ALGORITHMS,
+};
+
+/**
+ * A field that's recomputed after every mutation, so that mutated inputs still pass the target's
+ * integrity checks. Offsets below 0 count back from the end of the buffer, and an `end` of 0 is
+ * the end of the buffer. A field that's inside the bytes that it covers is zeroed before it's
+ * recomputed.
+ */
+struct sl2_fixup {
+  /*! The targeted read that the fixup applies to, or SL2_FIXUP_ANY_READ */
+  uint32_t mut_count;
+  /*! The algorithm (see sl2_fixup_algorithm) */
+  uint8_t algorithm;
+  /*! The field's width, in bytes: 1, 2 or 4. Wider values are truncated */
+  uint8_t width;
+  /*! Whether the field is big-endian */
+  uint8_t big_endian;
+  uint8_t reserved;
+  /*! Where the field is */
+  int32_t field;
+  /*! The covered bytes: [start, end) */
+  int32_t start;
+  int32_t end;
+  /*! Added to the computed value (e.g. for lengths that count their own header) */
+  int32_t adjust;
+};
+
+/**
+ * The header of a fixup table, as written by the harness. It's followed by `count` sl2_fixup,
+ * which are applied in order.
+ */
+struct sl2_fixups_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+};
+
+/**
+ * A fixup table, pointing into a mapped fixup file.
+ */
+struct sl2_fixups {
+  /*! The number of fixups */
+  uint32_t count;
+  const sl2_fixup *fixups;
+};
 
 /**
  * Represents a custom mutation strategy.
  */
-typedef void (*sl2_strategy_t)(uint8_t *buf, size_t size);
+typedef void (*sl2_strategy_t)(sl2_rng *rng, uint8_t *buf, size_t size);
 
 extern sl2_strategy_t SL2_STRATEGY_TABLE[];
 
+/**
+ * Represents a mutation strategy that may change the length of the buffer, up to its capacity.
+ * Returns the buffer's new length.
+ */
+typedef size_t (*sl2_resize_strategy_t)(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity);
+
+extern sl2_resize_strategy_t SL2_RESIZE_STRATEGY_TABLE[];
+
 /**
  *  Fill the input buffer with 0x41s,
+ * @param rng The sl2_rng to draw random decisions from
  * @param buf The buffer to mutate
  * @param size the size of the buffer to be mutated
  */
 SL2_EXPORT
-void strategyAAAA(uint8_t *buf, size_t size);
+void strategyAAAA(sl2_rng *rng, uint8_t *buf, size_t size);
 
 /**
  *  Flip a random bit within a random byte in the input buffer.
+ * @param rng The sl2_rng to draw random decisions from
  * @param buf The buffer to mutate
  * @param size the size of the buffer to be mutated
  */
 SL2_EXPORT
-void strategyFlipBit(uint8_t *buf, size_t size);
+void strategyFlipBit(sl2_rng *rng, uint8_t *buf, size_t size);
 
 /**
  *  Repeat a random continuous span of bytes within the input buffer.
+ * @param rng The sl2_rng to draw random decisions from
  * @param buf The buffer to mutate
  * @param size the size of the buffer to be mutated
  */
 SL2_EXPORT
-void strategyRepeatBytes(uint8_t *buf, size_t size);
+void strategyRepeatBytes(sl2_rng *rng, uint8_t *buf, size_t size);
 
 /**
  * Reverse the order of a random continuous span of bytes within the input buffer.
+ * @param rng The sl2_rng to draw random decisions from
  * @param buf The buffer to mutate
  * @param size the size of the buffer to be mutated
  */
 SL2_EXPORT
-void strategyRepeatBytesBackwards(uint8_t *buf, size_t size);
+void strategyRepeatBytesBackwards(sl2_rng *rng, uint8_t *buf, size_t size);
 
 /**
  * Delete (null out) a random continuous span of bytes within the input buffer.
+ * @param rng The sl2_rng to draw random decisions from
  * @param buf The buffer to mutate
  * @param size the size of the buffer to be mutated
  */
 SL2_EXPORT
-void strategyDeleteBytes(uint8_t *buf, size_t size);
+void strategyDeleteBytes(sl2_rng *rng, uint8_t *buf, size_t size);
 
 /**
  * Delete (ASCII zero-out) a random continuous span of bytes within the input buffer.
+ * @param rng The sl2_rng to draw random decisions from
  * @param buf The buffer to mutate
  * @param size the size of the buffer to be mutated
  */
 SL2_EXPORT
-void strategyDeleteBytesAscii(uint8_t *buf, size_t size);
+void strategyDeleteBytesAscii(sl2_rng *rng, uint8_t *buf, size_t size);
 
 /**
  * Replace a random continuous span of bytes within the input buffer with random values.
+ * @param rng The sl2_rng to draw random decisions from
  * @param buf The buffer to mutate
  * @param size the size of the buffer to be mutated
  */
 SL2_EXPORT
-void strategyRandValues(uint8_t *buf, size_t size);
+void strategyRandValues(sl2_rng *rng, uint8_t *buf, size_t size);
 
 /**
  * Replace a random continuous span of bytes within the input buffer with well-known values (maxes,
  * overflows, etc).
+ * @param rng The sl2_rng to draw random decisions from
  * @param buf The buffer to mutate
  * @param size the size of the buffer to be mutated
  */
 SL2_EXPORT
-void strategyKnownValues(uint8_t *buf, size_t size);
+void strategyKnownValues(sl2_rng *rng, uint8_t *buf, size_t size);
 
 /**
  * Add or subtract a random well-known value from a random u8/u16/u32/u64. Additionally, perform a
  * random byteswap.
+ * @param rng The sl2_rng to draw random decisions from
  * @param buf The buffer to mutate
  * @param size the size of the buffer to be mutated
  */
 SL2_EXPORT
-void strategyAddSubKnownValues(uint8_t *buf, size_t size);
+void strategyAddSubKnownValues(sl2_rng *rng, uint8_t *buf, size_t size);
 
 /**
  *  Swap the endiannness of a random u8/u16/u32/u64.
+ * @param rng The sl2_rng to draw random decisions from
  * @param buf The buffer to mutate
  * @param size the size of the buffer to be mutated
  */
 SL2_EXPORT
-void strategyEndianSwap(uint8_t *buf, size_t size);
+void strategyEndianSwap(sl2_rng *rng, uint8_t *buf, size_t size);
+
+/**
+ * Overwrite a random position in the input buffer with a random token from the dictionary.
+ * Falls back to strategyKnownValues when there's no dictionary.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ */
+SL2_EXPORT
+void strategyDictionary(sl2_rng *rng, uint8_t *buf, size_t size);
+
+/**
+ * Insert a random token from the dictionary at a random position in the input buffer.
+ * Falls back to strategyInsertBytes when there's no dictionary.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ * @param capacity the size of the memory behind the buffer
+ * @return the new size of the buffer
+ */
+SL2_EXPORT
+size_t strategyInsertToken(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity);
+
+/**
+ * Input-to-state substitution: find one operand of a logged comparison in the input buffer and
+ * overwrite it with the other operand (integers are also tried byte-swapped), so that the
+ * comparison goes the other way. Falls back to strategyDictionary when there's no comparison log,
+ * or when none of the logged operands that it tries appear in the buffer.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ */
+SL2_EXPORT
+void strategyInputToState(sl2_rng *rng, uint8_t *buf, size_t size);
+
+/**
+ * Structure-aware: overwrite a random number in a textual input (e.g. JSON, XML, an INI file)
+ * with a well-known value, keeping its width. Falls back to strategyKnownValues when there's no
+ * number near the position that it picks.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ */
+SL2_EXPORT
+void strategyTokenNumber(sl2_rng *rng, uint8_t *buf, size_t size);
+
+/**
+ * Structure-aware: find a plausible length prefix (a 1-, 2- or 4-byte integer, in either byte
+ * order, that counts no more than the bytes after it) and set it to a boundary: zero, one off,
+ * exactly the rest of the buffer, one past it, or the field's maximum. Falls back to
+ * strategyKnownValues when there's no plausible length prefix.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ */
+SL2_EXPORT
+void strategyTokenLength(sl2_rng *rng, uint8_t *buf, size_t size);
+
+/**
+ * Insert a random continuous span of random bytes into the input buffer, shifting the rest
+ * of the buffer back.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ * @param capacity the size of the memory behind the buffer
+ * @return the new size of the buffer
+ */
+SL2_EXPORT
+size_t strategyInsertBytes(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity);
+
+/**
+ * Remove a random continuous span of bytes from the input buffer, shifting the rest of the
+ * buffer forward.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ * @param capacity the size of the memory behind the buffer
+ * @return the new size of the buffer
+ */
+SL2_EXPORT
+size_t strategyDeleteShiftBytes(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity);
+
+/**
+ * Insert a copy of a random continuous span of the input buffer elsewhere in the buffer.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ * @param capacity the size of the memory behind the buffer
+ * @return the new size of the buffer
+ */
+SL2_EXPORT
+size_t strategySpliceBytes(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity);
+
+/**
+ * Cut the input buffer short at a random position.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ * @param capacity the size of the memory behind the buffer
+ * @return the new size of the buffer
+ */
+SL2_EXPORT
+size_t strategyTruncate(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity);
+
+/**
+ * Structure-aware: duplicate a random number, string or word in a textual input, along with a
+ * separator next to it (e.g. a list element and its comma). Falls back to strategySpliceBytes.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ * @param capacity the size of the memory behind the buffer
+ * @return the new size of the buffer
+ */
+SL2_EXPORT
+size_t strategyTokenDuplicate(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity);
+
+/**
+ * Structure-aware: delete a random number, string or word in a textual input, along with a
+ * separator next to it. Falls back to strategyDeleteShiftBytes.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ * @param capacity the size of the memory behind the buffer
+ * @return the new size of the buffer
+ */
+SL2_EXPORT
+size_t strategyTokenDelete(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity);
+
+/**
+ * Structure-aware: grow or shrink the value behind a plausible length prefix (see
+ * strategyTokenLength), and fix the prefix up to match, so that the record stays well-formed.
+ * Falls back to strategyInsertBytes when there's no plausible length prefix.
+ * @param rng The sl2_rng to draw random decisions from
+ * @param buf The buffer to mutate
+ * @param size the size of the buffer to be mutated
+ * @param capacity the size of the memory behind the buffer
+ * @return the new size of the buffer
+ */
+SL2_EXPORT
+size_t strategyTokenResize(sl2_rng *rng, uint8_t *buf, size_t size, size_t capacity);
 
 /**
  * Mutates the buffer within the given `mutation`. Uses the `mutation->mut_type` to indicate which
- * mutation was performed.
+ * mutation was performed. If `mutation->capacity` allows it, the strategy may change
+ * `mutation->bufsize`.
+ * @param rng the sl2_rng to draw random decisions from
  * @param mutation
  * @return
  */
 SL2_EXPORT
-bool do_mutation(sl2_mutation *mutation);
+bool do_mutation(sl2_rng *rng, sl2_mutation *mutation);
 
 /**
  * Mutates the buffer with `mutation` using `strategy`. Sets `mutation->mut_type` to
  * `SL2_CUSTOM_STRATEGY`.
+ * @param rng the sl2_rng to draw random decisions from
  * @param mutation
  * @param strategy
  * @return
  */
 SL2_EXPORT
-bool do_mutation_custom(sl2_mutation *mutation, sl2_strategy_t strategy);
+bool do_mutation_custom(sl2_rng *rng, sl2_mutation *mutation, sl2_strategy_t strategy);
+
+/**
+ * Mutates the buffer within the given `mutation` with a random-length stack of strategies.
+ * Sets `mutation->mut_type` to `SL2_HAVOC_STRATEGY` and records the stack (and the seed its
+ * strategies drew from) in `mutation->chain` and `mutation->chain_seed`.
+ * @param rng the sl2_rng to draw the stack (and its seed) from
+ * @param mutation
+ * @param max_stack the maximum number of strategies to stack, up to SL2_MAX_MUTATION_CHAIN
+ * @param first_strategy the table index of the first strategy to apply, or -1 to pick it at random
+ * @return
+ */
+SL2_EXPORT
+bool do_mutation_havoc(sl2_rng *rng, sl2_mutation *mutation, uint32_t max_stack,
+                       int first_strategy);
+
+/**
+ * (Re-)applies the stack of strategies recorded in `mutation->chain` to the buffer within the
+ * given `mutation`, seeding them from `mutation->chain_seed`. Applying a recorded chain to the
+ * original bytes reproduces the mutated bytes exactly.
+ * @param mutation
+ * @return
+ */
+SL2_EXPORT
+bool do_mutation_chain(sl2_mutation *mutation);
+
+/**
+ * Crosses the buffer within the given `mutation` with `donor`: keeps the buffer's head, and
+ * takes the donor's tail from a random split point between the first and last bytes where the
+ * two differ. If `mutation->capacity` allows it, the buffer takes on the donor's length.
+ * Sets `mutation->mut_type` to `SL2_SPLICE_STRATEGY`.
+ * @param rng the sl2_rng to draw the split point from
+ * @param mutation
+ * @param donor another input for the same targeted read, e.g. from the server's corpus
+ * @param donor_size the size of `donor`
+ * @return false if the buffer and the donor are too alike to splice (the buffer is unchanged)
+ */
+SL2_EXPORT
+bool do_mutation_splice(sl2_rng *rng, sl2_mutation *mutation, const uint8_t *donor,
+                        size_t donor_size);
+
+/**
+ * @param stage a deterministic stage
+ * @param size the size of the buffer being walked
+ * @return the number of mutations in the given stage, for a buffer of the given size
+ */
+SL2_EXPORT
+uint64_t sl2_det_stage_len(uint32_t stage, size_t size);
+
+/**
+ * Applies the single deterministic mutation at `cursor` to the buffer within the given
+ * `mutation`. Sets `mutation->mut_type` to `SL2_DETERMINISTIC_STRATEGY`.
+ * @param mutation
+ * @param cursor the stage and offset of the mutation to apply
+ * @return false if the cursor is past the end of its stage (for this buffer's size)
+ */
+SL2_EXPORT
+bool do_mutation_deterministic(sl2_mutation *mutation, const sl2_det_cursor *cursor);
+
+/**
+ * Validates a token dictionary and points `dict` at its contents.
+ * @param dict the dictionary to fill in
+ * @param data the dictionary file's contents
+ * @param size the size of `data`
+ * @return whether `data` is a well-formed dictionary
+ */
+SL2_EXPORT
+bool sl2_dictionary_parse(sl2_dictionary *dict, const uint8_t *data, size_t size);
+
+/**
+ * Sets the dictionary that the dictionary strategies draw tokens from. `dict` must outlive any
+ * further mutations; pass NULL to go back to having no dictionary.
+ * @param dict the dictionary
+ */
+SL2_EXPORT
+void set_mutation_dictionary(const sl2_dictionary *dict);
+
+/**
+ * Validates a comparison log and points `cmplog` at its entries.
+ * @param cmplog the comparison log to fill in
+ * @param data the comparison log file's contents
+ * @param size the size of `data`
+ * @return whether `data` is a well-formed comparison log
+ */
+SL2_EXPORT
+bool sl2_cmplog_parse(sl2_cmplog *cmplog, const uint8_t *data, size_t size);
+
+/**
+ * Sets the comparison log that strategyInputToState draws operands from. `cmplog` must outlive
+ * any further mutations; pass NULL to go back to having no comparison log.
+ * @param cmplog the comparison log
+ */
+SL2_EXPORT
+void set_mutation_cmplog(const sl2_cmplog *cmplog);
+
+/**
+ * Validates a fixup table and points `fixups` at its fixups.
+ * @param fixups the fixup table to fill in
+ * @param data the fixup file's contents
+ * @param size the size of `data`
+ * @return whether `data` is a well-formed fixup table
+ */
+SL2_EXPORT
+bool sl2_fixups_parse(sl2_fixups *fixups, const uint8_t *data, size_t size);
+
+/**
+ * Recomputes the fields of every fixup that applies to a targeted read, in order. Fixups that
+ * don't fit in the buffer are skipped.
+ * @param fixups the fixup table
+ * @param mut_count the targeted read
+ * @param buf the read's (mutated) bytes
+ * @param size the size of `buf`
+ * @return whether any of the buffer's bytes changed
+ */
+SL2_EXPORT
+bool sl2_apply_fixups(const sl2_fixups *fixups, uint32_t mut_count, uint8_t *buf, size_t size);
 
 #endif
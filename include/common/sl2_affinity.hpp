@@ -0,0 +1,168 @@
+#ifndef SL2_AFFINITY_HPP
+#define SL2_AFFINITY_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <Windows.h>
+#include <Tlhelp32.h>
+
+/**
+ * Processor placement for the server (-p, -numa) and the supervisor's slots. Processors are
+ * named by their group and their number within it, so that hosts with more than 64 logical
+ * processors can be pinned to in full, and can be narrowed down to a single NUMA node so that a
+ * server shard and its workers share the node's memory.
+ */
+
+/** A single logical processor. */
+struct sl2_processor {
+  WORD group;
+  BYTE number;
+};
+
+/**
+ * @param node a NUMA node, or -1 for every node
+ * @param candidates receives the node's processors (or every active processor), by group
+ * @return whether the node exists
+ */
+static inline bool sl2_node_processors(int node, std::vector<KAFFINITY> &candidates) {
+  WORD groups = GetActiveProcessorGroupCount();
+  candidates.assign(groups, 0);
+
+  if (node < 0) {
+    for (WORD group = 0; group < groups; ++group) {
+      DWORD count = GetActiveProcessorCount(group);
+      candidates[group] = count >= 64 ? ~(KAFFINITY)0 : (((KAFFINITY)1 << count) - 1);
+    }
+
+    return true;
+  }
+
+  GROUP_AFFINITY affinity = {0};
+
+  if (!GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) || !affinity.Mask ||
+      affinity.Group >= groups) {
+    return false;
+  }
+
+  candidates[affinity.Group] = affinity.Mask;
+
+  return true;
+}
+
+/**
+ * Finds the processors that some other process is pinned to by itself (i.e. whose affinity is
+ * that single processor), like `server.exe -p` or a supervisor's runs.
+ * @param pinned receives those processors, by group
+ * @return whether the processes could be enumerated
+ */
+static inline bool sl2_pinned_processors(std::vector<KAFFINITY> &pinned) {
+  PROCESSENTRY32 process_entry;
+  HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+
+  pinned.assign(GetActiveProcessorGroupCount(), 0);
+
+  if (snapshot == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  process_entry.dwSize = sizeof(PROCESSENTRY32);
+
+  if (Process32First(snapshot, &process_entry)) {
+    do {
+      if (process_entry.th32ProcessID == GetCurrentProcessId()) {
+        continue;
+      }
+
+      HANDLE handle =
+          OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, process_entry.th32ProcessID);
+      DWORD_PTR affinity, system_affinity;
+      USHORT group = 0, group_count = 1;
+
+      if (!handle) {
+        continue;
+      }
+
+      // A process's affinity mask is only meaningful within its one group.
+      if (GetProcessGroupAffinity(handle, &group_count, &group) && group_count == 1 &&
+          group < pinned.size() && GetProcessAffinityMask(handle, &affinity, &system_affinity) &&
+          affinity && !(affinity & (affinity - 1))) {
+        pinned[group] |= affinity;
+      }
+
+      CloseHandle(handle);
+    } while (Process32Next(snapshot, &process_entry));
+  }
+
+  CloseHandle(snapshot);
+
+  return true;
+}
+
+/**
+ * Lists the processors that a process can be pinned to: those of a NUMA node (or of every node),
+ * short of the ones that other processes are pinned to. If they're all taken, every processor of
+ * the node is listed instead, so that callers share rather than refusing to run.
+ * @param node a NUMA node, or -1 for every node
+ * @param processors receives the processors, in order
+ * @return whether the node exists
+ */
+static inline bool sl2_free_processors(int node, std::vector<sl2_processor> &processors) {
+  std::vector<KAFFINITY> candidates, pinned;
+
+  processors.clear();
+
+  if (!sl2_node_processors(node, candidates)) {
+    return false;
+  }
+
+  sl2_pinned_processors(pinned);
+
+  for (int pass = 0; pass < 2 && processors.empty(); ++pass) {
+    for (WORD group = 0; group < candidates.size(); ++group) {
+      KAFFINITY mask = pass ? candidates[group] : candidates[group] & ~pinned[group];
+
+      for (BYTE number = 0; number < sizeof(KAFFINITY) * 8; ++number) {
+        if ((mask >> number) & 1) {
+          processors.push_back({group, number});
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @param processor a processor
+ * @return the NUMA node that it belongs to, or NUMA_NO_PREFERRED_NODE if that can't be told
+ */
+static inline DWORD sl2_processor_node(sl2_processor processor) {
+  PROCESSOR_NUMBER number = {processor.group, processor.number, 0};
+  USHORT node;
+
+  if (!GetNumaProcessorNodeEx(&number, &node)) {
+    return NUMA_NO_PREFERRED_NODE;
+  }
+
+  return node;
+}
+
+/**
+ * Restricts every process in a job to some of a single group's processors. Unlike
+ * JOB_OBJECT_LIMIT_AFFINITY, this works for any group, not just the primary one.
+ * @param job the job
+ * @param group the group
+ * @param mask the group's processors to restrict the job to
+ * @return success
+ */
+static inline bool sl2_set_job_group_affinity(HANDLE job, WORD group, KAFFINITY mask) {
+  GROUP_AFFINITY affinity = {0};
+  affinity.Group = group;
+  affinity.Mask = mask;
+
+  return SetInformationJobObject(job, JobObjectGroupInformationEx, &affinity, sizeof(affinity));
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SL2_ALLOC_HPP
+#define SL2_ALLOC_HPP
+
+#include <stddef.h>
+
+#include "dr_api.h"
+
+/**
+ * The clients allocate through these, rather than through DR's allocators directly, so that
+ * allocations can be accounted for. In builds with SL2_ALLOC_STATS (every Debug build, or any
+ * build configured with -DSL2_ALLOC_STATS=ON), the profiler (-profile, see sl2_profile.hpp) counts
+ * each allocation and its size against the probe that made it, and reports them when the client
+ * exits. With -alloc_steady <n>, any allocation made by a probe that has already run <n> times on
+ * the same thread is a failed assertion, which keeps allocation-free hot paths that way.
+ * Without SL2_ALLOC_STATS, these are just DR's allocators.
+ * Frees aren't counted, so these don't track what's live; only what's asked for.
+ */
+
+#ifdef SL2_ALLOC_STATS
+/**
+ * Counts an allocation against the current thread's innermost probe.
+ * @param bytes the allocation's size
+ */
+void sl2_alloc_count(size_t bytes);
+#else
+static inline void sl2_alloc_count(size_t bytes) {
+}
+#endif
+
+/** `dr_global_alloc`, counted. */
+static inline void *sl2_global_alloc(size_t size) {
+  sl2_alloc_count(size);
+  return dr_global_alloc(size);
+}
+
+/** `dr_thread_alloc`, counted. */
+static inline void *sl2_thread_alloc(void *drcontext, size_t size) {
+  sl2_alloc_count(size);
+  return dr_thread_alloc(drcontext, size);
+}
+
+/** `dr_raw_mem_alloc`, counted. */
+static inline void *sl2_raw_mem_alloc(size_t size, uint prot, void *addr) {
+  sl2_alloc_count(size);
+  return dr_raw_mem_alloc(size, prot, addr);
+}
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef SL2_COMPRESS_HPP
+#define SL2_COMPRESS_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <Windows.h>
+#include <compressapi.h>
+#include <winioctl.h>
+
+/**
+ * Compression for the server's bulkiest artifacts: crash dumps and arenas (server -z). These
+ * are compressed with the Windows Compression API (XPRESS with Huffman coding, which is built into
+ * Cabinet.dll), so nothing has to be shipped alongside SL2. Each compressed file is an
+ * sl2_compressed_header followed by the compressor's output. Readers check for the header's magic
+ * (see `sl2_is_compressed`) and take anything else as raw, so compression can be switched on and
+ * off without invalidating what's already on disk.
+ * Binaries that include this must link against Cabinet.
+ */
+
+/*! The magic that compressed files start with: "SL2Z" */
+#define SL2_COMPRESS_MAGIC 0x5a324c53
+
+/*! The algorithm that files are compressed with */
+#define SL2_COMPRESS_ALGORITHM COMPRESS_ALGORITHM_XPRESS_HUFF
+
+/*! Precedes the compressor's output in a compressed file */
+struct sl2_compressed_header {
+  /*! SL2_COMPRESS_MAGIC */
+  uint32_t magic;
+  /*! The Compression API algorithm that the contents were compressed with */
+  uint32_t algorithm;
+  /*! The size of the contents once decompressed */
+  uint64_t raw_size;
+};
+
+/**
+ * @param data the start of some file's contents
+ * @param size how many bytes of the file `data` holds
+ * @return whether the file is compressed
+ */
+static inline bool sl2_is_compressed(const uint8_t *data, size_t size) {
+  uint32_t magic;
+
+  if (size < sizeof(sl2_compressed_header)) {
+    return false;
+  }
+
+  memcpy(&magic, data, sizeof(magic));
+
+  return magic == SL2_COMPRESS_MAGIC;
+}
+
+/**
+ * Compresses a buffer into a compressed file's contents.
+ * @param data the buffer
+ * @param size the size of the buffer
+ * @param out receives the compressed contents, header included
+ * @return success
+ */
+static inline bool sl2_compress(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+  COMPRESSOR_HANDLE compressor;
+  sl2_compressed_header header = {SL2_COMPRESS_MAGIC, SL2_COMPRESS_ALGORITHM, size};
+  SIZE_T needed = 0;
+  bool ok = false;
+
+  if (!CreateCompressor(SL2_COMPRESS_ALGORITHM, NULL, &compressor)) {
+    return false;
+  }
+
+  // The first call only asks how big the output can get.
+  Compress(compressor, data, size, NULL, 0, &needed);
+
+  if (GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
+    out.resize(sizeof(header) + needed);
+    memcpy(out.data(), &header, sizeof(header));
+
+    if (Compress(compressor, data, size, out.data() + sizeof(header), needed, &needed)) {
+      out.resize(sizeof(header) + needed);
+      ok = true;
+    }
+  }
+
+  CloseCompressor(compressor);
+
+  return ok;
+}
+
+/**
+ * Decompresses a compressed file's contents.
+ * @param data the compressed contents, header included (see `sl2_is_compressed`)
+ * @param size the size of the compressed contents
+ * @param out receives the decompressed contents
+ * @param out_size the size of `out`, which must be at least the header's `raw_size`
+ * @return success
+ */
+static inline bool sl2_decompress(const uint8_t *data, size_t size, uint8_t *out,
+                                  size_t out_size) {
+  DECOMPRESSOR_HANDLE decompressor;
+  sl2_compressed_header header;
+  SIZE_T written = 0;
+  bool ok;
+
+  if (!sl2_is_compressed(data, size)) {
+    return false;
+  }
+
+  memcpy(&header, data, sizeof(header));
+
+  if (header.raw_size > out_size || !CreateDecompressor(header.algorithm, NULL, &decompressor)) {
+    return false;
+  }
+
+  ok = Decompress(decompressor, data + sizeof(header), size - sizeof(header), out, out_size,
+                  &written) &&
+       written == header.raw_size;
+
+  CloseDecompressor(decompressor);
+
+  return ok;
+}
+
+/**
+ * @param data a compressed file's contents (see `sl2_is_compressed`)
+ * @return the size of the contents once decompressed
+ */
+static inline uint64_t sl2_compressed_raw_size(const uint8_t *data) {
+  sl2_compressed_header header;
+
+  memcpy(&header, data, sizeof(header));
+
+  return header.raw_size;
+}
+
+/**
+ * Turns on NTFS compression for an open file, for files that are read in place (e.g. mapped)
+ * and so can't be compressed by SL2 itself. Fails harmlessly on volumes that don't support it.
+ * @param file the file, opened for writing
+ * @return success
+ */
+static inline bool sl2_compress_in_place(HANDLE file) {
+  USHORT format = COMPRESSION_FORMAT_DEFAULT;
+  DWORD returned;
+
+  return DeviceIoControl(file, FSCTL_SET_COMPRESSION, &format, sizeof(format), NULL, 0, &returned,
+                         NULL);
+}
+
+#endif
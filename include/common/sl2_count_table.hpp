@@ -0,0 +1,172 @@
+#ifndef SL2_COUNT_TABLE_HPP
+#define SL2_COUNT_TABLE_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "dr_api.h"
+
+#include "common/sl2_alloc.hpp"
+
+/*! The number of slots in a table's first allocation. Must be a power of two. */
+#define SL2_COUNT_TABLE_INITIAL_SLOTS 64
+
+/*! The key that marks an empty slot. Counts for this key are kept on the side. */
+#define SL2_COUNT_TABLE_EMPTY UINT64_MAX
+
+/**
+ * A flat table of counts, keyed by 64-bit values (e.g. return addresses).
+ * This sits on the path of every hooked call, so it's an open-addressing (linear probing) table
+ * in a single DR global allocation: counting a key is one probe in the common case, instead of a
+ * node allocation and a rebalance.
+ * The table isn't allocated until the first key is counted, so static instances are
+ * safe to construct before DynamoRIO is up.
+ */
+class sl2_count_table {
+public:
+  sl2_count_table() : slots(NULL), capacity(0), size(0), empty_key_count(0) {
+  }
+
+  sl2_count_table(const sl2_count_table &other)
+      : slots(NULL), capacity(0), size(0), empty_key_count(0) {
+    *this = other;
+  }
+
+  ~sl2_count_table() {
+    release();
+  }
+
+  sl2_count_table &operator=(const sl2_count_table &other) {
+    if (this == &other) {
+      return *this;
+    }
+
+    if (capacity != other.capacity) {
+      release();
+
+      if (other.capacity) {
+        slots = (sl2_count_slot *)sl2_global_alloc(other.capacity * sizeof(sl2_count_slot));
+        capacity = other.capacity;
+      }
+    }
+
+    if (capacity) {
+      memcpy(slots, other.slots, capacity * sizeof(sl2_count_slot));
+    }
+
+    size = other.size;
+    empty_key_count = other.empty_key_count;
+
+    return *this;
+  }
+
+  /**
+   * @param key the key
+   * @return the number of times the key has been counted
+   */
+  uint64_t get(uint64_t key) const {
+    if (key == SL2_COUNT_TABLE_EMPTY) {
+      return empty_key_count;
+    }
+
+    if (!capacity) {
+      return 0;
+    }
+
+    const sl2_count_slot *slot = &slots[find(key)];
+    return slot->key == key ? slot->count : 0;
+  }
+
+  /**
+   * Counts a key.
+   * @param key the key
+   * @return the key's count before this one
+   */
+  uint64_t increment(uint64_t key) {
+    if (key == SL2_COUNT_TABLE_EMPTY) {
+      return empty_key_count++;
+    }
+
+    // Keep the load factor at or below 1/2, so that probe sequences stay short.
+    if ((size + 1) * 2 > capacity) {
+      grow();
+    }
+
+    sl2_count_slot *slot = &slots[find(key)];
+
+    if (slot->key != key) {
+      slot->key = key;
+      slot->count = 0;
+      size++;
+    }
+
+    return slot->count++;
+  }
+
+private:
+  struct sl2_count_slot {
+    uint64_t key;
+    uint64_t count;
+  };
+
+  sl2_count_slot *slots;
+  size_t capacity;
+  size_t size;
+  uint64_t empty_key_count;
+
+  /**
+   * @param key the key
+   * @return the index of the key's slot, or of the empty slot that it would go in
+   */
+  size_t find(uint64_t key) const {
+    size_t mask = capacity - 1;
+    size_t i = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+
+    while (slots[i].key != key && slots[i].key != SL2_COUNT_TABLE_EMPTY) {
+      i = (i + 1) & mask;
+    }
+
+    return i;
+  }
+
+  /**
+   * Doubles the table's capacity, and re-inserts every key.
+   */
+  void grow() {
+    sl2_count_slot *old_slots = slots;
+    size_t old_capacity = capacity;
+
+    capacity = old_capacity ? old_capacity * 2 : SL2_COUNT_TABLE_INITIAL_SLOTS;
+    slots = (sl2_count_slot *)sl2_global_alloc(capacity * sizeof(sl2_count_slot));
+
+    for (size_t i = 0; i < capacity; i++) {
+      slots[i].key = SL2_COUNT_TABLE_EMPTY;
+    }
+
+    for (size_t i = 0; i < old_capacity; i++) {
+      if (old_slots[i].key != SL2_COUNT_TABLE_EMPTY) {
+        slots[find(old_slots[i].key)] = old_slots[i];
+      }
+    }
+
+    if (old_slots) {
+      dr_global_free(old_slots, old_capacity * sizeof(sl2_count_slot));
+    }
+  }
+
+  /**
+   * Frees the table's slots, forgetting every key.
+   */
+  void release() {
+    if (slots) {
+      dr_global_free(slots, capacity * sizeof(sl2_count_slot));
+    }
+
+    slots = NULL;
+    capacity = 0;
+    size = 0;
+    empty_key_count = 0;
+  }
+};
+
+#endif
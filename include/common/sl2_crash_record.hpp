@@ -0,0 +1,136 @@
+#ifndef SL2_CRASH_RECORD_HPP
+#define SL2_CRASH_RECORD_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The tracer's findings about a crash (FUZZ_RUN_CRASH_RECORD_FMT), in a compact binary record
+ * that the triager and the harness read in place instead of each parsing a JSON document. A
+ * record is an sl2_crash_record followed by its sections, each of which starts on an 8-byte
+ * boundary. Sections that a crash doesn't have are empty. JSON is only made from a record for
+ * display (see XploitabilityTracer::toJson and sl2/harness/crash_record.py).
+ * Keep this in sync with sl2/harness/crash_record.py!
+ */
+
+/*! The magic that crash records start with: "SLCR" */
+#define SL2_CRASH_RECORD_MAGIC 0x52434c53
+
+/*! Bumped whenever the layout of a record changes */
+#define SL2_CRASH_RECORD_VERSION 1
+
+/*! The number of registers in a record: rax, rbx, rcx, rdx, rsp, rbp, rsi, rdi, r8-r15, rip */
+#define SL2_CRASH_RECORD_REGS 17
+
+/*! The number of calls and instructions in a record's header (the tracer's LAST_COUNT) */
+#define SL2_CRASH_RECORD_LAST 5
+
+/*! The tracer's observations about the crashing instruction, as sl2_crash_record flags */
+enum sl2_crash_record_flag {
+  SL2_CRASH_PC_TAINTED = 1 << 0,
+  SL2_CRASH_STACK_TAINTED = 1 << 1,
+  SL2_CRASH_IS_RET = 1 << 2,
+  SL2_CRASH_IS_INDIRECT = 1 << 3,
+  SL2_CRASH_IS_DIRECT = 1 << 4,
+  SL2_CRASH_IS_CALL = 1 << 5,
+  SL2_CRASH_MEM_WRITE = 1 << 6,
+  SL2_CRASH_MEM_READ = 1 << 7,
+  SL2_CRASH_TAINTED_SRC = 1 << 8,
+  SL2_CRASH_TAINTED_DST = 1 << 9,
+};
+
+/*! The variable-sized parts of a record */
+enum sl2_crash_record_section_id {
+  /*! Why the tracer scored the crash the way it did (UTF-8) */
+  SL2_CRASH_SECTION_REASON,
+  /*! The name of the exception (UTF-8) */
+  SL2_CRASH_SECTION_EXCEPTION,
+  /*! The disassembly of the crashing instruction (UTF-8) */
+  SL2_CRASH_SECTION_INSTRUCTION,
+  /*! The crashing thread's recent calls, oldest first (uint64_t each), with -history */
+  SL2_CRASH_SECTION_HISTORY_CALLS,
+  /*! The crashing thread's recent instructions, oldest first (uint64_t each), with -history */
+  SL2_CRASH_SECTION_HISTORY_INSNS,
+  /*! The tainted memory, as (start, size) uint64_t pairs */
+  SL2_CRASH_SECTION_TAINTED,
+  /*! The input offsets that reach the crash, as a JSON object, in label mode */
+  SL2_CRASH_SECTION_LABELS,
+  SL2_CRASH_SECTION_COUNT,
+};
+
+/*! Where one of a record's sections is, relative to the start of the record */
+struct sl2_crash_record_section {
+  uint32_t offset;
+  uint32_t size;
+};
+
+/*! The fixed-size start of every crash record */
+struct sl2_crash_record {
+  /*! SL2_CRASH_RECORD_MAGIC */
+  uint32_t magic;
+  /*! SL2_CRASH_RECORD_VERSION */
+  uint16_t version;
+  /*! sl2_crash_record_flag bits */
+  uint16_t flags;
+  /*! The size of the whole record, sections included */
+  uint32_t size;
+  /*! The tracer's exploitability score, from 0 to 100 */
+  uint32_t score;
+  /*! The exception code */
+  uint32_t exception_code;
+  /*! Which of `regs` were tainted, one bit per register */
+  uint32_t reg_taint;
+  /*! The address of the crashing instruction */
+  uint64_t location;
+  /*! The crashing thread's registers, in SL2_CRASH_RECORD_REGS order */
+  uint64_t regs[SL2_CRASH_RECORD_REGS];
+  /*! The crashing thread's last calls, oldest first, zero-padded */
+  uint64_t last_calls[SL2_CRASH_RECORD_LAST];
+  /*! The crashing thread's last instructions, oldest first, zero-padded */
+  uint64_t last_insns[SL2_CRASH_RECORD_LAST];
+  /*! The record's sections, by sl2_crash_record_section_id */
+  sl2_crash_record_section sections[SL2_CRASH_SECTION_COUNT];
+};
+
+static_assert(sizeof(sl2_crash_record) == 304, "crash record header layout changed");
+
+/**
+ * @param data a crash record
+ * @param size the size of `data`
+ * @return the record's header, if it's a well-formed record of this version, or NULL
+ */
+static inline const sl2_crash_record *sl2_crash_record_open(const uint8_t *data, size_t size) {
+  const sl2_crash_record *record = (const sl2_crash_record *)data;
+
+  if (size < sizeof(sl2_crash_record) || record->magic != SL2_CRASH_RECORD_MAGIC ||
+      record->version != SL2_CRASH_RECORD_VERSION || record->size > size) {
+    return NULL;
+  }
+
+  for (int i = 0; i < SL2_CRASH_SECTION_COUNT; i++) {
+    const sl2_crash_record_section *section = &record->sections[i];
+
+    if (section->size && ((uint64_t)section->offset + section->size > record->size ||
+                          section->offset < sizeof(sl2_crash_record))) {
+      return NULL;
+    }
+  }
+
+  return record;
+}
+
+/**
+ * @param record an open crash record (see sl2_crash_record_open)
+ * @param id the section
+ * @param size receives the size of the section
+ * @return the start of the section, within the record
+ */
+static inline const uint8_t *sl2_crash_record_section_data(const sl2_crash_record *record,
+                                                          sl2_crash_record_section_id id,
+                                                          size_t *size) {
+  *size = record->sections[id].size;
+
+  return (const uint8_t *)record + record->sections[id].offset;
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef SL2_DELTA_HPP
+#define SL2_DELTA_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+/*! How a registered (or replayed) mutation's bytes are sent: the whole mutated buffer... */
+#define SL2_FKT_FULL 0
+/*! ...or only the ranges that differ from the original buffer, as an sl2_delta. */
+#define SL2_FKT_DELTA 1
+/*! Only ever stored, never sent: the corpus seed that the mutation was made from and the stacked
+ * strategies that made it, as an sl2_fkt_chain (see sl2_fkt.hpp). */
+#define SL2_FKT_CHAIN 2
+
+/*! The smallest buffer that the fuzzer delta-encodes; smaller buffers are cheaper to send whole. */
+#define SL2_DELTA_MIN_BUFSIZE (64 * 1024)
+
+/*! Equal bytes shorter than this between two changed ranges are folded into one range, since
+ * a new range header would cost more than they do. */
+#define SL2_DELTA_GAP (sizeof(sl2_delta_range))
+
+/**
+ * The header of a delta-encoded mutation. It's followed by `count` ranges, each an
+ * sl2_delta_range followed by `length` bytes of mutated data.
+ * Applying a delta to a buffer holding the original bytes yields the mutated buffer: every byte
+ * past the end of the original is covered by a range, and a mutated buffer that's shorter than the
+ * original is just cut short.
+ */
+struct sl2_delta {
+  /*! The size of the original buffer */
+  uint32_t original_size;
+  /*! The size of the mutated buffer */
+  uint32_t mutated_size;
+  /*! The number of ranges that follow */
+  uint32_t count;
+};
+
+/*! A run of mutated bytes within a delta */
+struct sl2_delta_range {
+  /*! Where the run starts, in the mutated buffer */
+  uint32_t offset;
+  /*! The number of mutated bytes that follow */
+  uint32_t length;
+};
+
+/**
+ * Delta-encodes a mutated buffer against its original bytes.
+ * @param original the original buffer
+ * @param original_size the size of the original buffer
+ * @param mutated the mutated buffer
+ * @param mutated_size the size of the mutated buffer
+ * @param out receives the delta
+ * @param capacity the size of `out`
+ * @return the size of the delta, or 0 if it doesn't fit in `out` (send the whole buffer instead)
+ */
+static inline size_t sl2_delta_encode(const uint8_t *original, size_t original_size,
+                                      const uint8_t *mutated, size_t mutated_size, uint8_t *out,
+                                      size_t capacity) {
+  sl2_delta header = {(uint32_t)original_size, (uint32_t)mutated_size, 0};
+  size_t common = original_size < mutated_size ? original_size : mutated_size;
+  size_t used = sizeof(header);
+  size_t i = 0;
+
+  if (capacity < used) {
+    return 0;
+  }
+
+  while (i < mutated_size) {
+    if (i < common && original[i] == mutated[i]) {
+      i++;
+      continue;
+    }
+
+    // Grow the range until we see SL2_DELTA_GAP equal bytes in a row (or run out of buffer).
+    size_t last = i;
+
+    for (size_t j = i + 1; j < mutated_size && j - last <= SL2_DELTA_GAP; j++) {
+      if (j >= common || original[j] != mutated[j]) {
+        last = j;
+      }
+    }
+
+    sl2_delta_range range = {(uint32_t)i, (uint32_t)(last + 1 - i)};
+
+    if (capacity - used < sizeof(range) + range.length) {
+      return 0;
+    }
+
+    memcpy(out + used, &range, sizeof(range));
+    memcpy(out + used + sizeof(range), mutated + i, range.length);
+    used += sizeof(range) + range.length;
+    header.count++;
+
+    i = last + 1;
+  }
+
+  memcpy(out, &header, sizeof(header));
+
+  return used;
+}
+
+/**
+ * Turns a delta of a window of a buffer into a delta of the whole buffer, in place. The window
+ * mustn't have changed size.
+ * @param delta the window's delta
+ * @param delta_size the size of `delta`
+ * @param offset where the window starts in the buffer
+ * @param bufsize the size of the buffer
+ */
+static inline void sl2_delta_rebase(uint8_t *delta, size_t delta_size, size_t offset,
+                                    size_t bufsize) {
+  sl2_delta header;
+  size_t used = sizeof(header);
+
+  memcpy(&header, delta, sizeof(header));
+
+  for (uint32_t i = 0; i < header.count && delta_size - used >= sizeof(sl2_delta_range); i++) {
+    sl2_delta_range range;
+
+    memcpy(&range, delta + used, sizeof(range));
+    range.offset += (uint32_t)offset;
+    memcpy(delta + used, &range, sizeof(range));
+    used += sizeof(range) + range.length;
+  }
+
+  header.original_size = (uint32_t)bufsize;
+  header.mutated_size = (uint32_t)bufsize;
+  memcpy(delta, &header, sizeof(header));
+}
+
+/**
+ * Applies a delta to a buffer that holds the original bytes, in place.
+ * @param delta the delta
+ * @param delta_size the size of `delta`
+ * @param buffer the buffer holding the original bytes, which receives the mutated ones
+ * @param bufsize the size of `buffer`, which must fit the whole mutated buffer
+ * @return whether the delta was well-formed and fit in `buffer`
+ */
+static inline bool sl2_delta_apply(const uint8_t *delta, size_t delta_size, uint8_t *buffer,
+                                   size_t bufsize) {
+  sl2_delta header;
+  size_t used = sizeof(header);
+
+  if (delta_size < used) {
+    return false;
+  }
+
+  memcpy(&header, delta, sizeof(header));
+
+  if (header.mutated_size > bufsize) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < header.count; i++) {
+    sl2_delta_range range;
+
+    if (delta_size - used < sizeof(range)) {
+      return false;
+    }
+
+    memcpy(&range, delta + used, sizeof(range));
+    used += sizeof(range);
+
+    if (delta_size - used < range.length ||
+        (uint64_t)range.offset + range.length > header.mutated_size) {
+      return false;
+    }
+
+    memcpy(buffer + range.offset, delta + used, range.length);
+    used += range.length;
+  }
+
+  return used == delta_size;
+}
+
+#endif
@@ -1,10 +1,15 @@
 #ifndef SL2_DR_ALLOCATOR_H
 #define SL2_DR_ALLOCATOR_H
 
+#include <atomic>
 #include <memory>
+#include <string.h>
+
+#include "common/sl2_alloc.hpp"
 
 /**
- * Defines a templatized allocator that's backed by DynamoRIO's private heap.
+ * Defines a templatized allocator that's backed by DynamoRIO's private heap. Its allocations are
+ * counted like the rest of the client's (see sl2_alloc.hpp).
  * @tparam T - Type to allocate memory for
  */
 template <typename T> struct sl2_dr_allocator {
@@ -17,11 +22,11 @@ template <typename T> struct sl2_dr_allocator {
   }
 
   T *allocate(size_t size) {
-    return static_cast<T *>(dr_global_alloc(size * sizeof(T)));
+    return static_cast<T *>(sl2_global_alloc(size * sizeof(T)));
   }
 
   void deallocate(T *ptr, size_t size) {
-    dr_global_free(ptr, size);
+    dr_global_free(ptr, size * sizeof(T));
   }
 };
 
@@ -35,4 +40,231 @@ constexpr bool operator!=(const sl2_dr_allocator<T> &, const sl2_dr_allocator<U>
   return false;
 }
 
+/*! The size of each chunk that a region bump-allocates from */
+#define SL2_REGION_CHUNK_SIZE (1024 * 1024)
+
+/*! Allocations up to this size come out of a region's chunks, and are reused once they're freed.
+ * Larger ones (e.g. vectors' storage) go to DR's heap as usual. */
+#define SL2_REGION_MAX_SMALL 256
+
+/*! The granularity of a region's small allocations, and so the size of its free lists' classes */
+#define SL2_REGION_ALIGN 16
+
+#define SL2_REGION_CLASSES (SL2_REGION_MAX_SMALL / SL2_REGION_ALIGN)
+
+/*! A freed small allocation, on its size class's free list */
+struct sl2_region_free {
+  sl2_region_free *next;
+};
+
+/*! Starts each of a region's chunks */
+struct sl2_region_chunk {
+  sl2_region_chunk *next;
+  size_t size;
+};
+
+/**
+ * A region of raw DR memory that node-based containers bump-allocate from, so that they don't
+ * take DR's global heap lock for every node. Freed nodes go on a free list for their size, and
+ * the chunks are only given back once the region is released (at on_dr_exit; see
+ * sl2_region_release). Only the chunks are counted as allocations (see sl2_alloc.hpp), so nodes
+ * that reuse freed ones are free. Every thread shares the region, so it's guarded by a lock.
+ * There's no constructor, since the global region is a zero-initialized static that
+ * containers constructed before the client's main already allocate from.
+ */
+struct sl2_region {
+  std::atomic_flag lock;
+  /*! Every chunk, newest first */
+  sl2_region_chunk *chunks;
+  /*! The unused part of the newest chunk */
+  uint8_t *next;
+  uint8_t *end;
+  sl2_region_free *free_lists[SL2_REGION_CLASSES];
+  /*! The number of small allocations that haven't been freed */
+  size_t live;
+  /*! Whether the region has been released, so that its chunks go once `live` reaches 0 */
+  bool released;
+};
+
+/**
+ * @return the region that every thread shares. It's `inline` rather than `static`, so that every
+ *         translation unit in a client shares it, and releasing it at exit frees all of it.
+ */
+inline sl2_region *sl2_global_region() {
+  static sl2_region region;
+  return &region;
+}
+
+static inline void sl2_region_lock(sl2_region *region) {
+  while (region->lock.test_and_set(std::memory_order_acquire)) {
+  }
+}
+
+static inline void sl2_region_unlock(sl2_region *region) {
+  region->lock.clear(std::memory_order_release);
+}
+
+/**
+ * @param size the size of a small allocation
+ * @return the allocation's size class
+ */
+static inline size_t sl2_region_class(size_t size) {
+  return size ? (size - 1) / SL2_REGION_ALIGN : 0;
+}
+
+/**
+ * Gives back every chunk of a region. Callers must hold the region's lock.
+ * @param region the region, which has no live allocations
+ */
+static inline void sl2_region_free_chunks(sl2_region *region) {
+  sl2_region_chunk *chunk = region->chunks;
+
+  while (chunk) {
+    sl2_region_chunk *next = chunk->next;
+
+    dr_raw_mem_free(chunk, chunk->size);
+    chunk = next;
+  }
+
+  region->chunks = NULL;
+  region->next = region->end = NULL;
+  memset(region->free_lists, 0, sizeof(region->free_lists));
+}
+
+/**
+ * Allocates from a region.
+ * @param region the region
+ * @param size the size of the allocation
+ * @return the allocation
+ */
+static inline void *sl2_region_alloc(sl2_region *region, size_t size) {
+  if (size > SL2_REGION_MAX_SMALL) {
+    return sl2_global_alloc(size);
+  }
+
+  size_t cls = sl2_region_class(size);
+  size_t rounded = (cls + 1) * SL2_REGION_ALIGN;
+  void *ptr;
+
+  sl2_region_lock(region);
+
+  if (region->free_lists[cls]) {
+    ptr = region->free_lists[cls];
+    region->free_lists[cls] = region->free_lists[cls]->next;
+  } else {
+    if (region->end - region->next < (ptrdiff_t)rounded) {
+      sl2_region_chunk *chunk = (sl2_region_chunk *)sl2_raw_mem_alloc(
+          SL2_REGION_CHUNK_SIZE, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+
+      // Containers can't be told that an allocation failed, so there's no going on without it.
+      if (chunk == NULL) {
+        sl2_region_unlock(region);
+        dr_fprintf(STDERR, "ERROR: couldn't allocate a region chunk!\n");
+        dr_abort();
+      }
+
+      chunk->next = region->chunks;
+      chunk->size = SL2_REGION_CHUNK_SIZE;
+      region->chunks = chunk;
+      region->next = (uint8_t *)ALIGN_FORWARD(chunk + 1, SL2_REGION_ALIGN);
+      region->end = (uint8_t *)chunk + SL2_REGION_CHUNK_SIZE;
+    }
+
+    ptr = region->next;
+    region->next += rounded;
+  }
+
+  region->live++;
+  sl2_region_unlock(region);
+
+  return ptr;
+}
+
+/**
+ * Frees an allocation from a region. Once a released region's last allocation is freed, its
+ * chunks go with it.
+ * @param region the region
+ * @param ptr the allocation
+ * @param size the size of the allocation
+ */
+static inline void sl2_region_dealloc(sl2_region *region, void *ptr, size_t size) {
+  if (size > SL2_REGION_MAX_SMALL) {
+    dr_global_free(ptr, size);
+    return;
+  }
+
+  size_t cls = sl2_region_class(size);
+  sl2_region_free *node = (sl2_region_free *)ptr;
+
+  sl2_region_lock(region);
+
+  node->next = region->free_lists[cls];
+  region->free_lists[cls] = node;
+
+  if (!--region->live && region->released) {
+    sl2_region_free_chunks(region);
+  }
+
+  sl2_region_unlock(region);
+}
+
+/**
+ * Releases a region: its chunks are given back right away if its containers are empty, and
+ * otherwise as soon as they are. Containers that are still alive (e.g. statics that are only
+ * destroyed after on_dr_exit, and whose head nodes are allocated up front) can still be
+ * destroyed safely.
+ * @param region the region
+ */
+static inline void sl2_region_release(sl2_region *region) {
+  sl2_region_lock(region);
+
+  region->released = true;
+
+  if (!region->live) {
+    sl2_region_free_chunks(region);
+  }
+
+  sl2_region_unlock(region);
+}
+
+/**
+ * Like sl2_dr_allocator, but for node-based containers (maps, sets, and the client's JSON): their
+ * nodes come out of a region (see sl2_region) instead of DR's global heap. Default-constructed
+ * allocators use the global region, so containers of this type can be declared like any other.
+ * @tparam T - Type to allocate memory for
+ */
+template <typename T> struct sl2_region_allocator {
+  using value_type = T;
+
+  sl2_region *region;
+
+  sl2_region_allocator() : region(sl2_global_region()) {
+  }
+
+  explicit sl2_region_allocator(sl2_region *region) : region(region) {
+  }
+
+  template <typename U>
+  sl2_region_allocator(const sl2_region_allocator<U> &other) : region(other.region) {
+  }
+
+  T *allocate(size_t size) {
+    return static_cast<T *>(sl2_region_alloc(region, size * sizeof(T)));
+  }
+
+  void deallocate(T *ptr, size_t size) {
+    sl2_region_dealloc(region, ptr, size * sizeof(T));
+  }
+};
+
+template <class T, class U>
+bool operator==(const sl2_region_allocator<T> &a, const sl2_region_allocator<U> &b) {
+  return a.region == b.region;
+}
+
+template <class T, class U>
+bool operator!=(const sl2_region_allocator<T> &a, const sl2_region_allocator<U> &b) {
+  return a.region != b.region;
+}
+
 #endif
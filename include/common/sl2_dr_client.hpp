@@ -26,15 +26,26 @@ extern "C" {
 #include "uuid.h"
 }
 
+#include "common/sl2_alloc.hpp"
 #include "common/sl2_dr_allocator.hpp"
+#include "common/sl2_count_table.hpp"
+#include "common/sl2_target_index.hpp"
+#include "common/sl2_event.hpp"
+#include "common/sl2_profile.hpp"
+#include "common/sl2_etw.hpp"
 
 /** Used for iterating over the function-module pair table. */
 #define SL2_FUNCMOD_TABLE_SIZE (sizeof(SL2_FUNCMOD_TABLE) / sizeof(SL2_FUNCMOD_TABLE[0]))
 
+/** The most read hooks (function-module pairs) that `SL2Client::init_module_hooks` indexes. */
+#define SL2_MAX_MODULE_HOOKS 32
+
 /** Used for debugging prints. */
 #define SL2_DR_DEBUG(...) (dr_fprintf(STDERR, __VA_ARGS__))
 
 /**
+ Logs an event as a line of JSON on stderr. Clients only do this for events when they weren't
+ given an event file (see `SL2Client::emit_event`).
  NOTE(ww): This loop is here because dr_fprintf has an internal buffer
  of 2048, and our JSON objects frequently exceed that. When that happens,
  dr_fprintf silently truncates them and confuses the harness with invalid JSON.
@@ -49,6 +60,14 @@ extern "C" {
     dr_fprintf(STDERR, "\n");                                                                      \
   } while (0)
 
+/** The formats an argument hash can be in (see `SL2Client::hash_args`). Each target records the
+ * format that the wizard hashed it with, as `argHashVersion`. */
+#define SL2_ARG_HASH_SHA256 1
+#define SL2_ARG_HASH_FNV1A64 2
+
+/** The number of client_read_info records that each thread keeps on hand for its hooked calls */
+#define SL2_READ_INFO_POOL_SIZE 8
+
 /** Bits of the address that won't get randomized by ASLR */
 #define SUB_ASLR_BITS 0xffff
 
@@ -134,12 +153,65 @@ typedef struct targetFunction {
   string functionName;
   /*! The hash of the arguments of the function */
   string argHash;
+  /*! The format of `argHash` (SL2_ARG_HASH_*) */
+  uint32_t argHashVersion;
   /*! The name of the source file (if available) */
   wstring source;
   /*! The first few bytes of the argument buffer*/
   vector<uint8_t> buffer;
 } TargetFunction;
 
+/** The number of functions in the `Function` enum. */
+#define SL2_NUM_FUNCTIONS ((size_t)Function::MapViewOfFile + 1)
+
+/** The most leading argument buffer bytes that `MATCH_ARG_COMPARE` looks at. */
+#define SL2_TARGET_BUFFER_LEN 16
+
+/**
+ * A selected `targetFunction`, compiled by `loadTargets` into the form that
+ * `is_function_targeted` checks on every hooked call: flat, pre-masked, and allocation-free.
+ */
+struct sl2_target {
+  /*! The target's index in the target file */
+  size_t json_index;
+  /*! Which targeting strategy to use for this target */
+  uint64_t mode;
+  /*! The number of times we've encountered this function during execution */
+  uint64_t index;
+  /*! The return address, already masked with SUB_ASLR_BITS */
+  uint64_t retAddrOffset;
+  /*! The number of times we've encountered this return address during execution */
+  uint64_t retAddrCount;
+  /*! The hex-encoded hash of the arguments of the function */
+  char argHash[SL2_HASH_LEN + 1];
+  /*! The format of `argHash` (SL2_ARG_HASH_*) */
+  uint32_t argHashVersion;
+  /*! The name of the source file (if available) */
+  wstring source;
+  /*! The first few bytes of the argument buffer */
+  uint8_t buffer[SL2_TARGET_BUFFER_LEN];
+  /*! The number of bytes in `buffer` */
+  size_t bufferSize;
+};
+
+typedef std::vector<sl2_target, sl2_dr_allocator<sl2_target>> sl2_target_list;
+typedef std::vector<uint64_t, sl2_dr_allocator<uint64_t>> sl2_retaddr_list;
+
+/**
+ * The selected targets for a single function, in target file order.
+ */
+struct sl2_function_targets {
+  /*! The compiled targets */
+  sl2_target_list targets;
+  /*! The sorted, masked return addresses of the targets, if every one of them can only match at
+   * its own return address; empty otherwise */
+  sl2_retaddr_list retAddrs;
+  /*! Whether every target matches on MATCH_INDEX alone, so that none can match past `maxIndex` */
+  bool indexOnly;
+  /*! The largest MATCH_INDEX among the targets */
+  uint64_t maxIndex;
+};
+
 /**
  * Information for read in fuzzer and tracer clients
  */
@@ -159,10 +231,19 @@ struct client_read_info {
   /*! Pointer to the hex-encoded hash of the arguments */ // TODO(ww): Make this a wchar_t * for
                                                           // consistency.
   char *argHash;
+  /*! The format that `argHash` currently holds, or 0 if it hasn't been computed yet */
+  uint32_t argHashVersion;
+  /*! The arguments to hash, once a target needs `argHash` (see `SL2Client::arg_hash`) */
+  hash_context hashCtx;
+  /*! Storage for `argHash` */
+  char argHashBuf[SL2_HASH_LEN + 1];
   /*! Pointer to the string name of the source file (if applicable) */
   wchar_t *source;
   /*! Number of bytes this function wants to read */
   size_t nNumberOfBytesToRead;
+  /*! Size of the caller's buffer, if this function can report a different number of bytes read
+   * (or 0, if the number of bytes read can't change) */
+  size_t capacity;
 };
 
 /**
@@ -187,22 +268,53 @@ typedef void (*sl2_pre_proto)(void *, void **);
 typedef void (*sl2_post_proto)(void *, void *);
 
 typedef std::map<char *, sl2_pre_proto, std::less<char *>,
-                 sl2_dr_allocator<std::pair<const char *, sl2_pre_proto>>>
+                 sl2_region_allocator<std::pair<const char *, sl2_pre_proto>>>
     sl2_pre_proto_map;
 typedef std::map<char *, sl2_post_proto, std::less<char *>,
-                 sl2_dr_allocator<std::pair<const char *, sl2_post_proto>>>
+                 sl2_region_allocator<std::pair<const char *, sl2_post_proto>>>
     sl2_post_proto_map;
 
-typedef std::map<Function, uint64_t, std::less<Function>,
-                 sl2_dr_allocator<std::pair<Function, uint64_t>>>
-    sl2_call_counts_map;
+/**
+ * A read hook to wrap when its function's expected module loads (see
+ * `SL2Client::init_module_hooks`).
+ */
+struct sl2_module_hook {
+  const char *func;
+  /*! The module's index in `SL2Client::hook_modules` */
+  size_t module;
+  sl2_pre_proto pre_hook;
+  sl2_post_proto post_hook;
+};
+
+/** The number of times we've seen each function, indexed by `Function`. */
+struct sl2_call_counts {
+  uint64_t counts[SL2_NUM_FUNCTIONS];
+};
 
-typedef std::map<uint64_t, uint64_t, std::less<uint64_t>,
-                 sl2_dr_allocator<std::pair<uint64_t, uint64_t>>>
-    sl2_retaddr_counts_map;
+/** The number of times we've seen each return address. */
+typedef sl2_count_table sl2_retaddr_counts;
+
+/** A thread's own call counts, for threads whose reads are targeted on their own (see
+ * `SL2Client::set_thread_counts`). */
+struct sl2_thread_counts {
+  sl2_call_counts call_counts;
+  sl2_retaddr_counts ret_addr_counts;
+};
+
+/**
+ * The normalized path behind a file handle, as reported by GetFinalPathNameByHandle (or empty, if
+ * it couldn't report one).
+ */
+struct sl2_handle_path {
+  wchar_t path[MAX_PATH + 1];
+};
+
+typedef std::map<HANDLE, sl2_handle_path, std::less<HANDLE>,
+                 sl2_region_allocator<std::pair<const HANDLE, sl2_handle_path>>>
+    sl2_handle_path_map;
 
 typedef nlohmann::basic_json<std::map, std::vector, std::string, bool, int64_t, uint64_t, double,
-                             sl2_dr_allocator>
+                             sl2_region_allocator>
     json;
 
 // Declared in sl2_dr_client.cpp; contains pairs of functions and their expected modules.
@@ -219,27 +331,71 @@ public:
   ////////////////////////////////////////////////////////////////////////////////////////////
   // Variables
   // TODO(ww): Subsume sl2_conn under SL2Client.
-  /*! Map holding the number of times we've seen each function */
-  sl2_call_counts_map call_counts;
-  /*! Map holding the number of times we've seen each return address */
-  sl2_retaddr_counts_map ret_addr_counts;
-  /*! JSON object holding targeted functions */
-  json parsedJson;
+  /*! The number of times we've seen each function */
+  sl2_call_counts call_counts;
+  /*! The number of times we've seen each return address */
+  sl2_retaddr_counts ret_addr_counts;
+  /*! The number of targets in the target file, selected or not */
+  size_t target_count;
+  /*! The selected targets in the target file, compiled and indexed by `Function` */
+  sl2_function_targets compiledTargets[SL2_NUM_FUNCTIONS];
   /*! Base address for the main module */
   uint64_t baseAddr;
+  /*! The paths behind the handles that the target has read from, until it closes them */
+  sl2_handle_path_map handle_paths;
+  /*! Guards handle_paths */
+  void *handle_paths_lock;
+  /*! The modules that any read hook is expected in, and how many there are */
+  const char *hook_modules[SL2_MAX_MODULE_HOOKS];
+  size_t hook_module_count;
+  /*! The read hooks to wrap, grouped by module, and how many there are */
+  sl2_module_hook module_hooks[SL2_MAX_MODULE_HOOKS];
+  size_t module_hook_count;
 
   ////////////////////////////////////////////////////////////////////////////////////////////
   // Methods
   // Method targeting methods.
-  void hash_args(char *argHash, hash_context *fStruct);
-  bool is_function_targeted(client_read_info *info);
-  bool compare_filenames(targetFunction &t, client_read_info *info);
-  bool compare_indices(targetFunction &t, Function &function);
-  bool compare_index_at_retaddr(targetFunction &t, client_read_info *info);
-  bool compare_return_addresses(targetFunction &t, client_read_info *info);
-  bool compare_arg_hashes(targetFunction &t, client_read_info *info);
-  bool compare_arg_buffers(targetFunction &t, client_read_info *info);
+  void hash_args(char *argHash, hash_context *fStruct, uint32_t version = SL2_ARG_HASH_SHA256);
+  void defer_hash_args(client_read_info *info, hash_context *hash_ctx);
+  const char *arg_hash(client_read_info *info, uint32_t version);
+  bool is_function_targeted(client_read_info *info, size_t *target_index = NULL);
+  bool can_still_match(Function function);
+  bool compare_filenames(const sl2_target &t, client_read_info *info);
+  bool compare_indices(const sl2_target &t, Function &function);
+  bool compare_index_at_retaddr(const sl2_target &t, client_read_info *info);
+  bool compare_return_addresses(const sl2_target &t, client_read_info *info);
+  bool compare_arg_hashes(const sl2_target &t, client_read_info *info);
+  bool compare_arg_buffers(const sl2_target &t, client_read_info *info);
   bool function_is_in_expected_module(const char *func, const char *mod);
+  void init_module_hooks(sl2_pre_proto_map &pre_hooks, sl2_post_proto_map &post_hooks,
+                         bool targeted_only);
+  size_t hooks_for_module(const char *mod, const sl2_module_hook **hooks);
+
+  // Read info pool methods.
+  void init_read_info_pool();
+  void exit_read_info_pool();
+  client_read_info *alloc_read_info(void *drcontext);
+  void free_read_info(void *drcontext, client_read_info *info);
+
+  // Event stream methods.
+  void init_events(const char *path);
+  void exit_events();
+  void emit_event(sl2_event *ev, bool flush = false);
+  void flush_events();
+
+  // Profiler methods.
+  void init_profile(uint64_t alloc_steady = 0);
+  void exit_profile();
+  const char *probe_to_string(uint32_t probe, char *buf, size_t len);
+
+  // Handle path cache methods.
+  void init_handle_cache();
+  void exit_handle_cache();
+  void get_handle_path(HANDLE handle, wchar_t *path);
+  void forget_handle(HANDLE handle);
+  void wrap_pre_CloseHandle(void *wrapcxt, OUT void **user_data);
+  void wrap_pre_DuplicateHandle(void *wrapcxt, OUT void **user_data);
+  void wrap_post_DuplicateHandle(void *wrapcxt, void *user_data);
 
   // Crash-diversion mitigation methods.
   void wrap_pre_IsProcessorFeaturePresent(void *wrapcxt, OUT void **user_data);
@@ -262,12 +418,26 @@ public:
   void wrap_pre__read(void *wrapcxt, OUT void **user_data);
   void wrap_pre_MapViewOfFile(void *wrapcxt, OUT void **user_data);
   bool is_sane_post_hook(void *wrapcxt, void *user_data, void **drcontext);
-  bool loadTargets(string json);
+  bool loadTargets(string path);
+  bool load_target_index(string path);
+  void compile_targets(const json &targets);
+  void reset_targets();
+  void add_target(Function function, const sl2_target &target);
+  void finish_targets();
+  bool function_has_targets(const char *export_name);
   uint64_t increment_call_count(Function function);
   uint64_t increment_retaddr_count(uint64_t retAddr);
 
+  // Per-thread call count methods.
+  void init_thread_counts();
+  void exit_thread_counts();
+  void set_thread_counts(void *drcontext, sl2_thread_counts *counts);
+  sl2_call_counts &thread_call_counts();
+  sl2_retaddr_counts &thread_ret_addr_counts();
+
   // Utility methods.
   const char *function_to_string(Function function);
+  bool string_to_function(const char *name, Function *function);
   const char *exception_to_string(DWORD exception_code);
 };
 
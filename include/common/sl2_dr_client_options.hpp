@@ -15,4 +15,23 @@ static droption_t<bool> op_registry(DROPTION_SCOPE_CLIENT, "registry", false,
                                     "Enable Registry Tracking",
                                     "Tracking of RegQuery*() functions");
 
+/*! Where to write events for the harness. Without it, events go to stderr as JSON lines. */
+static droption_t<std::string> op_events(DROPTION_SCOPE_CLIENT, "events", "", "event file",
+                                         "Write events to this file, as length-prefixed msgpack, "
+                                         "instead of writing them to stderr as JSON.");
+
+/*! Count the calls to SL2's own hooks and requests, and the cycles they take (see sl2_profile.hpp) */
+static droption_t<bool> op_profile(DROPTION_SCOPE_CLIENT, "profile", false, "Profile the client",
+                                   "Count the calls to the client's hooks, server requests and "
+                                   "instrumentation, and how many cycles they took, and report "
+                                   "them when the client exits.");
+
+/*! Fail on allocations in probes that have warmed up (see sl2_alloc.hpp) */
+static droption_t<unsigned int>
+    op_alloc_steady(DROPTION_SCOPE_CLIENT, "alloc_steady", 0,
+                    "Fail on allocations after <n> calls to a probe",
+                    "Implies -profile. In builds with SL2_ALLOC_STATS, fails an assertion when a "
+                    "profiled hook or request allocates after it has run <n> times on its thread. "
+                    "0 allows every allocation.");
+
 #endif
\ No newline at end of file
@@ -0,0 +1,162 @@
+#ifndef SL2_ETW_HPP
+#define SL2_ETW_HPP
+
+#include <stdint.h>
+
+#include <Windows.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+
+/**
+ * SL2's ETW provider, which the server and the DR clients write TraceLogging events to, so that
+ * they can be lined up against kernel traces (disk I/O, scheduling, file system filters) in WPA.
+ * Each binary defines the provider once, with `SL2_ETW_DEFINE_PROVIDER`, and registers it for as
+ * long as it runs. While nobody is tracing the provider, each event costs a single branch.
+ *
+ * To record, alongside the kernel's disk and file I/O events:
+ *   wpr -start GeneralProfile -start DiskIO -start FileIO
+ *   tracelog -start sl2 -guid #188c35bd-6e90-4e65-ad2d-523545a4e338 -f sl2.etl
+ *   (fuzz)
+ *   tracelog -stop sl2
+ *   wpr -stop kernel.etl
+ * and open both in WPA, or name the provider in a custom WPR profile.
+ */
+
+/*! The provider's name, and its GUID (the same for every binary, so one session catches all) */
+#define SL2_ETW_PROVIDER_NAME "SiennaLocomotive"
+#define SL2_ETW_PROVIDER_GUID                                                                      \
+  (0x188c35bd, 0x6e90, 0x4e65, 0xad, 0x2d, 0x52, 0x35, 0x45, 0xa4, 0xe3, 0x38)
+
+/*! Keywords, so that a session can pick out the server's or the clients' events */
+#define SL2_ETW_KEYWORD_SERVER 0x1
+#define SL2_ETW_KEYWORD_CLIENT 0x2
+#define SL2_ETW_KEYWORD_DISK 0x4
+
+TRACELOGGING_DECLARE_PROVIDER(sl2_etw_provider);
+
+/** Defines the provider. This must appear exactly once in each binary. */
+#define SL2_ETW_DEFINE_PROVIDER()                                                                  \
+  TRACELOGGING_DEFINE_PROVIDER(sl2_etw_provider, SL2_ETW_PROVIDER_NAME, SL2_ETW_PROVIDER_GUID)
+
+/**
+ * Registers the provider. Nothing is written until this is called.
+ */
+static inline void sl2_etw_register() {
+  TraceLoggingRegister(sl2_etw_provider);
+}
+
+/**
+ * Unregisters the provider. Nothing is written after this is called.
+ */
+static inline void sl2_etw_unregister() {
+  TraceLoggingUnregister(sl2_etw_provider);
+}
+
+/**
+ * The server read a request from a client.
+ * @param event the request's event (see server.hpp)
+ * @param bytes how many bytes of the request had been read
+ */
+static inline void sl2_etw_event_received(uint8_t event, uint64_t bytes) {
+  TraceLoggingWrite(sl2_etw_provider, "EventReceived", TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+                    TraceLoggingKeyword(SL2_ETW_KEYWORD_SERVER), TraceLoggingUInt8(event, "Event"),
+                    TraceLoggingUInt64(bytes, "Bytes"));
+}
+
+/**
+ * The server started handling a request. WPA pairs this with the `sl2_etw_handler_stop` on the
+ * same thread, as a region.
+ * @param event the request's event
+ */
+static inline void sl2_etw_handler_start(uint8_t event) {
+  TraceLoggingWrite(sl2_etw_provider, "Handler", TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+                    TraceLoggingKeyword(SL2_ETW_KEYWORD_SERVER),
+                    TraceLoggingOpcode(WINEVENT_OPCODE_START), TraceLoggingUInt8(event, "Event"));
+}
+
+/**
+ * The server finished handling a request.
+ * @param event the request's event, or EVT_INVALID if it ended the session abnormally
+ * @param us how long the request took, in microseconds
+ */
+static inline void sl2_etw_handler_stop(uint8_t event, uint64_t us) {
+  TraceLoggingWrite(sl2_etw_provider, "Handler", TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+                    TraceLoggingKeyword(SL2_ETW_KEYWORD_SERVER),
+                    TraceLoggingOpcode(WINEVENT_OPCODE_STOP), TraceLoggingUInt8(event, "Event"),
+                    TraceLoggingUInt64(us, "Microseconds"));
+}
+
+/**
+ * The server wrote a file.
+ * @param what what was written (e.g. "arena")
+ * @param path the file that was written
+ * @param bytes how many bytes were written
+ * @param us how long the write took (including any rename into place), in microseconds
+ * @param ok whether the write succeeded
+ */
+static inline void sl2_etw_disk_write(const char *what, const wchar_t *path, uint64_t bytes,
+                                      uint64_t us, bool ok) {
+  TraceLoggingWrite(sl2_etw_provider, "DiskWrite", TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+                    TraceLoggingKeyword(SL2_ETW_KEYWORD_SERVER | SL2_ETW_KEYWORD_DISK),
+                    TraceLoggingString(what, "What"), TraceLoggingWideString(path, "Path"),
+                    TraceLoggingUInt64(bytes, "Bytes"), TraceLoggingUInt64(us, "Microseconds"),
+                    TraceLoggingBool(ok, "Ok"));
+}
+
+/**
+ * A client hooked a call that one of its targets matched.
+ * @param function the hooked function's name
+ * @param ret_addr_offset the call's return address, as an offset into its module
+ * @param bytes how many bytes the call read
+ */
+static inline void sl2_etw_targeted_call(const char *function, uint64_t ret_addr_offset,
+                                         uint64_t bytes) {
+  TraceLoggingWrite(sl2_etw_provider, "TargetedCall", TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+                    TraceLoggingKeyword(SL2_ETW_KEYWORD_CLIENT),
+                    TraceLoggingString(function, "Function"),
+                    TraceLoggingUInt64(ret_addr_offset, "RetAddrOffset"),
+                    TraceLoggingUInt64(bytes, "Bytes"));
+}
+
+/**
+ * A client mutated a targeted call's buffer.
+ * @param mut_count the mutation's index in the run
+ * @param mut_type the strategy that made it (see mutation.hpp)
+ * @param bytes the buffer's size after the mutation
+ * @param us how long the mutation took, including registering it with the server
+ */
+static inline void sl2_etw_mutation(uint32_t mut_count, uint32_t mut_type, uint64_t bytes,
+                                    uint64_t us) {
+  TraceLoggingWrite(sl2_etw_provider, "Mutation", TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+                    TraceLoggingKeyword(SL2_ETW_KEYWORD_CLIENT),
+                    TraceLoggingUInt32(mut_count, "MutCount"),
+                    TraceLoggingUInt32(mut_type, "MutType"), TraceLoggingUInt64(bytes, "Bytes"),
+                    TraceLoggingUInt64(us, "Microseconds"));
+}
+
+/**
+ * A client handed its coverage arena to the server.
+ * @param how how it was handed over (e.g. "finalize")
+ * @param bytes the arena's size
+ * @param us how long the server took, in microseconds
+ */
+static inline void sl2_etw_arena_upload(const char *how, uint64_t bytes, uint64_t us) {
+  TraceLoggingWrite(sl2_etw_provider, "ArenaUpload", TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+                    TraceLoggingKeyword(SL2_ETW_KEYWORD_CLIENT), TraceLoggingString(how, "How"),
+                    TraceLoggingUInt64(bytes, "Bytes"), TraceLoggingUInt64(us, "Microseconds"));
+}
+
+/**
+ * A client's target crashed.
+ * @param exception the exception's name
+ * @param module the module that it happened in, or "" if none
+ * @param offset where in the module it happened (or the address, if there's no module)
+ */
+static inline void sl2_etw_crash(const char *exception, const char *module, uint64_t offset) {
+  TraceLoggingWrite(sl2_etw_provider, "Crash", TraceLoggingLevel(WINEVENT_LEVEL_WARNING),
+                    TraceLoggingKeyword(SL2_ETW_KEYWORD_CLIENT),
+                    TraceLoggingString(exception, "Exception"),
+                    TraceLoggingString(module, "Module"), TraceLoggingUInt64(offset, "Offset"));
+}
+
+#endif
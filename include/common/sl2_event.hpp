@@ -0,0 +1,207 @@
+#ifndef SL2_EVENT_HPP
+#define SL2_EVENT_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The events that the clients report to the harness (wizard findings, crashes, coverage, ...).
+ * Each event is a frame: a little-endian uint32_t length, followed by that many bytes of a single
+ * msgpack map. Events are built in place with the functions below, without going through JSON,
+ * and are handed to `SL2Client::emit_event` (see sl2/harness/events.py for the decoder).
+ * Keep the encoding to the subset of msgpack that json::from_msgpack understands, since
+ * clients without an event file fall back to converting each event into a line of JSON on stderr.
+ */
+
+/*! The largest event, frame included. The wizard's biggest events (findings with a 64-byte
+ * buffer sample and a source path) come to well under this. */
+#define SL2_EVENT_MAX_SIZE 2048
+
+/*! An event under construction */
+struct sl2_event {
+  /*! The frame: length, map header, and fields */
+  uint8_t data[SL2_EVENT_MAX_SIZE];
+  /*! The number of bytes of `data` in use */
+  uint32_t size;
+  /*! The number of fields in the map */
+  uint32_t fields;
+  /*! Whether a field didn't fit, in which case the event is dropped */
+  bool overflow;
+};
+
+/**
+ * Appends raw bytes to an event.
+ * @param ev the event
+ * @param bytes the bytes
+ * @param len the number of bytes
+ */
+static inline void sl2_event_put(sl2_event *ev, const void *bytes, size_t len) {
+  if (ev->overflow || len > SL2_EVENT_MAX_SIZE - ev->size) {
+    ev->overflow = true;
+    return;
+  }
+
+  memcpy(ev->data + ev->size, bytes, len);
+  ev->size += (uint32_t)len;
+}
+
+/**
+ * Appends a msgpack type byte, followed by a big-endian value of `width` bytes.
+ * @param ev the event
+ * @param type the type byte
+ * @param value the value
+ * @param width the size of the value, in bytes (0 for none)
+ */
+static inline void sl2_event_put_be(sl2_event *ev, uint8_t type, uint64_t value, size_t width) {
+  uint8_t bytes[9];
+
+  bytes[0] = type;
+  for (size_t i = 0; i < width; i++) {
+    bytes[1 + i] = (uint8_t)(value >> (8 * (width - 1 - i)));
+  }
+
+  sl2_event_put(ev, bytes, 1 + width);
+}
+
+/**
+ * Appends an unsigned integer, in its shortest msgpack form.
+ * @param ev the event
+ * @param value the integer
+ */
+static inline void sl2_event_put_uint(sl2_event *ev, uint64_t value) {
+  if (value < 0x80) {
+    sl2_event_put_be(ev, (uint8_t)value, 0, 0);
+  } else if (value <= 0xff) {
+    sl2_event_put_be(ev, 0xcc, value, 1);
+  } else if (value <= 0xffff) {
+    sl2_event_put_be(ev, 0xcd, value, 2);
+  } else if (value <= 0xffffffff) {
+    sl2_event_put_be(ev, 0xce, value, 4);
+  } else {
+    sl2_event_put_be(ev, 0xcf, value, 8);
+  }
+}
+
+/**
+ * Appends a string.
+ * @param ev the event
+ * @param str the string (UTF-8)
+ * @param len the length of the string, in bytes
+ */
+static inline void sl2_event_put_str(sl2_event *ev, const char *str, size_t len) {
+  if (len < 32) {
+    sl2_event_put_be(ev, (uint8_t)(0xa0 | len), 0, 0);
+  } else if (len <= 0xff) {
+    sl2_event_put_be(ev, 0xd9, len, 1);
+  } else {
+    sl2_event_put_be(ev, 0xda, len, 2);
+  }
+
+  sl2_event_put(ev, str, len);
+}
+
+/**
+ * Starts an event.
+ * @param ev the event
+ * @param type the event's type (its "type" field), or NULL for an untyped event
+ */
+static inline void sl2_event_begin(sl2_event *ev, const char *type) {
+  // The length and the map header (a map32, so that the field count can be patched in later).
+  ev->size = sizeof(uint32_t) + 5;
+  ev->fields = 0;
+  ev->overflow = false;
+
+  if (type) {
+    ev->fields++;
+    sl2_event_put_str(ev, "type", 4);
+    sl2_event_put_str(ev, type, strlen(type));
+  }
+}
+
+/**
+ * Adds an unsigned integer field to an event.
+ * @param ev the event
+ * @param key the field's name
+ * @param value the field's value
+ */
+static inline void sl2_event_uint(sl2_event *ev, const char *key, uint64_t value) {
+  ev->fields++;
+  sl2_event_put_str(ev, key, strlen(key));
+  sl2_event_put_uint(ev, value);
+}
+
+/**
+ * Adds a boolean field to an event.
+ * @param ev the event
+ * @param key the field's name
+ * @param value the field's value
+ */
+static inline void sl2_event_bool(sl2_event *ev, const char *key, bool value) {
+  ev->fields++;
+  sl2_event_put_str(ev, key, strlen(key));
+  sl2_event_put_be(ev, value ? 0xc3 : 0xc2, 0, 0);
+}
+
+/**
+ * Adds a string field to an event. Strings longer than 64KB are cut short.
+ * @param ev the event
+ * @param key the field's name
+ * @param value the field's value (UTF-8)
+ */
+static inline void sl2_event_str(sl2_event *ev, const char *key, const char *value) {
+  size_t len = strlen(value);
+
+  ev->fields++;
+  sl2_event_put_str(ev, key, strlen(key));
+  sl2_event_put_str(ev, value, len > 0xffff ? 0xffff : len);
+}
+
+/**
+ * Adds a byte buffer field to an event, as an array of integers (the way the JSON events carry
+ * buffers). Buffers longer than 64K are cut short.
+ * @param ev the event
+ * @param key the field's name
+ * @param bytes the buffer
+ * @param len the size of the buffer
+ */
+static inline void sl2_event_bytes(sl2_event *ev, const char *key, const uint8_t *bytes,
+                                   size_t len) {
+  len = len > 0xffff ? 0xffff : len;
+
+  ev->fields++;
+  sl2_event_put_str(ev, key, strlen(key));
+
+  if (len < 16) {
+    sl2_event_put_be(ev, (uint8_t)(0x90 | len), 0, 0);
+  } else {
+    sl2_event_put_be(ev, 0xdc, len, 2);
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    sl2_event_put_uint(ev, bytes[i]);
+  }
+}
+
+/**
+ * Finishes an event, filling in its frame.
+ * @param ev the event
+ * @return the size of the frame, or 0 if the event overflowed
+ */
+static inline uint32_t sl2_event_finish(sl2_event *ev) {
+  if (ev->overflow) {
+    return 0;
+  }
+
+  uint32_t len = ev->size - sizeof(uint32_t);
+  memcpy(ev->data, &len, sizeof(len));
+
+  ev->data[4] = 0xdf;
+  ev->data[5] = (uint8_t)(ev->fields >> 24);
+  ev->data[6] = (uint8_t)(ev->fields >> 16);
+  ev->data[7] = (uint8_t)(ev->fields >> 8);
+  ev->data[8] = (uint8_t)ev->fields;
+
+  return ev->size;
+}
+
+#endif
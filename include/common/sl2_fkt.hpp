@@ -0,0 +1,227 @@
+#ifndef SL2_FKT_HPP
+#define SL2_FKT_HPP
+
+#include <Windows.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common/sl2_delta.hpp"
+#include "common/util.h"
+
+/**
+ * Reading replayable mutations (FKT records), shared by the server and the tracer.
+ * An FKT record is the magic ("FKT\0", "FKT2" for a delta-encoded record, or "FKT3" for a
+ * compact one whose buffer is an sl2_fkt_chain), the record's type, the mutation type, the size
+ * of the resource's path, `resource_size` wide characters of path, the position, the size of the
+ * buffer and the buffer itself, optionally followed by a stacked mutation's chain. See
+ * serialize_fkt in server.cpp.
+ * A run's records live either in one FKT file per mutation (FUZZ_RUN_FKT_FMT) or in the run's
+ * journal (FUZZ_RUN_FKT_JOURNAL), where each is preceded by an sl2_fkt_journal_entry.
+ */
+
+/**
+ * The buffer of a compact ("FKT3") record, which the server stores in place of the mutated bytes
+ * of a stacked mutation made from a corpus seed: re-applying the chain to the seed makes the
+ * bytes again (see do_mutation_chain). The seed itself is kept once, in its arena's seed archive,
+ * rather than in every record made from it. Only the server can replay a compact record.
+ */
+struct sl2_fkt_chain {
+  /*! The arena whose seed archive holds the seed */
+  wchar_t arena_id[SL2_HASH_LEN + 1];
+  /*! The seed's place in its arena's corpus (see sl2_corpus_entry) */
+  uint64_t seq;
+  /*! The seed's hash (see sl2_ring_hash), since a pruned corpus may hand a sequence number out
+   * again after the server restarts */
+  uint64_t digest;
+  /*! The size of the seed, as the mutation started from it */
+  uint64_t base_size;
+  /*! The mutation's capacity (see sl2_mutation) */
+  uint64_t capacity;
+  /*! The size of the mutated buffer */
+  uint64_t mutated_size;
+  /*! The chain's seed, length and strategies (see sl2_mutation) */
+  uint64_t chain_seed;
+  uint32_t chain_len;
+  uint32_t chain[SL2_MAX_MUTATION_CHAIN];
+};
+
+/*! Precedes each FKT record in a run's mutation journal */
+struct sl2_fkt_journal_entry {
+  /*! The mutation count that the record was registered under */
+  uint32_t mutate_count;
+  /*! The size of the FKT record that follows, in bytes */
+  uint32_t record_size;
+};
+
+/**
+ * Finds the mutated bytes in a serialized FKT record.
+ * @param record the FKT record
+ * @param record_size the size of the record
+ * @param payload receives a pointer to the record's buffer: the mutated bytes, or (in a v2 record)
+ *                their delta against the original bytes
+ * @param payload_size receives the size of the record's buffer
+ * @param encoding receives SL2_FKT_FULL, SL2_FKT_DELTA or SL2_FKT_CHAIN, saying what the
+ *                 buffer holds
+ * @return true if the record was well formed, false otherwise
+ */
+static inline bool sl2_fkt_parse(const uint8_t *record, size_t record_size, const uint8_t **payload,
+                                 size_t *payload_size, uint8_t *encoding) {
+  size_t path_size = 0;
+  size_t buf_size = 0;
+
+  // Read size of file path from fkt file
+  if (record_size < 0x14) {
+    return false;
+  }
+
+  if (!memcmp(record, "FKT\0", 4)) {
+    *encoding = SL2_FKT_FULL;
+  } else if (!memcmp(record, "FKT2", 4)) {
+    *encoding = SL2_FKT_DELTA;
+  } else if (!memcmp(record, "FKT3", 4)) {
+    *encoding = SL2_FKT_CHAIN;
+  } else {
+    return false;
+  }
+
+  memcpy(&path_size, record + 0xc, sizeof(path_size));
+
+  // Skip over the file path and position
+  size_t buf_offset = 0x14 + path_size * sizeof(wchar_t) + sizeof(size_t);
+
+  if (path_size > MAX_PATH * sizeof(wchar_t) || buf_offset + sizeof(buf_size) > record_size) {
+    return false;
+  }
+
+  // Read Buffer Size
+  memcpy(&buf_size, record + buf_offset, sizeof(buf_size));
+  buf_offset += sizeof(buf_size);
+
+  // Anything after the buffer is a stacked mutation's chain, which replay doesn't need.
+  if (buf_size > record_size - buf_offset) {
+    return false;
+  }
+
+  if (*encoding == SL2_FKT_DELTA && buf_size < sizeof(sl2_delta)) {
+    return false;
+  }
+
+  if (*encoding == SL2_FKT_CHAIN && buf_size != sizeof(sl2_fkt_chain)) {
+    return false;
+  }
+
+  *payload = record + buf_offset;
+  *payload_size = buf_size;
+
+  return true;
+}
+
+/**
+ * Finds the FKT record for the given mutation count in a run's (mapped) mutation journal.
+ * If the mutation count was journaled more than once (e.g. by a persistent fuzzer, which starts
+ * counting from zero on each iteration), the most recent record wins. A truncated entry ends the
+ * journal.
+ * @param journal the journal's contents
+ * @param journal_size the size of the journal
+ * @param mutate_count the mutation count to look up
+ * @param record receives a pointer to the record, within `journal`
+ * @param record_size receives the size of the record
+ * @return whether the journal contained the mutation
+ */
+static inline bool sl2_fkt_journal_find(const uint8_t *journal, size_t journal_size,
+                                        uint32_t mutate_count, const uint8_t **record,
+                                        size_t *record_size) {
+  bool found = false;
+  size_t offset = 0;
+  sl2_fkt_journal_entry entry;
+
+  while (journal_size - offset >= sizeof(entry)) {
+    memcpy(&entry, journal + offset, sizeof(entry));
+    offset += sizeof(entry);
+
+    if (entry.record_size > journal_size - offset) {
+      break;
+    }
+
+    if (entry.mutate_count == mutate_count) {
+      *record = journal + offset;
+      *record_size = entry.record_size;
+      found = true;
+    }
+
+    offset += entry.record_size;
+  }
+
+  return found;
+}
+
+/**
+ * Replays an FKT record's buffer into a buffer holding the original bytes, the same way that
+ * the server does when a client requests a replay: a delta is applied in place, and a whole
+ * mutated buffer replaces the original, zero-padded. Compact records can't be replayed here, since
+ * their seeds are the server's.
+ * @param payload the record's buffer, as found by sl2_fkt_parse
+ * @param payload_size the size of the record's buffer
+ * @param encoding the record's encoding
+ * @param buffer the buffer to replay into
+ * @param bufsize the size of `buffer`
+ * @param replayed receives the length of the mutated buffer (at most `bufsize`)
+ * @return false if the payload was malformed (leaving `buffer` partially replayed) or compact,
+ *         true otherwise
+ */
+static inline bool sl2_fkt_replay(const uint8_t *payload, size_t payload_size, uint8_t encoding,
+                                  uint8_t *buffer, size_t bufsize, size_t *replayed) {
+  if (encoding == SL2_FKT_CHAIN) {
+    return false;
+  }
+
+  if (encoding != SL2_FKT_DELTA) {
+    size_t replay_size = payload_size < bufsize ? payload_size : bufsize;
+
+    // This has always replayed the tail of the mutated buffer.
+    memcpy(buffer, payload + payload_size - replay_size, replay_size);
+    memset(buffer + replay_size, 0, bufsize - replay_size);
+    *replayed = replay_size;
+
+    return true;
+  }
+
+  sl2_delta delta;
+  size_t consumed = sizeof(delta);
+
+  memcpy(&delta, payload, sizeof(delta));
+
+  for (uint32_t i = 0; i < delta.count; i++) {
+    sl2_delta_range range;
+
+    if (payload_size - consumed < sizeof(range)) {
+      return false;
+    }
+
+    memcpy(&range, payload + consumed, sizeof(range));
+    consumed += sizeof(range);
+
+    if (payload_size - consumed < range.length ||
+        (uint64_t)range.offset + range.length > delta.mutated_size) {
+      return false;
+    }
+
+    if (range.offset < bufsize) {
+      size_t inside = bufsize - range.offset;
+      memcpy(buffer + range.offset, payload + consumed,
+             range.length < inside ? range.length : inside);
+    }
+
+    consumed += range.length;
+  }
+
+  if (consumed != payload_size) {
+    return false;
+  }
+
+  *replayed = delta.mutated_size < bufsize ? delta.mutated_size : bufsize;
+
+  return true;
+}
+
+#endif
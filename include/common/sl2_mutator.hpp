@@ -0,0 +1,83 @@
+#ifndef SL2_MUTATOR_HPP
+#define SL2_MUTATOR_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+/**
+ * The interface between the fuzzer and custom mutator plugins.
+ * A plugin is a DLL that exports the three functions below (with C linkage), and is loaded with
+ * the fuzzer's `-mutator` option. It only needs this header to build.
+ * Plugins are loaded into the fuzzer as DynamoRIO auxiliary libraries, so, like the
+ * fuzzer itself, they run inside the target and mustn't call back into the target's own code.
+ */
+
+/*! Bumped whenever the structures or signatures below change incompatibly */
+#define SL2_MUTATOR_ABI_VERSION 1
+
+/*! The names of the exports that each plugin must provide */
+#define SL2_MUTATOR_INIT_EXPORT "sl2_mutator_init"
+#define SL2_MUTATOR_MUTATE_EXPORT "sl2_mutator_mutate"
+#define SL2_MUTATOR_TEARDOWN_EXPORT "sl2_mutator_teardown"
+
+/*! A targeted read that the plugin is asked to mutate */
+struct sl2_mutator_input {
+  /*! The hooked function (see the Function enum in server.hpp) */
+  uint32_t function;
+  /*! Which of the run's targeted reads this is */
+  uint32_t mut_count;
+  /*! The file (or other resource) that was read, if known; NULL otherwise */
+  const wchar_t *resource;
+  /*! The position of the read within the resource */
+  size_t position;
+  /*! The bytes that the target read */
+  const uint8_t *buffer;
+  /*! The number of bytes that the target read */
+  size_t bufsize;
+  /*! The most bytes that a candidate may hold. Equal to `bufsize` unless the target can be
+   * told about a new length */
+  size_t capacity;
+};
+
+/*! A mutated candidate for a targeted read, filled in by the plugin */
+struct sl2_mutator_candidate {
+  /*! Room for `sl2_mutator_input.capacity` bytes, owned by the fuzzer */
+  uint8_t *buffer;
+  /*! The candidate's length. Must be set by the plugin, and be at most the input's capacity */
+  size_t bufsize;
+};
+
+extern "C" {
+/**
+ * Sets up the plugin. Called once, before any targeted read.
+ * @param abi_version the fuzzer's SL2_MUTATOR_ABI_VERSION; plugins should fail on a mismatch
+ * @param seed a seed for the plugin's randomness, derived from the run's seed so that runs
+ *             stay reproducible
+ * @param options the fuzzer's `-mutator_options` string (possibly empty)
+ * @return the plugin's state, passed to every other call, or NULL on failure
+ */
+typedef void *(*sl2_mutator_init_t)(uint32_t abi_version, uint64_t seed, const char *options);
+
+/**
+ * Prepares a batch of mutated candidates for a targeted read. The fuzzer uses them in order,
+ * for as long as it keeps seeing the same read (e.g. over a persistent run's iterations), so
+ * the plugin can keep state across calls and spread a structure-aware walk over a batch.
+ * @param state the plugin's state
+ * @param input the targeted read
+ * @param candidates the candidates to fill in
+ * @param count the number of candidates
+ * @return the number of candidates filled in (from the front); 0 to let the fuzzer's own
+ *         strategies mutate the read instead
+ */
+typedef uint32_t (*sl2_mutator_mutate_t)(void *state, const sl2_mutator_input *input,
+                                         sl2_mutator_candidate *candidates, uint32_t count);
+
+/**
+ * Tears the plugin down. Called once, as the fuzzer exits.
+ * @param state the plugin's state
+ */
+typedef void (*sl2_mutator_teardown_t)(void *state);
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef SL2_PROFILE_HPP
+#define SL2_PROFILE_HPP
+
+#include <intrin.h>
+#include <stdint.h>
+
+/**
+ * The clients' built-in profiler (-profile). Each probe counts how many times a piece of SL2's own
+ * code ran, and how many TSC cycles it took, per thread; the totals are reported to the harness
+ * as "profile" events when the client exits (see `SL2Client::exit_profile`). Cycles are
+ * inclusive: a post-hook's count includes the `is_function_targeted` and `mutate` calls that it
+ * makes. Without -profile, each probe costs a single branch.
+ *
+ * In builds with SL2_ALLOC_STATS (see sl2_alloc.hpp), each probe also counts the allocations made
+ * while it was the thread's innermost probe, and how many bytes they asked for. Allocations made
+ * outside of every probe are counted under SL2_PROBE_OTHER.
+ */
+
+/*! The number of read hooks that are profiled, indexed by `Function`. This must match
+ * SL2_NUM_FUNCTIONS in sl2_dr_client.hpp. */
+#define SL2_PROFILE_READ_HOOKS 11
+
+/*! The number of server events that requests are timed for, indexed by event (see server.hpp) */
+#define SL2_PROFILE_CONN_EVENTS 32
+
+/** The probes. The read hooks and server requests each get a range, indexed by `Function` and by
+ * event respectively. */
+enum sl2_probe : uint32_t {
+  /*! `wrap_pre_<function>`, for each `Function` */
+  SL2_PROBE_PRE_HOOK,
+  SL2_PROBE_POST_GENERIC = SL2_PROBE_PRE_HOOK + SL2_PROFILE_READ_HOOKS,
+  SL2_PROBE_POST_MAPVIEWOFFILE,
+  SL2_PROBE_PRE_CLOSEHANDLE,
+  SL2_PROBE_PRE_DUPLICATEHANDLE,
+  SL2_PROBE_POST_DUPLICATEHANDLE,
+  SL2_PROBE_PRE_ISPROCESSORFEATUREPRESENT,
+  SL2_PROBE_POST_ISPROCESSORFEATUREPRESENT,
+  SL2_PROBE_PRE_UNHANDLEDEXCEPTIONFILTER,
+  SL2_PROBE_PRE_VERIFIERSTOPMESSAGE,
+  SL2_PROBE_IS_FUNCTION_TARGETED,
+  SL2_PROBE_HASH_ARGS,
+  SL2_PROBE_MUTATE,
+  SL2_PROBE_BB_INSTRUMENT,
+  /*! Each `sl2_conn_*` request's round-trip, by the event it sent */
+  SL2_PROBE_CONN,
+  SL2_NUM_PROBES = SL2_PROBE_CONN + SL2_PROFILE_CONN_EVENTS,
+  /*! Allocations made outside of every probe. Only allocations are counted under it */
+  SL2_PROBE_OTHER = SL2_NUM_PROBES,
+};
+
+struct sl2_profile_scope;
+
+/** A single thread's counts for every probe. */
+struct sl2_profile_counters {
+  uint64_t calls[SL2_NUM_PROBES];
+  uint64_t cycles[SL2_NUM_PROBES];
+  /*! Allocations, and the bytes they asked for, by probe (SL2_ALLOC_STATS only) */
+  uint64_t allocs[SL2_NUM_PROBES + 1];
+  uint64_t alloc_bytes[SL2_NUM_PROBES + 1];
+  /*! The thread's innermost probe, or NULL if it's outside of every probe (SL2_ALLOC_STATS only) */
+  sl2_profile_scope *scope;
+  /*! The next thread's counts (see `sl2_profile_thread`) */
+  sl2_profile_counters *next;
+};
+
+/**
+ * @return the current thread's counts, or NULL if the profiler is off
+ */
+sl2_profile_counters *sl2_profile_thread();
+
+/**
+ * Counts a server request for the current thread. This is an `sl2_conn_profile_hook`.
+ * @param event the request's event
+ * @param cycles how long it took
+ */
+void sl2_profile_request(uint8_t event, uint64_t cycles);
+
+/**
+ * Counts a call to a probe, and the cycles until it goes out of scope, for the thread that it
+ * was made on. Probes that are only known partway through (e.g. a post-hook's function) can be
+ * changed with `probe` until then.
+ */
+struct sl2_profile_scope {
+  sl2_profile_counters *counters;
+  uint32_t probe;
+  uint64_t start;
+#ifdef SL2_ALLOC_STATS
+  sl2_profile_scope *outer;
+#endif
+
+  sl2_profile_scope(uint32_t probe) : counters(sl2_profile_thread()), probe(probe), start(0) {
+    if (counters) {
+#ifdef SL2_ALLOC_STATS
+      outer = counters->scope;
+      counters->scope = this;
+#endif
+      start = __rdtsc();
+    }
+  }
+
+  ~sl2_profile_scope() {
+    if (counters) {
+      counters->calls[probe]++;
+      counters->cycles[probe] += __rdtsc() - start;
+#ifdef SL2_ALLOC_STATS
+      counters->scope = outer;
+#endif
+    }
+  }
+};
+
+/** Profiles the rest of the enclosing scope as `probe`. */
+#define SL2_PROFILE(probe) sl2_profile_scope sl2_profile_scope_(probe)
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef SL2_RING_HPP
+#define SL2_RING_HPP
+
+#include <Windows.h>
+#include <stdint.h>
+#include <string.h>
+
+/*! The number of slots in each mutation ring. */
+#define SL2_RING_SLOTS 32
+
+/*! The largest targeted read that the server will pre-generate mutations for, in bytes. */
+#define SL2_RING_MAX_BUFSIZE 65536
+
+/**
+ * The header of a single slot in a mutation ring. It's followed by the ring's `bufsize` bytes
+ * of mutated data.
+ * A slot's `seq` says who may touch it next. The server may fill slot `i` for position
+ * `p` (`p % SL2_RING_SLOTS == i`) once `seq == p`, and publishes it by setting `seq = p + 1`.
+ * A fuzzer that claims position `p` hands the slot back by setting `seq = p + SL2_RING_SLOTS`.
+ */
+struct sl2_ring_slot {
+  volatile LONG64 seq;
+  /*! which strategy the server used */
+  uint32_t mut_type;
+  uint32_t reserved;
+};
+
+/**
+ * A ring of mutations that the server pre-generates for a single targeted read of an arena,
+ * shared with every fuzzer that performs that read through a named file mapping.
+ * The server is the ring's only producer; fuzzers claim slots with `sl2_ring_pop`.
+ */
+struct sl2_mutation_ring {
+  /*! The server's ID for the ring, sent back when registering a mutation popped from it */
+  uint32_t id;
+  /*! The size of the unmutated read, and of every mutation in the ring */
+  uint32_t bufsize;
+  /*! The next position the server will fill */
+  volatile LONG64 head;
+  /*! The next position a fuzzer will claim */
+  volatile LONG64 tail;
+};
+
+/**
+ * @param bufsize the size of each mutation in the ring
+ * @return the size of a single slot (header and data), in bytes
+ */
+static inline size_t sl2_ring_slot_size(size_t bufsize) {
+  return (sizeof(sl2_ring_slot) + bufsize + 7) & ~(size_t)7;
+}
+
+/**
+ * @param bufsize the size of each mutation in the ring
+ * @return the size of a whole ring (header and slots), in bytes
+ */
+static inline size_t sl2_ring_size(size_t bufsize) {
+  return sizeof(sl2_mutation_ring) + (SL2_RING_SLOTS * sl2_ring_slot_size(bufsize));
+}
+
+/**
+ * @param ring the ring
+ * @param pos a position in the ring
+ * @return the slot that holds the given position
+ */
+static inline sl2_ring_slot *sl2_ring_slot_at(sl2_mutation_ring *ring, LONG64 pos) {
+  uint8_t *slots = (uint8_t *)(ring + 1);
+  return (sl2_ring_slot *)(slots + ((pos % SL2_RING_SLOTS) * sl2_ring_slot_size(ring->bufsize)));
+}
+
+/**
+ * Hashes a targeted read (FNV-1a), so that fuzzers can find the ring generated from it without
+ * sending the read itself.
+ * @param buf the unmutated read
+ * @param size the size of the read
+ * @return the hash
+ */
+static inline uint64_t sl2_ring_hash(const uint8_t *buf, size_t size) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ buf[i]) * 0x100000001B3ULL;
+  }
+
+  return hash;
+}
+
+/**
+ * Claims the oldest mutation in the ring and copies it out.
+ * @param ring the ring
+ * @param buf where to copy the mutation to
+ * @param bufsize the size of `buf`, which must be the ring's `bufsize`
+ * @param mut_type receives the strategy that the server used
+ * @param seq receives the mutation's position, for registering it with the server
+ * @return true if a mutation was claimed, false if the ring was empty or is for another size
+ */
+static inline bool sl2_ring_pop(sl2_mutation_ring *ring, uint8_t *buf, size_t bufsize,
+                                uint32_t *mut_type, uint64_t *seq) {
+  LONG64 pos = ring->tail;
+  sl2_ring_slot *slot;
+
+  if (ring->bufsize != bufsize) {
+    return false;
+  }
+
+  while (1) {
+    slot = sl2_ring_slot_at(ring, pos);
+    LONG64 slot_seq = slot->seq;
+
+    if (slot_seq == pos + 1) {
+      if (InterlockedCompareExchange64(&ring->tail, pos + 1, pos) == pos) {
+        break;
+      }
+    } else if (slot_seq < pos + 1) {
+      // The server hasn't filled this position yet.
+      return false;
+    }
+
+    pos = ring->tail;
+  }
+
+  memcpy(buf, slot + 1, ring->bufsize);
+  *mut_type = slot->mut_type;
+  *seq = (uint64_t)pos;
+
+  MemoryBarrier();
+  slot->seq = pos + SL2_RING_SLOTS;
+
+  return true;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef SL2_RNG_HPP
+#define SL2_RNG_HPP
+
+#include <intrin.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * A small, fast, seedable PRNG (xoshiro256**) for the mutation engine.
+ * Unlike dr_get_random_value, this isn't shared or locked: each thread that mutates
+ * should own its own sl2_rng. Given the same seed, it produces the same stream on every machine,
+ * which is what makes a fuzzing run reproducible from its seed.
+ */
+struct sl2_rng {
+  uint64_t s[4];
+};
+
+/**
+ * One step of splitmix64, used to expand seeds into xoshiro256** state.
+ * @param x the splitmix64 state, advanced in place
+ * @return the next splitmix64 output
+ */
+static inline uint64_t sl2_rng_splitmix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/**
+ * Seeds the given sl2_rng from a 64-bit seed.
+ * @param rng the sl2_rng to seed
+ * @param seed the seed
+ */
+static inline void sl2_rng_seed(sl2_rng *rng, uint64_t seed) {
+  for (int i = 0; i < 4; i++) {
+    rng->s[i] = sl2_rng_splitmix64(&seed);
+  }
+}
+
+/**
+ * Seeds the given sl2_rng from a (NUL-terminated) seed string, like the decimal seeds the harness
+ * generates. Every character of the string contributes to the state.
+ * @param rng the sl2_rng to seed
+ * @param seed the seed string
+ * @param stream a stream number (e.g., a thread ordinal) mixed into the seed, so that several
+ *               generators derived from the same seed don't produce the same values
+ */
+static inline void sl2_rng_seed_string(sl2_rng *rng, const char *seed, uint64_t stream) {
+  uint64_t h = stream;
+
+  for (const char *c = seed; *c; c++) {
+    uint64_t x = h ^ (uint8_t)*c;
+    h = sl2_rng_splitmix64(&x);
+  }
+
+  sl2_rng_seed(rng, h);
+}
+
+static inline uint64_t sl2_rng_rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * @param rng the sl2_rng to draw from
+ * @return the next 64 random bits
+ */
+static inline uint64_t sl2_rng_next(sl2_rng *rng) {
+  uint64_t *s = rng->s;
+  uint64_t result = sl2_rng_rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = sl2_rng_rotl(s[3], 45);
+
+  return result;
+}
+
+/**
+ * Returns a random value in [0, bound), or 0 if bound is 0.
+ * This is Lemire's multiply-shift reduction without the rejection step; the bias is
+ * at most bound / 2^64, which is nothing for the sizes we mutate.
+ * @param rng the sl2_rng to draw from
+ * @param bound the exclusive upper bound
+ * @return the random value
+ */
+static inline uint64_t sl2_rng_below(sl2_rng *rng, uint64_t bound) {
+  uint64_t high;
+  _umul128(sl2_rng_next(rng), bound, &high);
+  return high;
+}
+
+/**
+ * Fills the given buffer with random bytes, eight at a time.
+ * @param rng the sl2_rng to draw from
+ * @param buf the buffer to fill
+ * @param size the number of bytes to fill
+ */
+static inline void sl2_rng_fill(sl2_rng *rng, uint8_t *buf, size_t size) {
+  while (size >= sizeof(uint64_t)) {
+    uint64_t r = sl2_rng_next(rng);
+    memcpy(buf, &r, sizeof(r));
+    buf += sizeof(r);
+    size -= sizeof(r);
+  }
+
+  if (size) {
+    uint64_t r = sl2_rng_next(rng);
+    memcpy(buf, &r, size);
+  }
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "common/util.h"
 #include "common/mutation.hpp"
+#include "common/sl2_ring.hpp"
+#include "common/sl2_delta.hpp"
 #include "server.hpp"
 #include <Rpc.h>
 
@@ -39,6 +41,30 @@ enum class SL2Response {
   BadValue,
 };
 
+/**
+ * Represents the advice given to a fuzzer by the server, for coverage
+ * guided fuzzing.
+ */
+struct sl2_mutation_advice {
+  sl2_strategy_t strategy;
+  uint32_t table_idx;
+};
+
+/**
+ * Told how long each request on a connection took, from being built to its last reply, in TSC
+ * cycles (see `sl2_conn_set_profile_hook`).
+ * @param event the request's event
+ * @param cycles how long it took
+ */
+typedef void (*sl2_conn_profile_hook)(uint8_t event, uint64_t cycles);
+
+/*! The number of targeted reads per run that a connection can map mutation rings for. */
+#define SL2_CONN_MAX_RINGS 8
+
+/*! The size of a connection's request buffer, which matches the server's default pipe buffers.
+ * Bigger requests are split across several frames. */
+#define SL2_CONN_FRAME_SIZE SL2_PIPE_BUFFER_SIZE
+
 /**
  * A structure representing an active connection between a
  * DynamoRIO client and the SL2 server.
@@ -50,19 +76,53 @@ struct sl2_conn {
   UUID run_id;
   /*! Whether we've been given a run ID */
   bool has_run_id;
+  /*! The coverage arena shared with the server (if any), which points to `shared_arena` */
+  sl2_arena *mapped_arena;
+  /*! The shared arena's ID and size, and its map (a view of the server's section) */
+  sl2_arena shared_arena;
+  /*! Whether the server has already ended our session (via EVT_FINALIZE_RUN) */
+  bool finalized;
+  /*! The mutation advice the server gave us with our arena, reused until we register it */
+  sl2_mutation_advice advice;
+  /*! Whether `advice` (and `target_advice`) is current */
+  bool has_advice;
+  /*! The advice the server gave us for each targeted call that it keeps a schedule for */
+  sl2_target_advice target_advice[SL2_MAX_TARGETS];
+  /*! How many entries of `target_advice` are current */
+  uint32_t target_advice_count;
+  /*! The mutation rings shared with the server (if any), indexed by mutation count */
+  sl2_mutation_ring *mapped_rings[SL2_CONN_MAX_RINGS];
+  /*! The size of the read that each of `mapped_rings` was generated from */
+  size_t mapped_ring_sizes[SL2_CONN_MAX_RINGS];
+  /*! The hash (see `sl2_ring_hash`) of the read that each of `mapped_rings` was generated from */
+  uint64_t mapped_ring_hashes[SL2_CONN_MAX_RINGS];
+  /*! The section shared with the server that large mutations are uploaded through (if any) */
+  uint8_t *upload;
+  /*! The size of `upload` */
+  size_t upload_size;
+  /*! Whether the server refused us an upload section, so that we don't keep asking for one */
+  bool upload_refused;
+  /*! Whether a request is being built into `frame`, i.e. it hasn't been sent yet */
+  bool framing;
+  /*! The request being built: a `sl2_frame_header`, followed by `frame_len` bytes of payload */
+  uint8_t frame[SL2_CONN_FRAME_SIZE];
+  /*! How much of the request's payload is in `frame` */
+  uint32_t frame_len;
+  /*! The flags sent on every frame of the request being built (e.g. SL2_FRAME_NO_REPLY) */
+  uint8_t frame_flags;
+  /*! Whether mutations are registered without waiting for the server (see `sl2_conn_set_async`) */
+  bool async;
+  /*! Whether the server has bound our session to `run_id`, so that requests don't resend it */
+  bool session_bound;
+  /*! Told how long each request took, or NULL (see `sl2_conn_set_profile_hook`) */
+  sl2_conn_profile_hook profile_hook;
+  /*! The event of the request being timed for `profile_hook` (EVT_INVALID if none was sent) */
+  uint8_t profile_event;
 };
 
 /**
- * Represents the advice given to a fuzzer by the server, for coverage
- * guided fuzzing.
- */
-struct sl2_mutation_advice {
-  sl2_strategy_t strategy;
-  uint32_t table_idx;
-};
-
-/**
- *  Opens a new connection to the SL2 server.
+ *  Opens a new connection to the SL2 server: the default instance, or the one that the
+ *  FUZZ_SERVER_INSTANCE_ENV environment variable names.
  *  This function should be used in conjunction with either `sl2_conn_request_run_id`
  *  *or* `sl2_conn_assign_run_id`, depending on the client's needs.
  * @param conn sl2_conn struct containing a pipe to the server
@@ -88,7 +148,32 @@ SL2_EXPORT
 SL2Response sl2_conn_close(sl2_conn *conn);
 
 /**
- * Associates this connection with an extant run ID.
+ *  Sets whether mutations are registered asynchronously: the registration is sent to the server
+ *  in a single write, and the call returns without waiting for the server's status. The server
+ *  handles the connection's requests in order, so later requests (replays, crash dumps, the run's
+ *  finalization) still see the mutation. Errors that the server runs into while registering it are
+ *  only logged by the server. Off by default.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param async whether to register mutations asynchronously
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_set_async(sl2_conn *conn, bool async);
+
+/**
+ *  Sets a hook that's told how long each of the connection's requests took, from when it started
+ *  being built until its last reply was read (or it was sent, for requests without replies).
+ *  Nothing is timed without one, which is the default.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param hook the hook, or NULL to stop timing requests
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_set_profile_hook(sl2_conn *conn, sl2_conn_profile_hook hook);
+
+/**
+ * Associates this connection with an extant run ID, and binds the connection's session on the
+ * server to it (EVT_SESSION_BEGIN), so that later requests don't have to send it.
  * @param conn sl2_conn struct containing a pipe to the server
  * @param run_id
  * @return SL2Response code
@@ -97,25 +182,35 @@ SL2_EXPORT
 SL2Response sl2_conn_assign_run_id(sl2_conn *conn, UUID run_id);
 
 /**
- *  Registers a mutation with the SL2 server.
+ *  Registers a mutation with the SL2 server. On synchronous connections, a whole mutated buffer of
+ *  at least SL2_UPLOAD_MIN_BUFSIZE bytes is copied into the connection's upload section (see
+ *  `sl2_conn_map_upload`) instead of being sent through the pipe.
  * @param conn sl2_conn struct containing a pipe to the server
  * @param mutation - a pointer to a `sl2_mutation` containing the mutation's state.
+ * @param delta - the mutation's delta against the original buffer (see `sl2_delta_encode`),
+ * sent instead of the whole mutated buffer. May be NULL.
+ * @param delta_size - the size of `delta`
  * @return SL2Response code
  */
 SL2_EXPORT
-SL2Response sl2_conn_register_mutation(sl2_conn *conn, sl2_mutation *mutation);
+SL2Response sl2_conn_register_mutation(sl2_conn *conn, sl2_mutation *mutation,
+                                       const uint8_t *delta = NULL, size_t delta_size = 0);
 
 /**
  *  Requests a replay (of a previously mutated buffer) from the SL2 server.
  * @param conn sl2_conn struct containing a pipe to the server
  * @param mut_count - the Nth mutation requested.
  * @param bufsize - the size of the mutable buffer, in bytes.
- * @param buffer - the mutable buffer. This function writes to `buffer`.
+ * @param buffer - the mutable buffer. This function writes to `buffer`. If the mutation was
+ * registered as a delta, `buffer` must hold the original bytes, and only the changed ones are
+ * overwritten.
+ * @param replayed - receives the length of the mutated buffer, which may differ from `bufsize`
+ * if a strategy changed it. May be NULL.
  * @return SL2Response code
  */
 SL2_EXPORT
 SL2Response sl2_conn_request_replay(sl2_conn *conn, uint32_t mut_count, size_t bufsize,
-                                    void *buffer);
+                                    void *buffer, size_t *replayed = NULL);
 
 /**
  *  Requests information about a run's crash from the SL2 server.
@@ -129,16 +224,96 @@ SL2_EXPORT
 SL2Response sl2_conn_request_crash_paths(sl2_conn *conn, uint64_t pid, sl2_crash_paths *paths);
 
 /**
- * Requests a coverage arena from the SL2 server.
+ * Asks the SL2 server to snapshot this (crashing) process and write its initial minidump
+ * out-of-process. Returns once the snapshot has been taken; the dump is written in the background.
+ * Clients should write the dump themselves if this fails.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param pid - the pid of the crashing process
+ * @param thread_id - the ID of the crashing thread
+ * @param exception_pointers - the crash's exception record and (application) context
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_request_crash_dump(sl2_conn *conn, uint64_t pid, uint32_t thread_id,
+                                        EXCEPTION_POINTERS *exception_pointers);
+
+/**
+ * Requests a coverage arena from the SL2 server. The server replies with the size of the arena's
+ * map and its current mutation advice, which the connection caches for `sl2_conn_advise_mutation`.
  * @param conn sl2_conn struct containing a pipe to the server
- * @param arena - a pointer to an allocated (but potentially uninitialized) `sl2_arena`.
+ * @param arena - a pointer to an `sl2_arena` with its ID filled in. Its `size` is the map size to
+ *                ask for, and is replaced by the arena's actual size; the caller allocates its map
+ *                afterwards.
  * @return SL2Response code
  */
 SL2_EXPORT
 SL2Response sl2_conn_request_arena(sl2_conn *conn, sl2_arena *arena);
 
+/**
+ * Requests a coverage arena from the SL2 server, shared with the server through a named
+ * file mapping. The mapped arena is owned by the connection and is unmapped by `sl2_conn_close`.
+ * Clients should fall back to `sl2_conn_request_arena` if this fails.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param arena_id - the ID of the arena to map.
+ * @param pid - the pid of the requesting process.
+ * @param size - the map size to ask for, if the server creates the arena (see
+ *               SL2_ARENA_SIZE_VALID). The mapped arena's `size` is its actual size.
+ * @param arena - a pointer that the mapped arena is placed in.
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_map_arena(sl2_conn *conn, wchar_t *arena_id, uint64_t pid, uint32_t size,
+                               sl2_arena **arena);
+
+/**
+ * Requests the ring of mutations that the SL2 server pre-generates for a targeted read,
+ * shared with the server through a named file mapping. The read is identified by its arena,
+ * its mutation count, and its (unmutated) contents; the contents are only sent if the server
+ * hasn't seen the read before. The mapped ring is owned by the connection and is unmapped by
+ * `sl2_conn_close`. A ring that's already mapped for the mutation count is only reused for a read
+ * of the same size and contents; persistent and snapshot iterations restart their mutation
+ * counts, so a later read with the same count gets its own ring instead.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param arena_id - the ID of the arena that the read belongs to.
+ * @param mutation - the targeted read, before it has been mutated.
+ * @param ring - a pointer that the mapped ring is placed in.
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_map_ring(sl2_conn *conn, wchar_t *arena_id, sl2_mutation *mutation,
+                              sl2_mutation_ring **ring);
+
+/**
+ * Registers a mutation popped from a ring with the SL2 server. Only the mutation's position in
+ * the ring is sent, since the server already has its bytes.
+ * Clients should fall back to `sl2_conn_register_mutation` if this fails, so this always waits
+ * for the server's status, even on asynchronous connections.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param mutation - the mutation's state. Its buffer isn't sent.
+ * @param ring - the ring that the mutation was popped from.
+ * @param seq - the mutation's position in the ring, as returned by `sl2_ring_pop`.
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_register_ring_mutation(sl2_conn *conn, sl2_mutation *mutation,
+                                            sl2_mutation_ring *ring, uint64_t seq);
+
+/**
+ * Requests a section from the SL2 server that large mutations are uploaded through, shared with
+ * the server through a named file mapping. Replaces the connection's old upload section, if any.
+ * `sl2_conn_register_mutation` calls this itself when a mutation doesn't fit, so clients don't
+ * usually need to. The mapped section is owned by the connection and is unmapped by
+ * `sl2_conn_close`.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param size - the size of the section (at most SL2_UPLOAD_MAX_SIZE).
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_map_upload(sl2_conn *conn, size_t size);
+
 /**
  * Registers a coverage arena with the SL2 server.
+ * If `arena` is the connection's mapped arena, only its ID is sent over the pipe.
  * @param conn sl2_conn struct containing a pipe to the server
  * @param arena - a pointer to an allocated `sl2_arena`.
  * @return SL2Response code
@@ -168,14 +343,65 @@ SL2Response sl2_conn_register_pid(sl2_conn *conn, uint64_t pid, bool tracing);
 
 /**
  * Requests advice about mutation strategies from the server, based on previous
- * code coverage statistics.
+ * code coverage statistics. The server only changes its advice when an arena is registered,
+ * so this reuses the advice cached by `sl2_conn_request_arena` or `sl2_conn_map_arena`
+ * until the next `sl2_conn_register_arena`.
+ * The advice is the targeted call's own, if the server has learned any for it yet, and the
+ * arena's otherwise.
  * @param conn sl2_conn struct containing a pipe to the server
  * @param arena
+ * @param mutation the targeted call to be mutated, or NULL for the arena's advice
  * @param advice
  * @return SL2Response code
  */
 SL2_EXPORT
-SL2Response sl2_conn_advise_mutation(sl2_conn *conn, sl2_arena *arena, sl2_mutation_advice *advice);
+SL2Response sl2_conn_advise_mutation(sl2_conn *conn, sl2_arena *arena,
+                                     const sl2_mutation *mutation, sl2_mutation_advice *advice);
+
+/**
+ * Requests the next deterministic mutation for an arena from the server. Each call claims a
+ * different mutation, so concurrent fuzzers on the same arena walk the stages together.
+ * This also refreshes the advice cached for `sl2_conn_advise_mutation`.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param arena
+ * @param bufsize the size of the buffer being walked
+ * @param cursor receives the mutation's stage and offset; the stage is SL2_DET_DONE once every
+ *               stage has been walked
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_advise_deterministic(sl2_conn *conn, sl2_arena *arena, size_t bufsize,
+                                          sl2_det_cursor *cursor);
+
+/**
+ * Requests a donor for a splice mutation: one of the inputs that the server has seen increase
+ * the arena's coverage at the given targeted read.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param arena
+ * @param mut_count the targeted read that the donor should come from
+ * @param buf receives the donor
+ * @param capacity the size of `buf`; longer donors are truncated
+ * @param size receives the donor's size, or 0 if the arena's corpus has no donor for the read
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_request_donor(sl2_conn *conn, sl2_arena *arena, uint32_t mut_count,
+                                   uint8_t *buf, size_t capacity, size_t *size);
+
+/**
+ * Requests a seed to mutate from: one of the inputs that the server has seen increase the
+ * arena's coverage at the given targeted read, favoring recent, small and fast ones.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param arena
+ * @param mut_count the targeted read that the seed should come from
+ * @param buf receives the seed
+ * @param capacity the size of `buf`; longer seeds are truncated
+ * @param size receives the seed's size, or 0 if the arena's corpus has no seed for the read
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_request_seed(sl2_conn *conn, sl2_arena *arena, uint32_t mut_count,
+                                  uint8_t *buf, size_t capacity, size_t *size);
 
 /**
  * Requests information about code coverage so far
@@ -187,4 +413,31 @@ SL2Response sl2_conn_advise_mutation(sl2_conn *conn, sl2_arena *arena, sl2_mutat
 SL2_EXPORT
 SL2Response sl2_conn_get_coverage(sl2_conn *conn, sl2_arena *arena, sl2_coverage_info *cov);
 
+/**
+ * Finalizes a run with the server in one round trip: registers the coverage arena,
+ * reports the run's pid and crash state, and requests the resulting coverage info.
+ * Only the arena's fingerprint is sent at first; the arena itself is only sent (or, if it's
+ * mapped, merged) when the server doesn't already know the run's path (see EVT_FINALIZE_PATH).
+ * The server ends the session afterwards, so `conn` can only be closed after this.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param arena the run's coverage arena
+ * @param pid the fuzzed process's ID
+ * @param crashed whether the run crashed
+ * @param distance the run's distance from its directed targets, or SL2_DISTANCE_NONE
+ * @param cov where to put the coverage info
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_finalize_run(sl2_conn *conn, sl2_arena *arena, uint64_t pid, bool crashed,
+                                  uint32_t distance, sl2_coverage_info *cov);
+
+/**
+ * Requests the server's per-event statistics.
+ * @param conn sl2_conn struct containing a pipe to the server
+ * @param stats where to put the statistics
+ * @return SL2Response code
+ */
+SL2_EXPORT
+SL2Response sl2_conn_request_stats(sl2_conn *conn, sl2_server_stats *stats);
+
 #endif
@@ -0,0 +1,126 @@
+#ifndef SL2_SIMD_HPP
+#define SL2_SIMD_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+/**
+ * Runtime dispatch for vectorized kernels. Kernels are written once per instruction set
+ * (scalar, SSE2, AVX2) and the fastest one that the host supports is picked once, at
+ * startup, so that a single binary runs on every CPU generation in the fleet without executing
+ * an instruction that the host doesn't have. The scalar kernels are the reference: every
+ * vector kernel must give bit-for-bit the same results, which can be checked on any host by
+ * capping the level (see sl2_simd_cap), and is checked for every kernel by bench/simd_test.
+ * AVX2 kernels must only ever be called through a dispatch on sl2_simd_current, since
+ * MSVC doesn't stop us from compiling them into a binary that runs on older CPUs.
+ */
+
+/** The instruction sets that kernels are written for, slowest first. */
+enum sl2_simd_level {
+  SL2_SIMD_SCALAR,
+  SL2_SIMD_SSE2,
+  SL2_SIMD_AVX2,
+};
+
+/**
+ * @param level an instruction set
+ * @return the instruction set's name, as sl2_simd_cap takes it
+ */
+static inline const char *sl2_simd_level_name(sl2_simd_level level) {
+  switch (level) {
+  case SL2_SIMD_SSE2:
+    return "sse2";
+  case SL2_SIMD_AVX2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+/**
+ * Asks the CPU (and, for AVX2, the OS) which instruction sets it supports.
+ * @return the fastest instruction set that kernels can use on this host
+ */
+static inline sl2_simd_level sl2_simd_detect() {
+#if defined(_M_X64) || defined(_M_IX86)
+  int info[4] = {0};
+
+  __cpuid(info, 0);
+  int max_leaf = info[0];
+
+  __cpuid(info, 1);
+  // Every x64 CPU has SSE2, but 32-bit builds have to check for it.
+  if ((info[3] & (1 << 26)) == 0) {
+    return SL2_SIMD_SCALAR;
+  }
+
+  // The CPU needs AVX and OSXSAVE, and the OS needs to be saving the YMM registers.
+  if (max_leaf < 7 || (info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 ||
+      (_xgetbv(0) & 0x6) != 0x6) {
+    return SL2_SIMD_SSE2;
+  }
+
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) ? SL2_SIMD_AVX2 : SL2_SIMD_SSE2;
+#else
+  return SL2_SIMD_SCALAR;
+#endif
+}
+
+/**
+ * Caps the instruction set that kernels use, e.g. to compare the vector kernels' results with
+ * the scalar ones', or to rule them out when chasing a bug.
+ * @param level the fastest instruction set that the host supports (see sl2_simd_detect)
+ * @param cap the name of the fastest instruction set to use (see sl2_simd_level_name), or NULL
+ * @return the instruction set to use
+ */
+static inline sl2_simd_level sl2_simd_cap(sl2_simd_level level, const char *cap) {
+  if (!cap) {
+    return level;
+  }
+
+  for (int capped = SL2_SIMD_SCALAR; capped < level; ++capped) {
+    if (!strcmp(cap, sl2_simd_level_name((sl2_simd_level)capped))) {
+      return (sl2_simd_level)capped;
+    }
+  }
+
+  return level;
+}
+
+/**
+ * @return the instruction set that kernels use on this host, detected on the first call
+ */
+static inline sl2_simd_level sl2_simd_current() {
+  static const sl2_simd_level level = sl2_simd_detect();
+
+  return level;
+}
+
+/**
+ * Picks a kernel for the host's instruction set, falling back to the fastest one below it that
+ * has a kernel.
+ * @tparam T the kernel's type
+ * @param level the instruction set to pick for (see sl2_simd_current)
+ * @param scalar the reference kernel, which must be given
+ * @param sse2 the SSE2 kernel, or NULL
+ * @param avx2 the AVX2 kernel, or NULL
+ * @return the kernel to call
+ */
+template <typename T>
+static inline T sl2_simd_pick(sl2_simd_level level, T scalar, T sse2, T avx2) {
+  if (level >= SL2_SIMD_AVX2 && avx2) {
+    return avx2;
+  } else if (level >= SL2_SIMD_SSE2 && sse2) {
+    return sse2;
+  }
+
+  return scalar;
+}
+
+#endif
@@ -0,0 +1,428 @@
+#ifndef SL2_TAINT_LABELS_HPP
+#define SL2_TAINT_LABELS_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "dr_api.h"
+
+#include "common/sl2_alloc.hpp"
+
+/**
+ * Taint labels record which bytes of the targeted input a tainted byte or register came from, so
+ * that the tracer can say which input offsets reach a crash (and not just that tainted data
+ * does). A label is a 32-bit id:
+ *  - SL2_LABEL_NONE, for no (known) input bytes;
+ *  - a single input byte (buffer and offset), encoded directly in the id, for the bytes that
+ *    targeted reads taint in the first place, so that tainting a buffer doesn't create a label per
+ *    byte;
+ *  - an index into a sl2_label_table, for everything that combines input bytes: up to
+ *    SL2_LABEL_SPANS buffers, each with the range of offsets that contribute to it. Ranges are
+ *    widened (rather than split) as labels are joined, so they can over-approximate.
+ */
+
+/*! No input bytes */
+#define SL2_LABEL_NONE 0
+/*! Set in labels that stand for a single input byte */
+#define SL2_LABEL_BYTE_FLAG 0x80000000
+/*! The number of bits of a single-byte label that hold the byte's offset into its buffer */
+#define SL2_LABEL_OFFSET_BITS 24
+/*! The largest number of buffers that can be labelled */
+#define SL2_LABEL_MAX_BUFFERS 128
+/*! The largest number of buffers that a single label can refer to */
+#define SL2_LABEL_SPANS 4
+/*! The largest number of combined labels; once the table is full, joins keep their first label */
+#define SL2_LABEL_TABLE_MAX (1 << 20)
+
+/*! The offsets of a single buffer that contribute to a label, [start, end] */
+struct sl2_label_span {
+  uint32_t buffer;
+  uint32_t start;
+  uint32_t end;
+};
+
+/*! The input bytes that a label stands for */
+struct sl2_label {
+  uint32_t count;
+  sl2_label_span spans[SL2_LABEL_SPANS];
+};
+
+/**
+ * Makes the label for a single input byte.
+ * @param buffer the index of the buffer (in the order that targeted reads happened)
+ * @param offset the byte's offset into the buffer
+ * @return the label, or SL2_LABEL_NONE if the buffer or offset is too large to label
+ */
+static inline uint32_t sl2_label_byte(uint32_t buffer, size_t offset) {
+  if (buffer >= SL2_LABEL_MAX_BUFFERS || offset >= ((size_t)1 << SL2_LABEL_OFFSET_BITS)) {
+    return SL2_LABEL_NONE;
+  }
+
+  return SL2_LABEL_BYTE_FLAG | (buffer << SL2_LABEL_OFFSET_BITS) | (uint32_t)offset;
+}
+
+/**
+ * Interns the labels that combine input bytes, and joins labels together.
+ * Nothing is allocated until the first join that needs it, so static instances are safe
+ * to construct before DynamoRIO is up. Call `init` before using it from more than one thread.
+ */
+class sl2_label_table {
+public:
+  sl2_label_table()
+      : lock(NULL), labels(NULL), count(0), capacity(0), slots(NULL), slot_capacity(0) {
+  }
+
+  ~sl2_label_table() {
+    reset();
+  }
+
+  /**
+   * Creates the table's lock.
+   */
+  void init() {
+    lock = dr_mutex_create();
+  }
+
+  /**
+   * Decodes a label into the input bytes that it stands for.
+   * @param label the label
+   * @param out where to put the spans
+   */
+  void decode(uint32_t label, sl2_label *out) {
+    memset(out, 0, sizeof(*out));
+
+    if (label == SL2_LABEL_NONE) {
+      return;
+    }
+
+    if (label & SL2_LABEL_BYTE_FLAG) {
+      out->count = 1;
+      out->spans[0].buffer = (label & ~SL2_LABEL_BYTE_FLAG) >> SL2_LABEL_OFFSET_BITS;
+      out->spans[0].start = label & ((1 << SL2_LABEL_OFFSET_BITS) - 1);
+      out->spans[0].end = out->spans[0].start;
+      return;
+    }
+
+    dr_mutex_lock(lock);
+    *out = labels[label - 1];
+    dr_mutex_unlock(lock);
+  }
+
+  /**
+   * Joins two labels.
+   * @return a label standing for the input bytes of both
+   */
+  uint32_t join(uint32_t a, uint32_t b) {
+    if (a == b || b == SL2_LABEL_NONE) {
+      return a;
+    }
+
+    if (a == SL2_LABEL_NONE) {
+      return b;
+    }
+
+    sl2_label joined, other;
+    decode(a, &joined);
+    decode(b, &other);
+
+    for (uint32_t i = 0; i < other.count; i++) {
+      add_span(&joined, &other.spans[i]);
+    }
+
+    if (joined.count == 1 && joined.spans[0].start == joined.spans[0].end) {
+      return sl2_label_byte(joined.spans[0].buffer, joined.spans[0].start);
+    }
+
+    dr_mutex_lock(lock);
+    uint32_t label = intern(&joined);
+    dr_mutex_unlock(lock);
+
+    return label ? label : a;
+  }
+
+  /**
+   * Frees the table's memory (and its lock).
+   */
+  void reset() {
+    if (labels) {
+      dr_raw_mem_free(labels, capacity * sizeof(sl2_label));
+      dr_raw_mem_free(slots, slot_capacity * sizeof(uint32_t));
+    }
+
+    if (lock) {
+      dr_mutex_destroy(lock);
+    }
+
+    lock = NULL;
+    labels = NULL;
+    slots = NULL;
+    count = 0;
+    capacity = 0;
+    slot_capacity = 0;
+  }
+
+private:
+  void *lock;
+  /*! The combined labels; label `i` is at index `i - 1` */
+  sl2_label *labels;
+  uint32_t count;
+  uint32_t capacity;
+  /*! An open-addressed hash table of combined labels, by contents */
+  uint32_t *slots;
+  uint32_t slot_capacity;
+
+  /**
+   * Adds a span to a label, widening the label's span for the same buffer if it has one.
+   */
+  static void add_span(sl2_label *label, const sl2_label_span *span) {
+    for (uint32_t i = 0; i < label->count; i++) {
+      sl2_label_span *mine = &label->spans[i];
+
+      if (mine->buffer == span->buffer) {
+        mine->start = span->start < mine->start ? span->start : mine->start;
+        mine->end = span->end > mine->end ? span->end : mine->end;
+        return;
+      }
+    }
+
+    // Labels that combine too many buffers lose the newest ones.
+    if (label->count < SL2_LABEL_SPANS) {
+      label->spans[label->count++] = *span;
+    }
+  }
+
+  static uint64_t hash(const sl2_label *label) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const uint8_t *bytes = (const uint8_t *)label;
+
+    for (size_t i = 0; i < sizeof(*label); i++) {
+      h = (h ^ bytes[i]) * 0x100000001b3ULL;
+    }
+
+    return h;
+  }
+
+  static void *alloc_zeroed(size_t bytes) {
+    void *mem = sl2_raw_mem_alloc(bytes, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+    DR_ASSERT(mem != NULL);
+    return mem;
+  }
+
+  /**
+   * Rebuilds the hash table with room for twice as many labels.
+   */
+  void grow() {
+    uint32_t new_capacity = capacity ? capacity * 2 : 1024;
+    sl2_label *new_labels = (sl2_label *)alloc_zeroed(new_capacity * sizeof(sl2_label));
+    uint32_t *new_slots = (uint32_t *)alloc_zeroed(new_capacity * 2 * sizeof(uint32_t));
+
+    if (labels) {
+      memcpy(new_labels, labels, count * sizeof(sl2_label));
+      dr_raw_mem_free(labels, capacity * sizeof(sl2_label));
+      dr_raw_mem_free(slots, slot_capacity * sizeof(uint32_t));
+    }
+
+    labels = new_labels;
+    capacity = new_capacity;
+    slots = new_slots;
+    slot_capacity = new_capacity * 2;
+
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t slot = (uint32_t)hash(&labels[i]) & (slot_capacity - 1);
+
+      while (slots[slot]) {
+        slot = (slot + 1) & (slot_capacity - 1);
+      }
+
+      slots[slot] = i + 1;
+    }
+  }
+
+  /**
+   * @return the id of a combined label, adding it if it's new, or 0 if the table is full
+   */
+  uint32_t intern(const sl2_label *label) {
+    if (slots) {
+      uint32_t slot = (uint32_t)hash(label) & (slot_capacity - 1);
+
+      for (; slots[slot]; slot = (slot + 1) & (slot_capacity - 1)) {
+        if (!memcmp(&labels[slots[slot] - 1], label, sizeof(*label))) {
+          return slots[slot];
+        }
+      }
+    }
+
+    if (count >= SL2_LABEL_TABLE_MAX) {
+      return 0;
+    }
+
+    if (count == capacity) {
+      grow();
+    }
+
+    labels[count++] = *label;
+
+    uint32_t slot = (uint32_t)hash(label) & (slot_capacity - 1);
+    while (slots[slot]) {
+      slot = (slot + 1) & (slot_capacity - 1);
+    }
+
+    slots[slot] = count;
+    return count;
+  }
+};
+
+/*! The number of address bits covered by a single page of labels */
+#define SL2_LABEL_PAGE_BITS 16
+/*! The number of address bits that select a page within a table */
+#define SL2_LABEL_TABLE_BITS 16
+/*! The number of address bits that select a table within the directory */
+#define SL2_LABEL_DIR_BITS 16
+
+/*! The number of bytes of address space covered by a single page of labels */
+#define SL2_LABEL_PAGE_SPAN ((uint64_t)1 << SL2_LABEL_PAGE_BITS)
+/*! The highest address (exclusive) that can be labelled */
+#define SL2_LABEL_ADDR_LIMIT ((uint64_t)1 << (SL2_LABEL_PAGE_BITS + SL2_LABEL_TABLE_BITS + \
+                                              SL2_LABEL_DIR_BITS))
+
+/**
+ * The label of every byte of memory, as shadow memory: a label per byte of address space, kept
+ * in pages allocated (zeroed) from DR's raw memory as they're first needed. The labels of
+ * untainted bytes don't matter. Covers the low 256TB of the address space, like sl2_taint_map.
+ * Nothing is allocated until the first label is set, so static instances are safe to
+ * construct before DynamoRIO is up.
+ */
+class sl2_label_shadow {
+public:
+  sl2_label_shadow() : directory(NULL) {
+  }
+
+  ~sl2_label_shadow() {
+    reset();
+  }
+
+  /**
+   * @return the label of a byte
+   */
+  uint32_t get(app_pc addr) {
+    uint32_t *page = page_for((uint64_t)addr, false);
+    return page ? page[(uint64_t)addr & (SL2_LABEL_PAGE_SPAN - 1)] : SL2_LABEL_NONE;
+  }
+
+  /**
+   * Labels a range of bytes with the same label.
+   */
+  void set(app_pc addr, size_t size, uint32_t label) {
+    for (uint64_t a = (uint64_t)addr; a < (uint64_t)addr + size && a < SL2_LABEL_ADDR_LIMIT;) {
+      uint64_t page_end = (a | (SL2_LABEL_PAGE_SPAN - 1)) + 1;
+      uint32_t *page = page_for(a, label != SL2_LABEL_NONE);
+
+      // Unlabelling bytes that were never labelled is a no-op.
+      if (!page) {
+        a = page_end;
+        continue;
+      }
+
+      for (; a < (uint64_t)addr + size && a < page_end; a++) {
+        page[a & (SL2_LABEL_PAGE_SPAN - 1)] = label;
+      }
+    }
+  }
+
+  /**
+   * Labels a range of bytes as consecutive bytes of a buffer.
+   * @param buffer the buffer's index
+   * @param offset the offset into the buffer of the first byte
+   */
+  void set_bytes(app_pc addr, size_t size, uint32_t buffer, size_t offset) {
+    for (size_t i = 0; i < size && (uint64_t)addr + i < SL2_LABEL_ADDR_LIMIT; i++) {
+      uint32_t *page = page_for((uint64_t)addr + i, true);
+      page[((uint64_t)addr + i) & (SL2_LABEL_PAGE_SPAN - 1)] = sl2_label_byte(buffer, offset + i);
+    }
+  }
+
+  /**
+   * Copies the labels of one range of bytes onto another, the way memmove copies the bytes.
+   */
+  void copy(app_pc dst, app_pc src, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      size_t off = dst < src ? i : size - 1 - i;
+      set(dst + off, 1, get(src + off));
+    }
+  }
+
+  /**
+   * Frees the shadow memory.
+   */
+  void reset() {
+    if (!directory) {
+      return;
+    }
+
+    for (uint64_t d = 0; d < ((uint64_t)1 << SL2_LABEL_DIR_BITS); d++) {
+      uint32_t **table = directory[d];
+
+      if (!table) {
+        continue;
+      }
+
+      for (uint64_t t = 0; t < ((uint64_t)1 << SL2_LABEL_TABLE_BITS); t++) {
+        if (table[t]) {
+          dr_raw_mem_free(table[t], SL2_LABEL_PAGE_SPAN * sizeof(uint32_t));
+        }
+      }
+
+      dr_raw_mem_free(table, sizeof(uint32_t *) << SL2_LABEL_TABLE_BITS);
+    }
+
+    dr_raw_mem_free(directory, sizeof(uint32_t **) << SL2_LABEL_DIR_BITS);
+    directory = NULL;
+  }
+
+private:
+  uint32_t ***directory;
+
+  static void *alloc_zeroed(size_t bytes) {
+    void *mem = sl2_raw_mem_alloc(bytes, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+    DR_ASSERT(mem != NULL);
+    return mem;
+  }
+
+  /**
+   * @param addr an address
+   * @param create whether to allocate the page if it doesn't exist yet
+   * @return the page of labels that covers the address, or NULL if it doesn't exist
+   */
+  uint32_t *page_for(uint64_t addr, bool create) {
+    if (addr >= SL2_LABEL_ADDR_LIMIT) {
+      return NULL;
+    }
+
+    uint64_t d = addr >> (SL2_LABEL_PAGE_BITS + SL2_LABEL_TABLE_BITS);
+    uint64_t t = (addr >> SL2_LABEL_PAGE_BITS) & (((uint64_t)1 << SL2_LABEL_TABLE_BITS) - 1);
+
+    if (!directory) {
+      if (!create) {
+        return NULL;
+      }
+
+      directory = (uint32_t ***)alloc_zeroed(sizeof(uint32_t **) << SL2_LABEL_DIR_BITS);
+    }
+
+    if (!directory[d]) {
+      if (!create) {
+        return NULL;
+      }
+
+      directory[d] = (uint32_t **)alloc_zeroed(sizeof(uint32_t *) << SL2_LABEL_TABLE_BITS);
+    }
+
+    if (!directory[d][t] && create) {
+      directory[d][t] = (uint32_t *)alloc_zeroed(SL2_LABEL_PAGE_SPAN * sizeof(uint32_t));
+    }
+
+    return directory[d][t];
+  }
+};
+
+#endif
@@ -0,0 +1,575 @@
+#ifndef SL2_TAINT_MAP_HPP
+#define SL2_TAINT_MAP_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "dr_api.h"
+
+#include "common/sl2_alloc.hpp"
+
+/*! The number of address bits covered by a single bitmap page (512KB per 64KB page of bits) */
+#define SL2_TAINT_PAGE_BITS 19
+/*! The number of address bits that select a page within a table */
+#define SL2_TAINT_TABLE_BITS 13
+/*! The number of address bits that select a table within the directory */
+#define SL2_TAINT_DIR_BITS 16
+
+/*! The number of bytes of address space covered by a single bitmap page */
+#define SL2_TAINT_PAGE_SPAN ((uint64_t)1 << SL2_TAINT_PAGE_BITS)
+/*! The highest address (exclusive) that the map can hold */
+#define SL2_TAINT_ADDR_LIMIT ((uint64_t)1 << (SL2_TAINT_PAGE_BITS + SL2_TAINT_TABLE_BITS + \
+                                              SL2_TAINT_DIR_BITS))
+
+/*! The smallest run of tainted bytes that's kept as an interval instead of in the bitmap */
+#define SL2_TAINT_INTERVAL_MIN 4096
+/*! The number of intervals that the interval array starts out with room for */
+#define SL2_TAINT_INTERVAL_INITIAL 64
+
+/*! The number of bytes that copy checks for taint at a time */
+#define SL2_TAINT_COPY_CHUNK 64
+
+/*! A run of tainted bytes, [start, end) */
+struct sl2_taint_interval {
+  uint64_t start;
+  uint64_t end;
+};
+
+/**
+ * The set of tainted bytes of memory, as shadow memory: a bit per byte of address space.
+ * The tracer tests, sets and clears the bytes of every memory operand, and the targeted reads that
+ * seed taint can be megabytes long, so ranges are handled a 64-bit word at a time instead of a
+ * byte at a time.
+ * The bits are kept in pages allocated (zeroed) from DR's raw memory as they're first needed,
+ * reached through a directory of tables, so that only the parts of the address space that have
+ * ever been tainted cost anything. The map covers the low 256TB of the address space (more than
+ * the user-mode address space of a 64-bit Windows process); bytes above that are never tainted.
+ * Most taint arrives as large fresh buffers (whole reads, whole file mappings), so runs of at
+ * least SL2_TAINT_INTERVAL_MIN bytes are kept as a sorted array of intervals instead. That makes
+ * tainting, testing and (mostly) untainting them logarithmic in the number of intervals rather
+ * than linear in their size. An interval that gets whittled down below the minimum falls back to the bitmap.
+ * No byte is ever both in an interval and in the bitmap.
+ * Nothing is allocated until the first byte is tainted, so static instances are safe to
+ * construct before DynamoRIO is up.
+ */
+class sl2_taint_map {
+public:
+  sl2_taint_map()
+      : directory(NULL), count(0), intervals(NULL), interval_count(0), interval_capacity(0) {
+  }
+
+  ~sl2_taint_map() {
+    reset();
+  }
+
+  /**
+   * @return the number of tainted bytes
+   */
+  size_t size() const {
+    return count;
+  }
+
+  /**
+   * @return whether no bytes are tainted
+   */
+  bool empty() const {
+    return count == 0;
+  }
+
+  /**
+   * Taints a range of bytes.
+   * @param addr the start of the range
+   * @param size the size of the range
+   */
+  void set(app_pc addr, size_t size) {
+    uint64_t start, end;
+
+    if (!bounds(addr, size, &start, &end)) {
+      return;
+    }
+
+    if (end - start < SL2_TAINT_INTERVAL_MIN) {
+      update_gaps(start, end, SL2_TAINT_SET);
+      return;
+    }
+
+    // Anything already in the bitmap moves into the interval, along with any intervals that this
+    // one overlaps or touches.
+    update_bits(start, end, SL2_TAINT_CLEAR);
+
+    size_t lo = first_interval_ending_at_or_after(start);
+    size_t hi = lo;
+
+    while (hi < interval_count && intervals[hi].start <= end) {
+      start = intervals[hi].start < start ? intervals[hi].start : start;
+      end = intervals[hi].end > end ? intervals[hi].end : end;
+      count -= (size_t)(intervals[hi].end - intervals[hi].start);
+      hi++;
+    }
+
+    remove_intervals(lo, hi);
+    insert_interval(lo, start, end);
+    count += (size_t)(end - start);
+  }
+
+  /**
+   * Untaints a range of bytes.
+   * @param addr the start of the range
+   * @param size the size of the range
+   * @return whether any byte in the range was tainted
+   */
+  bool clear(app_pc addr, size_t size) {
+    uint64_t start, end;
+
+    if (!bounds(addr, size, &start, &end) || !count) {
+      return false;
+    }
+
+    bool found = update_gaps(start, end, SL2_TAINT_CLEAR);
+    size_t i = first_interval_ending_after(start);
+
+    while (i < interval_count && intervals[i].start < end) {
+      sl2_taint_interval old = intervals[i];
+
+      found = true;
+      count -= (size_t)(old.end - old.start);
+      remove_intervals(i, i + 1);
+
+      // Whatever's left on either side stays an interval if it's big enough, and goes back into
+      // the bitmap if it isn't.
+      if (old.start < start) {
+        if (start - old.start >= SL2_TAINT_INTERVAL_MIN) {
+          insert_interval(i++, old.start, start);
+          count += (size_t)(start - old.start);
+        } else {
+          update_bits(old.start, start, SL2_TAINT_SET);
+        }
+      }
+
+      if (old.end > end) {
+        if (old.end - end >= SL2_TAINT_INTERVAL_MIN) {
+          insert_interval(i, end, old.end);
+          count += (size_t)(old.end - end);
+        } else {
+          update_bits(end, old.end, SL2_TAINT_SET);
+        }
+
+        break;
+      }
+    }
+
+    return found;
+  }
+
+  /**
+   * @param addr the start of the range
+   * @param size the size of the range
+   * @return whether any byte in the range is tainted
+   */
+  bool test(app_pc addr, size_t size) {
+    uint64_t start, end;
+
+    if (!bounds(addr, size, &start, &end) || !count) {
+      return false;
+    }
+
+    return update_gaps(start, end, SL2_TAINT_TEST);
+  }
+
+  /**
+   * Copies the taint of one range of bytes onto another, the way memmove copies the bytes
+   * themselves (so the ranges may overlap).
+   * @param dst the start of the range to copy onto
+   * @param src the start of the range to copy from
+   * @param size the size of the ranges
+   */
+  void copy(app_pc dst, app_pc src, size_t size) {
+    if (!size || dst == src) {
+      return;
+    }
+
+    // Untainted sources are the common case, and can be handled a word at a time.
+    if (!test(src, size)) {
+      clear(dst, size);
+      return;
+    }
+
+    // Bulk copies (rep movs, memcpy) are mostly untainted with tainted stretches, so each 64-byte
+    // chunk is only copied byte by byte if some of it is tainted. The chunks go in the same
+    // direction as the bytes, so that overlapping ranges still copy like memmove.
+    for (size_t chunk = 0; chunk < size; chunk += SL2_TAINT_COPY_CHUNK) {
+      size_t chunk_size = size - chunk < SL2_TAINT_COPY_CHUNK ? size - chunk : SL2_TAINT_COPY_CHUNK;
+      size_t chunk_off = dst < src ? chunk : size - chunk - chunk_size;
+
+      if (!test(src + chunk_off, chunk_size)) {
+        clear(dst + chunk_off, chunk_size);
+        continue;
+      }
+
+      for (size_t i = 0; i < chunk_size; i++) {
+        size_t off = chunk_off + (dst < src ? i : chunk_size - 1 - i);
+
+        if (test(src + off, 1)) {
+          set(dst + off, 1);
+        } else {
+          clear(dst + off, 1);
+        }
+      }
+    }
+  }
+
+  /**
+   * Calls `f(start, size)` for each run of tainted bytes, in address order.
+   * @param f the function to call
+   */
+  template <typename F> void for_each_range(F f) const {
+    sl2_taint_run_joiner<F> runs(f);
+    size_t next = 0;
+
+    if (directory) {
+      for (uint64_t d = 0; d < ((uint64_t)1 << SL2_TAINT_DIR_BITS); d++) {
+        uint64_t **table = directory[d];
+
+        if (!table) {
+          continue;
+        }
+
+        for (uint64_t t = 0; t < ((uint64_t)1 << SL2_TAINT_TABLE_BITS); t++) {
+          uint64_t *page = table[t];
+
+          if (!page) {
+            continue;
+          }
+
+          uint64_t page_start = ((d << SL2_TAINT_TABLE_BITS) | t) << SL2_TAINT_PAGE_BITS;
+
+          for (uint64_t w = 0; w < SL2_TAINT_PAGE_SPAN / 64; w++) {
+            uint64_t word = page[w];
+
+            if (!word) {
+              continue;
+            }
+
+            for (uint64_t b = 0; b < 64; b++) {
+              if (!(word & ((uint64_t)1 << b))) {
+                continue;
+              }
+
+              uint64_t addr = page_start + (w * 64) + b;
+
+              // Intervals and bits never overlap, so the intervals before this byte come first.
+              for (; next < interval_count && intervals[next].start < addr; next++) {
+                runs.add(intervals[next].start, intervals[next].end - intervals[next].start);
+              }
+
+              runs.add(addr, 1);
+            }
+          }
+        }
+      }
+    }
+
+    for (; next < interval_count; next++) {
+      runs.add(intervals[next].start, intervals[next].end - intervals[next].start);
+    }
+
+    runs.finish();
+  }
+
+  /**
+   * Untaints every byte, and frees the map's memory.
+   */
+  void reset() {
+    if (intervals) {
+      dr_raw_mem_free(intervals, interval_capacity * sizeof(sl2_taint_interval));
+      intervals = NULL;
+      interval_count = 0;
+      interval_capacity = 0;
+    }
+
+    count = 0;
+
+    if (!directory) {
+      return;
+    }
+
+    for (uint64_t d = 0; d < ((uint64_t)1 << SL2_TAINT_DIR_BITS); d++) {
+      uint64_t **table = directory[d];
+
+      if (!table) {
+        continue;
+      }
+
+      for (uint64_t t = 0; t < ((uint64_t)1 << SL2_TAINT_TABLE_BITS); t++) {
+        if (table[t]) {
+          dr_raw_mem_free(table[t], SL2_TAINT_PAGE_SPAN / 8);
+        }
+      }
+
+      dr_raw_mem_free(table, sizeof(uint64_t *) << SL2_TAINT_TABLE_BITS);
+    }
+
+    dr_raw_mem_free(directory, sizeof(uint64_t **) << SL2_TAINT_DIR_BITS);
+    directory = NULL;
+  }
+
+private:
+  enum sl2_taint_op { SL2_TAINT_SET, SL2_TAINT_CLEAR, SL2_TAINT_TEST };
+
+  /**
+   * Joins adjacent runs of tainted bytes before handing them to a `for_each_range` callback.
+   */
+  template <typename F> struct sl2_taint_run_joiner {
+    F &f;
+    uint64_t run_start;
+    uint64_t run_size;
+
+    sl2_taint_run_joiner(F &f) : f(f), run_start(0), run_size(0) {
+    }
+
+    void add(uint64_t start, uint64_t size) {
+      if (run_size && start == run_start + run_size) {
+        run_size += size;
+        return;
+      }
+
+      finish();
+      run_start = start;
+      run_size = size;
+    }
+
+    void finish() {
+      if (run_size) {
+        f(run_start, run_size);
+        run_size = 0;
+      }
+    }
+  };
+
+  uint64_t ***directory;
+  /*! The number of tainted bytes, in intervals and in the bitmap */
+  size_t count;
+  /*! The intervals, sorted and neither overlapping nor touching */
+  sl2_taint_interval *intervals;
+  size_t interval_count;
+  size_t interval_capacity;
+
+  /**
+   * Clamps a range of bytes to the part of the address space that the map covers.
+   * @return whether anything is left of the range
+   */
+  static bool bounds(app_pc addr, size_t size, uint64_t *start, uint64_t *end) {
+    *start = (uint64_t)addr;
+    *end = *start + size;
+
+    if (*end < *start || *end > SL2_TAINT_ADDR_LIMIT) {
+      *end = SL2_TAINT_ADDR_LIMIT;
+    }
+
+    return *start < *end;
+  }
+
+  /**
+   * @return the index of the first interval that ends after `addr`
+   */
+  size_t first_interval_ending_after(uint64_t addr) const {
+    size_t lo = 0;
+    size_t hi = interval_count;
+
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (intervals[mid].end <= addr) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+
+    return lo;
+  }
+
+  /**
+   * @return the index of the first interval that ends at or after `addr`
+   */
+  size_t first_interval_ending_at_or_after(uint64_t addr) const {
+    return addr ? first_interval_ending_after(addr - 1) : 0;
+  }
+
+  /**
+   * Inserts an interval, growing the array if need be.
+   * @param index where the interval goes
+   */
+  void insert_interval(size_t index, uint64_t start, uint64_t end) {
+    if (interval_count == interval_capacity) {
+      size_t capacity = interval_capacity ? interval_capacity * 2 : SL2_TAINT_INTERVAL_INITIAL;
+      sl2_taint_interval *grown =
+          (sl2_taint_interval *)alloc_zeroed(capacity * sizeof(sl2_taint_interval));
+
+      if (intervals) {
+        memcpy(grown, intervals, interval_count * sizeof(sl2_taint_interval));
+        dr_raw_mem_free(intervals, interval_capacity * sizeof(sl2_taint_interval));
+      }
+
+      intervals = grown;
+      interval_capacity = capacity;
+    }
+
+    memmove(&intervals[index + 1], &intervals[index],
+            (interval_count - index) * sizeof(sl2_taint_interval));
+    intervals[index].start = start;
+    intervals[index].end = end;
+    interval_count++;
+  }
+
+  /**
+   * Removes the intervals [lo, hi).
+   */
+  void remove_intervals(size_t lo, size_t hi) {
+    if (lo == hi) {
+      return;
+    }
+
+    memmove(&intervals[lo], &intervals[hi], (interval_count - hi) * sizeof(sl2_taint_interval));
+    interval_count -= hi - lo;
+  }
+
+  /**
+   * Sets, clears or tests the bitmap across the parts of a range that aren't in an interval.
+   * A test also succeeds if the range overlaps an interval.
+   * @return for tests and clears, whether any byte in the range was tainted
+   */
+  bool update_gaps(uint64_t start, uint64_t end, sl2_taint_op op) {
+    size_t i = first_interval_ending_after(start);
+    bool found = false;
+
+    while (start < end) {
+      if (i >= interval_count || intervals[i].start >= end) {
+        return update_bits(start, end, op) || found;
+      }
+
+      if (op == SL2_TAINT_TEST) {
+        return true;
+      }
+
+      if (intervals[i].start > start) {
+        found |= update_bits(start, intervals[i].start, op);
+      }
+
+      start = intervals[i].end;
+      i++;
+    }
+
+    return found;
+  }
+
+  /**
+   * @param bytes the size of the allocation
+   * @return zeroed memory from DR's raw memory
+   */
+  static void *alloc_zeroed(size_t bytes) {
+    void *mem = sl2_raw_mem_alloc(bytes, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+    DR_ASSERT(mem != NULL);
+    return mem;
+  }
+
+  /**
+   * @param word a word
+   * @return the number of set bits in the word
+   */
+  static uint64_t popcount(uint64_t word) {
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (word * 0x0101010101010101ULL) >> 56;
+  }
+
+  /**
+   * @param addr an address below SL2_TAINT_ADDR_LIMIT
+   * @param create whether to allocate the page if it doesn't exist yet
+   * @return the bitmap page that covers the address, or NULL if it doesn't exist
+   */
+  uint64_t *page_for(uint64_t addr, bool create) {
+    uint64_t d = addr >> (SL2_TAINT_PAGE_BITS + SL2_TAINT_TABLE_BITS);
+    uint64_t t = (addr >> SL2_TAINT_PAGE_BITS) & (((uint64_t)1 << SL2_TAINT_TABLE_BITS) - 1);
+
+    if (!directory) {
+      if (!create) {
+        return NULL;
+      }
+
+      directory = (uint64_t ***)alloc_zeroed(sizeof(uint64_t **) << SL2_TAINT_DIR_BITS);
+    }
+
+    if (!directory[d]) {
+      if (!create) {
+        return NULL;
+      }
+
+      directory[d] = (uint64_t **)alloc_zeroed(sizeof(uint64_t *) << SL2_TAINT_TABLE_BITS);
+    }
+
+    if (!directory[d][t] && create) {
+      directory[d][t] = (uint64_t *)alloc_zeroed(SL2_TAINT_PAGE_SPAN / 8);
+    }
+
+    return directory[d][t];
+  }
+
+  /**
+   * Sets, clears or tests a range of the bitmap, a word at a time.
+   * @param start the start of the range
+   * @param end the end of the range (exclusive, and no higher than SL2_TAINT_ADDR_LIMIT)
+   * @param op what to do
+   * @return for tests and clears, whether any byte in the range was tainted
+   */
+  bool update_bits(uint64_t start, uint64_t end, sl2_taint_op op) {
+    bool found = false;
+
+    if ((op != SL2_TAINT_SET && !count) || start >= end) {
+      return false;
+    }
+
+    while (start < end) {
+      uint64_t page_end = (start | (SL2_TAINT_PAGE_SPAN - 1)) + 1;
+      uint64_t chunk_end = end < page_end ? end : page_end;
+      uint64_t *page = page_for(start, op == SL2_TAINT_SET);
+
+      if (page) {
+        uint64_t first = start & (SL2_TAINT_PAGE_SPAN - 1);
+        uint64_t last = (chunk_end - 1) & (SL2_TAINT_PAGE_SPAN - 1);
+
+        for (uint64_t w = first / 64; w <= last / 64; w++) {
+          uint64_t lo = w == first / 64 ? first % 64 : 0;
+          uint64_t hi = w == last / 64 ? last % 64 : 63;
+          uint64_t mask = (~0ULL >> (63 - hi)) & (~0ULL << lo);
+
+          switch (op) {
+          case SL2_TAINT_SET:
+            count += (size_t)popcount(mask & ~page[w]);
+            page[w] |= mask;
+            break;
+          case SL2_TAINT_CLEAR:
+            if (page[w] & mask) {
+              count -= (size_t)popcount(page[w] & mask);
+              page[w] &= ~mask;
+              found = true;
+            }
+            break;
+          case SL2_TAINT_TEST:
+            if (page[w] & mask) {
+              return true;
+            }
+            break;
+          }
+        }
+      }
+
+      start = chunk_end;
+    }
+
+    return found;
+  }
+};
+
+#endif
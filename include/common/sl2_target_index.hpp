@@ -0,0 +1,74 @@
+#ifndef SL2_TARGET_INDEX_HPP
+#define SL2_TARGET_INDEX_HPP
+
+#include <stdint.h>
+
+/**
+ * The layout of a target index: a fixed-layout copy of targets.msg that the harness writes
+ * alongside it (see sl2/harness/target_index.py), and that the clients map and compile straight
+ * from, instead of decoding msgpack into JSON on every start.
+ * An index is a header, `count` records of `record_size` bytes each, and a table of the
+ * targets' UTF-16LE source names, which records refer into.
+ * Keep this in sync with target_index.py.
+ */
+
+/*! "SL2T", read as a little-endian uint32_t */
+#define SL2_TARGET_INDEX_MAGIC 0x54324C53
+
+/*! Bumped whenever the layout below changes */
+#define SL2_TARGET_INDEX_VERSION 1
+
+/*! The extension that replaces ".msg" in the name of a target file's index */
+#define SL2_TARGET_INDEX_EXT ".sl2t"
+
+/*! The size of a record's function name, including its terminator */
+#define SL2_TARGET_INDEX_NAME_LEN 32
+
+/*! The size of a record's argument hash, including its terminator (and padding) */
+#define SL2_TARGET_INDEX_HASH_LEN 72
+
+/*! The most leading argument buffer bytes that a record holds */
+#define SL2_TARGET_INDEX_BUFFER_LEN 16
+
+/*! The header of a target index */
+struct sl2_target_index_header {
+  /*! SL2_TARGET_INDEX_MAGIC */
+  uint32_t magic;
+  /*! SL2_TARGET_INDEX_VERSION */
+  uint32_t version;
+  /*! The number of records, in targets.msg order */
+  uint32_t count;
+  /*! The size of each record, in bytes */
+  uint32_t record_size;
+};
+
+/*! A single target in a target index */
+struct sl2_target_index_record {
+  /*! Whether the user selected the target */
+  uint32_t selected;
+  /*! The format of `argHash` (SL2_ARG_HASH_*) */
+  uint32_t argHashVersion;
+  /*! The name of the function, as recorded by the wizard (e.g. "ReadFile") */
+  char func_name[SL2_TARGET_INDEX_NAME_LEN];
+  /*! Which targeting strategy to use for this target */
+  uint64_t mode;
+  /*! The number of times the wizard had encountered this function */
+  uint64_t index;
+  /*! The return address, relative to the main module */
+  uint64_t retAddrOffset;
+  /*! The number of times the wizard had encountered this return address */
+  uint64_t retAddrCount;
+  /*! The hex-encoded hash of the arguments of the function */
+  char argHash[SL2_TARGET_INDEX_HASH_LEN];
+  /*! Where the target's source name starts in the string table, in UTF-16 code units */
+  uint32_t source_offset;
+  /*! The length of the target's source name, in UTF-16 code units */
+  uint32_t source_length;
+  /*! The number of bytes in `buffer` */
+  uint32_t buffer_size;
+  uint32_t reserved;
+  /*! The first few bytes of the argument buffer */
+  uint8_t buffer[SL2_TARGET_INDEX_BUFFER_LEN];
+};
+
+#endif
@@ -11,7 +11,19 @@
  * mutation.(cpp|hpp). We define it here so that other (non-DR) components can us it (e.g., the
  * server).
  */
-#define SL2_NUM_STRATEGIES 9
+#define SL2_NUM_STRATEGIES 13
+
+/**
+ * The number of length-changing mutation strategies currently implemented by SL2.
+ *  Like SL2_NUM_STRATEGIES, this MUST be kept up-to-date with the size of
+ * SL2_RESIZE_STRATEGY_TABLE in mutation.(cpp|hpp).
+ */
+#define SL2_NUM_RESIZE_STRATEGIES 8
+
+/**
+ * The maximum number of strategies that a single stacked (havoc) mutation can apply.
+ */
+#define SL2_MAX_MUTATION_CHAIN 32
 
 /**
  * The size of a SHA256 hash.
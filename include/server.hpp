@@ -6,6 +6,22 @@
 /*! The path to the local named pipe, used by the server to communicate with clients. */
 #define FUZZ_SERVER_PATH (L"\\\\.\\pipe\\fuzz_server")
 
+/*! The named mutex that the server holds for as long as it runs. */
+#define FUZZ_SERVER_MUTEX (L"fuzz_server_mutex")
+
+/*! The formats for a named server instance's pipe and mutex (see the server's -n). Formatted with
+ * the instance's name. */
+#define FUZZ_SERVER_INSTANCE_PATH_FMT (L"\\\\.\\pipe\\fuzz_server.%s")
+#define FUZZ_SERVER_INSTANCE_MUTEX_FMT (L"fuzz_server_mutex.%s")
+
+/*! The environment variable that names the server instance that clients connect to. Clients
+ * connect to the default instance when it's unset or empty. */
+#define FUZZ_SERVER_INSTANCE_ENV (L"SL2_SERVER_INSTANCE")
+
+/*! The longest name that a server instance can have. Names are made of letters, digits, dashes,
+ * and underscores, so that they can go into pipe, mutex, and directory names as they are. */
+#define FUZZ_SERVER_INSTANCE_MAX 32
+
 /*! The file (under the run directory) in which the name of the program is stored. */
 #define FUZZ_RUN_PROGRAM_TXT (L"program.txt")
 
@@ -25,22 +41,98 @@
 /*! The file (under the run directory) in which the program's crash state is stored. */
 #define FUZZ_RUN_EXECUTION_CSH (L"execution.csh")
 
-/*! The format for files (under the run directory) in which the program's crash triage info is
- * stored. */
-#define FUZZ_RUN_CRASH_JSON_FMT (L"crash.%lu.json")
+/*! The format for files (under the run directory) in which the tracer's crash record (see
+ * common/sl2_crash_record.hpp) is stored. */
+#define FUZZ_RUN_CRASH_RECORD_FMT (L"crash.%lu.sl2c")
 
 /*! The format for files (under a run directory) containing replayable mutations. */
 #define FUZZ_RUN_FKT_FMT (L"%d.fkt")
 
+/*! The file (under a run directory) that replayable mutations are appended to, when the server
+ * is journaling mutations instead of writing one FKT per mutation. */
+#define FUZZ_RUN_FKT_JOURNAL (L"mutations.fktj")
+
 /*! The file (under the run directory) in which the program's fuzzing pid(s) are stored. */
 #define FUZZ_RUN_FUZZER_PIDS (L"fuzz.pids")
 
 /*! The file (under the run directory) in which the program's tracing pid(s) are stored. */
 #define FUZZ_RUN_TRACER_PIDS (L"trace.pids")
 
-/*! The size, in bytes, of our fuzzing arena. */
+/*! The default size, in bytes, of a fuzzing arena's coverage map, and the smallest one allowed. */
 #define FUZZ_ARENA_SIZE 65536
 
+/*! The largest coverage map that a target can ask for, in bytes. */
+#define FUZZ_ARENA_MAX_SIZE (8 * 1024 * 1024)
+
+/*! Whether `size` is a valid coverage map size: a power of two from FUZZ_ARENA_SIZE to
+ * FUZZ_ARENA_MAX_SIZE. A target's map size is fixed when its arena is created. */
+#define SL2_ARENA_SIZE_VALID(size) \
+  ((size) >= FUZZ_ARENA_SIZE && (size) <= FUZZ_ARENA_MAX_SIZE && !((size) & ((size)-1)))
+
+/*! How an arena that isn't shared with the server is sent to it: its whole map... */
+#define SL2_ARENA_DENSE 0
+/*! ...or only its nonzero cells, as a uint32_t count followed by that many SL2_ARENA_CELLs. */
+#define SL2_ARENA_SPARSE 1
+
+/*! Arenas with fewer nonzero cells than this (for a map of `size` bytes) are sent sparse. At
+ * 4 bytes a cell, a sparse arena is then at most half the size of the dense map. */
+#define SL2_ARENA_SPARSE_MAX_CELLS(size) ((size) / 8)
+
+/*! Packs a nonzero arena cell for a sparse arena: its index in the map, and its hit count. */
+#define SL2_ARENA_CELL(index, hits) (((uint32_t)(index) << 8) | (uint8_t)(hits))
+/*! The index of a packed arena cell */
+#define SL2_ARENA_CELL_INDEX(cell) ((cell) >> 8)
+/*! The hit count of a packed arena cell */
+#define SL2_ARENA_CELL_HITS(cell) ((uint8_t)((cell)&0xFF))
+
+/*! The smallest hit count in the same bucket as `hits` (see bucket_bit in server/server.cpp).
+ * Fuzzers started with -no_raw_counts classify their maps' hit counts into these before sending
+ * them, which leaves every cell in its bucket, but lets runs that only differ within buckets hash
+ * to the same path. Their arenas' cells hold bucket floors rather than hit counts, so the merged
+ * map that the server sums them into (and the scores that it takes from it) differ from a raw
+ * campaign's. By default, fuzzers send raw counts. */
+#define SL2_BUCKET_FLOOR(hits)                                                                     \
+  ((hits) >= 128  ? 128                                                                            \
+   : (hits) >= 32 ? 32                                                                             \
+   : (hits) >= 16 ? 16                                                                             \
+   : (hits) >= 8  ? 8                                                                              \
+   : (hits) >= 4  ? 4                                                                              \
+                  : !!(hits))
+
+/*! The format for named file mapping sections that share a single run's coverage arena
+ * between a fuzzer and the server. Formatted with the arena ID and the fuzzer's pid. */
+#define FUZZ_ARENA_SECTION_FMT (L"Local\\sl2_arena_%s_%llu")
+
+/*! The format for named file mapping sections that share a ring of pre-generated mutations
+ * between the server and every fuzzer of an arena. Formatted with the arena ID, the mutation
+ * count of the targeted read, and the hash of the unmutated read. */
+#define FUZZ_RING_SECTION_FMT (L"Local\\sl2_ring_%s_%u_%016llx")
+
+/*! The format for named file mapping sections that a fuzzer puts its large mutations into, so
+ * that only their offset and length go through the pipe (see EVT_MAP_UPLOAD). Formatted with the
+ * server's pid and a serial number, since a fuzzer may have several connections. */
+#define FUZZ_UPLOAD_SECTION_FMT (L"Local\\sl2_upload_%lu_%llu")
+
+/*! The smallest mutation that's registered through an upload section instead of the pipe. */
+#define SL2_UPLOAD_MIN_BUFSIZE (256 * 1024)
+
+/*! Upload sections are sized in multiples of this, so that slowly growing reads don't keep
+ * replacing them. */
+#define SL2_UPLOAD_SECTION_SIZE (4 * 1024 * 1024)
+
+/*! The biggest upload section that the server will create. Bigger mutations go through the pipe. */
+#define SL2_UPLOAD_MAX_SIZE (256 * 1024 * 1024)
+
+/*! The named file mapping section that the server publishes its live stats in (see
+ * sl2_live_stats), and the format for a named server instance's. Formatted with the instance's
+ * name. */
+#define FUZZ_STATS_SECTION (L"Local\\sl2_stats")
+#define FUZZ_STATS_SECTION_FMT (L"Local\\sl2_stats.%s")
+
+/*! Set on a registered mutation's encoding (SL2_FKT_FULL) when its bytes are in the session's
+ * upload section: only their size and offset in the section are sent. */
+#define SL2_MUTATION_SHARED 0x80
+
 enum Event {
   /*! Request a new run ID from the server. WARNING: Deprecated; the server will complain and may
      die if you send this. */
@@ -64,11 +156,13 @@ enum Event {
   /*! Request a pathname for storing a memory dump from the server. WARNING: Deprecated; the server
      will complain and may die if you send this. */
   EVT_MEM_DMP_PATH, // 7
-  /*! Register a mutation generated by the fuzzer with the server. */
+  /*! Register a mutation generated by the fuzzer with the server. A stacked mutation's chain is
+     followed by the mutated buffer's capacity. */
   EVT_REGISTER_MUTATION, // 8
   /*! Request any and all paths containing crash information from the server. */
   EVT_CRASH_PATHS, // 9
-  /*! Request the coverage arena for a given run. */
+  /*! Request the coverage arena for a given run. The client asks for a map size, which the
+     server uses if it creates the arena, and the server replies with the arena's actual size. */
   EVT_GET_ARENA, // 10
   /*! Register the (modified) coverage arena for a given run. */
   EVT_SET_ARENA, // 11
@@ -76,15 +170,181 @@ enum Event {
   EVT_PING, // 12
   /*! Tell the server about a pid associated with a fuzzing or tracing run. */
   EVT_REGISTER_PID, // 13
-  /*! Request mutation strategy advice from the server. */
+  /*! Request mutation strategy advice from the server: the arena's strategy, followed by a count
+     of sl2_target_advice for the arena's targeted calls. */
   EVT_ADVISE_MUTATION, // 14
   /*! Request information about an arena's coverage from the server. */
   EVT_COVERAGE_INFO, // 15
+  /*! Request a shared-memory section for a run's coverage arena. EVT_SET_ARENA on a mapped arena
+     doesn't send the map; the server reads it from the section instead. */
+  EVT_MAP_ARENA, // 16
+  /*! Register a run's coverage arena, pid and crash state, request its coverage info, and end
+     the session, all in one round trip. */
+  EVT_FINALIZE_RUN, // 17
+  /*! Request per-event statistics from the server. */
+  EVT_STATS, // 18
+  /*! Ask the server to snapshot a crashing process and write its initial minidump from the
+     snapshot, out-of-process, so that the crashing process can exit right away. */
+  EVT_CRASH_DUMP, // 19
+  /*! Request the shared ring of mutations that the server pre-generates for a targeted read. */
+  EVT_MAP_RING, // 20
+  /*! Register a mutation popped from a ring. The server already has its bytes, so only the
+     mutation's position in the ring is sent. */
+  EVT_REGISTER_RING_MUTATION, // 21
+  /*! Request a donor for a splice mutation: an input from the arena's corpus of inputs that
+     increased its coverage. */
+  EVT_CORPUS_DONOR, // 22
+  /*! Bind the session to a run. The session's later events that are for a run don't carry its ID;
+     the server uses the session's instead. */
+  EVT_SESSION_BEGIN, // 23
+  /*! Request a seed to mutate from: an input from the arena's corpus, favoring recent, small and
+     fast ones. */
+  EVT_SEED, // 24
+  /*! Request every input in an arena's corpus, e.g. to minimize it. */
+  EVT_CORPUS_LIST, // 25
+  /*! Remove the given inputs (by their place in the corpus's order) from an arena's corpus. */
+  EVT_CORPUS_PRUNE, // 26
+  /*! Change the server's log file verbosity (a loguru verbosity, from -3 to 9). The server replies
+     with the old one. */
+  EVT_SET_LOG_LEVEL, // 27
+  /*! Mark the given cells of an arena's map as unstable (i.e. hit a varying number of times by
+     the same input), so that the server masks them out of every run. The server replies with the
+     number of unstable cells that the arena now has. */
+  EVT_SET_UNSTABLE, // 28
+  /*! Request an arena's metrics time series: an sl2_series_header, followed by its samples,
+     oldest first. */
+  EVT_SERIES, // 29
+  /*! Request a shared-memory section for uploading large mutations into, replacing the session's
+     old one (if any). EVT_REGISTER_MUTATION with SL2_MUTATION_SHARED doesn't send the mutated
+     bytes; the server journals them straight from the section instead. */
+  EVT_MAP_UPLOAD, // 30
+  /*! Finalize a run like EVT_FINALIZE_RUN, but send the fingerprint of the run's raw arena first,
+     and the run's distance from its directed targets (see SL2_DISTANCE_NONE) after its crash
+     flag. The server replies with whether it already knows the run's path: if it does, it counts
+     the run without its arena, and replies with the coverage info right away. Otherwise, the
+     client sends the arena (as EVT_FINALIZE_RUN does, after the mapping flag) for the coverage
+     info. */
+  EVT_FINALIZE_PATH, // 31
+  /*! Request the campaign's configuration (see sl2_campaign_config). */
+  EVT_GET_CONFIG, // 32
+  /*! Change the campaign's configuration: the client sends an sl2_campaign_config with the fields
+     that it changes, and the generation that it changes them from (or 0 to change them
+     regardless). The server replies with a status (see sl2_config_status), followed by the
+     configuration as it now stands. */
+  EVT_SET_CONFIG, // 33
   /*! Use this as a default value when handling multiple events. WARNING: The server will complain
      and may die if you send this. */
   EVT_INVALID = 255,
 };
 
+/*! The distance of a run that wasn't directed at any targets (see the fuzzer's -directed), or that
+ * never came near them. Distances are the mean distance of the blocks that the run hit from the
+ * nearest target, in SL2_DISTANCE_SCALE-ths of a log2 bucket of bytes: lower is closer, and 0 is
+ * a run that only hit the targets themselves. */
+#define SL2_DISTANCE_NONE 0xFFFFFFFF
+#define SL2_DISTANCE_SCALE 256
+
+/*! The version of sl2_campaign_config's layout. */
+#define SL2_CONFIG_VERSION 1
+
+/*! The most targets (by their index in the target's all_targets.msg) that a campaign's
+ * configuration can select. */
+#define SL2_CONFIG_MAX_TARGETS 256
+
+/*! Fields of sl2_campaign_config. The server's own fields are always set; the workers' are only
+ * set once a client has set them, and workers keep their own values until then. */
+#define SL2_CONFIG_FUZZ_TIMEOUT 0x1
+#define SL2_CONFIG_STICKINESS 0x2
+#define SL2_CONFIG_BUCKETING 0x4
+#define SL2_CONFIG_SCHEDULER 0x8
+#define SL2_CONFIG_TARGETS 0x10
+#define SL2_CONFIG_SERVER_FIELDS \
+  (SL2_CONFIG_STICKINESS | SL2_CONFIG_BUCKETING | SL2_CONFIG_SCHEDULER)
+#define SL2_CONFIG_ALL_FIELDS \
+  (SL2_CONFIG_FUZZ_TIMEOUT | SL2_CONFIG_SERVER_FIELDS | SL2_CONFIG_TARGETS)
+
+/**
+ * A running campaign's configuration, held by the server so that it can be tuned without
+ * restarting anything (see EVT_SET_CONFIG). The server applies its own fields right away; workers
+ * pick theirs up at their next run.
+ */
+struct sl2_campaign_config {
+  /*! Always SL2_CONFIG_VERSION */
+  uint32_t version;
+  /*! Bumped every time the configuration changes. 0 is the configuration that the server was
+   * started with */
+  uint32_t generation;
+  /*! Which of the fields below are set (SL2_CONFIG_*) */
+  uint32_t fields;
+  /*! Fuzzing runs' timeout, in seconds (0 for the adaptive timeout) */
+  uint32_t fuzz_timeout;
+  /*! How long to stick with a strategy that's stopped paying off (the server's -s) */
+  uint32_t stickiness;
+  /*! Whether score bucketing is on (the server's -b) */
+  uint8_t bucketing;
+  /*! How the next mutation strategy is picked (the server's -S): 0 for legacy, 1 for ucb1 and 2
+   * for thompson */
+  uint8_t scheduler;
+  uint8_t reserved[2];
+  /*! A bitmap of the selected targets, by their index in the target's all_targets.msg */
+  uint8_t targets[SL2_CONFIG_MAX_TARGETS / 8];
+};
+
+/*! The status of an EVT_SET_CONFIG request */
+enum sl2_config_status {
+  /*! The configuration was changed */
+  SL2_CONFIG_OK,
+  /*! The request's version wasn't SL2_CONFIG_VERSION, or one of its fields was out of range */
+  SL2_CONFIG_INVALID,
+  /*! The configuration had changed since the request's generation, so nothing was changed */
+  SL2_CONFIG_STALE,
+};
+
+/*! The first byte of a framed request. Clients that predate framing send a bare event byte
+ * instead, which the server still understands. */
+#define SL2_FRAME_MAGIC 0xF5
+
+/*! The version of the framing below. Bumped whenever it changes incompatibly. */
+#define SL2_FRAME_VERSION 1
+
+/*! Set on a frame whose request continues in the next frame, for requests too big for a single
+ * frame buffer. */
+#define SL2_FRAME_MORE 0x1
+
+/*! Set on every frame of a request whose response the client won't read. The server handles the
+ * request as usual, but doesn't send anything back for it, so the client doesn't have to wait on
+ * the server. Only for requests whose responses are just statuses (e.g. EVT_REGISTER_MUTATION).
+ */
+#define SL2_FRAME_NO_REPLY 0x2
+
+/*! The default size of the server's pipe buffers (each way), in bytes: enough for a framed
+ * request carrying a whole coverage arena of the default size, so that clients can send one
+ * without blocking on the server. Configurable with the server's -B option. */
+#define SL2_PIPE_BUFFER_SIZE (FUZZ_ARENA_SIZE + 4096)
+
+/*! The most payload that the server accepts for a single request, across all of its frames. */
+#define SL2_FRAME_MAX_PAYLOAD (64 * 1024 * 1024)
+
+/**
+ * Precedes every framed request from a client. A client builds each request's payload (exactly
+ * the fields that it used to write one by one) into a buffer, and sends the header and the payload
+ * with a single write, which the server reads with a single read. Anything that the client writes
+ * after its first read for the request (e.g. a ring's unmutated read, once the server asks for it)
+ * isn't framed.
+ */
+struct sl2_frame_header {
+  /*! Always SL2_FRAME_MAGIC */
+  uint8_t magic;
+  /*! Always SL2_FRAME_VERSION */
+  uint8_t version;
+  /*! The request's event */
+  uint8_t event;
+  /*! Some of SL2_FRAME_MORE and SL2_FRAME_NO_REPLY, or 0 */
+  uint8_t flags;
+  /*! The size of the payload that follows the header, in bytes */
+  uint32_t length;
+};
+
 /**
  * Represents the state associated with a mutation, including
  * the function whose input has been mutated, the mutation count,
@@ -109,6 +369,31 @@ struct sl2_mutation {
   size_t bufsize;
   /*! pointer to mutated buffer */
   uint8_t *buffer;
+  /*! seed of the PRNG that a stacked mutation's strategies drew from */
+  uint64_t chain_seed;
+  /*! number of stacked strategies (0 unless mut_type is SL2_HAVOC_STRATEGY) */
+  uint32_t chain_len;
+  /*! table indices of the stacked strategies, in the order they were applied */
+  uint32_t chain[SL2_MAX_MUTATION_CHAIN];
+  /*! capacity of the mutated buffer, if strategies may change bufsize (0 otherwise) */
+  size_t capacity;
+};
+
+/*! The most targeted calls (by function and mutation count) per arena that the server keeps a
+ * strategy schedule of their own for. Runs that mutate any others only teach their arena's. */
+#define SL2_MAX_TARGETS 64
+
+/**
+ * The strategy that the server recommends for a single targeted call, which it learns from the
+ * runs that mutated that call (see EVT_ADVISE_MUTATION).
+ */
+struct sl2_target_advice {
+  /*! The function of the targeted call (see sl2_mutation) */
+  uint32_t function;
+  /*! The mutation count of the targeted call (see sl2_mutation) */
+  uint32_t mut_count;
+  /*! The recommended strategy's table index */
+  uint32_t table_idx;
 };
 
 /**
@@ -128,15 +413,173 @@ struct sl2_crash_paths {
 struct sl2_arena {
   /*! Arena ID - hex string corresponding to target */
   wchar_t id[SL2_HASH_LEN + 1];
-  /*! array (NOT MAP) of bytes, each of which contains hit records for addresses */
-  uint8_t map[FUZZ_ARENA_SIZE];
+  /*! The size of `map` in bytes (see SL2_ARENA_SIZE_VALID), which the server settles on when the
+   * arena is requested (see EVT_GET_ARENA) */
+  uint32_t size;
+  /*! array (NOT MAP) of `size` bytes, each of which contains hit records for addresses. Owned by
+   * whoever allocated (or mapped) the arena */
+  uint8_t *map;
+};
+
+/*! The number of event IDs that the server keeps statistics for. */
+#define SL2_STATS_NUM_EVENTS 34
+
+/**
+ * Statistics for a single event type. Latencies are in microseconds, and percentiles are
+ * rounded up to the next power of two.
+ */
+struct sl2_event_stats {
+  /*! Number of times the event has been handled */
+  uint64_t count;
+  /*! Median handler latency */
+  uint64_t p50_us;
+  /*! 99th percentile handler latency */
+  uint64_t p99_us;
+  /*! Worst handler latency */
+  uint64_t max_us;
+  /*! Total time handlers spent waiting on the strategy map and arena locks */
+  uint64_t lock_wait_us;
+  /*! Total bytes moved over the pipe by the event's handlers */
+  uint64_t bytes;
 };
 
+/**
+ * Written to the named pipe when a client requests the server's statistics
+ */
+struct sl2_server_stats {
+  /*! Number of clients currently connected */
+  uint64_t active_connections;
+  /*! Statistics for each event, indexed by event ID */
+  sl2_event_stats events[SL2_STATS_NUM_EVENTS];
+  /*! Runs counted towards the arenas' path frequencies, and distinct paths, over every arena
+   * (see sl2_coverage_info) */
+  uint64_t path_runs;
+  uint64_t paths;
+};
+
+/*! Starts an arena's time series file ("SL2M") */
+#define SL2_SERIES_MAGIC 0x4D324C53
+
+/*! The version of the time series file. Series of any other version are started over. */
+#define SL2_SERIES_VERSION 1
+
+/**
+ * One interval of an arena's metrics time series. The counts are for the interval alone, and the
+ * score and paths are as of its end.
+ */
+struct sl2_series_sample {
+  /*! When the interval ended, in seconds since the Unix epoch */
+  uint64_t time;
+  /*! Runs merged into the arena */
+  uint64_t execs;
+  /*! Cells that those runs hit for the first time */
+  uint32_t new_cells;
+  /*! The arena's coverage score */
+  uint32_t score;
+  /*! Distinct paths that the arena's runs have taken since the server started */
+  uint64_t paths;
+  /*! Runs that crashed */
+  uint64_t crashes;
+  /*! How long the runs took on average, in microseconds */
+  uint64_t mean_exec_us;
+};
+
+/**
+ * Starts an arena's time series file, which holds a ring of `capacity` samples after it. Also
+ * written to the named pipe when a client requests an arena's series, followed by `count`
+ * samples, oldest first.
+ */
+struct sl2_series_header {
+  /*! Always SL2_SERIES_MAGIC */
+  uint32_t magic;
+  /*! Always SL2_SERIES_VERSION */
+  uint32_t version;
+  /*! The number of seconds between samples */
+  uint32_t interval;
+  /*! How many samples the ring holds */
+  uint32_t capacity;
+  /*! The slot that the next sample goes in */
+  uint32_t next;
+  /*! How many of the slots hold samples */
+  uint32_t count;
+};
+
+/*! Starts the live stats section ("SL2L") */
+#define SL2_LIVE_STATS_MAGIC 0x4C324C53
+
+/*! The version of sl2_live_stats. Readers ignore sections of any other version. */
+#define SL2_LIVE_STATS_VERSION 1
+
+/*! The most arenas that the live stats section has room for. The most recently used ones are
+ * published. */
+#define SL2_LIVE_STATS_ARENAS 64
+
+/*! How often the server republishes its live stats, in milliseconds */
+#define SL2_LIVE_STATS_INTERVAL_MS 500
+
+/**
+ * One arena's totals since the server started, in the live stats section.
+ */
+struct sl2_live_arena {
+  /*! Runs merged into the arena */
+  uint64_t execs;
+  /*! Cells that those runs hit for the first time */
+  uint64_t new_cells;
+  /*! Runs that crashed */
+  uint64_t crashes;
+  /*! How long the runs took altogether, in microseconds */
+  uint64_t exec_us;
+  /*! Distinct paths that the runs took */
+  uint64_t paths;
+  /*! Inputs in the arena's corpus */
+  uint64_t corpus;
+  /*! The arena's coverage score */
+  uint32_t score;
+  uint32_t reserved;
+  /*! The arena's ID, NUL-terminated */
+  wchar_t id[SL2_HASH_LEN + 1];
+  /*! Keeps the arenas 8-byte aligned without any implicit padding */
+  uint16_t padding[3];
+};
+
+/**
+ * The server's live stats, which it rewrites in a named section (see FUZZ_STATS_SECTION) every
+ * SL2_LIVE_STATS_INTERVAL_MS, so that the GUI can poll them without a request or a database
+ * query. Guarded by a seqlock: `seq` is odd while the server is writing, so readers copy the
+ * block and retry unless `seq` was the same even number before and after their copy.
+ */
+struct sl2_live_stats {
+  /*! Always SL2_LIVE_STATS_MAGIC, once the section is ready */
+  uint32_t magic;
+  /*! Always SL2_LIVE_STATS_VERSION */
+  uint32_t version;
+  /*! The seqlock's sequence number */
+  volatile int64_t seq;
+  /*! When the server started, and when the stats were last published, in seconds since the Unix
+   * epoch */
+  uint64_t started;
+  uint64_t published;
+  /*! Number of clients currently connected */
+  uint64_t active_connections;
+  /*! Total events handled, over every event type (see sl2_event_stats) */
+  uint64_t events;
+  /*! Runs counted towards the arenas' path frequencies, and distinct paths, over every arena */
+  uint64_t path_runs;
+  uint64_t paths;
+  /*! How many of `arenas` are in use, and how many arenas the server has altogether */
+  uint32_t arena_count;
+  uint32_t total_arenas;
+  sl2_live_arena arenas[SL2_LIVE_STATS_ARENAS];
+};
+
+static_assert(sizeof(sl2_live_arena) == 192, "live stats arena layout changed");
+
 /**
  * Written to the named pipe when a client requests the coverage info
  */
 struct sl2_coverage_info {
-  /*! SHA256 hash of the most recent arena - used to track unique paths */
+  /*! Hex hash of the most recent arena - used to track unique paths.
+   * 32 characters by default, or 64 when the server hashes paths with SHA256 */
   unsigned char path_hash[SL2_HASH_LEN + 1];
   /*! Whether or not bucketing is turned on */
   bool bucketing;
@@ -144,6 +587,21 @@ struct sl2_coverage_info {
   uint32_t score;
   /*! Number of tries left for the current strategy */
   uint32_t tries_remaining;
+  /*! How many cells the most recent run hit for the first time */
+  uint32_t new_cells;
+  /*! How many already-hit cells the most recent run hit in a new bucket */
+  uint32_t new_buckets;
+  /*! How many runs of the arena the server has seen since it started, how many distinct paths
+   * they took, and how many of those paths were taken exactly once and exactly twice */
+  uint64_t runs;
+  uint64_t paths;
+  uint64_t singletons;
+  uint64_t doubletons;
+  /*! How long the most recent run took, in microseconds, as the server timed it */
+  uint64_t exec_us;
+  /*! Whether the most recent run took so long next to the arena's others that its inputs were kept
+   * out of the corpus (see the server's -T) */
+  bool slow;
 };
 
 #endif
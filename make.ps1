@@ -75,6 +75,7 @@ Function SafeDelete {
 Function Reconfig {
     taskkill.exe /IM test_application.exe /F
     taskkill.exe /IM server.exe /F
+    taskkill.exe /IM supervisor.exe /F
     [Microsoft.VisualBasic.FileIO.FileSystem]::Deletedirectory("$env:APPDATA\Trail of Bits\sl2",'OnlyErrorDialogs','SendToRecycleBin')
 }
 
@@ -106,6 +107,7 @@ Function Deploy {
     New-Item sl2-deploy\build\fuzzer -Type Directory
     New-Item sl2-deploy\build\fuzzgoat -Type Directory
     New-Item sl2-deploy\build\server -Type Directory
+    New-Item sl2-deploy\build\supervisor -Type Directory
     New-Item sl2-deploy\build\tracer -Type Directory
     New-Item sl2-deploy\build\triage -Type Directory
     New-Item sl2-deploy\build\winchecksec -Type Directory
@@ -118,6 +120,7 @@ Function Deploy {
     Copy-Item build\fuzzer\Debug sl2-deploy\build\fuzzer -Recurse -Force
     Copy-Item build\fuzzgoat\Debug sl2-deploy\build\fuzzgoat -Recurse -Force
     Copy-Item build\server\Debug sl2-deploy\build\server -Recurse -Force
+    Copy-Item build\supervisor\Debug sl2-deploy\build\supervisor -Recurse -Force
     Copy-Item build\tracer\Debug sl2-deploy\build\tracer -Recurse -Force
     Copy-Item build\triage\Debug sl2-deploy\build\triage -Recurse -Force
     Copy-Item build\winchecksec\Debug sl2-deploy\build\winchecksec -Recurse -Force
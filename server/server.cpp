@@ -1,18 +1,33 @@
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <list>
+#include <memory>
+#include <algorithm>
+#include <vector>
 #include <cstdlib>
+#include <cstdint>
 #include <mutex>
+#include <atomic>
 #include <shared_mutex>
 #include <cstring>
 #include <cstdio>
+#include <cmath>
+#include <random>
+#include <cwctype>
+#include <cctype>
 
 #define NOMINMAX
+#include <WinSock2.h>
+#include <WS2tcpip.h>
 #include <Windows.h>
-#include <Tlhelp32.h>
 #include <ShlObj.h>
 #include <PathCch.h>
 #include <Rpc.h>
 #include <shellapi.h>
 #include <Strsafe.h>
+#include <DbgHelp.h>
+#include <ProcessSnapshot.h>
 
 #define LOGURU_IMPLEMENTATION 1
 // NOTE(ww): Windows likes to be special. We macro strdup to _strdup
@@ -23,6 +38,17 @@
 #undef strdup
 
 #include "server.hpp"
+#include "common/mutation.hpp"
+#include "common/sl2_ring.hpp"
+#include "common/sl2_delta.hpp"
+#include "common/sl2_fkt.hpp"
+#include "common/sl2_etw.hpp"
+#include "common/sl2_affinity.hpp"
+#include "common/sl2_compress.hpp"
+#include "common/sl2_simd.hpp"
+#include "arena_kernels.hpp"
+
+SL2_ETW_DEFINE_PROVIDER();
 
 /*! Convenience macros for logging. */
 #define SL2_SERVER_LOG(level, fmt, ...) LOG_F(level, __FUNCTION__ ": " fmt, __VA_ARGS__)
@@ -32,18 +58,355 @@
 #define SL2_SERVER_LOG_GLE(level, fmt, ...)                                                        \
   SL2_SERVER_LOG(level, "(GLE=%lu) " fmt, GetLastError(), __VA_ARGS__)
 #define SL2_SERVER_LOG_INFO(fmt, ...) SL2_SERVER_LOG(INFO, fmt, __VA_ARGS__)
+// Per-event detail goes here, so that it isn't even formatted unless asked for (-L 1).
+#define SL2_SERVER_LOG_DEBUG(fmt, ...) SL2_SERVER_LOG(1, fmt, __VA_ARGS__)
 #define SL2_SERVER_LOG_WARN(fmt, ...) SL2_SERVER_LOG_GLE(WARNING, fmt, __VA_ARGS__)
 #define SL2_SERVER_LOG_ERROR(fmt, ...) SL2_SERVER_LOG_GLE(ERROR, fmt, __VA_ARGS__)
 #define SL2_SERVER_LOG_FATAL(fmt, ...) SL2_SERVER_LOG_GLE(FATAL, fmt, __VA_ARGS__)
 
+/*! The number of pipe instances we keep listening for new clients at any given time. */
+#define SL2_SERVER_LISTENERS 8
+
+/*! The number of power-of-two buckets in each event's latency histogram. */
+#define SL2_STATS_BUCKETS 32
+
+/*! Running statistics for a single event type. See sl2_event_stats. */
+struct sl2_event_counters {
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> max_us;
+  std::atomic<uint64_t> lock_wait_us;
+  std::atomic<uint64_t> bytes;
+  /*! Bucket i counts handlers that took less than 2^i microseconds (and at least 2^(i-1)) */
+  std::atomic<uint64_t> latency[SL2_STATS_BUCKETS];
+};
+
+/*! The most inputs that an arena's corpus holds. Once it's full, new inputs replace the oldest. */
+#define SL2_CORPUS_SIZE 64
+
+/*! The most targeted reads per run whose inputs are kept for the corpus. */
+#define SL2_CORPUS_MAX_READS 8
+
+/*! The largest input that's kept for the corpus, in bytes. */
+#define SL2_CORPUS_MAX_BUFSIZE (256 * 1024)
+
+/*! How many of an arena's recent run times its median is taken over, and how many it needs before
+ * any of its runs can be slow */
+#define SL2_EXEC_WINDOW 256
+#define SL2_EXEC_MIN_SAMPLES 32
+
+/*! The most raw arena fingerprints (see EVT_FINALIZE_PATH) that an arena remembers the paths of.
+ * Once it's full, runs on new paths are still merged, but no longer remembered. */
+#define SL2_MAX_KNOWN_PATHS 16384
+
+/*! A path that an arena's runs have taken, as remembered by its runs' raw arena fingerprint */
+struct sl2_known_path {
+  /*! The path's hash, in hex (see path_hash_hex), as of the run that was merged */
+  unsigned char path_hash[SL2_HASH_LEN + 1];
+  /*! That run's own score */
+  uint32_t run_score;
+};
+
+/*! An input that increased an arena's coverage, kept as a splice donor and a seed */
+struct sl2_corpus_entry {
+  /*! The targeted read that the input was given to */
+  uint32_t mut_count;
+  std::vector<uint8_t> buf;
+  /*! The entry's place in the order that inputs joined the corpus, counting from 1 */
+  uint64_t seq;
+  /*! The node that the input came from: 0 for our own fuzzers, SL2_SYNC_COORDINATOR for inputs
+   * pulled from the coordinator */
+  uint64_t origin;
+  /*! How long the run that found the input took, in microseconds (0 if unknown, e.g. for inputs
+   * from other nodes) */
+  uint64_t exec_us;
+  /*! The path (see path_key) of the run that found the input (0 if unknown) */
+  uint64_t path;
+  /*! How many times the seed queue has come around to the entry (see next_seed) */
+  uint32_t picks;
+  /*! How many times the entry has been handed out as a seed */
+  uint64_t execs;
+  /*! How far the run that found the input got from its directed targets (see EVT_FINALIZE_PATH),
+   * or SL2_DISTANCE_NONE. Kept in memory only */
+  uint32_t distance;
+};
+
+/*! The extension of the file (next to its arena's) that an arena's corpus is kept in. */
+#define SL2_CORPUS_FILE_EXT L".corpus"
+
+/*! The extension of the directory (next to its arena's file) that an arena's seed archive is kept
+ * in: the seeds that compact FKT records were made from (see SL2_FKT_CHAIN), one file each. */
+#define SL2_SEED_ARCHIVE_EXT L".seeds"
+
+/*! The extension of the file (next to its arena's) that an arena's unstable cells are kept in. */
+#define SL2_UNSTABLE_FILE_EXT L".unstable"
+
+/*! The extension of the file (next to its arena's) that an arena's metrics time series is kept in.
+ * See sl2_series_header. */
+#define SL2_SERIES_FILE_EXT L".series"
+
+/*! Starts an arena's corpus file ("SL2C") */
+#define SL2_CORPUS_MAGIC 0x43324C53
+
+/*! The version of the corpus file. Corpora of any other version are ignored, except for version 1
+ * corpora, whose entries are read without their seed statistics. */
+#define SL2_CORPUS_VERSION 2
+
+/*! Starts an arena's corpus file, and is followed by its entries */
+struct sl2_corpus_file_header {
+  /*! Always SL2_CORPUS_MAGIC */
+  uint32_t magic;
+  /*! Always SL2_CORPUS_VERSION */
+  uint32_t version;
+  /*! The number of entries that follow */
+  uint32_t count;
+  /*! The corpus's corpus_next */
+  uint32_t next;
+};
+
+/*! Precedes each entry's bytes in an arena's corpus file. See sl2_corpus_entry */
+struct sl2_corpus_file_entry {
+  uint32_t mut_count;
+  uint32_t picks;
+  uint64_t seq;
+  uint64_t origin;
+  uint64_t exec_us;
+  /*! The number of bytes that follow */
+  uint64_t size;
+  /*! Version 1 entries end here */
+  uint64_t path;
+  uint64_t execs;
+};
+
+/*! The inputs that a session has registered so far, by mutation count. They're added to the
+ * arena's corpus if the run increases its coverage, and dropped once the run is merged. */
+typedef std::map<uint32_t, std::vector<uint8_t>> sl2_run_inputs_t;
+
+/*! The targeted calls (see sl2_target_key) that a session's run has mutated since its coverage
+ * was last merged */
+typedef std::set<uint64_t> sl2_run_targets_t;
+
+/**
+ * @param function the targeted call's function (see sl2_mutation)
+ * @param mut_count the targeted call's mutation count (see sl2_mutation)
+ * @return the key that the targeted call's own strategy schedule is kept under
+ */
+static inline uint64_t sl2_target_key(uint32_t function, uint32_t mut_count) {
+  return ((uint64_t)function << 32) | mut_count;
+}
+
+/**
+ * @param arena an arena allocated by alloc_arena or map_arena_file
+ * @return whether the arena's map is a view of its file (see map_arena_file), rather than memory
+ *         right after it
+ */
+static inline bool sl2_arena_mapped(const sl2_arena *arena) {
+  return arena->map != (uint8_t *)(arena + 1);
+}
+
+/*! Frees an arena allocated by alloc_arena, or unmaps one mapped by map_arena_file */
+struct sl2_arena_deleter {
+  void operator()(sl2_arena *arena) const {
+    if (sl2_arena_mapped(arena)) {
+      UnmapViewOfFile(arena->map);
+    }
+
+    free(arena);
+  }
+};
+
+/*! An arena that the server owns, map and all (see alloc_arena) */
+typedef std::unique_ptr<sl2_arena, sl2_arena_deleter> sl2_arena_ptr;
+
+/*! Which fuzzing strategy is recommended, and what the scheduler has learned about each of them.
+ * Kept for each arena, and for each of the arena's targeted calls */
+struct sl2_schedule {
+  uint32_t strategy;
+  /*! How many more runs that don't increase coverage the strategy gets (see strategy_stickiness) */
+  uint32_t tries_remaining;
+  std::map<uint32_t, int64_t> success_map;
+  /*! How many runs each strategy has been used for */
+  uint64_t pulls[SL2_NUM_STRATEGIES];
+  /*! How many of those runs increased coverage */
+  uint64_t rewards[SL2_NUM_STRATEGIES];
+};
+
+/*! Where a targeted read's walk over its arena's seeds is (power schedules only) */
+struct sl2_seed_queue {
+  /*! The seq of the seed that's being handed out, or 0 before the first */
+  uint64_t seq;
+  /*! How many more times it's handed out before the queue moves on */
+  uint32_t energy;
+};
+
 /*! Stores metadata for a given arena, like the last score and which fuzzing strategy was
  * recommended */
-struct strategy_state {
-  sl2_arena arena;
+struct strategy_state : sl2_schedule {
+  /*! Guards everything below. Taken exclusively to update the state, shared to read it */
+  std::shared_mutex mutex;
+  /*! Whether the arena has been loaded from (or created on) the disk yet */
+  bool loaded;
+  /*! Whether the arena has changed since it was last written to the disk */
+  bool dirty;
+  /*! The merged arena, or NULL while it's evicted to the disk (see evict_arena) */
+  sl2_arena_ptr arena;
+  /*! The size of the arena's map, fixed once the arena has been loaded (and kept while it's
+   * evicted) */
+  uint32_t map_size;
   uint32_t score;
+  /*! The path hash of the arena's most recent run, and that run's own score (for its coverage
+   * info). Only these are kept, rather than the run's whole arena */
+  unsigned char path_hash[SL2_HASH_LEN + 1];
+  uint32_t run_score;
+  /*! How many times each path (see path_key) has been taken since the server started, kept
+   * while the arena is evicted */
+  std::unordered_map<uint64_t, uint32_t> path_counts;
+  /*! How many runs have been counted in path_counts, and how many of its paths were taken
+   * exactly once and exactly twice (for a Chao1 estimate of how many paths are left) */
+  uint64_t path_runs;
+  uint64_t path_singletons;
+  uint64_t path_doubletons;
+  /*! The paths of the arena's merged runs, by their raw arenas' fingerprints, so that a run that
+   * retraces one of them is counted without sending or merging its arena (see
+   * EVT_FINALIZE_PATH). Kept in memory only, and forgotten whenever the unstable cells change */
+  std::unordered_map<uint64_t, sl2_known_path> known_paths;
+  /*! When a run last requested or returned the arena (GetTickCount64) */
+  std::atomic<uint64_t> last_used;
+  /*! The schedules of the arena's targeted calls (by sl2_target_key), each of which only learns
+   * from the runs that mutated its call. Up to SL2_MAX_TARGETS of them, started from the arena's
+   * own schedule, and kept in memory only */
+  std::map<uint64_t, sl2_schedule> target_schedules;
+  /*! The next deterministic mutation to hand out. Written to the disk along with the arena */
+  sl2_det_cursor cursor;
+  /*! Inputs that increased the arena's coverage, for splicing and seeding. Written to the disk
+   * next to the arena (see dump_corpus_to_disk) */
+  std::vector<sl2_corpus_entry> corpus;
+  /*! Whether the corpus has changed since it was last written to the disk */
+  bool corpus_dirty;
+  /*! The corpus entry that the next input replaces, once the corpus is full */
+  size_t corpus_next;
+  /*! How many inputs have ever joined the corpus (the newest entry's seq) */
+  uint64_t corpus_seq;
+  /*! Each targeted read's seed queue. Kept in memory only, unlike its seeds' statistics */
+  sl2_seed_queue seed_queues[SL2_CORPUS_MAX_READS];
+  /*! The arena's virgin map: the buckets (see bucket_bit) that each of its cells has been hit in
+   * by a run. Rebuilt from the map whenever the arena is loaded (see absorb_virgin) */
+  std::vector<uint8_t> virgin;
+  /*! How many new cells, and new buckets of already-hit cells, the arena's most recent run hit */
+  uint32_t run_new_cells;
+  uint32_t run_new_buckets;
+  /*! How long the arena's most recent run took (in microseconds), and whether it was slow */
+  uint64_t run_exec_us;
+  bool run_slow;
+  /*! The arena's recent run times, in microseconds, as a ring of the last SL2_EXEC_WINDOW (kept
+   * in memory only), and how many runs have been timed */
+  uint64_t exec_window[SL2_EXEC_WINDOW];
+  uint64_t exec_samples;
+  /*! The arena's unstable cells (see EVT_SET_UNSTABLE), sorted, which are masked out of every run
+   * before it's merged or scored. Written to the disk next to the arena, and kept while it's
+   * evicted */
+  std::vector<uint32_t> unstable;
+  /*! The arena's map as of its last sync with the coordinator (nodes only, empty until then) */
+  std::vector<uint8_t> synced_map;
+  /*! The bandit statistics as of the last sync (nodes only) */
+  uint64_t synced_pulls[SL2_NUM_STRATEGIES];
+  uint64_t synced_rewards[SL2_NUM_STRATEGIES];
+  /*! The coordinator's corpus_seq as of the last sync (nodes only) */
+  uint64_t synced_corpus_seq;
+  /*! Our corpus_seq as of the last sync, i.e. the last of our inputs that we've pushed */
+  uint64_t pushed_corpus_seq;
+  /*! What the arena's runs have done since its last time series sample (see sample_series): how
+   * many were merged, the new cells that they hit, how many crashed, and how long they took */
+  uint64_t series_execs;
+  uint64_t series_new_cells;
+  uint64_t series_crashes;
+  uint64_t series_exec_us;
+  /*! The same, since the server started, for the live stats (see publish_live_stats) */
+  uint64_t live_execs;
+  uint64_t live_new_cells;
+  uint64_t live_crashes;
+  uint64_t live_exec_us;
+  /*! Whether any of the arena's runs has reported a distance from its directed targets, and the
+   * closest that one has come (see EVT_FINALIZE_PATH). Kept in memory only */
+  bool directed;
+  uint32_t best_distance;
+};
+
+/*! Starts the strategy snapshot that follows an arena's map and cursor on the disk ("SL2T") */
+#define SL2_SNAPSHOT_MAGIC 0x54324C53
+
+/*! The version of sl2_strategy_snapshot. Bumped whenever it changes; snapshots of any other
+ * version are ignored, and their arenas relearn their strategies from scratch. */
+#define SL2_SNAPSHOT_VERSION 1
+
+/**
+ * What an arena's strategy state keeps across restarts, besides its map and cursor: which
+ * strategy it's on, the schedulers' statistics, and how far its corpus has been synced. Written
+ * after the cursor whenever the arena is, and read back when the arena is first loaded.
+ * The corpus itself has its own file (see dump_corpus_to_disk).
+ */
+struct sl2_strategy_snapshot {
+  /*! Always SL2_SNAPSHOT_MAGIC */
+  uint32_t magic;
+  /*! Always SL2_SNAPSHOT_VERSION */
+  uint32_t version;
+  /*! SL2_NUM_STRATEGIES when the snapshot was taken, since the arrays below are sized by it */
+  uint32_t num_strategies;
   uint32_t strategy;
   uint32_t tries_remaining;
-  std::map<uint32_t, int64_t> success_map;
+  /*! The success map, indexed by strategy */
+  int64_t successes[SL2_NUM_STRATEGIES];
+  uint64_t pulls[SL2_NUM_STRATEGIES];
+  uint64_t rewards[SL2_NUM_STRATEGIES];
+  uint64_t synced_pulls[SL2_NUM_STRATEGIES];
+  uint64_t synced_rewards[SL2_NUM_STRATEGIES];
+  uint64_t corpus_seq;
+  uint64_t synced_corpus_seq;
+  uint64_t pushed_corpus_seq;
+};
+
+/*! The ways we can pick the next mutation strategy for an arena */
+enum sl2_scheduler {
+  /*! Stick with a strategy until it stops paying off, then take the most successful one */
+  SL2_SCHEDULER_LEGACY,
+  /*! Treat the strategies as a multi-armed bandit and pick the one with the best UCB1 bound */
+  SL2_SCHEDULER_UCB1,
+  /*! Treat the strategies as a multi-armed bandit and pick them by Thompson sampling */
+  SL2_SCHEDULER_THOMPSON,
+};
+
+/*! The ways we can hand out an arena's seeds (see next_seed). Except for the weighted default,
+ * these are AFLFast's power schedules: the seed queue is walked in order, and each seed is handed
+ * out as many times in a row as its energy, which is based on its seed_weight */
+enum sl2_power_schedule {
+  /*! Pick every seed at random, in proportion to its seed_weight */
+  SL2_POWER_WEIGHTED,
+  /*! Energy grows with each pass over the seed, and shrinks with how often its path is taken */
+  SL2_POWER_FAST,
+  /*! Like fast, but seeds whose paths are taken more often than average get no energy at all */
+  SL2_POWER_COE,
+  /*! Every seed gets its baseline energy, cut by SL2_SEED_ENERGY_BETA */
+  SL2_POWER_EXPLORE,
+  /*! Every seed gets its whole baseline energy, as AFL itself does */
+  SL2_POWER_EXPLOIT,
+};
+
+/*! The energy of an average seed under the exploit schedule, in seeds handed out */
+#define SL2_SEED_ENERGY 16
+
+/*! How much less energy the other power schedules start a seed with than exploit (β in AFLFast) */
+#define SL2_SEED_ENERGY_BETA 4
+
+/*! The most energy that a seed gets */
+#define SL2_SEED_MAX_ENERGY 1024
+
+/*! The ways we can hash a raw arena into a path identifier */
+enum sl2_path_hash {
+  /*! A 128-bit xxHash-style hash of the whole map (the default) */
+  SL2_PATH_HASH_FAST,
+  /*! The same hash, folded over only the nonzero 64-bit words of the map */
+  SL2_PATH_HASH_SPARSE,
+  /*! SHA256 of the whole map, for compatibility with older path databases */
+  SL2_PATH_HASH_SHA256,
 };
 
 /*! Store server command line options */
@@ -52,184 +415,565 @@ struct server_opts {
   bool dump_mut_buffer;
   /*! Whether we should pin the server to one CPU core */
   bool pinned;
+  /*! The NUMA node that the server (and its shared arenas) should be placed on, or -1 for any */
+  int numa_node;
   /*! Whether score bucketing should be enabled */
   bool bucketing;
   /*! How long to stick with a given strategy if it's stopped yielding results */
   uint32_t stickiness;
+  /*! How often (in seconds) to write dirty arenas to the disk. 0 writes them after every run */
+  uint32_t checkpoint_interval;
+  /*! How raw arenas are hashed into path identifiers */
+  sl2_path_hash path_hash;
+  /*! Whether mutations are appended to a per-run journal instead of individual FKT files */
+  bool journal_mutations;
+  /*! Whether stacked mutations made from corpus seeds are stored as compact FKT records (see
+   * SL2_FKT_CHAIN), unless their runs crash */
+  bool compact_fkts;
+  /*! Whether crash dumps and arenas are compressed on the disk (see sl2_compress.hpp), and
+   * mutation journals are NTFS-compressed */
+  bool compress;
+  /*! Whether arenas are mapped from their files instead of read into memory (see map_arena_file).
+   * Ignored with -z, since compressed arenas can't be mapped */
+  bool mmap_arenas;
+  /*! How the next mutation strategy is picked */
+  sl2_scheduler scheduler;
+  /*! How seeds are handed out */
+  sl2_power_schedule power_schedule;
+  /*! The size of each pipe instance's in and out buffers, in bytes */
+  uint32_t pipe_buffer_size;
+  /*! Whether pipes are message pipes, which deliver each framed request in a single read */
+  bool message_pipes;
+  /*! The TCP port that we coordinate other nodes on, or 0 if we're not a coordinator */
+  uint16_t coordinator_port;
+  /*! The coordinator that we sync with (as a node), if any */
+  char coordinator_host[256];
+  char coordinator_service[16];
+  /*! How often (in seconds) a node syncs with its coordinator */
+  uint32_t sync_interval;
+  /*! The most bytes of FKT records that the replay cache holds. 0 disables the cache */
+  size_t replay_cache_bytes;
+  /*! How long (in seconds) an arena may go without runs before it's evicted to the disk. 0 keeps
+   * every arena in memory */
+  uint32_t evict_idle;
+  /*! How many times its arena's median run time a run may take before it's slow (see
+   * is_slow_run). 0 never treats runs as slow */
+  uint32_t slow_factor;
+  /*! The log file's verbosity (a loguru::Verbosity). EVT_SET_LOG_LEVEL changes it afterwards */
+  int log_verbosity;
+  /*! How often (in seconds) each busy arena's metrics are sampled into its time series. 0 keeps
+   * no time series */
+  uint32_t series_interval;
+};
+
+/*! The magic at the start of every sync message between a node and its coordinator ("SL2S") */
+#define SL2_SYNC_MAGIC 0x53324C53
+
+/*! The version of the sync messages below. Nodes and coordinators must run the same version. */
+#define SL2_SYNC_VERSION 3
+
+/*! The default number of seconds between a node's syncs with its coordinator. */
+#define SL2_SYNC_INTERVAL 30
+
+/*! How long (in seconds) either end of a sync waits on the other before giving up. */
+#define SL2_SYNC_TIMEOUT 60
+
+/*! The most arenas that a single sync carries. */
+#define SL2_SYNC_MAX_ARENAS 4096
+
+/*! The most that an arena's (sparse) coverage map of `size` bytes takes up in a sync. */
+#define SL2_SYNC_MAX_COVERAGE(size) (2 * (size))
+
+/*! The origin of corpus entries that a node pulled from its coordinator */
+#define SL2_SYNC_COORDINATOR UINT64_MAX
+
+/**
+ * Starts every sync message, in both directions. A node's request is followed by an
+ * sl2_sync_arena for each of its arenas, and the coordinator's reply by one for each of
+ * those arenas, in the same order.
+ */
+struct sl2_sync_header {
+  /*! Always SL2_SYNC_MAGIC */
+  uint32_t magic;
+  /*! Always SL2_SYNC_VERSION */
+  uint32_t version;
+  /*! The node that sent the request (0 in replies) */
+  uint64_t node_id;
+  /*! The number of arenas that follow */
+  uint32_t arenas;
+};
+
+/**
+ * An arena in a sync message. It's followed by `coverage_size` bytes of coverage (an sl2_delta
+ * against an empty map), and then `corpus_count` corpus entries, each an sl2_sync_input followed
+ * by its bytes.
+ * From a node, the coverage, statistics and corpus entries are what the arena gained since the
+ * node's last sync. From the coordinator, they're the merged arena's, and the entries that the
+ * node hasn't seen yet.
+ */
+struct sl2_sync_arena {
+  wchar_t id[SL2_HASH_LEN + 1];
+  uint64_t pulls[SL2_NUM_STRATEGIES];
+  uint64_t rewards[SL2_NUM_STRATEGIES];
+  /*! From a node: the coordinator corpus_seq that it's seen. From the coordinator: its own */
+  uint64_t corpus_seq;
+  uint32_t corpus_count;
+  /*! The size of the arena's map. Arenas only merge with arenas of the same size */
+  uint32_t map_size;
+  uint32_t coverage_size;
+};
+
+/*! A corpus entry in a sync message */
+struct sl2_sync_input {
+  uint32_t mut_count;
+  uint32_t size;
+};
+
+/*! Per-session arena state: the shared section that the client records its coverage into (if
+ * any), and the buffer that its arena is read into otherwise */
+struct sl2_arena_mapping {
+  /*! The named file mapping backing the client's arena */
+  HANDLE section;
+  /*! The client's mapped arena (`shared`), or NULL if it doesn't have one */
+  sl2_arena *arena;
+  /*! The mapped arena's ID and size, and the server's view of its map */
+  sl2_arena shared;
+  /*! Where an unmapped arena's map is read into (see read_run_arena), reused from run to run */
+  std::vector<uint8_t> run_map;
+};
+
+/*! Per-session upload state: the shared section that the client puts its large mutations into
+ * (see EVT_MAP_UPLOAD) */
+struct sl2_upload_section {
+  /*! The named file mapping backing the section, or NULL if the session doesn't have one */
+  HANDLE section;
+  /*! The server's view of the section */
+  uint8_t *view;
+  /*! The size of the section */
+  size_t size;
+};
+
+/*! How many of a ring's most recent mutations the server keeps, so that fuzzers can register
+ * them by position. The server can only get SL2_RING_SLOTS ahead of the fuzzers, so a
+ * mutation is only forgotten after the fuzzers have claimed this many more after it. */
+#define SL2_RING_JOURNAL_SLOTS (4 * SL2_RING_SLOTS)
+
+/*! The most mutation rings the server will create. */
+#define SL2_MAX_RINGS 256
+
+/*! A mutation that the server generated into a ring, kept until a fuzzer registers it */
+struct sl2_ring_entry {
+  /*! The mutation's position in the ring, or -1 if the entry hasn't been used yet */
+  int64_t seq;
+  uint32_t mut_type;
+  std::vector<uint8_t> buf;
+};
+
+/*! Server-side state for a ring of pre-generated mutations */
+struct sl2_ring_state {
+  /*! Guards the generator and the journal. Held for the whole of a fill */
+  std::mutex mutex;
+  /*! The named file mapping backing the ring */
+  HANDLE section;
+  /*! The server's view of the ring */
+  sl2_mutation_ring *ring;
+  /*! The strategy state of the ring's arena, whose advice the ring follows */
+  strategy_state *strategy;
+  /*! The unmutated read that every mutation in the ring starts from */
+  std::vector<uint8_t> original;
+  sl2_rng rng;
+  /*! Whether a fill is queued or running */
+  std::atomic<bool> filling;
+  /*! The ring's recent mutations, indexed by position modulo SL2_RING_JOURNAL_SLOTS */
+  sl2_ring_entry journal[SL2_RING_JOURNAL_SLOTS];
+};
+
+/*! The length of a stringified UUID, not including its terminator */
+#define SL2_UUID_LEN 36
+
+/*! A run that an event is for, with its ID already stringified and its directory resolved */
+struct sl2_run_ref {
+  UUID run_id;
+  wchar_t run_id_s[SL2_UUID_LEN + 1];
+  /*! The run's directory, under FUZZ_WORKING_PATH */
+  wchar_t run_dir[MAX_PATH + 1];
+};
+
+/*! What a client has bound its session to with EVT_SESSION_BEGIN. Events on a bound session
+ * don't carry their run ID. */
+struct sl2_session {
+  /*! Whether the session is bound to a run */
+  bool bound;
+  sl2_run_ref run;
+};
+
+/*! A seed that a session's run was handed (see EVT_SEED), kept for storing the mutations made
+ * from it compactly (see compact_fkt) */
+struct sl2_served_seed {
+  std::wstring arena_id;
+  /*! The seed's place in its arena's corpus */
+  uint64_t seq;
+  /*! The seed, as it was handed out */
+  std::vector<uint8_t> buf;
+  /*! Whether the seed is in its arena's seed archive yet */
+  bool archived;
+};
+
+/*! The seeds that a session's run has been handed, by mutation count */
+typedef std::map<uint32_t, sl2_served_seed> sl2_served_seeds_t;
+
+/*! The full FKT record of a mutation that was stored compactly, kept until its run is finalized,
+ * since a run that crashed gets its full records after all (see settle_compact_fkts) */
+struct sl2_pending_fkt {
+  sl2_run_ref run;
+  /*! The record, preceded by room for its journal entry (see serialize_fkt) */
+  std::vector<uint8_t> record;
 };
 
-/*! maps different targets to their arenas */
+/*! The compactly stored mutations of a session's run, by mutation count */
+typedef std::map<uint32_t, sl2_pending_fkt> sl2_pending_fkts_t;
+
+/*! State for a single pipe instance, from the time it starts listening until its session ends */
+struct sl2_pipe_ctx {
+  /*! Overlapped state for the pending connect or event read on this pipe */
+  OVERLAPPED ov;
+  /*! The pipe instance itself */
+  HANDLE pipe;
+  /*! Whether a client has connected to this instance yet */
+  bool connected;
+  /*! The most recently read event */
+  uint8_t event;
+  /*! The session's shared arena (if any) */
+  sl2_arena_mapping mapping;
+  /*! The session's upload section (if any) */
+  sl2_upload_section upload;
+  /*! The inputs that the session's run has registered since its coverage was last merged */
+  sl2_run_inputs_t inputs;
+  /*! The targeted calls that the session's run has mutated since its coverage was last merged */
+  sl2_run_targets_t targets;
+  /*! The seeds that the session's run has been handed (with -K only) */
+  sl2_served_seeds_t seeds;
+  /*! The session's run's compactly stored mutations, until the run is finalized */
+  sl2_pending_fkts_t pending;
+  /*! The payload of the framed request being handled, reused from request to request. On message
+   * pipes, the first message of each request is read straight into it. */
+  std::vector<uint8_t> frame;
+  /*! How many bytes the session's last event read took. More than one only on message pipes */
+  DWORD received;
+  /*! The run that the session is bound to, if any */
+  sl2_session session;
+  /*! When the session's current run started (QueryPerformanceCounter): when the client connected,
+   * or when its last run was merged */
+  uint64_t run_started;
+};
+
+/*! maps different targets to their arenas.
+ * Entries are never removed, so pointers to them stay valid once strategy_mutex
+ * is released. strategy_mutex only guards the map itself; each entry has its own lock. */
 typedef std::map<std::wstring, strategy_state> sl2_strategy_map_t;
 
+/*! maps mutation ring section names to their rings */
+typedef std::map<std::wstring, sl2_ring_state> sl2_ring_map_t;
+
+/*! The default number of seconds between arena checkpoints. */
+#define SL2_CHECKPOINT_INTERVAL 5
+
+/*! The default number of seconds that an arena may go without runs before it's evicted. */
+#define SL2_EVICT_IDLE 600
+
+/*! The default number of seconds between samples of an arena's metrics time series. */
+#define SL2_SERIES_INTERVAL 60
+
+/*! How many samples an arena's time series keeps before it wraps around: a week's worth, at the
+ * default interval. */
+#define SL2_SERIES_CAPACITY 10080
+
+/*! The default size of the replay cache, in MiB. */
+#define SL2_REPLAY_CACHE_MB 64
+
+/*! By default, runs that take more than this many times their arena's median run time are slow,
+ * and their inputs are kept out of the corpus. */
+#define SL2_SLOW_FACTOR 10
+
+/*! The most bytes of log lines that can wait for the log writer. Past this, lines are dropped
+ * (and counted) rather than making handlers wait on the disk. */
+#define SL2_LOG_BUFFER_BYTES (4 * 1024 * 1024)
+
+/*! How often (in milliseconds) the log writer writes out the lines that are waiting. */
+#define SL2_LOG_WRITE_INTERVAL 250
+
+/*! The loguru callback that queues lines for the log writer. */
+#define SL2_LOG_CALLBACK "sl2_log_writer"
+
+/*! The largest FKT record that the replay cache holds; bigger ones are always read from disk. */
+#define SL2_REPLAY_CACHE_MAX_RECORD (4 * 1024 * 1024)
+
+/*! Identifies a registered mutation: its run, and its mutation count within the run */
+struct sl2_replay_key {
+  UUID run_id;
+  uint32_t mut_count;
+
+  bool operator<(const sl2_replay_key &other) const {
+    int cmp = memcmp(&run_id, &other.run_id, sizeof(run_id));
+    return cmp < 0 || (cmp == 0 && mut_count < other.mut_count);
+  }
+};
+
+/*! Recently registered FKT records, most recently used first */
+typedef std::list<std::pair<sl2_replay_key, std::vector<uint8_t>>> sl2_replay_lru_t;
+
 static server_opts opts = {0};
 
+/*! The campaign's configuration (see EVT_SET_CONFIG), and what serializes changes to it. Its
+ * server fields mirror opts, which handlers keep reading without the lock */
+static std::mutex campaign_mutex;
+static sl2_campaign_config campaign = {0};
+
 static HANDLE process_mutex = INVALID_HANDLE_VALUE;
+static HANDLE iocp = NULL;
+
+/*! Per-worker event for waiting on the overlapped pipe I/O performed by event handlers */
+static thread_local HANDLE io_event = NULL;
+
+static LARGE_INTEGER perf_frequency;
+static sl2_event_counters event_counters[SL2_STATS_NUM_EVENTS];
+static std::atomic<uint64_t> active_connections;
+
+/*! Pipe bytes and lock waits (in performance counter ticks) for the event being handled */
+static thread_local uint64_t event_bytes = 0;
+static thread_local uint64_t event_lock_ticks = 0;
+
+/*! The unread part of the framed request being handled, which pipe_read reads from first */
+static thread_local const uint8_t *frame_next = NULL;
+static thread_local size_t frame_left = 0;
+/*! Whether the request being handled asked not to be answered (SL2_FRAME_NO_REPLY) */
+static thread_local bool frame_no_reply = false;
+
+/**
+ * @param start a performance counter reading
+ * @return the microseconds since `start`
+ */
+static uint64_t us_since(LARGE_INTEGER start) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+
+  return ((now.QuadPart - start.QuadPart) * 1000000) / perf_frequency.QuadPart;
+}
+
+/*! Identifies this server to its coordinator, if it has one */
+static uint64_t node_id = 0;
 
 static wchar_t FUZZ_WORKING_PATH[MAX_PATH] = L"";
 static wchar_t FUZZ_ARENAS_PATH[MAX_PATH] = L"";
 static wchar_t FUZZ_LOG[MAX_PATH] = L"";
 
+/*! This server's instance name (-n), or empty for the default instance */
+static wchar_t server_instance[FUZZ_SERVER_INSTANCE_MAX + 1] = L"";
+/*! The pipe that this server listens on, and the mutex that it holds: its instance's */
+static wchar_t FUZZ_SERVER_PIPE[MAX_PATH] = L"";
+static wchar_t FUZZ_SERVER_LOCK[MAX_PATH] = L"";
+
+/*! The log file, which the log writer writes to (see init_logging) */
+static FILE *log_file = NULL;
+/*! Log lines waiting for the log writer, and how many have been dropped since it last wrote */
+static std::mutex log_mutex;
+static std::string log_pending;
+static uint64_t log_dropped = 0;
+/*! The lines that the log writer is writing out. Guarded by log_write_mutex */
+static std::mutex log_write_mutex;
+static std::string log_writing;
+/*! Wakes the log writer early, when lines are piling up */
+static HANDLE log_wake = NULL;
+/*! Serializes changes to the log file's verbosity */
+static std::mutex log_verbosity_mutex;
+static std::atomic<int> log_verbosity;
+
 static std::shared_mutex pid_mutex;
 static std::shared_mutex fkt_mutex;
-static std::shared_mutex arena_mutex;
 static std::shared_mutex strategy_mutex;
+static std::mutex checkpoint_mutex;
+/*! Serializes access to the arenas' time series files */
+static std::mutex series_mutex;
 static sl2_strategy_map_t strategy_map;
 
-/** Gets the processor affinity mask for the given process ID.
- *
- * @param pid
- * @param mask
- * @return
- */
-static bool get_process_affinity(uint32_t pid, uint64_t *mask) {
-  HANDLE handle;
-  uint64_t system_affinity;
+/*! Guards ring_map and rings. Like strategy_map, rings are never removed. */
+static std::shared_mutex ring_mutex;
+/*! Maps ring section names to their rings */
+static sl2_ring_map_t ring_map;
+/*! Maps ring IDs to their rings */
+static std::vector<sl2_ring_state *> rings;
+
+/*! Guards the replay cache */
+static std::mutex replay_cache_mutex;
+/*! The replay cache's records, and where each of them is in the LRU list */
+static sl2_replay_lru_t replay_lru;
+static std::map<sl2_replay_key, sl2_replay_lru_t::iterator> replay_cache;
+/*! How many bytes of records the replay cache holds */
+static size_t replay_cache_size = 0;
+
+/*! The NUMA node that the server runs on (see -p and -numa), or NUMA_NO_PREFERRED_NODE. Shared
+ * arena and ring sections are allocated on it, so that they're local to the shard's workers */
+static DWORD server_numa_node = NUMA_NO_PREFERRED_NODE;
 
-  if (!(handle = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid))) {
-    SL2_SERVER_LOG_WARN("couldn't open process for pid=%d", pid);
-    *mask = -1;
-    return false;
+/**
+ * Restricts the server to some of a single processor group's processors.
+ * Only a job can move a process's threads out of its primary group, so on hosts with
+ * more than one group the server puts itself in a job of its own.
+ * @param group the group
+ * @param mask the group's processors
+ * @return success
+ */
+static bool set_server_affinity(WORD group, KAFFINITY mask) {
+  if (GetActiveProcessorGroupCount() == 1) {
+    return SetProcessAffinityMask(GetCurrentProcess(), mask);
   }
 
-  if (!GetProcessAffinityMask(handle, mask, &system_affinity)) {
-    SL2_SERVER_LOG_WARN("couldn't get process affinity for pid=%d", pid);
-    *mask = -1;
+  HANDLE job = CreateJobObject(NULL, NULL);
+
+  if (!job) {
     return false;
   }
 
-  CloseHandle(handle);
-
-  return true;
+  // The job is left open for as long as we run, and goes away with us.
+  return sl2_set_job_group_affinity(job, group, mask) &&
+         AssignProcessToJobObject(job, GetCurrentProcess());
 }
 
 /**
- * Finds the first free processor, i.e. the first processor that doesn't already have a process
- * pinned to it.
- * @param mask
- * @return
+ * Pins the server's process to the first free processor, i.e. the first processor (in any group)
+ * that no other process is pinned to, on the NUMA node given by -numa if there is one.
+ * @return success
  */
-static bool find_free_processor(uint64_t *mask) {
-  uint64_t cpu_mask = 0;
-  PROCESSENTRY32 process_entry;
-  HANDLE snapshot;
+static bool pin_to_free_processor() {
+  std::vector<sl2_processor> processors;
+  DWORD nprocessors = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
 
-  snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+  if (nprocessors < 2) {
+    SL2_SERVER_LOG_INFO("nprocessors=%d < 2, not bothing to pin to a processor", nprocessors);
+    return true;
+  }
 
-  if (snapshot == INVALID_HANDLE_VALUE) {
-    SL2_SERVER_LOG_FATAL("failed to snapshot process!");
+  if (!sl2_free_processors(opts.numa_node, processors) || processors.empty()) {
+    SL2_SERVER_LOG_WARN("couldn't find a free processor on numa_node=%d!", opts.numa_node);
+    return false;
   }
 
-  process_entry.dwSize = sizeof(PROCESSENTRY32);
+  sl2_processor processor = processors[0];
 
-  if (!Process32First(snapshot, &process_entry)) {
-    CloseHandle(snapshot);
-    SL2_SERVER_LOG_FATAL("failed to enumerate processes!");
+  if (!set_server_affinity(processor.group, (KAFFINITY)1 << processor.number)) {
+    return false;
   }
 
-  do {
-    uint64_t affinity;
+  server_numa_node = sl2_processor_node(processor);
 
-    // If we weren't able to get the process's affinity, keep looking.
-    if (!get_process_affinity(process_entry.th32ProcessID, &affinity)) {
-      continue;
-    }
+  SL2_SERVER_LOG_INFO("pinned to processor %u in group %u (numa_node=%lu)", processor.number,
+                      processor.group, server_numa_node);
+
+  return true;
+}
+
+/**
+ * Confines the server to the processors of the NUMA node given by -numa, without pinning it to
+ * any one of them.
+ * @return success
+ */
+static bool place_on_numa_node() {
+  std::vector<KAFFINITY> candidates;
 
-    // NOTE(ww): WinAFL discards masks that have more than two processors set,
-    // which doesn't make sense to me.
-    cpu_mask |= affinity;
-  } while (Process32Next(snapshot, &process_entry));
+  if (!sl2_node_processors(opts.numa_node, candidates)) {
+    SL2_SERVER_LOG_WARN("no such NUMA node: %d", opts.numa_node);
+    return false;
+  }
+
+  for (WORD group = 0; group < candidates.size(); ++group) {
+    if (candidates[group]) {
+      if (!set_server_affinity(group, candidates[group])) {
+        return false;
+      }
 
-  for (int i = 0; i < 64; ++i) {
-    if (!((cpu_mask >> i) & 1)) {
-      *mask = 0;
-      *mask |= (1 << i);
+      server_numa_node = opts.numa_node;
       return true;
     }
   }
 
   return false;
-
-  CloseHandle(snapshot);
 }
 
 /**
- * Pins the server's process to the first free processor.
- * @return success
+ * @return the instruction set that the arena kernels use: the fastest one that this machine
+ *         supports, unless the SL2_SIMD environment variable caps it (see sl2_simd_cap)
  */
-static bool pin_to_free_processor() {
-  SYSTEM_INFO info = {0};
-  uint64_t free_mask;
+static sl2_simd_level arena_simd_level() {
+  static const sl2_simd_level level = sl2_simd_cap(sl2_simd_current(), getenv("SL2_SIMD"));
 
-  GetSystemInfo(&info);
-
-  if (info.dwNumberOfProcessors < 2) {
-    SL2_SERVER_LOG_INFO("nprocessors=%d < 2, not bothing to pin to a processor",
-                        info.dwNumberOfProcessors);
-    return true;
-  }
-
-  if (info.dwNumberOfProcessors > 64) {
-    SL2_SERVER_LOG_WARN("nprocessors=%d > 64, processor pinning not supported!",
-                        info.dwNumberOfProcessors);
-    return false;
-  }
+  return level;
+}
 
-  if (!find_free_processor(&free_mask)) {
-    SL2_SERVER_LOG_WARN("couldn't find a free processor!");
-    return false;
-  }
+/**
+ * Picks the fastest merge/score kernels that this machine supports.
+ * @return the kernels, one per map size (see arena_size_class)
+ */
+static const sl2_merge_score_fn *select_merge_score() {
+  SL2_SERVER_LOG_INFO("using %s arena kernels", sl2_simd_level_name(arena_simd_level()));
+  return merge_score_kernels(arena_simd_level());
+}
 
-  if (!SetProcessAffinityMask(GetCurrentProcess(), free_mask)) {
-    return false;
-  }
+/**
+ * Saturates the hit counts in `other` into `arena` and returns the new coverage score
+ * of `arena` (depending on whether bucketing is on), in a single pass over the map.
+ * Saturating keeps hot blocks from wrapping back to 0 and falling out of the score.
+ * @param arena the arena to merge into
+ * @param other the arena to merge, which must be the same size, or NULL to only score `arena`
+ * @return the score
+ */
+static uint32_t arena_merge_score(sl2_arena *arena, const sl2_arena *other) {
+  static const sl2_merge_score_fn *merge_score = select_merge_score();
 
-  return true;
+  return merge_score[arena_size_class(arena->size)](arena->map, other ? other->map : NULL,
+                                                    opts.bucketing);
 }
 
 /**
- * Scores the coverage of the given arena by placing hit counts into buckets: higher scores are
- * given for relatively small counts, while large counts are given lower scores.
- * @param arena
- * @return
+ * Scores a single arena cell (depending on whether bucketing is on).
+ * @param hits the cell's hit count
+ * @return the cell's score
  */
-static uint32_t bucket_score(sl2_arena *arena) {
-  uint32_t score = 0;
-
-  for (int i = 0; i < FUZZ_ARENA_SIZE; ++i) {
-    if (!arena->map[i]) {
-      continue;
-    }
+static inline uint32_t cell_score(uint8_t hits) {
+  return opts.bucketing ? bucket_value(hits) : !!hits;
+}
 
-    if (arena->map[i] <= 3) {
-      score += 32;
-    } else if (arena->map[i] <= 7) {
-      score += 16;
-    } else if (arena->map[i] <= 15) {
-      score += 8;
-    } else if (arena->map[i] <= 31) {
-      score += 4;
-    } else if (arena->map[i] <= 127) {
-      score += 2;
-    } else {
-      score += 1;
-    }
+/**
+ * The sparse version of arena_merge_score: saturates a sparse arena's cells into `arena`, and
+ * updates its score by how much each of those cells' scores changed, without touching the rest
+ * of the map.
+ * @param arena the arena to merge into
+ * @param score the score of `arena` before the merge
+ * @param cells the sparse arena's cells (see SL2_ARENA_CELL)
+ * @return the new score
+ */
+static uint32_t arena_merge_sparse(sl2_arena *arena, uint32_t score,
+                                   const std::vector<uint32_t> &cells) {
+  for (uint32_t cell : cells) {
+    uint8_t *hits = &(arena->map[SL2_ARENA_CELL_INDEX(cell)]);
+    uint32_t merged = *hits + SL2_ARENA_CELL_HITS(cell);
+
+    score -= cell_score(*hits);
+    *hits = (uint8_t)(merged > UINT8_MAX ? UINT8_MAX : merged);
+    score += cell_score(*hits);
   }
 
   return score;
 }
 
 /**
- * Scores the coverage of the given arena with a dumb hit counter:
- * the ultimate score is the number of nonzero cells in the arena.
- * @return the coverage score
+ * @param cells a sparse arena's cells (see SL2_ARENA_CELL)
+ * @return the sparse arena's score
  */
-static uint32_t coverage_count(sl2_arena *arena) {
+static uint32_t sparse_score(const std::vector<uint32_t> &cells) {
   uint32_t score = 0;
 
-  for (int i = 0; i < FUZZ_ARENA_SIZE; ++i) {
-    if (arena->map[i]) {
-      score++;
-    }
+  for (uint32_t cell : cells) {
+    score += cell_score(SL2_ARENA_CELL_HITS(cell));
   }
 
   return score;
@@ -240,348 +984,662 @@ static uint32_t coverage_count(sl2_arena *arena) {
  * @return the score
  */
 static uint32_t coverage_score(sl2_arena *arena) {
-  if (opts.bucketing) {
-    return bucket_score(arena);
-  }
+  return arena_merge_score(arena, NULL);
+}
 
-  return coverage_count(arena);
+/**
+ * Picks the fastest novelty kernels that this machine supports (see select_merge_score).
+ * @return the kernels, one per map size (see arena_size_class)
+ */
+static const sl2_novelty_fn *select_novelty() {
+  return novelty_kernels(arena_simd_level());
 }
 
 /**
- * Concurrency protection. Prevent multiple servers from starting simultaneously
+ * Checks a run's arena for coverage that its merged arena has never seen, and records it in the
+ * merged arena's virgin map.
+ * @param virgin the merged arena's virgin map
+ * @param run_arena the run's arena, which must be the same size
+ * @param new_buckets receives the number of already-hit cells that the run hit in a new bucket
+ * @return the number of cells that the run hit for the first time
  */
-static void lock_process() {
-  process_mutex = CreateMutex(NULL, false, L"fuzz_server_mutex");
-  if (!process_mutex || process_mutex == INVALID_HANDLE_VALUE) {
-    SL2_SERVER_LOG_FATAL("could not create process lock");
-  }
+static uint32_t arena_novelty(std::vector<uint8_t> &virgin, const sl2_arena *run_arena,
+                              uint32_t *new_buckets) {
+  static const sl2_novelty_fn *novelty = select_novelty();
 
-  // Give ourselves a few milliseconds to acquire the mutex from the harness.
-  DWORD result = WaitForSingleObject(process_mutex, 10);
-  if (result != WAIT_OBJECT_0) {
-    SL2_SERVER_LOG_FATAL("could not obtain process lock");
-  }
+  return novelty[arena_size_class(run_arena->size)](virgin.data(), run_arena->map,
+                                                    opts.bucketing, new_buckets);
 }
 
 /**
- * Called on process termination (by atexit).
+ * The sparse version of arena_novelty, which only looks at the run's nonzero cells.
+ * @param virgin the merged arena's virgin map
+ * @param cells the run's sparse arena's cells (see SL2_ARENA_CELL)
+ * @param new_buckets receives the number of already-hit cells that the run hit in a new bucket
+ * @return the number of cells that the run hit for the first time
  */
-static void server_cleanup() {
-  SL2_SERVER_LOG_INFO("cleaning things up");
+static uint32_t sparse_novelty(std::vector<uint8_t> &virgin, const std::vector<uint32_t> &cells,
+                               uint32_t *new_buckets) {
+  uint32_t new_cells = 0;
+  *new_buckets = 0;
+
+  for (uint32_t cell : cells) {
+    uint8_t *seen = &(virgin[SL2_ARENA_CELL_INDEX(cell)]);
+    uint8_t bit = bucket_bit(SL2_ARENA_CELL_HITS(cell), opts.bucketing);
+
+    if (bit & ~*seen) {
+      if (*seen) {
+        (*new_buckets)++;
+      } else {
+        new_cells++;
+      }
 
-  // NOTE(ww): We could probably check return codes here, but there's
-  // no point -- the process is about to be destroyed anyways.
-  ReleaseMutex(process_mutex);
-  CloseHandle(process_mutex);
+      *seen |= bit;
+    }
+  }
+
+  return new_cells;
 }
 
 /**
- * Called on session termination.
+ * Adds an arena's merged map to its virgin map (creating the virgin map if need be).
+ * The merged map only has the sum of its runs' hits, so every bucket up to a cell's
+ * merged count is taken to have been seen: no run could have hit the cell more often than that,
+ * but the lower buckets may not actually have been hit on their own, and won't count as new.
+ * @param state the arena's strategy state, locked exclusively, whose arena is in memory
  */
-static void destroy_pipe(HANDLE pipe) {
-  if (!FlushFileBuffers(pipe)) {
-    SL2_SERVER_LOG_ERROR("failed to flush pipe");
-  }
+static void absorb_virgin(strategy_state &state) {
+  const sl2_arena *arena = state.arena.get();
 
-  if (!DisconnectNamedPipe(pipe)) {
-    SL2_SERVER_LOG_ERROR("failed to disconnect pipe");
+  if (state.virgin.size() != arena->size) {
+    state.virgin.assign(arena->size, 0);
   }
 
-  if (!CloseHandle(pipe)) {
-    SL2_SERVER_LOG_ERROR("failed to close pipe");
+  for (size_t i = 0; i < arena->size; ++i) {
+    uint8_t bit = bucket_bit(arena->map[i], opts.bucketing);
+
+    // Every bit up to and including the cell's own bucket.
+    if (bit) {
+      state.virgin[i] |= bit | (bit - 1);
+    }
   }
 }
 
+/*! Primes and rotations shared with xxHash64 */
+#define SL2_PRIME64_1 0x9E3779B185EBCA87ULL
+#define SL2_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define SL2_PRIME64_3 0x165667B19E3779F9ULL
+#define SL2_PRIME64_4 0x85EBCA77C2B2AE63ULL
+
 /**
- * Initialize the global variable (FUZZ_LOG) containing the path to the logging file.
- * NOTE(ww): We separate this from init_working_paths so that we can log any errors that
- * happen to occur in init_working_paths.
+ * Mixes one 64-bit word into a hash lane.
+ * @param lane the lane to mix into
+ * @param word the word to mix in
+ * @return the new lane
  */
-static void init_logging_path() {
-  wchar_t *roaming_path;
-  SHGetKnownFolderPath(FOLDERID_RoamingAppData, NULL, NULL, &roaming_path);
+static inline uint64_t path_hash_round(uint64_t lane, uint64_t word) {
+  lane += word * SL2_PRIME64_2;
+  lane = _rotl64(lane, 31);
+  return lane * SL2_PRIME64_1;
+}
 
-  if (PathCchCombine(FUZZ_LOG, MAX_PATH, roaming_path,
-                     L"Trail of Bits\\sl2\\log\\server.log") != S_OK) {
-    SL2_SERVER_LOG_FATAL("failed to combine logfile path");
+/**
+ * Scrambles a hash lane so that every input bit affects every output bit.
+ * @param hash the lane to scramble
+ * @return the scrambled lane
+ */
+static inline uint64_t path_hash_avalanche(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= SL2_PRIME64_2;
+  hash ^= hash >> 29;
+  hash *= SL2_PRIME64_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+/**
+ * Hashes a coverage map into a 128-bit path identifier. The map is walked in four independent
+ * lanes (like xxHash) so that the multiplies pipeline, and the lanes are folded into two
+ * differently-seeded halves at the end.
+ * When `sparse` is set, only nonzero words are mixed in (along with their index), which is
+ * much cheaper on the mostly-empty maps that a single run produces.
+ * @param map the coverage map to hash
+ * @param size the size of the map
+ * @param sparse whether to skip zero words
+ * @param hash the two halves of the hash
+ */
+static void path_hash_128(const uint8_t *map, size_t size, bool sparse, uint64_t hash[2]) {
+  const uint64_t *words = (const uint64_t *)map;
+  const size_t count = size / sizeof(uint64_t);
+  uint64_t lanes[4] = {SL2_PRIME64_1 + SL2_PRIME64_2, SL2_PRIME64_2, 0, 0 - SL2_PRIME64_1};
+
+  if (sparse) {
+    for (size_t i = 0; i < count; ++i) {
+      if (words[i]) {
+        lanes[i & 3] = path_hash_round(lanes[i & 3], words[i] ^ (i * SL2_PRIME64_4));
+      }
+    }
+  } else {
+    for (size_t i = 0; i < count; i += 4) {
+      lanes[0] = path_hash_round(lanes[0], words[i]);
+      lanes[1] = path_hash_round(lanes[1], words[i + 1]);
+      lanes[2] = path_hash_round(lanes[2], words[i + 2]);
+      lanes[3] = path_hash_round(lanes[3], words[i + 3]);
+    }
   }
 
-  CoTaskMemFree(roaming_path);
+  uint64_t low = _rotl64(lanes[0], 1) + _rotl64(lanes[1], 7) + _rotl64(lanes[2], 12) +
+                 _rotl64(lanes[3], 18);
+  uint64_t high = (lanes[0] ^ _rotl64(lanes[2], 27)) * SL2_PRIME64_1 +
+                  (lanes[1] ^ _rotl64(lanes[3], 27)) * SL2_PRIME64_4;
+
+  hash[0] = path_hash_avalanche(low + size);
+  hash[1] = path_hash_avalanche(high ^ hash[0]);
 }
 
 /**
- * Initialize the global variables containins the paths to the working directory,
- * as well as the subdirectories and files we expect individual runs to produce.
- * NOTE(ww): This should be kept up-to-date with fuzzer_config.py.
+ * Hashes a raw arena into a hex path identifier, using the configured path hash.
+ * @param arena the arena to hash
+ * @param hex the buffer to write the hex identifier into, at least SL2_HASH_LEN + 1 bytes long
  */
-static void init_working_paths() {
-  wchar_t *roaming_path;
-  SHGetKnownFolderPath(FOLDERID_RoamingAppData, NULL, NULL, &roaming_path);
-  wchar_t runs_local_path[MAX_PATH] = L"Trail of Bits\\sl2\\runs";
+static void path_hash_hex(sl2_arena *arena, char *hex) {
+  if (opts.path_hash == SL2_PATH_HASH_SHA256) {
+    std::string hash_hex_str = picosha2::hash256_hex_string(
+        (unsigned char *)arena->map, (unsigned char *)arena->map + arena->size);
 
-  if (PathCchCombine(FUZZ_WORKING_PATH, MAX_PATH, roaming_path, runs_local_path) != S_OK) {
-    SL2_SERVER_LOG_FATAL("failed to combine working dir path");
+    memcpy(hex, hash_hex_str.c_str(), SL2_HASH_LEN);
+    return;
   }
 
-  wchar_t arenas_local_path[MAX_PATH] = L"Trail of Bits\\sl2\\arenas";
+  uint64_t hash[2];
+  path_hash_128(arena->map, arena->size, opts.path_hash == SL2_PATH_HASH_SPARSE, hash);
+  StringCchPrintfA(hex, SL2_HASH_LEN + 1, "%016llx%016llx", hash[1], hash[0]);
+}
 
-  if (PathCchCombine(FUZZ_ARENAS_PATH, MAX_PATH, roaming_path, arenas_local_path) != S_OK) {
-    SL2_SERVER_LOG_FATAL("failed to combine arenas dir path");
+/**
+ * Concurrency protection. Prevent multiple servers from starting simultaneously
+ */
+static void lock_process() {
+  process_mutex = CreateMutex(NULL, false, FUZZ_SERVER_LOCK);
+  if (!process_mutex || process_mutex == INVALID_HANDLE_VALUE) {
+    SL2_SERVER_LOG_FATAL("could not create process lock");
   }
 
-  CoTaskMemFree(roaming_path);
+  // Give ourselves a few milliseconds to acquire the mutex from the harness.
+  DWORD result = WaitForSingleObject(process_mutex, 10);
+  if (result != WAIT_OBJECT_0) {
+    SL2_SERVER_LOG_FATAL("could not obtain process lock");
+  }
 }
 
+static void checkpoint_arenas();
+static bool sync_valid_arena_id(const wchar_t *id);
+
+/*! How many crash dumps are still being written in the background */
+static std::atomic<uint32_t> pending_dumps(0);
+
 /**
- * Writes the fkt file in the event we found a crash. Stores information about the mutation that
- * caused it. See the sl2_mutation struct for parameter details.
- * @return return code
+ * Writes out the log lines that are waiting for the log writer.
  */
-static uint8_t write_fkt(wchar_t *target_file, uint32_t type, uint32_t mutation_type,
-                         size_t resource_size, wchar_t *resource_path, size_t position, size_t size,
-                         uint8_t *buf) {
-  uint8_t rc = 0;
-  DWORD txsize;
-
-  std::unique_lock<std::shared_mutex> fkt_lock(fkt_mutex);
+static void write_log() {
+  if (!log_file) {
+    return;
+  }
 
-  HANDLE fkt = CreateFile(target_file, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+  std::lock_guard<std::mutex> write_lock(log_write_mutex);
+  uint64_t dropped;
 
-  if (fkt == INVALID_HANDLE_VALUE) {
-    SL2_SERVER_LOG_ERROR("failed to create FTK: %S", target_file);
-    rc = 1;
-    goto cleanup;
+  // The two buffers trade places, so that neither is reallocated once it's grown.
+  {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    log_writing.swap(log_pending);
+    dropped = log_dropped;
+    log_dropped = 0;
   }
 
-  if (!WriteFile(fkt, "FKT\0", 4, &txsize, NULL)) {
-    SL2_SERVER_LOG_ERROR("failed to write FKT header");
-    rc = 1;
-    goto cleanup;
+  if (dropped) {
+    fprintf(log_file, "(dropped %llu log lines)\n", (unsigned long long)dropped);
   }
 
-  if (!WriteFile(fkt, &type, sizeof(type), &txsize, NULL)) {
-    SL2_SERVER_LOG_ERROR("failed to write type");
-    rc = 1;
-    goto cleanup;
-  }
+  fwrite(log_writing.data(), 1, log_writing.size(), log_file);
+  fflush(log_file);
+  log_writing.clear();
+}
 
-  if (!WriteFile(fkt, &mutation_type, sizeof(mutation_type), &txsize, NULL)) {
-    SL2_SERVER_LOG_ERROR("failed to write mutation type");
-    rc = 1;
-    goto cleanup;
+/**
+ * Queues a line for the log writer. This is a loguru callback, so it runs on the thread that
+ * logged the line, and never touches the disk (except for fatal lines, which loguru aborts after).
+ * @param user_data unused
+ * @param message the line
+ */
+static void log_to_buffer(void *user_data, const loguru::Message &message) {
+  size_t size = strlen(message.preamble) + strlen(message.indentation) + strlen(message.prefix) +
+                strlen(message.message) + 1;
+  bool wake;
+
+  {
+    std::lock_guard<std::mutex> lock(log_mutex);
+
+    if (log_pending.size() + size > SL2_LOG_BUFFER_BYTES) {
+      log_dropped++;
+    } else {
+      log_pending.append(message.preamble);
+      log_pending.append(message.indentation);
+      log_pending.append(message.prefix);
+      log_pending.append(message.message);
+      log_pending.push_back('\n');
+    }
+
+    wake = log_pending.size() >= SL2_LOG_BUFFER_BYTES / 2;
   }
 
-  if (!WriteFile(fkt, &resource_size, sizeof(resource_size), &txsize, NULL)) {
-    SL2_SERVER_LOG_ERROR("failed to write path size");
-    rc = 1;
-    goto cleanup;
+  if (message.verbosity == loguru::Verbosity_FATAL) {
+    write_log();
+  } else if (wake) {
+    SetEvent(log_wake);
   }
+}
 
-  if (!WriteFile(fkt, resource_path, (DWORD)(resource_size * sizeof(wchar_t)), &txsize, NULL)) {
-    SL2_SERVER_LOG_ERROR("failed to write path");
-    rc = 1;
-    goto cleanup;
+/**
+ * Writes out log lines every SL2_LOG_WRITE_INTERVAL milliseconds, or sooner if they pile up.
+ * @param data unused
+ * @return error code (0)
+ */
+static DWORD WINAPI log_writer_thread(void *data) {
+  while (1) {
+    WaitForSingleObject(log_wake, SL2_LOG_WRITE_INTERVAL);
+    write_log();
   }
 
-  if (!WriteFile(fkt, &position, sizeof(position), &txsize, NULL)) {
-    SL2_SERVER_LOG_ERROR("failed to write offset");
-    rc = 1;
-    goto cleanup;
+  return 0;
+}
+
+/**
+ * Changes the log file's verbosity. Lines above it aren't even formatted.
+ * loguru can't change a callback's verbosity in place, so the callback is re-added; a
+ * line that another thread logs in between can be missed.
+ * @param verbosity the new verbosity (a loguru::Verbosity), clamped to FATAL..MAX
+ */
+static void set_log_verbosity(int verbosity) {
+  if (!log_file) {
+    return;
   }
 
-  if (!WriteFile(fkt, &size, sizeof(size_t), &txsize, NULL)) {
-    SL2_SERVER_LOG_ERROR("failed to write buffer size");
-    rc = 1;
-    goto cleanup;
+  std::lock_guard<std::mutex> lock(log_verbosity_mutex);
+  verbosity =
+      std::min(std::max(verbosity, (int)loguru::Verbosity_FATAL), (int)loguru::Verbosity_MAX);
+
+  loguru::remove_callback(SL2_LOG_CALLBACK);
+  loguru::add_callback(SL2_LOG_CALLBACK, log_to_buffer, NULL, (loguru::Verbosity)verbosity);
+  log_verbosity = verbosity;
+}
+
+/**
+ * Opens the log file (FUZZ_LOG), and starts the log writer thread. Lines are queued by the
+ * threads that log them and written out by the log writer, so that handlers never wait on the
+ * disk to log.
+ */
+static void init_logging() {
+  char log_path_mbs[MAX_PATH + 1] = {0};
+  wcstombs_s(NULL, log_path_mbs, MAX_PATH, FUZZ_LOG, MAX_PATH);
+
+  loguru::create_directories(log_path_mbs);
+
+  if (fopen_s(&log_file, log_path_mbs, "a")) {
+    log_file = NULL;
+    SL2_SERVER_LOG_ERROR("failed to open the log file: %s", log_path_mbs);
+    return;
   }
 
-  if (!WriteFile(fkt, buf, (DWORD)size, &txsize, NULL)) {
-    SL2_SERVER_LOG_ERROR("failed to write buffer");
-    rc = 1;
-    goto cleanup;
+  fprintf(log_file, "\n\n\n\n\n");
+  fflush(log_file);
+
+  log_wake = CreateEvent(NULL, false, false, NULL);
+  HANDLE thread = CreateThread(NULL, 0, log_writer_thread, NULL, 0, NULL);
+
+  if (log_wake == NULL || thread == NULL) {
+    SL2_SERVER_LOG_FATAL("couldn't start the log writer thread");
   }
 
-  if (!CloseHandle(fkt)) {
-    SL2_SERVER_LOG_ERROR("failed to close FKT");
-    rc = 1;
-    goto cleanup;
+  CloseHandle(thread);
+  loguru::add_callback(SL2_LOG_CALLBACK, log_to_buffer, NULL, loguru::Verbosity_INFO);
+  log_verbosity = loguru::Verbosity_INFO;
+}
+
+/**
+ * Called on process termination (by atexit).
+ */
+static void server_cleanup() {
+  SL2_SERVER_LOG_INFO("cleaning things up");
+
+  checkpoint_arenas();
+
+  // Crash dumps are written from process snapshots that only live as long as we do,
+  // so give any in-flight dumps a chance to finish.
+  while (pending_dumps) {
+    Sleep(10);
   }
 
-cleanup:
+  // NOTE(ww): We could probably check return codes here, but there's
+  // no point -- the process is about to be destroyed anyways.
+  ReleaseMutex(process_mutex);
+  CloseHandle(process_mutex);
 
-  return rc;
+  sl2_etw_unregister();
+  write_log();
 }
 
 /**
- * Gets the mutated bytes stored in the FKT file for mutation replay
- * @param target_file - path to the fkt file
- * @param buf - buffer to overwrite
- * @param size - length of the buffer
+ * Called on session termination.
  */
-static void get_bytes_fkt(wchar_t *target_file, uint8_t *buf, size_t size) {
-  DWORD txsize;
-  size_t buf_size = 0;
+static void destroy_pipe(HANDLE pipe) {
+  if (!FlushFileBuffers(pipe)) {
+    SL2_SERVER_LOG_ERROR("failed to flush pipe");
+  }
 
-  // NOTE(ww): Multiple threads are allowed to read from FKTs at once,
-  // so we use a shared lock here.
-  std::shared_lock<std::shared_mutex> fkt_lock(fkt_mutex);
+  if (!DisconnectNamedPipe(pipe)) {
+    SL2_SERVER_LOG_ERROR("failed to disconnect pipe");
+  }
 
-  HANDLE fkt = CreateFile(target_file, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+  if (!CloseHandle(pipe)) {
+    SL2_SERVER_LOG_ERROR("failed to close pipe");
+  }
+}
 
-  if (fkt == INVALID_HANDLE_VALUE) {
-    SL2_SERVER_LOG_FATAL("failed to open FKT: %S", target_file);
+/**
+ * Reads from an overlapped pipe, blocking until the read completes. The completion
+ * is not queued to the completion port.
+ * @param pipe the pipe to read from
+ * @param buf the buffer to read into
+ * @param size the number of bytes to read
+ * @param txsize the number of bytes actually read
+ * @return success
+ */
+static BOOL pipe_read_raw(HANDLE pipe, void *buf, DWORD size, DWORD *txsize) {
+  OVERLAPPED ov = {0};
+
+  // Setting the low bit of hEvent tells Windows not to queue this
+  // operation to the completion port. We wait for it right here instead.
+  ov.hEvent = (HANDLE)((uintptr_t)io_event | 1);
+
+  // On message pipes, reading part of a message "fails" with ERROR_MORE_DATA. The rest
+  // of the message is left for the next read, just like on a byte pipe.
+  if (!ReadFile(pipe, buf, size, NULL, &ov) && GetLastError() != ERROR_IO_PENDING &&
+      GetLastError() != ERROR_MORE_DATA) {
+    return false;
   }
 
-  // Read size of file path from fkt file
-  uint64_t pathSize;
-  SetFilePointer(fkt, 0xc, NULL, FILE_BEGIN);
-  if (!ReadFile(fkt, &pathSize, sizeof(int64_t), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read file path size from FKT");
+  if (!GetOverlappedResult(pipe, &ov, txsize, true) && GetLastError() != ERROR_MORE_DATA) {
+    return false;
   }
-  // Skip over the file path and position
-  SetFilePointer(fkt, pathSize * sizeof(wchar_t) + sizeof(int64_t), NULL, FILE_CURRENT);
 
-  // Read Buffer Size
-  if (!ReadFile(fkt, &buf_size, sizeof(buf_size), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read replay buffer size from FKT");
+  event_bytes += *txsize;
+  return true;
+}
+
+/**
+ * Reads the next part of the request being handled: from the request's frame, for framed
+ * requests, and from the pipe otherwise (or once the frame runs out).
+ * @param pipe the pipe to read from
+ * @param buf the buffer to read into
+ * @param size the number of bytes to read
+ * @param txsize the number of bytes actually read
+ * @return success
+ */
+static BOOL pipe_read(HANDLE pipe, void *buf, DWORD size, DWORD *txsize) {
+  DWORD framed = (DWORD)std::min((size_t)size, frame_left);
+
+  if (framed > 0) {
+    memcpy(buf, frame_next, framed);
+    frame_next += framed;
+    frame_left -= framed;
   }
 
-  if (buf_size < size) {
-    size = buf_size;
+  *txsize = framed;
+
+  if (framed == size) {
+    return true;
   }
 
-  SL2_SERVER_LOG_INFO("buffer size=%lu", size);
+  DWORD rest = 0;
+  BOOL ok = pipe_read_raw(pipe, (uint8_t *)buf + framed, size - framed, &rest);
+  *txsize += rest;
+
+  return ok;
+}
+
+/**
+ * Writes to an overlapped pipe, blocking until the write completes. The completion
+ * is not queued to the completion port.
+ * @param pipe the pipe to write to
+ * @param buf the buffer to write from
+ * @param size the number of bytes to write
+ * @param txsize the number of bytes actually written
+ * @return success
+ */
+static BOOL pipe_write(HANDLE pipe, const void *buf, DWORD size, DWORD *txsize) {
+  OVERLAPPED ov = {0};
+
+  // The client isn't reading this request's response, so we drop it rather than
+  // leaving it in the pipe for the client's next request to trip over.
+  if (frame_no_reply) {
+    *txsize = size;
+    return true;
+  }
 
-  SetFilePointer(fkt, -(LONG)size, NULL, FILE_END);
+  // See pipe_read.
+  ov.hEvent = (HANDLE)((uintptr_t)io_event | 1);
 
-  if (!ReadFile(fkt, buf, (DWORD)size, &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read replay buffer from FKT");
+  if (!WriteFile(pipe, buf, size, NULL, &ov) && GetLastError() != ERROR_IO_PENDING) {
+    return false;
   }
 
-  if (!CloseHandle(fkt)) {
-    SL2_SERVER_LOG_FATAL("failed to close FKT");
+  if (!GetOverlappedResult(pipe, &ov, txsize, true)) {
+    return false;
   }
+
+  event_bytes += *txsize;
+  return true;
 }
 
 /**
- * Dump the raw arena to the disk. No encoding, just the bytes straight from memory
- * @param arena_path where to dump the arena
- * @param arena the arena to dump
+ * Acquires a (deferred) lock, charging the time spent waiting for it to the event being handled.
+ * @param lock the lock to acquire
  */
-static void dump_arena_to_disk(wchar_t *arena_path, sl2_arena *arena) {
-  std::unique_lock<std::shared_mutex> arena_lock(arena_mutex);
+template <typename Lock> static void timed_lock(Lock &lock) {
+  LARGE_INTEGER start, end;
 
-  DWORD txsize;
-  HANDLE file =
-      CreateFile(arena_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  QueryPerformanceCounter(&start);
+  lock.lock();
+  QueryPerformanceCounter(&end);
 
-  if (file != INVALID_HANDLE_VALUE) {
-    if (!WriteFile(file, arena->map, FUZZ_ARENA_SIZE, &txsize, NULL)) {
-      SL2_SERVER_LOG_FATAL("failed to write arena to disk!");
+  event_lock_ticks += end.QuadPart - start.QuadPart;
+}
+
+/**
+ * Names this server's instance, from -n, and works out the pipe that it listens on and the mutex
+ * that it holds. A host can run several instances at once (e.g. one per shard of its targets),
+ * each with its own pipe, mutex, log, and arenas directory.
+ * This happens before anything else, since the instance decides where we log.
+ */
+static void init_instance(int argc, char **argv) {
+  for (int i = 0; i < argc - 1; ++i) {
+    if (!STREQ(argv[i], "-n")) {
+      continue;
     }
 
-    if (txsize != FUZZ_ARENA_SIZE) {
-      SL2_SERVER_LOG_FATAL("(txsize=%lu) != (FUZZ_ARENA_SIZE=%lu), truncated write?", txsize,
-                           FUZZ_ARENA_SIZE);
+    const char *name = argv[i + 1];
+    size_t len = strlen(name);
+
+    if (!len || len > FUZZ_SERVER_INSTANCE_MAX) {
+      SL2_SERVER_LOG_FATAL("instance names are 1 to %d characters long", FUZZ_SERVER_INSTANCE_MAX);
     }
 
-    if (!CloseHandle(file)) {
-      SL2_SERVER_LOG_ERROR("failed to close arena (arena_path=%S)", arena_path);
+    for (size_t j = 0; j < len; ++j) {
+      if (!isalnum((unsigned char)name[j]) && name[j] != '-' && name[j] != '_') {
+        SL2_SERVER_LOG_FATAL("instance names are letters, digits, dashes, and underscores");
+      }
     }
+
+    mbstowcs_s(NULL, server_instance, FUZZ_SERVER_INSTANCE_MAX + 1, name, len);
+  }
+
+  if (server_instance[0]) {
+    StringCchPrintfW(FUZZ_SERVER_PIPE, MAX_PATH, FUZZ_SERVER_INSTANCE_PATH_FMT, server_instance);
+    StringCchPrintfW(FUZZ_SERVER_LOCK, MAX_PATH, FUZZ_SERVER_INSTANCE_MUTEX_FMT, server_instance);
   } else {
-    SL2_SERVER_LOG_ERROR("failed to open arena_path=%S, skipping dump!", arena_path);
+    StringCchCopyW(FUZZ_SERVER_PIPE, MAX_PATH, FUZZ_SERVER_PATH);
+    StringCchCopyW(FUZZ_SERVER_LOCK, MAX_PATH, FUZZ_SERVER_MUTEX);
   }
 }
 
 /**
- * Reads the arena from the disk, straight into the memory
- * @param arena_path the path from which to read the arema
- * @param arena the arena to load into
- * @return success
+ * Initialize the global variable (FUZZ_LOG) containing the path to the logging file.
+ * NOTE(ww): We separate this from init_working_paths so that we can log any errors that
+ * happen to occur in init_working_paths.
  */
-static bool load_arena_from_disk(wchar_t *arena_path, sl2_arena *arena) {
-  bool rc = true;
-  DWORD txsize;
-
-  std::unique_lock<std::shared_mutex> arena_lock(arena_mutex);
+static void init_logging_path() {
+  wchar_t *roaming_path;
+  SHGetKnownFolderPath(FOLDERID_RoamingAppData, NULL, NULL, &roaming_path);
 
-  HANDLE file =
-      CreateFile(arena_path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  wchar_t log_local_path[MAX_PATH] = L"Trail of Bits\\sl2\\log\\server.log";
 
-  if (file == INVALID_HANDLE_VALUE) {
-    SL2_SERVER_LOG_ERROR("failed to open arena (arena_path=%S)", arena_path);
-    rc = false;
-    goto cleanup;
+  if (server_instance[0]) {
+    StringCchPrintfW(log_local_path, MAX_PATH, L"Trail of Bits\\sl2\\log\\server.%s.log",
+                     server_instance);
   }
 
-  if (!ReadFile(file, arena->map, FUZZ_ARENA_SIZE, &txsize, NULL)) {
-    SL2_SERVER_LOG_ERROR("failed to read arena from disk!");
-    rc = false;
-    goto cleanup;
+  if (PathCchCombine(FUZZ_LOG, MAX_PATH, roaming_path, log_local_path) != S_OK) {
+    SL2_SERVER_LOG_FATAL("failed to combine logfile path");
   }
 
-  if (txsize != FUZZ_ARENA_SIZE) {
-    SL2_SERVER_LOG_ERROR("(txsize=%lu) != (FUZZ_ARENA_SIZE=%lu), truncated read?", txsize,
-                         FUZZ_ARENA_SIZE);
-    rc = false;
-    goto cleanup;
+  CoTaskMemFree(roaming_path);
+}
+
+/**
+ * Initialize the global variables containins the paths to the working directory,
+ * as well as the subdirectories and files we expect individual runs to produce.
+ * NOTE(ww): This should be kept up-to-date with fuzzer_config.py.
+ */
+static void init_working_paths() {
+  wchar_t *roaming_path;
+  SHGetKnownFolderPath(FOLDERID_RoamingAppData, NULL, NULL, &roaming_path);
+  wchar_t runs_local_path[MAX_PATH] = L"Trail of Bits\\sl2\\runs";
+
+  if (PathCchCombine(FUZZ_WORKING_PATH, MAX_PATH, roaming_path, runs_local_path) != S_OK) {
+    SL2_SERVER_LOG_FATAL("failed to combine working dir path");
   }
 
-  if (!CloseHandle(file)) {
-    SL2_SERVER_LOG_ERROR("failed to close arena (arena_path=%S)", arena_path);
-    rc = false;
-    goto cleanup;
+  wchar_t arenas_local_path[MAX_PATH] = L"Trail of Bits\\sl2\\arenas";
+
+  if (PathCchCombine(FUZZ_ARENAS_PATH, MAX_PATH, roaming_path, arenas_local_path) != S_OK) {
+    SL2_SERVER_LOG_FATAL("failed to combine arenas dir path");
   }
 
-cleanup:
+  CoTaskMemFree(roaming_path);
 
-  return rc;
+  // Each instance keeps its arenas (and their corpora) to itself, but they all share
+  // the runs directory: run IDs are unique across instances, and the harness finds runs by ID.
+  if (server_instance[0]) {
+    if (PathCchAppend(FUZZ_ARENAS_PATH, MAX_PATH, server_instance) != S_OK) {
+      SL2_SERVER_LOG_FATAL("failed to combine instance arenas dir path");
+    }
+
+    if (!CreateDirectory(FUZZ_ARENAS_PATH, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+      SL2_SERVER_LOG_FATAL("failed to create instance arenas dir");
+    }
+  }
 }
 
 /**
- * Receives mutated bytes from the fuzzer
- * @param pipe handle to the named pipe that communicates with the client
+ * Serializes a mutation into an FKT record, preceded by room for a journal entry, so that
+ * it can be written to an FKT file or a journal with a single write. See the sl2_mutation
+ * struct for parameter details.
+ * Stacked mutations append their chain (seed, length, and strategy indices) after
+ * the buffer. Single-strategy records are laid out exactly as they always have been.
+ * Delta-encoded mutations are stored as v2 records ("FKT2"), whose buffer is the sl2_delta
+ * rather than the mutated bytes, and compact ones as v3 records ("FKT3"), whose buffer is an
+ * sl2_fkt_chain. The layout is otherwise the same.
+ * @param encoding SL2_FKT_FULL, SL2_FKT_DELTA or SL2_FKT_CHAIN, saying what `buf` holds
+ * @param record_size the size of the FKT record, not including the journal entry
+ * @return the serialized record, which the caller must free, or NULL on failure
  */
-static void handle_register_mutation(HANDLE pipe) {
-  DWORD txsize;
-  UUID run_id;
-  wchar_t *run_id_s;
-  uint8_t status = 0;
+static uint8_t *serialize_fkt(uint32_t type, uint32_t mutation_type, size_t resource_size,
+                              wchar_t *resource_path, size_t position, uint8_t encoding,
+                              size_t size, uint8_t *buf, uint64_t chain_seed, uint32_t chain_len,
+                              uint32_t *chain, size_t *record_size) {
+  size_t path_size = resource_size * sizeof(wchar_t);
+  size_t chain_size = 0;
+
+  if (chain_len > 0) {
+    chain_size = sizeof(chain_seed) + sizeof(chain_len) + chain_len * sizeof(chain[0]);
+  }
 
-  SL2_SERVER_LOG_INFO("starting mutation registration");
+  *record_size = 4 + sizeof(type) + sizeof(mutation_type) + sizeof(resource_size) + path_size +
+                 sizeof(position) + sizeof(size) + size + chain_size;
 
-  if (!ReadFile(pipe, &run_id, sizeof(run_id), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read run ID");
-  }
+  uint8_t *record = (uint8_t *)calloc(1, sizeof(sl2_fkt_journal_entry) + *record_size);
 
-  if (UuidToString(&run_id, (RPC_WSTR *)&run_id_s) != RPC_S_OK) {
-    SL2_SERVER_LOG_FATAL("couldn't stringify UUID");
+  if (record == NULL) {
+    return NULL;
   }
 
-  uint32_t type = 0;
-  if (!ReadFile(pipe, &type, sizeof(type), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read function type");
-  }
+  uint8_t *cur = record + sizeof(sl2_fkt_journal_entry);
 
-  uint32_t mutate_count = 0;
-  wchar_t mutate_fname[MAX_PATH + 1] = {0};
-  if (!ReadFile(pipe, &mutate_count, sizeof(mutate_count), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read mutation count");
+  const char *magic = "FKT\0";
+
+  if (encoding == SL2_FKT_DELTA) {
+    magic = "FKT2";
+  } else if (encoding == SL2_FKT_CHAIN) {
+    magic = "FKT3";
   }
-  StringCchPrintfW(mutate_fname, MAX_PATH, FUZZ_RUN_FKT_FMT, mutate_count);
 
-  uint32_t mutation_type = 0;
-  if (!ReadFile(pipe, &mutation_type, sizeof(mutation_type), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read mutation type");
+  memcpy(cur, magic, 4);
+  cur += 4;
+  memcpy(cur, &type, sizeof(type));
+  cur += sizeof(type);
+  memcpy(cur, &mutation_type, sizeof(mutation_type));
+  cur += sizeof(mutation_type);
+  memcpy(cur, &resource_size, sizeof(resource_size));
+  cur += sizeof(resource_size);
+
+  // resource_size is the path's length in bytes, but the FKT format has always
+  // reserved resource_size wide characters for it. We keep the layout and zero the slack.
+  memcpy(cur, resource_path, resource_size);
+  cur += path_size;
+
+  memcpy(cur, &position, sizeof(position));
+  cur += sizeof(position);
+  memcpy(cur, &size, sizeof(size));
+  cur += sizeof(size);
+  memcpy(cur, buf, size);
+  cur += size;
+
+  if (chain_len > 0) {
+    memcpy(cur, &chain_seed, sizeof(chain_seed));
+    cur += sizeof(chain_seed);
+    memcpy(cur, &chain_len, sizeof(chain_len));
+    cur += sizeof(chain_len);
+    memcpy(cur, chain, chain_len * sizeof(chain[0]));
   }
 
-  size_t resource_size = 0;
-  if (!ReadFile(pipe, &resource_size, sizeof(resource_size), &txsize, NULL)) {
+  return record;
+}
+
+/**
+ * Reads the (optional) path of the resource behind a mutation from the client.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param resource_path where to read the path into (at least MAX_PATH + 1 wide chars)
+ * @param resource_size receives the size of the path, in bytes
+ */
+static void read_resource_path(HANDLE pipe, wchar_t *resource_path, size_t *resource_size) {
+  DWORD txsize;
+
+  if (!pipe_read(pipe, resource_size, sizeof(*resource_size), &txsize)) {
     SL2_SERVER_LOG_FATAL("failed to read size of mutation filepath");
   }
 
-  wchar_t resource_path[MAX_PATH + 1] = {0};
-  if (resource_size >= (MAX_PATH * sizeof(wchar_t))) {
+  if (*resource_size >= (MAX_PATH * sizeof(wchar_t))) {
     // TODO(ww): Instead of failing, maybe just truncate here?
     SL2_SERVER_LOG_FATAL("resource_size >= MAX_PATH");
   }
@@ -589,690 +1647,6249 @@ static void handle_register_mutation(HANDLE pipe) {
   // NOTE(ww): Interestingly, Windows distinguishes between a read of 0 bytes
   // and no read at all -- both the client and the server have to do either one or the
   // other, and failing to do either on one side causes a truncated read or write.
-  if (resource_size > 0) {
-    if (!ReadFile(pipe, &resource_path, (DWORD)resource_size, &txsize, NULL)) {
+  if (*resource_size > 0) {
+    if (!pipe_read(pipe, resource_path, (DWORD)*resource_size, &txsize)) {
       SL2_SERVER_LOG_FATAL("failed to read mutation filepath");
     }
 
-    SL2_SERVER_LOG_INFO("mutation file path: %S", resource_path);
+    SL2_SERVER_LOG_DEBUG("mutation file path: %S", resource_path);
   } else {
     SL2_SERVER_LOG_WARN("the fuzzer didn't send us a file path!");
   }
+}
+
+/**
+ * Writes the fkt file in the event we found a crash. Stores information about the mutation that
+ * caused it.
+ * @param target_file the FKT file to create
+ * @param record the serialized FKT record
+ * @param record_size the size of the record
+ * @return return code
+ */
+static uint8_t write_fkt(wchar_t *target_file, uint8_t *record, size_t record_size) {
+  uint8_t rc = 0;
+  DWORD txsize;
+  LARGE_INTEGER start;
+
+  std::unique_lock<std::shared_mutex> fkt_lock(fkt_mutex);
+  QueryPerformanceCounter(&start);
+
+  HANDLE fkt = CreateFile(target_file, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+
+  if (fkt == INVALID_HANDLE_VALUE) {
+    SL2_SERVER_LOG_ERROR("failed to create FTK: %S", target_file);
+    rc = 1;
+    goto cleanup;
+  }
+
+  if (!WriteFile(fkt, record, (DWORD)record_size, &txsize, NULL) || txsize != record_size) {
+    SL2_SERVER_LOG_ERROR("failed to write FKT record");
+    rc = 1;
+  }
+
+  if (!CloseHandle(fkt)) {
+    SL2_SERVER_LOG_ERROR("failed to close FKT");
+    rc = 1;
+    goto cleanup;
+  }
+
+cleanup:
+
+  sl2_etw_disk_write("fkt", target_file, record_size, us_since(start), rc == 0);
+
+  return rc;
+}
+
+/**
+ * Appends an FKT record to a run's mutation journal.
+ * @param journal_file the run's journal
+ * @param mutate_count the mutation count to file the record under
+ * @param entry the serialized FKT record, preceded by room for its journal entry
+ * @param record_size the size of the record, not including the journal entry
+ * @return return code
+ */
+static uint8_t append_fkt_journal(wchar_t *journal_file, uint32_t mutate_count, uint8_t *entry,
+                                  size_t record_size) {
+  uint8_t rc = 0;
+  DWORD txsize;
+  DWORD entry_size = (DWORD)(sizeof(sl2_fkt_journal_entry) + record_size);
+  sl2_fkt_journal_entry *header = (sl2_fkt_journal_entry *)entry;
+
+  LARGE_INTEGER start;
+
+  header->mutate_count = mutate_count;
+  header->record_size = (uint32_t)record_size;
+
+  std::unique_lock<std::shared_mutex> fkt_lock(fkt_mutex);
+  QueryPerformanceCounter(&start);
+
+  // The tracer maps the journal and tmin reads it as it is, so it can't be compressed
+  // like dumps and arenas are. NTFS compresses it instead, which takes a read-write handle.
+  if (opts.compress) {
+    HANDLE created = CreateFile(journal_file, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_NEW,
+                                FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (created != INVALID_HANDLE_VALUE) {
+      if (!sl2_compress_in_place(created)) {
+        SL2_SERVER_LOG_WARN("couldn't compress FKT journal (GLE=%d): %S", GetLastError(),
+                            journal_file);
+      }
+
+      CloseHandle(created);
+    }
+  }
+
+  HANDLE journal = CreateFile(journal_file, FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (journal == INVALID_HANDLE_VALUE) {
+    SL2_SERVER_LOG_ERROR("failed to open FKT journal: %S", journal_file);
+    rc = 1;
+    goto cleanup;
+  }
+
+  if (!WriteFile(journal, entry, entry_size, &txsize, NULL) || txsize != entry_size) {
+    SL2_SERVER_LOG_ERROR("failed to append FKT record to journal");
+    rc = 1;
+  }
+
+  if (!CloseHandle(journal)) {
+    SL2_SERVER_LOG_ERROR("failed to close FKT journal");
+    rc = 1;
+    goto cleanup;
+  }
+
+cleanup:
+
+  sl2_etw_disk_write("fkt_journal", journal_file, entry_size, us_since(start), rc == 0);
+
+  return rc;
+}
+
+/**
+ * Stores a serialized FKT record under a run's directory: either in its own FKT file, or
+ * appended to the run's mutation journal.
+ * @param run_dir the run's directory
+ * @param mutate_count the mutation count that the record was registered under
+ * @param record the serialized record, as returned by serialize_fkt
+ * @param record_size the size of the FKT record, not including the journal entry
+ * @return return code
+ */
+static uint8_t store_fkt(const wchar_t *run_dir, uint32_t mutate_count, uint8_t *record,
+                         size_t record_size) {
+  wchar_t target_file[MAX_PATH + 1] = {0};
+
+  if (opts.journal_mutations) {
+    PathCchCombine(target_file, MAX_PATH, run_dir, FUZZ_RUN_FKT_JOURNAL);
+    return append_fkt_journal(target_file, mutate_count, record, record_size);
+  }
+
+  wchar_t mutate_fname[MAX_PATH + 1] = {0};
+  StringCchPrintfW(mutate_fname, MAX_PATH, FUZZ_RUN_FKT_FMT, mutate_count);
+  PathCchCombine(target_file, MAX_PATH, run_dir, mutate_fname);
+
+  return write_fkt(target_file, record + sizeof(sl2_fkt_journal_entry), record_size);
+}
+
+/**
+ * @param arena_id the ID of the seed's arena
+ * @param seq the seed's place in its arena's corpus
+ * @param digest the seed's hash (see sl2_fkt_chain)
+ * @param seed_path receives the path of the seed in its arena's seed archive
+ * @param dir_path receives the path of the arena's seed archive, if not NULL
+ */
+static void seed_archive_path(const wchar_t *arena_id, uint64_t seq, uint64_t digest,
+                              wchar_t *seed_path, wchar_t *dir_path) {
+  wchar_t dir[MAX_PATH + 1] = {0};
+  wchar_t name[MAX_PATH + 1] = {0};
+
+  PathCchCombine(dir, MAX_PATH, FUZZ_ARENAS_PATH, arena_id);
+  StringCchCatW(dir, MAX_PATH, SL2_SEED_ARCHIVE_EXT);
+  StringCchPrintfW(name, MAX_PATH, L"%llu-%016llx.seed", seq, digest);
+  PathCchCombine(seed_path, MAX_PATH, dir, name);
+
+  if (dir_path) {
+    StringCchCopyW(dir_path, MAX_PATH, dir);
+  }
+}
+
+/**
+ * Keeps a seed in its arena's seed archive, unless it's there already. Archived seeds outlive
+ * their corpus entries, so that compact FKT records can be replayed for as long as their runs are
+ * kept.
+ * @param seed the seed
+ * @param digest the seed's hash
+ * @return whether the seed is in the archive
+ */
+static bool archive_seed(const sl2_served_seed &seed, uint64_t digest) {
+  DWORD txsize;
+  wchar_t dir_path[MAX_PATH + 1] = {0};
+  wchar_t seed_path[MAX_PATH + 1] = {0};
+  LARGE_INTEGER start;
+
+  QueryPerformanceCounter(&start);
+  seed_archive_path(seed.arena_id.c_str(), seed.seq, digest, seed_path, dir_path);
+
+  if (!CreateDirectory(dir_path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+    SL2_SERVER_LOG_ERROR("failed to create seed archive: %S", dir_path);
+    return false;
+  }
+
+  // The seed's name holds its hash, so an archived seed never needs writing again.
+  HANDLE file =
+      CreateFile(seed_path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    return GetLastError() == ERROR_FILE_EXISTS;
+  }
+
+  bool ok = WriteFile(file, seed.buf.data(), (DWORD)seed.buf.size(), &txsize, NULL) &&
+            txsize == seed.buf.size();
+
+  if (!CloseHandle(file) || !ok) {
+    SL2_SERVER_LOG_ERROR("failed to archive seed: %S", seed_path);
+    DeleteFile(seed_path);
+    ok = false;
+  }
+
+  sl2_etw_disk_write("seed", seed_path, seed.buf.size(), us_since(start), ok);
+
+  return ok;
+}
+
+/**
+ * Reads the seed that a compact FKT record was made from out of its arena's seed archive.
+ * @param chain the record's buffer
+ * @param seed receives the seed
+ * @return whether the seed was found (and matches its hash)
+ */
+static bool read_archived_seed(const sl2_fkt_chain *chain, std::vector<uint8_t> &seed) {
+  DWORD txsize;
+  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+  wchar_t seed_path[MAX_PATH + 1] = {0};
+
+  // The record came off the disk, so its arena ID may not be terminated.
+  memcpy(arena_id, chain->arena_id, SL2_HASH_LEN * sizeof(wchar_t));
+
+  if (chain->base_size > SL2_CORPUS_MAX_BUFSIZE || !sync_valid_arena_id(arena_id)) {
+    return false;
+  }
+
+  seed_archive_path(arena_id, chain->seq, chain->digest, seed_path, NULL);
+
+  HANDLE file =
+      CreateFile(seed_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  seed.resize(chain->base_size);
+
+  bool ok = seed.empty() || (ReadFile(file, seed.data(), (DWORD)seed.size(), &txsize, NULL) &&
+                             txsize == seed.size());
+
+  CloseHandle(file);
+
+  return ok && sl2_ring_hash(seed.data(), seed.size()) == chain->digest;
+}
+
+/**
+ * Makes a compact FKT record's mutated bytes, by re-applying its chain to its seed the way that
+ * the fuzzer applied it (see apply_seed and do_mutation_havoc in the fuzzer).
+ * @param chain the record's buffer
+ * @param seed the seed that the record was made from
+ * @param mutated receives the mutated bytes
+ * @return false if the chain couldn't be applied
+ */
+static bool replay_fkt_chain(const sl2_fkt_chain *chain, const std::vector<uint8_t> &seed,
+                             std::vector<uint8_t> &mutated) {
+  sl2_mutation mutation = {0};
+
+  if (chain->chain_len == 0 || chain->chain_len > SL2_MAX_MUTATION_CHAIN ||
+      chain->base_size != seed.size() || chain->capacity > SL2_UPLOAD_MAX_SIZE) {
+    return false;
+  }
+
+  mutated.assign(std::max(seed.size(), (size_t)chain->capacity), 0);
+  std::copy(seed.begin(), seed.end(), mutated.begin());
+
+  mutation.mut_type = SL2_HAVOC_STRATEGY;
+  mutation.buffer = mutated.data();
+  mutation.bufsize = seed.size();
+  mutation.capacity = (size_t)chain->capacity;
+  mutation.chain_seed = chain->chain_seed;
+  mutation.chain_len = chain->chain_len;
+  memcpy(mutation.chain, chain->chain, chain->chain_len * sizeof(chain->chain[0]));
+
+  if (!do_mutation_chain(&mutation) || mutation.bufsize != chain->mutated_size) {
+    return false;
+  }
+
+  mutated.resize(mutation.bufsize);
+
+  return true;
+}
+
+/**
+ * Serializes a stacked mutation made from a corpus seed as a compact FKT record (see
+ * SL2_FKT_CHAIN), archiving the seed if it isn't already. Mutations are only stored compactly if
+ * re-applying their chain to the seed gives exactly their bytes back, which it doesn't for ones
+ * that were, say, fixed up or spliced after their chain, or made from a seed that was cut short.
+ * See serialize_fkt for the other parameters.
+ * @param capacity the mutated buffer's capacity (see sl2_mutation)
+ * @param seed the seed that the session's run was last handed for the mutation's read
+ * @param record_size receives the size of the record, not including the journal entry
+ * @return the serialized record, which the caller must free, or NULL if the mutation can't (or
+ *         shouldn't) be stored compactly
+ */
+static uint8_t *compact_fkt(uint32_t type, uint32_t mutation_type, size_t resource_size,
+                            wchar_t *resource_path, size_t position, size_t size,
+                            const uint8_t *buf, uint64_t chain_seed, uint32_t chain_len,
+                            const uint32_t *chain, size_t capacity, sl2_served_seed *seed,
+                            size_t *record_size) {
+  sl2_fkt_chain compact = {0};
+  std::vector<uint8_t> mutated;
+
+  // A small buffer is cheaper to store than the chain that makes it.
+  if (size <= sizeof(compact) || chain_len == 0 || chain_len > SL2_MAX_MUTATION_CHAIN) {
+    return NULL;
+  }
+
+  StringCchCopyW(compact.arena_id, SL2_HASH_LEN + 1, seed->arena_id.c_str());
+  compact.seq = seed->seq;
+  compact.digest = sl2_ring_hash(seed->buf.data(), seed->buf.size());
+  compact.base_size = seed->buf.size();
+  compact.capacity = capacity;
+  compact.mutated_size = size;
+  compact.chain_seed = chain_seed;
+  compact.chain_len = chain_len;
+  memcpy(compact.chain, chain, chain_len * sizeof(chain[0]));
+
+  if (!replay_fkt_chain(&compact, seed->buf, mutated) || memcmp(mutated.data(), buf, size)) {
+    return NULL;
+  }
+
+  if (!seed->archived) {
+    seed->archived = archive_seed(*seed, compact.digest);
+  }
+
+  if (!seed->archived) {
+    return NULL;
+  }
+
+  return serialize_fkt(type, mutation_type, resource_size, resource_path, position, SL2_FKT_CHAIN,
+                       sizeof(compact), (uint8_t *)&compact, 0, 0, NULL, record_size);
+}
+
+/**
+ * Settles a session's compactly stored mutations once its run is finalized: a run that crashed
+ * gets their full records, so that it's triaged (and kept) like any other, and the rest keep
+ * their compact ones.
+ * @param pending the session's compactly stored mutations, which are cleared
+ * @param seeds the seeds that the session's run was handed, which are cleared
+ * @param crashed whether the run crashed
+ */
+static void settle_compact_fkts(sl2_pending_fkts_t *pending, sl2_served_seeds_t *seeds,
+                                bool crashed) {
+  if (crashed) {
+    for (auto &it : *pending) {
+      sl2_pending_fkt &fkt = it.second;
+
+      if (store_fkt(fkt.run.run_dir, it.first, fkt.record.data(),
+                    fkt.record.size() - sizeof(sl2_fkt_journal_entry))) {
+        SL2_SERVER_LOG_ERROR("failed to store the full FKT of mutation %u (run_id=%S)", it.first,
+                             fkt.run.run_id_s);
+      }
+    }
+  }
+
+  pending->clear();
+  seeds->clear();
+}
+
+/**
+ * Reads the FKT record stored in an FKT file, for mutation replay
+ * @param target_file - path to the fkt file
+ * @param record_size - receives the size of the record
+ * @return the record, which the caller must free
+ */
+static uint8_t *read_fkt(wchar_t *target_file, size_t *record_size) {
+  DWORD txsize;
+  LARGE_INTEGER file_size;
+
+  // NOTE(ww): Multiple threads are allowed to read from FKTs at once,
+  // so we use a shared lock here.
+  std::shared_lock<std::shared_mutex> fkt_lock(fkt_mutex);
+
+  HANDLE fkt = CreateFile(target_file, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+
+  if (fkt == INVALID_HANDLE_VALUE) {
+    SL2_SERVER_LOG_FATAL("failed to open FKT: %S", target_file);
+  }
+
+  if (!GetFileSizeEx(fkt, &file_size)) {
+    SL2_SERVER_LOG_FATAL("failed to get FKT size");
+  }
+
+  uint8_t *record = (uint8_t *)malloc(file_size.QuadPart);
+
+  if (record == NULL) {
+    SL2_SERVER_LOG_FATAL("failed to allocate FKT record");
+  }
+
+  if (!ReadFile(fkt, record, (DWORD)file_size.QuadPart, &txsize, NULL) ||
+      txsize != file_size.QuadPart) {
+    SL2_SERVER_LOG_FATAL("failed to read FKT");
+  }
+
+  if (!CloseHandle(fkt)) {
+    SL2_SERVER_LOG_FATAL("failed to close FKT");
+  }
+
+  *record_size = txsize;
+
+  return record;
+}
+
+/**
+ * Reads the FKT record for the given mutation count out of a run's mutation journal.
+ * If the mutation count was journaled more than once (e.g. by a persistent fuzzer, which starts
+ * counting from zero on each iteration), the most recent record wins.
+ * @param journal_file the run's journal
+ * @param mutate_count the mutation count to look up
+ * @param record_size receives the size of the record
+ * @return the record, which the caller must free, or NULL if the journal didn't contain the
+ *         mutation
+ */
+static uint8_t *read_fkt_journal(wchar_t *journal_file, uint32_t mutate_count,
+                                 size_t *record_size) {
+  DWORD txsize;
+  bool found = false;
+  uint8_t *record = NULL;
+  sl2_fkt_journal_entry entry;
+  sl2_fkt_journal_entry latest = {0};
+  LARGE_INTEGER latest_offset = {0};
+  LARGE_INTEGER skip;
+
+  std::shared_lock<std::shared_mutex> fkt_lock(fkt_mutex);
+
+  HANDLE journal = CreateFile(journal_file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+  if (journal == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  // Walk the entry headers, seeking past each record and remembering the last one we want.
+  while (ReadFile(journal, &entry, sizeof(entry), &txsize, NULL) && txsize == sizeof(entry)) {
+    if (entry.mutate_count == mutate_count) {
+      skip.QuadPart = 0;
+      SetFilePointerEx(journal, skip, &latest_offset, FILE_CURRENT);
+      latest = entry;
+      found = true;
+    }
+
+    skip.QuadPart = entry.record_size;
+    SetFilePointerEx(journal, skip, NULL, FILE_CURRENT);
+  }
+
+  if (found) {
+    record = (uint8_t *)malloc(latest.record_size);
+
+    if (record == NULL) {
+      SL2_SERVER_LOG_FATAL("failed to allocate FKT record");
+    }
+
+    SetFilePointerEx(journal, latest_offset, NULL, FILE_BEGIN);
+
+    if (!ReadFile(journal, record, latest.record_size, &txsize, NULL) ||
+        txsize != latest.record_size) {
+      SL2_SERVER_LOG_FATAL("truncated FKT record in journal: %S", journal_file);
+    }
+
+    *record_size = latest.record_size;
+  }
+
+  if (!CloseHandle(journal)) {
+    SL2_SERVER_LOG_FATAL("failed to close FKT journal");
+  }
+
+  return record;
+}
+
+/**
+ * Remembers a newly registered mutation's FKT record, so that replaying it (usually right after
+ * its run crashes) doesn't have to go back to the disk. The least recently used records are
+ * dropped once the cache is full. A record registered again (e.g. by a persistent fuzzer)
+ * replaces the old one, just like the journal's most recent record wins.
+ * @param run_id the mutation's run
+ * @param mutate_count the mutation's count within the run
+ * @param record the FKT record, as stored on disk
+ * @param record_size the size of the record
+ */
+static void replay_cache_put(const UUID *run_id, uint32_t mutate_count, const uint8_t *record,
+                             size_t record_size) {
+  if (record_size > std::min(opts.replay_cache_bytes, (size_t)SL2_REPLAY_CACHE_MAX_RECORD)) {
+    return;
+  }
+
+  sl2_replay_key key = {*run_id, mutate_count};
+  std::lock_guard<std::mutex> cache_lock(replay_cache_mutex);
+
+  auto found = replay_cache.find(key);
+
+  if (found != replay_cache.end()) {
+    replay_cache_size -= found->second->second.size();
+    replay_lru.erase(found->second);
+    replay_cache.erase(found);
+  }
+
+  while (!replay_lru.empty() && replay_cache_size + record_size > opts.replay_cache_bytes) {
+    replay_cache_size -= replay_lru.back().second.size();
+    replay_cache.erase(replay_lru.back().first);
+    replay_lru.pop_back();
+  }
+
+  replay_lru.emplace_front(key, std::vector<uint8_t>(record, record + record_size));
+  replay_cache[key] = replay_lru.begin();
+  replay_cache_size += record_size;
+}
+
+/**
+ * Looks a mutation's FKT record up in the replay cache.
+ * @param run_id the mutation's run
+ * @param mutate_count the mutation's count within the run
+ * @param record_size receives the size of the record
+ * @return a copy of the record, which the caller must free, or NULL if it isn't cached
+ */
+static uint8_t *replay_cache_get(const UUID *run_id, uint32_t mutate_count, size_t *record_size) {
+  sl2_replay_key key = {*run_id, mutate_count};
+  std::lock_guard<std::mutex> cache_lock(replay_cache_mutex);
+
+  auto found = replay_cache.find(key);
+
+  if (found == replay_cache.end()) {
+    return NULL;
+  }
+
+  // Move the record to the front, as the most recently used.
+  replay_lru.splice(replay_lru.begin(), replay_lru, found->second);
+
+  const std::vector<uint8_t> &cached = found->second->second;
+  uint8_t *record = (uint8_t *)malloc(cached.size());
+
+  if (record == NULL) {
+    SL2_SERVER_LOG_FATAL("failed to allocate FKT record");
+  }
+
+  memcpy(record, cached.data(), cached.size());
+  *record_size = cached.size();
+
+  return record;
+}
+
+/**
+ * Dump the raw arena to the disk. No encoding, just the bytes straight from memory.
+ * The arena is written to a temporary file first and then moved into place, so that
+ * a crash mid-write never leaves a torn arena behind.
+ * The arena's deterministic cursor (and strategy snapshot, if any) are appended to the map.
+ * With -z, all of it is compressed into a single write (see sl2_compress.hpp).
+ * Callers must make sure that nobody else is writing the same arena.
+ * @param arena_path where to dump the arena
+ * @param arena the arena to dump
+ * @param cursor the arena's deterministic cursor
+ * @param snapshot the arena's strategy snapshot, or NULL for a fresh arena
+ */
+static void dump_arena_to_disk(wchar_t *arena_path, sl2_arena *arena,
+                               const sl2_det_cursor *cursor,
+                               const sl2_strategy_snapshot *snapshot) {
+  DWORD txsize;
+  wchar_t tmp_path[MAX_PATH + 1] = {0};
+  LARGE_INTEGER start;
+  bool ok = false;
+  size_t raw_size = arena->size + sizeof(*cursor) + (snapshot ? sizeof(*snapshot) : 0);
+  std::vector<uint8_t> compressed;
+
+  QueryPerformanceCounter(&start);
+  StringCchPrintfW(tmp_path, MAX_PATH, L"%s.tmp", arena_path);
+
+  if (opts.compress) {
+    std::vector<uint8_t> raw(arena->map, arena->map + arena->size);
+
+    raw.insert(raw.end(), (const uint8_t *)cursor, (const uint8_t *)(cursor + 1));
+
+    if (snapshot) {
+      raw.insert(raw.end(), (const uint8_t *)snapshot, (const uint8_t *)(snapshot + 1));
+    }
+
+    if (!sl2_compress(raw.data(), raw.size(), compressed)) {
+      SL2_SERVER_LOG_WARN("failed to compress arena, writing it raw (arena_path=%S)", arena_path);
+      compressed.clear();
+    }
+  }
+
+  HANDLE file =
+      CreateFile(tmp_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file != INVALID_HANDLE_VALUE) {
+    if (!compressed.empty()) {
+      if (!WriteFile(file, compressed.data(), (DWORD)compressed.size(), &txsize, NULL) ||
+          txsize != compressed.size()) {
+        SL2_SERVER_LOG_FATAL("failed to write compressed arena to disk!");
+      }
+    } else {
+      if (!WriteFile(file, arena->map, arena->size, &txsize, NULL)) {
+        SL2_SERVER_LOG_FATAL("failed to write arena to disk!");
+      }
+
+      if (txsize != arena->size) {
+        SL2_SERVER_LOG_FATAL("(txsize=%lu) != (arena->size=%lu), truncated write?", txsize,
+                             arena->size);
+      }
+
+      if (!WriteFile(file, cursor, sizeof(*cursor), &txsize, NULL) || txsize != sizeof(*cursor)) {
+        SL2_SERVER_LOG_FATAL("failed to write deterministic cursor to disk!");
+      }
+
+      if (snapshot && (!WriteFile(file, snapshot, sizeof(*snapshot), &txsize, NULL) ||
+                       txsize != sizeof(*snapshot))) {
+        SL2_SERVER_LOG_FATAL("failed to write strategy snapshot to disk!");
+      }
+    }
+
+    if (!CloseHandle(file)) {
+      SL2_SERVER_LOG_ERROR("failed to close arena (tmp_path=%S)", tmp_path);
+    }
+
+    ok = MoveFileEx(tmp_path, arena_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+
+    if (!ok) {
+      SL2_SERVER_LOG_ERROR("failed to move arena into place (arena_path=%S)", arena_path);
+    }
+  } else {
+    SL2_SERVER_LOG_ERROR("failed to open tmp_path=%S, skipping dump!", tmp_path);
+  }
+
+  sl2_etw_disk_write("arena", arena_path, compressed.empty() ? raw_size : compressed.size(),
+                     us_since(start), ok);
+}
+
+/*! The size of what follows an arena's map in its file: its cursor and strategy snapshot */
+static const size_t SL2_ARENA_TRAILER_SIZE = sizeof(sl2_det_cursor) + sizeof(sl2_strategy_snapshot);
+
+/**
+ * Stores an arena's deterministic cursor and strategy snapshot right after its mapped map, where
+ * dump_arena_to_disk would have written them.
+ * @param arena the arena, mapped by map_arena_file
+ * @param cursor the arena's deterministic cursor
+ * @param snapshot the arena's strategy snapshot
+ */
+static void write_arena_trailer(sl2_arena *arena, const sl2_det_cursor *cursor,
+                                const sl2_strategy_snapshot *snapshot) {
+  uint8_t *trailer = arena->map + arena->size;
+
+  memcpy(trailer, cursor, sizeof(*cursor));
+  memcpy(trailer + sizeof(*cursor), snapshot, sizeof(*snapshot));
+}
+
+/**
+ * Writes a mapped arena's dirty pages back to its file, which is all that dumping a mapped arena
+ * takes: there's no copy of the map, and no temporary file.
+ * The file is written in place, so a crash mid-flush can leave a mix of old and new
+ * pages behind. That's harmless for the map, whose cells only ever grow, but the cursor and
+ * snapshot can come back a checkpoint older than the map. Use the copying path (no -m) if that
+ * matters more than the copies do.
+ * Callers must make sure that the arena isn't unmapped underneath the flush.
+ * @param arena the arena, mapped by map_arena_file
+ */
+static void flush_arena_file(sl2_arena *arena) {
+  wchar_t arena_path[MAX_PATH + 1] = {0};
+  LARGE_INTEGER start;
+  size_t size = arena->size + SL2_ARENA_TRAILER_SIZE;
+
+  QueryPerformanceCounter(&start);
+  PathCchCombine(arena_path, MAX_PATH, FUZZ_ARENAS_PATH, arena->id);
+
+  bool ok = FlushViewOfFile(arena->map, size);
+
+  if (!ok) {
+    SL2_SERVER_LOG_ERROR("failed to flush mapped arena (arena_path=%S)", arena_path);
+  }
+
+  sl2_etw_disk_write("arena", arena_path, size, us_since(start), ok);
+}
+
+/**
+ * @param arena_id the ID of an arena
+ * @param corpus_path receives the path of the arena's corpus file
+ */
+static void corpus_file_path(const wchar_t *arena_id, wchar_t *corpus_path) {
+  PathCchCombine(corpus_path, MAX_PATH, FUZZ_ARENAS_PATH, arena_id);
+  StringCchCatW(corpus_path, MAX_PATH, SL2_CORPUS_FILE_EXT);
+}
+
+/**
+ * @param entry a corpus entry
+ * @return the record that precedes the entry's bytes in its corpus file
+ */
+static sl2_corpus_file_entry corpus_file_entry(const sl2_corpus_entry &entry) {
+  return {entry.mut_count, entry.picks, entry.seq, entry.origin, entry.exec_us, entry.buf.size(),
+          entry.path, entry.execs};
+}
+
+/**
+ * Dumps an arena's corpus to the disk, next to the arena. Like the arena, it's written to a
+ * temporary file first and then moved into place.
+ * Callers must make sure that nobody else is writing the same corpus.
+ * @param arena_id the ID of the corpus's arena
+ * @param corpus the corpus
+ * @param corpus_next the entry that the corpus's next input replaces, once it's full
+ */
+static void dump_corpus_to_disk(const wchar_t *arena_id,
+                                const std::vector<sl2_corpus_entry> &corpus, size_t corpus_next) {
+  DWORD txsize;
+  wchar_t corpus_path[MAX_PATH + 1] = {0};
+  wchar_t tmp_path[MAX_PATH + 1] = {0};
+  LARGE_INTEGER start;
+
+  QueryPerformanceCounter(&start);
+  corpus_file_path(arena_id, corpus_path);
+  StringCchPrintfW(tmp_path, MAX_PATH, L"%s.tmp", corpus_path);
+
+  HANDLE file =
+      CreateFile(tmp_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    SL2_SERVER_LOG_ERROR("failed to open tmp_path=%S, skipping corpus dump!", tmp_path);
+    return;
+  }
+
+  sl2_corpus_file_header header = {SL2_CORPUS_MAGIC, SL2_CORPUS_VERSION, (uint32_t)corpus.size(),
+                                   (uint32_t)corpus_next};
+  bool ok = WriteFile(file, &header, sizeof(header), &txsize, NULL) && txsize == sizeof(header);
+  uint64_t bytes = sizeof(header);
+
+  for (size_t i = 0; ok && i < corpus.size(); i++) {
+    const sl2_corpus_entry &entry = corpus[i];
+    sl2_corpus_file_entry record = corpus_file_entry(entry);
+    bytes += sizeof(record) + entry.buf.size();
+
+    ok = WriteFile(file, &record, sizeof(record), &txsize, NULL) && txsize == sizeof(record);
+    ok = ok && (entry.buf.empty() ||
+                (WriteFile(file, entry.buf.data(), (DWORD)entry.buf.size(), &txsize, NULL) &&
+                 txsize == entry.buf.size()));
+  }
+
+  if (!CloseHandle(file)) {
+    SL2_SERVER_LOG_ERROR("failed to close corpus (tmp_path=%S)", tmp_path);
+  }
+
+  if (!ok) {
+    SL2_SERVER_LOG_ERROR("failed to write corpus to disk (tmp_path=%S)", tmp_path);
+    DeleteFile(tmp_path);
+    sl2_etw_disk_write("corpus", corpus_path, bytes, us_since(start), false);
+    return;
+  }
+
+  ok = MoveFileEx(tmp_path, corpus_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+
+  if (!ok) {
+    SL2_SERVER_LOG_ERROR("failed to move corpus into place (corpus_path=%S)", corpus_path);
+  }
+
+  sl2_etw_disk_write("corpus", corpus_path, bytes, us_since(start), ok);
+}
+
+/**
+ * Reads an arena's corpus from the disk, if it has one.
+ * @param arena_id the ID of the corpus's arena
+ * @param corpus the corpus to load into, which must be empty. Left empty on failure
+ * @param corpus_next receives the entry that the corpus's next input replaces, once it's full
+ * @return whether a corpus was read
+ */
+static bool load_corpus_from_disk(const wchar_t *arena_id, std::vector<sl2_corpus_entry> &corpus,
+                                  size_t *corpus_next) {
+  DWORD txsize;
+  wchar_t corpus_path[MAX_PATH + 1] = {0};
+
+  corpus_file_path(arena_id, corpus_path);
+
+  HANDLE file =
+      CreateFile(corpus_path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  // Arenas that haven't found anything yet don't have a corpus file.
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  sl2_corpus_file_header header = {0};
+  bool ok = ReadFile(file, &header, sizeof(header), &txsize, NULL) && txsize == sizeof(header) &&
+            header.magic == SL2_CORPUS_MAGIC &&
+            (header.version == SL2_CORPUS_VERSION || header.version == 1) &&
+            header.count <= SL2_CORPUS_SIZE;
+
+  // A version 1 entry is a version 2 entry without the seed statistics at its end, and
+  // its reserved field (now picks) is always 0.
+  DWORD record_size = header.version == 1 ? (DWORD)offsetof(sl2_corpus_file_entry, path)
+                                          : (DWORD)sizeof(sl2_corpus_file_entry);
+
+  for (uint32_t i = 0; ok && i < header.count; i++) {
+    sl2_corpus_file_entry record = {0};
+
+    ok = ReadFile(file, &record, record_size, &txsize, NULL) && txsize == record_size &&
+         record.size <= SL2_CORPUS_MAX_BUFSIZE;
+
+    if (ok) {
+      std::vector<uint8_t> buf(record.size);
+      ok = buf.empty() ||
+           (ReadFile(file, buf.data(), (DWORD)buf.size(), &txsize, NULL) && txsize == buf.size());
+      corpus.push_back({record.mut_count, std::move(buf), record.seq, record.origin,
+                        record.exec_us, record.path, record.picks, record.execs,
+                        SL2_DISTANCE_NONE});
+    }
+  }
+
+  CloseHandle(file);
+
+  if (!ok) {
+    SL2_SERVER_LOG_ERROR("bad corpus file, ignoring it (corpus_path=%S)", corpus_path);
+    corpus.clear();
+    return false;
+  }
+
+  *corpus_next = header.next < corpus.size() ? header.next : 0;
+
+  return true;
+}
+
+/**
+ * @param arena_id the ID of an arena
+ * @param unstable_path receives the path of the arena's unstable cells file
+ */
+static void unstable_file_path(const wchar_t *arena_id, wchar_t *unstable_path) {
+  PathCchCombine(unstable_path, MAX_PATH, FUZZ_ARENAS_PATH, arena_id);
+  StringCchCatW(unstable_path, MAX_PATH, SL2_UNSTABLE_FILE_EXT);
+}
+
+/**
+ * Writes an arena's unstable cells to the disk, next to the arena: a uint32_t count, followed by
+ * that many cell indices.
+ * @param arena_id the ID of the arena
+ * @param unstable the arena's unstable cells
+ */
+static void dump_unstable_to_disk(const wchar_t *arena_id, const std::vector<uint32_t> &unstable) {
+  DWORD txsize;
+  wchar_t unstable_path[MAX_PATH + 1] = {0};
+  uint32_t count = (uint32_t)unstable.size();
+
+  unstable_file_path(arena_id, unstable_path);
+
+  HANDLE file =
+      CreateFile(unstable_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    SL2_SERVER_LOG_ERROR("failed to open unstable_path=%S, skipping dump!", unstable_path);
+    return;
+  }
+
+  bool ok = WriteFile(file, &count, sizeof(count), &txsize, NULL) && txsize == sizeof(count) &&
+            (!count || (WriteFile(file, unstable.data(), count * sizeof(uint32_t), &txsize, NULL) &&
+                        txsize == count * sizeof(uint32_t)));
+
+  CloseHandle(file);
+
+  if (!ok) {
+    SL2_SERVER_LOG_ERROR("failed to write unstable cells (unstable_path=%S)", unstable_path);
+    DeleteFile(unstable_path);
+  }
+}
+
+/**
+ * Reads an arena's unstable cells from the disk, if it has any.
+ * @param arena_id the ID of the arena
+ * @param map_size the size of the arena's map, which every cell must be inside of
+ * @param unstable receives the arena's unstable cells, sorted. Left empty on failure
+ * @return whether any unstable cells were read
+ */
+static bool load_unstable_from_disk(const wchar_t *arena_id, uint32_t map_size,
+                                    std::vector<uint32_t> &unstable) {
+  DWORD txsize;
+  wchar_t unstable_path[MAX_PATH + 1] = {0};
+  uint32_t count = 0;
+
+  unstable_file_path(arena_id, unstable_path);
+
+  HANDLE file =
+      CreateFile(unstable_path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  // Arenas that were never calibrated don't have an unstable cells file.
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  bool ok = ReadFile(file, &count, sizeof(count), &txsize, NULL) && txsize == sizeof(count) &&
+            count <= map_size;
+
+  if (ok && count) {
+    unstable.resize(count);
+    ok = ReadFile(file, unstable.data(), count * sizeof(uint32_t), &txsize, NULL) &&
+         txsize == count * sizeof(uint32_t);
+  }
+
+  CloseHandle(file);
+
+  ok = ok && std::is_sorted(unstable.begin(), unstable.end()) &&
+       (unstable.empty() || unstable.back() < map_size);
+
+  if (!ok) {
+    SL2_SERVER_LOG_ERROR("bad unstable cells file, ignoring it (unstable_path=%S)", unstable_path);
+    unstable.clear();
+  }
+
+  return !unstable.empty();
+}
+
+/*! The fewest tries that a strategy gets (unless -s is 0), however poorly it's done so far, so
+ * that it still gets a chance to prove itself */
+#define SL2_STICKINESS_FLOOR 1
+
+/*! The most tries that a strategy gets, as a multiple of -s */
+#define SL2_STICKINESS_MAX_SCALE 4
+
+/**
+ * Works out how many runs in a row that don't increase coverage a strategy gets before the
+ * legacy scheduler moves on. -s is what a strategy that yields as often as the schedule's
+ * strategies do on average gets, and each strategy gets more or fewer tries in proportion to how
+ * often its own runs have increased coverage (smoothed, so that untried strategies count as
+ * average).
+ * @param state the schedule, whose arena's strategy state is locked
+ * @param strategy the strategy
+ * @return the strategy's stickiness, between SL2_STICKINESS_FLOOR and SL2_STICKINESS_MAX_SCALE
+ *         times -s
+ */
+static uint32_t strategy_stickiness(const sl2_schedule &state, uint32_t strategy) {
+  uint64_t total_pulls = 0;
+  uint64_t total_rewards = 0;
+
+  if (!opts.stickiness) {
+    return 0;
+  }
+
+  for (int i = 0; i < SL2_NUM_STRATEGIES; ++i) {
+    total_pulls += state.pulls[i];
+    total_rewards += state.rewards[i];
+  }
+
+  double yield = (state.rewards[strategy] + 1.0) / (state.pulls[strategy] + 2.0);
+  double mean = (total_rewards + 1.0) / (total_pulls + 2.0);
+  double tries = round(opts.stickiness * yield / mean);
+
+  return (uint32_t)std::min(std::max(tries, (double)SL2_STICKINESS_FLOOR),
+                            (double)opts.stickiness * SL2_STICKINESS_MAX_SCALE);
+}
+
+/**
+ * Takes a snapshot of what an arena's strategy state keeps across restarts.
+ * @param state the arena's strategy state, locked
+ * @param snapshot the snapshot to fill in
+ */
+static void take_strategy_snapshot(const strategy_state &state, sl2_strategy_snapshot *snapshot) {
+  memset(snapshot, 0, sizeof(*snapshot));
+  snapshot->magic = SL2_SNAPSHOT_MAGIC;
+  snapshot->version = SL2_SNAPSHOT_VERSION;
+  snapshot->num_strategies = SL2_NUM_STRATEGIES;
+  snapshot->strategy = state.strategy;
+  snapshot->tries_remaining = state.tries_remaining;
+
+  for (const auto &success : state.success_map) {
+    if (success.first < SL2_NUM_STRATEGIES) {
+      snapshot->successes[success.first] = success.second;
+    }
+  }
+
+  memcpy(snapshot->pulls, state.pulls, sizeof(snapshot->pulls));
+  memcpy(snapshot->rewards, state.rewards, sizeof(snapshot->rewards));
+  memcpy(snapshot->synced_pulls, state.synced_pulls, sizeof(snapshot->synced_pulls));
+  memcpy(snapshot->synced_rewards, state.synced_rewards, sizeof(snapshot->synced_rewards));
+  snapshot->corpus_seq = state.corpus_seq;
+  snapshot->synced_corpus_seq = state.synced_corpus_seq;
+  snapshot->pushed_corpus_seq = state.pushed_corpus_seq;
+}
+
+/**
+ * Puts an arena's strategy state back the way it was when a snapshot of it was taken.
+ * @param state the arena's strategy state, locked exclusively
+ * @param snapshot the snapshot, which must be valid (see load_arena_from_disk)
+ */
+static void apply_strategy_snapshot(strategy_state &state, const sl2_strategy_snapshot *snapshot) {
+  state.strategy = snapshot->strategy % SL2_NUM_STRATEGIES;
+  state.success_map.clear();
+
+  for (uint32_t i = 0; i < SL2_NUM_STRATEGIES; i++) {
+    if (snapshot->successes[i]) {
+      state.success_map[i] = snapshot->successes[i];
+    }
+  }
+
+  memcpy(state.pulls, snapshot->pulls, sizeof(state.pulls));
+  memcpy(state.rewards, snapshot->rewards, sizeof(state.rewards));
+  // The server may have been restarted with a different -s.
+  state.tries_remaining =
+      std::min(snapshot->tries_remaining, strategy_stickiness(state, state.strategy));
+  memcpy(state.synced_pulls, snapshot->synced_pulls, sizeof(state.synced_pulls));
+  memcpy(state.synced_rewards, snapshot->synced_rewards, sizeof(state.synced_rewards));
+  state.corpus_seq = snapshot->corpus_seq;
+  state.synced_corpus_seq = snapshot->synced_corpus_seq;
+  state.pushed_corpus_seq = snapshot->pushed_corpus_seq;
+}
+
+/**
+ * Writes an arena, along with its cursor and strategy snapshot, to the disk. So is its corpus,
+ * if it's changed.
+ * @param state the arena's strategy state, locked exclusively, whose arena is in memory
+ */
+static void dump_strategy_state(strategy_state &state) {
+  wchar_t arena_path[MAX_PATH + 1] = {0};
+  sl2_strategy_snapshot snapshot;
+
+  PathCchCombine(arena_path, MAX_PATH, FUZZ_ARENAS_PATH, state.arena->id);
+  take_strategy_snapshot(state, &snapshot);
+
+  if (sl2_arena_mapped(state.arena.get())) {
+    write_arena_trailer(state.arena.get(), &state.cursor, &snapshot);
+    flush_arena_file(state.arena.get());
+  } else {
+    dump_arena_to_disk(arena_path, state.arena.get(), &state.cursor, &snapshot);
+  }
+
+  if (state.corpus_dirty) {
+    dump_corpus_to_disk(state.arena->id, state.corpus, state.corpus_next);
+    state.corpus_dirty = false;
+  }
+}
+
+/**
+ * Frees the memory behind an idle arena, which must have been written back to the disk already
+ * (corpus included). Its strategy and scheduler statistics stay in memory; its map and corpus
+ * are read back from the disk by the next run that requests it (see restore_arena).
+ * @param state the arena's strategy state, locked exclusively
+ */
+static void evict_arena(strategy_state &state) {
+  state.arena.reset();
+  std::vector<sl2_corpus_entry>().swap(state.corpus);
+  state.corpus_next = 0;
+  std::vector<uint8_t>().swap(state.virgin);
+  // Like a restarted node, a node pushes its whole arena again once it's restored.
+  std::vector<uint8_t>().swap(state.synced_map);
+}
+
+/**
+ * @param state an arena's strategy state
+ * @param now the current GetTickCount64
+ * @return whether the arena has gone long enough without runs to be evicted
+ */
+static bool arena_idle(const strategy_state &state, uint64_t now) {
+  return opts.evict_idle && now - state.last_used > (uint64_t)opts.evict_idle * 1000;
+}
+
+/**
+ * Writes every dirty arena (and corpus) in the strategy map back to the disk, and evicts the idle
+ * ones. Each arena is snapshotted under its own lock, so fuzzers only wait on the copy and never
+ * on the disk. Mapped arenas (-m) aren't copied at all: their trailers are updated under the lock,
+ * and their views flushed outside of it.
+ */
+static void checkpoint_arenas() {
+  std::vector<strategy_state *> states;
+  std::lock_guard<std::mutex> checkpoint_lock(checkpoint_mutex);
+
+  {
+    std::shared_lock<std::shared_mutex> strategy_lock(strategy_mutex);
+
+    for (auto &entry : strategy_map) {
+      states.push_back(&(entry.second));
+    }
+  }
+
+  sl2_arena snapshot = {0};
+  std::vector<uint8_t> snapshot_map;
+  sl2_arena *mapped = NULL;
+  sl2_det_cursor cursor;
+  sl2_strategy_snapshot strategy;
+
+  uint32_t written = 0;
+  uint32_t evicted = 0;
+  uint64_t now = GetTickCount64();
+
+  for (strategy_state *state : states) {
+    bool idle = arena_idle(*state, now);
+    bool arena_dirty = false;
+    bool corpus_dirty = false;
+    wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+    std::vector<sl2_corpus_entry> corpus;
+    size_t corpus_next = 0;
+
+    {
+      std::unique_lock<std::shared_mutex> state_lock(state->mutex);
+
+      if (!state->arena) {
+        continue;
+      }
+
+      if (!state->dirty && !state->corpus_dirty) {
+        if (idle) {
+          evict_arena(*state);
+          evicted++;
+        }
+        continue;
+      }
+
+      wcscpy_s(arena_id, state->arena->id);
+      arena_dirty = state->dirty;
+      corpus_dirty = state->corpus_dirty;
+
+      mapped = sl2_arena_mapped(state->arena.get()) ? state->arena.get() : NULL;
+
+      if (arena_dirty) {
+        take_strategy_snapshot(*state, &strategy);
+
+        if (mapped) {
+          write_arena_trailer(mapped, &(state->cursor), &strategy);
+        } else {
+          snapshot_map.assign(state->arena->map, state->arena->map + state->arena->size);
+          wcscpy_s(snapshot.id, state->arena->id);
+          snapshot.size = state->arena->size;
+          snapshot.map = snapshot_map.data();
+          cursor = state->cursor;
+        }
+
+        state->dirty = false;
+      }
+
+      if (corpus_dirty) {
+        corpus = state->corpus;
+        corpus_next = state->corpus_next;
+        state->corpus_dirty = false;
+      }
+    }
+
+    // Only this thread evicts arenas, so a mapped arena stays mapped while it's flushed.
+    if (arena_dirty && mapped) {
+      flush_arena_file(mapped);
+    } else if (arena_dirty) {
+      wchar_t arena_path[MAX_PATH + 1] = {0};
+      PathCchCombine(arena_path, MAX_PATH, FUZZ_ARENAS_PATH, arena_id);
+      dump_arena_to_disk(arena_path, &snapshot, &cursor, &strategy);
+    }
+
+    if (corpus_dirty) {
+      dump_corpus_to_disk(arena_id, corpus, corpus_next);
+    }
+
+    written++;
+
+    // A run may have come back to the arena while we were writing it.
+    if (idle) {
+      std::unique_lock<std::shared_mutex> state_lock(state->mutex);
+
+      if (state->arena && !state->dirty && !state->corpus_dirty &&
+          arena_idle(*state, GetTickCount64())) {
+        evict_arena(*state);
+        evicted++;
+      }
+    }
+  }
+
+  if (written || evicted) {
+    SL2_SERVER_LOG_INFO("checkpointed %d arenas, evicted %d idle arenas", written, evicted);
+  }
+}
+
+/**
+ * Periodically writes dirty arenas to the disk, so that handle_set_arena doesn't have to.
+ * @param data unused
+ * @return error code (0)
+ */
+static DWORD WINAPI checkpoint_thread(void *data) {
+  while (1) {
+    Sleep(opts.checkpoint_interval * 1000);
+    checkpoint_arenas();
+  }
+
+  return 0;
+}
+
+/**
+ * @param arena_id the ID of an arena
+ * @param series_path receives the path of the arena's time series file
+ */
+static void series_file_path(const wchar_t *arena_id, wchar_t *series_path) {
+  PathCchCombine(series_path, MAX_PATH, FUZZ_ARENAS_PATH, arena_id);
+  StringCchCatW(series_path, MAX_PATH, SL2_SERIES_FILE_EXT);
+}
+
+/**
+ * @return the current time, in seconds since the Unix epoch
+ */
+static uint64_t unix_time() {
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+
+  // FILETIMEs count 100ns intervals since 1601.
+  uint64_t ticks = ((uint64_t)now.dwHighDateTime << 32) | now.dwLowDateTime;
+  return (ticks - 116444736000000000ULL) / 10000000ULL;
+}
+
+/**
+ * Reads a time series file's header.
+ * @param file the time series file, positioned at its start
+ * @param header receives the header
+ * @return whether the file has a header of this version, whose ring is where it says it is
+ */
+static bool read_series_header(HANDLE file, sl2_series_header *header) {
+  DWORD txsize;
+  LARGE_INTEGER size;
+
+  if (!GetFileSizeEx(file, &size) || !ReadFile(file, header, sizeof(*header), &txsize, NULL) ||
+      txsize != sizeof(*header)) {
+    return false;
+  }
+
+  return header->magic == SL2_SERIES_MAGIC && header->version == SL2_SERIES_VERSION &&
+         header->capacity && header->next < header->capacity &&
+         header->count <= header->capacity &&
+         (uint64_t)size.QuadPart >=
+             sizeof(*header) + (uint64_t)header->capacity * sizeof(sl2_series_sample);
+}
+
+/**
+ * Appends a sample to an arena's time series, overwriting its oldest sample once its ring is
+ * full. Series that aren't of this version (or that are damaged) are started over.
+ * Callers must hold series_mutex.
+ * @param arena_id the ID of the arena
+ * @param sample the sample
+ */
+static void append_series_sample(const wchar_t *arena_id, const sl2_series_sample &sample) {
+  DWORD txsize;
+  wchar_t series_path[MAX_PATH + 1] = {0};
+  sl2_series_header header = {0};
+
+  series_file_path(arena_id, series_path);
+
+  HANDLE file = CreateFile(series_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                           OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    SL2_SERVER_LOG_ERROR("failed to open series_path=%S, skipping sample!", series_path);
+    return;
+  }
+
+  if (!read_series_header(file, &header) || header.capacity != SL2_SERIES_CAPACITY) {
+    header = {SL2_SERIES_MAGIC, SL2_SERIES_VERSION, opts.series_interval, SL2_SERIES_CAPACITY, 0,
+              0};
+  }
+
+  // The ring's slots are fixed, so a sample is a single write in place, and the header
+  // is only rewritten after it.
+  LARGE_INTEGER offset;
+  offset.QuadPart = sizeof(header) + (uint64_t)header.next * sizeof(sample);
+
+  bool ok = SetFilePointerEx(file, offset, NULL, FILE_BEGIN) &&
+            WriteFile(file, &sample, sizeof(sample), &txsize, NULL) && txsize == sizeof(sample);
+
+  if (ok) {
+    header.interval = opts.series_interval;
+    header.next = (header.next + 1) % header.capacity;
+    header.count = std::min(header.count + 1, header.capacity);
+    offset.QuadPart = 0;
+
+    ok = SetFilePointerEx(file, offset, NULL, FILE_BEGIN) &&
+         WriteFile(file, &header, sizeof(header), &txsize, NULL) && txsize == sizeof(header);
+  }
+
+  CloseHandle(file);
+
+  if (!ok) {
+    SL2_SERVER_LOG_ERROR("failed to write series sample (series_path=%S)", series_path);
+  }
+}
+
+/**
+ * Reads an arena's time series, oldest sample first.
+ * Callers must hold series_mutex.
+ * @param arena_id the ID of the arena
+ * @param header receives the series's header. Its count is 0 if the arena has no series
+ * @param samples receives the samples
+ */
+static void read_series(const wchar_t *arena_id, sl2_series_header *header,
+                        std::vector<sl2_series_sample> &samples) {
+  DWORD txsize;
+  wchar_t series_path[MAX_PATH + 1] = {0};
+
+  *header = {SL2_SERIES_MAGIC, SL2_SERIES_VERSION, opts.series_interval, SL2_SERIES_CAPACITY, 0, 0};
+  samples.clear();
+
+  series_file_path(arena_id, series_path);
+
+  HANDLE file = CreateFile(series_path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    return;
+  }
+
+  std::vector<sl2_series_sample> ring;
+  sl2_series_header found;
+
+  if (read_series_header(file, &found)) {
+    ring.resize(found.capacity);
+    DWORD size = found.capacity * sizeof(sl2_series_sample);
+
+    if (ReadFile(file, ring.data(), size, &txsize, NULL) && txsize == size) {
+      uint32_t start = found.count < found.capacity ? 0 : found.next;
+
+      for (uint32_t i = 0; i < found.count; ++i) {
+        samples.push_back(ring[(start + i) % found.capacity]);
+      }
+
+      *header = found;
+    }
+  }
+
+  CloseHandle(file);
+}
+
+/**
+ * Samples the metrics of every arena that's had runs since its last sample into its time series.
+ * Idle arenas get no samples, so their series have gaps rather than runs of empty samples.
+ */
+static void sample_series() {
+  std::vector<std::pair<std::wstring, strategy_state *>> states;
+
+  {
+    std::shared_lock<std::shared_mutex> strategy_lock(strategy_mutex);
+
+    for (auto &entry : strategy_map) {
+      states.emplace_back(entry.first, &(entry.second));
+    }
+  }
+
+  std::lock_guard<std::mutex> series_lock(series_mutex);
+  uint64_t now = unix_time();
+  uint32_t sampled = 0;
+
+  for (auto &entry : states) {
+    strategy_state *state = entry.second;
+    sl2_series_sample sample = {0};
+
+    {
+      std::unique_lock<std::shared_mutex> state_lock(state->mutex);
+
+      if (!state->series_execs) {
+        continue;
+      }
+
+      sample.time = now;
+      sample.execs = state->series_execs;
+      sample.new_cells = (uint32_t)std::min(state->series_new_cells, (uint64_t)UINT32_MAX);
+      sample.score = state->score;
+      sample.paths = state->path_counts.size();
+      sample.crashes = state->series_crashes;
+      sample.mean_exec_us = state->series_exec_us / state->series_execs;
+
+      state->series_execs = 0;
+      state->series_new_cells = 0;
+      state->series_crashes = 0;
+      state->series_exec_us = 0;
+    }
+
+    append_series_sample(entry.first.c_str(), sample);
+    sampled++;
+  }
+
+  SL2_SERVER_LOG_DEBUG("sampled %u arenas into their time series", sampled);
+}
+
+/**
+ * Periodically samples the busy arenas' metrics into their time series.
+ * @param data unused
+ * @return error code (0)
+ */
+static DWORD WINAPI series_thread(void *data) {
+  while (1) {
+    Sleep(opts.series_interval * 1000);
+    sample_series();
+  }
+
+  return 0;
+}
+
+/*! The live stats section (see sl2_live_stats), mapped for as long as the server runs */
+static HANDLE live_stats_section = NULL;
+static sl2_live_stats *live_stats = NULL;
+
+/**
+ * Creates the live stats section, named after the server's instance. The server goes without it
+ * if it can't be created.
+ * @return whether the section was created
+ */
+static bool init_live_stats() {
+  wchar_t section_name[MAX_PATH + 1] = {0};
+
+  if (server_instance[0]) {
+    StringCchPrintfW(section_name, MAX_PATH, FUZZ_STATS_SECTION_FMT, server_instance);
+  } else {
+    StringCchCopyW(section_name, MAX_PATH, FUZZ_STATS_SECTION);
+  }
+
+  live_stats_section = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+                                         sizeof(sl2_live_stats), section_name);
+
+  if (live_stats_section == NULL) {
+    SL2_SERVER_LOG_WARN("couldn't create the live stats section (GLE=%d)", GetLastError());
+    return false;
+  }
+
+  live_stats = (sl2_live_stats *)MapViewOfFile(live_stats_section, FILE_MAP_ALL_ACCESS, 0, 0,
+                                               sizeof(sl2_live_stats));
+
+  if (live_stats == NULL) {
+    SL2_SERVER_LOG_WARN("couldn't map the live stats section (GLE=%d)", GetLastError());
+    CloseHandle(live_stats_section);
+    live_stats_section = NULL;
+    return false;
+  }
+
+  // The section starts out zeroed, and readers ignore it until the magic is in place.
+  live_stats->version = SL2_LIVE_STATS_VERSION;
+  live_stats->started = unix_time();
+  MemoryBarrier();
+  live_stats->magic = SL2_LIVE_STATS_MAGIC;
+
+  return true;
+}
+
+/**
+ * Publishes the server's stats and the most recently used arenas' totals into the live stats
+ * section. Everything is gathered first, so that the seqlock is only held for a single copy.
+ */
+static void publish_live_stats() {
+  static sl2_live_stats snapshot;
+  std::vector<std::pair<std::wstring, strategy_state *>> states;
+
+  {
+    std::shared_lock<std::shared_mutex> strategy_lock(strategy_mutex);
+
+    for (auto &entry : strategy_map) {
+      states.emplace_back(entry.first, &(entry.second));
+    }
+  }
+
+  std::sort(states.begin(), states.end(), [](const auto &a, const auto &b) {
+    return a.second->last_used.load() > b.second->last_used.load();
+  });
+
+  memset(&snapshot, 0, sizeof(snapshot));
+  snapshot.published = unix_time();
+  snapshot.active_connections = active_connections;
+  snapshot.total_arenas = (uint32_t)states.size();
+
+  for (uint32_t i = 0; i < SL2_STATS_NUM_EVENTS; ++i) {
+    snapshot.events += event_counters[i].count;
+  }
+
+  for (auto &entry : states) {
+    strategy_state *state = entry.second;
+    std::shared_lock<std::shared_mutex> state_lock(state->mutex);
+
+    snapshot.path_runs += state->path_runs;
+    snapshot.paths += state->path_counts.size();
+
+    if (snapshot.arena_count == SL2_LIVE_STATS_ARENAS) {
+      continue;
+    }
+
+    sl2_live_arena *arena = &(snapshot.arenas[snapshot.arena_count++]);
+    arena->execs = state->live_execs;
+    arena->new_cells = state->live_new_cells;
+    arena->crashes = state->live_crashes;
+    arena->exec_us = state->live_exec_us;
+    arena->paths = state->path_counts.size();
+    arena->corpus = state->corpus.size();
+    arena->score = state->score;
+    StringCchCopyW(arena->id, SL2_HASH_LEN + 1, entry.first.c_str());
+  }
+
+  // The interlocked increments are full barriers, so the copy can't leak out from
+  // between them. Everything up to the publish time was set once, in init_live_stats.
+  size_t header = offsetof(sl2_live_stats, published);
+
+  InterlockedIncrement64(&(live_stats->seq));
+  memcpy((uint8_t *)live_stats + header, (uint8_t *)&snapshot + header,
+         sizeof(snapshot) - header);
+  InterlockedIncrement64(&(live_stats->seq));
+}
+
+/**
+ * Periodically publishes the server's live stats.
+ * @param data unused
+ * @return error code (0)
+ */
+static DWORD WINAPI live_stats_thread(void *data) {
+  while (1) {
+    publish_live_stats();
+    Sleep(SL2_LIVE_STATS_INTERVAL_MS);
+  }
+
+  return 0;
+}
+
+/**
+ * @param snapshot a strategy snapshot read back with an arena
+ * @return whether the snapshot is one of the current version, for the current strategies
+ */
+static bool snapshot_usable(const sl2_strategy_snapshot *snapshot) {
+  return snapshot->magic == SL2_SNAPSHOT_MAGIC && snapshot->version == SL2_SNAPSHOT_VERSION &&
+         snapshot->num_strategies == SL2_NUM_STRATEGIES;
+}
+
+/**
+ * Reads the arena from the disk, straight into the memory. Compressed arenas (see
+ * dump_arena_to_disk) are decompressed first, whether or not the server was started with -z.
+ * Callers must hold the arena's strategy lock exclusively.
+ * @param arena_path the path from which to read the arema
+ * @param arena the arena to load into
+ * @param cursor the deterministic cursor to load into. Arenas written before cursors were
+ *               stored just start over at the first stage
+ * @param snapshot the strategy snapshot to load into. Its magic is left 0 unless the arena had
+ *                 one of the current version
+ * @return success
+ */
+static bool load_arena_from_disk(wchar_t *arena_path, sl2_arena *arena, sl2_det_cursor *cursor,
+                                 sl2_strategy_snapshot *snapshot) {
+  DWORD txsize;
+  LARGE_INTEGER file_size = {0};
+  std::vector<uint8_t> contents;
+  size_t max_size = arena->size + sizeof(*cursor) + sizeof(*snapshot);
+
+  HANDLE file =
+      CreateFile(arena_path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    SL2_SERVER_LOG_ERROR("failed to open arena (arena_path=%S)", arena_path);
+    return false;
+  }
+
+  // Nothing past a snapshot is ever used, and a compressed arena is never much bigger
+  // than a raw one.
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart < 0) {
+    SL2_SERVER_LOG_ERROR("failed to size arena (arena_path=%S)", arena_path);
+    CloseHandle(file);
+    return false;
+  }
+
+  contents.resize((size_t)std::min<int64_t>(file_size.QuadPart, 2 * max_size));
+
+  if (!ReadFile(file, contents.data(), (DWORD)contents.size(), &txsize, NULL)) {
+    SL2_SERVER_LOG_ERROR("failed to read arena from disk!");
+    CloseHandle(file);
+    return false;
+  }
+
+  contents.resize(txsize);
+
+  if (!CloseHandle(file)) {
+    SL2_SERVER_LOG_ERROR("failed to close arena (arena_path=%S)", arena_path);
+    return false;
+  }
+
+  if (sl2_is_compressed(contents.data(), contents.size())) {
+    uint64_t raw_size = sl2_compressed_raw_size(contents.data());
+    std::vector<uint8_t> raw((size_t)std::min<uint64_t>(raw_size, max_size));
+
+    // A raw map could start with the magic too, so one that doesn't decompress is
+    // taken as it is.
+    if (raw_size <= max_size &&
+        sl2_decompress(contents.data(), contents.size(), raw.data(), raw.size())) {
+      contents.swap(raw);
+    } else {
+      SL2_SERVER_LOG_WARN("arena didn't decompress, reading it raw (arena_path=%S)", arena_path);
+    }
+  }
+
+  if (contents.size() < arena->size) {
+    SL2_SERVER_LOG_ERROR("(size=%llu) < (arena->size=%lu), truncated read?",
+                         (unsigned long long)contents.size(), arena->size);
+    return false;
+  }
+
+  memcpy(arena->map, contents.data(), arena->size);
+
+  size_t offset = arena->size;
+
+  if (contents.size() - offset < sizeof(*cursor)) {
+    SL2_SERVER_LOG_WARN("no deterministic cursor stored with the arena, starting over");
+    memset(cursor, 0, sizeof(*cursor));
+  } else {
+    memcpy(cursor, contents.data() + offset, sizeof(*cursor));
+    offset += sizeof(*cursor);
+  }
+
+  // Arenas written before snapshots were stored (or by another version) just relearn
+  // their strategies.
+  if (contents.size() - offset < sizeof(*snapshot)) {
+    memset(snapshot, 0, sizeof(*snapshot));
+  } else {
+    memcpy(snapshot, contents.data() + offset, sizeof(*snapshot));
+  }
+
+  if (!snapshot_usable(snapshot)) {
+    SL2_SERVER_LOG_WARN("no usable strategy snapshot stored with the arena, starting over");
+    memset(snapshot, 0, sizeof(*snapshot));
+  }
+
+  return true;
+}
+
+/**
+ * Keeps a copy of a run's input, in case the run increases its arena's coverage.
+ * @param inputs the session's inputs
+ * @param mutate_count the targeted read that the input was given to
+ * @param buf the input
+ * @param size the size of the input
+ */
+static void keep_run_input(sl2_run_inputs_t *inputs, uint32_t mutate_count, const uint8_t *buf,
+                           size_t size) {
+  if (mutate_count >= SL2_CORPUS_MAX_READS || size > SL2_CORPUS_MAX_BUFSIZE) {
+    return;
+  }
+
+  (*inputs)[mutate_count].assign(buf, buf + size);
+}
+
+/**
+ * Stringifies a run's ID and resolves its directory.
+ * @param run the run, whose ID is filled in
+ */
+static void resolve_run(sl2_run_ref *run) {
+  wchar_t *run_id_s;
+
+  if (UuidToString(&(run->run_id), (RPC_WSTR *)&run_id_s) != RPC_S_OK) {
+    SL2_SERVER_LOG_FATAL("couldn't stringify UUID");
+  }
+
+  wcscpy_s(run->run_id_s, run_id_s);
+  RpcStringFree((RPC_WSTR *)&run_id_s);
+
+  PathCchCombine(run->run_dir, MAX_PATH, FUZZ_WORKING_PATH, run->run_id_s);
+}
+
+/**
+ * Finds the run that an event is for: the session's, if it's bound to one, and otherwise the
+ * one whose ID the event starts with.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param session the session
+ * @param scratch where to resolve the event's run, for unbound sessions
+ * @return the event's run
+ */
+static const sl2_run_ref *read_run(HANDLE pipe, const sl2_session *session,
+                                   sl2_run_ref *scratch) {
+  DWORD txsize;
+
+  if (session->bound) {
+    return &(session->run);
+  }
+
+  if (!pipe_read(pipe, &(scratch->run_id), sizeof(scratch->run_id), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read run ID");
+  }
+
+  resolve_run(scratch);
+
+  return scratch;
+}
+
+/**
+ * Binds a session to a run, so that its later events don't have to send the run's ID (and the
+ * server doesn't have to stringify it and resolve its directory for each of them).
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param session the session
+ */
+static void handle_session_begin(HANDLE pipe, sl2_session *session) {
+  DWORD txsize;
+
+  if (!pipe_read(pipe, &(session->run.run_id), sizeof(session->run.run_id), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read run ID");
+  }
+
+  resolve_run(&(session->run));
+  session->bound = true;
+
+  SL2_SERVER_LOG_DEBUG("session bound to run %S", session->run.run_id_s);
+}
+
+/**
+ * Receives mutated bytes from the fuzzer
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param session the session, which may be bound to the event's run (see EVT_SESSION_BEGIN)
+ * @param inputs the session's inputs, which the mutated bytes are added to
+ * @param targets the session's mutated targets, which the mutation's targeted call is added to
+ * @param upload the session's upload section, which shared mutations are journalled straight from
+ * @param seeds the seeds that the session's run has been handed, which mutations made from them
+ *              may be stored compactly against (with -K)
+ * @param pending the session's compactly stored mutations, which the mutation may be added to
+ */
+static void handle_register_mutation(HANDLE pipe, const sl2_session *session,
+                                     sl2_run_inputs_t *inputs, sl2_run_targets_t *targets,
+                                     const sl2_upload_section *upload, sl2_served_seeds_t *seeds,
+                                     sl2_pending_fkts_t *pending) {
+  DWORD txsize;
+  sl2_run_ref scratch;
+  uint8_t status = 0;
+  bool shared = false;
+
+  SL2_SERVER_LOG_DEBUG("starting mutation registration");
+
+  const sl2_run_ref *run = read_run(pipe, session, &scratch);
+
+  uint32_t type = 0;
+  if (!pipe_read(pipe, &type, sizeof(type), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read function type");
+  }
+
+  uint32_t mutate_count = 0;
+  if (!pipe_read(pipe, &mutate_count, sizeof(mutate_count), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read mutation count");
+  }
+
+  uint32_t mutation_type = 0;
+  if (!pipe_read(pipe, &mutation_type, sizeof(mutation_type), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read mutation type");
+  }
+
+  uint64_t chain_seed = 0;
+  if (!pipe_read(pipe, &chain_seed, sizeof(chain_seed), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read mutation chain seed");
+  }
+
+  uint32_t chain_len = 0;
+  if (!pipe_read(pipe, &chain_len, sizeof(chain_len), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read mutation chain length");
+  }
+
+  if (chain_len > SL2_MAX_MUTATION_CHAIN) {
+    SL2_SERVER_LOG_FATAL("chain_len > SL2_MAX_MUTATION_CHAIN");
+  }
+
+  uint32_t chain[SL2_MAX_MUTATION_CHAIN] = {0};
+  size_t capacity = 0;
+  if (chain_len > 0) {
+    if (!pipe_read(pipe, chain, (DWORD)(chain_len * sizeof(chain[0])), &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to read mutation chain");
+    }
+
+    if (!pipe_read(pipe, &capacity, sizeof(capacity), &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to read mutation capacity");
+    }
+
+    SL2_SERVER_LOG_DEBUG("stacked mutation: chain_len=%u chain_seed=%llu", chain_len,
+                         chain_seed);
+  }
+
+  size_t resource_size = 0;
+  wchar_t resource_path[MAX_PATH + 1] = {0};
+  read_resource_path(pipe, resource_path, &resource_size);
+
+  size_t position = 0;
+  if (!pipe_read(pipe, &position, sizeof(position), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read mutation offset");
+  }
+
+  uint8_t encoding = SL2_FKT_FULL;
+  if (!pipe_read(pipe, &encoding, sizeof(encoding), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read mutation encoding");
+  }
+
+  if (encoding & SL2_MUTATION_SHARED) {
+    shared = true;
+    encoding &= ~SL2_MUTATION_SHARED;
+  }
+
+  // For a delta-encoded mutation, this is the size of the delta.
+  size_t size = 0;
+  if (!pipe_read(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read size of mutation buffer");
+  }
+
+  // A shared mutation's bytes are in the upload section already, so they're journalled
+  // straight from it. The client waits for our status before it reuses the section.
+  size_t offset = 0;
+  if (shared && !pipe_read(pipe, &offset, sizeof(offset), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read offset of shared mutation");
+  }
+
+  if (size > 0) {
+    // Only set for mutations read from the pipe; shared ones aren't ours to free.
+    uint8_t *owned = NULL;
+    uint8_t *buf = NULL;
+
+    if (shared) {
+      if (!upload->view || encoding != SL2_FKT_FULL || offset > upload->size ||
+          size > upload->size - offset) {
+        SL2_SERVER_LOG_ERROR("shared mutation out of bounds (offset=%lu, size=%lu)", offset, size);
+        status = 1;
+        goto cleanup;
+      }
+
+      buf = upload->view + offset;
+    } else {
+      owned = (uint8_t *)malloc(size);
+
+      if (owned == NULL) {
+        SL2_SERVER_LOG_ERROR("failed to allocate mutation buffer (size=%lu)", size);
+        status = 1;
+        goto cleanup;
+      }
+
+      if (!pipe_read(pipe, owned, (DWORD)size, &txsize)) {
+        SL2_SERVER_LOG_ERROR("failed to read mutation buffer from pipe (size=%lu)", size);
+        free(owned);
+        status = 1;
+        goto cleanup;
+      }
+
+      if (txsize < size) {
+        SL2_SERVER_LOG_WARN("read fewer bytes than expected (%d < %lu)", txsize, size);
+        size = txsize;
+      }
+
+      buf = owned;
+    }
+
+    if (encoding == SL2_FKT_DELTA && size < sizeof(sl2_delta)) {
+      SL2_SERVER_LOG_ERROR("truncated mutation delta (size=%lu)", size);
+      free(owned);
+      status = 1;
+      goto cleanup;
+    }
+
+    const wchar_t *run_dir = run->run_dir;
+    wchar_t target_file[MAX_PATH + 1] = {0};
+
+    size_t record_size = 0;
+    uint8_t *record =
+        serialize_fkt(type, mutation_type, resource_size, resource_path, position, encoding, size,
+                      buf, chain_seed, chain_len, chain, &record_size);
+
+    // A compactly stored mutation keeps its full record in the replay cache, so that
+    // it's replayed from there (rather than re-made) if its run crashes.
+    uint8_t *compact = NULL;
+    size_t compact_size = 0;
+    auto served = seeds->find(mutate_count);
+
+    if (record && opts.compact_fkts && encoding == SL2_FKT_FULL && served != seeds->end()) {
+      compact =
+          compact_fkt(type, mutation_type, resource_size, resource_path, position, size, buf,
+                      chain_seed, chain_len, chain, capacity, &served->second, &compact_size);
+    }
+
+    if (record == NULL) {
+      SL2_SERVER_LOG_ERROR("failed to allocate FKT record (size=%lu)", size);
+      status = 1;
+    } else {
+      status = compact ? store_fkt(run_dir, mutate_count, compact, compact_size)
+                       : store_fkt(run_dir, mutate_count, record, record_size);
+
+      if (!status) {
+        replay_cache_put(&run->run_id, mutate_count, record + sizeof(sl2_fkt_journal_entry),
+                         record_size);
+      }
+    }
+
+    if (!status && compact) {
+      SL2_SERVER_LOG_DEBUG("stored mutation %u compactly (%lu bytes instead of %lu)", mutate_count,
+                           compact_size, record_size);
+
+      sl2_pending_fkt &fkt = (*pending)[mutate_count];
+      fkt.run = *run;
+      fkt.record.assign(record, record + sizeof(sl2_fkt_journal_entry) + record_size);
+    } else if (!status) {
+      // A mutation count registered again (e.g. by a persistent fuzzer) replaces its
+      // compact record, if it had one.
+      pending->erase(mutate_count);
+    }
+
+    free(compact);
+    free(record);
+
+    // We can't rebuild a delta-encoded input without its original bytes, so those
+    // never make it into the corpus.
+    if (encoding == SL2_FKT_FULL) {
+      keep_run_input(inputs, mutate_count, buf, size);
+    }
+
+    targets->insert(sl2_target_key(type, mutate_count));
+
+    if (opts.dump_mut_buffer) {
+      SL2_SERVER_LOG_DEBUG("mutation buffer dump requested (encoding=%d)", encoding);
+
+      PathCchCombine(target_file, MAX_PATH, run_dir, L"buffer.bin");
+
+      HANDLE file = CreateFile(target_file, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL, NULL);
+
+      if (file != INVALID_HANDLE_VALUE) {
+        WriteFile(file, buf, size, &txsize, NULL);
+        CloseHandle(file);
+      } else {
+        SL2_SERVER_LOG_ERROR("couldn't create buffer dump file?");
+      }
+    }
+
+    free(owned);
+  } else {
+    SL2_SERVER_LOG_WARN("got size=%lu, skipping registration", size);
+  }
+
+cleanup:
+
+  if (!pipe_write(pipe, &status, sizeof(status), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write server status");
+  }
+}
+
+/**
+ * Handles requests over the named pipe from the triage client for replays of mutated bytes
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param session the session, which may be bound to the event's run (see EVT_SESSION_BEGIN)
+ */
+static void handle_replay(HANDLE pipe, const sl2_session *session) {
+  DWORD txsize;
+  sl2_run_ref scratch;
+
+  const sl2_run_ref *run = read_run(pipe, session, &scratch);
+
+  SL2_SERVER_LOG_DEBUG("Replaying for run id %S", run->run_id_s);
+
+  uint32_t mutate_count = 0;
+  wchar_t mutate_fname[MAX_PATH + 1] = {0};
+  if (!pipe_read(pipe, &mutate_count, sizeof(mutate_count), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read mutate count");
+  }
+
+  StringCchPrintfW(mutate_fname, MAX_PATH, FUZZ_RUN_FKT_FMT, mutate_count);
+
+  size_t size = 0;
+  if (!pipe_read(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read size of replay buffer");
+  }
+
+  wchar_t target_file[MAX_PATH + 1];
+  const wchar_t *run_dir = run->run_dir;
+  PathCchCombine(target_file, MAX_PATH, run_dir, mutate_fname);
+
+  size_t record_size = 0;
+  uint8_t *record = replay_cache_get(&run->run_id, mutate_count, &record_size);
+  DWORD attrs = record ? INVALID_FILE_ATTRIBUTES : GetFileAttributes(target_file);
+
+  if (record) {
+    SL2_SERVER_LOG_DEBUG("replaying mutation %d from the cache", mutate_count);
+  } else if (attrs != INVALID_FILE_ATTRIBUTES && !(attrs & FILE_ATTRIBUTE_DIRECTORY)) {
+    record = read_fkt(target_file, &record_size);
+  } else {
+    // No standalone FKT, so the run's mutations were (hopefully) journaled.
+    PathCchCombine(target_file, MAX_PATH, run_dir, FUZZ_RUN_FKT_JOURNAL);
+    record = read_fkt_journal(target_file, mutate_count, &record_size);
+
+    if (record == NULL) {
+      SL2_SERVER_LOG_FATAL("missing FKT and no journal entry for mutation %d", mutate_count);
+    }
+  }
+
+  const uint8_t *payload = NULL;
+  size_t payload_size = 0;
+  uint8_t encoding = SL2_FKT_FULL;
+
+  if (!sl2_fkt_parse(record, record_size, &payload, &payload_size, &encoding)) {
+    SL2_SERVER_LOG_FATAL("malformed FKT: %S", target_file);
+  }
+
+  // A compact record's bytes are made again from its seed, and replayed like any whole buffer.
+  std::vector<uint8_t> mutated;
+
+  if (encoding == SL2_FKT_CHAIN) {
+    sl2_fkt_chain chain;
+    std::vector<uint8_t> seed;
+
+    memcpy(&chain, payload, sizeof(chain));
+
+    if (!read_archived_seed(&chain, seed) || !replay_fkt_chain(&chain, seed, mutated)) {
+      SL2_SERVER_LOG_FATAL("couldn't remake compact FKT for mutation %d from seed %llu",
+                           mutate_count, chain.seq);
+    }
+
+    payload = mutated.data();
+    payload_size = mutated.size();
+    encoding = SL2_FKT_FULL;
+  }
+
+  SL2_SERVER_LOG_DEBUG("buffer size=%lu (encoding=%d)", payload_size, encoding);
+
+  if (!pipe_write(pipe, &encoding, sizeof(encoding), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write replay encoding");
+  }
+
+  // A delta goes to the client as is, since only the client has the bytes to apply it to.
+  if (encoding == SL2_FKT_DELTA) {
+    if (!pipe_write(pipe, &payload_size, sizeof(payload_size), &txsize) ||
+        !pipe_write(pipe, payload, (DWORD)payload_size, &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write replay delta");
+    }
+  } else {
+    // The mutated buffer may be shorter than the client's (e.g. if a strategy
+    // truncated it), so we zero the slack rather than sending uninitialized memory.
+    uint8_t *buf = (uint8_t *)calloc(1, size);
+    size_t replayed = std::min(size, payload_size);
+
+    if (buf == NULL) {
+      SL2_SERVER_LOG_FATAL("failed to allocate replay buffer");
+    }
+
+    // This has always replayed the tail of the mutated buffer.
+    memcpy(buf, payload + payload_size - replayed, replayed);
+
+    if (!pipe_write(pipe, buf, (DWORD)size, &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write replay buffer");
+    }
+
+    // Tell the client how much of the buffer was actually replayed, so that it can report
+    // the mutated length to the target.
+    if (!pipe_write(pipe, &replayed, sizeof(replayed), &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write replay size");
+    }
+
+    free(buf);
+  }
+
+  free(record);
+}
+
+/**
+ * Finds the strategy state for the given arena ID.
+ * @param arena_id the ID of the arena
+ * @param create whether to add an (unloaded) entry for the arena if it doesn't exist yet
+ * @return the arena's strategy state, or NULL if it doesn't exist and `create` is false
+ */
+static strategy_state *find_strategy_state(const wchar_t *arena_id, bool create) {
+  {
+    std::shared_lock<std::shared_mutex> strategy_lock(strategy_mutex, std::defer_lock);
+    timed_lock(strategy_lock);
+    sl2_strategy_map_t::iterator it = strategy_map.find(arena_id);
+
+    if (it != strategy_map.end()) {
+      return &(it->second);
+    }
+  }
+
+  if (!create) {
+    return NULL;
+  }
+
+  std::unique_lock<std::shared_mutex> strategy_lock(strategy_mutex, std::defer_lock);
+  timed_lock(strategy_lock);
+  return &(strategy_map[arena_id]);
+}
+
+/**
+ * Allocates a zeroed arena, with its map right after it.
+ * @param arena_id the ID of the arena
+ * @param size the size of the arena's map (see SL2_ARENA_SIZE_VALID)
+ * @return the arena, or NULL if it couldn't be allocated
+ */
+static sl2_arena *alloc_arena(const wchar_t *arena_id, uint32_t size) {
+  sl2_arena *arena = (sl2_arena *)calloc(1, sizeof(sl2_arena) + size);
+
+  if (arena) {
+    wcscpy_s(arena->id, arena_id);
+    arena->size = size;
+    arena->map = (uint8_t *)(arena + 1);
+  }
+
+  return arena;
+}
+
+/**
+ * Works out the size of an arena's map from the size of its file on the disk: the map comes
+ * first, followed by the (much smaller) deterministic cursor and strategy snapshot.
+ * @param attrs the arena file's attributes
+ * @return the largest valid map size that fits in the file, or 0 if none does
+ */
+static uint32_t arena_file_map_size(const WIN32_FILE_ATTRIBUTE_DATA *attrs) {
+  static_assert(sizeof(sl2_det_cursor) + sizeof(sl2_strategy_snapshot) < FUZZ_ARENA_SIZE,
+                "an arena file's trailer must be smaller than the smallest map");
+
+  uint64_t file_size = ((uint64_t)attrs->nFileSizeHigh << 32) | attrs->nFileSizeLow;
+
+  for (uint32_t size = FUZZ_ARENA_MAX_SIZE; size >= FUZZ_ARENA_SIZE; size >>= 1) {
+    if (file_size >= size) {
+      return size;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Maps an arena's file into memory (-m), instead of reading a copy of it: runs are merged straight
+ * into the file's pages, and writing the arena back is just a flush (see flush_arena_file).
+ * An intact file is grown to fit its trailer if it was written without one, in which case its
+ * cursor and snapshot start over. Any other file is recreated, zeroed.
+ * @param arena_path the arena's file
+ * @param arena_id the ID of the arena
+ * @param map_size the size of the arena's map
+ * @param intact whether the arena's file exists and holds a map of `map_size`
+ * @param cursor the deterministic cursor to load into, or to store with a recreated arena
+ * @param snapshot the strategy snapshot to load into. Its magic is left 0 unless the arena had
+ *                 one of the current version
+ * @return the arena, or NULL if its file is compressed (see sl2_compress.hpp) or couldn't be
+ *         mapped, in which case it should be read into memory instead
+ */
+static sl2_arena *map_arena_file(const wchar_t *arena_path, const wchar_t *arena_id,
+                                 uint32_t map_size, bool intact, sl2_det_cursor *cursor,
+                                 sl2_strategy_snapshot *snapshot) {
+  uint64_t view_size = (uint64_t)map_size + SL2_ARENA_TRAILER_SIZE;
+  uint8_t header[sizeof(sl2_compressed_header)] = {0};
+  DWORD txsize = 0;
+
+  HANDLE file = CreateFile(arena_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                           intact ? OPEN_EXISTING : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    SL2_SERVER_LOG_ERROR("failed to open arena for mapping (arena_path=%S)", arena_path);
+    return NULL;
+  }
+
+  // An arena written with -z is read the old way once, and written back raw.
+  if (intact && ReadFile(file, header, sizeof(header), &txsize, NULL) &&
+      sl2_is_compressed(header, txsize)) {
+    SL2_SERVER_LOG_INFO("arena is compressed, reading it instead (arena_path=%S)", arena_path);
+    CloseHandle(file);
+    return NULL;
+  }
+
+  // The section keeps the file open, and the view keeps the section.
+  HANDLE section = CreateFileMapping(file, NULL, PAGE_READWRITE, (DWORD)(view_size >> 32),
+                                     (DWORD)view_size, NULL);
+  CloseHandle(file);
+
+  if (section == NULL) {
+    SL2_SERVER_LOG_ERROR("failed to create arena section (arena_path=%S)", arena_path);
+    return NULL;
+  }
+
+  uint8_t *view = (uint8_t *)MapViewOfFile(section, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)view_size);
+  CloseHandle(section);
+
+  if (view == NULL) {
+    SL2_SERVER_LOG_ERROR("failed to map arena (arena_path=%S)", arena_path);
+    return NULL;
+  }
+
+  sl2_arena *arena = (sl2_arena *)calloc(1, sizeof(sl2_arena));
+
+  if (!arena) {
+    UnmapViewOfFile(view);
+    return NULL;
+  }
+
+  wcscpy_s(arena->id, arena_id);
+  arena->size = map_size;
+  arena->map = view;
+
+  if (intact) {
+    memcpy(cursor, view + map_size, sizeof(*cursor));
+    memcpy(snapshot, view + map_size + sizeof(*cursor), sizeof(*snapshot));
+
+    if (!snapshot_usable(snapshot)) {
+      memset(snapshot, 0, sizeof(*snapshot));
+    }
+  } else {
+    memset(snapshot, 0, sizeof(*snapshot));
+    write_arena_trailer(arena, cursor, snapshot);
+    flush_arena_file(arena);
+  }
+
+  return arena;
+}
+
+/**
+ * Reads an arena's map (and deterministic cursor) into memory from the disk, creating it on the
+ * disk if it doesn't exist yet, along with its corpus if it has one. An arena that hasn't been
+ * loaded before also gets its strategy state back from its snapshot, if it has one.
+ * An arena's map keeps the size that it was created with: `map_size` only applies to new arenas.
+ * With -m, the arena's file is mapped instead (see map_arena_file).
+ * @param state the arena's strategy state, locked exclusively, whose arena isn't in memory
+ * @param arena_id the ID of the arena
+ * @param map_size the size of the arena's map, if it has to be created
+ * @return whether the arena's strategy state was restored from a snapshot
+ */
+static bool restore_arena(strategy_state &state, const wchar_t *arena_id,
+                          uint32_t map_size = FUZZ_ARENA_SIZE) {
+  sl2_det_cursor cursor = state.cursor;
+  sl2_strategy_snapshot snapshot = {0};
+  wchar_t arena_path[MAX_PATH + 1] = {0};
+  WIN32_FILE_ATTRIBUTE_DATA attrs;
+
+  PathCchCombine(arena_path, MAX_PATH, FUZZ_ARENAS_PATH, arena_id);
+
+  bool found = GetFileAttributesEx(arena_path, GetFileExInfoStandard, &attrs);
+  bool intact = found;
+
+  if (found) {
+    map_size = arena_file_map_size(&attrs);
+  } else if (state.map_size) {
+    map_size = state.map_size;
+  }
+
+  if (!map_size) {
+    SL2_SERVER_LOG_WARN("arena file too small, resetting it (arena_path=%S)", arena_path);
+    map_size = state.map_size ? state.map_size : FUZZ_ARENA_SIZE;
+    intact = false;
+  }
+
+  sl2_arena *mapped = NULL;
+
+  if (opts.mmap_arenas) {
+    mapped = map_arena_file(arena_path, arena_id, map_size, intact, &(state.cursor), &snapshot);
+  }
+
+  if (mapped) {
+    state.arena.reset(mapped);
+  } else {
+    state.arena.reset(alloc_arena(arena_id, map_size));
+  }
+
+  if (!state.arena) {
+    SL2_SERVER_LOG_FATAL("failed to allocate arena (size=%u)", map_size);
+  }
+
+  state.map_size = map_size;
+
+  sl2_arena *arena = state.arena.get();
+
+  if (mapped) {
+    SL2_SERVER_LOG_DEBUG("arena mapped from disk");
+  } else if (!found) {
+    SL2_SERVER_LOG_DEBUG("no arena found, creating one");
+    dump_arena_to_disk(arena_path, arena, &(state.cursor), NULL);
+  } else {
+    SL2_SERVER_LOG_DEBUG("arena found, loading from disk");
+
+    if (!load_arena_from_disk(arena_path, arena, &(state.cursor), &snapshot)) {
+      SL2_SERVER_LOG_ERROR("load_arena_from_disk failed, resetting the arena");
+      memset(arena->map, 0, arena->size);
+      memset(&(state.cursor), 0, sizeof(state.cursor));
+      memset(&snapshot, 0, sizeof(snapshot));
+      dump_arena_to_disk(arena_path, arena, &(state.cursor), NULL);
+    }
+  }
+
+  state.score = coverage_score(arena);
+  absorb_virgin(state);
+
+  SL2_SERVER_LOG_DEBUG("score=%d", state.score);
+
+  // An evicted arena's corpus was written back before it was evicted, so it's never
+  // newer in memory than on the disk.
+  if (state.corpus.empty() && load_corpus_from_disk(arena_id, state.corpus, &state.corpus_next)) {
+    SL2_SERVER_LOG_INFO("loaded %lu corpus entries", state.corpus.size());
+  }
+
+  // Unstable cells are kept while the arena is evicted, so they're only read once.
+  if (!state.loaded && load_unstable_from_disk(arena_id, map_size, state.unstable)) {
+    SL2_SERVER_LOG_INFO("loaded %lu unstable cells", state.unstable.size());
+  }
+
+  // An evicted arena's cursor (and strategy state) may have moved on since it was
+  // written to the disk.
+  if (state.loaded) {
+    state.cursor = cursor;
+    return false;
+  }
+
+  bool warm = snapshot.magic == SL2_SNAPSHOT_MAGIC;
+
+  if (warm) {
+    apply_strategy_snapshot(state, &snapshot);
+  }
+
+  // New inputs are numbered after the loaded ones, even if the arena had no snapshot.
+  for (const sl2_corpus_entry &entry : state.corpus) {
+    state.corpus_seq = std::max(state.corpus_seq, entry.seq);
+  }
+
+  return warm;
+}
+
+/**
+ * Loads the strategy state for the given arena into the strategy map, either from disk or by
+ * creating a fresh arena. Does nothing if the arena is already in memory; an evicted arena
+ * only has its map read back.
+ * @param arena_id the ID of the arena to load
+ * @param map_size the size of the arena's map, if it has to be created
+ * @return the size of the arena's map, which is only `map_size` for new arenas
+ */
+static uint32_t load_strategy_state(wchar_t *arena_id, uint32_t map_size = FUZZ_ARENA_SIZE) {
+  strategy_state *state = find_strategy_state(arena_id, true);
+  std::unique_lock<std::shared_mutex> state_lock(state->mutex, std::defer_lock);
+  timed_lock(state_lock);
+
+  state->last_used = GetTickCount64();
+
+  // If we already have the arena in our strategy map, then we don't
+  // need to load it from disk again.
+  // Otherwise, we attempt to load the arena from disk, creating it if we don't
+  // have one.
+  if (state->arena) {
+    return state->arena->size;
+  }
+
+  bool warm = restore_arena(*state, arena_id, map_size);
+
+  if (state->loaded) {
+    SL2_SERVER_LOG_INFO("restored evicted arena %S", arena_id);
+    return state->arena->size;
+  }
+
+  if (warm) {
+    SL2_SERVER_LOG_INFO("restored strategy state: strategy=%d, tries_remaining=%d",
+                        state->strategy, state->tries_remaining);
+  } else {
+    state->strategy = 0;
+    state->tries_remaining = opts.stickiness;
+  }
+
+  state->loaded = true;
+
+  return state->arena->size;
+}
+
+/**
+ * Writes an arena's current mutation strategy to the client, followed by the current strategy of
+ * each of its targeted calls that has its own schedule.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param arena_id the ID of the (loaded) arena
+ */
+static void write_strategy_advice(HANDLE pipe, const wchar_t *arena_id) {
+  DWORD txsize;
+  uint32_t table_idx = 0;
+  uint32_t count = 0;
+  sl2_target_advice targets[SL2_MAX_TARGETS];
+
+  strategy_state *state = find_strategy_state(arena_id, false);
+
+  if (!state) {
+    SL2_SERVER_LOG_FATAL("arena ID missing from strategy_map?");
+  }
+
+  {
+    std::shared_lock<std::shared_mutex> state_lock(state->mutex, std::defer_lock);
+    timed_lock(state_lock);
+    table_idx = state->strategy;
+
+    for (const auto &target : state->target_schedules) {
+      if (count == SL2_MAX_TARGETS) {
+        break;
+      }
+
+      targets[count].function = (uint32_t)(target.first >> 32);
+      targets[count].mut_count = (uint32_t)target.first;
+      targets[count].table_idx = target.second.strategy;
+      count++;
+    }
+  }
+
+  if (!pipe_write(pipe, &table_idx, sizeof(table_idx), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write strategy advice");
+  }
+
+  if (!pipe_write(pipe, &count, sizeof(count), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write targeted call count");
+  }
+
+  if (count && !pipe_write(pipe, targets, (DWORD)(count * sizeof(targets[0])), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write targeted call advice");
+  }
+}
+
+/**
+ * Hands the client the next deterministic mutation for an arena, and moves the arena's cursor
+ * past it so that no other client gets the same one. Once every stage has been walked, the
+ * client gets a cursor at SL2_DET_DONE.
+ * The cursor is only written to the disk with the arena, so a server that dies can
+ * hand out up to a checkpoint's worth of mutations again. It never skips any.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param arena_id the ID of the (loaded) arena
+ * @param bufsize the size of the buffer that the client is walking
+ */
+static void write_deterministic_advice(HANDLE pipe, const wchar_t *arena_id, size_t bufsize) {
+  DWORD txsize;
+  sl2_det_cursor cursor;
+
+  strategy_state *state = find_strategy_state(arena_id, false);
+
+  if (!state) {
+    SL2_SERVER_LOG_FATAL("arena ID missing from strategy_map?");
+  }
+
+  {
+    std::unique_lock<std::shared_mutex> state_lock(state->mutex, std::defer_lock);
+    timed_lock(state_lock);
+    sl2_det_cursor &next = state->cursor;
+
+    while (next.stage < SL2_DET_DONE && next.offset >= sl2_det_stage_len(next.stage, bufsize)) {
+      SL2_SERVER_LOG_INFO("deterministic stage %u done after %llu mutations", next.stage,
+                          next.offset);
+      next.stage++;
+      next.offset = 0;
+    }
+
+    cursor = next;
+
+    if (next.stage < SL2_DET_DONE) {
+      next.offset++;
+
+      if (opts.checkpoint_interval) {
+        state->dirty = true;
+      }
+    }
+  }
+
+  if (!pipe_write(pipe, &cursor, sizeof(cursor), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write deterministic advice");
+  }
+}
+
+/**
+ * Reads the size of the map that a client would like its arena to have.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @return the size, or FUZZ_ARENA_SIZE if the client asked for an invalid one
+ */
+static uint32_t read_map_size(HANDLE pipe) {
+  DWORD txsize;
+  uint32_t map_size = 0;
+
+  if (!pipe_read(pipe, &map_size, sizeof(map_size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read map size");
+  }
+
+  if (!SL2_ARENA_SIZE_VALID(map_size)) {
+    SL2_SERVER_LOG_WARN("invalid map size %u, using %u", map_size, FUZZ_ARENA_SIZE);
+    map_size = FUZZ_ARENA_SIZE;
+  }
+
+  return map_size;
+}
+
+/**
+ * Loads (or creates) the requested arena on behalf of the client, and replies with the size of
+ * its map and its current mutation strategy.
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_get_arena(HANDLE pipe) {
+  DWORD txsize;
+  size_t size = 0;
+  uint32_t map_size = 0;
+  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+
+  if (!pipe_read(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+  }
+
+  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
+    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
+  }
+
+  if (!pipe_read(pipe, arena_id, (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID");
+  }
+
+  SL2_SERVER_LOG_DEBUG("got arena ID: %S", arena_id);
+
+  map_size = load_strategy_state(arena_id, read_map_size(pipe));
+
+  if (!pipe_write(pipe, &map_size, sizeof(map_size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write map size");
+  }
+
+  // The strategy only changes when a run registers its arena, so we hand the
+  // client its advice up front instead of making it ask on every mutation.
+  write_strategy_advice(pipe, arena_id);
+}
+
+/**
+ * Loads (or creates) the requested arena, and creates a named section that the client can map
+ * and record its coverage into directly. The section lives as long as the client's session.
+ * On success, the section name is followed by the size of the arena's map and its current
+ * mutation strategy.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param mapping the session's arena mapping
+ */
+static void handle_map_arena(HANDLE pipe, sl2_arena_mapping *mapping) {
+  DWORD txsize;
+  size_t size = 0;
+  uint64_t pid;
+  uint32_t map_size = 0;
+  uint8_t status = 0;
+  bool stale = false;
+  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+  wchar_t section_name[MAX_PATH + 1] = {0};
+
+  if (!pipe_read(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+  }
+
+  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
+    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
+  }
+
+  if (!pipe_read(pipe, arena_id, (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID");
+  }
+
+  if (!pipe_read(pipe, &pid, sizeof(pid), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read PID");
+  }
+
+  SL2_SERVER_LOG_DEBUG("got arena ID: %S (pid=%llu)", arena_id, pid);
+
+  map_size = load_strategy_state(arena_id, read_map_size(pipe));
+
+  if (mapping->arena) {
+    SL2_SERVER_LOG_ERROR("session already has a mapped arena, refusing to map another");
+    status = 1;
+    goto cleanup;
+  }
+
+  StringCchPrintfW(section_name, MAX_PATH, FUZZ_ARENA_SECTION_FMT, arena_id, pid);
+
+  mapping->section = CreateFileMappingNuma(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, map_size,
+                                           section_name, server_numa_node);
+
+  if (!mapping->section) {
+    SL2_SERVER_LOG_ERROR("failed to create arena section: %S", section_name);
+    status = 1;
+    goto cleanup;
+  }
+
+  // New sections are zero-filled by the kernel, but a stale section from
+  // a dead process with the same pid might still be around.
+  stale = GetLastError() == ERROR_ALREADY_EXISTS;
+
+  mapping->shared.map =
+      (uint8_t *)MapViewOfFile(mapping->section, FILE_MAP_ALL_ACCESS, 0, 0, map_size);
+
+  if (!mapping->shared.map) {
+    SL2_SERVER_LOG_ERROR("failed to map arena section: %S", section_name);
+    CloseHandle(mapping->section);
+    mapping->section = NULL;
+    status = 1;
+    goto cleanup;
+  }
+
+  if (stale) {
+    SL2_SERVER_LOG_WARN("arena section already existed, clearing it: %S", section_name);
+    memset(mapping->shared.map, 0, map_size);
+  }
+
+  wcscpy_s(mapping->shared.id, arena_id);
+  mapping->shared.size = map_size;
+  mapping->arena = &(mapping->shared);
+
+cleanup:
+
+  if (!pipe_write(pipe, &status, sizeof(status), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write server status");
+  }
+
+  if (!status) {
+    size = wcsnlen_s(section_name, MAX_PATH + 1) * sizeof(wchar_t);
+
+    if (!pipe_write(pipe, &size, sizeof(size), &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write length of arena section name to pipe");
+    }
+
+    if (!pipe_write(pipe, section_name, (DWORD)size, &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write arena section name to pipe");
+    }
+
+    SL2_SERVER_LOG_DEBUG("wrote arena section name: %S", section_name);
+
+    if (!pipe_write(pipe, &map_size, sizeof(map_size), &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write map size");
+    }
+
+    write_strategy_advice(pipe, arena_id);
+  }
+}
+
+/**
+ * Tears down a session's upload section, if it has one.
+ * @param upload the session's upload section
+ */
+static void destroy_upload_section(sl2_upload_section *upload) {
+  if (upload->view && !UnmapViewOfFile(upload->view)) {
+    SL2_SERVER_LOG_ERROR("failed to unmap upload section");
+  }
+
+  if (upload->section && !CloseHandle(upload->section)) {
+    SL2_SERVER_LOG_ERROR("failed to close upload section");
+  }
+
+  upload->view = NULL;
+  upload->section = NULL;
+  upload->size = 0;
+}
+
+/**
+ * Creates a named section that the client can upload its large mutations into, replacing the
+ * session's old one (if any). The section lives as long as the client's session, or until the
+ * client asks for another. On success, the section name is followed by its size.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param upload the session's upload section
+ */
+static void handle_map_upload(HANDLE pipe, sl2_upload_section *upload) {
+  static std::atomic<uint64_t> upload_serial(0);
+  DWORD txsize;
+  size_t size = 0;
+  uint8_t status = 0;
+  wchar_t section_name[MAX_PATH + 1] = {0};
+
+  if (!pipe_read(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read upload section size");
+  }
+
+  // The client drops its view of the old section once we reply, whether or not we
+  // manage to make it a new one.
+  destroy_upload_section(upload);
+
+  if (size == 0 || size > SL2_UPLOAD_MAX_SIZE) {
+    SL2_SERVER_LOG_ERROR("bad upload section size: %lu", size);
+    status = 1;
+    goto cleanup;
+  }
+
+  StringCchPrintfW(section_name, MAX_PATH, FUZZ_UPLOAD_SECTION_FMT, GetCurrentProcessId(),
+                   upload_serial++);
+
+  upload->section = CreateFileMappingNuma(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                          (DWORD)((uint64_t)size >> 32), (DWORD)size, section_name,
+                                          server_numa_node);
+
+  if (!upload->section) {
+    SL2_SERVER_LOG_ERROR("failed to create upload section: %S", section_name);
+    status = 1;
+    goto cleanup;
+  }
+
+  upload->view = (uint8_t *)MapViewOfFile(upload->section, FILE_MAP_ALL_ACCESS, 0, 0, size);
+
+  if (!upload->view) {
+    SL2_SERVER_LOG_ERROR("failed to map upload section: %S", section_name);
+    destroy_upload_section(upload);
+    status = 1;
+    goto cleanup;
+  }
+
+  upload->size = size;
+
+cleanup:
+
+  if (!pipe_write(pipe, &status, sizeof(status), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write server status");
+  }
+
+  if (!status) {
+    size = wcsnlen_s(section_name, MAX_PATH + 1) * sizeof(wchar_t);
+
+    if (!pipe_write(pipe, &size, sizeof(size), &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write length of upload section name to pipe");
+    }
+
+    if (!pipe_write(pipe, section_name, (DWORD)size, &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write upload section name to pipe");
+    }
+
+    if (!pipe_write(pipe, &(upload->size), sizeof(upload->size), &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write upload section size");
+    }
+
+    SL2_SERVER_LOG_DEBUG("mapped upload section: %S (size=%lu)", section_name, upload->size);
+  }
+}
+
+/**
+ * Tears down a session's arena mapping, if it has one.
+ * @param mapping the session's arena mapping
+ */
+static void destroy_arena_mapping(sl2_arena_mapping *mapping) {
+  if (mapping->arena && !UnmapViewOfFile(mapping->arena->map)) {
+    SL2_SERVER_LOG_ERROR("failed to unmap arena section");
+  }
+
+  if (mapping->section && !CloseHandle(mapping->section)) {
+    SL2_SERVER_LOG_ERROR("failed to close arena section");
+  }
+
+  mapping->arena = NULL;
+  mapping->section = NULL;
+}
+
+/**
+ * Reads the ID of a run's arena from the client.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param arena the arena to read the ID into
+ */
+static void read_run_arena_id(HANDLE pipe, sl2_arena *arena) {
+  DWORD txsize;
+  size_t size = 0;
+
+  if (!pipe_read(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+  }
+
+  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
+    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
+  }
+
+  if (!pipe_read(pipe, arena->id, (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID");
+  }
+
+  SL2_SERVER_LOG_DEBUG("got arena ID: %S", arena->id);
+}
+
+/**
+ * Reads a run's arena's map from the client, once its ID has been read. If the client's arena is
+ * mapped, its map is read straight from the shared section instead of the pipe; otherwise, the
+ * client sends the map's size first.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param mapping the session's arena mapping, whose run map an unmapped arena's map is read into
+ * @param arena the arena to read an unmapped arena's map into, whose ID has been read
+ * @param cells receives the arena's cells, if the client sent it sparse (and is left empty
+ *              otherwise)
+ * @return the run's arena: either `arena` or the session's mapped arena
+ */
+static sl2_arena *read_run_arena_map(HANDLE pipe, sl2_arena_mapping *mapping, sl2_arena *arena,
+                                     std::vector<uint32_t> *cells) {
+  DWORD txsize;
+  bool mapped = false;
+  if (!pipe_read(pipe, &mapped, sizeof(mapped), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena mapping flag");
+  }
+
+  if (mapped) {
+    if (!mapping->arena) {
+      SL2_SERVER_LOG_FATAL("client claims a mapped arena, but the session doesn't have one!");
+    }
+
+    if (!WSTREQ(mapping->arena->id, arena->id)) {
+      SL2_SERVER_LOG_FATAL("arena ID doesn't match the session's mapped arena (%S != %S)",
+                           arena->id, mapping->arena->id);
+    }
+
+    return mapping->arena;
+  }
+
+  uint32_t map_size = 0;
+  if (!pipe_read(pipe, &map_size, sizeof(map_size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read map size");
+  }
+
+  if (!SL2_ARENA_SIZE_VALID(map_size)) {
+    SL2_SERVER_LOG_FATAL("invalid map size %u", map_size);
+  }
+
+  mapping->run_map.assign(map_size, 0);
+  arena->size = map_size;
+  arena->map = mapping->run_map.data();
+
+  uint8_t encoding = SL2_ARENA_DENSE;
+  if (!pipe_read(pipe, &encoding, sizeof(encoding), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena encoding");
+  }
+
+  if (encoding == SL2_ARENA_DENSE) {
+    if (!pipe_read(pipe, arena->map, map_size, &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to read arena");
+    }
+
+    return arena;
+  }
+
+  uint32_t count = 0;
+  if (!pipe_read(pipe, &count, sizeof(count), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read sparse arena size");
+  }
+
+  if (count > SL2_ARENA_SPARSE_MAX_CELLS(map_size)) {
+    SL2_SERVER_LOG_FATAL("sparse arena too big (%u > %u)", count,
+                         SL2_ARENA_SPARSE_MAX_CELLS(map_size));
+  }
+
+  cells->resize(count);
+
+  if (count && (!pipe_read(pipe, cells->data(), count * sizeof(uint32_t), &txsize) ||
+                txsize != count * sizeof(uint32_t))) {
+    SL2_SERVER_LOG_FATAL("failed to read sparse arena");
+  }
+
+  // The run's raw arena is still kept whole, for path identification.
+  for (uint32_t cell : *cells) {
+    if (SL2_ARENA_CELL_INDEX(cell) >= map_size) {
+      SL2_SERVER_LOG_FATAL("sparse arena cell out of range (cell=%x)", cell);
+    }
+
+    arena->map[SL2_ARENA_CELL_INDEX(cell)] = SL2_ARENA_CELL_HITS(cell);
+  }
+
+  return arena;
+}
+
+/**
+ * Reads a run's arena from the client: its ID, and then its map (see read_run_arena_map).
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param mapping the session's arena mapping
+ * @param arena where to read an unmapped arena into
+ * @param cells receives the arena's cells, if the client sent it sparse
+ * @return the run's arena: either `arena` or the session's mapped arena
+ */
+static sl2_arena *read_run_arena(HANDLE pipe, sl2_arena_mapping *mapping, sl2_arena *arena,
+                                 std::vector<uint32_t> *cells) {
+  read_run_arena_id(pipe, arena);
+  return read_run_arena_map(pipe, mapping, arena, cells);
+}
+
+/**
+ * Picks the next strategy the way the server always has: stick with the current strategy while
+ * it increases coverage, and switch when it runs out of tries (see strategy_stickiness).
+ * @param state the schedule, whose arena's strategy state is locked exclusively
+ * @param improved whether the last run increased coverage
+ */
+static void next_strategy_legacy(sl2_schedule &state, bool improved) {
+  state.pulls[state.strategy]++;
+  if (improved) {
+    state.rewards[state.strategy]++;
+  }
+
+  // If coverage has increased, continue with the current strategy
+  // and reset the number of remaining tries.
+  //
+  // Otherwise, try a new strategy.
+  if (improved) {
+    SL2_SERVER_LOG_DEBUG("coverage score increased, continuing with strategy=%d",
+                         state.strategy);
+
+    state.success_map[state.strategy]++;
+    state.tries_remaining = strategy_stickiness(state, state.strategy);
+  } else {
+    SL2_SERVER_LOG_DEBUG("coverage score did NOT increase!");
+
+    // If we've run out of tries for this strategy, move to a new one
+    // (and reset the number of tries).
+    //
+    // Otherwise, try again, and decrement the number of tries remaining.
+    if (state.tries_remaining <= 0) {
+      uint32_t strategy;
+
+      // Ignore the success map about 20% of the time, to make sure that
+      // we're not digging ourselves into a hole.
+      //
+      // Otherwise, grab the best strategy from the strategy map.
+      if (!(rand() % 5)) {
+        strategy = (state.strategy + 1) % SL2_NUM_STRATEGIES;
+      } else {
+        bool found_success = false;
+        strategy = 0;
+
+        for (int i = 1; i < SL2_NUM_STRATEGIES; ++i) {
+          if (state.success_map[strategy] < state.success_map[i] && state.strategy != i) {
+            strategy = i;
+            found_success = true;
+          }
+        }
+
+        // Fallback: We've seen no successful strategies (other than the current one),
+        // so just move on.
+        if (!found_success) {
+          strategy = (state.strategy + 1) % SL2_NUM_STRATEGIES;
+        }
+      }
+
+      state.success_map[state.strategy]--;
+      state.strategy = strategy;
+      state.tries_remaining = strategy_stickiness(state, strategy);
+
+      SL2_SERVER_LOG_DEBUG("no tries left, changing strategy (%d, %d tries)!", strategy,
+                           state.tries_remaining);
+    } else {
+      SL2_SERVER_LOG_DEBUG("%d tries for strategy %d left", state.tries_remaining - 1,
+                           state.strategy);
+
+      state.tries_remaining--;
+    }
+  }
+}
+
+/**
+ * Picks the next strategy by treating the strategies as a multi-armed bandit, rewarded
+ * whenever a run increases coverage.
+ * @param state the schedule, whose arena's strategy state is locked exclusively
+ * @param improved whether the last run increased coverage
+ */
+static void next_strategy_bandit(sl2_schedule &state, bool improved) {
+  static thread_local std::mt19937_64 rng(std::random_device{}());
+  uint64_t total_pulls = 0;
+  uint32_t strategy = 0;
+  double best = -1.0;
+
+  state.pulls[state.strategy]++;
+  if (improved) {
+    state.rewards[state.strategy]++;
+    state.success_map[state.strategy]++;
+  }
+
+  for (int i = 0; i < SL2_NUM_STRATEGIES; ++i) {
+    total_pulls += state.pulls[i];
+  }
+
+  for (uint32_t i = 0; i < SL2_NUM_STRATEGIES; ++i) {
+    double value;
+
+    if (opts.scheduler == SL2_SCHEDULER_UCB1) {
+      // Every strategy gets tried once before the bounds mean anything.
+      if (!state.pulls[i]) {
+        strategy = i;
+        break;
+      }
+
+      double mean = (double)state.rewards[i] / state.pulls[i];
+      value = mean + sqrt(2.0 * log((double)total_pulls) / state.pulls[i]);
+    } else {
+      // Sample from Beta(rewards + 1, failures + 1) via a pair of gamma draws.
+      std::gamma_distribution<double> hits((double)state.rewards[i] + 1.0, 1.0);
+      std::gamma_distribution<double> misses((double)(state.pulls[i] - state.rewards[i]) + 1.0,
+                                             1.0);
+      double x = hits(rng);
+      double y = misses(rng);
+      value = x / (x + y);
+    }
+
+    if (value > best) {
+      best = value;
+      strategy = i;
+    }
+  }
+
+  if (strategy != state.strategy) {
+    SL2_SERVER_LOG_DEBUG("scheduler changing strategy (%d -> %d)", state.strategy, strategy);
+  }
+
+  state.strategy = strategy;
+  state.tries_remaining = strategy_stickiness(state, strategy);
+}
+
+/**
+ * Picks the strategy for an arena's (or a targeted call's) next run, using the configured
+ * scheduler.
+ * @param state the schedule, whose arena's strategy state is locked exclusively
+ * @param improved whether the last run increased coverage
+ */
+static void next_strategy(sl2_schedule &state, bool improved) {
+  if (opts.scheduler == SL2_SCHEDULER_LEGACY) {
+    next_strategy_legacy(state, improved);
+  } else {
+    next_strategy_bandit(state, improved);
+  }
+}
+
+/**
+ * Adds an input to an arena's corpus, replacing the oldest entry once it's full.
+ * @param state the arena's strategy state, locked exclusively
+ * @param mut_count the targeted read that the input was given to
+ * @param buf the input, which is consumed
+ * @param origin where the input came from (see sl2_corpus_entry)
+ * @param exec_us how long the run that found the input took, in microseconds (0 if unknown)
+ * @param path the path of the run that found the input (0 if unknown)
+ * @param distance how far that run got from its directed targets (see sl2_corpus_entry)
+ */
+static void add_corpus_entry(strategy_state &state, uint32_t mut_count, std::vector<uint8_t> &&buf,
+                             uint64_t origin, uint64_t exec_us = 0, uint64_t path = 0,
+                             uint32_t distance = SL2_DISTANCE_NONE) {
+  uint64_t seq = ++state.corpus_seq;
+
+  state.corpus_dirty = true;
+
+  if (state.corpus.size() < SL2_CORPUS_SIZE) {
+    state.corpus.push_back({mut_count, std::move(buf), seq, origin, exec_us, path, 0, 0, distance});
+    return;
+  }
+
+  sl2_corpus_entry &entry = state.corpus[state.corpus_next];
+  entry.mut_count = mut_count;
+  entry.buf = std::move(buf);
+  entry.seq = seq;
+  entry.origin = origin;
+  entry.exec_us = exec_us;
+  entry.path = path;
+  entry.picks = 0;
+  entry.execs = 0;
+  entry.distance = distance;
+  state.corpus_next = (state.corpus_next + 1) % SL2_CORPUS_SIZE;
+}
+
+/**
+ * Adds a run's inputs to its arena's corpus.
+ * @param state the arena's strategy state, locked exclusively
+ * @param inputs the run's inputs
+ * @param exec_us how long the run took, in microseconds (0 if unknown)
+ * @param path the run's path (see path_key)
+ * @param distance how far the run got from its directed targets (see sl2_corpus_entry)
+ */
+static void add_corpus_inputs(strategy_state &state, sl2_run_inputs_t *inputs, uint64_t exec_us,
+                              uint64_t path, uint32_t distance) {
+  for (sl2_run_inputs_t::iterator it = inputs->begin(); it != inputs->end(); ++it) {
+    add_corpus_entry(state, it->first, std::move(it->second), 0, exec_us, path, distance);
+  }
+}
+
+/**
+ * Decides whether a run was slow, i.e. whether it took more than -T times its arena's median run
+ * time, and adds its time to the arena's window. Slow runs aren't hangs, but their inputs would
+ * drag down every run that they seed, so they're kept out of the corpus; their run directories
+ * (and FKTs) are left for the harness to keep, as algorithmic DoS candidates.
+ * @param state the arena's strategy state, locked exclusively
+ * @param exec_us how long the run took, in microseconds (0 if unknown)
+ * @return whether the run was slow
+ */
+static bool is_slow_run(strategy_state &state, uint64_t exec_us) {
+  if (!exec_us) {
+    return false;
+  }
+
+  bool slow = false;
+  size_t samples = (size_t)std::min<uint64_t>(state.exec_samples, SL2_EXEC_WINDOW);
+
+  if (opts.slow_factor && samples >= SL2_EXEC_MIN_SAMPLES) {
+    uint64_t sorted[SL2_EXEC_WINDOW];
+
+    std::copy(state.exec_window, state.exec_window + samples, sorted);
+    std::nth_element(sorted, sorted + samples / 2, sorted + samples);
+    slow = exec_us > sorted[samples / 2] * opts.slow_factor;
+  }
+
+  // Slow runs still count towards the median, so that a target that really does slow
+  // down as its coverage grows eventually stops having every run flagged.
+  state.exec_window[state.exec_samples % SL2_EXEC_WINDOW] = exec_us;
+  state.exec_samples++;
+
+  return slow;
+}
+
+/**
+ * @param path_hash a path hash, in hex (see path_hash_hex)
+ * @return the path's key in an arena's path counts: its first 64 bits
+ */
+static uint64_t path_key(const unsigned char *path_hash) {
+  char prefix[17] = {0};
+
+  memcpy(prefix, path_hash, sizeof(prefix) - 1);
+  return _strtoui64(prefix, NULL, 16);
+}
+
+/**
+ * Counts a run's path towards its arena's path frequencies, without going back over the rest.
+ * @param state the arena's strategy state, locked exclusively
+ * @param path_hash the run's path hash, in hex
+ */
+static void count_path(strategy_state &state, const unsigned char *path_hash) {
+  uint32_t count = ++state.path_counts[path_key(path_hash)];
+
+  state.path_runs++;
+
+  if (count == 1) {
+    state.path_singletons++;
+  } else if (count == 2) {
+    state.path_singletons--;
+    state.path_doubletons++;
+  } else if (count == 3) {
+    state.path_doubletons--;
+  }
+}
+
+/**
+ * Picks the next strategy for each of the targeted calls that a run mutated, starting a schedule
+ * for each call that doesn't have one yet.
+ * The coverage map is the arena's, so a run that mutated several targeted calls credits
+ * each of them with its coverage.
+ * @param state the arena's strategy state, locked exclusively
+ * @param targets the run's mutated targets, which are consumed
+ * @param improved whether the run increased coverage
+ */
+static void next_target_strategies(strategy_state &state, sl2_run_targets_t *targets,
+                                   bool improved) {
+  for (uint64_t key : *targets) {
+    std::map<uint64_t, sl2_schedule>::iterator it = state.target_schedules.find(key);
+
+    if (it == state.target_schedules.end()) {
+      if (state.target_schedules.size() >= SL2_MAX_TARGETS) {
+        continue;
+      }
+
+      it = state.target_schedules.emplace(key, (sl2_schedule &)state).first;
+    }
+
+    next_strategy(it->second, improved);
+  }
+
+  targets->clear();
+}
+
+/**
+ * Clears an arena's unstable cells from a run's arena.
+ * @param unstable the arena's unstable cells, sorted
+ * @param run_arena the run's arena
+ * @param cells the run's arena's cells, if it was sent sparse, which the unstable ones are
+ *              removed from
+ */
+static void mask_unstable(const std::vector<uint32_t> &unstable, sl2_arena *run_arena,
+                          std::vector<uint32_t> *cells) {
+  if (unstable.empty()) {
+    return;
+  }
+
+  for (uint32_t index : unstable) {
+    if (index < run_arena->size) {
+      run_arena->map[index] = 0;
+    }
+  }
+
+  if (cells) {
+    cells->erase(std::remove_if(cells->begin(), cells->end(),
+                                [&unstable](uint32_t cell) {
+                                  return std::binary_search(unstable.begin(), unstable.end(),
+                                                            SL2_ARENA_CELL_INDEX(cell));
+                                }),
+                 cells->end());
+  }
+}
+
+/**
+ * Merges a run's arena with the one previously stored for incremental coverage
+ * measurements, and picks the strategy for the next run. If the run hit a cell that the arena's
+ * runs never had (or an already-hit cell in a new bucket), or came closer to its directed targets
+ * than any of them, its inputs join the arena's corpus. Each of the targeted calls that the run
+ * mutated gets its own next strategy too.
+ * @param run_arena the run's arena
+ * @param inputs the run's inputs, which are consumed
+ * @param targets the run's mutated targets, which are consumed
+ * @param exec_us how long the run took, in microseconds (0 if unknown)
+ * @param crashed whether the run crashed
+ * @param cells the run's arena's nonzero cells, if it was sent sparse, so that merging it only
+ *              touches those. The arena's unstable cells are masked out of them
+ * @param fingerprint the run's raw arena's fingerprint (see EVT_FINALIZE_PATH), under which its
+ *                    path is remembered, or 0 if the client didn't send one
+ * @param distance how far the run got from its directed targets, or SL2_DISTANCE_NONE
+ */
+static void merge_run_arena(sl2_arena *run_arena, sl2_run_inputs_t *inputs,
+                            sl2_run_targets_t *targets, uint64_t exec_us, bool crashed,
+                            std::vector<uint32_t> *cells = NULL, uint64_t fingerprint = 0,
+                            uint32_t distance = SL2_DISTANCE_NONE) {
+  strategy_state *found = find_strategy_state(run_arena->id, false);
+
+  // This should never happen, as the fuzzer always requests an arena before sending one back.
+  if (!found) {
+    SL2_SERVER_LOG_FATAL(
+        "no prior arena to compare against! fuzzer didn't request an initial arena?");
+  }
+
+  // Mask the arena's unstable cells out of the run first, so that they can't make its path look
+  // new, or its coverage look improved.
+  {
+    std::shared_lock<std::shared_mutex> mask_lock(found->mutex, std::defer_lock);
+    timed_lock(mask_lock);
+    mask_unstable(found->unstable, run_arena, cells);
+  }
+
+  // Identify the run's path (and score it on its own) before taking the arena's lock, since
+  // only this run's coverage is needed for it.
+  unsigned char path_hash[SL2_HASH_LEN + 1] = {0};
+  path_hash_hex(run_arena, (char *)path_hash);
+  uint32_t run_score = cells ? sparse_score(*cells) : coverage_score(run_arena);
+
+  // Only fuzzers on the same arena wait on this.
+  std::unique_lock<std::shared_mutex> state_lock(found->mutex, std::defer_lock);
+  timed_lock(state_lock);
+  strategy_state &state = *found;
+
+  state.last_used = GetTickCount64();
+
+  // A run that outlasts the eviction timeout can find its arena evicted.
+  if (!state.arena) {
+    restore_arena(state, run_arena->id);
+  }
+
+  if (run_arena->size != state.arena->size) {
+    SL2_SERVER_LOG_FATAL("run's map size doesn't match its arena's (%u != %u)", run_arena->size,
+                         state.arena->size);
+  }
+
+  uint32_t prior_score = state.score;
+
+  memcpy(state.path_hash, path_hash, sizeof(path_hash));
+  state.run_score = run_score;
+  count_path(state, path_hash);
+
+  if (fingerprint && state.known_paths.size() < SL2_MAX_KNOWN_PATHS) {
+    sl2_known_path &known = state.known_paths[fingerprint];
+    memcpy(known.path_hash, path_hash, sizeof(path_hash));
+    known.run_score = run_score;
+  }
+
+  // Progress is judged against the virgin map rather than the merged score: a run that
+  // hits a new cell (or bucket) is progress even when saturation or bucketing keeps the merged
+  // score from going up.
+  uint32_t new_buckets = 0;
+  uint32_t new_cells = cells ? sparse_novelty(state.virgin, *cells, &new_buckets)
+                             : arena_novelty(state.virgin, run_arena, &new_buckets);
+
+  // In directed mode, coming closer to the targets than ever is progress too, even without new
+  // coverage, so that the run's inputs and strategies are favored.
+  bool approached = distance != SL2_DISTANCE_NONE &&
+                    (!state.directed || distance < state.best_distance);
+  if (approached) {
+    state.directed = true;
+    state.best_distance = distance;
+  }
+
+  bool improved = new_cells || new_buckets || approached;
+
+  state.run_new_cells = new_cells;
+  state.run_new_buckets = new_buckets;
+  state.run_exec_us = exec_us;
+  state.run_slow = is_slow_run(state, exec_us);
+
+  state.series_execs++;
+  state.series_new_cells += new_cells;
+  state.series_crashes += crashed;
+  state.series_exec_us += exec_us;
+
+  state.live_execs++;
+  state.live_new_cells += new_cells;
+  state.live_crashes += crashed;
+  state.live_exec_us += exec_us;
+
+  // Merge the existing coverage map with the one returned from the fuzzer
+  uint32_t score = cells ? arena_merge_sparse(state.arena.get(), state.score, *cells)
+                         : arena_merge_score(state.arena.get(), run_arena);
+
+  SL2_SERVER_LOG_DEBUG("score=%d, prior.score=%d, new_cells=%u, new_buckets=%u", score,
+                       prior_score, new_cells, new_buckets);
+
+  state.score = score;
+
+  if (improved && !state.run_slow) {
+    add_corpus_inputs(state, inputs, exec_us, path_key(path_hash), distance);
+  } else if (improved) {
+    SL2_SERVER_LOG_INFO("keeping a slow run's inputs out of the corpus (exec_us=%llu)", exec_us);
+  }
+
+  // In persistent and snapshot modes, the next iteration starts from scratch.
+  inputs->clear();
+
+  // Targeted calls that are new to the arena start from its schedule as it was before
+  // this run, like the arena's other targeted calls did.
+  next_target_strategies(state, targets, improved);
+  next_strategy(state, improved);
+
+  // Unless the user asked for the old write-through behavior,
+  // the checkpointer picks this arena up and writes it to disk for us.
+  if (opts.checkpoint_interval) {
+    state.dirty = true;
+  } else {
+    dump_strategy_state(state);
+  }
+}
+
+/**
+ * Counts a run that retraced a path its arena already knows (by its raw arena's fingerprint), as
+ * if its arena had been merged: the same raw arena can't hit a new cell or bucket, so only the
+ * path's count, the run's time and the strategies' statistics change. The merged map is left
+ * alone, so runs on already-counted paths no longer add to its hit counts.
+ * @param arena_id the run's arena's ID
+ * @param fingerprint the run's raw arena's fingerprint
+ * @param inputs the run's inputs, which are consumed if the path is known
+ * @param targets the run's mutated targets, which are consumed if the path is known
+ * @param exec_us how long the run took, in microseconds (0 if unknown)
+ * @param crashed whether the run crashed
+ * @return whether the path was known, and the run counted. Otherwise, the run's arena still needs
+ *         to be merged
+ */
+static bool count_known_path(const wchar_t *arena_id, uint64_t fingerprint,
+                             sl2_run_inputs_t *inputs, sl2_run_targets_t *targets,
+                             uint64_t exec_us, bool crashed) {
+  strategy_state *found = find_strategy_state(arena_id, false);
+
+  if (!found) {
+    SL2_SERVER_LOG_FATAL(
+        "no prior arena to compare against! fuzzer didn't request an initial arena?");
+  }
+
+  std::unique_lock<std::shared_mutex> state_lock(found->mutex, std::defer_lock);
+  timed_lock(state_lock);
+  strategy_state &state = *found;
+
+  // An evicted arena is merged as usual, which restores it.
+  std::unordered_map<uint64_t, sl2_known_path>::const_iterator it =
+      state.known_paths.find(fingerprint);
+
+  if (!state.arena || it == state.known_paths.end()) {
+    return false;
+  }
+
+  state.last_used = GetTickCount64();
+
+  memcpy(state.path_hash, it->second.path_hash, sizeof(state.path_hash));
+  state.run_score = it->second.run_score;
+  count_path(state, it->second.path_hash);
+
+  state.run_new_cells = 0;
+  state.run_new_buckets = 0;
+  state.run_exec_us = exec_us;
+  state.run_slow = is_slow_run(state, exec_us);
+
+  state.series_execs++;
+  state.series_crashes += crashed;
+  state.series_exec_us += exec_us;
+
+  state.live_execs++;
+  state.live_crashes += crashed;
+  state.live_exec_us += exec_us;
+
+  inputs->clear();
+  next_target_strategies(state, targets, false);
+  next_strategy(state, false);
+
+  if (opts.checkpoint_interval) {
+    state.dirty = true;
+  } else {
+    dump_strategy_state(state);
+  }
+
+  return true;
+}
+
+/**
+ * Measures how long a session's run took, and starts timing its next one.
+ * @param run_started when the session's run started (see sl2_pipe_ctx), which is reset to now
+ * @return the run's duration, in microseconds
+ */
+static uint64_t end_run_timer(uint64_t *run_started) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+
+  uint64_t ticks = *run_started ? now.QuadPart - *run_started : 0;
+  *run_started = now.QuadPart;
+
+  return (ticks * 1000000) / perf_frequency.QuadPart;
+}
+
+/**
+ * Merges the arena sent by the client with the one previously stored for incremental coverage
+ * measurements. If the client's arena is mapped, its map is read straight from the shared section
+ * instead of the pipe.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param mapping the session's arena mapping
+ * @param inputs the session's inputs
+ * @param targets the session's mutated targets
+ * @param run_started when the session's run started (see end_run_timer)
+ */
+static void handle_set_arena(HANDLE pipe, sl2_arena_mapping *mapping, sl2_run_inputs_t *inputs,
+                             sl2_run_targets_t *targets, uint64_t *run_started) {
+  sl2_arena arena = {0};
+  std::vector<uint32_t> cells;
+
+  sl2_arena *run_arena = read_run_arena(pipe, mapping, &arena, &cells);
+  merge_run_arena(run_arena, inputs, targets, end_run_timer(run_started), false,
+                  cells.empty() ? NULL : &cells);
+}
+
+/**
+ * Renders full paths for writing dump files to the client
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param session the session, which may be bound to the event's run (see EVT_SESSION_BEGIN)
+ */
+static void handle_crash_paths(HANDLE pipe, const sl2_session *session) {
+  DWORD txsize;
+  sl2_run_ref scratch;
+  uint64_t pid;
+
+  const sl2_run_ref *run = read_run(pipe, session, &scratch);
+
+  if (!pipe_read(pipe, &pid, sizeof(pid), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read PID");
+  }
+
+  const wchar_t *run_dir = run->run_dir;
+  wchar_t target_file[MAX_PATH + 1] = {0};
+  wchar_t target_path[MAX_PATH + 1] = {0};
+
+  StringCchPrintfW(target_file, MAX_PATH, FUZZ_RUN_CRASH_RECORD_FMT, pid);
+  PathCchCombine(target_path, MAX_PATH, run_dir, target_file);
+
+  size_t size = wcsnlen_s(target_path, MAX_PATH + 1) * sizeof(wchar_t);
+
+  if (!pipe_write(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write length of crash record path to pipe");
+  }
+
+  if (!pipe_write(pipe, &target_path, (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write crash record path to pipe");
+  }
+
+  SL2_SERVER_LOG_INFO("wrote crash record path: %S", target_path);
+
+  memset(target_file, 0, (MAX_PATH + 1) * sizeof(wchar_t));
+  memset(target_path, 0, (MAX_PATH + 1) * sizeof(wchar_t));
+  StringCchPrintfW(target_file, MAX_PATH, FUZZ_RUN_MEM_DMP_FMT, pid);
+  PathCchCombine(target_path, MAX_PATH, run_dir, target_file);
+
+  size = wcsnlen_s(target_path, MAX_PATH + 1) * sizeof(wchar_t);
+
+  if (!pipe_write(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write length of mem.dmp path to pipe");
+  }
+
+  if (!pipe_write(pipe, &target_path, (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write mem.dmp path to pipe");
+  }
+
+  SL2_SERVER_LOG_INFO("wrote mem.dmp path: %S", target_path);
+
+  memset(target_file, 0, (MAX_PATH + 1) * sizeof(wchar_t));
+  memset(target_path, 0, (MAX_PATH + 1) * sizeof(wchar_t));
+  StringCchPrintfW(target_file, MAX_PATH, FUZZ_RUN_INITIAL_DMP_FMT, pid);
+  PathCchCombine(target_path, MAX_PATH, run_dir, target_file);
+
+  size = wcsnlen_s(target_path, MAX_PATH + 1) * sizeof(wchar_t);
+
+  if (!pipe_write(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write length of initial.dmp path to pipe");
+  }
+
+  if (!pipe_write(pipe, &target_path, (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write initial.dmp path to pipe");
+  }
+
+  SL2_SERVER_LOG_INFO("wrote initial.dmp path: %S", target_path);
+}
+
+/*! The capture flags that MiniDumpWriteDump needs in order to dump a process snapshot */
+#define SL2_DUMP_SNAPSHOT_FLAGS                                                                    \
+  (PSS_CAPTURE_VA_CLONE | PSS_CAPTURE_HANDLES | PSS_CAPTURE_HANDLE_NAME |                          \
+   PSS_CAPTURE_HANDLE_BASIC_INFORMATION | PSS_CAPTURE_HANDLE_TYPE_SPECIFIC_INFORMATION |           \
+   PSS_CAPTURE_HANDLE_TRACE | PSS_CAPTURE_THREADS | PSS_CAPTURE_THREAD_CONTEXT |                  \
+   PSS_CAPTURE_THREAD_CONTEXT_EXTENDED | PSS_CREATE_BREAKAWAY | PSS_CREATE_BREAKAWAY_OPTIONAL |    \
+   PSS_CREATE_USE_VM_ALLOCATIONS | PSS_CREATE_RELEASE_SECTION)
+
+/*! A minidump waiting to be written from a crashed process's snapshot */
+struct sl2_dump_job {
+  /*! The snapshot of the crashed process */
+  HPSS snapshot;
+  DWORD pid;
+  /*! The crashing thread */
+  DWORD thread_id;
+  /*! The address of the crash's EXCEPTION_POINTERS, in the crashed process */
+  uint64_t exception_pointers;
+  /*! Where the dump goes */
+  wchar_t dump_path[MAX_PATH + 1];
+};
+
+/**
+ * Tells MiniDumpWriteDump that the "process" we hand it is really a snapshot.
+ */
+static BOOL CALLBACK dump_snapshot_callback(PVOID param, const PMINIDUMP_CALLBACK_INPUT input,
+                                            PMINIDUMP_CALLBACK_OUTPUT output) {
+  if (input->CallbackType == IsProcessSnapshotCallback) {
+    output->Status = S_FALSE;
+  }
+
+  return TRUE;
+}
+
+/*! The most bytes that compress_file writes at a time */
+#define SL2_COMPRESS_WRITE_CHUNK (1 << 30)
+
+/**
+ * Writes a compressed copy of a file (see sl2_compress.hpp).
+ * @param src_path the file to compress, which is mapped rather than read
+ * @param dst_path where to write the compressed copy
+ * @param written receives the compressed copy's size, if it was written
+ * @return success. On failure, the compressed copy is deleted
+ */
+static bool compress_file(const wchar_t *src_path, const wchar_t *dst_path,
+                          LARGE_INTEGER *written) {
+  std::vector<uint8_t> compressed;
+  LARGE_INTEGER size = {0};
+  HANDLE mapping = NULL;
+  uint8_t *view = NULL;
+  bool ok = false;
+
+  HANDLE file =
+      CreateFile(src_path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+    mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  }
+
+  if (mapping) {
+    view = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  }
+
+  if (view) {
+    ok = sl2_compress(view, (size_t)size.QuadPart, compressed);
+    UnmapViewOfFile(view);
+  }
+
+  if (mapping) {
+    CloseHandle(mapping);
+  }
+
+  CloseHandle(file);
+
+  if (!ok) {
+    return false;
+  }
+
+  file = CreateFile(dst_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  for (size_t offset = 0; ok && offset < compressed.size();) {
+    DWORD chunk = (DWORD)std::min<size_t>(compressed.size() - offset, SL2_COMPRESS_WRITE_CHUNK);
+    DWORD txsize;
+
+    ok = WriteFile(file, compressed.data() + offset, chunk, &txsize, NULL) && txsize == chunk;
+    offset += chunk;
+  }
+
+  CloseHandle(file);
+
+  if (!ok) {
+    DeleteFile(dst_path);
+    return false;
+  }
+
+  written->QuadPart = compressed.size();
+
+  return true;
+}
+
+/**
+ * Writes a crashed process's initial minidump from its snapshot, then frees the snapshot.
+ * Runs on the system thread pool, so that the client that asked for it isn't kept waiting.
+ * With -z, the dump is compressed once it's written; triage decompresses it when it's read.
+ * @param data the sl2_dump_job to complete
+ * @return 0
+ */
+static DWORD WINAPI write_crash_dump(void *data) {
+  sl2_dump_job *job = (sl2_dump_job *)data;
+  wchar_t tmp_path[MAX_PATH + 1] = {0};
+  wchar_t compressed_path[MAX_PATH + 1] = {0};
+  MINIDUMP_EXCEPTION_INFORMATION mdump_info = {0};
+  MINIDUMP_CALLBACK_INFORMATION callback = {0};
+  HANDLE file = INVALID_HANDLE_VALUE;
+  BOOL ok = false;
+  LARGE_INTEGER start;
+  LARGE_INTEGER dump_size = {0};
+
+  QueryPerformanceCounter(&start);
+
+  // We write to a temporary file and rename it into place, so that triage
+  // never picks up a partially written dump.
+  StringCchPrintfW(tmp_path, MAX_PATH, L"%s.tmp", job->dump_path);
+  StringCchPrintfW(compressed_path, MAX_PATH, L"%s.z.tmp", job->dump_path);
+
+  file =
+      CreateFile(tmp_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    SL2_SERVER_LOG_ERROR("failed to open %S for the crash dump (GLE=%d)", tmp_path,
+                         GetLastError());
+    goto cleanup;
+  }
+
+  mdump_info.ThreadId = job->thread_id;
+  mdump_info.ExceptionPointers = (PEXCEPTION_POINTERS)job->exception_pointers;
+  mdump_info.ClientPointers = true;
+
+  callback.CallbackRoutine = dump_snapshot_callback;
+
+  ok = MiniDumpWriteDump((HANDLE)job->snapshot, job->pid, file, MiniDumpNormal, &mdump_info, NULL,
+                         &callback);
+
+  GetFileSizeEx(file, &dump_size);
+  CloseHandle(file);
+
+  if (!ok) {
+    SL2_SERVER_LOG_ERROR("MiniDumpWriteDump failed for pid=%lu (GLE=%d)", job->pid,
+                         GetLastError());
+    DeleteFile(tmp_path);
+    goto done;
+  }
+
+  if (opts.compress) {
+    if (compress_file(tmp_path, compressed_path, &dump_size)) {
+      DeleteFile(tmp_path);
+      StringCchCopyW(tmp_path, MAX_PATH, compressed_path);
+    } else {
+      SL2_SERVER_LOG_WARN("failed to compress the crash dump, keeping it raw: %S", job->dump_path);
+    }
+  }
+
+  if (!(ok = MoveFileEx(tmp_path, job->dump_path, MOVEFILE_REPLACE_EXISTING))) {
+    SL2_SERVER_LOG_ERROR("failed to move the crash dump into place: %S", job->dump_path);
+  } else {
+    SL2_SERVER_LOG_INFO("wrote crash dump: %S", job->dump_path);
+  }
+
+done:
+
+  sl2_etw_disk_write("crash_dump", job->dump_path, dump_size.QuadPart, us_since(start), ok);
+
+cleanup:
+
+  PssFreeSnapshot(GetCurrentProcess(), job->snapshot);
+  delete job;
+  pending_dumps--;
+
+  return 0;
+}
+
+/**
+ * Snapshots a crashing client and queues its initial minidump to be written in the background.
+ * The client only waits for the snapshot, which is copy-on-write and much cheaper than the
+ * dump itself, so it can exit (and the harness can move on) while the dump is written.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param session the session, which may be bound to the event's run (see EVT_SESSION_BEGIN)
+ */
+static void handle_crash_dump(HANDLE pipe, const sl2_session *session) {
+  DWORD txsize;
+  sl2_run_ref scratch;
+  uint64_t pid;
+  uint32_t thread_id;
+  uint64_t exception_pointers;
+  uint8_t status = 1;
+  wchar_t target_file[MAX_PATH + 1] = {0};
+  HANDLE process = NULL;
+  sl2_dump_job *job = NULL;
+
+  const sl2_run_ref *run = read_run(pipe, session, &scratch);
+
+  if (!pipe_read(pipe, &pid, sizeof(pid), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read PID");
+  }
+
+  if (!pipe_read(pipe, &thread_id, sizeof(thread_id), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read thread ID");
+  }
+
+  if (!pipe_read(pipe, &exception_pointers, sizeof(exception_pointers), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read exception pointers");
+  }
+
+  job = new sl2_dump_job();
+  job->pid = (DWORD)pid;
+  job->thread_id = thread_id;
+  job->exception_pointers = exception_pointers;
+
+  StringCchPrintfW(target_file, MAX_PATH, FUZZ_RUN_INITIAL_DMP_FMT, pid);
+  PathCchCombine(job->dump_path, MAX_PATH, run->run_dir, target_file);
+
+  process = OpenProcess(PROCESS_ALL_ACCESS, false, (DWORD)pid);
+
+  if (!process) {
+    SL2_SERVER_LOG_ERROR("couldn't open pid=%llu for a crash dump (GLE=%d)", pid, GetLastError());
+    delete job;
+    goto cleanup;
+  }
+
+  if (PssCaptureSnapshot(process, (PSS_CAPTURE_FLAGS)SL2_DUMP_SNAPSHOT_FLAGS, CONTEXT_ALL,
+                         &job->snapshot) != ERROR_SUCCESS) {
+    SL2_SERVER_LOG_ERROR("couldn't snapshot pid=%llu for a crash dump", pid);
+    delete job;
+    goto cleanup;
+  }
+
+  pending_dumps++;
+
+  if (!QueueUserWorkItem(write_crash_dump, job, WT_EXECUTELONGFUNCTION)) {
+    SL2_SERVER_LOG_WARN("couldn't queue the crash dump, writing it inline");
+    write_crash_dump(job);
+  }
+
+  status = 0;
+
+cleanup:
+
+  if (process) {
+    CloseHandle(process);
+  }
+
+  if (!pipe_write(pipe, &status, sizeof(status), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write crash dump status");
+  }
+}
+
+/**
+ * Confirms that the server is still alive
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_ping(HANDLE pipe) {
+  DWORD txsize;
+  uint8_t ok = 1;
+
+  SL2_SERVER_LOG_DEBUG("ponging the client");
+
+  if (!pipe_write(pipe, &ok, sizeof(ok), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write pong status to pipe");
+  }
+}
+
+/**
+ * Changes the log file's verbosity (see set_log_verbosity), and replies with the old one.
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_set_log_level(HANDLE pipe) {
+  DWORD txsize;
+  int8_t verbosity;
+
+  if (!pipe_read(pipe, &verbosity, sizeof(verbosity), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read log verbosity");
+  }
+
+  int8_t old = (int8_t)log_verbosity;
+
+  SL2_SERVER_LOG_INFO("changing log verbosity from %d to %d", old, verbosity);
+  set_log_verbosity(verbosity);
+
+  if (!pipe_write(pipe, &old, sizeof(old), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write the old log verbosity to pipe");
+  }
+}
+
+/**
+ * Starts the campaign's configuration off with the server's own options.
+ */
+static void init_campaign_config() {
+  std::lock_guard<std::mutex> lock(campaign_mutex);
+
+  campaign.version = SL2_CONFIG_VERSION;
+  campaign.fields = SL2_CONFIG_SERVER_FIELDS;
+  campaign.stickiness = opts.stickiness;
+  campaign.bucketing = opts.bucketing;
+  campaign.scheduler = (uint8_t)opts.scheduler;
+}
+
+/**
+ * Replies with the campaign's configuration.
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_get_config(HANDLE pipe) {
+  DWORD txsize;
+  sl2_campaign_config config;
+
+  {
+    std::lock_guard<std::mutex> lock(campaign_mutex);
+    config = campaign;
+  }
+
+  if (!pipe_write(pipe, &config, sizeof(config), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write campaign config");
+  }
+}
+
+/**
+ * Changes the fields of the campaign's configuration that the client sets, and replies with
+ * whether it did, followed by the configuration as it now stands. The server's own fields take
+ * effect right away: a new stickiness for the next strategy that stops paying off, and a new
+ * scheduler or bucketing for the next run that's merged.
+ * Handlers read opts without a lock, and each of the fields changed here is a single
+ * word, so a handler that's mid-way through a run just applies the old value to it.
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_set_config(HANDLE pipe) {
+  DWORD txsize;
+  sl2_campaign_config request = {0};
+  uint8_t status = SL2_CONFIG_OK;
+
+  if (!pipe_read(pipe, &request, sizeof(request), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read campaign config");
+  }
+
+  std::unique_lock<std::mutex> lock(campaign_mutex);
+
+  if (request.version != SL2_CONFIG_VERSION || (request.fields & ~SL2_CONFIG_ALL_FIELDS) ||
+      ((request.fields & SL2_CONFIG_SCHEDULER) && request.scheduler > SL2_SCHEDULER_THOMPSON)) {
+    status = SL2_CONFIG_INVALID;
+  } else if (request.generation && request.generation != campaign.generation) {
+    status = SL2_CONFIG_STALE;
+  } else {
+    if (request.fields & SL2_CONFIG_FUZZ_TIMEOUT) {
+      campaign.fuzz_timeout = request.fuzz_timeout;
+    }
+
+    if (request.fields & SL2_CONFIG_STICKINESS) {
+      campaign.stickiness = request.stickiness;
+      opts.stickiness = request.stickiness;
+    }
+
+    if (request.fields & SL2_CONFIG_BUCKETING) {
+      campaign.bucketing = !!request.bucketing;
+      opts.bucketing = !!request.bucketing;
+    }
+
+    if (request.fields & SL2_CONFIG_SCHEDULER) {
+      campaign.scheduler = request.scheduler;
+      opts.scheduler = (sl2_scheduler)request.scheduler;
+    }
+
+    if (request.fields & SL2_CONFIG_TARGETS) {
+      memcpy(campaign.targets, request.targets, sizeof(campaign.targets));
+    }
+
+    campaign.fields |= request.fields;
+    campaign.generation++;
+  }
+
+  sl2_campaign_config config = campaign;
+  lock.unlock();
+
+  if (status == SL2_CONFIG_OK) {
+    SL2_SERVER_LOG_INFO("campaign config is now generation %u (changed fields=%#x): "
+                        "fuzz_timeout=%u, stickiness=%u, bucketing=%d, scheduler=%d",
+                        config.generation, request.fields, config.fuzz_timeout, config.stickiness,
+                        config.bucketing, config.scheduler);
+  } else {
+    SL2_SERVER_LOG_WARN("refused campaign config change (status=%d, generation=%u, ours=%u)",
+                        status, request.generation, config.generation);
+  }
+
+  if (!pipe_write(pipe, &status, sizeof(status), &txsize) ||
+      !pipe_write(pipe, &config, sizeof(config), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write campaign config");
+  }
+}
+
+/**
+ * Handles PID registration for child processes (so we can kill them if they time out)
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param session the session, which may be bound to the event's run (see EVT_SESSION_BEGIN)
+ */
+static void handle_register_pid(HANDLE pipe, const sl2_session *session) {
+  DWORD txsize;
+  sl2_run_ref scratch;
+  bool tracing;
+  uint64_t pid;
+
+  SL2_SERVER_LOG_DEBUG("received pid registration request");
+
+  const sl2_run_ref *run = read_run(pipe, session, &scratch);
+
+  if (!pipe_read(pipe, &tracing, sizeof(tracing), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read tracing/fuzzing flag");
+  }
+
+  if (!pipe_read(pipe, &pid, sizeof(pid), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read pid");
+  }
+
+  SL2_SERVER_LOG_DEBUG("got pid=%lu", pid);
+
+  const wchar_t *run_dir = run->run_dir;
+  wchar_t pids_file[MAX_PATH + 1] = {0};
+  wchar_t pid_s[64] = {0};
+
+  _ui64tow_s(pid, pid_s, sizeof(pid_s) - 1, 10);
+  pid_s[wcsnlen_s(pid_s, sizeof(pid_s))] = '\n';
+
+  PathCchCombine(pids_file, MAX_PATH, run_dir,
+                 tracing ? FUZZ_RUN_TRACER_PIDS : FUZZ_RUN_FUZZER_PIDS);
+
+  std::unique_lock<std::shared_mutex> pid_lock(pid_mutex);
+
+  HANDLE file =
+      CreateFile(pids_file, FILE_APPEND_DATA, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file != INVALID_HANDLE_VALUE) {
+    if (!WriteFile(file, pid_s, (DWORD)wcsnlen_s(pid_s, sizeof(pid_s)) * sizeof(wchar_t), &txsize,
+                   NULL)) {
+      SL2_SERVER_LOG_ERROR("failed to write pid (pid=%lu, pids_file=%S)", pid, pids_file);
+    }
+
+    if (!CloseHandle(file)) {
+      SL2_SERVER_LOG_ERROR("failed to close pids_file=%S", pids_file);
+    }
+  } else {
+    SL2_SERVER_LOG_ERROR("failed to open pids_file=%S, not recording pid!", pids_file);
+  }
+}
+
+/**
+ * Suggests a mutation to the fuzzer based on coverage info. If the fuzzer is walking the
+ * deterministic stages, the next deterministic mutation follows the strategy advice.
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_advise_mutation(HANDLE pipe) {
+  DWORD txsize;
+  size_t size;
+  size_t bufsize = 0;
+  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+
+  if (!pipe_read(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+  }
+
+  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
+    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
+  }
+
+  if (!pipe_read(pipe, &arena_id, (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID");
+  }
+
+  if (!pipe_read(pipe, &bufsize, sizeof(bufsize), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read deterministic buffer size");
+  }
+
+  SL2_SERVER_LOG_DEBUG("got arena ID: %S (bufsize=%lu)", arena_id, bufsize);
+
+  write_strategy_advice(pipe, arena_id);
+
+  // A size of 0 means that the client only wants strategy advice.
+  if (bufsize > 0) {
+    write_deterministic_advice(pipe, arena_id, bufsize);
+  }
+}
+
+/**
+ * Weighs a corpus entry for picking as a seed: newer, smaller and faster entries are favored, as
+ * are (in directed mode) entries whose runs came closer to the directed targets. Each of those
+ * factors ranges from 0 to 2, and size, speed and closeness are 1 for an average entry.
+ * @param entry the entry
+ * @param newest_seq the seq of the newest entry that could be picked
+ * @param mean_size the mean size of the entries that could be picked
+ * @param mean_us the mean exec_us of the entries that could be picked (that have one)
+ * @param mean_distance the mean distance of the entries that could be picked (that have one), or
+ *                      a negative number if none of them has one
+ * @return the entry's weight
+ */
+static double seed_weight(const sl2_corpus_entry &entry, uint64_t newest_seq, double mean_size,
+                          double mean_us, double mean_distance) {
+  // An entry that's a whole corpus older than the newest one is worth half as much.
+  double recency = 2.0 / (1.0 + (double)(newest_seq - entry.seq) / SL2_CORPUS_SIZE);
+  double size = 2.0 * (mean_size + 1.0) / (mean_size + (double)entry.buf.size() + 2.0);
+  double us = entry.exec_us ? (double)entry.exec_us : mean_us;
+  double speed = 2.0 * (mean_us + 1.0) / (mean_us + us + 2.0);
+  double closeness = 1.0;
+
+  if (mean_distance >= 0.0) {
+    double distance = entry.distance != SL2_DISTANCE_NONE ? (double)entry.distance : mean_distance;
+    closeness = 2.0 * (mean_distance + 1.0) / (mean_distance + distance + 2.0);
+  }
+
+  return recency * size * speed * closeness;
+}
+
+/*! What seed_weight and seed_energy weigh a targeted read's seeds against */
+struct sl2_seed_stats {
+  /*! The number of seeds that the read has */
+  size_t count;
+  uint64_t newest_seq;
+  double mean_size;
+  double mean_us;
+  /*! The mean of the seeds' path frequencies (see path_frequency) */
+  double mean_freq;
+  /*! The mean distance of the seeds that have one, or -1 if none of them does */
+  double mean_distance;
+};
+
+/**
+ * @param state the seed's arena's strategy state, locked
+ * @param entry a seed
+ * @return how many runs have taken the seed's path since the server started, and at least 1 (so
+ *         that seeds whose paths are unknown count as rare)
+ */
+static uint64_t path_frequency(const strategy_state &state, const sl2_corpus_entry &entry) {
+  std::unordered_map<uint64_t, uint32_t>::const_iterator it = state.path_counts.find(entry.path);
+
+  return it != state.path_counts.end() && it->second ? it->second : 1;
+}
+
+/**
+ * Totals up a targeted read's seeds.
+ * @param state the arena's strategy state, locked
+ * @param mutate_count the targeted read
+ * @param stats receives the read's seed statistics
+ * @return whether the read has any seeds
+ */
+static bool seed_stats(const strategy_state &state, uint32_t mutate_count,
+                       sl2_seed_stats *stats) {
+  size_t timed = 0;
+  size_t directed = 0;
+  double total_size = 0.0;
+  double total_us = 0.0;
+  double total_freq = 0.0;
+  double total_distance = 0.0;
+
+  *stats = {0};
+
+  for (const sl2_corpus_entry &entry : state.corpus) {
+    if (entry.mut_count != mutate_count) {
+      continue;
+    }
+
+    stats->count++;
+    stats->newest_seq = std::max(stats->newest_seq, entry.seq);
+    total_size += (double)entry.buf.size();
+    total_freq += (double)path_frequency(state, entry);
+
+    if (entry.exec_us) {
+      timed++;
+      total_us += (double)entry.exec_us;
+    }
+
+    if (entry.distance != SL2_DISTANCE_NONE) {
+      directed++;
+      total_distance += (double)entry.distance;
+    }
+  }
+
+  if (!stats->count) {
+    return false;
+  }
+
+  stats->mean_size = total_size / stats->count;
+  stats->mean_us = timed ? total_us / timed : 0.0;
+  stats->mean_freq = total_freq / stats->count;
+  stats->mean_distance = directed ? total_distance / directed : -1.0;
+
+  return true;
+}
+
+/**
+ * Picks a seed from an arena's corpus, at random in proportion to each entry's seed_weight.
+ * @param state the arena's strategy state, locked
+ * @param mutate_count the targeted read that the seed should have been given to
+ * @param rng the random number generator to pick with
+ * @return the seed, or NULL if the corpus has no entry for the read
+ */
+static const sl2_corpus_entry *pick_seed(const strategy_state &state, uint32_t mutate_count,
+                                         std::mt19937_64 &rng) {
+  const std::vector<sl2_corpus_entry> &corpus = state.corpus;
+  sl2_seed_stats stats;
+
+  if (!seed_stats(state, mutate_count, &stats)) {
+    return NULL;
+  }
+
+  uint64_t newest_seq = stats.newest_seq;
+  double mean_size = stats.mean_size;
+  double mean_us = stats.mean_us;
+  double mean_distance = stats.mean_distance;
+  double total_weight = 0.0;
+
+  for (const sl2_corpus_entry &entry : corpus) {
+    if (entry.mut_count == mutate_count) {
+      total_weight += seed_weight(entry, newest_seq, mean_size, mean_us, mean_distance);
+    }
+  }
+
+  double roll = std::uniform_real_distribution<double>(0.0, total_weight)(rng);
+  const sl2_corpus_entry *pick = NULL;
+
+  for (const sl2_corpus_entry &entry : corpus) {
+    if (entry.mut_count != mutate_count) {
+      continue;
+    }
+
+    pick = &entry;
+    roll -= seed_weight(entry, newest_seq, mean_size, mean_us, mean_distance);
+
+    if (roll < 0.0) {
+      break;
+    }
+  }
+
+  return pick;
+}
+
+/**
+ * Works out how many times in a row a seed is handed out once the seed queue comes around to it,
+ * under the configured power schedule (see sl2_power_schedule). The baseline is the seed's
+ * seed_weight, so an average seed under the exploit schedule gets SL2_SEED_ENERGY.
+ * @param state the seed's arena's strategy state, locked
+ * @param entry the seed, whose picks don't count this one yet
+ * @param stats the seed's read's statistics
+ * @return the seed's energy, which is 0 if the seed should be skipped this time around
+ */
+static uint32_t seed_energy(const strategy_state &state, const sl2_corpus_entry &entry,
+                            const sl2_seed_stats &stats) {
+  double energy = SL2_SEED_ENERGY * seed_weight(entry, stats.newest_seq, stats.mean_size,
+                                                stats.mean_us, stats.mean_distance);
+  uint64_t freq = path_frequency(state, entry);
+  // 2^picks overflows the cap long before it overflows a double.
+  double growth = pow(2.0, (double)std::min(entry.picks, 32u));
+
+  switch (opts.power_schedule) {
+  case SL2_POWER_FAST:
+    energy = energy / SL2_SEED_ENERGY_BETA * growth / freq;
+    break;
+  case SL2_POWER_COE:
+    if (freq > stats.mean_freq) {
+      return 0;
+    }
+
+    energy = energy / SL2_SEED_ENERGY_BETA * growth;
+    break;
+  case SL2_POWER_EXPLORE:
+    energy /= SL2_SEED_ENERGY_BETA;
+    break;
+  default:
+    break;
+  }
+
+  return (uint32_t)std::min(std::max(energy, 1.0), (double)SL2_SEED_MAX_ENERGY);
+}
+
+/**
+ * Hands out the next seed in a targeted read's seed queue, under the configured power schedule.
+ * The queue walks the read's seeds in the order that they joined the corpus, handing each out
+ * as many times in a row as its seed_energy, and starts over once it's been through them all.
+ * Every fuzzer on the arena shares the queue, so they all work on the same seed.
+ * @param state the arena's strategy state, locked exclusively
+ * @param mutate_count the targeted read that the seed should have been given to
+ * @return the seed, or NULL if the corpus has no entry for the read
+ */
+static const sl2_corpus_entry *next_seed(strategy_state &state, uint32_t mutate_count) {
+  sl2_seed_stats stats;
+
+  if (mutate_count >= SL2_CORPUS_MAX_READS || !seed_stats(state, mutate_count, &stats)) {
+    return NULL;
+  }
+
+  sl2_seed_queue &queue = state.seed_queues[mutate_count];
+
+  if (queue.energy) {
+    for (sl2_corpus_entry &entry : state.corpus) {
+      if (entry.mut_count == mutate_count && entry.seq == queue.seq) {
+        queue.energy--;
+        entry.execs++;
+        return &entry;
+      }
+    }
+  }
+
+  // The seed ran out of energy (or left the corpus), so move on to the next one that has some.
+  // Under coe, the read's rarest seed never has a path more frequent than the mean, so
+  // a full pass over the queue always ends on a seed.
+  sl2_corpus_entry *pick = NULL;
+
+  for (size_t i = 0; i < stats.count && !pick; ++i) {
+    sl2_corpus_entry *next = NULL;
+    sl2_corpus_entry *first = NULL;
+
+    for (sl2_corpus_entry &entry : state.corpus) {
+      if (entry.mut_count != mutate_count) {
+        continue;
+      }
+
+      if (!first || entry.seq < first->seq) {
+        first = &entry;
+      }
+
+      if (entry.seq > queue.seq && (!next || entry.seq < next->seq)) {
+        next = &entry;
+      }
+    }
+
+    next = next ? next : first;
+
+    uint32_t energy = seed_energy(state, *next, stats);
+    next->picks++;
+    queue.seq = next->seq;
+    queue.energy = energy;
+
+    if (energy) {
+      pick = next;
+    }
+  }
+
+  // Seed statistics only change the corpus file once per pick, rather than every time
+  // a seed is handed out.
+  state.corpus_dirty = true;
+
+  if (!pick) {
+    return NULL;
+  }
+
+  queue.energy--;
+  pick->execs++;
+
+  SL2_SERVER_LOG_DEBUG("seed queue for read %u moved to seq=%llu (picks=%u, energy=%u)",
+                       mutate_count, pick->seq, pick->picks, queue.energy + 1);
+
+  return pick;
+}
+
+/**
+ * Hands the client an input from an arena's corpus that was given to the same targeted read:
+ * a random one for splicing, or one picked by the power schedule (see sl2_power_schedule) as a
+ * seed to mutate from. Replies with a size of 0 if there isn't one.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param seed whether the client wants a seed rather than a splice donor
+ * @param served the seeds that the session's run has been handed, which a seed is added to
+ *               (with -K), or NULL
+ */
+static void handle_corpus_donor(HANDLE pipe, bool seed, sl2_served_seeds_t *served) {
+  static thread_local std::mt19937_64 rng(std::random_device{}());
+  DWORD txsize;
+  size_t size = 0;
+  uint32_t mutate_count = 0;
+  size_t capacity = 0;
+  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+  std::vector<uint8_t> donor;
+  uint64_t seq = 0;
+
+  if (!pipe_read(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+  }
+
+  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
+    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
+  }
+
+  if (!pipe_read(pipe, arena_id, (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID");
+  }
+
+  if (!pipe_read(pipe, &mutate_count, sizeof(mutate_count), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read mutation count");
+  }
+
+  if (!pipe_read(pipe, &capacity, sizeof(capacity), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read donor capacity");
+  }
+
+  strategy_state *state = find_strategy_state(arena_id, false);
+
+  if (state && seed && opts.power_schedule != SL2_POWER_WEIGHTED) {
+    // Handing out a seed moves its read's seed queue along.
+    std::unique_lock<std::shared_mutex> state_lock(state->mutex, std::defer_lock);
+    timed_lock(state_lock);
+
+    const sl2_corpus_entry *pick = next_seed(*state, mutate_count);
+
+    if (pick) {
+      donor.assign(pick->buf.begin(), pick->buf.begin() + std::min(capacity, pick->buf.size()));
+      seq = pick->seq;
+    }
+  } else if (state) {
+    std::shared_lock<std::shared_mutex> state_lock(state->mutex, std::defer_lock);
+    timed_lock(state_lock);
+
+    // The corpus is small, so a pick over the whole thing is cheap enough.
+    size_t seen = 0;
+    const sl2_corpus_entry *pick = NULL;
+
+    if (!seed) {
+      for (const sl2_corpus_entry &entry : state->corpus) {
+        if (entry.mut_count == mutate_count && rng() % ++seen == 0) {
+          pick = &entry;
+        }
+      }
+    } else {
+      pick = pick_seed(*state, mutate_count, rng);
+    }
+
+    if (pick) {
+      donor.assign(pick->buf.begin(), pick->buf.begin() + std::min(capacity, pick->buf.size()));
+      seq = pick->seq;
+    }
+  }
+
+  if (seed && served && opts.compact_fkts && !donor.empty()) {
+    (*served)[mutate_count] = {arena_id, seq, donor, false};
+  }
+
+  SL2_SERVER_LOG_DEBUG("%s for %S#%u: size=%lu", seed ? "seed" : "donor", arena_id,
+                       mutate_count, donor.size());
+
+  size = donor.size();
+
+  if (!pipe_write(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write donor size");
+  }
+
+  if (size > 0 && !pipe_write(pipe, donor.data(), (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write donor");
+  }
+}
+
+/**
+ * Reads the ID of the arena that a corpus request is for, which must be well-formed since the
+ * arena's corpus may be read from the disk.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param arena_id receives the arena ID
+ */
+static void read_corpus_arena_id(HANDLE pipe, wchar_t *arena_id) {
+  DWORD txsize;
+  size_t size = 0;
+
+  if (!pipe_read(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+  }
+
+  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
+    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
+  }
+
+  if (!pipe_read(pipe, arena_id, (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID");
+  }
+
+  arena_id[SL2_HASH_LEN] = L'\0';
+
+  if (!sync_valid_arena_id(arena_id)) {
+    SL2_SERVER_LOG_FATAL("malformed arena ID in corpus request");
+  }
+}
+
+/**
+ * Sends the client every input in an arena's corpus, e.g. for minimizing it. An arena that
+ * isn't in memory has its corpus read straight from the disk.
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_corpus_list(HANDLE pipe) {
+  DWORD txsize;
+  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+  std::vector<sl2_corpus_entry> corpus;
+  bool resident = false;
+
+  read_corpus_arena_id(pipe, arena_id);
+
+  strategy_state *state = find_strategy_state(arena_id, false);
+
+  if (state) {
+    std::shared_lock<std::shared_mutex> state_lock(state->mutex, std::defer_lock);
+    timed_lock(state_lock);
+
+    if (state->arena) {
+      corpus = state->corpus;
+      resident = true;
+    }
+  }
+
+  // An arena that isn't in memory never has a newer corpus than the one on the disk.
+  if (!resident) {
+    size_t corpus_next;
+    load_corpus_from_disk(arena_id, corpus, &corpus_next);
+  }
+
+  SL2_SERVER_LOG_INFO("listing %lu corpus entries for %S", corpus.size(), arena_id);
+
+  uint32_t count = (uint32_t)corpus.size();
+
+  if (!pipe_write(pipe, &count, sizeof(count), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write corpus size");
+  }
+
+  for (const sl2_corpus_entry &entry : corpus) {
+    sl2_corpus_file_entry record = corpus_file_entry(entry);
+
+    if (!pipe_write(pipe, &record, sizeof(record), &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write corpus entry");
+    }
+
+    if (!entry.buf.empty() &&
+        !pipe_write(pipe, entry.buf.data(), (DWORD)entry.buf.size(), &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write corpus entry's input");
+    }
+  }
+}
+
+/**
+ * Removes the given inputs from an arena's corpus, e.g. once a minimization has found them to be
+ * redundant. Inputs that have already left the corpus are skipped. Replies with the number of
+ * inputs removed.
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_corpus_prune(HANDLE pipe) {
+  DWORD txsize;
+  uint32_t count = 0;
+  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+
+  read_corpus_arena_id(pipe, arena_id);
+
+  if (!pipe_read(pipe, &count, sizeof(count), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read prune count");
+  }
+
+  if (count > SL2_CORPUS_SIZE) {
+    SL2_SERVER_LOG_FATAL("too many inputs to prune (%u > %u)", count, SL2_CORPUS_SIZE);
+  }
+
+  std::vector<uint64_t> seqs(count);
+
+  if (count && !pipe_read(pipe, seqs.data(), count * sizeof(uint64_t), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read the inputs to prune");
+  }
+
+  load_strategy_state(arena_id);
+
+  strategy_state *state = find_strategy_state(arena_id, false);
+  std::unique_lock<std::shared_mutex> state_lock(state->mutex, std::defer_lock);
+  timed_lock(state_lock);
+
+  if (!state->arena) {
+    restore_arena(*state, arena_id);
+  }
+
+  size_t before = state->corpus.size();
+
+  state->corpus.erase(std::remove_if(state->corpus.begin(), state->corpus.end(),
+                                     [&seqs](const sl2_corpus_entry &entry) {
+                                       return std::find(seqs.begin(), seqs.end(), entry.seq) !=
+                                              seqs.end();
+                                     }),
+                      state->corpus.end());
+
+  uint32_t removed = (uint32_t)(before - state->corpus.size());
+
+  if (removed) {
+    // Once the corpus fills up again, new inputs go back to replacing the oldest one first.
+    std::sort(state->corpus.begin(), state->corpus.end(),
+              [](const sl2_corpus_entry &a, const sl2_corpus_entry &b) { return a.seq < b.seq; });
+    state->corpus_next = 0;
+    state->corpus_dirty = true;
+
+    if (!opts.checkpoint_interval) {
+      dump_strategy_state(*state);
+    }
+  }
+
+  SL2_SERVER_LOG_INFO("pruned %u of %lu corpus entries for %S", removed, before, arena_id);
+
+  if (!pipe_write(pipe, &removed, sizeof(removed), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write prune count");
+  }
+}
+
+/**
+ * Adds the given cells to an arena's unstable cells, e.g. once a calibration has seen their hit
+ * counts change between runs of the same input. They're cleared from the merged arena (and its
+ * virgin map) right away, and masked out of every run from now on. Replies with the number of
+ * unstable cells that the arena now has.
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_set_unstable(HANDLE pipe) {
+  DWORD txsize;
+  uint32_t count = 0;
+  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+
+  read_corpus_arena_id(pipe, arena_id);
+
+  if (!pipe_read(pipe, &count, sizeof(count), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read unstable cell count");
+  }
+
+  if (count > FUZZ_ARENA_MAX_SIZE) {
+    SL2_SERVER_LOG_FATAL("too many unstable cells (%u > %u)", count, FUZZ_ARENA_MAX_SIZE);
+  }
+
+  std::vector<uint32_t> cells(count);
+
+  if (count && !pipe_read(pipe, cells.data(), count * sizeof(uint32_t), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read unstable cells");
+  }
+
+  load_strategy_state(arena_id);
+
+  strategy_state *state = find_strategy_state(arena_id, false);
+  std::unique_lock<std::shared_mutex> state_lock(state->mutex, std::defer_lock);
+  timed_lock(state_lock);
+
+  if (!state->arena) {
+    restore_arena(*state, arena_id);
+  }
+
+  sl2_arena *arena = state->arena.get();
+  size_t before = state->unstable.size();
+
+  for (uint32_t index : cells) {
+    if (index >= arena->size) {
+      SL2_SERVER_LOG_FATAL("unstable cell out of range (%u >= %u)", index, arena->size);
+    }
+
+    arena->map[index] = 0;
+    state->virgin[index] = 0;
+    state->unstable.push_back(index);
+  }
+
+  std::sort(state->unstable.begin(), state->unstable.end());
+  state->unstable.erase(std::unique(state->unstable.begin(), state->unstable.end()),
+                        state->unstable.end());
+
+  if (state->unstable.size() != before) {
+    // The known paths were hashed with the old cells unmasked.
+    state->known_paths.clear();
+    state->score = coverage_score(arena);
+    dump_unstable_to_disk(arena_id, state->unstable);
+
+    if (opts.checkpoint_interval) {
+      state->dirty = true;
+    } else {
+      dump_strategy_state(*state);
+    }
+  }
+
+  uint32_t unstable = (uint32_t)state->unstable.size();
+
+  SL2_SERVER_LOG_INFO("%S has %u unstable cells (%lu new)", arena_id, unstable,
+                      state->unstable.size() - before);
+
+  if (!pipe_write(pipe, &unstable, sizeof(unstable), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write unstable cell count");
+  }
+}
+
+/**
+ * Generates mutations into a ring until it's full, following its arena's current strategy.
+ * Stops early if a fuzzer that claimed a slot on the last lap hasn't handed it back yet;
+ * that fuzzer's registration queues another fill once it has.
+ * @param state the ring, locked
+ * @return true if the ring is full, false if it stopped early
+ */
+static bool fill_ring_slots(sl2_ring_state *state) {
+  sl2_mutation_ring *ring = state->ring;
+  uint32_t table_idx;
+
+  {
+    std::shared_lock<std::shared_mutex> state_lock(state->strategy->mutex);
+    table_idx = state->strategy->strategy;
+  }
+
+  while (ring->head - ring->tail < SL2_RING_SLOTS) {
+    LONG64 pos = ring->head;
+    sl2_ring_slot *slot = sl2_ring_slot_at(ring, pos);
+
+    if (slot->seq != pos) {
+      return false;
+    }
+
+    uint8_t *buf = (uint8_t *)(slot + 1);
+    memcpy(buf, state->original.data(), ring->bufsize);
+
+    sl2_mutation mutation = {0};
+    mutation.buffer = buf;
+    mutation.bufsize = ring->bufsize;
+    do_mutation_custom(&state->rng, &mutation, SL2_STRATEGY_TABLE[table_idx]);
+
+    // Journal the mutation before publishing it, so that it can be registered as soon as
+    // a fuzzer claims it.
+    sl2_ring_entry &entry = state->journal[pos % SL2_RING_JOURNAL_SLOTS];
+    entry.seq = pos;
+    entry.mut_type = mutation.mut_type;
+    entry.buf.assign(buf, buf + ring->bufsize);
+
+    slot->mut_type = mutation.mut_type;
+    MemoryBarrier();
+    slot->seq = pos + 1;
+    InterlockedExchange64(&ring->head, pos + 1);
+  }
+
+  return true;
+}
+
+/**
+ * Fills a ring on the thread pool. See queue_ring_fill.
+ * @param data the ring's sl2_ring_state
+ * @return error code (0)
+ */
+static DWORD WINAPI fill_mutation_ring(void *data) {
+  sl2_ring_state *state = (sl2_ring_state *)data;
+  bool full;
+
+  do {
+    {
+      std::lock_guard<std::mutex> ring_lock(state->mutex);
+      full = fill_ring_slots(state);
+    }
+
+    state->filling = false;
+
+    // A fuzzer may have claimed a slot after we last checked, and had its fill
+    // dropped because we were still running. Go around again if so.
+  } while (full && state->ring->head - state->ring->tail < SL2_RING_SLOTS &&
+           !state->filling.exchange(true));
+
+  return 0;
+}
+
+/**
+ * Queues a fill of the given ring, unless one is already queued or running.
+ * @param state the ring
+ */
+static void queue_ring_fill(sl2_ring_state *state) {
+  if (state->filling.exchange(true)) {
+    return;
+  }
+
+  if (!QueueUserWorkItem(fill_mutation_ring, state, WT_EXECUTEDEFAULT)) {
+    SL2_SERVER_LOG_ERROR("failed to queue a ring fill");
+    state->filling = false;
+  }
+}
+
+/**
+ * @param section_name the name of the ring's section
+ * @return the ring, or NULL if it hasn't been created
+ */
+static sl2_ring_state *find_mutation_ring(const wchar_t *section_name) {
+  std::shared_lock<std::shared_mutex> ring_lock(ring_mutex, std::defer_lock);
+  timed_lock(ring_lock);
+
+  sl2_ring_map_t::iterator it = ring_map.find(section_name);
+  return it == ring_map.end() ? NULL : &(it->second);
+}
+
+/**
+ * @param id the ring's ID
+ * @return the ring, or NULL if there's no ring with that ID
+ */
+static sl2_ring_state *find_mutation_ring(uint32_t id) {
+  std::shared_lock<std::shared_mutex> ring_lock(ring_mutex, std::defer_lock);
+  timed_lock(ring_lock);
+
+  return id < rings.size() ? rings[id] : NULL;
+}
+
+/**
+ * Creates a ring of mutations of the given read (or finds the one that another client created
+ * first), and queues its first fill.
+ * @param section_name the name of the ring's section
+ * @param arena_id the ID of the (loaded) arena that the read belongs to
+ * @param original the unmutated read
+ * @return the ring, or NULL on failure
+ */
+static sl2_ring_state *create_mutation_ring(const wchar_t *section_name, const wchar_t *arena_id,
+                                            std::vector<uint8_t> &original) {
+  std::unique_lock<std::shared_mutex> ring_lock(ring_mutex, std::defer_lock);
+  timed_lock(ring_lock);
+
+  sl2_ring_map_t::iterator it = ring_map.find(section_name);
+  if (it != ring_map.end()) {
+    return &(it->second);
+  }
+
+  if (rings.size() >= SL2_MAX_RINGS) {
+    SL2_SERVER_LOG_ERROR("too many mutation rings, refusing to create %S", section_name);
+    return NULL;
+  }
+
+  size_t ring_size = sl2_ring_size(original.size());
+  HANDLE section = CreateFileMappingNuma(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+                                         (DWORD)ring_size, section_name, server_numa_node);
+
+  if (!section) {
+    SL2_SERVER_LOG_ERROR("failed to create ring section: %S", section_name);
+    return NULL;
+  }
+
+  // This can happen if a fuzzer from a previous server is still holding the section.
+  // We reset it below, so that fuzzer will just see an empty ring.
+  if (GetLastError() == ERROR_ALREADY_EXISTS) {
+    SL2_SERVER_LOG_WARN("ring section already existed, resetting it: %S", section_name);
+  }
+
+  sl2_mutation_ring *ring =
+      (sl2_mutation_ring *)MapViewOfFile(section, FILE_MAP_ALL_ACCESS, 0, 0, ring_size);
+
+  if (!ring) {
+    SL2_SERVER_LOG_ERROR("failed to map ring section: %S", section_name);
+    CloseHandle(section);
+    return NULL;
+  }
+
+  ring->id = (uint32_t)rings.size();
+  ring->bufsize = (uint32_t)original.size();
+  ring->head = 0;
+  ring->tail = 0;
+
+  for (LONG64 i = 0; i < SL2_RING_SLOTS; i++) {
+    sl2_ring_slot_at(ring, i)->seq = i;
+  }
+
+  sl2_ring_state *state = &(ring_map[section_name]);
+  state->section = section;
+  state->ring = ring;
+  state->strategy = find_strategy_state(arena_id, false);
+  state->original = original;
+
+  for (sl2_ring_entry &entry : state->journal) {
+    entry.seq = -1;
+  }
+
+  std::random_device rd;
+  sl2_rng_seed(&(state->rng), ((uint64_t)rd() << 32) | rd());
+
+  rings.push_back(state);
+
+  SL2_SERVER_LOG_DEBUG("created mutation ring %u: %S (bufsize=%lu)", ring->id, section_name,
+                       original.size());
+
+  queue_ring_fill(state);
+
+  return state;
+}
+
+/**
+ * Hands the client the ring of mutations that the server pre-generates for one of its targeted
+ * reads. The client identifies the read by its hash; if the server hasn't seen the read before,
+ * it replies with status 2 and the client sends the read itself.
+ * On success, the status is followed by the name of the ring's section.
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_map_ring(HANDLE pipe) {
+  DWORD txsize;
+  size_t size = 0;
+  uint32_t mutate_count = 0;
+  size_t bufsize = 0;
+  uint64_t hash = 0;
+  uint8_t status = 0;
+  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+  wchar_t section_name[MAX_PATH + 1] = {0};
+  sl2_ring_state *state = NULL;
+
+  if (!pipe_read(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+  }
+
+  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
+    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
+  }
+
+  if (!pipe_read(pipe, arena_id, (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID");
+  }
+
+  if (!pipe_read(pipe, &mutate_count, sizeof(mutate_count), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read mutation count");
+  }
+
+  if (!pipe_read(pipe, &bufsize, sizeof(bufsize), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read size of targeted read");
+  }
+
+  if (!pipe_read(pipe, &hash, sizeof(hash), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read hash of targeted read");
+  }
+
+  SL2_SERVER_LOG_DEBUG("got arena ID: %S (mutate_count=%u, bufsize=%lu)", arena_id,
+                       mutate_count, bufsize);
+
+  if (bufsize == 0 || bufsize > SL2_RING_MAX_BUFSIZE) {
+    SL2_SERVER_LOG_WARN("not generating mutations for a read of %lu bytes", bufsize);
+    status = 1;
+    goto cleanup;
+  }
+
+  load_strategy_state(arena_id);
+
+  StringCchPrintfW(section_name, MAX_PATH, FUZZ_RING_SECTION_FMT, arena_id, mutate_count, hash);
+  state = find_mutation_ring(section_name);
+
+  if (!state) {
+    status = 2;
+
+    if (!pipe_write(pipe, &status, sizeof(status), &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write server status");
+    }
+
+    std::vector<uint8_t> original(bufsize);
+
+    if (!pipe_read(pipe, original.data(), (DWORD)bufsize, &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to read targeted read");
+    }
+
+    if (sl2_ring_hash(original.data(), bufsize) != hash) {
+      SL2_SERVER_LOG_ERROR("targeted read doesn't match its hash, not creating a ring");
+      status = 1;
+      goto cleanup;
+    }
+
+    state = create_mutation_ring(section_name, arena_id, original);
+    status = state ? 0 : 1;
+  }
+
+cleanup:
+
+  if (!pipe_write(pipe, &status, sizeof(status), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write server status");
+  }
+
+  if (!status) {
+    size = wcsnlen_s(section_name, MAX_PATH + 1) * sizeof(wchar_t);
+
+    if (!pipe_write(pipe, &size, sizeof(size), &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write length of ring section name to pipe");
+    }
+
+    if (!pipe_write(pipe, section_name, (DWORD)size, &txsize)) {
+      SL2_SERVER_LOG_FATAL("failed to write ring section name to pipe");
+    }
+
+    SL2_SERVER_LOG_DEBUG("wrote ring section name: %S", section_name);
+  }
+}
+
+/**
+ * Registers a mutation that a fuzzer popped from a ring. The server already journaled the
+ * mutation's bytes when it generated them, so the fuzzer only sends the mutation's position.
+ * The client should fall back on EVT_REGISTER_MUTATION if this fails.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param session the session, which may be bound to the event's run (see EVT_SESSION_BEGIN)
+ * @param inputs the session's inputs, which the mutation's bytes are added to
+ */
+static void handle_register_ring_mutation(HANDLE pipe, const sl2_session *session,
+                                          sl2_run_inputs_t *inputs) {
+  DWORD txsize;
+  sl2_run_ref scratch;
+  uint8_t status = 0;
+  sl2_ring_state *state = NULL;
+  uint32_t mutation_type = 0;
+  std::vector<uint8_t> buf;
+
+  const sl2_run_ref *run = read_run(pipe, session, &scratch);
+
+  uint32_t type = 0;
+  if (!pipe_read(pipe, &type, sizeof(type), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read function type");
+  }
+
+  uint32_t mutate_count = 0;
+  if (!pipe_read(pipe, &mutate_count, sizeof(mutate_count), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read mutation count");
+  }
+
+  uint32_t ring_id = 0;
+  if (!pipe_read(pipe, &ring_id, sizeof(ring_id), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read ring ID");
+  }
+
+  uint64_t seq = 0;
+  if (!pipe_read(pipe, &seq, sizeof(seq), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read ring position");
+  }
+
+  size_t resource_size = 0;
+  wchar_t resource_path[MAX_PATH + 1] = {0};
+  read_resource_path(pipe, resource_path, &resource_size);
+
+  size_t position = 0;
+  if (!pipe_read(pipe, &position, sizeof(position), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read mutation offset");
+  }
+
+  state = find_mutation_ring(ring_id);
+
+  if (!state) {
+    SL2_SERVER_LOG_ERROR("no such ring: %u", ring_id);
+    status = 1;
+    goto cleanup;
+  }
+
+  {
+    std::lock_guard<std::mutex> ring_lock(state->mutex);
+    sl2_ring_entry &entry = state->journal[seq % SL2_RING_JOURNAL_SLOTS];
+
+    if (entry.seq == (int64_t)seq) {
+      mutation_type = entry.mut_type;
+      buf = entry.buf;
+    }
+  }
+
+  // The fuzzer took too long to register, or a restarted server handed it a reset ring.
+  if (buf.empty()) {
+    SL2_SERVER_LOG_WARN("ring %u no longer has position %llu", ring_id, seq);
+    status = 1;
+  } else {
+    const wchar_t *run_dir = run->run_dir;
+
+    size_t record_size = 0;
+    uint8_t *record =
+        serialize_fkt(type, mutation_type, resource_size, resource_path, position, SL2_FKT_FULL,
+                      buf.size(), buf.data(), 0, 0, NULL, &record_size);
+
+    if (record == NULL) {
+      SL2_SERVER_LOG_ERROR("failed to allocate FKT record (size=%lu)", buf.size());
+      status = 1;
+    } else {
+      status = store_fkt(run_dir, mutate_count, record, record_size);
+
+      if (!status) {
+        replay_cache_put(&run->run_id, mutate_count, record + sizeof(sl2_fkt_journal_entry),
+                         record_size);
+      }
+    }
+
+    free(record);
+
+    keep_run_input(inputs, mutate_count, buf.data(), buf.size());
+  }
+
+  // The fuzzer has handed its slot back, so there's room for another mutation.
+  queue_ring_fill(state);
+
+cleanup:
+
+  if (!pipe_write(pipe, &status, sizeof(status), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write server status");
+  }
+}
+
+/**
+ * Collects the current coverage score and related info for an arena.
+ * @param arena_id the ID of the arena
+ * @param cov the coverage info to fill in
+ */
+static void get_coverage_info(const wchar_t *arena_id, sl2_coverage_info *cov) {
+  strategy_state *state = find_strategy_state(arena_id, false);
+
+  if (!state) {
+    SL2_SERVER_LOG_FATAL("arena ID missing from strategy_map?");
+  }
+
+  std::shared_lock<std::shared_mutex> state_lock(state->mutex, std::defer_lock);
+  timed_lock(state_lock);
+
+  memcpy(cov->path_hash, state->path_hash, sizeof(cov->path_hash));
+  cov->bucketing = opts.bucketing;
+  cov->score = state->run_score;
+  cov->tries_remaining = state->tries_remaining;
+  cov->new_cells = state->run_new_cells;
+  cov->new_buckets = state->run_new_buckets;
+  cov->runs = state->path_runs;
+  cov->paths = state->path_counts.size();
+  cov->singletons = state->path_singletons;
+  cov->doubletons = state->path_doubletons;
+  cov->exec_us = state->run_exec_us;
+  cov->slow = state->run_slow;
+}
+
+/**
+ * Sends the client a dump of the current coverage score and related info
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_coverage_info(HANDLE pipe) {
+  DWORD txsize;
+  size_t size;
+  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+
+  if (!pipe_read(pipe, &size, sizeof(size), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+  }
+
+  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
+    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
+  }
+
+  if (!pipe_read(pipe, &arena_id, (DWORD)size, &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena ID");
+  }
+
+  SL2_SERVER_LOG_DEBUG("got arena ID: %S", arena_id);
+
+  sl2_coverage_info cov = {0};
+  get_coverage_info(arena_id, &cov);
+
+  // Zeroeth, write the coverage info scruct
+  if (!pipe_write(pipe, &cov, sizeof(sl2_coverage_info), &txsize)) {
+    // NOTE(ww): Failing to write the coverage to the fuzzer is bad,
+    // but not fatal: we've already received the fuzzer's arena, so
+    // future runs will be able sufficiently informed.
+    SL2_SERVER_LOG_WARN("Failed to write coverage information structure");
+  }
+}
+
+/**
+ * Finalizes a fuzzing run in a single round trip: merges the run's arena, sends back the
+ * resulting coverage info, and ends the client's session.
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param mapping the session's arena mapping
+ * @param inputs the session's inputs
+ * @param targets the session's mutated targets
+ * @param run_started when the session's run started (see end_run_timer)
+ * @param seeds the seeds that the session's run was handed
+ * @param pending the session's compactly stored mutations (see settle_compact_fkts)
+ */
+static void handle_finalize_run(HANDLE pipe, sl2_arena_mapping *mapping, sl2_run_inputs_t *inputs,
+                                sl2_run_targets_t *targets, uint64_t *run_started,
+                                sl2_served_seeds_t *seeds, sl2_pending_fkts_t *pending) {
+  DWORD txsize;
+  uint64_t pid = 0;
+  bool crashed = false;
+  sl2_arena arena = {0};
+
+  std::vector<uint32_t> cells;
+  sl2_arena *run_arena = read_run_arena(pipe, mapping, &arena, &cells);
+
+  if (!pipe_read(pipe, &pid, sizeof(pid), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read PID");
+  }
+
+  if (!pipe_read(pipe, &crashed, sizeof(crashed), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read crash flag");
+  }
+
+  SL2_SERVER_LOG_DEBUG("finalizing run for pid=%llu (crashed=%d)", pid, crashed);
+
+  settle_compact_fkts(pending, seeds, crashed);
+
+  merge_run_arena(run_arena, inputs, targets, end_run_timer(run_started), crashed,
+                  cells.empty() ? NULL : &cells);
+
+  sl2_coverage_info cov = {0};
+  get_coverage_info(run_arena->id, &cov);
+
+  if (!pipe_write(pipe, &cov, sizeof(sl2_coverage_info), &txsize)) {
+    SL2_SERVER_LOG_WARN("Failed to write coverage information structure");
+  }
+}
+
+/**
+ * Finalizes a fuzzing run like handle_finalize_run, but asks for the run's arena only if its path
+ * is new: the client sends its raw arena's fingerprint first, and a run that retraces a known path
+ * is counted without its arena being sent or merged (see count_known_path).
+ * @param pipe handle to the named pipe that communicates with the client
+ * @param mapping the session's arena mapping
+ * @param inputs the session's inputs
+ * @param targets the session's mutated targets
+ * @param run_started when the session's run started (see end_run_timer)
+ * @param seeds the seeds that the session's run was handed
+ * @param pending the session's compactly stored mutations (see settle_compact_fkts)
+ */
+static void handle_finalize_path(HANDLE pipe, sl2_arena_mapping *mapping, sl2_run_inputs_t *inputs,
+                                 sl2_run_targets_t *targets, uint64_t *run_started,
+                                 sl2_served_seeds_t *seeds, sl2_pending_fkts_t *pending) {
+  DWORD txsize;
+  uint64_t fingerprint = 0;
+  uint64_t pid = 0;
+  bool crashed = false;
+  uint32_t distance = SL2_DISTANCE_NONE;
+  sl2_arena arena = {0};
+
+  read_run_arena_id(pipe, &arena);
+
+  if (!pipe_read(pipe, &fingerprint, sizeof(fingerprint), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read arena fingerprint");
+  }
+
+  if (!pipe_read(pipe, &pid, sizeof(pid), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read PID");
+  }
+
+  if (!pipe_read(pipe, &crashed, sizeof(crashed), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read crash flag");
+  }
+
+  if (!pipe_read(pipe, &distance, sizeof(distance), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to read directed distance");
+  }
+
+  uint64_t exec_us = end_run_timer(run_started);
+  bool known = count_known_path(arena.id, fingerprint, inputs, targets, exec_us, crashed);
+
+  settle_compact_fkts(pending, seeds, crashed);
+
+  SL2_SERVER_LOG_DEBUG("finalizing run for pid=%llu (crashed=%d, known=%d, distance=%u)", pid,
+                       crashed, known, distance);
+
+  if (!pipe_write(pipe, &known, sizeof(known), &txsize)) {
+    SL2_SERVER_LOG_FATAL("failed to write known path flag");
+  }
+
+  const wchar_t *arena_id = arena.id;
+
+  if (!known) {
+    std::vector<uint32_t> cells;
+    sl2_arena *run_arena = read_run_arena_map(pipe, mapping, &arena, &cells);
+
+    merge_run_arena(run_arena, inputs, targets, exec_us, crashed, cells.empty() ? NULL : &cells,
+                    fingerprint, distance);
+    arena_id = run_arena->id;
+  }
+
+  sl2_coverage_info cov = {0};
+  get_coverage_info(arena_id, &cov);
+
+  if (!pipe_write(pipe, &cov, sizeof(sl2_coverage_info), &txsize)) {
+    SL2_SERVER_LOG_WARN("Failed to write coverage information structure");
+  }
+}
+
+/**
+ * Converts performance counter ticks into microseconds.
+ * @param ticks the ticks to convert
+ * @return the number of microseconds
+ */
+static uint64_t ticks_to_us(uint64_t ticks) {
+  return (ticks * 1000000) / perf_frequency.QuadPart;
+}
+
+/**
+ * Sends the client an arena's metrics time series, oldest sample first.
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_series(HANDLE pipe) {
+  DWORD txsize;
+  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+  sl2_series_header header;
+  std::vector<sl2_series_sample> samples;
+
+  read_corpus_arena_id(pipe, arena_id);
+
+  {
+    std::lock_guard<std::mutex> series_lock(series_mutex);
+    read_series(arena_id, &header, samples);
+  }
+
+  if (!pipe_write(pipe, &header, sizeof(header), &txsize) ||
+      (header.count && !pipe_write(pipe, samples.data(),
+                                   (DWORD)(samples.size() * sizeof(sl2_series_sample)), &txsize))) {
+    SL2_SERVER_LOG_WARN("failed to write the time series of %S", arena_id);
+  }
+}
+
+/**
+ * Records the cost of a single handled event.
+ * @param event the event that was handled
+ * @param ticks how long the handler took, in performance counter ticks
+ */
+static void record_event_stats(uint8_t event, uint64_t ticks) {
+  if (event >= SL2_STATS_NUM_EVENTS) {
+    return;
+  }
+
+  sl2_event_counters *counters = &(event_counters[event]);
+  uint64_t us = ticks_to_us(ticks);
+  uint32_t bucket = 0;
+
+  while (bucket < SL2_STATS_BUCKETS - 1 && (us >> bucket)) {
+    bucket++;
+  }
+
+  counters->count++;
+  counters->latency[bucket]++;
+  counters->lock_wait_us += ticks_to_us(event_lock_ticks);
+  counters->bytes += event_bytes;
+
+  uint64_t max_us = counters->max_us;
+  while (us > max_us && !counters->max_us.compare_exchange_weak(max_us, us)) {
+  }
+}
+
+/**
+ * Estimates a latency percentile from an event's histogram.
+ * @param counters the event's counters
+ * @param count the number of samples in the histogram
+ * @param percentile the percentile to estimate, out of 100
+ * @return the upper bound (in microseconds) of the bucket that the percentile falls in
+ */
+static uint64_t latency_percentile(sl2_event_counters *counters, uint64_t count,
+                                   uint64_t percentile) {
+  uint64_t rank = (count * percentile + 99) / 100;
+  uint64_t seen = 0;
+
+  for (uint32_t i = 0; i < SL2_STATS_BUCKETS; ++i) {
+    seen += counters->latency[i];
+
+    if (seen >= rank) {
+      return 1ULL << i;
+    }
+  }
+
+  return counters->max_us;
+}
+
+/**
+ * Sends the client the server's per-event statistics.
+ * @param pipe handle to the named pipe that communicates with the client
+ */
+static void handle_stats(HANDLE pipe) {
+  DWORD txsize;
+  sl2_server_stats *stats = (sl2_server_stats *)calloc(1, sizeof(sl2_server_stats));
 
-  size_t position = 0;
-  if (!ReadFile(pipe, &position, sizeof(position), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read mutation offset");
+  if (stats == NULL) {
+    SL2_SERVER_LOG_FATAL("failed to allocate server stats");
   }
 
-  size_t size = 0;
-  if (!ReadFile(pipe, &size, sizeof(size), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read size of mutation buffer");
-  }
+  stats->active_connections = active_connections;
 
-  if (size > 0) {
-    uint8_t *buf = (uint8_t *)malloc(size);
+  for (uint32_t i = 0; i < SL2_STATS_NUM_EVENTS; ++i) {
+    sl2_event_counters *counters = &(event_counters[i]);
+    sl2_event_stats *event = &(stats->events[i]);
 
-    if (buf == NULL) {
-      SL2_SERVER_LOG_ERROR("failed to allocate mutation buffer (size=%lu)", size);
-      status = 1;
-      goto cleanup;
-    }
+    event->count = counters->count;
 
-    if (!ReadFile(pipe, buf, (DWORD)size, &txsize, NULL)) {
-      SL2_SERVER_LOG_ERROR("failed to read mutation buffer from pipe (size=%lu)", size);
-      free(buf);
-      status = 1;
-      goto cleanup;
+    if (!event->count) {
+      continue;
     }
 
-    if (txsize < size) {
-      SL2_SERVER_LOG_WARN("read fewer bytes than expected (%d < %lu)", txsize, size);
-      size = txsize;
+    event->max_us = counters->max_us;
+    event->p50_us = std::min(latency_percentile(counters, event->count, 50), event->max_us);
+    event->p99_us = std::min(latency_percentile(counters, event->count, 99), event->max_us);
+    event->lock_wait_us = counters->lock_wait_us;
+    event->bytes = counters->bytes;
+  }
+
+  std::vector<strategy_state *> states;
+
+  {
+    std::shared_lock<std::shared_mutex> strategy_lock(strategy_mutex);
+
+    for (auto &entry : strategy_map) {
+      states.push_back(&(entry.second));
     }
+  }
 
-    wchar_t run_dir[MAX_PATH + 1] = {0};
-    wchar_t target_file[MAX_PATH + 1] = {0};
+  for (strategy_state *state : states) {
+    std::shared_lock<std::shared_mutex> state_lock(state->mutex);
 
-    PathCchCombine(run_dir, MAX_PATH, FUZZ_WORKING_PATH, run_id_s);
-    PathCchCombine(target_file, MAX_PATH, run_dir, mutate_fname);
+    stats->path_runs += state->path_runs;
+    stats->paths += state->path_counts.size();
+  }
 
-    status = write_fkt(target_file, type, mutation_type, resource_size, resource_path, position,
-                       size, buf);
+  if (!pipe_write(pipe, stats, sizeof(sl2_server_stats), &txsize)) {
+    SL2_SERVER_LOG_WARN("failed to write server stats");
+  }
 
-    if (opts.dump_mut_buffer) {
-      SL2_SERVER_LOG_INFO("mutation buffer dump requested");
+  free(stats);
+}
 
-      memset(target_file, 0, (MAX_PATH + 1) * sizeof(wchar_t));
-      PathCchCombine(target_file, MAX_PATH, run_dir, L"buffer.bin");
+/**
+ * Sends a whole buffer over a sync connection.
+ * @param sock the connection
+ * @param buf the buffer to send
+ * @param size the size of the buffer
+ * @return success
+ */
+static bool sync_send(SOCKET sock, const void *buf, size_t size) {
+  const char *next = (const char *)buf;
 
-      HANDLE file = CreateFile(target_file, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
-                               FILE_ATTRIBUTE_NORMAL, NULL);
+  while (size > 0) {
+    int sent = send(sock, next, (int)std::min(size, (size_t)INT_MAX), 0);
 
-      if (file != INVALID_HANDLE_VALUE) {
-        WriteFile(file, buf, size, &txsize, NULL);
-        CloseHandle(file);
-      } else {
-        SL2_SERVER_LOG_ERROR("couldn't create buffer dump file?");
-      }
+    if (sent <= 0) {
+      return false;
     }
 
-    free(buf);
-  } else {
-    SL2_SERVER_LOG_WARN("got size=%lu, skipping registration", size);
+    next += sent;
+    size -= sent;
   }
 
-cleanup:
+  return true;
+}
 
-  if (!WriteFile(pipe, &status, sizeof(status), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to write server status");
+/**
+ * Receives a whole buffer from a sync connection.
+ * @param sock the connection
+ * @param buf the buffer to receive into
+ * @param size the number of bytes to receive
+ * @return success
+ */
+static bool sync_recv(SOCKET sock, void *buf, size_t size) {
+  char *next = (char *)buf;
+
+  while (size > 0) {
+    int got = recv(sock, next, (int)std::min(size, (size_t)INT_MAX), 0);
+
+    if (got <= 0) {
+      return false;
+    }
+
+    next += got;
+    size -= got;
   }
 
-  RpcStringFree((RPC_WSTR *)&run_id_s);
+  return true;
 }
 
 /**
- * Handles requests over the named pipe from the triage client for replays of mutated bytes
- * @param pipe handle to the named pipe that communicates with the client
+ * Appends the raw bytes of a value to a sync message.
+ * @param msg the message
+ * @param thing the bytes
+ * @param size how many bytes
  */
-static void handle_replay(HANDLE pipe) {
-  DWORD txsize;
-  UUID run_id;
-  wchar_t *run_id_s;
+static void sync_append(std::vector<uint8_t> &msg, const void *thing, size_t size) {
+  const uint8_t *bytes = (const uint8_t *)thing;
+  msg.insert(msg.end(), bytes, bytes + size);
+}
 
-  if (!ReadFile(pipe, &run_id, sizeof(run_id), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read run ID");
-  }
+/**
+ * Appends a coverage map to a sync message, as an sl2_delta against an empty map (so that only
+ * the map's nonzero cells are sent).
+ * @param msg the message, whose last sl2_sync_arena receives the encoding's size
+ * @param header_offset where that sl2_sync_arena starts in the message
+ * @param map the map to append
+ * @param map_size the size of the map
+ */
+static void sync_append_map(std::vector<uint8_t> &msg, size_t header_offset, const uint8_t *map,
+                            uint32_t map_size) {
+  static const uint8_t empty[FUZZ_ARENA_MAX_SIZE] = {0};
+  size_t offset = msg.size();
 
-  if (UuidToString(&run_id, (RPC_WSTR *)&run_id_s) != RPC_S_OK) {
-    SL2_SERVER_LOG_FATAL("couldn't stringify UUID");
-  }
+  msg.resize(offset + SL2_SYNC_MAX_COVERAGE(map_size));
+  size_t size = sl2_delta_encode(empty, map_size, map, map_size, msg.data() + offset,
+                                 SL2_SYNC_MAX_COVERAGE(map_size));
+  msg.resize(offset + size);
 
-  SL2_SERVER_LOG_INFO("Replaying for run id %S", run_id_s);
+  ((sl2_sync_arena *)(msg.data() + header_offset))->coverage_size = (uint32_t)size;
+}
 
-  uint32_t mutate_count = 0;
-  wchar_t mutate_fname[MAX_PATH + 1] = {0};
-  if (!ReadFile(pipe, &mutate_count, sizeof(mutate_count), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read mutate count");
-  }
+/**
+ * Appends a corpus entry to a sync message.
+ * @param msg the message
+ * @param entry the entry
+ */
+static void sync_append_input(std::vector<uint8_t> &msg, const sl2_corpus_entry &entry) {
+  sl2_sync_input input = {entry.mut_count, (uint32_t)entry.buf.size()};
 
-  StringCchPrintfW(mutate_fname, MAX_PATH, FUZZ_RUN_FKT_FMT, mutate_count);
+  sync_append(msg, &input, sizeof(input));
+  sync_append(msg, entry.buf.data(), entry.buf.size());
+}
 
-  size_t size = 0;
-  if (!ReadFile(pipe, &size, sizeof(size), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read size of replay buffer");
+/**
+ * Receives an arena's coverage and corpus entries from a sync connection.
+ * @param sock the connection
+ * @param header the arena's sl2_sync_arena, already received
+ * @param map receives the arena's coverage map, which is header.map_size bytes
+ * @param inputs receives the arena's corpus entries
+ * @return success
+ */
+static bool sync_recv_arena(SOCKET sock, const sl2_sync_arena &header, std::vector<uint8_t> &map,
+                            std::vector<sl2_corpus_entry> &inputs) {
+  if (!SL2_ARENA_SIZE_VALID(header.map_size) ||
+      header.coverage_size > SL2_SYNC_MAX_COVERAGE(header.map_size) ||
+      header.corpus_count > SL2_CORPUS_SIZE) {
+    SL2_SERVER_LOG_ERROR("bad sync arena (map_size=%u, coverage_size=%u, corpus_count=%u)",
+                         header.map_size, header.coverage_size, header.corpus_count);
+    return false;
   }
 
-  uint8_t *buf = (uint8_t *)malloc(size);
+  std::vector<uint8_t> coverage(header.coverage_size);
+  map.assign(header.map_size, 0);
 
-  if (buf == NULL) {
-    SL2_SERVER_LOG_FATAL("failed to allocate replay buffer");
+  if (!sync_recv(sock, coverage.data(), coverage.size()) ||
+      !sl2_delta_apply(coverage.data(), coverage.size(), map.data(), map.size())) {
+    SL2_SERVER_LOG_ERROR("failed to read a sync arena's coverage");
+    return false;
   }
 
-  wchar_t target_file[MAX_PATH + 1];
-  wchar_t run_dir[MAX_PATH + 1];
-  PathCchCombine(run_dir, MAX_PATH, FUZZ_WORKING_PATH, run_id_s);
-  PathCchCombine(target_file, MAX_PATH, run_dir, mutate_fname);
+  for (uint32_t i = 0; i < header.corpus_count; i++) {
+    sl2_sync_input input;
 
-  DWORD attrs = GetFileAttributes(target_file);
+    if (!sync_recv(sock, &input, sizeof(input)) || input.size > SL2_CORPUS_MAX_BUFSIZE) {
+      SL2_SERVER_LOG_ERROR("bad sync corpus entry");
+      return false;
+    }
 
-  if (attrs == INVALID_FILE_ATTRIBUTES || (attrs & FILE_ATTRIBUTE_DIRECTORY)) {
-    SL2_SERVER_LOG_FATAL("missing FKT or is a directory: %S", target_file);
-  }
+    sl2_corpus_entry entry = {input.mut_count, std::vector<uint8_t>(input.size)};
 
-  get_bytes_fkt(target_file, buf, size);
+    if (!sync_recv(sock, entry.buf.data(), entry.buf.size())) {
+      SL2_SERVER_LOG_ERROR("failed to read a sync corpus entry");
+      return false;
+    }
 
-  if (!WriteFile(pipe, buf, (DWORD)size, &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to write replay buffer");
+    inputs.push_back(std::move(entry));
   }
 
-  RpcStringFree((RPC_WSTR *)&run_id_s);
+  return true;
 }
 
 /**
- * Sends the requested arena to the client
- * @param pipe handle to the named pipe that communicates with the client
+ * Marks an arena as changed, so that it's written back to the disk.
+ * @param state the arena's strategy state, locked exclusively
  */
-static void handle_get_arena(HANDLE pipe) {
-  DWORD txsize;
-  size_t size = 0;
-  sl2_arena arena = {0};
+static void mark_arena_dirty(strategy_state &state) {
+  if (opts.checkpoint_interval) {
+    state.dirty = true;
+  } else {
+    dump_strategy_state(state);
+  }
+}
 
-  if (!ReadFile(pipe, &size, sizeof(size), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+/**
+ * Checks that a node sent a well-formed arena ID, since it becomes part of a path.
+ * @param id the arena ID
+ * @return whether the ID is a hex string of the right length
+ */
+static bool sync_valid_arena_id(const wchar_t *id) {
+  for (size_t i = 0; i < SL2_HASH_LEN; i++) {
+    if (!iswxdigit(id[i])) {
+      return false;
+    }
   }
 
-  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
-    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
+  return id[SL2_HASH_LEN] == L'\0';
+}
+
+/**
+ * Merges one node's sync request into the coordinator's arenas, and sends back the merged state
+ * of each arena that the node sent.
+ * @param sock the node's connection
+ * @return success (the connection is closed on failure)
+ */
+static bool coordinator_handle_sync(SOCKET sock) {
+  sl2_sync_header request;
+
+  if (!sync_recv(sock, &request, sizeof(request))) {
+    return false;
   }
 
-  if (!ReadFile(pipe, arena.id, (DWORD)size, &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read arena ID");
+  if (request.magic != SL2_SYNC_MAGIC || request.version != SL2_SYNC_VERSION ||
+      request.arenas > SL2_SYNC_MAX_ARENAS) {
+    SL2_SERVER_LOG_ERROR("bad sync request (magic=%x, version=%u, arenas=%u)", request.magic,
+                         request.version, request.arenas);
+    return false;
   }
 
-  SL2_SERVER_LOG_INFO("got arena ID: %S", arena.id);
+  sl2_sync_header reply = {SL2_SYNC_MAGIC, SL2_SYNC_VERSION, 0, request.arenas};
+  std::vector<uint8_t> msg;
+  sync_append(msg, &reply, sizeof(reply));
 
-  // If we already have the arena in our strategy map, then we don't
-  // need to load it from disk again.
-  // Otherwise, we attempt to load the arena from disk, creating it if we don't
-  // have one, and then add it to our strategy map.
-  std::unique_lock<std::shared_mutex> strategy_lock(strategy_mutex);
-  sl2_strategy_map_t::iterator it = strategy_map.find(arena.id);
+  sl2_arena update = {0};
+  std::vector<uint8_t> update_map;
+  bool ok = true;
 
-  if (it != strategy_map.end()) {
-    memcpy_s(arena.map, FUZZ_ARENA_SIZE, it->second.arena.map, FUZZ_ARENA_SIZE);
-  } else {
-    wchar_t arena_path[MAX_PATH + 1] = {0};
+  for (uint32_t i = 0; ok && i < request.arenas; i++) {
+    sl2_sync_arena header;
+    std::vector<sl2_corpus_entry> inputs;
+
+    if (!sync_recv(sock, &header, sizeof(header)) ||
+        !sync_recv_arena(sock, header, update_map, inputs)) {
+      ok = false;
+      break;
+    }
 
-    PathCchCombine(arena_path, MAX_PATH, FUZZ_ARENAS_PATH, arena.id);
+    header.id[SL2_HASH_LEN] = L'\0';
 
-    DWORD attrs = GetFileAttributes(arena_path);
+    if (!sync_valid_arena_id(header.id)) {
+      SL2_SERVER_LOG_ERROR("bad sync arena ID");
+      ok = false;
+      break;
+    }
 
-    if (attrs == INVALID_FILE_ATTRIBUTES) {
-      SL2_SERVER_LOG_INFO("no arena found, creating one");
-      dump_arena_to_disk(arena_path, &arena);
+    uint32_t map_size = load_strategy_state(header.id, header.map_size);
+    strategy_state *state = find_strategy_state(header.id, false);
+    std::unique_lock<std::shared_mutex> state_lock(state->mutex);
+
+    // The node sends what its map gained since its last sync, which we add to ours.
+    // Maps of different sizes index their cells differently, so they can't be merged: the
+    // node still gets our map (and everything else) back.
+    if (map_size == header.map_size) {
+      update.size = header.map_size;
+      update.map = update_map.data();
+      state->score = arena_merge_score(state->arena.get(), &update);
+      absorb_virgin(*state);
     } else {
-      SL2_SERVER_LOG_INFO("arena found, loading from disk");
+      SL2_SERVER_LOG_WARN("node's map size doesn't match the arena's (%u != %u), not merging it",
+                          header.map_size, map_size);
+    }
 
-      if (!load_arena_from_disk(arena_path, &arena)) {
-        SL2_SERVER_LOG_ERROR("load_arena_from_disk failed, resetting the arena");
-        dump_arena_to_disk(arena_path, &arena);
+    for (int s = 0; s < SL2_NUM_STRATEGIES; s++) {
+      state->pulls[s] += header.pulls[s];
+      state->rewards[s] += header.rewards[s];
+    }
+
+    for (sl2_corpus_entry &input : inputs) {
+      add_corpus_entry(*state, input.mut_count, std::move(input.buf), request.node_id);
+    }
+
+    if (header.coverage_size > sizeof(sl2_delta)) {
+      mark_arena_dirty(*state);
+    }
+
+    // Send the merged state back, along with the corpus entries that the node hasn't seen.
+    size_t offset = msg.size();
+    sl2_sync_arena merged = {0};
+    wcscpy_s(merged.id, header.id);
+    memcpy(merged.pulls, state->pulls, sizeof(merged.pulls));
+    memcpy(merged.rewards, state->rewards, sizeof(merged.rewards));
+    merged.corpus_seq = state->corpus_seq;
+    merged.map_size = state->arena->size;
+
+    for (const sl2_corpus_entry &entry : state->corpus) {
+      if (entry.seq > header.corpus_seq && entry.origin != request.node_id) {
+        merged.corpus_count++;
       }
     }
 
-    uint32_t score = coverage_score(&arena);
+    sync_append(msg, &merged, sizeof(merged));
+    sync_append_map(msg, offset, state->arena->map, state->arena->size);
 
-    SL2_SERVER_LOG_INFO("score=%d", score);
+    for (const sl2_corpus_entry &entry : state->corpus) {
+      if (entry.seq > header.corpus_seq && entry.origin != request.node_id) {
+        sync_append_input(msg, entry);
+      }
+    }
+  }
 
-    // NOTE(ww): Start at strategy #0, because why not.
-    // In the future, we should grab the last strategy tried
-    // from the FKT and start with that.
-    strategy_map[arena.id] = {arena, score, 0, opts.stickiness};
+  if (!ok) {
+    return false;
   }
+
+  SL2_SERVER_LOG_INFO("merged %u arenas from node %llx", request.arenas,
+                      (unsigned long long)request.node_id);
+
+  return sync_send(sock, msg.data(), msg.size());
 }
 
 /**
- * Merges the arena sent by the client with the one previously stored for incremental coverage
- * measurements
- * @param pipe handle to the named pipe that communicates with the client
+ * Serves one node's connection to the coordinator, until the node hangs up.
+ * @param data the node's connection (a SOCKET)
+ * @return error code (0)
  */
-static void handle_set_arena(HANDLE pipe) {
-  DWORD txsize;
-  size_t size = 0;
-  sl2_arena arena = {0};
+static DWORD WINAPI coordinator_session(void *data) {
+  SOCKET sock = (SOCKET)data;
 
-  if (!ReadFile(pipe, &size, sizeof(size), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+  while (coordinator_handle_sync(sock)) {
   }
 
-  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
-    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
-  }
+  closesocket(sock);
+  return 0;
+}
 
-  if (!ReadFile(pipe, arena.id, (DWORD)size, &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read arena ID");
+/**
+ * Accepts connections from nodes, for as long as the server runs.
+ * @param data unused
+ * @return error code (0)
+ */
+static DWORD WINAPI coordinator_thread(void *data) {
+  SOCKET listener = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+  DWORD v6only = 0;
+  sockaddr_in6 addr = {0};
+
+  addr.sin6_family = AF_INET6;
+  addr.sin6_port = htons(opts.coordinator_port);
+  addr.sin6_addr = in6addr_any;
+
+  // A dual-stack socket takes IPv4 nodes too.
+  if (listener == INVALID_SOCKET ||
+      setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&v6only, sizeof(v6only)) ||
+      bind(listener, (sockaddr *)&addr, sizeof(addr)) || listen(listener, SOMAXCONN)) {
+    SL2_SERVER_LOG_FATAL("couldn't listen for nodes on port %u (WSAGLE=%d)",
+                         opts.coordinator_port, WSAGetLastError());
   }
 
-  SL2_SERVER_LOG_INFO("got arena ID: %S", arena.id);
+  SL2_SERVER_LOG_INFO("coordinating nodes on port %u", opts.coordinator_port);
 
-  wchar_t arena_path[MAX_PATH + 1] = {0};
+  while (1) {
+    SOCKET sock = accept(listener, NULL, NULL);
+
+    if (sock == INVALID_SOCKET) {
+      SL2_SERVER_LOG_ERROR("accept failed (WSAGLE=%d)", WSAGetLastError());
+      continue;
+    }
 
-  PathCchCombine(arena_path, MAX_PATH, FUZZ_ARENAS_PATH, arena.id);
+    DWORD timeout = SL2_SYNC_TIMEOUT * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
 
-  if (!ReadFile(pipe, arena.map, FUZZ_ARENA_SIZE, &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read arena");
-  }
+    HANDLE thread = CreateThread(NULL, 0, coordinator_session, (void *)sock, 0, NULL);
 
-  std::unique_lock<std::shared_mutex> strategy_lock(strategy_mutex);
-  sl2_strategy_map_t::iterator it = strategy_map.find(arena.id);
+    if (thread == NULL) {
+      SL2_SERVER_LOG_ERROR("couldn't start a coordinator session");
+      closesocket(sock);
+      continue;
+    }
 
-  // This should never happen, as the fuzzer always requests an arena before sending one back.
-  if (it == strategy_map.end()) {
-    SL2_SERVER_LOG_FATAL(
-        "no prior arena to compare against! fuzzer didn't request an initial arena?");
+    CloseHandle(thread);
   }
 
-  strategy_state prior = it->second;
+  return 0;
+}
+
+/*! What a node has sent for an arena, for applying the coordinator's reply against */
+struct sl2_sync_sent {
+  strategy_state *state;
+  /*! The arena's map as it was sent */
+  std::vector<uint8_t> map;
+  uint64_t pulls[SL2_NUM_STRATEGIES];
+  uint64_t rewards[SL2_NUM_STRATEGIES];
+  /*! The arena's corpus_seq when it was sent */
+  uint64_t corpus_seq;
+};
+
+/**
+ * Pushes what this node's arenas have gained since its last sync to the coordinator, and merges
+ * the coordinator's state back in.
+ * Each arena's map (and bandit statistics) become the coordinator's, plus whatever the node's
+ * fuzzers added while the sync was in flight.
+ * What a node's maps were when it last synced isn't kept on the disk (only its bandit
+ * statistics and corpus positions are), so a restarted node pushes its whole arenas again. That
+ * only inflates the arenas' hit counts, never their coverage.
+ * @param sock the connection to the coordinator
+ * @return success
+ */
+static bool node_sync(SOCKET sock) {
+  std::vector<strategy_state *> states;
 
-  // Record a raw copy of the coverage map for path identification
-  wchar_t wcs[SL2_HASH_LEN + 3];
-  wcscpy_s(wcs, L"R_");
-  wcscat_s(wcs, arena.id);
-  strategy_map[wcs] = {arena, coverage_score(&arena), prior.strategy, opts.stickiness,
-                       prior.success_map};
+  {
+    std::shared_lock<std::shared_mutex> strategy_lock(strategy_mutex);
 
-  // Merge the existing coverage map with the one returned from the fuzzer
-  for (int i = 0; i < FUZZ_ARENA_SIZE; i++) {
-    arena.map[i] += strategy_map[arena.id].arena.map[i];
+    for (auto &entry : strategy_map) {
+      if (entry.second.loaded && states.size() < SL2_SYNC_MAX_ARENAS) {
+        states.push_back(&(entry.second));
+      }
+    }
   }
 
-  uint32_t score = coverage_score(&arena);
+  if (states.empty()) {
+    return true;
+  }
 
-  SL2_SERVER_LOG_INFO("score=%d, prior.score=%d", score, prior.score);
+  sl2_sync_header request = {SL2_SYNC_MAGIC, SL2_SYNC_VERSION, node_id, 0};
+  std::vector<uint8_t> msg;
+  std::vector<sl2_sync_sent> sent;
+  std::vector<uint8_t> gained;
 
-  // If coverage has increased, continue with the current strategy
-  // and reset the number of remaining tries.
-  //
-  // Otherwise, try a new strategy.
-  if (score > prior.score) {
-    SL2_SERVER_LOG_INFO("coverage score increased, continuing with strategy=%d", prior.strategy);
+  sync_append(msg, &request, sizeof(request));
 
-    prior.success_map[prior.strategy]++;
-    strategy_map[arena.id] = {arena, score, prior.strategy, opts.stickiness, prior.success_map};
-  } else {
-    SL2_SERVER_LOG_INFO("coverage score did NOT increase!");
+  for (size_t i = 0; i < states.size(); i++) {
+    strategy_state &state = *states[i];
+    std::unique_lock<std::shared_mutex> state_lock(state.mutex);
 
-    // If we've run out of tries for this strategy, move to a new one
-    // (and reset the number of tries).
-    //
-    // Otherwise, try again, and decrement the number of tries remaining.
-    if (prior.tries_remaining <= 0) {
-      uint32_t strategy;
+    // Evicted arenas push their whole map once they're restored (see evict_arena).
+    if (!state.arena) {
+      continue;
+    }
 
-      // Ignore the success map about 20% of the time, to make sure that
-      // we're not digging ourselves into a hole.
-      //
-      // Otherwise, grab the best strategy from the strategy map.
-      if (!(rand() % 5)) {
-        strategy = (prior.strategy + 1) % SL2_NUM_STRATEGIES;
-      } else {
-        bool found_success = false;
-        strategy = 0;
+    sent.emplace_back();
+    sl2_sync_sent &out = sent.back();
+    size_t offset = msg.size();
+    sl2_sync_arena header = {0};
+    wcscpy_s(header.id, state.arena->id);
+    header.corpus_seq = state.synced_corpus_seq;
+    header.map_size = state.arena->size;
 
-        for (int i = 1; i < SL2_NUM_STRATEGIES; ++i) {
-          if (prior.success_map[strategy] < prior.success_map[i] && prior.strategy != i) {
-            strategy = i;
-            found_success = true;
-          }
-        }
+    out.state = &state;
+    out.map.assign(state.arena->map, state.arena->map + state.arena->size);
 
-        // Fallback: We've seen no successful strategies (other than the current one),
-        // so just move on.
-        if (!found_success) {
-          strategy = (prior.strategy + 1) % SL2_NUM_STRATEGIES;
-        }
-      }
+    if (state.synced_map.size() != state.arena->size) {
+      state.synced_map.assign(state.arena->size, 0);
+    }
 
-      SL2_SERVER_LOG_INFO("no tries left, changing strategy (%d)!", strategy);
+    gained.resize(state.arena->size);
 
-      prior.success_map[prior.strategy]--;
-      strategy_map[arena.id] = {arena, score, strategy, opts.stickiness, prior.success_map};
-    } else {
-      SL2_SERVER_LOG_INFO("%d tries for strategy %d left", prior.tries_remaining - 1,
-                          prior.strategy);
+    for (size_t cell = 0; cell < state.arena->size; cell++) {
+      uint8_t was = state.synced_map[cell];
+      gained[cell] = state.arena->map[cell] > was ? state.arena->map[cell] - was : 0;
+    }
 
-      strategy_map[arena.id] = {arena, score, prior.strategy, prior.tries_remaining - 1,
-                                prior.success_map};
+    for (int s = 0; s < SL2_NUM_STRATEGIES; s++) {
+      out.pulls[s] = state.pulls[s];
+      out.rewards[s] = state.rewards[s];
+      header.pulls[s] = state.pulls[s] - state.synced_pulls[s];
+      header.rewards[s] = state.rewards[s] - state.synced_rewards[s];
     }
-  }
 
-  // TODO(ww): We should try to avoid/minimize dumping the arena to disk.
-  dump_arena_to_disk(arena_path, &arena);
-}
+    // Only the node's own corpus entries are pushed, never the ones it pulled.
+    for (const sl2_corpus_entry &entry : state.corpus) {
+      if (entry.seq > state.pushed_corpus_seq && entry.origin == 0) {
+        header.corpus_count++;
+      }
+    }
 
-/**
- * Renders full paths for writing dump files to the client
- * @param pipe handle to the named pipe that communicates with the client
- */
-static void handle_crash_paths(HANDLE pipe) {
-  DWORD txsize;
-  UUID run_id;
-  wchar_t *run_id_s;
-  uint64_t pid;
+    sync_append(msg, &header, sizeof(header));
+    sync_append_map(msg, offset, gained.data(), (uint32_t)gained.size());
 
-  if (!ReadFile(pipe, &run_id, sizeof(run_id), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read UUID");
-  }
+    for (const sl2_corpus_entry &entry : state.corpus) {
+      if (entry.seq > state.pushed_corpus_seq && entry.origin == 0) {
+        sync_append_input(msg, entry);
+      }
+    }
 
-  if (UuidToString(&run_id, (RPC_WSTR *)&run_id_s) != RPC_S_OK) {
-    SL2_SERVER_LOG_FATAL("couldn't stringify UUID");
+    out.corpus_seq = state.corpus_seq;
   }
 
-  if (!ReadFile(pipe, &pid, sizeof(pid), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read PID");
+  if (sent.empty()) {
+    return true;
   }
 
-  wchar_t run_dir[MAX_PATH + 1] = {0};
-  wchar_t target_file[MAX_PATH + 1] = {0};
-  wchar_t target_path[MAX_PATH + 1] = {0};
-
-  PathCchCombine(run_dir, MAX_PATH, FUZZ_WORKING_PATH, run_id_s);
-  StringCchPrintfW(target_file, MAX_PATH, FUZZ_RUN_CRASH_JSON_FMT, pid);
-  PathCchCombine(target_path, MAX_PATH, run_dir, target_file);
-
-  size_t size = wcsnlen_s(target_path, MAX_PATH + 1) * sizeof(wchar_t);
+  request.arenas = (uint32_t)sent.size();
+  memcpy(msg.data(), &request, sizeof(request));
 
-  if (!WriteFile(pipe, &size, sizeof(size), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to write length of crash.json to pipe");
-  }
+  sl2_sync_header reply;
 
-  if (!WriteFile(pipe, &target_path, (DWORD)size, &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to write crash.json path to pipe");
+  if (!sync_send(sock, msg.data(), msg.size()) || !sync_recv(sock, &reply, sizeof(reply)) ||
+      reply.magic != SL2_SYNC_MAGIC || reply.version != SL2_SYNC_VERSION ||
+      reply.arenas != sent.size()) {
+    SL2_SERVER_LOG_ERROR("sync with the coordinator failed");
+    return false;
   }
 
-  SL2_SERVER_LOG_INFO("wrote crash.json path: %S", target_path);
-
-  memset(target_file, 0, (MAX_PATH + 1) * sizeof(wchar_t));
-  memset(target_path, 0, (MAX_PATH + 1) * sizeof(wchar_t));
-  StringCchPrintfW(target_file, MAX_PATH, FUZZ_RUN_MEM_DMP_FMT, pid);
-  PathCchCombine(target_path, MAX_PATH, run_dir, target_file);
+  std::vector<uint8_t> merged;
 
-  size = wcsnlen_s(target_path, MAX_PATH + 1) * sizeof(wchar_t);
+  for (size_t i = 0; i < sent.size(); i++) {
+    sl2_sync_arena header;
+    std::vector<sl2_corpus_entry> inputs;
 
-  if (!WriteFile(pipe, &size, sizeof(size), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to write length of mem.dmp path to pipe");
-  }
+    if (!sync_recv(sock, &header, sizeof(header)) ||
+        !sync_recv_arena(sock, header, merged, inputs)) {
+      return false;
+    }
 
-  if (!WriteFile(pipe, &target_path, (DWORD)size, &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to write mem.dmp path to pipe");
-  }
+    strategy_state &state = *sent[i].state;
+    std::unique_lock<std::shared_mutex> state_lock(state.mutex);
 
-  SL2_SERVER_LOG_INFO("wrote mem.dmp path: %S", target_path);
+    // Arenas evicted during the sync drop the reply, and push their whole map again
+    // once they're restored.
+    if (!state.arena) {
+      continue;
+    }
 
-  memset(target_file, 0, (MAX_PATH + 1) * sizeof(wchar_t));
-  memset(target_path, 0, (MAX_PATH + 1) * sizeof(wchar_t));
-  StringCchPrintfW(target_file, MAX_PATH, FUZZ_RUN_INITIAL_DMP_FMT, pid);
-  PathCchCombine(target_path, MAX_PATH, run_dir, target_file);
+    // The coordinator doesn't merge maps of different sizes, either (see
+    // coordinator_handle_sync).
+    if (header.map_size == state.arena->size) {
+      for (size_t cell = 0; cell < state.arena->size; cell++) {
+        uint8_t since = state.arena->map[cell] > sent[i].map[cell]
+                            ? state.arena->map[cell] - sent[i].map[cell]
+                            : 0;
+        state.arena->map[cell] = (uint8_t)std::min(255, merged[cell] + since);
+      }
 
-  size = wcsnlen_s(target_path, MAX_PATH + 1) * sizeof(wchar_t);
+      state.synced_map = merged;
+      state.score = coverage_score(state.arena.get());
+      absorb_virgin(state);
+    } else {
+      SL2_SERVER_LOG_WARN("coordinator's map size doesn't match the arena's (%u != %u)",
+                          header.map_size, state.arena->size);
+    }
 
-  if (!WriteFile(pipe, &size, sizeof(size), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to write length of initial.dmp path to pipe");
-  }
+    for (int s = 0; s < SL2_NUM_STRATEGIES; s++) {
+      state.pulls[s] = header.pulls[s] + (state.pulls[s] - sent[i].pulls[s]);
+      state.rewards[s] = header.rewards[s] + (state.rewards[s] - sent[i].rewards[s]);
+      state.synced_pulls[s] = header.pulls[s];
+      state.synced_rewards[s] = header.rewards[s];
+    }
 
-  if (!WriteFile(pipe, &target_path, (DWORD)size, &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to write initial.dmp path to pipe");
+    for (sl2_corpus_entry &input : inputs) {
+      add_corpus_entry(state, input.mut_count, std::move(input.buf), SL2_SYNC_COORDINATOR);
+    }
+
+    state.synced_corpus_seq = header.corpus_seq;
+    state.pushed_corpus_seq = sent[i].corpus_seq;
+    mark_arena_dirty(state);
   }
 
-  SL2_SERVER_LOG_INFO("wrote initial.dmp path: %S", target_path);
+  SL2_SERVER_LOG_INFO("synced %llu arenas with the coordinator", (unsigned long long)sent.size());
 
-  RpcStringFree((RPC_WSTR *)&run_id_s);
+  return true;
 }
 
 /**
- * Confirms that the server is still alive
- * @param pipe handle to the named pipe that communicates with the client
+ * Connects to the coordinator.
+ * @return the connection, or INVALID_SOCKET
  */
-static void handle_ping(HANDLE pipe) {
-  DWORD txsize;
-  uint8_t ok = 1;
+static SOCKET node_connect() {
+  SOCKET sock = INVALID_SOCKET;
+  addrinfo hints = {0};
+  addrinfo *addrs = NULL;
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+
+  if (getaddrinfo(opts.coordinator_host, opts.coordinator_service, &hints, &addrs)) {
+    SL2_SERVER_LOG_ERROR("couldn't resolve the coordinator (%s:%s)", opts.coordinator_host,
+                         opts.coordinator_service);
+    return INVALID_SOCKET;
+  }
 
-  SL2_SERVER_LOG_INFO("ponging the client");
+  for (addrinfo *addr = addrs; addr && sock == INVALID_SOCKET; addr = addr->ai_next) {
+    sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
 
-  if (!WriteFile(pipe, &ok, sizeof(ok), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to write pong status to pipe");
+    if (sock != INVALID_SOCKET && connect(sock, addr->ai_addr, (int)addr->ai_addrlen)) {
+      closesocket(sock);
+      sock = INVALID_SOCKET;
+    }
+  }
+
+  freeaddrinfo(addrs);
+
+  if (sock != INVALID_SOCKET) {
+    DWORD timeout = SL2_SYNC_TIMEOUT * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
   }
+
+  return sock;
 }
 
 /**
- * Handles PID registration for child processes (so we can kill them if they time out)
- * @param pipe handle to the named pipe that communicates with the client
+ * Periodically syncs this node's arenas with the coordinator, over a fresh connection each time.
+ * A coordinator that's down (or unreachable) is just tried again at the next sync.
+ * @param data unused
+ * @return error code (0)
  */
-static void handle_register_pid(HANDLE pipe) {
-  DWORD txsize;
-  UUID run_id;
-  wchar_t *run_id_s;
-  bool tracing;
-  uint64_t pid;
-
-  SL2_SERVER_LOG_INFO("received pid registration request");
+static DWORD WINAPI node_thread(void *data) {
+  while (1) {
+    Sleep(opts.sync_interval * 1000);
 
-  if (!ReadFile(pipe, &run_id, sizeof(run_id), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read UUID");
-  }
+    SOCKET sock = node_connect();
 
-  if (!ReadFile(pipe, &tracing, sizeof(tracing), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read tracing/fuzzing flag");
-  }
+    if (sock == INVALID_SOCKET) {
+      SL2_SERVER_LOG_ERROR("couldn't connect to the coordinator (%s:%s), retrying later",
+                           opts.coordinator_host, opts.coordinator_service);
+      continue;
+    }
 
-  if (!ReadFile(pipe, &pid, sizeof(pid), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read pid");
+    node_sync(sock);
+    closesocket(sock);
   }
 
-  SL2_SERVER_LOG_INFO("got pid=%lu", pid);
+  return 0;
+}
 
-  if (UuidToString(&run_id, (RPC_WSTR *)&run_id_s) != RPC_S_OK) {
-    SL2_SERVER_LOG_FATAL("couldn't stringify UUID");
+/**
+ * Reads the rest of a framed request: the rest of its header, and its payload (across every one
+ * of its frames) into the session's frame buffer, which pipe_read then reads from.
+ * @param ctx the session's pipe context, whose event is the request's first byte (SL2_FRAME_MAGIC)
+ * @return success; on success, the session's event is the request's event
+ */
+static bool read_frame(sl2_pipe_ctx *ctx) {
+  DWORD txsize;
+  sl2_frame_header header;
+  size_t payload = 0;
+  size_t prefetched = 0;
+
+  // On byte pipes, only the first byte of the first header (the magic) was read, as the
+  // event. On message pipes, as much of the first frame as fit in the frame buffer was.
+  if (opts.message_pipes && ctx->received >= sizeof(header)) {
+    memcpy(&header, ctx->frame.data(), sizeof(header));
+    prefetched = ctx->received - sizeof(header);
+    memmove(ctx->frame.data(), ctx->frame.data() + sizeof(header), prefetched);
+  } else {
+    size_t have = opts.message_pipes ? ctx->received : sizeof(header.magic);
+    memcpy(&header, opts.message_pipes ? ctx->frame.data() : &ctx->event, have);
+
+    if (!pipe_read_raw(ctx->pipe, (uint8_t *)&header + have, (DWORD)(sizeof(header) - have),
+                       &txsize) ||
+        txsize != sizeof(header) - have) {
+      SL2_SERVER_LOG_ERROR("failed to read frame header");
+      return false;
+    }
   }
 
-  wchar_t run_dir[MAX_PATH + 1] = {0};
-  wchar_t pids_file[MAX_PATH + 1] = {0};
-  wchar_t pid_s[64] = {0};
-
-  _ui64tow_s(pid, pid_s, sizeof(pid_s) - 1, 10);
-  pid_s[wcsnlen_s(pid_s, sizeof(pid_s))] = '\n';
+  while (true) {
+    if (header.magic != SL2_FRAME_MAGIC || header.version != SL2_FRAME_VERSION) {
+      SL2_SERVER_LOG_ERROR("bad frame (magic=%d, version=%d)", header.magic, header.version);
+      return false;
+    }
 
-  PathCchCombine(run_dir, MAX_PATH, FUZZ_WORKING_PATH, run_id_s);
-  PathCchCombine(pids_file, MAX_PATH, run_dir,
-                 tracing ? FUZZ_RUN_TRACER_PIDS : FUZZ_RUN_FUZZER_PIDS);
+    if (payload + header.length > SL2_FRAME_MAX_PAYLOAD || prefetched > header.length) {
+      SL2_SERVER_LOG_ERROR("bad frame length (size=%llu)",
+                           (unsigned long long)(payload + header.length));
+      return false;
+    }
 
-  RpcStringFree((RPC_WSTR *)&run_id_s);
+    // The buffer never shrinks, so that message pipes can keep reading into all of it.
+    if (ctx->frame.size() < payload + header.length) {
+      ctx->frame.resize(payload + header.length);
+    }
 
-  std::unique_lock<std::shared_mutex> pid_lock(pid_mutex);
+    for (DWORD got = (DWORD)prefetched; got < header.length; got += txsize) {
+      if (!pipe_read_raw(ctx->pipe, ctx->frame.data() + payload + got, header.length - got,
+                         &txsize) ||
+          txsize == 0) {
+        SL2_SERVER_LOG_ERROR("failed to read frame payload (size=%u)", header.length);
+        return false;
+      }
+    }
 
-  HANDLE file =
-      CreateFile(pids_file, FILE_APPEND_DATA, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    payload += header.length;
+    prefetched = 0;
 
-  if (file != INVALID_HANDLE_VALUE) {
-    if (!WriteFile(file, pid_s, (DWORD)wcsnlen_s(pid_s, sizeof(pid_s)) * sizeof(wchar_t), &txsize,
-                   NULL)) {
-      SL2_SERVER_LOG_ERROR("failed to write pid (pid=%lu, pids_file=%S)", pid, pids_file);
+    if (!(header.flags & SL2_FRAME_MORE)) {
+      break;
     }
 
-    if (!CloseHandle(file)) {
-      SL2_SERVER_LOG_ERROR("failed to close pids_file=%S", pids_file);
+    // Continued frames are read whole.
+    if (!pipe_read_raw(ctx->pipe, &header, sizeof(header), &txsize) || txsize != sizeof(header)) {
+      SL2_SERVER_LOG_ERROR("failed to read frame header");
+      return false;
     }
-  } else {
-    SL2_SERVER_LOG_ERROR("failed to open pids_file=%S, not recording pid!", pids_file);
   }
+
+  ctx->event = header.event;
+  frame_next = ctx->frame.data();
+  frame_left = payload;
+  frame_no_reply = (header.flags & SL2_FRAME_NO_REPLY) != 0;
+
+  return true;
 }
 
+/*! Handles an event for a session */
+typedef void (*sl2_event_handler)(sl2_pipe_ctx *ctx);
+
+/*! Every event's handler, indexed by event. Events without one are rejected. */
+static sl2_event_handler event_handlers[256];
+
 /**
- * Suggests a mutation to the fuzzer based on coverage info
- * @param pipe handle to the named pipe that communicates with the client
+ * Handles events that the server no longer supports.
+ * Any client that requests them and expects anything back is almost certain to
+ * misbehave.
+ * @param ctx the session's pipe context
  */
-static void handle_advise_mutation(HANDLE pipe) {
-  DWORD txsize;
-  size_t size;
-  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
-  uint32_t table_idx = 0;
+static void handle_deprecated(sl2_pipe_ctx *ctx) {
+  SL2_SERVER_LOG_ERROR("deprecated event requested.");
+  ctx->event = EVT_INVALID;
+}
 
-  if (!ReadFile(pipe, &size, sizeof(size), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+/**
+ * Fills in event_handlers.
+ */
+static void init_event_handlers() {
+  event_handlers[EVT_REGISTER_MUTATION] = [](sl2_pipe_ctx *ctx) {
+    handle_register_mutation(ctx->pipe, &ctx->session, &ctx->inputs, &ctx->targets,
+                             &ctx->upload, &ctx->seeds, &ctx->pending);
+  };
+  event_handlers[EVT_CRASH_PATHS] = [](sl2_pipe_ctx *ctx) {
+    handle_crash_paths(ctx->pipe, &ctx->session);
+  };
+  event_handlers[EVT_REPLAY] = [](sl2_pipe_ctx *ctx) { handle_replay(ctx->pipe, &ctx->session); };
+  event_handlers[EVT_GET_ARENA] = [](sl2_pipe_ctx *ctx) { handle_get_arena(ctx->pipe); };
+  event_handlers[EVT_SET_ARENA] = [](sl2_pipe_ctx *ctx) {
+    handle_set_arena(ctx->pipe, &ctx->mapping, &ctx->inputs, &ctx->targets, &ctx->run_started);
+  };
+  event_handlers[EVT_MAP_ARENA] = [](sl2_pipe_ctx *ctx) {
+    handle_map_arena(ctx->pipe, &ctx->mapping);
+  };
+  event_handlers[EVT_PING] = [](sl2_pipe_ctx *ctx) { handle_ping(ctx->pipe); };
+  event_handlers[EVT_REGISTER_PID] = [](sl2_pipe_ctx *ctx) {
+    handle_register_pid(ctx->pipe, &ctx->session);
+  };
+  event_handlers[EVT_ADVISE_MUTATION] = [](sl2_pipe_ctx *ctx) {
+    handle_advise_mutation(ctx->pipe);
+  };
+  event_handlers[EVT_COVERAGE_INFO] = [](sl2_pipe_ctx *ctx) { handle_coverage_info(ctx->pipe); };
+  event_handlers[EVT_FINALIZE_RUN] = [](sl2_pipe_ctx *ctx) {
+    handle_finalize_run(ctx->pipe, &ctx->mapping, &ctx->inputs, &ctx->targets, &ctx->run_started,
+                        &ctx->seeds, &ctx->pending);
+  };
+  event_handlers[EVT_FINALIZE_PATH] = [](sl2_pipe_ctx *ctx) {
+    handle_finalize_path(ctx->pipe, &ctx->mapping, &ctx->inputs, &ctx->targets, &ctx->run_started,
+                         &ctx->seeds, &ctx->pending);
+  };
+  event_handlers[EVT_STATS] = [](sl2_pipe_ctx *ctx) { handle_stats(ctx->pipe); };
+  event_handlers[EVT_CRASH_DUMP] = [](sl2_pipe_ctx *ctx) {
+    handle_crash_dump(ctx->pipe, &ctx->session);
+  };
+  event_handlers[EVT_MAP_RING] = [](sl2_pipe_ctx *ctx) { handle_map_ring(ctx->pipe); };
+  event_handlers[EVT_REGISTER_RING_MUTATION] = [](sl2_pipe_ctx *ctx) {
+    handle_register_ring_mutation(ctx->pipe, &ctx->session, &ctx->inputs);
+  };
+  event_handlers[EVT_CORPUS_DONOR] = [](sl2_pipe_ctx *ctx) {
+    handle_corpus_donor(ctx->pipe, false, NULL);
+  };
+  event_handlers[EVT_SEED] = [](sl2_pipe_ctx *ctx) {
+    handle_corpus_donor(ctx->pipe, true, &ctx->seeds);
+  };
+  event_handlers[EVT_CORPUS_LIST] = [](sl2_pipe_ctx *ctx) { handle_corpus_list(ctx->pipe); };
+  event_handlers[EVT_CORPUS_PRUNE] = [](sl2_pipe_ctx *ctx) { handle_corpus_prune(ctx->pipe); };
+  event_handlers[EVT_SET_LOG_LEVEL] = [](sl2_pipe_ctx *ctx) { handle_set_log_level(ctx->pipe); };
+  event_handlers[EVT_GET_CONFIG] = [](sl2_pipe_ctx *ctx) { handle_get_config(ctx->pipe); };
+  event_handlers[EVT_SET_CONFIG] = [](sl2_pipe_ctx *ctx) { handle_set_config(ctx->pipe); };
+  event_handlers[EVT_SET_UNSTABLE] = [](sl2_pipe_ctx *ctx) { handle_set_unstable(ctx->pipe); };
+  event_handlers[EVT_SERIES] = [](sl2_pipe_ctx *ctx) { handle_series(ctx->pipe); };
+  event_handlers[EVT_MAP_UPLOAD] = [](sl2_pipe_ctx *ctx) {
+    handle_map_upload(ctx->pipe, &ctx->upload);
+  };
+  event_handlers[EVT_SESSION_BEGIN] = [](sl2_pipe_ctx *ctx) {
+    handle_session_begin(ctx->pipe, &ctx->session);
+  };
+  event_handlers[EVT_SESSION_TEARDOWN] = [](sl2_pipe_ctx *ctx) {
+    SL2_SERVER_LOG_DEBUG("ending a client's session with the server.");
+  };
+
+  for (uint8_t event : {EVT_RUN_ID, EVT_MUTATION, EVT_RUN_INFO, EVT_CRASH_PATH, EVT_MEM_DMP_PATH,
+                        EVT_RUN_COMPLETE}) {
+    event_handlers[event] = handle_deprecated;
   }
+}
 
-  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
-    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
+/**
+ * Dispatches a single event read from a client's session.
+ * Sets the session's event to EVT_INVALID for events that end the session abnormally.
+ * @param ctx the session's pipe context
+ */
+static void dispatch_event(sl2_pipe_ctx *ctx) {
+  LARGE_INTEGER start, end;
+
+  // The start of the request was read before we got here.
+  event_bytes = ctx->received;
+  event_lock_ticks = 0;
+  QueryPerformanceCounter(&start);
+
+  // Framed requests are read whole, up front. Older clients send a bare event byte instead,
+  // and their handlers read each field from the pipe as they go.
+  if (ctx->event == SL2_FRAME_MAGIC && !read_frame(ctx)) {
+    ctx->event = EVT_INVALID;
+    return;
   }
 
-  if (!ReadFile(pipe, &arena_id, (DWORD)size, &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read arena ID");
-  }
+  uint8_t event = ctx->event;
+  SL2_SERVER_LOG_DEBUG("got event ID: %d", event);
+  sl2_etw_event_received(event, event_bytes);
 
-  SL2_SERVER_LOG_INFO("got arena ID: %S", arena_id);
+  sl2_event_handler handler = event_handlers[event];
 
-  std::unique_lock<std::shared_mutex> strategy_lock(strategy_mutex);
-  sl2_strategy_map_t::iterator it = strategy_map.find(arena_id);
+  if (handler) {
+    sl2_etw_handler_start(event);
+    handler(ctx);
+  } else {
+    SL2_SERVER_LOG_ERROR("unknown or invalid event %d", event);
+    ctx->event = EVT_INVALID;
+  }
 
-  if (it == strategy_map.end()) {
-    SL2_SERVER_LOG_FATAL("arena ID missing from strategy_map? (map size=%d)", strategy_map.size());
+  if (frame_left > 0) {
+    SL2_SERVER_LOG_WARN("event %d left %llu bytes of its request unread", event,
+                        (unsigned long long)frame_left);
   }
 
-  table_idx = it->second.strategy;
-  if (!WriteFile(pipe, &table_idx, sizeof(table_idx), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to write strategy advice");
+  frame_next = NULL;
+  frame_left = 0;
+  frame_no_reply = false;
+
+  QueryPerformanceCounter(&end);
+  record_event_stats(event, end.QuadPart - start.QuadPart);
+
+  if (handler) {
+    sl2_etw_handler_stop(ctx->event, ticks_to_us(end.QuadPart - start.QuadPart));
   }
 }
 
 /**
- * Sends the client a dump of the current coverage score and related info
- * @param pipe handle to the named pipe that communicates with the client
+ * Creates a new pipe instance and starts listening on it for a client.
+ * The connection completes on the completion port.
  */
-static void handle_coverage_info(HANDLE pipe) {
-  DWORD txsize;
-  size_t size;
-  wchar_t arena_id[SL2_HASH_LEN + 1] = {0};
+static void post_listener() {
+  sl2_pipe_ctx *ctx = new sl2_pipe_ctx();
 
-  if (!ReadFile(pipe, &size, sizeof(size), &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read arena ID size");
+  DWORD mode = PIPE_WAIT | PIPE_ACCEPT_REMOTE_CLIENTS;
+
+  // Clients still read in byte mode (the default for their end), so the server's
+  // replies can be read a field at a time either way.
+  if (opts.message_pipes) {
+    mode |= PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE;
   }
 
-  if (size != SL2_HASH_LEN * sizeof(wchar_t)) {
-    SL2_SERVER_LOG_FATAL("wrong arena ID size %lu != %lu", size, SL2_HASH_LEN * sizeof(wchar_t));
+  ctx->pipe = CreateNamedPipe(FUZZ_SERVER_PIPE, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, mode,
+                              PIPE_UNLIMITED_INSTANCES, opts.pipe_buffer_size,
+                              opts.pipe_buffer_size, 0, NULL);
+
+  if (ctx->pipe == INVALID_HANDLE_VALUE) {
+    SL2_SERVER_LOG_FATAL("could not create pipe");
   }
 
-  if (!ReadFile(pipe, &arena_id, (DWORD)size, &txsize, NULL)) {
-    SL2_SERVER_LOG_FATAL("failed to read arena ID");
+  if (!CreateIoCompletionPort(ctx->pipe, iocp, (ULONG_PTR)ctx, 0)) {
+    SL2_SERVER_LOG_FATAL("could not associate pipe with the completion port");
   }
 
-  SL2_SERVER_LOG_INFO("got arena ID: %S", arena_id);
-  wchar_t raw_arena_id[SL2_HASH_LEN + 3] = {0};
-  wcscpy(raw_arena_id, L"R_");
-  wcscat(raw_arena_id, arena_id);
+  if (!ConnectNamedPipe(ctx->pipe, &(ctx->ov))) {
+    switch (GetLastError()) {
+    case ERROR_IO_PENDING:
+      break;
+    // A client snuck in between CreateNamedPipe and ConnectNamedPipe.
+    // Nothing gets queued for us in this case, so we queue the completion ourselves.
+    case ERROR_PIPE_CONNECTED:
+      PostQueuedCompletionStatus(iocp, 0, (ULONG_PTR)ctx, &(ctx->ov));
+      break;
+    default:
+      SL2_SERVER_LOG_FATAL("could not listen on pipe");
+    }
+  }
+}
 
-  std::unique_lock<std::shared_mutex> strategy_lock(strategy_mutex);
-  sl2_strategy_map_t::iterator it = strategy_map.find(arena_id);
+/**
+ * Starts an asynchronous read of the next event in a client's session.
+ * @param ctx the session's pipe context
+ * @return success
+ */
+static bool post_event_read(sl2_pipe_ctx *ctx) {
+  memset(&(ctx->ov), 0, sizeof(ctx->ov));
+  ctx->event = EVT_INVALID;
+  ctx->received = 0;
+
+  // On message pipes, read as much of the request's first message as fits, so that a framed
+  // request that fits in the pipe's buffer takes just this one read.
+  void *buf = &(ctx->event);
+  DWORD size = sizeof(ctx->event);
+
+  if (opts.message_pipes) {
+    if (ctx->frame.size() < opts.pipe_buffer_size) {
+      ctx->frame.resize(opts.pipe_buffer_size);
+    }
 
-  if (it == strategy_map.end()) {
-    SL2_SERVER_LOG_FATAL("arena ID missing from strategy_map? (map size=%d)", strategy_map.size());
+    buf = ctx->frame.data();
+    size = (DWORD)ctx->frame.size();
   }
 
-  sl2_arena arena = it->second.arena;
-
-  it = strategy_map.find(raw_arena_id);
-  if (it == strategy_map.end()) {
-    SL2_SERVER_LOG_FATAL("Raw arena ID missing from strategy_map? (map size=%d)",
-                         strategy_map.size());
+  if (!ReadFile(ctx->pipe, buf, size, NULL, &(ctx->ov)) && GetLastError() != ERROR_IO_PENDING &&
+      GetLastError() != ERROR_MORE_DATA) {
+    return false;
   }
-  sl2_arena raw_arena = it->second.arena;
 
-  std::string hash_hex_str = picosha2::hash256_hex_string(
-      (unsigned char *)&raw_arena.map, (unsigned char *)&raw_arena.map + FUZZ_ARENA_SIZE);
+  return true;
+}
 
-  sl2_coverage_info cov = {0};
-  memcpy(cov.path_hash, hash_hex_str.c_str(), SL2_HASH_LEN);
-  cov.bucketing = opts.bucketing;
-  cov.score = it->second.score;
-  cov.tries_remaining = it->second.tries_remaining;
+/**
+ * Tears down a client's session and frees its pipe context.
+ * @param ctx the session's pipe context
+ */
+static void destroy_session(sl2_pipe_ctx *ctx) {
+  destroy_arena_mapping(&(ctx->mapping));
+  destroy_upload_section(&(ctx->upload));
 
-  // Zeroeth, write the coverage info scruct
-  if (!WriteFile(pipe, &cov, sizeof(sl2_coverage_info), &txsize, NULL)) {
-    // NOTE(ww): Failing to write the coverage to the fuzzer is bad,
-    // but not fatal: we've already received the fuzzer's arena, so
-    // future runs will be able sufficiently informed.
-    SL2_SERVER_LOG_WARN("Failed to write coverage information structure");
+  if (ctx->connected) {
+    active_connections--;
+    destroy_pipe(ctx->pipe);
+  } else {
+    CloseHandle(ctx->pipe);
   }
+
+  delete ctx;
 }
 
 /**
- * Handles incoming connections from clients
- * @param data HANDLE to the named pipe
+ * Services completions from the completion port: new connections and incoming events.
+ * Workers only run handlers when an event has arrived, so idle sessions (e.g. a fuzzer
+ * waiting on its target) don't tie up a worker. Clients can re-use their pipe instances to send
+ * multiple events; to end a "session", a client sends the EVT_SESSION_TEARDOWN event.
+ * @param data unused
  * @return error code (0)
  */
-static DWORD WINAPI thread_handler(void *data) {
-  HANDLE pipe = (HANDLE)data;
+static DWORD WINAPI worker_thread(void *data) {
   DWORD txsize;
-  uint8_t event;
+  ULONG_PTR key;
+  OVERLAPPED *ov;
 
-  // NOTE(ww): This is a second event loop, inside of the infinite event loop that
-  // creates each thread and calls thread_handler. We do this so that clients can
-  // re-use their pipe instances to send multiple events -- with only the top-level
-  // loop, each connection would be discarded after a single event.
-  //
-  // To end a "session", a client sends the EVT_SESSION_TEARDOWN event. "Session"
-  // is in scare quotes because each session is essentially anonymous -- the server
-  // only sees when they end, not which runs or events they correspond to.
-  do {
-    event = EVT_INVALID;
+  io_event = CreateEvent(NULL, true, false, NULL);
 
-    SL2_SERVER_LOG_INFO("waiting for the next event!");
+  if (!io_event) {
+    SL2_SERVER_LOG_FATAL("could not create worker I/O event");
+  }
 
-    if (!ReadFile(pipe, &event, sizeof(event), &txsize, NULL)) {
-      if (GetLastError() != ERROR_BROKEN_PIPE) {
-        SL2_SERVER_LOG_FATAL("failed to read event");
-      } else {
-        // Pipe was broken when we tried to read it. Happens when the python client
-        // checks if it exists.
-        SL2_SERVER_LOG_WARN("broken pipe! ending session on event=%d", event);
-        destroy_pipe(pipe);
-        return 0;
-      }
+  while (1) {
+    bool ok = GetQueuedCompletionStatus(iocp, &txsize, &key, &ov, INFINITE);
+
+    if (!ov) {
+      SL2_SERVER_LOG_FATAL("failed to dequeue a completion");
     }
 
-    SL2_SERVER_LOG_INFO("got event ID: %d", event);
+    sl2_pipe_ctx *ctx = (sl2_pipe_ctx *)key;
 
-    // Dispatch individual requests based on which event the client requested
-    // TODO(ww): Construct a sl2_conn here, and pass it to each event handler.
-    // Then, re-use our length-prefixed read and write utility functions
-    // in sl2_server_api.cpp to deduplicate some of the transaction code.
-    switch (event) {
-    case EVT_REGISTER_MUTATION:
-      handle_register_mutation(pipe);
-      break;
-    case EVT_CRASH_PATHS:
-      handle_crash_paths(pipe);
-      break;
-    case EVT_REPLAY:
-      handle_replay(pipe);
-      break;
-    case EVT_GET_ARENA:
-      handle_get_arena(pipe);
-      break;
-    case EVT_SET_ARENA:
-      handle_set_arena(pipe);
-      break;
-    case EVT_PING:
-      handle_ping(pipe);
-      break;
-    case EVT_REGISTER_PID:
-      handle_register_pid(pipe);
-      break;
-    case EVT_ADVISE_MUTATION:
-      handle_advise_mutation(pipe);
-      break;
-    case EVT_COVERAGE_INFO:
-      handle_coverage_info(pipe);
-      break;
-    case EVT_SESSION_TEARDOWN:
-      SL2_SERVER_LOG_INFO("ending a client's session with the server.");
-      break;
-    // NOTE(ww): These are just here for completeness.
-    // Any client that requests them and expects anything back is
-    // almost certain to misbehave.
-    case EVT_RUN_ID:
-    case EVT_MUTATION:
-    case EVT_RUN_INFO:
-    case EVT_CRASH_PATH:
-    case EVT_MEM_DMP_PATH:
-    case EVT_RUN_COMPLETE:
-      SL2_SERVER_LOG_ERROR("deprecated event requested.");
-      event = EVT_INVALID;
-      break;
-    default:
-      SL2_SERVER_LOG_ERROR("unknown or invalid event %d", event);
-      break;
+    if (!ctx->connected) {
+      // Whatever happened, this pipe instance is no longer listening,
+      // so put up another one in its place.
+      post_listener();
+
+      if (!ok) {
+        SL2_SERVER_LOG_ERROR("could not connect to pipe");
+        destroy_session(ctx);
+        continue;
+      }
+
+      LARGE_INTEGER now;
+      QueryPerformanceCounter(&now);
+
+      ctx->connected = true;
+      ctx->run_started = now.QuadPart;
+      active_connections++;
+    } else if ((!ok && GetLastError() != ERROR_MORE_DATA) || txsize == 0) {
+      // Pipe was broken when we tried to read it. Happens when the python client
+      // checks if it exists.
+      SL2_SERVER_LOG_WARN("broken pipe! ending session");
+      destroy_session(ctx);
+      continue;
+    } else {
+      ctx->received = txsize;
+
+      if (opts.message_pipes) {
+        ctx->event = ctx->frame[0];
+      }
+
+      dispatch_event(ctx);
+
+      if (ctx->event == EVT_SESSION_TEARDOWN || ctx->event == EVT_FINALIZE_RUN ||
+          ctx->event == EVT_FINALIZE_PATH || ctx->event == EVT_INVALID) {
+        SL2_SERVER_LOG_DEBUG("closing pipe after event=%d", ctx->event);
+        destroy_session(ctx);
+        continue;
+      }
     }
-  } while (event != EVT_SESSION_TEARDOWN && event != EVT_INVALID);
 
-  SL2_SERVER_LOG_INFO("closing pipe after event=%d", event);
-  destroy_pipe(pipe);
+    SL2_SERVER_LOG_DEBUG("waiting for the next event!");
+
+    if (!post_event_read(ctx)) {
+      SL2_SERVER_LOG_WARN("couldn't read the next event, ending session");
+      destroy_session(ctx);
+    }
+  }
 
   return 0;
 }
 
 /**
- * Init dirs and create a new thread to handle input from the named pipe
+ * Init dirs, then start the workers and listeners that handle input from the named pipe
  */
 int main(int argc, char **argv) {
+  init_instance(argc, argv);
   init_logging_path();
   loguru::init(argc, argv);
-  char log_path_mbs[MAX_PATH + 1] = {0};
-  wcstombs_s(NULL, log_path_mbs, MAX_PATH, FUZZ_LOG, MAX_PATH);
-  loguru::add_file(log_path_mbs, loguru::Append, loguru::Verbosity_MAX);
+  init_logging();
 
   lock_process();
+  sl2_etw_register();
   std::atexit(server_cleanup);
 
-  SL2_SERVER_LOG_INFO("server started!");
+  SL2_SERVER_LOG_INFO("server started! instance=%S",
+                      server_instance[0] ? server_instance : L"(default)");
+
+  opts.checkpoint_interval = SL2_CHECKPOINT_INTERVAL;
+  opts.pipe_buffer_size = SL2_PIPE_BUFFER_SIZE;
+  opts.sync_interval = SL2_SYNC_INTERVAL;
+  opts.replay_cache_bytes = (size_t)SL2_REPLAY_CACHE_MB * 1024 * 1024;
+  opts.evict_idle = SL2_EVICT_IDLE;
+  opts.slow_factor = SL2_SLOW_FACTOR;
+  opts.series_interval = SL2_SERIES_INTERVAL;
+  opts.log_verbosity = loguru::Verbosity_INFO;
+  opts.numa_node = -1;
 
   for (int i = 0; i < argc; ++i) {
     if (STREQ(argv[i], "-s")) {
@@ -1285,44 +7902,269 @@ int main(int argc, char **argv) {
       opts.bucketing = true;
     } else if (STREQ(argv[i], "-p")) {
       opts.pinned = true;
+    } else if (STREQ(argv[i], "-numa")) {
+      if (i < argc - 1) {
+        opts.numa_node = std::max(atoi(argv[i + 1]), -1);
+      } else {
+        SL2_SERVER_LOG_WARN("expected number after -numa, none given?");
+      }
     } else if (STREQ(argv[i], "-d")) {
       opts.dump_mut_buffer = true;
+    } else if (STREQ(argv[i], "-c")) {
+      if (i < argc - 1) {
+        opts.checkpoint_interval = atoi(argv[i + 1]);
+      } else {
+        SL2_SERVER_LOG_WARN("expected number after -c, none given?");
+      }
+    } else if (STREQ(argv[i], "-S")) {
+      if (i < argc - 1) {
+        if (STREQ(argv[i + 1], "legacy")) {
+          opts.scheduler = SL2_SCHEDULER_LEGACY;
+        } else if (STREQ(argv[i + 1], "ucb1")) {
+          opts.scheduler = SL2_SCHEDULER_UCB1;
+        } else if (STREQ(argv[i + 1], "thompson")) {
+          opts.scheduler = SL2_SCHEDULER_THOMPSON;
+        } else {
+          SL2_SERVER_LOG_WARN("unknown scheduler %s, using the default", argv[i + 1]);
+        }
+      } else {
+        SL2_SERVER_LOG_WARN("expected legacy, ucb1, or thompson after -S, none given?");
+      }
+    } else if (STREQ(argv[i], "-P")) {
+      if (i < argc - 1) {
+        if (STREQ(argv[i + 1], "weighted")) {
+          opts.power_schedule = SL2_POWER_WEIGHTED;
+        } else if (STREQ(argv[i + 1], "fast")) {
+          opts.power_schedule = SL2_POWER_FAST;
+        } else if (STREQ(argv[i + 1], "coe")) {
+          opts.power_schedule = SL2_POWER_COE;
+        } else if (STREQ(argv[i + 1], "explore")) {
+          opts.power_schedule = SL2_POWER_EXPLORE;
+        } else if (STREQ(argv[i + 1], "exploit")) {
+          opts.power_schedule = SL2_POWER_EXPLOIT;
+        } else {
+          SL2_SERVER_LOG_WARN("unknown power schedule %s, using the default", argv[i + 1]);
+        }
+      } else {
+        SL2_SERVER_LOG_WARN(
+            "expected weighted, fast, coe, explore, or exploit after -P, none given?");
+      }
+    } else if (STREQ(argv[i], "-j")) {
+      opts.journal_mutations = true;
+    } else if (STREQ(argv[i], "-K")) {
+      opts.compact_fkts = true;
+    } else if (STREQ(argv[i], "-z")) {
+      opts.compress = true;
+    } else if (STREQ(argv[i], "-m")) {
+      opts.mmap_arenas = true;
+    } else if (STREQ(argv[i], "-B")) {
+      if (i < argc - 1) {
+        // Message pipes read at least a frame header at a time.
+        opts.pipe_buffer_size = std::max(atoi(argv[i + 1]), (int)sizeof(sl2_frame_header));
+      } else {
+        SL2_SERVER_LOG_WARN("expected number after -B, none given?");
+      }
+    } else if (STREQ(argv[i], "-n")) {
+      // init_instance has already handled this; just don't mistake the name for a flag.
+      ++i;
+    } else if (STREQ(argv[i], "-M")) {
+      opts.message_pipes = true;
+    } else if (STREQ(argv[i], "-C")) {
+      if (i < argc - 1) {
+        opts.coordinator_port = (uint16_t)atoi(argv[i + 1]);
+      } else {
+        SL2_SERVER_LOG_WARN("expected port after -C, none given?");
+      }
+    } else if (STREQ(argv[i], "-N")) {
+      const char *colon = i < argc - 1 ? strrchr(argv[i + 1], ':') : NULL;
+
+      if (colon && colon != argv[i + 1] && colon[1]) {
+        StringCchCopyNA(opts.coordinator_host, sizeof(opts.coordinator_host), argv[i + 1],
+                        colon - argv[i + 1]);
+        StringCchCopyA(opts.coordinator_service, sizeof(opts.coordinator_service), colon + 1);
+      } else {
+        SL2_SERVER_LOG_WARN("expected host:port after -N, none given?");
+      }
+    } else if (STREQ(argv[i], "-R")) {
+      if (i < argc - 1) {
+        opts.replay_cache_bytes = (size_t)std::max(atoi(argv[i + 1]), 0) * 1024 * 1024;
+      } else {
+        SL2_SERVER_LOG_WARN("expected number after -R, none given?");
+      }
+    } else if (STREQ(argv[i], "-E")) {
+      if (i < argc - 1) {
+        opts.evict_idle = std::max(atoi(argv[i + 1]), 0);
+      } else {
+        SL2_SERVER_LOG_WARN("expected number after -E, none given?");
+      }
+    } else if (STREQ(argv[i], "-t")) {
+      if (i < argc - 1) {
+        opts.series_interval = std::max(atoi(argv[i + 1]), 0);
+      } else {
+        SL2_SERVER_LOG_WARN("expected number after -t, none given?");
+      }
+    } else if (STREQ(argv[i], "-T")) {
+      if (i < argc - 1) {
+        opts.slow_factor = std::max(atoi(argv[i + 1]), 0);
+      } else {
+        SL2_SERVER_LOG_WARN("expected number after -T, none given?");
+      }
+    } else if (STREQ(argv[i], "-L")) {
+      if (i < argc - 1) {
+        opts.log_verbosity = atoi(argv[i + 1]);
+      } else {
+        SL2_SERVER_LOG_WARN("expected number after -L, none given?");
+      }
+    } else if (STREQ(argv[i], "-I")) {
+      if (i < argc - 1) {
+        opts.sync_interval = std::max(atoi(argv[i + 1]), 1);
+      } else {
+        SL2_SERVER_LOG_WARN("expected number after -I, none given?");
+      }
+    } else if (STREQ(argv[i], "-H")) {
+      if (i < argc - 1) {
+        if (STREQ(argv[i + 1], "fast")) {
+          opts.path_hash = SL2_PATH_HASH_FAST;
+        } else if (STREQ(argv[i + 1], "sparse")) {
+          opts.path_hash = SL2_PATH_HASH_SPARSE;
+        } else if (STREQ(argv[i + 1], "sha256")) {
+          opts.path_hash = SL2_PATH_HASH_SHA256;
+        } else {
+          SL2_SERVER_LOG_WARN("unknown path hash %s, using the default", argv[i + 1]);
+        }
+      } else {
+        SL2_SERVER_LOG_WARN("expected fast, sparse, or sha256 after -H, none given?");
+      }
     }
   }
 
   if (opts.pinned && !pin_to_free_processor()) {
     SL2_SERVER_LOG_WARN("failed to pin server to a free processor, too many jobs already pinned?");
+  } else if (!opts.pinned && opts.numa_node >= 0 && !place_on_numa_node()) {
+    SL2_SERVER_LOG_WARN("failed to place the server on numa_node=%d", opts.numa_node);
   }
 
   init_working_paths();
+  set_log_verbosity(opts.log_verbosity);
+  init_campaign_config();
 
-  SL2_SERVER_LOG_INFO("dump_mut_buffer=%d, pinned=%d, bucketing=%d, stickiness=%d",
-                      opts.dump_mut_buffer, opts.pinned, opts.bucketing, opts.stickiness);
+  if (opts.mmap_arenas && opts.compress) {
+    SL2_SERVER_LOG_WARN("-m doesn't work with -z, reading arenas into memory instead");
+    opts.mmap_arenas = false;
+  }
 
-  while (1) {
-    HANDLE pipe = CreateNamedPipe(FUZZ_SERVER_PATH, PIPE_ACCESS_DUPLEX,
-                                  PIPE_WAIT | PIPE_ACCEPT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES,
-                                  BUFSIZ, BUFSIZ, 0, NULL);
+  SL2_SERVER_LOG_INFO(
+      "dump_mut_buffer=%d, pinned=%d, bucketing=%d, stickiness=%d, checkpoint_interval=%d, "
+      "path_hash=%d, journal_mutations=%d, compact_fkts=%d, scheduler=%d, power_schedule=%d, "
+      "pipe_buffer_size=%u, message_pipes=%d, coordinator_port=%u, coordinator=%s:%s, "
+      "sync_interval=%d, replay_cache_bytes=%llu, evict_idle=%d, slow_factor=%u, "
+      "log_verbosity=%d, numa_node=%d, compress=%d, mmap_arenas=%d, series_interval=%u",
+      opts.dump_mut_buffer, opts.pinned, opts.bucketing, opts.stickiness,
+      opts.checkpoint_interval, opts.path_hash, opts.journal_mutations, opts.compact_fkts,
+      opts.scheduler, opts.power_schedule, opts.pipe_buffer_size, opts.message_pipes,
+      opts.coordinator_port, opts.coordinator_host, opts.coordinator_service, opts.sync_interval,
+      (unsigned long long)opts.replay_cache_bytes, opts.evict_idle, opts.slow_factor,
+      log_verbosity.load(), opts.numa_node, opts.compress, opts.mmap_arenas,
+      opts.series_interval);
+
+  if (opts.checkpoint_interval) {
+    HANDLE thread = CreateThread(NULL, 0, checkpoint_thread, NULL, 0, NULL);
+
+    if (thread == NULL) {
+      SL2_SERVER_LOG_FATAL("couldn't start the checkpoint thread");
+    }
+
+    CloseHandle(thread);
+  }
+
+  if (opts.series_interval) {
+    HANDLE thread = CreateThread(NULL, 0, series_thread, NULL, 0, NULL);
 
-    if (pipe == INVALID_HANDLE_VALUE) {
-      SL2_SERVER_LOG_FATAL("could not create pipe");
+    if (thread == NULL) {
+      SL2_SERVER_LOG_FATAL("couldn't start the series thread");
     }
 
-    bool connected = ConnectNamedPipe(pipe, NULL) ? true : (GetLastError() == ERROR_PIPE_CONNECTED);
+    CloseHandle(thread);
+  }
 
-    if (connected) {
-      HANDLE thread = CreateThread(NULL, 0, thread_handler, (void *)pipe, 0, NULL);
+  if (init_live_stats()) {
+    HANDLE thread = CreateThread(NULL, 0, live_stats_thread, NULL, 0, NULL);
 
-      if (thread == NULL) {
-        SL2_SERVER_LOG_FATAL("CreateThread failed\n");
-      } else {
-        CloseHandle(thread);
-      }
-    } else {
-      SL2_SERVER_LOG_ERROR("could not connect to pipe");
-      CloseHandle(pipe);
+    if (thread == NULL) {
+      SL2_SERVER_LOG_FATAL("couldn't start the live stats thread");
+    }
+
+    CloseHandle(thread);
+  }
+
+  // Coordinators and nodes are ordinary servers that also sync their arenas over TCP.
+  // The sync isn't authenticated, so only coordinate nodes on a trusted network.
+  if (opts.coordinator_port || opts.coordinator_host[0]) {
+    WSADATA wsa;
+
+    if (WSAStartup(MAKEWORD(2, 2), &wsa)) {
+      SL2_SERVER_LOG_FATAL("WSAStartup failed");
+    }
+  }
+
+  if (opts.coordinator_port) {
+    HANDLE thread = CreateThread(NULL, 0, coordinator_thread, NULL, 0, NULL);
+
+    if (thread == NULL) {
+      SL2_SERVER_LOG_FATAL("couldn't start the coordinator thread");
+    }
+
+    CloseHandle(thread);
+  }
+
+  if (opts.coordinator_host[0]) {
+    std::random_device seed;
+
+    // 0 and SL2_SYNC_COORDINATOR are reserved corpus origins.
+    while (node_id == 0 || node_id == SL2_SYNC_COORDINATOR) {
+      node_id = ((uint64_t)seed() << 32) | seed();
+    }
+
+    HANDLE thread = CreateThread(NULL, 0, node_thread, NULL, 0, NULL);
+
+    if (thread == NULL) {
+      SL2_SERVER_LOG_FATAL("couldn't start the node thread");
+    }
+
+    CloseHandle(thread);
+  }
+
+  QueryPerformanceFrequency(&perf_frequency);
+  init_event_handlers();
+
+  iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+
+  if (!iocp) {
+    SL2_SERVER_LOG_FATAL("could not create completion port");
+  }
+
+  SYSTEM_INFO info = {0};
+  GetSystemInfo(&info);
+
+  SL2_SERVER_LOG_INFO("starting %d workers, %d listeners", info.dwNumberOfProcessors,
+                      SL2_SERVER_LISTENERS);
+
+  // The main thread becomes the last worker, below.
+  for (DWORD i = 1; i < info.dwNumberOfProcessors; ++i) {
+    HANDLE thread = CreateThread(NULL, 0, worker_thread, NULL, 0, NULL);
+
+    if (thread == NULL) {
+      SL2_SERVER_LOG_FATAL("CreateThread failed");
     }
+
+    CloseHandle(thread);
+  }
+
+  for (int i = 0; i < SL2_SERVER_LISTENERS; ++i) {
+    post_listener();
   }
 
+  worker_thread(NULL);
+
   return 0;
 }
@@ -2,7 +2,7 @@
 ## @package db
 # Main interface for accessing the sl2 database
 
-from sqlalchemy import create_engine
+from sqlalchemy import create_engine, event
 from sqlalchemy.pool import *
 from sqlalchemy.orm import sessionmaker
 from sqlalchemy.orm import scoped_session
@@ -14,9 +14,11 @@ from . import base
 from .conf import Conf
 from .tracer import Tracer  # noqa: F401
 from .checksec import Checksec  # noqa: F401
-from .crash import Crash  # noqa: F401
+from .crash import Crash, CrashDetail  # noqa: F401
+from .crash_bucket import CrashBucket  # noqa: F401
 from .target_config import TargetConfig  # noqa: F401
 from .run_block import RunBlock  # noqa: F401
+from .run_hour import RunHour  # noqa: F401
 from .coverage import PathRecord  # noqa: F401
 
 from . import utilz  # noqa: F401
@@ -69,6 +71,18 @@ dburl = os.path.join("sqlite:///%s" % dbpath)
 ## sqlalchemy database engine
 engine = create_engine(dburl, poolclass=NullPool)
 
+
+## Puts every connection in WAL mode, so that the harness's workers (and the GUI) can keep reading while
+#  a batch of run stats is written out, and waits on the write lock rather than failing outright.
+@event.listens_for(engine, "connect")
+def _configure_connection(dbapi_connection, connection_record):
+    cursor = dbapi_connection.cursor()
+    cursor.execute("PRAGMA journal_mode=WAL")
+    cursor.execute("PRAGMA synchronous=NORMAL")
+    cursor.execute("PRAGMA busy_timeout=30000")
+    cursor.close()
+
+
 base.Base.metadata.create_all(engine)
 session_factory = sessionmaker(bind=engine)
 Session = scoped_session(session_factory)
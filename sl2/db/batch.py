@@ -0,0 +1,126 @@
+## @package batch
+#
+# Buffers the writes that every fuzzing run makes (path hash increments and run block stats), and
+# writes them out in a single transaction every BATCH_RUNS runs or BATCH_SECONDS seconds, whichever
+# comes first. With many workers, committing every run on its own leaves them all waiting on
+# SQLite's write lock.
+#
+# Each block is also counted against its hour (see RunHour), in the same transaction, so that the
+# report can read those instead of every block.
+
+import datetime
+import threading
+import time
+
+from sqlalchemy import func
+from sqlalchemy.dialects.sqlite import insert
+
+from sl2 import db
+
+## Number of runs to buffer before writing them out
+BATCH_RUNS = 100
+
+## Longest that a run's writes are buffered for, in seconds
+BATCH_SECONDS = 5
+
+
+## class BatchWriter
+#  Buffers run stats for the database, and writes them out in bulk
+class BatchWriter(object):
+    def __init__(self):
+        ## Guards the buffers
+        self.lock = threading.Lock()
+        ## Serializes flushes, which happen outside of the buffers' lock
+        self.flush_lock = threading.Lock()
+
+        self._reset()
+
+    def _reset(self):
+        ## Path hash -> [target slug, number of times seen, first seen, last seen]
+        self.paths = {}
+        ## Keyword arguments of each RunBlock to write
+        self.blocks = []
+        self.runs = 0
+        self.last_flush = time.time()
+
+    ## Records a finished run
+    #  @param target_slug - the run's target
+    #  @param path_hash - the hash of the run's path through the target, or None
+    def run_complete(self, target_slug, path_hash=None):
+        now = datetime.datetime.utcnow()
+
+        with self.lock:
+            if path_hash:
+                path = self.paths.get(path_hash)
+                if path:
+                    path[1] += 1
+                    path[3] = now
+                else:
+                    self.paths[path_hash] = [target_slug, 1, now, now]
+
+            self.runs += 1
+            due = self.runs >= BATCH_RUNS or time.time() - self.last_flush >= BATCH_SECONDS
+
+        if due:
+            self.flush()
+
+    ## Records a finished block of runs. Unless it comes with one, its path coverage estimate is taken when it's
+    #  written out.
+    #  @param kwargs - the RunBlock's constructor arguments
+    def block_complete(self, **kwargs):
+        with self.lock:
+            self.blocks.append(kwargs)
+
+    ## Writes out everything that's buffered, in one transaction
+    def flush(self):
+        with self.flush_lock:
+            with self.lock:
+                paths, blocks = self.paths, self.blocks
+                self._reset()
+
+            if not paths and not blocks:
+                return
+
+            session = db.getSession()
+
+            if paths:
+                # Columns named "count" clash with a method of column collections, so these are all
+                # looked up by name.
+                table = db.PathRecord.__table__
+                stmt = insert(table)
+                stmt = stmt.on_conflict_do_update(
+                    index_elements=["hash"],
+                    set_={
+                        "count": func.coalesce(table.c["count"], 0) + stmt.excluded["count"],
+                        "last_seen": stmt.excluded["last_seen"],
+                    },
+                )
+                rows = [
+                    {"hash": pathhash, "target_config_slug": slug, "count": count, "created": first, "last_seen": last}
+                    for pathhash, (slug, count, first, last) in paths.items()
+                ]
+                session.execute(stmt, rows)
+
+            # The estimate only changes with the paths, so every block in a batch shares one.
+            coverage = {}
+            for block in blocks:
+                slug = block["target_slug"]
+                if block.get("coverage") is None:
+                    if slug not in coverage:
+                        session.flush()
+                        coverage[slug] = db.PathRecord.estimate_current_path_coverage(slug, session)
+                    block["coverage"] = coverage[slug]
+
+                run_block = db.RunBlock(**block)
+                run_block.ended = datetime.datetime.utcnow()
+                session.add(run_block)
+                db.RunHour.record(
+                    session, slug, block["started"], run_block.ended, block["runs"], block["crashes"], block["coverage"]
+                )
+
+            session.commit()
+            session.close()
+
+
+## The writer that every SessionManager buffers into
+writer = BatchWriter()
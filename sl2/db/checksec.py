@@ -5,6 +5,8 @@
 # equivalent of checksec.sh
 #
 
+from concurrent.futures import ThreadPoolExecutor
+from multiprocessing import cpu_count
 from sqlalchemy import *
 from sl2.harness import config
 import subprocess
@@ -78,28 +80,61 @@ class Checksec(Base):
     # @return Checksec obj
     @staticmethod
     def byExecutable(path):
-        cfg = config
+        return Checksec.byExecutables([path]).get(path)
+
+    ## Factory for checksec from many executables at once, like every module that a target loads.
+    # The ones that aren't in the db yet (by hash) are analyzed in parallel, and added in one commit.
+    # @param paths Paths to DLLs or EXEs
+    # @param workers How many copies of winchecksec to run at once (default: one per CPU)
+    # @return dict of path -> Checksec obj, without the paths that couldn't be analyzed
+    @staticmethod
+    def byExecutables(paths, workers=None):
         session = db.getSession()
         session.expire_on_commit = False
 
-        ret = session.query(Checksec).filter(Checksec.hash == hash_file(path)).first()
-        if ret:
-            session.close()
-            return ret
-        checker = cfg.config["checksec_path"]
-        cmd = [checker, "-j", path]
+        hashes = {}
+        for path in paths:
+            try:
+                hashes[path] = hash_file(path)
+            except OSError as x:
+                print("Exception", x)
+
+        known = {}
+        unique = list(set(hashes.values()))
+        # SQLite caps how many parameters a query can take, so the lookups are batched.
+        for i in range(0, len(unique), 500):
+            for row in session.query(Checksec).filter(Checksec.hash.in_(unique[i : i + 500])):
+                known[row.hash] = row
+
+        # Copies of the same binary (by hash) are only analyzed once
+        missing = {}
+        for path, digest in hashes.items():
+            if digest not in known:
+                missing.setdefault(digest, path)
+
+        if missing:
+            with ThreadPoolExecutor(max_workers=workers or cpu_count()) as pool:
+                for digest, result in zip(missing, pool.map(Checksec._analyze, missing.values())):
+                    if result:
+                        known[digest] = Checksec(result)
+                        session.add(known[digest])
+            session.commit()
+
+        session.close()
+        return {path: known[digest] for path, digest in hashes.items() if digest in known}
+
+    ## Runs winchecksec on a single executable
+    # @param path Path to DLL or EXE
+    # @return winchecksec's json object, or None
+    @staticmethod
+    def _analyze(path):
+        cmd = [config.config["checksec_path"], "-j", path]
 
         try:
-            out = subprocess.check_output(cmd)
-            ret = json.loads(out)
-            ret = Checksec(ret)
-            session.add(ret)
-            session.commit()
-            session.close()
-        except subprocess.CalledProcessError as x:
+            return json.loads(subprocess.check_output(cmd))
+        except (subprocess.CalledProcessError, ValueError) as x:
             print("Exception", x)
-
-        return ret
+            return None
 
     ## Returns value between 0 and 1 as a percentage of the rarity of protection flags.
     # If a binary has a flag that's rarely implemented (like RFG) it will more quickly increase this value
@@ -1,5 +1,5 @@
 from sqlalchemy import *
-from sqlalchemy import ForeignKey
+from sqlalchemy import ForeignKey, func
 from sqlalchemy.orm import relationship
 import datetime
 
@@ -38,6 +38,7 @@ class PathRecord(Base):
 
     ## Creates a new path record for paths we haven't seen before. Otherwise, finds the matching database record for the
     ## given path hash and increments it
+    #  NOTE: The harness buffers these through sl2.db.batch instead, rather than committing every run on its own.
     @staticmethod
     def incrementPath(pathhash, target_slug):
         session = db.getSession()
@@ -55,22 +56,24 @@ class PathRecord(Base):
         session.close()
 
     ## Uses a Chao1 estimator to estimate the current fraction of the total unique paths that have been analyzed so far
+    #  @param session - the session to query with, or None to use (and close) a new one
     #  @return (num_paths, estimated) - tuple containing the number of unique paths and a float from [0,1] estimating
     #   the fraction of possible paths that have been evaluated so far.
     @staticmethod
-    def estimate_current_path_coverage(target_slug):
-        session = db.getSession()
+    def estimate_current_path_coverage(target_slug, session=None):
+        own_session = session is None
+        session = session or db.getSession()
         target_query = session.query(PathRecord).filter(PathRecord.target_config_slug == target_slug)
         num_paths = target_query.count()
         num_singletons = target_query.filter(PathRecord.count == 1).count()
         num_doubletons = target_query.filter(PathRecord.count == 2).count()
-        num_runs = sum(x.count for x in target_query.all())
-
-        session.close()
-        # TODO - is it fair to calculate assuming at least one doubleton here?
-        c = num_paths / (
-            num_paths + ((num_runs - 1) / num_runs) * ((num_singletons ** 2) / (2 * max(num_doubletons, 1)))
+        num_runs = (
+            session.query(func.sum(PathRecord.count)).filter(PathRecord.target_config_slug == target_slug).scalar() or 0
         )
+
+        if own_session:
+            session.close()
+        c = PathRecord.chao1_path_coverage(num_paths, num_runs, num_singletons, num_doubletons)
         print(
             "Total Paths:",
             num_paths,
@@ -82,3 +85,20 @@ class PathRecord(Base):
             c,
         )
         return num_paths, c
+
+    ## Uses a Chao1 estimator to estimate the fraction of the total unique paths that have been seen, from path
+    #  frequencies that are already known (e.g. the server's, see sl2_coverage_info in include/server.hpp)
+    #  @param num_paths - the number of unique paths
+    #  @param num_runs - the number of runs that took them
+    #  @param num_singletons - the number of paths taken exactly once
+    #  @param num_doubletons - the number of paths taken exactly twice
+    #  @return a float from [0,1] estimating the fraction of possible paths that have been seen
+    @staticmethod
+    def chao1_path_coverage(num_paths, num_runs, num_singletons, num_doubletons):
+        if not num_runs:
+            return 0.0
+
+        # TODO - is it fair to calculate assuming at least one doubleton here?
+        return num_paths / (
+            num_paths + ((num_runs - 1) / num_runs) * ((num_singletons ** 2) / (2 * max(num_doubletons, 1)))
+        )
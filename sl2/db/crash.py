@@ -16,9 +16,26 @@ import subprocess
 from sqlalchemy.sql.expression import func
 
 from .base import Base
+from . import triage_cache
+from .crash_bucket import CrashBucket
 from sl2 import db
 
 
+## class CrashDetail
+# The bulky parts of a crash (the triager's full JSON and its text output), which only the crash
+# browser and bucket lookups need. They're kept out of the crash table so that listing crashes
+# doesn't read (or unpickle) them, and are only loaded when one of them is asked for.
+class CrashDetail(Base):
+    __tablename__ = "crash_detail"
+
+    ## The crash that this is the detail of
+    crash_id = Column(Integer, ForeignKey("crash.id"), primary_key=True)
+    ## The triager's JSON, less its output
+    obj = Column(Text)
+    ## Summary of triage information
+    output = Column(Text)
+
+
 # Holds information about a specific crash
 # Example json
 # <pre>
@@ -31,6 +48,7 @@ from sl2 import db
 #     'crashAddress': 140702400817557,
 #     'crashReason': 'EXCEPTION_BREAKPOINT',
 #     'crashash': 'f96808cfc4798256',
+#     'bucket': '1c3cd3e4e477dc9a',
 #     'exploitability': 'None',
 #     'instructionPointer': 140702400817557,
 #     'minidumpPath': 'long_path_to\\initial.PID.dmp',
@@ -44,6 +62,11 @@ from sl2 import db
 # </pre>
 class Crash(Base):
     __tablename__ = "crash"
+    __table_args__ = (
+        Index("ix_crash_slug_crashash", "target_config_slug", "crashash"),
+        Index("ix_crash_slug_bucket", "target_config_slug", "bucket"),
+        Index("ix_crash_runid", "runid"),
+    )
 
     id = Column(Integer, primary_key=True)
     target_config_slug = Column(String, ForeignKey("targets.target_slug"))
@@ -56,6 +79,8 @@ class Crash(Base):
     crashReason = Column(String(270))
     ## Crashash (Crash Hash).  Identifier for binning related crashes
     crashash = Column(String(64))
+    ## Bucket (v2 crash hash) of the crash's reason, faulting module and top frames, in order
+    bucket = Column(String(16))
     ## Text string description of Exploitability. Can be High, Medium, Low, Unknown, or None.
     exploitability = Column(String(32))
     ## Instruction Pointer (pc, eip, rep) as hex string
@@ -72,12 +97,12 @@ class Crash(Base):
     stackPointerString = Column(String(20))
     ## Tag or path used to succinctly describe crash bin
     tag = Column(String(128))
+    ## Runid of the crash that the crashing run focused on (see sl2.harness.crash_focus), if any
+    parent_runid = Column(String(40))
     ## Foreign key to tracer results
     tracer = relationship("Tracer", order_by=db.Tracer.runid, back_populates="crash", uselist=False)
-    ## Summary of triage information
-    output = Column(String)
-    ## Pickled object version of json object
-    obj = Column(PickleType)
+    ## The triager's JSON and output, loaded on demand (see obj and output)
+    detail = relationship(CrashDetail, uselist=False, lazy="select", cascade="all, delete-orphan")
     ## Timestamp of the crash
     timestamp = Column(DateTime, default=func.now())
     ## register follow
@@ -152,13 +177,14 @@ class Crash(Base):
 
             self.runid = runid
             ## Json object
-            self.output = j["output"]
+            output = j["output"]
             del (j["output"])
-            self.obj = j
+            self.detail = CrashDetail(obj=json.dumps(j), output=output)
+            self._obj = j
 
-            self.stackPointer = self.obj["stackPointer"]
-            self.crashAddress = self.obj["crashAddress"]
-            self.instructionPointer = self.obj["instructionPointer"]
+            self.stackPointer = j["stackPointer"]
+            self.crashAddress = j["crashAddress"]
+            self.instructionPointer = j["instructionPointer"]
 
             self.target_config_slug = slug
 
@@ -168,6 +194,8 @@ class Crash(Base):
             self.crashReason = j["crashReason"]
             ## Crashash (Crash Hash).  Identifier for binning related crashes
             self.crashash = j["crashash"]
+            ## Bucket (v2 crash hash).  Finer grained identifier for binning related crashes
+            self.bucket = j.get("bucket")
             ## Text string description of Exploitability. Can be High, Medium, Low, Unknown, or None.
             self.exploitability = j["exploitability"]
             ## Instruction Pointer (pc, eip, rep) as hex string
@@ -230,10 +258,23 @@ class Crash(Base):
     def int_exploitability(self):
         return {"High": 10, "Medium": 20, "Low": 30, "Unknown": 40}[self.exploitability]
 
+    ## The triager's JSON (less its output), from the crash's detail
+    @property
+    def obj(self):
+        if getattr(self, "_obj", None) is None:
+            self._obj = json.loads(self.detail.obj) if self.detail and self.detail.obj else {}
+        return self._obj
+
+    ## Summary of triage information, from the crash's detail
+    @property
+    def output(self):
+        return self.detail.output if self.detail else None
+
+    ## How many of the target's crashes share this one's crashash, from its bucket's tally
     @property
     def occurrences(self):
         session = db.getSession()
-        return session.query(Crash).filter(Crash.crashash == self.crashash).count()
+        return CrashBucket.occurrences(session, self.target_config_slug, self.crashash)
 
     ## Converts integer rank to exploitability string
     # @param rank integer rank
@@ -255,12 +296,15 @@ class Crash(Base):
     ## Reconstructs Crash object from database after it loads
     @orm.reconstructor
     def reconstructor(self):
-        self.stackPointer = self.obj["stackPointer"]
-        self.crashAddress = self.obj["crashAddress"]
-        self.instructionPointer = self.obj["instructionPointer"]
+        # These come from the hex columns rather than obj, so that loading a row doesn't
+        # load its detail too.
+        self.stackPointer = int(self.stackPointerString, 16)
+        self.crashAddress = int(self.crashAddressString, 16)
+        self.instructionPointer = int(self.instructionPointerString, 16)
 
         if hasattr(self, "ranks"):
-            if self.tracer:
+            # The triager already ranks with the tracer's crash record (as "sl2") when it can find it.
+            if self.tracer and "sl2" not in self.obj.get("engines", []):
                 self.ranks.append(self.tracer.rank)
 
             self.rank = max(self.ranks)
@@ -278,10 +322,10 @@ class Crash(Base):
     # it already exists in the db, return the row.
     # @param runid Run id
     # @param dmpPath string path to minidump file
+    # @param parent_runid Runid of the crash that the run focused on, if it was a focused run
     # @return Crash object
     @staticmethod
-    def factory(runid, slug=None, targetPath=None):
-        cfg = config
+    def factory(runid, slug=None, targetPath=None, parent_runid=None):
         session = db.getSession()
         runid = str(runid)
         ret = session.query(Crash).filter(Crash.runid == runid).first()
@@ -294,24 +338,9 @@ class Crash(Base):
             print("Unable to find dumpfile for runid %s" % runid)
             return None
 
-        # Runs triager, which will give us exploitability info
-        # using 2 engines: Google's breakpad and an reimplementation of Microsofts
-        # !exploitable
-        cmd = [cfg.config["triager_path"], dmpPath]
-        out = subprocess.check_output(cmd, shell=False)
-        # TODO: sorry didn't have time to clean this up before leave
-        dirname = os.path.dirname(dmpPath)
-        path = os.path.join(dirname, "triage.txt")
-        with open(path, "wb", newline=None) as f:
-            f.write(out)
-
-        out = out.decode("utf8")
-        j = None
-        for line in out.splitlines():
-            line = line.strip()
-            if re.match(r"{.*}", line):
-                j = json.loads(line)
-                j["output"] = out
+        j = triage_cache.load(dmpPath)
+        if j is None:
+            j = Crash._triageOrBucket(session, dmpPath, slug)
 
         if not j:
             return None
@@ -321,12 +350,91 @@ class Crash(Base):
             print("Unable to process crash json")
             return None
 
+        ret.parent_runid = parent_runid
+
         ret.mergeTracer()
         ret.reconstructor()
         session.add(ret)
+        CrashBucket.record(session, slug, ret)
         session.commit()
         return ret
 
+    ## Triages a minidump, or takes its exploitability from its bucket if it's a known crash
+    # Full triages are cached (see triage_cache), quick ones aren't: what they take from their
+    # bucket depends on the database.
+    # @param session Database session
+    # @param dmpPath string path to minidump file
+    # @param slug Target config slug, to look for buckets under
+    # @return the triager's JSON, or None
+    @staticmethod
+    def _triageOrBucket(session, dmpPath, slug):
+        dirname = os.path.dirname(dmpPath)
+
+        # Crashes that land in a bucket we already know about don't need a full triage: the triager
+        # only stackwalks the crashing thread to get their bucket, and the exploitability comes
+        # from the bucket's first crash.
+        known = [
+            row.bucket
+            for row in session.query(Crash.bucket).filter(Crash.target_config_slug == slug).distinct()
+            if row.bucket
+        ]
+        known_path = None
+        if known:
+            known_path = os.path.join(dirname, "known_crashes.txt")
+            with open(known_path, "w") as f:
+                f.write("\n".join(known))
+
+        j = Crash._triage(dmpPath, known_path)
+        if j and j.get("duplicate"):
+            bucket = (
+                session.query(Crash).filter(Crash.bucket == j["bucket"], Crash.target_config_slug == slug).first()
+            )
+            if bucket:
+                for key in Crash.BUCKET_KEYS:
+                    if key in bucket.obj:
+                        j[key] = bucket.obj[key]
+            else:
+                j = Crash._triage(dmpPath)
+
+        if j and not j.get("duplicate"):
+            triage_cache.store(dmpPath, j)
+
+        return j
+
+    ## The fields that a duplicate crash takes from the first crash in its bucket
+    BUCKET_KEYS = ["exploitability", "rank", "ranks", "engines", "tag", "triage"]
+
+    ## Runs the triager on a minidump
+    # The triager gives us exploitability info using 2 engines: Google's breakpad and a
+    # reimplementation of Microsoft's !exploitable. Its output is kept next to the minidump, in triage.txt.
+    # It's run in JSON-only mode, which skips printing (and symbolizing) every thread's stack.
+    # @param dmpPath string path to minidump file
+    # @param known_path path to the known buckets, one per line, or None to always triage fully
+    # @return the triager's JSON, or None
+    @staticmethod
+    def _triage(dmpPath, known_path=None):
+        cmd = [config.config["triager_path"], "--json"]
+        if known_path:
+            cmd += ["--known", known_path]
+        if config.config.get("triage_time_budget"):
+            cmd += ["--time-budget", str(config.config["triage_time_budget"])]
+        cmd.append(dmpPath)
+
+        out = subprocess.check_output(cmd, shell=False)
+        path = os.path.join(os.path.dirname(dmpPath), "triage.txt")
+        with open(path, "wb", newline=None) as f:
+            f.write(out)
+
+        out = out.decode("utf8")
+        j = None
+        for line in out.splitlines():
+            line = line.strip()
+            if re.match(r"{.*}", line):
+                j = json.loads(line)
+                j.setdefault("output", out)
+
+        return j
+
     ## Converts ranks list to colon seperated string
     def ranksStringGenerate(self):
         tmp = [str(_) for _ in self.ranks]
@@ -0,0 +1,113 @@
+############################################################################
+## @package crash_bucket
+# crash_bucket.py
+#
+# Per-crashash tallies of a target's crashes, kept up to date as crashes are added,
+# so that occurrence and unique crash counts don't have to scan the crash table.
+
+from sqlalchemy import *
+
+from .base import Base
+
+
+## class CrashBucket
+# One row per (target, crashash): how many crashes have landed in it, and which run was first
+class CrashBucket(Base):
+    __tablename__ = "crash_buckets"
+    __table_args__ = (UniqueConstraint("target_config_slug", "crashash"),)
+
+    id = Column(Integer, primary_key=True)
+    ## Slug of the target that the crashes are for
+    target_config_slug = Column(String, ForeignKey("targets.target_slug"))
+    ## Crashash (Crash Hash) shared by the bucket's crashes
+    crashash = Column(String(64))
+    ## Number of crashes in the bucket
+    count = Column(Integer, default=0)
+    ## Runid of the bucket's first crash
+    first_runid = Column(String(40))
+    ## Reason of the bucket's first crash
+    crash_reason = Column(String(270))
+    ## Exploitability of the bucket's first crash
+    exploitability = Column(String(32))
+    ## Rank of the bucket's first crash
+    rank = Column(Integer)
+
+    ## Counts a new crash against its bucket, creating the bucket if it's the first. Should be called in
+    # the same transaction that adds the crash.
+    # The UPDATE takes SQLite's write lock before the bucket is looked for, so two harness
+    # workers can't both create the same bucket.
+    # @param session Database session
+    # @param slug Target config slug
+    # @param crash The new crash
+    @staticmethod
+    def record(session, slug, crash):
+        updated = (
+            session.query(CrashBucket)
+            .filter(CrashBucket.target_config_slug == slug, CrashBucket.crashash == crash.crashash)
+            .update({CrashBucket.count: CrashBucket.count + 1}, synchronize_session=False)
+        )
+        if not updated:
+            session.add(
+                CrashBucket(
+                    target_config_slug=slug,
+                    crashash=crash.crashash,
+                    count=1,
+                    first_runid=crash.runid,
+                    crash_reason=crash.crashReason,
+                    exploitability=crash.exploitability,
+                    rank=crash.rank,
+                )
+            )
+
+    ## @param session Database session
+    # @param slug Target config slug
+    # @param crashash A crashash
+    # @return how many of the target's crashes have the crashash
+    @staticmethod
+    def occurrences(session, slug, crashash):
+        bucket = (
+            session.query(CrashBucket.count)
+            .filter(CrashBucket.target_config_slug == slug, CrashBucket.crashash == crashash)
+            .first()
+        )
+        return bucket.count if bucket else 0
+
+    ## @param session Database session
+    # @param slug Target config slug
+    # @return how many distinct crashashes the target's crashes have
+    @staticmethod
+    def unique_count(session, slug):
+        return session.query(CrashBucket).filter(CrashBucket.target_config_slug == slug).count()
+
+    ## @param session Database session
+    # @param slug Target config slug
+    # @return how many distinct crashashes the target's crashes have whose first crash is more than Low
+    @staticmethod
+    def severe_count(session, slug):
+        return (
+            session.query(CrashBucket)
+            .filter(
+                CrashBucket.target_config_slug == slug,
+                CrashBucket.exploitability.notin_(["None", "Unknown", "Low"]),
+            )
+            .count()
+        )
+
+    ## @param session Database session
+    # @param slug Target config slug
+    # @return how many crashes the target has, across every bucket
+    @staticmethod
+    def total_count(session, slug):
+        return session.query(func.sum(CrashBucket.count)).filter(CrashBucket.target_config_slug == slug).scalar() or 0
+
+    ## @param session Database session
+    # @param slug Target config slug
+    # @return the target's buckets, most exploitable first
+    @staticmethod
+    def ranked(session, slug):
+        return (
+            session.query(CrashBucket)
+            .filter(CrashBucket.target_config_slug == slug)
+            .order_by(CrashBucket.rank.desc(), CrashBucket.id)
+            .all()
+        )
@@ -4,9 +4,9 @@ from sqlalchemy.orm import relationship
 
 import datetime
 
-from sl2 import db
 from .base import Base
 from sl2.db.coverage import PathRecord
+from sl2.db import batch
 
 
 ## class RunBlock
@@ -45,7 +45,8 @@ class RunBlock(Base):
     ## Estimated percentage of all unique excution paths covered
     path_coverage = Column(Numeric)
 
-    def __init__(self, target_slug, started, runs, crashes, bucketing, score, num_tries_remaining):
+    ## @param coverage - (num_paths, path_coverage) if it's already known, otherwise it's estimated here
+    def __init__(self, target_slug, started, runs, crashes, bucketing, score, num_tries_remaining, coverage=None):
         self.target_config_slug = target_slug
         self.started = started
         self.runs = runs
@@ -54,11 +55,12 @@ class RunBlock(Base):
         self.score = score
         self.num_tries_remaining = num_tries_remaining
 
-        self.num_paths, self.path_coverage = PathRecord.estimate_current_path_coverage(target_slug)
+        self.num_paths, self.path_coverage = coverage or PathRecord.estimate_current_path_coverage(target_slug)
 
 
 ## class SessionManager
-#  Decorator that allows for easy incorporation of run statistics into the database
+#  Decorator that allows for easy incorporation of run statistics into the database. The writes are buffered
+#  through sl2.db.batch, and go out in bulk every few runs (and when the session manager exits).
 class SessionManager(object):
 
     ## Constructor for crash object
@@ -77,27 +79,34 @@ class SessionManager(object):
         self.started = datetime.datetime.utcnow()
         return self
 
-    ## Exit for the decorator. Calls _handle_completion
+    ## Exit for the decorator. Calls _handle_completion, and writes out everything that's buffered
     def __exit__(self, exc_type, exc_val, exc_tb):
         self._handle_completion()
+        batch.writer.flush()
 
-    ## Handles writing of the results to the database
+    ## Handles writing of the results to the database. When the server reported its path frequencies, the block's
+    #  path coverage comes from those instead of being recomputed from the database.
     def _handle_completion(self):
-        session = db.getSession()
-
-        record = RunBlock(
-            self.target_slug,
-            self.started,
-            self.runs_counted,
-            self.crash_counter,
-            self.run_dict["bkt"],
-            self.run_dict["scr"],
-            self.run_dict["rem"],
+        coverage = None
+        if self.run_dict.get("paths") is not None:
+            coverage = (
+                self.run_dict["paths"],
+                PathRecord.chao1_path_coverage(
+                    self.run_dict["paths"], self.run_dict["runs"], self.run_dict["f1"], self.run_dict["f2"]
+                ),
+            )
+
+        batch.writer.block_complete(
+            coverage=coverage,
+            target_slug=self.target_slug,
+            started=self.started,
+            runs=self.runs_counted,
+            crashes=self.crash_counter,
+            bucketing=self.run_dict["bkt"],
+            score=self.run_dict["scr"],
+            num_tries_remaining=self.run_dict["rem"],
         )
 
-        session.add(record)
-        session.commit()
-
     ## Resets the session manager back to its original state
     def _reset(self):
         self.runs_counted = 0
@@ -110,11 +119,11 @@ class SessionManager(object):
     def run_complete(self, run, found_crash=False):
         self.run_dict = run.coverage if run.coverage is not None else {"hash": None, "bkt": False, "scr": -1, "rem": -1}
         self.runs_counted += 1
-        if self.run_dict["hash"]:
-            PathRecord.incrementPath(self.run_dict["hash"], self.target_slug)
         if found_crash:
             self.crash_counter += 1
 
         if self.runs_counted == self.block_size:
             self._handle_completion()
             self._reset()
+
+        batch.writer.run_complete(self.target_slug, self.run_dict["hash"])
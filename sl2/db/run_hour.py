@@ -0,0 +1,112 @@
+############################################################################
+## @package run_hour
+# run_hour.py
+#
+# Per-hour tallies of a target's run blocks, kept up to date as the blocks are written out, so that the
+# report doesn't have to read every run block of a campaign.
+
+import datetime
+
+from sqlalchemy import *
+from sqlalchemy.dialects.sqlite import insert
+
+from .base import Base
+from .run_block import RunBlock
+
+
+## @param when A timestamp
+# @return the start of its hour
+def hour_of(when):
+    return when.replace(minute=0, second=0, microsecond=0)
+
+
+## class RunHour
+# One row per (target, hour): the runs, crashes and fuzzing time of the blocks that ended in it, and the path
+# stats of the last of them
+class RunHour(Base):
+    __tablename__ = "run_hours"
+    __table_args__ = (UniqueConstraint("target_config_slug", "hour"),)
+
+    id = Column(Integer, primary_key=True)
+    ## Slug of the target that the blocks are for
+    target_config_slug = Column(String, ForeignKey("targets.target_slug"))
+    ## Start of the hour
+    hour = Column(DateTime)
+    ## Number of run blocks that ended in the hour
+    blocks = Column(Integer, default=0)
+    ## Number of runs in those blocks
+    runs = Column(Integer, default=0)
+    ## Number of crashes found in those blocks
+    crashes = Column(Integer, default=0)
+    ## Seconds spent fuzzing in those blocks
+    cpu_seconds = Column(Float, default=0.0)
+    ## Number of unique paths at the end of the hour's last block
+    num_paths = Column(Integer)
+    ## Estimated path coverage at the end of the hour's last block
+    path_coverage = Column(Numeric)
+
+    ## Counts a finished run block against its hour. Should be called in the same transaction that adds the block.
+    # @param session Database session
+    # @param slug Target config slug
+    # @param started When the block started
+    # @param ended When the block ended
+    # @param runs Number of runs in the block
+    # @param crashes Number of crashes found in the block
+    # @param coverage (num_paths, path_coverage) at the end of the block
+    @staticmethod
+    def record(session, slug, started, ended, runs, crashes, coverage):
+        table = RunHour.__table__
+        stmt = insert(table)
+        stmt = stmt.on_conflict_do_update(
+            index_elements=["target_config_slug", "hour"],
+            set_={
+                "blocks": table.c["blocks"] + 1,
+                "runs": table.c["runs"] + stmt.excluded["runs"],
+                "crashes": table.c["crashes"] + stmt.excluded["crashes"],
+                "cpu_seconds": table.c["cpu_seconds"] + stmt.excluded["cpu_seconds"],
+                "num_paths": stmt.excluded["num_paths"],
+                "path_coverage": stmt.excluded["path_coverage"],
+            },
+        )
+        session.execute(
+            stmt,
+            {
+                "target_config_slug": slug,
+                "hour": hour_of(ended),
+                "blocks": 1,
+                "runs": runs,
+                "crashes": crashes,
+                "cpu_seconds": (ended - started).total_seconds(),
+                "num_paths": coverage[0],
+                "path_coverage": float(coverage[1] or 0),
+            },
+        )
+
+    ## Builds a target's hours from its run blocks, for databases that have blocks from before the hours were kept.
+    # Does nothing once the target has any hours.
+    # @param session Database session
+    # @param slug Target config slug
+    @staticmethod
+    def backfill(session, slug):
+        if session.query(RunHour.id).filter(RunHour.target_config_slug == slug).first():
+            return
+
+        blocks = session.query(RunBlock).filter(RunBlock.target_config_slug == slug).order_by(RunBlock.ended).all()
+        for block in blocks:
+            coverage = (block.num_paths, block.path_coverage)
+            RunHour.record(session, slug, block.started, block.ended, block.runs, block.crashes, coverage)
+
+        session.commit()
+
+    ## @param session Database session
+    # @param slug Target config slug
+    # @return the target's hours, oldest first
+    @staticmethod
+    def hours(session, slug):
+        return session.query(RunHour).filter(RunHour.target_config_slug == slug).order_by(RunHour.hour).all()
+
+    ## @param hours A target's hours (see RunHour.hours)
+    # @return the latest of them, which the report's charts are rendered for
+    @staticmethod
+    def window(hours):
+        return hours[-1].hour if hours else datetime.datetime.utcfromtimestamp(0)
@@ -181,11 +181,23 @@ class Tracer(Base):
     ## Result of the `tainted_dst` check performed by the tracer -- Indicates whether the dst of a memory r/w is tainted
     tainted_dst = Column(Boolean)
 
+    ## Every overhead counter that the tracer reported, including per-module instruction counts
+    stats = Column(PickleType)
+    ## The number of propagation clean calls that the tracer executed
+    clean_calls = Column(Integer)
+    ## The number of those clean calls that had taint to propagate
+    propagated = Column(Integer)
+    ## How long the tracer ran for, in milliseconds
+    elapsed_ms = Column(Integer)
+    ## How much of that was spent propagating taint, in milliseconds (summed across threads)
+    propagation_ms = Column(Integer)
+
     ## Constructor for a Tracer object
     # @param runid Run ID of tracer run
     # @param formatted String formatting results
     # @param rawJson json object used for pickling
-    def __init__(self, runid, formatted, rawJson):
+    # @param stats Overhead counters from the tracer's exit event (see instrument.tracer_run)
+    def __init__(self, runid, formatted, rawJson, stats=None):
         self.runid = runid
         self.formatted = formatted
         self.addrs = rawJson["tainted_addrs"]  # TODO - record memory map so these are actually useful
@@ -224,12 +236,19 @@ class Tracer(Base):
         self.tainted_src = rawJson["tainted_src"]
         self.tainted_dst = rawJson["tainted_dst"]
 
+        self.stats = stats or {}
+        self.clean_calls = self.stats.get("clean_calls")
+        self.propagated = self.stats.get("propagated")
+        self.elapsed_ms = self.stats.get("elapsed_ms")
+        self.propagation_ms = self.stats.get("propagation_ms")
+
     ## Factory for create or retrieving tracer object from db
     # @param runid Runid of the tracer run
     # @param formatted String summary of tracer run
     # @param raw json object
+    # @param stats Overhead counters from the tracer's exit event
     @staticmethod
-    def factory(runid, formatted=None, raw=None):
+    def factory(runid, formatted=None, raw=None, stats=None):
         runid = str(runid)
         session = db.getSession()
         ret = session.query(Tracer).filter(Tracer.runid == runid).first()
@@ -240,7 +259,7 @@ class Tracer(Base):
             print("Could not find tracer for runid ", runid)
             return None
 
-        ret = Tracer(runid, formatted, raw)
+        ret = Tracer(runid, formatted, raw, stats)
 
         session.add(ret)
         session.commit()
@@ -0,0 +1,129 @@
+## @package triage_cache
+#
+# Caches the triager's findings for a minidump, so that re-triaging a run (from the GUI, from a
+# report, or when an archived campaign is loaded into a new database) doesn't run the triager again
+# when nothing that it looks at has changed.
+#
+# The cache lives next to the minidump, and is keyed by a hash of the minidump, the tracer's
+# crash records (which the triager ranks with) and the triager executable itself. A global index maps
+# each key to the cache that holds it, so that copies of a minidump elsewhere reuse it too.
+
+import glob
+import hashlib
+import json
+import os
+import threading
+
+from sl2.harness import config
+
+## File name of the triage cache (next to the minidump)
+TRIAGE_CACHE_FILE = "triage_cache.json"
+
+## Path to the global index of triage caches, by key
+TRIAGE_INDEX_PATH = os.path.join(config.sl2_dir, "triage_index.json")
+
+## Bumped whenever the cache's contents change incompatibly
+TRIAGE_CACHE_VERSION = 1
+
+## Guards the global index between harness workers
+_index_lock = threading.Lock()
+
+
+## @param hasher The hash to update
+# @param path Path to a file to hash into it, if it exists
+def _hash_into(hasher, path):
+    try:
+        with open(path, "rb") as f:
+            for chunk in iter(lambda: f.read(1024 * 1024), b""):
+                hasher.update(chunk)
+    except FileNotFoundError:
+        hasher.update(b"\0")
+
+
+## Hashes everything that a triage of a minidump depends on
+# @param dmpPath Path to the minidump
+# @return hex digest
+def cache_key(dmpPath):
+    hasher = hashlib.sha256()
+
+    hasher.update(str(TRIAGE_CACHE_VERSION).encode("utf-8"))
+    _hash_into(hasher, config.config["triager_path"])
+    _hash_into(hasher, dmpPath)
+    for record in sorted(glob.glob(os.path.join(os.path.dirname(dmpPath), "crash.*.sl2c"))):
+        _hash_into(hasher, record)
+
+    return hasher.hexdigest()
+
+
+## @param cache_path Path to a triage cache
+# @param key The key that it must be for
+# @return the cached triage, or None if it's missing or for another key
+def _read(cache_path, key):
+    try:
+        with open(cache_path, "r") as cache_file:
+            cache = json.load(cache_file)
+
+        if cache["version"] != TRIAGE_CACHE_VERSION or cache["key"] != key:
+            return None
+
+        return cache["triage"]
+    except (OSError, ValueError, KeyError, TypeError):
+        return None
+
+
+## @return the global index, or an empty one if there isn't one yet
+def _read_index():
+    try:
+        with open(TRIAGE_INDEX_PATH, "r") as index_file:
+            return json.load(index_file)
+    except (OSError, ValueError):
+        return {}
+
+
+## Loads the cached triage of a minidump, if it's still valid. A copy of the minidump that was
+# triaged elsewhere is found through the global index, and cached next to this one.
+# @param dmpPath Path to the minidump
+# @return the triager's JSON, or None if there's no valid cache
+def load(dmpPath):
+    key = cache_key(dmpPath)
+    j = _read(os.path.join(os.path.dirname(dmpPath), TRIAGE_CACHE_FILE), key)
+    if j:
+        return j
+
+    with _index_lock:
+        cache_path = _read_index().get(key)
+
+    if not cache_path:
+        return None
+
+    j = _read(cache_path, key)
+    if j:
+        j["minidumpPath"] = dmpPath
+        store(dmpPath, j, key)
+
+    return j
+
+
+## Caches the triage of a minidump, and adds it to the global index
+# @param dmpPath Path to the minidump
+# @param j The triager's JSON. Duplicates (from a quick triage) shouldn't be cached, since what
+#          they're missing depends on the database.
+# @param key The minidump's cache_key, if it's already known
+def store(dmpPath, j, key=None):
+    key = key or cache_key(dmpPath)
+    cache_path = os.path.join(os.path.dirname(dmpPath), TRIAGE_CACHE_FILE)
+    cache = {"version": TRIAGE_CACHE_VERSION, "key": key, "triage": j}
+
+    with open(cache_path, "w") as cache_file:
+        json.dump(cache, cache_file)
+
+    # The index is replaced rather than rewritten in place, so that a harness that dies
+    # halfway through doesn't leave a torn one behind.
+    with _index_lock:
+        index = _read_index()
+        index[key] = cache_path
+
+        tmp_path = "{}.{}.tmp".format(TRIAGE_INDEX_PATH, os.getpid())
+        with open(tmp_path, "w") as index_file:
+            json.dump(index, index_file)
+        os.replace(tmp_path, TRIAGE_INDEX_PATH)
@@ -4,10 +4,14 @@
 
 import os
 import glob
+import json
 import re
+import threading
 from hashlib import sha256
-from functools import lru_cache
+from sl2.harness import archive
 from sl2.harness import config
+from sl2.harness import dumps
+from sl2.harness import retention
 
 
 ## Converts the full path to an sl2 minidump to a runid
@@ -23,23 +27,52 @@ def dumpPathToRunid(dmpPath):
 
 ## Converts an sl2 runid into a minidump path
 # @param runid Runid for the crash
-# @return string path to minidump file
+# @return string path to minidump file, which is a duplicate crash's stand-in if its own was dropped (see
+# retention.py). A dump that the server is still writing is waited for (see dumps.py).
 def runidToDumpPath(runid):
     dumpPath = None
     cfg = config
 
+    archive.restore_run(runid)
+    dumps.wait_for_dump(runid, grace=0)
     dumpsGlob = os.path.join(cfg.sl2_runs_dir, runid, "initial.*.dmp")
     for dumpPath in glob.glob(dumpsGlob):
         return dumpPath
 
-    return dumpPath
+    return retention.reference_dump(runid, "initial.*.dmp")
 
 
-## Takes the sha256 hash of a file
+## Path to the index of file hashes, so that unchanged binaries aren't re-hashed every session
+FILE_HASHES_PATH = os.path.join(config.sl2_dir, "file_hashes.json")
+
+## Path -> [size, mtime, hash], loaded from FILE_HASHES_PATH the first time it's needed
+_file_hashes = None
+_file_hashes_lock = threading.Lock()
+
+
+## Takes the sha256 hash of a file. Hashes are remembered by path, and only recomputed once the file's
+#  size or modification time changes.
 #  @param filename: str -- Path to the file
 #  @return str -- hex-encoded SHA256 hash
-@lru_cache()
 def hash_file(filename: str):
+    global _file_hashes
+
+    stat = os.stat(filename)
+    key = os.path.normcase(os.path.abspath(filename))
+    stamp = [stat.st_size, stat.st_mtime_ns]
+
+    with _file_hashes_lock:
+        if _file_hashes is None:
+            try:
+                with open(FILE_HASHES_PATH, "r") as hashes_file:
+                    _file_hashes = json.load(hashes_file)
+            except (OSError, ValueError):
+                _file_hashes = {}
+
+        cached = _file_hashes.get(key)
+        if cached and cached[:2] == stamp:
+            return cached[2]
+
     m = sha256()
     with open(filename, "rb") as f:
         while True:
@@ -47,4 +80,15 @@ def hash_file(filename: str):
             if not data:
                 break
             m.update(data)
-    return m.hexdigest()
+    digest = m.hexdigest()
+
+    # Like the triage index, the file is replaced rather than rewritten in place.
+    with _file_hashes_lock:
+        _file_hashes[key] = stamp + [digest]
+
+        tmp_path = "{}.{}.tmp".format(FILE_HASHES_PATH, os.getpid())
+        with open(tmp_path, "w") as hashes_file:
+            json.dump(_file_hashes, hashes_file)
+        os.replace(tmp_path, FILE_HASHES_PATH)
+
+    return digest
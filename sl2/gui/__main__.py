@@ -14,7 +14,14 @@ from sqlalchemy import desc
 
 from sl2 import db
 from sl2.harness import config
-from sl2.harness.state import sanity_checks, get_target, export_crash_data_to_csv, get_target_slug, TriageExport
+from sl2.harness.state import (
+    sanity_checks,
+    get_target,
+    export_crash_data_to_csv,
+    get_target_slug,
+    target_modules,
+    TriageExport,
+)
 from sl2.harness.threads import ChecksecThread, WizardThread, FuzzerThread, ServerThread
 from sl2.reporting.__main__ import generate_report
 
@@ -60,7 +67,7 @@ class MainWindow(QtWidgets.QMainWindow):
 
         # Set up Checksec, Wizard and Server threads so we don't block the UI
         # when they're running
-        self.checksec_thread = ChecksecThread(config.config["target_application_path"])
+        self.checksec_thread = ChecksecThread(config.config["target_application_path"], target_modules(config.config))
         self.wizard_thread = WizardThread(config.config)
         self.server_thread = ServerThread(close_on_exit=True)
 
@@ -218,6 +225,7 @@ class MainWindow(QtWidgets.QMainWindow):
                 ("Exploitability", db.Crash.exploitability, "exploitability", {}),
                 ("Ranks", db.Crash.ranksString, "ranksString", {}),
                 ("Crashash", db.Crash.crashash, "crashash", {}),
+                ("Bucket", db.Crash.bucket, "bucket", {}),
                 ("Crash Address", db.Crash.crashAddressString, "crashAddressString", {}),
                 ("RIP", db.Crash.instructionPointerString, "instructionPointerString", {}),
                 ("RSP", db.Crash.stackPointerString, "stackPointerString", {}),
@@ -425,8 +433,9 @@ class MainWindow(QtWidgets.QMainWindow):
     ## Signal handler that automatically retrieves data for a new crash whenver one is found
     def handle_new_crash(self, thread, run_id):
         """ Updates the crash counter and pauses other threads if specified """
-        self.crashes_model.update()
-        self.crashes_table.resizeColumnsToContents()
+        # The triage queue has already recorded the crash, so only its row (and any others since) is queried
+        if self.crashes_model.fetch_new():
+            self.crashes_table.resizeColumnsToContents()
         self.stats_widget.update()
         self.crash_counter.increment()
         crash = db.Crash.factory(run_id, get_target_slug(config.config))
@@ -466,6 +475,7 @@ class MainWindow(QtWidgets.QMainWindow):
                 "Calling Module",
                 # "Return Address",
                 "Targeting Mode",
+                "Influence",
             ]
         )
 
@@ -479,6 +489,10 @@ class MainWindow(QtWidgets.QMainWindow):
             "Which part of the program called this function. .exe modules are generally the most promising"
         )
         self.model.horizontalHeaderItem(5).setToolTip("How we re-identify whether we're calling this function again")
+        self.model.horizontalHeaderItem(6).setToolTip(
+            "How many basic blocks ran for the first time after this call, before the next one (with "
+            "--wizard_influence). Calls that much new code follows are the most promising targets"
+        )
 
         for index, option in enumerate(self.target_data):
             funcname_widget = CheckboxTreeWidgetItem(self._func_tree, index, "{func_name}".format(**option))
@@ -526,6 +540,13 @@ class MainWindow(QtWidgets.QMainWindow):
             mode_widget.setData(index, role=Qt.UserRole + 1)
             mode_widget.setData(QBrush(QColor(0, 0, 0, 16)), role=Qt.BackgroundRole)
 
+            # The influence is kept as a number, so that the column sorts numerically.
+            influence_widget = QStandardItem()
+            influence_widget.setEditable(False)
+            if "influenceBlocks" in option:
+                influence_widget.setData(option["influenceBlocks"], role=Qt.DisplayRole)
+                influence_widget.setToolTip("{influenceBranches} conditional branches".format(**option))
+
             self.model.appendRow(
                 [
                     funcname_widget,
@@ -535,6 +556,7 @@ class MainWindow(QtWidgets.QMainWindow):
                     mod_widget,
                     # addr_widget,
                     mode_widget,
+                    influence_widget,
                 ]
             )
             # self._func_tree.edit(self.model.indexFromItem(mode_widget))
@@ -545,7 +567,11 @@ class MainWindow(QtWidgets.QMainWindow):
         self._func_tree.resizeColumnToContents(2)
         self._func_tree.resizeColumnToContents(3)
 
-        self._func_tree.sortByColumn(3, Qt.AscendingOrder)
+        # Rank the findings by their influence, if the wizard measured it.
+        if any("influenceBlocks" in option for option in self.target_data):
+            self._func_tree.sortByColumn(6, Qt.DescendingOrder)
+        else:
+            self._func_tree.sortByColumn(3, Qt.AscendingOrder)
         self._func_tree.setSortingEnabled(True)
 
     ## Signal handler that updates the target file on the disk whenever a checkbox in the tree is clicked
@@ -648,7 +674,7 @@ class MainWindow(QtWidgets.QMainWindow):
             return
 
         exporter = TriageExport(path, get_target_slug(config.config))
-        num_crashes = len(exporter.get_crashes())
+        num_crashes = exporter.count_crashes()
 
         print("Exporting {} crashes".format(num_crashes))
 
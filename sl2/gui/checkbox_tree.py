@@ -27,7 +27,8 @@ class ComboboxTreeItemDelegate(QStyledItemDelegate):
     ## Create the combobox and fill it with labels
     def createEditor(self, parent, option, index):
         self.combobox = QComboBox(parent)
-        for sft in [4, 5, 6]:
+        # Return Address is what the wizard picks for calls that are alone at their call site.
+        for sft in [1, 4, 5, 6]:
             self.combobox.addItem(mode_labels[1 << sft], 1 << sft)
 
         return self.combobox
@@ -1,14 +1,21 @@
 ############################################################################
 ## @package sqlalchemy_model
 #
-from PySide2.QtCore import Qt
+from PySide2.QtCore import Qt, QModelIndex
 from PySide2.QtSql import QSqlTableModel
 
 
+## How many rows are loaded at a time, as the view scrolls down to them
+PAGE_SIZE = 256
+
+
 ## class SqlalchemyModel
 # Sqlalchemy to QT Table adapter
 # Acts as a model of a sqlalchemy object to a QSqlTableModel.  Allows for sorting,
 # column headers
+# Rows are loaded a page at a time (see fetchMore), and rows that are added to the table afterwards are
+# picked up by fetch_new without re-querying the ones that are already loaded. New rows go at the top, so
+# orderBy should put the newest rows first.
 class SqlalchemyModel(QSqlTableModel):
 
     ## Constructor for the model
@@ -41,7 +48,14 @@ class SqlalchemyModel(QSqlTableModel):
         self.session = session
         self.table_colmn = table_colmn
         self.cols = cols
-        self.rows = None
+        self.rows = []
+        ## Highest primary key loaded so far; fetch_new only asks for rows past it
+        self.last_id = 0
+        ## Highest primary key when the rows were first queried; pages only cover rows up to it
+        self.paged_id = 0
+        ## How many of the rows came from pages
+        self.paged = 0
+        self.exhausted = False
         # sort is (column, order )
         self.sort = sort
         self.orderBy = orderBy
@@ -67,12 +81,77 @@ class SqlalchemyModel(QSqlTableModel):
     def flags(self, i):
         return Qt.ItemIsEnabled | Qt.ItemIsSelectable
 
-    ## Updates table
-    def update(self):
-        self.layoutAboutToBeChanged.emit()
+    ## @return a query for the table's rows, before ordering
+    def query(self):
+        return self.session.query(self.table_colmn).filter_by(**self.filters)
 
-        self.rows = self.session.query(self.table_colmn).filter_by(**self.filters).order_by(self.orderBy).all()
-        self.layoutChanged.emit()
+    ## Reloads the table from scratch, starting over with its first page
+    def update(self):
+        self.beginResetModel()
+
+        newest = self.query().order_by(self.table_colmn.id.desc()).first()
+        self.last_id = self.paged_id = newest.id if newest else 0
+        self.rows = []
+        self.paged = 0
+        self.exhausted = False
+        self.load_page()
+
+        self.endResetModel()
+
+    ## Appends the next page of rows (those that were in the table when it was loaded)
+    # @return the rows
+    def load_page(self):
+        page = (
+            self.query()
+            .filter(self.table_colmn.id <= self.paged_id)
+            .order_by(self.orderBy)
+            .offset(self.paged)
+            .limit(PAGE_SIZE)
+            .all()
+        )
+
+        self.rows.extend(page)
+        self.paged += len(page)
+        self.exhausted = len(page) < PAGE_SIZE
+        return page
+
+    ## Whether there are rows left to page in
+    # @param parent parent index
+    def canFetchMore(self, parent):
+        return not parent.isValid() and not self.exhausted
+
+    ## Pages in more rows, as the view scrolls down to them
+    # @param parent parent index
+    def fetchMore(self, parent):
+        if not self.canFetchMore(parent):
+            return
+
+        # Qt wants to know which rows are coming before they're there, so the page is queried
+        # first and only shown once it's been counted.
+        start = len(self.rows)
+        page = self.load_page()
+        if not page:
+            return
+
+        self.rows, loaded = self.rows[:start], self.rows[start:]
+        self.beginInsertRows(QModelIndex(), start, start + len(loaded) - 1)
+        self.rows.extend(loaded)
+        self.endInsertRows()
+
+    ## Picks up the rows that were added since the table was last loaded, and puts them at the top. Called
+    # whenever a fuzzing thread reports a new crash, instead of reloading the whole table.
+    # @return how many rows were added
+    def fetch_new(self):
+        new = self.query().filter(self.table_colmn.id > self.last_id).order_by(self.orderBy).all()
+        if not new:
+            return 0
+
+        self.beginInsertRows(QModelIndex(), 0, len(new) - 1)
+        self.rows[:0] = new
+        self.last_id = max(row.id for row in new)
+        self.endInsertRows()
+
+        return len(new)
 
     ## Return number of rows
     # @param parent parent window
@@ -1,10 +1,13 @@
 ## @package stats
 
+import os
 import statistics
+import time
 
-from PySide2 import QtWidgets
+from PySide2 import QtCore, QtWidgets
 
-from sl2.db import Crash, getSession
+from sl2.db import Crash, CrashBucket, getSession
+from sl2.harness import config, live_stats, series, telemetry
 
 
 ## class StatsWidget
@@ -18,11 +21,23 @@ class StatsWidget(QtWidgets.QWidget):
         self.web = QtWidgets.QTextBrowser()
         self.web.setOpenExternalLinks(True)
         self.web.setOpenLinks(True)
+        # The live stats get their own label, so that refreshing them doesn't reset the browser's scroll.
+        self.live = QtWidgets.QLabel()
+        self.live.setTextFormat(QtCore.Qt.RichText)
+        self.layout.addWidget(self.live)
         self.layout.addWidget(self.web)
         self.setLayout(self.layout)
         self.target_slug = target_slug
 
+        self.liveStats = None
+        self.arenaId = None
+        self.lastRuns = None
+        self.liveTimer = QtCore.QTimer(self)
+        self.liveTimer.timeout.connect(self.updateLive)
+        self.liveTimer.start(live_stats.POLL_MS)
+
         self.update()
+        self.updateLive()
 
     ## Returns html string representation of object with # crashes, unique & duplicate crashes, and exploitability stats
     def toHTML(self):  # TODO - switch this to use Jinja
@@ -48,6 +63,8 @@ class StatsWidget(QtWidgets.QWidget):
         <tr> <td class="haupt">Unknown Exploitability</td> <td>%d</td></tr>
         <tr> <td class="haupt">None Exploitability</td> <td>%d</td></tr>
     </table>
+    %s
+    %s
 </html>
         """ % (
             self.crashesCnt,
@@ -60,8 +77,130 @@ class StatsWidget(QtWidgets.QWidget):
             self.exploitabilityCnts["Low"],
             self.exploitabilityCnts["Unknown"],
             self.exploitabilityCnts["None"],
+            self.telemetryHTML(),
+            self.seriesHTML(),
+        )
+
+    ## Returns html string representation of the target's execution rate, and where its runs spend their time
+    def telemetryHTML(self):
+        summary = telemetry.load(os.path.join(config.sl2_targets_dir, self.target_slug))
+        if summary is None:
+            return ""
+
+        rows = ""
+        for stage in telemetry.STAGES:
+            if stage in summary["stages"]:
+                stats = summary["stages"][stage]
+                rows += "<tr> <td class=\"haupt\">%s</td> <td>%0.1f</td> <td>%0.1f</td> <td>%0.1f</td> </tr>" % (
+                    stage,
+                    stats["p50_ms"],
+                    stats["p90_ms"],
+                    stats["p99_ms"],
+                )
+
+        return """
+    <table width="1024px">
+        <tr> <td class="heading">Execs/sec</td> <td class="heading">%0.2f</td> <td></td> <td></td> </tr>
+        <tr> <td class="heading">Stage</td> <td class="heading">p50 (ms)</td>
+             <td class="heading">p90 (ms)</td> <td class="heading">p99 (ms)</td> </tr>
+        %s
+    </table>
+        """ % (
+            summary["execs_per_sec"],
+            rows,
         )
 
+    ## Returns html string representation of the server's time series for the target: its recent and lifetime
+    # totals, read straight from the series file
+    def seriesHTML(self):
+        samples = series.target_series(os.path.join(config.sl2_targets_dir, self.target_slug))
+        if not samples:
+            return ""
+
+        rows = ""
+        summaries = (("Last hour", series.summarize(samples, 3600)), ("All samples", series.summarize(samples)))
+        for name, summary in summaries:
+            rows += "<tr> <td class=\"haupt\">%s</td> <td>%d</td> <td>%d</td> <td>%d</td> <td>%0.1f</td> </tr>" % (
+                name,
+                summary["execs"],
+                summary["new_cells"],
+                summary["crashes"],
+                summary["mean_exec_us"] / 1000,
+            )
+
+        return """
+    <table width="1024px">
+        <tr> <td class="heading">Unique paths</td> <td class="heading">%d</td> <td class="heading">Score</td>
+             <td class="heading">%d</td> <td></td> </tr>
+        <tr> <td class="heading">Window</td> <td class="heading">Runs</td> <td class="heading">New cells</td>
+             <td class="heading">Crashes</td> <td class="heading">Mean run (ms)</td> </tr>
+        %s
+    </table>
+        """ % (
+            samples[-1].paths,
+            samples[-1].score,
+            rows,
+        )
+
+    ## Returns html string representation of the server's live stats for the target's arena
+    # @param stats The server's live stats
+    # @param arena The arena's totals in them
+    # @param execs_per_sec The arena's runs per second since it was last seen to change, or None until it has
+    def liveHTML(self, stats, arena, execs_per_sec):
+        return """
+<html>
+    <head>
+        <style>
+            td      {  padding-left: 15px; }
+            .heading  {  font-weight: bold; background-color: #dddddd }
+        </style>
+    </head>
+    <table width="1024px">
+        <tr> <td class="heading">Live</td> <td class="heading">Runs</td> <td class="heading">Execs/sec</td>
+             <td class="heading">Crashes</td> <td class="heading">New cells</td> <td class="heading">Paths</td>
+             <td class="heading">Corpus</td> <td class="heading">Score</td> <td class="heading">Mean run (ms)</td>
+             <td class="heading">Connections</td> </tr>
+        <tr> <td></td> <td>%d</td> <td>%s</td> <td>%d</td> <td>%d</td> <td>%d</td> <td>%d</td> <td>%d</td>
+             <td>%0.1f</td> <td>%d</td> </tr>
+    </table>
+</html>
+        """ % (
+            arena.execs,
+            "%0.2f" % execs_per_sec if execs_per_sec is not None else "-",
+            arena.crashes,
+            arena.new_cells,
+            arena.paths,
+            arena.corpus,
+            arena.score,
+            arena.mean_exec_us / 1000,
+            stats.active_connections,
+        )
+
+    ## Rereads the server's live stats and updates their label. Doesn't touch the database.
+    def updateLive(self):
+        if self.liveStats is None or not self.liveStats.mapped():
+            # The server (or the target's arena) may not be up yet; keep trying on each poll.
+            if self.liveStats is not None:
+                self.liveStats.close()
+            target_dir = os.path.join(config.sl2_targets_dir, self.target_slug)
+            self.liveStats, self.arenaId = live_stats.open_target(target_dir)
+
+        stats = self.liveStats.read() if self.liveStats is not None else None
+        arena = live_stats.arena_stats(stats, self.arenaId) if stats is not None else None
+        if arena is None:
+            self.live.setText("")
+            self.lastRuns = None
+            return
+
+        # The server only publishes whole seconds, so the rate is timed here instead.
+        now = time.monotonic()
+        if self.lastRuns is None:
+            self.lastRuns = (now, arena.execs, None)
+        elif arena.execs != self.lastRuns[1] and now - self.lastRuns[0] >= 1:
+            self.lastRuns = (now, arena.execs, (arena.execs - self.lastRuns[1]) / (now - self.lastRuns[0]))
+
+        self.live.setText(self.liveHTML(stats, arena, self.lastRuns[2]))
+
     ## Requeries the database and updates the table
     def update(self):
         # create a query for the current target
@@ -80,7 +219,7 @@ class StatsWidget(QtWidgets.QWidget):
 
         # if there are crashes, update the rest of the counters
         if self.crashesCnt > 0:
-            self.uniquesCnt = basequery.distinct(Crash.crashash).group_by(Crash.crashash).count()
+            self.uniquesCnt = CrashBucket.unique_count(session, self.target_slug)
             self.dupesCount = self.crashesCnt - self.uniquesCnt
             self.ranks = [_.rank for _ in self.crashes]
             self.ranksMean = statistics.mean(self.ranks)
@@ -8,14 +8,46 @@ Imports harness/instrument.py for running DynamoRIO instrumentation clients.
 
 import atexit
 import concurrent.futures
+import contextlib
 import os
 import signal
 import sys
 
 import msgpack
 
-from .config import config
-from .instrument import print_l, wizard_run, fuzzer_run, tracer_run, start_server, fuzz_and_triage, kill
+from .config import config, server_mutex_name
+from .instrument import (
+    print_l,
+    perror,
+    wizard_run,
+    fuzzer_run,
+    tracer_run,
+    start_server,
+    server_instances,
+    server_stats,
+    set_server_log_level,
+    get_campaign_config,
+    set_campaign_config,
+    SL2_SCHEDULERS,
+    target_server_instance,
+    fuzz_and_triage,
+    start_triage_queue,
+    supervised_fuzz_and_triage,
+    scheduled_fuzz_and_triage,
+    kill,
+    Mode,
+)
+from . import telemetry
+from . import bench
+from . import named_mutex
+from .calibrate import calibrate
+from .cmin import build_cmplog, minimize_corpus
+from .corpus_import import import_corpus
+from .overhead import measure_overhead
+from .regress import regress
+from .tmin import minimize_crash
+from .scheduler import TargetScheduler, targets_from_disk
+from .target_index import write_target_index
 from .state import sanity_checks, get_target_dir, get_all_targets, get_runs, stringify_program_array
 
 
@@ -25,6 +57,7 @@ def goodbye():
     # We use os._exit instead of sys.exit here to make sure that we totally
     # kill the harness, even when inside of the non-main thread.
     kill()
+    telemetry.save_all()
     os._exit(0)
 
 
@@ -65,11 +98,19 @@ def select_and_dump_wizard_findings(wizard_findings, target_file):
         pass
     else:
         print_l("Functions found:")
-        for i, finding in enumerate(wizard_findings):
+
+        # With --wizard_influence, list the findings that the most new code ran after first.
+        order = sorted(range(len(wizard_findings)), key=lambda i: -wizard_findings[i].get("influenceBlocks", 0))
+
+        for i in order:
+            finding = wizard_findings[i]
+            mode = Mode(finding["mode"]).name
+            if "influenceBlocks" in finding:
+                mode += ", influence: {influenceBlocks} blocks, {influenceBranches} branches".format(**finding)
             if "source" in finding:
-                print_l("{}) {func_name} from {source}:{start}-{end}".format(i, **finding))
+                print_l("{}) {func_name} from {source}:{start}-{end} ({})".format(i, mode, **finding))
             else:
-                print_l("{}) {func_name}".format(i, **finding))
+                print_l("{}) {func_name} ({})".format(i, mode, **finding))
             buffer = bytearray(finding["buffer"])
             hexdump(buffer)
 
@@ -81,6 +122,7 @@ def select_and_dump_wizard_findings(wizard_findings, target_file):
         msgpack.dump(wizard_findings, msg_file)
     with open(target_file, "wb") as msg_file:
         msgpack.dump(list(filter(lambda k: k["selected"], wizard_findings)), msg_file)
+    write_target_index(target_file, list(filter(lambda k: k["selected"], wizard_findings)))
 
     return wizard_findings
 
@@ -97,16 +139,204 @@ def hexdump(buffer, lines=4, line_len=16):
         print_l("%08X:  %s  | %s" % (address, hexstr + " " * (line_len * 3 - len(hexstr)), asciistr))
 
 
+## Print the running server's per-event statistics
+# @param instance The server instance to ask, or None for the default instance
+def print_server_stats(instance=None):
+    active_connections, events, (path_runs, paths) = server_stats(instance)
+
+    if instance:
+        print_l("instance: {}".format(instance))
+    print_l("active connections: {}".format(active_connections))
+    print_l("paths: {} in {} runs".format(paths, path_runs))
+    print_l("{:<20} {:>10} {:>10} {:>10} {:>10} {:>14} {:>14}".format(
+        "event", "count", "p50 (us)", "p99 (us)", "max (us)", "lock wait (us)", "bytes"
+    ))
+    for name, stats in events.items():
+        print_l("{:<20} {count:>10} {p50_us:>10} {p99_us:>10} {max_us:>10} {lock_wait_us:>14} {bytes:>14}".format(
+            name, **stats
+        ))
+
+
+## Fuzz every target that has a targets file, sharing the workers between them (see scheduler.py)
+def schedule_targets():
+    targets = targets_from_disk(config)
+    if not targets:
+        print_l("[!] No targets to schedule: run the wizard on at least one target first")
+        return
+
+    scheduler = TargetScheduler(targets, None if config["continuous"] else config["runs"])
+    workers = config["simultaneous"] if config["continuous"] else min(config["simultaneous"], config["runs"])
+
+    with contextlib.ExitStack() as stack:
+        for target in targets:
+            target.queue = stack.enter_context(start_triage_queue(target.config_dict))
+
+        with concurrent.futures.ThreadPoolExecutor(max_workers=workers) as executor:
+            fuzz_futures = [executor.submit(scheduled_fuzz_and_triage, scheduler) for _ in range(workers)]
+            concurrent.futures.wait(fuzz_futures)
+
+    for line in scheduler.summary():
+        print_l(line)
+
+
+## Print the target's recent execution rate and per-stage latencies (see telemetry.py)
+def print_stats():
+    summary = telemetry.load(get_target_dir(config))
+    if summary is None:
+        print_l("[!] No telemetry for this target yet: fuzz it first")
+        return
+
+    print_l("runs: {runs}  execs/sec: {execs_per_sec:.2f}".format(**summary))
+    print_l("{:<16} {:>8} {:>10} {:>10} {:>10} {:>10}".format(
+        "stage", "count", "p50 (ms)", "p90 (ms)", "p99 (ms)", "mean (ms)"
+    ))
+    for stage in telemetry.STAGES:
+        if stage in summary["stages"]:
+            print_l("{:<16} {count:>8} {p50_ms:>10.1f} {p90_ms:>10.1f} {p99_ms:>10.1f} {mean_ms:>10.1f}".format(
+                stage, **summary["stages"][stage]
+            ))
+
+        # The startup phases break dr_init down, so they go under it.
+        if stage == "dr_init":
+            for phase in telemetry.STARTUP_PHASES:
+                if phase in summary["stages"]:
+                    print_l("  {:<14} {count:>8} {p50_ms:>10.1f} {p90_ms:>10.1f} {p99_ms:>10.1f} "
+                            "{mean_ms:>10.1f}".format(phase, **summary["stages"][phase]))
+
+
+## @param settings --set_campaign's KEY=VALUE settings
+#  @return the campaign configuration changes that they make (see instrument.pack_campaign_config)
+def parse_campaign_changes(settings):
+    changes = {}
+
+    for setting in settings:
+        key, sep, value = setting.partition("=")
+        key, value = key.strip(), value.strip()
+        if not sep:
+            perror("--set_campaign takes KEY=VALUE, not", setting)
+            sys.exit(1)
+
+        try:
+            if key == "fuzz_timeout":
+                changes[key] = int(value) or None
+            elif key == "stickiness":
+                changes[key] = int(value)
+            elif key == "bucketing":
+                if value.lower() not in ("on", "off", "true", "false", "1", "0"):
+                    raise ValueError(value)
+                changes[key] = value.lower() in ("on", "true", "1")
+            elif key == "scheduler":
+                if value not in SL2_SCHEDULERS:
+                    raise ValueError(value)
+                changes[key] = value
+            elif key == "targets":
+                changes[key] = [int(index) for index in value.split(",") if index.strip()]
+            else:
+                perror("Unknown campaign setting:", key)
+                sys.exit(1)
+        except ValueError:
+            perror("Bad value for campaign setting {}: {}".format(key, value))
+            sys.exit(1)
+
+    return changes
+
+
 ## Run single stages, or the complete fuzzing lifecycle
 def _main():
     sanity_checks()
 
+    # Only report on an already-running server; don't start one just to ask it about itself.
+    if config["server_stats"]:
+        for instance in server_instances():
+            print_server_stats(instance)
+        return
+
+    if config.get("server_log_level") is not None:
+        for instance in server_instances():
+            old = set_server_log_level(config["server_log_level"], instance)
+            print_l("{}server log verbosity: {} -> {}".format(
+                instance + " " if instance else "", old, config["server_log_level"]
+            ))
+        return
+
+    if config["campaign_config"] or config.get("set_campaign"):
+        changes = parse_campaign_changes(config.get("set_campaign") or [])
+        for instance in server_instances():
+            if changes:
+                status, campaign = set_campaign_config(changes, instance=instance)
+                print_l("{}campaign configuration change: {}".format(instance + " " if instance else "", status))
+            else:
+                campaign = get_campaign_config(instance)
+            print_l("{}campaign configuration: {}".format(instance + " " if instance else "", campaign))
+        return
+
+    if config["stats"]:
+        print_stats()
+        return
+
+    # Benchmarks pin the server's options, so that their numbers can be compared; that only works if we start it.
+    bench_server_started = False
+    if config.get("stage") == "BENCH":
+        config["server_args"] = bench.SERVER_ARGS
+        bench_server_started = named_mutex.test_named_mutex(server_mutex_name(target_server_instance(config)))
+
     start_server(no_window=config["no_server_window"])
 
     target_file = os.path.join(get_target_dir(config), "targets.msg")
 
+    if config["cmin"]:
+        config["client_args"].append("-t")
+        config["client_args"].append(target_file)
+        minimize_corpus(config, target_file)
+        return
+
+    if config["cmplog"]:
+        config["client_args"].append("-t")
+        config["client_args"].append(target_file)
+        build_cmplog(config, target_file)
+        return
+
+    if config.get("import_corpus"):
+        config["client_args"].append("-t")
+        config["client_args"].append(target_file)
+        import_corpus(config, target_file, config["import_corpus"])
+        return
+
+    if config["overhead"]:
+        config["client_args"].append("-t")
+        config["client_args"].append(target_file)
+        measure_overhead(config, target_file)
+        return
+
+    if config["tmin"]:
+        runs = get_runs(config["run_id"]) if "run_id" in config else None
+        if not runs:
+            print_l("[!] --tmin needs the --run_id of a crashing run")
+            return
+        run_dir = list(runs.keys())[0]
+        config["target_application_path"], config["target_args"] = runs[run_dir]
+        config["client_args"].append("-t")
+        config["client_args"].append(target_file)
+        minimize_crash(config, target_file, os.path.basename(run_dir))
+        return
+
+    if config["regress"]:
+        config["client_args"].append("-t")
+        config["client_args"].append(target_file)
+        regress(config, target_file, config.get("regress_target"))
+        return
+
     # If the user selected a single stage, do that instead of running anything else
     if "stage" in config:
+        # Benchmark the whole fuzzing pipeline against the configured target
+        if config["stage"] == "BENCH":
+            if not os.path.exists(target_file):
+                select_and_dump_wizard_findings(wizard_run(config), target_file)
+
+            config["client_args"].append("-t")
+            config["client_args"].append(target_file)
+            bench.run_benchmark(config, target_file, bench_server_started)
+
         # Re-run the wizard stage and dump the output in the target directory
         if config["stage"] == "WIZARD":
             select_and_dump_wizard_findings(wizard_run(config), target_file)
@@ -157,6 +387,9 @@ def _main():
             tracerResults = tracer_run(config, run_id[-36:])[0]
             print(tracerResults)
 
+    elif config["schedule"]:
+        schedule_targets()
+
     else:
         # Run the wizard to select a target function if we don't have one saved
         if not os.path.exists(target_file):
@@ -165,12 +398,25 @@ def _main():
         config["client_args"].append("-t")
         config["client_args"].append(target_file)
 
-        # Spawn a thread that will run DynamoRIO and wait for the output
-        with concurrent.futures.ThreadPoolExecutor(max_workers=config["simultaneous"]) as executor:
+        if config.get("calibrate"):
+            calibrate(config, target_file)
+
+        if config["supervisor"]:
+            if os.path.isfile(config.get("supervisor_path", "")):
+                supervised_fuzz_and_triage(config)
+                return
+
+            print_l("[!] No supervisor at supervisor_path, falling back to the harness's own workers")
+
+        # Spawn a thread that will run DynamoRIO and wait for the output. Crashes are triaged on the triage
+        # queue's own workers, so that these keep fuzzing.
+        with start_triage_queue(config) as triage_queue, concurrent.futures.ThreadPoolExecutor(
+            max_workers=config["simultaneous"]
+        ) as executor:
             # If we're in continuous mode, spawn as many futures as we can run simultaneously.
             # Otherwise, spawn as many as we want to run in total
             fuzz_futures = [
-                executor.submit(fuzz_and_triage, config)
+                executor.submit(fuzz_and_triage, config, triage_queue)
                 for _ in range(config["runs"] if not config["continuous"] else config["simultaneous"])
             ]
 
@@ -0,0 +1,343 @@
+## @package archive
+#
+# Packs finished runs into campaign archives, so that the runs directory doesn't keep a directory for every
+# crash (and preserved run) of every campaign. Enumerating hundreds of thousands of run directories is slow on
+# NTFS, and so is everything that globs them.
+#
+# With --archive_runs, each harness session appends the runs that it's done with to an archive of its own
+# (one file under sl2_archive_dir), and removes their directories. An archive is a header, then a record for
+# each of a run's files followed by an empty record that ends the run, and, once the session closes it, an
+# index of every run in it. The index is a footer, so it's found from the end of the file; the archive of a
+# session that was cut short is scanned instead, and keeps every run that it finished writing.
+#
+# Archived runs are listed through the indexes (see state.get_runs). Anything that needs one of their files
+# as a file, like the tracer or the triager, restores the run's directory first (see restore_run).
+
+import atexit
+import os
+import shutil
+import struct
+import threading
+import time
+import uuid
+
+import msgpack
+
+from . import config
+from . import dumps
+
+## File extension of campaign archives
+ARCHIVE_EXT = ".sl2a"
+
+## Starts every archive: magic and version
+HEADER = struct.Struct("<4sI")
+ARCHIVE_MAGIC = b"SL2A"
+ARCHIVE_VERSION = 1
+
+## Precedes each file: magic, the run's ID, and the sizes of the file's name and of its contents. A record
+# without a name ends its run.
+RECORD = struct.Struct("<4s16sHQ")
+RECORD_MAGIC = b"SL2R"
+
+## Ends a closed archive: magic, and the offset and size of its index
+FOOTER = struct.Struct("<4sQQ")
+FOOTER_MAGIC = b"SL2I"
+
+## How much of a file is copied into (or out of) an archive at a time
+COPY_CHUNK = 1024 * 1024
+
+## This session's archive, once it's archived a run
+_writer = None
+_writer_lock = threading.Lock()
+
+## Each archive's index, by path, as (size, mtime, index), so that it's only re-read once the archive changes
+_indexes = {}
+_indexes_lock = threading.Lock()
+
+## Every archive's runs, merged, and the (path, size, mtime) of each archive that they were merged from
+_merged = None
+
+## Serializes restores, so that two threads don't restore the same run at once
+_restore_lock = threading.Lock()
+
+
+## Copies exactly `size` bytes from one file to another
+# @param src The file to copy from
+# @param dst The file to copy to
+# @param size How many bytes to copy
+def _copy(src, dst, size):
+    while size > 0:
+        chunk = src.read(min(size, COPY_CHUNK))
+        if not chunk:
+            raise OSError("file shrank while it was copied")
+
+        dst.write(chunk)
+        size -= len(chunk)
+
+
+## A session's campaign archive, which runs are appended to
+class CampaignArchive(object):
+
+    ## Creates the archive
+    # @param path Where to put it
+    def __init__(self, path):
+        self.path = path
+        self.lock = threading.Lock()
+
+        ## Run ID -> {"files": {name: [offset, size]}}
+        self.index = {}
+
+        self.file = open(path, "wb")
+        self.file.write(HEADER.pack(ARCHIVE_MAGIC, ARCHIVE_VERSION))
+        self.file.flush()
+
+    ## Appends a run's files to the archive
+    # @param run_id The run's ID
+    # @param run_dir The run's directory
+    def add_run(self, run_id, run_dir):
+        run_bytes = uuid.UUID(str(run_id)).bytes
+        files = {}
+
+        with self.lock:
+            for root, _, names in os.walk(run_dir):
+                for name in names:
+                    # Temporary files are leftovers of writes that never finished.
+                    if name.endswith(".tmp"):
+                        continue
+
+                    path = os.path.join(root, name)
+                    member = os.path.relpath(path, run_dir).replace(os.sep, "/")
+                    encoded = member.encode("utf-8")
+
+                    with open(path, "rb") as member_file:
+                        size = os.fstat(member_file.fileno()).st_size
+                        self.file.write(RECORD.pack(RECORD_MAGIC, run_bytes, len(encoded), size))
+                        self.file.write(encoded)
+                        files[member] = [self.file.tell(), size]
+                        _copy(member_file, self.file, size)
+
+            self.file.write(RECORD.pack(RECORD_MAGIC, run_bytes, 0, 0))
+            self.file.flush()
+            self.index[str(run_id)] = {"files": files}
+
+    ## @param run_id A run's ID
+    # @return the run's index entry, or None if it isn't in this archive
+    def find(self, run_id):
+        with self.lock:
+            return self.index.get(str(run_id))
+
+    ## Writes the archive's index, and closes it
+    def close(self):
+        with self.lock:
+            if self.file.closed:
+                return
+
+            offset = self.file.tell()
+            packed = msgpack.packb(self.index, use_bin_type=True)
+            self.file.write(packed)
+            self.file.write(FOOTER.pack(FOOTER_MAGIC, offset, len(packed)))
+            self.file.close()
+
+
+## Reconstructs the index of an archive that was never closed, from its records
+# @param archive_file The archive, open for reading
+# @param end The archive's size
+# @return the index of every run that was written in full
+def _scan_index(archive_file, end):
+    index = {}
+    files = {}
+    offset = HEADER.size
+
+    while offset + RECORD.size <= end:
+        archive_file.seek(offset)
+        magic, run_bytes, name_size, size = RECORD.unpack(archive_file.read(RECORD.size))
+        data_offset = offset + RECORD.size + name_size
+
+        if magic != RECORD_MAGIC or data_offset + size > end:
+            break
+
+        run_id = str(uuid.UUID(bytes=run_bytes))
+        if name_size:
+            files.setdefault(run_id, {})[archive_file.read(name_size).decode("utf-8")] = [data_offset, size]
+        else:
+            index[run_id] = {"files": files.pop(run_id, {})}
+
+        offset = data_offset + size
+
+    return index
+
+
+## @param path An archive's path
+# @return the archive's index (see CampaignArchive.index), or an empty one if it isn't an archive
+def _read_index(path):
+    with open(path, "rb") as archive_file:
+        archive_file.seek(0, os.SEEK_END)
+        end = archive_file.tell()
+
+        archive_file.seek(0)
+        if end < HEADER.size or HEADER.unpack(archive_file.read(HEADER.size)) != (ARCHIVE_MAGIC, ARCHIVE_VERSION):
+            return {}
+
+        if end >= HEADER.size + FOOTER.size:
+            archive_file.seek(end - FOOTER.size)
+            magic, offset, size = FOOTER.unpack(archive_file.read(FOOTER.size))
+
+            if magic == FOOTER_MAGIC and offset + size + FOOTER.size == end:
+                archive_file.seek(offset)
+                return msgpack.unpackb(archive_file.read(size), raw=False)
+
+        return _scan_index(archive_file, end)
+
+
+## @return each closed (or abandoned) archive's runs, as their archive and index entry by run ID. This
+# session's own archive isn't included.
+def _archived():
+    global _merged
+
+    # Archives are named by when their sessions started, so a run that was restored and archived
+    # again is found in its latest archive.
+    with _indexes_lock:
+        archives = []
+        for entry in sorted(os.scandir(config.sl2_archive_dir), key=lambda entry: entry.name):
+            if entry.name.endswith(ARCHIVE_EXT) and not (_writer and entry.path == _writer.path):
+                stat = entry.stat()
+                archives.append((entry.path, stat.st_size, stat.st_mtime_ns))
+
+        if _merged is not None and _merged[0] == archives:
+            return _merged[1]
+
+        merged = {}
+        for path, size, mtime in archives:
+            cached = _indexes.get(path)
+            if cached is None or cached[:2] != (size, mtime):
+                try:
+                    cached = (size, mtime, _read_index(path))
+                except (OSError, ValueError, struct.error):
+                    cached = (size, mtime, {})
+                _indexes[path] = cached
+
+            for run_id, run in cached[2].items():
+                merged[run_id] = (path, run)
+
+        _merged = (archives, merged)
+        return merged
+
+
+## @return the IDs of every archived run
+def archived_run_ids():
+    run_ids = set(_archived().keys())
+
+    # This session's own archive isn't closed yet, so its index is only in memory.
+    if _writer:
+        with _writer.lock:
+            run_ids.update(_writer.index.keys())
+
+    return list(run_ids)
+
+
+## @param run_id A run's ID
+# @return the run's archive and index entry, or None if it isn't archived
+def find_run(run_id):
+    run_id = str(run_id)
+
+    if _writer:
+        run = _writer.find(run_id)
+        if run is not None:
+            return _writer.path, run
+
+    return _archived().get(run_id)
+
+
+## Reads one of an archived run's files
+# @param run_id The run's ID
+# @param name The file's name, relative to the run's directory
+# @return the file's contents, or None if the run (or the file) isn't archived
+def read_file(run_id, name):
+    found = find_run(run_id)
+    if found is None or name not in found[1]["files"]:
+        return None
+
+    offset, size = found[1]["files"][name]
+    with open(found[0], "rb") as archive_file:
+        archive_file.seek(offset)
+        return archive_file.read(size)
+
+
+## Restores an archived run's directory, so that its files can be used as files again. The run stays in its
+# archive, but its directory is used instead from then on (and is archived again if it's finished again).
+# @param run_id The run's ID
+# @return whether the run's directory exists
+def restore_run(run_id):
+    run_dir = os.path.join(config.sl2_runs_dir, str(run_id))
+    if os.path.isdir(run_dir):
+        return True
+
+    found = find_run(run_id)
+    if found is None:
+        return False
+
+    # The run is unpacked next to the archives and moved into place, so that nobody sees it half done.
+    with _restore_lock:
+        if os.path.isdir(run_dir):
+            return True
+
+        tmp_dir = os.path.join(config.sl2_archive_dir, "{}.{}.tmp".format(run_id, os.getpid()))
+        shutil.rmtree(tmp_dir, ignore_errors=True)
+        os.makedirs(tmp_dir)
+
+        with open(found[0], "rb") as archive_file:
+            for name, (offset, size) in found[1]["files"].items():
+                path = os.path.join(tmp_dir, *name.split("/"))
+                os.makedirs(os.path.dirname(path), exist_ok=True)
+
+                archive_file.seek(offset)
+                with open(path, "wb") as member_file:
+                    _copy(archive_file, member_file, size)
+
+        os.replace(tmp_dir, run_dir)
+
+    return True
+
+
+## Archives a finished run, and removes its directory. Does nothing without --archive_runs.
+# @param config_dict Configuration context dictionary
+# @param run_id The run's ID
+# @return whether the run was archived
+def archive_run(config_dict, run_id):
+    global _writer
+
+    run_dir = os.path.join(config.sl2_runs_dir, str(run_id))
+    if not config_dict.get("archive_runs") or not os.path.isdir(run_dir):
+        return False
+
+    # Slots are reused by the next run, so they're never archived (see run_slots.py).
+    if os.path.isfile(os.path.join(config.sl2_slots_dir, "{}.lock".format(run_id))):
+        return False
+
+    # The run's dump would be lost if the server renamed it into place after the run was archived.
+    dumps.wait_for_dump(run_id)
+
+    with _writer_lock:
+        if _writer is None:
+            name = "{}-{}{}".format(time.strftime("%Y%m%d-%H%M%S"), os.getpid(), ARCHIVE_EXT)
+            _writer = CampaignArchive(os.path.join(config.sl2_archive_dir, name))
+            atexit.register(_writer.close)
+
+    try:
+        _writer.add_run(run_id, run_dir)
+    except OSError as e:
+        print("Couldn't archive run {}: {}".format(run_id, e))
+        return False
+
+    shutil.rmtree(run_dir, ignore_errors=True)
+    return True
+
+
+## Closes this session's archive, if it has one. Later runs go into a new archive.
+def close():
+    global _writer
+
+    with _writer_lock:
+        if _writer is not None:
+            _writer.close()
+            _writer = None
@@ -0,0 +1,143 @@
+## @package bench
+#
+# The BENCH stage: a headless, reproducible fuzzing campaign that measures the whole pipeline's throughput, so
+# that it can be tracked from build to build. It makes a fixed number of fuzzing runs (--runs, spread over
+# --simultaneous workers) against the configured target, seeding run i with the base seed (--seed, or
+# BENCH_SEED) plus i, against a server started with SERVER_ARGS. Nothing is triaged.
+#
+# It reports, as JSON on stdout (and in BENCH_FILE under the target directory):
+#   execs_per_sec:          runs finished per second of wall time
+#   time_to_first_crash_s:  wall time until the first crashing run finished (null if none crashed)
+#   run_latency_ms:         mean, p50, p90 and p99 of each run's wall time
+#   server_events:          each event's count during the campaign, and its p50/p99/max latency (in
+#                           microseconds) as the server measured it since it started
+
+import concurrent.futures
+import json
+import os
+import threading
+import time
+
+from . import config
+from .instrument import (
+    fuzzer_config,
+    fuzzer_finish,
+    print_l,
+    pwarning,
+    run_dr,
+    server_instance,
+    server_stats,
+    target_arena_id,
+)
+from . import timeouts
+from .state import get_target_dir
+
+## The server's options during a benchmark: a fixed stickiness, and score bucketing.
+# A server that's already running keeps its own options, so the benchmark says which it got.
+SERVER_ARGS = ["-s", "2", "-b"]
+
+## The base seed, when --seed isn't given
+BENCH_SEED = 0
+
+## File name of the last benchmark's results (under the target directory)
+BENCH_FILE = "bench.json"
+
+
+## @param samples A non-empty sorted list
+# @param fraction The percentile, as a fraction
+# @return the percentile
+def _percentile(samples, fraction):
+    return samples[min(len(samples) - 1, int(len(samples) * fraction))]
+
+
+## Makes a single benchmark run
+# @param config_dict Configuration context dictionary
+# @param targets_file Path to the target's targets file
+# @param seed The run's seed
+# @return a tuple of whether the run crashed, and its wall time in seconds
+def _bench_run(config_dict, targets_file, seed):
+    run_id, fuzz_config = fuzzer_config(dict(config_dict, seed=seed), targets_file)
+    timeout = timeouts.fuzz_timeout(config_dict)
+    run = run_dr(fuzz_config, verbose=config_dict["verbose"], timeout=timeout, run_id=run_id)
+    crashed, run = fuzzer_finish(config_dict, run, timeout)
+
+    return crashed, run.process.elapsed
+
+
+## Runs the benchmark against the target in the given config, and reports its results
+# @param config_dict Configuration context dictionary
+# @param targets_file Path to the target's targets file
+# @param server_started Whether the server was started for this benchmark (with SERVER_ARGS)
+# @return the results, as a dict
+def run_benchmark(config_dict, targets_file, server_started):
+    runs = max(config_dict["runs"], 1)
+    workers = max(min(config_dict["simultaneous"], runs), 1)
+    base_seed = config_dict["seed"] if config_dict.get("seed") is not None else BENCH_SEED
+
+    if not server_started:
+        pwarning("The server was already running, so it has its own options rather than", " ".join(SERVER_ARGS))
+
+    instance = server_instance(target_arena_id(targets_file))
+    _, events_before, _ = server_stats(instance)
+
+    lock = threading.Lock()
+    latencies = []
+    first_crash = None
+    crashes = 0
+    started = time.time()
+
+    def bench_one(i):
+        nonlocal first_crash, crashes
+        crashed, elapsed = _bench_run(config_dict, targets_file, base_seed + i)
+
+        with lock:
+            latencies.append(elapsed)
+            if crashed:
+                crashes += 1
+                if first_crash is None:
+                    first_crash = time.time() - started
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=workers) as executor:
+        for future in [executor.submit(bench_one, i) for i in range(runs)]:
+            future.result()
+
+    wall = time.time() - started
+    _, events_after, _ = server_stats(instance)
+    latencies.sort()
+
+    results = {
+        "target": os.path.basename(config_dict["target_application_path"]),
+        "target_args": config_dict["target_args"],
+        "config_version": config.VERSION,
+        "seed": base_seed,
+        "runs": runs,
+        "simultaneous": workers,
+        "server_args": SERVER_ARGS if server_started else None,
+        "wall_s": round(wall, 3),
+        "execs_per_sec": round(runs / wall, 3) if wall else None,
+        "crashes": crashes,
+        "time_to_first_crash_s": round(first_crash, 3) if first_crash is not None else None,
+        "run_latency_ms": {
+            "mean": round(sum(latencies) / len(latencies) * 1000, 3),
+            "p50": round(_percentile(latencies, 0.5) * 1000, 3),
+            "p90": round(_percentile(latencies, 0.9) * 1000, 3),
+            "p99": round(_percentile(latencies, 0.99) * 1000, 3),
+        },
+        "server_events": {
+            name: {
+                "count": stats["count"] - events_before.get(name, {}).get("count", 0),
+                "p50_us": stats["p50_us"],
+                "p99_us": stats["p99_us"],
+                "max_us": stats["max_us"],
+            }
+            for name, stats in events_after.items()
+            if stats["count"] > events_before.get(name, {}).get("count", 0)
+        },
+    }
+
+    with open(os.path.join(get_target_dir(config_dict), BENCH_FILE), "w") as bench_file:
+        json.dump(results, bench_file, indent=2)
+
+    print_l(json.dumps(results, indent=2))
+
+    return results
@@ -0,0 +1,152 @@
+## @package calibrate
+#
+# Calibrates a target's coverage before a campaign: its unmodified input is replayed a few times (--calibrate), by
+# fuzzer runs that mutate nothing (-replay_inputs, with no inputs), and each run's coverage map is collected
+# (-arena_out). Cells that land in different hit count buckets from run to run (including cells that only some runs
+# hit) are unstable: they change without the input changing, e.g. because of threads, timers or caches, and every
+# run would otherwise look like it found new coverage in them. They're sent to the server (EVT_SET_UNSTABLE), which
+# masks them out of the target's runs from then on.
+#
+# Cells are only ever added to the mask, so calibrating again (e.g. on another machine) can only catch more of them.
+
+import os
+import shutil
+import struct
+
+from . import config
+from . import run_slots
+from . import timeouts
+from .cmin import _arena_id_payload, _read_exact, _valid_arena_size
+from .instrument import (
+    print_l,
+    pwarning,
+    replay_config,
+    run_dr,
+    server_instance,
+    server_request,
+    target_arena_id,
+    ServerEvent,
+)
+from .state import get_path_to_run_file
+
+## Names of a calibration run's (empty) input directory and coverage map (under its run directory)
+CALIBRATE_INPUTS_DIR = "calibrate_inputs"
+CALIBRATE_ARENA_FILE = "calibrate.arena"
+
+## The fewest runs that a calibration makes, since a single run can't disagree with itself
+MIN_RUNS = 2
+
+
+## Places a cell's hit count into a bucket, the same way that the server does with -b (see bucket_bit in
+# server/server.cpp), so that the mask doesn't catch cells whose counts only vary within a bucket
+# @param hits The cell's hit count
+# @return the cell's bucket, or 0 if it wasn't hit
+def bucket(hits):
+    for i, bound in enumerate((0, 3, 7, 15, 31, 127)):
+        if hits <= bound:
+            return i
+
+    return 6
+
+
+## Runs the target once, unmodified
+# @param config_dict Configuration context dictionary
+# @param arena_id The target's arena ID
+# @return the run's coverage map (as bytes), or None if it didn't report one
+def calibration_run(config_dict, arena_id):
+    run_id = run_slots.slots.acquire(config_dict)
+    inputs_dir = get_path_to_run_file(run_id, CALIBRATE_INPUTS_DIR)
+    arena_path = get_path_to_run_file(run_id, CALIBRATE_ARENA_FILE)
+
+    # Slots are reused, so the directory may still hold a replay's input.
+    if os.path.isdir(inputs_dir):
+        shutil.rmtree(inputs_dir)
+    os.makedirs(inputs_dir)
+
+    if os.path.isfile(arena_path):
+        os.remove(arena_path)
+
+    try:
+        run = run_dr(
+            replay_config(config_dict, run_id, arena_id, ["-replay_inputs", inputs_dir, "-arena_out", arena_path]),
+            verbose=config_dict["verbose"],
+            timeout=timeouts.fuzz_timeout(config_dict),
+            run_id=run_id,
+        )
+
+        if run.process.timed_out or not os.path.isfile(arena_path):
+            return None
+
+        with open(arena_path, "rb") as arena_file:
+            arena = arena_file.read()
+
+        return arena if _valid_arena_size(len(arena)) else None
+    finally:
+        if not run_slots.slots.release(run_id):
+            pwarning("Couldn't release calibration run", run_id)
+
+
+## Marks cells of an arena's map as unstable
+# @param arena_id The arena ID
+# @param cells The cells' indices
+# @return the number of unstable cells that the arena now has
+def set_unstable(arena_id, cells):
+    payload = _arena_id_payload(arena_id) + struct.pack("<I", len(cells)) + struct.pack("<%dI" % len(cells), *cells)
+
+    with open(config.server_pipe_path(server_instance(arena_id)), "r+b", buffering=0) as pipe:
+        pipe.write(server_request(ServerEvent.SET_UNSTABLE, payload))
+        (unstable,) = struct.unpack("<I", _read_exact(pipe, 4))
+        pipe.write(server_request(ServerEvent.SESSION_TEARDOWN))
+
+    return unstable
+
+
+## Calibrates the target in the given config, and masks its unstable cells
+# @param config_dict Configuration context dictionary
+# @param targets_file Path to the target's targets file
+# @return the fraction of the cells that the runs hit whose buckets never changed, or None if fewer than two runs
+#   reported their coverage
+def calibrate(config_dict, targets_file):
+    arena_id = target_arena_id(targets_file)
+    runs = max(config_dict["calibrate"], MIN_RUNS)
+    maps = []
+
+    for i in range(runs):
+        print_l("Calibration run {} of {}".format(i + 1, runs))
+        arena = calibration_run(config_dict, arena_id)
+
+        if arena is None:
+            pwarning("Calibration run", i + 1, "didn't report its coverage")
+        elif maps and len(arena) != len(maps[0]):
+            pwarning("Calibration run", i + 1, "reported a differently sized map, skipping it")
+        else:
+            maps.append(arena)
+
+    if len(maps) < MIN_RUNS:
+        print_l("[!] Too few calibration runs reported their coverage to tell which cells are unstable")
+        return None
+
+    hit = set()
+    unstable = []
+
+    for index, counts in enumerate(zip(*maps)):
+        if not any(counts):
+            continue
+
+        hit.add(index)
+        first = bucket(counts[0])
+        if any(bucket(count) != first for count in counts[1:]):
+            unstable.append(index)
+
+    stability = 1.0 - len(unstable) / len(hit) if hit else 1.0
+    total = set_unstable(arena_id, unstable) if unstable else None
+
+    print_l("Stability: {:.2f}% ({} of {} hit cells varied over {} runs{})".format(
+        stability * 100,
+        len(unstable),
+        len(hit),
+        len(maps),
+        ", {} masked in all".format(total) if total is not None else "",
+    ))
+
+    return stability
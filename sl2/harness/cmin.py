@@ -0,0 +1,261 @@
+## @package cmin
+#
+# Minimizes a target's corpus: the inputs that the server has seen increase the target's coverage
+# (see EVT_CORPUS_LIST), which it uses for seeds and splice donors. Each input is replayed on its own,
+# by a fuzzer run that gives it to its targeted read and mutates nothing else (-replay_inputs), and
+# that run's coverage map is collected (-arena_out). A minimal set of inputs that still covers every
+# cell that the whole corpus does is kept for each targeted read, favoring small and fast inputs, and
+# the rest are pruned from the server's corpus (EVT_CORPUS_PRUNE).
+#
+# Inputs are only ever removed, so inputs that join the corpus while it's being minimized are kept.
+#
+# The same replays also build the target's comparison log (see the cmplog package): each input is replayed with
+# its comparisons logged (-cmplog), and the logs are merged into the target directory.
+
+import collections
+import os
+import shutil
+import struct
+
+from . import cmplog
+from . import config
+from . import run_slots
+from . import timeouts
+from .instrument import (
+    print_l,
+    pwarning,
+    replay_config,
+    run_dr,
+    server_instance,
+    server_request,
+    target_arena_id,
+    ServerEvent,
+)
+from .state import get_path_to_run_file
+
+## Keep this up-to-date with sl2_corpus_file_entry in server/server.cpp
+CORPUS_ENTRY = struct.Struct("<IIQQQQQQ")
+
+## Keep these up-to-date with FUZZ_ARENA_SIZE and FUZZ_ARENA_MAX_SIZE in include/server.hpp
+ARENA_MIN_SIZE = 65536
+ARENA_MAX_SIZE = 8 * 1024 * 1024
+
+## Names of a replay's input directory and coverage map (under its run directory)
+REPLAY_INPUTS_DIR = "replay_inputs"
+REPLAY_ARENA_FILE = "cmin.arena"
+REPLAY_CMPLOG_FILE = "replay.sl2k"
+
+## An input in the server's corpus (see sl2_corpus_entry in server/server.cpp)
+CorpusEntry = collections.namedtuple("CorpusEntry", ["mut_count", "seq", "origin", "exec_us", "buf"])
+
+
+## @param pipe The server's pipe
+# @param size The number of bytes to read
+# @return exactly that many bytes from the pipe
+def _read_exact(pipe, size):
+    data = b""
+    while len(data) < size:
+        chunk = pipe.read(size - len(data))
+        if not chunk:
+            raise EOFError("server closed the pipe mid-reply")
+        data += chunk
+
+    return data
+
+
+## @param arena_id An arena ID
+# @return the arena ID, as the server expects it in corpus requests
+def _arena_id_payload(arena_id):
+    raw = arena_id.encode("utf-16-le")
+    return struct.pack("<Q", len(raw)) + raw
+
+
+## Asks the server for every input in an arena's corpus
+# @param arena_id The arena ID
+# @return a list of CorpusEntry
+def corpus_list(arena_id):
+    entries = []
+
+    with open(config.server_pipe_path(server_instance(arena_id)), "r+b", buffering=0) as pipe:
+        pipe.write(server_request(ServerEvent.CORPUS_LIST, _arena_id_payload(arena_id)))
+        (count,) = struct.unpack("<I", _read_exact(pipe, 4))
+
+        for _ in range(count):
+            mut_count, _picks, seq, origin, exec_us, size, _path, _execs = CORPUS_ENTRY.unpack(
+                _read_exact(pipe, CORPUS_ENTRY.size)
+            )
+            entries.append(CorpusEntry(mut_count, seq, origin, exec_us, _read_exact(pipe, size)))
+
+        pipe.write(server_request(ServerEvent.SESSION_TEARDOWN))
+
+    return entries
+
+
+## Removes inputs from an arena's corpus
+# @param arena_id The arena ID
+# @param seqs The seqs of the inputs to remove
+# @return the number of inputs that the server removed
+def corpus_prune(arena_id, seqs):
+    payload = _arena_id_payload(arena_id) + struct.pack("<I", len(seqs)) + struct.pack("<%dQ" % len(seqs), *seqs)
+
+    with open(config.server_pipe_path(server_instance(arena_id)), "r+b", buffering=0) as pipe:
+        pipe.write(server_request(ServerEvent.CORPUS_PRUNE, payload))
+        (removed,) = struct.unpack("<I", _read_exact(pipe, 4))
+        pipe.write(server_request(ServerEvent.SESSION_TEARDOWN))
+
+    return removed
+
+
+## @param size The size of a coverage map, in bytes
+# @return whether it's a valid size (see SL2_ARENA_SIZE_VALID in include/server.hpp)
+def _valid_arena_size(size):
+    return ARENA_MIN_SIZE <= size <= ARENA_MAX_SIZE and not size & (size - 1)
+
+
+## Replays a single corpus input
+# @param config_dict Configuration context dictionary
+# @param arena_id The target's arena ID
+# @param entry The CorpusEntry to replay
+# @param cmplog_entries If not None, a list that receives the replay's comparison log entries (as raw bytes)
+# @return a tuple of the cells that the replay covered (or None if it didn't report its coverage), and
+#   how long it took in seconds
+def replay(config_dict, arena_id, entry, cmplog_entries=None):
+    run_id = run_slots.slots.acquire(config_dict)
+    inputs_dir = get_path_to_run_file(run_id, REPLAY_INPUTS_DIR)
+    arena_path = get_path_to_run_file(run_id, REPLAY_ARENA_FILE)
+
+    # Slots are reused, so the directory may still hold another replay's input.
+    if os.path.isdir(inputs_dir):
+        shutil.rmtree(inputs_dir)
+    os.makedirs(inputs_dir)
+
+    with open(os.path.join(inputs_dir, "{}.bin".format(entry.mut_count)), "wb") as input_file:
+        input_file.write(entry.buf)
+
+    replay_args = ["-replay_inputs", inputs_dir, "-arena_out", arena_path]
+
+    cmplog_path = get_path_to_run_file(run_id, REPLAY_CMPLOG_FILE)
+    if cmplog_entries is not None:
+        if os.path.isfile(cmplog_path):
+            os.remove(cmplog_path)
+        replay_args += ["-cmplog", cmplog_path]
+
+    try:
+        run = run_dr(
+            replay_config(config_dict, run_id, arena_id, replay_args),
+            verbose=config_dict["verbose"],
+            timeout=timeouts.fuzz_timeout(config_dict),
+            run_id=run_id,
+        )
+
+        cells = None
+        if not run.process.timed_out and os.path.isfile(arena_path):
+            with open(arena_path, "rb") as arena_file:
+                arena = arena_file.read()
+            if _valid_arena_size(len(arena)):
+                cells = frozenset(i for i, count in enumerate(arena) if count)
+
+        if cmplog_entries is not None:
+            cmplog_entries += cmplog.read_cmplog(cmplog_path)
+
+        return cells, run.process.elapsed
+    finally:
+        if not run_slots.slots.release(run_id):
+            pwarning("Couldn't release replay run", run_id)
+
+
+## Picks a minimal set of inputs that covers every cell that all of them do. Inputs are taken cheapest
+# first (by size times run time), and each is kept only if it covers a cell that the ones kept before it
+# don't.
+# @param replays A list of (CorpusEntry, cells, elapsed) tuples, for inputs with known coverage
+# @return the set of seqs to keep
+def minimal_set(replays):
+    def cost(replay):
+        return (len(replay[0].buf) + 1) * max(replay[2], 0.001)
+
+    ordered = sorted(replays, key=cost)
+    uncovered = set()
+    for _, cells, _ in ordered:
+        uncovered |= cells
+
+    keep = set()
+    for entry, cells, _ in ordered:
+        if not uncovered:
+            break
+        if cells & uncovered:
+            keep.add(entry.seq)
+            uncovered -= cells
+
+    return keep
+
+
+## Minimizes the corpus of the target in the given config
+# @param config_dict Configuration context dictionary
+# @param targets_file Path to the target's targets file
+def minimize_corpus(config_dict, targets_file):
+    arena_id = target_arena_id(targets_file)
+    entries = corpus_list(arena_id)
+
+    if not entries:
+        print_l("[!] The target's corpus is empty: fuzz it with coverage first")
+        return
+
+    # Seeds and donors are only ever used for their own targeted read, so each read keeps its own set.
+    by_read = collections.defaultdict(list)
+    unknown = 0
+
+    for i, entry in enumerate(entries):
+        print_l("Replaying input {} of {} (read {}, {} bytes)".format(
+            i + 1, len(entries), entry.mut_count, len(entry.buf)
+        ))
+        cells, elapsed = replay(config_dict, arena_id, entry)
+
+        # Inputs that we couldn't measure (e.g. ones that hang the target) are kept.
+        if cells is None:
+            unknown += 1
+            continue
+
+        by_read[entry.mut_count].append((entry, cells, elapsed))
+
+    prune = []
+    for replays in by_read.values():
+        keep = minimal_set(replays)
+        prune += [entry.seq for entry, _, _ in replays if entry.seq not in keep]
+
+    removed = corpus_prune(arena_id, prune) if prune else 0
+
+    print_l("Kept {} of {} inputs ({} couldn't be replayed), pruned {}".format(
+        len(entries) - removed, len(entries), unknown, removed
+    ))
+
+
+## Builds the comparison log of the target in the given config, by replaying each input in its corpus
+# @param config_dict Configuration context dictionary
+# @param targets_file Path to the target's targets file
+def build_cmplog(config_dict, targets_file):
+    arena_id = target_arena_id(targets_file)
+    entries = corpus_list(arena_id)
+
+    if not entries:
+        print_l("[!] The target's corpus is empty: fuzz it with coverage first")
+        return
+
+    # Start from the comparisons that were logged before, so that inputs pruned since then still count.
+    cmplog_path = os.path.join(os.path.dirname(targets_file), cmplog.CMPLOG_FILE)
+    merged = cmplog.read_cmplog(cmplog_path)
+    before = len(merged)
+
+    for i, entry in enumerate(entries):
+        if len(merged) >= cmplog.MAX_ENTRIES:
+            break
+
+        print_l("Replaying input {} of {} (read {}, {} bytes)".format(
+            i + 1, len(entries), entry.mut_count, len(entry.buf)
+        ))
+        logged = []
+        replay(config_dict, arena_id, entry, logged)
+        cmplog.merge_cmplog(merged, logged)
+
+    cmplog.write_cmplog(cmplog_path, merged)
+
+    print_l("Logged {} new comparisons ({} in all) to {}".format(len(merged) - before, len(merged), cmplog_path))
@@ -0,0 +1,75 @@
+## @package cmplog
+#
+# Reads and writes the per-target comparison log that the fuzzer's input-to-state strategy draws from: the
+# operands of the comparisons that the selected modules make (2, 4 and 8-byte cmp/test/sub instructions, and
+# memcmp()/strcmp() calls) while the target runs on the inputs in its corpus. The fuzzer logs them (-cmplog) when
+# cmin.build_cmplog replays each input, and later fuzzing runs map the merged log from the target directory
+# (-cmplog_table).
+#
+# The comparison log is written in the same fixed-size format that the fuzzer writes:
+#   magic ("SL2K"), version (u32), entry count (u32),
+#   count entries: operand size (u32), kind (u32), lhs (MAX_OPERAND_LEN bytes), rhs (MAX_OPERAND_LEN bytes).
+
+import os
+import struct
+
+## File name of the comparison log (under the target directory)
+CMPLOG_FILE = "cmplog.sl2k"
+
+CMPLOG_MAGIC = b"SL2K"
+CMPLOG_VERSION = 1
+CMPLOG_HEADER = struct.Struct("<4sII")
+
+## Widest operand in a comparison log. This must match SL2_CMPLOG_MAX_OPERAND in mutation.hpp.
+MAX_OPERAND_LEN = 32
+## Most entries in a comparison log. This must match SL2_CMPLOG_MAX_ENTRIES in mutation.hpp.
+MAX_ENTRIES = 4096
+
+## Keep this up-to-date with sl2_cmplog_entry in include/common/mutation.hpp
+CMPLOG_ENTRY = struct.Struct("<II%ds%ds" % (MAX_OPERAND_LEN, MAX_OPERAND_LEN))
+
+
+## Reads a comparison log
+# @param path Path to the comparison log
+# @return a list of its entries, as raw bytes (or an empty list if it's missing or malformed)
+def read_cmplog(path):
+    if not os.path.isfile(path):
+        return []
+
+    with open(path, "rb") as cmplog_file:
+        data = cmplog_file.read()
+
+    if len(data) < CMPLOG_HEADER.size:
+        return []
+
+    magic, version, count = CMPLOG_HEADER.unpack_from(data)
+    if magic != CMPLOG_MAGIC or version != CMPLOG_VERSION or len(data) < CMPLOG_HEADER.size + count * CMPLOG_ENTRY.size:
+        return []
+
+    return [
+        data[offset:offset + CMPLOG_ENTRY.size]
+        for offset in range(CMPLOG_HEADER.size, CMPLOG_HEADER.size + count * CMPLOG_ENTRY.size, CMPLOG_ENTRY.size)
+    ]
+
+
+## Writes a comparison log
+# @param path Path to write the comparison log to
+# @param entries The entries, as raw bytes
+def write_cmplog(path, entries):
+    with open(path, "wb") as cmplog_file:
+        cmplog_file.write(CMPLOG_HEADER.pack(CMPLOG_MAGIC, CMPLOG_VERSION, len(entries)))
+        cmplog_file.write(b"".join(entries))
+
+
+## Adds entries to a comparison log, dropping duplicates and anything past MAX_ENTRIES
+# @param merged The comparison log's entries so far, as raw bytes (updated in place)
+# @param entries The entries to add, as raw bytes
+def merge_cmplog(merged, entries):
+    seen = set(merged)
+
+    for entry in entries:
+        if len(merged) >= MAX_ENTRIES:
+            break
+        if entry not in seen:
+            seen.add(entry)
+            merged.append(entry)
@@ -23,15 +23,65 @@ CONFIG_SCHEMA = {}
 
 # Increment this version number for any changes that might break backwards compatibilty.
 # This could be database schema changes, paths, file glob patterns, etc..
-VERSION = 12
+VERSION = 19
 
 # Recommended Windows Release. Increment this as new DynamoRIO builds come out.
 RECOMMENDED_WIN10_VERSION = 1803
 
 PATH_KEYS = ["drrun_path", "client_path", "server_path", "wizard_path", "tracer_path", "triager_path"]
 ARGS_KEYS = ["drrun_args", "client_args", "server_args", "target_args"]
-INT_KEYS = ["runs", "simultaneous", "fuzz_timeout", "tracer_timeout", "seed", "verbose", "function_number"]
-FLAG_KEYS = ["debug", "nopersist", "continuous", "exit_early", "inline_stdout", "preserve_runs", "no_server_window"]
+INT_KEYS = [
+    "runs",
+    "simultaneous",
+    "fuzz_timeout",
+    "tracer_timeout",
+    "seed",
+    "verbose",
+    "function_number",
+    "splice",
+    "seeds",
+    "job_cpu_time",
+    "job_memory",
+    "triage_workers",
+    "map_size",
+    "hang_ms",
+    "calibrate",
+    "server_shards",
+    "keep_crash_artifacts",
+    "tracer_idle",
+    "triage_time_budget",
+    "crash_focus",
+    "tracer_batch",
+    "import_read",
+    "prewarm",
+]
+MODULE_KEYS = ["coverage_allow", "coverage_deny"]
+FLAG_KEYS = [
+    "debug",
+    "nopersist",
+    "continuous",
+    "exit_early",
+    "inline_stdout",
+    "preserve_runs",
+    "archive_runs",
+    "no_server_window",
+    "drcov",
+    "havoc",
+    "mutation_ring",
+    "deterministic",
+    "supervisor",
+    "kill_after_crash",
+    "adaptive_timeout",
+    "schedule",
+    "stats",
+    "cmin",
+    "cmplog",
+    "tmin",
+    "regress",
+    "overhead",
+    "async_registration",
+    "export_representatives",
+]
 
 profile = "DEFAULT"
 
@@ -48,11 +98,34 @@ for args in ARGS_KEYS:
 for num in INT_KEYS:
     CONFIG_SCHEMA[num] = {"test": lambda x: type(x) is int, "expected": "integer value", "required": False}
 
+for mods in MODULE_KEYS:
+    CONFIG_SCHEMA[mods] = {
+        "test": lambda xs: type(xs) is list and all(type(x) is str for x in xs),
+        "expected": "module names (array of strings)",
+        "required": False,
+    }
+
 for flag in FLAG_KEYS:
     CONFIG_SCHEMA[flag] = {"test": lambda x: type(x) is bool, "expected": "boolean", "required": False}
 
 # NOTE(ww): Keep these up-to-data with include/server.hpp!
 sl2_server_pipe_path = "\\\\.\\pipe\\fuzz_server"
+sl2_server_mutex = "fuzz_server_mutex"
+## The environment variable that tells the clients which server instance to talk to
+sl2_server_instance_env = "SL2_SERVER_INSTANCE"
+
+
+## @param instance A server instance's name (see the server's -n), or None for the default instance
+# @return the path to the instance's pipe
+def server_pipe_path(instance=None):
+    return sl2_server_pipe_path + "." + instance if instance else sl2_server_pipe_path
+
+
+## @param instance A server instance's name, or None for the default instance
+# @return the name of the mutex that the instance holds while it runs
+def server_mutex_name(instance=None):
+    return sl2_server_mutex + "." + instance if instance else sl2_server_mutex
+
 ## Path to SL2 data and configuration
 sl2_dir = os.path.join(os.getenv("APPDATA", default="."), "Trail of Bits", "sl2")
 ## Path to runs directory
@@ -61,12 +134,20 @@ sl2_arenas_dir = os.path.join(sl2_dir, "arenas")
 ## Path to log files
 sl2_log_dir = os.path.join(sl2_dir, "log")
 sl2_targets_dir = os.path.join(sl2_dir, "targets")
+## Path to DynamoRIO's persistent code caches, by target and client
+sl2_code_cache_dir = os.path.join(sl2_dir, "dr_cache")
+## Path to the lock files of the scratch run directories that fuzzing runs reuse (see run_slots.py)
+sl2_slots_dir = os.path.join(sl2_dir, "slots")
+## Path to the campaign archives that finished runs are packed into (see archive.py)
+sl2_archive_dir = os.path.join(sl2_dir, "archive")
 sl2_config_path = os.path.join(sl2_dir, "config.ini")
 
 os.makedirs(sl2_runs_dir, exist_ok=True)
 os.makedirs(sl2_arenas_dir, exist_ok=True)
 os.makedirs(sl2_log_dir, exist_ok=True)
 os.makedirs(sl2_targets_dir, exist_ok=True)
+os.makedirs(sl2_slots_dir, exist_ok=True)
+os.makedirs(sl2_archive_dir, exist_ok=True)
 
 # Create a default config file if one doesn't exist
 if not os.path.exists(sl2_config_path):
@@ -81,6 +162,7 @@ if not os.path.exists(sl2_config_path):
         "wizard_path": "build\\wizard\\Debug\\wizard.dll",
         "tracer_path": "build\\tracer\\Debug\\tracer.dll",
         "triager_path": "build\\triage\\Debug\\triager.exe",
+        "supervisor_path": "build\\supervisor\\Debug\\supervisor.exe",
         "checksec_path": r"build\winchecksec\Debug\winchecksec.exe",
         "target_application_path": "build\\corpus\\test_application\\Debug\\test_application.exe",
         "target_args": "0 -f",
@@ -122,7 +204,8 @@ parser.add_argument(
     action="store_true",
     dest="nopersist",
     default=False,
-    help="Tell drrun not to use persistent code caches (slower)",
+    help="Tell drrun not to use persistent code caches (slower). The caches are kept per target and client, \
+    under the SL2 directory",
 )
 
 parser.add_argument(
@@ -163,6 +246,34 @@ parser.add_argument(
     By default, runs are not killed.",
 )
 
+parser.add_argument(
+    "--job_cpu_time",
+    action="store",
+    dest="job_cpu_time",
+    type=int,
+    help="CPU time (seconds) that each run's processes may use between them, after which the kernel kills \
+    the run and it's treated as timed out. By default, runs aren't limited.",
+)
+
+parser.add_argument(
+    "--job_memory",
+    action="store",
+    dest="job_memory",
+    type=int,
+    help="Memory (megabytes) that each run's processes may commit between them, past which their \
+    allocations fail. By default, runs aren't limited.",
+)
+
+parser.add_argument(
+    "--adaptive_timeout",
+    action="store_true",
+    dest="adaptive_timeout",
+    default=False,
+    help="Derive the fuzzing timeout from the target's recent run times (a multiple of their 99th \
+    percentile), with --fuzztimeout as its upper bound. Runs that the shorter timeout cuts short are logged \
+    in the target directory",
+)
+
 parser.add_argument(
     "-fn",
     "--functionnumber",
@@ -216,8 +327,9 @@ parser.add_argument(
     action="store",
     dest="stage",
     type=str,
-    choices=["WIZARD", "FUZZER", "TRACER"],
-    help="Synchronously re-run a single stage (for debugging purposes)",
+    choices=["WIZARD", "FUZZER", "TRACER", "BENCH"],
+    help="Synchronously re-run a single stage (for debugging purposes). BENCH makes --runs fuzzing runs from a \
+    fixed --seed against a server with pinned options, and prints their throughput and latencies as JSON",
 )
 
 parser.add_argument(
@@ -249,6 +361,16 @@ parser.add_argument(
     help="Preserve all fuzzer runs, even when they don't cause crashes",
 )
 
+parser.add_argument(
+    "--archive_runs",
+    action="store_true",
+    dest="archive_runs",
+    default=False,
+    help="Pack the runs that are done with (triaged crashes and preserved runs) into a campaign archive for each \
+    session, instead of keeping a directory for each. Archived runs are still listed, and are unpacked again \
+    whenever their files are needed",
+)
+
 parser.add_argument(
     "--run_id",
     action="store",
@@ -258,6 +380,498 @@ parser.add_argument(
     of using an auto-generated value. Useful for replaying triage runs.",
 )
 
+parser.add_argument(
+    "--seed",
+    action="store",
+    dest="seed",
+    type=int,
+    help="Seed every fuzzing run with this value instead of one derived from its Run ID. \
+    Together with --run_id, reproduces a fuzzing run's mutations exactly.",
+)
+
+parser.add_argument(
+    "--drcov",
+    action="store_true",
+    dest="drcov",
+    default=False,
+    help="Export exact basic block coverage from each fuzzing run, merged per target in drcov format",
+)
+
+parser.add_argument(
+    "--fixups",
+    action="store",
+    dest="fixups",
+    type=str,
+    help="JSON file of the checksum and length fields to recompute after every mutation (see fixups.py) \
+    (re-run the WIZARD stage to rebuild the fixup table)",
+)
+
+parser.add_argument(
+    "--directed",
+    action="store",
+    dest="directed",
+    type=str,
+    help="File of module+offset lines (e.g. the functions that changed in a new build) to steer the fuzzing runs \
+    towards (see directed.py) (re-run the WIZARD stage to rebuild the target table)",
+)
+
+parser.add_argument(
+    "--dictionary",
+    action="store",
+    dest="dictionary",
+    type=str,
+    help="AFL-style token file to seed the target's mutation dictionary with \
+    (re-run the WIZARD stage to rebuild the dictionary)",
+)
+
+parser.add_argument(
+    "--havoc",
+    action="store_true",
+    dest="havoc",
+    default=False,
+    help="Apply a random-length stack of mutation strategies to each targeted call",
+)
+
+parser.add_argument(
+    "--deterministic",
+    action="store_true",
+    dest="deterministic",
+    default=False,
+    help="Walk deterministic mutation stages (bit flips, arithmetic, interesting values) over the \
+    first targeted call before mutating it randomly. The server remembers how far each target got",
+)
+
+parser.add_argument(
+    "--async_registration",
+    action="store_true",
+    dest="async_registration",
+    default=False,
+    help="Register each mutation with the server without waiting for the server's response. Saves a \
+    round trip per targeted call, but the server only logs registration failures",
+)
+
+parser.add_argument(
+    "--mutation_ring",
+    action="store_true",
+    dest="mutation_ring",
+    default=False,
+    help="Have the server pre-generate mutations for each targeted call, instead of mutating \
+    inside the target (ignored with --havoc)",
+)
+
+parser.add_argument(
+    "--splice",
+    action="store",
+    dest="splice",
+    type=int,
+    help="Splice an input that increased coverage (kept by the server) into 1 in every N targeted calls",
+)
+
+parser.add_argument(
+    "--seeds",
+    action="store",
+    dest="seeds",
+    type=int,
+    help="Start 1 in every N targeted calls from a seed (an input that increased coverage, kept by the server) \
+    instead of the target's own input",
+)
+
+parser.add_argument(
+    "--crash_focus",
+    action="store",
+    dest="crash_focus",
+    type=int,
+    help="When a run finds a crash with a new signature, spend the target's next N runs on inputs right around \
+    it: each of them starts from the crashing run's inputs and only nudges them slightly. Their crashes are \
+    grouped under the crash that they focused on. By default, runs don't focus on crashes.",
+)
+
+parser.add_argument(
+    "--map_size",
+    action="store",
+    dest="map_size",
+    type=int,
+    help="Size of the coverage map of a target's arena, in bytes: a power of two from 65536 (the default) to \
+    8388608. Bigger maps collide less on big targets. An arena keeps the size that it was created with",
+)
+
+parser.add_argument(
+    "--hang_ms",
+    action="store",
+    dest="hang_ms",
+    type=int,
+    help="Milliseconds that a run can go without reaching new code or calling a hooked function, after its first \
+    mutation, before the fuzzer ends it as a hang. Unlike --fuzztimeout, the run's coverage is kept. By default, \
+    the fuzzer doesn't watch for hangs.",
+)
+
+parser.add_argument(
+    "--calibrate",
+    action="store",
+    dest="calibrate",
+    type=int,
+    help="Before fuzzing, run the target's unmodified input this many times, report how stable its coverage is, \
+    and have the server mask out the coverage cells whose hit counts varied between the runs. By default, the \
+    target isn't calibrated.",
+)
+
+parser.add_argument(
+    "--keep_crash_artifacts",
+    action="store",
+    dest="keep_crash_artifacts",
+    type=int,
+    help="Keep the memory dumps of only the first this many crashes with each signature. Later crashes keep \
+    their FKTs and crash records, and refer to the first crashes' dumps instead. By default, every crash keeps its \
+    dumps.",
+)
+
+parser.add_argument(
+    "--triage_workers",
+    action="store",
+    dest="triage_workers",
+    type=int,
+    help="Number of threads that triage crashes, separately from the fuzzing workers (default: 1)",
+)
+
+parser.add_argument(
+    "--triage_time_budget",
+    action="store",
+    dest="triage_time_budget",
+    type=int,
+    help="Stop walking a minidump's stacks after this many milliseconds, and triage it with the frames found so \
+    far. Crashes that were cut short are marked as truncated. By default, stacks are walked in full.",
+)
+
+parser.add_argument(
+    "--emulate_peer",
+    action="store",
+    dest="emulate_peer",
+    type=str,
+    help="Endpoint (IPv4-address:port for sockets, host:port for WinHTTP) that the target connects to, to answer \
+    from the --peer_script instead of the network",
+)
+
+parser.add_argument(
+    "--peer_script",
+    action="store",
+    dest="peer_script",
+    type=str,
+    help="JSON file of the responses for --emulate_peer to answer with (see peer.py) \
+    (re-run the WIZARD stage to rebuild the response script)",
+)
+
+parser.add_argument(
+    "--virtual_file",
+    action="store",
+    dest="virtual_file",
+    type=str,
+    help="Input file that the target opens, to read into memory once and serve from there on every run \
+    instead of from the disk (the target's reads of it are targeted and mutated as usual)",
+)
+
+parser.add_argument(
+    "--mutator",
+    action="store",
+    dest="mutator",
+    type=str,
+    help="Custom mutator plugin (a DLL exporting sl2_mutator_init, sl2_mutator_mutate and sl2_mutator_teardown) \
+    to mutate targeted calls with",
+)
+
+parser.add_argument(
+    "--mutator_options",
+    action="store",
+    dest="mutator_options",
+    type=str,
+    help="Option string to pass to the --mutator plugin",
+)
+
+parser.add_argument(
+    "--export_crashes",
+    action="store",
+    dest="export_crashes",
+    type=str,
+    help="(sl2-report) Stream the target's crashes to this file instead of writing a report",
+)
+
+parser.add_argument(
+    "--export_format",
+    action="store",
+    dest="export_format",
+    choices=["csv", "jsonl"],
+    help="Format of --export_crashes (default: csv)",
+)
+
+parser.add_argument(
+    "--export_representatives",
+    action="store_true",
+    dest="export_representatives",
+    default=False,
+    help="Only export the first crash of each crashash, with how many crashes share it",
+)
+
+parser.add_argument(
+    "--arg_hash",
+    action="store",
+    dest="arg_hash",
+    choices=["sha256", "fnv1a64"],
+    help="Hash that the wizard records call arguments with, for targets that match on them. fnv1a64 is much \
+    cheaper to compute on every read (re-run the WIZARD stage to re-hash)",
+)
+
+parser.add_argument(
+    "--clear_wizard_cache",
+    action="store_true",
+    dest="clear_wizard_cache",
+    default=False,
+    help="Re-run the wizard instead of re-using its cached findings for the target",
+)
+
+parser.add_argument(
+    "--tracer_scope",
+    action="store",
+    dest="tracer_scope",
+    type=str,
+    help="Where the tracer propagates taint instruction by instruction: 'all' (the default), 'main' (just the \
+    target executable), or a comma-separated list of modules to trace along with the target executable. Calls \
+    into other modules are summarized instead, which makes triage much faster",
+)
+
+parser.add_argument(
+    "--tracer_idle",
+    action="store",
+    dest="tracer_idle",
+    type=int,
+    help="Have the tracer stop propagating taint once this many instructions in a row haven't changed any, until \
+    the target's next targeted read. Faster replays of crashes far from their input, but taint that's left in \
+    memory stops being tracked (by default, propagation only stops once all taint is gone)",
+)
+
+parser.add_argument(
+    "--tracer_labels",
+    action="store_true",
+    dest="tracer_labels",
+    default=False,
+    help="Have the tracer track which input offsets each tainted value came from, and report the offsets that \
+    reach the crash. Slower",
+)
+
+parser.add_argument(
+    "--tracer_batch",
+    action="store",
+    dest="tracer_batch",
+    type=int,
+    help="Have each triage worker replay up to this many queued crashes in a single tracer process, by looping the \
+    persistent target that client_args give the fuzzer (-persist_module). Crashes that can't be replayed that way \
+    are traced on their own. By default, every crash gets a tracer process of its own",
+)
+
+parser.add_argument(
+    "--tracer_dump",
+    action="store",
+    dest="tracer_dump",
+    type=str,
+    choices=["normal", "referenced", "tainted", "full"],
+    help="How much memory the tracer writes into crash minidumps: 'normal' (thread stacks and modules), \
+    'referenced' (plus the memory that the stacks and the crashing registers point to), 'tainted' (the default; \
+    plus all tainted memory) or 'full' (the whole address space, which can be hundreds of MB per crash)",
+)
+
+parser.add_argument(
+    "--wizard_aggregate",
+    action="store_true",
+    dest="wizard_aggregate",
+    default=False,
+    help="Have the wizard report one finding per call site (function, return address and source) instead of one \
+    per call. Much less output for targets that make many small reads",
+)
+
+parser.add_argument(
+    "--wizard_influence",
+    action="store_true",
+    dest="wizard_influence",
+    default=False,
+    help="Have the wizard measure each finding's influence: how many basic blocks (and branches) run for the first \
+    time after it, before the next hooked call. The findings are then listed by influence, most first",
+)
+
+parser.add_argument(
+    "--coverage_allow",
+    action="store",
+    dest="coverage_allow",
+    nargs="+",
+    type=str,
+    help="Only measure coverage for these modules (e.g. parser.dll)",
+)
+
+parser.add_argument(
+    "--coverage_deny",
+    action="store",
+    dest="coverage_deny",
+    nargs="+",
+    type=str,
+    help="Never measure coverage for these modules",
+)
+
+parser.add_argument(
+    "--server_shards",
+    action="store",
+    dest="server_shards",
+    type=int,
+    help="Run this many server instances on this host, and send each target's runs to one of them by the \
+    target's arena ID. Each instance has its own pipe, lock, log and arenas directory. By default, a single \
+    server serves every target.",
+)
+
+parser.add_argument(
+    "--server_stats",
+    action="store_true",
+    dest="server_stats",
+    default=False,
+    help="Print per-event statistics from the running server and exit",
+)
+
+parser.add_argument(
+    "--server_log_level",
+    action="store",
+    dest="server_log_level",
+    type=int,
+    help="Set the running server's log verbosity (-3 to 9; 0 is INFO, 1 adds per-event detail) and exit",
+)
+
+parser.add_argument(
+    "--campaign_config",
+    action="store_true",
+    dest="campaign_config",
+    default=False,
+    help="Print the campaign configuration that the running server holds and exit",
+)
+
+parser.add_argument(
+    "--set_campaign",
+    action="append",
+    dest="set_campaign",
+    metavar="KEY=VALUE",
+    help="Change the campaign configuration that the running server holds, and exit. Workers pick the change up \
+    at their next run. Keys are fuzz_timeout (seconds, 0 for adaptive), stickiness, bucketing (on or off), \
+    scheduler (legacy, ucb1 or thompson) and targets (comma-separated indices into all_targets.msg). \
+    Can be given more than once.",
+)
+
+parser.add_argument(
+    "--stats",
+    action="store_true",
+    dest="stats",
+    default=False,
+    help="Print the target's recent executions per second, and where its runs spend their time, and exit",
+)
+
+parser.add_argument(
+    "--cmin",
+    action="store_true",
+    dest="cmin",
+    default=False,
+    help="Replay every input in the target's corpus, prune the ones that add no coverage, and exit",
+)
+
+parser.add_argument(
+    "--import_corpus",
+    action="store",
+    dest="import_corpus",
+    type=str,
+    help="Replay every sample under the given directory (e.g. existing files of the target's format), keep the ones \
+    that add coverage as seeds in the target's corpus, and exit",
+)
+
+parser.add_argument(
+    "--import_read",
+    action="store",
+    dest="import_read",
+    type=int,
+    help="The targeted read that --import_corpus gives each sample to (default: 0, the first)",
+)
+
+parser.add_argument(
+    "--cmplog",
+    action="store_true",
+    dest="cmplog",
+    default=False,
+    help="Replay every input in the target's corpus, log the operands of the comparisons that it makes for the \
+    input-to-state mutation strategy, and exit",
+)
+
+parser.add_argument(
+    "--tmin",
+    action="store_true",
+    dest="tmin",
+    default=False,
+    help="Shrink the inputs of the crashing run given by --run_id while it still crashes the same way, register \
+    them as a new run, and exit",
+)
+
+parser.add_argument(
+    "--regress",
+    action="store_true",
+    dest="regress",
+    default=False,
+    help="Replay every saved crash of the target against a new build of it (see --regress_target), report which \
+    are fixed, still crashing, or crashing differently, and exit",
+)
+
+parser.add_argument(
+    "--regress_target",
+    action="store",
+    dest="regress_target",
+    type=str,
+    help="The new build's target application, for --regress (default: the configured target application)",
+)
+
+parser.add_argument(
+    "--overhead",
+    action="store_true",
+    dest="overhead",
+    default=False,
+    help="Time --runs runs of the target natively, under the fuzzer (with and without coverage), and under the \
+    tracer (with and without taint), print each mode's overhead, and exit",
+)
+
+parser.add_argument(
+    "--supervisor",
+    action="store_true",
+    dest="supervisor",
+    default=False,
+    help="Run the fuzzing runs under the native supervisor (supervisor_path), which pins each of the \
+    --simultaneous workers to its own core. Scales past the handful of workers that the harness's own \
+    threads can keep busy",
+)
+
+parser.add_argument(
+    "--prewarm",
+    action="store",
+    dest="prewarm",
+    type=int,
+    help="Number of targets that each worker keeps started and parked ahead of its fuzzing runs, so that \
+    starting the target and DynamoRIO happens behind the previous run (not with --supervisor)",
+)
+
+parser.add_argument(
+    "--schedule",
+    action="store_true",
+    dest="schedule",
+    default=False,
+    help="Fuzz every target that has a targets file at once, sharing the workers between them in proportion \
+    to how much new coverage and how many new crashes each one's recent runs have found",
+)
+
+parser.add_argument(
+    "--kill_after_crash",
+    action="store_true",
+    dest="kill_after_crash",
+    default=False,
+    help="Stop each fuzzing run as soon as the client reports a crash, rather than waiting for the \
+    target (or its crash handler) to exit",
+)
+
 parser.add_argument(
     "-W",
     "--no_server_window",
@@ -308,6 +922,7 @@ def create_new_profile(name, dynamorio_exe, build_dir, target_path, target_args)
         "wizard_path": os.path.join(build_dir, "wizard\\Debug\\wizard.dll"),
         "tracer_path": os.path.join(build_dir, "tracer\\Debug\\tracer.dll"),
         "triager_path": os.path.join(build_dir, "triage\\Debug\\triager.exe"),
+        "supervisor_path": os.path.join(build_dir, "supervisor\\Debug\\supervisor.exe"),
         "checksec_path": os.path.join(build_dir, r"winchecksec\Debug\winchecksec.exe"),
         "target_application_path": target_path,
         "target_args": target_args,
@@ -337,6 +952,10 @@ def update_config_from_args():
     for opt in ARGS_KEYS:
         config[opt] = [] if (len(config[opt]) == 0) else winshlex.split(config[opt])
 
+    for opt in MODULE_KEYS:
+        if opt in config:
+            config[opt] = winshlex.split(config[opt])
+
     if args.target_application_path is not None and len(config["target_args"]) > 0:
         config["target_args"] = []
 
@@ -0,0 +1,113 @@
+## @package corpus_import
+#
+# Imports a directory of sample inputs (e.g. a collection of files of the target's format) into a target's corpus
+# (--import_corpus DIR). Each sample is replayed on its own, by a fuzzer run that gives it to one targeted read
+# (--import_read, the first by default) and mutates nothing else (-replay_inputs). Unlike corpus minimization's
+# replays, these are registered with the server (-replay_register) and return their coverage to it like fuzzing runs
+# do, so the server keeps exactly the samples that add coverage to the arena, as seeds, and drops the rest.
+#
+# Samples are replayed smallest first, on as many runs at once as --simultaneous allows, so that small samples get
+# the credit for the coverage that bigger ones share with them. The corpus only holds so many inputs (see
+# SL2_CORPUS_SIZE in server/server.cpp), so a big import is best followed by --cmin.
+
+import concurrent.futures
+import os
+import shutil
+
+from . import run_slots
+from . import timeouts
+from .cmin import corpus_list
+from .instrument import print_l, pwarning, replay_config, run_dr, target_arena_id
+from .state import get_path_to_run_file
+
+## Name of an import run's input directory (under its run directory)
+IMPORT_INPUTS_DIR = "import_inputs"
+
+## The biggest input that the server keeps in a corpus. Keep this up-to-date with SL2_CORPUS_MAX_BUFSIZE in
+# server/server.cpp
+MAX_SAMPLE_SIZE = 256 * 1024
+
+
+## @param samples_dir A directory of samples
+# @return the paths of the samples under it (recursively) that the corpus could keep, smallest first, and how many
+#   were skipped for being empty or too big
+def list_samples(samples_dir):
+    samples = []
+    skipped = 0
+
+    for root, _, names in os.walk(samples_dir):
+        for name in names:
+            path = os.path.join(root, name)
+            size = os.path.getsize(path)
+            if 0 < size <= MAX_SAMPLE_SIZE:
+                samples.append((size, path))
+            else:
+                skipped += 1
+
+    return [path for _, path in sorted(samples)], skipped
+
+
+## Replays a single sample, registered with the server
+# @param config_dict Configuration context dictionary
+# @param arena_id The target's arena ID
+# @param sample_path Path to the sample
+# @param read The targeted read to give the sample to
+# @return whether the replay finished in time
+def import_sample(config_dict, arena_id, sample_path, read):
+    run_id = run_slots.slots.acquire(config_dict)
+    inputs_dir = get_path_to_run_file(run_id, IMPORT_INPUTS_DIR)
+
+    # Slots are reused, so the directory may still hold another replay's input.
+    if os.path.isdir(inputs_dir):
+        shutil.rmtree(inputs_dir)
+    os.makedirs(inputs_dir)
+
+    shutil.copyfile(sample_path, os.path.join(inputs_dir, "{}.bin".format(read)))
+
+    try:
+        run = run_dr(
+            replay_config(config_dict, run_id, arena_id, ["-replay_inputs", inputs_dir, "-replay_register"]),
+            verbose=config_dict["verbose"],
+            timeout=timeouts.fuzz_timeout(config_dict),
+            run_id=run_id,
+        )
+
+        return not run.process.timed_out
+    finally:
+        if not run_slots.slots.release(run_id):
+            pwarning("Couldn't release import run", run_id)
+
+
+## Imports a directory of samples into the corpus of the target in the given config
+# @param config_dict Configuration context dictionary
+# @param targets_file Path to the target's targets file
+# @param samples_dir The directory of samples
+def import_corpus(config_dict, targets_file, samples_dir):
+    if not os.path.isdir(samples_dir):
+        print_l("[!] {} isn't a directory of samples".format(samples_dir))
+        return
+
+    samples, skipped = list_samples(samples_dir)
+
+    if not samples:
+        print_l("[!] No samples of up to {} bytes under {}".format(MAX_SAMPLE_SIZE, samples_dir))
+        return
+
+    arena_id = target_arena_id(targets_file)
+    read = config_dict.get("import_read", 0)
+    before = {entry.seq for entry in corpus_list(arena_id)}
+    timed_out = 0
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=max(1, config_dict["simultaneous"])) as executor:
+        futures = [executor.submit(import_sample, config_dict, arena_id, path, read) for path in samples]
+
+        for i, future in enumerate(concurrent.futures.as_completed(futures)):
+            if not future.result():
+                timed_out += 1
+            print_l("Replayed sample {} of {}".format(i + 1, len(samples)))
+
+    kept = [entry for entry in corpus_list(arena_id) if entry.seq not in before]
+
+    print_l("Kept {} of {} samples as seeds for read {} ({} timed out, {} skipped as empty or too big)".format(
+        len(kept), len(samples), read, timed_out, skipped
+    ))
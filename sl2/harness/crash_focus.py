@@ -0,0 +1,103 @@
+## @package crash_focus
+#
+# Crash focus (--crash_focus N): when a run finds a crash with a new signature, the target's next N fuzzing runs
+# (on whichever workers start them) spend themselves on the crash's neighborhood. Each of them starts every targeted
+# read from the crashing run's mutation of it, and only nudges it with a single small strategy (-focus_run), instead
+# of following the server's advice. Inputs right around a crash often hit sibling bugs, or more exploitable variants
+# of the same one.
+#
+# Each focused run records the run that it focused on in FOCUS_FILE, so that the crashes it finds are grouped under
+# their parent (see Crash.parent_runid). Focused runs' own crashes don't start bursts of their own, so that a crash
+# storm can't keep the workers away from the rest of the target.
+
+import json
+import os
+import threading
+
+from . import config
+from .state import get_target_dir, mutation_count
+
+## File name of a focused run's parent (under the run directory)
+FOCUS_FILE = "focus.json"
+
+
+## class CrashFocus
+#  A target's bursts of focused runs, shared by every worker that fuzzes it
+class CrashFocus(object):
+    def __init__(self):
+        self.lock = threading.Lock()
+        ## Signatures of the crashes that have been focused on
+        self.seen = set()
+        ## The bursts that still have runs left, oldest first: [parent run ID, its mutation count, runs left]
+        self.bursts = []
+
+    ## Starts a burst of focused runs on a crash, unless one with the same signature has had one already
+    # @param run_id The crashing run's ID
+    # @param signature The crash's quick signature (see triage_queue.crash_signature)
+    # @param runs How many runs to focus on it
+    # @return whether a burst was started
+    def crash_found(self, run_id, signature, runs):
+        if signature is None or runs <= 0:
+            return False
+
+        with self.lock:
+            if signature in self.seen:
+                return False
+            self.seen.add(signature)
+
+        count = mutation_count(run_id)
+        if not count:
+            return False
+
+        with self.lock:
+            self.bursts.append([str(run_id), count, runs])
+
+        return True
+
+    ## Takes the next focused run, from the oldest burst that has any left
+    # @return a tuple of the parent run's ID and its mutation count, or None if there's no burst going
+    def next_run(self):
+        with self.lock:
+            if not self.bursts:
+                return None
+
+            burst = self.bursts[0]
+            burst[2] -= 1
+            if burst[2] <= 0:
+                self.bursts.pop(0)
+
+            return burst[0], burst[1]
+
+
+## Target directory -> its CrashFocus
+_focuses = {}
+_focuses_lock = threading.Lock()
+
+
+## @param config_dict Configuration context dictionary
+# @return the CrashFocus of the target in the given config
+def focus(config_dict):
+    target_dir = get_target_dir(config_dict)
+
+    with _focuses_lock:
+        if target_dir not in _focuses:
+            _focuses[target_dir] = CrashFocus()
+        return _focuses[target_dir]
+
+
+## Records the run that a focused run focuses on, in its run directory
+# @param run_id The focused run's ID
+# @param parent_run_id The crashing run's ID
+def mark_run(run_id, parent_run_id):
+    with open(os.path.join(config.sl2_runs_dir, str(run_id), FOCUS_FILE), "w") as focus_file:
+        json.dump({"parent": str(parent_run_id)}, focus_file)
+
+
+## @param run_id A run's ID
+# @return the ID of the crashing run that the run focused on, or None if it wasn't a focused run
+def parent_run(run_id):
+    try:
+        with open(os.path.join(config.sl2_runs_dir, str(run_id), FOCUS_FILE), "r") as focus_file:
+            return json.load(focus_file)["parent"]
+    except (OSError, ValueError, KeyError, TypeError):
+        return None
@@ -0,0 +1,125 @@
+## @package crash_record
+#
+# Reads the tracer's crash records (crash.PID.sl2c), the binary handoff between the tracer and everything
+# downstream of it. A record is a fixed-size header followed by its sections, each of which the header locates.
+# Keep this in sync with include/common/sl2_crash_record.hpp!
+
+import json
+import struct
+
+## File name pattern of the tracer's crash records (under the run directory)
+CRASH_RECORD_PATTERN = "crash.*.sl2c"
+
+## The magic that crash records start with: "SLCR"
+RECORD_MAGIC = 0x52434C53
+RECORD_VERSION = 1
+
+## The registers in a record, in its order
+REGS = "rax rbx rcx rdx rsp rbp rsi rdi r8 r9 r10 r11 r12 r13 r14 r15 rip".split()
+
+## How many calls and instructions a record's header holds
+LAST_COUNT = 5
+
+## The record's flags, in bit order
+FLAGS = [
+    "pc_tainted",
+    "stack_tainted",
+    "is_ret",
+    "is_indirect",
+    "is_direct",
+    "is_call",
+    "mem_write",
+    "mem_read",
+    "tainted_src",
+    "tainted_dst",
+]
+
+## Section IDs
+SECTION_REASON = 0
+SECTION_EXCEPTION = 1
+SECTION_INSTRUCTION = 2
+SECTION_HISTORY_CALLS = 3
+SECTION_HISTORY_INSNS = 4
+SECTION_TAINTED = 5
+SECTION_LABELS = 6
+SECTION_COUNT = 7
+
+## sl2_crash_record: magic, version, flags, size, score, exception code, register taint, location, registers,
+# last calls, last instructions, and each section's offset and size
+HEADER = struct.Struct("<IHHIIIIQ{}Q{}Q{}Q{}I".format(len(REGS), LAST_COUNT, LAST_COUNT, SECTION_COUNT * 2))
+
+
+## @param data A record's contents
+# @param sections The record's (offset, size) pairs
+# @param section_id The section
+# @return the section's bytes
+def _section(data, sections, section_id):
+    offset, size = sections[section_id]
+    return data[offset : offset + size]
+
+
+## @param data A section of uint64_t values
+# @return the values
+def _u64s(data):
+    return list(struct.unpack("<{}Q".format(len(data) // 8), data[: len(data) // 8 * 8]))
+
+
+## Reads a crash record into the same shape as the tracer's old crash JSON, which the database and the GUI
+# still expect
+# @param path Path to the crash record
+# @return the crash, as a dict
+def read(path):
+    with open(path, "rb") as record_file:
+        data = memoryview(record_file.read())
+
+    if len(data) < HEADER.size:
+        raise ValueError("{} is too short to be a crash record".format(path))
+
+    fields = HEADER.unpack_from(data)
+    magic, version, flags, size, score, _, reg_taint, location = fields[:8]
+    if magic != RECORD_MAGIC or version != RECORD_VERSION or size > len(data):
+        raise ValueError("{} isn't a crash record this version can read".format(path))
+
+    regs = fields[8 : 8 + len(REGS)]
+    last = fields[8 + len(REGS) :]
+    sections = list(zip(last[2 * LAST_COUNT :: 2], last[2 * LAST_COUNT + 1 :: 2]))
+
+    for offset, section_size in sections:
+        if section_size and (offset < HEADER.size or offset + section_size > size):
+            raise ValueError("{} has a section out of bounds".format(path))
+
+    crash = {
+        "score": score,
+        "reason": bytes(_section(data, sections, SECTION_REASON)).decode("utf-8", "replace"),
+        "exception": bytes(_section(data, sections, SECTION_EXCEPTION)).decode("utf-8", "replace"),
+        "location": location,
+        "instruction": bytes(_section(data, sections, SECTION_INSTRUCTION)).decode("utf-8", "replace"),
+        "regs": [
+            {"reg": name, "value": value, "tainted": bool((reg_taint >> i) & 1)}
+            for i, (name, value) in enumerate(zip(REGS, regs))
+        ],
+        "last_calls": list(last[:LAST_COUNT]),
+        "last_insns": list(last[LAST_COUNT : 2 * LAST_COUNT]),
+    }
+
+    for i, name in enumerate(FLAGS):
+        crash[name] = bool(flags & (1 << i))
+
+    tainted = _u64s(_section(data, sections, SECTION_TAINTED))
+    crash["tainted_addrs"] = [{"start": start, "size": length} for start, length in zip(tainted[::2], tainted[1::2])]
+
+    calls = _u64s(_section(data, sections, SECTION_HISTORY_CALLS))
+    if calls:
+        crash["history"] = {"calls": calls, "insns": _u64s(_section(data, sections, SECTION_HISTORY_INSNS))}
+
+    # The label section is JSON already; its per-register offsets go back onto the regs.
+    labels = _section(data, sections, SECTION_LABELS)
+    if labels:
+        labels = json.loads(bytes(labels).decode("utf-8"))
+        offsets = labels.pop("regs", {})
+        for reg in crash["regs"]:
+            if reg["reg"] in offsets:
+                reg["offsets"] = offsets[reg["reg"]]
+        crash["labels"] = labels
+
+    return crash
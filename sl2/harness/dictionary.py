@@ -0,0 +1,147 @@
+## @package dictionary
+#
+# Builds the per-target token dictionary that the fuzzer's dictionary strategies draw from.
+# Tokens come from a user-supplied token file, from the input samples that the wizard records
+# for each targetable call, and from the constants that the wizard sees the target compare against.
+#
+# The dictionary is written in a compact, pre-indexed format that the fuzzer maps at startup:
+#   magic ("SL2D"), version (u32), token count (u32),
+#   count + 1 token offsets (u32, relative to the start of the token data),
+#   token data.
+
+import re
+import struct
+
+## File name of the token dictionary (under the target directory)
+DICTIONARY_FILE = "dictionary.sl2d"
+
+DICTIONARY_MAGIC = b"SL2D"
+DICTIONARY_VERSION = 1
+DICTIONARY_HEADER = struct.Struct("<4sII")
+
+## Longest token we keep. This must match SL2_MAX_TOKEN_LEN in mutation.hpp.
+MAX_TOKEN_LEN = 32
+## Most tokens we keep, so that the dictionary stays small enough to scan cheaply
+MAX_TOKENS = 4096
+## Shortest run of printable characters in an input sample that we treat as a keyword
+MIN_KEYWORD_LEN = 3
+
+## A single token in an AFL-style token file: an optional name, then a quoted value
+TOKEN_LINE = re.compile(r'^\s*(?:[\w.-]+(?:@\d+)?\s*=\s*)?"(.*)"\s*$')
+KEYWORD = re.compile(rb"[\x20-\x7e]{%d,}" % MIN_KEYWORD_LEN)
+
+
+## Decodes the value of an AFL-style token, which may contain \xNN, \\ and \" escapes
+def _unescape(value):
+    token = bytearray()
+    i = 0
+
+    while i < len(value):
+        if value[i] == "\\" and i + 1 < len(value):
+            if value[i + 1] == "x" and i + 3 < len(value):
+                token.append(int(value[i + 2:i + 4], 16))
+                i += 4
+                continue
+            token.extend(value[i + 1].encode("utf-8"))
+            i += 2
+        else:
+            token.extend(value[i].encode("utf-8"))
+            i += 1
+
+    return bytes(token)
+
+
+## Reads an AFL-style token file (one quoted token per line, # for comments)
+# @param path Path to the token file
+# @return list of tokens (bytes)
+def parse_token_file(path):
+    tokens = []
+
+    with open(path, "r", encoding="utf-8", errors="replace") as token_file:
+        for line in token_file:
+            if not line.strip() or line.lstrip().startswith("#"):
+                continue
+
+            match = TOKEN_LINE.match(line)
+            if match:
+                tokens.append(_unescape(match.group(1)))
+
+    return tokens
+
+
+## Pulls likely magic numbers and keywords out of the wizard's input samples
+# @param buffers Iterable of input samples (bytes), e.g. each wizard finding's "buffer"
+# @return list of tokens (bytes)
+def tokens_from_buffers(buffers):
+    tokens = []
+
+    for buffer in buffers:
+        buffer = bytes(buffer)
+
+        # File and protocol magic usually sits at the very start of the input.
+        for size in [2, 4, 8]:
+            if len(buffer) >= size:
+                tokens.append(buffer[:size])
+
+        tokens.extend(KEYWORD.findall(buffer))
+
+    return tokens
+
+
+## Turns the constants that the target compares against into tokens, in both byte orders
+# @param cmps Iterable of (size, value) pairs, as reported by the wizard
+# @return list of tokens (bytes)
+def tokens_from_cmps(cmps):
+    tokens = []
+
+    for size, value in cmps:
+        value &= (1 << (size * 8)) - 1
+        tokens.append(value.to_bytes(size, "little"))
+        tokens.append(value.to_bytes(size, "big"))
+
+    return tokens
+
+
+## Writes a token dictionary
+# @param path Path to the dictionary
+# @param tokens Iterable of tokens (bytes). Duplicates and empty tokens are dropped, long tokens
+#   are truncated, and only the first MAX_TOKENS are kept.
+# @return the number of tokens written
+def write_dictionary(path, tokens):
+    unique = []
+    seen = set()
+
+    for token in tokens:
+        token = bytes(token[:MAX_TOKEN_LEN])
+        if token and token not in seen:
+            seen.add(token)
+            unique.append(token)
+
+        if len(unique) == MAX_TOKENS:
+            break
+
+    offsets = [0]
+    for token in unique:
+        offsets.append(offsets[-1] + len(token))
+
+    with open(path, "wb") as dictionary:
+        dictionary.write(DICTIONARY_HEADER.pack(DICTIONARY_MAGIC, DICTIONARY_VERSION, len(unique)))
+        dictionary.write(struct.pack("<{}I".format(len(offsets)), *offsets))
+        dictionary.write(b"".join(unique))
+
+    return len(unique)
+
+
+## Builds a target's token dictionary from every source we have
+# @param path Path to the dictionary
+# @param findings The wizard's findings, whose "buffer" samples are mined for tokens
+# @param cmps (size, value) pairs of the constants that the wizard saw the target compare against
+# @param token_file Optional path to a user-supplied, AFL-style token file
+# @return the number of tokens written
+def build_dictionary(path, findings, cmps, token_file=None):
+    # User-supplied tokens go first, so that they survive the MAX_TOKENS cut.
+    tokens = parse_token_file(token_file) if token_file else []
+    tokens += tokens_from_cmps(cmps)
+    tokens += tokens_from_buffers(finding["buffer"] for finding in findings if "buffer" in finding)
+
+    return write_dictionary(path, tokens)
@@ -0,0 +1,87 @@
+## @package directed
+#
+# Builds the per-target directed target table: the module offsets (e.g. the functions that a new build changed, as
+# found by diffing it against the last one, or code picked by the user) that fuzzing runs are steered towards. The
+# fuzzer reports how close each run's blocks came to them (-directed), and the server favors the seeds and strategies
+# of the runs that come closest, so that executions are spent near the targets rather than spread over the whole
+# target application.
+#
+# Targets are listed in a text file (--directed), one per line, as module+offset, e.g. "foo.dll+0x1a2b0". Blank lines
+# and lines starting with "#" are skipped. Modules are matched by name, without regard to case, and must be ones that
+# the fuzzer measures coverage of.
+#
+# The table is written in the format that the fuzzer maps at startup (see sl2_directed_target in fuzzer/fuzzer.cpp):
+#   magic ("SL2D"), version (u32), target count (u32), and the targets, grouped by module.
+
+import struct
+
+## File name of the directed target table (under the target directory)
+DIRECTED_FILE = "directed.sl2d"
+
+DIRECTED_MAGIC = b"SL2D"
+DIRECTED_VERSION = 1
+DIRECTED_HEADER = struct.Struct("<4sII")
+
+## sl2_directed_target: module name (NUL-padded) and offset.
+# The module name's length must match SL2_DIRECTED_MODULE_LEN in fuzzer/fuzzer.cpp.
+TARGET = struct.Struct("<64sI")
+
+## Most targets and modules we keep. These must match SL2_DIRECTED_MAX_TARGETS and SL2_DIRECTED_MAX_MODULES
+# in fuzzer/fuzzer.cpp.
+MAX_TARGETS = 4096
+MAX_MODULES = 16
+
+
+## @param line A single target, as listed in the target file
+# @return a tuple of the target's module (lowercased) and offset
+def parse_target(line):
+    module, sep, offset = line.rpartition("+")
+    if not sep or not module.strip():
+        raise ValueError("directed targets are module+offset, not {}".format(line))
+
+    module = module.strip().lower()
+    if len(module.encode("utf-8")) >= TARGET.size - 4:
+        raise ValueError("module name too long: {}".format(module))
+
+    offset = int(offset.strip(), 0)
+    if not 0 <= offset <= 0xFFFFFFFF:
+        raise ValueError("directed target offset out of range: {}".format(line))
+
+    return module, offset
+
+
+## Reads a directed target file
+# @param path Path to the target file
+# @return the targets, as (module, offset) tuples, sorted
+def parse_directed_file(path):
+    targets = set()
+
+    with open(path, "r") as target_file:
+        for line in target_file:
+            line = line.strip()
+            if line and not line.startswith("#"):
+                targets.add(parse_target(line))
+
+    if len(targets) > MAX_TARGETS:
+        raise ValueError(
+            "{} has {} targets, more than the {} that the fuzzer takes".format(path, len(targets), MAX_TARGETS)
+        )
+
+    if len({module for module, _ in targets}) > MAX_MODULES:
+        raise ValueError("{} has targets in more than {} modules".format(path, MAX_MODULES))
+
+    return sorted(targets)
+
+
+## Builds a target's directed target table from a target file
+# @param path Path to the directed target table
+# @param directed_file Path to the target file
+# @return the number of targets written
+def build_directed(path, directed_file):
+    targets = parse_directed_file(directed_file)
+
+    with open(path, "wb") as table:
+        table.write(DIRECTED_HEADER.pack(DIRECTED_MAGIC, DIRECTED_VERSION, len(targets)))
+        table.write(b"".join(TARGET.pack(module.encode("utf-8"), offset) for module, offset in targets))
+
+    return len(targets)
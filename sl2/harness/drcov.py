@@ -0,0 +1,127 @@
+## @package drcov
+#
+# Reads, merges and writes drcov-format basic block coverage, as exported by the fuzzer's
+# -drcov option. Per-run exports are merged into a single per-target file, which the
+# reporting tools summarize.
+
+import os
+import re
+import struct
+
+## File name of a run's drcov export (under the run directory)
+RUN_DRCOV_FILE = "coverage.drcov"
+## File name of the merged drcov coverage (under the target directory)
+TARGET_DRCOV_FILE = "coverage.drcov"
+
+## A single record in drcov's binary basic block table: offset, size, module ID
+BB_RECORD = struct.Struct("<IHH")
+
+## A single line of drcov's (version 2) module table
+MODULE_LINE = re.compile(
+    r"^\s*\d+,\s*(0x[0-9a-fA-F]+),\s*(0x[0-9a-fA-F]+),\s*0x[0-9a-fA-F]+,\s*0x[0-9a-fA-F]+,\s*0x[0-9a-fA-F]+,\s*(.*)$"
+)
+
+
+## Reads a drcov file
+# @param path Path to the drcov file
+# @return (modules, blocks): a dict mapping module paths to (base, end) and a set of
+#   (module path, offset, size) tuples
+def read_drcov(path):
+    modules = []
+    count = 0
+
+    with open(path, "rb") as drcov:
+        for line in iter(drcov.readline, b""):
+            line = line.decode("utf-8", errors="replace").rstrip("\r\n")
+
+            if line.startswith("BB Table:"):
+                count = int(line.split()[2])
+                break
+
+            match = MODULE_LINE.match(line)
+            if match:
+                modules.append((match.group(3), int(match.group(1), 16), int(match.group(2), 16)))
+
+        data = drcov.read(count * BB_RECORD.size)
+
+    blocks = set()
+    for offset, size, mod_id in BB_RECORD.iter_unpack(data[:len(data) - len(data) % BB_RECORD.size]):
+        if mod_id < len(modules):
+            blocks.add((modules[mod_id][0], offset, size))
+
+    return {path: (base, end) for path, base, end in modules}, blocks
+
+
+## Reads just the module table of a drcov file
+# @param path Path to the drcov file
+# @return the paths of the modules that it has coverage for
+def read_drcov_modules(path):
+    modules = []
+
+    with open(path, "rb") as drcov:
+        for line in iter(drcov.readline, b""):
+            line = line.decode("utf-8", errors="replace").rstrip("\r\n")
+
+            if line.startswith("BB Table:"):
+                break
+
+            match = MODULE_LINE.match(line)
+            if match:
+                modules.append(match.group(3))
+
+    return modules
+
+
+## Writes a drcov file
+# @param path Path to the drcov file
+# @param modules Dict mapping module paths to (base, end)
+# @param blocks Set of (module path, offset, size) tuples
+def write_drcov(path, modules, blocks):
+    ids = {mod: i for i, mod in enumerate(modules)}
+
+    with open(path, "wb") as drcov:
+        drcov.write(b"DRCOV VERSION: 2\nDRCOV FLAVOR: drcov\n")
+        drcov.write("Module Table: version 2, count {}\n".format(len(modules)).encode("utf-8"))
+        drcov.write(b"Columns: id, base, end, entry, checksum, timestamp, path\n")
+
+        for mod, (base, end) in modules.items():
+            drcov.write(
+                "{:3}, 0x{:016x}, 0x{:016x}, 0x{:016x}, 0x{:08x}, 0x{:08x}, {}\n".format(
+                    ids[mod], base, end, 0, 0, 0, mod
+                ).encode("utf-8")
+            )
+
+        drcov.write("BB Table: {} bbs\n".format(len(blocks)).encode("utf-8"))
+
+        for mod, offset, size in sorted(blocks):
+            drcov.write(BB_RECORD.pack(offset, size, ids[mod]))
+
+
+## Merges a run's drcov export into a (possibly nonexistent) merged drcov file
+# @param merged_path Path to the merged drcov file
+# @param run_path Path to the run's drcov export
+def merge_drcov(merged_path, run_path):
+    modules, blocks = read_drcov(run_path)
+
+    if os.path.isfile(merged_path):
+        old_modules, old_blocks = read_drcov(merged_path)
+        # Modules are matched by path, since ASLR moves them between runs.
+        modules = {**old_modules, **modules}
+        blocks |= old_blocks
+
+    write_drcov(merged_path, modules, blocks)
+
+
+## Summarizes a drcov file
+# @param path Path to the drcov file
+# @return List of (module name, unique block count), most-covered first
+def summarize_drcov(path):
+    _, blocks = read_drcov(path)
+
+    counts = {}
+    for mod, offset, _ in blocks:
+        counts.setdefault(mod, set()).add(offset)
+
+    return sorted(
+        ((os.path.basename(mod), len(offsets)) for mod, offsets in counts.items()), key=lambda m: m[1], reverse=True
+    )
@@ -0,0 +1,52 @@
+## @package dumps
+#
+# The server writes a crashing run's initial dump in the background (see write_crash_dump in server/server.cpp), so
+# the run can finish, and the harness move on, before its dump is there. The dump is written to a temporary file and
+# renamed into place once it's complete. Anything that reads, strips or archives a fresh run's dump waits for it here
+# first, instead of finding no dump (or a dump that shows up after the run was archived).
+
+import glob
+import os
+import time
+
+from . import config
+
+## The run's finished initial dump
+DUMP_PATTERN = "initial.*.dmp"
+
+## The dump while the server is still writing (or compressing) it
+TMP_PATTERN = "initial.*.dmp*.tmp"
+
+## The longest that we wait for a dump that's being written, in seconds
+WAIT_TIMEOUT = 60
+
+## How long the server gets to start writing a dump, in seconds. Its thread pool picks up the dump as soon as the
+# client has been snapshotted, so a run whose dump hasn't started by then doesn't get one.
+START_GRACE = 2.0
+
+## How often the run directory is checked, in seconds
+POLL_INTERVAL = 0.05
+
+
+## Waits until a run's initial dump is in place, or until it's clear that it won't be
+# @param run_id The run's ID
+# @param grace How long to wait for the server to start writing the dump; with 0, we only wait for a dump that it
+# has already started
+# @param timeout The longest to wait for the dump, in seconds
+# @return whether the run has its dump
+def wait_for_dump(run_id, grace=START_GRACE, timeout=WAIT_TIMEOUT):
+    run_dir = os.path.join(config.sl2_runs_dir, str(run_id))
+    start = time.monotonic()
+
+    while os.path.isdir(run_dir):
+        if glob.glob(os.path.join(run_dir, DUMP_PATTERN)):
+            return True
+
+        elapsed = time.monotonic() - start
+        writing = glob.glob(os.path.join(run_dir, TMP_PATTERN))
+        if elapsed >= timeout or (not writing and elapsed >= grace):
+            break
+
+        time.sleep(POLL_INTERVAL)
+
+    return False
@@ -0,0 +1,143 @@
+## @package events
+#
+# Reads the events that the DynamoRIO clients report (wizard findings, crashes, coverage, ...).
+# Clients given an event file (with -events) write each event as a frame: a little-endian u32
+# length, followed by that many bytes of a single msgpack map. Clients without one log each
+# event to stderr as a line of JSON instead, which we still understand.
+#
+# This must match include/common/sl2_event.hpp.
+
+import json
+import os
+import struct
+
+import msgpack
+
+FRAME_HEADER = struct.Struct("<I")
+
+## Prefix of the coverage lines that older fuzzers log to stderr
+COVERAGE_PREFIX = "#COVERAGE:"
+
+## Size of the chunks that event files are read in
+READ_SIZE = 64 * 1024
+
+
+## Decodes the events in an event file as they're read, without loading the whole file.
+# A frame cut short (e.g. because the client was killed mid-write) ends the stream.
+# @param path Path to the event file
+# @return generator of events (dicts)
+def read_events(path):
+    with open(path, "rb") as event_file:
+        pending = b""
+
+        while True:
+            chunk = event_file.read(READ_SIZE)
+            if not chunk:
+                return
+
+            pending += chunk
+            decoded, offset = _decode_frames(pending)
+            yield from decoded
+            pending = pending[offset:]
+
+
+## Decodes the complete frames at the start of a buffer
+# @param pending The buffer
+# @return a tuple of the decoded events (list of dicts), and how many bytes of the buffer they took up
+def _decode_frames(pending):
+    decoded = []
+    offset = 0
+
+    while len(pending) - offset >= FRAME_HEADER.size:
+        (length,) = FRAME_HEADER.unpack_from(pending, offset)
+        start = offset + FRAME_HEADER.size
+        if len(pending) - start < length:
+            break
+
+        try:
+            decoded.append(msgpack.unpackb(pending[start:start + length], raw=False))
+        except ValueError:
+            pass
+
+        offset = start + length
+
+    return decoded, offset
+
+
+## Follows an event file while its client is still writing to it, decoding each frame as soon as it's
+# complete. Only the frame being written is ever held in memory.
+class EventTail(object):
+
+    ## @param path Path to the event file, which needn't exist yet
+    def __init__(self, path):
+        self.path = path
+        self.offset = 0
+        self.pending = b""
+
+    ## Reads whatever the client has written since the last call
+    # @return the newly completed events (list of dicts)
+    def poll(self):
+        decoded = []
+
+        try:
+            with open(self.path, "rb") as event_file:
+                event_file.seek(self.offset)
+
+                while True:
+                    chunk = event_file.read(READ_SIZE)
+                    if not chunk:
+                        break
+
+                    self.offset += len(chunk)
+                    self.pending += chunk
+                    events, consumed = _decode_frames(self.pending)
+                    decoded += events
+                    self.pending = self.pending[consumed:]
+        except OSError:
+            # Not created yet, or locked by the client for the moment; try again next time.
+            pass
+
+        return decoded
+
+
+## Decodes the events that a client logged to stderr as JSON lines
+# @param stderr The client's stderr (bytes)
+# @return generator of events (dicts)
+def parse_event_lines(stderr):
+    for line in stderr.split(b"\n"):
+        try:
+            line = line.decode("utf-8")
+
+            if line.startswith(COVERAGE_PREFIX):
+                event = json.loads(line[len(COVERAGE_PREFIX):])
+                event["type"] = "coverage"
+            else:
+                event = json.loads(line)
+
+            if isinstance(event, dict):
+                yield event
+        except (UnicodeDecodeError, json.JSONDecodeError):
+            pass
+
+
+## Appends an event to an event file, e.g. one that the harness synthesizes for a hung run
+# @param path Path to the event file
+# @param event The event (dict)
+def append_event(path, event):
+    payload = msgpack.packb(event, use_bin_type=True)
+
+    with open(path, "ab") as event_file:
+        event_file.write(FRAME_HEADER.pack(len(payload)))
+        event_file.write(payload)
+
+
+## Decodes the events that a client reported during a run, from its event file if it wrote one,
+# or from its stderr otherwise
+# @param events_path Path to the run's event file
+# @param stderr The client's stderr (bytes)
+# @return generator of events (dicts)
+def run_events(events_path, stderr):
+    if events_path and os.path.isfile(events_path) and os.path.getsize(events_path) > 0:
+        return read_events(events_path)
+
+    return parse_event_lines(stderr or b"")
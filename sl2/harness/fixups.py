@@ -0,0 +1,100 @@
+## @package fixups
+#
+# Builds the per-target fixup table: the checksum and length fields that the fuzzer recomputes after every mutation,
+# before it hands the buffer to the target and registers it, so that mutated inputs get past the target's integrity
+# checks instead of only exercising its rejection path. Registered mutations (and so FKTs) hold the fixed-up bytes.
+#
+# Fixups are declared in a JSON file (--fixups), as a list of objects with these keys:
+#   algorithm: "length", "crc32", "adler32" or "sum"
+#   field: where the field is
+#   width: the field's width, in bytes: 1, 2 or 4 (default: 4)
+#   endian: "little" or "big" (default: "little")
+#   start, end: the bytes that the field covers, [start, end) (default: the whole buffer)
+#   adjust: added to the computed value (default: 0)
+#   read: the targeted read that the fixup applies to (default: every read)
+# Offsets below 0 count back from the end of the buffer, and an end of 0 is the end of the buffer. A field inside
+# the bytes that it covers is zeroed before it's recomputed. Fixups are applied in order, so lengths should come
+# before the checksums that cover them.
+#
+# The table is written in the format that the fuzzer maps at startup (see sl2_fixups_header in mutation.hpp):
+#   magic ("SL2X"), version (u32), fixup count (u32), and the fixups.
+
+import json
+import struct
+
+## File name of the fixup table (under the target directory)
+FIXUPS_FILE = "fixups.sl2x"
+
+FIXUPS_MAGIC = b"SL2X"
+FIXUPS_VERSION = 1
+FIXUPS_HEADER = struct.Struct("<4sII")
+
+## sl2_fixup: read, algorithm, width, big-endian, (reserved), field, start, end, and adjustment
+FIXUP = struct.Struct("<IBBBxiiii")
+
+## The read of a fixup that applies to every read. This must match SL2_FIXUP_ANY_READ in mutation.hpp.
+ANY_READ = 0xFFFFFFFF
+
+## Most fixups we keep. This must match SL2_MAX_FIXUPS in mutation.hpp.
+MAX_FIXUPS = 64
+
+## Algorithm names, in sl2_fixup_algorithm's order. Keep this in sync with mutation.hpp.
+ALGORITHMS = ["length", "crc32", "adler32", "sum"]
+
+
+## @param spec A single fixup, as declared in the JSON file
+# @return the fixup, packed as an sl2_fixup
+def pack_fixup(spec):
+    if spec.get("algorithm") not in ALGORITHMS:
+        raise ValueError("unknown fixup algorithm: {}".format(spec.get("algorithm")))
+
+    width = spec.get("width", 4)
+    if width not in (1, 2, 4):
+        raise ValueError("fixup fields are 1, 2 or 4 bytes wide, not {}".format(width))
+
+    endian = spec.get("endian", "little")
+    if endian not in ("little", "big"):
+        raise ValueError("fixup fields are little- or big-endian, not {}".format(endian))
+
+    return FIXUP.pack(
+        spec.get("read", ANY_READ),
+        ALGORITHMS.index(spec["algorithm"]),
+        width,
+        endian == "big",
+        spec["field"],
+        spec.get("start", 0),
+        spec.get("end", 0),
+        spec.get("adjust", 0),
+    )
+
+
+## Reads a JSON fixup file
+# @param path Path to the fixup file
+# @return the packed fixups, in order
+def parse_fixup_file(path):
+    with open(path, "r") as fixup_file:
+        specs = json.load(fixup_file)
+
+    if not isinstance(specs, list):
+        raise ValueError("{} should hold a list of fixups".format(path))
+
+    if len(specs) > MAX_FIXUPS:
+        raise ValueError(
+            "{} has {} fixups, more than the {} that the fuzzer takes".format(path, len(specs), MAX_FIXUPS)
+        )
+
+    return [pack_fixup(spec) for spec in specs]
+
+
+## Builds a target's fixup table from a JSON fixup file
+# @param path Path to the fixup table
+# @param fixup_file Path to the JSON fixup file
+# @return the number of fixups written
+def build_fixups(path, fixup_file):
+    fixups = parse_fixup_file(fixup_file)
+
+    with open(path, "wb") as table:
+        table.write(FIXUPS_HEADER.pack(FIXUPS_MAGIC, FIXUPS_VERSION, len(fixups)))
+        table.write(b"".join(fixups))
+
+    return len(fixups)
@@ -6,39 +6,97 @@
 
 
 import array
+import contextlib
 import hashlib
-import json
 import os
 import re
 import shutil
-import signal
+import struct
 import subprocess
 import sys
+import tempfile
 import threading
 import time
 import traceback
+import uuid
 from enum import IntEnum
+from typing import NamedTuple
 
 import msgpack
 
 from sl2.db import Crash, Tracer
 from sl2.db.run_block import SessionManager
+from . import archive
+from . import cmplog
 from . import config
+from . import crash_focus
+from . import dictionary
+from . import directed
+from . import drcov
+from . import dumps
+from . import events
+from . import fixups
+from . import job_object
 from . import named_mutex
+from . import peer
+from . import prewarm
+from . import profile
+from . import retention
+from . import run_slots
+from . import supervisor
+from . import telemetry
+from . import timeouts
+from . import triage_queue
+from . import wizard_cache
 from .state import (
+    get_target,
     parse_tracer_crash_files,
     generate_run_id,
     write_output_files,
     create_invocation_statement,
-    check_fuzz_line_for_crash,
     get_path_to_run_file,
     get_target_dir,
     get_target_slug,
+    generate_seed,
 )
 
 print_lock = threading.Lock()
+drcov_lock = threading.Lock()
 can_fuzz = True
 
+## Exit status of fuzzing runs that ended early because every selected target had been mutated.
+# KEEP THIS UP-TO-DATE with fuzzer/fuzzer.cpp
+EXIT_TARGETS_CONSUMED = 0x512
+
+## Exit status of fuzzing runs that the fuzzer's watchdog ended because they hung (see --hang_ms).
+# KEEP THIS UP-TO-DATE with fuzzer/fuzzer.cpp
+EXIT_HUNG = 0x513
+
+## How often run_dr checks on a running client, and reads the events that it has reported, in seconds
+EVENT_POLL_INTERVAL = 0.05
+
+## How long a run that's been asked to stop has to exit before its job is killed, in seconds
+STOP_GRACE_PERIOD = 5
+
+## How much of the end of a run's stderr run_dr keeps in memory, when the run has no directory to keep it in
+OUTPUT_TAIL_SIZE = 64 * 1024
+
+## Overhead counters that the tracer reports in its exit event.
+# KEEP THIS UP-TO-DATE with emit_stats in tracer/tracer.cpp
+TRACER_STATS_KEYS = [
+    "clean_calls",
+    "propagated",
+    "decoded",
+    "peak_tainted_bytes",
+    "peak_tainted_regs",
+    "elapsed_ms",
+    "propagation_ms",
+    "native_ms",
+]
+
+## File name of the list of runs that a batched tracer replays after the first (under the first run's directory)
+TRACER_BATCH_FILE = "trace.runs"
+
 
 ## class Mode
 #  Enum storing bit flags that control how the fuzzer and tracer target functions
@@ -68,17 +126,131 @@ class Mode(IntEnum):
     MATCH_RETN_COUNT = 1 << 8
 
 
+## The bits of a return address that targets are matched on (see SUB_ASLR_BITS in include/common/sl2_dr_client.hpp)
+SUB_ASLR_BITS = 0xFFFF
+
+
+## @param finding A wizard finding
+# @return the call site that it was made from: its function, and its return address as targets match it
+def _call_site(finding):
+    return finding["func_name"], finding["retAddrOffset"] & SUB_ASLR_BITS
+
+
+## Picks the cheapest targeting mode that still tells a finding apart from every other call that the wizard saw.
+# Only modes that check the call's return address are considered, cheapest first:
+#  - MATCH_RETN_ADDRESS needs one comparison, and lets the client rule out every other call site with a single
+#    lookup. It's enough when the finding's call site was only called once.
+#  - MEDIUM_PRECISION also hashes the arguments, but only of the calls at the finding's site. It's enough when no
+#    other call there had the same arguments.
+#  - HIGH_PRECISION hashes the arguments of every call to the function, and is the fallback.
+# The wizard only watches one run, and an aggregated finding (-aggregate) only keeps its site's first
+# call's arguments, so a site with several aggregated calls always gets HIGH_PRECISION.
+# @param finding The finding
+# @param sites Call site -> the findings made from it (see recommend_modes)
+# @return the mode
+def recommend_mode(finding, sites):
+    calls = sites[_call_site(finding)]
+    if len(calls) == 1 and finding.get("calls", 1) == 1:
+        return Mode.MATCH_RETN_ADDRESS
+
+    if "calls" not in finding and finding.get("argHash"):
+        if sum(1 for call in calls if call.get("argHash") == finding["argHash"]) == 1:
+            return Mode.MEDIUM_PRECISION
+
+    return Mode.HIGH_PRECISION
+
+
+## Pre-selects each wizard finding's cheapest sufficient targeting mode (see recommend_mode)
+# @param wizard_findings The wizard's findings, which are updated in place
+def recommend_modes(wizard_findings):
+    sites = {}
+    for finding in wizard_findings:
+        sites.setdefault(_call_site(finding), []).append(finding)
+
+    for finding in wizard_findings:
+        finding["mode"] = recommend_mode(finding, sites)
+
+
+## class ServerEvent
+#  Enum storing the server's event IDs
+class ServerEvent(IntEnum):
+    """
+    Server events.
+    KEEP THIS UP-TO-DATE with include/server.hpp
+    """
+
+    REPLAY = 2
+    SESSION_TEARDOWN = 6
+    REGISTER_MUTATION = 8
+    CRASH_PATHS = 9
+    GET_ARENA = 10
+    SET_ARENA = 11
+    PING = 12
+    REGISTER_PID = 13
+    ADVISE_MUTATION = 14
+    COVERAGE_INFO = 15
+    MAP_ARENA = 16
+    FINALIZE_RUN = 17
+    STATS = 18
+    CRASH_DUMP = 19
+    MAP_RING = 20
+    REGISTER_RING_MUTATION = 21
+    CORPUS_DONOR = 22
+    SESSION_BEGIN = 23
+    SEED = 24
+    CORPUS_LIST = 25
+    CORPUS_PRUNE = 26
+    SET_LOG_LEVEL = 27
+    SET_UNSTABLE = 28
+    SERIES = 29
+    MAP_UPLOAD = 30
+    FINALIZE_PATH = 31
+    GET_CONFIG = 32
+    SET_CONFIG = 33
+
+
+## Keep these up-to-date with sl2_frame_header in include/server.hpp
+SL2_FRAME_HEADER = struct.Struct("<BBBBI")
+SL2_FRAME_MAGIC = 0xF5
+SL2_FRAME_VERSION = 1
+
+
+## @param event A ServerEvent
+# @param payload The request's payload
+# @return the request, framed for the server
+def server_request(event, payload=b""):
+    return SL2_FRAME_HEADER.pack(SL2_FRAME_MAGIC, SL2_FRAME_VERSION, event, 0, len(payload)) + payload
+
+
+## The keys of the fuzzer's coverage event (see emit_coverage in fuzzer/fuzzer.cpp) that each run keeps
+COVERAGE_KEYS = ["hash", "bkt", "scr", "rem", "newc", "newb", "runs", "paths", "f1", "f2", "us", "slow", "dist"]
+
+## Keep these up-to-date with sl2_server_stats in include/server.hpp
+SL2_STATS_NUM_EVENTS = 34
+SL2_EVENT_STATS_FIELDS = ["count", "p50_us", "p99_us", "max_us", "lock_wait_us", "bytes"]
+
+
 ## Named tuple for storing information about a call to run_dr
 class DRRun(object):
     """
     Represents the state returned by a call to run_dr.
     """
 
-    def __init__(self, process, seed, run_id, coverage=None):
+    def __init__(
+        self, process, seed, run_id, coverage=None, events_path=None, crash_signature=None, crash_severity=0
+    ):
         self.process: subprocess.Popen = process
         self.seed: str = seed
         self.run_id: str = run_id
         self.coverage: dict = coverage
+        self.events_path: str = events_path
+        self.crash_signature: str = crash_signature
+        self.crash_severity: int = crash_severity
+
+    ## Decodes the events that the client reported during the run
+    # @return generator of events (dicts)
+    def events(self):
+        return events.run_events(self.events_path, self.process.stderr)
 
 
 ## Safe printing
@@ -114,122 +286,521 @@ def ps_run(command, close_on_exit=False, no_window=False):
             subprocess.Popen(["powershell", "start", "powershell", "{-NoExit", "-Command", '"{}"}}'.format(command)])
 
 
-## Run the server in a new powershell window, if it's not already running
+## The format of each server shard's instance name (see --server_shards)
+SERVER_SHARD_FMT = "shard{}"
+
+
+## @return the names of the server instances that the harness uses: one per shard, or just the default instance
+# (None) if it isn't sharding
+def server_instances():
+    shards = config.config.get("server_shards") or 1
+    return [SERVER_SHARD_FMT.format(i) for i in range(shards)] if shards > 1 else [None]
+
+
+## Picks the server instance that serves an arena. Every run against an arena goes to the same instance, so
+# the arena's state lives in a single server.
+# @param arena_id The arena's ID
+# @return the instance's name, or None for the default instance
+def server_instance(arena_id):
+    instances = server_instances()
+    return instances[int(arena_id, 16) % len(instances)]
+
+
+## @param config_dict Configuration context dictionary
+# @return the server instance that serves the target's arena (see server_instance)
+def target_server_instance(config_dict):
+    targets_file = os.path.join(get_target_dir(config_dict), "targets.msg")
+
+    # A target that hasn't been through the wizard yet has no arena; any instance will do.
+    if len(server_instances()) == 1 or not os.path.isfile(targets_file):
+        return server_instances()[0]
+
+    return target_info(targets_file).server_instance
+
+
+## Places each server shard on a NUMA node of its own (round-robin, when there are more shards than nodes), along
+# with the runs that talk to it, so that their pipe and shared arena traffic stays on the node.
+# @param instance A server instance's name, or None for the default instance
+# @return the instance's NUMA node, or None if it isn't placed on one
+def server_numa_node(instance):
+    instances = server_instances()
+    nodes = job_object.numa_node_count()
+
+    if not instance or nodes <= 1:
+        return None
+
+    return instances.index(instance) % nodes
+
+
+## @param instance A server instance's name, or None for the default instance
+# @return the environment that a client needs to talk to the instance, or None for the harness's own
+def server_env(instance):
+    return dict(os.environ, **{config.sl2_server_instance_env: instance}) if instance else None
+
+
+## Run the server in a new powershell window, if it's not already running. When sharding, every shard's
+# instance is started.
 def start_server(close_on_exit=False, no_window=False):
     """
     Start the server, if it's not already running.
     """
-    # NOTE(ww): This is technically a TOCTOU, but it's probably reliable enough for our purposes.
-    server_cmd = " ".join([config.config["server_path"], *config.config["server_args"]])
-    if named_mutex.test_named_mutex("fuzz_server_mutex"):
-        ps_run(server_cmd, close_on_exit=close_on_exit, no_window=no_window)
-    named_mutex.spin_named_mutex("fuzz_server_mutex")
+    for instance in server_instances():
+        # NOTE(ww): This is technically a TOCTOU, but it's probably reliable enough for our purposes.
+        instance_args = ["-n", instance] if instance else []
+        if server_numa_node(instance) is not None:
+            instance_args += ["-numa", str(server_numa_node(instance))]
+        server_cmd = " ".join([config.config["server_path"], *config.config["server_args"], *instance_args])
+        if named_mutex.test_named_mutex(config.server_mutex_name(instance)):
+            ps_run(server_cmd, close_on_exit=close_on_exit, no_window=no_window)
+        named_mutex.spin_named_mutex(config.server_mutex_name(instance))
+
+
+## Ask the running server for its per-event statistics
+#  @param instance The server instance to ask, or None for the default instance
+#  @return a tuple of the number of active connections, a dict of event name -> stats dict for every event that
+#  the server has handled at least once, and a tuple of the runs and distinct paths that it has counted
+def server_stats(instance=None):
+    """
+    Requests per-event latency, lock wait, and I/O statistics from the server.
+    """
+    fmt = "<Q" + ("Q" * len(SL2_EVENT_STATS_FIELDS) * SL2_STATS_NUM_EVENTS) + "QQ"
+
+    with open(config.server_pipe_path(instance), "r+b", buffering=0) as pipe:
+        pipe.write(server_request(ServerEvent.STATS))
+        raw = pipe.read(struct.calcsize(fmt))
+        pipe.write(server_request(ServerEvent.SESSION_TEARDOWN))
+
+    values = struct.unpack(fmt, raw)
+    active_connections, paths, values = values[0], values[-2:], values[1:-2]
+    nfields = len(SL2_EVENT_STATS_FIELDS)
+
+    events = {}
+    for event_id in range(SL2_STATS_NUM_EVENTS):
+        stats = dict(zip(SL2_EVENT_STATS_FIELDS, values[event_id * nfields:(event_id + 1) * nfields]))
+        if stats["count"] > 0:
+            name = ServerEvent(event_id).name if event_id in ServerEvent.__members__.values() else str(event_id)
+            events[name] = stats
+
+    return active_connections, events, paths
+
+
+## Change the running server's log file verbosity
+#  @param verbosity - the new verbosity, from -3 (fatal errors only) to 9 (everything). 0 logs INFO and up, and 1
+#  adds per-event detail
+#  @param instance The server instance to change, or None for the default instance
+#  @return the old verbosity
+def set_server_log_level(verbosity, instance=None):
+    with open(config.server_pipe_path(instance), "r+b", buffering=0) as pipe:
+        pipe.write(server_request(ServerEvent.SET_LOG_LEVEL, struct.pack("<b", max(-3, min(verbosity, 9)))))
+        (old,) = struct.unpack("<b", pipe.read(1))
+        pipe.write(server_request(ServerEvent.SESSION_TEARDOWN))
+
+    return old
+
+
+## Keep these up-to-date with sl2_campaign_config in include/server.hpp
+SL2_CAMPAIGN_CONFIG = struct.Struct("<IIIIIBB2x32s")
+SL2_CONFIG_VERSION = 1
+SL2_CONFIG_MAX_TARGETS = 256
+## The campaign configuration's fields, by the bit that marks them as set
+SL2_CONFIG_FIELDS = {"fuzz_timeout": 0x1, "stickiness": 0x2, "bucketing": 0x4, "scheduler": 0x8, "targets": 0x10}
+## sl2_config_status's values, in order
+SL2_CONFIG_STATUSES = ["ok", "invalid", "stale"]
+## The server's mutation schedulers, in sl2_scheduler's order
+SL2_SCHEDULERS = ["legacy", "ucb1", "thompson"]
+
+## How often (in seconds) workers ask the server whether the campaign's configuration has changed
+CAMPAIGN_POLL_INTERVAL = 1.0
+
+
+## @param raw An sl2_campaign_config, as the server sends it
+# @return the configuration, as a dict of the generation and every field that's been set
+def unpack_campaign_config(raw):
+    _, generation, fields, fuzz_timeout, stickiness, bucketing, scheduler, targets = SL2_CAMPAIGN_CONFIG.unpack(raw)
+    values = {
+        "fuzz_timeout": fuzz_timeout or None,
+        "stickiness": stickiness,
+        "bucketing": bool(bucketing),
+        "scheduler": SL2_SCHEDULERS[scheduler] if scheduler < len(SL2_SCHEDULERS) else str(scheduler),
+        "targets": [i for i in range(SL2_CONFIG_MAX_TARGETS) if targets[i // 8] & (1 << (i % 8))],
+    }
+
+    campaign = {"generation": generation}
+    for name, bit in SL2_CONFIG_FIELDS.items():
+        if fields & bit:
+            campaign[name] = values[name]
+
+    return campaign
+
+
+## @param changes A dict of the fields to set (see SL2_CONFIG_FIELDS). fuzz_timeout is in seconds, or None for
+#  adaptive timeouts, and targets are indices into the target's all_targets.msg
+#  @param generation The configuration generation that the changes are based on, or 0 to apply them regardless
+#  @return the changes, packed as an sl2_campaign_config
+def pack_campaign_config(changes, generation=0):
+    fields = 0
+    for name in changes:
+        if name not in SL2_CONFIG_FIELDS:
+            raise ValueError("unknown campaign setting: {}".format(name))
+        fields |= SL2_CONFIG_FIELDS[name]
+
+    scheduler = changes.get("scheduler", SL2_SCHEDULERS[0])
+    if scheduler not in SL2_SCHEDULERS:
+        raise ValueError("unknown scheduler: {} (expected one of {})".format(scheduler, ", ".join(SL2_SCHEDULERS)))
+
+    targets = bytearray(SL2_CONFIG_MAX_TARGETS // 8)
+    for index in changes.get("targets", []):
+        if not 0 <= index < SL2_CONFIG_MAX_TARGETS:
+            raise ValueError("target index out of range: {}".format(index))
+        targets[index // 8] |= 1 << (index % 8)
+
+    return SL2_CAMPAIGN_CONFIG.pack(
+        SL2_CONFIG_VERSION,
+        generation,
+        fields,
+        changes.get("fuzz_timeout") or 0,
+        changes.get("stickiness", 0),
+        bool(changes.get("bucketing")),
+        SL2_SCHEDULERS.index(scheduler),
+        bytes(targets),
+    )
+
+
+## Ask the running server for the campaign's configuration
+#  @param instance The server instance to ask, or None for the default instance
+#  @return the configuration (see unpack_campaign_config)
+def get_campaign_config(instance=None):
+    with open(config.server_pipe_path(instance), "r+b", buffering=0) as pipe:
+        pipe.write(server_request(ServerEvent.GET_CONFIG))
+        raw = pipe.read(SL2_CAMPAIGN_CONFIG.size)
+        pipe.write(server_request(ServerEvent.SESSION_TEARDOWN))
+
+    return unpack_campaign_config(raw)
+
+
+## Change the campaign's configuration in the running server. Workers pick the changes up between runs.
+#  @param changes The fields to set (see pack_campaign_config)
+#  @param generation The configuration generation that the changes are based on, or 0 to apply them regardless
+#  @param instance The server instance to change, or None for the default instance
+#  @return a tuple of the status ("ok", "invalid" or "stale") and the server's configuration after the request
+def set_campaign_config(changes, generation=0, instance=None):
+    request = pack_campaign_config(changes, generation)
+
+    with open(config.server_pipe_path(instance), "r+b", buffering=0) as pipe:
+        pipe.write(server_request(ServerEvent.SET_CONFIG, request))
+        (status,) = struct.unpack("<B", pipe.read(1))
+        raw = pipe.read(SL2_CAMPAIGN_CONFIG.size)
+        pipe.write(server_request(ServerEvent.SESSION_TEARDOWN))
+
+    status = SL2_CONFIG_STATUSES[status] if status < len(SL2_CONFIG_STATUSES) else str(status)
+    return status, unpack_campaign_config(raw)
+
+
+_campaign_lock = threading.Lock()
+## Server instance -> a tuple of when we last asked it for the campaign's configuration, and what it said
+_campaign_configs = {}
+## Targets file -> the configuration generation whose target selection it holds
+_campaign_targets = {}
+
+
+## @param instance A server instance
+#  @return the campaign's configuration in the instance, asked for at most once every CAMPAIGN_POLL_INTERVAL, or
+#  None if the server couldn't be asked
+def _campaign_config(instance):
+    now = time.monotonic()
+
+    with _campaign_lock:
+        cached = _campaign_configs.get(instance)
+    if cached and now - cached[0] < CAMPAIGN_POLL_INTERVAL:
+        return cached[1]
+
+    try:
+        campaign = get_campaign_config(instance)
+    except (OSError, struct.error):
+        campaign = cached[1] if cached else None
+
+    with _campaign_lock:
+        _campaign_configs[instance] = (now, campaign)
+
+    return campaign
+
+
+## Picks up changes to the campaign's configuration at a run boundary: the fuzzing timeout goes into the worker's
+#  configuration, and the target selection into the targets file, once per configuration generation. The settings
+#  that the server uses itself (stickiness, bucketing and the scheduler) are already in effect there.
+#  @param config_dict The worker's configuration context dictionary
+#  @param targets_file Path to the targets file
+#  @param instance The server instance that serves the target
+def pick_up_campaign_config(config_dict, targets_file, instance):
+    campaign = _campaign_config(instance)
+    if not campaign or campaign["generation"] == config_dict.get("campaign_generation", 0):
+        return
+
+    # Only changes override the worker's own settings, so that e.g. the GUI's timeout still applies
+    # until the campaign's configuration changes again.
+    config_dict["campaign_generation"] = campaign["generation"]
+    if "fuzz_timeout" in campaign:
+        config_dict["fuzz_timeout"] = campaign["fuzz_timeout"]
+
+    if "targets" not in campaign:
+        return
+
+    with _campaign_lock:
+        if _campaign_targets.get(targets_file) == campaign["generation"]:
+            return
+        _campaign_targets[targets_file] = campaign["generation"]
+
+        adapter = get_target(config_dict)
+        selected = [i for i in campaign["targets"] if i < len(adapter.target_list)]
+        if not selected:
+            pwarning("Campaign configuration {} selects none of this target's {} targets; keeping the current "
+                     "selection".format(campaign["generation"], len(adapter.target_list)))
+            return
+
+        adapter.pause()
+        for i, _ in enumerate(adapter):
+            adapter.update(i, selected=i in selected)
+        adapter.unpause()
+
+    print_l("[+] Picked up campaign configuration {}".format(campaign["generation"]))
+
+
+## Builds the drrun command line for a run, with the client reporting its events through a file rather
+# than as JSON on stderr. Runs with an ID keep the file in their run directory; the rest get a temporary
+# one, which the caller is responsible for removing.
+#  @param config_dict - a set of key:value pairs from the config module
+#  @param run_id - the run id to pass to the client
+#  @return a tuple of the InvocationState and the path to the event file
+def dr_invocation(config_dict, run_id=None):
+    config_dict, events_path = dr_run_config(config_dict, run_id)
+    return create_invocation_statement(config_dict, run_id), events_path
+
+
+## @param config_dict - a set of key:value pairs from the config module
+#  @param run_id - the run id to pass to the client
+#  @return a tuple of the config, with the client told where to report its events, and the path to the event file
+#  (see dr_invocation)
+def dr_run_config(config_dict, run_id=None):
+    if run_id:
+        client_name = os.path.splitext(os.path.basename(config_dict["client_path"]))[0]
+        events_path = get_path_to_run_file(run_id, "{}.events".format(client_name))
+    else:
+        events_fd, events_path = tempfile.mkstemp(prefix="sl2-", suffix=".events")
+        os.close(events_fd)
+
+    return dict(config_dict, client_args=[*config_dict["client_args"], "-events", events_path]), events_path
+
+
+## Starts a run's drrun in a job of its own. drrun and everything that it spawns run in the job, which tears the whole
+#  tree down when it's closed.
+#  @param config_dict - the run's config, as returned by dr_run_config
+#  @param stdout - the file to send the run's stdout to
+#  @param stderr - the file to send the run's stderr to
+#  @param invoke - the run's InvocationState, or None to build one
+#  @return a tuple of the job and drrun's process
+def spawn_dr(config_dict, stdout, stderr, invoke=None):
+    invoke = invoke or create_invocation_statement(config_dict, None)
+
+    job = job_object.JobObject(
+        cpu_time=config_dict.get("job_cpu_time"),
+        memory=config_dict.get("job_memory"),
+        numa_node=server_numa_node(config_dict.get("server_instance")),
+    )
+
+    try:
+        popen_obj = job.popen(
+            invoke.cmd_arr,
+            stdout=stdout,
+            stderr=stderr,
+            env=config_dict["env"] if "env" in config_dict else server_env(config_dict.get("server_instance")),
+        )
+    except Exception:
+        job.close()
+        raise
+
+    return job, popen_obj
 
 
 ## Helper for arbitrary runs of dynamorio - wizard, fuzzer, and tracer
+#  The client's events are followed as it writes them, and its stdout and stderr go straight to files
+#  (in the run directory, for runs with an ID), so a run holds next to nothing in memory however chatty
+#  the target is.
 #  @param config_dict - a set of key:value pairs from the config module
 #  @param verbose - verbosity level
 #  @param timeout - number of seconds to wait before killing drrun
 #  @param run_id - specify the run id to pass to the client
 #  @param tracing - indicate whether this run is a tracer run
-def run_dr(config_dict, verbose=0, timeout=None, run_id=None, tracing=False):
+#  @param on_event - called with each event as soon as the client reports it; returning True stops the run
+def run_dr(config_dict, verbose=0, timeout=None, run_id=None, tracing=False, on_event=None):
     """
     Runs dynamorio with the given config.
     Clobbers console output if save_stderr/stdout are true.
     Returns a DRRun instance containing the popen object and PRNG seed
     used during the run.
     """
-    fuzzing = run_id and not tracing
-    invoke = create_invocation_statement(config_dict, run_id)
+    run_config, events_path = dr_run_config(config_dict, run_id)
+    invoke = create_invocation_statement(run_config, run_id)
+
+    # Runs with an ID can be handed to one of the worker's parked targets (see prewarm.py)
+    pool = prewarm.pool(config_dict) if run_id else None
+    parked = pool.take(run_config) if pool else None
 
     if verbose:
         print_l("Executing drrun: %s" % invoke.cmd_str)
+        if parked:
+            print_l("Handing the run to parked target %d" % parked.process.pid)
+
+    stdout_kept = bool(run_id)
+    if stdout_kept:
+        stage_name = "trace" if tracing else "fuzz"
+        stdout_path = get_path_to_run_file(run_id, "{}.stdout".format(stage_name))
+        stderr_path = get_path_to_run_file(run_id, "{}.stderr".format(stage_name))
+    else:
+        stdout_fd, stdout_path = tempfile.mkstemp(prefix="sl2-", suffix=".stdout")
+        stderr_fd, stderr_path = tempfile.mkstemp(prefix="sl2-", suffix=".stderr")
+        os.close(stdout_fd)
+        os.close(stderr_fd)
 
     # Run client on target application
     started = time.time()
+    deadline = started + timeout if timeout else None
+    inline = (verbose > 1) or config_dict["inline_stdout"]
 
-    stdout = sys.stdout if (verbose > 1) or config_dict["inline_stdout"] else subprocess.PIPE
-    stderr = subprocess.PIPE
-    popen_obj = subprocess.Popen(invoke.cmd_arr, stdout=stdout, stderr=stderr)
+    def spawn(spawn_config, stdout_file, stderr_file, spawn_invoke=None):
+        return spawn_dr(spawn_config, sys.stdout if inline else stdout_file, stderr_file, spawn_invoke)
 
-    try:
-        stdout, stderr = popen_obj.communicate(timeout=timeout)
+    if parked:
+        parked.activate(run_config["client_args"])
+        job, popen_obj = parked.job, parked.process
+    else:
+        with open(stdout_path, "wb") as stdout_file, open(stderr_path, "wb") as stderr_file:
+            job, popen_obj = spawn(run_config, stdout_file, stderr_file, invoke)
+
+    # Park the worker's next targets while this run goes, rather than in front of the next run
+    if pool:
+        try:
+            pool.refill(run_config, spawn)
+        except Exception as e:
+            pwarning("Couldn't park a target:", e)
+
+    tail = events.EventTail(events_path)
+    popen_obj.timed_out = False
+    popen_obj.stopped = False
+
+    while True:
+        try:
+            popen_obj.wait(timeout=EVENT_POLL_INTERVAL)
+            break
+        except subprocess.TimeoutExpired:
+            pass
+
+        if on_event:
+            for event in tail.poll():
+                popen_obj.stopped = bool(on_event(event)) or popen_obj.stopped
 
+        if popen_obj.stopped:
+            if verbose:
+                print_l("Stopping the process after %s seconds" % (time.time() - started))
+            break
+
+        # Handle cases where the program didn't exit in time
+        if deadline and time.time() > deadline:
+            if verbose:
+                print_l("Process Timed Out after %s seconds" % (time.time() - started))
+            popen_obj.timed_out = True
+            break
+
+    if popen_obj.returncode is None:
+        # Closing the run's windows gives the client's exit handlers a chance to run. Anything without
+        # a window couldn't be asked to exit, so there's no point in waiting before killing it.
+        closed = job.close_gently()
         if verbose:
-            print_l("Process completed after %s seconds" % (time.time() - started))
+            print_l("Asked %d window(s) of the run to close" % closed)
 
-        # Overwrite fields on the object we return to make stdout/stderr the right type
-        popen_obj.stdout = stdout
-        popen_obj.stderr = stderr
-        popen_obj.timed_out = False
+        if run_id and not pids_registered(run_id, tracing):
+            perror("The PID file was missing, so the run's processes were never registered with the server.")
+            perror("Most likely this is due to a server crash.")
+            run_id = -1
 
-        if verbose > 1:
-            try:
-                print_l(popen_obj.stderr.decode(sys.stderr.encoding))
-            except UnicodeDecodeError:
-                pass
+        # If it doesn't exit after being asked to, we probably caused the target program to hang
+        if not wait_for_stop(job, popen_obj, STOP_GRACE_PERIOD if closed else 0) and popen_obj.timed_out:
+            if verbose:
+                print_l("Caused the target application to hang")
 
-        return DRRun(popen_obj, invoke.seed, run_id)
+            events.append_event(events_path, {"exception": "EXCEPTION_SL2_TIMEOUT"})
 
-    # Handle cases where the program didn't exit in time
-    except subprocess.TimeoutExpired:
+    elif job.exceeded_cpu_time(popen_obj):
         if verbose:
-            print_l("Process Timed Out after %s seconds" % (time.time() - started))
+            print_l("Process ran out of CPU time after %s seconds" % (time.time() - started))
+        popen_obj.timed_out = True
 
-        if run_id:
-            pids_file = get_path_to_run_file(run_id, "trace.pids" if tracing else "fuzz.pids")
+    elif verbose:
+        print_l("Process completed after %s seconds" % (time.time() - started))
 
-            try:
-                with open(pids_file, "rb") as pids_contents:
-                    for line in pids_contents.read().decode("utf-16").split("\n"):
-                        if line:
-                            # TODO(ww): We probably want to call finalize() once per pid here,
-                            # since each pid has its own session/thread on the server.
-                            pid = int(line)
-                            if verbose:
-                                print_l("Killing child process:", pid)
-                            try:
-                                # If we're fuzzing or triaging, try a "soft" kill with taskkill:
-                                # taskkill will send a WM_CLOSE before anything else,
-                                # which will hopefully kill the client more gently
-                                # than a "hard" os.kill (which will prevent the client's
-                                # exit handlers from running).
-                                # TODO(ww): Replace this with a direct WM_CLOSE message.
-                                if fuzzing or tracing:
-                                    os.system("taskkill /T /PID {}".format(pid))
-                                else:
-                                    os.kill(pid, signal.SIGTERM)
-                            except PermissionError as e:
-                                pwarning("Couldn't kill child process (insufficient privilege?):", e)
-                                pwarning("Try running the harness as an Administrator.")
-                            except OSError as e:
-                                pwarning("Couldn't kill child process (maybe already dead?):", e)
-            except FileNotFoundError:
-                perror("The PID file was missing so we couldn't kill the child process.")
-                perror("Most likely this is due to a server crash.")
-                run_id = -1
-        else:
-            pwarning("No run ID, so not looking for PIDs to kill.")
+    job.close()
+    if parked:
+        parked.collect(stdout_path, stderr_path)
+
+    popen_obj.started = started
+    popen_obj.ended = time.time()
+    popen_obj.elapsed = popen_obj.ended - started
+
+    # Runs with an ID keep their output in their run directory. The rest only keep the end of stderr,
+    # which is where drrun complains about targets that it can't run.
+    popen_obj.stdout = None
+    popen_obj.stderr = None
+    stderr_tail = _read_tail(stderr_path) if (not stdout_kept or verbose > 1) else b""
 
-        # Try to get the output again
+    if verbose > 1:
         try:
-            # Try to grab the existing console output
-            stdout, stderr = popen_obj.communicate(timeout=5)
-            popen_obj.stdout = stdout
-            popen_obj.stderr = stderr
+            print_l(stderr_tail.decode(sys.stderr.encoding))
+        except UnicodeDecodeError:
+            pass
 
-        # If the timeout fires again, we probably caused the target program to hang
-        except subprocess.TimeoutExpired:
-            if verbose:
-                print_l("Caused the target application to hang")
+    if not stdout_kept:
+        popen_obj.stderr = stderr_tail
+        for path in [stdout_path, stderr_path]:
+            try:
+                os.remove(path)
+            except OSError:
+                pass
 
-            # Fix types again (expects bytes)
-            popen_obj.stdout = "ERROR".encode("utf-8")
-            popen_obj.stderr = json.dumps({"exception": "EXCEPTION_SL2_TIMEOUT"}).encode("utf-8")
+    return DRRun(popen_obj, invoke.seed, run_id, events_path=events_path)
 
-        popen_obj.timed_out = True
 
-    return DRRun(popen_obj, invoke.seed, run_id)
+## @param path Path to a file
+# @return the last OUTPUT_TAIL_SIZE bytes of the file
+def _read_tail(path):
+    try:
+        with open(path, "rb") as f:
+            f.seek(0, os.SEEK_END)
+            f.seek(max(0, f.tell() - OUTPUT_TAIL_SIZE))
+            return f.read()
+    except OSError:
+        return b""
+
+
+## Waits for a run that's been asked to stop, and kills its whole job if it doesn't exit in time
+#  @param job - the run's job
+#  @param popen_obj - drrun's process
+#  @param grace_period - how long the run has to exit, in seconds
+#  @return whether the run stopped on its own
+def wait_for_stop(job, popen_obj, grace_period):
+    try:
+        popen_obj.wait(timeout=grace_period)
+        return True
+    except subprocess.TimeoutExpired:
+        job.terminate()
+        popen_obj.wait()
+        return False
+
+
+## @param run_id - the run's ID
+#  @param tracing - whether the run is a tracer run
+#  @return whether the client registered the run's processes with the server, which writes their PIDs to
+#  the run's PID file
+def pids_registered(run_id, tracing):
+    return os.path.isfile(get_path_to_run_file(run_id, "trace.pids" if tracing else "fuzz.pids"))
 
 
 ## Executes a Triage run
@@ -241,22 +812,111 @@ def run_dr(config_dict, verbose=0, timeout=None, run_id=None, tracing=False):
 def triager_run(cfg, run_id):
     tracerOutput, _ = tracer_run(cfg, run_id)
 
+    return _triager_findings(cfg, run_id, tracerOutput)
+
+
+## Executes a Triage run for several crashing runs, which are traced in a single tracer process when they can be
+# (see tracer_batch_run)
+# @param cfg Configuration context dictionary
+# @param run_ids The runs' IDs
+# @return a dict of run ID -> what triager_run returns for it
+def triager_batch_run(cfg, run_ids):
+    traced = tracer_batch_run(cfg, run_ids)
+    return {run_id: _triager_findings(cfg, run_id, tracerOutput) for run_id, (tracerOutput, _) in traced.items()}
+
+
+## @param tracerOutput What the tracer found for the run (see tracer_run), or None
+# @return the triager's findings for the run, or None if the tracer didn't find its crash
+def _triager_findings(cfg, run_id, tracerOutput):
     if tracerOutput:
-        crashInfo = Crash.factory(run_id, get_target_slug(cfg), cfg["target_application_path"])
+        crashInfo = Crash.factory(
+            run_id, get_target_slug(cfg), cfg["target_application_path"], crash_focus.parent_run(run_id)
+        )
         return {"run_id": run_id, "tracerOutput": tracerOutput, "crashInfo": crashInfo}
     else:
         return None
 
 
 ## Runs the wizard and lets the user select a target function.
+# The findings are cached in the target directory, and re-used for as long as the target, its
+# arguments and its modules stay the same (see wizard_cache).
 #  @return wizard_findings: List[Dict] - list of targetable functions
 def wizard_run(config_dict):
+    target_dir = get_target_dir(config_dict)
+    cached = None
+
+    if config_dict.get("clear_wizard_cache"):
+        wizard_cache.invalidate(target_dir)
+    else:
+        cached = wizard_cache.load(target_dir, config_dict)
+
+    if cached is not None:
+        wizard_findings, cmps = cached
+        if config_dict["verbose"]:
+            print_l("Using {} cached wizard findings".format(len(wizard_findings)))
+    else:
+        result = _run_wizard(config_dict)
+        if result is None:
+            return []
+
+        wizard_findings, cmps, modules = result
+        if wizard_findings:
+            wizard_cache.store(target_dir, config_dict, wizard_findings, cmps, modules)
+
+    # The cache keeps the wizard's findings as it reported them, so the modes are picked afresh each time.
+    recommend_modes(wizard_findings)
+
+    # Keep whatever tokens we learned about the target's input for the fuzzer's dictionary strategies.
+    dictionary_path = os.path.join(target_dir, dictionary.DICTIONARY_FILE)
+    count = dictionary.build_dictionary(dictionary_path, wizard_findings, cmps, config_dict.get("dictionary"))
+    if config_dict["verbose"]:
+        print_l("Wrote {} tokens to {}".format(count, dictionary_path))
+
+    # Rebuild the fixup table too, so that it always matches the fixups that the user gave us last.
+    fixups_path = os.path.join(target_dir, fixups.FIXUPS_FILE)
+    if config_dict.get("fixups"):
+        count = fixups.build_fixups(fixups_path, config_dict["fixups"])
+        if config_dict["verbose"]:
+            print_l("Wrote {} fixups to {}".format(count, fixups_path))
+    elif os.path.isfile(fixups_path):
+        os.remove(fixups_path)
+
+    peer_path = os.path.join(target_dir, peer.PEER_FILE)
+    if config_dict.get("peer_script"):
+        count = peer.build_peer_script(peer_path, config_dict["peer_script"])
+        if config_dict["verbose"]:
+            print_l("Wrote {} peer responses to {}".format(count, peer_path))
+    elif os.path.isfile(peer_path):
+        os.remove(peer_path)
+
+    directed_path = os.path.join(target_dir, directed.DIRECTED_FILE)
+    if config_dict.get("directed"):
+        count = directed.build_directed(directed_path, config_dict["directed"])
+        if config_dict["verbose"]:
+            print_l("Wrote {} directed targets to {}".format(count, directed_path))
+    elif os.path.isfile(directed_path):
+        os.remove(directed_path)
+
+    return wizard_findings
+
+
+## Runs the target under the wizard
+#  @return (wizard_findings, cmps, modules), or None if the wizard couldn't run the target
+def _run_wizard(config_dict):
+    wizard_args = []
+    if config_dict.get("arg_hash"):
+        wizard_args += ["-arg_hash", config_dict["arg_hash"]]
+    if config_dict.get("wizard_aggregate"):
+        wizard_args.append("-aggregate")
+    if config_dict.get("wizard_influence"):
+        wizard_args.append("-influence")
+
     run = run_dr(
         {
             "drrun_path": config_dict["drrun_path"],
             "drrun_args": config_dict["drrun_args"],
             "client_path": config_dict["wizard_path"],
-            "client_args": config_dict["client_args"],
+            "client_args": [*config_dict["client_args"], *wizard_args],
             "target_application_path": config_dict["target_application_path"],
             "target_args": config_dict["target_args"],
             "inline_stdout": config_dict["inline_stdout"],
@@ -265,21 +925,23 @@ def wizard_run(config_dict):
     )
 
     wizard_findings = []
+    cmps = set()
+    influence = {}
     mem_map = {}
+    modules = set()
     base_addr = None
 
-    for line in run.process.stderr.split(b"\n"):
-        try:
-            line = line.decode("utf-8")
-
-            if re.match(r"ERROR: Target process .* is for the wrong architecture", line):
-                perror("Bad architecture for target application:", config_dict["target_application_path"])
-                return []
-
-            obj = json.loads(line)
+    if re.search(rb"ERROR: Target process .* is for the wrong architecture", run.process.stderr or b""):
+        perror("Bad architecture for target application:", config_dict["target_application_path"])
+        os.remove(run.events_path)
+        return None
 
+    for obj in run.events():
+        try:
             if "map" == obj["type"]:
                 mem_map[(obj["start"], obj["end"])] = obj["mod_name"]
+                if obj.get("path"):
+                    modules.add(obj["path"])
                 if ".exe" in obj["mod_name"]:
                     base_addr = obj["start"]
             elif "id" == obj["type"]:
@@ -291,22 +953,102 @@ def wizard_run(config_dict):
                         obj["called_from"] = mem_map[addrs]
 
                 wizard_findings.append(obj)
-        except UnicodeDecodeError:
-            if config_dict["verbose"]:
-                pwarning("Not UTF-8:", repr(line))
-        except json.JSONDecodeError:
+            elif "cmp" == obj["type"]:
+                cmps.add((obj["size"], obj["value"]))
+            elif "influence" == obj["type"]:
+                influence[(obj["func_name"], obj["callCount"])] = (obj["influenceBlocks"], obj["influenceBranches"])
+        except KeyError:
             pass
         except Exception as e:
             perror("Unexpected exception:", e)
 
-    return wizard_findings
+    os.remove(run.events_path)
+
+    # Aggregated findings come with their call site's influence, but single calls' is only known once the
+    # target is done, so it's reported separately. Calls that weren't followed by any new code have none.
+    if config_dict.get("wizard_influence"):
+        for finding in wizard_findings:
+            if "influenceBlocks" not in finding:
+                blocks, branches = influence.get((finding["func_name"], finding["callCount"]), (0, 0))
+                finding["influenceBlocks"] = blocks
+                finding["influenceBranches"] = branches
+
+    return wizard_findings, cmps, modules
 
 
 ## Runs the fuzzer with a given config dict and targets file.
 #  @return (crashed, run): Tuple(bool, DRRun) - whether the program crashed, and the run metadata
 def fuzzer_run(config_dict, targets_file):
     """ Runs the fuzzer """
+    run_id, fuzz_config = fuzzer_config(config_dict, targets_file)
+
+    # Crash handlers (e.g. WER) can keep a crashed target around for a long while, so there's no point
+    # in waiting on it once the client has reported the crash.
+    def on_event(event):
+        return bool(event.get("exception")) and config_dict.get("kill_after_crash", False)
+
+    timeout = timeouts.fuzz_timeout(config_dict)
+    run = run_dr(
+        fuzz_config,
+        verbose=config_dict["verbose"],
+        timeout=timeout,
+        run_id=run_id,
+        tracing=False,
+        on_event=on_event,
+    )
+
+    return fuzzer_finish(config_dict, run, timeout)
+
+
+## What every fuzzing run of a targets file has in common, worked out once per version of the file (see target_info)
+class TargetInfo(NamedTuple):
+    arena_id: str
+    server_instance: str
+    ## The environment that the runs' clients need to talk to the server instance, or None for the harness's own
+    env: dict
+
+
+## Targets file -> (its size and mtime, its TargetInfo)
+_target_infos = {}
+_target_infos_lock = threading.Lock()
+
+
+## Looks up what a targets file's runs have in common, only re-reading (and re-hashing) the file once it changes
+# @param targets_file Path to the targets file
+# @return the file's TargetInfo
+def target_info(targets_file):
+    try:
+        stat = os.stat(targets_file)
+        key = (stat.st_size, stat.st_mtime_ns)
+    except OSError:
+        key = None
+
+    with _target_infos_lock:
+        cached = _target_infos.get(targets_file)
+
+    if key is not None and cached and cached[0] == key:
+        return cached[1]
+
+    arena_id = _hash_targets(targets_file)
+    instance = server_instance(arena_id)
+    info = TargetInfo(arena_id, instance, server_env(instance))
+
+    if key is not None:
+        with _target_infos_lock:
+            _target_infos[targets_file] = (key, info)
+
+    return info
+
 
+## @param targets_file Path to the targets file
+# @return the ID of the arena that the targets file's runs share
+def target_arena_id(targets_file):
+    return target_info(targets_file).arena_id
+
+
+## @param targets_file Path to the targets file
+# @return the ID of the arena that the targets file's runs share, hashed from its contents
+def _hash_targets(targets_file):
     if not os.path.isfile(targets_file):
         perror("Nonexistent targets file:", targets_file)
 
@@ -325,57 +1067,253 @@ def fuzzer_run(config_dict, targets_file):
         hasher.update(array.array("B", target[b"buffer"]))
         hasher.update(target[b"func_name"])
 
-    arena_id = hasher.hexdigest()
+    return hasher.hexdigest()
 
-    # Generate a run ID and hand it to the fuzzer.
-    run_id = generate_run_id(config_dict)
 
-    run = run_dr(
-        {
-            "drrun_path": config_dict["drrun_path"],
-            "drrun_args": config_dict["drrun_args"],
-            "client_path": config_dict["client_path"],
-            "client_args": [*config_dict["client_args"], "-r", str(run_id), "-a", arena_id],
-            "target_application_path": config_dict["target_application_path"],
-            "target_args": config_dict["target_args"],
-            "inline_stdout": config_dict["inline_stdout"],
-        },
-        verbose=config_dict["verbose"],
-        timeout=config_dict.get("fuzz_timeout", None),
-        run_id=run_id,
-        tracing=False,
-    )
+## Sets up a new fuzzing run: its run directory, seed, arena, and client arguments
+# @param config_dict Configuration context dictionary
+# @param targets_file Path to the targets file
+# @return a tuple of the run ID and the configuration to hand to run_dr (or dr_invocation)
+def fuzzer_config(config_dict, targets_file):
+    pick_up_campaign_config(config_dict, targets_file, target_info(targets_file).server_instance)
+    target = target_info(targets_file)
+    arena_id = target.arena_id
+
+    # Hand the fuzzer a run ID: a scratch run directory, unless we've been told which run this is.
+    if "run_id" in config_dict:
+        run_id = generate_run_id(config_dict)
+    else:
+        run_id = run_slots.slots.acquire(config_dict)
+
+    # Restrict coverage to the modules the user cares about, if they told us which.
+    coverage_args = []
+    for key in ["coverage_allow", "coverage_deny"]:
+        if config_dict.get(key):
+            coverage_args += ["-" + key, ";".join(config_dict[key])]
+
+    # Seed the mutation engine, so that this run can be reproduced from its seed. Scratch run IDs are reused,
+    # so the seed comes from a fresh one.
+    if config_dict.get("seed") is not None:
+        seed = str(config_dict["seed"])
+    else:
+        seed = str(generate_seed(run_id if "run_id" in config_dict else uuid.uuid4()))
+    coverage_args += ["-seed", seed]
 
-    # Parse crash status from the output.
-    crashed = False
-    coverage_info = None
+    if config_dict.get("havoc"):
+        coverage_args.append("-havoc")
 
-    for line in run.process.stderr.split(b"\n"):
-        try:
-            line = line.decode("utf-8")
+    if config_dict.get("mutation_ring"):
+        coverage_args.append("-ring")
 
-            # Identify whether the fuzzing run resulted in a crash
-            if not crashed:
-                crashed, exception = check_fuzz_line_for_crash(line)
+    if config_dict.get("deterministic"):
+        coverage_args.append("-deterministic")
 
-            if "#COVERAGE:" in line:
-                coverage_info = json.loads(line.replace("#COVERAGE:", ""))
-        except UnicodeDecodeError:
-            if config_dict["verbose"]:
-                perror("Not UTF-8:", repr(line))
+    if config_dict.get("async_registration"):
+        coverage_args.append("-async")
+
+    if config_dict.get("splice"):
+        coverage_args += ["-splice", str(config_dict["splice"])]
+
+    if config_dict.get("seeds"):
+        coverage_args += ["-seeds", str(config_dict["seeds"])]
+
+    if config_dict.get("map_size"):
+        coverage_args += ["-map_size", str(config_dict["map_size"])]
+
+    if config_dict.get("hang_ms"):
+        coverage_args += ["-hang_ms", str(config_dict["hang_ms"])]
+
+    if config_dict.get("virtual_file"):
+        coverage_args += ["-virtual_file", config_dict["virtual_file"]]
+
+    peer_path = os.path.join(os.path.dirname(targets_file), peer.PEER_FILE)
+    if config_dict.get("emulate_peer") and os.path.isfile(peer_path):
+        coverage_args += ["-emulate_peer", config_dict["emulate_peer"], "-peer_script", peer_path]
+
+    if config_dict.get("mutator"):
+        coverage_args += ["-mutator", config_dict["mutator"]]
 
-    run = DRRun(run.process, run.seed, run.run_id, coverage_info)
+        if config_dict.get("mutator_options"):
+            coverage_args += ["-mutator_options", config_dict["mutator_options"]]
+
+    dictionary_path = os.path.join(os.path.dirname(targets_file), dictionary.DICTIONARY_FILE)
+    if os.path.isfile(dictionary_path):
+        coverage_args += ["-dictionary", dictionary_path]
+
+    fixups_path = os.path.join(os.path.dirname(targets_file), fixups.FIXUPS_FILE)
+    if os.path.isfile(fixups_path):
+        coverage_args += ["-fixups", fixups_path]
+
+    directed_path = os.path.join(os.path.dirname(targets_file), directed.DIRECTED_FILE)
+    if os.path.isfile(directed_path):
+        coverage_args += ["-directed", directed_path]
+
+    cmplog_path = os.path.join(os.path.dirname(targets_file), cmplog.CMPLOG_FILE)
+    if os.path.isfile(cmplog_path):
+        coverage_args += ["-cmplog_table", cmplog_path]
+
+    run_drcov = get_path_to_run_file(run_id, drcov.RUN_DRCOV_FILE)
+    if config_dict.get("drcov"):
+        coverage_args += ["-drcov", run_drcov]
+
+    # Spend the run around a new crash instead, if a burst of focused runs is going (see crash_focus).
+    focused = crash_focus.focus(config_dict).next_run() if config_dict.get("crash_focus") else None
+    if focused:
+        coverage_args += ["-focus_run", focused[0], "-focus_count", str(focused[1])]
+        crash_focus.mark_run(run_id, focused[0])
+
+    return run_id, {
+        "drrun_path": config_dict["drrun_path"],
+        "drrun_args": config_dict["drrun_args"],
+        "client_path": config_dict["client_path"],
+        "client_args": [*config_dict["client_args"], *coverage_args, "-r", str(run_id), "-a", arena_id],
+        "target_application_path": config_dict["target_application_path"],
+        "target_args": config_dict["target_args"],
+        "inline_stdout": config_dict["inline_stdout"],
+        "seed": seed,
+        "server_instance": target.server_instance,
+        "env": target.env,
+        "prewarm": config_dict.get("prewarm"),
+    }
+
+
+## Sets up a replay: a fuzzing run that replays given inputs (see -replay_inputs and friends) instead of mutating
+# @param config_dict Configuration context dictionary
+# @param run_id The replay's run ID (a run slot)
+# @param arena_id The target's arena ID
+# @param replay_args The fuzzer's replay arguments
+# @return the configuration to hand to run_dr
+def replay_config(config_dict, run_id, arena_id, replay_args):
+    coverage_args = []
+    for key in ["coverage_allow", "coverage_deny"]:
+        if config_dict.get(key):
+            coverage_args += ["-" + key, ";".join(config_dict[key])]
+
+    return {
+        "drrun_path": config_dict["drrun_path"],
+        "drrun_args": config_dict["drrun_args"],
+        "client_path": config_dict["client_path"],
+        "client_args": [
+            *config_dict["client_args"],
+            *coverage_args,
+            *replay_args,
+            "-r",
+            str(run_id),
+            "-a",
+            arena_id,
+        ],
+        "target_application_path": config_dict["target_application_path"],
+        "target_args": config_dict["target_args"],
+        "inline_stdout": config_dict["inline_stdout"],
+        "seed": "0",
+        "server_instance": server_instance(arena_id),
+    }
+
+
+## @param event_id A server event's number
+# @return the event's name, or its number if it isn't known
+def _server_event_name(event_id):
+    return ServerEvent(event_id).name if event_id in ServerEvent.__members__.values() else str(event_id)
+
+
+## Wraps up a finished fuzzing run: checks it for a crash, and keeps or discards its run directory
+# @param config_dict Configuration context dictionary
+# @param run The finished run (a DRRun)
+# @param timeout The timeout that the run was given, in seconds (or None)
+# @return a tuple of whether the run crashed, and the run (with its coverage)
+def fuzzer_finish(config_dict, run, timeout=None):
+    parse_started = time.time()
+    run_id = run.run_id
+    run_drcov = get_path_to_run_file(run_id, drcov.RUN_DRCOV_FILE)
+
+    # Parse crash status from the output.
+    crashed = False
+    coverage_info = None
+    signature = None
+    severity = triage_queue.SEVERITY_NONE
+    timing = None
+    probes = {}
+
+    for obj in run.events():
+        # Identify whether the fuzzing run resulted in a crash
+        if not crashed and obj.get("exception"):
+            crashed, exception = True, obj["exception"]
+            signature = triage_queue.crash_signature(obj)
+            severity = triage_queue.crash_severity(obj)
+
+        if obj.get("type") == "coverage":
+            coverage_info = {key: obj.get(key) for key in COVERAGE_KEYS}
+
+        if obj.get("type") == "timing":
+            timing = obj
+
+        if obj.get("type") == "profile":
+            probes[obj.get("probe")] = obj
+
+    if probes:
+        print_l("Profile of run %s:" % run_id)
+        for line in profile.format_profile(probes, _server_event_name):
+            print_l(line)
+
+    run = DRRun(run.process, run.seed, run.run_id, coverage_info, run.events_path, signature, severity)
+
+    # Feed the target's adaptive timeout, and keep track of the runs that it cut short.
+    slow = False
+    if config_dict.get("adaptive_timeout") and not crashed:
+        run_times = timeouts.run_times(config_dict)
+        if not run.process.timed_out:
+            run_times.observe(run.process.elapsed)
+        elif timeout is not None and timeout < timeouts.ceiling(config_dict):
+            slow = run_times.slow_run(run_id, run.seed, run.process.elapsed, timeout)
+
+    # The server flags runs that took far longer than their arena's usual (and keeps their inputs out of its
+    # corpus), which are logged and kept like the ones that the adaptive timeout cut short.
+    server_slow = not crashed and not slow and bool(coverage_info and coverage_info.get("slow"))
+    if server_slow:
+        slow = timeouts.run_times(config_dict).slow_run(run_id, run.seed, run.process.elapsed, timeout)
+
+    # Fold this run's exact coverage into the target's, before the run directory (maybe) goes away.
+    if config_dict.get("drcov") and os.path.isfile(run_drcov):
+        with drcov_lock:
+            drcov.merge_drcov(os.path.join(get_target_dir(config_dict), drcov.TARGET_DRCOV_FILE), run_drcov)
 
     if crashed:
+        if run.process.returncode == EXIT_HUNG:
+            print_l("Fuzzing run %s hung, and was ended by its watchdog" % run_id)
         print_l("Fuzzing run %s returned %s after raising %s" % (run_id, run.process.returncode, exception))
+        run_slots.slots.keep(run_id)
+
+        if config_dict.get("crash_focus") and crash_focus.parent_run(run_id) is None:
+            if crash_focus.focus(config_dict).crash_found(run_id, signature, config_dict["crash_focus"]):
+                print_l("Focusing the next %d runs on run %s (%s)" % (config_dict["crash_focus"], run_id, signature))
         write_output_files(run, run_id, "fuzz")
-    elif config_dict["preserve_runs"]:
-        print_l("Preserving run %s without a crash (requested)" % run_id)
+    elif config_dict["preserve_runs"] or slow:
+        if slow and server_slow:
+            print_l(
+                "Preserving run %s, which took %sus, far longer than its arena's usual" % (run_id, coverage_info["us"])
+            )
+        elif slow:
+            print_l("Preserving run %s, which ran past its adaptive timeout of %ss" % (run_id, timeout))
+        else:
+            print_l("Preserving run %s without a crash (requested)" % run_id)
+        run_slots.slots.keep(run_id)
         write_output_files(run, run_id, "fuzz")
+        archive.archive_run(config_dict, run_id)
     else:
         if config_dict["verbose"]:
+            if run.process.returncode == EXIT_TARGETS_CONSUMED:
+                print_l("Run %s exited early after consuming every target" % run_id)
             print_l("Run %s did not find a crash" % run_id)
-        shutil.rmtree(os.path.join(config.sl2_runs_dir, str(run_id)), ignore_errors=True)
+        if not run_slots.slots.release(run_id):
+            shutil.rmtree(os.path.join(config.sl2_runs_dir, str(run_id)), ignore_errors=True)
+
+    durations = telemetry.stage_durations(
+        timing,
+        getattr(run.process, "started", None),
+        getattr(run.process, "ended", None),
+        time.time() - parse_started,
+    )
+    telemetry.telemetry(config_dict).observe(durations)
 
     return crashed, run
 
@@ -385,73 +1323,235 @@ def fuzzer_run(config_dict, targets_file):
 # @param config_dict Configuration context dictionary
 # @param run_id Run ID (guid)
 def tracer_run(config_dict, run_id):
+    # The tracer replays the run's FKTs out of its directory, so an archived run has to be restored.
+    archive.restore_run(run_id)
+    tracer_args = ["-r", str(run_id), "-run_dir", os.path.join(config.sl2_runs_dir, str(run_id))]
+
+    run = _run_tracer(config_dict, run_id, tracer_args, config_dict.get("tracer_timeout", None))
+    success, message, stats = _tracer_results(run).get(str(run_id), (False, None, None))
+
+    if success:
+        formatted, raw = parse_tracer_crash_files(run_id)
+        if raw is not None:
+            Tracer.factory(run_id, formatted, raw, stats)
+        return formatted, raw
+    else:
+        perror("Tracer failure:", message)
+        return None, None
+
+
+## Replays several crashing runs in a single tracer process, by looping the persistent target that client_args give
+# the fuzzer (-persist_module), so that the tracer's startup is paid for once per batch instead of once per crash.
+# Runs that the batch didn't get to, or that didn't crash in it, are traced in a fresh process instead, since the
+# runs before them may have left the target in a state that they don't crash from.
+# @param config_dict Configuration context dictionary
+# @param run_ids The runs' IDs
+# @return a dict of run ID -> what tracer_run returns for it
+def tracer_batch_run(config_dict, run_ids):
+    run_ids = [str(run_id) for run_id in run_ids]
+    if len(run_ids) < 2 or "-persist_module" not in config_dict["client_args"]:
+        return {run_id: tracer_run(config_dict, run_id) for run_id in run_ids}
+
+    for run_id in run_ids:
+        archive.restore_run(run_id)
+
+    first = run_ids[0]
+    runs_path = get_path_to_run_file(first, TRACER_BATCH_FILE)
+    with open(runs_path, "w") as runs_file:
+        runs_file.write("\n".join(run_ids[1:]) + "\n")
+
+    tracer_args = ["-r", first, "-run_dir", os.path.join(config.sl2_runs_dir, first), "-runs", runs_path]
+    timeout = config_dict.get("tracer_timeout", None)
+
+    run = _run_tracer(config_dict, first, tracer_args, timeout * len(run_ids) if timeout else None)
+    results = _tracer_results(run)
+
+    traced = {}
+    for run_id in run_ids:
+        success, _, stats = results.get(run_id, (False, None, None))
+        raw = None
+
+        if success:
+            formatted, raw = parse_tracer_crash_files(run_id)
+
+        if raw is not None:
+            Tracer.factory(run_id, formatted, raw, stats)
+            traced[run_id] = formatted, raw
+
+    if config_dict["verbose"]:
+        print_l("Traced {} of {} crashes in a single tracer process".format(len(traced), len(run_ids)))
+
+    for run_id in run_ids:
+        if run_id not in traced:
+            traced[run_id] = tracer_run(config_dict, run_id)
+
+    return traced
+
+
+## Runs the tracer over one or more crashing runs
+# @param config_dict Configuration context dictionary
+# @param run_id The (first) run's ID, which keeps the tracer's output
+# @param tracer_args The tracer's arguments that say which runs to replay
+# @param timeout How long the tracer has, in seconds, or None
+# @return the DRRun
+def _run_tracer(config_dict, run_id, tracer_args, timeout):
+    tracer_args = list(tracer_args)
+    if config_dict.get("tracer_scope"):
+        tracer_args += ["-taint_scope", config_dict["tracer_scope"]]
+    if config_dict.get("tracer_idle"):
+        tracer_args += ["-taint_idle", str(config_dict["tracer_idle"])]
+    if config_dict.get("tracer_labels"):
+        tracer_args.append("-labels")
+    if config_dict.get("tracer_dump"):
+        tracer_args += ["-dump", config_dict["tracer_dump"]]
+
     run = run_dr(
         {
             "drrun_path": config_dict["drrun_path"],
             "drrun_args": config_dict["drrun_args"],
             "client_path": config_dict["tracer_path"],
-            "client_args": [*config_dict["client_args"], "-r", str(run_id)],
+            "client_args": [*config_dict["client_args"], *tracer_args],
             "target_application_path": config_dict["target_application_path"],
             "target_args": config_dict["target_args"],
             "inline_stdout": config_dict["inline_stdout"],
+            "server_instance": target_server_instance(config_dict),
         },
         config_dict["verbose"],
-        config_dict.get("tracer_timeout", None),
+        timeout,
         run_id=run_id,
     )
 
     # Write stdout and stderr to files
     write_output_files(run, run_id, "trace")
 
-    success = False
-    message = None
+    return run
 
-    for line in run.process.stderr.split(b"\n"):
-        try:
-            obj = json.loads(line.decode("utf-8"))
 
-            if obj["run_id"] == str(run_id) and "success" in obj:
-                success = obj["success"]
-                message = obj["message"]
-                break
+## @param run A tracer's DRRun
+# @return a dict of run ID -> (whether its replay crashed, the tracer's message, the tracer's overhead counters),
+# for each run that the tracer reported on
+def _tracer_results(run):
+    results = {}
+
+    for obj in run.events():
+        try:
+            result = results.setdefault(obj["run_id"], [False, None, {"modules": {}}])
+
+            if obj.get("type") == "tracer_module":
+                result[2]["modules"][obj["module"]] = obj["insns"]
+            elif "success" in obj:
+                result[0] = obj["success"]
+                result[1] = obj["message"]
+                result[2].update({key: obj[key] for key in TRACER_STATS_KEYS if key in obj})
         except Exception:
             pass
 
-    if success:
-        formatted, raw = parse_tracer_crash_files(run_id)
-        if raw is not None:
-            Tracer.factory(run_id, formatted, raw)
-        return formatted, raw
+    return {run_id: tuple(result) for run_id, result in results.items()}
+
+
+## Triages a crashing run once the server has written its dump, and prints what the triage found
+# @param config_dict Configuration context dictionary
+# @param run_id Run ID (guid)
+def triage_crash(config_dict, run_id):
+    dumps.wait_for_dump(run_id)
+
+    try:
+        triagerInfo = triager_run(config_dict, run_id)
+    except Exception:
+        traceback.print_exc()
+        triagerInfo = None
+
+    if triagerInfo:
+        print_l(triagerInfo)
     else:
-        perror("Tracer failure:", message)
-        return None, None
+        perror("Triage failure?")
+
+    return triagerInfo
+
+
+## Triages several crashing runs at once (see triager_batch_run), and prints what the triage found
+# @param config_dict Configuration context dictionary
+# @param run_ids The runs' IDs
+# @return a dict of run ID -> the triager's findings, or None
+def triage_crashes(config_dict, run_ids):
+    for run_id in run_ids:
+        dumps.wait_for_dump(run_id)
+
+    try:
+        findings = triager_batch_run(config_dict, run_ids)
+    except Exception:
+        traceback.print_exc()
+        findings = {}
+
+    for run_id in run_ids:
+        if findings.get(str(run_id)):
+            print_l(findings[str(run_id)])
+        else:
+            perror("Triage failure?")
+
+    return findings
+
+
+## Starts the target's triage queue, which triages crashes with triage_crash on
+# config_dict["triage_workers"] threads of its own. With --tracer_batch, each worker triages up to that many queued
+# crashes at once, with triage_crashes.
+# @param config_dict Configuration context dictionary
+# @return the TriageQueue
+def start_triage_queue(config_dict):
+    return triage_queue.TriageQueue(
+        get_target_dir(config_dict),
+        lambda run_id: triage_crash(config_dict, run_id),
+        config_dict.get("triage_workers", 1),
+        lambda run_id: archive.archive_run(config_dict, run_id),
+        lambda run_ids: triage_crashes(config_dict, run_ids),
+        config_dict.get("tracer_batch") or 1,
+    )
+
+
+## Hands a crashing run to the triage queue, or triages it right away if there's no queue
+# @param config_dict Configuration context dictionary
+# @param run The crashing run
+# @param queue The TriageQueue, or None
+# @param on_triaged Called with the run ID and the triager's findings (or None) once the run is triaged
+def queue_triage(config_dict, run, queue=None, on_triaged=None):
+    target_dir = get_target_dir(config_dict)
+
+    if queue is None:
+        triagerInfo = triage_crash(config_dict, run.run_id)
+        retention.retain_crash(config_dict, target_dir, run.run_id, run.crash_signature)
+        if on_triaged:
+            on_triaged(run.run_id, triagerInfo)
+        archive.archive_run(config_dict, run.run_id)
+    elif not queue.submit(run.run_id, run.crash_signature, on_triaged, run.crash_severity):
+        print_l("Not triaging run %s, which crashed like one before it (%s)" % (run.run_id, run.crash_signature))
+        if not retention.retain_crash(config_dict, target_dir, run.run_id, run.crash_signature):
+            print_l("Dropped the memory dumps of run %s, a duplicate of %s" % (run.run_id, run.crash_signature))
+        archive.archive_run(config_dict, run.run_id)
+    else:
+        # Queued crashes are the first of their signature, so they keep their artifacts for triage.
+        retention.retain_crash(config_dict, target_dir, run.run_id, run.crash_signature)
 
 
 ## Fuzzing run followed by triage
 # Runs the fuzzer (in a loop if continuous is true), then runs the triage
 # tools (DR tracer and breakpad) if a crash is found.
 # @param config_dict Configuration context dictionary
-# @param run_id Run ID (guid)
-def fuzz_and_triage(config_dict):
+# @param queue The TriageQueue to hand crashes to, or None to triage them on this thread
+def fuzz_and_triage(config_dict, queue=None):
     global can_fuzz
 
     targets_file = os.path.join(get_target_dir(config_dict), "targets.msg")
 
     # TODO: Move try/except so we can start new runs after an exception
-    with SessionManager(get_target_slug(config_dict)) as manager:
+    with SessionManager(get_target_slug(config_dict)) as manager, contextlib.ExitStack() as stack:
+        stack.callback(prewarm.drain)
         while can_fuzz:
             try:
                 crashed, run = fuzzer_run(config_dict, targets_file)
                 manager.run_complete(run, found_crash=crashed)
 
                 if crashed:
-
-                    triagerInfo = triager_run(config_dict, run.run_id)
-
-                    if triagerInfo:
-                        print_l(triagerInfo)
-                    else:
-                        perror("Triage failure?")
+                    queue_triage(config_dict, run, queue)
 
                     if config_dict["exit_early"]:
                         # Prevent other threads from starting new fuzzing runs
@@ -467,6 +1567,125 @@ def fuzz_and_triage(config_dict):
                 traceback.print_exc()
 
 
+## Fuzzing runs of several targets at once, followed by triage
+# Like fuzz_and_triage, but each run is of whichever target the scheduler picks, so that the workers go
+# where new coverage and crashes are still turning up.
+# @param scheduler The TargetScheduler
+def scheduled_fuzz_and_triage(scheduler):
+    global can_fuzz
+
+    # SessionManagers aren't shared between threads, so each worker keeps one per target.
+    managers = {}
+
+    with contextlib.ExitStack() as stack:
+        stack.callback(prewarm.drain)
+        while can_fuzz:
+            target = scheduler.next()
+            if target is None:
+                return
+
+            try:
+                config_dict = target.config_dict
+                if target.targets_file not in managers:
+                    managers[target.targets_file] = stack.enter_context(
+                        SessionManager(get_target_slug(config_dict))
+                    )
+
+                crashed, run = fuzzer_run(config_dict, target.targets_file)
+                managers[target.targets_file].run_complete(run, found_crash=crashed)
+                scheduler.run_complete(target, crashed, run)
+
+                if crashed:
+                    queue_triage(config_dict, run, target.queue)
+
+                    if config_dict["exit_early"]:
+                        # Prevent other threads from starting new fuzzing runs
+                        can_fuzz = False
+
+                if run.run_id == -1:
+                    start_server()
+
+            except Exception:
+                traceback.print_exc()
+
+
+## Fuzzing runs under the native supervisor, followed by triage
+# Like fuzz_and_triage, but the runs themselves are spawned, pinned and waited on by supervisor.exe, which
+# keeps config_dict["simultaneous"] of them going at once. This thread only sets runs up and wraps them
+# up; crashes go to the triage queue, so that the slots keep fuzzing meanwhile.
+# @param config_dict Configuration context dictionary
+def supervised_fuzz_and_triage(config_dict):
+    global can_fuzz
+
+    targets_file = os.path.join(get_target_dir(config_dict), "targets.msg")
+    workers = config_dict["simultaneous"]
+    remaining = None if config_dict["continuous"] else config_dict["runs"]
+    pending = {}
+
+    # The supervisor's runs inherit its environment, and so the target's server instance, and
+    # share the instance's NUMA node.
+    target = target_info(targets_file)
+    instance = target.server_instance
+    with SessionManager(get_target_slug(config_dict)) as manager, supervisor.Supervisor(
+        config_dict["supervisor_path"], workers, env=target.env, numa_node=server_numa_node(instance)
+    ) as sup, start_triage_queue(config_dict) as queue:
+
+        def submit():
+            nonlocal remaining
+            run_id, fuzz_config = fuzzer_config(config_dict, targets_file)
+            invoke, events_path = dr_invocation(fuzz_config, run_id)
+
+            if config_dict["verbose"]:
+                print_l("Executing drrun: %s" % invoke.cmd_str)
+
+            timeout = timeouts.fuzz_timeout(config_dict)
+            pending[str(run_id)] = (run_id, invoke.seed, events_path, timeout)
+            sup.submit(
+                run_id,
+                invoke.cmd_arr,
+                get_path_to_run_file(run_id, "fuzz.stdout"),
+                get_path_to_run_file(run_id, "fuzz.stderr"),
+                timeout,
+                config_dict.get("job_cpu_time", None),
+                config_dict.get("job_memory", None),
+            )
+            if remaining is not None:
+                remaining -= 1
+
+        # Keep a run queued behind every slot, so that no slot waits on this thread between runs.
+        while can_fuzz and len(pending) < workers * 2 and remaining != 0:
+            submit()
+
+        while pending:
+            result = sup.next_result()
+            if result is None:
+                perror("The supervisor exited with %d runs outstanding" % len(pending))
+                break
+
+            try:
+                run_id, seed, events_path, timeout = pending.pop(result["id"])
+
+                # Runs that didn't even close when asked are treated as hangs, like in run_dr.
+                if result["hung"]:
+                    events.append_event(events_path, {"exception": "EXCEPTION_SL2_TIMEOUT"})
+
+                run = DRRun(supervisor.SupervisedProcess(result), seed, run_id, events_path=events_path)
+                crashed, run = fuzzer_finish(config_dict, run, timeout)
+                manager.run_complete(run, found_crash=crashed)
+
+                if crashed:
+                    queue_triage(config_dict, run, queue)
+
+                    if config_dict["exit_early"]:
+                        # Stop handing out new runs; the ones already queued still finish.
+                        can_fuzz = False
+
+                if can_fuzz and remaining != 0:
+                    submit()
+            except Exception:
+                traceback.print_exc()
+
+
 def kill():
     """
     Ends a sequence of fuzzing runs.
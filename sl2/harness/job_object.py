@@ -0,0 +1,268 @@
+## @package job_object
+#
+# Puts a run (drrun, and everything that it spawns) in a Windows job object, so that the whole tree
+# can be torn down in one call when it times out, and so that the kernel can enforce CPU-time and
+# memory limits on it.
+#
+# supervisor/supervisor.cpp does the same for supervised runs.
+
+import ctypes
+import subprocess
+from ctypes import wintypes
+
+## Processes created with this flag don't run until they're resumed
+CREATE_SUSPENDED = 0x00000004
+
+JOB_OBJECT_LIMIT_JOB_TIME = 0x00000004
+JOB_OBJECT_LIMIT_JOB_MEMORY = 0x00000200
+JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE = 0x00002000
+
+JobObjectBasicProcessIdList = 3
+JobObjectExtendedLimitInformation = 9
+JobObjectGroupInformationEx = 14
+
+## The exit code of every process in a job that ran out of CPU time
+ERROR_NOT_ENOUGH_QUOTA = 1816
+
+## The exit code that terminate() gives the job's processes
+EXIT_JOB_TERMINATED = 0xFFFFFFFF
+
+WM_CLOSE = 0x0010
+
+## The most processes that pids() reports
+MAX_JOB_PIDS = 256
+
+
+class IO_COUNTERS(ctypes.Structure):
+    _fields_ = [
+        ("ReadOperationCount", ctypes.c_ulonglong),
+        ("WriteOperationCount", ctypes.c_ulonglong),
+        ("OtherOperationCount", ctypes.c_ulonglong),
+        ("ReadTransferCount", ctypes.c_ulonglong),
+        ("WriteTransferCount", ctypes.c_ulonglong),
+        ("OtherTransferCount", ctypes.c_ulonglong),
+    ]
+
+
+class JOBOBJECT_BASIC_LIMIT_INFORMATION(ctypes.Structure):
+    _fields_ = [
+        ("PerProcessUserTimeLimit", wintypes.LARGE_INTEGER),
+        ("PerJobUserTimeLimit", wintypes.LARGE_INTEGER),
+        ("LimitFlags", wintypes.DWORD),
+        ("MinimumWorkingSetSize", ctypes.c_size_t),
+        ("MaximumWorkingSetSize", ctypes.c_size_t),
+        ("ActiveProcessLimit", wintypes.DWORD),
+        ("Affinity", ctypes.c_size_t),
+        ("PriorityClass", wintypes.DWORD),
+        ("SchedulingClass", wintypes.DWORD),
+    ]
+
+
+class JOBOBJECT_EXTENDED_LIMIT_INFORMATION(ctypes.Structure):
+    _fields_ = [
+        ("BasicLimitInformation", JOBOBJECT_BASIC_LIMIT_INFORMATION),
+        ("IoInfo", IO_COUNTERS),
+        ("ProcessMemoryLimit", ctypes.c_size_t),
+        ("JobMemoryLimit", ctypes.c_size_t),
+        ("PeakProcessMemoryUsed", ctypes.c_size_t),
+        ("PeakJobMemoryUsed", ctypes.c_size_t),
+    ]
+
+
+class GROUP_AFFINITY(ctypes.Structure):
+    _fields_ = [
+        ("Mask", ctypes.c_size_t),
+        ("Group", wintypes.WORD),
+        ("Reserved", wintypes.WORD * 3),
+    ]
+
+
+class JOBOBJECT_BASIC_PROCESS_ID_LIST(ctypes.Structure):
+    _fields_ = [
+        ("NumberOfAssignedProcesses", wintypes.DWORD),
+        ("NumberOfProcessIdsInList", wintypes.DWORD),
+        ("ProcessIdList", ctypes.c_size_t * MAX_JOB_PIDS),
+    ]
+
+
+_CreateJobObject = ctypes.windll.kernel32.CreateJobObjectW
+_CreateJobObject.argtypes = [wintypes.LPVOID, wintypes.LPCWSTR]
+_CreateJobObject.restype = wintypes.HANDLE
+
+_SetInformationJobObject = ctypes.windll.kernel32.SetInformationJobObject
+_SetInformationJobObject.argtypes = [wintypes.HANDLE, ctypes.c_int, wintypes.LPVOID, wintypes.DWORD]
+_SetInformationJobObject.restype = wintypes.BOOL
+
+_QueryInformationJobObject = ctypes.windll.kernel32.QueryInformationJobObject
+_QueryInformationJobObject.argtypes = [
+    wintypes.HANDLE,
+    ctypes.c_int,
+    wintypes.LPVOID,
+    wintypes.DWORD,
+    ctypes.POINTER(wintypes.DWORD),
+]
+_QueryInformationJobObject.restype = wintypes.BOOL
+
+_AssignProcessToJobObject = ctypes.windll.kernel32.AssignProcessToJobObject
+_AssignProcessToJobObject.argtypes = [wintypes.HANDLE, wintypes.HANDLE]
+_AssignProcessToJobObject.restype = wintypes.BOOL
+
+_TerminateJobObject = ctypes.windll.kernel32.TerminateJobObject
+_TerminateJobObject.argtypes = [wintypes.HANDLE, wintypes.UINT]
+_TerminateJobObject.restype = wintypes.BOOL
+
+_CloseHandle = ctypes.windll.kernel32.CloseHandle
+_CloseHandle.argtypes = [wintypes.HANDLE]
+_CloseHandle.restype = wintypes.BOOL
+
+_GetNumaHighestNodeNumber = ctypes.windll.kernel32.GetNumaHighestNodeNumber
+_GetNumaHighestNodeNumber.argtypes = [ctypes.POINTER(wintypes.ULONG)]
+_GetNumaHighestNodeNumber.restype = wintypes.BOOL
+
+_GetNumaNodeProcessorMaskEx = ctypes.windll.kernel32.GetNumaNodeProcessorMaskEx
+_GetNumaNodeProcessorMaskEx.argtypes = [wintypes.USHORT, ctypes.POINTER(GROUP_AFFINITY)]
+_GetNumaNodeProcessorMaskEx.restype = wintypes.BOOL
+
+# subprocess doesn't give us the handle of the process's main thread, so we resume the
+# whole process instead.
+_NtResumeProcess = ctypes.windll.ntdll.NtResumeProcess
+_NtResumeProcess.argtypes = [wintypes.HANDLE]
+_NtResumeProcess.restype = ctypes.c_long
+
+_WNDENUMPROC = ctypes.WINFUNCTYPE(wintypes.BOOL, wintypes.HWND, wintypes.LPARAM)
+
+_EnumWindows = ctypes.windll.user32.EnumWindows
+_EnumWindows.argtypes = [_WNDENUMPROC, wintypes.LPARAM]
+_EnumWindows.restype = wintypes.BOOL
+
+_GetWindowThreadProcessId = ctypes.windll.user32.GetWindowThreadProcessId
+_GetWindowThreadProcessId.argtypes = [wintypes.HWND, ctypes.POINTER(wintypes.DWORD)]
+_GetWindowThreadProcessId.restype = wintypes.DWORD
+
+_PostMessage = ctypes.windll.user32.PostMessageW
+_PostMessage.argtypes = [wintypes.HWND, wintypes.UINT, wintypes.WPARAM, wintypes.LPARAM]
+_PostMessage.restype = wintypes.BOOL
+
+
+## @return how many NUMA nodes the host has
+def numa_node_count():
+    highest = wintypes.ULONG(0)
+    if not _GetNumaHighestNodeNumber(ctypes.byref(highest)):
+        return 1
+    return highest.value + 1
+
+
+## A job object. Closing it kills whatever is still running in it.
+class JobObject(object):
+
+    ## Creates the job
+    # @param cpu_time Seconds of user-mode CPU time that the job's processes may use between them,
+    #                 or None for no limit
+    # @param memory Megabytes of memory that the job's processes may commit between them, or None
+    #               for no limit
+    # @param numa_node The NUMA node whose processors the job's processes run on, or None for any
+    def __init__(self, cpu_time=None, memory=None, numa_node=None):
+        self.handle = _CreateJobObject(None, None)
+        if not self.handle:
+            raise ctypes.WinError()
+
+        self.cpu_time = cpu_time
+
+        limits = JOBOBJECT_EXTENDED_LIMIT_INFORMATION()
+        limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE
+
+        if cpu_time:
+            limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_TIME
+            # In 100ns ticks
+            limits.BasicLimitInformation.PerJobUserTimeLimit = int(cpu_time * 10000000)
+
+        if memory:
+            limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY
+            limits.JobMemoryLimit = int(memory) * 1024 * 1024
+
+        if not _SetInformationJobObject(
+            self.handle, JobObjectExtendedLimitInformation, ctypes.byref(limits), ctypes.sizeof(limits)
+        ):
+            self.close()
+            raise ctypes.WinError()
+
+        # A node that can't be looked up just leaves the job unplaced.
+        affinity = GROUP_AFFINITY()
+        if numa_node is not None and _GetNumaNodeProcessorMaskEx(numa_node, ctypes.byref(affinity)):
+            _SetInformationJobObject(
+                self.handle, JobObjectGroupInformationEx, ctypes.byref(affinity), ctypes.sizeof(affinity)
+            )
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+    ## Starts a process in the job. The process starts suspended, and is only resumed once it's in
+    # the job, so that nothing that it spawns can escape it.
+    # @param args The command line (array of strings)
+    # @param kwargs Passed on to subprocess.Popen
+    # @return the subprocess.Popen
+    def popen(self, args, **kwargs):
+        kwargs["creationflags"] = kwargs.get("creationflags", 0) | CREATE_SUSPENDED
+        process = subprocess.Popen(args, **kwargs)
+
+        # Popen doesn't expose its process handle, other than as this.
+        handle = int(process._handle)
+
+        if not _AssignProcessToJobObject(self.handle, handle):
+            error = ctypes.WinError()
+            process.kill()
+            process.wait()
+            raise error
+
+        _NtResumeProcess(handle)
+        return process
+
+    ## @return the IDs of the processes that are still running in the job
+    def pids(self):
+        pid_list = JOBOBJECT_BASIC_PROCESS_ID_LIST()
+
+        # This fails with ERROR_MORE_DATA when there are more than MAX_JOB_PIDS processes,
+        # but still fills in as many as fit.
+        _QueryInformationJobObject(
+            self.handle, JobObjectBasicProcessIdList, ctypes.byref(pid_list), ctypes.sizeof(pid_list), None
+        )
+
+        return set(pid_list.ProcessIdList[: pid_list.NumberOfProcessIdsInList])
+
+    ## Asks the job's processes to exit, by sending a WM_CLOSE to each of their top-level windows.
+    # This gives the client's exit handlers a chance to run.
+    # @return how many windows were asked to close. If there were none, nothing in the job will exit
+    #         unless it's terminated.
+    def close_gently(self):
+        pids = self.pids()
+        closed = [0]
+
+        def close_window(hwnd, _):
+            pid = wintypes.DWORD()
+            _GetWindowThreadProcessId(hwnd, ctypes.byref(pid))
+            if pid.value in pids and _PostMessage(hwnd, WM_CLOSE, 0, 0):
+                closed[0] += 1
+            return True
+
+        if pids:
+            _EnumWindows(_WNDENUMPROC(close_window), 0)
+
+        return closed[0]
+
+    ## Kills every process in the job, at once
+    def terminate(self):
+        _TerminateJobObject(self.handle, EXIT_JOB_TERMINATED)
+
+    ## @param process A process in the job, that has exited
+    # @return whether the job ran it out of CPU time
+    def exceeded_cpu_time(self, process):
+        return bool(self.cpu_time) and process.returncode == ERROR_NOT_ENOUGH_QUOTA
+
+    ## Closes the job, killing anything still running in it
+    def close(self):
+        if self.handle:
+            _CloseHandle(self.handle)
+            self.handle = None
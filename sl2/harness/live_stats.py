@@ -0,0 +1,167 @@
+## @package live_stats
+#
+# Reads the server's live stats: a small block that the server rewrites in a named shared memory section every
+# half second, with its own counters and each recently used arena's totals since it started. The GUI polls it at
+# display rate without sending the server a request or querying the database. The block is guarded by a seqlock, so
+# a read just copies it, and copies it again if the server was in the middle of writing it.
+# Keep this in sync with sl2_live_stats and sl2_live_arena in include/server.hpp!
+
+import collections
+import ctypes
+import os
+import struct
+from ctypes import wintypes
+
+from .instrument import server_instance, target_arena_id
+
+## The names of the default server instance's live stats section, and of a named instance's
+STATS_SECTION = "Local\\sl2_stats"
+STATS_SECTION_FMT = "Local\\sl2_stats.{}"
+
+## The magic that the live stats start with: "SL2L"
+STATS_MAGIC = 0x4C324C53
+STATS_VERSION = 1
+
+## How many arenas the block has room for
+MAX_ARENAS = 64
+
+## The length of an arena's ID, without its NUL
+ARENA_ID_LEN = 64
+
+## How often the GUI polls the live stats, in milliseconds: as often as the server publishes them
+POLL_MS = 500
+
+## How many times a read copies the block before giving up on a server that keeps writing over it
+READ_ATTEMPTS = 16
+
+## sl2_live_stats, up to its arenas: magic, version, sequence number, start time, publish time, active connections,
+# events, path runs, paths, arenas published, and arenas altogether
+HEADER = struct.Struct("<IIqQQQQQQII")
+
+## sl2_live_arena: execs, new cells, crashes, total run time, paths, corpus size, score, and its ID (and padding)
+ARENA = struct.Struct("<QQQQQQI4x{}s6x".format((ARENA_ID_LEN + 1) * 2))
+
+## Where the sequence number is in the block
+SEQ_OFFSET = 8
+
+SECTION_SIZE = HEADER.size + MAX_ARENAS * ARENA.size
+
+FILE_MAP_READ = 0x0004
+
+## One arena's totals since the server started
+Arena = collections.namedtuple(
+    "Arena", ["arena_id", "execs", "new_cells", "crashes", "mean_exec_us", "paths", "corpus", "score"]
+)
+
+## The server's live stats
+Stats = collections.namedtuple(
+    "Stats",
+    ["started", "published", "active_connections", "events", "path_runs", "paths", "total_arenas", "arenas"],
+)
+
+_OpenFileMapping = ctypes.windll.kernel32.OpenFileMappingW
+_OpenFileMapping.argtypes = [wintypes.DWORD, wintypes.BOOL, wintypes.LPCWSTR]
+_OpenFileMapping.restype = wintypes.HANDLE
+
+_MapViewOfFile = ctypes.windll.kernel32.MapViewOfFile
+_MapViewOfFile.argtypes = [wintypes.HANDLE, wintypes.DWORD, wintypes.DWORD, wintypes.DWORD, ctypes.c_size_t]
+_MapViewOfFile.restype = wintypes.LPVOID
+
+_UnmapViewOfFile = ctypes.windll.kernel32.UnmapViewOfFile
+_UnmapViewOfFile.argtypes = [wintypes.LPCVOID]
+_UnmapViewOfFile.restype = wintypes.BOOL
+
+_CloseHandle = ctypes.windll.kernel32.CloseHandle
+_CloseHandle.argtypes = [wintypes.HANDLE]
+_CloseHandle.restype = wintypes.BOOL
+
+
+## @param data A copy of the block
+# @return the stats in it, or None if the server hasn't published any of this version
+def unpack(data):
+    fields = HEADER.unpack_from(data)
+    magic, version = fields[:2]
+    if magic != STATS_MAGIC or version != STATS_VERSION:
+        return None
+
+    started, published, active_connections, events, path_runs, paths, arena_count, total_arenas = fields[3:]
+
+    arenas = []
+    for i in range(min(arena_count, MAX_ARENAS)):
+        execs, new_cells, crashes, exec_us, arena_paths, corpus, score, arena_id = ARENA.unpack_from(
+            data, HEADER.size + i * ARENA.size
+        )
+        arena_id = arena_id.decode("utf-16-le", "replace").split("\0")[0]
+        mean_exec_us = exec_us / execs if execs else 0.0
+        arenas.append(Arena(arena_id, execs, new_cells, crashes, mean_exec_us, arena_paths, corpus, score))
+
+    return Stats(started, published, active_connections, events, path_runs, paths, total_arenas, arenas)
+
+
+## class LiveStats
+# A server instance's live stats section, mapped read-only. The section is only opened, never created, so a server
+# that starts later than its reader isn't seen until the reader is reopened.
+class LiveStats(object):
+    ## @param instance The server instance, or None for the default instance
+    def __init__(self, instance=None):
+        self.view = None
+        name = STATS_SECTION_FMT.format(instance) if instance else STATS_SECTION
+        self.handle = _OpenFileMapping(FILE_MAP_READ, False, name)
+
+        if self.handle:
+            self.view = _MapViewOfFile(self.handle, FILE_MAP_READ, 0, 0, SECTION_SIZE)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+    def close(self):
+        if self.view:
+            _UnmapViewOfFile(self.view)
+            self.view = None
+        if self.handle:
+            _CloseHandle(self.handle)
+            self.handle = None
+
+    ## @return whether the section is mapped
+    def mapped(self):
+        return bool(self.view)
+
+    ## Copies the stats out of the section
+    # @return the stats, or None if there are none to read
+    def read(self):
+        if not self.view:
+            return None
+
+        seq = ctypes.c_int64.from_address(self.view + SEQ_OFFSET)
+        for _ in range(READ_ATTEMPTS):
+            before = seq.value
+            if before & 1:
+                continue
+
+            data = ctypes.string_at(self.view, SECTION_SIZE)
+            if seq.value == before:
+                return unpack(data)
+
+        return None
+
+
+## @param target_dir The target directory
+# @return the LiveStats of the server instance that serves the target, and the target's arena ID, or (None, None)
+# if the target has no arena yet
+def open_target(target_dir):
+    targets_file = os.path.join(target_dir, "targets.msg")
+    if not os.path.isfile(targets_file):
+        return None, None
+
+    arena_id = target_arena_id(targets_file)
+    return LiveStats(server_instance(arena_id)), arena_id
+
+
+## @param stats The server's live stats
+# @param arena_id An arena's ID
+# @return the arena's totals, or None if the server didn't publish them
+def arena_stats(stats, arena_id):
+    return next((arena for arena in stats.arenas if arena.arena_id == arena_id), None)
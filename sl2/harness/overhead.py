@@ -0,0 +1,114 @@
+## @package overhead
+#
+# Measures the instrumentation's overhead on the target: it's run natively, under the fuzzer (with and without
+# coverage), and under the tracer (with and without taint tracking, see the tracer's -nt), and each mode's wall
+# time is reported next to the native run's. The benchmark targets in corpus/bench_targets are meant for this:
+# each does a fixed, tunable amount of work on its input, so the same profile can be timed across builds.
+#
+# Tracer runs replay the mutations of the fuzzing run before them, so the fuzzer modes go first.
+
+import os
+import statistics
+import subprocess
+import time
+
+from . import config
+from . import run_slots
+from . import timeouts
+from .instrument import fuzzer_config, print_l, pwarning, run_dr
+
+## The instrumented modes that get timed, in order: (name, extra fuzzer arguments, extra tracer arguments). Fuzzer
+# modes have no tracer arguments, and tracer modes no fuzzer arguments.
+MODES = [
+    ("fuzzer", [], None),
+    ("fuzzer (no coverage)", ["-n"], None),
+    ("tracer", None, []),
+    ("tracer (-nt)", None, ["-nt", "1"]),
+]
+
+
+## Times a single native run of the target
+# @param config_dict Configuration context dictionary
+# @return how long it took, in seconds
+def _native_run(config_dict):
+    started = time.perf_counter()
+
+    try:
+        subprocess.run(
+            [config_dict["target_application_path"], *config_dict["target_args"]],
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+            timeout=timeouts.fuzz_timeout(config_dict),
+        )
+    except subprocess.TimeoutExpired:
+        pwarning("The native run timed out; its time is a lower bound")
+
+    return time.perf_counter() - started
+
+
+## Times a fuzzing run, and the tracer runs that replay its mutations
+# @param config_dict Configuration context dictionary
+# @param targets_file Path to the target's targets file
+# @param times A dict of each mode's times so far, in seconds (updated in place)
+def _instrumented_runs(config_dict, targets_file, times):
+    run_id = None
+
+    for name, fuzzer_args, tracer_args in MODES:
+        if fuzzer_args is not None:
+            if run_id is not None and not run_slots.slots.release(run_id):
+                pwarning("Couldn't release overhead run", run_id)
+
+            run_id, fuzz_config = fuzzer_config(config_dict, targets_file)
+            fuzz_config["client_args"] = [*fuzz_config["client_args"], *fuzzer_args]
+            run = run_dr(fuzz_config, verbose=config_dict["verbose"], timeout=timeouts.fuzz_timeout(config_dict),
+                         run_id=run_id)
+        else:
+            trace_config = {
+                "drrun_path": config_dict["drrun_path"],
+                "drrun_args": config_dict["drrun_args"],
+                "client_path": config_dict["tracer_path"],
+                "client_args": [
+                    *config_dict["client_args"],
+                    "-r",
+                    str(run_id),
+                    "-run_dir",
+                    os.path.join(config.sl2_runs_dir, str(run_id)),
+                    *tracer_args,
+                ],
+                "target_application_path": config_dict["target_application_path"],
+                "target_args": config_dict["target_args"],
+                "inline_stdout": config_dict["inline_stdout"],
+            }
+            run = run_dr(trace_config, verbose=config_dict["verbose"], timeout=config_dict.get("tracer_timeout"),
+                         run_id=run_id, tracing=True)
+
+        if run.process.timed_out:
+            pwarning("The", name, "run timed out; its time is a lower bound")
+        times[name].append(run.process.elapsed)
+
+    if run_id is not None and not run_slots.slots.release(run_id):
+        pwarning("Couldn't release overhead run", run_id)
+
+
+## Times the target in the given config natively, under the fuzzer, and under the tracer, and prints a summary
+# @param config_dict Configuration context dictionary
+# @param targets_file Path to the target's targets file
+def measure_overhead(config_dict, targets_file):
+    runs = max(config_dict.get("runs", 1), 1)
+    times = {name: [] for name in ["native"] + [name for name, _, _ in MODES]}
+
+    for i in range(runs):
+        print_l("Timing round {} of {}".format(i + 1, runs))
+        times["native"].append(_native_run(config_dict))
+        _instrumented_runs(config_dict, targets_file, times)
+
+    native = statistics.median(times["native"])
+
+    print_l("Target: {} {}".format(os.path.basename(config_dict["target_application_path"]),
+                                   " ".join(config_dict["target_args"])))
+    print_l("{:<24} {:>10} {:>10} {:>10} {:>10}".format("mode", "median_s", "min_s", "max_s", "overhead"))
+    for name, samples in times.items():
+        median = statistics.median(samples)
+        print_l("{:<24} {:>10.3f} {:>10.3f} {:>10.3f} {:>9.1f}x".format(
+            name, median, min(samples), max(samples), median / native if native else 0
+        ))
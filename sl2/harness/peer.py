@@ -0,0 +1,87 @@
+## @package peer
+#
+# Builds the per-target response script for peer emulation (--emulate_peer HOST:PORT): the fuzzer answers the
+# target's connections to that endpoint itself, from the script, so that network clients can be fuzzed without a
+# live peer, and without socket setup or round-trips on every run. A socket's responses each answer one of the
+# target's sends, in order, and each WinHTTP request is answered by the connection's next response. Once the
+# script runs out, the peer closes the connection. The responses are read (and targeted and mutated) like any
+# other recv or WinHttpReadData.
+#
+# Responses are declared in a JSON file (--peer_script), as a list of objects with these keys:
+#   data: the response, as text (encoded as UTF-8)
+#   hex: the response, as hex (instead of data)
+#   file: a file that holds the response (instead of data)
+#   unprompted: whether the peer sends it without waiting for a send, e.g. a banner (default: false)
+#
+# The script is written in the format that the fuzzer maps at startup (see parse_peer_script in fuzzer.cpp):
+#   magic ("SL2P"), version (u32), response count (u32), and the responses, each of which is its flags (u32),
+#   its length (u32) and its bytes.
+
+import json
+import struct
+
+## File name of the response script (under the target directory)
+PEER_FILE = "peer.sl2p"
+
+PEER_MAGIC = b"SL2P"
+PEER_VERSION = 1
+PEER_HEADER = struct.Struct("<4sII")
+
+## A response's flags and length
+RESPONSE = struct.Struct("<II")
+
+## The flag of responses that the peer sends without waiting for a send.
+# This must match SL2_PEER_UNPROMPTED in fuzzer.cpp.
+UNPROMPTED = 0x1
+
+## Most responses we keep. This must match SL2_PEER_MAX_RESPONSES in fuzzer.cpp.
+MAX_RESPONSES = 256
+
+
+## @param spec A single response, as declared in the JSON file
+# @return the response, packed
+def pack_response(spec):
+    if "data" in spec:
+        data = spec["data"].encode("utf-8")
+    elif "hex" in spec:
+        data = bytes.fromhex(spec["hex"])
+    elif "file" in spec:
+        with open(spec["file"], "rb") as response_file:
+            data = response_file.read()
+    else:
+        raise ValueError("peer responses need data, hex or a file")
+
+    flags = UNPROMPTED if spec.get("unprompted") else 0
+    return RESPONSE.pack(flags, len(data)) + data
+
+
+## Reads a JSON response script
+# @param path Path to the response script
+# @return the packed responses, in order
+def parse_peer_script(path):
+    with open(path, "r") as script_file:
+        specs = json.load(script_file)
+
+    if not isinstance(specs, list):
+        raise ValueError("{} should hold a list of responses".format(path))
+
+    if len(specs) > MAX_RESPONSES:
+        raise ValueError(
+            "{} has {} responses, more than the {} that the fuzzer takes".format(path, len(specs), MAX_RESPONSES)
+        )
+
+    return [pack_response(spec) for spec in specs]
+
+
+## Builds a target's response script from a JSON response script
+# @param path Path to the built response script
+# @param script_file Path to the JSON response script
+# @return the number of responses written
+def build_peer_script(path, script_file):
+    responses = parse_peer_script(script_file)
+
+    with open(path, "wb") as script:
+        script.write(PEER_HEADER.pack(PEER_MAGIC, PEER_VERSION, len(responses)))
+        script.write(b"".join(responses))
+
+    return len(responses)
@@ -0,0 +1,211 @@
+## @package prewarm
+#
+# Pre-warmed targets (--prewarm N): each fuzzing worker keeps N targets started ahead of its runs, so that drrun's
+# process creation and DynamoRIO's injection and initialization happen behind the previous run instead of in front
+# of the next one. A pre-warmed target is parked by the fuzzer client (-park), before the client has done anything
+# that depends on the run. Run IDs and arenas are only known once a run starts, so they aren't on the parked
+# target's command line: the harness activates the target by writing the run's client arguments to its -park_args
+# file and then signaling its -park event.
+#
+# A parked target is only handed runs with the same client arguments as the run that it was started for, other than
+# the ones that change from run to run (see state.PER_RUN_CLIENT_ARGS), which activation gives again.
+# DynamoRIO's own PRNG seed (-prng_seed) is the parked target's, not the run's. The mutation seed (-seed)
+# is the run's, so runs can still be reproduced from their seeds.
+
+import collections
+import ctypes
+import os
+import shutil
+import tempfile
+import threading
+import uuid
+from ctypes import wintypes
+
+from .state import PER_RUN_CLIENT_ARGS
+
+## The name of a parked target's activation event
+PARK_EVENT_FMT = "Local\\sl2_park.{}"
+
+## Client arguments that are left off of parked targets' command lines, since a run without them would inherit
+# them from the parked target
+UNPARKED_CLIENT_ARGS = ["-focus_run", "-focus_count"]
+
+_CreateEvent = ctypes.windll.kernel32.CreateEventW
+_CreateEvent.argtypes = [wintypes.LPVOID, wintypes.BOOL, wintypes.BOOL, wintypes.LPCWSTR]
+_CreateEvent.restype = wintypes.HANDLE
+
+_SetEvent = ctypes.windll.kernel32.SetEvent
+_SetEvent.argtypes = [wintypes.HANDLE]
+_SetEvent.restype = wintypes.BOOL
+
+_CloseHandle = ctypes.windll.kernel32.CloseHandle
+_CloseHandle.argtypes = [wintypes.HANDLE]
+_CloseHandle.restype = wintypes.BOOL
+
+
+## @param client_args A run's client arguments
+# @return the arguments, without the ones that parked targets are started without
+def parked_client_args(client_args):
+    parked = []
+    skip = False
+
+    for arg in client_args:
+        if skip:
+            skip = False
+        elif arg in UNPARKED_CLIENT_ARGS:
+            skip = True
+        else:
+            parked.append(arg)
+
+    return parked
+
+
+## @param config_dict The configuration of a run (see instrument.fuzzer_config)
+# @return what a parked target needs to have in common with the run to be handed it
+def pool_key(config_dict):
+    client_args = parked_client_args(config_dict["client_args"])
+    for i, arg in enumerate(client_args[:-1]):
+        if arg in PER_RUN_CLIENT_ARGS:
+            client_args[i + 1] = None
+
+    env = config_dict.get("env")
+    return (
+        config_dict["drrun_path"],
+        tuple(config_dict["drrun_args"]),
+        config_dict["client_path"],
+        tuple(client_args),
+        config_dict["target_application_path"],
+        tuple(config_dict["target_args"]),
+        config_dict.get("server_instance"),
+        tuple(sorted(env.items())) if env else None,
+    )
+
+
+## class ParkedTarget
+# A target that's been started, and is parked until it's given a run
+class ParkedTarget(object):
+    ## Starts a parked target
+    # @param config_dict The configuration of the run that the target is started for
+    # @param spawn Starts a run's drrun: called with the run's configuration and its stdout and stderr files, and
+    #   returns the run's job and drrun's process (see instrument.spawn_dr)
+    def __init__(self, config_dict, spawn):
+        name = PARK_EVENT_FMT.format(uuid.uuid4())
+        self.event = _CreateEvent(None, True, False, name)
+        if not self.event:
+            raise ctypes.WinError()
+
+        self.job = None
+        self.paths = []
+        for suffix in [".args", ".stdout", ".stderr"]:
+            fd, path = tempfile.mkstemp(prefix="sl2-park-", suffix=suffix)
+            os.close(fd)
+            self.paths.append(path)
+        self.args_path, self.stdout_path, self.stderr_path = self.paths
+
+        client_args = [*parked_client_args(config_dict["client_args"]), "-park", name, "-park_args", self.args_path]
+
+        try:
+            with open(self.stdout_path, "wb") as stdout_file, open(self.stderr_path, "wb") as stderr_file:
+                self.job, self.process = spawn(dict(config_dict, client_args=client_args), stdout_file, stderr_file)
+        except Exception:
+            self.discard()
+            raise
+
+    ## @return whether the target is still parked, and not, say, killed by DynamoRIO failing to start it
+    def alive(self):
+        return self.process.poll() is None
+
+    ## Hands the target its run
+    # @param client_args The run's client arguments
+    def activate(self, client_args):
+        with open(self.args_path, "w", newline="\n") as args_file:
+            args_file.write("\n".join(client_args))
+
+        _SetEvent(self.event)
+
+    ## Moves the target's output to where the run keeps it, once the run has ended
+    # @param stdout_path Where the run keeps its stdout
+    # @param stderr_path Where the run keeps its stderr
+    def collect(self, stdout_path, stderr_path):
+        shutil.move(self.stdout_path, stdout_path)
+        shutil.move(self.stderr_path, stderr_path)
+        self.release()
+
+    ## Kills the target, if it's still parked
+    def discard(self):
+        if self.job:
+            self.job.close()
+            self.job = None
+        self.release()
+
+    ## Frees the target's event and files
+    def release(self):
+        if self.event:
+            _CloseHandle(self.event)
+            self.event = None
+
+        for path in self.paths:
+            try:
+                os.remove(path)
+            except OSError:
+                pass
+
+
+## class TargetPool
+# A worker's parked targets, by the runs that they can be handed
+class TargetPool(object):
+    ## @param size How many targets to keep parked for each kind of run
+    def __init__(self, size):
+        self.size = size
+        self.parked = collections.defaultdict(collections.deque)
+
+    ## Takes a parked target that can be handed the given run
+    # @param config_dict The run's configuration
+    # @return the ParkedTarget, or None if there isn't one
+    def take(self, config_dict):
+        parked = self.parked[pool_key(config_dict)]
+
+        while parked:
+            target = parked.popleft()
+            if target.alive():
+                return target
+            target.discard()
+
+        return None
+
+    ## Parks targets for runs like the given one, until there are as many as the pool keeps
+    # @param config_dict The run's configuration
+    # @param spawn Starts a run's drrun (see ParkedTarget)
+    def refill(self, config_dict, spawn):
+        parked = self.parked[pool_key(config_dict)]
+
+        while len(parked) < self.size:
+            parked.append(ParkedTarget(config_dict, spawn))
+
+    ## Kills every parked target
+    def drain(self):
+        for parked in self.parked.values():
+            while parked:
+                parked.popleft().discard()
+
+
+_local = threading.local()
+
+
+## @param config_dict The configuration of a run
+# @return the calling worker's TargetPool, or None if runs like this one aren't pre-warmed
+def pool(config_dict):
+    if not config_dict.get("prewarm"):
+        return None
+
+    if getattr(_local, "pool", None) is None:
+        _local.pool = TargetPool(config_dict["prewarm"])
+
+    return _local.pool
+
+
+## Kills the calling worker's parked targets, once it's done fuzzing
+def drain():
+    if getattr(_local, "pool", None) is not None:
+        _local.pool.drain()
+        _local.pool = None
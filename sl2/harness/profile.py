@@ -0,0 +1,48 @@
+## @package profile
+#
+# Summarizes the clients' built-in profiler, which is on when a client is given -profile (e.g. via client_args).
+# Each client then reports a "profile" event for every probe that it hit (see sl2_profile.hpp): the probe's name,
+# its calls and TSC cycles over the whole run, and a final "run" probe with the run's cycles and microseconds, which
+# converts cycles to time. Probe cycles are inclusive, so a post-hook's include the mutation that it makes.
+#
+# Clients built with SL2_ALLOC_STATS (see sl2_alloc.hpp) also report each probe's allocations and the bytes they
+# asked for, with the ones made outside of every probe under "other", and the run's totals under "run".
+
+
+## Formats a run's profile as a table, most expensive probe first
+# @param probes A run's profile events, by probe name
+# @param event_names Maps server event numbers to names, for the "conn:<event>" probes
+# @return a list of lines
+def format_profile(probes, event_names=None):
+    run = probes.get("run", {})
+    us_per_cycle = run["us"] / run["cycles"] if run.get("cycles") and run.get("us") is not None else None
+
+    allocs = "allocs" in run
+
+    def alloc_columns(probe):
+        return " {:>10} {:>12}".format(probe.get("allocs", 0), probe.get("alloc_bytes", 0)) if allocs else ""
+
+    lines = ["{:<40} {:>10} {:>14} {:>10} {:>8}".format("probe", "calls", "cycles", "ms", "% run")
+             + (" {:>10} {:>12}".format("allocs", "bytes") if allocs else "")]
+    for name, probe in sorted(probes.items(), key=lambda item: item[1].get("cycles", 0), reverse=True):
+        if name == "run":
+            continue
+
+        if name.startswith("conn:") and event_names:
+            name = "conn:" + event_names(int(name[5:]))
+
+        cycles = probe.get("cycles", 0)
+        lines.append("{:<40} {:>10} {:>14} {:>10} {:>7.1f}%".format(
+            name,
+            probe.get("calls", 0),
+            cycles,
+            "{:.2f}".format(cycles * us_per_cycle / 1000) if us_per_cycle is not None else "-",
+            100 * cycles / run["cycles"] if run.get("cycles") else 0,
+        ) + alloc_columns(probe))
+
+    if run:
+        lines.append("{:<40} {:>10} {:>14} {:>10}".format(
+            "run", "", run.get("cycles", 0), "{:.2f}".format(run.get("us", 0) / 1000)
+        ) + (" {:>8}".format("") + alloc_columns(run) if allocs else ""))
+
+    return lines
@@ -0,0 +1,168 @@
+## @package regress
+#
+# Regression replay (--regress): re-checks every one of a target's saved crashes against a new build of it
+# (--regress_target, or the configured target application if it's been rebuilt in place). Each crashing run's
+# mutations are replayed by the fuzzer (-replay_run), on as many runs at once as --simultaneous allows, and the
+# replay is stopped as soon as it crashes. Replays skip coverage (-n) and never register anything with the server,
+# and the tracer isn't involved at all, so a crash costs about as much as a single fuzzing run.
+#
+# Each crash ends up as one of:
+#   fixed: the replay ran to completion without crashing
+#   crashing: the replay crashed the way that the crash did
+#   changed: the replay crashed some other way
+#   timed_out: the replay ran past the fuzzing timeout
+#   missing: the crashing run's directory (or its mutations) is gone, so it couldn't be replayed
+# Offsets within a module move from build to build, so crashes are compared by their exception and the
+# module that they happened in (see regression_signature), not by where in it they happened.
+#
+# The report is printed, and written to the target directory as JSON (see REGRESSION_FILE).
+
+import concurrent.futures
+import json
+import os
+
+from . import archive
+from . import events
+from . import run_slots
+from . import timeouts
+from . import triage_queue
+from .instrument import print_l, pwarning, replay_config, run_dr, target_arena_id
+from .state import get_path_to_run_file, get_target_dir, get_target_slug, iter_crashes, mutation_count
+
+## File name of the last regression report (under the target directory)
+REGRESSION_FILE = "regression.json"
+
+## The ways that a crash's replay can turn out, in the order that they're reported
+OUTCOMES = ["fixed", "crashing", "changed", "timed_out", "missing"]
+
+
+## @param signature A crash's quick signature (see triage_queue.crash_signature), or None
+# @return the part of it that should hold from one build to the next: the exception and the faulting module
+def regression_signature(signature):
+    if signature is None:
+        return None
+
+    return signature.split("+")[0]
+
+
+## @param config_dict Configuration context dictionary
+# @param run_id A crashing run's ID
+# @return the quick signature of the crash that the run's fuzzer reported, or None if it can't be found
+def original_signature(config_dict, run_id):
+    client_name = os.path.splitext(os.path.basename(config_dict["client_path"]))[0]
+    events_path = get_path_to_run_file(run_id, "{}.events".format(client_name))
+
+    if not os.path.isfile(events_path):
+        return None
+
+    for event in events.read_events(events_path):
+        if event.get("exception"):
+            return triage_queue.crash_signature(event, stack=False) or event["exception"]
+
+    return None
+
+
+## Replays a single crash against the build in the given config
+# @param config_dict Configuration context dictionary, with the build to replay against
+# @param arena_id The target's arena ID
+# @param crash_run_id The crashing run's ID
+# @return a dict of the crash's outcome (one of OUTCOMES), and its signatures before and after
+def replay_crash(config_dict, arena_id, crash_run_id):
+    result = {"run_id": crash_run_id, "before": None, "after": None}
+
+    count = mutation_count(crash_run_id) if archive.restore_run(crash_run_id) else 0
+    if not count:
+        result["outcome"] = "missing"
+        return result
+
+    result["before"] = original_signature(config_dict, crash_run_id)
+    signature = None
+
+    def on_event(event):
+        nonlocal signature
+        if event.get("exception") and signature is None:
+            signature = triage_queue.crash_signature(event, stack=False) or event["exception"]
+            return True
+
+        return False
+
+    replay_args = ["-n", "-replay_run", crash_run_id, "-replay_count", str(count)]
+    run_id = run_slots.slots.acquire(config_dict)
+
+    try:
+        run = run_dr(
+            replay_config(config_dict, run_id, arena_id, replay_args),
+            verbose=config_dict["verbose"],
+            timeout=timeouts.fuzz_timeout(config_dict),
+            run_id=run_id,
+            on_event=on_event,
+        )
+    finally:
+        if not run_slots.slots.release(run_id):
+            pwarning("Couldn't release regression run", run_id)
+
+    result["after"] = signature
+
+    if signature is not None:
+        before = regression_signature(result["before"])
+        result["outcome"] = "crashing" if before is None or before == regression_signature(signature) else "changed"
+    elif run.process.timed_out:
+        result["outcome"] = "timed_out"
+    else:
+        result["outcome"] = "fixed"
+
+    return result
+
+
+## Replays every saved crash of the target in the given config against a new build, and reports what became of
+# them
+# @param config_dict Configuration context dictionary, with the build that the crashes were found in
+# @param targets_file Path to the target's targets file
+# @param new_target Path to the new build's target application, or None to use the configured one
+def regress(config_dict, targets_file, new_target=None):
+    slug = get_target_slug(config_dict)
+    crashes = [(crash.runid, crash.crashash) for crash, _, _ in iter_crashes(slug)]
+
+    if not crashes:
+        print_l("[!] No saved crashes for {}".format(config_dict["target_application_path"]))
+        return
+
+    build_config = dict(config_dict, target_application_path=new_target) if new_target else config_dict
+    arena_id = target_arena_id(targets_file)
+    results = []
+
+    print_l("Replaying {} crashes against {}".format(len(crashes), build_config["target_application_path"]))
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=max(1, config_dict["simultaneous"])) as executor:
+        futures = {
+            executor.submit(replay_crash, build_config, arena_id, run_id): crashash for run_id, crashash in crashes
+        }
+
+        for i, future in enumerate(concurrent.futures.as_completed(futures)):
+            result = dict(future.result(), crashash=futures[future])
+            results.append(result)
+
+            if result["outcome"] == "changed":
+                print_l("Run {} now crashes with {} (was {})".format(
+                    result["run_id"], result["after"], result["before"]
+                ))
+            elif config_dict["verbose"]:
+                print_l("Run {}: {}".format(result["run_id"], result["outcome"]))
+            print_l("Replayed crash {} of {}".format(i + 1, len(crashes)))
+
+    results.sort(key=lambda result: (OUTCOMES.index(result["outcome"]), result["crashash"] or "", result["run_id"]))
+    report_path = os.path.join(get_target_dir(config_dict), REGRESSION_FILE)
+
+    with open(report_path, "w") as report_file:
+        json.dump({"target": build_config["target_application_path"], "crashes": results}, report_file, indent=2)
+
+    counts = {outcome: sum(1 for result in results if result["outcome"] == outcome) for outcome in OUTCOMES}
+    summary = ", ".join("{} {}".format(counts[outcome], outcome) for outcome in OUTCOMES)
+    print_l("Of {} crashes: {}".format(len(results), summary))
+
+    # Crashes whose whole crashash went away are the bugs that the build fixed.
+    buckets = {}
+    for result in results:
+        buckets.setdefault(result["crashash"], set()).add(result["outcome"])
+    fixed = [crashash for crashash, outcomes in buckets.items() if outcomes == {"fixed"}]
+    print_l("{} of {} crashashes are fixed. Report: {}".format(len(fixed), len(buckets), report_path))
@@ -0,0 +1,145 @@
+## @package retention
+#
+# Keeps the disk from filling up with duplicate crashes. Each crash is bucketed by its quick signature (see
+# triage_queue.crash_signature), and only the first --keep_crash_artifacts crashes in each bucket keep their full
+# artifacts. The rest keep their FKTs, their crash records and their output, but their memory dumps (initial.*.dmp
+# and the tracer's mem.*.dmp) are deleted. Each stripped run gets an ARTIFACTS_FILE instead. It refers to the
+# bucket's first runs, whose dumps stand in for its own (see reference_dump).
+#
+# The buckets are counted in BUCKETS_FILE under the target directory, so they last across sessions.
+
+import glob
+import json
+import os
+import threading
+
+from . import archive
+from . import config
+from . import dumps
+
+## File name of a target's crash buckets (under the target directory)
+BUCKETS_FILE = "crash_buckets.json"
+
+## File name of a stripped run's reference to the runs that kept their artifacts (under the run directory)
+ARTIFACTS_FILE = "artifacts.json"
+
+## The artifacts that stripped runs lose
+STRIPPED_PATTERNS = ["initial.*.dmp", "mem.*.dmp"]
+
+## Bumped whenever the buckets file changes incompatibly
+BUCKETS_VERSION = 1
+
+## Serializes updates to every target's buckets file
+_lock = threading.Lock()
+
+
+## @param target_dir The target directory
+# @return the target's buckets: a dict of signature -> {"count": crashes seen, "full": IDs of the runs that kept
+# their artifacts}
+def _load_buckets(target_dir):
+    try:
+        with open(os.path.join(target_dir, BUCKETS_FILE), "r") as buckets_file:
+            saved = json.load(buckets_file)
+
+        if saved["version"] == BUCKETS_VERSION:
+            return saved["buckets"]
+    except (OSError, ValueError, KeyError, TypeError):
+        pass
+
+    return {}
+
+
+# Like the triage queue, the file is replaced rather than rewritten in place.
+def _save_buckets(target_dir, buckets):
+    path = os.path.join(target_dir, BUCKETS_FILE)
+    tmp_path = "{}.{}.tmp".format(path, os.getpid())
+
+    with open(tmp_path, "w") as buckets_file:
+        json.dump({"version": BUCKETS_VERSION, "buckets": buckets}, buckets_file)
+    os.replace(tmp_path, path)
+
+
+## Deletes a run's memory dumps, and leaves a reference to its bucket's full runs in their place
+# @param run_id The run's ID
+# @param signature The run's bucket
+# @param instance Which crash in the bucket the run is (from 1)
+# @param full_runs IDs of the bucket's runs that kept their artifacts
+# @return how many bytes were freed
+def _strip_run(run_id, signature, instance, full_runs):
+    run_dir = os.path.join(config.sl2_runs_dir, str(run_id))
+    removed = []
+    kept = []
+    freed = 0
+
+    # Otherwise, a dump that's still being written would be renamed into place after we've stripped the run.
+    dumps.wait_for_dump(run_id)
+
+    for pattern in STRIPPED_PATTERNS:
+        for path in glob.glob(os.path.join(run_dir, pattern)):
+            try:
+                size = os.path.getsize(path)
+                os.remove(path)
+                removed.append(os.path.basename(path))
+                freed += size
+            except OSError:
+                # The server may still be writing the initial dump in the background.
+                kept.append(os.path.basename(path))
+
+    with open(os.path.join(run_dir, ARTIFACTS_FILE), "w") as artifacts_file:
+        json.dump(
+            {"bucket": signature, "instance": instance, "full_runs": full_runs, "removed": removed, "kept": kept},
+            artifacts_file,
+        )
+
+    return freed
+
+
+## Counts a crash against its bucket, and strips its artifacts if the bucket already has enough full ones
+# @param config_dict Configuration context dictionary
+# @param target_dir The target directory
+# @param run_id The crashing run's ID
+# @param signature The crash's quick signature, or None if it doesn't have one (and so is always kept in full)
+# @return whether the run kept its artifacts
+def retain_crash(config_dict, target_dir, run_id, signature):
+    keep = config_dict.get("keep_crash_artifacts") or 0
+
+    if keep <= 0 or signature is None:
+        return True
+
+    with _lock:
+        buckets = _load_buckets(target_dir)
+        bucket = buckets.setdefault(signature, {"count": 0, "full": []})
+        bucket["count"] += 1
+        instance = bucket["count"]
+
+        full = len(bucket["full"]) < keep
+        if full:
+            bucket["full"].append(str(run_id))
+
+        full_runs = list(bucket["full"])
+        _save_buckets(target_dir, buckets)
+
+    if not full:
+        _strip_run(run_id, signature, instance, full_runs)
+
+    return full
+
+
+## Finds the memory dump that stands in for a stripped run's own
+# @param run_id The run's ID
+# @param pattern The dump's file name pattern (e.g. "initial.*.dmp")
+# @return the path to a dump of the same crash, from one of the run's bucket's full runs, or None
+def reference_dump(run_id, pattern):
+    try:
+        archive.restore_run(run_id)
+        with open(os.path.join(config.sl2_runs_dir, str(run_id), ARTIFACTS_FILE), "r") as artifacts_file:
+            full_runs = json.load(artifacts_file)["full_runs"]
+    except (OSError, ValueError, KeyError, TypeError):
+        return None
+
+    for full_run in full_runs:
+        archive.restore_run(full_run)
+        for path in glob.glob(os.path.join(config.sl2_runs_dir, full_run, pattern)):
+            return path
+
+    return None
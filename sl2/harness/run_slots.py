@@ -0,0 +1,171 @@
+## @package run_slots
+#
+# Hands fuzzing runs a scratch run directory, reused from run to run, instead of creating a new one
+# for every run and deleting it again when it doesn't crash. A slot's directory is only kept (as the
+# run's own) when its run crashes or preserve_runs is set; the pool then makes a new slot for the
+# next run that needs one. Creating and removing a directory for every single run is a lot of
+# (antivirus-scanned) filesystem traffic on Windows.
+#
+# Slots are run directories like any other, named with a UUID (the server finds them by run ID),
+# so each one has a lock file in sl2_slots_dir that marks it as a slot. The lock is held for as long
+# as the harness owns the slot, so that slots left behind by a harness that has exited are adopted
+# by the next one, and never by two at once.
+
+import os
+import shutil
+import threading
+import uuid
+
+try:
+    import msvcrt
+except ImportError:
+    msvcrt = None
+
+from . import config
+from .state import target_run_files, write_target_run_files
+
+
+## @param run_id A run ID
+# @return the path to the run's slot lock file, if it's a slot
+def _lock_path(run_id):
+    return os.path.join(config.sl2_slots_dir, "{}.lock".format(run_id))
+
+
+## class RunSlots
+#  The pool of slots that this harness owns
+class RunSlots(object):
+    def __init__(self):
+        self.lock = threading.Lock()
+        ## Run ID -> the slot's open (and locked) lock file, or None if it couldn't be opened
+        self.owned = {}
+        ## Run IDs of the slots that aren't in use
+        self.free = []
+        ## Run ID -> the contents of the slot's program.txt and arguments.txt (see target_run_files)
+        self.written = {}
+        self.adopted = False
+
+    ## Takes the lock on a slot
+    # @return the open lock file, or None if someone else holds it
+    def _take(self, run_id):
+        try:
+            lock_file = open(_lock_path(run_id), "a+b")
+        except OSError:
+            return None
+
+        if msvcrt:
+            try:
+                lock_file.seek(0)
+                msvcrt.locking(lock_file.fileno(), msvcrt.LK_NBLCK, 1)
+            except OSError:
+                lock_file.close()
+                return None
+
+        return lock_file
+
+    # Callers should hold the lock.
+    def _adopt(self):
+        self.adopted = True
+
+        for name in os.listdir(config.sl2_slots_dir):
+            run_id, ext = os.path.splitext(name)
+            if ext != ".lock" or not os.path.isdir(os.path.join(config.sl2_runs_dir, run_id)):
+                continue
+
+            lock_file = self._take(run_id)
+            if lock_file:
+                self.owned[run_id] = lock_file
+                if self._clear(run_id):
+                    self.free.append(run_id)
+                else:
+                    self._drop(run_id)
+
+    ## Empties a slot's directory, short of the files that describe the target
+    # @return whether it's empty
+    def _clear(self, run_id):
+        run_dir = os.path.join(config.sl2_runs_dir, run_id)
+
+        try:
+            with os.scandir(run_dir) as entries:
+                for entry in entries:
+                    if entry.name in ["program.txt", "arguments.txt"]:
+                        continue
+                    if entry.is_dir(follow_symlinks=False):
+                        shutil.rmtree(entry.path)
+                    else:
+                        os.remove(entry.path)
+        except OSError:
+            return False
+
+        return True
+
+    ## Stops owning a slot
+    # @param remove Whether to remove its directory too
+    def _drop(self, run_id, remove=True):
+        lock_file = self.owned.pop(run_id)
+        if lock_file:
+            lock_file.close()
+        self.written.pop(run_id, None)
+
+        try:
+            os.remove(_lock_path(run_id))
+        except OSError:
+            pass
+
+        if remove:
+            shutil.rmtree(os.path.join(config.sl2_runs_dir, run_id), ignore_errors=True)
+
+    ## Hands out an empty slot, for a run of the target in the given config
+    # @param config_dict Configuration context dictionary
+    # @return the slot's run ID
+    def acquire(self, config_dict):
+        with self.lock:
+            if not self.adopted:
+                self._adopt()
+
+            if self.free:
+                run_id = self.free.pop()
+            else:
+                run_id = str(uuid.uuid4())
+                os.makedirs(os.path.join(config.sl2_runs_dir, run_id))
+                self.owned[run_id] = self._take(run_id)
+
+        # Slots can move between targets (in the GUI), so the files that describe the target are only
+        # rewritten when it changes.
+        run_files = target_run_files(config_dict)
+
+        if self.written.get(run_id) != run_files:
+            write_target_run_files(run_id, run_files)
+            self.written[run_id] = run_files
+
+        return run_id
+
+    ## Empties a slot whose run is done, and puts it back into the pool
+    # @param run_id The slot's run ID
+    # @return False if the run ID isn't one of our slots
+    def release(self, run_id):
+        run_id = str(run_id)
+
+        with self.lock:
+            if run_id not in self.owned:
+                return False
+
+            # A slot we couldn't empty (e.g. something still has a file in it open) is left for removal.
+            if self._clear(run_id):
+                self.free.append(run_id)
+            else:
+                self._drop(run_id)
+
+        return True
+
+    ## Turns a slot into its run's own directory, for good
+    # @param run_id The slot's run ID
+    def keep(self, run_id):
+        run_id = str(run_id)
+
+        with self.lock:
+            if run_id in self.owned:
+                self._drop(run_id, remove=False)
+
+
+## The slots that every fuzzing run in this harness draws from
+slots = RunSlots()
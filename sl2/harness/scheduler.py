@@ -0,0 +1,145 @@
+## @package scheduler
+#
+# Shares a session's fuzzing workers between several targets (or several targets files), giving each
+# target runs in proportion to how productive its recent runs have been: how often they found a new
+# path, hit new coverage or raised the server's coverage score (the "hash", "newc"/"newb" and "scr" of
+# each run's coverage event), and how often they found a new crash. Saturated targets keep a small
+# share, so that they can still be noticed picking back up, and the rest goes to the targets that are
+# still finding things.
+#
+# Shares are handed out by stride scheduling: each run of a target advances its "pass" by the inverse
+# of its weight, and the next run goes to the target with the lowest pass.
+
+import os
+import threading
+
+from .state import get_all_targets
+
+## How quickly a target's weight follows its recent runs: each run moves it this fraction of the way
+DECAY = 0.02
+
+## What a run that finds a new crash is worth, next to one that finds a new path
+CRASH_REWARD = 10.0
+
+## The least weight that a target has, so that saturated targets aren't starved outright
+WEIGHT_FLOOR = 0.05
+
+## The weight that a target starts out with, before it has any runs to go by
+INITIAL_WEIGHT = 1.0
+
+
+## class ScheduledTarget
+#  A target that the scheduler hands runs out for, and how productive its runs have been
+class ScheduledTarget(object):
+    ## @param config_dict Configuration context dictionary for the target
+    # @param targets_file Path to the target's targets file
+    def __init__(self, config_dict, targets_file):
+        self.config_dict = config_dict
+        self.targets_file = targets_file
+        ## Decaying average of what each run was worth
+        self.weight = INITIAL_WEIGHT
+        self.pass_value = 0.0
+        self.runs = 0
+        self.crashes = 0
+        self.paths = set()
+        self.signatures = set()
+        self.best_score = None
+        ## The target's TriageQueue, if it has one
+        self.queue = None
+
+    ## Scores a finished run, and moves the target's weight towards it
+    # @param crashed Whether the run crashed
+    # @param run The finished run
+    def update(self, crashed, run):
+        reward = 0.0
+        coverage = run.coverage or {}
+
+        if coverage.get("hash") and coverage["hash"] not in self.paths:
+            self.paths.add(coverage["hash"])
+            reward = 1.0
+
+        if coverage.get("newc") or coverage.get("newb"):
+            reward = 1.0
+
+        score = coverage.get("scr", -1)
+        if score is not None and score >= 0:
+            if self.best_score is not None and score > self.best_score:
+                reward = 1.0
+            self.best_score = score if self.best_score is None else max(self.best_score, score)
+
+        if crashed:
+            self.crashes += 1
+            signature = run.crash_signature or run.run_id
+            if signature not in self.signatures:
+                self.signatures.add(signature)
+                reward += CRASH_REWARD
+
+        self.runs += 1
+        self.weight += DECAY * (reward - self.weight)
+
+
+## class TargetScheduler
+#  Decides which target each worker fuzzes next
+class TargetScheduler(object):
+    ## @param targets The ScheduledTargets to share the workers between
+    # @param runs How many runs to hand out in total, or None for no limit
+    def __init__(self, targets, runs=None):
+        self.targets = targets
+        self.remaining = runs
+        self.lock = threading.Lock()
+
+    ## @return the target for a worker's next run, or None once every run has been handed out (or if there are no
+    # targets)
+    def next(self):
+        with self.lock:
+            if not self.targets:
+                return None
+
+            if self.remaining is not None:
+                if self.remaining <= 0:
+                    return None
+                self.remaining -= 1
+
+            target = min(self.targets, key=lambda t: t.pass_value)
+            target.pass_value += 1.0 / max(target.weight, WEIGHT_FLOOR)
+            return target
+
+    ## Records a finished run of a target
+    # @param target The ScheduledTarget
+    # @param crashed Whether the run crashed
+    # @param run The finished run
+    def run_complete(self, target, crashed, run):
+        with self.lock:
+            target.update(crashed, run)
+
+    ## @return a line for each target, with its share of the runs so far and what they've found
+    def summary(self):
+        with self.lock:
+            total = max(1, sum(t.runs for t in self.targets))
+            return [
+                "{:>6.1%}  {:>8} runs  {:>6} paths  {:>4} crashes  weight {:.3f}  {}".format(
+                    t.runs / total, t.runs, len(t.paths), t.crashes, t.weight, t.targets_file
+                )
+                for t in self.targets
+            ]
+
+
+## Builds a ScheduledTarget for every target directory that has a targets file
+# @param config_dict Configuration context dictionary, whose target (and targets file) is replaced in each
+# target's copy of it
+# @return the ScheduledTargets
+def targets_from_disk(config_dict):
+    targets = []
+
+    for target_dir, (program, args) in sorted(get_all_targets().items()):
+        targets_file = os.path.join(target_dir, "targets.msg")
+        if not os.path.isfile(targets_file):
+            continue
+
+        target_config = dict(config_dict)
+        target_config["target_application_path"] = program
+        target_config["target_args"] = args
+        target_config["client_args"] = list(config_dict["client_args"]) + ["-t", targets_file]
+        targets.append(ScheduledTarget(target_config, targets_file))
+
+    return targets
@@ -0,0 +1,115 @@
+## @package series
+#
+# Reads the server's per-arena metrics time series. Every minute (or every -t seconds), the server samples each
+# arena that's had runs since its last sample: how many runs it merged, the new cells that they hit, how many of
+# them crashed, how long they took on average, and the arena's score and distinct paths as of then. The samples go
+# into a fixed-size ring file next to the arena, so the series is cheap to keep and to read, and nothing has to go
+# through the database for it. The server also serves the series over its pipe (EVT_SERIES).
+# Keep this in sync with sl2_series_header and sl2_series_sample in include/server.hpp!
+
+import collections
+import os
+import struct
+
+from . import config
+from .cmin import _arena_id_payload, _read_exact
+from .instrument import server_instance, server_request, target_arena_id, ServerEvent
+
+## File extension of an arena's time series (next to its arena, under the server instance's arenas directory)
+SERIES_FILE_EXT = ".series"
+
+## The magic that time series start with: "SL2M"
+SERIES_MAGIC = 0x4D324C53
+SERIES_VERSION = 1
+
+## sl2_series_header: magic, version, interval, capacity, next slot, and count
+HEADER = struct.Struct("<IIIIII")
+
+## sl2_series_sample: time, execs, new cells, score, paths, crashes, and mean run time
+SAMPLE = struct.Struct("<QQIIQQQ")
+
+## One interval of an arena's time series
+Sample = collections.namedtuple("Sample", ["time", "execs", "new_cells", "score", "paths", "crashes", "mean_exec_us"])
+
+
+## @param arena_id An arena's ID
+# @param instance The server instance that serves the arena, or None for the default instance
+# @return the path to the arena's time series
+def series_path(arena_id, instance=None):
+    arenas_dir = os.path.join(config.sl2_arenas_dir, instance) if instance else config.sl2_arenas_dir
+    return os.path.join(arenas_dir, arena_id + SERIES_FILE_EXT)
+
+
+## @param data An sl2_series_header followed by samples, oldest first
+# @return the header's interval, and the samples
+def unpack(data):
+    magic, version, interval, _, _, count = HEADER.unpack_from(data)
+    if magic != SERIES_MAGIC or version != SERIES_VERSION:
+        raise ValueError("not a time series this version can read")
+
+    count = min(count, (len(data) - HEADER.size) // SAMPLE.size)
+    return interval, [Sample(*SAMPLE.unpack_from(data, HEADER.size + i * SAMPLE.size)) for i in range(count)]
+
+
+## Reads an arena's time series straight from its ring file
+# @param path Path to the time series
+# @return the samples, oldest first, or an empty list if there's no (readable) series
+def read(path):
+    try:
+        with open(path, "rb") as series_file:
+            data = series_file.read()
+    except OSError:
+        return []
+
+    if len(data) < HEADER.size:
+        return []
+
+    magic, version, _, capacity, next_slot, count = HEADER.unpack_from(data)
+    if magic != SERIES_MAGIC or version != SERIES_VERSION or len(data) < HEADER.size + capacity * SAMPLE.size:
+        return []
+
+    start = 0 if count < capacity else next_slot
+    slots = [(start + i) % capacity for i in range(min(count, capacity))]
+    return [Sample(*SAMPLE.unpack_from(data, HEADER.size + slot * SAMPLE.size)) for slot in slots]
+
+
+## @param target_dir The target directory
+# @return the target's time series, oldest first, or an empty list if it has none yet
+def target_series(target_dir):
+    targets_file = os.path.join(target_dir, "targets.msg")
+    if not os.path.isfile(targets_file):
+        return []
+
+    arena_id = target_arena_id(targets_file)
+    return read(series_path(arena_id, server_instance(arena_id)))
+
+
+## Asks the running server for an arena's time series (EVT_SERIES), instead of reading its file
+# @param arena_id The arena's ID
+# @return the series' interval, in seconds, and its samples, oldest first
+def server_series(arena_id):
+    with open(config.server_pipe_path(server_instance(arena_id)), "r+b", buffering=0) as pipe:
+        pipe.write(server_request(ServerEvent.SERIES, _arena_id_payload(arena_id)))
+        data = _read_exact(pipe, HEADER.size)
+        data += _read_exact(pipe, HEADER.unpack(data)[5] * SAMPLE.size)
+        pipe.write(server_request(ServerEvent.SESSION_TEARDOWN))
+
+    return unpack(data)
+
+
+## @param samples A time series (see read)
+# @param window How many seconds (up to its latest sample) of the series to total, or None for all of it
+# @return the series' totals over the window, as a dict
+def summarize(samples, window=None):
+    recent = [sample for sample in samples if not window or sample.time > samples[-1].time - window]
+    execs = sum(sample.execs for sample in recent)
+
+    return {
+        "samples": len(recent),
+        "execs": execs,
+        "new_cells": sum(sample.new_cells for sample in recent),
+        "crashes": sum(sample.crashes for sample in recent),
+        "mean_exec_us": sum(sample.mean_exec_us * sample.execs for sample in recent) / execs if execs else 0.0,
+        "score": recent[-1].score if recent else 0,
+        "paths": recent[-1].paths if recent else 0,
+    }
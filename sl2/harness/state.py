@@ -10,18 +10,29 @@ import re
 import uuid
 import sys
 from csv import DictWriter
-from hashlib import sha1
+from hashlib import sha1, sha256
 from typing import NamedTuple
 import csv
 import shutil
 from shutil import ignore_patterns
+import struct
 import winreg
 
 import msgpack
 
 from sl2 import db
-from sl2.db import Crash, Tracer, Checksec, TargetConfig
+from sl2.db import Crash, CrashBucket, Tracer, Checksec, TargetConfig
+from . import archive
 from . import config
+from . import crash_record
+from . import target_index
+from .drcov import TARGET_DRCOV_FILE, read_drcov_modules
+
+## Keep this up-to-date with sl2_fkt_journal_entry in include/common/sl2_fkt.hpp
+JOURNAL_ENTRY = struct.Struct("<II")
+
+## Keep this up-to-date with FUZZ_RUN_FKT_JOURNAL in include/server.hpp
+FKT_JOURNAL_FILE = "mutations.fktj"
 
 uuid_regex = re.compile("[a-fA-F0-9]{8}-[a-fA-F0-9]{4}-[a-fA-F0-9]{4}-[a-fA-F0-9]{4}-[a-fA-F0-9]{12}")
 
@@ -41,13 +52,79 @@ def esc_quote_paren(raw):
         return '"{}"'.format(raw)
 
 
+## Client arguments that differ from run to run (and don't change how the client instruments the target), whose
+#  values are left out of code cache keys
+PER_RUN_CLIENT_ARGS = ["-r", "-a", "-seed", "-events", "-drcov", "-run_dir"]
+
+## Client arguments that only parked targets are started with (see prewarm.py), which are left out of code cache keys
+#  altogether, so that parked targets share their code caches with the runs that they're handed
+PARK_CLIENT_ARGS = ["-park", "-park_args"]
+
+## Hashes of files that code caches depend on, by (path, size, mtime)
+_file_hashes = {}
+
+
+## @return the SHA-256 of a file, which is only re-read once it changes
+def _hash_file(path):
+    stat = os.stat(path)
+    key = (path, stat.st_size, stat.st_mtime_ns)
+
+    if key not in _file_hashes:
+        hasher = sha256()
+        with open(path, "rb") as f:
+            for chunk in iter(lambda: f.read(1024 * 1024), b""):
+                hasher.update(chunk)
+        _file_hashes[key] = hasher.hexdigest()
+
+    return _file_hashes[key]
+
+
+## Gets (or creates) the directory that DynamoRIO persists its code caches in, for runs of the given client on the
+#  given target. Caches are keyed by the target, the client build, and the options that change how the target is
+#  instrumented, so that a change to any of them starts from a cold cache rather than a stale one. Stale caches for
+#  the same target and client are removed.
+#  @return dir_name: str
+def get_code_cache_dir(config_dict):
+    hasher = sha256()
+    hasher.update(_hash_file(config_dict["target_application_path"].strip('"')).encode("utf-8"))
+    hasher.update(_hash_file(config_dict["client_path"]).encode("utf-8"))
+
+    client_args = []
+    for i, arg in enumerate(config_dict["client_args"]):
+        if arg not in PARK_CLIENT_ARGS and (i == 0 or config_dict["client_args"][i - 1] not in PARK_CLIENT_ARGS):
+            client_args.append(arg)
+    for i, arg in enumerate(client_args[:-1]):
+        if arg in PER_RUN_CLIENT_ARGS:
+            client_args[i + 1] = None
+    hasher.update(json.dumps([config_dict["drrun_args"], client_args]).encode("utf-8"))
+
+    client_name = os.path.splitext(os.path.basename(config_dict["client_path"]))[0]
+    target_cache_dir = os.path.join(config.sl2_code_cache_dir, get_target_slug(config_dict))
+    dir_name = os.path.join(target_cache_dir, "{}-{}".format(client_name, hasher.hexdigest()[:16]))
+
+    if not os.path.isdir(dir_name):
+        if os.path.isdir(target_cache_dir):
+            for stale in glob.glob(os.path.join(target_cache_dir, "{}-*".format(client_name))):
+                shutil.rmtree(stale, ignore_errors=True)
+        os.makedirs(dir_name, exist_ok=True)
+
+    return dir_name
+
+
 ## Returns an InvocationState containing the command run
 #     and the PRNG seed used.
 def create_invocation_statement(config_dict, run_id):
-    seed = str(generate_seed(run_id))
+    seed = str(config_dict["seed"]) if config_dict.get("seed") is not None else str(generate_seed(run_id))
+
+    # Point DynamoRIO's persistent code caches somewhere that's specific to this target and client, so that runs
+    # start out with the code that earlier runs translated, and with none that's out of date.
+    drrun_args = config_dict["drrun_args"]
+    if "-persist" in drrun_args:
+        drrun_args = [*drrun_args, "-persist_dir", get_code_cache_dir(config_dict)]
+
     program_arr = [
         config_dict["drrun_path"],
-        *config_dict["drrun_args"],
+        *drrun_args,
         "-prng_seed",
         seed,
         # '-no_follow_children', # NOTE(ww): We almost certainly don't want this.
@@ -137,6 +214,22 @@ def get_target_dir(_config):
     return dir_name
 
 
+## Lists the modules that a target has been seen to load, from its merged drcov coverage (see --drcov)
+# @param _config Configuration context dictionary
+# @return paths to the modules that still exist, not including the target itself
+def target_modules(_config):
+    drcov_path = os.path.join(get_target_dir(_config), TARGET_DRCOV_FILE)
+    if not os.path.isfile(drcov_path):
+        return []
+
+    target = os.path.normcase(os.path.abspath(_config["target_application_path"].strip('"')))
+    return [
+        path
+        for path in read_drcov_modules(drcov_path)
+        if os.path.isfile(path) and os.path.normcase(os.path.abspath(path)) != target
+    ]
+
+
 ## class TargetAdapter
 # Stores a list of targets and writes changes back to a target file on the disk
 class TargetAdapter(object):
@@ -176,6 +269,7 @@ class TargetAdapter(object):
     def save(self):
         with open(self.filename, "wb") as msgfile:
             msgpack.dump(list(filter(lambda k: k["selected"], self.target_list)), msgfile)
+        target_index.write_target_index(self.filename, list(filter(lambda k: k["selected"], self.target_list)))
         with open(self.filename.replace("targets.msg", "all_targets.msg"), "wb") as msgfile:
             msgpack.dump(self.target_list, msgfile)
 
@@ -215,26 +309,66 @@ def get_runs(run_id=None):
     """
     runs = {}
     for _dir in glob.glob(os.path.join(config.sl2_runs_dir, "*" if run_id is None else run_id)):
+        # Skip the scratch directories that fuzzing runs reuse (see run_slots.py)
+        if os.path.isfile(os.path.join(config.sl2_slots_dir, "{}.lock".format(os.path.basename(_dir)))):
+            continue
         argfile = os.path.join(_dir, "arguments.txt")
         if not os.path.exists(argfile):
             print("Warning: {} is missing".format(argfile))
             continue
         with open(argfile, "rb") as program_string_file:
             runs[_dir] = unstringify_program_array(program_string_file.read().decode("utf-16").strip())
+
+    # Archived runs don't have directories, so they're listed through their archives' indexes (see archive.py).
+    for archived_id in archive.archived_run_ids() if run_id is None else [run_id]:
+        _dir = os.path.join(config.sl2_runs_dir, archived_id)
+        if _dir in runs:
+            continue
+        arguments = archive.read_file(archived_id, "arguments.txt")
+        if arguments is not None:
+            runs[_dir] = unstringify_program_array(arguments.decode("utf-16").strip())
     return runs
 
 
-## @return path: str - the full path to the given filename within the given run's directory.
+## @return path: str - the full path to the given filename within the given run's directory. An archived run's
+#  directory is restored first (see archive.restore_run).
 def get_path_to_run_file(run_id, filename):
-    return os.path.join(config.sl2_runs_dir, str(run_id), filename)
+    run_dir = os.path.join(config.sl2_runs_dir, str(run_id))
+    if not os.path.isdir(run_dir):
+        archive.restore_run(run_id)
+    return os.path.join(run_dir, filename)
 
 
 ## @return glob: List[str] - Returns all paths under the given run's directory that match the given pattern glob.
 def get_paths_to_run_file(run_id, pattern):
-    pattern = os.path.join(config.sl2_runs_dir, str(run_id), pattern)
+    pattern = get_path_to_run_file(run_id, pattern)
     return glob.glob(pattern)
 
 
+## @param run_id A run's ID
+# @return the number of mutations that the run recorded, as the number of the last one plus one
+def mutation_count(run_id):
+    counts = set()
+
+    for path in get_paths_to_run_file(run_id, "*.fkt"):
+        name = os.path.splitext(os.path.basename(path))[0]
+        if name.isdigit():
+            counts.add(int(name))
+
+    journal_path = get_path_to_run_file(run_id, FKT_JOURNAL_FILE)
+    if os.path.isfile(journal_path):
+        with open(journal_path, "rb") as journal:
+            journal_data = journal.read()
+
+        offset = 0
+        while offset + JOURNAL_ENTRY.size <= len(journal_data):
+            mut_count, record_size = JOURNAL_ENTRY.unpack_from(journal_data, offset)
+            counts.add(mut_count)
+            offset += JOURNAL_ENTRY.size + record_size
+
+    return max(counts) + 1 if counts else 0
+
+
 ## Writes the PRNG seed, stdout, and stderr buffers for a particular stage into a run's directory.
 def write_output_files(run, run_id, stage_name):
     try:
@@ -252,7 +386,7 @@ def write_output_files(run, run_id, stage_name):
 
 ## Parses the results of a tracer run and returns them in human-readable form.
 def parse_tracer_crash_files(run_id):
-    crash_files = get_paths_to_run_file(run_id, "crash.*.json")
+    crash_files = get_paths_to_run_file(run_id, crash_record.CRASH_RECORD_PATTERN)
 
     if not crash_files:
         message = "The tracer tool exited improperly during run {}, \
@@ -266,13 +400,12 @@ To retry it manually, run \
 
     # TODO(ww): Parse all crash files, not just the first.
     crash_file = crash_files[0]
-    with open(crash_file, "r") as crash_json:
-        results = json.loads(crash_json.read())
-        results["run_id"] = run_id
-        results["crash_file"] = crash_file
-        formatted = "Tracer ({score}): {reason} in run {run_id} caused {exception}".format(**results)
-        formatted += "\n\t0x{location:02x}: {instruction}".format(**results)
-        return formatted, results
+    results = crash_record.read(crash_file)
+    results["run_id"] = run_id
+    results["crash_file"] = crash_file
+    formatted = "Tracer ({score}): {reason} in run {run_id} caused {exception}".format(**results)
+    formatted += "\n\t0x{location:02x}: {instruction}".format(**results)
+    return formatted, results
 
 
 ## (DEPRECATED) Dumps the crash data for a given set of crashs to a CSV file. Not currently used.
@@ -285,20 +418,123 @@ def export_crash_data_to_csv(crashes, csv_filename):
         writer.writerows(crashes)
 
 
-## Creates a new Run ID from a given config dict
-#  @return run_id: str - hex-encoded uuid4
-def generate_run_id(config_dict):
-    run_id = uuid.uuid4() if "run_id" not in config_dict else config_dict["run_id"]
+## How many crashes are fetched from the database at a time while they're streamed
+EXPORT_BATCH = 500
+
+## The crash columns that stream_crashes exports, in order
+EXPORT_COLS = [
+    "runid",
+    "parent_runid",
+    "timestamp",
+    "crashReason",
+    "crashash",
+    "bucket",
+    "exploitability",
+    "rank",
+    "ranksString",
+    "crashAddressString",
+    "instructionPointerString",
+    "stackPointerString",
+    "minidumpPath",
+    "tag",
+]
+
+
+## Iterates over a target's crashes without loading them all, along with their tracer results
+# @param slug The target's slug
+# @param representatives Whether to only yield the first crash of each crashash
+# @return a generator of (crash, tracer or None, number of crashes with the crash's crashash or None)
+def iter_crashes(slug, representatives=False):
+    session = db.getSession()
+    query = session.query(Crash, Tracer).outerjoin(Tracer, Tracer.runid == Crash.runid)
+
+    if representatives:
+        query = query.add_columns(CrashBucket.count).join(
+            CrashBucket,
+            (CrashBucket.target_config_slug == Crash.target_config_slug) & (CrashBucket.first_runid == Crash.runid),
+        )
 
-    os.makedirs(os.path.join(config.sl2_runs_dir, str(run_id)))
+    query = query.filter(Crash.target_config_slug == slug).order_by(Crash.id)
+
+    # yield_per streams the rows out of the cursor in batches, rather than fetching every one of
+    # them up front, and the session is cleared after each batch so that the crashes don't pile up in it.
+    for i, row in enumerate(query.execution_options(stream_results=True).yield_per(EXPORT_BATCH)):
+        yield (row[0], row[1], row[2] if representatives else None)
+
+        if (i + 1) % EXPORT_BATCH == 0:
+            session.expunge_all()
+
+
+## Streams a target's crashes to a CSV or JSONL file, one row at a time
+# @param slug The target's slug
+# @param path Where to write the file. It's written to a temporary file, and only replaces path once it's done.
+# @param fmt "csv" or "jsonl"
+# @param representatives Whether to only export the first crash of each crashash, with its count
+# @return how many crashes were exported
+def stream_crashes(slug, path, fmt="csv", representatives=False):
+    fields = EXPORT_COLS + ["tracer"] + (["count"] if representatives else [])
+    tmp_path = "{}.{}.tmp".format(path, os.getpid())
+    exported = 0
+
+    with open(tmp_path, "w", newline="") as export_file:
+        writer = None
+        if fmt == "csv":
+            writer = csv.writer(export_file, lineterminator="\n")
+            writer.writerow(fields)
+
+        for crash, tracer, count in iter_crashes(slug, representatives):
+            row = [getattr(crash, col, None) for col in EXPORT_COLS] + [tracer.formatted if tracer else None]
+            if representatives:
+                row.append(count)
+
+            if writer:
+                writer.writerow(row)
+            else:
+                export_file.write(json.dumps(dict(zip(fields, row)), default=str) + "\n")
+            exported += 1
+
+    os.replace(tmp_path, path)
+    return exported
+
+
+## (target_application_path, target_args) -> the target's encoded run files, see target_run_files
+_target_run_files = {}
+
+
+## The contents of the files that describe the target in each of its run directories, which are the same for
+#  every run of it, and so are only encoded once
+#  @return a tuple of program.txt's and arguments.txt's contents
+def target_run_files(config_dict):
+    key = (config_dict["target_application_path"], tuple(config_dict["target_args"]))
+
+    if key not in _target_run_files:
+        program = esc_quote_paren(config_dict["target_application_path"])
+        _target_run_files[key] = (
+            program.encode("utf-16"),
+            stringify_program_array(program, config_dict["target_args"]).encode("utf-16"),
+        )
 
-    program = esc_quote_paren(config_dict["target_application_path"])
+    return _target_run_files[key]
 
+
+## Writes the files that describe the target into a run directory
+#  @param run_id The run's ID
+#  @param run_files The target's run files (see target_run_files)
+def write_target_run_files(run_id, run_files):
     with open(get_path_to_run_file(run_id, "program.txt"), "wb") as program_file:
-        program_file.write(program.encode("utf-16"))
+        program_file.write(run_files[0])
 
     with open(get_path_to_run_file(run_id, "arguments.txt"), "wb") as arguments_file:
-        arguments_file.write(stringify_program_array(program, config_dict["target_args"]).encode("utf-16"))
+        arguments_file.write(run_files[1])
+
+
+## Creates a new Run ID from a given config dict
+#  @return run_id: str - hex-encoded uuid4
+def generate_run_id(config_dict):
+    run_id = uuid.uuid4() if "run_id" not in config_dict else config_dict["run_id"]
+
+    os.makedirs(os.path.join(config.sl2_runs_dir, str(run_id)))
+    write_target_run_files(run_id, target_run_files(config_dict))
 
     return run_id
 
@@ -359,6 +595,7 @@ class TriageExport:
             "crashAddressString",
             "crashReason",
             "crashash",
+            "bucket",
             "exploitability",
             "instructionPointerString",
             "minidumpPath",
@@ -399,17 +636,20 @@ class TriageExport:
             "ss",
         ]
 
-    ## Retrieves the number of exportable crashes.
-    # @return the number of exportable crashes
+    ## Retrieves the exportable crashes.
+    # @return the exportable crashes
     def get_crashes(self):
         return db.getSession().query(Crash).filter(Crash.target_config_slug == self.slug).all()
 
+    ## Counts the exportable crashes, without loading them.
+    # @return the number of exportable crashes
+    def count_crashes(self):
+        return db.getSession().query(Crash).filter(Crash.target_config_slug == self.slug).count()
+
     ## Exports crash from run directories to appropriate directory structure.
     # Also generates triage.csv file with summary of crashes
     # @param export_cb A callback that receives the index of the crash being exported
     def export(self, export_cb=None):
-        crashes = self.get_crashes()
-
         csvPath = os.path.join(self.exportDir, "triage.csv")
         with open(csvPath, "w") as f:
             csvWriter = csv.writer(f, lineterminator="\n")
@@ -423,8 +663,7 @@ class TriageExport:
             checksec = session.query(Checksec).filter(Checksec.hash == target.hash).first()
             if not checksec:
                 print("[!} Could not retrieve Checksec results!")
-            for crash in crashes:
-                tracer = session.query(Tracer).filter(Tracer.runid == crash.runid).first()
+            for crash, tracer, _ in iter_crashes(self.slug):
                 if not tracer:
                     print("[!] Could not retrive Tracer results!")
                 row = []
@@ -432,10 +671,18 @@ class TriageExport:
                     row.append(getattr(checksec, col, None))
                 for col in self.crash_cols:
                     row.append(getattr(crash, col, None))
-                row.append(tracer.formatted)
+                row.append(tracer.formatted if tracer else None)
                 csvWriter.writerow(row)
 
-        for idx, crash in enumerate(crashes):
+        # Every module's protections, as analyzed when the target was opened (and cached by hash)
+        modules = Checksec.byExecutables(target_modules(config.config))
+        with open(os.path.join(self.exportDir, "checksec.csv"), "w") as f:
+            csvWriter = csv.writer(f, lineterminator="\n")
+            csvWriter.writerow(checksec_no_gs)
+            for module in sorted(modules.values(), key=lambda module: module.path.lower()):
+                csvWriter.writerow([getattr(module, col, None) for col in self.checksec_cols])
+
+        for idx, (crash, _, _) in enumerate(iter_crashes(self.slug)):
             try:
                 if export_cb:
                     export_cb(idx)
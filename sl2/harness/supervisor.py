@@ -0,0 +1,88 @@
+## @package supervisor
+#
+# Talks to the native supervisor (supervisor.exe), which runs fuzzing runs on a fixed set of worker
+# slots, each pinned to its own core. The harness hands it one run per line of JSON on its stdin, and
+# reads each finished run's exit status back from its stdout, from a single thread. This replaces a
+# Python thread per worker, each blocked on its own drrun.
+#
+# This must match supervisor/supervisor.cpp.
+
+import json
+import subprocess
+import time
+
+
+## A finished run, shaped like the subprocess.Popen objects that run_dr returns. The run's stdout and
+# stderr went straight to files in its run directory, so they aren't kept here.
+class SupervisedProcess(object):
+    def __init__(self, result):
+        self.returncode: int = result["exit_code"]
+        self.timed_out: bool = result["timed_out"]
+        self.elapsed: float = result["elapsed_ms"] / 1000
+        # The supervisor only reports how long the run took, so it's taken to have just exited.
+        self.ended: float = time.time()
+        self.started: float = self.ended - self.elapsed
+        self.stdout = None
+        self.stderr = None
+
+
+## A running supervisor
+class Supervisor(object):
+
+    ## Starts the supervisor
+    # @param path Path to supervisor.exe
+    # @param workers Number of worker slots, or 0 for one per free core
+    # @param env The supervisor's (and so its runs') environment, or None for the harness's own
+    # @param numa_node The NUMA node that the slots' cores come from, or None for any
+    def __init__(self, path, workers, env=None, numa_node=None):
+        numa_args = ["-numa", str(numa_node)] if numa_node is not None else []
+        self.process = subprocess.Popen(
+            [path, "-w", str(workers), *numa_args], stdin=subprocess.PIPE, stdout=subprocess.PIPE, bufsize=0, env=env
+        )
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+    ## Queues a run on the next free slot
+    # @param run_id The run's ID
+    # @param cmd The drrun command line (array of strings)
+    # @param stdout_path Where the run's stdout goes
+    # @param stderr_path Where the run's stderr goes
+    # @param timeout Seconds that the run may take, or None
+    # @param cpu_time Seconds of CPU time that the run's processes may use between them, or None
+    # @param memory Megabytes of memory that the run's processes may commit between them, or None
+    def submit(self, run_id, cmd, stdout_path, stderr_path, timeout=None, cpu_time=None, memory=None):
+        job = {"id": str(run_id), "cmd": cmd, "stdout": stdout_path, "stderr": stderr_path}
+        if timeout is not None:
+            job["timeout"] = timeout
+        if cpu_time:
+            job["cpu_time"] = cpu_time
+        if memory:
+            job["memory"] = memory
+
+        self.process.stdin.write((json.dumps(job) + "\n").encode("utf-8"))
+
+    ## Waits for the next run to finish
+    # @return the run's result (a dict with its "id", "exit_code", "timed_out" and "hung"), or None if
+    # the supervisor exited
+    def next_result(self):
+        while True:
+            line = self.process.stdout.readline()
+            if not line:
+                return None
+
+            try:
+                return json.loads(line.decode("utf-8"))
+            except ValueError:
+                pass
+
+    ## Lets the supervisor finish the runs that it's been given, and waits for it to exit
+    def close(self):
+        try:
+            self.process.stdin.close()
+        except OSError:
+            pass
+        self.process.wait()
@@ -0,0 +1,77 @@
+## @package target_index
+#
+# Writes the binary index of a target file that the fuzzer and tracer map at startup, instead of
+# decoding targets.msg itself on every run. The index sits next to the target file, with its
+# ".msg" extension replaced by ".sl2t", and describes the same targets in the same order:
+#   magic ("SL2T"), version (u32), record count (u32), record size (u32),
+#   count fixed-size records (see RECORD below),
+#   a table of the targets' source names, in UTF-16LE.
+#
+# This must match include/common/sl2_target_index.hpp.
+
+import os
+import struct
+
+TARGET_INDEX_EXT = ".sl2t"
+
+TARGET_INDEX_MAGIC = b"SL2T"
+TARGET_INDEX_VERSION = 1
+TARGET_INDEX_HEADER = struct.Struct("<4sIII")
+
+## selected, argHashVersion, func_name, mode, callCount, retAddrOffset, retAddrCount, argHash,
+#  source offset, source length (both in UTF-16 code units), buffer size, reserved, buffer
+RECORD = struct.Struct("<II32sQQQQ72sIIII16s")
+
+## Most leading argument buffer bytes that a record holds (see SL2_TARGET_INDEX_BUFFER_LEN)
+MAX_BUFFER_LEN = 16
+
+## The default argument hash format (see SL2_ARG_HASH_SHA256)
+ARG_HASH_SHA256 = 1
+
+U64_MASK = (1 << 64) - 1
+
+
+## @param target_file Path to a target file (e.g. targets.msg)
+# @return the path to its index
+def index_path(target_file):
+    root, ext = os.path.splitext(target_file)
+    return (root if ext == ".msg" else target_file) + TARGET_INDEX_EXT
+
+
+## Writes the index of a target file
+# @param target_file Path to the target file that the index is for
+# @param targets The targets in the target file, in order (as dumped by the wizard)
+def write_target_index(target_file, targets):
+    records = []
+    strings = []
+    strings_len = 0
+
+    for target in targets:
+        source = target.get("source", "").encode("utf-16-le")
+        buffer = bytes(bytearray(target.get("buffer", []))[:MAX_BUFFER_LEN])
+
+        records.append(
+            RECORD.pack(
+                1 if target.get("selected", False) else 0,
+                target.get("argHashVersion", ARG_HASH_SHA256),
+                target.get("func_name", "").encode("utf-8")[:31],
+                target.get("mode", 1) & U64_MASK,
+                target.get("callCount", -1) & U64_MASK,
+                target.get("retAddrOffset", -1) & U64_MASK,
+                target.get("retAddrCount", -1) & U64_MASK,
+                target.get("argHash", "").encode("utf-8")[:71],
+                strings_len,
+                len(source) // 2,
+                len(buffer),
+                0,
+                buffer,
+            )
+        )
+
+        strings.append(source)
+        strings_len += len(source) // 2
+
+    with open(index_path(target_file), "wb") as index:
+        index.write(TARGET_INDEX_HEADER.pack(TARGET_INDEX_MAGIC, TARGET_INDEX_VERSION, len(records), RECORD.size))
+        index.write(b"".join(records))
+        index.write(b"".join(strings))
@@ -0,0 +1,257 @@
+## @package telemetry
+#
+# Breaks each fuzzing run's time down by stage, so that it's clear which overhead is worth attacking
+# on a given target. The fuzzer reports when it reached each stage in its "timing" event (see
+# emit_timing in fuzzer.cpp); the harness adds when it spawned the run, when the run exited, and how
+# long it took to wrap the run up. Each stage's recent durations and the target's executions per second
+# are kept per target, and saved to the target directory (TELEMETRY_FILE) for the GUI and --stats.
+#
+# The stages, in order:
+#   dr_init:         spawning drrun, through DynamoRIO and the fuzzer being initialized
+#   first_hook:      initialization, through the first call to a hooked function returning
+#   first_mutation:  that first hooked call, through its (first) mutation
+#   target:          the first mutation, through the target exiting
+#   exit:            the target exiting, through asking the server to finalize the run (crash dumps)
+#   server_finalize: the server finalizing the run (its coverage, and the path's score)
+#   dr_exit:         the last of those that the run reached, through the run's processes exiting
+#   harness_parse:   the harness reading the run's events and wrapping it up
+#
+# Stages that a run didn't reach (e.g. a run that never called a hooked function) are left out of it.
+#
+# dr_init is also broken down into the fuzzer's startup phases (STARTUP_PHASES), since every run pays for them:
+#   dr_load:      spawning drrun, through DynamoRIO calling the fuzzer's dr_client_main
+#   options:      parsing the fuzzer's options
+#   targets:      loading its targets
+#   connect:      connecting to the server, and registering the run with it
+#   dr_ext:       initializing drmgr, drreg and drwrap
+#   client_init:  the rest of the fuzzer's initialization
+#   module_hooks: all of the time spent hooking modules as they loaded (which overlaps the later stages)
+
+import collections
+import json
+import os
+import threading
+import time
+
+from .state import get_target_dir
+
+## File name of the saved telemetry (under the target directory)
+TELEMETRY_FILE = "telemetry.json"
+
+## The stages, in order
+STAGES = [
+    "dr_init",
+    "first_hook",
+    "first_mutation",
+    "target",
+    "exit",
+    "server_finalize",
+    "dr_exit",
+    "harness_parse",
+]
+
+## The keys of the fuzzer's timing event that each stage ends at (dr_exit and harness_parse end in the harness)
+STAGE_ENDS = {
+    "dr_init": "init",
+    "first_hook": "hook",
+    "first_mutation": "mut",
+    "target": "exit",
+    "exit": "fin0",
+    "server_finalize": "fin",
+}
+
+## The startup phases that dr_init is broken down into, in order
+STARTUP_PHASES = [
+    "dr_load",
+    "options",
+    "targets",
+    "connect",
+    "dr_ext",
+    "client_init",
+    "module_hooks",
+]
+
+## The keys of the fuzzer's timing event that each startup phase ends at (module_hooks is a total of its own)
+STARTUP_ENDS = {
+    "dr_load": "start",
+    "options": "opts",
+    "targets": "tgts",
+    "connect": "conn",
+    "dr_ext": "ext",
+    "client_init": "init",
+}
+
+## Number of recent durations kept per stage
+WINDOW_SIZE = 1000
+
+## Executions per second are measured over the runs that ended in the last this many seconds
+RATE_WINDOW = 60
+
+## How often the telemetry is saved, in seconds
+SAVE_INTERVAL = 10
+
+## Seconds between Jan 1, 1601 (which the fuzzer's timestamps count from) and the Unix epoch
+WINDOWS_EPOCH_OFFSET = 11644473600
+
+
+## @param timing The fuzzer's timing event
+# @param key The stage's key in it
+# @return the time that the fuzzer reached the stage at, as a Unix timestamp, or None if it didn't
+def _stamp(timing, key):
+    value = timing.get(key) or 0
+    if value <= 0:
+        return None
+
+    return value / 1000000 - WINDOWS_EPOCH_OFFSET
+
+
+## Works out how long a run spent in each stage
+# @param timing The fuzzer's timing event, or None if it didn't report one
+# @param spawned When the harness spawned the run (Unix timestamp)
+# @param exited When the run's processes exited (Unix timestamp)
+# @param parse How long the harness took to wrap the run up, in seconds
+# @return a dict of stage (or startup phase) name -> seconds, for the stages that the run reached
+def stage_durations(timing, spawned, exited, parse):
+    durations = {}
+    previous = spawned
+    last = None
+
+    # A stage only counts when the run reached both of its ends.
+    for stage in STAGES[: len(STAGE_ENDS)]:
+        stamp = _stamp(timing or {}, STAGE_ENDS[stage])
+        if stamp is not None and previous is not None:
+            durations[stage] = max(0.0, stamp - previous)
+
+        previous = stamp
+        last = stamp or last
+
+    if last is not None and exited is not None:
+        durations["dr_exit"] = max(0.0, exited - last)
+
+    durations["harness_parse"] = parse
+
+    previous = spawned
+    for phase in STARTUP_PHASES[: len(STARTUP_ENDS)]:
+        stamp = _stamp(timing or {}, STARTUP_ENDS[phase])
+        if stamp is not None and previous is not None:
+            durations[phase] = max(0.0, stamp - previous)
+
+        previous = stamp
+
+    if (timing or {}).get("mods"):
+        durations["module_hooks"] = timing["mods_us"] / 1000000
+
+    return durations
+
+
+## @param ordered Sorted durations
+# @param fraction The percentile, as a fraction
+def _percentile(ordered, fraction):
+    return ordered[min(len(ordered) - 1, int(len(ordered) * fraction))]
+
+
+## class Telemetry
+#  The recent stage durations and execution rate of a single target
+class Telemetry(object):
+    def __init__(self, target_dir):
+        self.path = os.path.join(target_dir, TELEMETRY_FILE)
+        self.lock = threading.Lock()
+        self.stages = {stage: collections.deque(maxlen=WINDOW_SIZE) for stage in STAGES + STARTUP_PHASES}
+        self.ends = collections.deque()
+        self.runs = 0
+        self.started = time.time()
+        self.last_save = 0
+
+    ## Records a finished run
+    # @param durations The run's stage durations (see stage_durations)
+    def observe(self, durations):
+        now = time.time()
+
+        with self.lock:
+            for stage, duration in durations.items():
+                self.stages[stage].append(duration)
+
+            self.runs += 1
+            self.ends.append(now)
+            while self.ends and self.ends[0] < now - RATE_WINDOW:
+                self.ends.popleft()
+
+            if now - self.last_save < SAVE_INTERVAL:
+                return
+            self.last_save = now
+
+        self.save()
+
+    ## @return a summary of the recent runs: their rate, and each stage's percentiles (in milliseconds)
+    def summary(self):
+        now = time.time()
+
+        with self.lock:
+            recent = [end for end in self.ends if end >= now - RATE_WINDOW]
+            span = max(1.0, min(RATE_WINDOW, now - self.started))
+            stages = {}
+
+            for stage in STAGES + STARTUP_PHASES:
+                ordered = sorted(self.stages[stage])
+                if not ordered:
+                    continue
+
+                stages[stage] = {
+                    "count": len(ordered),
+                    "p50_ms": _percentile(ordered, 0.5) * 1000,
+                    "p90_ms": _percentile(ordered, 0.9) * 1000,
+                    "p99_ms": _percentile(ordered, 0.99) * 1000,
+                    "mean_ms": sum(ordered) / len(ordered) * 1000,
+                }
+
+            return {
+                "updated": now,
+                "runs": self.runs,
+                "execs_per_sec": len(recent) / span,
+                "stages": stages,
+            }
+
+    ## Writes the summary out to the target directory
+    def save(self):
+        summary = self.summary()
+
+        tmp_path = "{}.{}.tmp".format(self.path, threading.get_ident())
+        with open(tmp_path, "w") as telemetry_file:
+            json.dump(summary, telemetry_file)
+        os.replace(tmp_path, self.path)
+
+
+## Telemetry, by target directory
+_telemetry = {}
+_telemetry_lock = threading.Lock()
+
+
+## @param config_dict Configuration context dictionary
+# @return the Telemetry of the target in the given config
+def telemetry(config_dict):
+    target_dir = get_target_dir(config_dict)
+
+    with _telemetry_lock:
+        if target_dir not in _telemetry:
+            _telemetry[target_dir] = Telemetry(target_dir)
+        return _telemetry[target_dir]
+
+
+## Saves every target's telemetry, e.g. when the session ends
+def save_all():
+    with _telemetry_lock:
+        targets = list(_telemetry.values())
+
+    for target in targets:
+        target.save()
+
+
+## Loads a target's saved telemetry
+# @param target_dir The target directory
+# @return the saved summary (see Telemetry.summary), or None if there isn't one
+def load(target_dir):
+    try:
+        with open(os.path.join(target_dir, TELEMETRY_FILE), "r") as telemetry_file:
+            return json.load(telemetry_file)
+    except (OSError, ValueError):
+        return None
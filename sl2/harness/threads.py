@@ -1,23 +1,28 @@
+import threading
+
 from PySide2.QtCore import QThread, Signal, Qt
 
 from .state import get_target_slug
-from .instrument import wizard_run, fuzzer_run, start_server, triager_run
+from .instrument import wizard_run, fuzzer_run, start_server, start_triage_queue, queue_triage
 from sl2 import db
 from sl2.db.run_block import SessionManager
 
 
 ## class ChecksecThread
-#  Runs Checksec once in a background thread so as not to stall the GUI
+#  Runs Checksec once in a background thread so as not to stall the GUI, on the target and (in parallel) on the
+#  modules that it loads. Results are cached by hash, so only new or changed binaries are analyzed.
 class ChecksecThread(QThread):
     result_ready = Signal(str)
 
-    def __init__(self, target_path):
+    def __init__(self, target_path, modules=()):
         QThread.__init__(self)
         self.target_path = target_path
+        self.modules = list(modules)
 
     def run(self):
-        checksec_output = db.Checksec.byExecutable(self.target_path).short_description()
-        self.result_ready.emit(checksec_output)
+        results = db.Checksec.byExecutables([self.target_path] + self.modules)
+        checksec = results.get(self.target_path)
+        self.result_ready.emit(checksec.short_description() if checksec else "Unknown")
 
 
 ## class WizardThread
@@ -44,9 +49,24 @@ class ServerThread(QThread):
         start_server(close_on_exit=self.close_on_exit)
 
 
+## The triage queue that every FuzzerThread hands its crashes to, by target slug
+triage_queues = {}
+triage_queues_lock = threading.Lock()
+
+
+## @return the triage queue for the target in the given config, which is started the first time it's asked for
+def shared_triage_queue(config_dict):
+    slug = get_target_slug(config_dict)
+
+    with triage_queues_lock:
+        if slug not in triage_queues:
+            triage_queues[slug] = start_triage_queue(config_dict)
+        return triage_queues[slug]
+
+
 ## class FuzzerThread
-#  Duplicates the functionality of instrument.fuzz_and_triage. Runs the fuzzer in a loop, automatically triaging once we
-#  find a crash.
+#  Duplicates the functionality of instrument.fuzz_and_triage. Runs the fuzzer in a loop, handing crashes to the
+#  target's triage queue so that it can keep fuzzing while they're triaged.
 class FuzzerThread(QThread):
     found_crash = Signal(QThread, str)
     run_complete = Signal()
@@ -71,9 +91,18 @@ class FuzzerThread(QThread):
         self.should_fuzz = False
         self.paused.emit(self)
 
+    ## Emits found_crash (or tracer_failed) once the triage queue has triaged one of this thread's crashes
+    def triaged(self, run_id, triagerInfo):
+        if triagerInfo:
+            # We can't pass the findings to another thread since they're database objects, so just the run ID
+            self.found_crash.emit(self, str(run_id))
+        else:
+            self.tracer_failed.emit()
+
     ## Creates a session manager and records runs in a loop, triaging where necessary
     def run(self):
         self.should_fuzz = True
+        triage_queue = shared_triage_queue(self.config_dict)
 
         with SessionManager(get_target_slug(self.config_dict)) as manager:
             while self.should_fuzz:
@@ -83,13 +112,7 @@ class FuzzerThread(QThread):
                 if crashed:
                     if self.config_dict["exit_early"]:
                         self.pause()
-                    # We can't pass this object to another thread since it's database, so just returning the runid
-                    triagerInfo = triager_run(self.config_dict, run.run_id)
-
-                    if triagerInfo:
-                        self.found_crash.emit(self, str(run.run_id))
-                    else:
-                        self.tracer_failed.emit()
+                    queue_triage(self.config_dict, run, triage_queue, self.triaged)
 
                 if not self.config_dict["continuous"]:
                     self.pause()
@@ -0,0 +1,152 @@
+## @package timeouts
+#
+# Derives each target's fuzzing timeout from how long its runs actually take, rather than from a
+# fixed (and usually far too generous) fuzz_timeout: the timeout is the 99th percentile of the
+# target's recent run times, times TIMEOUT_FACTOR, kept between TIMEOUT_FLOOR and the configured
+# fuzz_timeout (or TIMEOUT_CEILING). A hang then costs a handful of runs' worth of time, rather than
+# dozens.
+#
+# Runs that time out under the adaptive timeout, without crashing, are slow inputs rather than
+# hangs as far as we know, so they're logged in the target directory (SLOW_RUNS_FILE) and the first
+# SLOW_RUN_DIRS of them keep their run directories, for later review.
+#
+# So are runs that the server flags as slow, for taking far longer than their arena's median run time
+# (see the server's -T), whose inputs it keeps out of the arena's corpus so that they don't seed more.
+
+import collections
+import json
+import os
+import threading
+import time
+
+from .state import get_target_dir
+
+## File name of the saved run times (under the target directory)
+RUN_TIMES_FILE = "run_times.json"
+
+## File name of the slow run log (under the target directory), one JSON object per line
+SLOW_RUNS_FILE = "slow_runs.jsonl"
+
+## How many recent run times the timeout is derived from
+WINDOW_SIZE = 1000
+
+## How many run times a target needs before its timeout is derived from them
+MIN_SAMPLES = 50
+
+## The adaptive timeout is this many times the 99th percentile run time
+TIMEOUT_FACTOR = 5
+
+## Shortest adaptive timeout, in seconds
+TIMEOUT_FLOOR = 1.0
+
+## Longest adaptive timeout (in seconds), when fuzz_timeout isn't set
+TIMEOUT_CEILING = 60.0
+
+## How many slow runs keep their run directories
+SLOW_RUN_DIRS = 100
+
+## How often the run times are saved, in seconds
+SAVE_INTERVAL = 30
+
+
+## class RunTimes
+#  The recent run times of a single target
+class RunTimes(object):
+    def __init__(self, target_dir):
+        self.path = os.path.join(target_dir, RUN_TIMES_FILE)
+        self.slow_path = os.path.join(target_dir, SLOW_RUNS_FILE)
+        self.lock = threading.Lock()
+        self.times = collections.deque(maxlen=WINDOW_SIZE)
+        self.last_save = time.time()
+        self.slow_dirs_kept = 0
+
+        try:
+            with open(self.path, "r") as times_file:
+                self.times.extend(float(t) for t in json.load(times_file))
+        except (OSError, ValueError, TypeError):
+            pass
+
+        try:
+            with open(self.slow_path, "r") as slow_file:
+                self.slow_dirs_kept = sum(1 for line in slow_file if '"kept": true' in line)
+        except OSError:
+            pass
+
+    ## @param ceiling The longest that the timeout may be, in seconds
+    # @return the timeout for the target's next run, in seconds
+    def timeout(self, ceiling):
+        with self.lock:
+            if len(self.times) < MIN_SAMPLES:
+                return ceiling
+
+            ordered = sorted(self.times)
+
+        p99 = ordered[min(len(ordered) - 1, int(len(ordered) * 0.99))]
+        return min(ceiling, max(TIMEOUT_FLOOR, p99 * TIMEOUT_FACTOR))
+
+    ## Records how long a run that finished on its own took
+    # @param elapsed The run's time, in seconds
+    def observe(self, elapsed):
+        with self.lock:
+            self.times.append(elapsed)
+
+            if time.time() - self.last_save < SAVE_INTERVAL:
+                return
+
+            self.last_save = time.time()
+            times = list(self.times)
+
+        tmp_path = "{}.{}.tmp".format(self.path, threading.get_ident())
+        with open(tmp_path, "w") as times_file:
+            json.dump(times, times_file)
+        os.replace(tmp_path, self.path)
+
+    ## Logs a run that timed out under the adaptive timeout
+    # @param run_id The run's ID
+    # @param seed The run's seed
+    # @param elapsed The run's time, in seconds
+    # @param timeout The timeout that it ran into, in seconds
+    # @return whether the run should keep its run directory
+    def slow_run(self, run_id, seed, elapsed, timeout):
+        with self.lock:
+            keep = self.slow_dirs_kept < SLOW_RUN_DIRS
+            if keep:
+                self.slow_dirs_kept += 1
+
+            entry = {"run_id": str(run_id), "seed": seed, "elapsed": elapsed, "timeout": timeout, "kept": keep}
+            with open(self.slow_path, "a") as slow_file:
+                slow_file.write(json.dumps(entry) + "\n")
+
+        return keep
+
+
+## Run times, by target directory
+_run_times = {}
+_run_times_lock = threading.Lock()
+
+
+## @param config_dict Configuration context dictionary
+# @return the RunTimes of the target in the given config
+def run_times(config_dict):
+    target_dir = get_target_dir(config_dict)
+
+    with _run_times_lock:
+        if target_dir not in _run_times:
+            _run_times[target_dir] = RunTimes(target_dir)
+        return _run_times[target_dir]
+
+
+## @param config_dict Configuration context dictionary
+# @return the longest that the adaptive timeout may be, in seconds
+def ceiling(config_dict):
+    return config_dict.get("fuzz_timeout") or TIMEOUT_CEILING
+
+
+## @param config_dict Configuration context dictionary
+# @return the timeout for the next fuzzing run of the target in the given config, in seconds (or None for
+# no timeout)
+def fuzz_timeout(config_dict):
+    if not config_dict.get("adaptive_timeout"):
+        return config_dict.get("fuzz_timeout", None)
+
+    return run_times(config_dict).timeout(ceiling(config_dict))
@@ -0,0 +1,291 @@
+## @package tmin
+#
+# Minimizes a crash's inputs: the bytes that each of the crashing run's targeted reads were given. The run's
+# mutations are replayed (-replay_run) to capture each read's bytes (-replay_outputs), and then each read is
+# shrunk in turn by replaying every read's current bytes (-replay_inputs) and keeping each change that still
+# crashes the same way (see triage_queue.crash_signature). When the tracer labeled the crash (-labels), the
+# bytes that didn't reach it are zeroed and the ones after the last that did are cut first. What's left is
+# shrunk the way afl-tmin does it: deleting blocks of halving size, and then zeroing them.
+#
+# The minimized inputs are registered with the server by one last replay (-replay_register), which becomes a
+# new crashing run that can be triaged like any other.
+
+import glob
+import os
+import shutil
+
+from . import crash_record
+from . import run_slots
+from . import timeouts
+from . import triage_queue
+from .instrument import print_l, pwarning, replay_config, run_dr, target_arena_id
+from .state import get_path_to_run_file, get_paths_to_run_file, mutation_count, write_output_files
+
+## Names of a replay's input and output directories (under its run directory)
+REPLAY_INPUTS_DIR = "replay_inputs"
+REPLAY_OUTPUTS_DIR = "replay_outputs"
+
+## The most replays that a crash gets minimized with
+TMIN_MAX_EXECS = 2000
+
+## The smallest block that gets deleted or zeroed, in bytes
+TMIN_MIN_BLOCK = 1
+
+
+## @param run_id The crashing run's ID
+# @return a dict of each targeted read's labeled spans (as (start, end) tuples), or None if the tracer didn't
+#   label the crash
+def crash_spans(run_id):
+    for crash_file in get_paths_to_run_file(run_id, crash_record.CRASH_RECORD_PATTERN):
+        labels = crash_record.read(crash_file).get("labels")
+
+        if not labels:
+            continue
+
+        spans = {}
+        for key in ["pc", "operands", "address"]:
+            for span in labels.get(key) or []:
+                spans.setdefault(span["buffer"], []).append((span["start"], span["start"] + span["size"]))
+
+        return spans
+
+    return None
+
+
+## Makes an empty directory under a run's directory, cleaning up after any replay that used it before
+# @param run_id The run's ID
+# @param name The directory's name
+# @return the directory's path
+def _fresh_dir(run_id, name):
+    path = get_path_to_run_file(run_id, name)
+    if os.path.isdir(path):
+        shutil.rmtree(path)
+    os.makedirs(path)
+
+    return path
+
+
+## @param inputs_dir A replay input directory
+# @param reads A dict of each targeted read's bytes
+def _write_inputs(inputs_dir, reads):
+    for mut_count, buf in reads.items():
+        with open(os.path.join(inputs_dir, "{}.bin".format(mut_count)), "wb") as input_file:
+            input_file.write(buf)
+
+
+## Replays a run, stopping it as soon as it crashes
+# @param config_dict Configuration context dictionary
+# @param run_id The replay's run ID
+# @param arena_id The target's arena ID
+# @param replay_args The fuzzer's replay arguments
+# @return a tuple of the crash's signature (or None if it didn't crash) and the run
+def _replay(config_dict, run_id, arena_id, replay_args):
+    signature = None
+
+    def on_event(event):
+        nonlocal signature
+        if event.get("exception") and signature is None:
+            # The stack hash can pick up stale return addresses, which shrinking the input can
+            # change without changing the crash, so it's left out.
+            signature = triage_queue.crash_signature(event, stack=False) or event["exception"]
+            return True
+
+        return False
+
+    run = run_dr(
+        replay_config(config_dict, run_id, arena_id, replay_args),
+        verbose=config_dict["verbose"],
+        timeout=timeouts.fuzz_timeout(config_dict),
+        run_id=run_id,
+        on_event=on_event,
+    )
+
+    return signature, run
+
+
+## Replays a crashing run's mutations, and captures the bytes that each of its targeted reads ended up with
+# @param config_dict Configuration context dictionary
+# @param arena_id The target's arena ID
+# @param crash_run_id The crashing run's ID
+# @param count The number of mutations that the run recorded
+# @return a tuple of the crash's signature (or None if it didn't crash) and a dict of each read's bytes
+def capture(config_dict, arena_id, crash_run_id, count):
+    run_id = run_slots.slots.acquire(config_dict)
+
+    try:
+        outputs_dir = _fresh_dir(run_id, REPLAY_OUTPUTS_DIR)
+        replay_args = ["-replay_run", crash_run_id, "-replay_count", str(count), "-replay_outputs", outputs_dir]
+        signature, _ = _replay(config_dict, run_id, arena_id, replay_args)
+
+        reads = {}
+        for path in glob.glob(os.path.join(outputs_dir, "*.bin")):
+            name = os.path.splitext(os.path.basename(path))[0]
+            if name.isdigit():
+                with open(path, "rb") as output_file:
+                    reads[int(name)] = output_file.read()
+
+        return signature, reads
+    finally:
+        if not run_slots.slots.release(run_id):
+            pwarning("Couldn't release replay run", run_id)
+
+
+## Shrinks a crashing run's inputs
+class Minimizer(object):
+
+    ## @param config_dict Configuration context dictionary
+    # @param arena_id The target's arena ID
+    # @param signature The crash's signature, which every kept change must preserve
+    # @param reads A dict of each targeted read's bytes
+    def __init__(self, config_dict, arena_id, signature, reads):
+        self.config_dict = config_dict
+        self.arena_id = arena_id
+        self.signature = signature
+        self.reads = dict(reads)
+        self.execs = 0
+
+    ## @return whether the minimizer has run out of replays
+    def exhausted(self):
+        return self.execs >= TMIN_MAX_EXECS
+
+    ## Replays the current inputs with one read's bytes replaced
+    # @param mut_count The read
+    # @param buf The read's candidate bytes
+    # @return whether the replay crashed the same way (in which case the candidate is kept)
+    def attempt(self, mut_count, buf):
+        if self.exhausted() or buf == self.reads[mut_count]:
+            return False
+
+        self.execs += 1
+        candidate = dict(self.reads)
+        candidate[mut_count] = buf
+
+        run_id = run_slots.slots.acquire(self.config_dict)
+        try:
+            inputs_dir = _fresh_dir(run_id, REPLAY_INPUTS_DIR)
+            _write_inputs(inputs_dir, candidate)
+            signature, _ = _replay(self.config_dict, run_id, self.arena_id, ["-replay_inputs", inputs_dir])
+        finally:
+            if not run_slots.slots.release(run_id):
+                pwarning("Couldn't release replay run", run_id)
+
+        if signature != self.signature:
+            return False
+
+        self.reads[mut_count] = buf
+        return True
+
+    ## Zeroes the bytes that didn't reach the crash, and cuts the ones after the last that did
+    # @param mut_count The read
+    # @param spans The read's labeled spans, as (start, end) tuples
+    def apply_labels(self, mut_count, spans):
+        buf = self.reads[mut_count]
+
+        if not spans:
+            self.attempt(mut_count, b"\x00" * len(buf))
+            return
+
+        zeroed = bytearray(len(buf))
+        for start, end in spans:
+            zeroed[start:end] = buf[start:end]
+        self.attempt(mut_count, bytes(zeroed))
+
+        end = max(end for _, end in spans)
+        self.attempt(mut_count, self.reads[mut_count][:end])
+
+    ## Deletes, and then zeroes, blocks of a read's bytes, halving the block size each pass
+    # @param mut_count The read
+    def shrink(self, mut_count):
+        block = max(len(self.reads[mut_count]) // 2, TMIN_MIN_BLOCK)
+
+        while block >= TMIN_MIN_BLOCK and not self.exhausted():
+            offset = 0
+            while offset < len(self.reads[mut_count]) and not self.exhausted():
+                buf = self.reads[mut_count]
+                if not self.attempt(mut_count, buf[:offset] + buf[offset + block:]):
+                    offset += block
+            block //= 2
+
+        block = max(len(self.reads[mut_count]) // 2, TMIN_MIN_BLOCK)
+
+        while block >= TMIN_MIN_BLOCK and not self.exhausted():
+            for offset in range(0, len(self.reads[mut_count]), block):
+                buf = self.reads[mut_count]
+                chunk = buf[offset:offset + block]
+                if any(chunk):
+                    self.attempt(mut_count, buf[:offset] + b"\x00" * len(chunk) + buf[offset + block:])
+            block //= 2
+
+    ## Minimizes every read
+    # @param spans A dict of each read's labeled spans, or None if the crash wasn't labeled
+    def minimize(self, spans):
+        for mut_count in sorted(self.reads):
+            before = len(self.reads[mut_count])
+
+            if spans is not None:
+                self.apply_labels(mut_count, spans.get(mut_count, []))
+            self.shrink(mut_count)
+
+            print_l("Read {}: {} -> {} bytes ({} replays so far)".format(
+                mut_count, before, len(self.reads[mut_count]), self.execs
+            ))
+
+
+## Registers minimized inputs with the server, as a new crashing run
+# @param config_dict Configuration context dictionary
+# @param arena_id The target's arena ID
+# @param reads A dict of each targeted read's bytes
+# @return the new run's ID, or None if it didn't crash
+def register(config_dict, arena_id, reads):
+    run_id = run_slots.slots.acquire(config_dict)
+    inputs_dir = _fresh_dir(run_id, REPLAY_INPUTS_DIR)
+    _write_inputs(inputs_dir, reads)
+
+    signature, run = _replay(config_dict, run_id, arena_id, ["-replay_inputs", inputs_dir, "-replay_register"])
+
+    if signature is None:
+        if not run_slots.slots.release(run_id):
+            pwarning("Couldn't release replay run", run_id)
+        return None
+
+    run_slots.slots.keep(run_id)
+    write_output_files(run, run_id, "fuzz")
+
+    return run_id
+
+
+## Minimizes the inputs of a crashing run of the target in the given config
+# @param config_dict Configuration context dictionary
+# @param targets_file Path to the target's targets file
+# @param crash_run_id The crashing run's ID
+def minimize_crash(config_dict, targets_file, crash_run_id):
+    arena_id = target_arena_id(targets_file)
+    count = mutation_count(crash_run_id)
+
+    if not count:
+        print_l("[!] Run {} didn't record any mutations".format(crash_run_id))
+        return
+
+    signature, reads = capture(config_dict, arena_id, crash_run_id, count)
+
+    if signature is None:
+        print_l("[!] Run {} didn't crash when replayed".format(crash_run_id))
+        return
+
+    print_l("Minimizing {} reads ({} bytes) that crash with {}".format(
+        len(reads), sum(len(buf) for buf in reads.values()), signature
+    ))
+
+    minimizer = Minimizer(config_dict, arena_id, signature, reads)
+    minimizer.minimize(crash_spans(crash_run_id))
+
+    run_id = register(config_dict, arena_id, minimizer.reads)
+
+    if run_id is None:
+        print_l("[!] The minimized inputs didn't crash when registered")
+        return
+
+    print_l("Minimized {} to {} bytes in {} replays: run {}".format(
+        sum(len(buf) for buf in reads.values()), sum(len(buf) for buf in minimizer.reads.values()),
+        minimizer.execs, run_id
+    ))
@@ -0,0 +1,290 @@
+## @package triage_queue
+#
+# Triages crashes on a pool of worker threads of their own, so that the fuzzing workers go straight
+# back to fuzzing after a crash rather than waiting on the tracer and the triager.
+#
+# The queue is kept in the target directory, so that crashes that were still waiting to be triaged
+# when the harness exited are triaged the next time it fuzzes the target. Crashes are also
+# deduplicated before they're queued, by a quick signature of where they happened (see
+# crash_signature), so that a crash storm in a single spot doesn't bury the workers.
+#
+# Queued crashes aren't triaged in the order they arrived in. Crashes at a spot that no queued crash has
+# crashed at before come first, and then the likeliest exploitable ones, by a severity prior that the fuzzer's
+# exception event already gives us (see crash_severity). That way, a backlog of triage doesn't keep the crashes
+# that matter most from an analyst.
+#
+# With a batch size over 1, a worker takes every queued crash up to the batch size at once, and triages them
+# together (see instrument.tracer_batch_run), so that the tracer's startup is paid for once per batch.
+
+import json
+import os
+import queue
+import threading
+import traceback
+
+from sl2.harness import config
+
+## File name of the triage queue (under the target directory)
+TRIAGE_QUEUE_FILE = "triage_queue.json"
+
+## Bumped whenever the queue's contents change incompatibly
+TRIAGE_QUEUE_VERSION = 1
+
+## Faults below this address are near-null dereferences, which are rarely exploitable
+NEAR_NULL_LIMIT = 0x10000
+
+## Severity priors, from the least to the likeliest exploitable
+SEVERITY_NONE = 0
+SEVERITY_NEAR_NULL_READ = 1
+SEVERITY_READ = 2
+SEVERITY_NEAR_NULL_WRITE = 3
+SEVERITY_CORRUPTION = 4
+SEVERITY_WRITE = 5
+SEVERITY_PC = 6
+
+## Severity priors of the exceptions that don't come with a faulting access
+EXCEPTION_SEVERITY = {
+    "STATUS_HEAP_CORRUPTION": SEVERITY_CORRUPTION,
+    "EXCEPTION_ILLEGAL_INSTRUCTION": SEVERITY_CORRUPTION,
+    "EXCEPTION_PRIV_INSTRUCTION": SEVERITY_CORRUPTION,
+    "EXCEPTION_ARRAY_BOUNDS_EXCEEDED": SEVERITY_READ,
+    "EXCEPTION_STACK_OVERFLOW": SEVERITY_NEAR_NULL_READ,
+}
+
+
+## Builds a crash's quick signature from the exception event that the fuzzer reported for it:
+# the exception, the module and offset that it happened at, and a hash of the return addresses on its
+# stack (when the fuzzer found any), so that crashes in shared code from different callers aren't merged.
+# @param event The fuzzer's exception event
+# @param stack Whether to include the stack hash
+# @return the signature, or None if the event doesn't say where the crash happened
+def crash_signature(event, stack=True):
+    if "module" not in event or "offset" not in event:
+        return None
+
+    signature = "{}|{}+{:x}".format(event["exception"], event["module"].lower(), event["offset"])
+    if stack and event.get("stack"):
+        signature += "|" + event["stack"]
+
+    return signature
+
+
+## @param signature A crash's quick signature (see crash_signature)
+# @return the part of it that says where the crash happened, without its stack
+def signature_site(signature):
+    return "|".join(signature.split("|")[:2])
+
+
+## Rates how likely a crash is to be exploitable, from the exception event that the fuzzer reported for it.
+# Access violations are rated by their faulting access: execution (or a fault at the PC itself) beats a write,
+# which beats a read, and wild addresses beat near-null ones.
+# @param event The fuzzer's exception event
+# @return the crash's severity prior (one of the SEVERITY_ constants)
+def crash_severity(event):
+    exception = event.get("exception")
+    access = event.get("access")
+
+    if exception != "EXCEPTION_ACCESS_VIOLATION" or access is None:
+        return EXCEPTION_SEVERITY.get(exception, SEVERITY_NONE)
+
+    if access == "execute" or event.get("fault_at_pc"):
+        return SEVERITY_PC
+
+    near_null = event.get("fault_address", 0) < NEAR_NULL_LIMIT
+    if access == "write":
+        return SEVERITY_NEAR_NULL_WRITE if near_null else SEVERITY_WRITE
+
+    return SEVERITY_NEAR_NULL_READ if near_null else SEVERITY_READ
+
+
+## A target's triage queue, and the workers that service it
+class TriageQueue(object):
+
+    ## Starts the queue's workers, and requeues anything left over from the last session
+    # @param target_dir The target directory
+    # @param triage Called with a run ID to triage it. Returns the triager's findings, or None.
+    # @param workers Number of triage workers
+    # @param finished Called with a run ID once everything that the queue does with it is done, or None
+    # @param triage_batch Called with a list of run IDs to triage them together. Returns a dict of run ID -> the
+    # triager's findings. None to triage every crash on its own.
+    # @param batch The most crashes that a worker hands to triage_batch at once
+    def __init__(self, target_dir, triage, workers=1, finished=None, triage_batch=None, batch=1):
+        self.path = os.path.join(target_dir, TRIAGE_QUEUE_FILE)
+        self.triage = triage
+        self.finished = finished
+        self.triage_batch = triage_batch
+        self.batch = max(1, batch)
+        self.lock = threading.Lock()
+        self.queue = queue.PriorityQueue()
+        self.sequence = 0
+
+        ## Run IDs that are queued or being triaged, in order
+        self.pending = []
+        ## Signatures of every crash that's been queued
+        self.seen = set()
+        ## Where every crash that's been queued happened (see signature_site)
+        self.sites = set()
+        ## Each pending run's priority, as [novel, severity]
+        self.priorities = {}
+
+        self._load()
+        for run_id in self.pending:
+            novel, severity = self.priorities.get(run_id, [False, SEVERITY_NONE])
+            self._put(run_id, None, novel, severity)
+
+        # The workers are daemons, so that the GUI can exit with triages outstanding;
+        # those are picked back up next time.
+        self.workers = [threading.Thread(target=self._work, daemon=True) for _ in range(max(1, workers))]
+        for worker in self.workers:
+            worker.start()
+
+    def __enter__(self):
+        return self
+
+    # On an exception (e.g. a KeyboardInterrupt), whatever's still queued is left for next time
+    # rather than waited on.
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        if exc_type is None:
+            self.close()
+
+    def _load(self):
+        try:
+            with open(self.path, "r") as queue_file:
+                saved = json.load(queue_file)
+
+            if saved["version"] != TRIAGE_QUEUE_VERSION:
+                return
+
+            self.pending = [
+                run_id for run_id in saved["pending"] if os.path.isdir(os.path.join(config.sl2_runs_dir, run_id))
+            ]
+            self.seen = set(saved["seen"])
+
+            # Queues saved before crashes were prioritized just triage in arrival order.
+            self.sites = set(saved.get("sites", []))
+            priorities = saved.get("priority", {})
+            self.priorities = {run_id: priorities[run_id] for run_id in self.pending if run_id in priorities}
+        except (OSError, ValueError, KeyError, TypeError):
+            pass
+
+    # Callers should hold the lock. The queue is replaced rather than rewritten in place,
+    # so that a harness that dies halfway through doesn't leave a torn one behind.
+    def _save(self):
+        saved = {
+            "version": TRIAGE_QUEUE_VERSION,
+            "pending": self.pending,
+            "seen": sorted(self.seen),
+            "sites": sorted(self.sites),
+            "priority": self.priorities,
+        }
+
+        tmp_path = "{}.{}.tmp".format(self.path, os.getpid())
+        with open(tmp_path, "w") as queue_file:
+            json.dump(saved, queue_file)
+        os.replace(tmp_path, self.path)
+
+    ## Hands a crash to the workers. Novel crashes go first, then the most severe, then the oldest.
+    # @param run_id The crash's run ID, or None to stop a worker after everything else
+    # @param on_triaged Called once the crash is triaged
+    # @param novel Whether the crash happened at a new site
+    # @param severity The crash's severity prior
+    def _put(self, run_id, on_triaged, novel, severity):
+        with self.lock:
+            self.sequence += 1
+            sequence = self.sequence
+
+        rank = 2 if run_id is None else (0 if novel else 1)
+        self.queue.put((rank, -severity, sequence, run_id, on_triaged))
+
+    ## Queues a crash for triage, unless a crash with the same signature already has been
+    # @param run_id The crashing run's ID
+    # @param signature The crash's quick signature (see crash_signature), or None to always triage it
+    # @param on_triaged Called with the run ID and the triager's findings (or None) once it's triaged
+    # @param severity The crash's severity prior (see crash_severity)
+    # @return whether the crash was queued
+    def submit(self, run_id, signature=None, on_triaged=None, severity=SEVERITY_NONE):
+        run_id = str(run_id)
+        novel = False
+
+        with self.lock:
+            if signature is not None:
+                if signature in self.seen:
+                    return False
+                self.seen.add(signature)
+
+                site = signature_site(signature)
+                novel = site not in self.sites
+                self.sites.add(site)
+
+            self.pending.append(run_id)
+            self.priorities[run_id] = [novel, severity]
+            self._save()
+
+        self._put(run_id, on_triaged, novel, severity)
+        return True
+
+    ## @return how many crashes are queued or being triaged
+    def outstanding(self):
+        with self.lock:
+            return len(self.pending)
+
+    ## @return the next crashes for a worker to triage, as (run ID, on_triaged) pairs, or an empty list once the
+    # worker should stop
+    def _take(self):
+        _, _, _, run_id, on_triaged = self.queue.get()
+        if run_id is None:
+            return []
+
+        taken = [(run_id, on_triaged)]
+        while self.triage_batch and len(taken) < self.batch:
+            try:
+                item = self.queue.get_nowait()
+            except queue.Empty:
+                break
+
+            # Stops sort after every crash, so the rest of the queue is empty; leave it for whoever's next.
+            if item[3] is None:
+                self.queue.put(item)
+                break
+            taken.append((item[3], item[4]))
+
+        return taken
+
+    def _work(self):
+        while True:
+            taken = self._take()
+            if not taken:
+                return
+
+            run_ids = [run_id for run_id, _ in taken]
+            try:
+                if len(run_ids) > 1:
+                    batch_findings = self.triage_batch(run_ids)
+                else:
+                    batch_findings = {run_ids[0]: self.triage(run_ids[0])}
+            except Exception:
+                traceback.print_exc()
+                batch_findings = {}
+
+            for run_id, on_triaged in taken:
+                findings = batch_findings.get(run_id)
+
+                with self.lock:
+                    if run_id in self.pending:
+                        self.pending.remove(run_id)
+                    self.priorities.pop(run_id, None)
+                    self._save()
+
+                if on_triaged:
+                    on_triaged(run_id, findings)
+
+                if self.finished:
+                    self.finished(run_id)
+
+    ## Waits for every queued crash to be triaged, and stops the workers
+    def close(self):
+        for _ in self.workers:
+            self._put(None, None, False, SEVERITY_NONE)
+
+        for worker in self.workers:
+            worker.join()
@@ -0,0 +1,97 @@
+## @package wizard_cache
+#
+# Caches the wizard's findings for a target, so that re-opening a target (or changing its profile)
+# doesn't mean re-running it under the wizard when nothing about it has changed.
+#
+# The cache lives in the target directory, and is keyed by a hash of the target executable, its
+# arguments, and the options that change what the wizard reports. It also records the size and
+# modification time of every module that the wizard saw the target load, and is only used while
+# all of them are unchanged.
+
+import hashlib
+import json
+import os
+
+## File name of the wizard cache (under the target directory)
+WIZARD_CACHE_FILE = "wizard_cache.json"
+
+## Bumped whenever the cache's contents change incompatibly
+WIZARD_CACHE_VERSION = 1
+
+## Config keys that change what the wizard reports
+WIZARD_KEYS = ["client_args", "arg_hash", "wizard_aggregate", "wizard_influence"]
+
+
+## Hashes everything that a wizard run's findings depend on, short of the modules it loads
+# @param config_dict Configuration context dictionary
+# @return hex digest
+def cache_key(config_dict):
+    hasher = hashlib.sha256()
+
+    with open(config_dict["target_application_path"].strip('"'), "rb") as target:
+        for chunk in iter(lambda: target.read(1024 * 1024), b""):
+            hasher.update(chunk)
+
+    hasher.update(json.dumps(config_dict["target_args"]).encode("utf-8"))
+    hasher.update(json.dumps([config_dict.get(key) for key in WIZARD_KEYS]).encode("utf-8"))
+
+    return hasher.hexdigest()
+
+
+## @param path Path to a module
+# @return [size, mtime] for the module, or None if it's gone
+def _module_stamp(path):
+    try:
+        stat = os.stat(path)
+        return [stat.st_size, stat.st_mtime_ns]
+    except OSError:
+        return None
+
+
+## Loads the cached findings of a target, if they're still valid
+# @param target_dir The target directory
+# @param config_dict Configuration context dictionary
+# @return (findings, cmps), or None if there's no valid cache
+def load(target_dir, config_dict):
+    try:
+        with open(os.path.join(target_dir, WIZARD_CACHE_FILE), "r") as cache_file:
+            cache = json.load(cache_file)
+
+        if cache["version"] != WIZARD_CACHE_VERSION or cache["key"] != cache_key(config_dict):
+            return None
+
+        for path, stamp in cache["modules"].items():
+            if _module_stamp(path) != stamp:
+                return None
+
+        return cache["findings"], {tuple(cmp) for cmp in cache["cmps"]}
+    except (OSError, ValueError, KeyError, TypeError):
+        return None
+
+
+## Caches the findings of a wizard run
+# @param target_dir The target directory
+# @param config_dict Configuration context dictionary
+# @param findings The wizard's findings
+# @param cmps The (size, value) comparison constants that the wizard saw
+# @param modules Paths to the modules that the wizard saw the target load
+def store(target_dir, config_dict, findings, cmps, modules):
+    cache = {
+        "version": WIZARD_CACHE_VERSION,
+        "key": cache_key(config_dict),
+        "modules": {path: _module_stamp(path) for path in modules},
+        "findings": findings,
+        "cmps": sorted(cmps),
+    }
+
+    with open(os.path.join(target_dir, WIZARD_CACHE_FILE), "w") as cache_file:
+        json.dump(cache, cache_file)
+
+
+## Throws away a target's cached findings, so that the wizard runs again next time
+# @param target_dir The target directory
+def invalidate(target_dir):
+    try:
+        os.remove(os.path.join(target_dir, WIZARD_CACHE_FILE))
+    except FileNotFoundError:
+        pass
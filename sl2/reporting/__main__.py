@@ -9,12 +9,15 @@ from jinja2 import Environment, PackageLoader
 from shutil import copyfile
 
 import sl2.harness.config
-from sl2.harness.state import get_target_slug, get_target_dir
-from sl2.stats.__main__ import plot_discovered_paths
+from sl2.harness.drcov import TARGET_DRCOV_FILE, summarize_drcov
+from sl2.harness.state import get_target_slug, get_target_dir, stream_crashes
+from sl2.stats.__main__ import plot_hourly_paths
 from sl2 import db
-from sl2.db.crash import Crash
-from sl2.db.run_block import RunBlock
-from sl2.db.coverage import PathRecord
+from sl2.db.crash_bucket import CrashBucket
+from sl2.db.run_hour import RunHour
+
+## File name of the report's rendered path graph (under the target directory), by the hour that it covers up to
+CHART_FILE_FMT = "report_paths.{}.png"
 
 
 ## Filter that formats floats or ints into strings with commas in the thousands place
@@ -22,7 +25,34 @@ def comma_ify(value):
     return "{:,}".format(value)
 
 
-## Create an HTML report for a given target from the database.
+## Renders the graph of the estimated path coverage, or reuses the one already rendered for the same hour
+# @param target_dir The target directory
+# @param hours The target's hours (see RunHour.hours)
+# @return the graph, as a base64-encoded PNG
+def render_coverage_graph(target_dir, hours):
+    path = os.path.join(target_dir, CHART_FILE_FMT.format(RunHour.window(hours).strftime("%Y%m%d%H")))
+
+    if not os.path.isfile(path):
+        coverage_img = io.BytesIO()
+        plt = plot_hourly_paths(hours)
+        plt.savefig(coverage_img, format="png", dpi=200)
+        plt.close()
+
+        # Graphs of earlier hours are never used again.
+        for stale in glob.glob(os.path.join(target_dir, CHART_FILE_FMT.format("*"))):
+            os.remove(stale)
+
+        tmp_path = "{}.{}.tmp".format(path, os.getpid())
+        with open(tmp_path, "wb") as chart_file:
+            chart_file.write(coverage_img.getvalue())
+        os.replace(tmp_path, path)
+
+    with open(path, "rb") as chart_file:
+        return b64encode(chart_file.read()).decode("utf-8")
+
+
+## Create an HTML report for a given target from the database. Only the database's aggregates (RunHour and
+# CrashBucket) are read, so the time that this takes doesn't grow with the campaign.
 def generate_report(dest=None, browser=True):
     # Create the template environment
     env = Environment(loader=PackageLoader("sl2", "reporting/templates"))
@@ -36,20 +66,22 @@ def generate_report(dest=None, browser=True):
     ]
     revision = 0 if len(found) == 0 else max(found) + 1
 
-    # Render the graph of the estimated path coverage and base64 encode it
+    # Grab the target's hourly run stats from the database, building them from its run blocks if it has none yet
     slug = get_target_slug(sl2.harness.config.config)
-    coverage_img = io.BytesIO()
-    plt = plot_discovered_paths(slug)
-    plt.savefig(coverage_img, format="png", dpi=200)
-    coverage_graph = b64encode(coverage_img.getvalue()).decode("utf-8")
+    session = db.getSession()
+    RunHour.backfill(session, slug)
+    hours = RunHour.hours(session, slug)
 
-    # Get a current estimate of the path coverage
-    num_paths, coverage_estimate = PathRecord.estimate_current_path_coverage(slug)
+    # Render the graph of the estimated path coverage (once per hour) and base64 encode it
+    coverage_graph = render_coverage_graph(target_dir, hours)
 
-    # Grab the run blocks and crashes from the database
-    session = db.getSession()
-    run_blocks = session.query(RunBlock).filter(RunBlock.target_config_slug == slug).all()
-    crash_base = session.query(Crash).filter(Crash.target_config_slug == slug)
+    # The path coverage estimate as of the last block
+    num_paths = hours[-1].num_paths if hours else 0
+    coverage_estimate = float(hours[-1].path_coverage) if hours else 0.0
+
+    # Summarize the exact block coverage, if any runs exported it
+    drcov_path = os.path.join(target_dir, TARGET_DRCOV_FILE)
+    block_coverage = summarize_drcov(drcov_path) if os.path.isfile(drcov_path) else []
 
     # create a big dict with all the environment variables for the template to render
     vars = {
@@ -65,25 +97,19 @@ def generate_report(dest=None, browser=True):
         "generated": datetime.datetime.now().isoformat(timespec="minutes"),
         "version": pkg_resources.require("sl2")[0].version,
         # Get the count of unique, total, and severe crashes from the database
-        "uniq_crash_count": crash_base.distinct(Crash.crashash).group_by(Crash.crashash).count(),
-        "total_crash_count": crash_base.count(),
-        "severe_crash_count": crash_base.filter(
-            Crash.exploitability != "None", Crash.exploitability != "Unknown", Crash.exploitability != "Low"
-        )
-        .group_by(Crash.crashash)
-        .count(),
+        "uniq_crash_count": CrashBucket.unique_count(session, slug),
+        "total_crash_count": CrashBucket.total_count(session, slug),
+        "severe_crash_count": CrashBucket.severe_count(session, slug),
         # Get the number of runs and time spent
-        "run_count": sum(x.runs for x in run_blocks),
-        "cpu_time": sum(((block.ended - block.started).total_seconds()) for block in run_blocks),
+        "run_count": sum(hour.runs for hour in hours),
+        "cpu_time": sum(hour.cpu_seconds for hour in hours),
         # Get the number of paths and coverage
         "path_count": num_paths,
         "coverage_estimate": coverage_estimate * 100,
         "coverage_graph": coverage_graph,
+        "block_coverage": block_coverage,
         # Generate a list of the unique crashes
-        "crashes": sorted(
-            session.query(Crash).filter(Crash.target_config_slug == slug).group_by(Crash.crashash).all(),
-            key=lambda crash: crash.int_exploitability,
-        ),
+        "buckets": CrashBucket.ranked(session, slug),
     }
 
     # Write the report to the disk
@@ -104,6 +130,18 @@ def generate_report(dest=None, browser=True):
             os.startfile(fname)
 
 
-## Generates a fuzzing report. Takes the `-p` parameter to indicate which config profile to use
+## Generates a fuzzing report. Takes the `-p` parameter to indicate which config profile to use, and
+# --export_crashes to stream the crashes to a file instead
 def main():
+    export_path = sl2.harness.config.config.get("export_crashes")
+    if export_path:
+        exported = stream_crashes(
+            get_target_slug(sl2.harness.config.config),
+            export_path,
+            sl2.harness.config.config.get("export_format") or "csv",
+            sl2.harness.config.config.get("export_representatives"),
+        )
+        print("Exported {} crashes to {}".format(exported, export_path))
+        return
+
     generate_report()
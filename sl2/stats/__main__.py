@@ -1,10 +1,11 @@
+import itertools
 import matplotlib.pyplot as plt
 import statistics
 
 from sl2 import db
 from sl2.db.run_block import RunBlock
-from sl2.harness import config
-from sl2.harness.state import get_target_slug
+from sl2.harness import config, series
+from sl2.harness.state import get_target_dir, get_target_slug
 
 
 ## Gets a list of the total number of CPU seconds spent fuzzing after each block
@@ -69,11 +70,65 @@ def plot_discovered_paths(target_slug):
     return plt
 
 
-## Builds and renders rate/time graph and path graph
+## Builds the same graph as plot_discovered_paths, from a target's hourly tallies instead of its run blocks
+#  @param hours - List[RunHour] - the target's hours, oldest first
+def plot_hourly_paths(hours):
+    fuzzing_time = []
+    total_time_spent_fuzzing = 0
+    for hour in hours:
+        total_time_spent_fuzzing += hour.cpu_seconds
+        fuzzing_time.append(total_time_spent_fuzzing)
+
+    figure, count = plt.subplots()
+
+    count.plot(fuzzing_time, [hour.num_paths for hour in hours], marker=".", color="black")
+    count.set_xlabel("Seconds spent fuzzing")
+    count.set_ylabel("Unique Paths Encountered")
+    count.legend(["Unique Paths"])
+
+    percentage = count.twinx()
+    percentage.plot(fuzzing_time, [(hour.path_coverage * 100) for hour in hours], marker=",", color="r")
+    percentage.legend(["Estimated Completion"])
+    percentage.set_ylabel("Estimated path completion percentage")
+
+    plt.title("Code Paths Over Time")
+    figure.tight_layout()
+    return plt
+
+
+## Builds a graph of the server's time series for a target: its execution rate, paths, and crashes over time
+#  @param samples - List[series.Sample] - the target's time series, oldest first
+def plot_series(samples):
+    start = samples[0].time if samples else 0
+    minutes = [(sample.time - start) / 60 for sample in samples]
+
+    figure, rate = plt.subplots()
+
+    rate.plot(minutes, [sample.execs for sample in samples], marker=".", color="black")
+    rate.set_xlabel("Minutes since the first sample")
+    rate.set_ylabel("Runs per sample")
+    rate.legend(["Runs"])
+
+    paths = rate.twinx()
+    paths.plot(minutes, [sample.paths for sample in samples], marker=",", color="b")
+    paths.step(minutes, list(itertools.accumulate(sample.crashes for sample in samples)), color="r")
+    paths.legend(["Unique Paths", "Crashes"])
+    paths.set_ylabel("Paths and crashes")
+
+    plt.title("Campaign Over Time")
+    figure.tight_layout()
+    return plt
+
+
+## Builds and renders rate/time graph and path graph, and the server's time series when there is one
 def main():
     slug = get_target_slug(config.config)
     print("Getting stats for", slug)
 
+    samples = series.target_series(get_target_dir(config.config))
+    if samples:
+        plot_series(samples)
+
     plot_run_rate(slug)
     # plt.show()
     plot_discovered_paths(slug)
@@ -8,6 +8,14 @@ import sys
 import test.support as support
 import unittest
 
+from sl2.test.test_dumps import TestDumps  # noqa: F401
+from sl2.test.test_events import TestEvents  # noqa: F401
+from sl2.test.test_run_slots import TestRunSlots  # noqa: F401
+from sl2.test.test_scheduler import TestScheduledTarget, TestTargetScheduler  # noqa: F401
+from sl2.test.test_target_index import TestTargetIndex  # noqa: F401
+from sl2.test.test_timeouts import TestTimeouts  # noqa: F401
+from sl2.test.test_triage_queue import TestCrashSeverity, TestCrashSignature, TestTriageQueue  # noqa: F401
+
 ## Set to true for stdout/stderr
 DEBUG = True
 
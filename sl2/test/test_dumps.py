@@ -0,0 +1,63 @@
+## @package test_dumps
+# Unit tests for waiting on the server's background crash dumps (see sl2.harness.dumps)
+import os
+import tempfile
+import threading
+import unittest
+from unittest import mock
+
+from sl2.harness import dumps
+
+
+class TestDumps(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.run_dir = os.path.join(self.dir.name, "run")
+        os.makedirs(self.run_dir)
+
+        for patcher in [
+            mock.patch.object(dumps.config, "sl2_runs_dir", self.dir.name),
+            mock.patch.object(dumps, "POLL_INTERVAL", 0.01),
+        ]:
+            patcher.start()
+            self.addCleanup(patcher.stop)
+
+    def tearDown(self):
+        self.dir.cleanup()
+
+    def touch(self, name):
+        with open(os.path.join(self.run_dir, name), "w"):
+            pass
+
+    ## A dump that's already in place doesn't wait
+    def test_present(self):
+        self.touch("initial.42.dmp")
+        self.assertTrue(dumps.wait_for_dump("run", grace=60, timeout=60))
+
+    ## A dump that's being written is waited for, until it's renamed into place
+    def test_writing(self):
+        self.touch("initial.42.dmp.z.tmp")
+
+        def finish():
+            os.replace(os.path.join(self.run_dir, "initial.42.dmp.z.tmp"), os.path.join(self.run_dir, "initial.42.dmp"))
+
+        timer = threading.Timer(0.1, finish)
+        timer.start()
+        self.addCleanup(timer.cancel)
+
+        self.assertTrue(dumps.wait_for_dump("run", grace=0, timeout=10))
+
+    ## A dump that the server hasn't started gets the grace period, and one that it never finishes gets the timeout
+    def test_missing(self):
+        self.assertFalse(dumps.wait_for_dump("run", grace=0.05, timeout=10))
+
+        self.touch("initial.42.dmp.tmp")
+        self.assertFalse(dumps.wait_for_dump("run", grace=0, timeout=0.05))
+
+    ## Runs that are gone (e.g. archived) have nothing to wait for
+    def test_no_run(self):
+        self.assertFalse(dumps.wait_for_dump("gone", grace=60, timeout=60))
+
+
+if __name__ == "__main__":
+    unittest.main()
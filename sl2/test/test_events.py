@@ -0,0 +1,113 @@
+## @package test_events
+# Unit tests for decoding client events (see sl2.harness.events)
+import os
+import tempfile
+import unittest
+from unittest import mock
+
+import msgpack
+
+from sl2.harness import events
+
+
+## @param event An event (dict)
+# @return the event as a frame of an event file
+def frame(event):
+    payload = msgpack.packb(event, use_bin_type=True)
+    return events.FRAME_HEADER.pack(len(payload)) + payload
+
+
+class TestEvents(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.path = os.path.join(self.dir.name, "fuzzer.events")
+
+    def tearDown(self):
+        self.dir.cleanup()
+
+    def write(self, data, mode="wb"):
+        with open(self.path, mode) as event_file:
+            event_file.write(data)
+
+    ## Frames are decoded in order, even when they straddle the chunks that the file is read in
+    def test_read_events(self):
+        written = [{"type": "coverage", "newc": i} for i in range(10)]
+        self.write(b"".join(frame(event) for event in written))
+
+        with mock.patch.object(events, "READ_SIZE", 3):
+            self.assertEqual(list(events.read_events(self.path)), written)
+
+    ## An empty file has no events
+    def test_read_empty(self):
+        self.write(b"")
+        self.assertEqual(list(events.read_events(self.path)), [])
+
+    ## A frame that the client didn't finish writing ends the stream
+    def test_read_truncated(self):
+        self.write(frame({"a": 1}) + frame({"b": 2})[:-1])
+        self.assertEqual(list(events.read_events(self.path)), [{"a": 1}])
+
+        self.write(frame({"a": 1}) + b"\x05\x00")
+        self.assertEqual(list(events.read_events(self.path)), [{"a": 1}])
+
+    ## A frame that isn't a single msgpack object is skipped, and the frames after it still decode
+    def test_read_malformed(self):
+        bad = msgpack.packb(1) + msgpack.packb(2)
+        self.write(events.FRAME_HEADER.pack(len(bad)) + bad + frame({"b": 2}))
+        self.assertEqual(list(events.read_events(self.path)), [{"b": 2}])
+
+    ## Appended events read back like the client's own
+    def test_append_event(self):
+        self.write(frame({"type": "crash"}))
+        events.append_event(self.path, {"type": "timeout", "elapsed": 1.5})
+
+        self.assertEqual(list(events.read_events(self.path)), [{"type": "crash"}, {"type": "timeout", "elapsed": 1.5}])
+
+    ## A tail only returns each event once, as soon as its frame is complete
+    def test_tail(self):
+        tail = events.EventTail(self.path)
+        self.assertEqual(tail.poll(), [])
+
+        first, second = frame({"n": 1}), frame({"n": 2})
+        self.write(first + second[:3])
+        self.assertEqual(tail.poll(), [{"n": 1}])
+        self.assertEqual(tail.poll(), [])
+
+        self.write(second[3:], "ab")
+        self.assertEqual(tail.poll(), [{"n": 2}])
+        self.assertEqual(tail.offset, len(first) + len(second))
+        self.assertEqual(tail.pending, b"")
+
+    ## stderr lines that aren't JSON objects are skipped, and old coverage lines are recognized
+    def test_parse_event_lines(self):
+        stderr = b"\n".join([
+            b'{"type": "crash", "exception": "EXCEPTION_ACCESS_VIOLATION"}',
+            b"some target output",
+            b'#COVERAGE:{"newc": 3}',
+            b"[1, 2]",
+            b"\xff\xfe",
+            b"",
+        ])
+
+        self.assertEqual(list(events.parse_event_lines(stderr)), [
+            {"type": "crash", "exception": "EXCEPTION_ACCESS_VIOLATION"},
+            {"type": "coverage", "newc": 3},
+        ])
+
+    ## The event file wins when it has anything in it, and stderr is used otherwise
+    def test_run_events(self):
+        stderr = b'{"from": "stderr"}'
+
+        self.assertEqual(list(events.run_events(self.path, stderr)), [{"from": "stderr"}])
+        self.assertEqual(list(events.run_events(None, stderr)), [{"from": "stderr"}])
+        self.assertEqual(list(events.run_events(None, None)), [])
+
+        self.write(b"")
+        self.assertEqual(list(events.run_events(self.path, stderr)), [{"from": "stderr"}])
+
+        self.write(frame({"from": "file"}))
+        self.assertEqual(list(events.run_events(self.path, stderr)), [{"from": "file"}])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,148 @@
+## @package test_run_slots
+# Unit tests for the scratch run directory pool (see sl2.harness.run_slots)
+import os
+import tempfile
+import unittest
+from unittest import mock
+
+from sl2.harness import run_slots
+from sl2.harness.run_slots import RunSlots
+
+
+class TestRunSlots(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.runs_dir = os.path.join(self.dir.name, "runs")
+        self.slots_dir = os.path.join(self.dir.name, "slots")
+        os.makedirs(self.runs_dir)
+        os.makedirs(self.slots_dir)
+
+        self.written = []
+        for patcher in [
+            mock.patch.object(run_slots.config, "sl2_runs_dir", self.runs_dir),
+            mock.patch.object(run_slots.config, "sl2_slots_dir", self.slots_dir),
+            mock.patch.object(run_slots, "target_run_files", lambda config_dict: config_dict["files"]),
+            mock.patch.object(run_slots, "write_target_run_files", self.write_target_run_files),
+        ]:
+            patcher.start()
+            self.addCleanup(patcher.stop)
+
+        self.pools = []
+
+    def tearDown(self):
+        # The lock files have to be closed before their directory can go.
+        for pool in self.pools:
+            for run_id in list(pool.owned):
+                pool._drop(run_id, remove=False)
+        self.dir.cleanup()
+
+    def write_target_run_files(self, run_id, run_files):
+        self.written.append((run_id, run_files))
+        for name, contents in zip(["program.txt", "arguments.txt"], run_files):
+            with open(os.path.join(self.runs_dir, run_id, name), "w") as run_file:
+                run_file.write(contents)
+
+    def pool(self):
+        pool = RunSlots()
+        self.pools.append(pool)
+        return pool
+
+    def run_dir(self, run_id):
+        return os.path.join(self.runs_dir, run_id)
+
+    def lock_path(self, run_id):
+        return os.path.join(self.slots_dir, "{}.lock".format(run_id))
+
+    ## A released slot is emptied (short of the target's files) and handed out again
+    def test_reuse(self):
+        pool = self.pool()
+        config_dict = {"files": ("target.exe", "-x")}
+
+        run_id = pool.acquire(config_dict)
+        self.assertTrue(os.path.isdir(self.run_dir(run_id)))
+        self.assertTrue(os.path.isfile(self.lock_path(run_id)))
+
+        os.makedirs(os.path.join(self.run_dir(run_id), "inputs"))
+        with open(os.path.join(self.run_dir(run_id), "initial.dmp"), "w"):
+            pass
+
+        self.assertTrue(pool.release(run_id))
+        self.assertEqual(sorted(os.listdir(self.run_dir(run_id))), ["arguments.txt", "program.txt"])
+        self.assertEqual(pool.acquire(config_dict), run_id)
+
+    ## Every slot that's in use is a different one
+    def test_concurrent(self):
+        pool = self.pool()
+        run_ids = {pool.acquire({"files": ("a", "")}) for _ in range(3)}
+
+        self.assertEqual(len(run_ids), 3)
+        self.assertEqual(len(os.listdir(self.slots_dir)), 3)
+
+    ## The target's files are only rewritten when the slot's target changes
+    def test_target_files(self):
+        pool = self.pool()
+
+        run_id = pool.acquire({"files": ("a.exe", "")})
+        pool.release(run_id)
+        pool.acquire({"files": ("a.exe", "")})
+        pool.release(run_id)
+        pool.acquire({"files": ("b.exe", "")})
+
+        self.assertEqual(self.written, [(run_id, ("a.exe", "")), (run_id, ("b.exe", ""))])
+
+    ## Only our own slots can be released
+    def test_release_unknown(self):
+        pool = self.pool()
+        self.assertFalse(pool.release("not-a-slot"))
+
+    ## A kept slot becomes its run's own directory, and the next run gets a new slot
+    def test_keep(self):
+        pool = self.pool()
+        config_dict = {"files": ("a", "")}
+
+        run_id = pool.acquire(config_dict)
+        pool.keep(run_id)
+
+        self.assertTrue(os.path.isdir(self.run_dir(run_id)))
+        self.assertFalse(os.path.exists(self.lock_path(run_id)))
+        self.assertFalse(pool.release(run_id))
+        self.assertNotEqual(pool.acquire(config_dict), run_id)
+
+        # Keeping something that isn't a slot (any more) does nothing.
+        pool.keep(run_id)
+        self.assertTrue(os.path.isdir(self.run_dir(run_id)))
+
+    ## Slots left behind by an earlier harness are adopted, emptied, by the next one
+    def test_adopt(self):
+        config_dict = {"files": ("a", "")}
+
+        left = self.pool()
+        run_id = left.acquire(config_dict)
+        with open(os.path.join(self.run_dir(run_id), "stale.txt"), "w"):
+            pass
+        left.owned.pop(run_id).close()
+
+        # A lock file whose directory is gone isn't a slot any more.
+        with open(self.lock_path("gone"), "w"):
+            pass
+
+        pool = self.pool()
+        self.assertEqual(pool.acquire(config_dict), run_id)
+        self.assertNotIn("stale.txt", os.listdir(self.run_dir(run_id)))
+        self.assertNotIn("gone", pool.owned)
+
+    ## A slot that's still locked by another harness isn't adopted
+    @unittest.skipUnless(run_slots.msvcrt, "slot locks are only taken on Windows")
+    def test_adopt_locked(self):
+        config_dict = {"files": ("a", "")}
+
+        other = self.pool()
+        run_id = other.acquire(config_dict)
+        other.release(run_id)
+
+        pool = self.pool()
+        self.assertNotEqual(pool.acquire(config_dict), run_id)
+
+
+if __name__ == "__main__":
+    unittest.main()
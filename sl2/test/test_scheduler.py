@@ -0,0 +1,154 @@
+## @package test_scheduler
+# Unit tests for sharing workers between targets (see sl2.harness.scheduler)
+import os
+import tempfile
+import types
+import unittest
+from unittest import mock
+
+from sl2.harness import scheduler
+from sl2.harness.scheduler import ScheduledTarget, TargetScheduler
+
+
+## @return a finished run with the given coverage event and crash signature
+def run(coverage=None, crash_signature=None, run_id="run"):
+    return types.SimpleNamespace(coverage=coverage, crash_signature=crash_signature, run_id=run_id)
+
+
+class TestScheduledTarget(unittest.TestCase):
+    def setUp(self):
+        self.target = ScheduledTarget({}, "targets.msg")
+
+    ## @return what a run was worth, given a target that started out with no weight
+    def reward(self, crashed, finished):
+        self.target.weight = 0.0
+        self.target.update(crashed, finished)
+        return self.target.weight / scheduler.DECAY
+
+    ## New paths, new coverage and a higher score are each worth a path, however many of them a run has
+    def test_coverage_rewards(self):
+        self.assertAlmostEqual(self.reward(False, run()), 0.0)
+        self.assertAlmostEqual(self.reward(False, run({"hash": "a"})), 1.0)
+        self.assertAlmostEqual(self.reward(False, run({"hash": "a"})), 0.0)
+        self.assertAlmostEqual(self.reward(False, run({"newc": 2})), 1.0)
+        self.assertAlmostEqual(self.reward(False, run({"newb": 1})), 1.0)
+        self.assertAlmostEqual(self.reward(False, run({"hash": "b", "newc": 1, "newb": 1})), 1.0)
+        self.assertEqual(self.target.paths, {"a", "b"})
+
+    ## The first score only sets the bar; later runs are rewarded for beating it, and unscored runs are ignored
+    def test_score(self):
+        self.assertAlmostEqual(self.reward(False, run({"scr": 10})), 0.0)
+        self.assertAlmostEqual(self.reward(False, run({"scr": 10})), 0.0)
+        self.assertAlmostEqual(self.reward(False, run({"scr": 11})), 1.0)
+        self.assertAlmostEqual(self.reward(False, run({"scr": 5})), 0.0)
+        self.assertAlmostEqual(self.reward(False, run({"scr": -1})), 0.0)
+        self.assertAlmostEqual(self.reward(False, run({"scr": None})), 0.0)
+        self.assertEqual(self.target.best_score, 11)
+
+    ## New crashes are worth CRASH_REWARD on top of their coverage; crashes without a signature go by run ID
+    def test_crashes(self):
+        self.assertAlmostEqual(self.reward(True, run(crash_signature="E|m+1")), scheduler.CRASH_REWARD)
+        self.assertAlmostEqual(self.reward(True, run(crash_signature="E|m+1")), 0.0)
+        self.assertAlmostEqual(self.reward(True, run({"newc": 1}, "E|m+2")), 1.0 + scheduler.CRASH_REWARD)
+        self.assertAlmostEqual(self.reward(True, run(run_id="r1")), scheduler.CRASH_REWARD)
+        self.assertAlmostEqual(self.reward(True, run(run_id="r2")), scheduler.CRASH_REWARD)
+        self.assertEqual((self.target.crashes, self.target.runs), (5, 5))
+
+    ## The weight decays towards a target's recent rewards
+    def test_decay(self):
+        for _ in range(1000):
+            self.target.update(False, run())
+        self.assertLess(self.target.weight, scheduler.WEIGHT_FLOOR)
+
+        self.target.update(False, run({"newc": 1}))
+        self.assertAlmostEqual(self.target.weight, scheduler.DECAY, delta=scheduler.WEIGHT_FLOOR)
+
+
+class TestTargetScheduler(unittest.TestCase):
+    def targets(self, *weights):
+        targets = [ScheduledTarget({}, "targets{}.msg".format(i)) for i in range(len(weights))]
+        for target, weight in zip(targets, weights):
+            target.weight = weight
+        return targets
+
+    ## Runs are handed out in proportion to the targets' weights
+    def test_shares(self):
+        targets = self.targets(3.0, 1.0)
+        chosen = TargetScheduler(targets)
+        picks = [chosen.next() for _ in range(400)]
+
+        self.assertEqual(picks.count(targets[0]), 300)
+        self.assertEqual(picks.count(targets[1]), 100)
+
+    ## Ties go to the first target, and equal weights take turns
+    def test_ties(self):
+        targets = self.targets(1.0, 1.0, 1.0)
+        chosen = TargetScheduler(targets)
+
+        self.assertEqual([chosen.next() for _ in range(6)], targets * 2)
+
+    ## A target that's stopped finding anything still gets WEIGHT_FLOOR's share
+    def test_floor(self):
+        targets = self.targets(0.0, 1.0)
+        chosen = TargetScheduler(targets)
+        picks = [chosen.next() for _ in range(int(100 * (1 + 1 / scheduler.WEIGHT_FLOOR)))]
+
+        self.assertAlmostEqual(picks.count(targets[0]) / len(picks), scheduler.WEIGHT_FLOOR, delta=0.01)
+
+    ## A run limit stops the scheduler once it's been used up
+    def test_limit(self):
+        chosen = TargetScheduler(self.targets(1.0), runs=2)
+
+        self.assertIsNotNone(chosen.next())
+        self.assertIsNotNone(chosen.next())
+        self.assertIsNone(chosen.next())
+        self.assertIsNone(chosen.next())
+        self.assertIsNone(TargetScheduler(self.targets(1.0), runs=0).next())
+
+    ## Without targets there's nothing to hand out
+    def test_empty(self):
+        chosen = TargetScheduler([])
+
+        self.assertIsNone(chosen.next())
+        self.assertEqual(chosen.summary(), [])
+
+    ## Finished runs move their own target's weight, and show up in the summary
+    def test_run_complete(self):
+        targets = self.targets(1.0, 1.0)
+        chosen = TargetScheduler(targets)
+        chosen.run_complete(targets[1], False, run({"hash": "a"}))
+
+        self.assertEqual((targets[0].runs, targets[1].runs), (0, 1))
+        summary = chosen.summary()
+        self.assertEqual(len(summary), 2)
+        self.assertTrue(summary[1].startswith("100.0%"))
+        self.assertTrue(summary[1].endswith("targets1.msg"))
+
+    ## Every target directory with a targets file is scheduled, each with its own copy of the config
+    def test_targets_from_disk(self):
+        names = ["b", "a", "untargeted"]
+
+        with tempfile.TemporaryDirectory() as targets_dir:
+            for name in names:
+                os.makedirs(os.path.join(targets_dir, name))
+            for name in ["a", "b"]:
+                with open(os.path.join(targets_dir, name, "targets.msg"), "wb"):
+                    pass
+
+            all_targets = {os.path.join(targets_dir, name): ("{}.exe".format(name), "-" + name) for name in names}
+            config_dict = {"target_application_path": "other.exe", "client_args": ["-x"]}
+
+            with mock.patch.object(scheduler, "get_all_targets", return_value=all_targets):
+                targets = scheduler.targets_from_disk(config_dict)
+
+            self.assertEqual([t.config_dict["target_application_path"] for t in targets], ["a.exe", "b.exe"])
+            self.assertEqual(targets[0].config_dict["target_args"], "-a")
+            self.assertEqual(targets[0].config_dict["client_args"], ["-x", "-t", targets[0].targets_file])
+            self.assertEqual(config_dict, {"target_application_path": "other.exe", "client_args": ["-x"]})
+
+        with mock.patch.object(scheduler, "get_all_targets", return_value={}):
+            self.assertEqual(scheduler.targets_from_disk(config_dict), [])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,94 @@
+## @package test_target_index
+# Unit tests for the binary target index (see sl2.harness.target_index)
+import os
+import tempfile
+import unittest
+
+from sl2.harness import target_index
+
+
+## Reads an index back into its header and records
+# @param path Path to the index
+# @return a tuple of the header fields, the unpacked records, and the source name table
+def read_index(path):
+    with open(path, "rb") as index:
+        data = index.read()
+
+    header = target_index.TARGET_INDEX_HEADER.unpack_from(data, 0)
+    offset = target_index.TARGET_INDEX_HEADER.size
+    records = [
+        target_index.RECORD.unpack_from(data, offset + i * target_index.RECORD.size) for i in range(header[2])
+    ]
+    return header, records, data[offset + header[2] * target_index.RECORD.size:]
+
+
+class TestTargetIndex(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.target_file = os.path.join(self.dir.name, "targets.msg")
+
+    def tearDown(self):
+        self.dir.cleanup()
+
+    ## The index replaces a .msg extension, and is appended to anything else
+    def test_index_path(self):
+        self.assertEqual(target_index.index_path(os.path.join("a", "targets.msg")), os.path.join("a", "targets.sl2t"))
+        self.assertEqual(target_index.index_path("targets.json"), "targets.json.sl2t")
+        self.assertEqual(target_index.index_path("targets"), "targets.sl2t")
+
+    ## A target file with no targets still gets a valid header
+    def test_empty(self):
+        target_index.write_target_index(self.target_file, [])
+        header, records, strings = read_index(target_index.index_path(self.target_file))
+
+        self.assertEqual(header, (b"SL2T", target_index.TARGET_INDEX_VERSION, 0, target_index.RECORD.size))
+        self.assertEqual(records, [])
+        self.assertEqual(strings, b"")
+
+    ## Records keep the targets' order, and their source names are laid out one after the other
+    def test_records(self):
+        targets = [
+            {"selected": True, "func_name": "ReadFile", "mode": 4, "callCount": 2, "source": "a.txt",
+             "buffer": [65, 66], "argHash": "ff"},
+            {"func_name": "recv", "source": "éé"},
+        ]
+        target_index.write_target_index(self.target_file, targets)
+        header, records, strings = read_index(target_index.index_path(self.target_file))
+
+        self.assertEqual(header[2], 2)
+        first, second = records
+        self.assertEqual(first[0], 1)
+        self.assertEqual(first[1], target_index.ARG_HASH_SHA256)
+        self.assertEqual(first[2].rstrip(b"\0"), b"ReadFile")
+        self.assertEqual(first[3:5], (4, 2))
+        self.assertEqual(first[7].rstrip(b"\0"), b"ff")
+        self.assertEqual(first[8:11], (0, 5, 2))
+        self.assertEqual(first[12][:2], b"AB")
+
+        self.assertEqual(second[0], 0)
+        self.assertEqual(second[8:11], (5, 2, 0))
+        self.assertEqual(strings, "a.txtéé".encode("utf-16-le"))
+
+    ## Missing counts are -1, which is stored as the largest u64
+    def test_defaults_wrap(self):
+        target_index.write_target_index(self.target_file, [{}])
+        _, (record,), _ = read_index(target_index.index_path(self.target_file))
+
+        self.assertEqual(record[3], 1)
+        self.assertEqual(record[4:7], (target_index.U64_MASK,) * 3)
+
+    ## Names and buffers that don't fit are cut short, leaving room for a NUL
+    def test_truncation(self):
+        target_index.write_target_index(
+            self.target_file, [{"func_name": "f" * 64, "argHash": "h" * 100, "buffer": list(range(40))}]
+        )
+        _, (record,), _ = read_index(target_index.index_path(self.target_file))
+
+        self.assertEqual(record[2], b"f" * 31 + b"\0")
+        self.assertEqual(record[7], b"h" * 71 + b"\0")
+        self.assertEqual(record[10], target_index.MAX_BUFFER_LEN)
+        self.assertEqual(record[12], bytes(range(target_index.MAX_BUFFER_LEN)))
+
+
+if __name__ == "__main__":
+    unittest.main()
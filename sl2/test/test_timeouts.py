@@ -0,0 +1,106 @@
+## @package test_timeouts
+# Unit tests for the adaptive fuzzing timeout (see sl2.harness.timeouts)
+import json
+import os
+import tempfile
+import unittest
+from unittest import mock
+
+from sl2.harness import timeouts
+from sl2.harness.timeouts import RunTimes
+
+
+class TestTimeouts(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        patcher = mock.patch.object(timeouts, "_run_times", {})
+        patcher.start()
+        self.addCleanup(patcher.stop)
+
+    def tearDown(self):
+        self.dir.cleanup()
+
+    def run_times(self, times=()):
+        run_times = RunTimes(self.dir.name)
+        run_times.times.extend(times)
+        return run_times
+
+    ## Targets without enough runs yet get the whole ceiling
+    def test_too_few_samples(self):
+        self.assertEqual(self.run_times().timeout(30), 30)
+        self.assertEqual(self.run_times([0.1] * (timeouts.MIN_SAMPLES - 1)).timeout(30), 30)
+
+    ## The timeout is TIMEOUT_FACTOR times the 99th percentile, so the slowest percent of runs doesn't count
+    def test_percentile(self):
+        self.assertAlmostEqual(self.run_times([0.1] * 99 + [2.0]).timeout(60), 2.0 * timeouts.TIMEOUT_FACTOR)
+        self.assertAlmostEqual(self.run_times([0.5] * 199 + [50.0]).timeout(60), 0.5 * timeouts.TIMEOUT_FACTOR)
+
+    ## The timeout stays between TIMEOUT_FLOOR and the ceiling
+    def test_bounds(self):
+        self.assertEqual(self.run_times([0.001] * 100).timeout(60), timeouts.TIMEOUT_FLOOR)
+        self.assertEqual(self.run_times([100.0] * 100).timeout(60), 60)
+
+        # A ceiling under the floor still wins.
+        self.assertEqual(self.run_times([0.001] * 100).timeout(0.5), 0.5)
+
+    ## Only the last WINDOW_SIZE runs count, so a target that speeds up gets a shorter timeout
+    def test_window(self):
+        run_times = self.run_times()
+        with mock.patch.object(timeouts, "SAVE_INTERVAL", float("inf")):
+            for _ in range(timeouts.WINDOW_SIZE):
+                run_times.observe(10.0)
+            for _ in range(timeouts.WINDOW_SIZE):
+                run_times.observe(1.0)
+
+        self.assertEqual(len(run_times.times), timeouts.WINDOW_SIZE)
+        self.assertEqual(run_times.timeout(60), 1.0 * timeouts.TIMEOUT_FACTOR)
+
+    ## Run times are saved, and a target's next session picks up from them
+    def test_persist(self):
+        with mock.patch.object(timeouts, "SAVE_INTERVAL", 0):
+            run_times = self.run_times()
+            for _ in range(timeouts.MIN_SAMPLES):
+                run_times.observe(2.0)
+
+        self.assertEqual(RunTimes(self.dir.name).timeout(60), 2.0 * timeouts.TIMEOUT_FACTOR)
+        self.assertEqual([name for name in os.listdir(self.dir.name) if name.endswith(".tmp")], [])
+
+    ## Saved run times that can't be read are ignored
+    def test_corrupt(self):
+        for contents in ["not json", json.dumps({"times": 1}), json.dumps(["fast"])]:
+            with open(os.path.join(self.dir.name, timeouts.RUN_TIMES_FILE), "w") as times_file:
+                times_file.write(contents)
+
+            self.assertEqual(len(RunTimes(self.dir.name).times), 0)
+
+    ## Only the first SLOW_RUN_DIRS slow runs keep their directories, across sessions too, but every one is logged
+    def test_slow_runs(self):
+        with mock.patch.object(timeouts, "SLOW_RUN_DIRS", 2):
+            run_times = self.run_times()
+            kept = [run_times.slow_run("run{}".format(i), i, 5.0, 1.0) for i in range(3)]
+            self.assertEqual(kept, [True, True, False])
+            self.assertFalse(RunTimes(self.dir.name).slow_run("run3", 3, 5.0, 1.0))
+
+        with open(os.path.join(self.dir.name, timeouts.SLOW_RUNS_FILE), "r") as slow_file:
+            logged = [json.loads(line) for line in slow_file]
+
+        self.assertEqual([entry["run_id"] for entry in logged], ["run0", "run1", "run2", "run3"])
+        self.assertEqual(logged[0], {"run_id": "run0", "seed": 0, "elapsed": 5.0, "timeout": 1.0, "kept": True})
+
+    ## Without adaptive_timeout, the configured timeout (if any) is used as it is
+    def test_fuzz_timeout(self):
+        self.assertIsNone(timeouts.fuzz_timeout({}))
+        self.assertEqual(timeouts.fuzz_timeout({"fuzz_timeout": 7}), 7)
+
+        self.assertEqual(timeouts.ceiling({}), timeouts.TIMEOUT_CEILING)
+        self.assertEqual(timeouts.ceiling({"fuzz_timeout": 0}), timeouts.TIMEOUT_CEILING)
+        self.assertEqual(timeouts.ceiling({"fuzz_timeout": 7}), 7)
+
+        with mock.patch.object(timeouts, "get_target_dir", return_value=self.dir.name):
+            config_dict = {"adaptive_timeout": True, "fuzz_timeout": 7}
+            self.assertEqual(timeouts.fuzz_timeout(config_dict), 7)
+            self.assertIs(timeouts.run_times(config_dict), timeouts.run_times(config_dict))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,208 @@
+## @package test_triage_queue
+# Unit tests for crash signatures, severity priors and triage ordering (see sl2.harness.triage_queue)
+import json
+import os
+import tempfile
+import threading
+import unittest
+from unittest import mock
+
+from sl2.harness import triage_queue
+from sl2.harness.triage_queue import TriageQueue
+
+## How long a test waits on a triage worker before giving up, in seconds
+WAIT = 10
+
+
+class TestCrashSignature(unittest.TestCase):
+    ## Crashes that the fuzzer couldn't place have no signature
+    def test_unplaced(self):
+        self.assertIsNone(triage_queue.crash_signature({"exception": "EXCEPTION_ACCESS_VIOLATION"}))
+        self.assertIsNone(triage_queue.crash_signature({"exception": "EXCEPTION_ACCESS_VIOLATION", "module": "a.dll"}))
+
+    ## Module names are case-insensitive, and the stack hash is optional
+    def test_signature(self):
+        event = {"exception": "EXCEPTION_ACCESS_VIOLATION", "module": "Target.EXE", "offset": 0x1a2b, "stack": "beef"}
+
+        self.assertEqual(triage_queue.crash_signature(event), "EXCEPTION_ACCESS_VIOLATION|target.exe+1a2b|beef")
+        self.assertEqual(triage_queue.crash_signature(event, stack=False), "EXCEPTION_ACCESS_VIOLATION|target.exe+1a2b")
+        self.assertEqual(
+            triage_queue.crash_signature(dict(event, stack="")), "EXCEPTION_ACCESS_VIOLATION|target.exe+1a2b"
+        )
+
+    ## A signature's site drops the stack hash, if it has one
+    def test_site(self):
+        self.assertEqual(triage_queue.signature_site("E|m+1|beef"), "E|m+1")
+        self.assertEqual(triage_queue.signature_site("E|m+1"), "E|m+1")
+
+
+class TestCrashSeverity(unittest.TestCase):
+    def av(self, **kwargs):
+        return triage_queue.crash_severity(dict(exception="EXCEPTION_ACCESS_VIOLATION", **kwargs))
+
+    ## Execution faults (or faults at the PC) beat writes, which beat reads
+    def test_access_violations(self):
+        self.assertEqual(self.av(access="execute", fault_address=0), triage_queue.SEVERITY_PC)
+        self.assertEqual(self.av(access="read", fault_at_pc=True), triage_queue.SEVERITY_PC)
+        self.assertEqual(self.av(access="write", fault_address=0x41414141), triage_queue.SEVERITY_WRITE)
+        self.assertEqual(self.av(access="write", fault_address=8), triage_queue.SEVERITY_NEAR_NULL_WRITE)
+        self.assertEqual(self.av(access="read", fault_address=0x41414141), triage_queue.SEVERITY_READ)
+        self.assertEqual(self.av(access="read", fault_address=8), triage_queue.SEVERITY_NEAR_NULL_READ)
+
+    ## NEAR_NULL_LIMIT itself is the first wild address, and a missing fault address counts as null
+    def test_near_null_limit(self):
+        limit = triage_queue.NEAR_NULL_LIMIT
+        self.assertEqual(self.av(access="write", fault_address=limit - 1), triage_queue.SEVERITY_NEAR_NULL_WRITE)
+        self.assertEqual(self.av(access="write", fault_address=limit), triage_queue.SEVERITY_WRITE)
+        self.assertEqual(self.av(access="read"), triage_queue.SEVERITY_NEAR_NULL_READ)
+
+    ## Other exceptions (and access violations without an access) fall back to the exception table
+    def test_other_exceptions(self):
+        self.assertEqual(
+            triage_queue.crash_severity({"exception": "STATUS_HEAP_CORRUPTION"}), triage_queue.SEVERITY_CORRUPTION
+        )
+        self.assertEqual(triage_queue.crash_severity({"exception": "EXCEPTION_INT_DIVIDE_BY_ZERO"}), 0)
+        self.assertEqual(triage_queue.crash_severity({}), triage_queue.SEVERITY_NONE)
+        self.assertEqual(self.av(), triage_queue.SEVERITY_NONE)
+
+
+class TestTriageQueue(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.runs_dir = os.path.join(self.dir.name, "runs")
+        os.makedirs(self.runs_dir)
+        patcher = mock.patch.object(triage_queue.config, "sl2_runs_dir", self.runs_dir)
+        patcher.start()
+        self.addCleanup(patcher.stop)
+
+        self.triaged = []
+        self.started = threading.Event()
+        self.gate = threading.Event()
+
+    def tearDown(self):
+        self.gate.set()
+        self.dir.cleanup()
+
+    ## Triages a crash, holding the worker on the first one until the gate opens
+    def triage(self, run_id):
+        self.triaged.append(run_id)
+        self.started.set()
+        self.assertTrue(self.gate.wait(WAIT))
+        return {"run_id": run_id}
+
+    ## Starts a queue whose only worker is busy with a crash, so that everything submitted after it waits
+    def busy_queue(self, **kwargs):
+        queue = TriageQueue(self.dir.name, self.triage, **kwargs)
+        queue.submit("busy")
+        self.assertTrue(self.started.wait(WAIT))
+        return queue
+
+    ## Crashes at new sites go first, then the most severe, then the oldest
+    def test_priority(self):
+        queue = self.busy_queue()
+        queue.submit("seen-site-a", "E|m+1|a", severity=triage_queue.SEVERITY_PC)
+        queue.submit("seen-site-b", "E|m+1|b", severity=triage_queue.SEVERITY_PC)
+        queue.submit("new-read", "E|m+2", severity=triage_queue.SEVERITY_READ)
+        queue.submit("new-write", "E|m+3", severity=triage_queue.SEVERITY_WRITE)
+        queue.submit("new-write-later", "E|m+4", severity=triage_queue.SEVERITY_WRITE)
+        queue.submit("unsigned", severity=triage_queue.SEVERITY_PC)
+
+        self.gate.set()
+        queue.close()
+
+        # The first crash at m+1 was new when it was queued; its second caller wasn't. Crashes without a
+        # signature are never new.
+        self.assertEqual(
+            self.triaged,
+            ["busy", "seen-site-a", "new-write", "new-write-later", "new-read", "seen-site-b", "unsigned"],
+        )
+        self.assertEqual(queue.outstanding(), 0)
+
+    ## Crashes with a signature that's already been queued aren't queued again, even across sessions
+    def test_dedup(self):
+        queue = TriageQueue(self.dir.name, self.triage)
+        self.gate.set()
+
+        self.assertTrue(queue.submit("first", "E|m+1"))
+        self.assertFalse(queue.submit("second", "E|m+1"))
+        self.assertTrue(queue.submit("third"))
+        self.assertTrue(queue.submit("fourth"))
+        queue.close()
+
+        self.assertEqual(sorted(self.triaged), ["first", "fourth", "third"])
+
+        queue = TriageQueue(self.dir.name, self.triage)
+        self.assertFalse(queue.submit("fifth", "E|m+1"))
+        queue.close()
+
+    ## Whatever was still queued is triaged by the next session, in priority order, unless its run is gone
+    def test_requeue(self):
+        for run_id in ["old", "severe", "novel"]:
+            os.makedirs(os.path.join(self.runs_dir, run_id))
+
+        with open(os.path.join(self.dir.name, triage_queue.TRIAGE_QUEUE_FILE), "w") as queue_file:
+            json.dump({
+                "version": triage_queue.TRIAGE_QUEUE_VERSION,
+                "pending": ["old", "gone", "severe", "novel"],
+                "seen": [],
+                "priority": {"severe": [False, triage_queue.SEVERITY_WRITE], "novel": [True, 0]},
+            }, queue_file)
+
+        self.gate.set()
+        queue = TriageQueue(self.dir.name, self.triage)
+        queue.close()
+
+        self.assertEqual(self.triaged, ["novel", "severe", "old"])
+
+    ## A queue saved by another version is ignored rather than misread
+    def test_requeue_version(self):
+        os.makedirs(os.path.join(self.runs_dir, "old"))
+        with open(os.path.join(self.dir.name, triage_queue.TRIAGE_QUEUE_FILE), "w") as queue_file:
+            json.dump({"version": triage_queue.TRIAGE_QUEUE_VERSION + 1, "pending": ["old"], "seen": []}, queue_file)
+
+        queue = TriageQueue(self.dir.name, self.triage)
+        queue.close()
+
+        self.assertEqual(self.triaged, [])
+
+    ## Batches take up to the batch size, and never swallow a worker's stop
+    def test_batches(self):
+        batches = []
+
+        def triage_batch(run_ids):
+            batches.append(run_ids)
+            return {run_id: run_id.upper() for run_id in run_ids}
+
+        findings = {}
+        queue = self.busy_queue(triage_batch=triage_batch, batch=3)
+        for run_id in "abcd":
+            queue.submit(run_id, on_triaged=findings.__setitem__)
+
+        self.gate.set()
+        queue.close()
+
+        # A batch of one goes through the single-crash triage.
+        self.assertEqual(batches, [["a", "b", "c"]])
+        self.assertEqual(self.triaged, ["busy", "d"])
+        self.assertEqual(findings, {"a": "A", "b": "B", "c": "C", "d": {"run_id": "d"}})
+
+    ## A triage that fails reports no findings, but still finishes its crash
+    def test_failure(self):
+        findings = {}
+        finished = []
+
+        def triage(run_id):
+            raise RuntimeError(run_id)
+
+        queue = TriageQueue(self.dir.name, triage, finished=finished.append)
+        with mock.patch("traceback.print_exc"):
+            queue.submit("broken", on_triaged=findings.__setitem__)
+            queue.close()
+
+        self.assertEqual(findings, {"broken": None})
+        self.assertEqual(finished, ["broken"])
+        self.assertEqual(queue.outstanding(), 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
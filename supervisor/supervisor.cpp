@@ -0,0 +1,524 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+#include <ShlObj.h>
+#include <PathCch.h>
+
+#define LOGURU_IMPLEMENTATION 1
+#include "vendor/loguru.hpp"
+#include "vendor/json.hpp"
+#include "common/sl2_affinity.hpp"
+
+using json = nlohmann::json;
+
+/*! Convenience macros for logging. */
+#define SL2_SUPERVISOR_LOG(level, fmt, ...) LOG_F(level, __FUNCTION__ ": " fmt, __VA_ARGS__)
+// See the note on SL2_SERVER_LOG_GLE in server.cpp.
+#define SL2_SUPERVISOR_LOG_GLE(level, fmt, ...)                                                    \
+  SL2_SUPERVISOR_LOG(level, "(GLE=%lu) " fmt, GetLastError(), __VA_ARGS__)
+#define SL2_SUPERVISOR_LOG_INFO(fmt, ...) SL2_SUPERVISOR_LOG(INFO, fmt, __VA_ARGS__)
+#define SL2_SUPERVISOR_LOG_WARN(fmt, ...) SL2_SUPERVISOR_LOG_GLE(WARNING, fmt, __VA_ARGS__)
+#define SL2_SUPERVISOR_LOG_ERROR(fmt, ...) SL2_SUPERVISOR_LOG_GLE(ERROR, fmt, __VA_ARGS__)
+#define SL2_SUPERVISOR_LOG_FATAL(fmt, ...) SL2_SUPERVISOR_LOG_GLE(FATAL, fmt, __VA_ARGS__)
+
+/*! How long a timed out run gets to exit after being asked to close, before it's killed. This
+ * matches the harness's second wait in run_dr. */
+#define SL2_SUPERVISOR_GRACE_MS 5000
+
+/*! Exit code reported for runs that couldn't be started at all. */
+#define SL2_SUPERVISOR_SPAWN_FAILED 0xFFFFFFFF
+
+/*! A single run, as submitted by the harness on stdin. */
+struct sl2_supervisor_job {
+  /*! The run's ID, echoed back in its result. */
+  std::string id;
+  /*! The full drrun command line, as an argv. */
+  std::vector<std::string> cmd;
+  /*! Where the run's stdout and stderr go, or empty to discard them. */
+  std::string stdout_path;
+  std::string stderr_path;
+  /*! How long the run may take, in milliseconds, or INFINITE. */
+  DWORD timeout_ms;
+  /*! How much user-mode CPU time the run's processes may use between them, in seconds, or 0. */
+  double cpu_time;
+  /*! How much memory the run's processes may commit between them, in megabytes, or 0. */
+  size_t memory_mb;
+};
+
+/*! A worker slot: a core that it owns, and the runs that it spawns there one at a time. */
+struct sl2_supervisor_slot {
+  int index;
+  /*! The slot's core: its processor group, and its number within the group */
+  WORD group;
+  int core;
+};
+
+static wchar_t SUPERVISOR_LOG[MAX_PATH] = L"";
+
+/*! Guards jobs and jobs_done. */
+static std::mutex jobs_mutex;
+/*! Signalled whenever a job is queued, or stdin runs out. */
+static std::condition_variable jobs_cv;
+/*! The runs that the harness has submitted, and that no slot has picked up yet. */
+static std::deque<sl2_supervisor_job> jobs;
+/*! Whether stdin has run out, i.e. the harness won't submit any more runs. */
+static bool jobs_done = false;
+
+/*! Guards stdout, which every slot writes its results to. */
+static std::mutex results_mutex;
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-w <workers>] [-numa <node>]\n", argv0);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Runs each job read from stdin (one JSON object per line, until EOF) on one of\n");
+  fprintf(stderr, "<workers> slots (default: one per free core), each pinned to its own core.\n");
+  fprintf(stderr, "With -numa, the slots' cores all come from that NUMA node.\n");
+  fprintf(stderr, "Jobs look like {\"id\": ..., \"cmd\": [...], \"stdout\": ..., \"stderr\": ...,\n");
+  fprintf(stderr, "\"timeout\": <seconds>, \"cpu_time\": <seconds>, \"memory\": <MB>}, where\n");
+  fprintf(stderr, "the limits are optional. Each result goes to stdout as a line of JSON.\n");
+}
+
+static void init_logging_path() {
+  wchar_t *roaming_path;
+  SHGetKnownFolderPath(FOLDERID_RoamingAppData, NULL, NULL, &roaming_path);
+
+  if (PathCchCombine(SUPERVISOR_LOG, MAX_PATH, roaming_path,
+                     L"Trail of Bits\\sl2\\log\\supervisor.log") != S_OK) {
+    SL2_SUPERVISOR_LOG_FATAL("failed to combine logfile path");
+  }
+
+  CoTaskMemFree(roaming_path);
+}
+
+/**
+ * Converts a UTF-8 string (as the harness sends them) into a wide one.
+ * @param str the UTF-8 string
+ * @return the wide string
+ */
+static std::wstring widen(const std::string &str) {
+  if (str.empty()) {
+    return L"";
+  }
+
+  int len = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), NULL, 0);
+  std::wstring wide(len, L'\0');
+  MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), &wide[0], len);
+  return wide;
+}
+
+/**
+ * Quotes a single argument so that CommandLineToArgvW (and the CRT) parse it back out unchanged.
+ * @param arg the argument
+ * @param cmdline the command line to append it to
+ */
+static void append_quoted(const std::wstring &arg, std::wstring &cmdline) {
+  if (!cmdline.empty()) {
+    cmdline.push_back(L' ');
+  }
+
+  if (!arg.empty() && arg.find_first_of(L" \t\n\v\"") == std::wstring::npos) {
+    cmdline.append(arg);
+    return;
+  }
+
+  cmdline.push_back(L'"');
+
+  for (auto it = arg.begin();; ++it) {
+    size_t backslashes = 0;
+
+    while (it != arg.end() && *it == L'\\') {
+      ++it;
+      ++backslashes;
+    }
+
+    if (it == arg.end()) {
+      // Backslashes before the closing quote have to be escaped.
+      cmdline.append(backslashes * 2, L'\\');
+      break;
+    } else if (*it == L'"') {
+      cmdline.append(backslashes * 2 + 1, L'\\');
+      cmdline.push_back(*it);
+    } else {
+      cmdline.append(backslashes, L'\\');
+      cmdline.push_back(*it);
+    }
+  }
+
+  cmdline.push_back(L'"');
+}
+
+/**
+ * Picks the processors that slots get pinned to: every processor that we're allowed to run on
+ * (on the given NUMA node, if any), short of the ones that other processes are pinned to.
+ * @param node the NUMA node, or -1 for every node
+ * @return the processors, in order
+ */
+static std::vector<sl2_processor> usable_processors(int node) {
+  DWORD_PTR process_affinity, system_affinity;
+  std::vector<sl2_processor> processors, allowed;
+
+  if (!sl2_free_processors(node, processors) || processors.empty()) {
+    SL2_SUPERVISOR_LOG_FATAL("no processors on NUMA node %d", node);
+  }
+
+  // Our own affinity mask only covers our primary group, so it only narrows things
+  // down on hosts with a single group.
+  if (GetActiveProcessorGroupCount() > 1) {
+    return processors;
+  }
+
+  if (!GetProcessAffinityMask(GetCurrentProcess(), &process_affinity, &system_affinity)) {
+    SL2_SUPERVISOR_LOG_FATAL("couldn't get the supervisor's own affinity");
+  }
+
+  for (const sl2_processor &processor : processors) {
+    if ((process_affinity >> processor.number) & 1) {
+      allowed.push_back(processor);
+    }
+  }
+
+  return allowed.empty() ? processors : allowed;
+}
+
+/**
+ * Opens a file that a run's output gets redirected to, as an inheritable handle.
+ * @param path the file, or empty for NUL
+ * @return the handle, or INVALID_HANDLE_VALUE
+ */
+static HANDLE open_output(const std::string &path) {
+  SECURITY_ATTRIBUTES sa = {sizeof(sa), NULL, true};
+  std::wstring wpath = path.empty() ? L"NUL" : widen(path);
+
+  return CreateFileW(wpath.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa,
+                     CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+/**
+ * Asks every process of a timed out run to close, the way `taskkill /T` (without /F) does: by
+ * posting WM_CLOSE to their top-level windows. This gives the client's exit handlers a chance to
+ * run, which a hard kill doesn't.
+ * @param job the run's job object
+ */
+static void close_job_gently(HANDLE job) {
+  // Room for 1024 pids is plenty for a target and its children.
+  struct {
+    JOBOBJECT_BASIC_PROCESS_ID_LIST list;
+    ULONG_PTR more[1023];
+  } pids = {0};
+
+  if (!QueryInformationJobObject(job, JobObjectBasicProcessIdList, &pids, sizeof(pids), NULL)) {
+    SL2_SUPERVISOR_LOG_WARN("couldn't list the processes of a timed out run");
+    return;
+  }
+
+  for (DWORD i = 0; i < pids.list.NumberOfProcessIdsInList; ++i) {
+    DWORD pid = (DWORD)pids.list.ProcessIdList[i];
+
+    EnumWindows(
+        [](HWND window, LPARAM target) -> BOOL {
+          DWORD owner = 0;
+          GetWindowThreadProcessId(window, &owner);
+          if (owner == (DWORD)target) {
+            PostMessageW(window, WM_CLOSE, 0, 0);
+          }
+          return true;
+        },
+        (LPARAM)pid);
+  }
+}
+
+/**
+ * Spawns a single run on a slot's core, and waits for it to finish (or kills it once it's run out
+ * of time). Each run gets its own job object, which pins it (and every process it spawns, i.e. the
+ * target) to the core, and kills whatever is left of it once drrun exits.
+ * @param slot the slot to run on
+ * @param job the run
+ * @return the run's result
+ */
+static json run_job(const sl2_supervisor_slot &slot, const sl2_supervisor_job &job) {
+  json result = {
+      {"id", job.id},
+      {"slot", slot.index},
+      {"group", slot.group},
+      {"core", slot.core},
+      {"exit_code", SL2_SUPERVISOR_SPAWN_FAILED},
+      {"timed_out", false},
+      {"hung", false},
+      {"elapsed_ms", 0},
+  };
+
+  std::wstring cmdline;
+  for (const std::string &arg : job.cmd) {
+    append_quoted(widen(arg), cmdline);
+  }
+
+  HANDLE job_object = CreateJobObjectW(NULL, NULL);
+  if (!job_object) {
+    SL2_SUPERVISOR_LOG_ERROR("couldn't create a job object for run %s", job.id.c_str());
+    return result;
+  }
+
+  JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {0};
+  limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+
+  // A plain affinity limit only reaches the primary group; see below for the others.
+  bool grouped = GetActiveProcessorGroupCount() > 1;
+
+  if (!grouped) {
+    limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_AFFINITY;
+    limits.BasicLimitInformation.Affinity = (ULONG_PTR)1 << slot.core;
+  }
+
+  if (job.cpu_time > 0) {
+    limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_TIME;
+    // In 100ns ticks.
+    limits.BasicLimitInformation.PerJobUserTimeLimit.QuadPart = (LONGLONG)(job.cpu_time * 10000000);
+  }
+
+  if (job.memory_mb > 0) {
+    limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+    limits.JobMemoryLimit = job.memory_mb * 1024 * 1024;
+  }
+
+  if (!SetInformationJobObject(job_object, JobObjectExtendedLimitInformation, &limits,
+                               sizeof(limits)) ||
+      (grouped &&
+       !sl2_set_job_group_affinity(job_object, slot.group, (KAFFINITY)1 << slot.core))) {
+    SL2_SUPERVISOR_LOG_WARN("couldn't pin (or limit) run %s to core %d", job.id.c_str(), slot.core);
+  }
+
+  SECURITY_ATTRIBUTES sa = {sizeof(sa), NULL, true};
+  HANDLE std_in = CreateFileW(L"NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  HANDLE std_out = open_output(job.stdout_path);
+  HANDLE std_err = open_output(job.stderr_path);
+
+  // Only the run's own handles are inherited, so that runs spawned concurrently by the
+  // other slots don't pick up (and hold open) each other's output files, or our stdin.
+  HANDLE inherited[] = {std_in, std_out, std_err};
+  SIZE_T attributes_size = 0;
+  InitializeProcThreadAttributeList(NULL, 1, 0, &attributes_size);
+  std::vector<uint8_t> attributes_buf(attributes_size);
+  LPPROC_THREAD_ATTRIBUTE_LIST attributes = (LPPROC_THREAD_ATTRIBUTE_LIST)attributes_buf.data();
+
+  STARTUPINFOEXW startup = {0};
+  PROCESS_INFORMATION process = {0};
+  bool spawned = false;
+
+  if (std_in != INVALID_HANDLE_VALUE && std_out != INVALID_HANDLE_VALUE &&
+      std_err != INVALID_HANDLE_VALUE &&
+      InitializeProcThreadAttributeList(attributes, 1, 0, &attributes_size)) {
+    UpdateProcThreadAttribute(attributes, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherited,
+                              sizeof(inherited), NULL, NULL);
+
+    startup.StartupInfo.cb = sizeof(startup);
+    startup.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+    startup.StartupInfo.hStdInput = std_in;
+    startup.StartupInfo.hStdOutput = std_out;
+    startup.StartupInfo.hStdError = std_err;
+    startup.lpAttributeList = attributes;
+
+    // The run starts suspended, so that it's pinned before it runs a single instruction.
+    spawned = CreateProcessW(NULL, &cmdline[0], NULL, NULL, true,
+                             CREATE_SUSPENDED | EXTENDED_STARTUPINFO_PRESENT, NULL, NULL,
+                             &startup.StartupInfo, &process);
+
+    DeleteProcThreadAttributeList(attributes);
+  }
+
+  for (HANDLE handle : inherited) {
+    if (handle != INVALID_HANDLE_VALUE) {
+      CloseHandle(handle);
+    }
+  }
+
+  if (!spawned) {
+    SL2_SUPERVISOR_LOG_ERROR("couldn't spawn run %s", job.id.c_str());
+    CloseHandle(job_object);
+    return result;
+  }
+
+  auto started = std::chrono::steady_clock::now();
+
+  if (!AssignProcessToJobObject(job_object, process.hProcess)) {
+    SL2_SUPERVISOR_LOG_WARN("couldn't assign run %s to its job, so it isn't pinned",
+                            job.id.c_str());
+  }
+
+  ResumeThread(process.hThread);
+  CloseHandle(process.hThread);
+
+  if (WaitForSingleObject(process.hProcess, job.timeout_ms) == WAIT_TIMEOUT) {
+    result["timed_out"] = true;
+    close_job_gently(job_object);
+
+    if (WaitForSingleObject(process.hProcess, SL2_SUPERVISOR_GRACE_MS) == WAIT_TIMEOUT) {
+      SL2_SUPERVISOR_LOG_INFO("run %s hung, killing it", job.id.c_str());
+      result["hung"] = true;
+      TerminateJobObject(job_object, SL2_SUPERVISOR_SPAWN_FAILED);
+      WaitForSingleObject(process.hProcess, INFINITE);
+    }
+  }
+
+  DWORD exit_code = SL2_SUPERVISOR_SPAWN_FAILED;
+  GetExitCodeProcess(process.hProcess, &exit_code);
+  result["exit_code"] = exit_code;
+
+  // The kernel kills the whole job once it runs out of CPU time, which is as good as a timeout.
+  if (job.cpu_time > 0 && exit_code == ERROR_NOT_ENOUGH_QUOTA) {
+    result["timed_out"] = true;
+  }
+  result["elapsed_ms"] = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() - started)
+                             .count();
+
+  CloseHandle(process.hProcess);
+  // Closing the job kills anything that the run left behind.
+  CloseHandle(job_object);
+
+  return result;
+}
+
+/**
+ * A slot's thread. Takes runs off of the queue until there are none left (and the harness won't
+ * submit any more), and writes out each one's result as soon as it's done.
+ * @param slot the slot
+ */
+static void slot_thread(sl2_supervisor_slot slot) {
+  for (;;) {
+    sl2_supervisor_job job;
+
+    {
+      std::unique_lock<std::mutex> lock(jobs_mutex);
+      jobs_cv.wait(lock, [] { return !jobs.empty() || jobs_done; });
+
+      if (jobs.empty()) {
+        return;
+      }
+
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+
+    json result = run_job(slot, job);
+
+    std::lock_guard<std::mutex> lock(results_mutex);
+    std::cout << result << std::endl;
+  }
+}
+
+/**
+ * Parses a job submitted by the harness.
+ * @param line the job, as a line of JSON
+ * @param job receives the job
+ * @return whether the line was a valid job
+ */
+static bool parse_job(const std::string &line, sl2_supervisor_job &job) {
+  try {
+    json obj = json::parse(line);
+
+    job.id = obj.at("id").get<std::string>();
+    job.cmd = obj.at("cmd").get<std::vector<std::string>>();
+    job.stdout_path = obj.value("stdout", "");
+    job.stderr_path = obj.value("stderr", "");
+    job.timeout_ms = INFINITE;
+
+    if (obj.count("timeout") && obj["timeout"].is_number()) {
+      job.timeout_ms = (DWORD)(obj["timeout"].get<double>() * 1000);
+    }
+
+    job.cpu_time = obj.value("cpu_time", 0.0);
+    job.memory_mb = obj.value("memory", (size_t)0);
+  } catch (const std::exception &e) {
+    SL2_SUPERVISOR_LOG_ERROR("couldn't parse job: %s", e.what());
+    return false;
+  }
+
+  return !job.cmd.empty();
+}
+
+int main(int argc, char **argv) {
+  init_logging_path();
+  loguru::init(argc, argv);
+  char log_path_mbs[MAX_PATH + 1] = {0};
+  wcstombs_s(NULL, log_path_mbs, MAX_PATH, SUPERVISOR_LOG, MAX_PATH);
+  loguru::add_file(log_path_mbs, loguru::Append, loguru::Verbosity_MAX);
+
+  // Keep our own output for results; everything else goes to the log.
+  loguru::g_stderr_verbosity = loguru::Verbosity_WARNING;
+
+  int workers = 0;
+  int numa_node = -1;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+      workers = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-numa") && i + 1 < argc) {
+      numa_node = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<sl2_processor> cores = usable_processors(numa_node);
+
+  if (workers <= 0) {
+    workers = (int)cores.size();
+  }
+
+  if (workers > (int)cores.size()) {
+    SL2_SUPERVISOR_LOG_WARN("%d workers but only %zu free cores, some slots will share a core",
+                            workers, cores.size());
+  }
+
+  std::vector<std::thread> slots;
+  for (int i = 0; i < workers; ++i) {
+    const sl2_processor &core = cores[i % cores.size()];
+    sl2_supervisor_slot slot = {i, core.group, core.number};
+    SL2_SUPERVISOR_LOG_INFO("slot %d pinned to core %d in group %u", slot.index, slot.core,
+                            slot.group);
+    slots.emplace_back(slot_thread, slot);
+  }
+
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    sl2_supervisor_job job;
+    if (line.empty() || !parse_job(line, job)) {
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    jobs.push_back(std::move(job));
+    jobs_cv.notify_one();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    jobs_done = true;
+  }
+  jobs_cv.notify_all();
+
+  for (std::thread &slot : slots) {
+    slot.join();
+  }
+
+  return 0;
+}
@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <climits>
 #include <map>
 #include <set>
+#include <vector>
+
+#include <intrin.h>
 
 #include "vendor/picosha2.h"
 
@@ -12,8 +17,13 @@ extern "C" {
 #include "common/sl2_server_api.hpp"
 #include "common/sl2_dr_client.hpp"
 #include "common/sl2_dr_client_options.hpp"
+#include "common/sl2_crash_record.hpp"
+#include "common/sl2_fkt.hpp"
+#include "common/sl2_taint_labels.hpp"
+#include "common/sl2_taint_map.hpp"
 
 #include "dr_ir_instr.h"
+#include "drutil.h"
 
 static SL2Client client;
 static sl2_conn sl2_conn;
@@ -25,17 +35,160 @@ static bool no_mutate = false;
 static bool crashed = false;
 static uint32_t mutate_count = 0;
 
-/*! Set that tracks over time which registers have become tainted */
-static std::set<reg_id_t, std::less<reg_id_t>, sl2_dr_allocator<reg_id_t>> tainted_regs;
-/*! Set that tracks over time which memory addresses have become tainted */
-static std::set<app_pc, std::less<app_pc>, sl2_dr_allocator<app_pc>> tainted_mems;
+/*! The number of 64-bit words in a register taint mask */
+#define SL2_REG_TAINT_WORDS ((DR_REG_LAST_ENUM / 64) + 1)
+
+/*! The most arguments we'll snapshot and restore for a persistent target function */
+#define SL2_PERSIST_MAX_ARGS 8
+
+/**
+ * The registers that have become tainted on a single thread, as a bitmask indexed by full-width
+ * register (see reg_to_full_width64). DR_REG_NULL stands in for the program counter. Vector
+ * registers are tracked along with the general purpose ones, by their YMM names.
+ */
+struct sl2_reg_taint {
+  uint64_t bits[SL2_REG_TAINT_WORDS];
+};
+
+/*! The most calls out of the taint scope that a thread can be inside of at once */
+#define SL2_TAINT_SUMMARY_DEPTH 16
+
+/*! A call out of the taint scope (see op_taint_scope) that hasn't returned yet */
+struct sl2_taint_summary {
+  /*! Where the call returns to */
+  app_pc ret_pc;
+  /*! Whether the call's return value is tainted */
+  bool ret_tainted;
+  /*! The label of the call's return value, in label mode */
+  uint32_t ret_label;
+};
+
+/*! The most modules that we keep per-module instruction counts for */
+#define SL2_STATS_MODULES 64
+
+/*! The per-module count for instructions outside of every module in stats_modules */
+#define SL2_STATS_OTHER_MODULE SL2_STATS_MODULES
+
+/**
+ * Cheap counters that explain where a replay spent its time. Each thread keeps its own, which are
+ * folded into tracer_stats when it exits, and reported by on_dr_exit.
+ */
+struct sl2_tracer_stats {
+  /*! The number of propagate_taint clean calls executed */
+  uint64_t clean_calls;
+  /*! The number of those that had taint to propagate */
+  uint64_t propagated;
+  /*! The time spent in propagate_taint, in TSC ticks */
+  uint64_t propagation_ticks;
+  /*! The most bytes of memory that were tainted at once */
+  uint64_t peak_tainted_bytes;
+  /*! The most registers that the thread had tainted at once */
+  uint64_t peak_tainted_regs;
+  /*! The number of clean calls executed for each module in stats_modules */
+  uint64_t module_insns[SL2_STATS_MODULES + 1];
+};
+
+/*! The taint state of a single thread */
+struct sl2_thread_taint {
+  /*! The thread's tainted registers */
+  sl2_reg_taint regs;
+  /*! The thread's overhead counters */
+  sl2_tracer_stats stats;
+  /*! The label of each (full-width) tainted register, in label mode */
+  uint32_t reg_labels[DR_REG_LAST_ENUM + 1];
+  /*! Whether the thread is counted in taint_holders */
+  bool holds_taint;
+  /*! The replay that the thread's taint is from (see replay_epoch) */
+  uint32_t epoch;
+  /*! The number of calls in `summaries` */
+  int summary_depth;
+  /*! The calls out of the taint scope that the thread is inside of, innermost last */
+  sl2_taint_summary summaries[SL2_TAINT_SUMMARY_DEPTH];
+};
+
+/*! The drmgr TLS field holding each thread's sl2_thread_taint */
+static int thread_taint_tls_idx = -1;
+
+/*! A module that we keep instruction counts for */
+struct sl2_stats_module {
+  app_pc start;
+  app_pc end;
+  char name[64];
+};
+
+/*! The modules that we keep instruction counts for, in load order. Guarded by stats_lock */
+static sl2_stats_module stats_modules[SL2_STATS_MODULES];
+static int stats_module_count = 0;
+/*! The counters of every thread that has exited so far. Guarded by stats_lock */
+static sl2_tracer_stats tracer_stats = {0};
+/*! The number of instructions that we've built taint descriptors for (see get_taint_insn) */
+static uint64_t decoded_insns = 0;
+static void *stats_lock;
+/*! When the tracer started, for converting propagation_ticks into time */
+static uint64_t start_ticks = 0;
+static uint64_t start_ms = 0;
+/*! Shadow memory that tracks over time which memory addresses have become tainted */
+static sl2_taint_map tainted_mems;
+
+/*! Whether we're tracking which input bytes each tainted byte and register came from */
+static bool labels_on = false;
+/*! The labels that combine input bytes, in label mode */
+static sl2_label_table taint_labels;
+/*! The label of every tainted byte of memory, in label mode */
+static sl2_label_shadow mem_labels;
+
+/*! A buffer filled by a targeted read, whose bytes are labelled in label mode */
+struct sl2_label_buffer {
+  Function function;
+  size_t size;
+  size_t position;
+};
+
+/*! The labelled buffers, in the order that they were read */
+static sl2_label_buffer label_buffers[SL2_LABEL_MAX_BUFFERS];
+static volatile int label_buffer_count = 0;
+
+/*! Whether taint is live: introduced, and not yet died out (see check_taint_liveness). While it
+ * isn't, blocks only check this before each instruction instead of calling propagate_taint (see
+ * on_bb_instrument). */
+static volatile uint8_t taint_live = 0;
+
+/*! The number of threads with tainted registers, or inside of a summarized call. Along with
+ * tainted_mems, it tells when taint has died out (see check_taint_liveness). */
+static volatile int taint_holders = 0;
+/*! The number of instructions in a row, across every thread, that haven't changed any taint.
+ * Updated without a lock, so it's only an estimate; that's fine for a budget. */
+static volatile uint64_t quiet_insns = 0;
+/*! How many quiet instructions switch taint propagation off (see op_taint_idle), or 0 */
+static uint64_t taint_idle_budget = 0;
+/*! The number of times that taint propagation was switched off */
+static uint64_t taint_idles = 0;
+/*! Serializes switching taint propagation on and off */
+static void *taint_live_lock;
 
 #define LAST_COUNT 5 // WARNING: If you change this, you need to update the database schema
 
-static int last_call_idx = 0;
-static int last_insn_idx = 0;
-static app_pc last_calls[LAST_COUNT] = {0};
-static app_pc last_insns[LAST_COUNT] = {0};
+/*! The number of entries in each of a thread's history rings. The ring positions are bytes, so
+ * that the inline code that advances them can let them wrap instead of masking them. */
+#define SL2_HISTORY_LEN 256
+
+/**
+ * A thread's recent history within the target executable, written by inline instrumentation
+ * (see on_bb_history) and only made sense of when the thread crashes (see history_insns).
+ */
+struct sl2_history {
+  /*! The position in `blocks` of the next entry */
+  uint8_t block_pos;
+  /*! The position in `calls` of the next entry */
+  uint8_t call_pos;
+  /*! The first instruction of each recently executed block */
+  app_pc blocks[SL2_HISTORY_LEN];
+  /*! The memory-operand addresses of recent indirect calls through memory */
+  app_pc calls[SL2_HISTORY_LEN];
+};
+
+/*! The drmgr TLS field holding each thread's sl2_history */
+static int history_tls_idx = -1;
 
 /*! memory map information for target module */
 static app_pc module_start = 0;
@@ -48,6 +201,32 @@ static size_t baseAddr;
 static droption_t<unsigned int> op_no_taint(DROPTION_SCOPE_CLIENT, "nt", 0, "no-taint",
                                             "Do not do instruction level instrumentation.");
 
+/** Limits instruction-level taint propagation to some modules, summarizing calls into the rest */
+static droption_t<std::string> op_taint_scope(
+    DROPTION_SCOPE_CLIENT, "taint_scope", "all", "taint-scope",
+    "Where to propagate taint instruction by instruction: 'all', 'main' (just the target "
+    "executable), or a comma-separated list of modules to trace along with the target executable. "
+    "Calls out of the scope are summarized instead of traced.");
+
+/** Tracks which input bytes reach each tainted byte and register */
+static droption_t<bool> op_labels(DROPTION_SCOPE_CLIENT, "labels", false, "labels",
+                                  "Track which input offsets each tainted value came from, and "
+                                  "report the offsets that reach the crash.");
+
+/** How long taint can go unchanged before propagation is switched off until the next read */
+static droption_t<unsigned int> op_taint_idle(
+    DROPTION_SCOPE_CLIENT, "taint_idle", 0, "taint idle budget",
+    "Switch taint propagation off once this many instructions in a row (across every thread) "
+    "haven't changed any taint, until the next targeted read. Taint that's left in memory isn't "
+    "propagated in the meantime. Without it, propagation is only switched off once all of the "
+    "taint is gone.");
+
+/** How much history to report beyond last_insns and last_calls */
+static droption_t<unsigned int> op_history(
+    DROPTION_SCOPE_CLIENT, "history", 0, "history",
+    "Report this many recent instructions and calls (up to 256) under \"history\" in the crash "
+    "JSON, in addition to last_insns and last_calls.");
+
 /** Used when replaying a run from the server */
 static droption_t<std::string> op_replay(DROPTION_SCOPE_CLIENT, "r", "", "replay",
                                          "The run id for a crash to replay.");
@@ -58,6 +237,102 @@ static droption_t<std::string> op_replay(DROPTION_SCOPE_CLIENT, "r", "", "replay
 static droption_t<bool> op_no_mutate(DROPTION_SCOPE_CLIENT, "nm", false, "no-mutate",
                                      "Don't use the mutated buffer when replaying.");
 
+/** Where to replay the run's mutations from, instead of asking the server for each of them */
+static droption_t<std::string> op_run_dir(
+    DROPTION_SCOPE_CLIENT, "run_dir", "", "run directory",
+    "Replay mutations straight from the FKT files (or journal) in this run directory. Mutations "
+    "that aren't found there are still requested from the server.");
+
+/** More crashes to replay in the same process, one after another */
+static droption_t<std::string> op_runs(
+    DROPTION_SCOPE_CLIENT, "runs", "", "more run ids",
+    "A file of more run ids (one per line) to replay after -r in the same process, by looping the "
+    "persistent target from -persist_module. Each of them is replayed from the directory next to "
+    "-run_dir that's named after it. A crash that the loop can't recover from ends the process, "
+    "and the runs after it aren't replayed.");
+
+static droption_t<std::string> op_persist_module(
+    DROPTION_SCOPE_CLIENT, "persist_module", "", "module containing the persistent target",
+    "loop the function at -persist_offset in this module to replay the runs from -runs");
+
+static droption_t<std::string> op_persist_offset(DROPTION_SCOPE_CLIENT, "persist_offset", "0",
+                                                 "offset of the persistent target",
+                                                 "offset (from the module base) of the function "
+                                                 "to loop in persistent mode");
+
+static droption_t<unsigned int> op_persist_nargs(DROPTION_SCOPE_CLIENT, "persist_nargs", 4,
+                                                 "persistent target arguments",
+                                                 "how many arguments the persistent target takes");
+
+/** How much of the target's memory goes into a crash's minidump */
+static droption_t<std::string> op_dump(
+    DROPTION_SCOPE_CLIENT, "dump", "tainted", "dump policy",
+    "How much memory to write into crash minidumps: 'normal' (thread stacks and the module list), "
+    "'referenced' (normal, plus the memory that the stacks point to and the memory around the "
+    "crashing thread's registers), 'tainted' (referenced, plus all tainted memory) or 'full' (the "
+    "whole address space).");
+
+/*! The crash minidump policies that op_dump can select */
+enum sl2_dump_policy {
+  SL2_DUMP_NORMAL,
+  SL2_DUMP_REFERENCED,
+  SL2_DUMP_TAINTED,
+  SL2_DUMP_FULL,
+};
+
+static sl2_dump_policy dump_policy = SL2_DUMP_TAINTED;
+
+/*! How much memory on either side of each of the crashing thread's registers goes into the dump */
+#define SL2_DUMP_REG_WINDOW 0x100
+
+/*! A range of memory to add to the crash's minidump */
+struct sl2_dump_region {
+  uint64_t base;
+  ULONG size;
+};
+
+/*! The ranges that dump_memory_callback adds to the minidump, and the next one to add */
+static std::vector<sl2_dump_region> dump_regions;
+static size_t dump_region_next = 0;
+
+/*! The run's mutation journal, mapped the first time a mutation isn't found in its own FKT file */
+static uint8_t *journal_view = NULL;
+static size_t journal_view_size = 0;
+static size_t journal_size = 0;
+static bool journal_mapped = false;
+
+/*! The directory that the current run's mutations are replayed from (see op_run_dir) */
+static std::string replay_run_dir;
+
+/*! State for replaying several runs in one process, by looping the persistent target (see
+ * op_runs) */
+struct sl2_replay_batch {
+  /*! The runs to replay after the first, in order, and the next of them */
+  std::vector<std::string> run_ids;
+  size_t next;
+  /*! The thread that looped the target, and whether it's inside of it */
+  thread_id_t thread_id;
+  bool entered;
+  bool in_target;
+  /*! Whether the target's current entry is one that we redirected to */
+  bool redirected;
+  /*! The target, and the stack pointer and return address on its first entry */
+  app_pc func_pc;
+  reg_t xsp;
+  app_pc ret_addr;
+  /*! The target's arguments on its first entry, restored for each run */
+  void *args[SL2_PERSIST_MAX_ARGS];
+  /*! The call counts at the target's first entry, so that targeting stays consistent */
+  sl2_call_counts call_counts;
+  sl2_retaddr_counts ret_addr_counts;
+};
+
+static sl2_replay_batch batch;
+
+/*! Bumped for each run of a batch, so that every thread drops the taint that it had from the last
+ * one the next time it looks at it (see thread_taint) */
+static volatile uint32_t replay_epoch = 0;
+
 /** Currently unused as this runs on 64 bit applications */
 static reg_id_t reg_to_full_width32(reg_id_t reg) {
   switch (reg) {
@@ -90,8 +365,17 @@ static reg_id_t reg_to_full_width32(reg_id_t reg) {
   }
 }
 
-/** Converts a register to full width for taint tracking */
+/**
+ * Converts a register to full width for taint tracking. XMM registers are the low halves of the
+ * YMM registers, so both are tracked as the YMM register.
+ * Like a write to AL untaints all of RAX, a write to an XMM register untaints (or
+ * taints) all of its YMM register, even for the SSE instructions that leave the top half alone.
+ */
 static reg_id_t reg_to_full_width64(reg_id_t reg) {
+  if (reg >= DR_REG_START_XMM && reg <= DR_REG_STOP_XMM) {
+    return (reg_id_t)(DR_REG_START_YMM + (reg - DR_REG_START_XMM));
+  }
+
   switch (reg) {
   case DR_REG_EAX:
   case DR_REG_AX:
@@ -162,14 +446,85 @@ static reg_id_t reg_to_full_width64(reg_id_t reg) {
   }
 }
 
+/**
+ * @param drcontext the thread's DR context
+ * @return the thread's taint state
+ */
+static sl2_thread_taint *thread_taint(void *drcontext) {
+  sl2_thread_taint *state =
+      (sl2_thread_taint *)drmgr_get_tls_field(drcontext, thread_taint_tls_idx);
+
+  // Threads normally get theirs in on_thread_init, but be safe about early callbacks.
+  if (!state) {
+    state = (sl2_thread_taint *)sl2_thread_alloc(drcontext, sizeof(sl2_thread_taint));
+    memset(state, 0, sizeof(sl2_thread_taint));
+    state->epoch = replay_epoch;
+    drmgr_set_tls_field(drcontext, thread_taint_tls_idx, state);
+  }
+
+  // The thread's counters are kept; its taint belongs to the last run of the batch.
+  if (state->epoch != replay_epoch) {
+    memset(&state->regs, 0, sizeof(state->regs));
+    memset(state->reg_labels, 0, sizeof(state->reg_labels));
+    state->holds_taint = false;
+    state->summary_depth = 0;
+    state->epoch = replay_epoch;
+  }
+
+  return state;
+}
+
+/**
+ * @param drcontext the thread's DR context
+ * @return the thread's register taint
+ */
+static sl2_reg_taint *thread_reg_taint(void *drcontext) {
+  return &thread_taint(drcontext)->regs;
+}
+
+/** Check whether a (full-width) register is set in a register taint mask */
+static inline bool reg_mask_test(const sl2_reg_taint *regs, reg_id_t reg) {
+  return (regs->bits[reg / 64] >> (reg % 64)) & 1;
+}
+
+/** Set a (full-width) register in a register taint mask */
+static inline void reg_mask_set(sl2_reg_taint *regs, reg_id_t reg) {
+  regs->bits[reg / 64] |= (uint64_t)1 << (reg % 64);
+}
+
+/** Clear a (full-width) register in a register taint mask. Returns whether it was set. */
+static inline bool reg_mask_clear(sl2_reg_taint *regs, reg_id_t reg) {
+  uint64_t bit = (uint64_t)1 << (reg % 64);
+  bool tainted = (regs->bits[reg / 64] & bit) != 0;
+
+  regs->bits[reg / 64] &= ~bit;
+  return tainted;
+}
+
+/** Check whether any register is set in a register taint mask */
+static inline bool reg_mask_any(const sl2_reg_taint *regs) {
+  for (size_t i = 0; i < SL2_REG_TAINT_WORDS; i++) {
+    if (regs->bits[i]) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/** Check whether a (full-width) register is tainted on the current thread */
+static bool reg_is_tainted(void *drcontext, reg_id_t reg) {
+  return reg_mask_test(thread_reg_taint(drcontext), reg);
+}
+
 /** Check whether and operand is tainted */
 static bool is_tainted(void *drcontext, opnd_t opnd) {
   if (opnd_is_reg(opnd)) {
-    /** Check if a register is in tainted_regs */
+    /** Check if a register is tainted */
     reg_id_t reg = opnd_get_reg(opnd);
     reg = reg_to_full_width64(reg);
 
-    if (tainted_regs.find(reg) != tainted_regs.end()) {
+    if (reg_is_tainted(drcontext, reg)) {
       return true;
     }
   } else if (opnd_is_memory_reference(opnd)) {
@@ -180,10 +535,8 @@ static bool is_tainted(void *drcontext, opnd_t opnd) {
     /* Check if a memory region overlaps a tainted address */
     opnd_size_t dr_size = opnd_get_size(opnd);
     uint size = opnd_size_in_bytes(dr_size);
-    for (uint i = 0; i < size; i++) {
-      if (tainted_mems.find(addr + i) != tainted_mems.end()) {
-        return true;
-      }
+    if (tainted_mems.test(addr, size)) {
+      return true;
     }
 
     /* Check if a register used in calculating an address is tainted */
@@ -193,17 +546,17 @@ static bool is_tainted(void *drcontext, opnd_t opnd) {
       reg_id_t reg_indx = opnd_get_index(opnd);
 
       if (reg_base != NULL &&
-          tainted_regs.find(reg_to_full_width64(reg_base)) != tainted_regs.end()) {
+          reg_is_tainted(drcontext, reg_to_full_width64(reg_base))) {
         return true;
       }
 
       if (reg_disp != NULL &&
-          tainted_regs.find(reg_to_full_width64(reg_disp)) != tainted_regs.end()) {
+          reg_is_tainted(drcontext, reg_to_full_width64(reg_disp))) {
         return true;
       }
 
       if (reg_indx != NULL &&
-          tainted_regs.find(reg_to_full_width64(reg_indx)) != tainted_regs.end()) {
+          reg_is_tainted(drcontext, reg_to_full_width64(reg_indx))) {
         return true;
       }
     }
@@ -216,578 +569,2017 @@ static bool is_tainted(void *drcontext, opnd_t opnd) {
   return false;
 }
 
+/**
+ * Switches the tracer into full taint propagation, the first time that taint is introduced.
+ * Blocks built before now skip propagate_taint unless taint_live is set, so setting it is enough
+ * to be correct right away; flushing them gets them rebuilt without the check.
+ */
+static void go_taint_live() {
+  if (taint_live) {
+    return;
+  }
+
+  dr_mutex_lock(taint_live_lock);
+
+  if (!taint_live) {
+    SL2_DR_DEBUG("tracer#go_taint_live: taint introduced, rebuilding blocks with propagation\n");
+
+    quiet_insns = 0;
+    taint_live = 1;
+    dr_delay_flush_region(NULL, ~(size_t)0, 0, NULL);
+  }
+
+  dr_mutex_unlock(taint_live_lock);
+}
+
+/**
+ * Switches taint propagation back off once taint has died out: when nothing is tainted any more,
+ * or (with -taint_idle) when nothing has changed for long enough. Blocks are flushed so that
+ * they're rebuilt with the taint_live check back in front of each clean call, which leaves just
+ * the history instrumentation running until the next targeted read re-arms propagation (see
+ * taint_input).
+ */
+static void check_taint_liveness() {
+  if (!taint_live || ((!tainted_mems.empty() || taint_holders) &&
+                      (!taint_idle_budget || quiet_insns < taint_idle_budget))) {
+    return;
+  }
+
+  dr_mutex_lock(taint_live_lock);
+
+  // Checked again under the lock, since a targeted read may have re-armed in between.
+  if (taint_live && ((tainted_mems.empty() && !taint_holders) ||
+                     (taint_idle_budget && quiet_insns >= taint_idle_budget))) {
+    SL2_DR_DEBUG("tracer#check_taint_liveness: taint died out, rebuilding blocks without it\n");
+
+    taint_live = 0;
+    quiet_insns = 0;
+    taint_idles++;
+    dr_delay_flush_region(NULL, ~(size_t)0, 0, NULL);
+  }
+
+  dr_mutex_unlock(taint_live_lock);
+}
+
 /** Mark a memory address as tainted */
 static void taint_mem(app_pc addr, size_t size) {
-  for (size_t i = 0; i < size; i++) {
-    tainted_mems.insert(addr + i);
-  }
+  go_taint_live();
+  tainted_mems.set(addr, size);
+}
+
+/**
+ * Taints a targeted read's buffer. Unlike taint_mem (which propagation uses), this re-arms
+ * propagation under taint_live_lock, so that it can't be switched off before the buffer's taint
+ * is in place.
+ */
+static void taint_input(app_pc addr, size_t size) {
+  dr_mutex_lock(taint_live_lock);
+  tainted_mems.set(addr, size);
+  quiet_insns = 0;
+  dr_mutex_unlock(taint_live_lock);
+
+  go_taint_live();
 }
 
 /** Unmark a memory address as tainted */
 static bool untaint_mem(app_pc addr, uint size) {
-  bool untainted = false;
-  for (uint i = 0; i < size; i++) {
-    size_t n = tainted_mems.erase(addr + i);
-    if (n) {
-      untainted = true;
+  return tainted_mems.clear(addr, size);
+}
+
+/*! The ways in which an instruction can propagate taint */
+enum sl2_taint_kind {
+  /*! Tainted sources taint every destination, untainted sources untaint them */
+  SL2_TAINT_KIND_GENERIC,
+  /*! xor of a register with itself (including the vector xors), which untaints the destination
+   * since the result is inevitably 0 */
+  SL2_TAINT_KIND_XOR_SELF,
+  /*! xchg of two registers, which swaps their taint */
+  SL2_TAINT_KIND_XCHG,
+  /*! Branches, calls and returns, which taint or untaint PC (see SL2_TAINT_BRANCH_*) */
+  SL2_TAINT_KIND_BRANCH,
+  /*! A vector load whose register is stored right back to memory by the next instruction (see
+   * is_vector_copy), which copies the taint of the bytes themselves */
+  SL2_TAINT_KIND_VECTOR_COPY,
+  /*! rep movs, which copies the taint of every element that it moves at once */
+  SL2_TAINT_KIND_REP_MOVS,
+  /*! rep stos, which taints or untaints every element that it stores at once */
+  SL2_TAINT_KIND_REP_STOS,
+};
+
+/*! The branch is a return */
+#define SL2_TAINT_BRANCH_RET 0x1
+/*! The branch is direct (including direct calls) */
+#define SL2_TAINT_BRANCH_DIRECT 0x2
+/*! The branch is indirect (including indirect calls) */
+#define SL2_TAINT_BRANCH_INDIRECT 0x4
+/*! The branch is a call */
+#define SL2_TAINT_BRANCH_CALL 0x8
+
+/*! A register or memory operand, as needed to move taint through it */
+struct sl2_taint_opnd {
+  /*! Whether the operand is a memory reference (otherwise, it's a register) */
+  bool is_mem;
+  /*! The operand's full-width register, for register operands */
+  reg_id_t reg;
+  /*! The full-width base register of a base+disp memory reference, or DR_REG_NULL */
+  reg_id_t base;
+  /*! The full-width index register of a base+disp memory reference, or DR_REG_NULL */
+  reg_id_t index;
+  /*! The size of a memory reference, in bytes */
+  uint size;
+  /*! The memory reference itself, for computing its address when the instruction runs */
+  opnd_t mem;
+};
+
+/**
+ * Everything that propagate_taint needs to know about an instruction, worked out once when its
+ * block is built instead of by decoding the instruction each time it runs.
+ * The operands that can carry taint (registers and memory references) follow the descriptor:
+ * first the sources, then the destinations. Immediates and PCs can't, so they're left out.
+ */
+struct sl2_taint_insn {
+  /*! The size of the descriptor, operands included */
+  size_t size;
+  /*! The next descriptor in the list of retired descriptors (see get_taint_insn) */
+  sl2_taint_insn *next;
+  /*! The instruction's address */
+  app_pc pc;
+  /*! How the instruction propagates taint */
+  sl2_taint_kind kind;
+  /*! SL2_TAINT_BRANCH_* flags, for SL2_TAINT_KIND_BRANCH */
+  uint32_t branch;
+  /*! Whether propagating taint through the instruction needs the machine context */
+  bool needs_mc;
+  /*! The address of the instruction after this one */
+  app_pc next_pc;
+  /*! The target of a direct call, or NULL */
+  app_pc direct_target;
+  /*! Whether the instruction is an indirect call or jump (other than a return) */
+  bool has_target;
+  /*! The indirect call or jump's target operand, if has_target */
+  sl2_taint_opnd target;
+  /*! The memory that the paired store writes to, for SL2_TAINT_KIND_VECTOR_COPY */
+  sl2_taint_opnd pair_store;
+  /*! The instruction's module, as an index into stats_modules */
+  uint16_t module;
+  /*! The number of source operands */
+  uint16_t src_count;
+  /*! The number of destination operands */
+  uint16_t dst_count;
+  /*! The source operands, followed by the destination operands */
+  sl2_taint_opnd opnds[1];
+};
+
+/*! The taint descriptors of every instruction that we've instrumented, by address */
+typedef std::map<app_pc, sl2_taint_insn *, std::less<app_pc>,
+                 sl2_region_allocator<std::pair<const app_pc, sl2_taint_insn *>>>
+    sl2_taint_insn_map;
+
+static sl2_taint_insn_map taint_insns;
+/*! Descriptors that were replaced (e.g. because the code changed), but that code cache fragments
+ * might still be using. They're only freed at exit. */
+static sl2_taint_insn *retired_taint_insns = NULL;
+static void *taint_insns_lock;
+
+/** Check whether an operand can carry taint */
+static bool opnd_carries_taint(opnd_t opnd) {
+  return opnd_is_reg(opnd) || opnd_is_memory_reference(opnd);
+}
+
+/** Fill in the descriptor of an operand that can carry taint */
+static void describe_taint_opnd(opnd_t opnd, sl2_taint_opnd *desc) {
+  if (opnd_is_reg(opnd)) {
+    desc->reg = reg_to_full_width64(opnd_get_reg(opnd));
+    return;
+  }
+
+  desc->is_mem = true;
+  desc->reg = DR_REG_NULL;
+  desc->base = DR_REG_NULL;
+  desc->index = DR_REG_NULL;
+  desc->size = opnd_size_in_bytes(opnd_get_size(opnd));
+  desc->mem = opnd;
+
+  if (opnd_is_base_disp(opnd)) {
+    if (opnd_get_base(opnd) != DR_REG_NULL) {
+      desc->base = reg_to_full_width64(opnd_get_base(opnd));
     }
-    if (untainted) {
-      // TODO(ww): Why is this branch here?
+
+    if (opnd_get_index(opnd) != DR_REG_NULL) {
+      desc->index = reg_to_full_width64(opnd_get_index(opnd));
     }
   }
-  return untainted;
 }
 
-/** Mark an operand as tainted. Could be a register or memory reference. */
-static void taint(void *drcontext, opnd_t opnd) {
-  if (opnd_is_reg(opnd)) {
-    reg_id_t reg = opnd_get_reg(opnd);
-    reg = reg_to_full_width64(reg);
+/** Check whether both sources of an instruction are registers, and return them if so */
+static bool srcs_are_two_regs(instr_t *instr, reg_id_t *reg_0, reg_id_t *reg_1) {
+  if (instr_num_srcs(instr) != 2 || !opnd_is_reg(instr_get_src(instr, 0)) ||
+      !opnd_is_reg(instr_get_src(instr, 1))) {
+    return false;
+  }
 
-    tainted_regs.insert(reg);
+  *reg_0 = reg_to_full_width64(opnd_get_reg(instr_get_src(instr, 0)));
+  *reg_1 = reg_to_full_width64(opnd_get_reg(instr_get_src(instr, 1)));
+  return true;
+}
 
-    // char buf[100];
-    // opnd_disassemble_to_buffer(drcontext, opnd, buf, 100);
-  } else if (opnd_is_memory_reference(opnd)) {
-    dr_mcontext_t mc = {sizeof(mc), DR_MC_ALL};
-    dr_get_mcontext(drcontext, &mc);
-    app_pc addr = opnd_compute_address(opnd, &mc);
+/** Check whether an instruction is a full-width vector move (aligned or not) */
+static bool is_vector_move(instr_t *instr) {
+  switch (instr_get_opcode(instr)) {
+  case OP_movdqu:
+  case OP_movdqa:
+  case OP_movups:
+  case OP_movaps:
+  case OP_movupd:
+  case OP_movapd:
+  case OP_vmovdqu:
+  case OP_vmovdqa:
+  case OP_vmovups:
+  case OP_vmovaps:
+  case OP_vmovupd:
+  case OP_vmovapd:
+    return instr_num_srcs(instr) == 1 && instr_num_dsts(instr) == 1;
+  default:
+    return false;
+  }
+}
 
-    // opnd get size
-    opnd_size_t dr_size = opnd_get_size(opnd);
-    // opnd size in bytes
-    uint size = opnd_size_in_bytes(dr_size);
-    // loop insert
-    taint_mem(addr, size);
+/**
+ * Check whether a vector load is followed right away by a store of the same register, the way
+ * memcpy and friends move blocks of memory. The pair is handled by the load (see
+ * SL2_TAINT_KIND_VECTOR_COPY), so the store doesn't get a clean call of its own.
+ * @param load the load
+ * @param store the app instruction after it, or NULL
+ */
+static bool is_vector_copy(instr_t *load, instr_t *store) {
+  if (!store || !is_vector_move(load) || !is_vector_move(store)) {
+    return false;
   }
-  // else if(opnd_is_pc(opnd)) {
-  //     opnd_get_pc(opnd);
-  // } else if(opnd_is_abs_addr(opnd)) {
-  //     opnd_get_addr(opnd);
-  // }
 
-  return;
+  opnd_t loaded = instr_get_dst(load, 0);
+  opnd_t stored = instr_get_src(store, 0);
+
+  return opnd_is_memory_reference(instr_get_src(load, 0)) && opnd_is_reg(loaded) &&
+         opnd_is_reg(stored) && opnd_get_reg(loaded) == opnd_get_reg(stored) &&
+         opnd_is_memory_reference(instr_get_dst(store, 0)) &&
+         opnd_get_size(instr_get_src(load, 0)) == opnd_get_size(instr_get_dst(store, 0));
 }
 
-/** Untaint an operand */
-static bool untaint(void *drcontext, opnd_t opnd) {
-  bool untainted = false;
-  if (opnd_is_reg(opnd)) {
-    reg_id_t reg = opnd_get_reg(opnd);
-    reg = reg_to_full_width64(reg);
+/**
+ * Starts keeping instruction counts for a module, if there's room.
+ * @param mod the module
+ * @param mod_name the module's name
+ */
+static void stats_module_load(const module_data_t *mod, const char *mod_name) {
+  dr_mutex_lock(stats_lock);
 
-    size_t n = tainted_regs.erase(reg);
-    if (n) {
-      // char buf[100];
-      // opnd_disassemble_to_buffer(drcontext, opnd, buf, 100);
-      untainted = true;
-    }
-  } else if (opnd_is_memory_reference(opnd)) {
-    dr_mcontext_t mc = {sizeof(mc), DR_MC_ALL};
-    dr_get_mcontext(drcontext, &mc);
-    app_pc addr = opnd_compute_address(opnd, &mc);
+  if (stats_module_count < SL2_STATS_MODULES) {
+    sl2_stats_module *module = &stats_modules[stats_module_count++];
 
-    // opnd get size
-    opnd_size_t dr_size = opnd_get_size(opnd);
-    // opnd size in bytes
-    uint size = opnd_size_in_bytes(dr_size);
-    // loop insert
-    untainted = untaint_mem(addr, size);
+    module->start = mod->start;
+    module->end = mod->end;
+    dr_snprintf(module->name, sizeof(module->name), "%s", mod_name ? mod_name : "<unknown>");
+    module->name[sizeof(module->name) - 1] = '\0';
   }
-  // else if(opnd_is_pc(opnd)) {
-  //     opnd_get_pc(opnd);
-  // } else if(opnd_is_abs_addr(opnd)) {
-  //     opnd_get_addr(opnd);
-  // }
 
-  return untainted;
+  dr_mutex_unlock(stats_lock);
 }
 
-/** Handle special case of xor regA, regA - untaint the destination since it's inevitably 0 */
-static bool handle_xor(void *drcontext, instr_t *instr) {
-  bool result = false;
-  int src_count = instr_num_srcs(instr);
+/**
+ * @param pc an address
+ * @return the index into stats_modules of the module containing pc, or SL2_STATS_OTHER_MODULE
+ * Modules that get unloaded keep their slot, so a module loaded over one that was
+ * unloaded gets counted under whichever of the two loaded first.
+ */
+static uint16_t stats_module_index(app_pc pc) {
+  uint16_t index = SL2_STATS_OTHER_MODULE;
 
-  if (src_count == 2) {
-    opnd_t opnd_0 = instr_get_src(instr, 0);
-    opnd_t opnd_1 = instr_get_src(instr, 1);
-
-    if (opnd_is_reg(opnd_0) && opnd_is_reg(opnd_1)) {
-      reg_id_t reg_0 = reg_to_full_width64(opnd_get_reg(opnd_0));
-      reg_id_t reg_1 = reg_to_full_width64(opnd_get_reg(opnd_1));
-
-      if (reg_0 == reg_1) {
-        size_t n = tainted_regs.erase(reg_0);
-        // if(n) {
-        //     char buf[100];
-        //     opnd_disassemble_to_buffer(drcontext, opnd_0, buf, 100);
-        // }
-        result = true;
-      }
+  dr_mutex_lock(stats_lock);
+
+  for (int i = 0; i < stats_module_count; i++) {
+    if (pc >= stats_modules[i].start && pc < stats_modules[i].end) {
+      index = (uint16_t)i;
+      break;
     }
   }
 
-  return result;
+  dr_mutex_unlock(stats_lock);
+
+  return index;
 }
 
-/** Handle push and pop by not tainting RSP (included in operands) */
-static void handle_push_pop(void *drcontext, instr_t *instr) {
-  int src_count = instr_num_srcs(instr);
-  bool tainted = false;
+/**
+ * Folds a thread's counters into tracer_stats, and zeroes them so that they're only counted once.
+ * @param stats the thread's counters
+ */
+static void fold_thread_stats(sl2_tracer_stats *stats) {
+  dr_mutex_lock(stats_lock);
 
-  // check sources for taint
-  for (int i = 0; i < src_count && !tainted; i++) {
-    opnd_t opnd = instr_get_src(instr, i);
-    tainted |= is_tainted(drcontext, opnd);
+  tracer_stats.clean_calls += stats->clean_calls;
+  tracer_stats.propagated += stats->propagated;
+  tracer_stats.propagation_ticks += stats->propagation_ticks;
+  tracer_stats.peak_tainted_bytes =
+      (std::max)(tracer_stats.peak_tainted_bytes, stats->peak_tainted_bytes);
+  tracer_stats.peak_tainted_regs =
+      (std::max)(tracer_stats.peak_tainted_regs, stats->peak_tainted_regs);
+
+  for (int i = 0; i <= SL2_STATS_MODULES; i++) {
+    tracer_stats.module_insns[i] += stats->module_insns[i];
   }
 
-  // if tainted
-  // taint destinations that aren't rsp
-  int dst_count = instr_num_dsts(instr);
-  for (int i = 0; i < dst_count && tainted; i++) {
-    opnd_t opnd = instr_get_dst(instr, i);
+  dr_mutex_unlock(stats_lock);
 
-    if (opnd_is_reg(opnd)) {
-      reg_id_t reg = opnd_get_reg(opnd);
-      reg = reg_to_full_width64(reg);
-      if (reg == DR_REG_RSP) {
-        continue;
-      }
-    }
+  memset(stats, 0, sizeof(*stats));
+}
+
+/**
+ * Works out how an instruction propagates taint.
+ * @param instr the (fully decoded) instruction
+ * @return a new descriptor for the instruction, allocated from DR's global heap
+ */
+static sl2_taint_insn *describe_taint_insn(instr_t *instr) {
+  int opcode = instr_get_opcode(instr);
+  int src_count = instr_num_srcs(instr);
+  int dst_count = instr_num_dsts(instr);
+  sl2_taint_kind kind = SL2_TAINT_KIND_GENERIC;
+  uint32_t branch = 0;
+  reg_id_t reg_0, reg_1;
 
-    taint(drcontext, opnd);
+  if (instr_is_return(instr)) {
+    branch |= SL2_TAINT_BRANCH_RET;
   }
 
-  // if not tainted
-  // untaint destinations that aren't rsp
-  bool untainted = false;
-  for (int i = 0; i < dst_count && !tainted; i++) {
-    opnd_t opnd = instr_get_dst(instr, i);
+  if (instr_is_ubr(instr) || instr_is_cbr(instr) || instr_is_call_direct(instr)) {
+    branch |= SL2_TAINT_BRANCH_DIRECT;
+  }
 
-    if (opnd_is_reg(opnd)) {
-      reg_id_t reg = opnd_get_reg(opnd);
-      reg = reg_to_full_width64(reg);
-      if (reg == DR_REG_RSP) {
-        continue;
-      }
-    }
+  if (instr_is_mbr(instr)) {
+    branch |= SL2_TAINT_BRANCH_INDIRECT;
+  }
 
-    untainted |= untaint(drcontext, opnd);
+  if (instr_is_call(instr)) {
+    branch |= SL2_TAINT_BRANCH_CALL;
   }
 
-  // if(tainted | untainted) {
-  //     int opcode = instr_get_opcode(instr);
-  // char buf[100];
-  // instr_disassemble_to_buffer(drcontext, instr, buf, 100);
-  // }
-}
+  if (branch) {
+    kind = SL2_TAINT_KIND_BRANCH;
+  } else if ((opcode == OP_xor || opcode == OP_pxor || opcode == OP_xorps || opcode == OP_xorpd ||
+              opcode == OP_vpxor || opcode == OP_vxorps || opcode == OP_vxorpd) &&
+             srcs_are_two_regs(instr, &reg_0, &reg_1) && reg_0 == reg_1) {
+    kind = SL2_TAINT_KIND_XOR_SELF;
+  } else if (opcode == OP_xchg && srcs_are_two_regs(instr, &reg_0, &reg_1)) {
+    kind = SL2_TAINT_KIND_XCHG;
+  } else if (opcode == OP_rep_movs) {
+    kind = SL2_TAINT_KIND_REP_MOVS;
+  } else if (opcode == OP_rep_stos) {
+    kind = SL2_TAINT_KIND_REP_STOS;
+  } else if (is_vector_copy(instr, instr_get_next_app(instr))) {
+    kind = SL2_TAINT_KIND_VECTOR_COPY;
+  }
 
-/** Xchg of a tainted reg and non tainted reg should swap taint */
-static bool handle_xchg(void *drcontext, instr_t *instr) {
-  bool result = false;
-  int src_count = instr_num_srcs(instr);
+  // push and pop are generic, except that they never taint or untaint RSP
+  // (which is one of their destinations), so we leave it out of their operands.
+  bool skip_stack = opcode == OP_push || opcode == OP_pop;
+  size_t opnd_count = 0;
 
-  if (src_count == 2) {
-    opnd_t opnd_0 = instr_get_src(instr, 0);
-    opnd_t opnd_1 = instr_get_src(instr, 1);
-
-    if (opnd_is_reg(opnd_0) && opnd_is_reg(opnd_1)) {
-      reg_id_t reg_0 = reg_to_full_width64(opnd_get_reg(opnd_0));
-      reg_id_t reg_1 = reg_to_full_width64(opnd_get_reg(opnd_1));
-
-      bool reg_0_tainted = tainted_regs.find(reg_0) != tainted_regs.end();
-      bool reg_1_tainted = tainted_regs.find(reg_1) != tainted_regs.end();
-
-      if (reg_0_tainted && !reg_1_tainted) {
-        tainted_regs.erase(reg_0);
-        tainted_regs.insert(reg_1);
-        result = true;
-      } else if (reg_1_tainted && !reg_0_tainted) {
-        tainted_regs.erase(reg_1);
-        tainted_regs.insert(reg_0);
-        result = true;
-      }
-    }
+  for (int i = 0; i < src_count; i++) {
+    opnd_count += opnd_carries_taint(instr_get_src(instr, i));
   }
 
-  return result;
-}
-
-/** Special cases for tainting / untainting PC */
-static bool handle_branches(void *drcontext, instr_t *instr) {
+  for (int i = 0; i < dst_count; i++) {
+    opnd_t opnd = instr_get_dst(instr, i);
 
-  bool is_ret = instr_is_return(instr);
-  bool is_direct = instr_is_ubr(instr) || instr_is_cbr(instr) || instr_is_call_direct(instr);
-  bool is_indirect = instr_is_mbr(instr);
-  bool is_call = instr_is_call(instr);
+    if (skip_stack && opnd_is_reg(opnd) && reg_to_full_width64(opnd_get_reg(opnd)) == DR_REG_RSP) {
+      continue;
+    }
 
-  if (!is_ret && !is_direct && !is_indirect && !is_call) {
-    return false;
+    opnd_count += opnd_carries_taint(opnd);
   }
 
-  reg_id_t reg_pc = reg_to_full_width64(DR_REG_NULL);
-  reg_id_t reg_stack = reg_to_full_width64(DR_REG_ESP);
-  bool pc_tainted = tainted_regs.find(reg_pc) != tainted_regs.end();
+  size_t size = sizeof(sl2_taint_insn) + (opnd_count ? opnd_count - 1 : 0) * sizeof(sl2_taint_opnd);
+  sl2_taint_insn *insn = (sl2_taint_insn *)sl2_global_alloc(size);
+  memset(insn, 0, size);
 
-  bool result = false;
-  int src_count = instr_num_srcs(instr);
-  int dst_count = instr_num_dsts(instr);
+  insn->size = size;
+  insn->module = stats_module_index(instr_get_app_pc(instr));
+  insn->pc = instr_get_app_pc(instr);
+  insn->kind = kind;
+  insn->branch = branch;
 
-  // call
-  if (is_call) {
-    if (pc_tainted) {
-      // make saved return address tainted
-      for (int i = 0; i < dst_count; i++) {
-        opnd_t opnd = instr_get_dst(instr, i);
-        if (opnd_is_memory_reference(opnd)) {
-          taint(drcontext, opnd);
-          break;
-        }
-      }
+  insn->next_pc = insn->pc + instr_length(GLOBAL_DCONTEXT, instr);
+
+  if (instr_is_call(instr) || (instr_is_mbr(instr) && !instr_is_return(instr))) {
+    opnd_t target = instr_get_target(instr);
+
+    if (opnd_is_pc(target)) {
+      insn->direct_target = opnd_get_pc(target);
+    } else if (opnd_carries_taint(target)) {
+      insn->has_target = true;
+      insn->needs_mc = true;
+      describe_taint_opnd(target, &insn->target);
     }
   }
 
-  // direct branch or call
-  if (is_direct) {
-    if (pc_tainted) {
-      // untaint pc
-      tainted_regs.erase(reg_pc);
-    }
+  if (kind == SL2_TAINT_KIND_VECTOR_COPY) {
+    describe_taint_opnd(instr_get_dst(instr_get_next_app(instr), 0), &insn->pair_store);
   }
 
-  // indirect branch or call
-  if (is_indirect) {
-    for (int i = 0; i < src_count; i++) {
-      opnd_t opnd = instr_get_src(instr, i);
-
-      if (opnd_is_reg(opnd)) {
-        reg_id_t reg = reg_to_full_width64(opnd_get_reg(opnd));
-        if (reg != reg_stack && tainted_regs.find(reg) != tainted_regs.end()) {
-          // taint pc
-          tainted_regs.insert(reg_pc);
-        }
-      }
+  // The string instructions keep their counts and pointers in the integer registers,
+  // and their direction in the flags.
+  insn->needs_mc |= kind == SL2_TAINT_KIND_REP_MOVS || kind == SL2_TAINT_KIND_REP_STOS;
+
+  sl2_taint_opnd *desc = insn->opnds;
+
+  for (int i = 0; i < src_count; i++) {
+    opnd_t opnd = instr_get_src(instr, i);
+
+    if (opnd_carries_taint(opnd)) {
+      describe_taint_opnd(opnd, desc++);
+      insn->src_count++;
+      insn->needs_mc |= opnd_is_memory_reference(opnd);
     }
   }
 
-  /* TODO: check that this taints PC if the tainted address is saved (by the if(is_call)) and
-   * restored */
-  // ret
-  if (is_ret) {
-    bool tainted = false;
-    for (int i = 0; i < src_count; i++) {
-      opnd_t opnd = instr_get_src(instr, i);
-      if (is_tainted(drcontext, opnd)) {
-        tainted = true;
-        break;
-      }
+  for (int i = 0; i < dst_count; i++) {
+    opnd_t opnd = instr_get_dst(instr, i);
+
+    if (skip_stack && opnd_is_reg(opnd) && reg_to_full_width64(opnd_get_reg(opnd)) == DR_REG_RSP) {
+      continue;
     }
 
-    if (tainted) {
-      // taint pc
-      tainted_regs.insert(reg_pc);
-    } else {
-      // untaint pc
-      tainted_regs.erase(reg_pc);
+    if (opnd_carries_taint(opnd)) {
+      describe_taint_opnd(opnd, desc++);
+      insn->dst_count++;
+      insn->needs_mc |= opnd_is_memory_reference(opnd);
     }
   }
 
-  return true;
+  return insn;
 }
 
-/** Dispatch to instruction-specific taint handling for things that don't fit the general
-    model of tainted operand -> tainted result */
-static bool handle_specific(void *drcontext, instr_t *instr) {
-  int opcode = instr_get_opcode(instr);
-  bool result = false;
+/**
+ * Gets the taint descriptor of an instruction from the side table, adding it if it's new.
+ * Blocks get rebuilt (e.g. into traces, or to translate a fault), so the same instruction usually
+ * maps to one descriptor. If the instruction has changed since we last saw it, its new descriptor
+ * replaces the old one, which is retired rather than freed.
+ * @param instr the (fully decoded) instruction
+ * @return the instruction's descriptor
+ */
+static sl2_taint_insn *get_taint_insn(instr_t *instr) {
+  sl2_taint_insn *insn = describe_taint_insn(instr);
 
-  // indirect call
-  if (handle_branches(drcontext, instr)) {
-    return true;
-  }
+  dr_mutex_lock(taint_insns_lock);
 
-  switch (opcode) {
-  case OP_push:
-  case OP_pop:
-    handle_push_pop(drcontext, instr);
-    return true;
-  case OP_xor:
-    result = handle_xor(drcontext, instr);
-    return result;
-  case OP_xchg:
-    result = handle_xchg(drcontext, instr);
-    return result;
-  default:
-    return false;
-  }
-}
+  sl2_taint_insn_map::iterator it = taint_insns.find(insn->pc);
+  decoded_insns++;
 
-/** Called on each instruction. Spreads taint from sources to destinations,
-    wipes tainted destinations with untainted sources. */
-static void propagate_taint(app_pc pc) {
-  // Store instruction trace
-  if (pc > module_start && pc < module_end) {
-    last_insns[last_insn_idx] = pc;
-    last_insn_idx++;
-    last_insn_idx %= LAST_COUNT;
+  if (it == taint_insns.end()) {
+    taint_insns[insn->pc] = insn;
+  } else if (it->second->size == insn->size && !memcmp(it->second, insn, insn->size)) {
+    dr_global_free(insn, insn->size);
+    insn = it->second;
+  } else {
+    it->second->next = retired_taint_insns;
+    retired_taint_insns = it->second;
+    it->second = insn;
   }
 
-  if (tainted_mems.size() == 0 && tainted_regs.size() == 0) {
-    return;
-  }
+  dr_mutex_unlock(taint_insns_lock);
 
-  void *drcontext = dr_get_current_drcontext();
-  instr_t instr;
-  instr_init(drcontext, &instr);
-  decode(drcontext, pc, &instr);
-
-  // Save the count of times we've called this function (if it's a call)
-  if (instr_is_call(&instr)) {
-    opnd_t target = instr_get_target(&instr);
-    if (opnd_is_memory_reference(target)) {
-      dr_mcontext_t mc = {sizeof(mc), DR_MC_ALL};
-      dr_get_mcontext(drcontext, &mc);
-      app_pc addr = opnd_compute_address(target, &mc);
-
-      if (pc > module_start && pc < module_end) {
-        last_calls[last_call_idx] = addr;
-        last_call_idx++;
-        last_call_idx %= LAST_COUNT;
-      }
-    }
+  return insn;
+}
+
+/** Free every taint descriptor */
+static void free_taint_insns() {
+  for (sl2_taint_insn_map::iterator it = taint_insns.begin(); it != taint_insns.end(); it++) {
+    dr_global_free(it->second, it->second->size);
   }
 
-  // if(tainted_mems.size() > 0) {
-  //     char buf[100];
-  //     instr_disassemble_to_buffer(drcontext, &instr, buf, 100);
-  //     dr_printf("%s\n", buf);
-  // }
+  taint_insns.clear();
 
-  /* Handle specific instructions */
-  if (handle_specific(drcontext, &instr)) {
-    instr_free(drcontext, &instr);
-    return;
+  while (retired_taint_insns) {
+    sl2_taint_insn *next = retired_taint_insns->next;
+    dr_global_free(retired_taint_insns, retired_taint_insns->size);
+    retired_taint_insns = next;
   }
 
-  /* Check if sources are tainted */
-  int src_count = instr_num_srcs(&instr);
-  bool tainted = false;
+  dr_mutex_destroy(taint_insns_lock);
+}
 
-  for (int i = 0; i < src_count && !tainted; i++) {
-    opnd_t opnd = instr_get_src(&instr, i);
-    tainted |= is_tainted(drcontext, opnd);
+/** Check whether an operand is tainted */
+static bool taint_opnd_is_tainted(const sl2_reg_taint *regs, dr_mcontext_t *mc,
+                                  const sl2_taint_opnd *opnd) {
+  if (!opnd->is_mem) {
+    return reg_mask_test(regs, opnd->reg);
   }
 
-  /* If tainted sources, taint destinations */
-  int dst_count = instr_num_dsts(&instr);
-  for (int i = 0; i < dst_count && tainted; i++) {
-    opnd_t opnd = instr_get_dst(&instr, i);
-    taint(drcontext, opnd);
+  /* Check if a memory region overlaps a tainted address */
+  if (tainted_mems.test(opnd_compute_address(opnd->mem, mc), opnd->size)) {
+    return true;
   }
 
-  /* If not tainted sources, untaint destinations*/
-  bool untainted = false;
-  for (int i = 0; i < dst_count && !tainted; i++) {
-    opnd_t opnd = instr_get_dst(&instr, i);
-    untainted |= untaint(drcontext, opnd);
+  /* Check if a register used in calculating an address is tainted */
+  return (opnd->base != DR_REG_NULL && reg_mask_test(regs, opnd->base)) ||
+         (opnd->index != DR_REG_NULL && reg_mask_test(regs, opnd->index));
+}
+
+/** @return the label of a (full-width) register, or SL2_LABEL_NONE if it isn't tainted */
+static uint32_t reg_label(sl2_thread_taint *state, reg_id_t reg) {
+  if (!labels_on || !reg_mask_test(&state->regs, reg)) {
+    return SL2_LABEL_NONE;
   }
 
-  // if(tainted | untainted) {
-  //     int opcode = instr_get_opcode(&instr);
-  // }
+  return state->reg_labels[reg];
+}
 
-  instr_free(drcontext, &instr);
+/** Mark a (full-width) register as tainted, with a label */
+static void taint_reg_labelled(sl2_thread_taint *state, reg_id_t reg, uint32_t label) {
+  reg_mask_set(&state->regs, reg);
+
+  if (labels_on) {
+    state->reg_labels[reg] = label;
+  }
 }
 
-/** Called upon basic block insertion with each individual instruction as an argument.
-    Inserts a clean call to propagate_taint before every instruction */
-static dr_emit_flags_t on_bb_instrument(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
+/** Label a range of memory, in label mode */
+static void label_mem(app_pc addr, size_t size, uint32_t label) {
+  if (labels_on) {
+    mem_labels.set(addr, size, label);
+  }
+}
+
+/** @return the label of an operand: its tainted bytes (or register), and its address registers */
+static uint32_t taint_opnd_label(sl2_thread_taint *state, dr_mcontext_t *mc,
+                                 const sl2_taint_opnd *opnd) {
+  if (!labels_on) {
+    return SL2_LABEL_NONE;
+  }
+
+  if (!opnd->is_mem) {
+    return reg_label(state, opnd->reg);
+  }
+
+  app_pc addr = opnd_compute_address(opnd->mem, mc);
+  uint32_t label = SL2_LABEL_NONE;
+
+  // The labels of untainted bytes can be stale, so we only look at the tainted ones.
+  for (uint i = 0; i < opnd->size; i++) {
+    if (tainted_mems.test(addr + i, 1)) {
+      label = taint_labels.join(label, mem_labels.get(addr + i));
+    }
+  }
+
+  if (opnd->base != DR_REG_NULL) {
+    label = taint_labels.join(label, reg_label(state, opnd->base));
+  }
+
+  if (opnd->index != DR_REG_NULL) {
+    label = taint_labels.join(label, reg_label(state, opnd->index));
+  }
+
+  return label;
+}
+
+/** Mark an operand as tainted, with a label */
+static void taint_opnd(sl2_thread_taint *state, dr_mcontext_t *mc, const sl2_taint_opnd *opnd,
+                       uint32_t label) {
+  if (opnd->is_mem) {
+    app_pc addr = opnd_compute_address(opnd->mem, mc);
+
+    taint_mem(addr, opnd->size);
+    label_mem(addr, opnd->size, label);
+  } else {
+    taint_reg_labelled(state, opnd->reg, label);
+  }
+}
+
+/** Untaint an operand */
+static void untaint_opnd(sl2_reg_taint *regs, dr_mcontext_t *mc, const sl2_taint_opnd *opnd) {
+  if (opnd->is_mem) {
+    untaint_mem(opnd_compute_address(opnd->mem, mc), opnd->size);
+  } else {
+    reg_mask_clear(regs, opnd->reg);
+  }
+}
+
+/** Special cases for tainting / untainting PC */
+static void propagate_branch_taint(sl2_thread_taint *state, dr_mcontext_t *mc,
+                                   const sl2_taint_insn *insn) {
+  sl2_reg_taint *regs = &state->regs;
+  const sl2_taint_opnd *srcs = insn->opnds;
+  const sl2_taint_opnd *dsts = insn->opnds + insn->src_count;
+  reg_id_t reg_pc = reg_to_full_width64(DR_REG_NULL);
+  reg_id_t reg_stack = reg_to_full_width64(DR_REG_ESP);
+  bool pc_tainted = reg_mask_test(regs, reg_pc);
+
+  // call
+  if ((insn->branch & SL2_TAINT_BRANCH_CALL) && pc_tainted) {
+    // make saved return address tainted
+    for (int i = 0; i < insn->dst_count; i++) {
+      if (dsts[i].is_mem) {
+        taint_opnd(state, mc, &dsts[i], reg_label(state, reg_pc));
+        break;
+      }
+    }
+  }
+
+  // direct branch or call
+  if ((insn->branch & SL2_TAINT_BRANCH_DIRECT) && pc_tainted) {
+    // untaint pc
+    reg_mask_clear(regs, reg_pc);
+  }
+
+  // indirect branch or call
+  if (insn->branch & SL2_TAINT_BRANCH_INDIRECT) {
+    for (int i = 0; i < insn->src_count; i++) {
+      if (!srcs[i].is_mem && srcs[i].reg != reg_stack && reg_mask_test(regs, srcs[i].reg)) {
+        // taint pc
+        taint_reg_labelled(state, reg_pc, reg_label(state, srcs[i].reg));
+      }
+    }
+  }
+
+  /* TODO: check that this taints PC if the tainted address is saved (by the call case) and
+   * restored */
+  // ret
+  if (insn->branch & SL2_TAINT_BRANCH_RET) {
+    bool tainted = false;
+    uint32_t label = SL2_LABEL_NONE;
+
+    for (int i = 0; i < insn->src_count && !tainted; i++) {
+      tainted = taint_opnd_is_tainted(regs, mc, &srcs[i]);
+    }
+
+    for (int i = 0; i < insn->src_count && tainted && labels_on; i++) {
+      label = taint_labels.join(label, taint_opnd_label(state, mc, &srcs[i]));
+    }
+
+    if (tainted) {
+      taint_reg_labelled(state, reg_pc, label);
+    } else {
+      reg_mask_clear(regs, reg_pc);
+    }
+  }
+}
+
+/*! The most modules that can be in the taint scope */
+#define SL2_TAINT_SCOPE_MAX 32
+/*! The longest string that a summarized strcpy/wcscpy is assumed to copy */
+#define SL2_TAINT_STRLEN_MAX (1024 * 1024)
+
+/*! A module in the taint scope */
+struct sl2_scope_range {
+  app_pc start;
+  app_pc end;
+};
+
+/*! Whether every module is in the taint scope (the default) */
+static bool scope_all = true;
+/*! The modules in the taint scope, unless scope_all */
+static sl2_scope_range scope_ranges[SL2_TAINT_SCOPE_MAX];
+static volatile int scope_count = 0;
+
+/*! Functions outside of the taint scope whose effects on taint we model exactly */
+enum sl2_taint_model {
+  /*! Tainted arguments taint the return value */
+  SL2_TAINT_MODEL_GENERIC,
+  /*! memcpy(dst, src, size) and memmove(dst, src, size) */
+  SL2_TAINT_MODEL_MEMMOVE,
+  /*! memset(dst, value, size) */
+  SL2_TAINT_MODEL_MEMSET,
+  /*! strcpy(dst, src) */
+  SL2_TAINT_MODEL_STRCPY,
+  /*! wcscpy(dst, src) */
+  SL2_TAINT_MODEL_WCSCPY,
+};
+
+/*! The exports that get SL2_TAINT_MODEL_* summaries, wherever they're found */
+static const struct {
+  const char *name;
+  sl2_taint_model model;
+} taint_model_exports[] = {
+    {"memcpy", SL2_TAINT_MODEL_MEMMOVE},        {"memmove", SL2_TAINT_MODEL_MEMMOVE},
+    {"RtlCopyMemory", SL2_TAINT_MODEL_MEMMOVE}, {"RtlMoveMemory", SL2_TAINT_MODEL_MEMMOVE},
+    {"memset", SL2_TAINT_MODEL_MEMSET},         {"strcpy", SL2_TAINT_MODEL_STRCPY},
+    {"wcscpy", SL2_TAINT_MODEL_WCSCPY},
+};
+
+/*! The addresses of the exports in taint_model_exports, outside of the taint scope */
+typedef std::map<app_pc, sl2_taint_model, std::less<app_pc>,
+                 sl2_region_allocator<std::pair<const app_pc, sl2_taint_model>>>
+    sl2_taint_model_map;
+
+static sl2_taint_model_map taint_models;
+static void *taint_models_lock;
+
+/** Check whether an address is in the taint scope */
+static bool in_taint_scope(app_pc pc) {
+  if (scope_all) {
+    return true;
+  }
+
+  for (int i = 0; i < scope_count; i++) {
+    if (pc >= scope_ranges[i].start && pc < scope_ranges[i].end) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/** Check whether a module was named in op_taint_scope */
+static bool module_named_in_scope(const char *mod_name) {
+  const std::string &scope = op_taint_scope.get_value();
+  size_t start = 0;
+
+  while (start <= scope.size()) {
+    size_t end = scope.find(',', start);
+    if (end == std::string::npos) {
+      end = scope.size();
+    }
+
+    if (!_stricmp(scope.substr(start, end - start).c_str(), mod_name)) {
+      return true;
+    }
+
+    start = end + 1;
+  }
+
+  return false;
+}
+
+/**
+ * Puts a newly loaded module into the taint scope if it belongs there, and records where the
+ * modelled exports are if it doesn't.
+ */
+static void scope_module_load(const module_data_t *mod, const char *mod_name, bool is_main) {
+  if (scope_all) {
+    return;
+  }
+
+  if (is_main || module_named_in_scope(mod_name)) {
+    if (scope_count < SL2_TAINT_SCOPE_MAX) {
+      scope_ranges[scope_count].start = mod->start;
+      scope_ranges[scope_count].end = mod->end;
+      scope_count++;
+    } else {
+      SL2_DR_DEBUG("tracer#scope_module_load: too many modules in scope, skipping %s\n", mod_name);
+    }
+
+    return;
+  }
+
+  dr_mutex_lock(taint_models_lock);
+
+  for (size_t i = 0; i < sizeof(taint_model_exports) / sizeof(taint_model_exports[0]); i++) {
+    app_pc addr = (app_pc)dr_get_proc_address(mod->handle, taint_model_exports[i].name);
+
+    if (addr && !in_taint_scope(addr)) {
+      taint_models[addr] = taint_model_exports[i].model;
+    }
+  }
+
+  dr_mutex_unlock(taint_models_lock);
+}
+
+/** @return the model for a function outside of the taint scope */
+static sl2_taint_model taint_model_for(app_pc target) {
+  sl2_taint_model model = SL2_TAINT_MODEL_GENERIC;
+
+  dr_mutex_lock(taint_models_lock);
+
+  sl2_taint_model_map::iterator it = taint_models.find(target);
+  if (it != taint_models.end()) {
+    model = it->second;
+  }
+
+  dr_mutex_unlock(taint_models_lock);
+
+  return model;
+}
+
+/** @return the size of a NUL-terminated string in bytes, terminator included */
+static size_t safe_strsize(app_pc str, size_t width) {
+  size_t size = 0;
+
+  while (size < SL2_TAINT_STRLEN_MAX) {
+    uint16_t c = 0;
+
+    if (!dr_safe_read(str + size, width, &c, NULL)) {
+      break;
+    }
+
+    size += width;
+
+    if (!c) {
+      break;
+    }
+  }
+
+  return size;
+}
+
+/**
+ * Summarizes a call (or tail jump) out of the taint scope, since we won't see the instructions
+ * that it runs. Modelled functions move taint between their buffers now; everything else has its
+ * return value tainted if any of its register arguments are. The rest of the summary is applied
+ * when the call returns (see apply_taint_summary).
+ * @param state the thread's taint state
+ * @param mc the machine context at the call
+ * @param insn the call or jump
+ * @param target where the call or jump goes
+ */
+static void summarize_call(sl2_thread_taint *state, dr_mcontext_t *mc, const sl2_taint_insn *insn,
+                           app_pc target) {
+  sl2_reg_taint *regs = &state->regs;
+  app_pc ret_pc = NULL;
+
+  // A jump out of the scope is a tail call (e.g. an import thunk), so it returns to
+  // whatever called us.
+  if (insn->branch & SL2_TAINT_BRANCH_CALL) {
+    ret_pc = insn->next_pc;
+  } else if (!dr_safe_read((void *)mc->xsp, sizeof(ret_pc), &ret_pc, NULL)) {
+    return;
+  }
+
+  app_pc dst = (app_pc)mc->xcx;
+  app_pc src = (app_pc)mc->xdx;
+  size_t size = (size_t)mc->r8;
+  bool ret_tainted = reg_mask_test(regs, DR_REG_RCX);
+  uint32_t ret_label = reg_label(state, DR_REG_RCX);
+
+  switch (taint_model_for(target)) {
+  case SL2_TAINT_MODEL_MEMMOVE:
+    tainted_mems.copy(dst, src, size);
+    if (labels_on) {
+      mem_labels.copy(dst, src, size);
+    }
+    break;
+  case SL2_TAINT_MODEL_MEMSET:
+    if (reg_mask_test(regs, DR_REG_RDX)) {
+      taint_mem(dst, size);
+      label_mem(dst, size, reg_label(state, DR_REG_RDX));
+    } else {
+      tainted_mems.clear(dst, size);
+    }
+    break;
+  case SL2_TAINT_MODEL_STRCPY:
+  case SL2_TAINT_MODEL_WCSCPY:
+    size = safe_strsize(src, taint_model_for(target) == SL2_TAINT_MODEL_STRCPY ? 1 : 2);
+    tainted_mems.copy(dst, src, size);
+    if (labels_on) {
+      mem_labels.copy(dst, src, size);
+    }
+    break;
+  default:
+    ret_tainted = ret_tainted || reg_mask_test(regs, DR_REG_RDX) ||
+                  reg_mask_test(regs, DR_REG_R8) || reg_mask_test(regs, DR_REG_R9);
+    ret_label = taint_labels.join(ret_label, reg_label(state, DR_REG_RDX));
+    ret_label = taint_labels.join(ret_label, reg_label(state, DR_REG_R8));
+    ret_label = taint_labels.join(ret_label, reg_label(state, DR_REG_R9));
+    break;
+  }
+
+  // If calls nest too deeply (or never return, e.g. because of longjmp), forget the oldest.
+  if (state->summary_depth == SL2_TAINT_SUMMARY_DEPTH) {
+    memmove(&state->summaries[0], &state->summaries[1],
+            sizeof(sl2_taint_summary) * (SL2_TAINT_SUMMARY_DEPTH - 1));
+    state->summary_depth--;
+  }
+
+  state->summaries[state->summary_depth].ret_pc = ret_pc;
+  state->summaries[state->summary_depth].ret_tainted = ret_tainted;
+  state->summaries[state->summary_depth].ret_label = ret_label;
+  state->summary_depth++;
+}
+
+/**
+ * Finishes summarizing the innermost call out of the taint scope, now that it has returned:
+ * the volatile registers are clobbered, and RAX holds the (possibly tainted) return value.
+ * @param state the thread's taint state
+ */
+static void apply_taint_summary(sl2_thread_taint *state) {
+  static const reg_id_t volatile_regs[] = {DR_REG_RCX, DR_REG_RDX, DR_REG_R8,
+                                           DR_REG_R9,  DR_REG_R10, DR_REG_R11};
+  sl2_taint_summary *summary = &state->summaries[--state->summary_depth];
+
+  for (size_t i = 0; i < sizeof(volatile_regs) / sizeof(volatile_regs[0]); i++) {
+    reg_mask_clear(&state->regs, volatile_regs[i]);
+  }
+
+  if (summary->ret_tainted) {
+    taint_reg_labelled(state, DR_REG_RAX, summary->ret_label);
+  } else {
+    reg_mask_clear(&state->regs, DR_REG_RAX);
+  }
+}
+
+/**
+ * Moves taint through a vector load and the store that it's paired with, byte by byte: the
+ * stored bytes get the taint of the loaded ones, rather than all of them getting the register's.
+ * @param state the thread's taint state
+ * @param mc the machine context at the load
+ * @param insn the load
+ */
+static void propagate_vector_copy(sl2_thread_taint *state, dr_mcontext_t *mc,
+                                  const sl2_taint_insn *insn) {
+  const sl2_taint_opnd *src = &insn->opnds[0];
+  const sl2_taint_opnd *reg = &insn->opnds[insn->src_count];
+  const sl2_taint_opnd *dst = &insn->pair_store;
+  app_pc src_addr = opnd_compute_address(src->mem, mc);
+  app_pc dst_addr = opnd_compute_address(dst->mem, mc);
+  sl2_reg_taint *regs = &state->regs;
+
+  bool tainted = taint_opnd_is_tainted(regs, mc, src);
+  uint32_t label = tainted ? taint_opnd_label(state, mc, src) : SL2_LABEL_NONE;
+
+  if (tainted) {
+    taint_reg_labelled(state, reg->reg, label);
+  } else {
+    reg_mask_clear(regs, reg->reg);
+  }
+
+  // Tainted address registers taint everything that's stored, like they would have
+  // through the register.
+  bool addr_tainted = (src->base != DR_REG_NULL && reg_mask_test(regs, src->base)) ||
+                      (src->index != DR_REG_NULL && reg_mask_test(regs, src->index)) ||
+                      (dst->base != DR_REG_NULL && reg_mask_test(regs, dst->base)) ||
+                      (dst->index != DR_REG_NULL && reg_mask_test(regs, dst->index));
+
+  if (addr_tainted) {
+    // DR_REG_NULL is PC's slot, so missing address registers are skipped.
+    if (dst->base != DR_REG_NULL) {
+      label = taint_labels.join(label, reg_label(state, dst->base));
+    }
+
+    if (dst->index != DR_REG_NULL) {
+      label = taint_labels.join(label, reg_label(state, dst->index));
+    }
+
+    taint_opnd(state, mc, dst, label);
+    return;
+  }
+
+  tainted_mems.copy(dst_addr, src_addr, dst->size);
+  if (labels_on) {
+    mem_labels.copy(dst_addr, src_addr, dst->size);
+  }
+}
+
+/**
+ * Moves taint through every element of a rep movs or rep stos at once, instead of only the
+ * element that the instruction's operands describe.
+ * @param state the thread's taint state
+ * @param mc the machine context at the instruction
+ * @param insn the instruction
+ */
+static void propagate_rep_taint(sl2_thread_taint *state, dr_mcontext_t *mc,
+                                const sl2_taint_insn *insn) {
+  const sl2_taint_opnd *dsts = insn->opnds + insn->src_count;
+  size_t count = (size_t)mc->xcx;
+  size_t element = 0;
+
+  for (int i = 0; i < insn->dst_count; i++) {
+    if (dsts[i].is_mem) {
+      element = dsts[i].size;
+    }
+  }
+
+  if (!count || !element || count > SIZE_MAX / element) {
+    return;
+  }
+
+  // With the direction flag set, the pointers walk down from the last element.
+  size_t size = count * element;
+  size_t back = (mc->xflags & EFLAGS_DF) ? size - element : 0;
+  app_pc dst = (app_pc)mc->xdi - back;
+
+  if (insn->kind == SL2_TAINT_KIND_REP_MOVS) {
+    app_pc src = (app_pc)mc->xsi - back;
+
+    tainted_mems.copy(dst, src, size);
+    if (labels_on) {
+      mem_labels.copy(dst, src, size);
+    }
+  } else if (reg_mask_test(&state->regs, DR_REG_RAX)) {
+    taint_mem(dst, size);
+    label_mem(dst, size, reg_label(state, DR_REG_RAX));
+  } else {
+    tainted_mems.clear(dst, size);
+  }
+
+  // The count always runs out; the pointers keep whatever taint they had.
+  reg_mask_clear(&state->regs, DR_REG_RCX);
+}
+
+/** Spreads taint from an instruction's sources to its destinations, and wipes tainted destinations
+    with untainted sources. */
+static void propagate_insn_taint(void *drcontext, sl2_thread_taint *state, sl2_taint_insn *insn) {
+  app_pc pc = insn->pc;
+  sl2_reg_taint *regs = &state->regs;
+
+  // Finish summarizing a call out of the taint scope, if this is where it returns to
+  if (state->summary_depth && state->summaries[state->summary_depth - 1].ret_pc == pc) {
+    apply_taint_summary(state);
+  }
+
+  if (tainted_mems.empty() && !reg_mask_any(regs)) {
+    return;
+  }
+
+  state->stats.propagated++;
+
+  // Only memory references and indirect branches need the machine context, and only
+  // its integer registers.
+  dr_mcontext_t mc = {sizeof(mc), DR_MC_CONTROL | DR_MC_INTEGER};
+  if (insn->needs_mc) {
+    dr_get_mcontext(drcontext, &mc);
+  }
+
+  const sl2_taint_opnd *srcs = insn->opnds;
+  const sl2_taint_opnd *dsts = insn->opnds + insn->src_count;
+
+  /* Handle specific instructions */
+  switch (insn->kind) {
+  case SL2_TAINT_KIND_BRANCH: {
+    propagate_branch_taint(state, &mc, insn);
+
+    if (scope_all || !(insn->direct_target || insn->has_target)) {
+      return;
+    }
+
+    app_pc target = insn->direct_target;
+
+    if (insn->has_target && insn->target.is_mem) {
+      app_pc slot = opnd_compute_address(insn->target.mem, &mc);
+
+      if (!dr_safe_read(slot, sizeof(target), &target, NULL)) {
+        return;
+      }
+    } else if (insn->has_target) {
+      target = (app_pc)reg_get_value(insn->target.reg, &mc);
+    }
+
+    if (!in_taint_scope(target)) {
+      summarize_call(state, &mc, insn, target);
+    }
+    return;
+  }
+  case SL2_TAINT_KIND_XOR_SELF:
+    reg_mask_clear(regs, dsts[0].reg);
+    return;
+  case SL2_TAINT_KIND_VECTOR_COPY:
+    propagate_vector_copy(state, &mc, insn);
+    return;
+  case SL2_TAINT_KIND_REP_MOVS:
+  case SL2_TAINT_KIND_REP_STOS:
+    propagate_rep_taint(state, &mc, insn);
+    return;
+  case SL2_TAINT_KIND_XCHG: {
+    bool reg_0_tainted = reg_mask_test(regs, srcs[0].reg);
+    bool reg_1_tainted = reg_mask_test(regs, srcs[1].reg);
+
+    uint32_t reg_0_label = reg_label(state, srcs[0].reg);
+    uint32_t reg_1_label = reg_label(state, srcs[1].reg);
+
+    if (reg_0_tainted != reg_1_tainted) {
+      if (reg_0_tainted) {
+        reg_mask_clear(regs, srcs[0].reg);
+        taint_reg_labelled(state, srcs[1].reg, reg_0_label);
+      } else {
+        reg_mask_clear(regs, srcs[1].reg);
+        taint_reg_labelled(state, srcs[0].reg, reg_1_label);
+      }
+    } else if (reg_0_tainted) {
+      taint_reg_labelled(state, srcs[0].reg, reg_1_label);
+      taint_reg_labelled(state, srcs[1].reg, reg_0_label);
+    }
+    return;
+  }
+  default:
+    break;
+  }
+
+  /* Check if sources are tainted */
+  bool tainted = false;
+
+  for (int i = 0; i < insn->src_count && !tainted; i++) {
+    tainted = taint_opnd_is_tainted(regs, &mc, &srcs[i]);
+  }
+
+  /* In label mode, destinations get the labels of all of the sources */
+  uint32_t label = SL2_LABEL_NONE;
+
+  for (int i = 0; i < insn->src_count && tainted && labels_on; i++) {
+    label = taint_labels.join(label, taint_opnd_label(state, &mc, &srcs[i]));
+  }
+
+  /* If tainted sources, taint destinations. If not, untaint them. */
+  for (int i = 0; i < insn->dst_count; i++) {
+    if (tainted) {
+      taint_opnd(state, &mc, &dsts[i], label);
+    } else {
+      untaint_opnd(regs, &mc, &dsts[i]);
+    }
+  }
+}
+
+/** Called on each instruction, with the descriptor built for it by on_bb_instrument. Propagates
+    its taint, and keeps the thread's counters. */
+static void propagate_taint(sl2_taint_insn *insn) {
+  uint64_t start = __rdtsc();
+  void *drcontext = dr_get_current_drcontext();
+  sl2_thread_taint *state = thread_taint(drcontext);
+  sl2_tracer_stats *stats = &state->stats;
+  uint64_t propagated = stats->propagated;
+
+  size_t tainted_bytes = tainted_mems.size();
+  sl2_reg_taint regs_before = state->regs;
+
+  stats->clean_calls++;
+  stats->module_insns[insn->module]++;
+
+  propagate_insn_taint(drcontext, state, insn);
+
+  bool holds = state->summary_depth || reg_mask_any(&state->regs);
+
+  if (holds != state->holds_taint) {
+    state->holds_taint = holds;
+    dr_atomic_add32_return_sum(&taint_holders, holds ? 1 : -1);
+  }
+
+  if (taint_idle_budget) {
+    if (tainted_mems.size() != tainted_bytes ||
+        memcmp(&regs_before, &state->regs, sizeof(regs_before))) {
+      quiet_insns = 0;
+    } else {
+      quiet_insns++;
+    }
+  }
+
+  check_taint_liveness();
+
+  if (stats->propagated != propagated) {
+    uint64_t regs = 0;
+
+    for (size_t i = 0; i < SL2_REG_TAINT_WORDS; i++) {
+      regs += __popcnt64(state->regs.bits[i]);
+    }
+
+    stats->peak_tainted_regs = (std::max)(stats->peak_tainted_regs, regs);
+    stats->peak_tainted_bytes =
+        (std::max)(stats->peak_tainted_bytes, (uint64_t)tainted_mems.size());
+  }
+
+  stats->propagation_ticks += __rdtsc() - start;
+}
+
+/** Called upon basic block insertion with each individual instruction as an argument.
+    Inserts a clean call to propagate_taint before every instruction, passing it the instruction's
+    taint descriptor so that the instruction doesn't need to be decoded again when it runs.
+    Until taint is introduced, the clean call is skipped by an inline check of taint_live, so that
+    everything before the targeted read runs without paying for one. The same goes for everything
+    after taint dies out, until the next targeted read. */
+static dr_emit_flags_t on_bb_instrument(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
                                         bool for_trace, bool translating, void *user_data) {
   if (!instr_is_app(instr))
     return DR_EMIT_DEFAULT;
 
+  // Calls out of the taint scope are summarized (see summarize_call), not traced.
+  if (!in_taint_scope(instr_get_app_pc(instr))) {
+    return DR_EMIT_DEFAULT;
+  }
+
+  // The store of a vector copy is handled along with its load.
+  instr_t *prev = instr_get_prev_app(instr);
+  if (prev && is_vector_copy(prev, instr) && in_taint_scope(instr_get_app_pc(prev))) {
+    return DR_EMIT_DEFAULT;
+  }
+
+  SL2_PROFILE(SL2_PROBE_BB_INSTRUMENT);
+  sl2_taint_insn *insn = get_taint_insn(instr);
+
   /* Clean call propagate taint on each instruction. Should be side-effect free
       http://dynamorio.org/docs/dr__ir__utils_8h.html#ae7b7bd1e750b8a24ebf401fb6a6d6d5e */
   // TODO(ww): Replace this with instruction injection for performance?
-  dr_insert_clean_call(drcontext, bb, instr, propagate_taint, false, 1,
-                       OPND_CREATE_INTPTR(instr_get_app_pc(instr)));
+  if (taint_live) {
+    dr_insert_clean_call(drcontext, bb, instr, propagate_taint, false, 1,
+                         OPND_CREATE_INTPTR(insn));
+    return DR_EMIT_DEFAULT;
+  }
+
+  instr_t *skip = INSTR_CREATE_label(drcontext);
+
+  drreg_reserve_aflags(drcontext, bb, instr);
+
+  instrlist_meta_preinsert(
+      bb, instr,
+      INSTR_CREATE_cmp(drcontext, OPND_CREATE_ABSMEM((void *)&taint_live, OPSZ_1),
+                       OPND_CREATE_INT8(0)));
+  instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jz, opnd_create_instr(skip)));
+  dr_insert_clean_call(drcontext, bb, instr, propagate_taint, false, 1, OPND_CREATE_INTPTR(insn));
+  instrlist_meta_preinsert(bb, instr, skip);
+
+  drreg_unreserve_aflags(drcontext, bb, instr);
+
+  return DR_EMIT_DEFAULT;
+}
+
+/**
+ * Inserts the code that appends a value to one of the current thread's history rings.
+ * @param value a register holding the value, or DR_REG_NULL to append `pc` instead
+ * @param pc the value to append, if `value` is DR_REG_NULL
+ * @param pos_offset the offset of the ring's position within sl2_history
+ * @param ring_offset the offset of the ring within sl2_history
+ */
+static void insert_history_append(void *drcontext, instrlist_t *bb, instr_t *where, reg_id_t value,
+                                  app_pc pc, int pos_offset, int ring_offset) {
+  reg_id_t history, pos;
+
+  if (drreg_reserve_register(drcontext, bb, where, NULL, &history) != DRREG_SUCCESS ||
+      drreg_reserve_register(drcontext, bb, where, NULL, &pos) != DRREG_SUCCESS) {
+    DR_ASSERT(false);
+  }
+
+  drmgr_insert_read_tls_field(drcontext, history_tls_idx, bb, where, history);
+  instrlist_meta_preinsert(bb, where,
+                           INSTR_CREATE_movzx(drcontext, opnd_create_reg(reg_64_to_32(pos)),
+                                              OPND_CREATE_MEM8(history, pos_offset)));
+
+  if (value != DR_REG_NULL) {
+    instrlist_meta_preinsert(
+        bb, where,
+        INSTR_CREATE_mov_st(
+            drcontext, opnd_create_base_disp(history, pos, sizeof(app_pc), ring_offset, OPSZ_8),
+            opnd_create_reg(value)));
+  } else {
+    // There's no 64-bit immediate store, so the address goes in as two halves.
+    instrlist_meta_preinsert(
+        bb, where,
+        INSTR_CREATE_mov_st(
+            drcontext, opnd_create_base_disp(history, pos, sizeof(app_pc), ring_offset, OPSZ_4),
+            OPND_CREATE_INT32((int)(ptr_uint_t)pc)));
+    instrlist_meta_preinsert(
+        bb, where,
+        INSTR_CREATE_mov_st(
+            drcontext, opnd_create_base_disp(history, pos, sizeof(app_pc), ring_offset + 4, OPSZ_4),
+            OPND_CREATE_INT32((int)((ptr_uint_t)pc >> 32))));
+  }
+
+  // Advance the position without touching the flags, letting it wrap at 256.
+  instrlist_meta_preinsert(
+      bb, where,
+      INSTR_CREATE_lea(drcontext, opnd_create_reg(pos),
+                       opnd_create_base_disp(pos, DR_REG_NULL, 0, 1, OPSZ_lea)));
+  instrlist_meta_preinsert(bb, where,
+                           INSTR_CREATE_mov_st(drcontext, OPND_CREATE_MEM8(history, pos_offset),
+                                               opnd_create_reg(reg_resize_to_opsz(pos, OPSZ_1))));
+
+  if (drreg_unreserve_register(drcontext, bb, where, pos) != DRREG_SUCCESS ||
+      drreg_unreserve_register(drcontext, bb, where, history) != DRREG_SUCCESS) {
+    DR_ASSERT(false);
+  }
+}
+
+/**
+ * Records the history of the target executable with a few inline instructions: the start of each
+ * block, and the memory operand of each indirect call through memory. Unlike taint propagation,
+ * this runs even with -nt.
+ */
+static dr_emit_flags_t on_bb_history(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
+                                     bool for_trace, bool translating, void *user_data) {
+  if (!instr_is_app(instr)) {
+    return DR_EMIT_DEFAULT;
+  }
+
+  app_pc pc = instr_get_app_pc(instr);
+
+  if (pc <= module_start || pc >= module_end) {
+    return DR_EMIT_DEFAULT;
+  }
+
+  if (drmgr_is_first_instr(drcontext, instr)) {
+    insert_history_append(drcontext, bb, instr, DR_REG_NULL, pc, offsetof(sl2_history, block_pos),
+                          offsetof(sl2_history, blocks));
+  }
+
+  if (instr_is_call(instr) && opnd_is_memory_reference(instr_get_target(instr))) {
+    reg_id_t addr, scratch;
+
+    if (drreg_reserve_register(drcontext, bb, instr, NULL, &addr) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, NULL, &scratch) != DRREG_SUCCESS) {
+      DR_ASSERT(false);
+    }
+
+    if (drutil_insert_get_mem_addr(drcontext, bb, instr, instr_get_target(instr), addr, scratch)) {
+      drreg_unreserve_register(drcontext, bb, instr, scratch);
+      insert_history_append(drcontext, bb, instr, addr, NULL, offsetof(sl2_history, call_pos),
+                            offsetof(sl2_history, calls));
+    } else {
+      drreg_unreserve_register(drcontext, bb, instr, scratch);
+    }
+
+    drreg_unreserve_register(drcontext, bb, instr, addr);
+  }
+
+  return DR_EMIT_DEFAULT;
+}
+
+static void on_thread_init(void *drcontext) {
+  SL2_DR_DEBUG("tracer#on_thread_init\n");
+  thread_taint(drcontext);
+
+  sl2_history *history = (sl2_history *)sl2_thread_alloc(drcontext, sizeof(sl2_history));
+  memset(history, 0, sizeof(sl2_history));
+  drmgr_set_tls_field(drcontext, history_tls_idx, history);
+}
+
+static void on_thread_exit(void *drcontext) {
+  SL2_DR_DEBUG("tracer#on_thread_exit\n");
+
+  sl2_thread_taint *state =
+      (sl2_thread_taint *)drmgr_get_tls_field(drcontext, thread_taint_tls_idx);
+
+  if (state) {
+    fold_thread_stats(&state->stats);
+
+    if (state->holds_taint) {
+      dr_atomic_add32_return_sum(&taint_holders, -1);
+    }
+
+    dr_thread_free(drcontext, state, sizeof(sl2_thread_taint));
+    drmgr_set_tls_field(drcontext, thread_taint_tls_idx, NULL);
+  }
+
+  sl2_history *history = (sl2_history *)drmgr_get_tls_field(drcontext, history_tls_idx);
+
+  if (history) {
+    dr_thread_free(drcontext, history, sizeof(sl2_history));
+    drmgr_set_tls_field(drcontext, history_tls_idx, NULL);
+  }
+}
+
+/**
+ * Adds the tracer's overhead counters to its exit event.
+ * propagation_ms is summed across threads, so it can exceed elapsed_ms when several
+ * threads propagate taint at once. native_ms is whatever is left of elapsed_ms, which includes
+ * DynamoRIO's own overhead.
+ * @param ev the exit event
+ */
+static void emit_stats(sl2_event *ev) {
+  void *drcontext = dr_get_current_drcontext();
+  sl2_thread_taint *state =
+      (sl2_thread_taint *)drmgr_get_tls_field(drcontext, thread_taint_tls_idx);
+
+  // The exiting thread's exit event may not have run yet.
+  if (state) {
+    fold_thread_stats(&state->stats);
+  }
+
+  uint64_t elapsed_ms = dr_get_milliseconds() - start_ms;
+  uint64_t elapsed_ticks = __rdtsc() - start_ticks;
+  uint64_t propagation_ms = 0;
+
+  if (elapsed_ticks) {
+    propagation_ms =
+        (uint64_t)((double)tracer_stats.propagation_ticks * elapsed_ms / elapsed_ticks);
+  }
+
+  sl2_event_uint(ev, "clean_calls", tracer_stats.clean_calls);
+  sl2_event_uint(ev, "propagated", tracer_stats.propagated);
+  sl2_event_uint(ev, "decoded", decoded_insns);
+  sl2_event_uint(ev, "peak_tainted_bytes", tracer_stats.peak_tainted_bytes);
+  sl2_event_uint(ev, "peak_tainted_regs", tracer_stats.peak_tainted_regs);
+  sl2_event_uint(ev, "taint_idles", taint_idles);
+  sl2_event_uint(ev, "elapsed_ms", elapsed_ms);
+  sl2_event_uint(ev, "propagation_ms", propagation_ms);
+  sl2_event_uint(ev, "native_ms", elapsed_ms - (std::min)(elapsed_ms, propagation_ms));
+}
+
+/**
+ * Reports the instruction counts of each module that we executed clean calls in, as one
+ * "tracer_module" event per module (since all of them may not fit in a single event).
+ */
+static void emit_module_stats() {
+  for (int i = 0; i <= SL2_STATS_MODULES; i++) {
+    if (!tracer_stats.module_insns[i] || (i < SL2_STATS_MODULES && i >= stats_module_count)) {
+      continue;
+    }
+
+    sl2_event ev;
+    sl2_event_begin(&ev, "tracer_module");
+    sl2_event_str(&ev, "run_id", run_id_s.c_str());
+    sl2_event_str(&ev, "module", i < SL2_STATS_MODULES ? stats_modules[i].name : "<other>");
+    sl2_event_uint(&ev, "insns", tracer_stats.module_insns[i]);
+    client.emit_event(&ev);
+  }
+}
+
+/** Reports whether the current run's replay crashed, along with the overhead counters for it */
+static void report_replay() {
+  sl2_event ev;
+  sl2_event_begin(&ev, NULL);
+  sl2_event_bool(&ev, "success", crashed);
+  sl2_event_str(&ev, "run_id", run_id_s.c_str());
+
+  if (!crashed) {
+    SL2_DR_DEBUG("tracer#report_replay: target did NOT crash on replay!\n");
+
+    sl2_event_str(&ev, "message", "replay did not cause a crash");
+  } else {
+    sl2_event_str(&ev, "message", "replay caused a crash");
+  }
+
+  emit_stats(&ev);
+  client.emit_event(&ev);
+  emit_module_stats();
+}
+
+/** Clean up registered callbacks before exiting */
+static void on_dr_exit(void) {
+  SL2_DR_DEBUG("tracer#on_dr_exit: cleaning up and exiting.\n");
+
+  report_replay();
+  client.exit_profile();
+  sl2_etw_unregister();
+
+  if (!op_no_taint.get_value()) {
+    if (!drmgr_unregister_bb_insertion_event(on_bb_instrument)) {
+      DR_ASSERT(false);
+    }
+  }
+
+  if (!drmgr_unregister_thread_init_event(on_thread_init) ||
+      !drmgr_unregister_thread_exit_event(on_thread_exit) ||
+      !drmgr_unregister_bb_insertion_event(on_bb_history) ||
+      !drmgr_unregister_tls_field(thread_taint_tls_idx) ||
+      !drmgr_unregister_tls_field(history_tls_idx) || drreg_exit() != DRREG_SUCCESS) {
+    DR_ASSERT(false);
+  }
+
+  sl2_conn_close(&sl2_conn);
+
+  if (journal_view) {
+    dr_unmap_file(journal_view, journal_view_size);
+  }
+
+  free_taint_insns();
+  dr_mutex_destroy(stats_lock);
+  taint_models.clear();
+  dr_mutex_destroy(taint_models_lock);
+  dr_mutex_destroy(taint_live_lock);
+  tainted_mems.reset();
+  mem_labels.reset();
+  taint_labels.reset();
+  client.exit_events();
+  client.exit_handle_cache();
+  client.exit_read_info_pool();
+
+  drutil_exit();
+  drmgr_exit();
+
+  // The containers that are still alive keep their nodes until they're destroyed.
+  sl2_region_release(sl2_global_region());
+}
+
+/** Debug functionality. If you need to use it, add the relevant print statements */
+static void dump_regs(void *drcontext, app_pc exception_address) {
+  reg_id_t regs[16] = {
+      DR_REG_RAX, DR_REG_RBX, DR_REG_RCX, DR_REG_RDX, DR_REG_RSP, DR_REG_RBP,
+      DR_REG_RSI, DR_REG_RDI, DR_REG_R8,  DR_REG_R9,  DR_REG_R10, DR_REG_R11,
+      DR_REG_R12, DR_REG_R13, DR_REG_R14, DR_REG_R15,
+  };
+
+  tainted_mems.for_each_range([](uint64_t start, uint64_t size) {
+    // TODO(ww): Implement.
+  });
+
+  for (int i = 0; i < 16; i++) {
+    bool tainted = reg_is_tainted(drcontext, regs[i]);
+    dr_mcontext_t mc = {sizeof(mc), DR_MC_ALL};
+    dr_get_mcontext(drcontext, &mc);
+    if (tainted) {
+      // TODO(ww): Implement.
+    } else {
+      // TODO(ww): Implement.
+    }
+  }
+
+  bool tainted = reg_is_tainted(drcontext, DR_REG_NULL);
+  if (tainted) {
+    // TODO(ww): Implement.
+  } else {
+    // TODO(ww): Implement.
+  }
+}
+
+/** Get crash info as JSON for dumping to stderr */
+/**
+ * Reads the most recent indirect call targets out of a thread's history.
+ * @param history the thread's history
+ * @param calls where to put them, oldest first
+ * @param count the most to read (no more than SL2_HISTORY_LEN)
+ * @return the number read
+ */
+static size_t history_calls(sl2_history *history, app_pc *calls, size_t count) {
+  size_t found = 0;
+
+  for (size_t i = 0; history && i < count; i++) {
+    app_pc call = history->calls[(uint8_t)(history->call_pos - count + i)];
+
+    if (call) {
+      calls[found++] = call;
+    }
+  }
+
+  return found;
+}
+
+/**
+ * Works out the most recent instructions that a thread executed in the target executable, by
+ * decoding forward from the start of each of its most recent blocks: to the crashing
+ * instruction for the block that crashed, and to the end of the block for the others.
+ * @param history the thread's history
+ * @param crash_pc the crashing instruction
+ * @param insns where to put them, oldest first
+ * @param count the most to find (no more than SL2_HISTORY_LEN)
+ * @return the number found
+ */
+static size_t history_insns(void *drcontext, sl2_history *history, app_pc crash_pc, app_pc *insns,
+                            size_t count) {
+  app_pc block_insns[SL2_HISTORY_LEN];
+  size_t found = 0;
+
+  if (!history) {
+    return 0;
+  }
+
+  // Walk the blocks from newest to oldest, filling `insns` from the back.
+  for (size_t b = 0; b < SL2_HISTORY_LEN && found < count; b++) {
+    app_pc pc = history->blocks[(uint8_t)(history->block_pos - 1 - b)];
+    size_t block_len = 0;
+
+    if (!pc) {
+      break;
+    }
+
+    while (block_len < SL2_HISTORY_LEN && dr_memory_is_readable(pc, 1)) {
+      instr_t instr;
+      instr_init(drcontext, &instr);
+      app_pc next = decode(drcontext, pc, &instr);
+      bool is_cti = instr_is_cti(&instr);
+      instr_free(drcontext, &instr);
+
+      if (!next) {
+        break;
+      }
+
+      block_insns[block_len++] = pc;
+
+      if (is_cti || (b == 0 && pc == crash_pc)) {
+        break;
+      }
+
+      pc = next;
+    }
+
+    for (size_t i = block_len; i > 0 && found < count; i--) {
+      insns[count - 1 - found++] = block_insns[i - 1];
+    }
+  }
+
+  memmove(insns, insns + (count - found), found * sizeof(app_pc));
+  return found;
+}
+
+/**
+ * @param label a label
+ * @return the input offsets that the label stands for, as JSON
+ */
+static json label_to_json(uint32_t label) {
+  json offsets = json::array();
+  sl2_label decoded;
+
+  taint_labels.decode(label, &decoded);
+
+  for (uint32_t i = 0; i < decoded.count; i++) {
+    sl2_label_span *span = &decoded.spans[i];
+    offsets.push_back(
+        {{"buffer", span->buffer}, {"start", span->start}, {"size", span->end - span->start + 1}});
+  }
+
+  return offsets;
+}
+
+/**
+ * In label mode, works out which input offsets reach the crash: the crashing PC, the crashing
+ * instruction's operands, and the registers that its memory references are computed from.
+ * @return the offsets, along with the buffers that they're offsets into, as JSON
+ */
+static json crash_labels(void *drcontext, dr_exception_t *excpt) {
+  sl2_thread_taint *state = thread_taint(drcontext);
+  app_pc exception_address = (app_pc)excpt->record->ExceptionAddress;
+  uint32_t operands = SL2_LABEL_NONE;
+  uint32_t address = SL2_LABEL_NONE;
+  json labels;
+
+  labels["buffers"] = json::array();
+  for (int i = 0; i < label_buffer_count && i < SL2_LABEL_MAX_BUFFERS; i++) {
+    sl2_label_buffer *buffer = &label_buffers[i];
+
+    labels["buffers"].push_back({{"index", i},
+                                 {"func_name", client.function_to_string(buffer->function)},
+                                 {"size", buffer->size},
+                                 {"position", buffer->position}});
+  }
+
+  if (dr_memory_is_readable(exception_address, 1)) {
+    instr_t instr;
+    instr_init(drcontext, &instr);
+
+    if (decode(drcontext, exception_address, &instr)) {
+      int src_count = instr_num_srcs(&instr);
+
+      for (int i = 0; i < src_count + instr_num_dsts(&instr); i++) {
+        opnd_t opnd =
+            i < src_count ? instr_get_src(&instr, i) : instr_get_dst(&instr, i - src_count);
+        sl2_taint_opnd desc = {0};
+
+        if (!opnd_carries_taint(opnd)) {
+          continue;
+        }
+
+        describe_taint_opnd(opnd, &desc);
+        operands = taint_labels.join(operands, taint_opnd_label(state, excpt->mcontext, &desc));
+
+        if (desc.is_mem && desc.base != DR_REG_NULL) {
+          address = taint_labels.join(address, reg_label(state, desc.base));
+        }
+
+        if (desc.is_mem && desc.index != DR_REG_NULL) {
+          address = taint_labels.join(address, reg_label(state, desc.index));
+        }
+      }
+    }
+
+    instr_free(drcontext, &instr);
+  }
+
+  labels["pc"] = label_to_json(reg_label(state, reg_to_full_width64(DR_REG_NULL)));
+  labels["operands"] = label_to_json(operands);
+  labels["address"] = label_to_json(address);
+
+  return labels;
+}
+
+/**
+ * Appends a section to a crash record, padded to an 8-byte boundary.
+ * @param out the record so far
+ * @param id the section
+ * @param data the section's contents
+ * @param size the size of the section's contents
+ */
+static void crash_record_section(std::vector<uint8_t> &out, sl2_crash_record_section_id id,
+                                 const void *data, size_t size) {
+  size_t offset = out.size();
+  sl2_crash_record *record = (sl2_crash_record *)out.data();
+
+  record->sections[id].offset = (uint32_t)offset;
+  record->sections[id].size = (uint32_t)size;
+
+  out.resize(offset + ((size + 7) & ~(size_t)7));
+  if (size) {
+    memcpy(out.data() + offset, data, size);
+  }
+}
+
+/**
+ * Builds the crash record (see sl2_crash_record.hpp) for the triager and the harness.
+ * @return the record
+ */
+static std::vector<uint8_t> crash_record(void *drcontext, uint8_t score, std::string reason,
+                                         dr_exception_t *excpt, std::string disassembly,
+                                         uint16_t flags) {
+  DWORD exception_code = excpt->record->ExceptionCode;
+  app_pc exception_address = (app_pc)excpt->record->ExceptionAddress;
+  std::vector<uint8_t> out(sizeof(sl2_crash_record), 0);
+  sl2_crash_record header = {0};
+
+  header.magic = SL2_CRASH_RECORD_MAGIC;
+  header.version = SL2_CRASH_RECORD_VERSION;
+  header.flags = flags;
+  header.score = score;
+  header.exception_code = exception_code;
+  header.location = (uint64_t)exception_address;
+
+  reg_id_t regs[SL2_CRASH_RECORD_REGS - 1] = {
+      DR_REG_RAX, DR_REG_RBX, DR_REG_RCX, DR_REG_RDX, DR_REG_RSP, DR_REG_RBP,
+      DR_REG_RSI, DR_REG_RDI, DR_REG_R8,  DR_REG_R9,  DR_REG_R10, DR_REG_R11,
+      DR_REG_R12, DR_REG_R13, DR_REG_R14, DR_REG_R15,
+  };
+  json reg_offsets = json::object();
+
+  for (int i = 0; i < SL2_CRASH_RECORD_REGS - 1; i++) {
+    header.regs[i] = reg_get_value(regs[i], excpt->mcontext);
+    header.reg_taint |= (uint32_t)reg_is_tainted(drcontext, regs[i]) << i;
+
+    if (labels_on) {
+      reg_offsets[get_register_name(regs[i])] =
+          label_to_json(reg_label(thread_taint(drcontext), regs[i]));
+    }
+  }
+
+  header.regs[SL2_CRASH_RECORD_REGS - 1] = (uint64_t)exception_address;
+  header.reg_taint |= (uint32_t)reg_is_tainted(drcontext, DR_REG_NULL)
+                      << (SL2_CRASH_RECORD_REGS - 1);
+
+  // last_calls and last_insns are always LAST_COUNT long (oldest first, zero-padded),
+  // since the database expects them to be; anything more goes in the history sections.
+  // The parentheses keep windows.h's min and max macros out of the way.
+  sl2_history *history = (sl2_history *)drmgr_get_tls_field(drcontext, history_tls_idx);
+  size_t history_len = (std::min)((size_t)op_history.get_value(), (size_t)SL2_HISTORY_LEN);
+  size_t wanted = (std::max)(history_len, (size_t)LAST_COUNT);
+  size_t last_count = LAST_COUNT;
+  app_pc calls[SL2_HISTORY_LEN] = {0};
+  app_pc insns[SL2_HISTORY_LEN] = {0};
+  size_t call_count = history_calls(history, calls, wanted);
+  size_t insn_count = history_insns(drcontext, history, exception_address, insns, wanted);
+  size_t last_calls = (std::min)(call_count, last_count);
+  size_t last_insns = (std::min)(insn_count, last_count);
+
+  for (size_t i = 0; i < last_calls; i++) {
+    header.last_calls[last_count - last_calls + i] = (uint64_t)calls[call_count - last_calls + i];
+  }
+
+  for (size_t i = 0; i < last_insns; i++) {
+    header.last_insns[last_count - last_insns + i] = (uint64_t)insns[insn_count - last_insns + i];
+  }
+
+  memcpy(out.data(), &header, sizeof(header));
+
+  std::string exception = client.exception_to_string(exception_code);
+  crash_record_section(out, SL2_CRASH_SECTION_REASON, reason.data(), reason.size());
+  crash_record_section(out, SL2_CRASH_SECTION_EXCEPTION, exception.data(), exception.size());
+  crash_record_section(out, SL2_CRASH_SECTION_INSTRUCTION, disassembly.data(),
+                       disassembly.size());
+
+  if (history_len) {
+    size_t deep_calls = (std::min)(call_count, history_len);
+    size_t deep_insns = (std::min)(insn_count, history_len);
+
+    crash_record_section(out, SL2_CRASH_SECTION_HISTORY_CALLS, calls + call_count - deep_calls,
+                         deep_calls * sizeof(uint64_t));
+    crash_record_section(out, SL2_CRASH_SECTION_HISTORY_INSNS, insns + insn_count - deep_insns,
+                         deep_insns * sizeof(uint64_t));
+  }
+
+  std::vector<uint64_t> tainted;
+  tainted_mems.for_each_range([&tainted](uint64_t start, uint64_t size) {
+    tainted.push_back(start);
+    tainted.push_back(size);
+  });
+  crash_record_section(out, SL2_CRASH_SECTION_TAINTED, tainted.data(),
+                       tainted.size() * sizeof(uint64_t));
+
+  if (labels_on) {
+    json labels = crash_labels(drcontext, excpt);
+    labels["regs"] = reg_offsets;
+    labels["regs"]["rip"] = label_to_json(reg_label(thread_taint(drcontext), DR_REG_NULL));
+
+    std::string dumped = labels.dump();
+    crash_record_section(out, SL2_CRASH_SECTION_LABELS, dumped.data(), dumped.size());
+  }
+
+  ((sl2_crash_record *)out.data())->size = (uint32_t)out.size();
+
+  return out;
+}
+
+/**
+ * Queues up the readable parts of a range of application memory for the crash's minidump.
+ * @param start the start of the range
+ * @param size the size of the range
+ */
+static void add_dump_region(app_pc start, size_t size) {
+  app_pc end = start + size;
+  dr_mem_info_t mem;
+
+  // Wrapping around the top of the address space.
+  if (end < start) {
+    end = (app_pc)UINTPTR_MAX;
+  }
+
+  while (start < end && dr_query_memory_ex(start, &mem)) {
+    app_pc chunk_end = (std::min)(end, mem.base_pc + mem.size);
+
+    if (chunk_end <= start) {
+      break;
+    }
+
+    if (mem.type != DR_MEMTYPE_FREE && mem.type != DR_MEMTYPE_RESERVED &&
+        (mem.prot & DR_MEMPROT_READ) && !(mem.prot & DR_MEMPROT_GUARD) &&
+        !dr_memory_is_dr_internal(mem.base_pc) && !dr_memory_is_in_client(mem.base_pc)) {
+      for (app_pc pc = start; pc < chunk_end;) {
+        ULONG len = (ULONG)(std::min)((size_t)(chunk_end - pc), (size_t)ULONG_MAX);
+        dump_regions.push_back({(uint64_t)pc, len});
+        pc += len;
+      }
+    }
+
+    start = chunk_end;
+  }
+}
+
+/**
+ * Collects the memory that the dump policy adds to the crash's minidump: the memory around each
+ * of the crashing thread's registers (and with it, the instructions around the crash) and, with
+ * the 'tainted' policy, every tainted range.
+ * Must be called in DR's state, since it reads the taint map.
+ */
+static void collect_dump_regions() {
+  const CONTEXT &ctx = trace_exception_ctx.thread_ctx;
+  const DWORD64 regs[] = {ctx.Rax, ctx.Rbx, ctx.Rcx, ctx.Rdx, ctx.Rsi, ctx.Rdi,
+                          ctx.Rbp, ctx.Rsp, ctx.R8,  ctx.R9,  ctx.R10, ctx.R11,
+                          ctx.R12, ctx.R13, ctx.R14, ctx.R15, ctx.Rip};
+
+  dump_regions.clear();
+  dump_region_next = 0;
+
+  for (DWORD64 reg : regs) {
+    DWORD64 start = reg < SL2_DUMP_REG_WINDOW ? 0 : reg - SL2_DUMP_REG_WINDOW;
+    add_dump_region((app_pc)start, (size_t)(reg - start + SL2_DUMP_REG_WINDOW));
+  }
 
-  return DR_EMIT_DEFAULT;
+  if (dump_policy == SL2_DUMP_TAINTED) {
+    tainted_mems.for_each_range(
+        [](uint64_t start, uint64_t size) { add_dump_region((app_pc)start, (size_t)size); });
+  }
 }
 
-static void on_thread_init(void *drcontext) {
-  SL2_DR_DEBUG("tracer#on_thread_init\n");
-}
+/**
+ * Feeds the regions from collect_dump_regions to MiniDumpWriteDump, one per MemoryCallback.
+ * Everything else (threads, modules) is left at MiniDumpWriteDump's defaults.
+ * This runs in the application's state, so it mustn't allocate.
+ */
+static BOOL CALLBACK dump_memory_callback(PVOID param, const PMINIDUMP_CALLBACK_INPUT input,
+                                          PMINIDUMP_CALLBACK_OUTPUT output) {
+  switch (input->CallbackType) {
+  case MemoryCallback:
+    if (dump_region_next >= dump_regions.size()) {
+      return FALSE;
+    }
 
-static void on_thread_exit(void *drcontext) {
-  SL2_DR_DEBUG("tracer#on_thread_exit\n");
+    output->MemoryBase = dump_regions[dump_region_next].base;
+    output->MemorySize = dump_regions[dump_region_next].size;
+    dump_region_next++;
+    return TRUE;
+  case CancelCallback:
+    output->Cancel = FALSE;
+    output->CheckCancel = FALSE;
+    return TRUE;
+  default:
+    return TRUE;
+  }
 }
 
-/** Clean up registered callbacks before exiting */
-static void on_dr_exit(void) {
-  json j;
-  j["success"] = crashed;
-  j["run_id"] = run_id_s;
+/**
+ * Moves on to the next run of the batch (see op_runs): binds a fresh connection to it, and drops
+ * everything that the last run's replay left behind. Must be called on the looping thread.
+ * @param drcontext the looping thread's DR context
+ * @return whether there was another run to replay
+ */
+static bool next_replay(void *drcontext) {
+  if (batch.next >= batch.run_ids.size()) {
+    return false;
+  }
 
-  SL2_DR_DEBUG("tracer#on_dr_exit: cleaning up and exiting.\n");
+  report_replay();
 
-  if (!crashed) {
-    SL2_DR_DEBUG("tracer#on_dr_exit: target did NOT crash on replay!\n");
+  run_id_s = batch.run_ids[batch.next++];
+  UUID run_id;
+  sl2_string_to_uuid(run_id_s.c_str(), &run_id);
 
-    j["message"] = "replay did not cause a crash";
-  } else {
-    j["message"] = "replay caused a crash";
-  }
+  SL2_DR_DEBUG("tracer#next_replay: replaying %s (%d of %d)\n", run_id_s.c_str(), batch.next + 1,
+               batch.run_ids.size() + 1);
 
-  SL2_LOG_JSONL(j);
+  // A session stays bound to the run that it began with, so the next run gets one of
+  // its own.
+  sl2_conn_close(&sl2_conn);
 
-  if (!op_no_taint.get_value()) {
-    if (!drmgr_unregister_bb_insertion_event(on_bb_instrument)) {
-      DR_ASSERT(false);
-    }
+  if (sl2_conn_open(&sl2_conn) != SL2Response::OK) {
+    SL2_DR_DEBUG("tracer#next_replay: couldn't reopen a connection to the server!\n");
+    dr_abort();
   }
 
-  if (!drmgr_unregister_thread_init_event(on_thread_init) ||
-      !drmgr_unregister_thread_exit_event(on_thread_exit) || drreg_exit() != DRREG_SUCCESS) {
-    DR_ASSERT(false);
+  if (op_profile.get_value() || op_alloc_steady.get_value()) {
+    sl2_conn_set_profile_hook(&sl2_conn, sl2_profile_request);
   }
 
-  sl2_conn_close(&sl2_conn);
-
-  drmgr_exit();
-}
+  sl2_conn_assign_run_id(&sl2_conn, run_id);
+  sl2_conn_register_pid(&sl2_conn, dr_get_process_id(), true);
 
-/** Debug functionality. If you need to use it, add the relevant print statements */
-static void dump_regs(void *drcontext, app_pc exception_address) {
-  reg_id_t regs[16] = {
-      DR_REG_RAX, DR_REG_RBX, DR_REG_RCX, DR_REG_RDX, DR_REG_RSP, DR_REG_RBP,
-      DR_REG_RSI, DR_REG_RDI, DR_REG_R8,  DR_REG_R9,  DR_REG_R10, DR_REG_R11,
-      DR_REG_R12, DR_REG_R13, DR_REG_R14, DR_REG_R15,
-  };
+  const std::string &first_dir = op_run_dir.get_value();
+  size_t sep = first_dir.find_last_of("\\/");
+  replay_run_dir = first_dir == "" ? "" : first_dir.substr(0, sep + 1) + run_id_s;
 
-  std::set<reg_id_t>::iterator reg_it;
-  for (reg_it = tainted_regs.begin(); reg_it != tainted_regs.end(); reg_it++) {
-    // TODO(ww): Implement.
+  if (journal_view) {
+    dr_unmap_file(journal_view, journal_view_size);
+    journal_view = NULL;
   }
+  journal_mapped = false;
 
-  std::set<app_pc>::iterator mem_it;
-  for (mem_it = tainted_mems.begin(); mem_it != tainted_mems.end(); mem_it++) {
-    // TODO(ww): Implement.
-  }
+  dr_mutex_lock(mutatex);
+  mutate_count = 0;
+  crashed = false;
+  dr_mutex_unlock(mutatex);
 
-  for (int i = 0; i < 16; i++) {
-    bool tainted = tainted_regs.find(regs[i]) != tainted_regs.end();
-    dr_mcontext_t mc = {sizeof(mc), DR_MC_ALL};
-    dr_get_mcontext(drcontext, &mc);
-    if (tainted) {
-      // TODO(ww): Implement.
-    } else {
-      // TODO(ww): Implement.
-    }
+  // Drop the last run's taint. Other threads drop their registers' the next time that they look.
+  dr_mutex_lock(taint_live_lock);
+  tainted_mems.reset();
+  mem_labels.reset();
+  taint_labels.reset();
+  taint_labels.init();
+  label_buffer_count = 0;
+  taint_holders = 0;
+  quiet_insns = 0;
+  replay_epoch++;
+
+  if (taint_live) {
+    taint_live = 0;
+    dr_delay_flush_region(NULL, ~(size_t)0, 0, NULL);
   }
 
-  bool tainted = tainted_regs.find(DR_REG_NULL) != tainted_regs.end();
-  if (tainted) {
-    // TODO(ww): Implement.
-  } else {
-    // TODO(ww): Implement.
+  dr_mutex_unlock(taint_live_lock);
+
+  sl2_history *history = (sl2_history *)drmgr_get_tls_field(drcontext, history_tls_idx);
+
+  if (history) {
+    memset(history, 0, sizeof(sl2_history));
   }
+
+  dr_mutex_lock(stats_lock);
+  memset(&tracer_stats, 0, sizeof(tracer_stats));
+  taint_idles = 0;
+  dr_mutex_unlock(stats_lock);
+
+  start_ticks = __rdtsc();
+  start_ms = dr_get_milliseconds();
+
+  return true;
 }
 
-/** Get crash info as JSON for dumping to stderr */
-std::string dump_json(void *drcontext, uint8_t score, std::string reason, dr_exception_t *excpt,
-                      std::string disassembly, bool pc_tainted, bool stack_tainted, bool is_ret,
-                      bool is_indirect, bool is_direct, bool is_call, bool mem_write, bool mem_read,
-                      bool tainted_src, bool tainted_dst) {
-  DWORD exception_code = excpt->record->ExceptionCode;
-  app_pc exception_address = (app_pc)excpt->record->ExceptionAddress;
+/**
+ * Points a context at the top of the persistent target, with its stack as it was on the target's
+ * first entry. wrap_pre_persist_target restores the target's arguments once it gets there.
+ * @param mc the context to redirect
+ */
+static void restart_persist_target(dr_mcontext_t *mc) {
+  size_t written = 0;
 
-  json j;
-
-  j["score"] = score;
-  j["reason"] = reason;
-  j["exception"] = client.exception_to_string(exception_code);
-  j["location"] = (uint64_t)exception_address;
-  j["instruction"] = disassembly;
-  j["pc_tainted"] = pc_tainted;
-  j["stack_tainted"] = stack_tainted;
-  j["is_ret"] = is_ret;
-  j["is_indirect"] = is_indirect;
-  j["is_direct"] = is_direct;
-  j["is_call"] = is_call;
-  j["mem_write"] = mem_write;
-  j["mem_read"] = mem_read;
-  j["tainted_src"] = tainted_src;
-  j["tainted_dst"] = tainted_dst;
-
-  j["regs"] = json::array();
-  reg_id_t regs[16] = {
-      DR_REG_RAX, DR_REG_RBX, DR_REG_RCX, DR_REG_RDX, DR_REG_RSP, DR_REG_RBP,
-      DR_REG_RSI, DR_REG_RDI, DR_REG_R8,  DR_REG_R9,  DR_REG_R10, DR_REG_R11,
-      DR_REG_R12, DR_REG_R13, DR_REG_R14, DR_REG_R15,
-  };
+  // A smashed stack may have overwritten the return address, and the batch's last run
+  // still returns through it.
+  dr_safe_write((void *)batch.xsp, sizeof(batch.ret_addr), &batch.ret_addr, &written);
 
-  for (int i = 0; i < 16; i++) {
-    bool tainted = tainted_regs.find(regs[i]) != tainted_regs.end();
-    json reg = {{"reg", get_register_name(regs[i])},
-                {"value", reg_get_value(regs[i], excpt->mcontext)},
-                {"tainted", tainted}};
-    j["regs"].push_back(reg);
-  }
-
-  bool tainted = tainted_regs.find(DR_REG_NULL) != tainted_regs.end();
-  json rip = {{"reg", "rip"}, {"value", (uint64_t)exception_address}, {"tainted", tainted}};
-  j["regs"].push_back(rip);
-
-  j["last_calls"] = json::array();
-  for (int i = 0; i < LAST_COUNT; i++) {
-    int idx = last_call_idx + i;
-    idx %= LAST_COUNT;
-    j["last_calls"].push_back((uint64_t)last_calls[idx]);
-  }
-
-  j["last_insns"] = json::array();
-  for (int i = 0; i < LAST_COUNT; i++) {
-    int idx = last_insn_idx + i;
-    idx %= LAST_COUNT;
-    j["last_insns"].push_back((uint64_t)last_insns[idx]);
-  }
-
-  j["tainted_addrs"] = json::array();
-  if (tainted_mems.size() > 0) {
-    std::set<app_pc>::iterator mit = tainted_mems.begin();
-    uint64_t start = (uint64_t)*mit;
-    uint64_t size = 1;
-
-    mit++;
-    for (; mit != tainted_mems.end(); mit++) {
-      uint64_t curr = (uint64_t)*mit;
-      if (curr > (start + size)) {
-        json addr = {{"start", start}, {"size", size}};
-        j["tainted_addrs"].push_back(addr);
-
-        start = curr;
-        size = 0;
-      }
-      size++;
-    }
+  mc->xsp = batch.xsp;
+  mc->pc = batch.func_pc;
+  batch.redirected = true;
+}
 
-    json addr = {{"start", start}, {"size", size}};
-    j["tainted_addrs"].push_back(addr);
-  }
+/**
+ * Checks whether the batch can go on to its next run after a crash, by abandoning the crashed
+ * run's call to the persistent target: the crash has to have happened inside of the target, on
+ * the thread that loops it, and not from a corrupt heap or an exhausted stack, which the next run
+ * would inherit.
+ * @param drcontext the crashing thread's DR context
+ * @return whether the crash can be recovered from
+ */
+static bool replay_recoverable(void *drcontext) {
+  DWORD code = trace_exception_ctx.record.ExceptionCode;
 
-  return j.dump();
+  return batch.in_target && dr_get_thread_id(drcontext) == batch.thread_id &&
+         code != STATUS_HEAP_CORRUPTION && code != STATUS_STACK_BUFFER_OVERRUN &&
+         code != EXCEPTION_STACK_OVERFLOW;
 }
 
-/** Get Run ID and dump crash info into JSON file in the run folder. */
-static void dump_crash(void *drcontext, dr_exception_t *excpt, std::string reason, uint8_t score,
+/**
+ * Get Run ID and dump crash info into a crash record in the run folder. Then either exits, or
+ * (when the rest of a batch can be replayed after the crash) sends the crashing thread back to
+ * the top of the persistent target for the next run.
+ * @return what on_exception should return
+ */
+static bool dump_crash(void *drcontext, dr_exception_t *excpt, std::string reason, uint8_t score,
                        std::string disassembly, bool pc_tainted, bool stack_tainted, bool is_ret,
                        bool is_indirect, bool is_direct, bool is_call, bool mem_write,
                        bool mem_read, bool tainted_src, bool tainted_dst) {
   sl2_crash_paths crash_paths = {0};
-  std::string crash_json =
-      dump_json(drcontext, score, reason, excpt, disassembly, pc_tainted, stack_tainted, is_ret,
-                is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src, tainted_dst);
+  uint16_t flags = (pc_tainted ? SL2_CRASH_PC_TAINTED : 0) |
+                   (stack_tainted ? SL2_CRASH_STACK_TAINTED : 0) | (is_ret ? SL2_CRASH_IS_RET : 0) |
+                   (is_indirect ? SL2_CRASH_IS_INDIRECT : 0) |
+                   (is_direct ? SL2_CRASH_IS_DIRECT : 0) | (is_call ? SL2_CRASH_IS_CALL : 0) |
+                   (mem_write ? SL2_CRASH_MEM_WRITE : 0) | (mem_read ? SL2_CRASH_MEM_READ : 0) |
+                   (tainted_src ? SL2_CRASH_TAINTED_SRC : 0) |
+                   (tainted_dst ? SL2_CRASH_TAINTED_DST : 0);
+  std::vector<uint8_t> record = crash_record(drcontext, score, reason, excpt, disassembly, flags);
 
   if (replay) {
     sl2_conn_request_crash_paths(&sl2_conn, dr_get_process_id(), &crash_paths);
@@ -802,7 +2594,7 @@ static void dump_crash(void *drcontext, dr_exception_t *excpt, std::string reaso
     }
 
     DWORD txsize;
-    if (!WriteFile(dump_file, crash_json.c_str(), (DWORD)crash_json.length(), &txsize, NULL)) {
+    if (!WriteFile(dump_file, record.data(), (DWORD)record.size(), &txsize, NULL)) {
       SL2_DR_DEBUG("tracer#dump_crash: could not write to the crash file (GLE=%d)\n",
                    GetLastError());
       dr_abort();
@@ -827,19 +2619,48 @@ static void dump_crash(void *drcontext, dr_exception_t *excpt, std::string reaso
     mdump_info.ExceptionPointers = &exception_pointers;
     mdump_info.ClientPointers = true;
 
+    MINIDUMP_TYPE dump_type = MiniDumpNormal;
+    MINIDUMP_CALLBACK_INFORMATION callback = {0};
+    PMINIDUMP_CALLBACK_INFORMATION callback_ptr = NULL;
+
+    switch (dump_policy) {
+    case SL2_DUMP_FULL:
+      dump_type = MiniDumpWithFullMemory;
+      break;
+    case SL2_DUMP_REFERENCED:
+    case SL2_DUMP_TAINTED:
+      dump_type = MiniDumpWithIndirectlyReferencedMemory;
+      collect_dump_regions();
+      callback.CallbackRoutine = dump_memory_callback;
+      callback_ptr = &callback;
+      break;
+    default:
+      break;
+    }
+
     // NOTE(ww): Switching back to the application's state is necessary, as we don't want
     // parts of the instrumentation showing up in our memory dump.
     dr_switch_to_app_state(drcontext);
 
-    MiniDumpWriteDump(GetCurrentProcess(), GetCurrentProcessId(), hDumpFile, MiniDumpWithFullMemory,
-                      &mdump_info, NULL, NULL);
+    MiniDumpWriteDump(GetCurrentProcess(), GetCurrentProcessId(), hDumpFile, dump_type,
+                      &mdump_info, NULL, callback_ptr);
 
     dr_switch_to_dr_state(drcontext);
 
     CloseHandle(hDumpFile);
   }
 
+  if (replay_recoverable(drcontext)) {
+    batch.in_target = false;
+
+    if (next_replay(drcontext)) {
+      restart_persist_target(excpt->mcontext);
+      return false;
+    }
+  }
+
   dr_exit_process(1);
+  return true;
 }
 
 /** Scoring function. Checks exception code, then checks taint state in order to calculate the
@@ -856,10 +2677,21 @@ static bool on_exception(void *drcontext, dr_exception_t *excpt) {
   // Make our own copy of the exception record.
   memcpy(&(trace_exception_ctx.record), excpt->record, sizeof(EXCEPTION_RECORD));
 
+  app_pc crash_pc = (app_pc)excpt->record->ExceptionAddress;
+  module_data_t *crash_mod = dr_lookup_module(crash_pc);
+  const char *crash_mod_name = crash_mod ? dr_module_preferred_name(crash_mod) : NULL;
+
+  sl2_etw_crash(client.exception_to_string(exception_code), crash_mod_name ? crash_mod_name : "",
+                (uint64_t)(crash_mod ? crash_pc - crash_mod->start : crash_pc));
+
+  if (crash_mod) {
+    dr_free_module_data(crash_mod);
+  }
+
   reg_id_t reg_pc = reg_to_full_width64(DR_REG_NULL);
   reg_id_t reg_stack = reg_to_full_width64(DR_REG_ESP);
-  bool pc_tainted = tainted_regs.find(reg_pc) != tainted_regs.end();
-  bool stack_tainted = tainted_regs.find(reg_stack) != tainted_regs.end();
+  bool pc_tainted = reg_is_tainted(drcontext, reg_pc);
+  bool stack_tainted = reg_is_tainted(drcontext, reg_stack);
 
   // catch-all result
   app_pc exception_address = (app_pc)(excpt->record->ExceptionAddress);
@@ -876,8 +2708,8 @@ static bool on_exception(void *drcontext, dr_exception_t *excpt) {
       reason = "oob execution";
       score = 50;
     }
-    dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted, false,
-               false, false, false, false, false, false, false);
+    return dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted,
+                      false, false, false, false, false, false, false, false);
   }
 
   instr_t instr;
@@ -910,16 +2742,17 @@ static bool on_exception(void *drcontext, dr_exception_t *excpt) {
       reason = "illegal instruction";
       score = 50;
     }
-    dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted, false,
-               false, false, false, false, false, false, false);
+    return dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted,
+                      false, false, false, false, false, false, false, false);
   }
 
   // Divide by zero is probably not too bad
   if (exception_code == EXCEPTION_INT_DIVIDE_BY_ZERO) {
     reason = "divide by zero";
     score = 50;
-    dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted, is_ret,
-               is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src, tainted_dst);
+    return dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted,
+                      is_ret, is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src,
+                      tainted_dst);
   }
 
   // Breakpoints
@@ -927,8 +2760,9 @@ static bool on_exception(void *drcontext, dr_exception_t *excpt) {
   if (exception_code == EXCEPTION_BREAKPOINT) {
     reason = "breakpoint";
     score = 25;
-    dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted, is_ret,
-               is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src, tainted_dst);
+    return dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted,
+                      is_ret, is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src,
+                      tainted_dst);
   }
 
   // check branch
@@ -940,8 +2774,9 @@ static bool on_exception(void *drcontext, dr_exception_t *excpt) {
       reason = "branching";
       score = 25;
     }
-    dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted, is_ret,
-               is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src, tainted_dst);
+    return dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted,
+                      is_ret, is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src,
+                      tainted_dst);
   }
 
   // check ret
@@ -954,8 +2789,9 @@ static bool on_exception(void *drcontext, dr_exception_t *excpt) {
       score = 75;
     }
 
-    dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted, is_ret,
-               is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src, tainted_dst);
+    return dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted,
+                      is_ret, is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src,
+                      tainted_dst);
   }
 
   int src_count = instr_num_srcs(&instr);
@@ -984,8 +2820,9 @@ static bool on_exception(void *drcontext, dr_exception_t *excpt) {
       score = 50;
     }
 
-    dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted, is_ret,
-               is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src, tainted_dst);
+    return dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted,
+                      is_ret, is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src,
+                      tainted_dst);
   }
 
   // ditto, but for invalid reads
@@ -999,14 +2836,14 @@ static bool on_exception(void *drcontext, dr_exception_t *excpt) {
       score = 25;
     }
 
-    dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted, is_ret,
-               is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src, tainted_dst);
+    return dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted,
+                      is_ret, is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src,
+                      tainted_dst);
   }
 
-  dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted, is_ret,
-             is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src, tainted_dst);
-
-  return true;
+  return dump_crash(drcontext, excpt, reason, score, disassembly, pc_tainted, stack_tainted,
+                    is_ret, is_indirect, is_direct, is_call, mem_write, mem_read, tainted_src,
+                    tainted_dst);
 }
 
 /**
@@ -1037,6 +2874,27 @@ static void wrap_pre_VerifierStopMessage(void *wrapcxt, OUT void **user_data) {
   client.wrap_pre_VerifierStopMessage(wrapcxt, user_data, on_exception);
 }
 
+/**
+ * Transparent wrapper around SL2Client.wrap_pre_CloseHandle
+ */
+static void wrap_pre_CloseHandle(void *wrapcxt, OUT void **user_data) {
+  client.wrap_pre_CloseHandle(wrapcxt, user_data);
+}
+
+/**
+ * Transparent wrapper around SL2Client.wrap_pre_DuplicateHandle
+ */
+static void wrap_pre_DuplicateHandle(void *wrapcxt, OUT void **user_data) {
+  client.wrap_pre_DuplicateHandle(wrapcxt, user_data);
+}
+
+/**
+ * Transparent wrapper around SL2Client.wrap_post_DuplicateHandle
+ */
+static void wrap_post_DuplicateHandle(void *wrapcxt, void *user_data) {
+  client.wrap_post_DuplicateHandle(wrapcxt, user_data);
+}
+
 /*
 *
   Large block of pre-function callbacks that collect metadata about the target call
@@ -1120,8 +2978,148 @@ static void wrap_pre_MapViewOfFile(void *wrapcxt, OUT void **user_data) {
   client.wrap_pre_MapViewOfFile(wrapcxt, user_data);
 }
 
+/**
+ * In label mode, labels each byte of a targeted read's buffer with its offset into the buffer.
+ */
+static void label_buffer(client_read_info *info) {
+  if (!labels_on) {
+    return;
+  }
+
+  uint32_t index = (uint32_t)(dr_atomic_add32_return_sum(&label_buffer_count, 1) - 1);
+
+  if (index >= SL2_LABEL_MAX_BUFFERS) {
+    SL2_DR_DEBUG("tracer#label_buffer: too many targeted reads, not labelling the rest\n");
+    return;
+  }
+
+  label_buffers[index].function = info->function;
+  label_buffers[index].size = info->nNumberOfBytesToRead;
+  label_buffers[index].position = info->position;
+
+  mem_labels.set_bytes((app_pc)info->lpBuffer, info->nNumberOfBytesToRead, index, 0);
+}
+
+/**
+ * Maps a file for reading.
+ * @param path the file to map
+ * @param view_size receives the size of the mapping
+ * @param file_size receives the size of the file
+ * @return the mapping, or NULL if the file couldn't be opened or mapped (or is empty)
+ */
+static uint8_t *map_replay_file(const char *path, size_t *view_size, size_t *file_size) {
+  file_t file = dr_open_file(path, DR_FILE_READ);
+  uint64 size = 0;
+  uint8_t *view = NULL;
+
+  if (file == INVALID_FILE) {
+    return NULL;
+  }
+
+  if (dr_file_size(file, &size) && size > 0) {
+    *view_size = (size_t)size;
+    *file_size = (size_t)size;
+    view = (uint8_t *)dr_map_file(file, view_size, 0, NULL, DR_MEMPROT_READ, DR_MAP_PRIVATE);
+  }
+
+  // The mapping outlives the handle.
+  dr_close_file(file);
+
+  return view;
+}
+
+/**
+ * Replays a mutation from the run directory given with -run_dir: from the mutation's own FKT
+ * file if it has one, or from the run's journal otherwise.
+ * @param mutate_count the mutation to replay
+ * @param buffer the buffer holding the original bytes
+ * @param bufsize the size of the buffer
+ * @param replayed receives the length of the mutated buffer (at most `bufsize`)
+ * @return whether the mutation was replayed
+ */
+static bool replay_local(uint32_t mutate_count, uint8_t *buffer, size_t bufsize,
+                         size_t *replayed) {
+  const char *run_dir = replay_run_dir.c_str();
+  wchar_t fkt_name[MAX_PATH + 1] = {0};
+  char path[MAX_PATH + 1] = {0};
+  uint8_t *view = NULL;
+  size_t view_size = 0;
+  const uint8_t *record = NULL;
+  size_t record_size = 0;
+  const uint8_t *payload = NULL;
+  size_t payload_size = 0;
+  uint8_t encoding = SL2_FKT_FULL;
+  bool replayed_ok = false;
+
+  dr_snwprintf(fkt_name, MAX_PATH, FUZZ_RUN_FKT_FMT, mutate_count);
+  dr_snprintf(path, MAX_PATH, "%s\\%S", run_dir, fkt_name);
+
+  view = map_replay_file(path, &view_size, &record_size);
+
+  if (view) {
+    record = view;
+  } else {
+    if (!journal_mapped) {
+      dr_snprintf(path, MAX_PATH, "%s\\%S", run_dir, FUZZ_RUN_FKT_JOURNAL);
+      journal_view = map_replay_file(path, &journal_view_size, &journal_size);
+      journal_mapped = true;
+    }
+
+    if (!journal_view ||
+        !sl2_fkt_journal_find(journal_view, journal_size, mutate_count, &record, &record_size)) {
+      SL2_DR_DEBUG("replay_local: no FKT or journal entry for mutation %d in %s\n", mutate_count,
+                   run_dir);
+      goto cleanup;
+    }
+  }
+
+  if (!sl2_fkt_parse(record, record_size, &payload, &payload_size, &encoding)) {
+    SL2_DR_DEBUG("replay_local: malformed FKT for mutation %d\n", mutate_count);
+    goto cleanup;
+  }
+
+  // Only the server has the seeds that compact records are replayed from.
+  if (encoding == SL2_FKT_CHAIN) {
+    SL2_DR_DEBUG("replay_local: mutation %d is compact, replaying it from the server\n",
+                 mutate_count);
+    goto cleanup;
+  }
+
+  replayed_ok = sl2_fkt_replay(payload, payload_size, encoding, buffer, bufsize, replayed);
+
+  if (!replayed_ok) {
+    SL2_DR_DEBUG("replay_local: malformed delta for mutation %d\n", mutate_count);
+  }
+
+cleanup:
+  if (view) {
+    dr_unmap_file(view, view_size);
+  }
+
+  return replayed_ok;
+}
+
+/**
+ * Replays a mutation into a targeted buffer, locally if we were given a run directory, and from
+ * the server otherwise (or if the run directory doesn't have it).
+ * A delta that turns out to be malformed may have been partially applied, so we
+ * don't fall back to the server in that case; the server would have failed it too.
+ * Callers must hold mutatex.
+ * @param buffer the buffer holding the original bytes
+ * @param bufsize the size of the buffer
+ * @param replayed receives the length of the mutated buffer (at most `bufsize`)
+ */
+static void replay_mutation(uint8_t *buffer, size_t bufsize, size_t *replayed) {
+  if (replay_run_dir != "" && replay_local(mutate_count, buffer, bufsize, replayed)) {
+    return;
+  }
+
+  sl2_conn_request_replay(&sl2_conn, mutate_count, bufsize, buffer, replayed);
+}
+
 /** Called after each targeted function to replay mutation and mark bytes as tainted */
 static void wrap_post_Generic(void *wrapcxt, void *user_data) {
+  SL2_PROFILE(SL2_PROBE_POST_GENERIC);
   void *drcontext = NULL;
 
   if (!client.is_sane_post_hook(wrapcxt, user_data, &drcontext)) {
@@ -1138,17 +3136,30 @@ static void wrap_post_Generic(void *wrapcxt, void *user_data) {
 
   // Mark the targeted memory as tainted
   if (targeted) {
-    taint_mem((app_pc)info->lpBuffer, info->nNumberOfBytesToRead);
+    taint_input((app_pc)info->lpBuffer, info->nNumberOfBytesToRead);
+    label_buffer(info);
   }
 
-  // Talk to the server, get the stored mutation from the fuzzing run, and write it into memory.
+  // Get the stored mutation from the fuzzing run and write it into memory.
   if (replay && targeted) {
     dr_mutex_lock(mutatex);
 
     if (no_mutate) {
       SL2_DR_DEBUG("user requested replay WITHOUT mutation!\n");
+    } else if (info->capacity) {
+      // The fuzzer may have changed the buffer's length, so we ask for as much as the
+      // buffer can hold and report whatever length the mutation ended up with.
+      size_t replayed = 0;
+      replay_mutation((uint8_t *)info->lpBuffer, info->capacity, &replayed);
+
+      if (info->lpNumberOfBytesRead) {
+        *(info->lpNumberOfBytesRead) = (DWORD)replayed;
+      } else {
+        drwrap_set_retval(wrapcxt, (void *)replayed);
+      }
     } else {
-      sl2_conn_request_replay(&sl2_conn, mutate_count, info->nNumberOfBytesToRead, info->lpBuffer);
+      size_t replayed = 0;
+      replay_mutation((uint8_t *)info->lpBuffer, info->nNumberOfBytesToRead, &replayed);
     }
 
     mutate_count++;
@@ -1158,17 +3169,14 @@ static void wrap_post_Generic(void *wrapcxt, void *user_data) {
 
 cleanup:
 
-  if (info->argHash) {
-    dr_thread_free(drcontext, info->argHash, SL2_HASH_LEN + 1);
-  }
-
-  dr_thread_free(drcontext, info, sizeof(client_read_info));
+  client.free_read_info(drcontext, info);
 }
 
 /**
  * Replays mutation and marks bytes as tainted. MapViewOfFile can't use the generic callback.
  */
 static void wrap_post_MapViewOfFile(void *wrapcxt, void *user_data) {
+  SL2_PROFILE(SL2_PROBE_POST_MAPVIEWOFFILE);
   void *drcontext = NULL;
   bool interesting_call = true;
 
@@ -1200,24 +3208,27 @@ static void wrap_post_MapViewOfFile(void *wrapcxt, void *user_data) {
     interesting_call = false;
   }
 
-  // Create the argHash, now that we have the correct source and nNumberOfBytesToRead.
-  client.hash_args(info->argHash, &hash_ctx);
+  // Stash the arguments for the argHash, now that we have the correct source and
+  // nNumberOfBytesToRead. They're only hashed if a target needs them.
+  client.defer_hash_args(info, &hash_ctx);
 
   bool targeted = client.is_function_targeted(info);
   client.increment_call_count(info->function);
 
   if (targeted) {
-    taint_mem((app_pc)info->lpBuffer, info->nNumberOfBytesToRead);
+    taint_input((app_pc)info->lpBuffer, info->nNumberOfBytesToRead);
+    label_buffer(info);
   }
 
-  // Talk to the server, get the stored mutation from the fuzzing run, and write it into memory.
+  // Get the stored mutation from the fuzzing run and write it into memory.
   if (interesting_call && replay && targeted) {
     dr_mutex_lock(mutatex);
 
     if (no_mutate) {
       SL2_DR_DEBUG("user requested replay WITHOUT mutation!\n");
     } else {
-      sl2_conn_request_replay(&sl2_conn, mutate_count, info->nNumberOfBytesToRead, info->lpBuffer);
+      size_t replayed = 0;
+      replay_mutation((uint8_t *)info->lpBuffer, info->nNumberOfBytesToRead, &replayed);
     }
 
     mutate_count++;
@@ -1228,19 +3239,14 @@ static void wrap_post_MapViewOfFile(void *wrapcxt, void *user_data) {
 #pragma warning(suppress : 4533)
 cleanup:
 
-  dr_thread_free(drcontext, info->argHash, SL2_HASH_LEN + 1);
-  dr_thread_free(drcontext, info, sizeof(client_read_info));
+  client.free_read_info(drcontext, info);
 }
 
-/** Register function pre/post callbacks in each module */
-static void on_module_load(void *drcontext, const module_data_t *mod, bool loaded) {
-  if (!strcmp(dr_get_application_name(), dr_module_preferred_name(mod))) {
-    baseAddr = (size_t)mod->start;
-  }
-
-  const char *mod_name = dr_module_preferred_name(mod);
-  app_pc towrap;
-
+/**
+ * Indexes the read hooks by module, once, so that on_module_load only has to look up the loaded
+ * module's own. Only the functions that a target matches are hooked.
+ */
+static void init_read_hooks() {
   sl2_pre_proto_map pre_hooks;
   SL2_PRE_HOOK1(pre_hooks, ReadFile);
   SL2_PRE_HOOK1(pre_hooks, InternetReadFile);
@@ -1278,6 +3284,124 @@ static void on_module_load(void *drcontext, const module_data_t *mod, bool loade
   SL2_POST_HOOK2(post_hooks, _read, Generic);
   SL2_POST_HOOK1(post_hooks, MapViewOfFile);
 
+  client.init_module_hooks(pre_hooks, post_hooks, true);
+}
+
+/**
+ * Runs on every entry to the persistent target. The first entry is snapshotted; every entry that
+ * we redirected to (for the next run of the batch) gets the snapshotted arguments back.
+ * @param wrapcxt - DynamoRIO Wrap Context.
+ * @param user_data - unused
+ */
+static void wrap_pre_persist_target(void *wrapcxt, OUT void **user_data) {
+  uint32_t nargs = (std::min)(op_persist_nargs.get_value(), (unsigned int)SL2_PERSIST_MAX_ARGS);
+  void *drcontext = drwrap_get_drcontext(wrapcxt);
+
+  if (!batch.entered) {
+    batch.entered = true;
+    batch.thread_id = dr_get_thread_id(drcontext);
+    batch.func_pc = drwrap_get_func(wrapcxt);
+    batch.xsp = drwrap_get_mcontext(wrapcxt)->xsp;
+    batch.ret_addr = drwrap_get_retaddr(wrapcxt);
+
+    for (uint32_t i = 0; i < nargs; ++i) {
+      batch.args[i] = drwrap_get_arg(wrapcxt, i);
+    }
+
+    batch.call_counts = client.call_counts;
+    batch.ret_addr_counts = client.ret_addr_counts;
+
+    SL2_DR_DEBUG("persistent target entered @ 0x%p, replaying %d more runs\n", batch.func_pc,
+                 batch.run_ids.size());
+  } else if (dr_get_thread_id(drcontext) != batch.thread_id) {
+    return;
+  } else if (batch.redirected) {
+    for (uint32_t i = 0; i < nargs; ++i) {
+      drwrap_set_arg(wrapcxt, i, batch.args[i]);
+    }
+
+    client.call_counts = batch.call_counts;
+    client.ret_addr_counts = batch.ret_addr_counts;
+    batch.redirected = false;
+  }
+
+  batch.in_target = true;
+}
+
+/**
+ * Runs on every return from the persistent target. Sends execution back to the top of the target
+ * for the next run of the batch, until there are none left.
+ * @param wrapcxt - DynamoRIO Wrap Context.
+ * @param user_data - unused
+ */
+static void wrap_post_persist_target(void *wrapcxt, void *user_data) {
+  // drwrap calls us without a context when a crash that we recovered from (see
+  // dump_crash) abandoned the target's call.
+  if (!wrapcxt) {
+    return;
+  }
+
+  void *drcontext = drwrap_get_drcontext(wrapcxt);
+
+  if (!batch.in_target || dr_get_thread_id(drcontext) != batch.thread_id) {
+    return;
+  }
+
+  batch.in_target = false;
+
+  // Let the last run return normally; on_dr_exit reports it.
+  if (!next_replay(drcontext)) {
+    return;
+  }
+
+  restart_persist_target(drwrap_get_mcontext(wrapcxt));
+  drwrap_redirect_execution(wrapcxt);
+}
+
+/**
+ * Reads the runs to replay after the first one from the file given with -runs.
+ * @param path the file, with one run id per line
+ */
+static void load_batch(const std::string &path) {
+  file_t file = dr_open_file(path.c_str(), DR_FILE_READ);
+  uint64 size = 0;
+
+  if (file == INVALID_FILE || !dr_file_size(file, &size)) {
+    SL2_DR_DEBUG("tracer#load_batch: ERROR: couldn't read %s\n", path.c_str());
+    dr_abort();
+  }
+
+  std::string contents((size_t)size, '\0');
+  ssize_t read = size ? dr_read_file(file, &contents[0], (size_t)size) : 0;
+  contents.resize(read > 0 ? (size_t)read : 0);
+  dr_close_file(file);
+
+  size_t start = 0;
+
+  while (start < contents.size()) {
+    size_t end = contents.find('\n', start);
+    std::string line = contents.substr(start, end == std::string::npos ? end : end - start);
+    start = end == std::string::npos ? contents.size() : end + 1;
+
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+      line.pop_back();
+    }
+
+    if (!line.empty() && line != run_id_s) {
+      batch.run_ids.push_back(line);
+    }
+  }
+}
+
+/** Register function pre/post callbacks in each module */
+static void on_module_load(void *drcontext, const module_data_t *mod, bool loaded) {
+  if (!strcmp(dr_get_application_name(), dr_module_preferred_name(mod))) {
+    baseAddr = (size_t)mod->start;
+  }
+
+  const char *mod_name = dr_module_preferred_name(mod);
+  app_pc towrap;
+
   // Wrap IsProcessorFeaturePresent and UnhandledExceptionFilter to prevent
   // __fastfail from circumventing our exception tracking. See the comment
   // above wrap_pre_IsProcessorFeaturePresent for more information.
@@ -1291,6 +3415,16 @@ static void on_module_load(void *drcontext, const module_data_t *mod, bool loade
     drwrap_wrap(towrap, wrap_pre_UnhandledExceptionFilter, NULL);
   }
 
+  // Wrap CloseHandle and DuplicateHandle, so that the client knows when to forget the path it
+  // cached for a handle. See SL2Client::get_handle_path.
+  if (STREQI(mod_name, "KERNELBASE.DLL")) {
+    towrap = (app_pc)dr_get_proc_address(mod->handle, "CloseHandle");
+    drwrap_wrap(towrap, wrap_pre_CloseHandle, NULL);
+
+    towrap = (app_pc)dr_get_proc_address(mod->handle, "DuplicateHandle");
+    drwrap_wrap(towrap, wrap_pre_DuplicateHandle, wrap_post_DuplicateHandle);
+  }
+
   // Wrap VerifierStopMessage and VerifierStopMessageEx, which are apparently
   // used in AppVerifier to register heap corruptions.
   //
@@ -1313,41 +3447,30 @@ static void on_module_load(void *drcontext, const module_data_t *mod, bool loade
   }
 
   /* assume our target executable is an exe */
-  if (strstr(mod_name, ".exe") != NULL) {
+  bool is_main = strstr(mod_name, ".exe") != NULL;
+  if (is_main) {
     module_start = mod->start; // TODO evaluate us of dr_get_application_name above
     module_end = module_start + mod->module_internal_size;
   }
 
-  void(__cdecl * pre_hook)(void *, void **);
-  void(__cdecl * post_hook)(void *, void *);
-
-  sl2_pre_proto_map::iterator it;
-  for (it = pre_hooks.begin(); it != pre_hooks.end(); it++) {
-    char *function_name = it->first;
-    bool hook = false;
+  scope_module_load(mod, mod_name, is_main);
+  stats_module_load(mod, mod_name);
 
-    if (!client.function_is_in_expected_module(function_name, mod_name)) {
-      continue;
-    }
+  if (!batch.run_ids.empty() && STREQI(mod_name, op_persist_module.get_value().c_str())) {
+    towrap = mod->start + strtoull(op_persist_offset.get_value().c_str(), NULL, 0);
 
-    // Look for function matching the target specified on the command line
-    for (targetFunction t : client.parsedJson) {
-      if (t.selected && STREQ(t.functionName.c_str(), function_name)) {
-        hook = true;
-      } else if (t.selected && (STREQ(function_name, "RegQueryValueExW") ||
-                                STREQ(function_name, "RegQueryValueExA"))) {
-        if (!STREQ(t.functionName.c_str(), "RegQueryValueEx")) {
-          hook = false;
-        }
-      }
+    if (drwrap_wrap(towrap, wrap_pre_persist_target, wrap_post_persist_target)) {
+      SL2_DR_DEBUG("<wrapped persistent target @ 0x%p in %s\n", towrap, mod_name);
+    } else {
+      SL2_DR_DEBUG("<FAILED to wrap persistent target @ 0x%p in %s\n", towrap, mod_name);
     }
+  }
 
-    if (!hook) {
-      continue;
-    }
+  const sl2_module_hook *hooks;
+  size_t hook_count = client.hooks_for_module(mod_name, &hooks);
 
-    pre_hook = it->second;
-    post_hook = post_hooks[function_name];
+  for (size_t i = 0; i < hook_count; i++) {
+    const char *function_name = hooks[i].func;
 
     // find target function in module
     towrap = (app_pc)dr_get_proc_address(mod->handle, function_name);
@@ -1355,8 +3478,7 @@ static void on_module_load(void *drcontext, const module_data_t *mod, bool loade
     // if the function was found, wrap it
     if (towrap != NULL) {
       dr_flush_region(towrap, 0x1000);
-      bool ok = drwrap_wrap(towrap, pre_hook, post_hook);
-      // bool ok = false;
+      bool ok = drwrap_wrap(towrap, hooks[i].pre_hook, hooks[i].post_hook);
       if (ok) {
         SL2_DR_DEBUG("<wrapped %s @ 0x%p>\n", function_name, towrap);
       } else {
@@ -1397,13 +3519,25 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]) {
 
   dr_enable_console_printing();
 
-  drreg_options_t ops = {sizeof(ops), 3, false};
+  drreg_options_t ops = {sizeof(ops), 4, false};
   dr_set_client_name("Tracer", "https://github.com/trailofbits/sienna-locomotive");
 
-  if (!drmgr_init() || !drwrap_init() || drreg_init(&ops) != DRREG_SUCCESS) {
+  if (!drmgr_init() || !drwrap_init() || drreg_init(&ops) != DRREG_SUCCESS || !drutil_init()) {
     DR_ASSERT(false);
   }
 
+  if (op_profile.get_value() || op_alloc_steady.get_value()) {
+    client.init_profile(op_alloc_steady.get_value());
+    sl2_conn_set_profile_hook(&sl2_conn, sl2_profile_request);
+  }
+
+  sl2_etw_register();
+
+  thread_taint_tls_idx = drmgr_register_tls_field();
+  DR_ASSERT(thread_taint_tls_idx != -1);
+  history_tls_idx = drmgr_register_tls_field();
+  DR_ASSERT(history_tls_idx != -1);
+
   run_id_s = op_replay.get_value();
   UUID run_id;
 
@@ -1412,6 +3546,16 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]) {
   }
 
   no_mutate = op_no_mutate.get_value();
+  replay_run_dir = op_run_dir.get_value();
+
+  if (replay && op_runs.get_value() != "") {
+    if (op_persist_module.get_value() == "") {
+      SL2_DR_DEBUG("tracer#main: -runs needs -persist_module, only replaying %s\n",
+                   run_id_s.c_str());
+    } else {
+      load_batch(op_runs.get_value());
+    }
+  }
 
   sl2_string_to_uuid(run_id_s.c_str(), &run_id);
   sl2_conn_assign_run_id(&sl2_conn, run_id);
@@ -1419,8 +3563,39 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]) {
   sl2_conn_register_pid(&sl2_conn, dr_get_process_id(), true);
 
   mutatex = dr_mutex_create();
+  stats_lock = dr_mutex_create();
+  start_ticks = __rdtsc();
+  start_ms = dr_get_milliseconds();
+  taint_insns_lock = dr_mutex_create();
+  taint_models_lock = dr_mutex_create();
+  taint_live_lock = dr_mutex_create();
+  taint_idle_budget = op_taint_idle.get_value();
+  labels_on = op_labels.get_value();
+  taint_labels.init();
+  scope_all = op_taint_scope.get_value() == "all";
+
+  const std::string &dump = op_dump.get_value();
+  if (dump == "normal") {
+    dump_policy = SL2_DUMP_NORMAL;
+  } else if (dump == "referenced") {
+    dump_policy = SL2_DUMP_REFERENCED;
+  } else if (dump == "tainted") {
+    dump_policy = SL2_DUMP_TAINTED;
+  } else if (dump == "full") {
+    dump_policy = SL2_DUMP_FULL;
+  } else {
+    SL2_DR_DEBUG("tracer#main: ERROR: unknown dump policy: %s\n", dump.c_str());
+    dr_abort();
+  }
+  client.init_read_info_pool();
+  client.init_events(op_events.get_value().c_str());
+  client.init_handle_cache();
+  init_read_hooks();
   dr_register_exit_event(on_dr_exit);
 
+  // So that every thread's exit event (and with it, its counters) runs before ours.
+  dr_request_synchronized_exit();
+
   // If taint tracing is enabled, register the propagate_taint callback
   if (!op_no_taint.get_value()) {
     // http://dynamorio.org/docs/group__drmgr.html#ga83a5fc96944e10bd7356e0c492c93966
@@ -1429,7 +3604,8 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]) {
     }
   }
 
-  if (!drmgr_register_module_load_event(on_module_load) ||
+  if (!drmgr_register_bb_instrumentation_event(NULL, on_bb_history, NULL) ||
+      !drmgr_register_module_load_event(on_module_load) ||
       !drmgr_register_thread_init_event(on_thread_init) ||
       !drmgr_register_thread_exit_event(on_thread_exit) ||
       !drmgr_register_exception_event(on_exception)) {
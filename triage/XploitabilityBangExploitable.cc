@@ -50,7 +50,7 @@ const bool XploitabilityBangExploitable::doesStackTraceContainUnknownFunctions()
  * @return whether we found the exception code
  */
 const bool XploitabilityBangExploitable::isEventNotAnException() const { 
-    unordered_set<MDExceptionCodeWin> validExceptions = {
+    static const unordered_set<MDExceptionCodeWin> validExceptions = {
         MD_EXCEPTION_CODE_WIN_CONTROL_C,
         MD_EXCEPTION_CODE_WIN_GUARD_PAGE_VIOLATION,
         MD_EXCEPTION_CODE_WIN_ACCESS_VIOLATION,
@@ -289,23 +289,60 @@ ExceptionSubtype XploitabilityBangExploitable::exceptionSubtype() {
     }
 }
 
+/*! The number of exception types and subtypes, for sizing the rule table */
+#define EXCEPTION_TYPE_COUNT        (STATUS_UNKNOWN + 1)
+#define EXCEPTION_SUBTYPE_COUNT     (ACCESS_VIOLATION_TYPE_WRITE + 1)
+/*! The number of kinds of exception address: in userland or not, near NULL or not */
+#define EXCEPTION_ADDRESS_COUNT     4
+
+struct BangRuleTable {
+    vector<BangRule>    rules;
+    /*! The indices of the rules that can match each kind of crash, in rule order */
+    vector<size_t>      candidates[EXCEPTION_TYPE_COUNT][EXCEPTION_SUBTYPE_COUNT][EXCEPTION_ADDRESS_COUNT];
+};
+
+/*! @return the kind of an exception address, as an index into BangRuleTable::candidates */
+static int exceptionAddressIndex( bool inUser, bool nearNull ) {
+    return (inUser ? 1 : 0) | (nearNull ? 2 : 0);
+}
+
+/*! @return whether a rule's address range admits an exception address */
+static bool ruleMatchesAddress( const BangRule& rule, bool inUser, bool nearNull ) {
+    switch( rule.exceptionAddressRange ) {
+        case IN_KERNEL_MEMORY:
+            return !inUser;
+        case IN_USER_MEMORY:
+            return inUser;
+        case NEAR_NULL:
+            return nearNull;
+        case NOT_NEAR_NULL:
+            return !nearNull;
+        default:
+            return true;
+    }
+}
+
 /**
  * These is the structure of the rules as implemented for !exploitable
  * The rules are a series of checks that depend on processor mode, exception address,
  * and exception type and subtype.  Analysis functions are called and eventually
- * an exploitability is returned
- * @return rule describing current exception
+ * an exploitability is returned.
+ * The rules are only built once. Everything but the analysis functions only depends on the
+ * enumerated dimensions of the crash, so each combination of them gets the list of rules that it
+ * can match up front, and only those rules' analysis functions are run (in order) for a crash.
+ * @return the compiled rules
  */
-BangRule XploitabilityBangExploitable::processRules() {
+BangRuleTable XploitabilityBangExploitable::compileRules() {
+    BangRuleTable built;
 
-    vector<BangRule> rules = {    
+    built.rules = {    
         {
             DONT_CARE_PROCESSOR_MODE,
             DONT_CARE_EXCEPTION_ADDRESS_RANGE,
             DONT_CARE_EXCEPTION_TYPE,
             DONT_CARE_EXCEPTION_SUBTYPE,
             DONT_CARE_EXCEPTION_LEVEL,        
-            bind( &XploitabilityBangExploitable::isEventNotAnException, this ),
+            &XploitabilityBangExploitable::isEventNotAnException,
             NOT_AN_EXCEPTION,
             "",
             "NotException",
@@ -333,7 +370,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             DONT_CARE_EXCEPTION_TYPE,
             DONT_CARE_EXCEPTION_SUBTYPE,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isFaultingInstructionOnStack, this ),
+            &XploitabilityBangExploitable::isFaultingInstructionOnStack,
             EXPLOITABLE,
             "Exception generated by code running in the Stack",
             "StackCodeExecution",
@@ -347,7 +384,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             DONT_CARE_EXCEPTION_TYPE,
             DONT_CARE_EXCEPTION_SUBTYPE,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isFaultingInstructionInUserland, this ),
+            &XploitabilityBangExploitable::isFaultingInstructionInUserland,
             EXPLOITABLE,
             "Kernel Exception in Userland",
             "KernelExceptionInUserland",
@@ -460,7 +497,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isFaultingAddressInstructionPointer, this ),
+            &XploitabilityBangExploitable::isFaultingAddressInstructionPointer,
             EXPLOITABLE,
             "Kernel Mode Read Access Violation at the Instruction Pointer",
             "ReadAVonIP",
@@ -474,7 +511,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isFaultingAddressInstructionPointer, this ),
+            &XploitabilityBangExploitable::isFaultingAddressInstructionPointer,
             EXPLOITABLE,
             "Read Access Violation at the Instruction Pointer",
             "ReadAVonIP",
@@ -488,7 +525,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             DONT_CARE_EXCEPTION_TYPE,
             DONT_CARE_EXCEPTION_SUBTYPE,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::WasExceptionHandlerChainCorrupted, this ),
+            &XploitabilityBangExploitable::WasExceptionHandlerChainCorrupted,
             EXPLOITABLE,
             "Exception Handler Chain Corrupted",
             "ExceptionHandlerCorrupted",
@@ -516,7 +553,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isFaultingAddressInstructionPointer, this ),
+            &XploitabilityBangExploitable::isFaultingAddressInstructionPointer,
             PROBABLY_EXPLOITABLE,
             "Read Access Violation Near Null at the Instruction Pointer",
             "ReadAVonIP",
@@ -530,7 +567,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::canFaultingInstructionNotBeDisassebled, this ),
+            &XploitabilityBangExploitable::canFaultingInstructionNotBeDisassebled,
             PROBABLY_EXPLOITABLE,
             "Cannot disassemble instruction",
             "ReadAvOnIP",
@@ -586,7 +623,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isFaultingInstructionControlFlow, this ),
+            &XploitabilityBangExploitable::isFaultingInstructionControlFlow,
             EXPLOITABLE,
             "Kernel Read Access Violation on Control Flow",
             "ReadAVonControlFlow",
@@ -600,7 +637,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isFaultingInstructionControlFlow, this ),
+            &XploitabilityBangExploitable::isFaultingInstructionControlFlow,
             EXPLOITABLE,
             "Read Access Violation on Control Flow",
             "ReadAVonControlFlow",
@@ -614,7 +651,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isFaultingInstructionControlFlow, this ),
+            &XploitabilityBangExploitable::isFaultingInstructionControlFlow,
             PROBABLY_EXPLOITABLE,
             "Read Access Violation on Control Flow",
             "ReadAVonControlFlow",
@@ -628,7 +665,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isFaultingInstructionBlockDataMove, this ),
+            &XploitabilityBangExploitable::isFaultingInstructionBlockDataMove,
             PROBABLY_EXPLOITABLE,
             "Read Access Violation on Block Data Move",
             "ReadAVonBlockMove",
@@ -642,7 +679,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isFaultingInstructionBlockDataMove, this ),
+            &XploitabilityBangExploitable::isFaultingInstructionBlockDataMove,
             PROBABLY_EXPLOITABLE,
             "Kernel Memory Read Access Violation on Block Data Move",
             "ReadAVonBlockMove",
@@ -656,7 +693,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             SECOND_CHANCE,
-            bind( &XploitabilityBangExploitable::isFaultingInstructionBlockDataMove, this ),
+            &XploitabilityBangExploitable::isFaultingInstructionBlockDataMove,
             PROBABLY_EXPLOITABLE,
             "Memory Read Access Violation on Block Data Move",
             "ReadAVonBlockMove",
@@ -670,7 +707,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isTaintedDataUsedToDetermineBranchTarget, this ),
+            &XploitabilityBangExploitable::isTaintedDataUsedToDetermineBranchTarget,
             PROBABLY_EXPLOITABLE,
             "Data from Faulting Address controls Code Flow",
             "TaintedDataControlsCodeFlow",
@@ -684,7 +721,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isTaintedDataUsedInALaterWrite, this ),
+            &XploitabilityBangExploitable::isTaintedDataUsedInALaterWrite,
             PROBABLY_EXPLOITABLE,
             "Data from Faulting Address controls subsequent Write Address",
             "TaintedDataControlsWriteAddress",
@@ -698,7 +735,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             DONT_CARE_EXCEPTION_TYPE,
             DONT_CARE_EXCEPTION_SUBTYPE,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::WasApplicationVerifierStopDetected, this ),
+            &XploitabilityBangExploitable::WasApplicationVerifierStopDetected,
             UNKNOWN,
             "Application Verifier Stop",
             "AppVerifierStop",
@@ -838,7 +875,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_BREAKPOINT,
             DONT_CARE_EXCEPTION_SUBTYPE,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::WasBugCheckDetected, this ),
+            &XploitabilityBangExploitable::WasBugCheckDetected,
             UNKNOWN,
             "BugCheck",
             "BugCheck",
@@ -852,7 +889,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             DONT_CARE_EXCEPTION_TYPE,
             DONT_CARE_EXCEPTION_SUBTYPE,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::doesStackTraceContainUnknownFunctions, this ),
+            &XploitabilityBangExploitable::doesStackTraceContainUnknownFunctions,
             UNKNOWN,
             "Possible Stack Corruption",
             "PossibleStackCorruption",
@@ -880,7 +917,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isTaintedDataUsedAsSourceForBlockDataMove, this ),
+            &XploitabilityBangExploitable::isTaintedDataUsedAsSourceForBlockDataMove,
             UNKNOWN,
             "Data from Faulting Address is used in a subsequent Block Data Move",
             "TaintedDataUsedInBlockMove",
@@ -894,7 +931,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             FIRST_CHANCE,
-            bind( &XploitabilityBangExploitable::isFaultingInstructionBlockDataMove, this ),
+            &XploitabilityBangExploitable::isFaultingInstructionBlockDataMove,
             UNKNOWN,
             "Memory Read Access Violation on Block Data Move",
             "ReadAVonBlockMove",
@@ -908,7 +945,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isTaintedDataUsedAsAFunctionArgument, this ),
+            &XploitabilityBangExploitable::isTaintedDataUsedAsAFunctionArgument,
             UNKNOWN,
             "Data from Faulting Address is used as one or more arguments in a subsequent Function Call",
             "TaintedDataPassedToFunction",
@@ -922,7 +959,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isTaintedDataUsedAsAFunctionRetVal, this ),
+            &XploitabilityBangExploitable::isTaintedDataUsedAsAFunctionRetVal,
             UNKNOWN,
             "Data from Faulting Address may be used as a return value",
             "TaintedDataReturnedFromFunction",
@@ -936,7 +973,7 @@ BangRule XploitabilityBangExploitable::processRules() {
             STATUS_ACCESS_VIOLATION,
             ACCESS_VIOLATION_TYPE_READ,
             DONT_CARE_EXCEPTION_LEVEL,
-            bind( &XploitabilityBangExploitable::isTaintedDataUsedToDetermineBranchSelection, this ),
+            &XploitabilityBangExploitable::isTaintedDataUsedToDetermineBranchSelection,
             UNKNOWN,
             "Data from Faulting Address controls Branch Selection",
             "TaintedDataControlsBranchSelection",
@@ -946,50 +983,65 @@ BangRule XploitabilityBangExploitable::processRules() {
     
     };
 
+    for( size_t i = 0; i < built.rules.size(); i++ ) {
+        const BangRule& rule = built.rules[i];
 
-    for( BangRule& rule : rules ) {
-
-        // We don't care about kernel stuff
-        if( rule.processorMode==KERNEL ) {
-            continue;
-        }
-        
-        // Process the area where the exception occurred
-        if( ( rule.exceptionAddressRange != DONT_CARE_EXCEPTION_ADDRESS_RANGE ) 
-            && 
-                ( ((rule.exceptionAddressRange == IN_KERNEL_MEMORY) 
-                    && isExceptionAddressInUser()) ||
-                ( (rule.exceptionAddressRange  == IN_USER_MEMORY) 
-                    && !isExceptionAddressInUser()) ||
-                ( (rule.exceptionAddressRange  == NEAR_NULL) 
-                    && !isExceptionAddressNearNull()) ||
-                ( (rule.exceptionAddressRange  == NOT_NEAR_NULL) 
-                && isExceptionAddressNearNull()) ) ) {
+        // We don't care about kernel stuff, and rules that can't be final never decide anything
+        if( rule.processorMode==KERNEL || !rule.isFinal ) {
             continue;
         }
 
-        // Check exception type
-        if( rule.exceptionType != DONT_CARE_EXCEPTION_TYPE) {            
-            if( rule.exceptionType != exceptionType()  )  {
+        for( int type = 0; type < EXCEPTION_TYPE_COUNT; type++ ) {
+            // Check exception type
+            if( rule.exceptionType != DONT_CARE_EXCEPTION_TYPE && rule.exceptionType != type ) {
                 continue;
             }
-        }
-
-        // Check exception subtype
-        if( (rule.exceptionSubtype != DONT_CARE_EXCEPTION_SUBTYPE ) && 
-                rule.exceptionSubtype != exceptionSubtype() ) {
-            continue;
-        }
 
-        // Everything passed so far, run the analysis function
-        if( rule.analyzeFunction ) {
-            if( !rule.analyzeFunction() ) {
-                continue;
+            for( int subtype = 0; subtype < EXCEPTION_SUBTYPE_COUNT; subtype++ ) {
+                // Check exception subtype
+                if( rule.exceptionSubtype != DONT_CARE_EXCEPTION_SUBTYPE && rule.exceptionSubtype != subtype ) {
+                    continue;
+                }
+
+                // Process the area where the exception occurred
+                for( int inUser = 0; inUser < 2; inUser++ ) {
+                    for( int nearNull = 0; nearNull < 2; nearNull++ ) {
+                        int address = exceptionAddressIndex(inUser != 0, nearNull != 0);
+
+                        if( ruleMatchesAddress(rule, inUser != 0, nearNull != 0) ) {
+                            built.candidates[type][subtype][address].push_back(i);
+                        }
+                    }
+                }
             }
         }
+    }
+
+    return built;
+}
+
+/**
+ * @return the compiled rules, which are only compiled once
+ */
+const BangRuleTable& XploitabilityBangExploitable::ruleTable() {
+    static const BangRuleTable table = compileRules();
+    return table;
+}
 
-        // This rule is not final, so keep on going
-        if( !rule.isFinal ) {
+/**
+ * Matches the current exception against the compiled rules
+ * @return rule describing current exception
+ */
+const BangRule& XploitabilityBangExploitable::processRules() {
+    const BangRuleTable& table = ruleTable();
+    const vector<size_t>& candidates = table.candidates[exceptionType()][exceptionSubtype()]
+        [exceptionAddressIndex(isExceptionAddressInUser(), isExceptionAddressNearNull())];
+
+    for( size_t i : candidates ) {
+        const BangRule& rule = table.rules[i];
+
+        // Everything else was matched when the table was built, run the analysis function
+        if( rule.analyzeFunction && !rule.analyzeFunction(*this) ) {
             continue;
         }
 
@@ -997,7 +1049,7 @@ BangRule XploitabilityBangExploitable::processRules() {
     }
 
     // Couldn't find anything
-    return BangRule {
+    static const BangRule nothing = BangRule {
         DONT_CARE_PROCESSOR_MODE,
         DONT_CARE_EXCEPTION_ADDRESS_RANGE,
         DONT_CARE_EXCEPTION_TYPE,
@@ -1011,13 +1063,13 @@ BangRule XploitabilityBangExploitable::processRules() {
         true,
     };
 
-    
+    return nothing;
 }
 
 /**
  *  operator<<() - converts between exploitability enum forms
  */
-XploitabilityResult& operator<<( XploitabilityResult& result, BangRule& rule ) {
+XploitabilityResult& operator<<( XploitabilityResult& result, const BangRule& rule ) {
     switch(rule.resultClassification) {
         case EXPLOITABLE:
             result.rank = XploitabilityRank::XPLOITABILITY_HIGH;
@@ -1043,7 +1095,7 @@ XploitabilityResult& operator<<( XploitabilityResult& result, BangRule& rule ) {
  * @return
  */
 XploitabilityResult XploitabilityBangExploitable::process() {    
-    BangRule& rule = processRules();
+    const BangRule& rule = processRules();
     XploitabilityResult result(name());
     result << rule;
     return result;
@@ -105,7 +105,10 @@ enum ResultClassification {
 
 
 
-typedef   function<bool()>     AnalyzeFunction;
+class XploitabilityBangExploitable;
+
+/*! An analysis function, called on the engine that's processing the crash */
+typedef   function<bool( const XploitabilityBangExploitable& )>     AnalyzeFunction;
 /**
  * Used to store a set of characteristics that describe a particualr exception that we can then pattern-match against
  */
@@ -147,6 +150,10 @@ public:
 
 
 
+/*! The rules, compiled into candidate lists by exception type, subtype and address range (see ruleTable) */
+struct BangRuleTable;
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // XploitabilityBangExploitable()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -160,7 +167,9 @@ public:
 
 private:
 
-    BangRule                processRules();
+    static BangRuleTable        compileRules();
+    static const BangRuleTable& ruleTable();
+    const BangRule&         processRules();
     ExceptionSubtype        exceptionSubtype();
     ExceptionType           exceptionType();
     const bool              WasApplicationVerifierStopDetected()            const;
@@ -6,6 +6,7 @@
 
 #include <string>
 #include <fstream>
+#include <iterator>
 
 using namespace std;
 
@@ -15,37 +16,127 @@ namespace sl2 {
  * Default constructor. Uses tracer.cpp to calculate exploitability
  * @param dump minidump file spit out by tracer
  * @param process_state
- * @param crashJson JSON dump of tracer output
+ * @param crashRecord path to the tracer's crash record (see common/sl2_crash_record.hpp)
  */
 XploitabilityTracer::XploitabilityTracer(
         Minidump *dump,
         ProcessState *process_state,
-        const string crashJson )
+        const string crashRecord )
     :   Xploitability(dump, process_state, "sl2"),
-        crashJsonPath_(crashJson)  {
+        crashRecordPath_(crashRecord),
+        record_(nullptr)  {
+}
+
+/*! Register names, in the crash record's order */
+static const char *recordRegs[SL2_CRASH_RECORD_REGS] = {
+    "rax", "rbx", "rcx", "rdx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rip",
+};
+
+/*! Flag names, in sl2_crash_record_flag bit order */
+static const char *recordFlags[] = {
+    "pc_tainted", "stack_tainted", "is_ret", "is_indirect", "is_direct",
+    "is_call", "mem_write", "mem_read", "tainted_src", "tainted_dst",
+};
+
+/*! @return a text section of the record */
+static string recordString( const sl2_crash_record *record, sl2_crash_record_section_id id ) {
+    size_t size;
+    const uint8_t *data = sl2_crash_record_section_data(record, id, &size);
+    return string((const char *)data, size);
+}
+
+/*! @return a section of the record holding 64-bit values, as a JSON array */
+static json recordArray( const sl2_crash_record *record, sl2_crash_record_section_id id ) {
+    size_t size;
+    const uint8_t *data = sl2_crash_record_section_data(record, id, &size);
+    json ret = json::array();
+
+    for( size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t) ) {
+        uint64_t value;
+        memcpy(&value, data + i, sizeof(value));
+        ret.push_back(value);
+    }
+    return ret;
 }
 
 /**
- * Copies the tracer.cpp json into triage.json for extra information
+ * Builds the tracer's findings as JSON, for triage.json. Only the triager's output needs JSON;
+ * the score comes straight out of the record.
  */
  json XploitabilityTracer::toJson() const {
-    return json_;
+    if( !record_ ) {
+        return json();
+    }
+
+    json j;
+    j["score"] = record_->score;
+    j["reason"] = recordString(record_, SL2_CRASH_SECTION_REASON);
+    j["exception"] = recordString(record_, SL2_CRASH_SECTION_EXCEPTION);
+    j["location"] = record_->location;
+    j["instruction"] = recordString(record_, SL2_CRASH_SECTION_INSTRUCTION);
+
+    for( size_t i = 0; i < sizeof(recordFlags) / sizeof(recordFlags[0]); i++ ) {
+        j[recordFlags[i]] = (record_->flags & (1 << i)) != 0;
+    }
+
+    j["regs"] = json::array();
+    for( int i = 0; i < SL2_CRASH_RECORD_REGS; i++ ) {
+        j["regs"].push_back({{"reg", recordRegs[i]},
+                             {"value", record_->regs[i]},
+                             {"tainted", ((record_->reg_taint >> i) & 1) != 0}});
+    }
+
+    j["last_calls"] = vector<uint64_t>(record_->last_calls, record_->last_calls + SL2_CRASH_RECORD_LAST);
+    j["last_insns"] = vector<uint64_t>(record_->last_insns, record_->last_insns + SL2_CRASH_RECORD_LAST);
+
+    json tainted = recordArray(record_, SL2_CRASH_SECTION_TAINTED);
+    j["tainted_addrs"] = json::array();
+    for( size_t i = 0; i + 1 < tainted.size(); i += 2 ) {
+        j["tainted_addrs"].push_back({{"start", tainted[i]}, {"size", tainted[i + 1]}});
+    }
+
+    json calls = recordArray(record_, SL2_CRASH_SECTION_HISTORY_CALLS);
+    if( !calls.empty() ) {
+        j["history"] = {{"calls", calls}, {"insns", recordArray(record_, SL2_CRASH_SECTION_HISTORY_INSNS)}};
+    }
+
+    // The label section is already JSON; its per-register offsets go back onto the regs.
+    string labels = recordString(record_, SL2_CRASH_SECTION_LABELS);
+    if( !labels.empty() ) {
+        try {
+            json parsed = json::parse(labels);
+
+            for( auto& reg : j["regs"] ) {
+                if( parsed["regs"].count(reg["reg"].get<string>()) ) {
+                    reg["offsets"] = parsed["regs"][reg["reg"].get<string>()];
+                }
+            }
+            parsed.erase("regs");
+            j["labels"] = parsed;
+        } catch(...) {
+        }
+    }
+
+    return j;
  }
 
 /**
- * Reads the crash.json file from tracer.cpp. There is potential to include information from the minidump processing here.
+ * Reads the crash record from tracer.cpp. There is potential to include information from the minidump processing here.
  */
 XploitabilityResult XploitabilityTracer::process() {
     XploitabilityResult ret(name());
 
 
-    // If we can't open the crash.json file, we return XPLOITABILITY_NONE
+    // If we can't read the crash record, we return XPLOITABILITY_NONE
     uint32_t score  = 0;
-    try {
-        ifstream ifs (crashJsonPath_);
-        json_ << ifs;
-        score = json_["score"];
-    } catch(...) {
+    ifstream ifs(crashRecordPath_, std::ios::in | std::ios::binary);
+    if( ifs ) {
+        data_.assign(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+        record_ = sl2_crash_record_open(data_.data(), data_.size());
+    }
+    if( record_ ) {
+        score = record_->score;
     }
 
     // Convert the 0-100 ranking to our 0-4 . No information is lost
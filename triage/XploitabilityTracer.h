@@ -7,6 +7,9 @@
 
 #include "Xploitability.h"
 
+#include <vector>
+
+#include "common/sl2_crash_record.hpp"
 #include "vendor/json.hpp"
 using json = nlohmann::json;
 
@@ -15,18 +18,18 @@ namespace sl2 {
 
 class XploitabilityTracer : public Xploitability {
 public:
-    XploitabilityTracer::XploitabilityTracer(
+    XploitabilityTracer(
                 Minidump* dump,
                 ProcessState* process_state,
-                const string crashJson );
+                const string crashRecord );
 
     json                                    toJson() const;
     virtual XploitabilityResult             process();
 
 protected:
-    const string                            crashJsonPath_;
-    json                                    json_;
-    void                                    loadJson();
+    const string                            crashRecordPath_;
+    vector<uint8_t>                         data_;
+    const sl2_crash_record*                 record_;
 
 };
 
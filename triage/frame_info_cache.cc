@@ -0,0 +1,262 @@
+// XXX_INCLUDE_TOB_COPYRIGHT_HERE
+
+// A cache of the CFI rule sets and Windows frame info that stack walking looks up for every frame.
+// See frame_info_cache.h.
+
+#include "frame_info_cache.h"
+
+#include <sstream>
+
+#include "google_breakpad/processor/code_module.h"
+#include "google_breakpad/processor/code_modules.h"
+#include "google_breakpad/processor/source_line_resolver_interface.h"
+#include "google_breakpad/processor/stack_frame.h"
+
+namespace sl2 {
+
+
+/**
+ * Constructor for a frame info cache
+ * @param capacity how many instructions to remember each kind of frame info for
+ */
+FrameInfoCache::FrameInfoCache( size_t capacity )
+    :   cfi_(capacity),
+        windows_(capacity) {
+
+}
+
+
+/**
+ * Looks up a cached CFI rule set
+ * @param key the instruction's key (see CachingFrameSymbolizer::cacheKey)
+ * @param info receives the rule set, or NULL if the instruction is known to have none
+ * @return whether the instruction was cached
+ */
+bool FrameInfoCache::findCFI( const string& key, shared_ptr<const CFIFrameInfo>* info ) {
+    lock_guard<mutex> lock(lock_);
+    return cfi_.get( key, info );
+}
+
+
+/*! Caches an instruction's CFI rule set, or NULL if it has none */
+void FrameInfoCache::storeCFI( const string& key, shared_ptr<const CFIFrameInfo> info ) {
+    lock_guard<mutex> lock(lock_);
+    cfi_.put( key, info );
+}
+
+
+/**
+ * Looks up cached Windows frame info
+ * @param key the instruction's key (see CachingFrameSymbolizer::cacheKey)
+ * @param info receives the frame info, or NULL if the instruction is known to have none
+ * @return whether the instruction was cached
+ */
+bool FrameInfoCache::findWindows( const string& key, shared_ptr<const WindowsFrameInfo>* info ) {
+    lock_guard<mutex> lock(lock_);
+    return windows_.get( key, info );
+}
+
+
+/*! Caches an instruction's Windows frame info, or NULL if it has none */
+void FrameInfoCache::storeWindows( const string& key, shared_ptr<const WindowsFrameInfo> info ) {
+    lock_guard<mutex> lock(lock_);
+    windows_.put( key, info );
+}
+
+
+/**
+ * Constructor for a caching frame symbolizer
+ * @param supplier where the resolver gets its symbols from
+ * @param resolver the resolver to ask on a cache miss
+ * @param cache the cache to go through. If NULL, this behaves like a plain StackFrameSymbolizer.
+ */
+CachingFrameSymbolizer::CachingFrameSymbolizer( SymbolSupplier* supplier,
+                                                SourceLineResolverInterface* resolver,
+                                                FrameInfoCache* cache )
+    :   StackFrameSymbolizer(supplier, resolver),
+        cache_(cache),
+        focused_(false),
+        hasCrashInstruction_(false),
+        focusInstruction_(0),
+        focusFrames_(0),
+        inFocus_(false),
+        frameIndex_(0),
+        walkFrames_(0),
+        scanWords_(0),
+        truncated_(false) {
+
+}
+
+
+/**
+ * Tells the crashing thread's stack apart from the others, for focus() and the budget.
+ * @param instruction the crashing thread's instruction pointer, which its stack walk starts at
+ */
+void CachingFrameSymbolizer::crashInstruction( uint64_t instruction ) {
+    hasCrashInstruction_    = true;
+    focusInstruction_       = instruction;
+}
+
+
+/**
+ * Only resolves functions and source lines for the crashing thread's top frames from now on.
+ * Without a crashInstruction(), no thread's are.
+ * @param frames how many of its frames to resolve
+ */
+void CachingFrameSymbolizer::focus( size_t frames ) {
+    focused_            = true;
+    focusFrames_        = frames;
+}
+
+
+/**
+ * Limits the stack walk that's about to start (of one minidump). The clock starts now.
+ * @param budget the limits
+ */
+void CachingFrameSymbolizer::budget( const StackBudget& budget ) {
+    budget_     = budget;
+    deadline_   = chrono::steady_clock::now() + chrono::milliseconds(budget.wallClockMs);
+    scanWords_  = 0;
+    truncated_  = false;
+}
+
+
+/*! @return whether any stack was cut short by the budget, since it was set */
+bool CachingFrameSymbolizer::truncated() const {
+    return truncated_;
+}
+
+
+/**
+ * Counts a frame against the budget.
+ * NOTE: Stack scanning vets each word that it tries as a return address by looking its module
+ * up, through a frame that it hasn't given any trust. Those are how scanned words are counted.
+ * @return whether the walk is over the budget
+ */
+bool CachingFrameSymbolizer::overBudget( const StackFrame* frame ) {
+    bool probe = frame->trust==StackFrame::FRAME_TRUST_NONE;
+
+    if( !budget_.active() ) {
+        return false;
+    }
+
+    if( budget_.crashingThreadOnly && hasCrashInstruction_ && !inFocus_ ) {
+        return true;
+    }
+
+    if( probe ? (budget_.maxScanWords && ++scanWords_ > budget_.maxScanWords)
+              : (budget_.maxFrames && ++walkFrames_ > budget_.maxFrames) ) {
+        return true;
+    }
+
+    return budget_.wallClockMs && chrono::steady_clock::now() > deadline_;
+}
+
+
+/**
+ * Loads the symbols for a frame's module, and resolves the frame's function and source line if
+ * the symbolizer isn't focused elsewhere.
+ * NOTE: Each thread's stack walk starts with a frame taken from its context, which is how we tell
+ * the crashing thread's apart.
+ */
+StackFrameSymbolizer::SymbolizerResult CachingFrameSymbolizer::FillSourceLineInfo(
+        const CodeModules* modules,
+        const CodeModules* unloadedModules,
+        const SystemInfo* systemInfo,
+        StackFrame* frame ) {
+    if( frame->trust==StackFrame::FRAME_TRUST_CONTEXT ) {
+        inFocus_    = hasCrashInstruction_ && frame->instruction==focusInstruction_;
+        frameIndex_ = 0;
+        walkFrames_ = 0;
+    }
+
+    // NOTE: Interrupting the walk keeps the frames before this one; a stack scan whose candidate
+    // isn't in any module just fails, and so ends the walk there too.
+    if( overBudget(frame) ) {
+        truncated_ = true;
+        return frame->trust==StackFrame::FRAME_TRUST_NONE ? kNoError : kInterrupt;
+    }
+
+    if( !focused_ ) {
+        return StackFrameSymbolizer::FillSourceLineInfo( modules, unloadedModules, systemInfo,
+                                                         frame );
+    }
+
+    if( inFocus_ && frameIndex_++ < focusFrames_ ) {
+        return StackFrameSymbolizer::FillSourceLineInfo( modules, unloadedModules, systemInfo,
+                                                         frame );
+    }
+
+    const CodeModule* module = modules ? modules->GetModuleForAddress(frame->instruction) : nullptr;
+    if( !module && unloadedModules ) {
+        module = unloadedModules->GetModuleForAddress(frame->instruction);
+    }
+
+    // Once the module is loaded there's nothing left to do but resolve the frame, which we skip.
+    if( module && resolver_ && resolver_->HasModule(module) ) {
+        frame->module = module;
+        return resolver_->IsModuleCorrupt(module) ? kWarningCorruptSymbols : kNoError;
+    }
+
+    return StackFrameSymbolizer::FillSourceLineInfo( modules, unloadedModules, systemInfo, frame );
+}
+
+
+/**
+ * Identifies a frame's instruction across minidumps: by its module's identity, and its offset
+ * into the module (so that ASLR doesn't matter).
+ * NOTE: Frames in modules that the resolver hasn't loaded symbols for aren't cached, since the
+ * resolver might still load them later on.
+ * @return the key, or an empty string if the frame's frame info can't be cached
+ */
+const string CachingFrameSymbolizer::cacheKey( const StackFrame* frame ) {
+    const CodeModule* module = frame->module;
+
+    if( !cache_ || !resolver_ || !module || !resolver_->HasModule(module) ) {
+        return "";
+    }
+
+    ostringstream key;
+    key << module->code_file() << "|" << module->code_identifier() << "|"
+        << module->debug_file() << "|" << module->debug_identifier() << "|"
+        << hex << (frame->instruction - module->base_address());
+    return key.str();
+}
+
+
+/*! @return the frame's CFI rule set, which the caller owns, or NULL if it has none */
+CFIFrameInfo* CachingFrameSymbolizer::FindCFIFrameInfo( const StackFrame* frame ) {
+    const string key = cacheKey(frame);
+    shared_ptr<const CFIFrameInfo> info;
+
+    if( key.empty() ) {
+        return StackFrameSymbolizer::FindCFIFrameInfo(frame);
+    }
+
+    if( !cache_->findCFI(key, &info) ) {
+        info.reset( StackFrameSymbolizer::FindCFIFrameInfo(frame) );
+        cache_->storeCFI(key, info);
+    }
+
+    return info ? new CFIFrameInfo(*info) : nullptr;
+}
+
+
+/*! @return the frame's Windows frame info, which the caller owns, or NULL if it has none */
+WindowsFrameInfo* CachingFrameSymbolizer::FindWindowsFrameInfo( const StackFrame* frame ) {
+    const string key = cacheKey(frame);
+    shared_ptr<const WindowsFrameInfo> info;
+
+    if( key.empty() ) {
+        return StackFrameSymbolizer::FindWindowsFrameInfo(frame);
+    }
+
+    if( !cache_->findWindows(key, &info) ) {
+        info.reset( StackFrameSymbolizer::FindWindowsFrameInfo(frame) );
+        cache_->storeWindows(key, info);
+    }
+
+    return info ? new WindowsFrameInfo(*info) : nullptr;
+}
+
+} // namespace
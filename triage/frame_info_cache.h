@@ -0,0 +1,192 @@
+// XXX_INCLUDE_TOB_COPYRIGHT_HERE
+
+// A cache of the CFI rule sets and Windows frame info that stack walking looks up for every frame.
+// The resolver parses a fresh rule set out of a module's symbols on each lookup, and crashes from
+// one campaign keep walking through the same target modules (usually along the same call paths),
+// so one cache is shared by every triage in a triager run, batch workers included.
+
+#ifndef FrameInfoCache_H
+#define FrameInfoCache_H
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "google_breakpad/processor/stack_frame_symbolizer.h"
+#include "processor/cfi_frame_info.h"
+#include "processor/windows_frame_info.h"
+
+using namespace google_breakpad;
+using namespace std;
+
+namespace sl2 {
+
+
+/*! The default number of instructions that a FrameInfoCache remembers frame info for */
+#define FRAME_INFO_CACHE_SIZE   (64 * 1024)
+
+
+/**
+ * Limits on how much work walking a single minidump's stacks can do, so that corrupted stacks
+ * (e.g. from heap smashes) can't keep stack scanning busy for minutes. Limits left at 0 are off.
+ */
+struct StackBudget {
+    /*! Only walk the crashing thread's stack; the other threads are left without frames */
+    bool                        crashingThreadOnly  = false;
+    /*! The most frames to walk on each thread */
+    size_t                      maxFrames           = 0;
+    /*! The most stack words to try as return addresses, across the whole minidump */
+    size_t                      maxScanWords        = 0;
+    /*! How long walking the whole minidump may take, in milliseconds */
+    uint64_t                    wallClockMs         = 0;
+
+    /*! @return whether any limit is on */
+    bool                        active()            const {
+        return crashingThreadOnly || maxFrames || maxScanWords || wallClockMs;
+    }
+};
+
+
+/*! A least-recently-used cache, keyed by string. Not thread safe. */
+template<typename T>
+class LruCache {
+
+public:
+    LruCache( size_t capacity ) : capacity_(capacity) {}
+
+    /**
+     * Looks up a key, making it the most recently used
+     * @param key the key
+     * @param value receives the key's value, if it's cached
+     * @return whether the key is cached
+     */
+    bool get( const string& key, T* value ) {
+        auto it = index_.find(key);
+        if( it==index_.end() ) {
+            return false;
+        }
+
+        entries_.splice( entries_.begin(), entries_, it->second );
+        *value = it->second->second;
+        return true;
+    }
+
+    /*! Caches a key's value, evicting the least recently used key if the cache is full */
+    void put( const string& key, const T& value ) {
+        auto it = index_.find(key);
+        if( it!=index_.end() ) {
+            it->second->second = value;
+            entries_.splice( entries_.begin(), entries_, it->second );
+            return;
+        }
+
+        if( capacity_==0 ) {
+            return;
+        }
+
+        if( index_.size()>=capacity_ ) {
+            index_.erase( entries_.back().first );
+            entries_.pop_back();
+        }
+
+        entries_.emplace_front( key, value );
+        index_[key] = entries_.begin();
+    }
+
+private:
+    typedef list< pair<string, T> > Entries;
+
+    const size_t                                            capacity_;
+    Entries                                                 entries_;
+    unordered_map<string, typename Entries::iterator>       index_;
+
+};
+
+
+/**
+ * The frame info found for instructions, keyed by module identity and module-relative address.
+ * Lookups that found nothing are cached too (as NULL), since modules without CFI are the common
+ * case on Windows. Thread safe.
+ */
+class FrameInfoCache {
+
+public:
+    FrameInfoCache( size_t capacity = FRAME_INFO_CACHE_SIZE );
+
+    bool                        findCFI( const string& key, shared_ptr<const CFIFrameInfo>* info );
+    void                        storeCFI( const string& key, shared_ptr<const CFIFrameInfo> info );
+    bool                        findWindows( const string& key,
+                                             shared_ptr<const WindowsFrameInfo>* info );
+    void                        storeWindows( const string& key,
+                                              shared_ptr<const WindowsFrameInfo> info );
+
+private:
+    mutex                                           lock_;
+    LruCache< shared_ptr<const CFIFrameInfo> >      cfi_;
+    LruCache< shared_ptr<const WindowsFrameInfo> >  windows_;
+
+};
+
+
+/**
+ * A frame symbolizer that goes through a FrameInfoCache before asking the resolver for a frame's
+ * CFI rule set or Windows frame info. It can also be focused on the crashing thread's top frames,
+ * in which case no other frames get their functions and source lines resolved (although their
+ * modules still get loaded, since walking the stack needs their CFI). It also enforces a
+ * StackBudget: a stack whose walk runs over the budget is cut short, by interrupting the walk
+ * (which keeps the frames walked so far) or by failing its stack scans.
+ */
+class CachingFrameSymbolizer : public StackFrameSymbolizer {
+
+public:
+    CachingFrameSymbolizer( SymbolSupplier* supplier, SourceLineResolverInterface* resolver,
+                            FrameInfoCache* cache );
+
+    void                        crashInstruction( uint64_t instruction );
+    void                        focus( size_t frames );
+    void                        budget( const StackBudget& budget );
+    bool                        truncated()         const;
+
+    virtual SymbolizerResult    FillSourceLineInfo( const CodeModules* modules,
+                                                    const CodeModules* unloadedModules,
+                                                    const SystemInfo* systemInfo,
+                                                    StackFrame* frame );
+    virtual WindowsFrameInfo*   FindWindowsFrameInfo( const StackFrame* frame );
+    virtual CFIFrameInfo*       FindCFIFrameInfo( const StackFrame* frame );
+
+private:
+    const string                cacheKey( const StackFrame* frame );
+    bool                        overBudget( const StackFrame* frame );
+
+    FrameInfoCache*             cache_;
+
+    /*! Whether focus() was called */
+    bool                        focused_;
+    /*! Whether crashInstruction() was called */
+    bool                        hasCrashInstruction_;
+    /*! The instruction that the crashing thread's stack walk starts from */
+    uint64_t                    focusInstruction_;
+    /*! How many of the crashing thread's frames to resolve */
+    size_t                      focusFrames_;
+    /*! Whether the stack being walked is the crashing thread's, and how far into it we are */
+    bool                        inFocus_;
+    size_t                      frameIndex_;
+
+    StackBudget                 budget_;
+    /*! When the budget's walk has to be done by */
+    chrono::steady_clock::time_point    deadline_;
+    /*! The frames walked on the current stack, and the words scanned so far in the minidump */
+    size_t                      walkFrames_;
+    size_t                      scanWords_;
+    /*! Whether any stack was cut short by the budget */
+    bool                        truncated_;
+
+};
+
+} // namespace
+
+#endif
@@ -43,13 +43,21 @@
 
 #ifdef _WIN32
 #include <io.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+#include "common/sl2_compress.hpp"
 #else  // _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #endif  // _WIN32
 
 #include <algorithm>
 #include <fstream>
 #include <limits>
+#include <new>
 #include <utility>
 
 #include "processor/range_map-inl.h"
@@ -1268,6 +1276,14 @@ const uint8_t* MinidumpMemoryRegion::GetMemory() const {
       return NULL;
     }
 
+    // If the minidump is mapped, the region's memory is used in place rather
+    // than copied out.
+    const uint8_t* view = minidump_->GetView(descriptor_->memory.rva,
+                                             descriptor_->memory.data_size);
+    if (view) {
+      return view;
+    }
+
     if (!minidump_->SeekSet(descriptor_->memory.rva)) {
       BPLOG(ERROR) << "MinidumpMemoryRegion could not seek to memory region";
       return NULL;
@@ -4994,6 +5010,10 @@ Minidump::Minidump(const string& path, bool hexdump, unsigned int hexdump_width)
       stream_map_(new MinidumpStreamMap()),
       path_(path),
       stream_(NULL),
+      mapped_(NULL),
+      mapped_size_(0),
+      mapped_position_(0),
+      inflated_(false),
       swap_(false),
       valid_(false),
       hexdump_(hexdump),
@@ -5006,6 +5026,10 @@ Minidump::Minidump(istream& stream)
       stream_map_(new MinidumpStreamMap()),
       path_(),
       stream_(&stream),
+      mapped_(NULL),
+      mapped_size_(0),
+      mapped_position_(0),
+      inflated_(false),
       swap_(false),
       valid_(false),
       hexdump_(false),
@@ -5019,13 +5043,14 @@ Minidump::~Minidump() {
   if (!path_.empty()) {
     delete stream_;
   }
+  Unmap();
   delete directory_;
   delete stream_map_;
 }
 
 
 bool Minidump::Open() {
-  if (stream_ != NULL) {
+  if (stream_ != NULL || mapped_ != NULL) {
     BPLOG(INFO) << "Minidump reopening minidump " << path_;
 
     // The file is already open.  Seek to the beginning, which is the position
@@ -5033,6 +5058,11 @@ bool Minidump::Open() {
     return SeekSet(0);
   }
 
+  if (Map()) {
+    BPLOG(INFO) << "Minidump mapped minidump " << path_;
+    return true;
+  }
+
   stream_ = new ifstream(path_.c_str(), std::ios::in | std::ios::binary);
   if (!stream_ || !stream_->good()) {
     string error_string;
@@ -5046,6 +5076,122 @@ bool Minidump::Open() {
   return true;
 }
 
+bool Minidump::Map() {
+  const uint8_t* mapped = NULL;
+  size_t size = 0;
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path_.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER file_size;
+  if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 &&
+      static_cast<uint64_t>(file_size.QuadPart) <=
+          numeric_limits<size_t>::max()) {
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+      mapped = static_cast<const uint8_t*>(
+          MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+      size = static_cast<size_t>(file_size.QuadPart);
+      CloseHandle(mapping);
+    }
+  }
+
+  // The view keeps the file mapped after its handles are closed.
+  CloseHandle(file);
+
+  // Compressed dumps have to be decompressed before they can be read, so
+  // they're inflated onto the heap in one go and the view is dropped.
+  if (mapped && sl2_is_compressed(mapped, size)) {
+    uint64_t raw_size = sl2_compressed_raw_size(mapped);
+    uint8_t* raw = NULL;
+
+    if (raw_size > 0 && raw_size <= numeric_limits<size_t>::max()) {
+      raw = new (std::nothrow) uint8_t[static_cast<size_t>(raw_size)];
+    }
+
+    if (raw && !sl2_decompress(mapped, size, raw, static_cast<size_t>(raw_size))) {
+      delete[] raw;
+      raw = NULL;
+    }
+
+    UnmapViewOfFile(mapped);
+
+    if (!raw) {
+      BPLOG(ERROR) << "Minidump could not decompress minidump " << path_;
+      return false;
+    }
+
+    BPLOG(INFO) << "Minidump decompressed minidump " << path_;
+    mapped = raw;
+    size = static_cast<size_t>(raw_size);
+    inflated_ = true;
+  }
+#else  // _WIN32
+  int fd = open(path_.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view != MAP_FAILED) {
+      mapped = static_cast<const uint8_t*>(view);
+      size = st.st_size;
+    }
+  }
+
+  close(fd);
+#endif  // _WIN32
+
+  if (!mapped) {
+    return false;
+  }
+
+  mapped_ = mapped;
+  mapped_size_ = size;
+  mapped_position_ = 0;
+  return true;
+}
+
+
+void Minidump::Unmap() {
+  if (!mapped_) {
+    return;
+  }
+
+#ifdef _WIN32
+  if (inflated_) {
+    delete[] mapped_;
+  } else {
+    UnmapViewOfFile(mapped_);
+  }
+#else  // _WIN32
+  munmap(const_cast<uint8_t*>(mapped_), mapped_size_);
+#endif  // _WIN32
+
+  mapped_ = NULL;
+  mapped_size_ = 0;
+  mapped_position_ = 0;
+  inflated_ = false;
+}
+
+
+const uint8_t* Minidump::GetView(off_t offset, size_t count) const {
+  if (!mapped_ || offset < 0 ||
+      static_cast<uint64_t>(offset) > mapped_size_ ||
+      count > mapped_size_ - static_cast<size_t>(offset)) {
+    return NULL;
+  }
+
+  return mapped_ + offset;
+}
+
+
 bool Minidump::GetContextCPUFlagsFromSystemInfo(uint32_t *context_cpu_flags) {
   // Initialize output parameters
   *context_cpu_flags = 0;
@@ -5484,6 +5630,18 @@ const MDRawDirectory* Minidump::GetDirectoryEntryAtIndex(unsigned int index)
 bool Minidump::ReadBytes(void* bytes, size_t count) {
   // Can't check valid_ because Read needs to call this method before
   // validity can be determined.
+  if (mapped_) {
+    const uint8_t* view = GetView(mapped_position_, count);
+    if (!view) {
+      BPLOG(ERROR) << "ReadBytes: read past the end of the minidump";
+      return false;
+    }
+
+    memcpy(bytes, view, count);
+    mapped_position_ += count;
+    return true;
+  }
+
   if (!stream_) {
     return false;
   }
@@ -5516,6 +5674,16 @@ bool Minidump::ReadBytes(void* bytes, size_t count) {
 bool Minidump::SeekSet(off_t offset) {
   // Can't check valid_ because Read needs to call this method before
   // validity can be determined.
+  if (mapped_) {
+    if (offset < 0 || static_cast<uint64_t>(offset) > mapped_size_) {
+      BPLOG(ERROR) << "SeekSet: offset " << offset << " is past the end";
+      return false;
+    }
+
+    mapped_position_ = offset;
+    return true;
+  }
+
   if (!stream_) {
     return false;
   }
@@ -5530,10 +5698,14 @@ bool Minidump::SeekSet(off_t offset) {
 }
 
 off_t Minidump::Tell() {
-  if (!valid_ || !stream_) {
+  if (!valid_ || (!stream_ && !mapped_)) {
     return (off_t)-1;
   }
 
+  if (mapped_) {
+    return static_cast<off_t>(mapped_position_);
+  }
+
   // Check for conversion data loss
   std::streamoff std_streamoff = stream_->tellg();
   off_t rv = static_cast<off_t>(std_streamoff);
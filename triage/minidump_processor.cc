@@ -291,9 +291,11 @@ ProcessResult MinidumpProcessor::Process(
     process_state->thread_memory_regions_.push_back(thread_memory);
   }
 
+  // NOTE(sl2): SL2's symbol suppliers never interrupt. Walks are only interrupted
+  // by the triage's stack budget (see CachingFrameSymbolizer), which keeps the
+  // frames walked so far, so the rest of the processing goes on as usual.
   if (interrupted) {
-    BPLOG(INFO) << "Processing interrupted for " << dump->path();
-    return PROCESS_SYMBOL_SUPPLIER_INTERRUPTED;
+    BPLOG(INFO) << "Processing truncated for " << dump->path();
   }
 
   // If a requesting thread was indicated, it must be present.
@@ -0,0 +1,327 @@
+// XXX_INCLUDE_TOB_COPYRIGHT_HERE
+
+// A symbol supplier for FastSourceLineResolver, which keeps a persistent cache of every module's
+// symbols in breakpad's serialized ("fast") format. See symbol_cache.h.
+
+#include "symbol_cache.h"
+
+#include <Windows.h>
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include "google_breakpad/processor/code_module.h"
+#include "google_breakpad/processor/minidump.h"
+#include "processor/module_serializer.h"
+#include "processor/pathname_stripper.h"
+
+namespace fs = std::experimental::filesystem;
+
+/*! Identifies a symbol cache file */
+#define SYMBOL_CACHE_MAGIC      "SL2S"
+
+/*! Bumped whenever the cache format (or breakpad's serialization of modules) changes */
+#define SYMBOL_CACHE_VERSION    1
+
+namespace sl2 {
+
+
+/**
+ * Constructor for a symbol cache
+ * @param symbolPaths where to look for the text .sym files of modules that aren't cached yet
+ * @param cacheDir where the serialized symbols are cached
+ */
+SymbolCache::SymbolCache( const vector<string>& symbolPaths, const string& cacheDir )
+    :   SimpleSymbolSupplier(symbolPaths),
+        cacheDir_(cacheDir) {
+
+}
+
+
+/*! Releases every buffer that we've handed out. The resolver using them must be gone by now. */
+SymbolCache::~SymbolCache() {
+    while( !buffers_.empty() ) {
+        release( buffers_.begin()->first );
+    }
+}
+
+
+/**
+ * Where a module's serialized symbols are cached: keyed by its debug file name, its debug
+ * identifier and its code identifier, so that rebuilt modules never pick up stale symbols.
+ * @param module the module
+ * @return the path of the cache file, or an empty string if the module can't be identified
+ */
+const string SymbolCache::cachePath( const CodeModule* module ) const {
+    string debugFile    = PathnameStripper::File( module->debug_file() );
+    string debugId      = module->debug_identifier();
+    string codeId       = module->code_identifier();
+
+    if( debugFile.empty() || debugId.empty() || codeId.empty() ) {
+        return "";
+    }
+
+    fs::path path(cacheDir_);
+    path.append(debugFile);
+    path.append(debugId);
+    path.append(codeId + ".sym.fast");
+    return path.string();
+}
+
+
+/**
+ * Supplies a module's serialized symbols: memory-mapped from the cache if they're there, or
+ * serialized from the module's text .sym file (and cached) if they aren't.
+ * @return FOUND if the module has symbols, NOT_FOUND otherwise
+ */
+SymbolSupplier::SymbolResult SymbolCache::GetCStringSymbolData( const CodeModule* module,
+                                                                const SystemInfo* systemInfo,
+                                                                string* symbolFile,
+                                                                char** symbolData,
+                                                                size_t* symbolDataSize ) {
+    if( !module ) {
+        return NOT_FOUND;
+    }
+
+    const string path = cachePath(module);
+    Buffer buffer = { nullptr, nullptr };
+    size_t size = 0;
+
+    if( !path.empty() ) {
+        buffer.data = mapCached( path, &size, &buffer.view );
+    }
+
+    if( buffer.data ) {
+        *symbolFile = path;
+    } else {
+        string text;
+        SymbolResult result = GetSymbolFile( module, systemInfo, symbolFile, &text );
+
+        if( result!=FOUND ) {
+            return result;
+        }
+
+        ModuleSerializer serializer;
+        unsigned int serializedSize = 0;
+        buffer.data = serializer.SerializeSymbolFileData( text, &serializedSize );
+
+        if( !buffer.data ) {
+            return NOT_FOUND;
+        }
+
+        size = serializedSize;
+
+        if( !path.empty() ) {
+            store( path, buffer.data, size );
+        }
+    }
+
+    release( module->code_file() );
+    buffers_[module->code_file()] = buffer;
+
+    *symbolData     = buffer.data;
+    *symbolDataSize = size;
+    return FOUND;
+}
+
+
+/**
+ * Fills the cache with the symbols of every module that a batch of minidumps loaded, converting
+ * them on a pool of workers. Modules that are already cached (or that have no symbols) are
+ * skipped, so prefetching a batch whose modules have all been seen before only reads the
+ * minidumps' module lists.
+ * @param minidumpPaths the minidumps
+ * @param workers the number of workers, or 0 for one per core
+ * @return the number of modules whose symbols were cached
+ */
+size_t SymbolCache::prefetch( const vector<string>& minidumpPaths, unsigned int workers ) {
+    map<string, unique_ptr<CodeModule>> modules;
+
+    for( const string& minidumpPath : minidumpPaths ) {
+        Minidump dump(minidumpPath);
+        if( !dump.Read() ) {
+            continue;
+        }
+
+        MinidumpModuleList* list = dump.GetModuleList();
+        for( unsigned int i = 0; list && i < list->module_count(); i++ ) {
+            const CodeModule* module = list->GetModuleAtIndex(i);
+            const string path = module ? cachePath(module) : "";
+
+            if( path.empty() || modules.count(path) || fs::exists(path) ) {
+                continue;
+            }
+
+            modules[path].reset( module->Copy() );
+        }
+    }
+
+    vector<pair<const string, unique_ptr<CodeModule>>*> pending;
+    for( auto& module : modules ) {
+        pending.push_back(&module);
+    }
+
+    atomic<size_t> next(0);
+    atomic<size_t> cached(0);
+
+    // NOTE: SimpleSymbolSupplier only reads the symbol paths, so the workers can share it.
+    auto worker = [&]() {
+        for( size_t i = next++; i < pending.size(); i = next++ ) {
+            string symbolFile, text;
+
+            if( GetSymbolFile(pending[i]->second.get(), nullptr, &symbolFile, &text)!=FOUND ) {
+                continue;
+            }
+
+            ModuleSerializer serializer;
+            unsigned int size = 0;
+            char* data = serializer.SerializeSymbolFileData( text, &size );
+
+            if( data ) {
+                store( pending[i]->first, data, size );
+                delete[] data;
+                cached++;
+            }
+        }
+    };
+
+    if( workers==0 ) {
+        workers = max(1u, thread::hardware_concurrency());
+    }
+
+    vector<thread> pool;
+    for( unsigned int i = 0; i < workers && i < pending.size(); i++ ) {
+        pool.emplace_back(worker);
+    }
+
+    for( thread& t : pool ) {
+        t.join();
+    }
+
+    return cached;
+}
+
+
+/**
+ * Frees a module's serialized symbols.
+ * NOTE: FastSourceLineResolver uses the symbols in place, so breakpad only calls this for
+ * resolvers that copy them.
+ */
+void SymbolCache::FreeSymbolData( const CodeModule* module ) {
+    if( module ) {
+        release( module->code_file() );
+    }
+}
+
+
+/*! Unmaps or frees the buffer handed out for a module, if there is one */
+void SymbolCache::release( const string& codeFile ) {
+    auto it = buffers_.find(codeFile);
+    if( it==buffers_.end() ) {
+        return;
+    }
+
+    if( it->second.view ) {
+        UnmapViewOfFile( it->second.view );
+    } else {
+        delete[] it->second.data;
+    }
+
+    buffers_.erase(it);
+}
+
+
+/**
+ * Maps a cache file, copy-on-write.
+ * @param path the cache file
+ * @param size receives the size of the serialized module
+ * @param view receives the start of the mapping, for unmapping it later
+ * @return the serialized module, or NULL if it isn't cached (or the cache file is stale or torn)
+ */
+char* SymbolCache::mapCached( const string& path, size_t* size, void** view ) const {
+    HANDLE file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if( file==INVALID_HANDLE_VALUE ) {
+        return nullptr;
+    }
+
+    LARGE_INTEGER fileSize;
+    HANDLE mapping = NULL;
+    void* mapped = nullptr;
+
+    if( GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > sizeof(SymbolCacheHeader) ) {
+        mapping = CreateFileMappingA( file, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+    }
+
+    if( mapping ) {
+        mapped = MapViewOfFile( mapping, FILE_MAP_COPY, 0, 0, 0 );
+        CloseHandle(mapping);
+    }
+
+    // The mapping outlives the handles.
+    CloseHandle(file);
+
+    if( !mapped ) {
+        return nullptr;
+    }
+
+    const SymbolCacheHeader* header = (const SymbolCacheHeader*)mapped;
+    if( memcmp(header->magic, SYMBOL_CACHE_MAGIC, sizeof(header->magic))
+        || header->version!=SYMBOL_CACHE_VERSION
+        || header->size!=(uint64_t)fileSize.QuadPart - sizeof(SymbolCacheHeader) ) {
+        UnmapViewOfFile(mapped);
+        return nullptr;
+    }
+
+    *size = (size_t)header->size;
+    *view = mapped;
+    return (char*)mapped + sizeof(SymbolCacheHeader);
+}
+
+
+/**
+ * Caches a serialized module. The cache file is written under a temporary name and then moved
+ * into place, so that concurrent triages never map a torn one. Failures are ignored, since the
+ * cache is only an optimization.
+ * @param path the cache file
+ * @param data the serialized module
+ * @param size the size of the serialized module
+ */
+void SymbolCache::store( const string& path, const char* data, size_t size ) const {
+    SymbolCacheHeader header;
+    memcpy( header.magic, SYMBOL_CACHE_MAGIC, sizeof(header.magic) );
+    header.version  = SYMBOL_CACHE_VERSION;
+    header.size     = size;
+
+    ostringstream tmpPath;
+    tmpPath << path << "." << GetCurrentProcessId() << "." << this_thread::get_id() << ".tmp";
+
+    try {
+        fs::create_directories( fs::path(path).parent_path() );
+    } catch(...) {
+        return;
+    }
+
+    {
+        ofstream out( tmpPath.str(), ios::binary | ios::trunc );
+        out.write( (const char*)&header, sizeof(header) );
+        out.write( data, size );
+
+        if( !out ) {
+            out.close();
+            DeleteFileA( tmpPath.str().c_str() );
+            return;
+        }
+    }
+
+    if( !MoveFileExA( tmpPath.str().c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING ) ) {
+        DeleteFileA( tmpPath.str().c_str() );
+    }
+}
+
+} // namespace
@@ -0,0 +1,73 @@
+// XXX_INCLUDE_TOB_COPYRIGHT_HERE
+
+// A symbol supplier for FastSourceLineResolver, which keeps a persistent cache of every module's
+// symbols in breakpad's serialized ("fast") format. A module whose symbols are cached is loaded by
+// memory-mapping its cache file, instead of parsing its text .sym file into maps all over again.
+// The cache is a local symbol store, laid out the way symsrv lays out its stores (debug file,
+// then debug identifier), and it can be filled ahead of time for a batch of minidumps (see
+// prefetch), so that stack walking doesn't stop to convert each module's symbols as it first
+// comes across it.
+
+#ifndef SymbolCache_H
+#define SymbolCache_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "processor/simple_symbol_supplier.h"
+
+using namespace google_breakpad;
+using namespace std;
+
+namespace sl2 {
+
+
+/*! Precedes the serialized module in each cache file */
+struct SymbolCacheHeader {
+    /*! SYMBOL_CACHE_MAGIC */
+    char        magic[4];
+    /*! SYMBOL_CACHE_VERSION */
+    uint32_t    version;
+    /*! The size of the serialized module that follows */
+    uint64_t    size;
+};
+
+
+class SymbolCache : public SimpleSymbolSupplier {
+
+public:
+    SymbolCache( const vector<string>& symbolPaths, const string& cacheDir );
+    virtual ~SymbolCache();
+
+    virtual SymbolResult GetCStringSymbolData( const CodeModule* module,
+                                               const SystemInfo* systemInfo,
+                                               string* symbolFile,
+                                               char** symbolData,
+                                               size_t* symbolDataSize );
+    virtual void FreeSymbolData( const CodeModule* module );
+
+    const string                cachePath( const CodeModule* module ) const;
+    size_t                      prefetch( const vector<string>& minidumpPaths, unsigned int workers );
+
+private:
+
+    /*! Serialized symbols that we've handed out, by module */
+    struct Buffer {
+        char*       data;
+        /*! Where the mapping starts (the header), if the symbols were mapped from the cache */
+        void*       view;
+    };
+
+    char*                       mapCached( const string& path, size_t* size, void** view ) const;
+    void                        store( const string& path, const char* data, size_t size ) const;
+    void                        release( const string& codeFile );
+
+    const string                cacheDir_;
+    map<string, Buffer>         buffers_;
+
+};
+
+} // namespace
+
+#endif
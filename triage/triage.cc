@@ -8,21 +8,27 @@
 #include "triage.h"
 
 #include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <iterator>
 #include <numeric>
 #include <regex>
 #include <string>
+#include <thread>
 
 #include "Xploitability.h"
 #include "XploitabilityBangExploitable.h"
 #include "XploitabilityBreakpad.h"
+#include "XploitabilityTracer.h"
 #include "google_breakpad/processor/minidump.h"
 #include "google_breakpad/processor/minidump_processor.h"
 #include "google_breakpad/processor/process_state.h"
 #include "google_breakpad/processor/call_stack.h"
 #include "google_breakpad/processor/stack_frame.h"
+#include "google_breakpad/processor/stack_frame_symbolizer.h"
+#include "google_breakpad/processor/stackwalker.h"
+#include "processor/pathname_stripper.h"
 #include "stackwalk_common.h"
 
 
@@ -38,16 +44,89 @@ using google_breakpad::SimpleSymbolSupplier;
 namespace sl2 {
 
 
+/*! @return the seconds since `start` */
+static double secondsSince( chrono::steady_clock::time_point start ) {
+    return chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+}
+
+
+/**
+ * Makes an exploitability engine for a minidump.
+ * @return the engine, or NULL if it doesn't apply to the minidump
+ */
+typedef unique_ptr<Xploitability> (*EngineFactory)( Minidump* dump, ProcessState* state,
+                                                    const string& minidumpPath );
+
+
+/*! Makes a breakpad exploitability engine */
+static unique_ptr<Xploitability> makeBreakpad( Minidump* dump, ProcessState* state,
+                                               const string& minidumpPath ) {
+    return make_unique<XploitabilityBreakpad>(dump, state);
+}
+
+
+/*! Makes a !exploitable exploitability engine */
+static unique_ptr<Xploitability> makeBangExploitable( Minidump* dump, ProcessState* state,
+                                                      const string& minidumpPath ) {
+    return make_unique<XploitabilityBangExploitable>(dump, state);
+}
+
+
+/*! Makes a tracer exploitability engine, if the tracer left a crash record (crash.PID.sl2c) next to the minidump */
+static unique_ptr<Xploitability> makeTracer( Minidump* dump, ProcessState* state,
+                                             const string& minidumpPath ) {
+    std::error_code ec;
+
+    for( const auto& entry : fs::directory_iterator(fs::path(minidumpPath).parent_path(), ec) ) {
+        string name = entry.path().filename().string();
+
+        if( name.rfind("crash.", 0) == 0 && entry.path().extension() == ".sl2c" ) {
+            return make_unique<XploitabilityTracer>(dump, state, entry.path().string());
+        }
+    }
+    return nullptr;
+}
+
+
+/**
+ * The exploitability engines that every triage runs, in the order that their results are reported
+ * in. To add an engine, add its factory here.
+ */
+static const EngineFactory engineFactories[] = {
+    makeBreakpad,
+    makeBangExploitable,
+    makeTracer,
+};
+
 
 /**
  * Constructor for Triage class which loads a minidump file
  * @param minidumpPath path to the minidump to load
+ * @param resolver a resolver to share with other triages (e.g., of the same target in batch mode),
+ *                 so that symbols that it has already loaded aren't parsed again. It must outlive
+ *                 the triage, and must not be used by another triage at the same time. If NULL,
+ *                 the triage uses its own.
+ * @param supplier where the resolver gets its symbols from (e.g., a SymbolCache for a
+ *                 FastSourceLineResolver). It must outlive the triage. If NULL, symbols are looked
+ *                 for next to the minidump.
+ * @param frameCache frame info to share with other triages, so that stack walking through modules
+ *                 that other dumps have already walked through doesn't look it up again. If NULL,
+ *                 nothing is cached.
  */
-Triage::Triage( const string& minidumpPath )
+Triage::Triage( const string& minidumpPath, SourceLineResolverInterface* resolver,
+                SymbolSupplier* supplier, FrameInfoCache* frameCache )
     :   minidumpPath_(minidumpPath),
-        symbolSupplier_(minidumpPath),
-        proc_(&symbolSupplier_, &resolver_, true),
-        dump_ (minidumpPath) {
+        ownSupplier_(minidumpPath),
+        resolver_(resolver ? resolver : &ownResolver_),
+        supplier_(supplier ? supplier : &ownSupplier_),
+        symbolizer_(supplier_, resolver_, frameCache),
+        proc_(&symbolizer_, true),
+        dump_ (minidumpPath),
+        xploitabilityEngine_(nullptr),
+        focusFrames_(0),
+        quick_(false),
+        quickAddress_(0),
+        quickContext_(nullptr) {
 
 }
 
@@ -59,13 +138,23 @@ StatusCode Triage::preProcess() {
     ProcessResult   sc;
 
     // Read in minidump
-    if( !dump_.Read() ) {
+    auto start = chrono::steady_clock::now();
+    bool read = dump_.Read();
+    timings_.read = secondsSince(start);
+    if( !read ) {
         return StatusCode::ERROR;
     }
 
+    markCrashingThread();
+    if( focusFrames_ ) {
+        symbolizer_.focus( focusFrames_ );
+    }
 
     // Do some breakpad processing
+    symbolizer_.budget( budget_ );
+    start = chrono::steady_clock::now();
     sc = proc_.Process( &dump_, &state_);
+    timings_.process = secondsSince(start);
     if( PROCESS_OK!=sc ) {
         return StatusCode::ERROR;
     }
@@ -75,36 +164,132 @@ StatusCode Triage::preProcess() {
 
 
 /**
- * Does actual processing a minidump file
- * @return Status code
+ * Makes processing only symbolize the crashing thread's top frames, since they're all that toJson()
+ * and the engines look at. Every other frame is left without a function or a source line.
+ * NOTE: The Linux engine looks for stack smashing functions anywhere in the crashing thread, which
+ * is why it's more than a handful of frames.
+ * @param frames how many of the crashing thread's frames to symbolize
  */
-StatusCode Triage::process() {
+void Triage::focusSymbols(size_t frames) {
+    focusFrames_ = frames;
+}
 
 
-    StatusCode   sc;
+/**
+ * Limits how much work stack walking the minidump can do. Once a limit is hit, the stacks are
+ * cut short and the triage is marked as truncated.
+ * @param budget the limits
+ */
+void Triage::budget(const StackBudget& budget) {
+    budget_ = budget;
+}
 
-    sc = preProcess();
-    if( StatusCode::GOOD!=sc ) {
-        cerr << "Unable to process dumpfile." << endl;
+
+/*! @return whether the stack budget cut any of the minidump's stacks short */
+bool Triage::truncated() const {
+    return symbolizer_.truncated();
+}
+
+
+/*! Points the symbolizer at the crashing thread, which is the one whose walk starts at its IP */
+void Triage::markCrashingThread() {
+    MinidumpException*  exception   = dump_.GetException();
+    MinidumpContext*    context     = exception ? exception->GetContext() : nullptr;
+
+    if( !context ) {
+        return;
+    }
+
+    switch( context->GetContextCPU() ) {
+        case MD_CONTEXT_AMD64:
+            symbolizer_.crashInstruction( context->GetContextAMD64()->rip );
+            break;
+        case MD_CONTEXT_X86:
+            symbolizer_.crashInstruction( context->GetContextX86()->eip );
+            break;
+        default:
+            break;
+    }
+}
+
+
+/**
+ * Reads just enough of the minidump to compute its crashash and bucket: the exception, thread list
+ * and module list streams (plus the system info, for the CPU), and stackwalks only the crashing
+ * thread. This skips breakpad's full processing and the exploitability engines, so that crashes
+ * that are already known can be told apart cheaply. Afterwards, only crashash(), bucket(),
+ * callStack(), crashReason(), crashAddress(), instructionPointer(), stackPointer() and quickJson()
+ * are meaningful.
+ * NOTE: The stack is walked with the same symbolizer as a full triage, so the crashash and bucket
+ * come out the same.
+ * @return success code
+ */
+StatusCode Triage::quickProcess() {
+    if( !dump_.Read() ) {
+        return StatusCode::ERROR;
+    }
+
+    MinidumpException*  exception   = dump_.GetException();
+    MinidumpThreadList* threads     = dump_.GetThreadList();
+    MinidumpModuleList* modules     = dump_.GetModuleList();
+    uint32_t            threadId    = 0;
+
+    if( !exception || !threads || !modules || !exception->GetThreadID(&threadId) ) {
         return StatusCode::ERROR;
     }
 
+    MinidumpThread*     thread      = threads->GetThreadByID(threadId);
+    MinidumpContext*    context     = exception->GetContext();
 
-    cout << "-----------------------------------------------" << endl;
-    cout << minidumpPath_ << endl;
-    cout << "Crashash: " << crashash() << endl;
+    if( !thread || !context || !context->GetContextAMD64() ) {
+        return StatusCode::ERROR;
+    }
 
+    SystemInfo systemInfo;
+    if( !MinidumpProcessor::GetCPUInfo(&dump_, &systemInfo) ) {
+        return StatusCode::ERROR;
+    }
+    MinidumpProcessor::GetOSInfo(&dump_, &systemInfo);
 
+    unique_ptr<Stackwalker> walker( Stackwalker::StackwalkerForCPU( &systemInfo, context,
+                                                                    thread->GetMemory(), modules,
+                                                                    nullptr, &symbolizer_ ) );
+    vector<const CodeModule*> withoutSymbols;
+    vector<const CodeModule*> withCorruptSymbols;
 
+    // NOTE: Only the crashing thread is walked, so it's the budget's crashing thread too.
+    symbolizer_.crashInstruction( context->GetContextAMD64()->rip );
+    symbolizer_.budget( budget_ );
 
-    // There is a bug in Visual Studio that doesn't let you do this the sane way...
-    vector< unique_ptr<Xploitability> > engine;
-    engine.push_back( make_unique<XploitabilityBreakpad>( &dump_, &state_) );
-    engine.push_back( make_unique<XploitabilityBangExploitable>( &dump_, &state_) );
+    if( !walker ) {
+        return StatusCode::ERROR;
+    }
 
-    for( const unique_ptr<Xploitability>& mod : engine ) {
-        processEngine(*mod);
-        xploitabilityEngine_ = mod.get();
+    // A walk that the budget cut short still has the frames that it got to.
+    if( !walker->Walk(&quickStack_, &withoutSymbols, &withCorruptSymbols) && !truncated() ) {
+        return StatusCode::ERROR;
+    }
+
+    quickReason_    = MinidumpProcessor::GetCrashReason(&dump_, &quickAddress_);
+    quickContext_   = context->GetContextAMD64();
+    quick_          = true;
+
+    return StatusCode::GOOD;
+}
+
+
+/**
+ * Does actual processing a minidump file
+ * @return Status code
+ */
+StatusCode Triage::process() {
+
+
+    StatusCode   sc;
+
+    sc = analyze(cout);
+    if( StatusCode::GOOD!=sc ) {
+        return StatusCode::ERROR;
     }
 
     // Write the final triage information to the triage.json file
@@ -113,7 +298,7 @@ StatusCode Triage::process() {
     // persist(outminidumpPath.string());
 
 
-    PrintProcessState( state_, true, &resolver_);
+    PrintProcessState( state_, true, resolver_);
 
 
     const ProcessState& process_state = state_;
@@ -126,16 +311,122 @@ StatusCode Triage::process() {
 
 
 
+/**
+ * Processes a minidump file and writes only its JSON, as a single line, without breakpad's human
+ * readable process state. The engines' findings are carried in "output", like in batch mode. The
+ * JSON is serialized straight into the stream, rather than through a string first.
+ * @param out where to write the JSON
+ * @return Status code
+ */
+StatusCode Triage::processJson(ostream& out) {
+    ostringstream   findings;
+
+    if( StatusCode::GOOD!=analyze(findings) ) {
+        return StatusCode::ERROR;
+    }
+
+    json ret = toJson();
+    ret["output"] = findings.str();
+    out << ret << endl;
+    return StatusCode::GOOD;
+}
+
+
+/**
+ * Processes the minidump and runs the exploitability engines on it, without printing the process
+ * state (which breakpad prints straight to stdout). Batch mode uses this directly.
+ * @param out where to write the engines' findings
+ * @return Status code
+ */
+StatusCode Triage::analyze(ostream& out) {
+    StatusCode   sc;
+
+    sc = preProcess();
+    if( StatusCode::GOOD!=sc ) {
+        cerr << "Unable to process dumpfile." << endl;
+        return StatusCode::ERROR;
+    }
+
+
+    out << "-----------------------------------------------" << endl;
+    out << minidumpPath_ << endl;
+    out << "Crashash: " << crashash() << endl;
+    out << "Bucket  : " << bucket() << endl;
+
+
+    // NOTE: The engines live as long as the triage, since toJson() reads the chosen one's context.
+    // They're made here, one at a time, since making one reads the parts of the minidump that it
+    // needs and Minidump reads lazily (and isn't thread safe). Processing them only reads what's
+    // already loaded, so they run concurrently.
+    for( EngineFactory factory : engineFactories ) {
+        unique_ptr<Xploitability> engine = factory( &dump_, &state_, minidumpPath_ );
+        if( engine ) {
+            engines_.push_back( move(engine) );
+        }
+    }
+
+    vector< unique_ptr<XploitabilityResult> >   results( engines_.size() );
+    vector<ostringstream>                       outputs( engines_.size() );
+    vector<double>                              elapsed( engines_.size() );
+    vector<thread>                              workers;
+
+    for( size_t i=0; i<engines_.size(); i++ ) {
+        workers.emplace_back( [this, i, &results, &outputs, &elapsed]() {
+            auto start = chrono::steady_clock::now();
+            results[i] = processEngine( *engines_[i], outputs[i] );
+            elapsed[i] = secondsSince(start);
+        } );
+    }
+
+    for( thread& worker : workers ) {
+        worker.join();
+    }
+
+    for( size_t i=0; i<engines_.size(); i++ ) {
+        timings_.engines.emplace_back( engines_[i]->name(), elapsed[i] );
+    }
+
+    // Merge in engine order, so that the output and ranks() don't depend on which engine finished
+    // first. The context reported comes from the highest ranked engine (the last one, on a tie).
+    XploitabilityRank best = XploitabilityRank::XPLOITABILITY_NONE;
+    for( size_t i=0; i<engines_.size(); i++ ) {
+        out << outputs[i].str();
+
+        if( !xploitabilityEngine_ ) {
+            xploitabilityEngine_ = engines_[i].get();
+        }
+
+        if( !results[i] ) {
+            continue;
+        }
+
+        if( results[i]->rank >= best ) {
+            best = results[i]->rank;
+            xploitabilityEngine_ = engines_[i].get();
+        }
+        results_.push_back( *results[i] );
+    }
+
+    if( !xploitabilityEngine_ ) {
+        return StatusCode::ERROR;
+    }
+
+    return StatusCode::GOOD;
+}
+
+
 /**
  * process a single exploitability engine
  * @param x Which exploitability engine (!exploitable, tracer, breakpad) to use
+ * @param out where to write the engine's findings
+ * @return the engine's result, or NULL if the engine failed
  */
-void Triage::processEngine(Xploitability& x) {
+unique_ptr<XploitabilityResult> Triage::processEngine(Xploitability& x, ostream& out) {
     try {
-        cout << "Processing engine: " << x.name() << endl;
-        const auto result   = x.process();
-        results_.push_back( result );
-        cout << result << endl;
+        out << "Processing engine: " << x.name() << endl;
+        auto result = make_unique<XploitabilityResult>( x.process() );
+        out << *result << endl;
+        return result;
     } catch( string& x1 ) {
         cerr << x1 << endl;
     } catch( exception& x2 ) {
@@ -143,6 +434,17 @@ void Triage::processEngine(Xploitability& x) {
     } catch(...) {
         cerr << "processEngine() error" << endl;
     }
+
+    return nullptr;
+}
+
+
+/**
+ * How long each phase of the last analysis took. Only phases that have run are filled in.
+ * @return the timings
+ */
+const TriageTimings& Triage::timings() const {
+    return timings_;
 }
 
 
@@ -160,15 +462,23 @@ int Triage::signalType() {
 }
 
 
+/*! @return the crashing thread's stack, from whichever of process() or quickProcess() ran */
+const CallStack* Triage::crashingStack() const {
+    if( quick_ ) {
+        return &quickStack_;
+    }
+
+    int threadid = state_.requesting_thread();
+    return state_.threads()->at(threadid);
+}
+
+
 /**
  * Retrieves the call stack from the minidump
  * @return Vector of stack frames
  */
 const vector<uint64_t> Triage::callStack() const {
-    int threadid = state_.requesting_thread();
-    const CallStack* stack = state_.threads()->at(threadid);
-
-    uint8_t     i = 0;
+    const CallStack* stack = crashingStack();
 
     vector<uint64_t> ret;
     for( StackFrame* frame : *stack->frames()  ) {
@@ -205,6 +515,48 @@ const string Triage::crashash() const {
     return oss.str();
 }
 
+/**
+ * Returns the crash's bucket: a 64 bit FNV-1a hash of the crash reason, the faulting module, and
+ * the module-relative return addresses of the crashing thread's top TRIAGE_BUCKET_FRAMES frames,
+ * in order. Unlike the crashash, frames that reorder (or differ past the 12th bit) end up in
+ * different buckets, and crashes deep in one module's callees don't all collide.
+ * NOTE: The crash reason stands in for the exception code; it's derived from the code, and also
+ * tells reads from writes and executes apart for access violations.
+ * @return the bucket, as 16 hex digits
+ */
+const string Triage::bucket() const {
+    const CallStack*    stack   = crashingStack();
+    ostringstream       key;
+
+    key << crashReason();
+
+    size_t i = 0;
+    for( const StackFrame* frame : *stack->frames() ) {
+        if( i++==TRIAGE_BUCKET_FRAMES ) {
+            break;
+        }
+
+        // Frames outside of any module only happen for wild jumps, where the address is the point.
+        if( frame->module ) {
+            key << "|" << PathnameStripper::File( frame->module->code_file() )
+                << "+" << hex << (frame->ReturnAddress() - frame->module->base_address());
+        } else {
+            key << "|?+" << hex << frame->ReturnAddress();
+        }
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for( unsigned char c : key.str() ) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+
+    ostringstream oss;
+    oss << setfill('0') << setw(16) << hex << hash;
+    return oss.str();
+}
+
+
 /**
  * A tag is basically a string that uniquely identifies the crash.
  * It includes exploitability, crash reason, and eventually a unique address
@@ -227,8 +579,10 @@ const string Triage::crashReason()  const {
     string ret;
     regex regexFilter { "[^a-zA-Z0-9_]+" };
 
-    if(  state_.crash_reason().size()>0 ) {
-        ret = state_.crash_reason();
+    const string& reason = quick_ ? quickReason_ : state_.crash_reason();
+
+    if(  reason.size()>0 ) {
+        ret = reason;
     } else {
         ret =  "Unknown";
     }
@@ -242,21 +596,21 @@ const string Triage::crashReason()  const {
  * @return Memory address where the crash occurred
  */
 const uint64_t Triage::crashAddress() const {
-    return state_.crash_address();
+    return quick_ ? quickAddress_ : state_.crash_address();
 }
 
 /**
  * @return the stack pointer when the crash occurred
  */
 const uint64_t Triage::stackPointer() const {
-    return xploitabilityEngine_->stackPointer();
+    return quick_ ? quickContext_->rsp : xploitabilityEngine_->stackPointer();
 }
 
 /**
  * @return instruction pointer when the crash occurred
  */
 const uint64_t Triage::instructionPointer() const {
-    return xploitabilityEngine_->instructionPointer();
+    return quick_ ? quickContext_->rip : xploitabilityEngine_->instructionPointer();
 }
 
 
@@ -294,6 +648,18 @@ vector<XploitabilityRank>   Triage::ranks() const {
 }
 
 
+/**
+ * @return the names of the engines that ranks() came from, in the same order
+ */
+vector<string> Triage::engines() const {
+    vector<string> ret;
+    for( auto& result : results_ ) {
+        ret.push_back(result.moduleName);
+    }
+    return ret;
+}
+
+
 /**
  * @return Stringified version of all three ranks
  */
@@ -318,20 +684,56 @@ const string Triage::minidumpPath() const {
  * @return the json object
  */
 json Triage::toJson() const {
-    auto ctx = xploitabilityEngine_->getContext();
-    return json{
+    json ret = contextJson( xploitabilityEngine_->getContext() );
+    ret.update( json{
         { "crashReason",        crashReason() },
         { "crashAddress",       crashAddress() },
         { "exploitability",     exploitability() },
         { "tag",                triageTag() },
         { "callStack",          callStack() },
         { "crashash",           crashash() },
+        { "bucket",             bucket() },
         { "minidumpPath",       minidumpPath() },
         { "ranks",              ranks() },
+        { "engines",            engines() },
         { "rank",               exploitabilityRank() },
         { "instructionPointer", instructionPointer() },
         { "stackPointer",       stackPointer() },
         { "triage",             xploitabilityEngine_->str() },
+        { "truncated",          truncated() }
+    } );
+    return ret;
+}
+
+
+/**
+ * Converts what quickProcess() found into a json object. It's toJson() without the exploitability
+ * fields, which only a full triage can fill in.
+ * @return the json object
+ */
+json Triage::quickJson() const {
+    json ret = contextJson(quickContext_);
+    ret.update( json{
+        { "crashReason",        crashReason() },
+        { "crashAddress",       crashAddress() },
+        { "callStack",          callStack() },
+        { "crashash",           crashash() },
+        { "bucket",             bucket() },
+        { "minidumpPath",       minidumpPath() },
+        { "instructionPointer", instructionPointer() },
+        { "stackPointer",       stackPointer() },
+        { "truncated",          truncated() }
+    } );
+    return ret;
+}
+
+
+/**
+ * Converts the crashing thread's registers into a json object
+ * @return the json object
+ */
+json Triage::contextJson(const MDRawContextAMD64* ctx) {
+    return json{
         { "context_flags",      ctx->context_flags },
         { "cs",                 ctx->cs },
         { "dr0",                ctx->dr0 },
@@ -9,13 +9,17 @@
 #define Triage_H
 
 #include "Xploitability.h"
+#include "frame_info_cache.h"
 #include "google_breakpad/processor/basic_source_line_resolver.h"
+#include "google_breakpad/processor/call_stack.h"
 #include "google_breakpad/processor/minidump_processor.h"
 #include "google_breakpad/processor/process_state.h"
 #include "simple_symbol_supplier.h"
 #include <filesystem>
 #include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "vendor/json.hpp"
 using json = nlohmann::json;
@@ -33,19 +37,49 @@ enum StatusCode {
 };
 
 
+/*! How many of the crashing thread's frames go into its bucket */
+#define TRIAGE_BUCKET_FRAMES    8
+
+/*! How many of the crashing thread's frames get symbolized in JSON-only mode */
+#define TRIAGE_JSON_FRAMES      32
+
+
+/**
+ * How long each phase of a triage took, in seconds. Phases that didn't run are left at 0, and
+ * engines that didn't apply to the minidump aren't listed.
+ */
+struct TriageTimings {
+    /*! Minidump::Read */
+    double                              read        = 0;
+    /*! MinidumpProcessor::Process (stack walking and symbolization) */
+    double                              process     = 0;
+    /*! Each exploitability engine that ran, by name, in engine order. The engines run at the same
+        time, so these overlap. */
+    vector< pair<string, double> >      engines;
+};
+
+
 class Triage {
 
 public:
-    Triage( const string& path );
+    Triage( const string& path, SourceLineResolverInterface* resolver = nullptr,
+            SymbolSupplier* supplier = nullptr, FrameInfoCache* frameCache = nullptr );
 
     StatusCode                  process();
+    StatusCode                  processJson(ostream& out);
+    void                        focusSymbols(size_t frames);
+    void                        budget(const StackBudget& budget);
+    bool                        truncated()                 const;
+    StatusCode                  analyze(ostream& out);
     StatusCode                  preProcess();
+    StatusCode                  quickProcess();
     XploitabilityRank           exploitabilityRank()        const;
     const string                crashReason()               const;
     const string                exploitability()            const;
     const string                minidumpPath()              const;
     const string                ranksString()               const;
     const string                crashash()                 const;
+    const string                bucket()                    const;
     const string                triageTag()                 const;
     const uint64_t              crashAddress()              const;
     const uint64_t              instructionPointer()        const;
@@ -54,22 +88,46 @@ public:
     friend ostream&             operator<< (ostream& os, Triage& self);
     int                         signalType();
     json                        toJson()                    const;
+    json                        quickJson()                 const;
     static double               normalize(double x);
+    static json                 contextJson(const MDRawContextAMD64* ctx);
     vector<XploitabilityRank>   ranks()                     const;
+    vector<string>              engines()                   const;
+    const TriageTimings&        timings()                   const;
     void                        persist(const string path)  const;
-    void                        processEngine(Xploitability& x);
+    static unique_ptr<XploitabilityResult> processEngine(Xploitability& x, ostream& out = cout);
 
 private:
-
-    BasicSourceLineResolver         resolver_;
+    void                        markCrashingThread();
+    const CallStack*            crashingStack()             const;
+
+    BasicSourceLineResolver         ownResolver_;
+    SimpleSymbolSupplier            ownSupplier_;
+    SourceLineResolverInterface*    resolver_;
+    SymbolSupplier*                 supplier_;
+    CachingFrameSymbolizer          symbolizer_;
     Minidump                        dump_;
     MinidumpProcessor               proc_;
     ProcessState                    state_;
-    SimpleSymbolSupplier            symbolSupplier_;
     const string                    minidumpPath_;
     fs::path                        dirPath_;
     vector<XploitabilityResult>     results_;
     Xploitability*                  xploitabilityEngine_;
+    vector< unique_ptr<Xploitability> > engines_;
+
+    /*! How many of the crashing thread's frames to symbolize, or 0 for all threads' */
+    size_t                          focusFrames_;
+
+    /*! The limits on stack walking */
+    StackBudget                     budget_;
+
+    /*! Whether quickProcess() (rather than preProcess()) filled in the crash state */
+    bool                            quick_;
+    TriageTimings                   timings_;
+    CallStack                       quickStack_;
+    string                          quickReason_;
+    uint64_t                        quickAddress_;
+    const MDRawContextAMD64*        quickContext_;
 
 };
 
@@ -0,0 +1,278 @@
+// XXX_INCLUDE_TOB_COPYRIGHT_HERE
+
+// main() for triage_bench.exe, which times triager.exe's code paths over a fixed set of minidumps.
+
+
+#include "frame_info_cache.h"
+#include "symbol_cache.h"
+#include "triage.h"
+#include "google_breakpad/processor/fast_source_line_resolver.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+void usage(char* argv[]) {
+    cout << "Syntax : " << argv[0] << " [options] <minidump or dir> [... <minidump or dir>]" << endl;
+    cout << "Example: " << argv[0] << " --symbol-cache C:\\cache --iterations 5 runs" << endl;
+    cout << endl;
+    cout << "Triages every minidump given (and every .dmp under each directory given) the way" << endl;
+    cout << "triager.exe does, and reports how long each phase took: Minidump::Read," << endl;
+    cout << "MinidumpProcessor::Process, each exploitability engine, and the JSON output." << endl;
+    cout << endl;
+    cout << "Options:" << endl;
+    cout << "  --symbols <dir>        look for .sym files under <dir> (may be repeated)" << endl;
+    cout << "  --symbol-cache <dir>   cache serialized symbols under <dir>, and load them from it" << endl;
+    cout << "  --focus                only symbolize the top frames of the crashing thread, like" << endl;
+    cout << "                         triager.exe --json" << endl;
+    cout << "  --cold                 give every triage its own symbols and frame info, rather" << endl;
+    cout << "                         than sharing them like a batch worker does" << endl;
+    cout << "  --iterations <n>       triage the whole set <n> times (default 3)" << endl;
+    cout << "  --json                 print the results as JSON instead of a table" << endl;
+}
+
+
+/*! Where triages get their symbols from */
+static vector<string> symbolPaths;
+
+/*! Where serialized symbols are cached, if anywhere */
+static string symbolCacheDir;
+
+
+/**
+ * A resolver and the supplier that it gets its symbols from; the same as triager.exe's.
+ * NOTE: The supplier is declared first, so that it outlives the resolver.
+ */
+struct Symbols {
+    unique_ptr<SymbolSupplier>              supplier;
+    unique_ptr<SourceLineResolverInterface> resolver;
+};
+
+
+/*! Makes a new set of symbols, per the command line */
+static Symbols makeSymbols() {
+    Symbols symbols;
+
+    if( !symbolCacheDir.empty() ) {
+        symbols.supplier.reset( new sl2::SymbolCache(symbolPaths, symbolCacheDir) );
+        symbols.resolver.reset( new FastSourceLineResolver() );
+    } else {
+        if( !symbolPaths.empty() ) {
+            symbols.supplier.reset( new SimpleSymbolSupplier(symbolPaths) );
+        }
+        symbols.resolver.reset( new BasicSourceLineResolver() );
+    }
+
+    return symbols;
+}
+
+
+/*! @return the seconds since `start` */
+static double secondsSince( chrono::steady_clock::time_point start ) {
+    return chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+}
+
+
+/*! Every sample of each phase, in seconds, in the order that the phases were first seen in */
+static vector< pair<string, vector<double> > > phases;
+
+
+/*! Records a sample of a phase */
+static void record(const string& phase, double seconds) {
+    auto it = find_if( phases.begin(), phases.end(),
+                       [&phase](const pair<string, vector<double> >& p) { return p.first==phase; } );
+
+    if( it==phases.end() ) {
+        phases.emplace_back( phase, vector<double>() );
+        it = phases.end() - 1;
+    }
+    it->second.push_back(seconds);
+}
+
+
+/**
+ * @param samples a phase's samples, sorted
+ * @param fraction the percentile, as a fraction
+ * @return the percentile, in milliseconds
+ */
+static double percentileMs(const vector<double>& samples, double fraction) {
+    size_t i = min( samples.size()-1, (size_t)(samples.size() * fraction) );
+    return samples[i] * 1000;
+}
+
+
+/**
+ * Adds a minidump, or every .dmp under a directory, to the set.
+ * @param path the minidump or directory
+ * @param dumps the set
+ */
+static void collect(const string& path, vector<string>& dumps) {
+    if( !fs::is_directory(path) ) {
+        dumps.push_back(path);
+        return;
+    }
+
+    vector<string> found;
+    for( const auto& entry : fs::recursive_directory_iterator(path) ) {
+        if( fs::is_regular_file(entry.path()) && entry.path().extension()==".dmp" ) {
+            found.push_back( entry.path().string() );
+        }
+    }
+
+    // NOTE: Directory order isn't stable, and the set should be triaged the same way every time.
+    sort( found.begin(), found.end() );
+    dumps.insert( dumps.end(), found.begin(), found.end() );
+}
+
+
+int main(int argc, char* argv[] ) {
+    bool    focus       = false;
+    bool    cold        = false;
+    bool    jsonOut     = false;
+    int     iterations  = 3;
+    int     i           = 1;
+
+    for( ; i<argc; i++ ) {
+        string arg = argv[i];
+
+        if( arg=="--symbols" && i+1<argc ) {
+            symbolPaths.push_back(argv[++i]);
+        } else if( arg=="--symbol-cache" && i+1<argc ) {
+            symbolCacheDir = argv[++i];
+        } else if( arg=="--focus" ) {
+            focus = true;
+        } else if( arg=="--cold" ) {
+            cold = true;
+        } else if( arg=="--iterations" && i+1<argc ) {
+            iterations = max( 1, atoi(argv[++i]) );
+        } else if( arg=="--json" ) {
+            jsonOut = true;
+        } else {
+            break;
+        }
+    }
+
+    vector<string> dumps;
+    for( ; i<argc; i++ ) {
+        collect(argv[i], dumps);
+    }
+
+    if( dumps.empty() ) {
+        usage(argv);
+        return -1;
+    }
+
+    Symbols                 shared      = makeSymbols();
+    sl2::FrameInfoCache     sharedCache;
+    size_t                  triaged     = 0;
+    size_t                  failures    = 0;
+    auto                    started     = chrono::steady_clock::now();
+
+    for( int iteration=0; iteration<iterations; iteration++ ) {
+        for( const string& path : dumps ) {
+            Symbols                 own;
+            sl2::FrameInfoCache     ownCache;
+            Symbols&                symbols     = cold ? (own = makeSymbols()) : shared;
+            sl2::FrameInfoCache&    frameCache  = cold ? ownCache : sharedCache;
+            auto                    start       = chrono::steady_clock::now();
+
+            try {
+                sl2::Triage triage(path, symbols.resolver.get(), symbols.supplier.get(),
+                                   &frameCache);
+                ostringstream findings;
+
+                if( focus ) {
+                    triage.focusSymbols(TRIAGE_JSON_FRAMES);
+                }
+
+                if( triage.analyze(findings)!=sl2::GOOD ) {
+                    failures++;
+                    continue;
+                }
+
+                // The same JSON that triager.exe --json writes, serialized the same way.
+                auto jsonStart = chrono::steady_clock::now();
+                ostringstream out;
+                json ret = triage.toJson();
+                ret["output"] = findings.str();
+                out << ret << endl;
+                double jsonTime = secondsSince(jsonStart);
+
+                const sl2::TriageTimings& timings = triage.timings();
+                record( "read", timings.read );
+                record( "process", timings.process );
+                for( const auto& engine : timings.engines ) {
+                    record( "engine:" + engine.first, engine.second );
+                }
+                record( "json", jsonTime );
+                record( "total", secondsSince(start) );
+                triaged++;
+            } catch (...) {
+                failures++;
+            }
+        }
+    }
+
+    double wall = secondsSince(started);
+    for( auto& phase : phases ) {
+        sort( phase.second.begin(), phase.second.end() );
+    }
+
+    if( jsonOut ) {
+        json ret = {
+            { "dumps", dumps.size() },
+            { "iterations", iterations },
+            { "triaged", triaged },
+            { "failures", failures },
+            { "cold", cold },
+            { "focus", focus },
+            { "symbolCache", !symbolCacheDir.empty() },
+            { "wallSeconds", wall },
+            { "triagesPerSecond", wall>0 ? triaged / wall : 0 },
+        };
+
+        for( const auto& phase : phases ) {
+            double total = 0;
+            for( double sample : phase.second ) {
+                total += sample;
+            }
+
+            ret["phases"][phase.first] = {
+                { "count", phase.second.size() },
+                { "totalMs", total * 1000 },
+                { "meanMs", total * 1000 / phase.second.size() },
+                { "p50Ms", percentileMs(phase.second, 0.5) },
+                { "p90Ms", percentileMs(phase.second, 0.9) },
+                { "maxMs", phase.second.back() * 1000 },
+            };
+        }
+
+        cout << ret.dump(2) << endl;
+        return failures ? 1 : 0;
+    }
+
+    printf("%zu triages of %zu minidumps in %.3fs (%.1f/s), %zu failed\n", triaged, dumps.size(),
+           wall, wall>0 ? triaged / wall : 0, failures);
+    printf("%-32s %8s %12s %10s %10s %10s\n", "phase", "count", "total (ms)", "mean (ms)",
+           "p50 (ms)", "p90 (ms)");
+
+    for( const auto& phase : phases ) {
+        double total = 0;
+        for( double sample : phase.second ) {
+            total += sample;
+        }
+
+        printf("%-32s %8zu %12.1f %10.3f %10.3f %10.3f\n", phase.first.c_str(), phase.second.size(),
+               total * 1000, total * 1000 / phase.second.size(), percentileMs(phase.second, 0.5),
+               percentileMs(phase.second, 0.9));
+    }
+
+    return failures ? 1 : 0;
+}
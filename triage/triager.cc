@@ -4,33 +4,375 @@
 
 
 #include "statz.h"
+#include "symbol_cache.h"
 #include "triage.h"
+#include "google_breakpad/processor/fast_source_line_resolver.h"
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
 
 using namespace std;
 
 
 void usage(char* argv[]) {
-    cout << "Syntax : " << argv[0] << " <minidump1> [minidump2 ... minidumpN]" << endl;
-    cout << "Example: " << argv[0] << " mem.dmp crash2.dmp" << endl;
+    cout << "Syntax : " << argv[0] << " [options] <minidump1> [minidump2 ... minidumpN]" << endl;
+    cout << "         " << argv[0] << " [options] --batch [workers]" << endl;
+    cout << "Example: " << argv[0] << " --symbols C:\\symbols mem.dmp crash2.dmp" << endl;
+    cout << endl;
+    cout << "With --batch, minidump paths are read from stdin (one per line, until EOF) and each" << endl;
+    cout << "result is written to stdout as a line of JSON, as soon as it's ready." << endl;
+    cout << endl;
+    cout << "Options:" << endl;
+    cout << "  --symbols <dir>        look for .sym files under <dir> (may be repeated)" << endl;
+    cout << "  --symbol-cache <dir>   cache serialized symbols under <dir>, and load them from it" << endl;
+    cout << "  --prefetch             with --symbol-cache, cache the symbols of every module in the" << endl;
+    cout << "                         minidumps (in parallel) before triaging any of them. With" << endl;
+    cout << "                         --batch, the whole batch is read from stdin first" << endl;
+    cout << "  --known <file>         skip the full triage of crashes whose bucket is listed in" << endl;
+    cout << "                         <file> (one per line); their JSON has \"duplicate\": true" << endl;
+    cout << "  --crashing-thread-only only walk the crashing thread's stack" << endl;
+    cout << "  --max-frames <n>       walk at most <n> frames of each thread's stack" << endl;
+    cout << "  --max-scan-words <n>   try at most <n> stack words as return addresses, per minidump" << endl;
+    cout << "  --time-budget <ms>     give up on walking a minidump's stacks after <ms> milliseconds" << endl;
+    cout << "                         (stacks cut short by any of these are marked \"truncated\")" << endl;
+    cout << "  --json                 only write each result's JSON, and only symbolize the top" << endl;
+    cout << "                         frames of the crashing thread" << endl;
 }
 
+
+/*! Where triages get their symbols from */
+static vector<string> symbolPaths;
+
+/*! Where serialized symbols are cached, if anywhere */
+static string symbolCacheDir;
+
+/*! Whether to fill the symbol cache before triaging, per --prefetch */
+static bool prefetchOn = false;
+
+/*! The limits on walking each minidump's stacks */
+static sl2::StackBudget stackBudget;
+
+/*! Whether to write out JSON only, per --json */
+static bool jsonOnly = false;
+
+/*! The CFI rule sets and Windows frame info found while stack walking, shared by every triage */
+static sl2::FrameInfoCache frameInfoCache;
+
+
+/**
+ * A resolver and the supplier that it gets its symbols from. With a symbol cache, modules are
+ * loaded by a FastSourceLineResolver straight out of their (mapped) cache files.
+ * NOTE: The supplier is declared first, so that it outlives the resolver: a FastSourceLineResolver
+ * uses the supplier's buffers in place.
+ */
+struct Symbols {
+    unique_ptr<SymbolSupplier>              supplier;
+    unique_ptr<SourceLineResolverInterface> resolver;
+};
+
+
+/*! Makes a new set of symbols, per the command line */
+static Symbols makeSymbols() {
+    Symbols symbols;
+
+    if( !symbolCacheDir.empty() ) {
+        symbols.supplier.reset( new sl2::SymbolCache(symbolPaths, symbolCacheDir) );
+        symbols.resolver.reset( new FastSourceLineResolver() );
+    } else {
+        if( !symbolPaths.empty() ) {
+            symbols.supplier.reset( new SimpleSymbolSupplier(symbolPaths) );
+        }
+        symbols.resolver.reset( new BasicSourceLineResolver() );
+    }
+
+    return symbols;
+}
+
+
+/*! The buckets of crashes that don't need a full triage, if --known was given */
+static set<string> knownCrashes;
+static bool knownOn = false;
+
+/*! Guards knownCrashes between batch workers */
+static mutex knownMutex;
+
+
+/**
+ * Reads the known crashes index: one bucket per line.
+ * @return false if the index couldn't be opened
+ */
+static bool loadKnown(const string& path) {
+    ifstream in(path);
+    string line;
+
+    if( !in ) {
+        return false;
+    }
+
+    while( getline(in, line) ) {
+        if( !line.empty() && line.back()=='\r' ) {
+            line.pop_back();
+        }
+
+        if( !line.empty() ) {
+            knownCrashes.insert(line);
+        }
+    }
+
+    knownOn = true;
+    return true;
+}
+
+
+/**
+ * Checks a minidump's bucket against the known crashes, without fully triaging it. A crash
+ * that isn't known yet is added, so that its duplicates later on are skipped too.
+ * @param path the minidump
+ * @param symbols the symbols to stackwalk with; the same ones as the full triage
+ * @return the quick triage's JSON (marked as a duplicate) if the crash is known; null if it
+ *         needs a full triage
+ */
+static json checkKnown(const string& path, Symbols& symbols) {
+    if( !knownOn ) {
+        return nullptr;
+    }
+
+    sl2::Triage triage(path, symbols.resolver.get(), symbols.supplier.get(),
+                       &frameInfoCache);
+    triage.budget(stackBudget);
+    if( triage.quickProcess()!=sl2::GOOD ) {
+        return nullptr;
+    }
+
+    const string bucket = triage.bucket();
+    {
+        lock_guard<mutex> lock(knownMutex);
+        if( knownCrashes.insert(bucket).second ) {
+            return nullptr;
+        }
+    }
+
+    json ret = triage.quickJson();
+    ret["duplicate"] = true;
+    return ret;
+}
+
+
+/*! Guards stdin and stdout (and the prefetched batch) between batch workers */
+static mutex batchMutex;
+
+/*! The batch, when it was read up front to be prefetched, and the next minidump in it */
+static vector<string> batchPaths;
+static size_t batchNext = 0;
+
+
+/**
+ * Takes the next minidump path of the batch: off of stdin, or out of the prefetched batch.
+ * Must be called with batchMutex held.
+ * @return false once there are none left
+ */
+static bool nextBatchPath(string& path) {
+    if( prefetchOn ) {
+        if( batchNext==batchPaths.size() ) {
+            return false;
+        }
+
+        path = batchPaths[batchNext++];
+        return true;
+    }
+
+    return (bool)getline(cin, path);
+}
+
+
+/**
+ * Caches the symbols of every module in some minidumps, ahead of triaging them.
+ * @param paths the minidumps
+ */
+static void prefetchSymbols(const vector<string>& paths) {
+    if( symbolCacheDir.empty() ) {
+        cerr << "--prefetch needs --symbol-cache, not prefetching" << endl;
+        return;
+    }
+
+    sl2::SymbolCache cache(symbolPaths, symbolCacheDir);
+    cache.prefetch(paths, 0);
+}
+
+
+/**
+ * A batch worker. Takes minidump paths off of stdin until there are none left, and writes
+ * each one's triage out as a line of JSON. Results come out in the order that they finish in,
+ * so each carries its minidumpPath.
+ * The worker's symbols are shared by all of its triages, so that the symbols of modules that
+ * keep showing up (i.e., the target's) are only loaded once per worker.
+ * NOTE: Breakpad prints the process state straight to stdout, so batch results carry the
+ * engines' findings in "output" instead of the full process state.
+ */
+static void batchWorker() {
+    Symbols symbols = makeSymbols();
+    string path;
+
+    for(;;) {
+        {
+            lock_guard<mutex> lock(batchMutex);
+            if( !nextBatchPath(path) ) {
+                return;
+            }
+        }
+
+        if( !path.empty() && path.back()=='\r' ) {
+            path.pop_back();
+        }
+
+        if( path.empty() ) {
+            continue;
+        }
+
+        json result;
+        try {
+            result = checkKnown(path, symbols);
+            if( !result.is_null() ) {
+                result["output"] = "";
+                lock_guard<mutex> lock(batchMutex);
+                cout << result << endl;
+                continue;
+            }
+
+            sl2::Triage triage(path, symbols.resolver.get(), symbols.supplier.get(),
+                               &frameInfoCache);
+            triage.budget(stackBudget);
+            ostringstream output;
+
+            if( jsonOnly ) {
+                triage.focusSymbols(TRIAGE_JSON_FRAMES);
+            }
+
+            if( triage.analyze(output)==sl2::GOOD ) {
+                result = triage.toJson();
+                result["output"] = output.str();
+            } else {
+                result = json{ { "minidumpPath", path }, { "error", "unable to process dumpfile" } };
+            }
+        } catch (...) {
+            result = json{ { "minidumpPath", path }, { "error", "error on processing" } };
+        }
+
+        lock_guard<mutex> lock(batchMutex);
+        cout << result << endl;
+    }
+}
+
+
+/**
+ * Triages minidumps from stdin until EOF, on a pool of workers.
+ * @param workers the number of workers, or 0 for one per core
+ */
+static int batch(unsigned int workers) {
+    if( workers==0 ) {
+        workers = max(1u, thread::hardware_concurrency());
+    }
+
+    if( prefetchOn ) {
+        string path;
+
+        while( getline(cin, path) ) {
+            if( !path.empty() && path.back()=='\r' ) {
+                path.pop_back();
+            }
+
+            if( !path.empty() ) {
+                batchPaths.push_back(path);
+            }
+        }
+
+        prefetchSymbols(batchPaths);
+    }
+
+    vector<thread> pool;
+    for( unsigned int i=0; i<workers; i++ ) {
+        pool.emplace_back(batchWorker);
+    }
+
+    for( thread& worker : pool ) {
+        worker.join();
+    }
+
+    return 0;
+}
+
+
 int main(int argc, char* argv[] ) {
 
     uint32_t parity = 0;
     int i=1;
 
-    if(argc==1) {
+    for( ; i<argc; i++ ) {
+        string arg = argv[i];
+
+        if( arg=="--symbols" && i+1<argc ) {
+            symbolPaths.push_back(argv[++i]);
+        } else if( arg=="--symbol-cache" && i+1<argc ) {
+            symbolCacheDir = argv[++i];
+        } else if( arg=="--crashing-thread-only" ) {
+            stackBudget.crashingThreadOnly = true;
+        } else if( arg=="--max-frames" && i+1<argc ) {
+            stackBudget.maxFrames = strtoul(argv[++i], NULL, 10);
+        } else if( arg=="--max-scan-words" && i+1<argc ) {
+            stackBudget.maxScanWords = strtoul(argv[++i], NULL, 10);
+        } else if( arg=="--time-budget" && i+1<argc ) {
+            stackBudget.wallClockMs = strtoull(argv[++i], NULL, 10);
+        } else if( arg=="--prefetch" ) {
+            prefetchOn = true;
+        } else if( arg=="--json" ) {
+            jsonOnly = true;
+        } else if( arg=="--known" && i+1<argc ) {
+            if( !loadKnown(argv[++i]) ) {
+                cerr << "unable to read the known crashes from " << argv[i] << endl;
+            }
+        } else {
+            break;
+        }
+    }
+
+    if( i==argc ) {
         usage(argv);
         return -1;
     }
 
+    if( string(argv[i])=="--batch" ) {
+        return batch( i+1<argc ? (unsigned int)strtoul(argv[i+1], NULL, 10) : 0 );
+    }
 
-    for( i=1; i<argc; i++ ) {
+    if( prefetchOn ) {
+        prefetchSymbols( vector<string>(argv + i, argv + argc) );
+    }
+
+    Symbols symbols = makeSymbols();
+
+    for( ; i<argc; i++ ) {
         try {
-            sl2::Triage triage = string(argv[i]);
+            json duplicate = checkKnown(argv[i], symbols);
+            if( !duplicate.is_null() ) {
+                cout << duplicate << endl;
+                continue;
+            }
+
+            sl2::Triage triage(argv[i], symbols.resolver.get(), symbols.supplier.get(),
+                               &frameInfoCache);
+            triage.budget(stackBudget);
+
+            if( jsonOnly ) {
+                triage.focusSymbols(TRIAGE_JSON_FRAMES);
+                triage.processJson(cout);
+                continue;
+            }
+
             sl2::StatusCode sc = triage.process();
 
             if(sc!=sl2::GOOD) {
@@ -47,4 +389,3 @@ int main(int argc, char* argv[] ) {
     return 0;
 
 }
-
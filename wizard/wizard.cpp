@@ -1,4 +1,5 @@
 #include <map>
+#include <set>
 #include <iostream>
 #include <codecvt>
 
@@ -11,6 +12,122 @@ using namespace std;
 /*! Creates a client for the wizard to use (not inherited) */
 static SL2Client client;
 
+/*! Which hash to record each call's arguments with */
+static droption_t<std::string> op_arg_hash(DROPTION_SCOPE_CLIENT, "arg_hash", "sha256",
+                                           "Argument hash",
+                                           "Hash to record arguments with (sha256 or fnv1a64)");
+
+/*! The SL2_ARG_HASH_* format picked with op_arg_hash */
+static uint32_t arg_hash_version = SL2_ARG_HASH_SHA256;
+
+/*! Summarize each call site instead of reporting every call */
+static droption_t<bool> op_aggregate(DROPTION_SCOPE_CLIENT, "aggregate", false,
+                                     "Aggregate call sites",
+                                     "Report one finding per call site (function, return address "
+                                     "and source) on exit, instead of one per call");
+
+/*! Measure how much code runs for the first time after each call */
+static droption_t<bool> op_influence(DROPTION_SCOPE_CLIENT, "influence", false, "Measure influence",
+                                     "Count the basic blocks (and conditional branches) that run "
+                                     "for the first time after each call, before the next one, "
+                                     "and report them with its finding");
+
+/*! The code that ran for the first time after a call (or the calls at a call site), for
+ * -influence */
+struct sl2_influence {
+  uint64_t blocks;
+  uint64_t branches;
+};
+
+/*! Identifies a call site, for -aggregate */
+struct sl2_call_site_key {
+  Function function;
+  uint64_t retAddrOffset;
+  wstring source;
+
+  bool operator<(const sl2_call_site_key &other) const {
+    if (function != other.function) {
+      return function < other.function;
+    }
+
+    if (retAddrOffset != other.retAddrOffset) {
+      return retAddrOffset < other.retAddrOffset;
+    }
+
+    return source < other.source;
+  }
+};
+
+/*! The summary of the calls at a single call site, for -aggregate */
+struct sl2_call_site {
+  /*! The first call's index and return address count, which identify it as a target */
+  uint64_t callCount;
+  uint64_t retAddrCount;
+  /*! The last call's index */
+  uint64_t lastCallCount;
+  /*! The number of calls */
+  uint64_t calls;
+  /*! The smallest range of the source that covers every call's read */
+  size_t start;
+  size_t end;
+  /*! The first call's argument hash, if it had one */
+  char argHash[SL2_HASH_LEN + 1];
+  bool hasArgHash;
+  /*! The first few bytes of the first call's read */
+  uint8_t buffer[64];
+  size_t bufferSize;
+  /*! The code that ran for the first time after the calls, with -influence */
+  sl2_influence influence;
+};
+
+typedef std::map<sl2_call_site_key, sl2_call_site, std::less<sl2_call_site_key>,
+                 sl2_region_allocator<std::pair<const sl2_call_site_key, sl2_call_site>>>
+    sl2_call_site_map;
+
+/*! Every call site seen so far, with -aggregate */
+static sl2_call_site_map call_sites;
+/*! Guards call_sites */
+static void *call_sites_lock = NULL;
+
+/*! Identifies a single call, for -influence: its function, and its index among that function's
+ * calls */
+typedef std::pair<Function, uint64_t> sl2_call_key;
+
+typedef std::map<sl2_call_key, sl2_influence, std::less<sl2_call_key>,
+                 sl2_region_allocator<std::pair<const sl2_call_key, sl2_influence>>>
+    sl2_influence_map;
+
+/*! The most modules whose code counts towards -influence */
+#define SL2_MAX_INFLUENCE_MODULES 256
+
+/*! The influence of every call that was followed by new code, without -aggregate */
+static sl2_influence_map call_influence;
+/*! The last call, which new code is counted towards, and whether there's been one yet */
+static sl2_call_key current_call;
+static bool current_call_seen = false;
+/*! The last call's influence: in call_influence, or its call site's with -aggregate. NULL until
+ * new code runs after it */
+static sl2_influence *current_influence = NULL;
+/*! The start of every block that's been counted, since blocks can be built more than once */
+static std::set<app_pc, std::less<app_pc>, sl2_region_allocator<app_pc>> influence_blocks;
+/*! The modules whose code counts towards -influence: every one outside of the Windows directory */
+static std::pair<app_pc, app_pc> influence_modules[SL2_MAX_INFLUENCE_MODULES];
+static size_t influence_module_count = 0;
+static char windows_dir[MAX_PATH + 1];
+/*! Guards everything above. NULL unless -influence was given */
+static void *influence_lock = NULL;
+
+/*! The most distinct comparison constants we'll report to the harness */
+#define SL2_MAX_CMP_VALUES 1024
+
+/*! The bounds of the application's main module, whose comparisons we're interested in */
+static app_pc app_start = NULL;
+static app_pc app_end = NULL;
+/*! (size, value) pairs of the immediates that the application has compared against */
+static std::set<std::pair<uint32_t, uint64_t>> cmp_values;
+/*! Guards cmp_values */
+static void *cmp_lock = NULL;
+
 /** Print a debug message when a new thread starts */
 static void on_thread_init(void *drcontext) {
   SL2_DR_DEBUG("wizard#on_thread_init\n");
@@ -27,21 +144,146 @@ static void on_thread_exit(void *drcontext) {
 static bool on_exception(void *drcontext, dr_exception_t *excpt) {
   SL2_DR_DEBUG("The target application crashed under the wizard!\n");
 
-  json j;
-
-  j["type"] = "error";
-  j["exception"] = client.exception_to_string(excpt->record->ExceptionCode);
-
-  SL2_LOG_JSONL(j);
+  sl2_event ev;
+  sl2_event_begin(&ev, "error");
+  sl2_event_str(&ev, "exception", client.exception_to_string(excpt->record->ExceptionCode));
+  client.emit_event(&ev, true);
 
   dr_exit_process(1);
   return true;
 }
 
+/**
+ * Records the immediate operands of the comparisons in each new block of the main module, so
+ * that the harness can turn them into tokens for the fuzzer's dictionary. Nothing is inserted;
+ * we only look at blocks as they're built, so every block that runs gets looked at once.
+ */
+static dr_emit_flags_t on_bb_cmp(void *drcontext, void *tag, instrlist_t *bb, bool for_trace,
+                                 bool translating) {
+  app_pc pc = dr_fragment_app_pc(tag);
+
+  if (for_trace || translating || pc < app_start || pc >= app_end) {
+    return DR_EMIT_DEFAULT;
+  }
+
+  for (instr_t *instr = instrlist_first_app(bb); instr != NULL; instr = instr_get_next_app(instr)) {
+    if (instr_get_opcode(instr) != OP_cmp) {
+      continue;
+    }
+
+    for (int i = 0; i < instr_num_srcs(instr); i++) {
+      opnd_t src = instr_get_src(instr, i);
+
+      if (!opnd_is_immed_int(src)) {
+        continue;
+      }
+
+      uint32_t size = opnd_size_in_bytes(opnd_get_size(src));
+      ptr_int_t value = opnd_get_immed_int(src);
+
+      // Single bytes and small values are already covered by strategyKnownValues.
+      if (size < 2 || (value >= -256 && value <= 256)) {
+        continue;
+      }
+
+      dr_mutex_lock(cmp_lock);
+      if (cmp_values.size() < SL2_MAX_CMP_VALUES) {
+        cmp_values.insert(std::make_pair(size, (uint64_t)value));
+      }
+      dr_mutex_unlock(cmp_lock);
+    }
+  }
+
+  return DR_EMIT_DEFAULT;
+}
+
+/**
+ * @param pc the start of a block
+ * @return whether the block's code counts towards -influence
+ * Callers must hold influence_lock.
+ */
+static bool in_influence_module(app_pc pc) {
+  for (size_t i = 0; i < influence_module_count; i++) {
+    if (pc >= influence_modules[i].first && pc < influence_modules[i].second) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Counts each block of an application module towards the influence of the last call before it
+ * first ran, for -influence. Like on_bb_cmp, nothing is inserted: blocks are counted as they're
+ * built, which is the first time that they run.
+ */
+static dr_emit_flags_t on_bb_influence(void *drcontext, void *tag, instrlist_t *bb,
+                                       bool for_trace, bool translating) {
+  app_pc pc = dr_fragment_app_pc(tag);
+
+  if (for_trace || translating) {
+    return DR_EMIT_DEFAULT;
+  }
+
+  dr_mutex_lock(influence_lock);
+
+  if (!current_call_seen || !in_influence_module(pc) || !influence_blocks.insert(pc).second) {
+    dr_mutex_unlock(influence_lock);
+    return DR_EMIT_DEFAULT;
+  }
+
+  if (!current_influence) {
+    current_influence = &call_influence[current_call];
+  }
+
+  instr_t *last = instrlist_last_app(bb);
+
+  current_influence->blocks++;
+  if (last && instr_is_cbr(last)) {
+    current_influence->branches++;
+  }
+
+  dr_mutex_unlock(influence_lock);
+
+  return DR_EMIT_DEFAULT;
+}
+
+static void emit_call_sites();
+static void emit_influence();
+
 /** Clean up after the target binary exits */
 static void on_dr_exit(void) {
   SL2_DR_DEBUG("wizard#on_dr_exit\n");
 
+  if (influence_lock) {
+    drmgr_unregister_bb_app2app_event(on_bb_influence);
+  }
+
+  emit_call_sites();
+
+  if (influence_lock) {
+    emit_influence();
+    dr_mutex_destroy(influence_lock);
+    influence_lock = NULL;
+  }
+
+  for (auto &cmp : cmp_values) {
+    sl2_event ev;
+    sl2_event_begin(&ev, "cmp");
+    sl2_event_uint(&ev, "size", cmp.first);
+    sl2_event_uint(&ev, "value", cmp.second);
+    client.emit_event(&ev);
+  }
+
+  client.exit_profile();
+
+  drmgr_unregister_bb_app2app_event(on_bb_cmp);
+  dr_mutex_destroy(cmp_lock);
+  dr_mutex_destroy(call_sites_lock);
+  client.exit_events();
+  client.exit_handle_cache();
+  client.exit_read_info_pool();
+
   drwrap_exit();
 
   if (!drmgr_unregister_thread_init_event(on_thread_init) ||
@@ -50,6 +292,9 @@ static void on_dr_exit(void) {
   }
 
   drmgr_exit();
+
+  // The containers that are still alive keep their nodes until they're destroyed.
+  sl2_region_release(sl2_global_region());
 }
 
 /*
@@ -115,13 +360,207 @@ static void wrap_pre_MapViewOfFile(void *wrapcxt, OUT void **user_data) {
   client.wrap_pre_MapViewOfFile(wrapcxt, user_data);
 }
 
+/** Transparent wrapper around SL2Client.wrap_pre_CloseHandle */
+static void wrap_pre_CloseHandle(void *wrapcxt, OUT void **user_data) {
+  client.wrap_pre_CloseHandle(wrapcxt, user_data);
+}
+
+/** Transparent wrapper around SL2Client.wrap_pre_DuplicateHandle */
+static void wrap_pre_DuplicateHandle(void *wrapcxt, OUT void **user_data) {
+  client.wrap_pre_DuplicateHandle(wrapcxt, user_data);
+}
+
+/** Transparent wrapper around SL2Client.wrap_post_DuplicateHandle */
+static void wrap_post_DuplicateHandle(void *wrapcxt, void *user_data) {
+  client.wrap_post_DuplicateHandle(wrapcxt, user_data);
+}
+
+/**
+ * A single hooked call, as the wizard reports it to the harness.
+ */
+struct sl2_wizard_call {
+  /*! The call's read info, for its function, return address, position and (lazy) argument hash */
+  client_read_info *info;
+  uint64_t callCount;
+  uint64_t retAddrCount;
+  /*! The resource that was read, or NULL if unknown */
+  const wchar_t *source;
+  /*! The range of the resource that was read, if the source is known */
+  size_t start;
+  size_t end;
+  /*! The first few bytes that were read */
+  const uint8_t *buffer;
+  size_t bufferSize;
+};
+
+/**
+ * Sends a finding for a hooked call to the harness.
+ * @param call the call
+ * @param argHash the call's argument hash, or NULL if it doesn't have one
+ * @param site if the call summarizes a call site, the summary
+ */
+static void emit_finding(const sl2_wizard_call &call, const char *argHash,
+                         const sl2_call_site *site) {
+  wstring_convert<std::codecvt_utf8<wchar_t>> utf8Converter;
+  sl2_event ev;
+
+  sl2_event_begin(&ev, "id");
+  sl2_event_uint(&ev, "callCount", call.callCount);
+  sl2_event_uint(&ev, "retAddrCount", call.retAddrCount);
+  sl2_event_uint(&ev, "retAddrOffset", (uint64_t)call.info->retAddrOffset);
+  sl2_event_str(&ev, "func_name", client.function_to_string(call.info->function));
+
+  if (call.source != NULL) {
+    sl2_event_str(&ev, "source", utf8Converter.to_bytes(wstring(call.source)).c_str());
+    sl2_event_uint(&ev, "start", call.start);
+    sl2_event_uint(&ev, "end", call.end);
+  }
+
+  if (argHash != NULL) {
+    sl2_event_str(&ev, "argHash", argHash);
+    sl2_event_uint(&ev, "argHashVersion", arg_hash_version);
+  }
+
+  sl2_event_bytes(&ev, "buffer", call.buffer, call.bufferSize);
+
+  if (site != NULL) {
+    sl2_event_uint(&ev, "calls", site->calls);
+    sl2_event_uint(&ev, "lastCallCount", site->lastCallCount);
+
+    if (op_influence.get_value()) {
+      sl2_event_uint(&ev, "influenceBlocks", site->influence.blocks);
+      sl2_event_uint(&ev, "influenceBranches", site->influence.branches);
+    }
+  }
+
+  client.emit_event(&ev);
+}
+
+/**
+ * Counts the code that runs after a call towards it (or its call site), for -influence.
+ * @param call the call
+ * @param site if the call is aggregated into a call site, the call site
+ */
+static void note_influence(const sl2_wizard_call &call, sl2_call_site *site) {
+  dr_mutex_lock(influence_lock);
+
+  current_call = std::make_pair(call.info->function, call.callCount);
+  current_call_seen = true;
+  current_influence = site ? &site->influence : NULL;
+
+  dr_mutex_unlock(influence_lock);
+}
+
 /**
- * Prints information about the function call caught by the pre-wrapper to stderr so the harness can
- * ingest it
+ * Sends the harness the influence of each call that was followed by new code, without
+ * -aggregate. With it, each call site's influence goes with its finding.
+ */
+static void emit_influence() {
+  for (auto &it : call_influence) {
+    sl2_event ev;
+    sl2_event_begin(&ev, "influence");
+    sl2_event_str(&ev, "func_name", client.function_to_string(it.first.first));
+    sl2_event_uint(&ev, "callCount", it.first.second);
+    sl2_event_uint(&ev, "influenceBlocks", it.second.blocks);
+    sl2_event_uint(&ev, "influenceBranches", it.second.branches);
+    client.emit_event(&ev);
+  }
+
+  call_influence.clear();
+  influence_blocks.clear();
+}
+
+/**
+ * Reports a hooked call: right away, or, with -aggregate, by folding it into its call site's
+ * summary. Only the first call at each site gets its arguments hashed and its buffer copied.
+ * @param call the call
+ */
+static void report_call(const sl2_wizard_call &call) {
+  if (!op_aggregate.get_value()) {
+    const char *argHash = call.info->argHash ? client.arg_hash(call.info, arg_hash_version) : NULL;
+    emit_finding(call, argHash, NULL);
+
+    if (influence_lock) {
+      note_influence(call, NULL);
+    }
+    return;
+  }
+
+  sl2_call_site_key key = {call.info->function, (uint64_t)call.info->retAddrOffset,
+                           call.source ? wstring(call.source) : wstring()};
+
+  dr_mutex_lock(call_sites_lock);
+
+  sl2_call_site_map::iterator it = call_sites.find(key);
+
+  if (it == call_sites.end()) {
+    sl2_call_site site = {0};
+    const char *argHash = call.info->argHash ? client.arg_hash(call.info, arg_hash_version) : NULL;
+
+    site.callCount = call.callCount;
+    site.retAddrCount = call.retAddrCount;
+    site.start = call.start;
+    site.end = call.end;
+
+    if (argHash != NULL) {
+      strncpy(site.argHash, argHash, SL2_HASH_LEN);
+      site.hasArgHash = true;
+    }
+
+    site.bufferSize = min(call.bufferSize, sizeof(site.buffer));
+    memcpy(site.buffer, call.buffer, site.bufferSize);
+
+    it = call_sites.insert(std::make_pair(key, site)).first;
+  } else {
+    it->second.start = min(it->second.start, call.start);
+    it->second.end = max(it->second.end, call.end);
+  }
+
+  it->second.calls++;
+  it->second.lastCallCount = call.callCount;
+
+  if (influence_lock) {
+    note_influence(call, &it->second);
+  }
+
+  dr_mutex_unlock(call_sites_lock);
+}
+
+/**
+ * Sends the harness one finding per call site, for its first call, once the target is done.
+ */
+static void emit_call_sites() {
+  for (auto &it : call_sites) {
+    const sl2_call_site_key &key = it.first;
+    const sl2_call_site &site = it.second;
+    client_read_info info = {0};
+    sl2_wizard_call call = {0};
+
+    info.function = key.function;
+    info.retAddrOffset = (size_t)key.retAddrOffset;
+
+    call.info = &info;
+    call.callCount = site.callCount;
+    call.retAddrCount = site.retAddrCount;
+    call.source = key.source.empty() ? NULL : key.source.c_str();
+    call.start = site.start;
+    call.end = site.end;
+    call.buffer = site.buffer;
+    call.bufferSize = site.bufferSize;
+
+    emit_finding(call, site.hasArgHash ? site.argHash : NULL, &site);
+  }
+
+  call_sites.clear();
+}
+
+/**
+ * Reports the function call caught by the pre-wrapper to the harness
  * @param wrapcxt DynamoRIO Wrap context. Only used as an argument to DynamoRIO's helper methods
  * @param user_data struct with metadata about the function call
  */
 static void wrap_post_Generic(void *wrapcxt, void *user_data) {
+  SL2_PROFILE(SL2_PROBE_POST_GENERIC);
   void *drcontext = NULL;
 
   if (!client.is_sane_post_hook(wrapcxt, user_data, &drcontext)) {
@@ -129,29 +568,17 @@ static void wrap_post_Generic(void *wrapcxt, void *user_data) {
     return;
   }
 
-  wstring_convert<std::codecvt_utf8<wchar_t>> utf8Converter;
-
   client_read_info *info = (client_read_info *)user_data;
-  const char *func_name = client.function_to_string(info->function);
+  sl2_wizard_call call = {0};
 
-  json j;
-  j["type"] = "id";
-  j["callCount"] = client.increment_call_count(info->function);
-  j["retAddrCount"] = client.increment_retaddr_count(info->retAddrOffset);
-  j["retAddrOffset"] = (uint64_t)info->retAddrOffset;
-  j["func_name"] = func_name;
+  call.info = info;
+  call.callCount = client.increment_call_count(info->function);
+  call.retAddrCount = client.increment_retaddr_count(info->retAddrOffset);
 
   if (info->source != NULL) {
-    wstring wsource = wstring(info->source);
-    j["source"] = utf8Converter.to_bytes(wsource);
-
-    size_t end = info->position + info->nNumberOfBytesToRead;
-    j["start"] = info->position;
-    j["end"] = end;
-  }
-
-  if (info->argHash != NULL) {
-    j["argHash"] = info->argHash;
+    call.source = info->source;
+    call.start = info->position;
+    call.end = info->position + info->nNumberOfBytesToRead;
   }
 
   if (info->function == Function::_read) {
@@ -163,20 +590,12 @@ static void wrap_post_Generic(void *wrapcxt, void *user_data) {
     info->nNumberOfBytesToRead = min(info->nNumberOfBytesToRead, (int)*(info->lpNumberOfBytesRead));
   }
 
-  vector<unsigned char> x((char *)info->lpBuffer,
-                          ((char *)info->lpBuffer) + min(info->nNumberOfBytesToRead, 64));
-  j["buffer"] = x;
+  call.buffer = (uint8_t *)info->lpBuffer;
+  call.bufferSize = min(info->nNumberOfBytesToRead, 64);
 
-  SL2_LOG_JSONL(j);
+  report_call(call);
 
-  if (info->source) {
-    dr_thread_free(drcontext, info->source, MAX_PATH + 1);
-  }
-  if (info->argHash) {
-    dr_thread_free(drcontext, info->argHash, SL2_HASH_LEN + 1);
-  }
-
-  dr_thread_free(drcontext, info, sizeof(client_read_info));
+  client.free_read_info(drcontext, info);
 }
 
 /**
@@ -184,6 +603,7 @@ static void wrap_post_Generic(void *wrapcxt, void *user_data) {
  * returns.
  */
 static void wrap_post_MapViewOfFile(void *wrapcxt, void *user_data) {
+  SL2_PROFILE(SL2_PROBE_POST_MAPVIEWOFFILE);
   void *drcontext = NULL;
   bool interesting_call = true;
 
@@ -193,18 +613,13 @@ static void wrap_post_MapViewOfFile(void *wrapcxt, void *user_data) {
   }
 
   client_read_info *info = ((client_read_info *)user_data);
-  const char *func_name = client.function_to_string(info->function);
+  sl2_wizard_call call = {0};
 
   info->lpBuffer = drwrap_get_retval(wrapcxt);
 
-  wstring_convert<std::codecvt_utf8<wchar_t>> utf8Converter;
-
-  json j;
-  j["type"] = "id";
-  j["callCount"] = client.increment_call_count(info->function);
-  j["retAddrCount"] = client.increment_retaddr_count(info->retAddrOffset);
-  j["retAddrOffset"] = (uint64_t)info->retAddrOffset;
-  j["func_name"] = func_name;
+  call.info = info;
+  call.callCount = client.increment_call_count(info->function);
+  call.retAddrCount = client.increment_retaddr_count(info->retAddrOffset);
 
   hash_context hash_ctx = {0};
 
@@ -231,46 +646,26 @@ static void wrap_post_MapViewOfFile(void *wrapcxt, void *user_data) {
 
     hash_ctx.readSize = info->nNumberOfBytesToRead;
 
-    j["source"] = utf8Converter.to_bytes(wstring(hash_ctx.fileName));
-
-    size_t end = info->position + info->nNumberOfBytesToRead;
-    j["start"] = info->position;
-    j["end"] = end;
+    call.source = hash_ctx.fileName;
+    call.start = info->position;
+    call.end = info->position + info->nNumberOfBytesToRead;
 
-    client.hash_args(info->argHash, &hash_ctx);
+    client.defer_hash_args(info, &hash_ctx);
 
-    j["argHash"] = info->argHash;
+    call.buffer = (uint8_t *)info->lpBuffer;
+    call.bufferSize = min(info->nNumberOfBytesToRead, 64);
 
-    vector<unsigned char> x((char *)info->lpBuffer,
-                            ((char *)info->lpBuffer) + min(info->nNumberOfBytesToRead, 64));
-    j["buffer"] = x;
-
-    SL2_LOG_JSONL(j);
+    report_call(call);
   }
 
-  dr_thread_free(drcontext, info->argHash, SL2_HASH_LEN + 1);
-  dr_thread_free(drcontext, info, sizeof(client_read_info));
+  client.free_read_info(drcontext, info);
 }
 
 /**
- * Called every time a module loads. Wraps target-able functions with pre and post callbacks
- * if they're in the right module.
- * @param drcontext - DynamoRIO context
- * @param mod Module Data
- * @param loaded Unused
+ * Indexes the read hooks by module, once, so that on_module_load only has to look up the loaded
+ * module's own. Unlike the fuzzer and tracer, the wizard hooks every function, targeted or not.
  */
-static void on_module_load(void *drcontext, const module_data_t *mod, bool loaded) {
-  if (!strcmp(dr_get_application_name(), dr_module_preferred_name(mod))) {
-    client.baseAddr = (size_t)mod->start;
-  }
-
-  json j;
-  j["type"] = "map";
-  j["start"] = (size_t)mod->start;
-  j["end"] = (size_t)mod->end;
-  j["mod_name"] = dr_module_preferred_name(mod);
-  SL2_LOG_JSONL(j);
-
+static void init_read_hooks() {
   sl2_pre_proto_map pre_hooks;
   SL2_PRE_HOOK1(pre_hooks, ReadFile);
   SL2_PRE_HOOK1(pre_hooks, InternetReadFile);
@@ -309,34 +704,74 @@ static void on_module_load(void *drcontext, const module_data_t *mod, bool loade
   SL2_POST_HOOK2(post_hooks, _read, Generic);
   SL2_POST_HOOK1(post_hooks, MapViewOfFile);
 
-  void(__cdecl * pre_hook)(void *, void **);
-  void(__cdecl * post_hook)(void *, void *);
+  client.init_module_hooks(pre_hooks, post_hooks, false);
+}
 
-  sl2_pre_proto_map::iterator it;
-  for (it = pre_hooks.begin(); it != pre_hooks.end(); it++) {
-    char *function_name = it->first;
+/**
+ * Called every time a module loads. Wraps target-able functions with pre and post callbacks
+ * if they're in the right module.
+ * @param drcontext - DynamoRIO context
+ * @param mod Module Data
+ * @param loaded Unused
+ */
+static void on_module_load(void *drcontext, const module_data_t *mod, bool loaded) {
+  if (!strcmp(dr_get_application_name(), dr_module_preferred_name(mod))) {
+    client.baseAddr = (size_t)mod->start;
+    app_start = mod->start;
+    app_end = mod->end;
+  }
 
-    pre_hook = it->second;
-    post_hook = post_hooks[function_name];
+  sl2_event ev;
+  sl2_event_begin(&ev, "map");
+  sl2_event_uint(&ev, "start", (size_t)mod->start);
+  sl2_event_uint(&ev, "end", (size_t)mod->end);
+  sl2_event_str(&ev, "mod_name", dr_module_preferred_name(mod));
+  if (mod->full_path != NULL) {
+    sl2_event_str(&ev, "path", mod->full_path);
+  }
+  client.emit_event(&ev);
+
+  // The application itself always counts, even if it's a Windows one.
+  if (influence_lock && mod->full_path != NULL &&
+      (mod->start == app_start || _strnicmp(mod->full_path, windows_dir, strlen(windows_dir)))) {
+    dr_mutex_lock(influence_lock);
+    if (influence_module_count < SL2_MAX_INFLUENCE_MODULES) {
+      influence_modules[influence_module_count++] = std::make_pair(mod->start, mod->end);
+    }
+    dr_mutex_unlock(influence_lock);
+  }
 
-    app_pc towrap = (app_pc)dr_get_proc_address(mod->handle, function_name);
-    const char *mod_name = dr_module_preferred_name(mod);
+  // Wrap CloseHandle and DuplicateHandle, so that the client knows when to forget the path it
+  // cached for a handle. See SL2Client::get_handle_path.
+  if (STREQI(dr_module_preferred_name(mod), "KERNELBASE.DLL")) {
+    app_pc towrap = (app_pc)dr_get_proc_address(mod->handle, "CloseHandle");
+    drwrap_wrap(towrap, wrap_pre_CloseHandle, NULL);
 
-    if (!client.function_is_in_expected_module(function_name, mod_name)) {
-      continue;
-    }
+    towrap = (app_pc)dr_get_proc_address(mod->handle, "DuplicateHandle");
+    drwrap_wrap(towrap, wrap_pre_DuplicateHandle, wrap_post_DuplicateHandle);
+  }
+
+  const sl2_module_hook *hooks;
+  size_t hook_count = client.hooks_for_module(dr_module_preferred_name(mod), &hooks);
+
+  for (size_t i = 0; i < hook_count; i++) {
+    const char *function_name = hooks[i].func;
+    app_pc towrap = (app_pc)dr_get_proc_address(mod->handle, function_name);
 
     if (towrap != NULL) {
       dr_flush_region(towrap, 0x1000);
-      bool ok = drwrap_wrap(towrap, pre_hook, post_hook);
-      json j;
+      bool ok = drwrap_wrap(towrap, hooks[i].pre_hook, hooks[i].post_hook);
 
       if (!ok) {
-        j["type"] = "error";
-        std::basic_ostringstream<char, std::char_traits<char>, sl2_dr_allocator<char>> s;
-        s << "FAILED to wrap " << function_name << " @ " << towrap << " already wrapped?";
-        j["msg"] = s.str();
-        SL2_LOG_JSONL(j);
+        char msg[256];
+        dr_snprintf(msg, sizeof(msg), "FAILED to wrap %s @ %p already wrapped?", function_name,
+                    towrap);
+        msg[sizeof(msg) - 1] = 0;
+
+        sl2_event err;
+        sl2_event_begin(&err, "error");
+        sl2_event_str(&err, "msg", msg);
+        client.emit_event(&err);
       }
     }
   }
@@ -354,6 +789,13 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]) {
 
   dr_enable_console_printing();
 
+  if (op_arg_hash.get_value() == "fnv1a64") {
+    arg_hash_version = SL2_ARG_HASH_FNV1A64;
+  } else if (op_arg_hash.get_value() != "sha256") {
+    SL2_DR_DEBUG("wizard#main: unknown argument hash: %s\n", op_arg_hash.get_value().c_str());
+    dr_abort();
+  }
+
   drreg_options_t ops = {sizeof(ops), 3, false};
   dr_set_client_name("Wizard", "https://github.com/trailofbits/sienna-locomotive");
 
@@ -361,9 +803,31 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]) {
     DR_ASSERT(false);
   }
 
+  if (op_profile.get_value() || op_alloc_steady.get_value()) {
+    client.init_profile(op_alloc_steady.get_value());
+  }
+
   dr_register_exit_event(on_dr_exit);
 
+  cmp_lock = dr_mutex_create();
+  call_sites_lock = dr_mutex_create();
+
+  if (op_influence.get_value()) {
+    GetWindowsDirectoryA(windows_dir, MAX_PATH + 1);
+    influence_lock = dr_mutex_create();
+
+    if (!drmgr_register_bb_app2app_event(on_bb_influence, NULL)) {
+      DR_ASSERT(false);
+    }
+  }
+
+  client.init_events(op_events.get_value().c_str());
+  client.init_read_info_pool();
+  client.init_handle_cache();
+  init_read_hooks();
+
   if (!drmgr_register_module_load_event(on_module_load) ||
+      !drmgr_register_bb_app2app_event(on_bb_cmp, NULL) ||
       !drmgr_register_thread_init_event(on_thread_init) ||
       !drmgr_register_thread_exit_event(on_thread_exit) ||
       !drmgr_register_exception_event(on_exception)) {